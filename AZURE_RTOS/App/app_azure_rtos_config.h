@@ -43,9 +43,12 @@ extern "C" {
 
 #define USE_STATIC_ALLOCATION                    1
 
-#define TX_APP_MEM_POOL_SIZE                     1024
+/* Nothing allocates from the ThreadX app pool (every thread stack is
+   static); the USBX one holds the USB app thread's stack only, as the USB
+   device runs on the HAL PCD driver (usb_cdc.c) with its buffers in .bss. */
+#define TX_APP_MEM_POOL_SIZE                     256
 
-#define UX_DEVICE_APP_MEM_POOL_SIZE              1024
+#define UX_DEVICE_APP_MEM_POOL_SIZE              640
 
 /* USER CODE BEGIN EC */
 
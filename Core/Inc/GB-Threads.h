@@ -1,10 +1,114 @@
 #pragma once
 #include "tx_api.h"
+#include <stdint.h>
 
-/* ------ Telemetry Thread ------ */
-extern TX_THREAD telemetry_thread;
-extern ULONG telemetry_thread_stack[];
+/* ------ Telemetry Threads ------ */
+/* Ingest (RX), TX dispatch and maintenance stages; see telemetry_thread.c. */
+extern TX_THREAD telemetry_rx_thread;
+extern TX_THREAD telemetry_tx_thread;
+extern TX_THREAD telemetry_maint_thread;
 
-void telemetry_thread_entry(ULONG initial_input);
+/* Wake-up reasons for the telemetry threads (event flags). */
+#define TELEMETRY_EVT_CAN_RX    0x1u  /* CAN ISR queued frames */
+#define TELEMETRY_EVT_TX_QUEUED 0x2u  /* packet queued on the router */
+#define TELEMETRY_EVT_USB_RX    0x4u  /* USB CDC bytes received */
+#define TELEMETRY_EVT_UART_RX   0x8u  /* UART link bytes received */
+#define TELEMETRY_EVT_CAN_PACK  0x10u /* packed CAN frame is due */
+#define TELEMETRY_EVT_CAN_TX    0x20u /* CAN TX ring has room again */
+#define TELEMETRY_EVT_GS_TX     0x40u /* gs_usb host frames to send */
+#define TELEMETRY_EVT_SPI_RX    0x80u /* SPI link transaction received */
+#define TELEMETRY_EVT_RX_ALL    (TELEMETRY_EVT_CAN_RX | TELEMETRY_EVT_USB_RX | \
+                                 TELEMETRY_EVT_UART_RX | TELEMETRY_EVT_CAN_PACK | \
+                                 TELEMETRY_EVT_SPI_RX)
+#define TELEMETRY_EVT_TX_ALL    (TELEMETRY_EVT_TX_QUEUED | TELEMETRY_EVT_CAN_TX | \
+                                 TELEMETRY_EVT_GS_TX)
+
+void telemetry_rx_thread_entry(ULONG initial_input);
+void telemetry_tx_thread_entry(ULONG initial_input);
+void telemetry_maint_thread_entry(ULONG initial_input);
 void create_telemetry_thread(void);
-/* ------ Telemetry Thread ------ */
+
+/* Wake the telemetry thread(s) waiting for `flags`. Safe from ISRs and
+ * before the threads exist. */
+void telemetry_thread_notify(ULONG flags);
+/* ------ Telemetry Threads ------ */
+
+/* ------ Telemetry Scheduler Thread ------ */
+/* Samples the sources registered with telemetry_sched_add(). */
+extern TX_THREAD telemetry_sched_thread;
+
+void telemetry_sched_thread_entry(ULONG initial_input);
+void create_telemetry_sched_thread(void);
+/* ------ Telemetry Scheduler Thread ------ */
+
+/* ------ CPU Load Monitor Thread ------ */
+/* Only runs with TX_EXECUTION_PROFILE_ENABLE; otherwise create is a no-op. */
+void create_cpu_load_thread(void);
+
+/* Share of the last window in per mille, CPU_LOAD_UNKNOWN before the first
+ * window, for a thread it didn't see, or without the profile. */
+#define CPU_LOAD_UNKNOWN 0xFFFFu
+uint16_t cpu_load_thread_permille(const TX_THREAD *t);
+uint16_t cpu_load_isr_permille(void);
+uint16_t cpu_load_idle_permille(void);
+/* ------ CPU Load Monitor Thread ------ */
+
+/* ------ Loopback Bench Thread ------ */
+/* Only with TELEMETRY_BENCH (see telemetry_bench.h); otherwise a no-op. */
+extern TX_THREAD telemetry_bench_thread;
+
+void telemetry_bench_thread_entry(ULONG initial_input);
+void create_telemetry_bench_thread(void);
+/* ------ Loopback Bench Thread ------ */
+
+/* ------ Microbenchmark Thread ------ */
+/* Only with MICROBENCH_ENABLED (see microbench.h); otherwise a no-op. */
+void create_microbench_thread(void);
+/* ------ Microbenchmark Thread ------ */
+
+/* ------ Time-Sync Bench Thread ------ */
+/* Only with TIMESYNC_BENCH_ENABLED (see timesync_bench.h); otherwise a no-op. */
+void create_timesync_bench_thread(void);
+/* ------ Time-Sync Bench Thread ------ */
+
+/* ------ I2C Bus Thread ------ */
+/* Queues the periodic device polls of i2c_bus.h. */
+extern TX_THREAD i2c_bus_thread;
+
+void i2c_bus_thread_entry(ULONG initial_input);
+void create_i2c_bus_thread(void);
+/* ------ I2C Bus Thread ------ */
+
+/* ------ DSP Filter Thread ------ */
+/* Runs the FMAC / CORDIC filter channels of dsp_filter.h. */
+extern TX_THREAD dsp_filter_thread;
+
+void dsp_filter_thread_entry(ULONG initial_input);
+void create_dsp_filter_thread(void);
+/* ------ DSP Filter Thread ------ */
+
+/* ------ SD Card Logger Thread ------ */
+/* Only with SD_LOG_ENABLED (see sd_log.h). */
+extern TX_THREAD sd_log_thread;
+
+void sd_log_thread_entry(ULONG initial_input);
+void create_sd_log_thread(void);
+/* ------ SD Card Logger Thread ------ */
+
+/* ------ USB Disk Thread ------ */
+/* Only with USB_MSC_ENABLED (see usb_msc.h). */
+extern TX_THREAD usb_msc_thread;
+
+void usb_msc_thread_entry(ULONG initial_input);
+void create_usb_msc_thread(void);
+/* ------ USB Disk Thread ------ */
+
+/* ------ Application Task Threads ------ */
+/* One worker per APP_TASK_LEVEL_*; only with APP_TASK_ENABLED (app_task.h). */
+void create_app_task_threads(void);
+/* ------ Application Task Threads ------ */
+
+/* ------ Coroutine Thread ------ */
+/* Runs the driver coroutines of coro.h; only with CORO_ENABLED. */
+void create_coro_thread(void);
+/* ------ Coroutine Thread ------ */
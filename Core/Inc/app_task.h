@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Periodic application tasks, built with APP_TASK_ENABLED (CMake option
+ * ENABLE_APP_TASKS). Instead of a thread and a sleep loop per job, a task
+ * registers a callback with a period, a level and a deadline; the callback
+ * runs to completion once per release.
+ *
+ * Each level is one worker thread (create_app_task_threads(), GB-Threads.h)
+ * at a fixed ThreadX priority, so all tasks of a level share its stack.
+ * Levels preempt each other by priority; within a level the released task
+ * with the earliest deadline runs first. Releases fall on ThreadX ticks:
+ * the worker sleeps to the next one with nothing spinning in between.
+ *
+ * Per task the framework records release jitter (release tick to callback
+ * start, measured against the SysTick phase in microseconds), execution time
+ * (us_clock) and deadline misses (callback finished more than the deadline
+ * after its release). A task still running, or waiting behind others of its
+ * level, when a later release is due drops the releases in between
+ * (`skipped`) instead of running them back to back.
+ */
+
+#ifndef APP_TASK_MAX
+#define APP_TASK_MAX 16u
+#endif
+
+/* Worker levels, highest priority first (ThreadX priorities in app_task.c). */
+#define APP_TASK_LEVEL_HIGH 0u   /* control loops, above the I2C polls */
+#define APP_TASK_LEVEL_NORMAL 1u /* sensor processing, below the DSP work */
+#define APP_TASK_LEVEL_LOW 2u    /* housekeeping, below the SD log writer */
+#define APP_TASK_LEVELS 3u
+
+typedef void (*app_task_fn_t)(void *user);
+
+typedef struct {
+  const char *name;     /* kept, not copied */
+  app_task_fn_t run;
+  void *user;
+  uint32_t period_ms;   /* whole ThreadX ticks at the default 1 kHz */
+  uint32_t deadline_us; /* from release; 0 = the period */
+  uint32_t offset_ms;   /* first release this long after registration */
+  uint8_t level;        /* APP_TASK_LEVEL_* */
+} app_task_t;
+
+typedef struct {
+  const char *name;
+  uint32_t releases;       /* callbacks started */
+  uint32_t misses;         /* finished past the deadline */
+  uint32_t skipped;        /* releases dropped because the level ran late */
+  uint32_t jitter_last_us;
+  uint32_t jitter_max_us;
+  uint32_t exec_last_us;
+  uint32_t exec_max_us;
+  uint64_t exec_total_us;  /* / releases for the mean */
+} app_task_stats_t;
+
+#ifdef APP_TASK_ENABLED
+
+/*
+ * Register a task (copied, but for `name`). Returns its handle, or -1 if
+ * the table (APP_TASK_MAX) is full or `task` is invalid. Any context but an
+ * ISR; before the kernel starts too.
+ */
+int app_task_add(const app_task_t *task);
+
+/* Stop releasing the task behind `handle`; a run in progress completes. */
+void app_task_remove(int handle);
+
+/* Stats of `handle`; 0 when it's not a registered task. */
+int app_task_get_stats(int handle, app_task_stats_t *out);
+
+#else
+
+static inline int app_task_add(const app_task_t *task) {
+  (void)task;
+  return -1;
+}
+static inline void app_task_remove(int handle) { (void)handle; }
+static inline int app_task_get_stats(int handle, app_task_stats_t *out) {
+  (void)handle;
+  (void)out;
+  return 0;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
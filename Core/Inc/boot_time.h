@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Boot phase timestamps, from reset to the first CAN frame out. DWT->CYCCNT
+ * is started from Reset_Handler (boot_early_init()) and each phase keeps the
+ * cycle count it was first reached at; the report converts with the core
+ * clock of each interval, HSI until the PLL is up.
+ *
+ * Fast boot (TELEMETRY_FAST_BOOT, CMake option ENABLE_FAST_BOOT):
+ *  - boot_early_init() switches to the 170 MHz PLL before the startup code
+ *  copies .data and zeroes .bss, so that runs 10x faster;
+ *  - raw data buffers (RX, capture, black box, console, USB) go into noinit
+ *  sections (RAM_NOINIT / CCM_NOINIT in mem_sections.h), their owners
+ *  initialize only the indices.
+ */
+
+typedef enum {
+  BOOT_MAIN = 0, /* main() entered: .data copied, .bss zeroed */
+  BOOT_HAL,      /* HAL_Init() done */
+  BOOT_CLOCK,    /* SystemClock_Config() done */
+  BOOT_DRIVERS,  /* peripherals and drivers up, entering tx_kernel_enter() */
+  BOOT_KERNEL,   /* tx_application_define() entered */
+  BOOT_ROUTER,   /* telemetry router created */
+  BOOT_THREADS,  /* telemetry RX thread running */
+  BOOT_CAN_TX,   /* first CAN frame handed to the controller */
+  BOOT_PHASE_COUNT
+} boot_phase_t;
+
+/* From Reset_Handler before .data/.bss exist: touches registers only. */
+void boot_early_init(void);
+
+extern volatile uint32_t g_boot_reached; /* bit per phase */
+
+void boot_time_mark_slow(boot_phase_t ph);
+
+/* Record `ph` the first time it is reached; a load and a test after that. */
+static inline void boot_time_mark(boot_phase_t ph) {
+  if (!(g_boot_reached & (1u << ph))) boot_time_mark_slow(ph);
+}
+
+/* Microseconds from reset to `ph`; 0 if not reached yet. */
+uint32_t boot_time_us(boot_phase_t ph);
+
+/* One MESSAGE_DATA line "boot us main=.. hal=.. ... can_tx=..", once, after
+ * the first CAN frame; later calls do nothing. Thread context. */
+void boot_time_report(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "can_bus.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Windowed bulk transfers over the CAN FD driver, for payloads past what
+ * can_bus_send_large() can describe (64 KB, 255 fragments) or reassemble
+ * (CAN_BUS_REASM_MAX_BYTES): log pulls, firmware images. Every data frame
+ * carries a 32-bit byte offset, so a transfer runs to 4 GB and its size is
+ * set by whatever produces or stores it, not by header fields.
+ *
+ * Neither end holds the whole transfer. The sender pulls bytes from a
+ * source callback as the window moves; the receiver hands them, in order,
+ * to a sink callback as they arrive. The receiver acknowledges with its
+ * next expected offset and a window; the sender keeps up to that window in
+ * flight and goes back N to the acknowledged offset on a gap or timeout.
+ * A sink that can't take bytes yet (flash busy) just refuses them and they
+ * come again, so a slow sink paces the sender.
+ *
+ * Like isotp.h each session is one (tx_id, rx_id) pair claimed with
+ * can_bus_subscribe_id(), rx_id must pass the hardware filters, and
+ * everything runs in the thread calling can_bus_process_rx() and
+ * can_bulk_poll(). A session sends and receives one transfer at a time in
+ * each direction.
+ */
+
+#ifndef CAN_BULK_MAX_SESSIONS
+#define CAN_BULK_MAX_SESSIONS 2u
+#endif
+
+/* Copy up to `len` bytes at offset `off` of the transfer to `dst`; return
+ * the count (0 = nothing available yet, asked again on the next poll). */
+typedef size_t (*can_bulk_source_t)(uint32_t off, uint8_t *dst, size_t len,
+                                    void *user);
+
+/*
+ * `len` bytes at offset `off` of a `total`-byte transfer, in order, with
+ * CAN_BUS_STREAM_START / END / ABORT marks (ABORT carries no data). Return
+ * 0 once taken, non-zero to refuse them for now: they are sent again.
+ */
+typedef int (*can_bulk_sink_t)(const uint8_t *data, size_t len, uint32_t off,
+                               uint32_t total, uint8_t flags, void *user);
+
+/* End of a can_bulk_send(): HAL_OK once the receiver has acknowledged every
+ * byte, HAL_ERROR if it aborted, HAL_TIMEOUT if it stopped answering. */
+typedef void (*can_bulk_tx_done_cb_t)(HAL_StatusTypeDef status, void *user);
+
+typedef struct {
+  can_bus_t *bus;  /* controller the session runs on (can_bus_get()) */
+  uint16_t tx_id;  /* our frames, data and acknowledgements */
+  uint16_t rx_id;  /* the peer's frames */
+  uint8_t window;  /* frames we let a sender have in flight, 1-255;
+                      0 = CAN_BULK_DEFAULT_WINDOW */
+  can_bulk_sink_t sink; /* inbound transfers; NULL refuses them */
+  can_bulk_tx_done_cb_t on_tx_done; /* optional */
+  void *user;
+} can_bulk_config_t;
+
+typedef struct {
+  uint32_t rx_xfers;
+  uint32_t tx_xfers;
+  uint32_t rx_aborted; /* peer abort, timeout, refused */
+  uint32_t tx_aborted; /* peer abort, retries used up */
+  uint32_t rewinds;    /* go-back-N: gap reported or ack timeout */
+  uint64_t rx_bytes;   /* taken by sinks */
+  uint64_t tx_bytes;   /* acknowledged */
+} can_bulk_stats_t;
+
+/*
+ * Start a session; `cfg` is copied. Returns HAL_ERROR if rx_id is already
+ * claimed on the CAN driver or the table (CAN_BULK_MAX_SESSIONS) is full.
+ */
+HAL_StatusTypeDef can_bulk_open(const can_bulk_config_t *cfg);
+
+/* End the session on `rx_id`; transfers in progress are aborted and the
+ * peer told so. */
+void can_bulk_close(uint16_t rx_id);
+
+/*
+ * Start sending a `total`-byte transfer (1 to 2^32-1) read from `src` on the
+ * session for `rx_id`; `src` is called from can_bulk_poll() until on_tx_done
+ * runs. Returns HAL_BUSY if a send is in progress or the start can't be
+ * queued, HAL_ERROR for an unknown session or a bad argument.
+ */
+HAL_StatusTypeDef can_bulk_send(uint16_t rx_id, uint32_t total,
+                                can_bulk_source_t src, void *src_user);
+
+/* Stop the send on `rx_id`; the peer is told and on_tx_done gets HAL_ERROR. */
+void can_bulk_cancel(uint16_t rx_id);
+
+/*
+ * Send what the window allows, resend on timeout and expire stalled
+ * transfers. Call after can_bus_process_rx(). Returns the ms until it next
+ * has work (UINT32_MAX if idle), for bounding the caller's wait.
+ */
+uint32_t can_bulk_poll(void);
+
+/* Counters summed over all sessions. */
+void can_bulk_get_stats(can_bulk_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,41 +8,986 @@
 extern "C" {
 #endif
 
+/*
+ * One driver instance per FDCAN controller (CAN_BUS_INSTANCES in can_bus.c),
+ * each with its own queues, reassembly, subscribers and statistics. Every
+ * call below acts on the instance it is given.
+ */
+typedef struct can_bus can_bus_t;
+
 typedef void (*can_bus_rx_cb_t)(const uint8_t *data, size_t len, void *user);
 
-/* Init with the FDCAN handle that receives on FIFO1 (e.g. &hfdcan2). */
-void can_bus_init(FDCAN_HandleTypeDef *hfdcan);
+/* One message with the standard ID it arrived on (the base ID for
+ * extended-ID fragments) and the start-of-frame time of its first frame. */
+typedef void (*can_bus_msg_cb_t)(const uint8_t *data, size_t len,
+                                 uint16_t std_id, uint64_t ts_us, void *user);
+
+/* One received message, pointing into driver-owned storage. */
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+} can_bus_msg_t;
+
+typedef void (*can_bus_rx_batch_cb_t)(const can_bus_msg_t *msgs, size_t count,
+                                      void *user);
+
+/* One raw frame on a claimed ID, with its start-of-frame time (see
+ * can_bus_time_us()). */
+typedef void (*can_bus_frame_cb_t)(const uint8_t *data, size_t len,
+                                   uint64_t ts_us, void *user);
+
+/* Marks on streamed message chunks (can_bus_subscribe_stream()). */
+#define CAN_BUS_STREAM_START 0x01u /* first chunk, offset 0 */
+#define CAN_BUS_STREAM_END 0x02u   /* last chunk; the message is complete */
+#define CAN_BUS_STREAM_ABORT 0x04u /* given up (timeout, eviction); no data */
+
+/* `len` bytes at message offset `off` of a `total_len` message, in order. */
+typedef void (*can_bus_stream_cb_t)(const uint8_t *data, size_t len,
+                                    size_t off, size_t total_len,
+                                    uint16_t std_id, uint8_t flags,
+                                    void *user);
 
-/* Send raw bytes (len clamped to 64). */
-HAL_StatusTypeDef can_bus_send_bytes(const uint8_t *bytes, size_t len, uint32_t std_id);
+/* Build the reply to `req` into `reply` (64 bytes) and return its length,
+ * or 0 for no reply. Runs in the FIFO0 RX ISR; keep it short. */
+typedef size_t (*can_bus_responder_cb_t)(const uint8_t *req, size_t len,
+                                         uint64_t ts_us, uint8_t *reply,
+                                         void *user);
 
-/* Send an arbitrarily large buffer by fragmenting into multiple CAN FD frames. */
-HAL_StatusTypeDef can_bus_send_large(const uint8_t *bytes, size_t len, uint32_t std_id);
+/* Called from a low-priority pended interrupt after the RX ISR queued
+ * frames; ThreadX ISR-safe calls are fine here. */
+typedef void (*can_bus_rx_notify_cb_t)(void);
 
 /*
- * MUST be called periodically from thread/main-loop context.
- * This drains the ISR RX ring, performs reassembly, and invokes subscribers.
+ * Hardware acceptance filters (11-bit standard IDs). With extended-ID
+ * fragments (CAN_BUS_FRAG_EXT_ID in can_bus.c) each entry also covers the
+ * fragments sent under the IDs it matches.
+ */
+#define CAN_BUS_MAX_STD_FILTERS 28u
+
+typedef enum {
+  CAN_BUS_FILTER_ID_LIST = 0, /* accept id1 and id2 (id2 = id1 for one ID) */
+  CAN_BUS_FILTER_ID_RANGE,    /* accept id1..id2 inclusive */
+  CAN_BUS_FILTER_ID_MASK,     /* accept when (id & id2) == (id1 & id2) */
+} can_bus_filter_type_t;
+
+typedef enum {
+  CAN_BUS_RX_FIFO0 = 0,
+  CAN_BUS_RX_FIFO1 = 1,
+} can_bus_rx_fifo_t;
+
+typedef struct {
+  can_bus_filter_type_t type;
+  uint16_t id1;
+  uint16_t id2;
+  can_bus_rx_fifo_t fifo; /* which hardware FIFO accepted frames land in */
+} can_bus_filter_t;
+
+/*
+ * Init an instance for an FDCAN handle (e.g. &hfdcan2); calling it again with
+ * the same handle re-initializes that instance.
+ * Re-applies bit timing from the built-in table for the current FDCAN kernel
+ * clock (CAN_BUS_NOMINAL_BITRATE / CAN_BUS_DATA_BITRATE, FD+BRS by default).
+ * Returns HAL_ERROR if no table entry matches; the controller is still
+ * started with the CubeMX timing in that case. Also HAL_ERROR (nothing
+ * started) when all CAN_BUS_INSTANCES are taken.
+ * With CAN_BUS_AUTOBAUD (CMake option ENABLE_CAN_AUTOBAUD) and the handle in
+ * normal mode, it first listens in bus monitoring mode with each table rate
+ * for the kernel clock and starts at the one that decodes the bus (up to
+ * CAN_BUS_AUTOBAUD_TIMEOUT_MS, blocking; configured rates on a quiet bus);
+ * see can_bus_get_bitrate().
+ * FIFO1 interrupts are coalesced (see CAN_BUS_RX_COALESCE_FIFO in can_bus.c);
+ * FIFO0 interrupts on every frame.
+ */
+HAL_StatusTypeDef can_bus_init(FDCAN_HandleTypeDef *hfdcan);
+
+/* Instance `index` in can_bus_init() order, or NULL. */
+can_bus_t *can_bus_get(unsigned index);
+
+typedef struct {
+  uint32_t nominal_bps; /* running at */
+  uint32_t data_bps;
+  uint8_t detected;     /* picked by CAN_BUS_AUTOBAUD from bus traffic */
+  uint8_t data_checked; /* ... including a BRS frame at data_bps */
+  uint8_t listen_only;
+  uint16_t tried;       /* rates listened to */
+} can_bus_bitrate_t;
+
+void can_bus_get_bitrate(can_bus_t *bus, can_bus_bitrate_t *out);
+
+/*
+ * Passive capture: with `on`, the controller only listens (bus monitoring
+ * mode). It sends no ACK or error frame, so a node with a wrong rate or an
+ * analyser tap can't disturb the bus; RX, subscribers and the monitor work
+ * as usual. Frames queued meanwhile are held (direct sends fail) and go out
+ * when it's turned off. Restarts the controller; thread context. The mode
+ * survives can_bus_init().
+ */
+HAL_StatusTypeDef can_bus_set_listen_only(can_bus_t *bus, int on);
+
+/*
+ * FDCAN interrupt line handler: call from the controller's IT0 (line 0) and
+ * IT1 (line 1) IRQ handlers in place of HAL_FDCAN_IRQHandler().
+ */
+void can_bus_irq(FDCAN_HandleTypeDef *hfdcan, unsigned line);
+
+/*
+ * Program the FDCAN standard-ID filter list. Frames that match no entry are
+ * rejected in hardware and never reach the ISR. count == 0 restores the
+ * default accept-all (into FIFO1). The controller is briefly stopped if it
+ * was running: queued frames stay in the TX rings, and those already in the
+ * hardware FIFO are given CAN_BUS_FILTER_DRAIN_MS (can_bus.c) to go out,
+ * busy-waiting. Any still pending then (no ACK, a saturated bus) are
+ * dropped and counted in can_bus_monitor_t.tx_flushed; a fragmented message
+ * they belonged to is lost. Call from thread context. Returns HAL_ERROR on
+ * a bad table or if not initialized.
+ */
+HAL_StatusTypeDef can_bus_set_filters(can_bus_t *bus,
+                                      const can_bus_filter_t *filters,
+                                      size_t count);
+
+/*
+ * TX priority classes, each with its own queue. Pending frames of a higher
+ * class always reach the controller first; use lower CAN IDs for higher
+ * classes so arbitration on the bus agrees.
+ */
+typedef enum {
+  CAN_BUS_TX_PRIO_HIGH = 0, /* time sync */
+  CAN_BUS_TX_PRIO_MID,      /* errors, commands */
+  CAN_BUS_TX_PRIO_LOW,      /* bulk telemetry */
+  CAN_BUS_TX_PRIO_COUNT
+} can_bus_tx_prio_t;
+
+/*
+ * Queue raw bytes for transmit (len clamped to 64) in the bulk class.
+ * Returns HAL_BUSY if the TX ring is full.
+ */
+HAL_StatusTypeDef can_bus_send_bytes(can_bus_t *bus, const uint8_t *bytes,
+                                     size_t len, uint32_t std_id);
+
+/* As can_bus_send_bytes(), in the given priority class. */
+HAL_StatusTypeDef can_bus_send_bytes_prio(can_bus_t *bus, const uint8_t *bytes,
+                                          size_t len, uint32_t std_id,
+                                          can_bus_tx_prio_t prio);
+
+/*
+ * Send an arbitrarily large buffer by fragmenting into multiple CAN FD frames.
+ * All fragments are queued at once (bulk class) and drained by the
+ * TX-complete interrupt; returns HAL_BUSY (nothing queued) if the TX ring
+ * can't hold the message. Fragments are 64-byte frames, or shorter ones
+ * when the bus is seeing errors or bulk frames are time-limited
+ * (can_bus_set_frag_block_us()). Fragments carry a payload header on `std_id`, or
+ * with CAN_BUS_FRAG_EXT_ID go out as extended IDs built from it. Past 64 KB
+ * or 255 fragments use can_bulk.h.
+ */
+HAL_StatusTypeDef can_bus_send_large(can_bus_t *bus, const uint8_t *bytes,
+                                     size_t len, uint32_t std_id);
+
+/* As can_bus_send_large(), in the given priority class. */
+HAL_StatusTypeDef can_bus_send_large_prio(can_bus_t *bus, const uint8_t *bytes,
+                                          size_t len, uint32_t std_id,
+                                          can_bus_tx_prio_t prio);
+
+/*
+ * Transport profile for traffic on a standard ID, for both directions.
+ * CLASSIC is for IDs shared with classic-CAN (8-byte) nodes: everything sent
+ * on them goes out as classic frames, fragmented messages with a 1-2 byte
+ * header (up to 64 frames, 447 bytes), and every frame received on them that
+ * isn't claimed with can_bus_subscribe_id() is taken as such a fragment.
+ * Only one node may send fragmented messages on a CLASSIC ID.
+ */
+typedef enum {
+  CAN_BUS_PROFILE_FD = 0, /* 64-byte FD frames, the default */
+  CAN_BUS_PROFILE_CLASSIC
+} can_bus_profile_t;
+
+/*
+ * Set the profile of `std_id`; CAN_BUS_PROFILE_FD removes its entry.
+ * Returns HAL_ERROR if the table (CAN_BUS_PEER_PROFILES) is full.
  */
-void can_bus_process_rx(void);
+HAL_StatusTypeDef can_bus_set_peer_profile(can_bus_t *bus, uint16_t std_id,
+                                           can_bus_profile_t profile);
+
+/* Profile of `std_id`; isotp.h and can_bulk.h size their frames by it. */
+can_bus_profile_t can_bus_get_peer_profile(can_bus_t *bus, uint16_t std_id);
+
+/* One segment of a scatter-gather message. */
+typedef struct {
+  const void *base;
+  size_t len;
+} can_bus_iovec_t;
+
+/*
+ * As can_bus_send_large(), with the message given as `iovcnt` segments sent
+ * back to back (empty ones allowed), so callers don't assemble a contiguous
+ * buffer. Each byte is copied once, into the TX ring or, while nothing is
+ * queued ahead of it, straight into the hardware TX FIFO. Bulk class.
+ */
+HAL_StatusTypeDef can_bus_sendv(can_bus_t *bus, const can_bus_iovec_t *iov,
+                                size_t iovcnt, uint32_t std_id);
+
+/* As can_bus_sendv(), in the given priority class. */
+HAL_StatusTypeDef can_bus_sendv_prio(can_bus_t *bus, const can_bus_iovec_t *iov,
+                                     size_t iovcnt, uint32_t std_id,
+                                     can_bus_tx_prio_t prio);
+
+/*
+ * Completion of can_bus_send_async(): HAL_OK once every fragment has left
+ * the hardware TX FIFO, HAL_ERROR if one of them failed for good (see
+ * can_bus_tx_event_stats_t). Runs in the TX interrupt with IRQs enabled;
+ * it must not send on the bus (the TX rings have one producer), so wake
+ * the sending thread instead.
+ */
+typedef void (*can_bus_tx_done_cb_t)(void *user, HAL_StatusTypeDef status);
+
+/*
+ * As can_bus_send_large_prio(), without copying `buf`: the queued
+ * fragments point into it and are read as they go into the hardware TX
+ * FIFO, so `buf` must stay as it is until `done` runs, and may be reused
+ * from then on. Up to CAN_BUS_ASYNC_SLOTS (can_bus.c) messages can be in
+ * flight; past that, or with the TX ring full, HAL_BUSY (the tx notify
+ * callback then says when to retry). HAL_ERROR for a bad argument, a
+ * CLASSIC-profile ID, or with async sends compiled out. No parity
+ * fragments go with these messages.
+ */
+HAL_StatusTypeDef can_bus_send_async_prio(can_bus_t *bus, const void *buf,
+                                          size_t len, uint32_t std_id,
+                                          can_bus_tx_prio_t prio,
+                                          can_bus_tx_done_cb_t done,
+                                          void *user);
+
+/* As can_bus_send_async_prio(), in the bulk class. */
+HAL_StatusTypeDef can_bus_send_async(can_bus_t *bus, const void *buf,
+                                     size_t len, uint32_t std_id,
+                                     can_bus_tx_done_cb_t done, void *user);
+
+typedef struct {
+  uint32_t sent;    /* messages queued */
+  uint32_t done;    /* callbacks run */
+  uint32_t failed;  /* ...with HAL_ERROR */
+  uint32_t no_slot; /* HAL_BUSY: every slot in flight */
+} can_bus_async_stats_t;
+
+void can_bus_get_async_stats(can_bus_t *bus, can_bus_async_stats_t *out);
+
+/* An open TX reservation; `frag_cnt` is for the caller, the rest private. */
+typedef struct {
+  uint32_t std_id;
+  uint16_t len;  /* reserved bytes, 0 once committed or cancelled */
+  uint16_t head; /* first reserved ring slot */
+  uint8_t prio;
+  uint8_t frag_cnt;
+} can_bus_tx_resv_t;
+
+/*
+ * Zero-copy send: reserve room for a `len`-byte fragmented message in the TX
+ * ring of `prio`, write the message into spans 0..frag_cnt-1 in order (the
+ * frames' payload areas, see can_bus_tx_span()), then commit the bytes
+ * actually written (<= len) or cancel. Receivers see the same wire format as
+ * can_bus_send_large(). Nothing else may be sent in the class while the
+ * reservation is open; commit then fails with HAL_ERROR. Not available on
+ * CAN_BUS_PROFILE_CLASSIC IDs (HAL_ERROR).
+ * Returns HAL_BUSY (nothing reserved) if the ring can't hold the message.
+ */
+HAL_StatusTypeDef can_bus_tx_reserve(can_bus_t *bus, size_t len,
+                                     uint32_t std_id, can_bus_tx_prio_t prio,
+                                     can_bus_tx_resv_t *rv);
+
+/*
+ * Writable area of reserved fragment `idx` and its size in *len; NULL past
+ * the last one. Span sizes are fixed at reserve time.
+ */
+uint8_t *can_bus_tx_span(can_bus_t *bus, const can_bus_tx_resv_t *rv,
+                         size_t idx, size_t *len);
+
+/* Queue the first `used` bytes of the reservation. */
+HAL_StatusTypeDef can_bus_tx_commit(can_bus_t *bus, can_bus_tx_resv_t *rv,
+                                    size_t used);
+
+/* Drop the reservation without sending anything. */
+void can_bus_tx_cancel(can_bus_tx_resv_t *rv);
+
+/*
+ * Queue a small message (up to 61 bytes) for packing with others into one
+ * frame, sent when full, when another message of the same class is sent, or
+ * CAN_BUS_PACK_FLUSH_US (can_bus.c) after the first one. The deadline runs
+ * the pack notify hook; the frame then goes out from can_bus_process_rx().
+ * Longer messages go straight to can_bus_send_large_prio(). Same thread as
+ * the other senders. Returns HAL_BUSY if the open frame couldn't be sent to
+ * make room.
+ */
+HAL_StatusTypeDef can_bus_send_packed_prio(can_bus_t *bus, const uint8_t *bytes,
+                                           size_t len, uint32_t std_id,
+                                           can_bus_tx_prio_t prio);
+
+/* As can_bus_send_packed_prio(), in the bulk class. */
+HAL_StatusTypeDef can_bus_send_packed(can_bus_t *bus, const uint8_t *bytes,
+                                      size_t len, uint32_t std_id);
+
+/* Send the open packed frame now (best effort if the TX ring is full). */
+void can_bus_flush_packed(can_bus_t *bus);
+
+/* Called from interrupt context when the open packed frame is due. */
+typedef void (*can_bus_pack_notify_cb_t)(void);
+
+/* Register the deadline hook; it should get can_bus_process_rx() called. */
+void can_bus_set_pack_notify(can_bus_t *bus, can_bus_pack_notify_cb_t cb);
+
+/* Called from the TX-complete interrupt once the hardware has taken frames
+ * from the TX rings after a send returned HAL_BUSY for a full ring; a good
+ * time to retry it. */
+typedef void (*can_bus_tx_notify_cb_t)(void);
+
+void can_bus_set_tx_notify(can_bus_t *bus, can_bus_tx_notify_cb_t cb);
+
+/*
+ * Cap a TX class at `share_pct` percent of the bus (estimated bus time of
+ * its frames), with bursts of up to `burst_us` at full rate after it has
+ * been idle. Frames of a class over its share wait in its ring while the
+ * other classes go ahead; sends still only return HAL_BUSY for a full ring.
+ * 0 or 100 percent = unshaped, the default. HAL_ERROR on a bad argument, a
+ * burst over 1 s, or with CAN_BUS_TX_SHAPING compiled out.
+ */
+HAL_StatusTypeDef can_bus_set_tx_shaping(can_bus_t *bus, can_bus_tx_prio_t prio,
+                                         uint8_t share_pct, uint32_t burst_us);
+
+/*
+ * Time-triggered transmission: classes in `class_mask` (bit per
+ * can_bus_tx_prio_t) only start frames inside windows of `open_ns` that
+ * begin at `anchor_us` (us_clock_now() time) and every `cycle_ns` after
+ * it. A frame is held if it wouldn't clear the bus, behind those already in
+ * the controller, before its window closes. Call again to re-anchor as the
+ * common clock moves; cycle_ns == 0 turns windows off. HAL_ERROR on a bad
+ * window or with CAN_BUS_TX_WINDOWS compiled out.
+ */
+HAL_StatusTypeDef can_bus_set_tx_window(can_bus_t *bus, uint8_t class_mask,
+                                        uint64_t anchor_us, uint32_t cycle_ns,
+                                        uint32_t open_ns);
+
+/* TX pumps that ended with a class held back by its shaper or window. */
+uint32_t can_bus_get_tx_shape_holds(can_bus_t *bus);
+
+/* How full the TX ring of class `prio` is, 0..100 (0 on a bad argument). */
+unsigned can_bus_tx_fill_pct(can_bus_t *bus, can_bus_tx_prio_t prio);
+
+typedef struct {
+  uint32_t tx_frames;  /* packed frames queued */
+  uint32_t tx_records; /* messages packed into them */
+  uint32_t rx_frames;
+  uint32_t rx_records;
+  uint32_t rx_bad;     /* packed frames with a truncated record */
+} can_bus_pack_stats_t;
+
+void can_bus_get_pack_stats(can_bus_t *bus, can_bus_pack_stats_t *out);
+
+/* Messages that went as one frame, skipping fragmentation and reassembly
+ * (CAN_BUS_FRAG_SINGLE in can_bus.c). */
+typedef struct {
+  uint32_t tx;
+  uint32_t rx;
+  uint32_t rx_bad; /* length byte past the end of the frame */
+} can_bus_single_stats_t;
+
+void can_bus_get_single_stats(can_bus_t *bus, can_bus_single_stats_t *out);
+
+/* Bulk messages sent ahead of a fragment train already queued, through the
+ * class's express lane (CAN_BUS_TX_EXPRESS_DEPTH in can_bus.c): short ones,
+ * and ones on an ID that wins arbitration against the train. */
+typedef struct {
+  uint32_t msgs;
+  uint32_t frames;
+} can_bus_express_stats_t;
+
+void can_bus_get_express_stats(can_bus_t *bus, can_bus_express_stats_t *out);
+
+/* Fragmented messages sent per frame size (CAN_BUS_FRAG_ADAPT in
+ * can_bus.c), smallest first: 12, 16, 20, 24, 32, 48 and 64 bytes. */
+#define CAN_BUS_FRAG_SIZES 7u
+
+typedef struct {
+  uint32_t msgs[CAN_BUS_FRAG_SIZES];
+} can_bus_frag_size_stats_t;
+
+void can_bus_get_frag_size_stats(can_bus_t *bus,
+                                 can_bus_frag_size_stats_t *out);
+
+/*
+ * Longest bus time one fragment of a bulk-class message may take, so a
+ * high-class frame queued behind bulk traffic waits at most about `us`:
+ * such messages go in FD frames short enough for it (12-byte ones if none
+ * is), at the cost of more header per byte. 0, the default, lifts it.
+ * HAL_ERROR past 1 s, or for a nonzero limit with fixed 64-byte fragments
+ * compiled in (CAN_BUS_FRAG_ADAPT off, or CAN_BUS_FRAG_RELIABLE/FEC on).
+ */
+HAL_StatusTypeDef can_bus_set_frag_block_us(can_bus_t *bus, uint32_t us);
+
+/* Per-frame TX events (CAN_BUS_TX_EVENTS in can_bus.c); zero if off. */
+typedef struct {
+  uint32_t events;      /* frames seen starting on the wire */
+  uint32_t events_lost; /* TX event FIFO overflows */
+  uint32_t lat_min_us;  /* into the hardware FIFO -> start of frame */
+  uint32_t lat_avg_us;
+  uint32_t lat_max_us;
+  uint32_t arb_lost;    /* single attempt failed: arbitration lost */
+  uint32_t nacked;      /* ...no ACK */
+  uint32_t bus_errors;  /* ...other error */
+  uint32_t retried;     /* sent again (CAN_BUS_TX_RETRY) */
+  uint32_t retry_dropped; /* no free element to send again */
+} can_bus_tx_event_stats_t;
+
+void can_bus_get_tx_event_stats(can_bus_t *bus, can_bus_tx_event_stats_t *out);
+
+/* Error state, worst last; see can_bus_monitor_t.state. */
+enum {
+  CAN_BUS_STATE_ACTIVE = 0,
+  CAN_BUS_STATE_WARNING, /* a counter at 96 or more */
+  CAN_BUS_STATE_PASSIVE, /* a counter at 128 or more */
+  CAN_BUS_STATE_BUS_OFF,
+};
+
+/*
+ * Bus load and error monitor. Rates cover the last CAN_BUS_MON_PERIOD_MS
+ * (can_bus.c) and are refreshed from can_bus_process_rx(); RX only sees
+ * frames the filters accept. lec/dlec count polls that found that last
+ * error code (1 stuff, 2 form, 3 ack, 4 bit1, 5 bit0, 6 CRC) in the
+ * nominal and data phases.
+ */
+typedef struct {
+  uint32_t tx_frames; /* completed, since init */
+  uint32_t rx_frames;
+  uint32_t tx_fps;
+  uint32_t rx_fps;
+  uint32_t tx_bps;   /* wire bits, stuffing estimated */
+  uint32_t rx_bps;
+  uint8_t load_pct;  /* bus time of those frames over wall time */
+  uint8_t tec;
+  uint8_t rec;
+  uint8_t state;     /* CAN_BUS_STATE_* */
+  uint32_t warnings; /* entries into each state */
+  uint32_t passives;
+  uint32_t bus_offs;
+  uint32_t recoveries; /* bus-off restarts (CAN_BUS_BUSOFF_RECOVER) */
+  uint32_t backoff_ms; /* wait before the last restart */
+  uint32_t passive_holds; /* bulk TX pumps held back while error passive */
+  uint32_t tx_flushed;    /* frames dropped from the hardware FIFO by the
+                             stop in can_bus_set_filters() */
+  uint32_t errors;     /* protocol errors logged by the controller */
+  uint32_t err_per_gbit; /* ...per 1e9 wire bits, smoothed over periods */
+  uint32_t lec[8];
+  uint32_t dlec[8];
+} can_bus_monitor_t;
+
+void can_bus_get_monitor(can_bus_t *bus, can_bus_monitor_t *out);
+
+/*
+ * Bus-off recovery backoff. The controller restarts itself `min_ms` after
+ * a bus-off (0: at once); one following within CAN_BUS_BUSOFF_STABLE_MS
+ * (can_bus.c) of the last restart waits twice as long, up to `max_ms`.
+ * Frames queued meanwhile are kept and sent after the rejoin. Safe from
+ * any context.
+ */
+HAL_StatusTypeDef can_bus_set_busoff_backoff(can_bus_t *bus, uint32_t min_ms,
+                                             uint32_t max_ms);
+
+/* Selective retransmit (CAN_BUS_FRAG_RELIABLE in can_bus.c); zero if off. */
+typedef struct {
+  uint32_t nacks_tx;     /* NACKs sent for messages with gaps */
+  uint32_t nacks_rx;     /* NACKs received */
+  uint32_t nacks_stale;  /* received for a message no longer kept */
+  uint32_t frags_resent; /* fragments queued again */
+} can_bus_rtx_stats_t;
+
+void can_bus_get_rtx_stats(can_bus_t *bus, can_bus_rtx_stats_t *out);
+
+/* XOR parity fragments (CAN_BUS_FRAG_FEC in can_bus.c sends them). */
+typedef struct {
+  uint32_t parity_tx;     /* parity fragments queued */
+  uint32_t parity_rx;
+  uint32_t recovered;     /* lost data fragments rebuilt from parity */
+  uint32_t unrecoverable; /* parity groups missing more than one */
+} can_bus_fec_stats_t;
+
+void can_bus_get_fec_stats(can_bus_t *bus, can_bus_fec_stats_t *out);
+
+/*
+ * Broadcast this node's free reassembly capacity as credits every
+ * `period_ms` from can_bus_process_rx() (0 stops). Senders built with
+ * CAN_BUS_FLOW_CONTROL hold fragmented messages back (HAL_BUSY) once their
+ * share is spent. HAL_ERROR if flow control is compiled out.
+ */
+HAL_StatusTypeDef can_bus_advertise_credits(can_bus_t *bus, uint32_t period_ms);
+
+typedef struct {
+  uint32_t credits_tx;  /* adverts sent */
+  uint32_t credits_rx;  /* adverts heard */
+  uint32_t sends_held;  /* sends refused for lack of credit */
+} can_bus_flow_stats_t;
+
+void can_bus_get_flow_stats(can_bus_t *bus, can_bus_flow_stats_t *out);
 
 /*
  * MUST be called periodically from thread/main-loop context.
- * This drains the ISR RX ring, performs reassembly, and invokes subscribers.
+ * This drains the ISR RX ring, performs reassembly, and invokes subscribers,
+ * and sends a packed frame whose deadline has passed. Reassembly timeouts
+ * and NACKs fire from proto_timer_poll(), which the same thread must run.
  */
-void can_bus_process_rx(void);
+void can_bus_process_rx(can_bus_t *bus);
 
 /*
- * Subscribe a callback to RX events (FIFO1).
+ * Subscribe a callback to RX events (FIFO0 and FIFO1).
  * Can be called at startup before interrupts start firing.
+ * `data` points into driver-owned storage (the RX ring or a reassembly
+ * buffer) and is only valid until the callback returns; copy what you keep.
  * Returns HAL_OK on success, HAL_ERROR if the list is full or duplicate.
  */
-HAL_StatusTypeDef can_bus_subscribe_rx(can_bus_rx_cb_t cb, void *user);
+HAL_StatusTypeDef can_bus_subscribe_rx(can_bus_t *bus, can_bus_rx_cb_t cb,
+                                       void *user);
+
+/*
+ * As can_bus_subscribe_rx(), for messages whose standard ID matches
+ * `std_id` under `mask` ((id & mask) == (std_id & mask)); mask 0 takes
+ * everything. Shares the CAN_BUS_MAX_SUBSCRIBERS table. Dispatch goes
+ * through a per-ID lookup, so subscribers cost nothing on other IDs.
+ */
+HAL_StatusTypeDef can_bus_subscribe_rx_match(can_bus_t *bus, uint16_t std_id,
+                                             uint16_t mask, can_bus_msg_cb_t cb,
+                                             void *user);
+
+/* Returns HAL_OK if removed, HAL_ERROR if not found. */
+HAL_StatusTypeDef can_bus_unsubscribe_rx_match(can_bus_t *bus,
+                                               can_bus_msg_cb_t cb, void *user);
+
+/*
+ * Subscribe to messages in batches: everything completed during one
+ * can_bus_process_rx() pass (up to CAN_BUS_RX_BATCH_MAX per call) arrives in
+ * a single callback, in arrival order. Entries point into the RX ring and
+ * reassembly buffers, which stay reserved until the callback returns.
+ * Returns HAL_OK on success, HAL_ERROR if the list is full or duplicate.
+ */
+HAL_StatusTypeDef can_bus_subscribe_rx_batch(can_bus_t *bus,
+                                             can_bus_rx_batch_cb_t cb,
+                                             void *user);
+
+/* Returns HAL_OK if removed, HAL_ERROR if not found. */
+HAL_StatusTypeDef can_bus_unsubscribe_rx_batch(can_bus_t *bus,
+                                               can_bus_rx_batch_cb_t cb,
+                                               void *user);
+
+/* Outside allocator for reassembly buffers (thread context). */
+typedef void *(*can_bus_buf_alloc_t)(size_t len);
+typedef void (*can_bus_buf_free_t)(void *buf);
+
+/* Adopt a completed message: return non-zero to keep `buf` (release it
+ * with the can_bus_buf_free_t given to can_bus_set_reasm_alloc()). */
+typedef int (*can_bus_rx_take_cb_t)(uint8_t *buf, size_t len, uint16_t std_id,
+                                    void *user);
+
+/*
+ * Reassemble fragmented messages into buffers from `alloc` (e.g. the heap a
+ * consumer queues packets in) instead of the static block pool, which stays
+ * as the fallback when `alloc` fails. NULL/NULL goes back to the pool only.
+ * Returns HAL_BUSY while messages are in flight.
+ */
+HAL_StatusTypeDef can_bus_set_reasm_alloc(can_bus_t *bus,
+                                          can_bus_buf_alloc_t alloc,
+                                          can_bus_buf_free_t free_fn);
+
+/*
+ * Offer each completed message in an allocator buffer to `cb` first; when it
+ * takes the buffer the message is handed over without a copy and no
+ * subscriber sees it. NULL removes the hook.
+ */
+void can_bus_set_rx_take(can_bus_t *bus, can_bus_rx_take_cb_t cb, void *user);
+
+/*
+ * Backpressure for the reassembly stage: while set, fragmented messages from
+ * standard IDs >= `from_id` (the lower-priority ones) are not started and
+ * their fragments are dropped; messages already in flight finish. 0 turns
+ * it off. Safe from any context.
+ */
+void can_bus_set_reasm_pause(can_bus_t *bus, uint16_t from_id);
+
+/*
+ * Cap the reassembly slots messages from low-priority IDs (outside the
+ * can_bus_set_reasm_priority() range) may hold at once, so fewer buffers
+ * are taken from the allocator under memory pressure. Messages in flight
+ * over the cap finish, or are evicted by newcomers as usual. 0 restores the
+ * default, every slot but the CAN_BUS_REASM_RESERVED ones. Safe from any
+ * context.
+ */
+void can_bus_set_reasm_low_limit(can_bus_t *bus, unsigned slots);
+
+/*
+ * Standard IDs [first_id, last_id] are high priority for reassembly: when
+ * slots run out their messages win over others, and CAN_BUS_REASM_RESERVED
+ * slots are kept for them alone. Defaults to CAN_BUS_REASM_HIGH_ID_FIRST..
+ * _LAST. Safe from any context.
+ */
+HAL_StatusTypeDef can_bus_set_reasm_priority(can_bus_t *bus, uint16_t first_id,
+                                             uint16_t last_id);
+
+/*
+ * Take fragmented messages on IDs matching `std_id` under `mask` as a stream:
+ * `cb` gets each fragment's payload as soon as everything before it has
+ * arrived, instead of the whole message once complete. Only out-of-order
+ * fragments cost a reassembly buffer. These messages no longer reach the
+ * whole-message subscribers. Once a message has started, ABORT follows if
+ * it can't be finished. NULL `cb` removes the entry for (std_id, mask).
+ * Returns HAL_ERROR if already registered or the table
+ * (CAN_BUS_MAX_STREAM_SUBSCRIBERS) is full.
+ */
+HAL_StatusTypeDef can_bus_subscribe_stream(can_bus_t *bus, uint16_t std_id,
+                                           uint16_t mask,
+                                           can_bus_stream_cb_t cb, void *user);
+
+/*
+ * Claim a standard ID: its frames skip reassembly and the subscribers above
+ * and go to `cb` one at a time, from can_bus_process_rx(), with their
+ * hardware timestamp. NULL `cb` releases the ID.
+ * Returns HAL_ERROR if the ID is already claimed or the table
+ * (CAN_BUS_MAX_ID_SUBSCRIBERS) is full.
+ */
+HAL_StatusTypeDef can_bus_subscribe_id(can_bus_t *bus, uint16_t std_id,
+                                       can_bus_frame_cb_t cb, void *user);
+
+/* Raw frame flags (can_bus_set_rx_tap(), can_bus_send_raw()). */
+#define CAN_BUS_RAW_EXT 0x01u /* `id` is a 29-bit extended ID */
+#define CAN_BUS_RAW_FD 0x02u  /* FD frame; else classic, 8 bytes at most */
+#define CAN_BUS_RAW_BRS 0x04u /* FD data phase at the data bit rate */
+#define CAN_BUS_RAW_TX 0x08u  /* capture: a frame sent, not received */
+
+typedef void (*can_bus_rx_tap_cb_t)(uint32_t id, uint8_t flags,
+                                    const uint8_t *data, size_t len,
+                                    uint64_t ts_us, void *user);
+
+/*
+ * See every frame taken off the RX rings, before it is dispatched and
+ * without consuming it, e.g. to bridge the bus to a host as a plain CAN
+ * adapter. Runs in can_bus_process_rx(). Frames a responder answered or a
+ * route only forwarded never reach the rings, and extended IDs are only
+ * accepted with CAN_BUS_FRAG_EXT_ID. One tap per instance; NULL removes it.
+ */
+void can_bus_set_rx_tap(can_bus_t *bus, can_bus_rx_tap_cb_t cb, void *user);
+
+/*
+ * Capture hook, independent of the tap: sees the same received frames, and
+ * every frame as it is written to the hardware TX FIFO (CAN_BUS_RAW_TX, at
+ * padded wire length) stamped with the timestamp counter at that moment
+ * rather than its start of frame. Sent frames are seen from any context
+ * with IRQs masked, so `cb` must be short and ISR-safe. NULL removes it.
+ */
+void can_bus_set_capture(can_bus_t *bus, can_bus_rx_tap_cb_t cb, void *user);
+
+/*
+ * Store one frame in the RX ring of `fifo` as if the FDCAN had received it
+ * just now, e.g. to replay recorded traffic; the next can_bus_process_rx()
+ * dispatches it like any other, taps included. Responders and routes, which
+ * act in the RX interrupt, don't see it. Extended IDs need
+ * CAN_BUS_FRAG_EXT_ID. HAL_BUSY if the ring has no room (nothing is
+ * dropped); thread context.
+ */
+HAL_StatusTypeDef can_bus_inject_rx(can_bus_t *bus, can_bus_rx_fifo_t fifo,
+                                    uint32_t id, uint8_t flags,
+                                    const uint8_t *data, size_t len);
+
+/*
+ * Queue one frame as given: no fragmentation, packing or peer profile.
+ * FD lengths between DLC sizes are zero-padded. CAN_BUS_RAW_BRS is ignored
+ * (the instance's BRS setting applies). Same thread as the other senders;
+ * HAL_BUSY if the class's ring is full.
+ */
+HAL_StatusTypeDef can_bus_send_raw(can_bus_t *bus, uint32_t id, uint8_t flags,
+                                   const uint8_t *data, size_t len,
+                                   can_bus_tx_prio_t prio);
+
+/*
+ * Answer frames on `std_id` directly from the RX interrupt: `cb` gets each
+ * request with its SOF time, and its reply is written to the hardware TX
+ * FIFO on the same ID, bypassing the RX ring and the TX queues. The ID must
+ * be filtered into FIFO0. One responder per instance; NULL `cb` removes it.
+ */
+HAL_StatusTypeDef can_bus_set_responder(can_bus_t *bus, uint16_t std_id,
+                                        can_bus_responder_cb_t cb,
+                                        void *user);
+
+/*
+ * Frames built ahead of time (e.g. a heartbeat or a time-sync reply) and
+ * sent later with can_bus_tx_fire(), a copy into the hardware TX FIFO that
+ * skips every TX queue. The G4 has no dedicated TX buffers, so a fired
+ * frame still follows the few already in the hardware FIFO. Slots run to
+ * CAN_BUS_TX_PRELOAD_SLOTS (can_bus.c); loading again replaces the frame.
+ */
+HAL_StatusTypeDef can_bus_tx_preload(can_bus_t *bus, unsigned slot,
+                                     uint32_t std_id, const uint8_t *bytes,
+                                     size_t len);
+void can_bus_tx_unload(can_bus_t *bus, unsigned slot);
+
+/* Send a loaded slot; ISR-safe. HAL_BUSY if the hardware FIFO is full,
+ * HAL_ERROR if the slot is empty. */
+HAL_StatusTypeDef can_bus_tx_fire(can_bus_t *bus, unsigned slot);
+
+/*
+ * Send `len` bytes from `data` as frame `id` (CAN_BUS_RAW_* flags, as
+ * can_bus_send_raw()) every `period_us` (100 us at least), the first
+ * `phase_us` from now, straight from the us_clock alarm interrupt into the
+ * hardware TX FIFO, as the pre-loaded frames go: no thread or queue is
+ * involved. `data` is read at every send and must stay valid until
+ * removed; change multi-word payloads with IRQs masked or a frame may
+ * carry half of each. Returns a handle, or -1 when the table
+ * (CAN_BUS_CYCLIC_SLOTS in can_bus.c) is full or an argument is bad.
+ */
+int can_bus_cyclic_add(can_bus_t *bus, uint32_t id, uint8_t flags,
+                       const void *data, size_t len, uint32_t period_us,
+                       uint32_t phase_us);
+void can_bus_cyclic_remove(can_bus_t *bus, int handle);
+
+typedef struct {
+  uint32_t period_us;
+  uint32_t sent;
+  uint32_t skipped;     /* periods missed (bus-off, FIFO full all along) */
+  uint32_t late_max_us; /* worst due time to hardware FIFO */
+} can_bus_cyclic_stats_t;
+
+/* Zeroes for a free handle. */
+void can_bus_get_cyclic_stats(can_bus_t *bus, int handle,
+                              can_bus_cyclic_stats_t *out);
+
+/* Replies sent, and replies dropped because the hardware FIFO was full. */
+void can_bus_get_responder_stats(can_bus_t *bus, uint32_t *sent,
+                                 uint32_t *dropped);
+
+/* Forward with the ID the frame arrived on. */
+#define CAN_BUS_ROUTE_SAME_ID 0xFFFFu
+
+/* One gateway route: standard-ID frames with (id & mask) == (id & mask)
+ * are resent on `dst`, unchanged apart from the optional new ID. */
+typedef struct {
+  uint16_t id;
+  uint16_t mask;
+  can_bus_t *dst;
+  uint16_t dst_id; /* new ID, or CAN_BUS_ROUTE_SAME_ID */
+  uint8_t local;   /* also deliver on this instance as usual */
+} can_bus_route_t;
+
+/*
+ * Replace the gateway routing table of `bus` (up to CAN_BUS_MAX_ROUTES in
+ * can_bus.c); the first matching entry wins, count 0 clears it. Matching
+ * frames go from the RX interrupt straight into the destination's hardware
+ * TX FIFO, ahead of its queues, and skip the RX ring and reassembly unless
+ * `local` is set. Routed IDs must pass the hardware filters; filter them
+ * into FIFO0, whose interrupts aren't coalesced. Extended-ID frames are
+ * never routed. The new table replaces the old whole, so the interrupt
+ * matches against one or the other, never a mix; call it from a thread.
+ * Returns HAL_ERROR on a bad entry or a route back to `bus`.
+ */
+HAL_StatusTypeDef can_bus_set_routes(can_bus_t *bus,
+                                     const can_bus_route_t *routes,
+                                     size_t count);
+
+/* Frames forwarded from `bus`, and ones dropped because the destination's
+ * hardware TX FIFO was full or its controller not running. */
+void can_bus_get_route_stats(can_bus_t *bus, uint32_t *forwarded,
+                             uint32_t *dropped);
+
+/* RX ring occupancy and overflow counters, per hardware FIFO. */
+typedef struct {
+  uint32_t size_bytes;
+  uint32_t used_bytes;       /* right now */
+  uint32_t high_water_bytes; /* since can_bus_init() */
+  uint32_t frames;           /* stored in the ring */
+  uint32_t dropped;          /* lost because the ring was full */
+  uint32_t flushed;          /* unread frames discarded by drop-oldest */
+  uint32_t stalls;           /* drains paused for backpressure */
+  uint8_t policy;            /* 0 drop-newest, 1 drop-oldest, 2 backpressure */
+} can_bus_rx_ring_stats_t;
+
+HAL_StatusTypeDef can_bus_get_rx_ring_stats(can_bus_t *bus,
+                                            can_bus_rx_fifo_t fifo,
+                                            can_bus_rx_ring_stats_t *out);
+
+/*
+ * Broadcast readers: more consumers of every received frame (capture, black
+ * box, bridging to a host) with their own cursor into the RX rings, beside
+ * the one can_bus_process_rx() dispatches from. The ISR stores a frame once
+ * and never waits for a reader; one that falls a whole ring behind loses
+ * the frames overwritten meanwhile, counts them, and goes on from the
+ * oldest the router still holds. A reader sees what the tap sees, from the
+ * moment it was opened. Returns the reader (below CAN_BUS_RX_READERS in
+ * can_bus.c) or -1 if none is free.
+ */
+int can_bus_rx_reader_open(can_bus_t *bus, can_bus_rx_tap_cb_t cb, void *user);
+void can_bus_rx_reader_close(can_bus_t *bus, int reader);
+
+/*
+ * Hand up to `max` frames to the reader's callback, FIFO0 first; returns
+ * how many. Thread context, one thread per reader, e.g. on the wake-ups
+ * can_bus_set_rx_notify() gives the router or on a period shorter than the
+ * time the rings take to fill.
+ */
+size_t can_bus_rx_reader_poll(can_bus_t *bus, int reader, size_t max);
+
+typedef struct {
+  uint32_t frames;   /* handed to the callback */
+  uint32_t lost;     /* overwritten before the reader got to them */
+  uint32_t overruns; /* times it fell a ring behind */
+  uint32_t lag;      /* frames stored and not yet read, right now */
+  uint32_t lag_max;  /* most seen after a poll */
+} can_bus_rx_reader_stats_t;
+
+/* HAL_ERROR for a reader that isn't open. */
+HAL_StatusTypeDef can_bus_get_rx_reader_stats(can_bus_t *bus, int reader,
+                                              can_bus_rx_reader_stats_t *out);
+
+/*
+ * RX interrupt latency per hardware FIFO (CAN_BUS_RX_LAT_HIST in can_bus.c):
+ * how long each frame sat in the FIFO between its end on the wire (the RX
+ * timestamp at start of frame plus the frame's length) and the timestamp
+ * counter read as the ISR starts draining, i.e. interrupt masking, higher
+ * priority ISRs and the coalescing timeout. Bin i counts waits below
+ * 1 us << i, the last bin the rest; p50/p99 are the upper edge of the bin
+ * they fall in, capped at max_us. Since init; zero if the build is off.
+ */
+#define CAN_BUS_RX_LAT_BINS 12u
+typedef struct {
+  uint32_t frames;
+  uint32_t p50_us;
+  uint32_t p99_us;
+  uint32_t max_us;
+  uint32_t hist[CAN_BUS_RX_LAT_BINS];
+} can_bus_rx_lat_stats_t;
+
+HAL_StatusTypeDef can_bus_get_rx_lat_stats(can_bus_t *bus,
+                                           can_bus_rx_fifo_t fifo,
+                                           can_bus_rx_lat_stats_t *out);
+
+/* Per-sender reassembly statistics (fragmented messages only). */
+typedef struct {
+  uint16_t std_id;
+  uint16_t gap_avg_ms;   /* smoothed gap between fragments of one message */
+  uint16_t timeout_ms;   /* reassembly timeout currently derived from it */
+  uint32_t frags_rx;
+  uint32_t msgs_completed;
+  uint32_t msgs_expired; /* timed out waiting for a fragment */
+  uint32_t msgs_evicted; /* dropped to make room for a newer message */
+  uint32_t dup_frags;
+  uint32_t seq_jumps;    /* new message whose seq isn't previous + 1 */
+  uint32_t msgs_paused;  /* refused by can_bus_set_reasm_pause() */
+  uint32_t frags_held;   /* arrived before their message could place them */
+  uint32_t frags_orphaned; /* held ones that expired or were pushed out */
+  uint32_t starts_refused; /* no slot it was allowed to take */
+} can_bus_id_stats_t;
+
+/*
+ * Stats are updated by can_bus_process_rx(); read them from the same thread
+ * for a consistent snapshot.
+ * Returns HAL_ERROR if `std_id` has no entry (nothing seen, or table full).
+ */
+HAL_StatusTypeDef can_bus_get_id_stats(can_bus_t *bus, uint16_t std_id,
+                                       can_bus_id_stats_t *out);
+
+/*
+ * Copy up to `max` entries into `out`; returns how many. `untracked`
+ * (optional) receives the fragments from IDs that didn't fit the table.
+ */
+size_t can_bus_get_all_id_stats(can_bus_t *bus, can_bus_id_stats_t *out,
+                                size_t max, uint32_t *untracked);
+
+/* Forget all per-sender stats and learned timeouts. */
+void can_bus_reset_id_stats(can_bus_t *bus);
+
+/*
+ * Top talkers: frames and payload bytes per frame ID received (through the
+ * RX rings, so not frames only a route forwarded), with when the last one
+ * came and the shortest and longest gap between two, in a table of
+ * CAN_BUS_TALKER_SLOTS (can_bus.c). When it is full a new ID replaces the
+ * one heard from least recently in its hash neighbourhood.
+ */
+#define CAN_BUS_TALKER_EXT 0x80000000u /* or'ed into `id`: 29-bit extended */
+typedef struct {
+  uint32_t id;
+  uint32_t frames;
+  uint32_t bytes;
+  uint32_t age_us;     /* since the last frame */
+  uint32_t gap_min_us; /* 0 until a second frame */
+  uint32_t gap_max_us;
+} can_bus_talker_t;
+
+/*
+ * Copy up to `max` entries, most bytes first; returns how many. `evicted`
+ * (optional) gets the number of IDs pushed out of the table. Same thread
+ * as can_bus_process_rx().
+ */
+size_t can_bus_get_talkers(can_bus_t *bus, can_bus_talker_t *out, size_t max,
+                           uint32_t *evicted);
+
+void can_bus_reset_talkers(can_bus_t *bus);
+
+/*
+ * Hardware timestamps from the FDCAN timestamp counter (one tick per nominal
+ * bit, e.g. 2 us at 500 kbit/s), latched by the controller at start of
+ * frame. All three share one microsecond scale that starts at can_bus_init();
+ * each instance has its own counter, so times from two instances don't mix.
+ */
+uint64_t can_bus_time_us(can_bus_t *bus);
+
+/*
+ * First-fragment RX time of the last fragmented message completed on
+ * `std_id`. HAL_ERROR if none yet or the ID isn't in the stats table.
+ */
+HAL_StatusTypeDef can_bus_last_rx_time_us(can_bus_t *bus, uint16_t std_id,
+                                          uint64_t *t_us);
+
+/*
+ * TX time of the last CAN_BUS_TX_PRIO_HIGH message (its first frame), if it
+ * was sent on `std_id`.
+ */
+HAL_StatusTypeDef can_bus_last_tx_time_us(can_bus_t *bus, uint16_t std_id,
+                                          uint64_t *t_us);
+
+/*
+ * Register a wake-up hook run from interrupt context whenever new frames are
+ * waiting for can_bus_process_rx() on this instance. Pass NULL to remove it.
+ */
+void can_bus_set_rx_notify(can_bus_t *bus, can_bus_rx_notify_cb_t cb);
+
+/*
+ * Handler of the pended notify interrupt (FMAC_IRQn unless
+ * CAN_BUS_NOTIFY_IRQn is overridden), shared by all instances. The FDCAN RX
+ * ISRs run above the ThreadX BASEPRI mask and may not call the kernel, so
+ * they pend this one.
+ */
+void can_bus_notify_irq(void);
 
 /*
  * Optional: remove a previously added subscription.
  * Returns HAL_OK if removed, HAL_ERROR if not found.
  */
-HAL_StatusTypeDef can_bus_unsubscribe_rx(can_bus_rx_cb_t cb, void *user);
+HAL_StatusTypeDef can_bus_unsubscribe_rx(can_bus_t *bus, can_bus_rx_cb_t cb,
+                                         void *user);
+
+#ifdef MICROBENCH_ENABLED
+/*
+ * Microbenchmark hooks (microbench.h): private driver steps run on caller
+ * data, each returning the DWT cycles of just that step. `rec` buffers
+ * hold one RX ring record (CAN_BUS_BENCH_REC_BYTES, word aligned).
+ *   rb_push / rb_pop   RX ring record in and out, on a scratch ring
+ *   frag               fragment `idx` of a `len`-byte message as a record,
+ *                      *wire = its frame length (0: no such fragment)
+ *   frame              an unfragmented record (not timed)
+ *   rx                 the thread-side handling of one record: reassembly,
+ *                      without subscriber callbacks
+ * From the thread that runs can_bus_process_rx(), or while it can't run.
+ */
+#define CAN_BUS_BENCH_REC_BYTES 80u
+
+uint32_t can_bus_bench_rb_push(const uint32_t *words, uint8_t len);
+uint32_t can_bus_bench_rb_pop(void);
+uint32_t can_bus_bench_frag(uint8_t *rec, uint8_t *wire, uint32_t std_id,
+                            uint8_t seq, uint8_t idx, const uint8_t *msg,
+                            size_t len);
+void can_bus_bench_frame(uint8_t *rec, uint32_t std_id, const uint8_t *data,
+                         uint8_t len);
+uint32_t can_bus_bench_rx(can_bus_t *bus, const uint8_t *rec);
+#endif
 
 #ifdef __cplusplus
 }
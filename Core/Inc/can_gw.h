@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include "can_bus.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Dual-gateway redundancy with load sharing (CAN_GW_ENABLED, CMake option
+ * ENABLE_GW_REDUNDANCY). Two gateways on one bus both hear all traffic; each
+ * sends a heartbeat every CAN_GW_PERIOD_MS, a classic 8-byte frame on
+ * CAN_GW_STD_ID:
+ *   u8 CAN_GW_VERSION, u16 node ID, u8 flags (CAN_GW_F_UPLINK),
+ *   u32 sequence
+ * (little-endian). While both are heard with their uplinks up, they split
+ * the uplink by data type: a hash of the type picks one share, and the
+ * gateway with the lower node ID takes share 0. A gateway whose peer has
+ * been silent for CAN_GW_TIMEOUT_MS, or reports its uplink down, forwards
+ * every type; the telemetry uplink sides (USB, UART) ask can_gw_owns()
+ * per packet, so the takeover needs no poll.
+ *
+ * Everything on the local side is also sent on the bus, so the peer hears
+ * it and uplinks its share of it too. The heartbeat subscription and
+ * can_gw_poll() run in the telemetry RX thread; can_gw_owns() only reads
+ * word-sized state and is safe from any thread.
+ */
+
+#ifndef CAN_GW_STD_ID
+#define CAN_GW_STD_ID 0x7E3u
+#endif
+#ifndef CAN_GW_PERIOD_MS
+#define CAN_GW_PERIOD_MS 10u
+#endif
+#ifndef CAN_GW_TIMEOUT_MS
+#define CAN_GW_TIMEOUT_MS (3u * CAN_GW_PERIOD_MS + 5u)
+#endif
+
+#define CAN_GW_VERSION 1u
+#define CAN_GW_F_UPLINK 0x01u /* the sender's uplink is up */
+
+/* Role of this gateway right now. */
+enum {
+  CAN_GW_ROLE_ALL = 0, /* alone, or the peer can't uplink: every type */
+  CAN_GW_ROLE_SHARE,   /* half the types, the peer the other half */
+};
+
+typedef struct {
+  uint32_t beats_tx;
+  uint32_t beats_rx;
+  uint32_t bad;       /* wrong length or version */
+  uint32_t others;    /* heartbeats from a third gateway, ignored */
+  uint32_t takeovers; /* entries into CAN_GW_ROLE_ALL from sharing */
+  uint32_t shed;      /* packets left to the peer */
+  uint16_t peer_node; /* 0xFFFF until one is heard */
+  uint8_t role;       /* CAN_GW_ROLE_* */
+  uint8_t share;      /* this gateway's share while sharing, 0 or 1 */
+} can_gw_stats_t;
+
+#ifdef CAN_GW_ENABLED
+
+/*
+ * Start on `bus` as node `node_id`; `uplink_up` reports whether this
+ * gateway's host link can take traffic (NULL: always). Takes CAN_GW_STD_ID
+ * with can_bus_subscribe_id(), so it must also pass the hardware filters.
+ */
+HAL_StatusTypeDef can_gw_init(can_bus_t *bus, uint16_t node_id,
+                              int (*uplink_up)(void));
+
+/* 1 if this gateway uplinks data type `ty` now. */
+int can_gw_owns(uint32_t ty);
+
+/* Send the heartbeat when due. Returns the ms until it is due again, or
+ * until the peer times out (UINT32_MAX before can_gw_init()). */
+uint32_t can_gw_poll(void);
+
+void can_gw_get_stats(can_gw_stats_t *out);
+
+#else
+
+static inline int can_gw_owns(uint32_t ty) {
+  (void)ty;
+  return 1;
+}
+static inline uint32_t can_gw_poll(void) { return UINT32_MAX; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
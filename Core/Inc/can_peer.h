@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "can_bus.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Peer discovery and capability table (CAN_PEER_ENABLED, CMake option
+ * ENABLE_PEER_DISCOVERY). At boot and every CAN_PEER_PERIOD_MS after, each
+ * node advertises the standard IDs it takes directed traffic on (its ISO-TP
+ * and file request IDs), one classic 8-byte frame per ID on CAN_PEER_STD_ID
+ * so classic-only nodes can read them too:
+ *   u8 CAN_PEER_VERSION, u16 node ID, u16 std ID, u8 flags,
+ *   u8 largest frame payload, u8 reassembly capacity in 64-byte units
+ * (little-endian). flags: CAN_PEER_F_FD / _BRS, and the transport the node
+ * prefers on that ID (CAN_PEER_XPORT_*) in bits 4-5. Capacity 255 means
+ * unbounded (a streaming sink); a node with no such IDs sends one advert
+ * with std ID CAN_PEER_NO_ID.
+ *
+ * Adverts heard fill a table per advertised ID. The TX path consults it
+ * through the CAN driver's per-ID profile: an ID whose node can't take FD
+ * frames gets CAN_BUS_PROFILE_CLASSIC, so can_bus fragments, ISO-TP
+ * (isotp.h) and bulk (can_bulk.h) sends to it use classic frames and
+ * fragment sizes. An ID not heard for CAN_PEER_STALE_MS is dropped and goes
+ * back to FD. An advert from a node not in the table has ours go out at
+ * the next poll, so a node that boots late learns the bus at once.
+ *
+ * Everything runs in the telemetry RX thread (can_bus_process_rx()
+ * callbacks and can_peer_poll()), like isotp.c.
+ */
+
+#ifndef CAN_PEER_STD_ID
+#define CAN_PEER_STD_ID 0x7E2u
+#endif
+#ifndef CAN_PEER_PERIOD_MS
+#define CAN_PEER_PERIOD_MS 1000u
+#endif
+#ifndef CAN_PEER_STALE_MS
+#define CAN_PEER_STALE_MS (3u * CAN_PEER_PERIOD_MS + 500u)
+#endif
+#ifndef CAN_PEER_MAX
+#define CAN_PEER_MAX 16u /* advertised IDs tracked, all nodes together */
+#endif
+#ifndef CAN_PEER_LOCAL_MAX
+#define CAN_PEER_LOCAL_MAX 4u /* IDs this node advertises */
+#endif
+/* What this node advertises of its own controller. */
+#ifndef CAN_PEER_LOCAL_FD
+#define CAN_PEER_LOCAL_FD 1
+#endif
+#ifndef CAN_PEER_LOCAL_BRS
+#define CAN_PEER_LOCAL_BRS 1
+#endif
+
+#define CAN_PEER_VERSION 1u
+#define CAN_PEER_NO_ID 0xFFFFu
+
+#define CAN_PEER_F_FD 0x01u  /* takes FD frames */
+#define CAN_PEER_F_BRS 0x02u /* with bit-rate switching */
+
+#define CAN_PEER_XPORT_FRAG 0u  /* can_bus fragmented messages */
+#define CAN_PEER_XPORT_ISOTP 1u /* isotp.h */
+#define CAN_PEER_XPORT_BULK 2u  /* can_bulk.h */
+
+#define CAN_PEER_CAP_STREAM 0xFFFFFFFFu /* can_peer_local_t: no limit */
+
+/* One ID this node advertises. */
+typedef struct {
+  uint16_t std_id;
+  uint8_t transport;    /* CAN_PEER_XPORT_* */
+  uint32_t reasm_bytes; /* largest message it takes; CAN_PEER_CAP_STREAM */
+} can_peer_local_t;
+
+/* What the table holds for one advertised ID. */
+typedef struct {
+  uint16_t node_id;
+  uint16_t std_id;
+  uint8_t flags;        /* CAN_PEER_F_* */
+  uint8_t transport;    /* CAN_PEER_XPORT_* */
+  uint8_t frame_max;    /* largest frame payload, 8..64 */
+  uint32_t reasm_bytes; /* CAN_PEER_CAP_STREAM for unbounded */
+  uint32_t age_ms;      /* since its last advert */
+} can_peer_info_t;
+
+typedef struct {
+  uint32_t adverts_tx;
+  uint32_t adverts_rx;
+  uint32_t bad;        /* wrong length or version */
+  uint32_t expired;    /* entries dropped for silence */
+  uint32_t table_full; /* adverts with no free entry */
+  uint32_t conflicts;  /* an ID advertised by a second node */
+  uint32_t no_profile; /* classic IDs the driver's profile table refused */
+  uint8_t peers;       /* entries in use */
+  uint8_t classic;     /* of them on the classic profile */
+} can_peer_stats_t;
+
+#ifdef CAN_PEER_ENABLED
+
+/*
+ * Start on `bus` advertising `ids` (copied, up to CAN_PEER_LOCAL_MAX) for
+ * node `node_id`; the first advert goes out at the next can_peer_poll().
+ * Takes CAN_PEER_STD_ID with can_bus_subscribe_id(), so it must also pass
+ * the hardware filters.
+ */
+HAL_StatusTypeDef can_peer_init(can_bus_t *bus, uint16_t node_id,
+                                const can_peer_local_t *ids, size_t n);
+
+/* Entry for destination `std_id`; 0 when no node advertised it. */
+int can_peer_lookup(uint16_t std_id, can_peer_info_t *out);
+
+/* Entry `i` of the table (0..CAN_PEER_MAX-1); 0 if unused. */
+int can_peer_get(unsigned i, can_peer_info_t *out);
+
+/* Send adverts that are due, drop stale entries. Returns the ms until it
+ * has work again (UINT32_MAX before can_peer_init()). */
+uint32_t can_peer_poll(void);
+
+void can_peer_get_stats(can_peer_stats_t *out);
+
+#else
+
+static inline uint32_t can_peer_poll(void) { return UINT32_MAX; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Consistent Overhead Byte Stuffing. Encoded frames contain no 0x00, so a
+ * single 0x00 delimits frames on a byte stream (USB CDC, UART).
+ */
+
+/* Worst-case encoded size of `n` payload bytes, excluding the delimiter. */
+#define COBS_MAX_ENCODED(n) ((n) + ((n) / 254u) + 1u)
+
+/*
+ * Encode `len` bytes into `dst` (no trailing delimiter).
+ * Returns the encoded length, or 0 if `cap` is too small.
+ */
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/*
+ * Decode one frame (delimiter already stripped). `dst` may equal `src`.
+ * Returns the decoded length, or 0 on a malformed frame or if `cap` is too
+ * small.
+ */
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
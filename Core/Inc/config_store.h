@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runtime tunables, kept in the two internal flash pages the linker script
+ * sets aside as CONFIG (_sconfig .. _econfig) and read at boot.
+ *
+ * Page layout (2 KB pages, little-endian, 8-byte aligned):
+ *
+ *   u32 magic "CFG1", u32 crc       CRC-32 of everything after it
+ *   u16 format, u16 count, u32 seq  seq + 1 per commit
+ *   entries: u16 key, u16 ~key, u32 value
+ *
+ * Commits go to the page not holding the newest record, so a reset during
+ * one leaves the previous record in place. The owning module declares each
+ * key with its compile-time default and range (config_define()); a stored
+ * value outside the range is ignored. LIVE keys take effect on
+ * config_set(); the others are read once at boot and take a set value
+ * after a commit and a reset.
+ */
+
+/* Key IDs are stored in flash and used on the wire: append, never reuse. */
+typedef enum {
+  CONFIG_KEY_NONE = 0,
+  CONFIG_TIMESYNC_ACQUIRE_PERIOD_MS = 1,
+  CONFIG_TIMESYNC_MAX_PERIOD_MS = 2,
+  CONFIG_TIMESYNC_BURST_GAP_MS = 3,
+  CONFIG_TIMESYNC_JITTER_PCT = 4,
+  CONFIG_TIMESYNC_LOCK_US = 5,
+  CONFIG_CAN_BULK_SHARE_PCT = 6,
+  CONFIG_CAN_BULK_BURST_US = 7,
+  CONFIG_INTAKE_AGE_MS = 8,
+  CONFIG_TELEMETRY_RX_PRIORITY = 9,
+  CONFIG_TELEMETRY_TX_PRIORITY = 10,
+  CONFIG_TELEMETRY_MAINT_PRIORITY = 11,
+  CONFIG_HEALTH_PERIOD_MS = 12,
+  CONFIG_UART_LINK_BPS = 13,
+  CONFIG_KEY_COUNT
+} config_key_t;
+
+#define CONFIG_LIVE 0x01u    /* config_set() applies it at once */
+#define CONFIG_DEFINED 0x80u /* config_entry_t.flags: declared by this build */
+
+/* Called with the new value when a LIVE key is set. */
+typedef void (*config_apply_cb_t)(uint32_t value);
+
+typedef struct {
+  uint32_t value;   /* in effect */
+  uint32_t pending; /* set, takes effect after a reset unless LIVE */
+  uint32_t def;
+  uint32_t min;
+  uint32_t max;
+  uint8_t flags;
+} config_entry_t;
+
+typedef struct {
+  uint32_t seq;     /* of the newest record, 0 if none */
+  uint32_t commits; /* records programmed since boot */
+  uint32_t errors;  /* program, erase and verify failures */
+  uint32_t ignored; /* stored values out of range at boot */
+  uint8_t dirty;    /* values set since the last commit */
+} config_stats_t;
+
+/*
+ * Declare `key` and return the value it boots with: the stored one if it is
+ * within min..max, else `def`. Boot or thread context, once per key, before
+ * any config_get() of it. `apply` (LIVE keys, may be NULL) is not called
+ * for the boot value.
+ */
+uint32_t config_define(config_key_t key, uint32_t def, uint32_t min,
+                       uint32_t max, uint8_t flags, config_apply_cb_t apply);
+
+/* The value in effect; 0 for a key not declared. */
+uint32_t config_get(config_key_t key);
+
+/*
+ * Set a value for the next commit and, for a LIVE key, apply it. HAL_ERROR
+ * for a key not declared or a value out of range.
+ */
+HAL_StatusTypeDef config_set(config_key_t key, uint32_t value);
+
+/* Set every declared key back to its default (not committed). */
+void config_set_defaults(void);
+
+/* Have the next config_store_poll() write the values set. */
+void config_commit(void);
+
+/*
+ * Program a commit if one is due. Returns ms until it has more to do,
+ * UINT32_MAX when idle. Stalls flash fetches like flash_log_poll(); call it
+ * from the same low-priority thread.
+ */
+uint32_t config_store_poll(void);
+
+/* 0 if `key` is out of range; undeclared keys come back without
+ * CONFIG_DEFINED. */
+int config_get_entry(config_key_t key, config_entry_t *out);
+
+void config_get_stats(config_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
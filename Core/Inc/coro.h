@@ -0,0 +1,187 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stackless coroutines for drivers that mostly wait on I/O, built with
+ * CORO_ENABLED (CMake option ENABLE_COROUTINES). Each driver is a function
+ * written between CORO_BEGIN() and CORO_END() that returns to the executor
+ * at every wait and resumes after it on its next call, protothread style;
+ * all of them run in one ThreadX thread (create_coro_thread(),
+ * GB-Threads.h) on its one stack, so a driver costs its coro_t and state
+ * instead of a thread stack.
+ *
+ * A coroutine runs when it is started, when coro_wake() is called for it
+ * (from an ISR too: a DMA, I2C or UART completion), when the deadline it
+ * armed passes and after a CORO_YIELD(). With nothing to run the thread
+ * sleeps until the earliest deadline or the next wake.
+ *
+ * Rules, as for any protothread: locals don't survive a wait (keep state
+ * in the struct behind `user`), a wait can't be inside a switch of the
+ * coroutine's own, one wait per source line (the line is the resume
+ * point), and nothing in the body may block the thread: no
+ * tx_thread_sleep(), mutex or queue waits. Every coroutine shares the
+ * thread's priority (CORO_THREAD_PRIORITY in coro.c).
+ *
+ * Example: a sensor read by i2c_bus.h every 20 ms.
+ *
+ *   static void on_done(HAL_StatusTypeDef st, const uint8_t *rx, size_t n,
+ *                       uint64_t t_us, void *user) {
+ *     sensor_t *s = user;
+ *     ... store rx, st and t_us in s ...
+ *     coro_wake(&s->co);
+ *   }
+ *   static int sensor_run(coro_t *c, void *user) {
+ *     sensor_t *s = user;
+ *     CORO_BEGIN(c);
+ *     for (;;) {
+ *       (void)i2c_bus_submit(&s->xfer);  // xfer.done = on_done
+ *       CORO_WAIT_WAKE(c, 5);
+ *       if (!coro_timed_out(c)) ... publish the value ...
+ *       CORO_SLEEP(c, 20);
+ *     }
+ *     CORO_END(c);
+ *   }
+ *   coro_start(&s->co, "sensor", sensor_run, s);
+ */
+
+#ifndef CORO_MAX
+#define CORO_MAX 24u
+#endif
+
+typedef struct coro coro_t;
+
+/* Returns CORO_WAITING (after a wait or yield) or CORO_DONE; the macros
+ * below do it. */
+typedef int (*coro_fn_t)(coro_t *c, void *user);
+
+#define CORO_WAITING 0
+#define CORO_DONE 1
+
+/* Owned by the caller, usually inside the driver's state; opaque. */
+struct coro {
+  uint16_t pc; /* resume point: a line of the body, 0 = the top */
+  uint8_t used;
+  uint8_t yielded;
+  volatile uint8_t signalled; /* coro_wake() since the last run */
+  uint8_t woken;              /* signalled, as taken for this run */
+  uint8_t armed;              /* deadline set */
+  uint32_t deadline;          /* ThreadX tick */
+  const char *name;
+  coro_fn_t fn;
+  void *user;
+  uint32_t runs;
+  uint32_t run_max_us;
+  uint64_t run_total_us;
+};
+
+#define CORO_BEGIN(c)                                                        \
+  switch ((c)->pc) {                                                         \
+  case 0:
+
+#define CORO_END(c)                                                          \
+  }                                                                          \
+  (c)->pc = 0;                                                               \
+  return CORO_DONE
+
+/* Return here once `cond` holds; it is tested whenever the coroutine runs
+ * (woken, deadline passed), not continuously. */
+#define CORO_WAIT_UNTIL(c, cond)                                             \
+  do {                                                                       \
+    (c)->pc = (uint16_t)__LINE__;                                            \
+    __attribute__((fallthrough));                                            \
+  case __LINE__:                                                             \
+    if (!(cond))                                                             \
+      return CORO_WAITING;                                                   \
+  } while (0)
+
+/* Let the other coroutines run, then go on. */
+#define CORO_YIELD(c)                                                        \
+  do {                                                                       \
+    (c)->yielded = 1;                                                        \
+    (c)->pc = (uint16_t)__LINE__;                                            \
+    return CORO_WAITING;                                                     \
+  case __LINE__:;                                                            \
+  } while (0)
+
+/* Sleep `ms`; other wakes don't end it. */
+#define CORO_SLEEP(c, ms)                                                    \
+  do {                                                                       \
+    coro_arm((c), (ms));                                                     \
+    CORO_WAIT_UNTIL((c), coro_timed_out(c));                                 \
+  } while (0)
+
+/* Wait for coro_wake() or `ms`, whichever comes first; coro_timed_out()
+ * says which. A wake that came in since the coroutine last ran, e.g. from a
+ * transfer it just started, counts. */
+#define CORO_WAIT_WAKE(c, ms)                                                \
+  do {                                                                       \
+    coro_arm((c), (ms));                                                     \
+    (c)->woken = 0;                                                          \
+    CORO_WAIT_UNTIL((c), (c)->woken || coro_timed_out(c));                   \
+  } while (0)
+
+typedef struct {
+  const char *name;
+  uint32_t runs;
+  uint32_t run_max_us;
+  uint32_t run_avg_us;
+} coro_stats_t;
+
+#ifdef CORO_ENABLED
+
+/* Register `c` and run it soon. Returns 0, or -1 with CORO_MAX running or
+ * `c` already started. Any context but an ISR; before the kernel too. */
+int coro_start(coro_t *c, const char *name, coro_fn_t fn, void *user);
+
+/* Stop `c` before it ends by itself; from the executor thread (another
+ * coroutine) or while it isn't running. */
+void coro_stop(coro_t *c);
+
+/* Run `c` soon. ISR-safe; a wake before the run is remembered once. */
+void coro_wake(coro_t *c);
+
+/* Deadline `ms` from now (rounded up to ticks) for the waits above. */
+void coro_arm(coro_t *c, uint32_t ms);
+
+/* 1 once the armed deadline has passed, until the end of that run. */
+int coro_timed_out(const coro_t *c);
+
+/* Stats of the i-th running coroutine; 0 past the last. */
+int coro_get_stats(unsigned i, coro_stats_t *out);
+
+#else
+
+static inline int coro_start(coro_t *c, const char *name, coro_fn_t fn,
+                             void *user) {
+  (void)c;
+  (void)name;
+  (void)fn;
+  (void)user;
+  return -1;
+}
+static inline void coro_stop(coro_t *c) { (void)c; }
+static inline void coro_wake(coro_t *c) { (void)c; }
+static inline void coro_arm(coro_t *c, uint32_t ms) {
+  (void)c;
+  (void)ms;
+}
+static inline int coro_timed_out(const coro_t *c) {
+  (void)c;
+  return 1;
+}
+static inline int coro_get_stats(unsigned i, coro_stats_t *out) {
+  (void)i;
+  (void)out;
+  return 0;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
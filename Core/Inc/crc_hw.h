@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRCs on the G4's CRC unit. Any 7, 8, 16 or 32-bit polynomial in the usual
+ * parameter model (poly in normal form, init, input and output reflection,
+ * final xor); buffers from CRC_HW_DMA_MIN_BYTES up are fed to the unit by
+ * the DMA copy channel (dma_copy.h) while the caller's thread sleeps.
+ *
+ * The unit is shared under a mutex. Calls from interrupts or before the
+ * scheduler compute the same CRC in software instead.
+ */
+
+#ifndef CRC_HW_DMA_MIN_BYTES
+#define CRC_HW_DMA_MIN_BYTES 256u
+#endif
+
+typedef struct {
+  uint32_t poly;   /* normal form, without the top bit */
+  uint32_t init;
+  uint32_t xorout;
+  uint8_t width;   /* 7, 8, 16 or 32 */
+  uint8_t refin;
+  uint8_t refout;
+} crc_hw_params_t;
+
+/* CRC-32 (ISO-HDLC: Ethernet, zlib) and CRC-16/CCITT-FALSE. */
+extern const crc_hw_params_t crc_hw_crc32;
+extern const crc_hw_params_t crc_hw_crc16_ccitt;
+
+/* Clock the unit and create its mutex. From tx_application_define(),
+ * after dma_copy_init(). */
+HAL_StatusTypeDef crc_hw_init(void);
+
+/* CRC of `len` bytes; 0 for an unsupported width. */
+uint32_t crc_hw_compute(const crc_hw_params_t *p, const void *data,
+                        size_t len);
+
+/* The software model crc_hw_compute() falls back to. */
+uint32_t crc_sw_compute(const crc_hw_params_t *p, const void *data,
+                        size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Logic-analyzer markers: named events on spare GPIO pins, each edge a
+ * single BSRR store, for timing the CAN/telemetry path against the bus on
+ * a scope.
+ *
+ *   DBG_MARK_HI(CAN_ISR);  ...  DBG_MARK_LO(CAN_ISR);   span
+ *   DBG_MARK_PULSE(REASM_DONE);                          instant
+ *
+ * Events and their default pins (override DBG_MARK_PORT_<event> /
+ * DBG_MARK_PIN_<event>; pin 0 leaves an event unmarked):
+ *   CAN_ISR         PB4  FDCAN RX FIFO drain, per interrupt line
+ *   RB_PUSH         PB5  one frame into the RX ring
+ *   REASM_DONE      PB6  CAN message reassembled
+ *   ROUTER_DISPATCH PB7  router TX queue pass
+ *   TX_SEND         PB10 router -> CAN side callback
+ *
+ * With DBG_MARKERS_ENABLED undefined (CMake option ENABLE_DBG_MARKERS)
+ * the macros expand to nothing and the pins are left alone.
+ */
+
+#ifdef DBG_MARKERS_ENABLED
+
+#include "stm32g4xx_hal.h"
+
+#ifndef DBG_MARK_PORT_CAN_ISR
+#define DBG_MARK_PORT_CAN_ISR GPIOB
+#endif
+#ifndef DBG_MARK_PIN_CAN_ISR
+#define DBG_MARK_PIN_CAN_ISR GPIO_PIN_4
+#endif
+#ifndef DBG_MARK_PORT_RB_PUSH
+#define DBG_MARK_PORT_RB_PUSH GPIOB
+#endif
+#ifndef DBG_MARK_PIN_RB_PUSH
+#define DBG_MARK_PIN_RB_PUSH GPIO_PIN_5
+#endif
+#ifndef DBG_MARK_PORT_REASM_DONE
+#define DBG_MARK_PORT_REASM_DONE GPIOB
+#endif
+#ifndef DBG_MARK_PIN_REASM_DONE
+#define DBG_MARK_PIN_REASM_DONE GPIO_PIN_6
+#endif
+#ifndef DBG_MARK_PORT_ROUTER_DISPATCH
+#define DBG_MARK_PORT_ROUTER_DISPATCH GPIOB
+#endif
+#ifndef DBG_MARK_PIN_ROUTER_DISPATCH
+#define DBG_MARK_PIN_ROUTER_DISPATCH GPIO_PIN_7
+#endif
+#ifndef DBG_MARK_PORT_TX_SEND
+#define DBG_MARK_PORT_TX_SEND GPIOB
+#endif
+#ifndef DBG_MARK_PIN_TX_SEND
+#define DBG_MARK_PIN_TX_SEND GPIO_PIN_10
+#endif
+
+/* Configure every marked pin as a low push-pull output; after the port
+ * clocks are on (MX_GPIO_Init()). */
+void dbg_marker_init(void);
+
+#define DBG_MARK_HI(ev)                                                        \
+  (DBG_MARK_PORT_##ev->BSRR = (uint32_t)DBG_MARK_PIN_##ev)
+#define DBG_MARK_LO(ev)                                                        \
+  (DBG_MARK_PORT_##ev->BSRR = (uint32_t)DBG_MARK_PIN_##ev << 16)
+#define DBG_MARK_PULSE(ev)                                                     \
+  do {                                                                         \
+    DBG_MARK_HI(ev);                                                           \
+    DBG_MARK_LO(ev);                                                           \
+  } while (0)
+
+#else
+
+static inline void dbg_marker_init(void) {}
+
+#define DBG_MARK_HI(ev) ((void)0)
+#define DBG_MARK_LO(ev) ((void)0)
+#define DBG_MARK_PULSE(ev) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Memory-to-memory copies on the DMA1 channel CubeMX sets aside (channel 1,
+ * hdma_dma_generator0). Requests are queued and run one after the other
+ * from the channel's interrupt; word transfers when source, destination
+ * and length are all multiples of 4, bytes otherwise.
+ *
+ * Copies below DMA_COPY_MIN_BYTES, copies touching CCM SRAM, and copies
+ * with the queue full are done with memcpy() on the spot: setting up the
+ * channel costs more than moving a few hundred bytes.
+ */
+
+#ifndef DMA_COPY_MIN_BYTES
+#define DMA_COPY_MIN_BYTES 256u
+#endif
+
+/* Runs in interrupt context once the bytes are in place (or with
+ * HAL_ERROR on a transfer error, contents undefined). */
+typedef void (*dma_copy_cb_t)(HAL_StatusTypeDef st, void *user);
+
+typedef struct {
+  uint32_t dma;      /* copies moved by DMA */
+  uint32_t bytes;    /* bytes moved by DMA */
+  uint32_t cpu;      /* done with memcpy() instead */
+  uint32_t errors;   /* DMA transfer errors */
+  uint32_t waits;    /* dma_copy() calls that blocked on the channel */
+} dma_copy_stats_t;
+
+/* Program the channel for memory-to-memory use and create the completion
+ * flags. From tx_application_define(), before anything copies. */
+HAL_StatusTypeDef dma_copy_init(void);
+
+/*
+ * Start copying `len` bytes; neither buffer may be touched until `done`
+ * runs. A copy that isn't worth the channel is done before this returns,
+ * and `done` (may be NULL) is called from here. Any context. Buffers must
+ * not overlap.
+ */
+void dma_copy_async(void *dst, const void *src, size_t len,
+                    dma_copy_cb_t done, void *user);
+
+/*
+ * memcpy() that lets other threads run while a large copy is on the DMA
+ * channel. Falls back to memcpy() where it can't block: ISRs, before the
+ * scheduler, or with the queue full.
+ */
+void dma_copy(void *dst, const void *src, size_t len);
+
+/*
+ * dma_copy() into one peripheral data register: `len` bytes (a multiple of
+ * `width`, 1 or 4) written `width` at a time to `reg`, in order. `src` must
+ * be aligned to `width`.
+ */
+void dma_copy_to_reg(volatile void *reg, const void *src, size_t len,
+                     uint8_t width);
+
+void dma_copy_get_stats(dma_copy_stats_t *out);
+
+/* DMA1 channel 1 interrupt (stm32g4xx_it.c). */
+void dma_copy_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sedsprintf.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Anti-alias filtering and decimation of high-rate sensor streams on the
+ * FMAC, ahead of the router. A channel takes q1.15 samples of 1 to
+ * DSP_FILTER_MAX_ELEMS elements (one sensor axis each) from any context,
+ * runs each element through the same FIR in blocks of DSP_FILTER_BLOCK
+ * samples, and forwards every `decimate`-th output as one sample of
+ * `type` through log_telemetry_from_isr_at(), stamped with the time its
+ * input sample was pushed. The filter's group delay is not taken off.
+ *
+ * With `polar` set, a two-element channel is sent as (magnitude, phase) of
+ * its filtered (x, y) instead, from the CORDIC. Phase is q1.15 of pi.
+ *
+ * The FMAC and CORDIC work on a low-priority DSP thread
+ * (create_dsp_filter_thread(), GB-Threads.h); the producer only copies into
+ * the channel's ring.
+ */
+
+#ifndef DSP_FILTER_MAX_CHANNELS
+#define DSP_FILTER_MAX_CHANNELS 4u
+#endif
+#ifndef DSP_FILTER_MAX_ELEMS
+#define DSP_FILTER_MAX_ELEMS 3u
+#endif
+#ifndef DSP_FILTER_MAX_TAPS
+#define DSP_FILTER_MAX_TAPS 32u
+#endif
+/* Samples per FMAC run, and the ring holds two runs' worth. */
+#ifndef DSP_FILTER_BLOCK
+#define DSP_FILTER_BLOCK 32u
+#endif
+
+typedef struct {
+  SedsDataType type;     /* of the forwarded samples: int16 elements */
+  const int16_t *coeffs; /* q1.15 taps, b0 first (copied) */
+  uint8_t taps;          /* 1 .. DSP_FILTER_MAX_TAPS */
+  uint8_t shift;         /* output gain 2^shift, 0 .. 7 */
+  uint8_t elems;         /* 1 .. DSP_FILTER_MAX_ELEMS */
+  uint8_t polar;         /* elems == 2: send magnitude and phase */
+  uint16_t decimate;     /* forward one output in this many, >= 1 */
+} dsp_filter_cfg_t;
+
+typedef struct {
+  uint32_t pushed;
+  uint32_t overruns; /* samples dropped with a channel's ring full */
+  uint32_t blocks;   /* FMAC runs */
+  uint32_t sent;     /* outputs forwarded */
+  uint32_t dropped;  /* outputs refused by the intake ring */
+  uint32_t errors;   /* FMAC or CORDIC failures; the block is lost */
+} dsp_filter_stats_t;
+
+/* Add a channel; its handle, or -1 with the table full or `cfg` invalid. */
+int dsp_filter_add(const dsp_filter_cfg_t *cfg);
+
+void dsp_filter_remove(int handle);
+
+/*
+ * Push one sample (`elems` values). Any context, one producer per channel;
+ * HAL_BUSY when the ring is full, HAL_ERROR for a bad handle.
+ */
+HAL_StatusTypeDef dsp_filter_push(int handle, const int16_t *x);
+
+/*
+ * Magnitude and phase of `n` q1.15 (x, y) pairs into `out` (same layout),
+ * on the CORDIC. Thread context. Magnitudes saturate at 1.
+ */
+HAL_StatusTypeDef dsp_polar_q15(const int16_t *xy, size_t n, int16_t *out);
+
+void dsp_filter_get_stats(dsp_filter_stats_t *out);
+
+/* DMA interrupt entry points (stm32g4xx_it.c). */
+void dsp_filter_dma_in_irq(void);
+void dsp_filter_dma_out_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
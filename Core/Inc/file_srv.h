@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "can_bulk.h"
+#include "can_bus.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Named file pulls between nodes (FILE_SRV_ENABLED, CMake option
+ * ENABLE_FILE_SRV), on can_bulk.h sessions. Every node serves the files it
+ * registered on one pair of IDs, FILE_SRV_RX_ID / FILE_SRV_TX_ID; the
+ * gateway pulls one from a node on that node's pair and the bytes go to a
+ * sink as they arrive (telemetry.c forwards them to USB), so no file is
+ * ever held in RAM at either end.
+ *
+ * A pull is two bulk transfers on the same pair. The request goes to the
+ * node:
+ *   u32 offset to start at, name (1..FILE_SRV_NAME_MAX bytes, no NUL)
+ * and the node answers with
+ *   u8 status (FILE_SRV_*), 3 bytes 0, u32 file size, bytes from offset on
+ * (little-endian), the file bytes only with status OK. The size is the
+ * file's when the request was taken; files that grow while being read
+ * (logs) are pulled up to that point.
+ *
+ * Node IDs: FILE_SRV_RX_ID and FILE_SRV_TX_ID are set per node; the gateway
+ * takes answers on FILE_SRV_PULL_FIRST..LAST, which pass its filters, so
+ * node TX IDs must be in that range. Everything runs in the telemetry RX
+ * thread, like can_bulk.c.
+ */
+
+#ifndef FILE_SRV_RX_ID
+#define FILE_SRV_RX_ID 0x7C0u /* requests to this node */
+#endif
+#ifndef FILE_SRV_TX_ID
+#define FILE_SRV_TX_ID 0x7D0u /* its answers */
+#endif
+#ifndef FILE_SRV_PULL_FIRST
+#define FILE_SRV_PULL_FIRST 0x7D0u
+#endif
+#ifndef FILE_SRV_PULL_LAST
+#define FILE_SRV_PULL_LAST 0x7DFu
+#endif
+#ifndef FILE_SRV_NAME_MAX
+#define FILE_SRV_NAME_MAX 16u
+#endif
+#ifndef FILE_SRV_MAX_FILES
+#define FILE_SRV_MAX_FILES 4u
+#endif
+
+/* Answer status. */
+#define FILE_SRV_OK 0x00u
+#define FILE_SRV_NOT_FOUND 0x01u  /* no file by that name */
+#define FILE_SRV_BAD_OFFSET 0x02u /* offset past the end */
+#define FILE_SRV_BAD_REQ 0x03u    /* malformed request */
+#define FILE_SRV_LOST 0x04u       /* pull side: the transfer broke off, or
+                                     the node never took the request */
+
+/* Snapshot a file for one read-through; returns its size (0 = empty or
+ * unavailable). */
+typedef uint32_t (*file_srv_open_t)(void *user);
+
+/*
+ * Pulled bytes: with status OK, `len` bytes at file offset `off` of a
+ * `size`-byte file, in order, and CAN_BUS_STREAM_END on the last call (which
+ * may carry no bytes). Any other status ends the pull with no bytes. Return
+ * 0 once taken, non-zero to refuse them for now (they come again).
+ */
+typedef int (*file_srv_sink_t)(uint8_t status, const uint8_t *data,
+                               size_t len, uint32_t off, uint32_t size,
+                               uint8_t flags, void *user);
+
+#ifdef FILE_SRV_ENABLED
+
+/* Open this node's serving session on `bus` and register the built-in
+ * files ("sdlog" with SD_LOG_ENABLED); at router init. */
+void file_srv_init(can_bus_t *bus);
+
+/* Serve `name`; `read` is called as the transfer moves. HAL_ERROR if the
+ * name is bad or taken, or the table (FILE_SRV_MAX_FILES) is full. */
+HAL_StatusTypeDef file_srv_register(const char *name, file_srv_open_t open,
+                                    can_bulk_source_t read, void *user);
+
+/*
+ * Pull `name` from `offset` on from the node with request ID `req_id` and
+ * answer ID `rep_id` (FILE_SRV_PULL_FIRST..LAST). HAL_BUSY while another
+ * pull runs or the request can't be queued, HAL_ERROR on bad arguments.
+ */
+HAL_StatusTypeDef file_srv_pull(uint16_t req_id, uint16_t rep_id,
+                                uint32_t offset, const char *name,
+                                size_t name_len, file_srv_sink_t sink,
+                                void *user);
+
+/* Drop the pull in progress; its sink hears nothing more. */
+void file_srv_pull_abort(void);
+
+/* Start an answer that couldn't be queued yet. Call before
+ * can_bulk_poll(); returns the ms until it has work again (UINT32_MAX if
+ * idle). */
+uint32_t file_srv_poll(void);
+
+#else
+
+static inline uint32_t file_srv_poll(void) { return UINT32_MAX; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Store-and-forward record ring in the internal flash pages the linker
+ * script sets aside as FLASH_LOG (_sflash_log .. _eflash_log).
+ *
+ * Page layout (2 KB pages, little-endian, 8-byte aligned):
+ *
+ *   u32 magic "FLG1", u32 seq   page header, seq + 1 per page opened
+ *   u64 read mark               erased: unread records; zero: all read
+ *   records: u16 len, u16 ~len, payload[len], padded to 8 bytes
+ *
+ * Appends are staged in RAM and programmed by flash_log_poll(). The reading
+ * side (flash_log_peek() / flash_log_pop()) sees records once they are in
+ * flash, oldest first, across resets. poll, peek and pop belong to one
+ * thread; appends may come from any thread.
+ */
+
+/* Largest record flash_log_append() takes. */
+#ifndef FLASH_LOG_STAGE_BYTES
+#define FLASH_LOG_STAGE_BYTES 1024u
+#endif
+#define FLASH_LOG_RECORD_MAX (FLASH_LOG_STAGE_BYTES - 4u)
+
+typedef struct {
+  uint32_t stored;       /* records programmed */
+  uint32_t read;         /* records popped */
+  uint32_t dropped_full; /* staging full: poll too far behind */
+  uint32_t dropped_big;  /* over FLASH_LOG_RECORD_MAX */
+  uint32_t pages_lost;   /* unread pages erased because the ring was full */
+  uint32_t erases;
+  uint32_t errors;       /* program or erase failures */
+  uint16_t pages;        /* in the ring, 0 until flash_log_init() */
+  uint16_t pages_unread;
+} flash_log_stats_t;
+
+/* Scan the region for the oldest unread and the newest page. Boot or
+ * thread context, before any other call. */
+HAL_StatusTypeDef flash_log_init(void);
+
+/*
+ * Stage one record for programming. HAL_BUSY if the staging buffer is full,
+ * HAL_ERROR if too big or not initialized.
+ */
+HAL_StatusTypeDef flash_log_append(const uint8_t *data, size_t len);
+
+/*
+ * Program what was staged, or else erase one read-back page ahead of the
+ * writer. Returns ms until it has more to do, UINT32_MAX when idle. Each
+ * call stalls flash fetches for the duration (see flash_log.c).
+ */
+uint32_t flash_log_poll(void);
+
+/* The oldest unread record, pointing into flash; 0 if none. */
+int flash_log_peek(const uint8_t **data, size_t *len);
+
+/* Drop the record flash_log_peek() returned. */
+void flash_log_pop(void);
+
+void flash_log_get_stats(flash_log_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "can_bus.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Firmware delivery to another node on the bus (FW_RELAY_ENABLED, CMake
+ * option ENABLE_FW_RELAY). The host sends the image to the gateway over
+ * USB (FW_RELAY_* in telemetry.h) and the gateway streams it to the target
+ * over CAN-FD as FW_BLOCK commands through an ISO-TP session, the target
+ * running fw_update.h on its own ISO-TP IDs.
+ *
+ * The stream is windowed: up to FW_RELAY_WINDOW blocks of the image sit in
+ * gateway RAM, and blocks go out back to back as long as the target's last
+ * answer left room for them (its u32 taken / u32 room credit), without
+ * waiting for each answer. Every block carries its own CRC-32. A target
+ * answering BUSY or BAD_ARG, or not at all, sends it back to the first
+ * byte the target lacks (go-back-N); acknowledged blocks free their slot
+ * for the host's next ones, so the host is paced by BUSY answers to
+ * FW_RELAY_DATA. Commands (host side):
+ *   FW_RELAY_BEGIN   u16 target request ID, u16 target reply ID, u32 size,
+ *                    u32 CRC-32 of the image; the reply ID must be within
+ *                    FW_RELAY_REPLY_FIRST..LAST, which pass the filters
+ *   FW_RELAY_DATA    u32 offset, bytes, as FW_DATA; BAD_ARG once the
+ *                    target refused the image or stopped answering
+ *   FW_RELAY_COMMIT  [u8 1 = target resets into it]: BUSY until the target
+ *                    has every byte and answered its COMMIT, then its
+ *                    answer
+ *   FW_RELAY_ABORT   tell the target to drop it, end the session
+ * Everything runs in the telemetry RX thread, like isotp.c.
+ */
+
+#ifndef FW_RELAY_BLOCK_BYTES
+#define FW_RELAY_BLOCK_BYTES 1024u
+#endif
+#ifndef FW_RELAY_WINDOW
+#define FW_RELAY_WINDOW 4u /* blocks buffered, sent or not */
+#endif
+/* Target reply IDs the gateway takes ISO-TP frames from. */
+#ifndef FW_RELAY_REPLY_FIRST
+#define FW_RELAY_REPLY_FIRST 0x7F0u
+#endif
+#ifndef FW_RELAY_REPLY_LAST
+#define FW_RELAY_REPLY_LAST 0x7FFu
+#endif
+
+#ifdef FW_RELAY_ENABLED
+
+/* Bus the targets are on; at router init. */
+void fw_relay_init(can_bus_t *bus);
+
+/* Run one FW_RELAY_* command; returns its TELEMETRY_USB_CTRL_* status. */
+uint8_t fw_relay_ctrl(uint8_t op, const uint8_t *args, size_t n);
+
+/* Send what is due and expire unanswered blocks. Call before isotp_poll();
+ * returns the ms until it has work again (UINT32_MAX if idle). */
+uint32_t fw_relay_poll(void);
+
+#else
+
+static inline uint32_t fw_relay_poll(void) { return UINT32_MAX; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-application firmware update (FW_UPDATE_ENABLED, CMake option
+ * ENABLE_FW_UPDATE). A new image streams into the staging slot, the upper
+ * half of the application flash (_sfw_stage.._efw_stage in
+ * STM32G491XX_FLASH.ld), while the gateway keeps routing. COMMIT checks its
+ * CRC-32 and marks it pending with a trailer at the end of the slot; at the
+ * next reset fw_update_install() copies it over the running image and
+ * resets into it.
+ *
+ * The STM32G491 has one flash bank, so there is no bank swap (DBANK/BFB2):
+ * "slot B" is a region and the swap is that copy, run from CCM with
+ * interrupts off, a few seconds for a full slot. A reset during the copy
+ * just runs it again, but the old image is gone by then: power lost in the
+ * middle leaves a board that needs ST-LINK or DFU.
+ *
+ * The commands are transport-agnostic; telemetry.c feeds them from USB
+ * control frames and from a CAN-FD ISO-TP session (telemetry.h):
+ *   BEGIN   u32 size, u32 CRC-32 (ISO-HDLC) of the image; drops any
+ *           previous session, pending one included
+ *   DATA    u32 offset, bytes: in order; a resend of bytes already taken
+ *           is fine, a gap is BAD_ARG, BUSY while both page buffers wait
+ *           for flash (send it again)
+ *   BLOCK   DATA with a u32 CRC-32 of the bytes after them; BAD_ARG if it
+ *           doesn't match (fw_relay.h sends these)
+ *   COMMIT  [u8 1 = reset once pending]: BUSY while the tail programs and
+ *           the CRC is checked (send it again), then OK or BAD_ARG
+ *   ABORT   drop the session, pending one included
+ * Flash work happens in fw_update_poll(), telemetry maintenance thread.
+ */
+
+#ifdef FW_UPDATE_ENABLED
+
+#include "stm32g4xx_hal.h"
+
+/* Create the session lock; with the other flash users at router init. */
+HAL_StatusTypeDef fw_update_init(void);
+
+/* Run one command (TELEMETRY_USB_CTRL_FW_*) and return its
+ * TELEMETRY_USB_CTRL_* status. Telemetry RX thread. */
+uint8_t fw_update_ctrl(uint8_t op, const uint8_t *args, size_t n);
+
+/* Bytes taken so far, and how many more DATA would take right now (0 when
+ * not receiving): the credit a sender paces itself by. */
+void fw_update_progress(uint32_t *next, uint32_t *room);
+
+/* Erase, program and verify what the commands left. Maintenance thread;
+ * returns the ms until it has work again (UINT32_MAX if idle). */
+uint32_t fw_update_poll(void);
+
+/* Install a pending image and reset into it; returns if there is none.
+ * From main(), once the clock is up and before anything is started. */
+void fw_update_install(void);
+
+#else
+
+static inline uint32_t fw_update_poll(void) { return UINT32_MAX; }
+static inline void fw_update_install(void) {}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+#include "telemetry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * GNSS time for the gateway as time master (GNSS_TIME_ENABLED, CMake option
+ * ENABLE_GNSS_TIME, which also builds the master side of the time sync).
+ *
+ *  - PPS: rising edges on GNSS_TIME_PPS_PIN are captured by TIM2 channel 2
+ *    (us_clock_set_capture()), so each edge has an exact raw time.
+ *  - NMEA: USART2 RX at GNSS_TIME_BAUDRATE, received by circular DMA with no
+ *    interrupts; $--RMC (status A) and $--ZDA sentences with a good checksum
+ *    give the UTC second.
+ *  - gnss_time_poll(), from the maintenance thread, pairs them: a sentence
+ *    for a whole second received within a second of an edge names that
+ *    edge (u-blox and most receivers send the time of the last PPS after
+ *    it). The edge goes to telemetry_pps_edge(), which disciplines the node
+ *    clock to it and takes unix time from it; an edge no sentence claimed
+ *    still steers the clock. The master's TIME_SYNC_RESPONSEs then carry
+ *    PPS time, and an announce goes out every GNSS_TIME_ANNOUNCE_MS.
+ *  - Without PPS the sentences alone set unix time, to the UART latency.
+ */
+
+#ifndef GNSS_TIME_BAUDRATE
+#define GNSS_TIME_BAUDRATE 9600u
+#endif
+#ifndef GNSS_TIME_PPS_PORT
+#define GNSS_TIME_PPS_PORT GPIOA
+#endif
+#ifndef GNSS_TIME_PPS_PIN
+#define GNSS_TIME_PPS_PIN GPIO_PIN_1 /* TIM2_CH2 */
+#endif
+#ifndef GNSS_TIME_PPS_AF
+#define GNSS_TIME_PPS_AF GPIO_AF1_TIM2
+#endif
+#ifndef GNSS_TIME_RX_PORT
+#define GNSS_TIME_RX_PORT GPIOA
+#endif
+#ifndef GNSS_TIME_RX_PIN
+#define GNSS_TIME_RX_PIN GPIO_PIN_3 /* USART2_RX */
+#endif
+#ifndef GNSS_TIME_RX_AF
+#define GNSS_TIME_RX_AF GPIO_AF7_USART2
+#endif
+#ifndef GNSS_TIME_ANNOUNCE_MS
+#define GNSS_TIME_ANNOUNCE_MS 5000u
+#endif
+/* Priority field of the announces. */
+#ifndef GNSS_TIME_ANNOUNCE_PRIORITY
+#define GNSS_TIME_ANNOUNCE_PRIORITY 1u
+#endif
+
+typedef struct {
+  uint32_t pps_edges;    /* captured, glitches dropped */
+  uint32_t pps_glitches; /* edges too soon after the last one */
+  uint32_t nmea_ok;      /* time sentences parsed */
+  uint32_t nmea_bad;     /* checksum, format or no-fix */
+  uint32_t rx_lapped;    /* polls too late to keep every byte */
+  uint32_t announces;
+  uint8_t  fix;          /* last RMC status was A */
+  telemetry_pps_stats_t pps;
+} gnss_time_stats_t;
+
+#ifdef GNSS_TIME_ENABLED
+
+/* Pins, USART2 and its DMA, and the PPS capture. After us_clock_init(). */
+HAL_StatusTypeDef gnss_time_init(void);
+
+/* Parse what came in and feed edges to the clock; ms until it wants to
+ * run again. Maintenance thread. */
+uint32_t gnss_time_poll(void);
+
+void gnss_time_get_stats(gnss_time_stats_t *out);
+
+#else
+
+static inline HAL_StatusTypeDef gnss_time_init(void) { return HAL_OK; }
+static inline uint32_t gnss_time_poll(void) { return UINT32_MAX; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
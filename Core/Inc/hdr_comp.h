@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Header compression for serialized router packets on a byte link, with a
+ * table of stream contexts kept at both ends. A stream (one data type from
+ * one sender, picked by the caller's key) repeats nearly the same header
+ * on every packet; its context holds the first HDR_COMP_TEMPLATE_BYTES of
+ * one packet as a template, and later packets only carry the bytes of
+ * that span that differ from it (timestamp, length), then the rest as is:
+ *
+ *   define:     [HDR_COMP_TAG][0x80 | ctx << 4 | gen][packet]
+ *   compressed: [HDR_COMP_TAG][ctx << 4 | gen][u8 span][bitmap][bytes][rest]
+ *   escaped:    [HDR_COMP_TAG][0xFF][packet]   (packet starts with the tag)
+ *   other:      [packet]
+ *
+ * The bitmap has a bit per byte of the span, LSB first, set where the
+ * packet differs, and the differing bytes follow in order. Every define
+ * moves the context to a new generation (0..14) and a compressed frame
+ * names the one it was made against, so a decoder that missed a define
+ * drops the frames that depend on it instead of rebuilding them wrongly;
+ * the encoder sends a fresh define every HDR_COMP_REFRESH packets.
+ */
+
+#define HDR_COMP_TAG 0xC6u
+#define HDR_COMP_NO_KEY 0xFFFFu
+
+#ifndef HDR_COMP_CONTEXTS
+#define HDR_COMP_CONTEXTS 8u /* at most 8 */
+#endif
+#ifndef HDR_COMP_TEMPLATE_BYTES
+#define HDR_COMP_TEMPLATE_BYTES 32u
+#endif
+#ifndef HDR_COMP_REFRESH
+#define HDR_COMP_REFRESH 32u
+#endif
+/* Packets up to this long go as they are. */
+#ifndef HDR_COMP_MIN_BYTES
+#define HDR_COMP_MIN_BYTES 8u
+#endif
+
+/* Most an encoded frame exceeds its packet by (define or escape). */
+#define HDR_COMP_GROWTH 2u
+
+typedef struct {
+  uint8_t used;
+  uint8_t gen;
+  uint8_t len;  /* template bytes */
+  uint8_t uses; /* packets since the define */
+  uint16_t key;
+  uint32_t last; /* for LRU reuse */
+  uint8_t tpl[HDR_COMP_TEMPLATE_BYTES];
+} hdr_comp_ctx_t;
+
+typedef struct {
+  hdr_comp_ctx_t ctx[HDR_COMP_CONTEXTS];
+  uint32_t tick;
+} hdr_comp_t;
+
+typedef enum {
+  HDR_COMP_PASS = 0, /* not an encoded frame: the input is the packet */
+  HDR_COMP_OK,       /* *pkt / *pkt_len hold the packet */
+  HDR_COMP_DROP,     /* unknown context, stale generation or corrupt */
+} hdr_comp_result_t;
+
+void hdr_comp_reset(hdr_comp_t *c);
+
+/*
+ * Encode `pkt` of stream `key` (HDR_COMP_NO_KEY: no stream, sent whole)
+ * into `out`, which takes len + HDR_COMP_GROWTH bytes. Returns the frame
+ * length; the frame is never longer than a define of the packet.
+ */
+size_t hdr_comp_encode(hdr_comp_t *c, uint16_t key, const uint8_t *pkt,
+                       size_t len, uint8_t *out);
+
+/*
+ * Decode one frame. A rebuilt packet goes to `buf` (`cap` bytes; len +
+ * HDR_COMP_TEMPLATE_BYTES always suffice); a define or escape points into
+ * `in`.
+ */
+hdr_comp_result_t hdr_comp_decode(hdr_comp_t *c, const uint8_t *in,
+                                  size_t len, uint8_t *buf, size_t cap,
+                                  const uint8_t **pkt, size_t *pkt_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Transaction queue on the I2C2 sensor bus. Each transaction is a write
+ * (register address, command) and/or a read after a repeated start, both
+ * by DMA; the completion interrupt of one starts the next, so a queue of
+ * them runs without a thread. Devices registered with a period are queued
+ * by the I2C bus thread (create_i2c_bus_thread(), GB-Threads.h) when due.
+ *
+ * The `done` callback runs in interrupt context with the bytes read and
+ * the us_clock_now() time the transaction started: decode there and hand
+ * the value to log_telemetry_from_isr_at(), which doesn't block.
+ */
+
+#ifndef I2C_BUS_TX_MAX
+#define I2C_BUS_TX_MAX 4u
+#endif
+#ifndef I2C_BUS_RX_MAX
+#define I2C_BUS_RX_MAX 32u
+#endif
+
+/* `rx` is only valid during the call; st is HAL_OK, HAL_ERROR (NACK, bus
+ * error, arbitration lost) or HAL_TIMEOUT (the bus was reset). */
+typedef void (*i2c_bus_done_cb_t)(HAL_StatusTypeDef st, const uint8_t *rx,
+                                  size_t len, uint64_t t_us, void *user);
+
+typedef struct {
+  uint8_t addr;   /* 7-bit */
+  uint8_t tx_len; /* bytes written first, up to I2C_BUS_TX_MAX */
+  uint8_t rx_len; /* bytes read after, up to I2C_BUS_RX_MAX */
+  uint8_t tx[I2C_BUS_TX_MAX];
+  i2c_bus_done_cb_t done; /* may be NULL */
+  void *user;
+} i2c_bus_xfer_t;
+
+typedef struct {
+  uint32_t queued;
+  uint32_t done;       /* completed with HAL_OK */
+  uint32_t errors;     /* NACK or bus error */
+  uint32_t timeouts;   /* stuck transactions that reset the bus */
+  uint32_t overruns;   /* periods skipped: the last poll was still queued */
+  uint32_t queue_full; /* i2c_bus_submit() refused */
+} i2c_bus_stats_t;
+
+/* Link DMA to the initialized handle and enable its interrupts. Boot. */
+HAL_StatusTypeDef i2c_bus_init(I2C_HandleTypeDef *hi2c);
+
+/* Queue one transaction (copied). Any context; HAL_BUSY with the queue
+ * (I2C_BUS_QUEUE_LEN) full, HAL_ERROR if invalid or before init. */
+HAL_StatusTypeDef i2c_bus_submit(const i2c_bus_xfer_t *x);
+
+/*
+ * Poll `x` every `period_ms` from now on. Returns a handle, or -1 with the
+ * table (I2C_BUS_MAX_DEVICES) full or `x` invalid. A poll still queued
+ * when the next is due makes that one skip (overruns).
+ */
+int i2c_bus_add_device(const i2c_bus_xfer_t *x, uint32_t period_ms);
+
+void i2c_bus_remove_device(int handle);
+
+void i2c_bus_get_stats(i2c_bus_stats_t *out);
+
+/* Interrupt entry points (stm32g4xx_it.c). */
+void i2c_bus_ev_irq(void);
+void i2c_bus_er_irq(void);
+void i2c_bus_dma_tx_irq(void);
+void i2c_bus_dma_rx_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "can_bus.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ISO 15765-2 (ISO-TP) transport over the CAN FD driver, normal addressing
+ * on standard IDs, for tools that don't speak our fragment scheme. Sends use
+ * 64-byte FD frames, 8-byte classic ones when tx_id has the classic profile
+ * (can_bus_set_peer_profile()); the receiver's flow control (block size,
+ * STmin) paces consecutive frames. Each session is one (tx_id, rx_id) pair and runs
+ * independently of the others; rx_id is unique across sessions even when
+ * they sit on different controllers.
+ *
+ * Frames reach a session through can_bus_subscribe_id(), so rx_id must also
+ * pass the hardware filters (can_bus_set_filters()). Everything runs in the
+ * thread that calls can_bus_process_rx() and isotp_poll().
+ */
+
+/* One complete inbound message; valid until return. */
+typedef void (*isotp_rx_cb_t)(const uint8_t *data, size_t len, void *user);
+
+/* End of an isotp_send(): HAL_OK once the last frame is queued, HAL_ERROR if
+ * the receiver refused it, HAL_TIMEOUT if it stopped answering. */
+typedef void (*isotp_tx_done_cb_t)(HAL_StatusTypeDef status, void *user);
+
+typedef struct {
+  can_bus_t *bus;   /* controller the session runs on (can_bus_get()) */
+  uint16_t tx_id;   /* our frames, including flow control */
+  uint16_t rx_id;   /* the peer's frames */
+  uint8_t block_size; /* CFs between our flow controls; 0 = no limit */
+  uint8_t st_min;     /* requested CF gap, ISO-TP encoding (0-0x7F ms,
+                         0xF1-0xF9 = 100-900 us) */
+  uint8_t *rx_buf;  /* inbound messages larger than one frame land here */
+  size_t rx_cap;    /* larger ones are refused with an overflow FC */
+  isotp_rx_cb_t on_rx;
+  isotp_tx_done_cb_t on_tx_done; /* optional */
+  void *user;
+} isotp_config_t;
+
+typedef struct {
+  uint32_t rx_msgs;
+  uint32_t tx_msgs;
+  uint32_t rx_aborted; /* bad sequence number, timeout, overflow */
+  uint32_t tx_aborted; /* overflow FC, FC timeout, too many WAITs */
+} isotp_stats_t;
+
+/*
+ * Start a session; `cfg` is copied. Returns HAL_ERROR if rx_id is already
+ * claimed on the CAN driver or the table (ISOTP_MAX_SESSIONS) is full.
+ */
+HAL_StatusTypeDef isotp_open(const isotp_config_t *cfg);
+
+/* End the session on `rx_id`, dropping any transfer in progress. */
+void isotp_close(uint16_t rx_id);
+
+/*
+ * Start sending `len` bytes (up to 2^32-1) on the session for `rx_id`.
+ * `data` must stay valid until on_tx_done runs; frames after the first wait
+ * for the receiver's flow control and go out from isotp_poll().
+ * Returns HAL_BUSY if a send is in progress or the first frame can't be
+ * queued, HAL_ERROR for an unknown session.
+ */
+HAL_StatusTypeDef isotp_send(uint16_t rx_id, const void *data, size_t len);
+
+/*
+ * Send consecutive frames that are due and expire stalled transfers. Call
+ * after can_bus_process_rx(). Returns the ms until it next has work to do
+ * (UINT32_MAX if idle), for bounding the caller's wait.
+ */
+uint32_t isotp_poll(void);
+
+/* Counters summed over all sessions. */
+void isotp_get_stats(isotp_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event trace over ITM/SWO. Each event is two 32-bit stimulus writes:
+ *
+ *   port ITM_TRACE_PORT      event << 24 | arg (24 bits)
+ *   port ITM_TRACE_PORT + 1  DWT->CYCCNT
+ *
+ * so a host decoder (itm_decode.py) can pair them up again after an
+ * overflow. An event is dropped, not waited for, when the ITM FIFO is
+ * full. Context switches need the ThreadX execution profile hooks
+ * (ENABLE_THREADX_PROFILING).
+ *
+ * With ITM_TRACE_ENABLED undefined (CMake option ENABLE_ITM_TRACE) the
+ * macro expands to nothing.
+ */
+
+typedef enum {
+  ITM_EV_THREAD_IN = 1, /* arg: TX_THREAD address, low 24 bits */
+  ITM_EV_THREAD_OUT,
+  ITM_EV_CAN_ISR_IN,    /* arg: FDCAN interrupt line */
+  ITM_EV_CAN_ISR_OUT,
+  ITM_EV_REASM_DONE,    /* arg: length << 11 | standard ID */
+  ITM_EV_ROUTER_IN,     /* arg: ITM_ROUTER_* */
+  ITM_EV_ROUTER_OUT,
+  ITM_EV_TX_SEND,       /* arg: packet bytes */
+} itm_event_t;
+
+#define ITM_ROUTER_RX 0u
+#define ITM_ROUTER_TX 1u
+#define ITM_ROUTER_ALL 2u
+
+#ifdef ITM_TRACE_ENABLED
+
+#include "stm32g4xx.h"
+
+#ifndef ITM_TRACE_PORT
+#define ITM_TRACE_PORT 1u
+#endif
+/* SWO bit rate set by itm_trace_init() (NRZ/UART encoding, on PB3). */
+#ifndef ITM_TRACE_SWO_HZ
+#define ITM_TRACE_SWO_HZ 2000000u
+#endif
+
+/* Route SWO to PB3 and enable the two stimulus ports. A debugger that
+ * configures the trace itself may do so again afterwards. */
+void itm_trace_init(void);
+
+/* Events dropped with the ITM FIFO full. */
+uint32_t itm_trace_dropped(void);
+
+extern volatile uint32_t g_itm_trace_dropped;
+
+static inline void itm_trace_emit(itm_event_t ev, uint32_t arg) {
+  if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) ||
+      (ITM->TER & (3u << ITM_TRACE_PORT)) != (3u << ITM_TRACE_PORT))
+    return; // nobody listening
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (ITM->PORT[ITM_TRACE_PORT].u32 == 0u) {
+    g_itm_trace_dropped++;
+  } else {
+    ITM->PORT[ITM_TRACE_PORT].u32 = ((uint32_t)ev << 24) | (arg & 0xFFFFFFu);
+    const uint32_t cyc = DWT->CYCCNT;
+    unsigned spin = 64u; // one word's worth of SWO time at the least
+    while (ITM->PORT[ITM_TRACE_PORT + 1u].u32 == 0u && --spin)
+      ;
+    if (spin) ITM->PORT[ITM_TRACE_PORT + 1u].u32 = cyc;
+    else g_itm_trace_dropped++; // the decoder drops the unpaired word
+  }
+  __set_PRIMASK(primask);
+}
+
+#define ITM_TRACE(ev, arg) itm_trace_emit((ev), (uint32_t)(arg))
+
+#else
+
+static inline void itm_trace_init(void) {}
+static inline uint32_t itm_trace_dropped(void) { return 0; }
+
+#define ITM_TRACE(ev, arg) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
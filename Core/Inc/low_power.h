@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stop-mode idle on top of the tickless WFI idle (TX_LOW_POWER, CMake
+ * option ENABLE_TICKLESS_IDLE), built with LOW_POWER_STOP_ENABLED (CMake
+ * option ENABLE_STOP_IDLE).
+ *
+ * When the ThreadX idle loop finds nothing to run for at least
+ * LOW_POWER_STOP_MIN_MS, the USB host has the bus suspended (or none is
+ * attached), the CAN controller has been quiet for LOW_POWER_CAN_QUIET_MS
+ * with nothing queued, no DMA channel is running and no us_clock alarm is
+ * set, the core goes to Stop 1 instead of WFI sleep. It wakes on:
+ *   - LPTIM1 (LSE, or LSI without one) at the next ThreadX timer, so
+ *     tx_time_get() and us_clock_now() stay continuous;
+ *   - a falling edge on FDCAN2_RX (PB12): the frame that woke us is lost,
+ *     the ones after it are received normally;
+ *   - USB resume or reset signalling.
+ * The PLL and HSI48 are restarted before anything else runs; the time from
+ * wakeup to full clock is measured per stop (low_power_get_stats()).
+ *
+ * Everything here but low_power_get_stats() / _set_stop() runs from the
+ * ThreadX idle path (app_threadx.c) or the wake interrupts.
+ */
+
+/* Shortest idle worth a stop: wakeup costs the PLL restart. */
+#ifndef LOW_POWER_STOP_MIN_MS
+#define LOW_POWER_STOP_MIN_MS 5u
+#endif
+/* CAN RX silence before a stop may drop a frame. */
+#ifndef LOW_POWER_CAN_QUIET_MS
+#define LOW_POWER_CAN_QUIET_MS 100u
+#endif
+/* Stop idle on at boot (low_power_set_stop() changes it). */
+#ifndef LOW_POWER_STOP_DEFAULT
+#define LOW_POWER_STOP_DEFAULT 1u
+#endif
+/* Wake interrupts stay above THREADX_BASEPRI_PRIO so they end the idle
+ * WFI; their handlers touch no ThreadX state. */
+#ifndef LOW_POWER_WAKE_IRQ_PRIO
+#define LOW_POWER_WAKE_IRQ_PRIO 1u
+#endif
+
+/* Wake sources (low_power_wake_irq(), stats). */
+#define LOW_POWER_WAKE_TIMER 0x01u
+#define LOW_POWER_WAKE_CAN 0x02u
+#define LOW_POWER_WAKE_USB 0x04u
+
+typedef struct {
+  uint32_t stops;        /* Stop 1 entries */
+  uint32_t wake_timer;   /* woken by the next ThreadX timer */
+  uint32_t wake_can;     /* by CAN RX activity */
+  uint32_t wake_usb;     /* by USB resume/reset */
+  uint32_t wake_other;   /* any other interrupt */
+  uint32_t lat_last_us;  /* wakeup to PLL clock, LPTIM resolution (~31 us) */
+  uint32_t lat_max_us;
+  uint64_t stopped_us;   /* total time in stop */
+  uint8_t enabled;
+} low_power_stats_t;
+
+#ifdef LOW_POWER_STOP_ENABLED
+
+/* LPTIM1 and wake lines; after rtc_time_init() (the LSE choice). */
+void low_power_init(void);
+
+/* Allow or forbid stop idle at run time (WFI idle goes on either way). */
+void low_power_set_stop(uint8_t on);
+
+void low_power_get_stats(low_power_stats_t *out);
+
+/*
+ * Idle path hooks, IRQs masked. _setup() returns non-zero when it armed a
+ * stop for `ticks` ThreadX ticks (SysTick is then stopped); the next WFI
+ * enters it. _exit() restores the clocks after that WFI, and _take()
+ * returns the microseconds spent since _setup() (0 if no stop was armed).
+ */
+int low_power_stop_setup(unsigned long ticks);
+void low_power_stop_exit(void);
+uint32_t low_power_stop_take(void);
+
+/* From the wake interrupt handlers (stm32g4xx_it.c). */
+void low_power_wake_irq(uint8_t source);
+
+/* CAN RX activity, counted from the FDCAN RX interrupts. */
+extern volatile uint32_t low_power_can_rx_events;
+static inline void low_power_note_can_rx(void) { low_power_can_rx_events++; }
+
+#else
+
+static inline void low_power_init(void) {}
+static inline void low_power_note_can_rx(void) {}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
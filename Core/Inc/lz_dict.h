@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Small LZ77 codec for text-heavy packets (log and error strings). The
+ * stream is LZ4's block format (token nibbles for literal and match
+ * lengths, 255-byte length extensions, 2-byte little-endian offsets, a
+ * final literal-only sequence), except that match offsets may reach back
+ * past the start of the data into a built-in dictionary of common phrases,
+ * so short messages compress too. Both ends must be built with the same
+ * dictionary.
+ */
+
+/* Match finder hash table size (2^bits entries of 2 bytes). */
+#ifndef LZ_DICT_HASH_BITS
+#define LZ_DICT_HASH_BITS 8u
+#endif
+
+/* Scratch for one lz_dict_compress() call; on the caller's stack or
+ * static, nothing is kept between calls. */
+typedef struct {
+  uint16_t head[1u << LZ_DICT_HASH_BITS];
+} lz_dict_work_t;
+
+/*
+ * Compress `len` bytes (at most 65535 - the dictionary) into `dst`.
+ * Returns the compressed size, or 0 if it wouldn't fit in `cap` bytes:
+ * pass cap < len to only take results that are actually smaller.
+ */
+size_t lz_dict_compress(const uint8_t *src, size_t len, uint8_t *dst,
+                        size_t cap, lz_dict_work_t *work);
+
+/*
+ * Decompress into `dst` (`cap` bytes) and set *out_len. HAL_ERROR for a
+ * corrupt stream or one that decodes to more than `cap` bytes.
+ */
+HAL_StatusTypeDef lz_dict_decompress(const uint8_t *src, size_t len,
+                                     uint8_t *dst, size_t cap,
+                                     size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
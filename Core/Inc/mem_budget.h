@@ -0,0 +1,286 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The budget checks below (and TELEMETRY_SAMPLE) use the C11 spelling. */
+#if defined(__cplusplus) && !defined(_Static_assert)
+#define _Static_assert static_assert
+#endif
+
+/*
+ * RAM budget: the sizes of the big static buffers, in one place so RAM can
+ * be moved from one to another here instead of in each module.
+ *
+ * SRAM1+SRAM2 (96 KB, contiguous; RAM in the linker script) holds one
+ * arena, the .arena section of STM32G491XX_FLASH.ld, carved into named
+ * regions: reassembly block pools, the router heap's block pools, the
+ * sample handoff blocks, thread stacks, and the router heap's byte pool,
+ * which gets whatever the others leave of MEM_ARENA_BYTES. Growing a region therefore
+ * shrinks the byte pool and changing one size is the whole edit; a static
+ * assert stops a build where the byte pool would get too small. The arena
+ * is not zeroed at boot: every region is set up by its owner
+ * (tx_*_pool_create(), tx_thread_create() fills stacks).
+ *
+ * CCM SRAM (16 KB, mem_sections.h) keeps the CAN RX rings next to the ISR
+ * code that fills them; they are budgeted here too, against what the code
+ * and the reassembly slot tables leave.
+ *
+ * Every size can still be set with -D. mem_budget_print() writes the layout
+ * to the console at boot. The linker remains the exact check on what else
+ * .data/.bss needs.
+ */
+
+/* The G491's; a host build simulating many boards in one process sets
+ * larger ones. */
+#ifndef MEM_BUDGET_SRAM_BYTES
+#define MEM_BUDGET_SRAM_BYTES (96u * 1024u)
+#endif
+#ifndef MEM_BUDGET_CCM_BYTES
+#define MEM_BUDGET_CCM_BYTES (16u * 1024u)
+#endif
+
+/* Left in SRAM for .data, the rest of .bss and the main stack. */
+#ifndef MEM_BUDGET_SRAM_RESERVE
+#define MEM_BUDGET_SRAM_RESERVE (32u * 1024u)
+#endif
+/* Left in CCM for the ISR code (.ramfunc) and the reassembly slots. */
+#ifndef MEM_BUDGET_CCM_RESERVE
+#define MEM_BUDGET_CCM_RESERVE (8u * 1024u)
+#endif
+
+/* ---- CCM: CAN RX rings (can_bus.c) ---- */
+
+/* FDCAN controllers driven; rings and reassembly are per instance. */
+#ifndef CAN_BUS_INSTANCES
+#define CAN_BUS_INSTANCES 1
+#endif
+#ifndef CAN_BUS_RX_RING_BYTES
+#define CAN_BUS_RX_RING_BYTES 4096u /* FIFO1, bulk; power of two */
+#endif
+#ifndef CAN_BUS_RX_HI_RING_BYTES
+#define CAN_BUS_RX_HI_RING_BYTES 1024u /* FIFO0, high priority; power of two */
+#endif
+
+#define MEM_CCM_RX_RINGS_BYTES \
+  (CAN_BUS_INSTANCES * (CAN_BUS_RX_RING_BYTES + CAN_BUS_RX_HI_RING_BYTES))
+
+/* ---- Arena: CAN reassembly block pools (can_bus.c) ---- */
+
+#ifndef CAN_BUS_REASM_BLOCK_BYTES
+#define CAN_BUS_REASM_BLOCK_BYTES 256
+#endif
+#ifndef CAN_BUS_REASM_POOL_BLOCKS
+#define CAN_BUS_REASM_POOL_BLOCKS 32 /* <= 32 (one bitmap word) */
+#endif
+
+#define MEM_ARENA_REASM_BYTES                                  \
+  ((uint32_t)CAN_BUS_INSTANCES * CAN_BUS_REASM_POOL_BLOCKS * \
+   CAN_BUS_REASM_BLOCK_BYTES)
+
+/* ---- Arena: router heap block pools (telemetry_hooks.c) ---- */
+
+#ifndef RUST_POOL_32_BLOCKS
+#define RUST_POOL_32_BLOCKS 128u
+#endif
+#ifndef RUST_POOL_64_BLOCKS
+#define RUST_POOL_64_BLOCKS 64u
+#endif
+#ifndef RUST_POOL_128_BLOCKS
+#define RUST_POOL_128_BLOCKS 32u
+#endif
+#ifndef RUST_POOL_512_BLOCKS
+#define RUST_POOL_512_BLOCKS 6u
+#endif
+#ifndef RUST_POOL_2048_BLOCKS
+#define RUST_POOL_2048_BLOCKS 2u
+#endif
+
+/* Each block carries one pointer of ThreadX bookkeeping. */
+#define RUST_POOL_BYTES(size, count) ((count) * ((size) + sizeof(void *)))
+
+#define MEM_ARENA_RUST_POOLS_BYTES                                       \
+  ((uint32_t)(RUST_POOL_BYTES(32u, RUST_POOL_32_BLOCKS) +                \
+              RUST_POOL_BYTES(64u, RUST_POOL_64_BLOCKS) +                \
+              RUST_POOL_BYTES(128u, RUST_POOL_128_BLOCKS) +              \
+              RUST_POOL_BYTES(512u, RUST_POOL_512_BLOCKS) +              \
+              RUST_POOL_BYTES(2048u, RUST_POOL_2048_BLOCKS)))
+
+/* ---- Arena: sample handoff blocks (telemetry_block_get(), telemetry.c) ---- */
+
+#ifndef TELEMETRY_BLOCK_BYTES
+#define TELEMETRY_BLOCK_BYTES 256u /* 16-byte header + data */
+#endif
+#ifndef TELEMETRY_BLOCK_COUNT
+#define TELEMETRY_BLOCK_COUNT 8u
+#endif
+
+#define MEM_ARENA_BLOCKS_BYTES \
+  ((uint32_t)RUST_POOL_BYTES(TELEMETRY_BLOCK_BYTES, TELEMETRY_BLOCK_COUNT))
+
+/* ---- Arena: thread stacks ---- */
+
+#ifndef TELEMETRY_RX_STACK_SIZE
+#define TELEMETRY_RX_STACK_SIZE 2048u /* router RX: deserialize + handlers */
+#endif
+#ifndef TELEMETRY_TX_STACK_SIZE
+#define TELEMETRY_TX_STACK_SIZE 1536u /* router TX: serialize + side sends */
+#endif
+#ifndef TELEMETRY_MAINT_STACK_SIZE
+#define TELEMETRY_MAINT_STACK_SIZE 2048u /* snprintf in the reports */
+#endif
+#ifndef TELEMETRY_SCHED_STACK_SIZE
+#define TELEMETRY_SCHED_STACK_SIZE 1024u
+#endif
+#ifndef I2C_BUS_THREAD_STACK_SIZE
+#define I2C_BUS_THREAD_STACK_SIZE 768u
+#endif
+#ifndef DSP_FILTER_THREAD_STACK_SIZE
+#define DSP_FILTER_THREAD_STACK_SIZE 1024u
+#endif
+#ifndef CPU_LOAD_THREAD_STACK_SIZE
+#define CPU_LOAD_THREAD_STACK_SIZE 1536u
+#endif
+#ifndef SD_LOG_THREAD_STACK_SIZE
+#define SD_LOG_THREAD_STACK_SIZE 1024u
+#endif
+#ifndef USB_MSC_THREAD_STACK_SIZE
+#define USB_MSC_THREAD_STACK_SIZE 1024u
+#endif
+/* App task levels (app_task.h): each stack is shared by the level's tasks. */
+#ifndef APP_TASK_HIGH_STACK_SIZE
+#define APP_TASK_HIGH_STACK_SIZE 1024u
+#endif
+#ifndef APP_TASK_NORMAL_STACK_SIZE
+#define APP_TASK_NORMAL_STACK_SIZE 1024u
+#endif
+#ifndef APP_TASK_LOW_STACK_SIZE
+#define APP_TASK_LOW_STACK_SIZE 1536u /* housekeeping may format text */
+#endif
+/* Coroutine executor (coro.h): one stack for every driver coroutine. */
+#ifndef CORO_THREAD_STACK_SIZE
+#define CORO_THREAD_STACK_SIZE 1024u
+#endif
+#ifndef TELEMETRY_BENCH_STACK_SIZE
+#define TELEMETRY_BENCH_STACK_SIZE 2048u
+#endif
+#ifndef TELEMETRY_BENCH_SPIN_STACK_SIZE
+#define TELEMETRY_BENCH_SPIN_STACK_SIZE 512u
+#endif
+#ifndef MICROBENCH_STACK_SIZE
+#define MICROBENCH_STACK_SIZE 2048u
+#endif
+#ifndef TIMESYNC_BENCH_STACK_SIZE
+#define TIMESYNC_BENCH_STACK_SIZE 1536u /* formats the report line */
+#endif
+
+/* Threads of optional features; the arena grows by their stacks. */
+#ifdef TX_EXECUTION_PROFILE_ENABLE
+#define MEM_STACK_CPU_LOAD CPU_LOAD_THREAD_STACK_SIZE
+#else
+#define MEM_STACK_CPU_LOAD 0u
+#endif
+#ifdef SD_LOG_ENABLED
+#define MEM_STACK_SD_LOG SD_LOG_THREAD_STACK_SIZE
+#else
+#define MEM_STACK_SD_LOG 0u
+#endif
+#ifdef USB_MSC_ENABLED
+#define MEM_STACK_USB_MSC USB_MSC_THREAD_STACK_SIZE
+#else
+#define MEM_STACK_USB_MSC 0u
+#endif
+#ifdef APP_TASK_ENABLED
+#define MEM_STACK_APP_TASKS                                    \
+  (APP_TASK_HIGH_STACK_SIZE + APP_TASK_NORMAL_STACK_SIZE + \
+   APP_TASK_LOW_STACK_SIZE)
+#else
+#define MEM_STACK_APP_TASKS 0u
+#endif
+#ifdef CORO_ENABLED
+#define MEM_STACK_CORO CORO_THREAD_STACK_SIZE
+#else
+#define MEM_STACK_CORO 0u
+#endif
+#ifdef TELEMETRY_BENCH
+#define MEM_STACK_BENCH \
+  (TELEMETRY_BENCH_STACK_SIZE + TELEMETRY_BENCH_SPIN_STACK_SIZE)
+#else
+#define MEM_STACK_BENCH 0u
+#endif
+#ifdef MICROBENCH_ENABLED
+#define MEM_STACK_MICROBENCH MICROBENCH_STACK_SIZE
+#else
+#define MEM_STACK_MICROBENCH 0u
+#endif
+#ifdef TIMESYNC_BENCH_ENABLED
+#define MEM_STACK_TIMESYNC_BENCH TIMESYNC_BENCH_STACK_SIZE
+#else
+#define MEM_STACK_TIMESYNC_BENCH 0u
+#endif
+
+#define MEM_STACKS_OPTIONAL_BYTES \
+  (MEM_STACK_CPU_LOAD + MEM_STACK_SD_LOG + MEM_STACK_USB_MSC + \
+   MEM_STACK_APP_TASKS + MEM_STACK_CORO + MEM_STACK_BENCH + \
+   MEM_STACK_MICROBENCH + MEM_STACK_TIMESYNC_BENCH)
+
+#define MEM_ARENA_STACKS_BYTES                                      \
+  ((uint32_t)(TELEMETRY_RX_STACK_SIZE + TELEMETRY_TX_STACK_SIZE +   \
+              TELEMETRY_MAINT_STACK_SIZE + TELEMETRY_SCHED_STACK_SIZE + \
+              I2C_BUS_THREAD_STACK_SIZE + DSP_FILTER_THREAD_STACK_SIZE + \
+              MEM_STACKS_OPTIONAL_BYTES))
+
+/* ---- Arena total; the router heap byte pool takes the rest ---- */
+
+#ifndef MEM_ARENA_BYTES
+#define MEM_ARENA_BYTES \
+  (48u * 1024u + MEM_STACKS_OPTIONAL_BYTES + MEM_ARENA_BLOCKS_BYTES)
+#endif
+
+/* Smallest byte pool that still takes the library's oversize requests. */
+#ifndef RUST_HEAP_MIN_SIZE
+#define RUST_HEAP_MIN_SIZE (4u * 1024u)
+#endif
+
+#ifndef RUST_HEAP_SIZE
+#define RUST_HEAP_SIZE                                                  \
+  ((MEM_ARENA_BYTES - MEM_ARENA_REASM_BYTES - MEM_ARENA_RUST_POOLS_BYTES - \
+    MEM_ARENA_BLOCKS_BYTES - MEM_ARENA_STACKS_BYTES) & ~7u)
+#endif
+
+_Static_assert(MEM_ARENA_REASM_BYTES + MEM_ARENA_RUST_POOLS_BYTES +
+                       MEM_ARENA_BLOCKS_BYTES + MEM_ARENA_STACKS_BYTES +
+                       RUST_HEAP_MIN_SIZE <=
+                   MEM_ARENA_BYTES,
+               "arena regions leave the router heap less than "
+               "RUST_HEAP_MIN_SIZE: grow MEM_ARENA_BYTES or shrink a region");
+_Static_assert(MEM_ARENA_REASM_BYTES + MEM_ARENA_RUST_POOLS_BYTES +
+                       MEM_ARENA_BLOCKS_BYTES + MEM_ARENA_STACKS_BYTES +
+                       RUST_HEAP_SIZE <=
+                   MEM_ARENA_BYTES,
+               "RUST_HEAP_SIZE doesn't fit in the arena");
+_Static_assert(MEM_ARENA_BYTES + MEM_BUDGET_SRAM_RESERVE <=
+                   MEM_BUDGET_SRAM_BYTES,
+               "arena too large for SRAM1+SRAM2");
+_Static_assert(MEM_CCM_RX_RINGS_BYTES + MEM_BUDGET_CCM_RESERVE <=
+                   MEM_BUDGET_CCM_BYTES,
+               "CAN RX rings too large for CCM SRAM");
+
+/* Place a buffer in arena region `region` (reasm, rust, block, stack). */
+#if defined(__GNUC__) || defined(__clang__)
+#define MEM_ARENA(region) \
+  __attribute__((section(".arena." #region), aligned(8)))
+#else
+#define MEM_ARENA(region)
+#endif
+
+/* Print the budget and the linked arena and CCM use; after the console is
+ * up. */
+void mem_budget_print(void);
+
+#ifdef __cplusplus
+}
+#endif
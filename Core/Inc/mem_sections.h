@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * Placement in the 16 KB CCM SRAM (0x10000000). The CPU reaches it over the
+ * I-bus and D-bus with no wait states, and the DMA channels and USB all work
+ * out of SRAM1, so nothing contends for it. It holds the hot CAN RX path:
+ * the ISR code, the RX rings and the reassembly metadata. Sections are set up by STM32G491XX_FLASH.ld and
+ * copied/zeroed in startup_stm32g491xx.s.
+ *
+ * Keep it to code that runs on every frame: calls between CCM and flash go
+ * through linker veneers.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CCM_DATA __attribute__((section(".ccmram")))  /* initialized, copied at boot */
+#define CCM_BSS  __attribute__((section(".ccmbss")))  /* zeroed at boot */
+#define CCM_FUNC __attribute__((section(".ramfunc"))) /* code, zero wait state */
+#else
+#define CCM_DATA
+#define CCM_BSS
+#define CCM_FUNC
+#endif
+
+/*
+ * Fast boot (TELEMETRY_FAST_BOOT, boot_time.h): raw data buffers whose
+ * owner keeps its own indices skip the zero fill at boot and start out
+ * holding whatever RAM held. Without fast boot they are ordinary .bss.
+ */
+#if defined(TELEMETRY_FAST_BOOT) && (defined(__GNUC__) || defined(__clang__))
+#define RAM_NOINIT __attribute__((section(".noinit")))
+#define CCM_NOINIT __attribute__((section(".ccmnoinit")))
+#else
+#define RAM_NOINIT
+#define CCM_NOINIT CCM_BSS
+#endif
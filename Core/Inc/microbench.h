@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * On-target microbenchmarks on the DWT cycle counter, for before/after
+ * numbers from real hardware. Built with MICROBENCH_ENABLED, which the
+ * CMake option ENABLE_MICROBENCH sets for a second image,
+ * gateway_board_bench, next to the normal firmware. Like the loopback
+ * bench it puts FDCAN2 in internal loopback, so it needs no bus.
+ *
+ * A fixed suite runs once at boot, each case MICROBENCH_ITERS times:
+ * RX ring push/pop, the RX handling of raw, single, first, middle and
+ * last fragments, fragment framing, can_bus_send_large(), the router
+ * heap per size class, memcpy variants and dma_copy(), the clocks,
+ * vsnprintf(), and the router logging and queue calls. The first cases
+ * run before any other thread has, from the highest application priority,
+ * so they may drive the CAN driver's thread-side paths directly; the ones
+ * that can block come last.
+ *
+ * Results are in cycles at SystemCoreClock, with the cost of reading the
+ * counter taken off; min is the number to compare, mean and max include
+ * whatever interrupts hit the case. One line per case goes to the console
+ * and out as a telemetry message (so over USB):
+ *   mb <case> n=<runs> min=<cyc> mean=<cyc> max=<cyc> skip=<runs>
+ * and the same numbers as a result record (telemetry_result_record()).
+ * A case is skipped on a run where the code under test refused (full
+ * ring, no memory).
+ */
+
+#ifndef MICROBENCH_ITERS
+#define MICROBENCH_ITERS 100u
+#endif
+
+typedef struct {
+  const char *name;
+  uint32_t n;       /* timed runs */
+  uint32_t min;     /* cycles */
+  uint32_t mean;
+  uint32_t max;
+  uint32_t skipped; /* runs the code under test refused */
+} microbench_result_t;
+
+#ifdef MICROBENCH_ENABLED
+
+/* Result of case `i` of the finished suite; 0 past the last case or while
+ * the suite is still running. */
+int microbench_get(unsigned i, microbench_result_t *out);
+
+/* Print and log every result line again. */
+void microbench_report(void);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
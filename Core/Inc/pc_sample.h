@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Statistical PC-sampling profiler (CMake option ENABLE_PC_SAMPLE). TIM7
+ * interrupts at a few kHz, above every other interrupt but FDCAN2 IT0, and
+ * records the PC and LR stacked by the interrupted context into a ring:
+ * threads, ISRs, HAL and the Rust router alike, no probes needed. The
+ * period is dithered by a few microseconds so periodic work doesn't alias
+ * with it. A sample costs about 40 cycles, 0.1% of the CPU at 5 kHz.
+ *
+ * Code running with interrupts masked is sampled where it unmasks, and
+ * FDCAN2 IT0 (same priority) where it returns; sleeping shows up as the
+ * idle loop.
+ *
+ * The telemetry RX thread streams the ring over USB
+ * (TELEMETRY_USB_CTRL_PC_SAMPLE_START); pc_sample.py symbolizes the
+ * samples against the .elf or .map and prints a flat profile.
+ */
+
+#ifndef PC_SAMPLE_RECORDS
+#define PC_SAMPLE_RECORDS 1024u /* power of two */
+#endif
+#ifndef PC_SAMPLE_DEFAULT_HZ
+#define PC_SAMPLE_DEFAULT_HZ 5000u
+#endif
+#define PC_SAMPLE_MAX_HZ 20000u
+
+/* One sample. pc bit 0 (always clear in a Thumb PC) is set when the
+ * interrupted context was a handler, not a thread. */
+typedef struct {
+  uint32_t pc;
+  uint32_t lr;
+} pc_sample_t;
+
+#define PC_SAMPLE_IN_HANDLER 0x1u
+
+typedef struct {
+  uint32_t taken;   /* samples recorded since the last start */
+  uint32_t dropped; /* ring full: the reader fell behind */
+  uint32_t hz;      /* 0 while stopped */
+} pc_sample_stats_t;
+
+/* (Re)start sampling at `hz` (0: PC_SAMPLE_DEFAULT_HZ) with an empty ring.
+ * HAL_ERROR above PC_SAMPLE_MAX_HZ or for a timer clock it can't divide. */
+HAL_StatusTypeDef pc_sample_start(uint32_t hz);
+
+void pc_sample_stop(void);
+
+/* Take up to `max` samples, oldest first; `seq` gets how many were
+ * recorded before the first one since the start. Single reader. */
+size_t pc_sample_read(pc_sample_t *out, size_t max, uint32_t *seq);
+
+void pc_sample_get_stats(pc_sample_stats_t *out);
+
+/* Called by the TIM7 handler stub with the interrupted context's stack
+ * frame (stm32g4xx_it.c). */
+void pc_sample_irq(const uint32_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hot-path profiler on the DWT cycle counter.
+ *
+ * Bracket a region with PROF_START(tag) / PROF_STOP(tag, PROF_x). With
+ * PROFILING_ENABLED undefined the macros expand to nothing and the API
+ * collapses to empty inlines, so probes can stay in the code.
+ */
+
+typedef enum {
+  PROF_CAN_RX_ISR = 0,   /* FDCAN RX FIFO drain (per interrupt) */
+  PROF_CAN_RB_PUSH,      /* one frame into the RX ring */
+  PROF_CAN_HANDLE_FRAME, /* reassembly + subscriber fanout, per frame */
+  PROF_CAN_SEND_LARGE,   /* fragment + queue one message */
+  PROF_ROUTER_PROCESS,   /* seds_router_process_* calls */
+  PROF_TX_SEND,          /* router -> CAN side callback */
+  PROF_CAN_TX_WIRE,      /* frame in the TX FIFO until it starts (TX event) */
+  PROF_COUNT
+} prof_probe_t;
+
+/* Bin 0 counts 0 cycles, bin k counts [2^(k-1), 2^k), last bin the rest. */
+#define PROF_HIST_BINS 16u
+
+typedef struct {
+  uint32_t count;
+  uint32_t min; /* cycles */
+  uint32_t max;
+  uint64_t total;
+  uint32_t hist[PROF_HIST_BINS];
+} prof_stats_t;
+
+#ifdef PROFILING_ENABLED
+
+#include "stm32g4xx.h"
+
+/* Enable DWT->CYCCNT and clear all probes. */
+void prof_init(void);
+void prof_reset(void);
+
+/* Stop or resume recording (on after prof_init()); the counts are kept.
+ * Returns 0, or -1 in builds without the profiler. */
+int prof_set_enabled(int on);
+
+/* Record one sample; ISR-safe. */
+void prof_record(prof_probe_t probe, uint32_t cycles);
+
+void prof_get(prof_probe_t probe, prof_stats_t *out);
+const char *prof_name(prof_probe_t probe);
+
+/* One-line text summary (name, count, min/mean/max us, histogram). */
+int prof_format(prof_probe_t probe, char *buf, size_t len);
+
+/* Dump every probe via printf (UART), or as telemetry messages plus a
+ * result record per probe that has samples (telemetry_result_record()). */
+void prof_dump_printf(void);
+void prof_report_telemetry(void);
+
+#define PROF_START(tag) const uint32_t prof_t0_##tag = DWT->CYCCNT
+#define PROF_STOP(tag, probe)                                                  \
+  prof_record((probe), DWT->CYCCNT - prof_t0_##tag)
+
+#else
+
+static inline void prof_init(void) {}
+static inline void prof_reset(void) {}
+static inline int prof_set_enabled(int on) {
+  (void)on;
+  return -1;
+}
+static inline void prof_dump_printf(void) {}
+static inline void prof_report_telemetry(void) {}
+
+#define PROF_START(tag) ((void)0)
+#define PROF_STOP(tag, probe) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
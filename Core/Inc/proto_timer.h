@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Protocol timers: one hierarchical timer wheel for the timeouts of the CAN
+ * protocol stack (reassembly slots, NACK repair, held early fragments),
+ * serviced by the telemetry RX thread through proto_timer_poll(). Instead of
+ * every module scanning its tables on each loop, each pending deadline is a
+ * proto_timer_t linked into the wheel; arming and cancelling are O(1) and
+ * the thread sleeps until the earliest deadline.
+ *
+ * Deadlines are HAL_GetTick() milliseconds. Level 0 has one slot per ms for
+ * the next 64 ms; each level above has 64 slots 64 times wider, and a timer
+ * in one drops a level when its slot comes up (cascading). With
+ * PROTO_TIMER_LEVELS levels the wheel reaches 64^levels ms; later deadlines
+ * are pulled in to its end.
+ *
+ * Everything, callbacks included, runs in the thread that calls
+ * proto_timer_poll(): timers are armed and cancelled from that thread only
+ * (can_bus_process_rx() runs there).
+ */
+
+#ifndef PROTO_TIMER_LEVELS
+#define PROTO_TIMER_LEVELS 4u /* 16.7 M ms, 4.6 h */
+#endif
+
+typedef struct proto_timer proto_timer_t;
+typedef void (*proto_timer_fn_t)(proto_timer_t *t, void *user);
+
+/* Owned by the caller, usually inside the object it times; opaque. */
+struct proto_timer {
+  proto_timer_t *next;
+  proto_timer_t **pprev; /* NULL while not armed */
+  uint32_t expires_ms;
+  uint16_t bucket;
+  proto_timer_fn_t fn;
+  void *user;
+};
+
+typedef struct {
+  uint32_t armed;    /* timers pending now */
+  uint32_t fired;
+  uint32_t cascaded; /* moves to a finer level */
+} proto_timer_stats_t;
+
+/* Set up `t` (not armed) to call `fn(t, user)` when it expires. */
+void proto_timer_init(proto_timer_t *t, proto_timer_fn_t fn, void *user);
+
+/* (Re)arm `t` to fire at `expires_ms`; a deadline already passed fires at
+ * the next poll. Safe from inside a callback, for any timer. */
+void proto_timer_arm(proto_timer_t *t, uint32_t expires_ms);
+
+/* Disarm `t`; a no-op when it isn't armed. */
+void proto_timer_cancel(proto_timer_t *t);
+
+static inline int proto_timer_armed(const proto_timer_t *t) {
+  return t->pprev != 0;
+}
+
+/* Fire the timers that are due. Returns the ms until the next one may be
+ * (UINT32_MAX with none armed); a deadline in a coarse level returns the
+ * time its slot cascades, so the answer is never late. */
+uint32_t proto_timer_poll(void);
+
+void proto_timer_get_stats(proto_timer_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
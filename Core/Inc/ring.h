@@ -0,0 +1,257 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "cmsis_compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock-free rings for the ISR <-> thread I/O paths. Positions are
+ * free-running 32-bit counters masked by a power-of-two slot count, so
+ * "full" and "empty" need no spare slot and wrap arithmetic stays exact.
+ *
+ *   ring_t       single producer, single consumer; fixed-size slots,
+ *                byte rings (slot size 1) and variable-length records.
+ *   ring_mpsc_t  any number of producers (threads and ISRs preempting each
+ *                other), one consumer; fixed-size slots, claimed with
+ *                LDREX/STREX and published in any order.
+ *
+ * Fixed-slot rings can be used in place: ring_slot_w()/ring_publish() let a
+ * producer (or a DMA / USB endpoint) fill the slot at the head, and
+ * ring_peek()/ring_at()/ring_consume() let the consumer read slots where
+ * they are. ring_push()/ring_pop() copy a batch in at most two spans.
+ *
+ * Memory ordering (Cortex-M, one core): ring_release() before the position
+ * that publishes a write, ring_acquire() after reading the position that
+ * reveals one. All helpers here do that themselves; the primitives are for
+ * callers that move the positions by hand.
+ *
+ * Each side keeps its own counters in ring_stats_t, so they are written by
+ * one context only (ring_mpsc_t producers update theirs atomically).
+ */
+
+static inline void ring_release(void) { __DMB(); }
+static inline void ring_acquire(void) { __DMB(); }
+
+typedef struct {
+  uint32_t pushed;  /* slots (or records) written */
+  uint32_t popped;  /* slots (or records) consumed */
+  uint32_t full;    /* pushes refused, or cut short, for lack of room */
+  uint32_t hwm;     /* most slots (bytes, for records) in use at once */
+} ring_stats_t;
+
+typedef struct {
+  volatile uint32_t head; /* producer */
+  volatile uint32_t tail; /* consumer */
+  uint32_t mask;          /* slots - 1 */
+  uint32_t slot;          /* bytes per slot */
+  uint8_t *buf;
+  ring_stats_t stats;
+} ring_t;
+
+/* Static initializer; `slots` must be a power of two (not checked). */
+#define RING_INIT(buf_, slots_, slot_size_)                                    \
+  {.mask = (slots_) - 1u, .slot = (slot_size_), .buf = (uint8_t *)(buf_)}
+
+/*
+ * Set up `r` on `buf` (`slots` x `slot_size` bytes, word aligned for
+ * records). Returns 0 unless `slots` is a power of two and nothing is zero.
+ */
+int ring_init(ring_t *r, void *buf, uint32_t slots, uint32_t slot_size);
+
+/* Drop everything queued. Only while neither side runs. */
+void ring_reset(ring_t *r);
+
+void ring_get_stats(const ring_t *r, ring_stats_t *out);
+
+static inline uint32_t ring_size(const ring_t *r) { return r->mask + 1u; }
+static inline uint32_t ring_count(const ring_t *r) { return r->head - r->tail; }
+static inline uint32_t ring_free(const ring_t *r) {
+  return ring_size(r) - ring_count(r);
+}
+
+static inline void *ring_at(const ring_t *r, uint32_t pos) {
+  return r->buf + (size_t)(pos & r->mask) * r->slot;
+}
+
+/* Of `n` slots from `pos`, how many lie before the end of the buffer. */
+static inline uint32_t ring_contig(const ring_t *r, uint32_t pos, uint32_t n) {
+  const uint32_t left = ring_size(r) - (pos & r->mask);
+  return (n < left) ? n : left;
+}
+
+static inline void ring_note_fill_(ring_t *r, uint32_t used) {
+  if (used > r->stats.hwm) r->stats.hwm = used;
+}
+
+/* ---- producer ---- */
+
+/* Slot at the head to fill in place, NULL if full. */
+static inline void *ring_slot_w(ring_t *r) {
+  const uint32_t h = r->head;
+  if (h - r->tail > r->mask) {
+    r->stats.full++;
+    return NULL;
+  }
+  return ring_at(r, h);
+}
+
+/* Hand `n` slots written in place (from the head) to the consumer. */
+static inline void ring_publish(ring_t *r, uint32_t n) {
+  ring_release(); // contents before the position
+  const uint32_t h = r->head + n;
+  r->head = h;
+  r->stats.pushed += n;
+  ring_note_fill_(r, h - r->tail);
+}
+
+/*
+ * Copy up to `n` slots from `src`; returns how many fit. With
+ * `all_or_none` a batch that doesn't fit whole is refused outright.
+ */
+static inline uint32_t ring_push(ring_t *r, const void *src, uint32_t n,
+                                 int all_or_none) {
+  const uint32_t h = r->head;
+  const uint32_t room = ring_size(r) - (h - r->tail);
+  if (n > room) {
+    r->stats.full++;
+    if (all_or_none) return 0;
+    n = room;
+  }
+  if (n == 0) return 0;
+  const uint32_t first = ring_contig(r, h, n);
+  memcpy(ring_at(r, h), src, (size_t)first * r->slot);
+  if (n > first)
+    memcpy(r->buf, (const uint8_t *)src + (size_t)first * r->slot,
+           (size_t)(n - first) * r->slot);
+  ring_publish(r, n);
+  return n;
+}
+
+/* ---- consumer ---- */
+
+/* Slots ready to read from the tail (ring_at(r, r->tail + i)). */
+static inline uint32_t ring_peek(const ring_t *r) {
+  const uint32_t n = r->head - r->tail;
+  ring_acquire(); // position before contents
+  return n;
+}
+
+/* Give `n` read slots back to the producer. */
+static inline void ring_consume(ring_t *r, uint32_t n) {
+  ring_release(); // reads done before the slots can be reused
+  r->tail = r->tail + n;
+  r->stats.popped += n;
+}
+
+/* Copy out up to `n` slots; returns how many there were. */
+static inline uint32_t ring_pop(ring_t *r, void *dst, uint32_t n) {
+  const uint32_t have = ring_peek(r);
+  if (n > have) n = have;
+  if (n == 0) return 0;
+  const uint32_t first = ring_contig(r, r->tail, n);
+  memcpy(dst, ring_at(r, r->tail), (size_t)first * r->slot);
+  if (n > first)
+    memcpy((uint8_t *)dst + (size_t)first * r->slot, r->buf,
+           (size_t)(n - first) * r->slot);
+  ring_consume(r, n);
+  return n;
+}
+
+/* ---- variable-length records (ring_t with slot size 1) ----
+ *
+ * Each record is a u32 length header and the payload, padded to a word and
+ * never split across the end: a record that doesn't fit before the end
+ * leaves a skip marker there and starts over at the front. So the ring must
+ * be word aligned, and a record takes up to len + 4 bytes plus whatever
+ * padding the wrap costs; RING_REC_BYTES() is the contiguous size.
+ */
+#define RING_REC_BYTES(len) (4u + (((uint32_t)(len) + 3u) & ~3u))
+
+/* Copy in one record; 0 if it doesn't fit now (or ever). */
+int ring_rec_push(ring_t *r, const void *data, uint32_t len);
+
+/* Oldest record in place, NULL if none; ring_rec_consume() when done. */
+const void *ring_rec_peek(ring_t *r, uint32_t *len);
+void ring_rec_consume(ring_t *r);
+
+/* ---- multi producer, single consumer ---- */
+
+typedef struct {
+  ring_t r;                /* head = next position to claim */
+  volatile uint32_t *seq;  /* per slot: pos free to claim, pos + 1 written */
+} ring_mpsc_t;
+
+/* As ring_init(), plus `seq`: one u32 per slot. */
+int ring_mpsc_init(ring_mpsc_t *q, void *buf, volatile uint32_t *seq,
+                   uint32_t slots, uint32_t slot_size);
+
+static inline void ring_stat_add_(uint32_t *c, uint32_t n) {
+  uint32_t v;
+  do {
+    v = __LDREXW((volatile uint32_t *)c);
+  } while (__STREXW(v + n, (volatile uint32_t *)c) != 0u);
+}
+
+/*
+ * Claim the slot at the head; writes its position to *pos and returns it,
+ * or NULL if the ring is full. Safe from any context; fill it, then
+ * ring_mpsc_publish(). Until then the consumer stops at that slot, so claim
+ * and publish as close together as possible.
+ */
+static inline void *ring_mpsc_claim(ring_mpsc_t *q, uint32_t *pos) {
+  for (;;) {
+    const uint32_t p = __LDREXW(&q->r.head);
+    if (q->seq[p & q->r.mask] != p) { // last lap's record not consumed yet
+      __CLREX();
+      ring_stat_add_(&q->r.stats.full, 1u);
+      return NULL;
+    }
+    if (__STREXW(p + 1u, &q->r.head) == 0u) {
+      ring_acquire();
+      *pos = p;
+      return ring_at(&q->r, p);
+    }
+  }
+}
+
+static inline void ring_mpsc_publish(ring_mpsc_t *q, uint32_t pos) {
+  ring_release(); // contents before the sequence
+  q->seq[pos & q->r.mask] = pos + 1u;
+  ring_stat_add_(&q->r.stats.pushed, 1u);
+}
+
+/* Copy one slot in; 0 if full. */
+static inline int ring_mpsc_push(ring_mpsc_t *q, const void *src) {
+  uint32_t pos;
+  void *s = ring_mpsc_claim(q, &pos);
+  if (!s) return 0;
+  memcpy(s, src, q->r.slot);
+  ring_mpsc_publish(q, pos);
+  return 1;
+}
+
+/* Consumer: the slot at the tail once published, else NULL. */
+static inline void *ring_mpsc_peek(ring_mpsc_t *q) {
+  const uint32_t t = q->r.tail;
+  if (q->seq[t & q->r.mask] != t + 1u) return NULL; // empty or being written
+  ring_acquire();
+  return ring_at(&q->r, t);
+}
+
+static inline void ring_mpsc_pop(ring_mpsc_t *q) {
+  const uint32_t t = q->r.tail;
+  ring_release(); // done reading before a producer reuses it
+  q->seq[t & q->r.mask] = t + q->r.mask + 1u;
+  q->r.tail = t + 1u;
+  q->r.stats.popped++;
+  ring_note_fill_(&q->r, q->r.head - t);
+}
+
+#ifdef __cplusplus
+}
+#endif
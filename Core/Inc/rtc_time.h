@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Unix time kept by the LSE-clocked RTC across resets, plus a few words of
+ * time-sync state in the backup registers. Only a backup-domain reset
+ * (VBAT and VDD both lost) clears them.
+ */
+
+/*
+ * Bring up the backup domain. Never blocks on the LSE: if the RTC isn't
+ * already running from it, the oscillator is started and the RTC is set up
+ * on the first rtc_time_set_unix_ms() after it has settled.
+ */
+HAL_StatusTypeDef rtc_time_init(void);
+
+/* HAL_ERROR if the RTC isn't running or was never set. */
+HAL_StatusTypeDef rtc_time_get_unix_ms(uint64_t *unix_ms);
+
+/* Set the calendar (~4 ms resolution). HAL_BUSY while the LSE is starting. */
+HAL_StatusTypeDef rtc_time_set_unix_ms(uint64_t unix_ms);
+
+/* Days from 1970-01-01 to a proleptic Gregorian date on or after it. */
+uint32_t rtc_time_days_from_civil(uint32_t year, uint32_t mon, uint32_t day);
+
+/* Last clock-servo drift estimate (2^-32 units), saved across resets. */
+void rtc_time_save_drift(int32_t freq_q32);
+HAL_StatusTypeDef rtc_time_load_drift(int32_t *freq_q32);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Black-box logger behind the SEDS_EP_SD_CARD endpoint, built with
+ * SD_LOG_ENABLED (CMake option ENABLE_SD_LOG) on the SPI card of sd_spi.h.
+ *
+ * The card is a raw, append-only ring of 512-byte blocks from
+ * SD_LOG_FIRST_LBA to its end; nothing else on it survives. Each block
+ * (little-endian):
+ *
+ *   u8 magic[4] "SDLG", u32 seq, u32 session, u16 used, u16 reserved,
+ *   then `used` bytes of records: u16 len, u16 type, u64 ts, payload[len]
+ *
+ * `seq` counts blocks since the log was first written, so block seq sits at
+ * SD_LOG_FIRST_LBA + seq % (ring blocks) and the newest one is found with a
+ * binary search at mount. `session` goes up by one per mount. Records never
+ * straddle blocks; the tail after `used` is padding.
+ *
+ * Appends copy into one of two RAM halves of SD_LOG_HALF_BLOCKS blocks
+ * while a low-priority thread writes the other as one multi-block write.
+ * With both halves full, or no card, records are counted and dropped: the
+ * router never waits on the card. The thread is create_sd_log_thread()
+ * (GB-Threads.h); it mounts the card and retries while there is none.
+ */
+
+/* Largest payload a record carries: one block minus its two headers. */
+#define SD_LOG_PAYLOAD_MAX (512u - 16u - 12u)
+
+typedef struct {
+  uint32_t records;      /* appended */
+  uint32_t bytes;        /* payload bytes appended */
+  uint32_t dropped_full; /* both halves waiting on the card, or no card */
+  uint32_t dropped_big;  /* payload over SD_LOG_PAYLOAD_MAX */
+  uint32_t blocks_written;
+  uint32_t write_errors; /* each one remounts the card */
+  uint32_t next_seq;     /* seq of the next block written */
+  uint32_t session;
+  uint8_t mounted;
+} sd_log_stats_t;
+
+#ifdef SD_LOG_ENABLED
+
+/* Append one record (thread context; any thread). */
+void sd_log_append(uint16_t ty, uint64_t ts, const void *data, size_t len);
+
+void sd_log_get_stats(sd_log_stats_t *out);
+
+/* Where the log is on the card: the seq of its oldest block still there
+ * and the number of blocks from it to the newest (0 without a card). */
+void sd_log_span(uint32_t *first, uint32_t *count);
+
+/*
+ * Read `count` log blocks from block seq `seq` on into `buf`, wrapping
+ * around the ring. Waits up to `wait_ms` (UINT32_MAX: for good) while the
+ * writer has the card, then HAL_BUSY. Thread context, not the writer's.
+ */
+HAL_StatusTypeDef sd_log_read(uint32_t seq, uint8_t *buf, uint32_t count,
+                              uint32_t wait_ms);
+
+/*
+ * The log on the card as one file, for pulls (file_srv.h): the ring's
+ * blocks as written, headers included, from the oldest still there to the
+ * newest. _open() fixes that range and returns its size in bytes (0 with
+ * no card); _read() copies from it, giving 0 while the writer has the card
+ * or the range is unset. Blocks the writer wraps over during a pull come
+ * out with their new, larger seq. Telemetry RX thread.
+ */
+uint32_t sd_log_file_open(void *user);
+size_t sd_log_file_read(uint32_t off, uint8_t *dst, size_t len, void *user);
+
+#else
+
+static inline void sd_log_append(uint16_t ty, uint64_t ts, const void *data,
+                                 size_t len) {
+  (void)ty;
+  (void)ts;
+  (void)data;
+  (void)len;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
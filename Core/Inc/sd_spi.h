@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SD / SDHC card in SPI mode, as a raw 512-byte block device for the SD
+ * logger (sd_log.h). The board file has no card slot; the wiring defaults to
+ * SPI1 on PA5 (SCK), PA6 (MISO), PA7 (MOSI) with chip select on PA4, and
+ * can be moved with the SD_SPI_* defines in sd_spi.c.
+ *
+ * Block writes go out by DMA with the calling thread blocked until each one
+ * completes; commands, reads and the busy polls between blocks are polled.
+ * One thread uses the card at a time.
+ */
+
+#define SD_SPI_BLOCK 512u
+
+/* Bring the card up (reset, identify, sector addressing, capacity).
+ * HAL_ERROR without a card or with one that doesn't answer. Thread context. */
+HAL_StatusTypeDef sd_spi_init(void);
+
+/* Blocks on the card, 0 until sd_spi_init() succeeded. */
+uint32_t sd_spi_block_count(void);
+
+HAL_StatusTypeDef sd_spi_read(uint32_t lba, uint8_t *buf, uint32_t count);
+
+/* One multi-block write of `count` blocks from `buf` (word aligned, DMA
+ * reachable RAM: not CCM). */
+HAL_StatusTypeDef sd_spi_write(uint32_t lba, const uint8_t *buf,
+                               uint32_t count);
+
+/* DMA channel interrupt, from stm32g4xx_it.c. */
+void sd_spi_dma_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "cmsis_compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sequence locks for multi-word snapshots (stats blocks, cached values)
+ * written from ISRs or threads and read from anywhere. A writer bumps the
+ * sequence to odd, writes, and bumps it back to even; it never waits. A
+ * reader copies the data out between two reads of the sequence and tries
+ * again if a write was open or ran in between, so it never masks
+ * interrupts either.
+ *
+ * Rules for writers: writers of one lock must not preempt each other, so
+ * either one context writes it, or each write runs with IRQs masked (a
+ * few dozen cycles for a short copy). Rules for readers: on one core a
+ * reader that preempted a writer can't wait it out, so reads give up after
+ * SEQLOCK_READ_TRIES attempts and report it; the caller treats that as
+ * "busy", never as data.
+ */
+
+#ifndef SEQLOCK_READ_TRIES
+#define SEQLOCK_READ_TRIES 4u
+#endif
+
+typedef struct {
+  volatile uint32_t seq; /* odd while a write is open */
+} seqlock_t;
+
+#define SEQLOCK_INIT {0u}
+
+static inline void seqlock_write_begin(seqlock_t *s) {
+  s->seq++;
+  __DMB(); /* odd sequence before the data */
+}
+
+static inline void seqlock_write_end(seqlock_t *s) {
+  __DMB(); /* data before the even sequence */
+  s->seq++;
+}
+
+static inline uint32_t seqlock_read_begin(const seqlock_t *s) {
+  const uint32_t v = s->seq;
+  __DMB(); /* sequence before the data */
+  return v;
+}
+
+/* Nonzero if what was read since seqlock_read_begin() returned `start`
+ * may be torn. */
+static inline int seqlock_read_retry(const seqlock_t *s, uint32_t start) {
+  __DMB(); /* data before the second sequence read */
+  return (start & 1u) != 0u || s->seq != start;
+}
+
+/* Copy `n` bytes of `src`, guarded by `s`, into `dst`. Returns 1 for a
+ * consistent copy, 0 if every try overlapped a write (`dst` then holds
+ * garbage). */
+static inline int seqlock_read(const seqlock_t *s, void *dst, const void *src,
+                               size_t n) {
+  for (unsigned i = 0; i < SEQLOCK_READ_TRIES; i++) {
+    const uint32_t start = seqlock_read_begin(s);
+    memcpy(dst, src, n);
+    if (!seqlock_read_retry(s, start))
+      return 1;
+  }
+  return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
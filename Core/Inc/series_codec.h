@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sedsprintf.h"
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compact encoding of numeric telemetry series, one sample per frame, with
+ * state kept per channel at both ends (little-endian, LEB128 varints):
+ *
+ *   [u8 data type][u8 key << 7 | seq]
+ *   key:   [u8 kind << 4 | element size][u8 count][varint ts]
+ *          then each element as a delta from 0
+ *   delta: [varint ts - previous ts], then each element as a delta
+ *
+ * Integer elements are zig-zag varints of the difference to the previous
+ * sample; float elements the varint of their bits XORed with the previous
+ * sample's (Gorilla's idea, byte aligned: a value that kept its sign,
+ * exponent and top of mantissa has a small XOR). A decoder that missed a
+ * frame (seq gap) drops deltas until the next key frame, which the encoder
+ * sends every SERIES_KEY_EVERY samples and whenever the shape changes.
+ */
+
+#ifndef SERIES_MAX_ELEMS
+#define SERIES_MAX_ELEMS 8u
+#endif
+#ifndef SERIES_KEY_EVERY
+#define SERIES_KEY_EVERY 32u
+#endif
+/* Frames are single CAN FD frames. */
+#define SERIES_FRAME_MAX 64u
+
+typedef struct {
+  uint8_t live; /* a key frame went out / came in since the last reset */
+  uint8_t kind; /* SedsElemKind */
+  uint8_t elem_size;
+  uint8_t elems;
+  uint8_t seq;
+  uint8_t since_key;
+  uint64_t ts;
+  uint64_t prev[SERIES_MAX_ELEMS]; /* integers widened, floats as bits */
+} series_state_t;
+
+/* Force the next frame to be a key frame (e.g. after a failed send). */
+static inline void series_reset(series_state_t *s) { s->live = 0; }
+
+/*
+ * Encode one sample of `count` elements of `size` bytes into `out`
+ * (SERIES_FRAME_MAX bytes) and advance `s`. 0 if the shape can't be
+ * encoded: more than SERIES_MAX_ELEMS elements, a size other than 1, 2, 4
+ * or 8 (4 or 8 for floats), or a key frame that wouldn't fit a frame.
+ */
+size_t series_encode(series_state_t *s, SedsDataType ty, SedsElemKind kind,
+                     const void *vals, size_t count, size_t size, uint64_t ts,
+                     uint8_t *out);
+
+/*
+ * Decode a frame for the channel `s` belongs to (pick it by
+ * series_frame_type()) into `vals` (SERIES_MAX_ELEMS * 8 bytes).
+ * HAL_ERROR for a corrupt frame, or a delta frame `s` can't apply.
+ */
+HAL_StatusTypeDef series_decode(series_state_t *s, const uint8_t *in,
+                                size_t len, void *vals, size_t *count,
+                                size_t *size, SedsElemKind *kind,
+                                uint64_t *ts);
+
+static inline SedsDataType series_frame_type(const uint8_t *in) {
+  return (SedsDataType)in[0];
+}
+
+#ifdef __cplusplus
+}
+#endif
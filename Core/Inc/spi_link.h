@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SPI slave router link for a companion computer. The host is the SPI
+ * master and clocks fixed-size transactions of SPI_LINK_XFER_SIZE bytes,
+ * full duplex, one per chip-select assertion. Both directions carry the
+ * same layout:
+ *
+ *   [0]    SPI_LINK_MAGIC
+ *   [1]    flags (SPI_LINK_F_*)
+ *   [2]    ~flags
+ *   [3..4] CRC-16/CCITT-FALSE over seq, length and the payload, LE
+ *   [5]    seq, bumped per transaction that carries data
+ *   [6..7] payload length, LE
+ *   [8..]  payload: router frames, each a u16 LE length and its bytes
+ *
+ * Bytes past the payload are don't-care. The data-ready GPIO is high while
+ * the slave has frames queued for the host; the host clocks a transaction
+ * whenever it has something to send or the line is high. A transaction
+ * with length 0 carries nothing.
+ *
+ * The slave answers every transaction. If it has no buffer free for what
+ * the host sends, it says so in the same transaction (SPI_LINK_F_RX_BUSY,
+ * in the header the host reads while it is still sending) and the host
+ * repeats it with the same seq later; a repeated seq is taken once.
+ *
+ * Both directions are DMA to and from double buffers, re-armed from the
+ * transfer-complete interrupt, so the host needs to leave only a short gap
+ * (SPI_LINK_MIN_GAP_US) between transactions.
+ */
+
+#ifndef SPI_LINK_XFER_SIZE
+#define SPI_LINK_XFER_SIZE 512u
+#endif
+
+#define SPI_LINK_MAGIC 0x5Au
+#define SPI_LINK_HDR_SIZE 8u
+#define SPI_LINK_PAYLOAD_MAX (SPI_LINK_XFER_SIZE - SPI_LINK_HDR_SIZE)
+/* Largest router frame one transaction carries. */
+#define SPI_LINK_FRAME_MAX (SPI_LINK_PAYLOAD_MAX - 2u)
+
+/* Header flags, slave to host. */
+#define SPI_LINK_F_RX_BUSY 0x01u /* this transaction's host data is dropped */
+#define SPI_LINK_F_MORE 0x02u    /* more is queued after this transaction */
+
+/* Host-side gap between transactions for the slave to re-arm DMA. */
+#define SPI_LINK_MIN_GAP_US 5u
+
+/* Called from thread context with one received frame; valid until return. */
+typedef void (*spi_link_rx_cb_t)(const uint8_t *data, size_t len, void *user);
+
+/* Called from the DMA ISR when a transaction carrying data arrived. */
+typedef void (*spi_link_notify_cb_t)(void);
+
+/*
+ * Set up the SPI peripheral as a slave (hardware NSS), its DMA channels and
+ * the data-ready pin, and arm the first transaction.
+ */
+HAL_StatusTypeDef spi_link_init(void);
+
+/*
+ * Queue one frame for the host and raise data-ready.
+ * Returns HAL_BUSY if it doesn't fit right now, HAL_ERROR if it never will
+ * (longer than SPI_LINK_FRAME_MAX). Single writer thread.
+ */
+HAL_StatusTypeDef spi_link_send_frame(const uint8_t *bytes, size_t len);
+
+/*
+ * MUST be called from thread context whenever the RX notify fires.
+ * Checks and unpacks received transactions and invokes the handler; also
+ * re-arms the slave after a transaction the host cut short.
+ */
+void spi_link_process_rx(void);
+
+/* Single frame consumer; NULL removes it. */
+void spi_link_set_rx_handler(spi_link_rx_cb_t cb, void *user);
+
+/* Wake-up hook run from interrupt context when data arrived. */
+void spi_link_set_rx_notify(spi_link_notify_cb_t cb);
+
+typedef struct {
+  uint32_t xfers;         /* transactions completed */
+  uint32_t rx_frames;
+  uint32_t rx_bad;        /* CRC or frame length errors */
+  uint32_t rx_busy;       /* transactions answered with SPI_LINK_F_RX_BUSY */
+  uint32_t rx_repeats;    /* repeated seq, dropped */
+  uint32_t tx_frames;
+  uint32_t tx_busy;       /* frames refused for lack of buffer space */
+  uint32_t resyncs;       /* re-aligned after a cut, overrun or bad magic */
+} spi_link_stats_t;
+
+void spi_link_get_stats(spi_link_stats_t *out);
+
+/* IRQ glue, called from stm32g4xx_it.c. */
+void spi_link_dma_rx_irq(void);
+void spi_link_spi_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
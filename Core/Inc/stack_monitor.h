@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Thread stack high-water marks, from the 0xEF fill ThreadX writes into
+ * every stack at tx_thread_create(): the deepest byte no longer holding
+ * the pattern bounds what the thread has used since it started. Walks every
+ * created thread, USBX's and the timer thread's included.
+ *
+ * With TX_ENABLE_STACK_CHECKING (CMake option ENABLE_STACK_CHECK) ThreadX
+ * also checks the stack ends at each context switch; an overflow found is
+ * counted, named in the report and triggers the black box.
+ *
+ * stack_report.py gives the build-time side: the worst static call depth
+ * of each thread entry from the compiler's call graph.
+ */
+
+/* Threads a scan reports; later ones are skipped. */
+#ifndef STACK_MONITOR_MAX_THREADS
+#define STACK_MONITOR_MAX_THREADS 16u
+#endif
+/* Use at or above this share of the stack is flagged in the report. */
+#ifndef STACK_MONITOR_WARN_PCT
+#define STACK_MONITOR_WARN_PCT 85u
+#endif
+
+typedef struct {
+  const char *name;
+  uint32_t size; /* bytes */
+  uint32_t used; /* high-water mark, bytes */
+} stack_monitor_entry_t;
+
+/* Register the overflow handler; before the threads start. */
+void stack_monitor_init(void);
+
+/* Fill `out` with up to `cap` threads; returns how many. Thread context. */
+size_t stack_monitor_scan(stack_monitor_entry_t *out, size_t cap);
+
+/* Overflows ThreadX reported, and the last thread (NULL if none). */
+uint32_t stack_monitor_overflows(const char **last);
+
+/* High-water marks as MESSAGE_DATA text, "stack <name>=<used>/<size>"
+ * with a '!' past STACK_MONITOR_WARN_PCT. */
+void stack_monitor_report(void);
+
+#ifdef __cplusplus
+}
+#endif
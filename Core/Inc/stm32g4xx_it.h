@@ -55,6 +55,19 @@ void DebugMon_Handler(void);
 void USB_LP_IRQHandler(void);
 void TIM6_DAC_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void DMA1_Channel1_IRQHandler(void);
+void DMA1_Channel2_IRQHandler(void);
+void DMA1_Channel3_IRQHandler(void);
+void DMA1_Channel4_IRQHandler(void);
+void DMA1_Channel5_IRQHandler(void);
+void DMA1_Channel6_IRQHandler(void);
+void I2C2_EV_IRQHandler(void);
+void I2C2_ER_IRQHandler(void);
+void DMA1_Channel7_IRQHandler(void);
+void DMA1_Channel8_IRQHandler(void);
+void USART1_IRQHandler(void);
+void TIM2_IRQHandler(void);
+void FMAC_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Double-buffered tables edited at runtime (routes, ID maps, subscriptions)
+ * and read without locks from ISRs and threads. Readers load the live
+ * pointer and use the table behind it; a writer fills the spare copy and
+ * publishes it with one pointer store, so a reader sees the old table or the
+ * new one, never a mix, and nothing it does is masked or waits.
+ *
+ * The old copy becomes the spare again once no reader can still be on it
+ * (the grace period). A reader in an ISR is done by the time the writing
+ * thread runs again, so tables read only from ISRs are reusable at once.
+ * A thread reader can only be on it if it was preempted (ready, not
+ * running) when the pointer moved; the grace period ends once each thread
+ * ready at the publish, the writer aside, has been seen suspended.
+ *
+ * Rules for readers: read the pointer once per use, and don't keep it
+ * across anything that can suspend the thread. Writers of one table must
+ * be serialized by the caller, run in thread context (or before the
+ * kernel starts), and only touch the buffer table_swap_begin() returned.
+ */
+
+/* Threads a grace period tracks one by one; later ones in the created
+ * list are checked all together. */
+#ifndef TABLE_SWAP_MAX_THREADS
+#define TABLE_SWAP_MAX_THREADS 32u
+#endif
+
+#define TABLE_SWAP_ISR_READERS 0x01u /* every reader runs in an ISR */
+
+typedef struct {
+  void *volatile live;
+  void *spare;
+  size_t size;
+  uint8_t flags;
+  uint8_t pending_more; /* a thread past the tracked ones was ready */
+  uint32_t pending;     /* tracked threads ready at the last publish */
+  uint32_t publishes;
+  uint32_t busy; /* table_swap_begin() calls that gave up */
+} table_swap_t;
+
+/*
+ * Use `a` and `b` (`size` bytes each) for one table, `a` live. Both should
+ * hold the initial contents. A table already set up is left alone, so this
+ * can run on every (re)initialisation of its owner.
+ */
+void table_swap_init(table_swap_t *t, void *a, void *b, size_t size,
+                     unsigned flags);
+
+/* The live table (NULL before table_swap_init()). */
+static inline const void *table_swap_read(const table_swap_t *t) {
+  return t->live;
+}
+
+/*
+ * The spare table, holding a copy of the live one, for the caller to edit;
+ * waits up to `wait_ms` for the previous grace period to end, then returns
+ * NULL (counted in `busy`). Nothing is visible until table_swap_publish().
+ */
+void *table_swap_begin(table_swap_t *t, uint32_t wait_ms);
+
+/* Make the edited spare live; the old table's grace period starts. */
+void table_swap_publish(table_swap_t *t);
+
+#ifdef __cplusplus
+}
+#endif
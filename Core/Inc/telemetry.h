@@ -1,5 +1,8 @@
 #pragma once
 #include "sedsprintf.h"
+#include "can_bus.h"
+#include "mem_budget.h"
+#include "telemetry_wire.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -19,6 +22,17 @@ typedef struct {
 // A single global router state (defined in telemetry.c)
 extern RouterState g_router;
 
+// CAN controller the router runs on, as a can_bus_get() index.
+#ifndef TELEMETRY_CAN_BUS
+#define TELEMETRY_CAN_BUS 0u
+#endif
+
+// Controller a boundary clock serves time on (TELEMETRY_TIME_BOUNDARY in
+// telemetry.c), as a can_bus_get() index.
+#ifndef TELEMETRY_TIME_DOWN_BUS
+#define TELEMETRY_TIME_DOWN_BUS 1u
+#endif
+
 // Transmit and radio handlers implemented in telemetry.c
 SedsResult tx_send(const uint8_t *bytes, size_t len, void *user);
 
@@ -35,6 +49,87 @@ SedsResult log_telemetry_asynchronous(SedsDataType data_type, const void *data,
                                       size_t element_count,
                                       size_t element_size);
 
+// Returned by the asynchronous logging calls when the packet's TX class is
+// over its share of the router heap budget, or its intake ring is full.
+// Nothing was queued; retry later or drop the sample.
+#define TELEMETRY_WOULD_BLOCK SEDS_IO
+
+// As above with the element kind given instead of guessed from the size
+// (4 and 8 bytes = float), and no argument checks. Normally reached through
+// the LOG_TELEMETRY* macros below.
+SedsResult log_telemetry_typed_synchronous(SedsDataType data_type,
+                                           const void *data,
+                                           size_t element_count,
+                                           size_t element_size,
+                                           SedsElemKind kind);
+SedsResult log_telemetry_typed_asynchronous(SedsDataType data_type,
+                                            const void *data,
+                                            size_t element_count,
+                                            size_t element_size,
+                                            SedsElemKind kind);
+
+// Element kind of an expression's type. Plain char counts as unsigned
+// (text); bool and the unsigned types fall to the default.
+#define TELEMETRY_ELEM_KIND(x)                                              \
+  _Generic((x), float: SEDS_EK_FLOAT, double: SEDS_EK_FLOAT,                \
+           signed char: SEDS_EK_SIGNED, short: SEDS_EK_SIGNED,              \
+           int: SEDS_EK_SIGNED, long: SEDS_EK_SIGNED,                       \
+           long long: SEDS_EK_SIGNED, default: SEDS_EK_UNSIGNED)
+
+// Typed logging with kind, element size and count taken from the argument:
+//   LOG_TELEMETRY(ty, value)        one scalar (any expression)
+//   LOG_TELEMETRY_ARRAY(ty, array)  a whole array (not a pointer)
+//   LOG_TELEMETRY_SAMPLE(ty, s)     a TELEMETRY_SAMPLE struct
+// Queued through the asynchronous path; the _SYNC forms emit right away.
+#define LOG_TELEMETRY(ty, value)                                            \
+  SEDS_LOG_SCALAR_(log_telemetry_typed_asynchronous, ty, value)
+#define LOG_TELEMETRY_SYNC(ty, value)                                       \
+  SEDS_LOG_SCALAR_(log_telemetry_typed_synchronous, ty, value)
+#define LOG_TELEMETRY_ARRAY(ty, array)                                      \
+  SEDS_LOG_ARRAY_(log_telemetry_typed_asynchronous, ty, array)
+#define LOG_TELEMETRY_ARRAY_SYNC(ty, array)                                 \
+  SEDS_LOG_ARRAY_(log_telemetry_typed_synchronous, ty, array)
+#define LOG_TELEMETRY_SAMPLE(ty, s)                                         \
+  SEDS_LOG_SAMPLE_(log_telemetry_typed_asynchronous, ty, s)
+#define LOG_TELEMETRY_SAMPLE_SYNC(ty, s)                                    \
+  SEDS_LOG_SAMPLE_(log_telemetry_typed_synchronous, ty, s)
+
+// Multi-field sample with a compile-time schema. The router's typed payload
+// is homogeneous, so every field shares `elem_t`:
+//   TELEMETRY_SAMPLE(imu_sample_t, float, ax, ay, az);
+//   imu_sample_t s = {.ax = ..., .ay = ..., .az = ...};
+//   LOG_TELEMETRY_SAMPLE(SEDS_DT_IMU, s);
+// The zero-length seds_elem_ member carries the element type for the log
+// macro and takes no space.
+#define TELEMETRY_SAMPLE(name, elem_t, ...)                                 \
+  typedef struct __attribute__((packed)) {                                  \
+    elem_t seds_elem_[0];                                                   \
+    elem_t __VA_ARGS__;                                                     \
+  } name;                                                                   \
+  _Static_assert(sizeof(name) % sizeof(elem_t) == 0,                        \
+                 #name " must be a whole number of " #elem_t)
+
+#define SEDS_LOG_SCALAR_(fn, ty, value)                                     \
+  __extension__({                                                           \
+    const __typeof__(value) seds_v_ = (value);                              \
+    fn((ty), &seds_v_, 1u, sizeof(seds_v_), TELEMETRY_ELEM_KIND(seds_v_));  \
+  })
+#define SEDS_LOG_ARRAY_(fn, ty, array)                                      \
+  __extension__({                                                           \
+    _Static_assert(!__builtin_types_compatible_p(__typeof__(array),         \
+                                                 __typeof__(&(array)[0])),  \
+                   "LOG_TELEMETRY_ARRAY needs an array, not a pointer");    \
+    fn((ty), (array), sizeof(array) / sizeof((array)[0]),                   \
+       sizeof((array)[0]), TELEMETRY_ELEM_KIND((array)[0]));                \
+  })
+#define SEDS_LOG_SAMPLE_(fn, ty, s)                                         \
+  fn((ty), &(s), sizeof(s) / sizeof((s).seds_elem_[0]),                     \
+     sizeof((s).seds_elem_[0]), TELEMETRY_ELEM_KIND((s).seds_elem_[0]))
+
+// The dispatch calls first send what earlier passes parked on a full CAN TX
+// ring, and return TELEMETRY_WOULD_BLOCK without touching the router's queue
+// while bulk is still parked; the next CAN TX completion raises
+// TELEMETRY_EVT_CAN_TX to resume.
 SedsResult dispatch_tx_queue(void);
 
 void rx_asynchronous(const uint8_t *bytes, size_t len);
@@ -46,12 +141,565 @@ SedsResult dispatch_tx_queue_timeout(uint32_t timeout_ms);
 SedsResult process_rx_queue_timeout(uint32_t timeout_ms);
 SedsResult process_all_queues_timeout(uint32_t timeout_ms);
 
+// Queue a small sample from an interrupt handler: no allocation, no locks,
+// a bounded copy into the intake ring. Samples up to
+// TELEMETRY_INTAKE_DATA_MAX (48) bytes; SEDS_BAD_ARG for larger ones,
+// SEDS_IO with the ring full, SEDS_ERR before init_telemetry_router().
+// The packet is stamped with the time of the call, or with `raw_us`
+// (us_clock_now() scale) captured earlier, e.g. at a data-ready edge.
+SedsResult log_telemetry_from_isr(SedsDataType data_type, const void *data,
+                                  size_t element_count, size_t element_size);
+SedsResult log_telemetry_from_isr_at(SedsDataType data_type, const void *data,
+                                     size_t element_count, size_t element_size,
+                                     uint64_t raw_us);
+
+// Zero-copy handoff for thread producers, e.g. samples larger than the
+// intake ring takes: take a block from the sample pool, write the elements
+// into it and send it. Only the pointer is queued; the TX thread serializes
+// straight from the block and returns it to the pool, so the producer does
+// no second copy and never waits on the router's lock.
+//   float *v = telemetry_block_get(TX_NO_WAIT);
+//   if (v) { ...fill...; telemetry_block_send(v, ty, n, sizeof(float),
+//                                             SEDS_EK_FLOAT); }
+// telemetry_block_get() returns word-aligned room for
+// TELEMETRY_BLOCK_DATA_MAX bytes, or NULL when all TELEMETRY_BLOCK_COUNT
+// (mem_budget.h) are taken after `wait_ticks` (TX_NO_WAIT from ISRs) or
+// before init_telemetry_router(). telemetry_block_send() always takes the
+// block back: SEDS_BAD_ARG for a shape that doesn't fit, SEDS_ERR without
+// the intake. The packet is stamped at the send; blocks go through the same
+// TX classes, aggregation and heap budget as the intake ring, after the
+// ring's records of a drain pass. telemetry_block_put() returns a block
+// unsent.
+#define TELEMETRY_BLOCK_HDR_BYTES 16u
+#define TELEMETRY_BLOCK_DATA_MAX (TELEMETRY_BLOCK_BYTES - TELEMETRY_BLOCK_HDR_BYTES)
+void *telemetry_block_get(uint32_t wait_ticks);
+SedsResult telemetry_block_send(void *block, SedsDataType data_type,
+                                size_t element_count, size_t element_size,
+                                SedsElemKind kind);
+void telemetry_block_put(void *block);
+// Blocks sent, and telemetry_block_get() calls that found the pool empty.
+// Either pointer may be NULL.
+void telemetry_block_get_stats(uint32_t *sent, uint32_t *exhausted);
+
+// Several samples in one call, e.g. all channels of one sensor read:
+//   const telemetry_batch_item_t b[] = {
+//       TELEMETRY_BATCH_ARRAY(SEDS_DT_GYRO_DATA, gyro),
+//       TELEMETRY_BATCH_ARRAY(SEDS_DT_ACCEL_DATA, accel),
+//   };
+//   log_telemetry_batch(b, 2, 0);
+// The router check, heap budget reading and TX thread wakeup happen once per
+// call rather than once per sample, and consecutive items of one TX class
+// that fit the intake ring take their records in a single claim (queued all
+// or none). Each item is stamped at `raw_us` (us_clock_now() scale), 0 for
+// the time of the call. Flags:
+//   TELEMETRY_BATCH_SYNC  emit now, as log_telemetry_typed_synchronous()
+//   TELEMETRY_BATCH_PACK  join consecutive items of one data type and
+//                         element shape into one packet, stamped with the
+//                         first (the type must take that many elements)
+// Returns SEDS_OK, or the first failure (TELEMETRY_WOULD_BLOCK, ...): the
+// items after a failed one are still tried. SEDS_BAD_ARG for an empty item,
+// before anything is logged.
+typedef struct {
+  SedsDataType type;
+  const void *data;
+  size_t count;      // elements
+  size_t size;       // bytes per element
+  SedsElemKind kind;
+  uint64_t raw_us;   // 0 = now
+} telemetry_batch_item_t;
+
+#define TELEMETRY_BATCH_SYNC 0x1u
+#define TELEMETRY_BATCH_PACK 0x2u
+
+#define TELEMETRY_BATCH_ARRAY(ty, array)                                    \
+  {.type = (ty), .data = (array),                                           \
+   .count = sizeof(array) / sizeof((array)[0]), .size = sizeof((array)[0]), \
+   .kind = TELEMETRY_ELEM_KIND((array)[0]), .raw_us = 0}
+
+SedsResult log_telemetry_batch(const telemetry_batch_item_t *items, size_t n,
+                               unsigned flags);
+
+// On-board reduction of high-rate channels before they reach the router.
+// Each rule folds a window of samples of one data type into a single
+// sample of the same shape, element by element:
+//   DECIMATE  forward the first sample of each window (N-to-1)
+//   LAST      the newest sample
+//   MIN/MAX/MEAN/RMS  per-element statistic
+//   DEADBAND  report by exception: forward a sample only when an element
+//             has moved more than `deadband` from the last one forwarded
+//             (0 = on any change), or `heartbeat_ms` has passed without
+//             one (0 = no heartbeat); the window fields are not used
+// The window closes after `window` samples or `window_ms` ms, whichever is
+// set (non-zero) and comes first; it's checked as samples arrive, so a
+// channel that stops mid-window holds its partial result. Samples wider
+// than TELEMETRY_AGG_MAX_ELEMS (8) elements pass through. Text going
+// through log_error_*() isn't aggregated.
+typedef enum {
+  TELEMETRY_AGG_DECIMATE,
+  TELEMETRY_AGG_LAST,
+  TELEMETRY_AGG_MIN,
+  TELEMETRY_AGG_MAX,
+  TELEMETRY_AGG_MEAN,
+  TELEMETRY_AGG_RMS,
+  TELEMETRY_AGG_DEADBAND,
+} telemetry_agg_mode_t;
+
+typedef struct {
+  SedsDataType type;
+  telemetry_agg_mode_t mode;
+  uint16_t window;    // samples per output, 0 = time only
+  uint16_t window_ms; // 0 = count only
+  float deadband;        // DEADBAND: change threshold, in the type's units
+  uint32_t heartbeat_ms; // DEADBAND: longest silence
+} telemetry_agg_rule_t;
+
+// Replace the rule table (copied; up to TELEMETRY_AGG_MAX_RULES, 8) and
+// restart every window. count 0 turns aggregation off. SEDS_BAD_ARG for an
+// unknown mode, a negative deadband, or a windowed rule with neither
+// window set.
+SedsResult telemetry_set_aggregation(const telemetry_agg_rule_t *rules,
+                                     size_t count);
+
+// Bus-load fidelity profiles (TELEMETRY_AGG_PROFILES in telemetry.c): the
+// CAN bus load from the monitor picks one level for every profiled type,
+//   FULL       every sample
+//   DECIMATED  one of `decimate` samples (0 or 1: stays at FULL)
+//   STATS      one `stats_mode` sample (LAST or MIN..RMS) per `stats_ms`
+//              (0: stays at DECIMATED)
+// Load at or over TELEMETRY_AGG_LOAD_DECIMATE_PCT / _STATS_PCT steps down
+// to that level at once; the level steps back up one at a time once load
+// has stayed TELEMETRY_AGG_LOAD_HYST_PCT under the mark that set it for
+// TELEMETRY_AGG_LOAD_HOLD_MS. Types with a telemetry_set_aggregation() rule
+// keep that rule. Each level change restarts the profiled windows.
+enum {
+  TELEMETRY_AGG_LEVEL_FULL = 0,
+  TELEMETRY_AGG_LEVEL_DECIMATED,
+  TELEMETRY_AGG_LEVEL_STATS,
+};
+
+typedef struct {
+  SedsDataType type;
+  uint16_t decimate;
+  telemetry_agg_mode_t stats_mode;
+  uint16_t stats_ms;
+} telemetry_agg_profile_t;
+
+typedef struct {
+  uint8_t level;      // TELEMETRY_AGG_LEVEL_*
+  uint8_t load_pct;   // at the last poll
+  uint32_t step_downs;
+  uint32_t step_ups;
+} telemetry_agg_load_stats_t;
+
+// Replace the profile table (copied); count 0 turns profiles off.
+// SEDS_BAD_ARG past TELEMETRY_AGG_PROFILES or for a stats_mode that isn't a
+// statistic.
+SedsResult telemetry_set_agg_profiles(const telemetry_agg_profile_t *profiles,
+                                      size_t count);
+
+// Follow the bus load; returns ms until the next check, or UINT32_MAX with
+// no profiles. Telemetry maintenance thread.
+uint32_t telemetry_agg_load_poll(void);
+
+void telemetry_agg_get_load_stats(telemetry_agg_load_stats_t *out);
+
+// Remote rate control (TELEMETRY_RATE_* in telemetry.c): the gateway
+// throttles sources at the origin instead of dropping what already crossed
+// the bus. A gateway configured with telemetry_set_rate_ctrl() takes the
+// worst of CAN bus load, uplink backlog (USB, the UART schedule) and
+// refused relays, steps a level 0..TELEMETRY_RATE_MAX_LEVEL, and while
+// above 0 broadcasts a TELEMETRY_CMD_RATE table each poll: every listed
+// type at decimation 1 << level, capped at its own `decimate`. Sources,
+// the gateway included, apply it as DECIMATE channels behind their own
+// rules and profiles and drop it when it isn't refreshed within the hold
+// it carries.
+typedef struct {
+  SedsDataType type;
+  uint16_t decimate; // gateway: the most; source: the factor (0, 1: full)
+} telemetry_rate_t;
+
+typedef struct {
+  uint8_t level;        // gateway: 0 = full rate
+  uint8_t load_pct;     // gateway, at the last poll
+  uint8_t backlog_pct;  // gateway, at the last poll
+  uint8_t remote_types; // source: entries of the table in effect
+  uint32_t step_downs;
+  uint32_t step_ups;
+  uint32_t broadcasts;
+  uint32_t remote_applied;
+  uint32_t remote_expired;
+} telemetry_rate_stats_t;
+
+// Gateway: the types to throttle (copied; up to TELEMETRY_RATE_TYPES, 4);
+// count 0 stops it, and the sources' tables lapse.
+SedsResult telemetry_set_rate_ctrl(const telemetry_rate_t *types,
+                                   size_t count);
+
+// Source: the table in effect for `hold_ms`; count 0 clears it. What the
+// RATE command calls.
+SedsResult telemetry_set_remote_rates(const telemetry_rate_t *rates,
+                                      size_t count, uint32_t hold_ms);
+
+// Expire the source table and run the gateway's control; returns ms until
+// the next call is due. Telemetry maintenance thread.
+uint32_t telemetry_rate_poll(void);
+
+void telemetry_rate_get_stats(telemetry_rate_stats_t *out);
+
+// Memory-pressure degradation (TELEMETRY_MEM_* in telemetry.c). Pressure is
+// the router heap's fill in percent of the queue budget, or 100 for a poll
+// that saw an allocation fail. Each level adds one action to the ones
+// below it:
+//   CAPTURE  raw capture stops, and new captures are refused (BUSY)
+//   AGGR     every profiled type at its coarsest level (STATS, else
+//            DECIMATED), whatever the bus load
+//   SHED     bulk (LOW) records are shed at once instead of waiting out
+//            TELEMETRY_SHED_AGE_MS, and not admitted
+//   REASM    low-priority CAN IDs get TELEMETRY_MEM_REASM_SLOTS reassembly
+//            slots at most
+// Pressure at or over a level's mark steps down to that level at once; the
+// level steps back up one at a time once pressure has stayed
+// TELEMETRY_MEM_HYST_PCT under the mark that set it for
+// TELEMETRY_MEM_CALM_MS, undoing that level's action.
+enum {
+  TELEMETRY_MEM_NORMAL = 0,
+  TELEMETRY_MEM_CAPTURE,
+  TELEMETRY_MEM_AGGR,
+  TELEMETRY_MEM_SHED,
+  TELEMETRY_MEM_REASM,
+};
+
+typedef struct {
+  uint8_t level;        // TELEMETRY_MEM_*
+  uint8_t pressure_pct; // at the last poll
+  uint8_t peak_pct;
+  uint32_t step_downs;
+  uint32_t step_ups;
+  uint32_t alloc_failed; // heap allocations refused, as of the last poll
+  uint32_t captures_stopped;
+} telemetry_mem_stats_t;
+
+// Follow the memory pressure; returns ms until the next check. Telemetry
+// maintenance thread.
+uint32_t telemetry_mem_poll(void);
+
+void telemetry_mem_get_stats(telemetry_mem_stats_t *out);
+
+// TX class of a data type on the asynchronous path. The intake drain takes
+// classes in strict order, with records of a lower class promoted once they
+// have waited TELEMETRY_INTAKE_AGE_MS (50 ms); HIGH and MID packets are
+// sent straight away in that CAN class, bulk joins the router's FIFO TX
+// queue. Defaults: time sync HIGH, errors MID, everything else LOW.
+SedsResult telemetry_set_tx_class(SedsDataType ty, can_bus_tx_prio_t prio);
+
+// Standard CAN ID the data type is sent on, 0 for its TX class's ID; the
+// default is TELEMETRY_CAN_ID_MAP. Senders keep using the old map until the
+// new one is published whole. Call from one thread at a time; SEDS_ERR if
+// a sender preempted on the spare map didn't let go of it within 20 ms.
+SedsResult telemetry_set_can_id(SedsDataType ty, uint16_t id);
+
+// Data type IDs the per-type tables cover (TX class, CAN ID, subscriptions,
+// link priority); a higher type always gets the defaults.
+#ifndef TELEMETRY_RX_MAX_DATA_TYPES
+#define TELEMETRY_RX_MAX_DATA_TYPES 128u
+#endif
+
+// UART downlink budget, for a low-rate radio modem on the UART side:
+// CONFIG_UART_LINK_BPS bytes per second (0, the default: no limit). URGENT
+// types always go at once; of the others only the newest packet per type
+// waits for the budget, and the one sent next is the best priority that
+// has waited longest. A held packet older than TELEMETRY_UART_STALE_MS
+// (telemetry.c) is dropped unsent. Defaults: the HIGH and MID TX classes
+// URGENT, everything else NORMAL.
+enum {
+  TELEMETRY_LINK_URGENT = 0,
+  TELEMETRY_LINK_HIGH,
+  TELEMETRY_LINK_NORMAL,
+  TELEMETRY_LINK_LOW,
+  TELEMETRY_LINK_PRIO_COUNT
+};
+SedsResult telemetry_set_link_priority(SedsDataType ty, uint8_t prio);
+
+typedef struct {
+  uint32_t sent;       // packets that went out
+  uint32_t held;       // packets that waited for the budget
+  uint32_t superseded; // held packets replaced by a newer one of the type
+  uint32_t stale;      // held packets too old to send
+  uint32_t dropped;    // over budget with no room to hold
+  uint32_t pending;    // held now
+  // Header compression (TELEMETRY_UART_HDR_COMP; zero without it):
+  uint32_t hc_in_bytes;   // packet bytes encoded
+  uint32_t hc_out_bytes;  // frame bytes they became
+  uint32_t hc_rx_dropped; // frames against a template this end doesn't have
+} telemetry_link_stats_t;
+void telemetry_link_get_stats(telemetry_link_stats_t *out);
+
+// Send held packets the budget covers now; returns ms until the next one
+// is covered (UINT32_MAX with none held). Telemetry RX thread.
+uint32_t telemetry_link_poll(void);
+
+// USB uplink merge (TELEMETRY_USB_MERGE_WINDOW_MS): packets held per source
+// and sent in order of the synced time they reached the gateway.
+typedef struct {
+  uint32_t queued;   // held for merging
+  uint32_t sent;     // out of the merge, packets that bypassed it included
+  uint32_t forced;   // sent before the window because a queue was full
+  uint32_t bypassed; // longer than a slot: flushed everything and went on
+  uint32_t late;     // sent after a packet stamped later (window too short)
+  uint32_t held;     // in the queues now
+  uint32_t held_hwm;
+} telemetry_usb_merge_stats_t;
+void telemetry_usb_merge_get_stats(telemetry_usb_merge_stats_t *out);
+
+// Send merged packets that are past the window; returns ms until the next
+// one is (UINT32_MAX with none held). Telemetry RX thread.
+uint32_t telemetry_usb_merge_poll(void);
+
+// Backpressure counters: asynchronous calls refused with
+// TELEMETRY_WOULD_BLOCK, queued records shed after waiting
+// TELEMETRY_SHED_AGE_MS behind the budget, and whether CAN reassembly of
+// bulk IDs is paused right now. Any pointer may be NULL.
+void telemetry_flow_get_stats(uint32_t *blocked, uint32_t *shed,
+                              uint8_t *rx_paused);
+
+// Hand up to `max` records from the asynchronous logging intake ring to the
+// router; returns how many it took. Single consumer: the TX thread.
+size_t telemetry_intake_drain(size_t max);
+
+// Records accepted into the intake ring, and calls dropped with it full.
+// Either pointer may be NULL.
+void telemetry_intake_get_stats(uint32_t *queued, uint32_t *overflow);
+
+// CAN side of tx_send(): packets parked on a full TX ring, packets refused
+// with TELEMETRY_WOULD_BLOCK because the parking buffer was full too, and
+// packets the driver rejected outright. Any pointer may be NULL.
+void telemetry_can_tx_get_stats(uint32_t *parked, uint32_t *would_block,
+                                uint32_t *failed);
+
+// Packets sent compressed (TELEMETRY_CAN_LZ in telemetry.c) and the bytes
+// that saved. Either pointer may be NULL.
+void telemetry_can_lz_get_stats(uint32_t *packets, uint32_t *saved);
+
+// Series profile for a numeric data type: with `on`, its samples go out on
+// CAN as compact delta-encoded frames (series_codec.h) rather than router
+// packets. Other sides and local endpoints are unaffected. SEDS_BAD_ARG
+// with every channel (TELEMETRY_SERIES_CHANNELS, 8) taken. Receiving is
+// always on.
+SedsResult telemetry_set_series(SedsDataType ty, int on);
+
+// Series frames sent, and received frames dropped for a gap or damage
+// (until the sender's next key frame). Either pointer may be NULL.
+void telemetry_series_get_stats(uint32_t *sent, uint32_t *lost);
+
 SedsResult print_telemetry_error(int32_t error_code);
 SedsResult log_error_asyncronous(const char* fmt, ...);
 SedsResult log_error_syncronous(const char* fmt, ...);
 
+// The log_error_*() calls, LOG_ERROR_DEFERRED included, are rate limited
+// per call site (its format string) and by a byte budget for all errors
+// (TELEMETRY_ERR_* in telemetry.c). A call over a limit returns SEDS_OK
+// having sent nothing and formatted nothing; the maintenance thread's
+// telemetry_error_poll() later sends "<n> repeats suppressed: <format>" for
+// the site, and returns ms until it has another summary due.
+uint32_t telemetry_error_poll(void);
+// Calls dropped by the per-site limit, and by the byte budget. Either
+// pointer may be NULL.
+void telemetry_error_get_stats(uint32_t *suppressed, uint32_t *capped);
+
+// Deferred-format error logging. LOG_ERROR_DEFERRED("fmt", args...) puts the
+// format string in the .seds_fmt linker section, which is never loaded: the
+// string's address there is its 16-bit ID. Only the ID and the raw argument
+// bytes go out, as a SEDS_DT_GENERIC_ERROR payload starting with a NUL
+// byte; fmt_decode.py expands them against the ELF. No formatting happens
+// on the target.
+//
+// `fmt` must be a string literal; up to 8 arguments, checked against it like
+// printf. Integers and pointers go out as 4 bytes, or 8 for 64-bit types
+// (%ll, %j); float and double as a 4-byte float (%f, %e, %g). %s is not
+// supported: the host can't follow the pointer.
+#define TELEMETRY_DEFERRED_MARK 0x00u
+#define TELEMETRY_DEFERRED_MAX_ARGS 8u
+
+SedsResult log_error_deferred(uint16_t fmt_id, const uint64_t *vals,
+                              const uint8_t *widths, size_t count);
+
+static inline uint64_t seds_fmt_f(double v) {
+  union { float f; uint32_t u; } c = { .f = (float)v };
+  return c.u;
+}
+static inline uint64_t seds_fmt_p(const volatile void *p) {
+  return (uint64_t)(uintptr_t)p;
+}
+static inline uint64_t seds_fmt_i(int64_t v) { return (uint64_t)v; }
+static inline __attribute__((format(printf, 1, 2))) void
+seds_fmt_check(const char *fmt, ...) { (void)fmt; }
+
+#define SEDS_FMT_VAL(x)                                                     \
+  _Generic((x), float: seds_fmt_f, double: seds_fmt_f,                      \
+           char *: seds_fmt_p, const char *: seds_fmt_p,                    \
+           void *: seds_fmt_p, const void *: seds_fmt_p,                    \
+           default: seds_fmt_i)(x)
+#define SEDS_FMT_W(x)                                                       \
+  _Generic((x), float: 4u, double: 4u,                                      \
+           default: (sizeof(x) > 4u ? 8u : 4u))
+
+#define SEDS_FMT_NARG(...)                                                  \
+  SEDS_FMT_NARG_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define SEDS_FMT_NARG_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define SEDS_FMT_CAT(a, b) SEDS_FMT_CAT_(a, b)
+#define SEDS_FMT_CAT_(a, b) a##b
+#define SEDS_FMT_MAP(m, ...)                                                \
+  SEDS_FMT_CAT(SEDS_FMT_MAP_, SEDS_FMT_NARG(__VA_ARGS__))(m, ##__VA_ARGS__)
+#define SEDS_FMT_MAP_0(m)
+#define SEDS_FMT_MAP_1(m, a) m(a),
+#define SEDS_FMT_MAP_2(m, a, ...) m(a), SEDS_FMT_MAP_1(m, __VA_ARGS__)
+#define SEDS_FMT_MAP_3(m, a, ...) m(a), SEDS_FMT_MAP_2(m, __VA_ARGS__)
+#define SEDS_FMT_MAP_4(m, a, ...) m(a), SEDS_FMT_MAP_3(m, __VA_ARGS__)
+#define SEDS_FMT_MAP_5(m, a, ...) m(a), SEDS_FMT_MAP_4(m, __VA_ARGS__)
+#define SEDS_FMT_MAP_6(m, a, ...) m(a), SEDS_FMT_MAP_5(m, __VA_ARGS__)
+#define SEDS_FMT_MAP_7(m, a, ...) m(a), SEDS_FMT_MAP_6(m, __VA_ARGS__)
+#define SEDS_FMT_MAP_8(m, a, ...) m(a), SEDS_FMT_MAP_7(m, __VA_ARGS__)
+
+#define LOG_ERROR_DEFERRED(fmt, ...)                                        \
+  do {                                                                      \
+    __attribute__((section(".seds_fmt"), used))                             \
+    static const char seds_fmt_str_[] = fmt;                                \
+    if (0) seds_fmt_check(fmt, ##__VA_ARGS__);                              \
+    const uint64_t seds_fmt_v_[] = {                                        \
+        SEDS_FMT_MAP(SEDS_FMT_VAL, ##__VA_ARGS__) 0u};                      \
+    const uint8_t seds_fmt_w_[] = {                                         \
+        SEDS_FMT_MAP(SEDS_FMT_W, ##__VA_ARGS__) 0u};                        \
+    (void)log_error_deferred((uint16_t)(uintptr_t)seds_fmt_str_,            \
+                             seds_fmt_v_, seds_fmt_w_,                      \
+                             sizeof(seds_fmt_w_) - 1u);                     \
+  } while (0)
+
 SedsResult telemetry_timesync_request(void);
 
+// Master only: send TIME_SYNC_ANNOUNCE with `unix_ms`, from which clients
+// set their unix time. SEDS_OK and nothing sent on a client.
+SedsResult telemetry_timesync_announce(uint64_t priority, uint64_t unix_ms);
+
+// Offset and round-trip delay measured by the last time-sync exchange, in µs.
+// Either pointer may be NULL.
+void telemetry_timesync_last(int64_t *offset_us, uint64_t *delay_us);
+
+// How long to wait after a request before sending the next one: short gaps
+// inside a burst, then a longer pause that grows once the servo is locked.
+uint32_t telemetry_timesync_interval_ms(void);
+
+// Current slew rate of the node clock against the raw timer, in ppb.
+int32_t telemetry_timesync_drift_ppb(void);
+
+// Payload of the compact time-sync request and response frames, and of the
+// master's broadcast SYNC and FOLLOW_UP (NET_TIMESYNC_BROADCAST in
+// telemetry.c).
+#define TELEMETRY_TIMESYNC_REQ_BYTES 8u
+#define TELEMETRY_TIMESYNC_RESP_BYTES 16u
+#define TELEMETRY_TIMESYNC_SYNC_BYTES 4u
+#define TELEMETRY_TIMESYNC_FOLLOW_UP_BYTES 12u
+
+// Histogram bins: < 10, 30, 100, 300, 1000, 3000, 10000 µs, and above.
+#define TELEMETRY_TIMESYNC_HIST_BINS 8u
+
+// Time-sync health on a client since boot. All zero on the master but the
+// frame counters.
+typedef struct {
+  uint8_t  servo_state;      // 0 unsynced, 1 stepped once, 2 tracking
+  uint8_t  locked;
+  uint32_t samples;          // responses matched to a request
+  uint32_t syncs;            // broadcast SYNCs fed to the servo
+  uint32_t bursts;           // bursts with at least one response
+  uint32_t bursts_rejected;  // above the delay floor, not fed to the servo
+  uint32_t steps;            // clock steps, the first one included
+  uint32_t rejected_steps;   // offsets beyond NET_TIMESYNC_MAX_STEP_MS
+  int64_t  last_offset_us;   // servo input from the last accepted burst
+  uint64_t last_delay_us;    // round trip of that sample
+  uint64_t delay_floor_us;   // UINT64_MAX until the first burst
+  uint32_t jitter_us;        // smoothed change in offset between bursts
+  uint32_t last_good_age_ms; // since the last accepted burst, UINT32_MAX if none
+  uint32_t period_ms;        // current pause between bursts
+  int32_t  drift_ppb;
+  uint32_t converge_ms;      // first request to first lock, 0 until locked
+  uint32_t frames_tx;        // sync frames sent: requests, master responses
+                             // and SYNC / FOLLOW_UP
+  uint32_t frames_rx;        // responses heard (any client's), SYNC /
+                             // FOLLOW_UP, master requests
+  uint32_t offset_hist[TELEMETRY_TIMESYNC_HIST_BINS]; // |offset| per sample
+  uint32_t delay_hist[TELEMETRY_TIMESYNC_HIST_BINS];  // delay per sample
+} telemetry_timesync_stats_t;
+
+void telemetry_timesync_get_stats(telemetry_timesync_stats_t *out);
+
+// Boundary clock: time served on TELEMETRY_TIME_DOWN_BUS from this board's
+// clock, synced upstream. All zero on other builds.
+typedef struct {
+  uint32_t frames_tx; // responses, SYNC and FOLLOW_UP sent downstream
+  uint32_t frames_rx; // requests heard downstream
+  uint32_t refused;   // of those, left unanswered before the servo tracked
+  uint8_t  serving;   // servo tracking: downstream gets time now
+} telemetry_boundary_stats_t;
+
+// Boundary clock with NET_TIMESYNC_BROADCAST: send the downstream SYNC or
+// FOLLOW_UP when due. Returns the ms until it is due again, UINT32_MAX on
+// builds without it. Same thread as telemetry_timesync_request().
+uint32_t telemetry_boundary_poll(void);
+
+void telemetry_boundary_get_stats(telemetry_boundary_stats_t *out);
+
+// Master only: discipline the node clock to a PPS edge captured at raw time
+// `raw_us` (us_clock_now()), and take `unix_ms` as the unix time of that
+// edge unless it is 0. Thread context; a no-op on clients.
+void telemetry_pps_edge(uint64_t raw_us, uint64_t unix_ms);
+
+typedef struct {
+  uint32_t edges;            // PPS edges fed in
+  uint32_t labelled;         // of those, with a unix time
+  uint32_t steps;            // clock steps, the first edge included
+  uint8_t  locked;           // last phase error within NET_PPS_LOCK_US
+  int32_t  last_err_us;      // phase error at the last edge, before correction
+  int32_t  drift_ppb;        // oscillator drift against the PPS
+  uint32_t last_edge_age_ms; // UINT32_MAX if none
+} telemetry_pps_stats_t;
+
+void telemetry_pps_get_stats(telemetry_pps_stats_t *out);
+
+// Gateway health summary, one fixed-layout sample of u32s. The maintenance
+// thread publishes it every CONFIG_HEALTH_PERIOD_MS (config_store.h; 0 =
+// off) on TELEMETRY_HEALTH_TYPE when the build names one from the router
+// schema, else as a single "health ..." text message. Fields that weren't
+// measured are UINT32_MAX: CPU shares need the ThreadX execution profile,
+// the time-sync fields a client. Layout, oldest field first; bump
+// TELEMETRY_HEALTH_VERSION when it changes:
+//   cpu_*_pm        share of the last cpu_load window, per mille
+//   heap_*          Rust heap live/peak bytes and failed allocations
+//   rx_ring_*       CAN RX rings: largest high-water mark, frames dropped
+//   reasm_*         CAN messages reassembled, and expired or evicted
+//   intake_*        records waiting per TX class; queue_heap_pct the Rust
+//                   heap share the router queues hold against the budget
+//   can_*           bus load %, error counters, CAN_BUS_STATE_*
+//   ts_offset_us    signed (two's complement), ts_delay_us, ts_locked
+//   can_/usb_/uart_ telemetry_side_stats_t of that side in field order
+//   trace_*         source-to-gateway latency of every traced packet;
+//                   telemetry_trace_get_stats() has it per origin and type
+//   rxlat_*         CAN frame wait in the hardware FIFO until the RX ISR,
+//                   high-priority FIFO0 (hi) and FIFO1; histograms in
+//                   can_bus_get_rx_lat_stats()
+TELEMETRY_SAMPLE(telemetry_health_t, uint32_t, TELEMETRY_HEALTH_FIELDS);
+
+// Collect a summary now; it also becomes the one telemetry_health_last()
+// and HEALTH_GET return.
+void telemetry_health_collect(telemetry_health_t *out);
+
+// Copy of the last summary collected, read under a seqlock (seqlock.h):
+// no lock is taken and nothing is masked. 0 (and zeroes) if none has been
+// collected yet, or a collect kept overlapping the read. On USB and UART,
+// HEALTH_GET returns it after the status, collecting one if there's none.
+int telemetry_health_last(telemetry_health_t *out);
+
+// Node clock, synced to the master on clients. The µs form is a TIM2 read
+// plus an offset: no division, and callable from ISRs.
+uint64_t telemetry_now_us(void);
 uint64_t telemetry_now_ms(void);
 
 uint64_t telemetry_unix_ms(void);
@@ -61,6 +709,385 @@ uint8_t  telemetry_unix_is_valid(void);
 // Master / GPS thread calls this:
 void telemetry_set_unix_time_ms(uint64_t unix_ms);
 
+// Header-only parse of a serialized router packet: store its data type and
+// return 1, or return 0 if the bytes can't be classified. Drives the relay
+// cut-through (TELEMETRY_RELAY_CUT_THROUGH in telemetry.c). The default is a
+// weak stub returning 0, so every packet takes the full router path; a
+// build that pins the sedsprintf_rs wire layout overrides it. The early
+// drop (TELEMETRY_RX_EARLY_DROP) and the per-type CAN IDs
+// (telemetry_can_ids.h) use it too.
+int telemetry_peek_type(const uint8_t *bytes, size_t len, SedsDataType *ty);
+
+// In-band control from the USB host, to limit what the USB side forwards.
+// A CDC frame starting with TELEMETRY_USB_CTRL_MAGIC is a command for the
+// gateway, not a router packet: magic, op, then little-endian u16s.
+//   SUBSCRIBE        first type, last type, min gap ms between packets of
+//                    each type (0 = no limit)
+//   UNSUBSCRIBE      first type, last type
+//   SUBSCRIBE_ALL    (the default, also after each reconnect)
+//   UNSUBSCRIBE_ALL
+// Type ranges stand in for endpoint groups. Each command gets the reply
+// magic, op | 0x80, status. Filtering needs telemetry_peek_type(); packets
+// it can't read are always forwarded.
+// The same frames, unencoded, also work on the USB command pipe
+// (USB_CMD_EP_ENABLED, usb_cdc.h), which answers on the pipe itself and
+// isn't delayed by the bulk stream; routed packets are refused there.
+// The magic, ops and statuses are in telemetry_wire.h.
+
+// Packets kept off USB as unsubscribed, and by the per-type gaps.
+void telemetry_usb_sub_get_stats(uint32_t *filtered, uint32_t *limited);
+
+// Last-value cache (TELEMETRY_LVC in telemetry.c): the newest payload and
+// timestamp of each data type the router delivered locally, for clients
+// that poll instead of taking the stream. A query is a list of u16 LE data
+// types, none meaning every cached one:
+//   USB, UART  magic, TELEMETRY_USB_CTRL_LVC_GET, types
+//              -> magic, op | 0x80, status, values
+//   CAN        types on TELEMETRY_CAN_LVC_QUERY_STD_ID (one frame)
+//              -> status, values on TELEMETRY_CAN_LVC_REPLY_STD_ID
+//              (fragmented, as can_bus_send_large())
+// `values` is a count byte, then per value: type u16, length u8, timestamp
+// u64 (all LE) and the payload. Types never seen are left out; values that
+// don't fit the reply are left out with status PARTIAL. UART takes no other
+// control op.
+typedef struct {
+  uint32_t updates;  // values stored
+  uint32_t too_big;  // payloads over TELEMETRY_LVC_VALUE_MAX, not stored
+  uint32_t no_slot;  // new types after every slot was taken, not stored
+  uint32_t queries;
+} telemetry_lvc_stats_t;
+
+// Copy the cached value of `ty` into `out` (up to `cap` bytes). Returns its
+// length, or -1 if the type has no value, it doesn't fit or it kept
+// changing under the read (values are read under a seqlock, unmasked).
+int telemetry_lvc_get(SedsDataType ty, void *out, size_t cap,
+                      uint64_t *timestamp);
+
+void telemetry_lvc_get_stats(telemetry_lvc_stats_t *out);
+
+// Raw bus capture (TELEMETRY_CAPTURE_BYTES in telemetry.c). CAPTURE_START,
+// with an optional flags byte, streams every CAN frame taken off the RX
+// rings to the side (USB or UART) it came from, and with
+// TELEMETRY_CAPTURE_TX the frames handed to the controller too, until
+// CAPTURE_STOP or another START. Capture frames are sent only while the
+// link has room to spare, so router packets keep their share of it:
+//   TELEMETRY_CAPTURE_MAGIC, u32 records dropped so far, records...
+// Each record maps onto a pcapng packet of LINKTYPE_CAN_SOCKETCAN:
+//   u64 time us (FDCAN timestamp scale, start of frame for RX, handed to
+//   the controller for TX), u32 SocketCAN can_id (CAN_EFF_FLAG for 29-bit
+//   IDs), u8 length, u8 SocketCAN FD flags | TELEMETRY_CAPTURE_DIR_TX, data
+// all little-endian. Records dropped are those the capture buffer had no
+// room for.
+
+typedef struct {
+  uint32_t records;  // frames captured
+  uint32_t dropped;  // no room in the capture buffer
+  uint32_t frames;   // capture frames sent
+  uint8_t active;
+} telemetry_capture_stats_t;
+
+// Send what has been captured; telemetry RX thread.
+void telemetry_capture_poll(void);
+
+void telemetry_capture_get_stats(telemetry_capture_stats_t *out);
+
+// ThreadX event trace (tracex.h) on USB. TRACEX_DUMP freezes the trace
+// buffer and answers BUSY if a dump is already running, BAD_OP if the build
+// doesn't trace; then the buffer follows in frames of
+//   TELEMETRY_TRACEX_MAGIC, u32 offset, u32 buffer size, bytes...
+// (little-endian) sent while the link has room to spare, like capture
+// frames, and recording resumes after the last one. Written at their
+// offsets, the bytes are the .trx file for TraceX (tracex_dump.py).
+
+// Send the next part of a dump; telemetry RX thread.
+void telemetry_tracex_poll(void);
+
+// Allocation trace (telemetry_hooks.h) on USB. HEAP_TRACE_DUMP stops
+// recording and answers BUSY or BAD_OP as TRACEX_DUMP; then the records
+// kept follow in frames of
+//   TELEMETRY_HEAP_TRACE_MAGIC, u32 seq of the first record, u32 seq the
+//   dump ends at, rust_heap_trace_t records...
+// (little-endian, sent like capture frames), and recording resumes after
+// the last one. heap_trace.py aggregates them by call site.
+
+// Send the next part of a heap trace dump; telemetry RX thread.
+void telemetry_heap_trace_poll(void);
+
+// PC sampling profiler (pc_sample.h, PC_SAMPLE_ENABLED) on USB.
+// PC_SAMPLE_START with an optional u32 rate in Hz (0 or left out: the
+// default) clears the ring and starts sampling, BAD_ARG for a rate it
+// can't run, BAD_OP in builds without it; PC_SAMPLE_STOP stops it. While
+// it runs the samples stream in frames of
+//   TELEMETRY_PC_SAMPLE_MAGIC, u32 seq of the first sample, u32 samples
+//   dropped so far, u32 rate Hz, pc_sample_t records...
+// (little-endian, sent like capture frames). It stops by itself when the
+// host goes away. pc_sample.py turns them into a flat profile.
+
+// Send the samples taken; returns ms until the ring is half full, or
+// UINT32_MAX while stopped. Telemetry RX thread.
+uint32_t telemetry_pc_sample_poll(void);
+
+// Send one result record (TELEMETRY_RESULT_MAGIC in telemetry_wire.h) to
+// the USB host, if one is connected, and the UART link: `count` metrics,
+// in the order documented there for `source` (TELEMETRY_RESULT_SRC_*),
+// under `name` (cut to TELEMETRY_RESULT_NAME_MAX). The build's git hash,
+// the core and CAN clocks and the node ID go in the header, so
+// result_collect.py can append records of different revisions and boards
+// to one file and compare them. HAL_BUSY if the link was full (nothing
+// queued there), HAL_ERROR if no link is up. Thread context.
+HAL_StatusTypeDef telemetry_result_record(uint8_t source, const char *name,
+                                          const uint32_t *metrics,
+                                          size_t count);
+
+// Firmware update (fw_update.h, FW_UPDATE_ENABLED). FW_BEGIN, FW_DATA,
+// FW_BLOCK, FW_COMMIT and FW_ABORT with the arguments documented there, on
+// USB, or on CAN as ISO-TP messages of op, arguments to
+// TELEMETRY_FW_ISOTP_RX_ID (telemetry.c), answered from
+// TELEMETRY_FW_ISOTP_TX_ID with
+//   op | 0x80, status, u32 bytes taken, u32 bytes it would take now
+// (fw_update_progress(), LE) so a sender can keep a window open. BAD_OP if
+// the build takes no updates. fw_update.py drives either.
+//
+// FW_RELAY_BEGIN, FW_RELAY_DATA, FW_RELAY_COMMIT and FW_RELAY_ABORT (USB,
+// FW_RELAY_ENABLED) hand an image to another node through the gateway:
+// the gateway sends it on as FW_BLOCKs to that node's ISO-TP IDs
+// (fw_relay.h). fw_update.py --relay.
+
+// File pulls from nodes (file_srv.h, FILE_SRV_ENABLED). FILE_PULL takes
+//   u16 node request ID, u16 node answer ID, u32 offset, name
+// (LE; the answer ID within FILE_SRV_PULL_FIRST..LAST) and answers BUSY
+// while another pull runs; the file then follows in frames of
+//   TELEMETRY_FILE_MAGIC, u8 FILE_SRV_* status, u32 offset, u32 file size,
+//   bytes...
+// as the node sends it, forwarded without being stored. The pull is over
+// at the frame ending at the file size (it may carry no bytes) or at one
+// with a status other than OK. FILE_PULL_ABORT drops it. file_pull.py.
+
+// Per-ID bus usage (can_bus_get_talkers()), on USB or UART. TALKERS takes an
+// optional u8, bit 0 set to clear the table after reading it, and is
+// answered with up to TELEMETRY_TALKERS_MAX of the busiest IDs in the layout
+// of telemetry_wire.h; bus_top.py polls it.
+
+// Runtime tunables (config_store.h), on USB or UART:
+//   CONFIG_GET       u16 keys, none meaning every one this build declares
+//                    -> magic, op | 0x80, status, count, then per key: u16
+//                    key, u8 flags (CONFIG_LIVE, CONFIG_DEFINED), u32
+//                    value in effect, pending, default, min, max
+//   CONFIG_SET       (u16 key, u32 value) pairs, applied in order; BAD_ARG
+//                    at the first unknown key or value out of range
+//   CONFIG_COMMIT    write the values set to flash (in the background)
+//   CONFIG_DEFAULTS  set every key back to its default, for a commit
+// All little-endian. LIVE keys take effect on SET, the rest at the next
+// boot after a COMMIT; until then GET shows them as pending.
+
+// Command endpoint (TELEMETRY_CMD_ENDPOINT in telemetry.c): mode changes
+// sent as router packets, so any node or ground tool on the network can
+// drive them. The endpoint and its data type come from the router schema;
+// the build names them (TELEMETRY_CMD_ENDPOINT, TELEMETRY_CMD_TYPE) and
+// without them there is no endpoint. Payload: op u8, seq u8, then
+//   CAPTURE   side u8 (0 USB, 1 UART), on u8, [flags u8 as CAPTURE_START]
+//   PROFILER  u8: 0 stop, 1 record, 2 clear the counts
+//   AGG       rules, each type u16, mode u8, window u16, window_ms u16,
+//             deadband f32, heartbeat_ms u32; none turns aggregation off
+//   AGG_PROFILE  bus-load profiles, each type u16, decimate u16, stats
+//             mode u8, stats_ms u16; none turns them off
+//   RATE      hold_ms u16, then entries of type u16, decimate u16 (the
+//             gateway's broadcast, telemetry_set_remote_rates()); not
+//             answered
+//   SHAPER    class u8 (can_bus_tx_prio_t), share pct u8, burst us u32;
+//             the bulk class goes through the config store
+//   BENCH     [size u32, rate_hz u32, run_ms u32], 0 or left out = default
+//   CONFIG    (u16 key, u32 value) pairs, as CONFIG_SET
+//   COMMIT    as CONFIG_COMMIT
+// all little-endian. Each other op is answered with a MESSAGE_DATA text
+// packet "cmd op=<op> seq=<seq> st=<status>", status as
+// TELEMETRY_USB_CTRL_*.
+#define TELEMETRY_CMD_CAPTURE  0x01u
+#define TELEMETRY_CMD_PROFILER 0x02u
+#define TELEMETRY_CMD_AGG      0x03u
+#define TELEMETRY_CMD_SHAPER   0x04u
+#define TELEMETRY_CMD_BENCH    0x05u
+#define TELEMETRY_CMD_CONFIG   0x06u
+#define TELEMETRY_CMD_COMMIT   0x07u
+#define TELEMETRY_CMD_AGG_PROFILE 0x08u
+#define TELEMETRY_CMD_RATE     0x09u
+
+// Trace replay (TELEMETRY_REPLAY_BYTES in telemetry.c), on USB or UART:
+// REPLAY_START with an optional u16 scale in percent (100 = recorded timing,
+// 200 = twice as fast, 0 = as fast as the RX rings take them), then
+// REPLAY_DATA frames of capture records, each answered OK, or BUSY while
+// the replay buffer is full (send the frame again), until REPLAY_STOP. The
+// frames enter the CAN RX rings as if just received, so reassembly, the
+// router and the profiler see the recorded traffic mix. Sent frames and
+// time-sync IDs in the trace are skipped.
+typedef struct {
+  uint32_t injected;
+  uint32_t skipped;  // sent frames, time sync, or refused by can_bus
+  uint32_t busy;     // REPLAY_DATA answered BUSY
+  uint8_t active;
+} telemetry_replay_stats_t;
+
+// Inject the records that are due; returns ms until the next one is, or
+// UINT32_MAX with none waiting. Telemetry RX thread.
+uint32_t telemetry_replay_poll(void);
+
+void telemetry_replay_get_stats(telemetry_replay_stats_t *out);
+
+// Black box (TELEMETRY_BLACKBOX_BYTES): the most recent bus traffic, both
+// directions, held in RAM. A trigger (a GENERIC_ERROR packet at the SD
+// endpoint, the bus going off, BLACKBOX_TRIGGER on USB or UART, or a call)
+// keeps it recording for TELEMETRY_BLACKBOX_POST_MS, then it is written out
+// from TELEMETRY_BLACKBOX_PRE_MS before the trigger as capture frames: to
+// the flash store, which sends them to the USB host like stored packets,
+// and to the SD log as records of type TELEMETRY_BLACKBOX_SD_TYPE. Triggers
+// while one is being handled are counted and ignored.
+#define TELEMETRY_BLACKBOX_SD_TYPE 0xFFFFu
+
+#define TELEMETRY_BLACKBOX_COMMAND      0x01u // trigger reasons
+#define TELEMETRY_BLACKBOX_ERROR_PACKET 0x02u
+#define TELEMETRY_BLACKBOX_BUS_OFF      0x03u
+#define TELEMETRY_BLACKBOX_STACK        0x04u // stack_monitor.h
+
+typedef struct {
+  uint32_t triggers;
+  uint32_t ignored;  // during the post-trigger time or a dump
+  uint32_t dumps;    // completed
+  uint32_t frames;   // capture frames written out
+  uint8_t last_reason;
+  uint8_t state;     // 0 recording, 1 post-trigger, 2 writing out
+} telemetry_blackbox_stats_t;
+
+// Safe from ISRs; reasons above 0x7F are free for the application.
+void telemetry_blackbox_trigger(uint8_t reason);
+
+// Check for bus-off, freeze the ring when the post-trigger time is up and
+// write it out; returns ms until it wants to run again. Telemetry
+// maintenance thread, ahead of telemetry_store_poll().
+uint32_t telemetry_blackbox_poll(void);
+
+void telemetry_blackbox_get_stats(telemetry_blackbox_stats_t *out);
+
+// Store and forward (TELEMETRY_STORE_FORWARD): packets the USB side gets
+// while no host is connected are kept in internal flash and sent, rate
+// limited, after one connects. The poll programs and erases flash (which
+// stalls flash fetches) and replays; returns ms until it wants to run
+// again. Telemetry maintenance thread.
+uint32_t telemetry_store_poll(void);
+
+// Stored packets sent to the host, and flash pages still holding unsent
+// ones.
+void telemetry_store_get_stats(uint32_t *replayed, uint32_t *pending_pages);
+
+// Packets relayed by the cut-through, relays a side's send refused, and
+// packets dropped on arrival because nothing wanted their type.
+void telemetry_relay_get_stats(uint32_t *forwarded, uint32_t *failed,
+                               uint32_t *dropped);
+
+// Inbound packets dropped as copies of one received within
+// TELEMETRY_RX_DEDUP_MS (telemetry.c), on any side: the same packet over a
+// second path, or back around a loop of relaying gateways. Checked before
+// the relay and the router's queue.
+void telemetry_dedup_get_stats(uint32_t *dropped);
+
+typedef enum {
+  TELEMETRY_SIDE_CAN = 0, // tx_send(), CAN RX and ISO-TP, rx_asynchronous()
+  TELEMETRY_SIDE_USB,
+  TELEMETRY_SIDE_UART,
+  TELEMETRY_SIDE_SPI, // not in telemetry_health_t
+  TELEMETRY_SIDE_COUNT
+} telemetry_side_t;
+
+// Traffic per side since boot. rx_* counts everything that arrived, control
+// frames included; tx_* what the link took (CAN: parked packets too).
+// queue_rejects: arrivals the router RX queue refused, and CAN sends
+// refused with TELEMETRY_WOULD_BLOCK. io_errors: sends the link failed
+// (SEDS_IO, or SEDS_ERR from the CAN driver). bad_args: empty or
+// undecodable frames and calls the router refused as SEDS_BAD_ARG.
+typedef struct {
+  uint32_t rx_packets;
+  uint32_t rx_bytes;
+  uint32_t tx_packets;
+  uint32_t tx_bytes;
+  uint32_t queue_rejects;
+  uint32_t io_errors;
+  uint32_t bad_args;
+} telemetry_side_stats_t;
+
+// Zeroes `out` for a side out of range.
+void telemetry_side_get_stats(telemetry_side_t side,
+                              telemetry_side_stats_t *out);
+
+typedef enum {
+  TELEMETRY_QUEUE_RX = 0, // arrivals waiting for process_rx_queue*()
+  TELEMETRY_QUEUE_TX,     // queued logs waiting for dispatch_tx_queue*()
+  TELEMETRY_QUEUE_COUNT
+} telemetry_queue_t;
+
+// Time packets spend on a router queue, from the enqueue call to the end of
+// the processing pass that emptied the queue (high by at most one pass;
+// TELEMETRY_QLAT_SLOTS in telemetry.c). Bin i counts samples below
+// TELEMETRY_QLAT_BIN0_US << i, the last bin the rest; p50/p99 are the upper
+// edge of the bin they fall in, capped at max_us.
+#define TELEMETRY_QLAT_BINS 16u
+#define TELEMETRY_QLAT_BIN0_US 32u
+typedef struct {
+  uint32_t samples;
+  uint32_t untracked; // enqueued while the shadow FIFO was full
+  uint32_t pending;   // enqueued, not yet retired by a draining pass
+  uint32_t depth;     // the same over all packets, tracked or not
+  uint32_t idle;      // passes skipped by telemetry_queue_budget_ms()
+  uint32_t budget_ms; // last pass budget it handed out
+  uint32_t p50_us;
+  uint32_t p99_us;
+  uint32_t max_us;
+  uint32_t hist[TELEMETRY_QLAT_BINS];
+} telemetry_qlat_stats_t;
+
+void telemetry_qlat_get_stats(telemetry_queue_t q,
+                              telemetry_qlat_stats_t *out);
+
+// Clear the histograms and maxima, e.g. between tuning runs.
+void telemetry_qlat_reset(void);
+
+// Packets on router queue `q` not yet known to be processed: exact after a
+// pass that drained it, an upper bound while a backlog lasts.
+uint32_t telemetry_queue_depth(telemetry_queue_t q);
+
+// Time budget for the next processing pass of `q`, from its depth (and for
+// TX, the bulk CAN TX ring's fill); 0 when it is known to be empty and the
+// pass can be skipped. Called by the queue's consumer thread.
+uint32_t telemetry_queue_budget_ms(telemetry_queue_t q);
+
+// This board's origin ID in traces: TELEMETRY_NODE_ID, else folded from
+// the chip UID (never 0).
+uint16_t telemetry_node_id(void);
+
+// Source-to-gateway latency of traced CAN packets (TELEMETRY_CAN_TRACE_EVERY
+// in telemetry.c): this node's synced clock on arrival minus the origin's
+// at log time, or at dispatch for packets the origin's router queued.
+// Binned like the queue latency; `key` is the origin ID or data type
+// (0xFFFF if telemetry_peek_type() can't read it). skewed counts stamps
+// ahead of this clock, left out of the histogram.
+typedef enum {
+  TELEMETRY_TRACE_BY_ORIGIN = 0,
+  TELEMETRY_TRACE_BY_TYPE,
+  TELEMETRY_TRACE_ALL, // one entry, every traced packet
+} telemetry_trace_table_t;
+
+typedef struct {
+  uint16_t key;
+  uint32_t samples;
+  uint32_t skewed;
+  uint32_t p50_us;
+  uint32_t p99_us;
+  uint32_t max_us;
+  uint32_t hist[TELEMETRY_QLAT_BINS];
+} telemetry_trace_stats_t;
+
+// Entry `i` of `table`; 0 (and `out` zeroed) past the last one in use.
+int telemetry_trace_get_stats(telemetry_trace_table_t table, size_t i,
+                              telemetry_trace_stats_t *out);
+
 
 void die(const char *fmt, ...);
 
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "telemetry.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+/*
+ * Typed C++ front end for telemetry.h, header-only (C++11). A data type is
+ * a plain struct whose fields all share one element type, with its schema
+ * as static members:
+ *
+ *   struct imu_sample {
+ *     static constexpr SedsDataType type = SEDS_DT_IMU;
+ *     typedef float elem_type;
+ *     float ax, ay, az;
+ *   };
+ *   telemetry::log_async(imu_sample{ax, ay, az});
+ *
+ * telemetry::schema<S> derives the element kind, count and size, and the
+ * CAN ID from TELEMETRY_CAN_ID_MAP, as constants; the log calls pass them
+ * straight to log_telemetry_typed_*(), so nothing is looked up at run time
+ * and a struct that doesn't fit the router's typed payload (padding, a
+ * field wider than elem_type, a type past the per-type tables) fails to
+ * compile. A field of another type with elem_type's size and alignment
+ * (int32_t next to float) can't be caught; keep every field elem_type.
+ * telemetry_hpp_check.cpp instantiates the checks in every build.
+ *
+ * An optional `static constexpr can_bus_tx_prio_t tx_class` member moves
+ * the type out of the bulk class; telemetry::apply<S...>() sets those once,
+ * after init_telemetry_router() (which loads the defaults).
+ *
+ * Notes / Assumptions:
+ *  - Built with the toolchain's -fno-exceptions -fno-rtti; only
+ *    <type_traits> is used from the library.
+ *  - The typed entry points are called rather than the router directly, so
+ *    the asynchronous path keeps its intake ring, TX class budget and
+ *    aggregation; they inline down to the same call the C macros make.
+ */
+
+#ifndef TELEMETRY_CAN_ID_MAP_HEADER
+#define TELEMETRY_CAN_ID_MAP_HEADER "telemetry_can_ids.h"
+#endif
+#include TELEMETRY_CAN_ID_MAP_HEADER
+
+namespace telemetry {
+
+// Element kind as TELEMETRY_ELEM_KIND(): plain char and bool are unsigned.
+template <typename E> struct elem_kind {
+  static_assert(std::is_arithmetic<E>::value,
+                "telemetry elements are numbers");
+  static constexpr SedsElemKind value =
+      std::is_floating_point<E>::value ? SEDS_EK_FLOAT
+      : (std::is_signed<E>::value && !std::is_same<E, char>::value)
+          ? SEDS_EK_SIGNED
+          : SEDS_EK_UNSIGNED;
+};
+
+namespace detail {
+
+struct can_id_entry {
+  SedsDataType ty;
+  uint16_t id; // 0 ends the table
+};
+
+#define TELEMETRY_HPP_CAN_ID_(ty, id) {(ty), (uint16_t)(id)},
+constexpr can_id_entry can_ids[] = {
+    TELEMETRY_CAN_ID_MAP(TELEMETRY_HPP_CAN_ID_){SedsDataType(), 0u}};
+#undef TELEMETRY_HPP_CAN_ID_
+
+constexpr uint16_t can_id_find(SedsDataType ty, size_t i) {
+  return can_ids[i].id == 0u   ? 0u
+         : can_ids[i].ty == ty ? can_ids[i].id
+                               : can_id_find(ty, i + 1u);
+}
+
+template <typename S, typename = void> struct tx_class_of {
+  static constexpr bool set = false;
+  static constexpr can_bus_tx_prio_t value = CAN_BUS_TX_PRIO_LOW;
+};
+template <typename S>
+struct tx_class_of<S, decltype((void)S::tx_class)> {
+  static constexpr bool set = true;
+  static constexpr can_bus_tx_prio_t value = S::tx_class;
+};
+
+} // namespace detail
+
+// CAN ID of a data type from TELEMETRY_CAN_ID_MAP; 0 = its TX class's ID.
+constexpr uint16_t can_id_of(SedsDataType ty) {
+  return detail::can_id_find(ty, 0u);
+}
+
+template <typename S> struct schema {
+  typedef typename S::elem_type elem_type;
+
+  static_assert(std::is_standard_layout<S>::value &&
+                    std::is_trivially_copyable<S>::value,
+                "a telemetry schema is a plain struct");
+  static_assert(sizeof(S) % sizeof(elem_type) == 0 &&
+                    alignof(S) == alignof(elem_type),
+                "schema fields must all be elem_type, without padding");
+  static_assert((uint32_t)S::type < TELEMETRY_RX_MAX_DATA_TYPES,
+                "data type past the per-type tables");
+  static_assert((unsigned)detail::tx_class_of<S>::value <
+                    CAN_BUS_TX_PRIO_COUNT,
+                "tx_class is not a CAN TX class");
+
+  static constexpr SedsDataType type = S::type;
+  static constexpr size_t count = sizeof(S) / sizeof(elem_type);
+  static constexpr size_t size = sizeof(elem_type);
+  static constexpr SedsElemKind kind = elem_kind<elem_type>::value;
+  static constexpr uint16_t can_id = can_id_of(S::type);
+  static constexpr can_bus_tx_prio_t tx_class = detail::tx_class_of<S>::value;
+};
+
+template <typename S> inline SedsResult log_async(const S &s) {
+  typedef schema<S> sc;
+  return log_telemetry_typed_asynchronous(sc::type, &s, sc::count, sc::size,
+                                          sc::kind);
+}
+
+template <typename S> inline SedsResult log_sync(const S &s) {
+  typedef schema<S> sc;
+  return log_telemetry_typed_synchronous(sc::type, &s, sc::count, sc::size,
+                                         sc::kind);
+}
+
+// Several samples of one type, as separate packets in a single batch call.
+template <typename S, size_t N>
+inline SedsResult log_async(const S (&s)[N], unsigned flags = 0u) {
+  typedef schema<S> sc;
+  telemetry_batch_item_t items[N];
+  for (size_t i = 0; i < N; i++) {
+    items[i] = telemetry_batch_item_t();
+    items[i].type = sc::type;
+    items[i].data = &s[i];
+    items[i].count = sc::count;
+    items[i].size = sc::size;
+    items[i].kind = sc::kind;
+  }
+  return log_telemetry_batch(items, N, flags);
+}
+
+namespace detail {
+
+template <typename S>
+inline SedsResult apply_one(std::true_type) {
+  return telemetry_set_tx_class(schema<S>::type, schema<S>::tx_class);
+}
+template <typename S>
+inline SedsResult apply_one(std::false_type) {
+  return SEDS_OK;
+}
+
+} // namespace detail
+
+// Set the TX class of each schema that declares one; the first error, if
+// any, after trying them all.
+template <typename... S> inline SedsResult apply() {
+  const SedsResult r[] = {
+      SEDS_OK, detail::apply_one<S>(
+                   std::integral_constant<bool,
+                                          detail::tx_class_of<S>::set>())...};
+  for (size_t i = 0; i < sizeof(r) / sizeof(r[0]); i++) {
+    if (r[i] != SEDS_OK)
+      return r[i];
+  }
+  return SEDS_OK;
+}
+
+} // namespace telemetry
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Loopback self-benchmark of the whole CAN + router stack, for one board on
+ * the bench. Built with TELEMETRY_BENCH (CMake option ENABLE_LOOPBACK_BENCH),
+ * which also puts FDCAN2 in internal loopback, so every frame sent comes
+ * straight back through the RX interrupt and reassembly.
+ *
+ * A generator thread logs synthetic packets at a fixed size and rate
+ * through log_telemetry_asynchronous(); they are picked out of the CAN RX
+ * batch before the router sees them, timed and counted. Each run ends with
+ * a summary line on the console and as a telemetry message (so over USB),
+ * and a result record (telemetry_result_record()).
+ * Bench packets are not forwarded to the USB or UART sides.
+ */
+
+typedef struct {
+  uint32_t size;        /* payload bytes per packet */
+  uint32_t rate_hz;
+  uint32_t run_ms;
+  uint32_t sent;        /* accepted by the logging API */
+  uint32_t refused;     /* refused by it */
+  uint32_t received;
+  uint32_t lost;        /* sent but not received by the end of the drain */
+  uint32_t reordered;   /* arrived after a later sequence number */
+  uint32_t goodput_Bps; /* payload bytes received per second */
+  uint32_t lat_p50_us;  /* log call to reassembled, bin upper edges */
+  uint32_t lat_p90_us;
+  uint32_t lat_p99_us;
+  uint32_t lat_max_us;
+  uint8_t cpu_pct;      /* CPU taken over the idle calibration */
+  uint8_t done;         /* results are from a finished run */
+} telemetry_bench_result_t;
+
+#ifdef TELEMETRY_BENCH
+
+/* Start a run (0 = default for any argument). Returns -1 while one is
+ * running or if the size doesn't fit a bench packet. */
+int telemetry_bench_start(uint32_t size, uint32_t rate_hz, uint32_t run_ms);
+
+void telemetry_bench_get(telemetry_bench_result_t *out);
+
+/* CAN RX hook: 1 if `bytes` is a bench packet (now counted). */
+int telemetry_bench_rx(const uint8_t *bytes, size_t len);
+
+/* 1 if an outgoing router packet is a bench packet. */
+int telemetry_bench_owns(const uint8_t *bytes, size_t len);
+
+#else
+
+static inline int telemetry_bench_rx(const uint8_t *bytes, size_t len) {
+  (void)bytes;
+  (void)len;
+  return 0;
+}
+static inline int telemetry_bench_owns(const uint8_t *bytes, size_t len) {
+  (void)bytes;
+  (void)len;
+  return 0;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+/*
+ * CAN standard ID per data type for router packets, one X(type, std_id)
+ * entry each. Meant to be generated from the telemetry schema together
+ * with the data type list; point TELEMETRY_CAN_ID_MAP_HEADER at the
+ * generated copy to use it instead of this one.
+ *
+ * IDs must lie between TELEMETRY_CAN_TIMESYNC_STD_ID and
+ * TELEMETRY_CAN_STD_ID_LAST (telemetry.c); the lower the ID, the earlier
+ * the packet wins arbitration. Types not listed use the ID of their TX
+ * class, 0x03 for bulk.
+ */
+#define TELEMETRY_CAN_ID_MAP(X)                                             \
+  X(SEDS_DT_MESSAGE_DATA, 0x04u)
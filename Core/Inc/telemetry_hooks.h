@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Rust heap hooks (implemented in telemetry_hooks.c). */
+void rust_heap_init(void);
+void *telemetryMalloc(size_t xSize);
+void telemetryFree(void *pv);
+void seds_error_msg(const char *str, size_t len);
+
+/* Checksum hooks on the CRC unit (crc_hw.h): CRC-32 (ISO-HDLC) and
+ * CRC-16/CCITT-FALSE. Any context; interrupts get the software model. */
+uint32_t telemetryCrc32(const uint8_t *data, size_t len);
+uint16_t telemetryCrc16(const uint8_t *data, size_t len);
+
+/*
+ * Lock hooks for the router's shared state, so sedsprintf_rs locks through
+ * the RTOS instead of its own spin or interrupt masking:
+ *
+ *   void *telemetryLockCreate(const char *name);  NULL when none is left
+ *   void telemetryLock(void *lock);               recursive
+ *   void telemetryUnlock(void *lock);
+ *
+ * Each lock is a ThreadX mutex with priority inheritance (TX_INHERIT): a
+ * low-priority logger holding the router runs at the priority of the
+ * thread waiting on it until it lets go, which with preemption-threshold
+ * compiled out (tx_user.h) is the only bound on that wait. From an ISR or
+ * before the kernel runs they do nothing but count: the router is only
+ * used from threads.
+ *
+ *   uint32_t telemetryCriticalEnter(void);
+ *   void telemetryCriticalExit(uint32_t state);
+ *
+ * is the cheap form for a few instructions (a counter, a list link): it
+ * raises BASEPRI to the ThreadX mask (TX_PORT_BASEPRI, else PRIMASK), so
+ * the interrupts above it (FDCAN, PPS capture) still run. It nests; never
+ * block inside it.
+ */
+#ifndef RUST_LOCKS
+#define RUST_LOCKS 8u
+#endif
+
+void *telemetryLockCreate(const char *name);
+void telemetryLock(void *lock);
+void telemetryUnlock(void *lock);
+uint32_t telemetryCriticalEnter(void);
+void telemetryCriticalExit(uint32_t state);
+
+typedef struct {
+  const char *name;
+  uint32_t acquires;    /* outermost takes */
+  uint32_t contended;   /* ...that had to wait for another thread */
+  uint32_t wait_max_us;
+  uint32_t hold_max_us; /* outermost take to release */
+  uint64_t hold_total_us;
+} rust_lock_stats_t;
+
+/* Lock `i` in creation order; 0 (and `out` zeroed) past the last one. */
+int rust_lock_get_stats(unsigned i, rust_lock_stats_t *out);
+
+/* Critical sections entered, the longest in CPU cycles, and lock calls
+ * that came from an ISR or before the kernel. */
+void rust_lock_get_misc(uint32_t *critical, uint32_t *critical_max_cycles,
+                        uint32_t *not_thread);
+
+/* Request-size histogram: bin i counts sizes <= (32 << i), last bin the rest. */
+#define RUST_HEAP_HIST_BINS 8u
+#define RUST_HEAP_CLASS_COUNT 5u
+
+typedef struct {
+  uint32_t live_bytes;  /* block bytes + byte-pool bytes currently handed out */
+  uint32_t peak_bytes;  /* high-water mark of live_bytes */
+  uint32_t alloc_count; /* successful allocations since boot */
+  uint32_t failed_count;
+  uint32_t byte_pool_free;        /* tx_byte_pool_info_get() available bytes */
+  uint32_t byte_pool_fragments;   /* tx_byte_pool_info_get() fragments */
+  uint32_t largest_free_fragment; /* biggest contiguous free run, byte pool */
+  uint32_t size_hist[RUST_HEAP_HIST_BINS];
+  uint32_t class_block_size[RUST_HEAP_CLASS_COUNT];
+  uint32_t class_in_use[RUST_HEAP_CLASS_COUNT];
+  uint32_t class_peak[RUST_HEAP_CLASS_COUNT];
+  uint32_t class_exhausted[RUST_HEAP_CLASS_COUNT];
+  uint32_t steady_allocs;      /* since rust_heap_seal(), refused ones too */
+  uint32_t steady_pool_allocs; /* of those, the ones that reached the byte pool */
+  uint8_t sealed;
+} rust_heap_stats_t;
+
+/* Snapshot the allocator counters. Walks the byte pool with IRQs masked. */
+void rust_heap_get_stats(rust_heap_stats_t *out);
+
+/* End of start-up: count, and with RUST_HEAP_STEADY_STRICT refuse, what
+ * the byte pool is asked for from now on. */
+void rust_heap_seal(void);
+
+/*
+ * Allocation trace (CMake option ENABLE_HEAP_TRACE): the last
+ * RUST_HEAP_TRACE_EVENTS calls of telemetryMalloc() / telemetryFree(), each
+ * with its caller's return address, for finding the code that allocates
+ * per packet. Dumped over USB (TELEMETRY_USB_CTRL_HEAP_TRACE_DUMP in
+ * telemetry.h), aggregated on the host by heap_trace.py.
+ */
+#ifndef RUST_HEAP_TRACE_EVENTS
+#define RUST_HEAP_TRACE_EVENTS 0u /* power of two, 0 = no trace */
+#endif
+
+#define RUST_HEAP_TRACE_ALLOC 1u
+#define RUST_HEAP_TRACE_FREE  2u
+#define RUST_HEAP_TRACE_FAIL  3u /* allocation refused or out of memory */
+
+#define RUST_HEAP_TRACE_BYTE_POOL 0xFFu /* rust_heap_trace_t.cls */
+
+/* 16 bytes, little-endian on the wire as in memory. */
+typedef struct {
+  uint32_t ts_us;   /* low 32 bits of us_clock_now() */
+  uint32_t caller;  /* return address into the allocating code */
+  uint32_t ptr;     /* block handed out or released, 0 for a failure */
+  uint16_t size;    /* bytes asked for (saturated), 0 for a free */
+  uint8_t op;       /* RUST_HEAP_TRACE_* */
+  uint8_t cls;      /* size class index, or RUST_HEAP_TRACE_BYTE_POOL */
+} rust_heap_trace_t;
+
+/*
+ * Stop (1) or resume (0) recording, so a dump reads a still ring. Returns
+ * the number of events recorded since boot: the ring holds the last
+ * RUST_HEAP_TRACE_EVENTS of them.
+ */
+uint32_t rust_heap_trace_freeze(int on);
+
+/* Record `seq` (counted from boot); 0 if it has been overwritten. */
+int rust_heap_trace_get(uint32_t seq, rust_heap_trace_t *out);
+
+/* live_bytes alone, without the pool walk: cheap enough per packet. */
+uint32_t rust_heap_live_bytes(void);
+
+/* Allocations refused since boot (failed_count), without the pool walk. */
+uint32_t rust_heap_failed_count(void);
+
+/* Bytes the heap can hand out in total: byte pool plus every block. */
+uint32_t rust_heap_capacity_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sedsprintf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Periodic telemetry sources, sampled from one scheduler thread instead of
+ * ad-hoc log calls. Time is cut into TELEMETRY_SCHED_SLOT_MS slots; each
+ * source gets the phase within its period whose slots are least loaded so
+ * far, so sources with equal periods spread out instead of firing on the
+ * same tick. The sources due in a slot are sampled shortest period first
+ * (rate monotonic) and queued back to back, with one TX wake-up for the
+ * lot, so the dispatch pass sees them together and can pack them.
+ */
+
+/* Write up to `cap` bytes of elements into `buf`; return the element count
+ * (0 = nothing this time). Runs on the scheduler thread. */
+typedef size_t (*telemetry_sample_cb_t)(void *buf, size_t cap, void *user);
+
+typedef struct {
+  SedsDataType type;
+  uint32_t period_ms;   /* rounded up to whole slots */
+  uint8_t elem_size;
+  SedsElemKind kind;
+  telemetry_sample_cb_t sample;
+  void *user;
+} telemetry_source_t;
+
+typedef struct {
+  uint32_t samples; /* callbacks that produced a sample */
+  uint32_t skipped; /* periods missed because the thread ran late */
+} telemetry_sched_stats_t;
+
+/*
+ * Register a source (copied). Returns its handle, or -1 if the table
+ * (TELEMETRY_SCHED_MAX_SOURCES) is full or `src` is invalid.
+ */
+int telemetry_sched_add(const telemetry_source_t *src);
+
+/* Stop sampling the source behind `handle`. */
+void telemetry_sched_remove(int handle);
+
+void telemetry_sched_get_stats(telemetry_sched_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
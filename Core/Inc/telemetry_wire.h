@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * What the gateway puts on its USB (and UART) byte stream besides router
+ * packets, as plain constants with no firmware dependencies, so host code
+ * (gateway_stream.hpp) builds against the same definitions. Every frame is
+ * COBS encoded and 0x00 delimited; a frame starting with one of the magics
+ * below is one of these, anything else is a serialized router packet. The
+ * layouts are documented next to the features in telemetry.h, all
+ * little-endian.
+ */
+
+/* Control ops from the host and their replies: magic, op | 0x80, status. */
+#define TELEMETRY_USB_CTRL_MAGIC {0xC5, 'S', 'U', 'B'}
+#define TELEMETRY_USB_CTRL_SUBSCRIBE       0x01u
+#define TELEMETRY_USB_CTRL_UNSUBSCRIBE     0x02u
+#define TELEMETRY_USB_CTRL_SUBSCRIBE_ALL   0x03u
+#define TELEMETRY_USB_CTRL_UNSUBSCRIBE_ALL 0x04u
+#define TELEMETRY_USB_CTRL_LVC_GET         0x05u
+#define TELEMETRY_USB_CTRL_CAPTURE_START   0x06u
+#define TELEMETRY_USB_CTRL_CAPTURE_STOP    0x07u
+#define TELEMETRY_USB_CTRL_REPLAY_START    0x08u
+#define TELEMETRY_USB_CTRL_REPLAY_DATA     0x09u
+#define TELEMETRY_USB_CTRL_REPLAY_STOP     0x0Au
+#define TELEMETRY_USB_CTRL_BLACKBOX_TRIGGER 0x0Bu
+#define TELEMETRY_USB_CTRL_CONFIG_GET      0x0Cu
+#define TELEMETRY_USB_CTRL_CONFIG_SET      0x0Du
+#define TELEMETRY_USB_CTRL_CONFIG_COMMIT   0x0Eu
+#define TELEMETRY_USB_CTRL_CONFIG_DEFAULTS 0x0Fu
+#define TELEMETRY_USB_CTRL_TRACEX_DUMP     0x10u
+#define TELEMETRY_USB_CTRL_HEAP_TRACE_DUMP 0x11u
+#define TELEMETRY_USB_CTRL_FW_BEGIN        0x12u
+#define TELEMETRY_USB_CTRL_FW_DATA         0x13u
+#define TELEMETRY_USB_CTRL_FW_COMMIT       0x14u
+#define TELEMETRY_USB_CTRL_FW_ABORT        0x15u
+#define TELEMETRY_USB_CTRL_FW_BLOCK        0x16u
+#define TELEMETRY_USB_CTRL_FW_RELAY_BEGIN  0x17u
+#define TELEMETRY_USB_CTRL_FW_RELAY_DATA   0x18u
+#define TELEMETRY_USB_CTRL_FW_RELAY_COMMIT 0x19u
+#define TELEMETRY_USB_CTRL_FW_RELAY_ABORT  0x1Au
+#define TELEMETRY_USB_CTRL_FILE_PULL       0x1Bu
+#define TELEMETRY_USB_CTRL_FILE_PULL_ABORT 0x1Cu
+#define TELEMETRY_USB_CTRL_TALKERS         0x1Du
+#define TELEMETRY_USB_CTRL_HEALTH_GET      0x1Eu
+#define TELEMETRY_USB_CTRL_PC_SAMPLE_START 0x1Fu
+#define TELEMETRY_USB_CTRL_PC_SAMPLE_STOP  0x20u
+#define TELEMETRY_USB_CTRL_REPLY           0x80u /* or'ed into the op */
+
+#define TELEMETRY_USB_CTRL_OK      0x00u
+#define TELEMETRY_USB_CTRL_BAD_OP  0x01u
+#define TELEMETRY_USB_CTRL_BAD_ARG 0x02u /* short, or a type out of range */
+#define TELEMETRY_USB_CTRL_PARTIAL 0x03u /* LVC_GET: not every value fit */
+#define TELEMETRY_USB_CTRL_BUSY    0x04u /* full or mid-update, send it again */
+
+/* Raw bus capture: magic, u32 records dropped, then records of a
+ * TELEMETRY_CAPTURE_REC_HDR header (u64 time us, u32 SocketCAN can_id, u8
+ * length, u8 flags) and the data. */
+#define TELEMETRY_CAPTURE_MAGIC {0xC5, 'C', 'A', 'P'}
+#define TELEMETRY_CAPTURE_FRAME_HDR 8u
+#define TELEMETRY_CAPTURE_REC_HDR   14u
+#define TELEMETRY_CAPTURE_TX        0x01u /* START flag: sent frames too */
+#define TELEMETRY_CAPTURE_EFF_FLAG  0x80000000u
+#define TELEMETRY_CAPTURE_FD_BRS    0x01u
+#define TELEMETRY_CAPTURE_FD_FDF    0x04u
+#define TELEMETRY_CAPTURE_DIR_TX    0x80u /* not SocketCAN: the frame was sent */
+
+/* ThreadX trace dump: magic, u32 offset, u32 buffer size, bytes. */
+#define TELEMETRY_TRACEX_MAGIC {0xC5, 'T', 'R', 'X'}
+/* Heap trace dump: magic, u32 first seq, u32 end seq, 16-byte records. */
+#define TELEMETRY_HEAP_TRACE_MAGIC {0xC5, 'H', 'T', 'R'}
+/* PC samples: magic, u32 seq of the first, u32 dropped, u32 rate hz, then
+ * (u32 pc, u32 lr) records. */
+#define TELEMETRY_PC_SAMPLE_MAGIC {0xC5, 'P', 'C', 'S'}
+/* File pull: magic, u8 status, u32 offset, u32 file size, bytes. */
+#define TELEMETRY_FILE_MAGIC {0xC5, 'F', 'I', 'L'}
+
+/* Result record (telemetry_result_record()), one benchmark or report
+ * result: magic, u8 TELEMETRY_RESULT_VERSION, u8 source, u8 name length,
+ * u8 metric count, u32 firmware git hash (first 8 hex digits, 0 unknown),
+ * u32 flags, u32 core clock Hz, u32 CAN nominal bit/s, u32 CAN data bit/s,
+ * u32 uptime ms, u16 node ID, u16 zero, then the name (no NUL) and the
+ * metrics, u32 each (two's complement where signed). Metric order per
+ * source:
+ *   MICRO     n, min, mean, max, skipped (cycles; name: the case)
+ *   LOOPBACK  telemetry_bench_result_t from size to lat_max_us, cpu_pct
+ *   TIMESYNC  locked, converge_ms, pulses, steady_samples, steady_max_us,
+ *             frames_per_s, bytes_per_s, steady_hist[] (name: the mode)
+ *   PROFILER  count, min, mean, max (ns), hist[] (name: the probe)
+ *   HEALTH    TELEMETRY_HEALTH_FIELDS */
+#define TELEMETRY_RESULT_MAGIC {0xC5, 'R', 'E', 'S'}
+#define TELEMETRY_RESULT_VERSION 1u
+#define TELEMETRY_RESULT_HDR 36u
+#define TELEMETRY_RESULT_NAME_MAX 24u
+#define TELEMETRY_RESULT_METRICS_MAX 64u
+
+#define TELEMETRY_RESULT_SRC_MICRO    1u /* microbench.h */
+#define TELEMETRY_RESULT_SRC_LOOPBACK 2u /* telemetry_bench.h */
+#define TELEMETRY_RESULT_SRC_TIMESYNC 3u /* timesync_bench.h */
+#define TELEMETRY_RESULT_SRC_PROFILER 4u /* profiler.h */
+#define TELEMETRY_RESULT_SRC_HEALTH   5u /* telemetry_health_t */
+
+#define TELEMETRY_RESULT_F_DIRTY    0x01u /* built with uncommitted changes */
+#define TELEMETRY_RESULT_F_LOOPBACK 0x02u /* FDCAN in internal loopback */
+
+/* TALKERS reply after the status: u8 count, u32 IDs evicted, then count
+ * records of TELEMETRY_TALKER_REC bytes, busiest first: u32 id (bit 31 =
+ * extended), u32 frames, u32 bytes, u32 us since the last, u32 min gap us,
+ * u32 max gap us. */
+#define TELEMETRY_TALKER_REC 24u
+#define TELEMETRY_TALKER_EXT 0x80000000u
+
+/* Deferred-format error payload (LOG_ERROR_DEFERRED): this first byte,
+ * u16 offset of the format in .seds_fmt, then the arguments. */
+#define TELEMETRY_FMT_DEFERRED 0x00u
+
+/* Health summary (telemetry_health_t), u32 fields in this order. The
+ * HEALTH_GET reply carries the same layout after the status. */
+#define TELEMETRY_HEALTH_VERSION 4u
+#define TELEMETRY_HEALTH_FIELDS                                             \
+  version, uptime_s, cpu_idle_pm, cpu_isr_pm, cpu_rx_pm, cpu_tx_pm,         \
+      cpu_maint_pm, heap_live, heap_peak, heap_failed, rx_ring_hw_bytes,    \
+      rx_ring_dropped, reasm_done, reasm_expired, intake_high, intake_mid,  \
+      intake_low, queue_heap_pct, can_load_pct, can_tec, can_rec,           \
+      can_state, ts_offset_us, ts_delay_us, ts_locked, can_rx_pkts,         \
+      can_rx_bytes, can_tx_pkts, can_tx_bytes, can_rej, can_io, can_bad,    \
+      usb_rx_pkts, usb_rx_bytes, usb_tx_pkts, usb_tx_bytes, usb_rej,        \
+      usb_io, usb_bad, uart_rx_pkts, uart_rx_bytes, uart_tx_pkts,           \
+      uart_tx_bytes, uart_rej, uart_io, uart_bad, trace_n, trace_p50_us,    \
+      trace_p99_us, trace_max_us, rxlat_hi_p99_us, rxlat_hi_max_us,        \
+      rxlat_p99_us, rxlat_max_us
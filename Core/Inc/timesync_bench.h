@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include "telemetry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Time-sync convergence and accuracy bench (TIMESYNC_BENCH_ENABLED, CMake
+ * option ENABLE_TIMESYNC_BENCH). The master and every client run the normal
+ * time-sync exchange; on top of it each board
+ *
+ *  - raises TIMESYNC_BENCH_PULSE_PIN at every multiple of
+ *    TIMESYNC_BENCH_PULSE_PERIOD_MS of synced time (telemetry_now_us()), so
+ *    a scope on all boards shows the real skew between them. A client
+ *    starts pulsing once the servo has locked the first time.
+ *  - reports every TIMESYNC_BENCH_REPORT_MS, to the console and as a
+ *    telemetry message:
+ *      tsb mode=<m> lock=<0|1> conv=<ms> off=<us> jit=<us> pulses=<n>
+ *          steady=<n> smax=<us> sh=<hist> fps=<frames/s> bps=<bytes/s>
+ *    conv is the time from the first request to the first lock; steady,
+ *    smax and sh describe the samples since then (count, largest accepted
+ *    offset, |offset| histogram with the telemetry_timesync_stats_t bins);
+ *    fps and bps are this board's sync frames and payload bytes, both
+ *    directions, over the last report period. The same figures go out as
+ *    a result record (telemetry_result_record()).
+ *
+ * The mode under test is chosen at build time (CMake TIMESYNC_BENCH_MODE):
+ *   servo  PI servo on hardware SOF stamps, the default firmware
+ *   step   every accepted offset stepped, no slew (NET_TIMESYNC_STEP_ONLY)
+ *   sw     PI servo on software stamps (NET_TIMESYNC_SW_STAMPS)
+ * and should match on all boards of a run.
+ */
+
+#ifndef TIMESYNC_BENCH_PULSE_PORT
+#define TIMESYNC_BENCH_PULSE_PORT GPIOB
+#endif
+#ifndef TIMESYNC_BENCH_PULSE_PIN
+#define TIMESYNC_BENCH_PULSE_PIN GPIO_PIN_11 /* 0 = no pulse */
+#endif
+#ifndef TIMESYNC_BENCH_PULSE_PERIOD_MS
+#define TIMESYNC_BENCH_PULSE_PERIOD_MS 1000u
+#endif
+#ifndef TIMESYNC_BENCH_PULSE_WIDTH_US
+#define TIMESYNC_BENCH_PULSE_WIDTH_US 100u
+#endif
+#ifndef TIMESYNC_BENCH_REPORT_MS
+#define TIMESYNC_BENCH_REPORT_MS 10000u
+#endif
+
+typedef struct {
+  uint8_t locked;
+  uint32_t converge_ms;    /* 0 until the first lock */
+  uint32_t pulses;
+  uint32_t steady_samples; /* samples since the first lock */
+  uint32_t steady_max_us;  /* largest accepted |offset| since then */
+  uint32_t steady_hist[TELEMETRY_TIMESYNC_HIST_BINS];
+  uint32_t frames_per_s;   /* over the last report period */
+  uint32_t bytes_per_s;
+} timesync_bench_result_t;
+
+#ifdef TIMESYNC_BENCH_ENABLED
+
+/* Figures as of the last report. */
+void timesync_bench_get(timesync_bench_result_t *out);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ThreadX event trace (TX_ENABLE_EVENT_TRACE, CMake option ENABLE_TRACEX)
+ * into a RAM buffer in the TraceX format, time-stamped with DWT->CYCCNT.
+ * The kernel records scheduling, blocking and object events itself; our own
+ * hot-path events go in as user events (TRACEX_EVENT). The buffer wraps, so
+ * it always holds the newest events.
+ *
+ * A snapshot freezes it (every event filtered) while the host reads it out
+ * (TELEMETRY_USB_CTRL_TRACEX_DUMP), then recording resumes. The bytes,
+ * written out as they are, are a .trx file TraceX opens.
+ *
+ * Without TX_ENABLE_EVENT_TRACE the macro expands to nothing.
+ */
+
+/* User event IDs, numbered from TX_TRACE_USER_EVENT_START in the trace. */
+typedef enum {
+  TRACEX_EV_REASM_DONE = 1, /* info: standard ID, length */
+  TRACEX_EV_TX_SEND,        /* info: packet bytes */
+} tracex_event_t;
+
+#ifdef TX_ENABLE_EVENT_TRACE
+
+#include "tx_api.h"
+
+#ifndef TRACEX_BUFFER_BYTES
+#define TRACEX_BUFFER_BYTES 8192u
+#endif
+/* Threads, queues, semaphores... the trace can name. */
+#ifndef TRACEX_REGISTRY_ENTRIES
+#define TRACEX_REGISTRY_ENTRIES 24u
+#endif
+
+/* Start recording. From tx_application_define(), before the objects to be
+ * named are created. */
+void tracex_init(void);
+
+/* Stop recording and hand out the buffer; 0 if tracing isn't running. */
+int tracex_freeze(const uint8_t **buf, size_t *len);
+
+/* Record again after tracex_freeze(). */
+void tracex_resume(void);
+
+#define TRACEX_EVENT(ev, a, b)                                        \
+  ((void)tx_trace_user_event_insert(TX_TRACE_USER_EVENT_START + (ev), \
+                                    (ULONG)(a), (ULONG)(b), 0, 0))
+
+#else
+
+static inline void tracex_init(void) {}
+static inline int tracex_freeze(const uint8_t **buf, size_t *len) {
+  (void)buf;
+  (void)len;
+  return 0;
+}
+static inline void tracex_resume(void) {}
+
+#define TRACEX_EVENT(ev, a, b) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
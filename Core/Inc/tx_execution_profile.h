@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+ * Minimal ThreadX execution-profile support (TX_EXECUTION_PROFILE_ENABLE).
+ *
+ * tx_api.h includes this header when profiling is enabled; the Cortex-M4
+ * port's scheduler and tx_initialize_low_level.S call the _tx_execution_*
+ * hooks. Times are DWT cycle counts accumulated into 64-bit totals, so the
+ * 32-bit counter may wrap freely as long as no single segment exceeds one
+ * wrap (~25 s at 170 MHz).
+ *
+ * Interrupt handlers that are not entered through ThreadX must bracket their
+ * body with _tx_execution_isr_enter() / _tx_execution_isr_exit() to have
+ * their time charged to ISRs instead of the interrupted thread.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned long long EXECUTION_TIME;
+typedef unsigned long EXECUTION_TIME_SOURCE_TYPE;
+
+/* DWT->CYCCNT, free-running at the core clock. */
+#define TX_EXECUTION_TIME_SOURCE \
+    (EXECUTION_TIME_SOURCE_TYPE) (*((volatile unsigned long *) 0xE0001004UL))
+
+struct TX_THREAD_STRUCT;
+
+/* Called by the port / ISRs. */
+void _tx_execution_initialize(void);
+void _tx_execution_thread_enter(void);
+void _tx_execution_thread_exit(void);
+void _tx_execution_isr_enter(void);
+void _tx_execution_isr_exit(void);
+
+/* Application API. */
+unsigned int _tx_execution_thread_time_get(struct TX_THREAD_STRUCT *thread_ptr,
+                                           EXECUTION_TIME *total_time);
+unsigned int _tx_execution_thread_time_reset(struct TX_THREAD_STRUCT *thread_ptr);
+unsigned int _tx_execution_isr_time_get(EXECUTION_TIME *total_time);
+unsigned int _tx_execution_isr_time_reset(void);
+unsigned int _tx_execution_idle_time_get(EXECUTION_TIME *total_time);
+unsigned int _tx_execution_idle_time_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -193,7 +193,7 @@
    code size and overhead, but provides the ability to generate system trace information which
    is available for viewing in TraceX.  */
 
-/*#define TX_ENABLE_EVENT_TRACE*/
+/*#define TX_ENABLE_EVENT_TRACE*/   /* set by CMake option ENABLE_TRACEX */
 
 /* Determine if block pool performance gathering is required by the application. When the following is
    defined, ThreadX gathers various block pool performance information. */
@@ -237,7 +237,9 @@
 
 /* Define the common timer tick reference for use by other middleware components. */
 
-/*#define TX_TIMER_TICKS_PER_SECOND                100*/
+#ifndef TX_TIMER_TICKS_PER_SECOND
+#define TX_TIMER_TICKS_PER_SECOND                1000
+#endif
 
 /* Determine if there is a FileX pointer in the thread control block.
    By default, the pointer is there for legacy/backwards compatibility.
@@ -270,6 +272,26 @@
 
 /* USER CODE BEGIN 2 */
 
+/* Tickless idle: while no thread is ready, SysTick is stretched up to the
+   next ThreadX timer expiration and the core waits in WFI. The elapsed ticks
+   are folded back into the ThreadX clock on wakeup, so tx_time_get() keeps
+   running (TX_LOW_POWER_TICKLESS stays undefined on purpose: the telemetry
+   clock is derived from it). */
+#ifdef TX_LOW_POWER
+#ifndef TX_ENABLE_WFI
+#define TX_ENABLE_WFI
+#endif
+void          App_ThreadX_LowPower_Timer_Setup(unsigned long count);
+unsigned long App_ThreadX_LowPower_Timer_Adjust(void);
+#define TX_LOW_POWER_TIMER_SETUP(_count)  App_ThreadX_LowPower_Timer_Setup(_count)
+#define TX_LOW_POWER_USER_TIMER_ADJUST    App_ThreadX_LowPower_Timer_Adjust()
+#ifdef LOW_POWER_STOP_ENABLED
+/* Clocks back up after a stop, before the timer adjust (low_power.h). */
+void          low_power_stop_exit(void);
+#define TX_LOW_POWER_USER_EXIT            low_power_stop_exit()
+#endif
+#endif
+
 /* USER CODE END 2 */
 
 #endif
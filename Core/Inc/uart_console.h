@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Buffered printf console. _write()/__io_putchar() append to a RAM ring and
+ * return immediately; DMA drains it to the UART in the background. Safe from
+ * any thread or ISR. Output that doesn't fit is dropped and counted.
+ */
+
+#ifndef UART_CONSOLE_BAUDRATE
+#define UART_CONSOLE_BAUDRATE 115200u
+#endif
+
+/*
+ * Attach the console to an initialized UART (e.g. &huart1) and its TX DMA
+ * channel. A non-zero `baud` different from the CubeMX setting re-inits the
+ * UART, switching to 8x oversampling above kernel clock / 16.
+ * Anything written before this call is kept and sent once DMA is up.
+ */
+HAL_StatusTypeDef uart_console_init(UART_HandleTypeDef *huart, uint32_t baud);
+
+/* Queue bytes for output. Returns how many were accepted. */
+size_t uart_console_write(const char *data, size_t len);
+
+/* Bytes dropped so far because the ring was full. */
+uint32_t uart_console_dropped(void);
+
+/* IRQ glue, called from stm32g4xx_it.c. */
+void uart_console_dma_irq(void);
+void uart_console_uart_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * UART router link: COBS frames, 0x00-delimited, in both directions.
+ * RX runs as one circular DMA transfer with idle-line/half/full events, TX
+ * is DMA from a double buffer, so there are no per-byte interrupts.
+ *
+ * The link takes the UART over from the printf console: with
+ * ENABLE_UART_LINK the build swaps uart_console.c for uart_link.c and
+ * printf output is discarded.
+ */
+
+#ifndef UART_LINK_BAUDRATE
+#define UART_LINK_BAUDRATE 115200u
+#endif
+
+/* Called from thread context with one decoded frame; valid until return. */
+typedef void (*uart_link_rx_cb_t)(const uint8_t *data, size_t len, void *user);
+
+/* Called from the UART/DMA ISR when bytes arrived; keep it ISR-safe. */
+typedef void (*uart_link_notify_cb_t)(void);
+
+/*
+ * Attach to an initialized UART (e.g. &huart1), set up its RX/TX DMA
+ * channels and start receiving. A non-zero `baud` different from the CubeMX
+ * setting re-inits the UART (8x oversampling above kernel clock / 16).
+ */
+HAL_StatusTypeDef uart_link_init(UART_HandleTypeDef *huart, uint32_t baud);
+
+/*
+ * Encode and queue one frame; starts DMA if the line is idle.
+ * Returns HAL_BUSY if it doesn't fit right now, HAL_ERROR if it never will.
+ * Single writer thread.
+ */
+HAL_StatusTypeDef uart_link_send_frame(const uint8_t *bytes, size_t len);
+
+/*
+ * MUST be called from thread context whenever the RX notify fires.
+ * Splits the received byte stream into frames and invokes the handler.
+ */
+void uart_link_process_rx(void);
+
+/* Single frame consumer; NULL removes it. */
+void uart_link_set_rx_handler(uart_link_rx_cb_t cb, void *user);
+
+/* Wake-up hook run from interrupt context when bytes arrived. */
+void uart_link_set_rx_notify(uart_link_notify_cb_t cb);
+
+typedef struct {
+  uint32_t rx_bytes;
+  uint32_t rx_frames;
+  uint32_t rx_bad_frames;  /* COBS errors or oversize */
+  uint32_t rx_overruns;    /* DMA lapped the reader, or UART errors */
+  uint32_t tx_frames;
+  uint32_t tx_busy;        /* frames refused for lack of buffer space */
+} uart_link_stats_t;
+
+void uart_link_get_stats(uart_link_stats_t *out);
+
+/* IRQ glue, called from stm32g4xx_it.c. */
+void uart_link_dma_rx_irq(void);
+void uart_link_dma_tx_irq(void);
+void uart_link_uart_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Free-running microsecond clock on TIM2 (32-bit, 1 MHz), extended to
+ * 64 bits by counting update events. Reads are lock-free and safe from any
+ * context, including ISRs above the update interrupt's priority.
+ */
+
+/* Start TIM2 at 1 MHz. Needs a timer clock that is a whole number of MHz. */
+HAL_StatusTypeDef us_clock_init(void);
+
+/* Microseconds since us_clock_init(); 0 before it. */
+uint64_t us_clock_now(void);
+
+/* Run from the TIM2 interrupt when an alarm expires. */
+typedef void (*us_clock_alarm_cb_t)(void);
+
+/*
+ * One-shot alarm on TIM2 channel 1 at `at_us` (us_clock_now() scale, less
+ * than 2^31 us ahead); fires at once if that time has passed. Replaces any
+ * pending alarm; NULL `cb` cancels. One alarm in the system.
+ */
+void us_clock_set_alarm(uint64_t at_us, us_clock_alarm_cb_t cb);
+
+/* Non-zero while an alarm is set. */
+uint8_t us_clock_alarm_pending(void);
+
+/* Run from the TIM2 interrupt with the us_clock_now() time of an edge. */
+typedef void (*us_clock_capture_cb_t)(uint64_t at_us);
+
+/*
+ * Time-stamp rising edges on TIM2 channel 2 (TI2, e.g. PA1 in AF1; the pin
+ * is the caller's to set up). The count is latched by the timer, so the
+ * stamp is exact to the microsecond however late the interrupt runs, up to
+ * 2^31 us. `filter` is the IC2F input filter (0..15). NULL `cb` stops it.
+ */
+void us_clock_set_capture(us_clock_capture_cb_t cb, uint32_t filter);
+
+/*
+ * Move the clock on by `us` that passed with TIM2 stopped (stop mode,
+ * low_power.c). IRQs masked, no alarm pending.
+ */
+void us_clock_advance(uint32_t us);
+
+/* TIM2 update, compare and capture interrupt; call from TIM2_IRQHandler. */
+void us_clock_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * USB full-speed CDC-ACM (virtual COM port) on the HAL PCD driver.
+ * Frames are COBS-encoded and 0x00-delimited on the byte stream in both
+ * directions, so every write/read is one router packet.
+ */
+
+/* Called from thread context with one decoded frame; valid until return. */
+typedef void (*usb_cdc_rx_cb_t)(const uint8_t *data, size_t len, void *user);
+
+/* Called from the USB ISR or the writer; keep it ISR-safe. */
+typedef void (*usb_cdc_notify_cb_t)(void);
+
+/*
+ * Configure the packet memory and connect to the bus (D+ pull-up).
+ * `hpcd` must already be initialized (MX_USB_PCD_Init).
+ */
+HAL_StatusTypeDef usb_cdc_init(PCD_HandleTypeDef *hpcd);
+
+/* Non-zero once the host has configured the device and asserted DTR. */
+uint8_t usb_cdc_is_connected(void);
+
+/* Non-zero while the host has the bus suspended (or no host drives it). */
+uint8_t usb_cdc_is_suspended(void);
+
+/*
+ * Encode and queue one frame. Small frames are coalesced so bulk IN packets
+ * go out full; a transfer starts immediately once CDC_TX_COALESCE_BYTES are
+ * pending, otherwise on usb_cdc_flush() or within CDC_TX_FLUSH_FRAMES ms.
+ * While one transfer is on the bus the next collects up to CDC_TX_BUF_SIZE.
+ * Returns HAL_BUSY if the frame doesn't fit right now, HAL_ERROR if no host
+ * is connected or the frame can never fit.
+ */
+HAL_StatusTypeDef usb_cdc_send_frame(const uint8_t *bytes, size_t len);
+
+/* Start a transfer for whatever is pending, if the IN pipe is idle. */
+void usb_cdc_flush(void);
+
+/* Bytes queued but not yet handed to the hardware. */
+size_t usb_cdc_tx_pending(void);
+
+/*
+ * Hook run when data was queued without starting a transfer, so a thread can
+ * call usb_cdc_flush() after a short coalescing window. NULL removes it.
+ */
+void usb_cdc_set_tx_notify(usb_cdc_notify_cb_t cb);
+
+/*
+ * MUST be called from thread context whenever the RX notify fires.
+ * Splits the received byte stream into frames and invokes the handler.
+ */
+void usb_cdc_process_rx(void);
+
+/* Single frame consumer; NULL removes it. */
+void usb_cdc_set_rx_handler(usb_cdc_rx_cb_t cb, void *user);
+
+/* Wake-up hook run from the USB ISR when bytes arrived. NULL removes it. */
+void usb_cdc_set_rx_notify(usb_cdc_notify_cb_t cb);
+
+/*
+ * Command pipe, built with USB_CMD_EP_ENABLED (CMake option
+ * ENABLE_USB_CMD_EP): a vendor interface with interrupt EP 0x06 (OUT) and
+ * 0x86 (IN), 64-byte packets polled every millisecond. A frame is one
+ * transfer, raw (no COBS), ended by a short packet or a zero-length one,
+ * up to USB_CMD_FRAME_MAX bytes; longer ones are dropped. It exists so
+ * control frames and their replies don't queue behind the bulk stream.
+ */
+#ifndef USB_CMD_FRAME_MAX
+#define USB_CMD_FRAME_MAX 512u
+#endif
+
+#ifdef USB_CMD_EP_ENABLED
+
+/*
+ * Consumer of command frames, run by usb_cdc_process_rx() before the bulk
+ * frames; the RX notify fires for them too. NULL removes it.
+ */
+void usb_cdc_set_cmd_handler(usb_cdc_rx_cb_t cb, void *user);
+
+/*
+ * Queue one reply on the interrupt IN endpoint (copied; USB_CMD_QUEUE
+ * frames deep). Same single writer as usb_cdc_send_frame(). Returns
+ * HAL_BUSY with the queue full, HAL_ERROR if unconfigured or the frame is
+ * too long; DTR isn't needed.
+ */
+HAL_StatusTypeDef usb_cdc_send_cmd(const uint8_t *bytes, size_t len);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
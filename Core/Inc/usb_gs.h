@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+#include "can_bus.h"
+#include "usb_cdc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * gs_usb (candleLight) raw CAN interface, built with USB_GS_USB_ENABLED
+ * (CMake option ENABLE_GS_USB). The device enumerates as 1d50:606f with the
+ * gs_usb vendor interface first and the CDC-ACM telemetry port after it,
+ * so Linux binds it as can0 (gs_usb) next to ttyACM0 (cdc_acm).
+ *
+ * Once the host starts the channel, every frame off the CAN RX rings is
+ * also sent to it, one host frame per bulk IN transfer, with its hardware
+ * SOF time when the host asks for timestamps. Host frames are queued on
+ * CAN_BUS_TX_PRIO_MID and echoed back once queued. Bit timing stays the
+ * firmware's: the host's settings are accepted and not applied.
+ */
+
+typedef struct {
+  uint32_t rx_frames;     /* bus frames sent to the host */
+  uint32_t rx_dropped;    /* IN queue full, or FD frame in classic mode */
+  uint32_t tx_frames;     /* host frames queued on the bus */
+  uint32_t tx_rejected;   /* malformed or refused by the driver */
+  uint32_t tx_retries;    /* CAN TX ring full, sent later */
+  uint8_t started;
+} usb_gs_stats_t;
+
+#ifdef USB_GS_USB_ENABLED
+
+#define USB_GS_IN_EP 0x81u
+#define USB_GS_OUT_EP 0x02u
+#define USB_GS_MPS 64u
+
+/* Bridge `bus`: installs its RX tap. */
+void usb_gs_attach(can_bus_t *bus);
+
+/*
+ * Wake-up hook run from the USB ISR when host frames arrived; the thread it
+ * wakes must be the bus's sending thread and call usb_gs_process_tx().
+ */
+void usb_gs_set_tx_notify(usb_cdc_notify_cb_t cb);
+
+/* Queue pending host frames on the bus (CAN sending thread). */
+void usb_gs_process_tx(void);
+
+void usb_gs_get_stats(usb_gs_stats_t *out);
+
+/*
+ * Called by usb_cdc.c from the USB ISR. Control requests return the IN data
+ * length (or 0 for an OUT request's status), -1 to stall.
+ */
+int usb_gs_ctrl_in(uint8_t request, uint16_t w_value, uint8_t *buf,
+                   size_t cap);
+int usb_gs_ctrl_out(uint8_t request, uint16_t w_value, const uint8_t *data,
+                    size_t len);
+void usb_gs_configure(PCD_HandleTypeDef *hpcd); /* NULL: deconfigured */
+void usb_gs_in_complete_isr(void);
+void usb_gs_out_complete_isr(void);
+
+#else
+
+static inline void usb_gs_attach(can_bus_t *bus) { (void)bus; }
+static inline void usb_gs_set_tx_notify(usb_cdc_notify_cb_t cb) { (void)cb; }
+static inline void usb_gs_process_tx(void) {}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
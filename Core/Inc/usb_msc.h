@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Read-only USB disk of the SD log, built with USB_MSC_ENABLED (CMake
+ * option ENABLE_USB_MSC, needs ENABLE_SD_LOG). A Mass Storage interface
+ * (Bulk-Only Transport, SCSI transparent command set) is added to the
+ * usb_cdc.c device behind the CDC function, so the host gets a drive next
+ * to the telemetry port and copies the log with ordinary file tools.
+ *
+ * The drive is a FAT32 volume made up on the fly: one read-only file,
+ * SDLOG.BIN, holding the log blocks from the oldest still on the card to
+ * the newest (sd_log_span()), as sd_log_file_open() gives them. Boot
+ * sector, FATs and directory are computed per sector; file sectors are
+ * read from the card with multi-block reads, USB_MSC_BUF_BLOCKS at a time,
+ * into two buffers that take turns on the bulk IN endpoint.
+ *
+ * The volume is fixed when the host configures the device (and again
+ * while the card is missing); unplug the drive to see newer blocks. Writes
+ * fail with DATA PROTECT. The reads run in create_usb_msc_thread()
+ * (GB-Threads.h), below the SD writer.
+ */
+
+#ifndef USB_MSC_BUF_BLOCKS
+#define USB_MSC_BUF_BLOCKS 4u /* 512-byte sectors per buffer, two held */
+#endif
+
+typedef struct {
+  uint32_t commands;     /* CBWs taken */
+  uint32_t failed;       /* commands answered with a failed CSW */
+  uint32_t read_blocks;  /* sectors sent to the host */
+  uint32_t card_errors;  /* log reads that failed (sent as MEDIUM ERROR) */
+  uint32_t file_blocks;  /* size of SDLOG.BIN in the current volume */
+  uint8_t ready;         /* volume built, card mounted */
+} usb_msc_stats_t;
+
+#ifdef USB_MSC_ENABLED
+
+#define USB_MSC_IN_EP 0x85u
+#define USB_MSC_OUT_EP 0x05u
+#define USB_MSC_MPS 64u
+
+void usb_msc_get_stats(usb_msc_stats_t *out);
+
+/*
+ * Called by usb_cdc.c from the USB ISR. usb_msc_ctrl() takes the class
+ * requests of the interface and returns the IN data length (0 for an OUT
+ * request's status), -1 to stall.
+ */
+int usb_msc_ctrl(uint8_t request, uint8_t *buf, size_t cap);
+void usb_msc_configure(PCD_HandleTypeDef *hpcd); /* NULL: deconfigured */
+void usb_msc_clear_halt_isr(uint8_t ep);
+void usb_msc_in_complete_isr(void);
+void usb_msc_out_complete_isr(void);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
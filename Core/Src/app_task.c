@@ -0,0 +1,270 @@
+// app_task.c
+//
+// Periodic application tasks (app_task.h):
+//  - every task keeps its next release as a ThreadX tick. A level's worker
+//  takes, under the IRQ lock, the released task of its level with the
+//  earliest absolute deadline, moves that task's release on by one period
+//  (more if it fell behind) and runs the callback unlocked.
+//  - with nothing released the worker waits on its event flag for the next
+//  release tick of its level; app_task_add() sets the flag so a new task
+//  isn't left behind a long sleep.
+//  - jitter is the tick distance from the release plus how far SysTick is
+//  into the current tick, so a worker woken by the release tick itself
+//  shows the tick ISR and scheduling latency in microseconds.
+//
+// Notes / Assumptions:
+//  - Releases compare as signed tick differences: periods and offsets must
+//  stay below 2^31 ticks.
+//  - A handle's stats belong to one registration: a slot reused while its
+//  old callback still ran drops that run's stats (generation check).
+//  - The SysTick phase stays valid with the tickless idle: the reload is put
+//  back on the tick grid before any thread runs (app_threadx.c).
+
+#include "app_task.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "us_clock.h"
+#include "stm32g4xx_hal.h"
+#include <string.h>
+
+#ifdef APP_TASK_ENABLED
+
+// ThreadX priorities of the levels; stack sizes APP_TASK_*_STACK_SIZE in
+// mem_budget.h.
+#ifndef APP_TASK_HIGH_PRIORITY
+#define APP_TASK_HIGH_PRIORITY 2u
+#endif
+#ifndef APP_TASK_NORMAL_PRIORITY
+#define APP_TASK_NORMAL_PRIORITY 8u
+#endif
+#ifndef APP_TASK_LOW_PRIORITY
+#define APP_TASK_LOW_PRIORITY 12u
+#endif
+
+#define US_PER_TICK (1000000u / TX_TIMER_TICKS_PER_SECOND)
+
+typedef struct {
+  app_task_t task;
+  ULONG next_release; // tick
+  uint32_t period_ticks;
+  uint32_t deadline_us;
+  uint32_t gen;
+  uint8_t used;
+  app_task_stats_t stats;
+} task_entry_t;
+
+typedef struct {
+  TX_THREAD thread;
+  const char *name;
+  ULONG *stack;
+  ULONG stack_size;
+  UINT priority;
+} level_t;
+
+static MEM_ARENA(stack) ULONG g_high_stack[APP_TASK_HIGH_STACK_SIZE / sizeof(ULONG)];
+static MEM_ARENA(stack) ULONG g_normal_stack[APP_TASK_NORMAL_STACK_SIZE / sizeof(ULONG)];
+static MEM_ARENA(stack) ULONG g_low_stack[APP_TASK_LOW_STACK_SIZE / sizeof(ULONG)];
+
+static level_t g_levels[APP_TASK_LEVELS] = {
+    {.name = "App Tasks High", .stack = g_high_stack,
+     .stack_size = APP_TASK_HIGH_STACK_SIZE, .priority = APP_TASK_HIGH_PRIORITY},
+    {.name = "App Tasks Normal", .stack = g_normal_stack,
+     .stack_size = APP_TASK_NORMAL_STACK_SIZE,
+     .priority = APP_TASK_NORMAL_PRIORITY},
+    {.name = "App Tasks Low", .stack = g_low_stack,
+     .stack_size = APP_TASK_LOW_STACK_SIZE, .priority = APP_TASK_LOW_PRIORITY},
+};
+
+static task_entry_t g_tasks[APP_TASK_MAX];
+static TX_EVENT_FLAGS_GROUP g_wake;
+static uint8_t g_ready = 0;
+
+static ULONG ms_to_ticks(uint32_t ms) {
+  const uint64_t t = ((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u;
+  return (ULONG)t;
+}
+
+// Current tick and microseconds since it began (SysTick counts down from
+// LOAD). A tick interrupt already pending belongs to the next tick.
+static ULONG tick_phase(uint32_t *phase_us) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t pend, val;
+  do {
+    pend = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+    val = SysTick->VAL;
+  } while (pend != (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk));
+  const ULONG tick = tx_time_get() + (pend ? 1u : 0u);
+  const uint32_t into = SysTick->LOAD - val;
+  __set_PRIMASK(primask);
+  *phase_us = into / (SystemCoreClock / 1000000u);
+  return tick;
+}
+
+int app_task_add(const app_task_t *task) {
+  if (!task || !task->run || task->period_ms == 0 ||
+      task->level >= APP_TASK_LEVELS) {
+    return -1;
+  }
+  const uint32_t period = (uint32_t)ms_to_ticks(task->period_ms);
+  const uint32_t deadline =
+      task->deadline_us ? task->deadline_us : period * US_PER_TICK;
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  int handle = -1;
+  for (unsigned i = 0; i < APP_TASK_MAX; i++) {
+    if (!g_tasks[i].used) {
+      handle = (int)i;
+      break;
+    }
+  }
+  if (handle >= 0) {
+    task_entry_t *e = &g_tasks[handle];
+    const uint32_t gen = e->gen + 1u;
+    memset(e, 0, sizeof(*e));
+    e->task = *task;
+    e->period_ticks = period;
+    e->deadline_us = deadline;
+    e->next_release = tx_time_get() + 1u + ms_to_ticks(task->offset_ms);
+    e->gen = gen;
+    e->stats.name = task->name;
+    e->used = 1;
+  }
+  __set_PRIMASK(primask);
+  if (handle >= 0 && g_ready) {
+    (void)tx_event_flags_set(&g_wake, 1u << task->level, TX_OR);
+  }
+  return handle;
+}
+
+void app_task_remove(int handle) {
+  if (handle < 0 || (unsigned)handle >= APP_TASK_MAX) {
+    return;
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_tasks[handle].used = 0;
+  __set_PRIMASK(primask);
+}
+
+int app_task_get_stats(int handle, app_task_stats_t *out) {
+  if (!out || handle < 0 || (unsigned)handle >= APP_TASK_MAX) {
+    return 0;
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const int used = g_tasks[handle].used;
+  if (used) {
+    *out = g_tasks[handle].stats;
+  }
+  __set_PRIMASK(primask);
+  return used;
+}
+
+// Released task of `level` with the earliest deadline, its release moved
+// on; -1 and the ticks to the level's next release (TX_WAIT_FOREVER for
+// none) otherwise. IRQs masked.
+static int take_released(unsigned level, ULONG now, ULONG *release,
+                         ULONG *wait) {
+  int pick = -1;
+  int64_t pick_dl = 0;
+  ULONG next = TX_WAIT_FOREVER;
+  for (unsigned i = 0; i < APP_TASK_MAX; i++) {
+    const task_entry_t *e = &g_tasks[i];
+    if (!e->used || e->task.level != level) continue;
+    const int32_t ahead = (int32_t)(e->next_release - now);
+    if (ahead > 0) {
+      if ((ULONG)ahead < next) next = (ULONG)ahead;
+      continue;
+    }
+    const int64_t dl = (int64_t)ahead * US_PER_TICK + e->deadline_us;
+    if (pick < 0 || dl < pick_dl) {
+      pick = (int)i;
+      pick_dl = dl;
+    }
+  }
+  if (pick < 0) {
+    *wait = next;
+    return -1;
+  }
+  task_entry_t *e = &g_tasks[pick];
+  // Run for the latest release that's due, drop the ones before it.
+  while ((int32_t)(now - (e->next_release + e->period_ticks)) >= 0) {
+    e->next_release += e->period_ticks;
+    e->stats.skipped++;
+  }
+  *release = e->next_release;
+  e->next_release += e->period_ticks;
+  return pick;
+}
+
+static void level_thread_entry(ULONG level) {
+  for (;;) {
+    ULONG release = 0, wait = 0;
+    app_task_t task;
+    uint32_t gen = 0, deadline = 0;
+    const ULONG now = tx_time_get();
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const int h = take_released((unsigned)level, now, &release, &wait);
+    if (h >= 0) {
+      task = g_tasks[h].task;
+      gen = g_tasks[h].gen;
+      deadline = g_tasks[h].deadline_us;
+    }
+    __set_PRIMASK(primask);
+
+    if (h < 0) {
+      ULONG got;
+      (void)tx_event_flags_get(&g_wake, 1u << level, TX_OR_CLEAR, &got, wait);
+      continue;
+    }
+
+    uint32_t phase_us;
+    const ULONG tick = tick_phase(&phase_us);
+    const uint32_t jitter = (uint32_t)(tick - release) * US_PER_TICK + phase_us;
+    const uint64_t t0 = us_clock_now();
+    task.run(task.user);
+    const uint32_t exec = (uint32_t)(us_clock_now() - t0);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    task_entry_t *e = &g_tasks[h];
+    if (e->used && e->gen == gen) {
+      app_task_stats_t *s = &e->stats;
+      s->releases++;
+      s->jitter_last_us = jitter;
+      if (jitter > s->jitter_max_us) s->jitter_max_us = jitter;
+      s->exec_last_us = exec;
+      if (exec > s->exec_max_us) s->exec_max_us = exec;
+      s->exec_total_us += exec;
+      if ((uint64_t)jitter + exec > deadline) s->misses++;
+    }
+    __set_PRIMASK(primask);
+  }
+}
+
+void create_app_task_threads(void) {
+  if (tx_event_flags_create(&g_wake, "app tasks") != TX_SUCCESS) {
+    die("Failed to create app task flags");
+  }
+  for (unsigned i = 0; i < APP_TASK_LEVELS; i++) {
+    level_t *l = &g_levels[i];
+    const UINT status = tx_thread_create(
+        &l->thread, (CHAR *)l->name, level_thread_entry, i, l->stack,
+        l->stack_size, l->priority, l->priority, TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+    if (status != TX_SUCCESS) {
+      die("Failed to create app task thread %u: %u", i, (unsigned)status);
+    }
+  }
+  g_ready = 1;
+  // Tasks registered before the threads existed.
+  (void)tx_event_flags_set(&g_wake, (1u << APP_TASK_LEVELS) - 1u, TX_OR);
+}
+
+#endif /* APP_TASK_ENABLED */
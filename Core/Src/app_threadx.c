@@ -24,9 +24,15 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "main.h"
+#include "boot_time.h"
 #include "sedsprintf.h"
 #include "telemetry.h"
 #include "GB-Threads.h"
+#include "dma_copy.h"
+#include "crc_hw.h"
+#include "stack_monitor.h"
+#include "tracex.h"
+#include "low_power.h"
 #include "tx_api.h"
 /* USER CODE END Includes */
 
@@ -47,6 +53,19 @@
 
 /* Private variables ---------------------------------------------------------*/
 /* USER CODE BEGIN PV */
+#ifdef TX_LOW_POWER
+/* SysTick cycles per ThreadX tick (the reload programmed at boot + 1). */
+#define LP_TICK_CYCLES   (SystemCoreClock / TX_TIMER_TICKS_PER_SECOND)
+/* 24-bit reload register → ~98 ms per stretched period at 170 MHz. */
+#define LP_SYSTICK_MAX   (SysTick_LOAD_RELOAD_Msk + 1u)
+
+static uint32_t lp_head_cycles;  /* cycles left to the regular tick on entry */
+static uint32_t lp_sleep_ticks;  /* whole ticks skipped after that boundary  */
+static uint8_t  lp_stretched;
+#ifdef LOW_POWER_STOP_ENABLED
+static uint8_t  lp_stopped;      /* SysTick off, LPTIM1 keeps the time */
+#endif
+#endif
 
 /* USER CODE END PV */
 
@@ -64,6 +83,13 @@ UINT App_ThreadX_Init(VOID *memory_ptr)
 {
   UINT ret = TX_SUCCESS;
   /* USER CODE BEGIN App_ThreadX_MEM_POOL */
+  boot_time_mark(BOOT_KERNEL);
+  /* Before any object is created, so the trace can name them all. */
+  tracex_init();
+  stack_monitor_init();
+  if (dma_copy_init() != HAL_OK || crc_hw_init() != HAL_OK) {
+    Error_Handler();
+  }
   if (init_telemetry_router() != SEDS_OK) {
     Error_Handler();
   }
@@ -77,6 +103,25 @@ UINT App_ThreadX_Init(VOID *memory_ptr)
 
   /* USER CODE BEGIN App_ThreadX_Init */
   create_telemetry_thread();
+  create_telemetry_sched_thread();
+  create_cpu_load_thread();
+  create_telemetry_bench_thread();
+  create_microbench_thread();
+  create_timesync_bench_thread();
+  create_i2c_bus_thread();
+  create_dsp_filter_thread();
+#ifdef SD_LOG_ENABLED
+  create_sd_log_thread();
+#endif
+#ifdef USB_MSC_ENABLED
+  create_usb_msc_thread();
+#endif
+#ifdef APP_TASK_ENABLED
+  create_app_task_threads();
+#endif
+#ifdef CORO_ENABLED
+  create_coro_thread();
+#endif
 
   /* USER CODE END App_ThreadX_Init */
 
@@ -102,5 +147,111 @@ void MX_ThreadX_Init(void)
 }
 
 /* USER CODE BEGIN 1 */
+#ifdef TX_LOW_POWER
+/* Restart SysTick so the next interrupt lands `first` cycles from now and
+   regular tick periods follow. VAL is cleared first; the counter reloads on
+   the next clock, after which the period LOAD can be put back. */
+static void lp_systick_restart(uint32_t first, uint32_t period)
+{
+  SysTick->LOAD = first - 1u;
+  SysTick->VAL  = 0u;
+  __DSB();
+  __NOP();
+  SysTick->LOAD = period - 1u;
+}
+
+/* Called by tx_low_power_enter() with interrupts disabled. `count` is the
+   number of ticks until the earliest ThreadX timer minus one (0xFFFFFFFF =
+   no timer active); the final tick is still delivered by the SysTick ISR. */
+void App_ThreadX_LowPower_Timer_Setup(unsigned long count)
+{
+  const uint32_t period = LP_TICK_CYCLES;
+  uint32_t head = SysTick->VAL + 1u;
+  uint32_t max_ticks;
+
+  lp_stretched = 0u;
+  if (count == 0u || (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk)) {
+    /* Next tick is due anyway, or one is already pending. */
+    return;
+  }
+
+#ifdef LOW_POWER_STOP_ENABLED
+  lp_stopped = 0u;
+  if (low_power_stop_setup(count)) {
+    /* Stop 1 until the next timer or a wakeup; see Timer_Adjust. */
+    lp_head_cycles = head;
+    lp_stopped = 1u;
+    return;
+  }
+#endif
+
+  max_ticks = (LP_SYSTICK_MAX - head) / period;
+  lp_sleep_ticks = (count < max_ticks) ? (uint32_t)count : max_ticks;
+  if (lp_sleep_ticks == 0u) {
+    return;
+  }
+
+  lp_head_cycles = head;
+  SysTick->LOAD = head + lp_sleep_ticks * period - 1u;
+  SysTick->VAL  = 0u;
+  lp_stretched = 1u;
+}
+
+/* Called by tx_low_power_exit() before interrupts are re-enabled. Returns the
+   ticks that elapsed without a SysTick interrupt and re-aligns SysTick to the
+   regular period so the tick phase is preserved. */
+unsigned long App_ThreadX_LowPower_Timer_Adjust(void)
+{
+  const uint32_t period = LP_TICK_CYCLES;
+  uint32_t elapsed;
+  uint32_t ticks;
+  uint32_t into;
+
+#ifdef LOW_POWER_STOP_ENABLED
+  if (lp_stopped) {
+    /* SysTick was off: take the time from LPTIM1 instead, in core cycles
+       (low_power_stop_exit() has restored the clock). */
+    lp_stopped = 0u;
+    elapsed = low_power_stop_take() * (SystemCoreClock / 1000000u);
+    if (elapsed < lp_head_cycles) {
+      lp_systick_restart(lp_head_cycles - elapsed, period);
+      ticks = 0u;
+    } else {
+      elapsed -= lp_head_cycles;
+      ticks = 1u + elapsed / period;
+      lp_systick_restart(period - elapsed % period, period);
+    }
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    return ticks;
+  }
+#endif
+
+  if (!lp_stretched) {
+    return 0u;
+  }
+  lp_stretched = 0u;
+
+  if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) {
+    /* Full sleep: the pending SysTick ISR accounts for the expiring tick;
+       any boundaries crossed since the reload (wake latency) are added. */
+    elapsed = SysTick->LOAD - SysTick->VAL;
+    ticks = lp_sleep_ticks + elapsed / period;
+    into = elapsed % period;
+  } else {
+    /* Woken early by another interrupt. */
+    elapsed = SysTick->LOAD - SysTick->VAL;
+    if (elapsed < lp_head_cycles) {
+      lp_systick_restart(lp_head_cycles - elapsed, period);
+      return 0u;
+    }
+    elapsed -= lp_head_cycles;
+    ticks = 1u + elapsed / period;
+    into = elapsed % period;
+  }
+
+  lp_systick_restart(period - into, period);
+  return ticks;
+}
+#endif
 
 /* USER CODE END 1 */
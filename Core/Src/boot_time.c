@@ -0,0 +1,128 @@
+// boot_time.c
+//
+// Boot phase timestamps (boot_time.h):
+//  - boot_early_init() starts DWT->CYCCNT at reset, before anything else
+//  runs, and in fast boot brings the PLL up right there.
+//  - a mark keeps the cycle count and the core clock of the first time a
+//  phase is reached; later marks of it return after one test.
+//  - cycles below the PLL switch count at HSI (16 MHz), the rest at the
+//  PLL clock. Without fast boot the switch is taken at BOOT_CLOCK, which
+//  counts the few microseconds after it inside SystemClock_Config() slow.
+//
+// Notes / Assumptions:
+//  - CYCCNT wraps after 25 s at 170 MHz; phases later than that read wrong.
+//  - Nothing else zeroes CYCCNT (prof_init() no longer does).
+
+#include "boot_time.h"
+#include "mem_sections.h"
+#include "stm32g4xx_hal.h"
+#include "telemetry.h"
+
+#include <stdio.h>
+
+volatile uint32_t g_boot_reached = 0;
+static uint32_t g_boot_cyc[BOOT_PHASE_COUNT];
+static uint32_t g_boot_hz[BOOT_PHASE_COUNT]; // SystemCoreClock at the mark
+static uint8_t g_boot_reported = 0;
+
+#ifdef TELEMETRY_FAST_BOOT
+// CYCCNT at the early PLL switch; written before .bss is zeroed.
+static RAM_NOINIT uint32_t g_boot_pll_cyc;
+
+// SystemClock_Config()'s PLL, HSI / 4 * 85 / 2 = 170 MHz in range 1 boost,
+// set up with registers only. It must match: the HAL refuses to reconfigure
+// the PLL running the core and SystemClock_Config() then fails.
+static void clock_early(void) {
+  RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
+  (void)RCC->APB1ENR1;
+  CLEAR_BIT(PWR->CR5, PWR_CR5_R1MODE); // VOS is range 1 out of reset
+  MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, FLASH_LATENCY_4);
+  while ((FLASH->ACR & FLASH_ACR_LATENCY) != FLASH_LATENCY_4) {
+  }
+  FLASH->ACR |= FLASH_ACR_ICEN | FLASH_ACR_DCEN | FLASH_ACR_PRFTEN;
+
+  __HAL_RCC_PLL_CONFIG(RCC_PLLSOURCE_HSI, RCC_PLLM_DIV4, 85, RCC_PLLP_DIV2,
+                       RCC_PLLQ_DIV2, RCC_PLLR_DIV2);
+  __HAL_RCC_PLL_ENABLE();
+  __HAL_RCC_PLLCLKOUT_ENABLE(RCC_PLL_SYSCLK);
+  while (!(RCC->CR & RCC_CR_PLLRDY)) {
+  }
+
+  // Above 80 MHz the switch goes through AHB / 2 for at least 1 us.
+  MODIFY_REG(RCC->CFGR, RCC_CFGR_HPRE, RCC_SYSCLK_DIV2);
+  MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_SYSCLKSOURCE_PLLCLK);
+  while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_SYSCLKSOURCE_STATUS_PLLCLK) {
+  }
+  for (volatile uint32_t i = 0; i < 100u; i++) {
+  }
+  MODIFY_REG(RCC->CFGR, RCC_CFGR_HPRE, RCC_SYSCLK_DIV1);
+}
+#endif
+
+void boot_early_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#ifdef TELEMETRY_FAST_BOOT
+  clock_early();
+  g_boot_pll_cyc = DWT->CYCCNT;
+#endif
+}
+
+void boot_time_mark_slow(boot_phase_t ph) {
+  const uint32_t cyc = DWT->CYCCNT;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (!(g_boot_reached & (1u << ph))) {
+    g_boot_cyc[ph] = cyc;
+    g_boot_hz[ph] = SystemCoreClock;
+    g_boot_reached |= 1u << ph;
+  }
+  __set_PRIMASK(primask);
+}
+
+uint32_t boot_time_us(boot_phase_t ph) {
+  if ((unsigned)ph >= BOOT_PHASE_COUNT || !(g_boot_reached & (1u << ph)))
+    return 0;
+  const uint32_t hz = g_boot_hz[ph];
+#ifdef TELEMETRY_FAST_BOOT
+  const uint32_t sw = g_boot_pll_cyc;
+#else
+  const uint32_t sw =
+      (g_boot_reached & (1u << BOOT_CLOCK)) ? g_boot_cyc[BOOT_CLOCK] : ~0u;
+#endif
+  const uint64_t cyc = g_boot_cyc[ph];
+  if (cyc <= sw || hz == 0) return (uint32_t)(cyc * 1000000u / HSI_VALUE);
+  return (uint32_t)((uint64_t)sw * 1000000u / HSI_VALUE +
+                    (cyc - sw) * 1000000u / hz);
+}
+
+void boot_time_report(void) {
+  static const char *const k_names[BOOT_PHASE_COUNT] = {
+      "main", "hal", "clock", "drivers", "kernel", "router", "threads",
+      "can_tx",
+  };
+  if (g_boot_reported) return;
+  g_boot_reported = 1;
+
+  char txt[192];
+  int n = snprintf(txt, sizeof(txt), "boot us");
+  for (unsigned i = 0; i < BOOT_PHASE_COUNT && n > 0; i++) {
+    const size_t room = sizeof(txt) - (size_t)n;
+    const int m =
+        (g_boot_reached & (1u << i))
+            ? snprintf(&txt[n], room, " %s=%lu", k_names[i],
+                       (unsigned long)boot_time_us((boot_phase_t)i))
+            : snprintf(&txt[n], room, " %s=-", k_names[i]);
+    if (m <= 0 || (size_t)m >= room) break;
+    n += m;
+  }
+#ifdef TELEMETRY_FAST_BOOT
+  const char *mode = " fast";
+#else
+  const char *mode = "";
+#endif
+  const int m = snprintf(&txt[n], sizeof(txt) - (size_t)n, "%s", mode);
+  if (m > 0 && (size_t)m < sizeof(txt) - (size_t)n) n += m;
+  (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
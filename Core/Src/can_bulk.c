@@ -0,0 +1,489 @@
+// can_bulk.c
+//
+// Windowed bulk transfers on top of can_bus, laid out like isotp.c: inbound
+// frames arrive through can_bus_subscribe_id() callbacks from
+// can_bus_process_rx(), outbound ones are queued with
+// can_bus_send_bytes_prio(), and both run in the thread calling
+// can_bulk_poll(), so sessions need no locking.
+//
+// Frame layouts (integers little-endian):
+//   START  0x01 u32 total              sender: a new transfer
+//   DATA   0x02 u32 offset bytes...    sender: 1..59 bytes at `offset`
+//                                      (1..3 to a CAN_BUS_PROFILE_CLASSIC
+//                                      tx_id, looked up per transfer)
+//   ACK    0x03 u32 next u8 window u8 flags
+//                                      receiver: every byte before `next`
+//                                      is taken; `window` frames may be in
+//                                      flight past it (0 = hold off)
+//   STOP   0x04                        receiver: gave up, stop sending
+//   CANCEL 0x05                        sender: gave up on its transfer
+//
+// Notes / Assumptions:
+// - The receiver only takes DATA at exactly its next offset, so it needs
+//   no reassembly buffer; anything else is answered with one ACK (flagged
+//   GAP) per position, which sends the sender back to that offset.
+// - The receiver acknowledges every half window, at the end, once per
+//   position for a gap or a duplicate, and on every refusal by the sink
+//   (window 0; a held window only sees probes).
+// - A sender with nothing acknowledged for CAN_BULK_RTO_MS goes back to the
+//   last acknowledged offset; a held window is probed the same way, one
+//   frame at a time. Any ACK resets its retry count.
+// - A finished receiver keeps the total and answers late DATA with a final
+//   ACK, in case the last one was lost.
+
+#include "can_bulk.h"
+#include "can_bus.h"
+#include "us_clock.h"
+#include <string.h>
+
+// Sender: no ACK for this long goes back N (or probes a held window).
+#ifndef CAN_BULK_RTO_MS
+#define CAN_BULK_RTO_MS 20u
+#endif
+// Timeouts in a row without any ACK before the sender gives up.
+#ifndef CAN_BULK_MAX_RETRIES
+#define CAN_BULK_MAX_RETRIES 16u
+#endif
+// Receiver: no progress for this long aborts the transfer.
+#ifndef CAN_BULK_TIMEOUT_MS
+#define CAN_BULK_TIMEOUT_MS 1000u
+#endif
+#ifndef CAN_BULK_DEFAULT_WINDOW
+#define CAN_BULK_DEFAULT_WINDOW 16u
+#endif
+// Same split as isotp.c: data in the bulk class, acknowledgements in the
+// command class so a full bulk queue can't hold up the peer's sender.
+#ifndef CAN_BULK_TX_PRIO
+#define CAN_BULK_TX_PRIO CAN_BUS_TX_PRIO_LOW
+#endif
+#ifndef CAN_BULK_ACK_PRIO
+#define CAN_BULK_ACK_PRIO CAN_BUS_TX_PRIO_MID
+#endif
+
+#define BULK_FRAME 64u
+#define BULK_DATA_HDR 5u
+#define BULK_DATA_MAX (BULK_FRAME - BULK_DATA_HDR)
+#define BULK_DATA_MAX_CLASSIC (8u - BULK_DATA_HDR)
+
+#define OP_START 0x01u
+#define OP_DATA 0x02u
+#define OP_ACK 0x03u
+#define OP_STOP 0x04u
+#define OP_CANCEL 0x05u
+
+#define ACK_GAP 0x01u  // out of order or duplicate: resend from `next`
+#define ACK_HOLD 0x02u // the sink refused `next`
+
+enum { TX_IDLE = 0, TX_START, TX_SEND };
+
+typedef struct {
+  can_bulk_config_t cfg;
+  uint8_t used;
+
+  // Receive.
+  uint8_t rx_active;
+  uint8_t rx_done;      // last transfer finished; rx_total still valid
+  uint8_t rx_answered;  // GAP/HOLD ACK already sent for rx_next
+  uint8_t rx_ack_due;   // an ACK that couldn't be queued yet
+  uint8_t rx_ack_flags;
+  uint8_t rx_since_ack; // frames taken since the last ACK
+  uint8_t rx_held;      // the sink refused rx_next
+  uint32_t rx_total;
+  uint32_t rx_next;
+  uint64_t rx_deadline_us;
+
+  // Send.
+  uint8_t tx_state;
+  uint8_t tx_win;
+  uint8_t tx_retries;
+  uint8_t tx_chunk; // DATA bytes per frame of this transfer
+  uint32_t tx_total;
+  uint32_t tx_base; // acknowledged
+  uint32_t tx_pos;  // next byte to send
+  can_bulk_source_t tx_src;
+  void *tx_src_user;
+  uint64_t tx_deadline_us;
+} bulk_session_t;
+
+static bulk_session_t g_sessions[CAN_BULK_MAX_SESSIONS];
+static can_bulk_stats_t g_stats;
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static bulk_session_t *session_find(uint16_t rx_id) {
+  for (unsigned i = 0; i < CAN_BULK_MAX_SESSIONS; i++) {
+    if (g_sessions[i].used && g_sessions[i].cfg.rx_id == rx_id)
+      return &g_sessions[i];
+  }
+  return NULL;
+}
+
+static HAL_StatusTypeDef send_op(bulk_session_t *s, uint8_t op) {
+  return can_bus_send_bytes_prio(s->cfg.bus, &op, 1u, s->cfg.tx_id,
+                                 CAN_BULK_ACK_PRIO);
+}
+
+static uint64_t deadline_in(uint64_t now, uint32_t ms) {
+  return now + (uint64_t)ms * 1000ull;
+}
+
+// =========================
+// Receive
+// =========================
+
+static void send_ack(bulk_session_t *s, uint8_t flags) {
+  uint8_t f[7];
+  f[0] = OP_ACK;
+  put_u32(f + 1, s->rx_done ? s->rx_total : s->rx_next);
+  f[5] = (flags & ACK_HOLD) ? 0u : s->cfg.window;
+  f[6] = flags;
+  if (can_bus_send_bytes_prio(s->cfg.bus, f, sizeof(f), s->cfg.tx_id,
+                              CAN_BULK_ACK_PRIO) != HAL_OK) {
+    s->rx_ack_due = 1; // retried from can_bulk_poll()
+    s->rx_ack_flags = flags;
+    return;
+  }
+  s->rx_ack_due = 0;
+  s->rx_since_ack = 0;
+}
+
+static void rx_abort(bulk_session_t *s, int tell_peer) {
+  if (!s->rx_active)
+    return;
+  s->rx_active = 0;
+  s->rx_ack_due = 0;
+  g_stats.rx_aborted++;
+  if (s->cfg.sink)
+    (void)s->cfg.sink(NULL, 0, s->rx_next, s->rx_total, CAN_BUS_STREAM_ABORT,
+                      s->cfg.user);
+  if (tell_peer)
+    (void)send_op(s, OP_STOP);
+}
+
+static void rx_start(bulk_session_t *s, const uint8_t *d, size_t len) {
+  if (len < 5)
+    return;
+  const uint32_t total = get_u32(d + 1);
+  if (total == 0 || !s->cfg.sink) {
+    (void)send_op(s, OP_STOP);
+    return;
+  }
+  // A repeated START (our ACK was lost) only needs the ACK again.
+  if (!(s->rx_active && s->rx_next == 0 && s->rx_total == total)) {
+    rx_abort(s, 0);
+    s->rx_active = 1;
+    s->rx_total = total;
+    s->rx_next = 0;
+    s->rx_held = 0;
+  }
+  s->rx_done = 0;
+  s->rx_answered = 0;
+  s->rx_deadline_us = deadline_in(us_clock_now(), CAN_BULK_TIMEOUT_MS);
+  send_ack(s, 0);
+}
+
+static void rx_data(bulk_session_t *s, const uint8_t *d, size_t len) {
+  if (len <= BULK_DATA_HDR)
+    return;
+  if (!s->rx_active) {
+    if (s->rx_done)
+      send_ack(s, 0); // the final ACK was lost
+    return;
+  }
+  const uint32_t off = get_u32(d + 1);
+  if (off != s->rx_next) {
+    if (!s->rx_answered) {
+      s->rx_answered = 1;
+      send_ack(s, ACK_GAP);
+    }
+    return;
+  }
+
+  size_t n = len - BULK_DATA_HDR;
+  if (n > s->rx_total - s->rx_next)
+    n = s->rx_total - s->rx_next; // padding on the last frame
+  const int last = (s->rx_next + n == s->rx_total);
+  uint8_t flags = 0;
+  if (off == 0)
+    flags |= CAN_BUS_STREAM_START;
+  if (last)
+    flags |= CAN_BUS_STREAM_END;
+  if (s->cfg.sink(d + BULK_DATA_HDR, n, off, s->rx_total, flags,
+                  s->cfg.user) != 0) {
+    // Answered every time: with the window held, each one is a probe.
+    s->rx_held = 1;
+    s->rx_answered = 1;
+    send_ack(s, ACK_HOLD);
+    return;
+  }
+
+  s->rx_next += (uint32_t)n;
+  s->rx_answered = 0;
+  g_stats.rx_bytes += n;
+  s->rx_deadline_us = deadline_in(us_clock_now(), CAN_BULK_TIMEOUT_MS);
+  if (last) {
+    s->rx_active = 0;
+    s->rx_done = 1;
+    g_stats.rx_xfers++;
+    send_ack(s, 0);
+    return;
+  }
+  // A refusal closed the window; the first byte taken opens it again.
+  if (s->rx_held || ++s->rx_since_ack >= (s->cfg.window + 1u) / 2u) {
+    s->rx_held = 0;
+    send_ack(s, 0);
+  }
+}
+
+// =========================
+// Send
+// =========================
+
+static void tx_finish(bulk_session_t *s, HAL_StatusTypeDef status) {
+  s->tx_state = TX_IDLE;
+  s->tx_src = NULL;
+  if (status == HAL_OK)
+    g_stats.tx_xfers++;
+  else
+    g_stats.tx_aborted++;
+  if (s->cfg.on_tx_done)
+    s->cfg.on_tx_done(status, s->cfg.user);
+}
+
+static HAL_StatusTypeDef send_start(bulk_session_t *s) {
+  uint8_t f[5];
+  f[0] = OP_START;
+  put_u32(f + 1, s->tx_total);
+  return can_bus_send_bytes_prio(s->cfg.bus, f, sizeof(f), s->cfg.tx_id,
+                                 CAN_BULK_ACK_PRIO);
+}
+
+static void rx_ack(bulk_session_t *s, const uint8_t *d, size_t len) {
+  if (s->tx_state == TX_IDLE || len < 7)
+    return;
+  const uint32_t next = get_u32(d + 1);
+  if (next > s->tx_total || next < s->tx_base)
+    return; // stale, or not about this transfer
+
+  const uint64_t now = us_clock_now();
+  s->tx_state = TX_SEND;
+  s->tx_retries = 0;
+  s->tx_win = d[5];
+  s->tx_deadline_us = deadline_in(now, CAN_BULK_RTO_MS);
+  g_stats.tx_bytes += next - s->tx_base;
+  s->tx_base = next;
+  if (s->tx_pos < next)
+    s->tx_pos = next;
+  if (s->tx_base == s->tx_total) {
+    tx_finish(s, HAL_OK);
+    return;
+  }
+  if ((d[6] & (ACK_GAP | ACK_HOLD)) && s->tx_pos > next) {
+    s->tx_pos = next;
+    g_stats.rewinds++;
+  }
+}
+
+// Queue the DATA frames the window allows; stops at a full TX ring or a
+// source with nothing yet.
+static void tx_pump(bulk_session_t *s) {
+  const uint32_t limit = (uint32_t)s->tx_win * s->tx_chunk;
+  while (s->tx_state == TX_SEND && s->tx_pos < s->tx_total &&
+         s->tx_pos - s->tx_base < limit) {
+    uint8_t f[BULK_FRAME];
+    size_t n = s->tx_total - s->tx_pos;
+    if (n > s->tx_chunk)
+      n = s->tx_chunk;
+    n = s->tx_src(s->tx_pos, f + BULK_DATA_HDR, n, s->tx_src_user);
+    if (n == 0)
+      return;
+    f[0] = OP_DATA;
+    put_u32(f + 1, s->tx_pos);
+    if (can_bus_send_bytes_prio(s->cfg.bus, f, BULK_DATA_HDR + n,
+                                s->cfg.tx_id, CAN_BULK_TX_PRIO) != HAL_OK)
+      return; // ring full; retried on the next poll
+    s->tx_pos += (uint32_t)n;
+  }
+}
+
+HAL_StatusTypeDef can_bulk_send(uint16_t rx_id, uint32_t total,
+                                can_bulk_source_t src, void *src_user) {
+  bulk_session_t *s = session_find(rx_id);
+  if (!s || !src || total == 0)
+    return HAL_ERROR;
+  if (s->tx_state != TX_IDLE)
+    return HAL_BUSY;
+
+  s->tx_total = total;
+  if (send_start(s) != HAL_OK)
+    return HAL_BUSY;
+  s->tx_base = 0;
+  s->tx_pos = 0;
+  s->tx_win = 0;
+  s->tx_retries = 0;
+  s->tx_chunk = can_bus_get_peer_profile(s->cfg.bus, s->cfg.tx_id) ==
+                        CAN_BUS_PROFILE_CLASSIC
+                    ? BULK_DATA_MAX_CLASSIC
+                    : BULK_DATA_MAX;
+  s->tx_src = src;
+  s->tx_src_user = src_user;
+  s->tx_deadline_us = deadline_in(us_clock_now(), CAN_BULK_RTO_MS);
+  s->tx_state = TX_START;
+  return HAL_OK;
+}
+
+void can_bulk_cancel(uint16_t rx_id) {
+  bulk_session_t *s = session_find(rx_id);
+  if (!s || s->tx_state == TX_IDLE)
+    return;
+  (void)send_op(s, OP_CANCEL);
+  tx_finish(s, HAL_ERROR);
+}
+
+static void bulk_on_frame(const uint8_t *data, size_t len, uint64_t ts_us,
+                          void *user) {
+  (void)ts_us;
+  bulk_session_t *s = (bulk_session_t *)user;
+  if (!s || !s->used || !data || len == 0)
+    return;
+  switch (data[0]) {
+  case OP_START:
+    rx_start(s, data, len);
+    break;
+  case OP_DATA:
+    rx_data(s, data, len);
+    break;
+  case OP_ACK:
+    rx_ack(s, data, len);
+    break;
+  case OP_STOP:
+    if (s->tx_state != TX_IDLE)
+      tx_finish(s, HAL_ERROR);
+    break;
+  case OP_CANCEL:
+    rx_abort(s, 0);
+    break;
+  default:
+    break;
+  }
+}
+
+static uint32_t us_to_ms_ceil(uint64_t us) {
+  const uint64_t ms = (us + 999u) / 1000u;
+  return (ms > UINT32_MAX) ? UINT32_MAX : (uint32_t)ms;
+}
+
+static void tx_timeout(bulk_session_t *s, uint64_t now) {
+  if (++s->tx_retries > CAN_BULK_MAX_RETRIES) {
+    (void)send_op(s, OP_CANCEL);
+    tx_finish(s, HAL_TIMEOUT);
+    return;
+  }
+  s->tx_deadline_us = deadline_in(now, CAN_BULK_RTO_MS);
+  if (s->tx_state == TX_START) {
+    (void)send_start(s);
+    return;
+  }
+  if (s->tx_pos > s->tx_base)
+    g_stats.rewinds++;
+  s->tx_pos = s->tx_base;
+  if (s->tx_win == 0)
+    s->tx_win = 1; // probe a held window with one frame
+}
+
+uint32_t can_bulk_poll(void) {
+  uint32_t next_ms = UINT32_MAX;
+  const uint64_t now = us_clock_now();
+
+  for (unsigned i = 0; i < CAN_BULK_MAX_SESSIONS; i++) {
+    bulk_session_t *s = &g_sessions[i];
+    if (!s->used)
+      continue;
+
+    if (s->rx_ack_due)
+      send_ack(s, s->rx_ack_flags);
+    if (s->rx_active) {
+      if (now >= s->rx_deadline_us) {
+        rx_abort(s, 1);
+      } else {
+        uint32_t ms = us_to_ms_ceil(s->rx_deadline_us - now);
+        if (s->rx_ack_due)
+          ms = 1u;
+        if (ms < next_ms)
+          next_ms = ms;
+      }
+    }
+
+    if (s->tx_state == TX_IDLE)
+      continue;
+    // Nothing in flight (a source with no bytes yet) can't time out.
+    if (s->tx_state == TX_SEND && s->tx_pos == s->tx_base && s->tx_win != 0)
+      s->tx_deadline_us = deadline_in(now, CAN_BULK_RTO_MS);
+    else if (now >= s->tx_deadline_us)
+      tx_timeout(s, now);
+    tx_pump(s);
+    if (s->tx_state == TX_IDLE)
+      continue;
+
+    uint32_t ms = us_to_ms_ceil(s->tx_deadline_us - now);
+    // A full ring or a source with nothing yet: back on the next tick.
+    if (s->tx_state == TX_SEND && s->tx_pos < s->tx_total &&
+        s->tx_pos - s->tx_base < (uint32_t)s->tx_win * s->tx_chunk)
+      ms = 1u;
+    if (ms < next_ms)
+      next_ms = ms;
+  }
+  return next_ms;
+}
+
+// =========================
+// Sessions
+// =========================
+
+HAL_StatusTypeDef can_bulk_open(const can_bulk_config_t *cfg) {
+  if (!cfg || !cfg->bus || cfg->rx_id > 0x7FFu || cfg->tx_id > 0x7FFu ||
+      cfg->rx_id == cfg->tx_id || session_find(cfg->rx_id))
+    return HAL_ERROR;
+
+  bulk_session_t *s = NULL;
+  for (unsigned i = 0; i < CAN_BULK_MAX_SESSIONS && !s; i++) {
+    if (!g_sessions[i].used)
+      s = &g_sessions[i];
+  }
+  if (!s)
+    return HAL_ERROR;
+
+  memset(s, 0, sizeof(*s));
+  s->cfg = *cfg;
+  if (s->cfg.window == 0)
+    s->cfg.window = CAN_BULK_DEFAULT_WINDOW;
+  if (can_bus_subscribe_id(cfg->bus, cfg->rx_id, bulk_on_frame, s) != HAL_OK)
+    return HAL_ERROR;
+  s->used = 1;
+  return HAL_OK;
+}
+
+void can_bulk_close(uint16_t rx_id) {
+  bulk_session_t *s = session_find(rx_id);
+  if (!s)
+    return;
+  rx_abort(s, 1);
+  can_bulk_cancel(rx_id);
+  (void)can_bus_subscribe_id(s->cfg.bus, rx_id, NULL, NULL);
+  s->used = 0;
+}
+
+void can_bulk_get_stats(can_bulk_stats_t *out) {
+  if (out)
+    *out = g_stats;
+}
@@ -11,12 +11,18 @@
 // Notes / Assumptions:
 //  - Uses CAN FD frames for fragmentation (default payload 64 bytes).
 //  - Fragment frames are distinguished by a small "magic" header in the
-//  payload.
-//  - Reassembly is bounded (no malloc). Oldest RX frames are dropped on ring
-//  overflow.
+//  payload, or (CAN_BUS_FRAG_EXT_ID) carry their header in a 29-bit ID.
+//  - Reassembly is bounded (no malloc). On RX ring overflow the producer
+//  never touches the tail (the consumer reads records in place); see
+//  CAN_BUS_RX_OVERFLOW for what happens instead.
 //  - One producer (ISR) and one consumer (thread calling can_bus_process_rx()).
 //  - You can call can_bus_process_rx() from a ThreadX thread, or main
-//  superloop.
+//  superloop; reassembly timeouts are proto_timer.h timers, so the same
+//  thread must run proto_timer_poll().
+//  - TX is queued: senders copy whole frames into a software TX ring and the
+//  TX-complete interrupt refills the 3-deep hardware TX FIFO from it. One
+//  producer (the thread calling can_bus_send_*()) and one consumer (the
+//  pump, run from the ISR or from thread context with IRQs masked).
 //
 // IMPORTANT CONCURRENCY NOTE:
 //  `volatile` head/tail alone does NOT guarantee publish/consume ordering for
@@ -25,6 +31,19 @@
 //  ensure the consumer sees the slot contents after observing `head` (acquire).
 
 #include "can_bus.h"
+#include "boot_time.h"
+#include "dbg_marker.h"
+#include "dma_copy.h"
+#include "itm_trace.h"
+#include "low_power.h"
+#include "tracex.h"
+#include "mem_sections.h"
+#include "mem_budget.h"
+#include "profiler.h"
+#include "proto_timer.h"
+#include "table_swap.h"
+#include "us_clock.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -40,6 +59,37 @@
 #define CAN_BUS_MAX_SUBSCRIBERS 8
 #endif
 
+#ifndef CAN_BUS_MAX_BATCH_SUBSCRIBERS
+#define CAN_BUS_MAX_BATCH_SUBSCRIBERS 2
+#endif
+
+// Time sync takes one; ISO-TP sessions (isotp.c) one each.
+#ifndef CAN_BUS_MAX_ID_SUBSCRIBERS
+#define CAN_BUS_MAX_ID_SUBSCRIBERS 6
+#endif
+
+#ifndef CAN_BUS_MAX_STREAM_SUBSCRIBERS
+#define CAN_BUS_MAX_STREAM_SUBSCRIBERS 2
+#endif
+
+// Gateway routes per source instance (can_bus_set_routes()). Every frame
+// the RX ISR drains is compared against them, so keep the table short.
+#ifndef CAN_BUS_MAX_ROUTES
+#define CAN_BUS_MAX_ROUTES 8
+#endif
+
+// One published routing table; two per instance (see table_swap.h).
+typedef struct {
+  uint8_t count;
+  can_bus_route_t routes[CAN_BUS_MAX_ROUTES];
+} can_bus_route_tab_t;
+
+// Messages handed to batch subscribers per call. Every one of them pins its
+// RX ring record or reassembly buffer until the batch is delivered.
+#ifndef CAN_BUS_RX_BATCH_MAX
+#define CAN_BUS_RX_BATCH_MAX 8
+#endif
+
 // =========================
 // FD DLC helpers
 // =========================
@@ -110,25 +160,185 @@ static size_t can_bus_round_up_fd_len(size_t len) {
   return 64;
 }
 
+// =========================
+// Bit timing
+// =========================
+//
+// Nominal (arbitration) and data-phase timing come from a small table keyed
+// by the FDCAN kernel clock, so changing the clock tree only needs a new row.
+// Nominal sample point ~80%, data sample point ~75%.
+//
+// With CAN_BUS_AUTOBAUD, can_bus_init() doesn't trust the configured rates:
+// it listens with every row for the kernel clock in bus monitoring mode
+// (receive only: no ACK, no error frame, nothing sent) and keeps the first
+// that decodes CAN_BUS_AUTOBAUD_FRAMES frames with no protocol error. A row
+// whose nominal rate decodes but which saw no BRS frame only passes the
+// data phase untested, so the scan goes on for one that did, and among the
+// untested ones prefers the configured data rate.
+
+#ifndef CAN_BUS_NOMINAL_BITRATE
+#define CAN_BUS_NOMINAL_BITRATE 500000u
+#endif
+
+#ifndef CAN_BUS_DATA_BITRATE
+#define CAN_BUS_DATA_BITRATE 2000000u
+#endif
+
+// 1 = CAN-FD with bit-rate switching, 0 = CAN-FD at the nominal rate only.
+#ifndef CAN_BUS_USE_BRS
+#define CAN_BUS_USE_BRS 1
+#endif
+
+#ifndef CAN_BUS_AUTOBAUD
+#define CAN_BUS_AUTOBAUD 0
+#endif
+#ifndef CAN_BUS_AUTOBAUD_LISTEN_MS
+#define CAN_BUS_AUTOBAUD_LISTEN_MS 200u // per row, less once it decides
+#endif
+#ifndef CAN_BUS_AUTOBAUD_TIMEOUT_MS
+#define CAN_BUS_AUTOBAUD_TIMEOUT_MS 3000u // quiet bus: configured rates
+#endif
+#ifndef CAN_BUS_AUTOBAUD_FRAMES
+#define CAN_BUS_AUTOBAUD_FRAMES 4u
+#endif
+
+typedef struct {
+  uint32_t kernel_hz;
+  uint32_t nominal_bps;
+  uint32_t data_bps;
+  uint16_t nom_presc;
+  uint16_t nom_seg1;
+  uint8_t nom_seg2;
+  uint8_t nom_sjw;
+  uint8_t data_presc;
+  uint8_t data_seg1;
+  uint8_t data_seg2;
+  uint8_t data_sjw;
+} can_bus_bit_timing_t;
+
+static const can_bus_bit_timing_t g_bit_timings[] = {
+    // 16 MHz kernel (HSI via PCLK1)
+    {16000000u, 125000u, 2000000u, 4, 25, 6, 6, 1, 5, 2, 2},
+    {16000000u, 250000u, 2000000u, 2, 25, 6, 6, 1, 5, 2, 2},
+    {16000000u, 500000u, 2000000u, 1, 25, 6, 6, 1, 5, 2, 2},
+    {16000000u, 500000u, 4000000u, 1, 25, 6, 6, 1, 2, 1, 1},
+    {16000000u, 1000000u, 2000000u, 1, 12, 3, 3, 1, 5, 2, 2},
+    {16000000u, 1000000u, 4000000u, 1, 12, 3, 3, 1, 2, 1, 1},
+    // 170 MHz kernel (PLLQ, 170 MHz core profile)
+    {170000000u, 125000u, 2000000u, 8, 135, 34, 34, 5, 12, 4, 4},
+    {170000000u, 250000u, 2000000u, 4, 135, 34, 34, 5, 12, 4, 4},
+    {170000000u, 500000u, 2000000u, 2, 135, 34, 34, 5, 12, 4, 4},
+    {170000000u, 500000u, 5000000u, 2, 135, 34, 34, 2, 12, 4, 4},
+    {170000000u, 1000000u, 2000000u, 2, 67, 17, 17, 5, 12, 4, 4},
+    {170000000u, 1000000u, 5000000u, 2, 67, 17, 17, 2, 12, 4, 4},
+};
+
+#define CAN_BUS_TIMINGS (sizeof(g_bit_timings) / sizeof(g_bit_timings[0]))
+
+static const can_bus_bit_timing_t *can_bus_find_timing(uint32_t kernel_hz,
+                                                       uint32_t nominal_bps,
+                                                       uint32_t data_bps) {
+  for (unsigned i = 0; i < CAN_BUS_TIMINGS; i++) {
+    const can_bus_bit_timing_t *t = &g_bit_timings[i];
+    if (t->kernel_hz == kernel_hz && t->nominal_bps == nominal_bps &&
+        t->data_bps == data_bps)
+      return t;
+  }
+  return NULL;
+}
+
+// Re-initialize the controller with timing `t` and, for BRS, transmitter
+// delay compensation. Must run while the controller is not started.
+static HAL_StatusTypeDef can_bus_apply_bit_timing(FDCAN_HandleTypeDef *hfdcan,
+                                                  const can_bus_bit_timing_t *t,
+                                                  uint8_t *brs) {
+  hfdcan->Init.ClockDivider = FDCAN_CLOCK_DIV1;
+  hfdcan->Init.FrameFormat = CAN_BUS_USE_BRS ? FDCAN_FRAME_FD_BRS
+                                             : FDCAN_FRAME_FD_NO_BRS;
+  hfdcan->Init.NominalPrescaler = t->nom_presc;
+  hfdcan->Init.NominalTimeSeg1 = t->nom_seg1;
+  hfdcan->Init.NominalTimeSeg2 = t->nom_seg2;
+  hfdcan->Init.NominalSyncJumpWidth = t->nom_sjw;
+  hfdcan->Init.DataPrescaler = t->data_presc;
+  hfdcan->Init.DataTimeSeg1 = t->data_seg1;
+  hfdcan->Init.DataTimeSeg2 = t->data_seg2;
+  hfdcan->Init.DataSyncJumpWidth = t->data_sjw;
+
+  if (HAL_FDCAN_Init(hfdcan) != HAL_OK)
+    return HAL_ERROR;
+
+#if CAN_BUS_USE_BRS
+  // Secondary sample point at the data-phase sample point, no filter window.
+  if (HAL_FDCAN_ConfigTxDelayCompensation(
+          hfdcan, (uint32_t)t->data_presc * t->data_seg1, 0) != HAL_OK)
+    return HAL_ERROR;
+  if (HAL_FDCAN_EnableTxDelayCompensation(hfdcan) != HAL_OK)
+    return HAL_ERROR;
+  *brs = 1;
+#endif
+  return HAL_OK;
+}
+
 // =========================
 // Subscriber fanout
 // =========================
 
+// Either cb (every std ID) or msg_cb (IDs matching id under mask) is set.
 typedef struct {
   can_bus_rx_cb_t cb;
+  can_bus_msg_cb_t msg_cb;
   void *user;
+  uint16_t id;
+  uint16_t mask;
 } can_bus_sub_t;
 
-static FDCAN_HandleTypeDef *g_hfdcan = NULL;
-static can_bus_sub_t g_subs[CAN_BUS_MAX_SUBSCRIBERS];
+typedef struct {
+  can_bus_rx_batch_cb_t cb;
+  void *user;
+} can_bus_batch_sub_t;
 
-static inline void can_bus_notify_rx(const uint8_t *data, size_t len) {
-  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
-    can_bus_rx_cb_t cb = g_subs[i].cb;
-    if (cb)
-      cb(data, len, g_subs[i].user);
-  }
-}
+typedef struct {
+  uint16_t std_id;
+  can_bus_frame_cb_t cb;
+  void *user;
+} can_bus_id_sub_t;
+
+typedef struct {
+  can_bus_stream_cb_t cb;
+  void *user;
+  uint16_t id;
+  uint16_t mask;
+} can_bus_stream_sub_t;
+
+#if CAN_BUS_MAX_SUBSCRIBERS > 8
+#error "CAN_BUS_MAX_SUBSCRIBERS must fit the 8-bit dispatch map"
+#endif
+
+// The FDCAN lines run above the ThreadX BASEPRI threshold, where kernel
+// calls aren't allowed, so the RX ISRs pend this spare vector instead and
+// the notify hook runs from its handler (can_bus_notify_irq()).
+#ifndef CAN_BUS_NOTIFY_IRQn
+#define CAN_BUS_NOTIFY_IRQn FMAC_IRQn // FMAC is unused
+#endif
+#ifndef CAN_BUS_NOTIFY_IRQ_PRIO
+#define CAN_BUS_NOTIFY_IRQ_PRIO 6u // masked by ThreadX like any kernel caller
+#endif
+
+// RX interrupt coalescing. One FIFO (the bulk FIFO1 by default, -1 for
+// none) interrupts when it is full instead of on every frame: the G4 FDCAN
+// has no watermark and its FIFOs hold 3 elements, so full is the only
+// threshold. A lone frame is flushed by the timeout counter, which starts
+// when the first element is stored and reloads once the FIFO is emptied.
+// There is a single timeout counter, hence a single coalesced FIFO.
+#ifndef CAN_BUS_RX_COALESCE_FIFO
+#define CAN_BUS_RX_COALESCE_FIFO 1
+#endif
+#ifndef CAN_BUS_RX_FLUSH_US
+#define CAN_BUS_RX_FLUSH_US 200u
+#endif
+#if CAN_BUS_RX_COALESCE_FIFO > 1
+#error "CAN_BUS_RX_COALESCE_FIFO must be 0, 1 or -1"
+#endif
 
 // =========================
 // Fragmentation protocol
@@ -136,491 +346,6413 @@ static inline void can_bus_notify_rx(const uint8_t *data, size_t len) {
 //
 // We mark fragment frames by a magic header at the start of payload.
 // You can use a dedicated CAN ID range too, but magic is simplest.
+// The v2 header sends the message length and fragment count in the first
+// fragment only; later ones carry just magic, seq and index (4 bytes). The
+// receiver takes both versions. The last fragment goes out with the
+// shortest FD length that holds it, in every format.
+//
+// With CAN_BUS_FRAG_EXT_ID the header moves into the 29-bit extended ID
+// instead and the whole payload carries data:
+//   [28:18] base ID (the sender's 11-bit ID, so arbitration order is kept)
+//   [17:10] seq   [9:2] frag_idx   [1:0] CAN_BUS_FRAG_F_* flags
+// The first fragment starts with the message length (u16, little-endian),
+// from which the fragment count follows. Standard frames are then never
+// fragments and extended ones never anything else, so no magic check, and
+// hardware filters can route fragments by base ID. Every node on the bus
+// must use the same mode.
+
+#ifndef CAN_BUS_FRAG_EXT_ID
+#define CAN_BUS_FRAG_EXT_ID 0
+#endif
+
+// 0: v1 header on every fragment, for receivers that predate v2.
+#ifndef CAN_BUS_FRAG_COMPACT_HDR
+#define CAN_BUS_FRAG_COMPACT_HDR 1
+#endif
+
+// Messages of up to CAN_BUS_SINGLE_CAP bytes go as one standard frame,
+//   [u16 CAN_BUS_SINGLE_MAGIC] [u8 len] [len bytes] (padded to the FD length)
+// with no sequence number, and the receiver hands them to subscribers
+// straight from its RX ring, skipping the reassembly slots. They can't be
+// NACKed or covered by parity, like any lone frame. 0 for receivers that
+// predate it.
+#ifndef CAN_BUS_FRAG_SINGLE
+#define CAN_BUS_FRAG_SINGLE 1
+#endif
+
+// Fragment frame size picked per message (see "Adaptive fragment size")
+// rather than always 64 bytes. Receivers take it from each message's first
+// fragment, so this only changes what the sender does.
+#ifndef CAN_BUS_FRAG_ADAPT
+#define CAN_BUS_FRAG_ADAPT 1
+#endif
+
+// Selective retransmit of lost fragments (see "Selective retransmit"). Costs
+// CAN_BUS_RTX_SLOTS x CAN_BUS_REASM_MAX_BYTES of RAM and a copy of every
+// fragmented message sent. NACKs travel on CAN_BUS_NACK_STD_ID, which
+// can_bus_set_filters() always lets into FIFO0 in this mode.
+#ifndef CAN_BUS_FRAG_RELIABLE
+#define CAN_BUS_FRAG_RELIABLE 0
+#endif
+
+// XOR parity for one-to-many traffic, where NACKs don't scale: the sender
+// appends one parity fragment per CAN_BUS_FEC_GROUP data fragments, and a
+// receiver rebuilds one lost fragment per group without asking. Receivers
+// always decode parity; CAN_BUS_FRAG_FEC only turns on sending it, so
+// enable it once every node runs a build that knows parity fragments.
+// CAN_BUS_FEC_GROUP must be the same on all nodes.
+#ifndef CAN_BUS_FRAG_FEC
+#define CAN_BUS_FRAG_FEC 0
+#endif
+#ifndef CAN_BUS_FEC_GROUP
+#define CAN_BUS_FEC_GROUP 4u
+#endif
+
+// Receiver-window flow control (see "Credit flow control"): receivers can
+// advertise their free reassembly space on CAN_BUS_CREDIT_STD_ID, and
+// senders then hold back new messages they have no credit for. A sender
+// that hasn't heard an advert for CAN_BUS_CREDIT_STALE_MS sends freely.
+#ifndef CAN_BUS_FLOW_CONTROL
+#define CAN_BUS_FLOW_CONTROL 0
+#endif
+#ifndef CAN_BUS_CREDIT_STD_ID
+#define CAN_BUS_CREDIT_STD_ID 0x7F1u
+#endif
+#ifndef CAN_BUS_CREDIT_STALE_MS
+#define CAN_BUS_CREDIT_STALE_MS 500u
+#endif
+#ifndef CAN_BUS_CREDIT_IDS
+#define CAN_BUS_CREDIT_IDS 4u // IDs this node sends fragmented messages on
+#endif
+#ifndef CAN_BUS_NACK_STD_ID
+#define CAN_BUS_NACK_STD_ID 0x7F0u
+#endif
+
+// Per-frame TX events (see "TX events"): every frame asks for a TX event
+// tagged with its own message marker, which gives its wait in the hardware
+// FIFO, and frames that fail (AutoRetransmission is off) are counted by
+// cause. CAN_BUS_TX_RETRY > 0 queues a failed frame again that many times,
+// behind whatever is already in the FIFO. 0: events only for time-stamped
+// frames.
+#ifndef CAN_BUS_TX_EVENTS
+#define CAN_BUS_TX_EVENTS 1
+#endif
+// RX latency histogram per FIFO (can_bus_get_rx_lat_stats()): each frame's
+// wait in the hardware FIFO, from its end (RX timestamp plus its length) to
+// the timestamp counter read when the ISR starts draining.
+#ifndef CAN_BUS_RX_LAT_HIST
+#define CAN_BUS_RX_LAT_HIST 1
+#endif
+#ifndef CAN_BUS_TX_RETRY
+#define CAN_BUS_TX_RETRY 0u
+#endif
+
+// Messages sent with can_bus_send_async() that can be in flight at once
+// (see "Async sends"); 0 leaves them out.
+#ifndef CAN_BUS_ASYNC_SLOTS
+#define CAN_BUS_ASYNC_SLOTS 4u
+#endif
+
+// Frames built ahead of time and sent with can_bus_tx_fire() (see
+// "Pre-loaded frames").
+#ifndef CAN_BUS_TX_PRELOAD_SLOTS
+#define CAN_BUS_TX_PRELOAD_SLOTS 2u
+#endif
+// Frames sent on a fixed period from the us_clock alarm (see "Cyclic
+// frames"); 0 leaves the scheduler out.
+#ifndef CAN_BUS_CYCLIC_SLOTS
+#define CAN_BUS_CYCLIC_SLOTS 4u
+#endif
+// Standard IDs that can be given the classic profile (see "Classic peers").
+#ifndef CAN_BUS_PEER_PROFILES
+#define CAN_BUS_PEER_PROFILES 4u
+#endif
+#ifndef CAN_BUS_RTX_SLOTS
+#define CAN_BUS_RTX_SLOTS 2u
+#endif
+#ifndef CAN_BUS_NACK_MAX
+#define CAN_BUS_NACK_MAX 2u // per message
+#endif
 
-#define CAN_BUS_FRAG_MAGIC 0x5344u // 'S''D' (arbitrary)
+#define CAN_BUS_FRAG_MAGIC 0x5344u    // 'S''D' (arbitrary)
+#define CAN_BUS_FRAG_MAGIC_V2 0x5345u // 'S''E'
+#define CAN_BUS_PACK_MAGIC 0x5350u    // 'S''P': packed records, see TX packing
+#define CAN_BUS_PACK_HDR 2u
+#define CAN_BUS_SINGLE_MAGIC 0x5331u  // 'S''1': one whole message
+#define CAN_BUS_SINGLE_HDR 3u         // magic, length
+#define CAN_BUS_NACK_MAGIC 0x534Eu    // 'S''N'
+#define CAN_BUS_CREDIT_MAGIC 0x5343u  // 'S''C'
 #define CAN_BUS_FRAG_WIRE_LEN 64   // always send 64B payload frames for frags
-#define CAN_BUS_REASM_TIMEOUT_MS 250u // drop partial message after this many ms
+
+#define CAN_BUS_XID_BASE_Pos 18u
+#define CAN_BUS_XID_SEQ_Pos 10u
+#define CAN_BUS_XID_IDX_Pos 2u
+#define CAN_BUS_XID_FLAGS_Msk 0x3u
+#define CAN_BUS_XID_SUB_Msk ((1u << CAN_BUS_XID_BASE_Pos) - 1u) // under a base
+#define CAN_BUS_XID_LEAD 2u // length prefix in the first fragment
+
+// Frame IDs inside the driver: an 11-bit standard ID, or a 29-bit extended
+// ID with this flag set.
+#define CAN_BUS_ID_XTD (1u << 31)
+#define CAN_BUS_ID_EXT_Msk 0x1FFFFFFFu
+// TX only: send as a classic frame (no FDF/BRS), 8 bytes at most.
+#define CAN_BUS_ID_CLASSIC (1u << 30)
+
+// Reassembly timeout: how long an in-flight message may go without a new
+// fragment. Derived per sender from its observed inter-fragment gap
+// (CAN_BUS_REASM_TIMEOUT_GAP_MULT x average, clamped to MIN..MAX), so slow
+// senders on a loaded bus get more room and dead ones free their slot sooner.
+// CAN_BUS_REASM_TIMEOUT_MS applies until a gap has been measured, and to IDs
+// beyond the stats table.
+#ifndef CAN_BUS_REASM_TIMEOUT_MS
+#define CAN_BUS_REASM_TIMEOUT_MS 250u
+#endif
+#ifndef CAN_BUS_REASM_TIMEOUT_MIN_MS
+#define CAN_BUS_REASM_TIMEOUT_MIN_MS 50u
+#endif
+#ifndef CAN_BUS_REASM_TIMEOUT_MAX_MS
+#define CAN_BUS_REASM_TIMEOUT_MAX_MS 1000u
+#endif
+#ifndef CAN_BUS_REASM_TIMEOUT_GAP_MULT
+#define CAN_BUS_REASM_TIMEOUT_GAP_MULT 8u
+#endif
 
 typedef struct __attribute__((packed)) {
   uint16_t magic;     // CAN_BUS_FRAG_MAGIC
   uint8_t seq;        // message sequence (wrap OK)
   uint8_t frag_idx;   // 0..frag_cnt-1
   uint8_t frag_cnt;   // total fragments
-  uint8_t flags;      // bit0=first, bit1=last (optional)
+  uint8_t flags;      // bit0=first, bit1=last (optional), bits 2-7 stride
   uint16_t total_len; // total bytes of reassembled message
 } can_bus_frag_hdr_t;
 
+// v2: every fragment starts with this...
+typedef struct __attribute__((packed)) {
+  uint16_t magic;   // CAN_BUS_FRAG_MAGIC_V2
+  uint8_t seq;      // message sequence (wrap OK)
+  uint8_t frag_idx; // 0..frag_cnt-1
+} can_bus_frag_hdr2_t;
+
+// ...and the first one continues with this.
+typedef struct __attribute__((packed)) {
+  uint8_t frag_cnt;   // total fragments
+  uint8_t rsvd;       // 0
+  uint16_t total_len; // total bytes of reassembled message
+} can_bus_frag_hdr2_first_t;
+
 enum { CAN_BUS_FRAG_F_FIRST = 1u << 0, CAN_BUS_FRAG_F_LAST = 1u << 1 };
+// v1: message bytes per fragment, so each one lands at idx * stride however
+// they arrive. 0 from senders that predate it.
+#define CAN_BUS_FRAG_STRIDE_Pos 2u
+#define CAN_BUS_FRAG_STRIDE_Msk 0x3Fu
+
+// Sender header geometry: TX_HDR bytes on every fragment, plus TX_LEAD on
+// the first.
+#if CAN_BUS_FRAG_EXT_ID
+#define CAN_BUS_FRAG_TX_HDR 0u
+#define CAN_BUS_FRAG_TX_LEAD CAN_BUS_XID_LEAD
+#elif CAN_BUS_FRAG_COMPACT_HDR
+#define CAN_BUS_FRAG_TX_HDR sizeof(can_bus_frag_hdr2_t)
+#define CAN_BUS_FRAG_TX_LEAD sizeof(can_bus_frag_hdr2_first_t)
+#else
+#define CAN_BUS_FRAG_TX_HDR sizeof(can_bus_frag_hdr_t)
+#define CAN_BUS_FRAG_TX_LEAD 0u
+#endif
+#define CAN_BUS_FRAG_TX_CAP (CAN_BUS_FRAG_WIRE_LEN - CAN_BUS_FRAG_TX_HDR)
+#define CAN_BUS_SINGLE_CAP (CAN_BUS_FRAG_WIRE_LEN - CAN_BUS_SINGLE_HDR)
+_Static_assert(CAN_BUS_FRAG_EXT_ID || CAN_BUS_FRAG_COMPACT_HDR ||
+                   CAN_BUS_FRAG_TX_CAP <= CAN_BUS_FRAG_STRIDE_Msk,
+               "v1 stride must fit the flags byte");
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic;     // CAN_BUS_NACK_MAGIC
+  uint16_t std_id;    // of the message
+  uint8_t seq;
+  uint8_t frag_cnt;
+  uint16_t total_len;
+  uint64_t missing;   // bit i = fragment i still needed
+} can_bus_nack_t;
+
+// Credit advert: a share of the advertiser's free reassembly blocks for each
+// sender it knows, and `dflt` for anyone else.
+typedef struct __attribute__((packed)) {
+  uint16_t std_id;
+  uint8_t credits; // in blocks of block_bytes
+  uint8_t rsvd;
+} can_bus_credit_entry_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic; // CAN_BUS_CREDIT_MAGIC
+  uint16_t block_bytes;
+  uint8_t dflt;
+  uint8_t count;
+  can_bus_credit_entry_t e[14];
+} can_bus_credit_t;
+_Static_assert(sizeof(can_bus_credit_t) <= 64, "credit advert is one frame");
+
+// Parity fragments behind a `cnt`-fragment message, numbered cnt.. on the
+// wire. Fragment i is covered by parity i % n, so a burst of up to n lost
+// frames still costs each group at most one.
+static inline size_t fec_parity_count(size_t cnt) {
+  return (cnt < 2u) ? 0u : (cnt + CAN_BUS_FEC_GROUP - 1u) / CAN_BUS_FEC_GROUP;
+}
 
 // =========================
-// RX ring buffer (ISR -> thread)
+// Instances
 // =========================
 //
-// ISR drains FDCAN FIFO into this ring. Consumer calls can_bus_process_rx()
-// from a thread/main loop.
+// Each FDCAN controller handed to can_bus_init() gets a can_bus_t with all
+// of its state, so the controllers run side by side with separate rings,
+// ISRs and reassembly. The bigger tables (RX/TX rings, reassembly slots and
+// pool, retransmit copies) are allocated per instance in their own sections
+// below, keeping their memory placement, and hooked up at init. Shared by
+// all instances: the bit timing table, the notify interrupt and the
+// us_clock alarm that times packed frames.
 
-#ifndef CAN_BUS_RX_RING_DEPTH
-#define CAN_BUS_RX_RING_DEPTH 64
-#endif
+// Controllers driven at once (the G491 has FDCAN1 and FDCAN2),
+// CAN_BUS_INSTANCES in mem_budget.h. Each takes its own RX rings and
+// reassembly slots in CCM; with two, shrink CAN_BUS_RX_RING_BYTES so the ISR
+// code still fits.
 
+typedef struct can_bus_rx_ring can_bus_rx_ring_t;
+typedef struct can_bus_tx_ring can_bus_tx_ring_t;
+typedef struct can_bus_pack can_bus_pack_t;
+typedef struct can_bus_peer can_bus_peer_t;
+typedef struct can_bus_rtx_slot can_bus_rtx_slot_t;
+typedef struct can_bus_reasm_slot can_bus_reasm_slot_t;
+typedef struct can_bus_early can_bus_early_t;
+typedef struct can_bus_id_stats_entry can_bus_id_stats_entry_t;
+typedef struct can_bus_credit_slot can_bus_credit_slot_t;
+typedef struct can_bus_rx_reader can_bus_rx_reader_t;
+typedef struct can_bus_talker_slot can_bus_talker_slot_t;
+typedef struct can_bus_shaper can_bus_shaper_t;
+typedef struct can_bus_tx_frame can_bus_tx_frame_t;
+typedef struct can_bus_cyclic can_bus_cyclic_t;
+typedef struct can_bus_async can_bus_async_t;
+
+// Frame behind one message marker (CAN_BUS_TX_EVENTS).
+#define CAN_BUS_TX_RECS 8u // > frames in the hardware FIFO + unread events
+#define CAN_BUS_TX_MM_SEQ 0x7Fu
+#define CAN_BUS_TX_MM_STAMP 0x80u // time-stamped frame (tx_evt_*)
 typedef struct {
-  uint32_t std_id; // 11-bit ID in lower bits (we only handle standard here)
-  uint8_t len;     // payload bytes (0..64)
-  uint8_t data[64];
-} can_bus_rx_frame_t;
+  uint16_t ts;   // timestamp counter when handed to the hardware
+  uint8_t tries; // retransmissions so far
+} can_bus_tx_rec_t;
 
-static volatile uint16_t g_rx_head = 0;
-static volatile uint16_t g_rx_tail = 0;
-static can_bus_rx_frame_t g_rx_ring[CAN_BUS_RX_RING_DEPTH];
+struct can_bus {
+  FDCAN_HandleTypeDef *hfdcan;
+  IRQn_Type it_irqn[2]; // interrupt lines 0 and 1
+  uint8_t brs;          // set once FD+BRS timing is active
+  uint8_t listen_only;  // CCCR.MON: receive only, TX held
+  uint8_t tx_draining;  // can_bus_set_filters() emptying the hardware FIFO
+  uint32_t nom_bit_ns;  // of the applied timing
+  uint32_t data_bit_ns;
+  can_bus_bitrate_t rate;
 
-static inline uint16_t rb_next(uint16_t v) {
-  v++;
-  if (v >= CAN_BUS_RX_RING_DEPTH)
-    v = 0;
-  return v;
-}
+  // Hardware timestamps
+  volatile uint32_t ts_wraps;
+  uint32_t ts_bps; // timestamp ticks per second
+  // Latest TX event (time-stamped high-class frame).
+  volatile uint32_t tx_evt_id;
+  volatile uint32_t tx_evt_ts;
+  volatile uint8_t tx_evt_valid;
+#if CAN_BUS_TX_EVENTS
+  // Every frame's marker picks a record; see tx_rec_new().
+  can_bus_tx_rec_t tx_rec[CAN_BUS_TX_RECS];
+  uint8_t tx_mm;         // next marker sequence
+  uint8_t tx_elem_mm[3]; // marker of the frame in each hardware element
+  can_bus_tx_event_stats_t tx_ev; // latencies in timestamp ticks
+  uint64_t tx_lat_total;
+#endif
+#if CAN_BUS_RX_LAT_HIST
+  // Per FIFO; written by its drain only.
+  uint32_t rx_lat_frames[2];
+  uint32_t rx_lat_max_us[2];
+  uint32_t rx_lat_hist[2][CAN_BUS_RX_LAT_BINS];
+#endif
 
-static inline int __attribute__((unused)) rb_is_empty(void) {
-  return g_rx_head == g_rx_tail;
-}
+  // Subscriber fanout
+  can_bus_sub_t subs[CAN_BUS_MAX_SUBSCRIBERS];
+  can_bus_batch_sub_t batch_subs[CAN_BUS_MAX_BATCH_SUBSCRIBERS];
+  can_bus_id_sub_t id_subs[CAN_BUS_MAX_ID_SUBSCRIBERS];
+  can_bus_stream_sub_t stream_subs[CAN_BUS_MAX_STREAM_SUBSCRIBERS];
+  unsigned batch_sub_count;
+  can_bus_rx_notify_cb_t volatile rx_notify;
+  can_bus_rx_tap_cb_t volatile rx_tap;
+  void *rx_tap_user;
+  can_bus_rx_tap_cb_t volatile capture; // see can_bus_set_capture()
+  void *capture_user;
+  // Standard ID -> bit i set if subs[i] wants it, so delivery only visits
+  // matching subscribers. Kept up to date by (un)subscribe.
+  uint8_t sub_map[0x800];
 
-static inline int rb_is_full(void) { return rb_next(g_rx_head) == g_rx_tail; }
+  // ISR responder (see rx_respond()).
+  can_bus_responder_cb_t volatile resp_cb;
+  void *resp_user;
+  volatile uint16_t resp_id;
+  volatile uint32_t resp_sent;
+  volatile uint32_t resp_dropped;
 
-// Push frame from ISR. Drop-oldest on overflow (hybrid “stay current”
-// behavior).
-//
-// Memory ordering:
-//  - We must ensure slot writes are visible before publishing head.
-//  - `__DMB()` acts as a release barrier here.
-static inline void rb_push_drop_oldest(uint32_t std_id, const uint8_t *data,
-                                       uint8_t len) {
-  if (len > 64)
-    len = 64;
+  // Gateway routes (see rx_forward()), a can_bus_route_tab_t swapped in
+  // whole by can_bus_set_routes(); only the RX ISRs read it.
+  table_swap_t routes;
+  volatile uint32_t fwd_frames;
+  volatile uint32_t fwd_dropped;
 
-  if (rb_is_full()) {
-    // drop oldest
-    g_rx_tail = rb_next(g_rx_tail);
-  }
+  // RX path: rings indexed by hardware FIFO, drain requests per FIFO.
+  can_bus_rx_ring_t *rx_ring;
+  can_bus_rx_reader_t *readers; // CAN_BUS_RX_READERS, see "Broadcast readers"
+  volatile uint8_t rx_pending[2]; // set by callbacks
+  volatile int8_t irq_line;       // line being serviced, -1 = none
+
+  // TX path
+  can_bus_tx_ring_t *tx_ring; // indexed by can_bus_tx_prio_t
+  can_bus_tx_ring_t *tx_express; // bulk messages sent ahead of a train
+  uint8_t express_run;           // express frames pumped in a row
+  can_bus_express_stats_t express_stats;
+  can_bus_pack_t *pack;
+  volatile can_bus_pack_notify_cb_t pack_notify;
+  volatile can_bus_tx_notify_cb_t tx_notify;
+  volatile uint8_t tx_blocked; // a send found its TX ring full
+  can_bus_shaper_t *shaper;    // indexed by can_bus_tx_prio_t
+  can_bus_tx_frame_t *preload; // CAN_BUS_TX_PRELOAD_SLOTS
+  volatile uint8_t preload_set; // bit i: slot i loaded
+  can_bus_cyclic_t *cyclic;    // CAN_BUS_CYCLIC_SLOTS
+#if CAN_BUS_ASYNC_SLOTS
+  can_bus_async_t *async;      // CAN_BUS_ASYNC_SLOTS
+  uint8_t tx_elem_async[3];    // async slot + 1 of each hardware element
+  can_bus_async_stats_t async_stats;
+#endif
+  uint64_t cyclic_next_us;     // earliest cyclic frame due, 0 = none
+  uint64_t shape_wake_us;      // pump held until then, 0 = not
+  uint32_t shape_holds;
+  // Bus-off recovery (see "Bus monitor"); the pump is held while off.
+  uint64_t boff_rejoin_us; // INIT cleared then, 0 = not pending
+  uint32_t boff_min_ms;
+  uint32_t boff_max_ms;
+  uint32_t boff_delay_ms;  // the next bus-off's wait
+  uint32_t boff_up_ms;     // HAL_GetTick() of the last rejoin
+  // TX windows (can_bus_set_tx_window()); cycle 0 = off.
+  uint64_t win_anchor_us;
+  uint32_t win_cycle_ns;
+  uint32_t win_open_ns;
+  uint8_t win_classes;
+  can_bus_pack_stats_t pack_stats; // both directions
+  can_bus_single_stats_t single_stats;
+  // Bus monitor: bus time and bits of each frame in the hardware TX FIFO,
+  // counted when it completes.
+  uint32_t tx_elem_ns[3];
+  uint16_t tx_elem_bits[3];
+  can_bus_monitor_t mon;
+  uint64_t mon_busy_ns;  // TX and RX frames, running
+  uint32_t mon_tx_bits;  // running
+  uint32_t mon_rx_bits;
+  uint64_t mon_last_us;  // start of the current rate period
+  uint32_t mon_prev[4];  // tx frames, rx frames, tx bits, rx bits then
+  uint64_t mon_prev_busy_ns;
+  uint32_t mon_prev_errors;
+  uint32_t mon_err_pgb;   // protocol errors per 1e9 wire bits, smoothed
+  uint32_t frag_block_ns; // bus time limit of bulk fragments, 0 = none
+  uint32_t frag_size_tx[CAN_BUS_FRAG_SIZES];
+  uint8_t tx_seq;                  // fragmented message sequence
+  can_bus_peer_t *peers;
+  uint8_t peer_count;
+#if CAN_BUS_FRAG_RELIABLE
+  can_bus_rtx_slot_t *rtx;
+  unsigned rtx_next;
+#endif
+  can_bus_rtx_stats_t rtx_stats;
+  can_bus_fec_stats_t fec_stats;
 
-  uint16_t h = g_rx_head;
+  // Reassembly
+  can_bus_reasm_slot_t *reasm;
+  unsigned reasm_active;
+  unsigned reasm_low; // of those, from IDs outside reasm_high_*
+  unsigned reasm_low_max; // see can_bus_set_reasm_low_limit()
+  uint16_t reasm_high_first;
+  uint16_t reasm_high_last;
+  can_bus_early_t *early;
+  uint8_t early_count;
+  uint8_t *reasm_pool;
+  uint32_t reasm_pool_free; // bit i set = block i free
+  can_bus_id_stats_entry_t *id_stats;
+  can_bus_talker_slot_t *talkers; // CAN_BUS_TALKER_SLOTS, see "Top talkers"
+  uint32_t talker_evicted;
+  uint32_t id_stats_untracked;
+  // Optional outside allocator for reassembly buffers (e.g. the router
+  // heap), and a consumer that adopts completed ones; see
+  // can_bus_set_reasm_alloc().
+  can_bus_buf_alloc_t reasm_alloc;
+  can_bus_buf_free_t reasm_free;
+  can_bus_rx_take_cb_t rx_take;
+  void *rx_take_user;
+  // New messages from IDs at or above this aren't started (0 = none);
+  // see can_bus_set_reasm_pause().
+  volatile uint16_t reasm_pause_id;
 
-  g_rx_ring[h].std_id = std_id;
-  g_rx_ring[h].len = len;
-  memcpy(g_rx_ring[h].data, data, len);
+#if CAN_BUS_FLOW_CONTROL
+  can_bus_credit_slot_t *credit;
+  uint16_t credit_block; // advertiser's block size, 0 = none heard
+  uint8_t credit_dflt;   // share for IDs the advert didn't list
+  uint32_t credit_heard_ms;
+  uint32_t credit_period_ms; // our own adverts, 0 = off
+  uint32_t credit_sent_ms;
+#endif
+  can_bus_flow_stats_t flow_stats;
 
-  __DMB(); // publish slot before updating head (release)
-  g_rx_head = rb_next(h);
+  // RX batch
+  can_bus_msg_t batch[CAN_BUS_RX_BATCH_MAX];
+  can_bus_reasm_slot_t *batch_held[CAN_BUS_RX_BATCH_MAX];
+  size_t batch_held_cnt;
+  size_t batch_len;
+};
+
+// In can_bus_init() order.
+static can_bus_t g_bus[CAN_BUS_INSTANCES];
+static unsigned g_bus_count = 0;
+
+// Instance driving `hfdcan`, or NULL (HAL callbacks of other controllers).
+static inline can_bus_t *bus_of(const FDCAN_HandleTypeDef *hfdcan) {
+  for (unsigned i = 0; i < g_bus_count; i++) {
+    if (g_bus[i].hfdcan == hfdcan)
+      return &g_bus[i];
+  }
+  return NULL;
 }
 
-// Pop frame in thread context
+// =========================
+// Hardware timestamps
+// =========================
 //
-// Memory ordering:
-//  - After observing head != tail, we must ensure subsequent reads of the slot
-//    see the writes that happened-before the producer published head.
-//  - `__DMB()` acts as an acquire barrier here.
-static inline int rb_pop(can_bus_rx_frame_t *out) {
-  uint16_t t = g_rx_tail;
-  uint16_t h = g_rx_head;
+// The FDCAN timestamp counter (16 bits, one tick per nominal bit time) is
+// latched at start of frame into every RX element and TX event FIFO entry.
+// Wraparounds are counted in the line-0 ISR to extend it; frames carry the
+// low 32 bits of the extended count (hours at any bit rate), widened against
+// the current count when read.
 
-  if (h == t)
-    return 0;
+// Extended tick count. IRQs are masked so the wrap ISR can't slip in between
+// reading the wrap count and the counter.
+static uint64_t ts_now_ticks(can_bus_t *b) {
+  FDCAN_GlobalTypeDef *can = b->hfdcan->Instance;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint32_t c1 = can->TSCV & FDCAN_TSCV_TSC;
+  const uint32_t wrap_pending = can->IR & FDCAN_IR_TSW;
+  const uint32_t c2 = can->TSCV & FDCAN_TSCV_TSC;
+  uint64_t w = b->ts_wraps;
+  if (wrap_pending || c2 < c1)
+    w++; // wrapped, not counted yet
+  __set_PRIMASK(primask);
+  return (w << 16) | c2;
+}
 
-  __DMB(); // ensure slot contents are visible after seeing head advance
-           // (acquire)
+// Extend a 16-bit capture taken less than one wrap before `now`.
+static inline uint32_t ts_extend(uint32_t now, uint32_t ts16) {
+  return now - ((now - ts16) & 0xFFFFu);
+}
 
-  *out = g_rx_ring[t];
+static inline uint64_t ts_ticks_to_us(can_bus_t *b, uint64_t ticks) {
+  return b->ts_bps ? (ticks * 1000000ull) / b->ts_bps : 0;
+}
 
-  __DMB(); // ensure slot read completes before we advance tail (conservative)
-  g_rx_tail = rb_next(t);
-  return 1;
+// Widen a stored 32-bit tick stamp to microseconds on the extended scale.
+static uint64_t ts_widen_us(can_bus_t *b, uint32_t ts) {
+  const uint64_t now = ts_now_ticks(b);
+  return ts_ticks_to_us(b, now - (uint32_t)((uint32_t)now - ts));
 }
 
 // =========================
-// Reassembly state
+// RX ring buffer (ISR -> thread)
 // =========================
+//
+// ISR drains each FDCAN RX FIFO into its own ring. Consumer calls
+// can_bus_process_rx() from a thread/main loop.
+//
+// FIFO0 is the high-priority path (short, urgent traffic such as time sync;
+// steered there by the filter table) and is serviced on interrupt line 0 at a
+// higher NVIC priority. FIFO1 carries bulk traffic on line 1. The consumer
+// always empties the FIFO0 ring before touching the next FIFO1 frame.
+//
+// Each ring is a byte-granular SPSC buffer of variable-length records
+// (header + payload rounded up to a word), so classic 8-byte frames take
+// 20 bytes instead of a 64-byte slot. head/tail/rd are free-running byte
+// counters masked by the power-of-two size. A record never wraps: if it
+// doesn't fit before the end, the producer skips to the start, leaving a
+// pad record (or, with less than a header left, nothing) that the consumer
+// steps over the same way.
+//
+// Ring sizes (CAN_BUS_RX_RING_BYTES, CAN_BUS_RX_HI_RING_BYTES) are set in
+// mem_budget.h.
 
-#ifndef CAN_BUS_REASM_SLOTS
-#define CAN_BUS_REASM_SLOTS 4
-#endif
+// Overflow policy per ring. None of them lets the ISR move the tail:
+//  - DROP_NEWEST: the frame that doesn't fit is lost.
+//  - DROP_OLDEST: that frame is lost too. The producer also bumps a flush
+//    generation, and the consumer then discards every frame still unread at
+//    that point, so the backlog gives way to current traffic.
+//  - BACKPRESSURE: the frame stays in the hardware FIFO (blocking mode),
+//    and the consumer re-triggers the drain once it frees space. Nothing is
+//    lost until the 3-element FIFO overflows as well.
+#define CAN_BUS_RX_DROP_NEWEST 0
+#define CAN_BUS_RX_DROP_OLDEST 1
+#define CAN_BUS_RX_BACKPRESSURE 2
 
-#ifndef CAN_BUS_REASM_MAX_BYTES
-#define CAN_BUS_REASM_MAX_BYTES 2048
+#ifndef CAN_BUS_RX_HI_OVERFLOW
+#define CAN_BUS_RX_HI_OVERFLOW CAN_BUS_RX_DROP_NEWEST
+#endif
+#ifndef CAN_BUS_RX_OVERFLOW
+#define CAN_BUS_RX_OVERFLOW CAN_BUS_RX_BACKPRESSURE // keeps fragment trains whole
 #endif
 
-#ifndef CAN_BUS_REASM_MAX_FRAGS
-#define CAN_BUS_REASM_MAX_FRAGS 64
+// Cursors besides the router's (can_bus_rx_reader_open()), per instance.
+#ifndef CAN_BUS_RX_READERS
+#define CAN_BUS_RX_READERS 2u
 #endif
 
 typedef struct {
-  uint8_t active;
-  uint32_t std_id; // which CAN ID this slot is for
-  uint8_t seq;
-  uint8_t frag_cnt;
-  uint16_t total_len;
-  uint8_t data_cap; // payload bytes per frag (wire_len - hdr)
-  uint32_t last_tick_ms;
-  uint64_t got_mask[(CAN_BUS_REASM_MAX_FRAGS + 63) / 64];
-  uint16_t got_count;
-  uint8_t buf[CAN_BUS_REASM_MAX_BYTES];
-} can_bus_reasm_slot_t;
-
-static can_bus_reasm_slot_t g_reasm[CAN_BUS_REASM_SLOTS];
-
-static void reasm_reset(can_bus_reasm_slot_t *s) {
-  s->active = 0;
-  s->std_id = 0;
-  s->seq = 0;
-  s->frag_cnt = 0;
-  s->total_len = 0;
-  s->data_cap = 0;
-  s->last_tick_ms = 0;
-  s->got_count = 0;
-  memset(s->got_mask, 0, sizeof(s->got_mask));
-}
-
-static can_bus_reasm_slot_t *reasm_get_slot(uint32_t std_id, uint8_t seq,
-                                            uint32_t now_ms) {
-  // First try to find existing active slot for std_id
-  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
-    if (g_reasm[i].active && g_reasm[i].std_id == std_id) {
-      // If sequence changed, drop partial and reuse slot
-      if (g_reasm[i].seq != seq) {
-        reasm_reset(&g_reasm[i]);
-      }
-      g_reasm[i].last_tick_ms = now_ms;
-      return &g_reasm[i];
-    }
-  }
+  uint32_t id;    // 11-bit standard ID, or extended ID | CAN_BUS_ID_XTD
+  uint32_t ts;    // start-of-frame timestamp, extended ticks (low 32 bits)
+  uint8_t len;    // payload bytes (0..64), or CAN_BUS_RX_PAD
+  uint8_t flags;  // CAN_BUS_RAW_FD / CAN_BUS_RAW_BRS
+  uint8_t rsvd[2];
+  uint8_t data[]; // word aligned: the ISR copies from message RAM 4B at a time
+} can_bus_rx_frame_t;
 
-  // Find a free slot
-  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
-    if (!g_reasm[i].active) {
-      reasm_reset(&g_reasm[i]);
-      g_reasm[i].active = 1;
-      g_reasm[i].std_id = std_id;
-      g_reasm[i].seq = seq;
-      g_reasm[i].last_tick_ms = now_ms;
-      return &g_reasm[i];
-    }
-  }
+#define CAN_BUS_RX_PAD 0xFFu // rest of the buffer is unused, skip to start
+#define CAN_BUS_RX_HDR ((uint32_t)sizeof(can_bus_rx_frame_t))
+#define CAN_BUS_RX_REC_MAX (CAN_BUS_RX_HDR + 64u)
 
-  // No free slot: drop the stalest slot (oldest last_tick_ms)
-  unsigned stalest = 0;
-  uint32_t best_age = 0;
-  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
-    uint32_t age = (uint32_t)(now_ms - g_reasm[i].last_tick_ms);
-    if (age >= best_age) {
-      best_age = age;
-      stalest = i;
-    }
-  }
-  reasm_reset(&g_reasm[stalest]);
-  g_reasm[stalest].active = 1;
-  g_reasm[stalest].std_id = std_id;
-  g_reasm[stalest].seq = seq;
-  g_reasm[stalest].last_tick_ms = now_ms;
-  return &g_reasm[stalest];
+_Static_assert(CAN_BUS_RX_HDR % 4u == 0, "records must stay word aligned");
+_Static_assert((CAN_BUS_RX_RING_BYTES & (CAN_BUS_RX_RING_BYTES - 1u)) == 0 &&
+                   (CAN_BUS_RX_HI_RING_BYTES & (CAN_BUS_RX_HI_RING_BYTES - 1u)) == 0,
+               "RX ring sizes must be powers of two");
+_Static_assert(CAN_BUS_RX_HI_RING_BYTES >= 2u * CAN_BUS_RX_REC_MAX &&
+                   CAN_BUS_RX_RING_BYTES >= 2u * CAN_BUS_RX_REC_MAX,
+               "RX rings must hold at least two full FD frames");
+
+struct can_bus_rx_ring {
+  volatile uint32_t head; // producer byte count
+  volatile uint32_t tail; // released by the consumer
+  uint32_t rd; // consumer read position; runs ahead of tail while batching
+  uint32_t mask; // size - 1
+  uint8_t *buf;
+  uint8_t policy;           // CAN_BUS_RX_DROP_NEWEST / _OLDEST / _BACKPRESSURE
+  volatile uint8_t stalled; // producer left frames in the hardware FIFO
+  volatile uint32_t flush_gen; // DROP_OLDEST: bumped after flush_pos is set
+  volatile uint32_t flush_pos; // head when the ring last overflowed
+  uint32_t seen_gen;           // consumer's copy of flush_gen
+  // Statistics. Producer-owned except `flushed`.
+  volatile uint32_t frames;     // frames stored
+  volatile uint32_t dropped;    // frames lost because the ring was full
+  volatile uint32_t stalls;     // times the drain stopped for backpressure
+  volatile uint32_t high_water; // most bytes in use (head - tail)
+  uint32_t flushed;             // unread frames discarded by DROP_OLDEST
+};
+
+// In CCM SRAM with the ISR that fills them (see mem_sections.h).
+static CCM_NOINIT uint8_t
+    g_rx_buf_hi[CAN_BUS_INSTANCES][CAN_BUS_RX_HI_RING_BYTES]
+    __attribute__((aligned(4)));
+static CCM_NOINIT uint8_t g_rx_buf_lo[CAN_BUS_INSTANCES][CAN_BUS_RX_RING_BYTES]
+    __attribute__((aligned(4)));
+
+// Per instance, indexed by hardware FIFO: [0] = FIFO0 (high priority),
+// [1] = FIFO1 (bulk).
+static can_bus_rx_ring_t g_rx_rings[CAN_BUS_INSTANCES][2];
+
+// Re-run a FIFO drain (ISR dispatch).
+static void rx_request(can_bus_t *b, unsigned fifo);
+
+static inline uint32_t rb_rec_bytes(uint8_t len) {
+  return CAN_BUS_RX_HDR + (((uint32_t)len + 3u) & ~3u);
 }
 
-static inline int bit_test(uint64_t *mask, uint16_t idx) {
-  uint16_t w = (uint16_t)(idx / 64);
-  uint16_t b = (uint16_t)(idx % 64);
-  return (mask[w] >> b) & 1u;
+static inline can_bus_rx_frame_t *rb_at(const can_bus_rx_ring_t *r,
+                                        uint32_t pos) {
+  return (can_bus_rx_frame_t *)(void *)&r->buf[pos & r->mask];
 }
 
-static inline void bit_set(uint64_t *mask, uint16_t idx) {
-  uint16_t w = (uint16_t)(idx / 64);
-  uint16_t b = (uint16_t)(idx % 64);
-  mask[w] |= (1ull << b);
+// Bytes from pos to the end of the buffer if a record can't start there,
+// else 0. Producer and consumer agree on where the skips are.
+static inline uint32_t rb_skip_at(const can_bus_rx_ring_t *r, uint32_t pos) {
+  const uint32_t left = r->mask + 1u - (pos & r->mask);
+  if (left < CAN_BUS_RX_HDR || rb_at(r, pos)->len == CAN_BUS_RX_PAD)
+    return left;
+  return 0;
 }
 
-static void reasm_expire_old(uint32_t now_ms) {
-  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
-    if (!g_reasm[i].active)
-      continue;
-    if ((uint32_t)(now_ms - g_reasm[i].last_tick_ms) >
-        CAN_BUS_REASM_TIMEOUT_MS) {
-      reasm_reset(&g_reasm[i]);
+// Push frame from ISR, copying the payload as whole words straight from an
+// FDCAN message RAM element. Bytes below tail may be in use by a subscriber
+// (see rb_peek()), so on overflow the producer applies the ring's policy
+// instead of touching tail. Returns 0 only for BACKPRESSURE: leave the
+// element in the hardware FIFO and stop draining.
+//
+// Memory ordering:
+//  - We must ensure record writes are visible before publishing head.
+//  - `__DMB()` acts as a release barrier here.
+static inline int rb_push_words(can_bus_rx_ring_t *r, uint32_t id,
+                                 uint32_t ts, const volatile uint32_t *src,
+                                 uint8_t len, uint8_t flags) {
+  PROF_START(push);
+  DBG_MARK_HI(RB_PUSH);
+  if (len > 64)
+    len = 64;
+
+  uint32_t h = r->head;
+  const uint32_t need = rb_rec_bytes(len);
+  const uint32_t left = r->mask + 1u - (h & r->mask);
+  const uint32_t skip = (left < need) ? left : 0u;
+  if (r->mask + 1u - (h - r->tail) < skip + need) {
+    PROF_STOP(push, PROF_CAN_RB_PUSH);
+    DBG_MARK_LO(RB_PUSH);
+    if (r->policy == CAN_BUS_RX_BACKPRESSURE) {
+      if (!r->stalled)
+        r->stalls++;
+      r->stalled = 1;
+      return 0;
     }
+    r->dropped++;
+    if (r->policy == CAN_BUS_RX_DROP_OLDEST) {
+      r->flush_pos = h;
+      __DMB(); // position before generation (release)
+      r->flush_gen++;
+    }
+    return 1;
+  }
+  if (skip) {
+    if (skip >= CAN_BUS_RX_HDR)
+      rb_at(r, h)->len = CAN_BUS_RX_PAD;
+    h += skip;
   }
-}
 
-// Handle one RX frame (thread context)
-static void handle_rx_frame(const can_bus_rx_frame_t *f, uint32_t now_ms) {
-  // Check if this is a fragment frame
-  if (f->len >= sizeof(can_bus_frag_hdr_t)) {
-    can_bus_frag_hdr_t hdr;
-    memcpy(&hdr, f->data, sizeof(hdr));
-
-    if (hdr.magic == CAN_BUS_FRAG_MAGIC) {
-      // Validate header fields
-      if (hdr.frag_cnt == 0)
-        return;
-      if (hdr.frag_idx >= hdr.frag_cnt)
-        return;
-      if (hdr.frag_cnt > CAN_BUS_REASM_MAX_FRAGS)
-        return;
-      if (hdr.total_len == 0)
-        return;
-      if (hdr.total_len > CAN_BUS_REASM_MAX_BYTES)
-        return;
+  can_bus_rx_frame_t *rec = rb_at(r, h);
+  rec->id = id;
+  rec->ts = ts;
+  rec->len = len;
+  rec->flags = flags;
+  uint32_t *dst = (uint32_t *)(void *)rec->data;
+  const unsigned words = (len + 3u) / 4u;
+  for (unsigned i = 0; i < words; i++) {
+    dst[i] = src[i];
+  }
 
-      const uint8_t *payload = f->data + sizeof(hdr);
-      const uint8_t payload_len = (uint8_t)(f->len - sizeof(hdr));
-
-      // We expect fixed 64B wire frames for frags by default.
-      // But tolerate smaller frames as long as consistent.
-      can_bus_reasm_slot_t *s = reasm_get_slot(f->std_id, hdr.seq, now_ms);
-
-      // If slot was newly created (or reset), initialize message params
-      if (s->frag_cnt == 0) {
-        s->frag_cnt = hdr.frag_cnt;
-        s->total_len = hdr.total_len;
-        s->data_cap =
-            payload_len; // data bytes available in each fragment frame
-        s->got_count = 0;
-        memset(s->got_mask, 0, sizeof(s->got_mask));
-      } else {
-        // Must match the in-flight message properties
-        if (s->frag_cnt != hdr.frag_cnt) {
-          reasm_reset(s);
-          return;
-        }
-        if (s->total_len != hdr.total_len) {
-          reasm_reset(s);
-          return;
-        }
-        // If payload_len changes, we tolerate it (often last frame is shorter),
-        // but offset math uses s->data_cap established at first fragment.
-      }
+  __DMB(); // publish record before updating head (release)
+  r->head = h + need;
+  r->frames++;
+  const uint32_t used = h + need - r->tail;
+  if (used > r->high_water)
+    r->high_water = used;
+  PROF_STOP(push, PROF_CAN_RB_PUSH);
+  DBG_MARK_LO(RB_PUSH);
+  return 1;
+}
 
-      // Compute where this fragment’s payload should land
-      uint32_t off = (uint32_t)hdr.frag_idx * (uint32_t)s->data_cap;
-      if (off >= s->total_len)
-        return;
+// DROP_OLDEST: skip everything that was unread when the ring overflowed.
+// rd may already be past flush_pos if the frames were read meanwhile.
+static void rb_skip_flushed(can_bus_rx_ring_t *r) {
+  r->seen_gen = r->flush_gen;
+  __DMB(); // generation before position (acquire)
+  const uint32_t to = r->flush_pos;
+  while ((int32_t)(to - r->rd) > 0) {
+    r->rd += rb_skip_at(r, r->rd);
+    if ((int32_t)(to - r->rd) <= 0)
+      break;
+    r->rd += rb_rec_bytes(rb_at(r, r->rd)->len);
+    r->flushed++;
+  }
+}
 
-      uint32_t take = payload_len;
-      if (off + take > s->total_len)
-        take = (uint32_t)s->total_len - off;
+// Peek at the oldest unread frame in thread context without copying it. The
+// record stays owned by the consumer until rb_release().
+//
+// Memory ordering:
+//  - After observing head != rd, we must ensure subsequent reads of the
+//    record see the writes that happened-before the producer published head.
+//  - `__DMB()` acts as an acquire barrier here.
+static inline const can_bus_rx_frame_t *rb_peek(can_bus_rx_ring_t *r) {
+  if (r->flush_gen != r->seen_gen)
+    rb_skip_flushed(r);
+  if (r->head == r->rd)
+    return NULL;
 
-      // Mark + copy if not already received
-      if (!bit_test(s->got_mask, hdr.frag_idx)) {
-        bit_set(s->got_mask, hdr.frag_idx);
-        s->got_count++;
-        memcpy(&s->buf[off], payload, take);
-      }
+  __DMB(); // ensure record contents are visible after seeing head advance
+           // (acquire)
 
-      s->last_tick_ms = now_ms;
+  // A skip is always published together with the record after it.
+  r->rd += rb_skip_at(r, r->rd);
+  return rb_at(r, r->rd);
+}
 
-      // Complete?
-      if (s->got_count == s->frag_cnt) {
-        can_bus_notify_rx(s->buf, s->total_len);
-        reasm_reset(s);
-      }
+// Step past the record returned by rb_peek(); it stays readable.
+static inline void rb_advance(can_bus_rx_ring_t *r) {
+  r->rd += rb_rec_bytes(rb_at(r, r->rd)->len);
+}
 
-      return;
-    }
+// Hand every record already read back to the producer, and restart a
+// drain that stopped for backpressure now that there is room.
+static inline void rb_release(can_bus_t *b, can_bus_rx_ring_t *r) {
+  __DMB(); // ensure record reads complete before we advance tail (release)
+  r->tail = r->rd;
+  if (r->stalled) {
+    r->stalled = 0;
+    rx_request(b, (unsigned)(r - b->rx_ring));
   }
-
-  // Not a fragment frame: deliver raw CAN payload
-  can_bus_notify_rx(f->data, f->len);
 }
 
 // =========================
-// Public API
+// Broadcast readers
 // =========================
+//
+// Other consumers of every frame (capture, black box, host bridging) read
+// the same rings through cursors of their own, so the ISR still writes each
+// frame once. The producer only ever respects tail, the router's cursor: a
+// reader can't hold anything back, and one that falls a whole ring behind
+// finds its records overwritten instead.
+//
+// A reader copies each record out and only then checks it: the ISR writes
+// position p + size (over p's bytes) only after head has passed it, and runs
+// to completion before the reader resumes, so the copy is good while
+// head - p <= size. A reader that fails the check has overrun; it restarts
+// at tail, whose records the ISR can't touch, and counts the frames in
+// between as lost by numbering records with the ring's `frames` counter.
 
-void can_bus_init(FDCAN_HandleTypeDef *hfdcan) {
-  g_hfdcan = hfdcan;
-  // subscribers static-zeroed
-  HAL_FDCAN_ActivateNotification(hfdcan, FDCAN_IT_RX_FIFO1_NEW_MESSAGE, 0);
-  HAL_FDCAN_Start(hfdcan);
+struct can_bus_rx_reader {
+  can_bus_rx_tap_cb_t volatile cb; // NULL = free
+  void *user;
+  uint32_t pos[2]; // next record per ring, as a byte counter
+  uint32_t seq[2]; // ring frame count at pos (frames before it)
+  can_bus_rx_reader_stats_t st;
+};
 
-  // reset rings + reasm
-  g_rx_head = 0;
-  g_rx_tail = 0;
-  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
-    reasm_reset(&g_reasm[i]);
-  }
+static can_bus_rx_reader_t g_rx_readers[CAN_BUS_INSTANCES][CAN_BUS_RX_READERS];
+static can_bus_route_tab_t g_route_tabs[CAN_BUS_INSTANCES][2];
+
+static inline int reader_intact(const can_bus_rx_ring_t *r, uint32_t pos) {
+  return r->head - pos <= r->mask + 1u;
 }
 
-HAL_StatusTypeDef can_bus_subscribe_rx(can_bus_rx_cb_t cb, void *user) {
-  if (!cb)
-    return HAL_ERROR;
+// Move the reader to tail after an overrun.
+static void reader_resync(can_bus_rx_ring_t *r, can_bus_rx_reader_t *c,
+                          unsigned fifo) {
+  for (;;) {
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const uint32_t tail = r->tail;
+    const uint32_t head = r->head;
+    const uint32_t frames = r->frames;
+    __set_PRIMASK(primask);
 
-  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
-    if (g_subs[i].cb == cb && g_subs[i].user == user)
-      return HAL_ERROR;
-  }
-  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
-    if (g_subs[i].cb == NULL) {
-      g_subs[i].cb = cb;
-      g_subs[i].user = user;
-      return HAL_OK;
+    // Records still held from tail on; the router may release them while
+    // they are counted, hence the same check as a read.
+    uint32_t n = 0;
+    uint32_t p = tail;
+    while ((int32_t)(head - p) > 0) {
+      p += rb_skip_at(r, p);
+      if ((int32_t)(head - p) <= 0)
+        break;
+      p += rb_rec_bytes(rb_at(r, p)->len);
+      n++;
     }
-  }
+    __DMB();
+    if (p == head && reader_intact(r, tail)) {
+      c->st.lost += (frames - n) - c->seq[fifo];
+      c->st.overruns++;
+      c->pos[fifo] = tail;
+      c->seq[fifo] = frames - n;
+      return;
+    }
+  }
+}
+
+// Hand the reader's next frame on `fifo` to its callback; 0 once it has
+// caught up with head.
+static int reader_next(can_bus_t *b, can_bus_rx_reader_t *c, unsigned fifo) {
+  can_bus_rx_ring_t *r = &b->rx_ring[fifo];
+  uint32_t data[16];
+  for (;;) {
+    const uint32_t at = c->pos[fifo];
+    if (r->head == at)
+      return 0;
+    __DMB(); // record contents after head (acquire)
+    if (!reader_intact(r, at)) {
+      reader_resync(r, c, fifo);
+      continue;
+    }
+    const uint32_t p = at + rb_skip_at(r, at);
+    const can_bus_rx_frame_t *f = rb_at(r, p);
+    const uint32_t id = f->id;
+    const uint32_t ts = f->ts;
+    const uint8_t flags = f->flags;
+    uint8_t len = f->len;
+    if (len > 64u)
+      len = 64u; // torn; the check below throws it away
+    memcpy(data, f->data, len);
+    __DMB(); // copy before the check
+    if (!reader_intact(r, at)) {
+      reader_resync(r, c, fifo);
+      continue;
+    }
+
+    c->pos[fifo] = p + rb_rec_bytes(len);
+    c->seq[fifo]++;
+    c->st.frames++;
+    const can_bus_rx_tap_cb_t cb = c->cb;
+    if (cb)
+      cb(id & CAN_BUS_ID_EXT_Msk,
+         (uint8_t)(flags | ((id & CAN_BUS_ID_XTD) ? CAN_BUS_RAW_EXT : 0u)),
+         (const uint8_t *)data, len, ts_widen_us(b, ts), c->user);
+    return 1;
+  }
+}
+
+// =========================
+// TX ring buffer (thread -> ISR)
+// =========================
+//
+// The FDCAN TX FIFO is only 3 elements deep, so a fragmented message is
+// queued here in full and the TX-complete interrupt tops the hardware FIFO
+// back up as each element goes out on the wire.
+//
+// One ring per priority class. The pump always feeds the hardware from the
+// highest non-empty class its shaper lets through (see TX shaping), and
+// bulk frames never take the last CAN_BUS_TX_HW_RESERVE hardware slots, so
+// a time-sync frame queued behind a long dump waits for at most the bulk
+// frames already in the controller.
+// Give higher classes lower CAN IDs and the bus arbitrates the same way.
+//
+// Within the bulk class a long train (a 2 KB packet is ~36 fragments)
+// would hold up everything queued after it. Receivers reassemble by
+// (std_id, seq), so trains may interleave at fragment granularity: while
+// bulk frames are waiting, a short message (up to CAN_BUS_TX_EXPRESS_FRAGS
+// fragments, so every single-frame one) or one on a lower ID than the
+// train at the head of the ring, which would win arbitration against it,
+// goes into the class's express lane instead. The pump takes the lane
+// first, at the next fragment boundary, but lets a ring frame through
+// after CAN_BUS_TX_EXPRESS_BURST lane frames in a row so the train still
+// moves. Messages keep their order within the lane and within the ring.
+
+#ifndef CAN_BUS_TX_EXPRESS_DEPTH
+#define CAN_BUS_TX_EXPRESS_DEPTH 16 // 0 = no express lane
+#endif
+
+#ifndef CAN_BUS_TX_EXPRESS_FRAGS
+#define CAN_BUS_TX_EXPRESS_FRAGS 2u
+#endif
+
+#ifndef CAN_BUS_TX_EXPRESS_BURST
+#define CAN_BUS_TX_EXPRESS_BURST 8u
+#endif
+
+#ifndef CAN_BUS_TX_RING_DEPTH
+#define CAN_BUS_TX_RING_DEPTH 64 // bulk class
+#endif
+
+#ifndef CAN_BUS_TX_HI_RING_DEPTH
+#define CAN_BUS_TX_HI_RING_DEPTH 8
+#endif
+
+#ifndef CAN_BUS_TX_MID_RING_DEPTH
+#define CAN_BUS_TX_MID_RING_DEPTH 16
+#endif
+
+#ifndef CAN_BUS_TX_HW_RESERVE
+#define CAN_BUS_TX_HW_RESERVE 1u // of 3 hardware FIFO elements
+#endif
+
+// Leave bus-off on our own: clearing INIT starts the 128 x 11 recessive
+// bits recovery, after which the controller rejoins the bus. The first
+// bus-off waits CAN_BUS_BUSOFF_MIN_MS (0: none), each one following within
+// CAN_BUS_BUSOFF_STABLE_MS of the last rejoin twice as long, up to
+// CAN_BUS_BUSOFF_MAX_MS; see can_bus_set_busoff_backoff().
+#ifndef CAN_BUS_BUSOFF_RECOVER
+#define CAN_BUS_BUSOFF_RECOVER 1
+#endif
+#ifndef CAN_BUS_BUSOFF_MIN_MS
+#define CAN_BUS_BUSOFF_MIN_MS 0u
+#endif
+#ifndef CAN_BUS_BUSOFF_MAX_MS
+#define CAN_BUS_BUSOFF_MAX_MS 200u
+#endif
+#ifndef CAN_BUS_BUSOFF_STABLE_MS
+#define CAN_BUS_BUSOFF_STABLE_MS 1000u
+#endif
+
+struct can_bus_tx_frame {
+  uint32_t id;     // 11-bit standard ID, or extended ID | CAN_BUS_ID_XTD
+  uint8_t len;     // wire bytes, already rounded up to a valid FD length
+  uint8_t marker;  // non-zero: log a TX event (timestamp) for this frame
+  uint8_t ref;     // non-zero: async slot + 1, data holds a can_bus_tx_ref_t
+  uint8_t rsvd;
+  uint8_t data[64]; // word aligned: copied to message RAM 4B at a time
+};
+
+_Static_assert(offsetof(can_bus_tx_frame_t, data) % 4u == 0,
+               "TX payload must be word aligned");
+
+struct can_bus_tx_ring {
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  uint16_t depth;
+  can_bus_tx_frame_t *slots;
+};
+
+static can_bus_tx_frame_t
+    g_tx_slots_hi[CAN_BUS_INSTANCES][CAN_BUS_TX_HI_RING_DEPTH];
+static can_bus_tx_frame_t
+    g_tx_slots_mid[CAN_BUS_INSTANCES][CAN_BUS_TX_MID_RING_DEPTH];
+static can_bus_tx_frame_t
+    g_tx_slots_lo[CAN_BUS_INSTANCES][CAN_BUS_TX_RING_DEPTH];
+
+// Per instance, indexed by can_bus_tx_prio_t.
+static can_bus_tx_ring_t g_tx_rings[CAN_BUS_INSTANCES][CAN_BUS_TX_PRIO_COUNT];
+
+#if CAN_BUS_TX_EXPRESS_DEPTH
+static can_bus_tx_frame_t
+    g_tx_slots_x[CAN_BUS_INSTANCES][CAN_BUS_TX_EXPRESS_DEPTH];
+static can_bus_tx_ring_t g_tx_express[CAN_BUS_INSTANCES];
+#endif
+
+// Pre-loaded frames (can_bus_tx_preload()).
+_Static_assert(CAN_BUS_TX_PRELOAD_SLOTS <= 8u, "preload_set is 8 bits");
+static can_bus_tx_frame_t
+    g_preload[CAN_BUS_INSTANCES][CAN_BUS_TX_PRELOAD_SLOTS];
+
+// Cyclic frames (can_bus_cyclic_add()).
+#if CAN_BUS_CYCLIC_SLOTS
+struct can_bus_cyclic {
+  const void *data; // caller's payload, read at every send
+  uint8_t len;
+  uint8_t used;
+  uint32_t period_us;
+  uint64_t next_us;
+  uint32_t sent;
+  uint32_t skipped;
+  uint32_t late_max_us; // due time to hardware FIFO
+  can_bus_tx_frame_t img;
+};
+
+static can_bus_cyclic_t g_cyclic_tabs[CAN_BUS_INSTANCES][CAN_BUS_CYCLIC_SLOTS];
+#endif
+
+static inline uint16_t tx_rb_next(const can_bus_tx_ring_t *r, uint16_t v) {
+  v++;
+  if (v >= r->depth)
+    v = 0;
+  return v;
+}
+
+static inline size_t tx_rb_free(const can_bus_tx_ring_t *r) {
+  uint16_t h = r->head;
+  uint16_t t = r->tail;
+  size_t used = (h >= t) ? (size_t)(h - t) : (size_t)(r->depth - t + h);
+  return (size_t)(r->depth - 1) - used;
+}
+
+// Write one frame into the slot at head `h` (not yet published).
+static inline void tx_rb_fill(can_bus_tx_ring_t *r, uint16_t h, uint32_t id,
+                              const uint8_t *bytes, size_t len) {
+  size_t wire_len = can_bus_round_up_fd_len(len);
+  can_bus_tx_frame_t *f = &r->slots[h];
+  f->id = (id & CAN_BUS_ID_XTD) ? (id & (CAN_BUS_ID_XTD | CAN_BUS_ID_EXT_Msk))
+                                : (id & (CAN_BUS_ID_CLASSIC | 0x7FFu));
+  f->len = (uint8_t)wire_len;
+  f->marker = 0;
+  f->ref = 0;
+  memcpy(f->data, bytes, len);
+  if (wire_len > len)
+    memset(f->data + len, 0, wire_len - len);
+}
+
+// Frame timing, for the shaper, the TX windows and the bus monitor.
+#define CAN_BUS_TX_HW_DEPTH 3u // hardware TX FIFO elements
+// Bit times come from b->nom_bit_ns / data_bit_ns, the rates in use.
+
+// Wire bits of one frame: arbitration, control and trailer in *nom, data
+// field and CRC in *data, which is at the data rate when `brs` (else 0, all
+// nominal). Stuff bits are taken as one in eight.
+static CCM_FUNC void frame_bits(uint32_t xtd, uint32_t brs, uint8_t len,
+                                uint32_t *nom, uint32_t *data) {
+  uint32_t n = xtd ? 64u : 44u;
+  uint32_t d = 8u * len + ((len > 16u) ? 26u : 22u);
+  if (!brs) {
+    n += d;
+    d = 0;
+  }
+  *nom = n + n / 8u;
+  *data = d + d / 8u;
+}
+
+// Bus time of frame (id, len) sent by this controller.
+static CCM_FUNC uint32_t frame_ns(const can_bus_t *b, uint32_t id,
+                                  uint8_t len, uint32_t *bits) {
+  uint32_t nom, data;
+  frame_bits(id & CAN_BUS_ID_XTD, !(id & CAN_BUS_ID_CLASSIC) && b->brs, len,
+             &nom, &data);
+  if (bits)
+    *bits = nom + data;
+  return nom * b->nom_bit_ns + data * b->data_bit_ns;
+}
+
+// Frames are written to the hardware TX FIFO directly rather than through
+// HAL_FDCAN_AddMessageToTxFifoQ(), which assembles every payload word from
+// bytes: the header is two words built with shifts and the payload is copied
+// as words (from a ring slot, or gathered straight from the caller's
+// segments by can_bus_sendv_prio()). Callers have IRQs masked.
+
+// TX element layout (RM0440, "Tx buffer element"); same size as RX.
+#define CAN_BUS_MRAM_TX_ELEMENT_BYTES (18u * 4u)
+#define CAN_BUS_MRAM_T0_XTD (1u << 30)
+#define CAN_BUS_MRAM_T0_STDID_Pos 18u
+#define CAN_BUS_MRAM_T1_MM_Pos 24u
+#define CAN_BUS_MRAM_T1_EFC (1u << 23)
+#define CAN_BUS_MRAM_T1_FDF (1u << 21)
+#define CAN_BUS_MRAM_T1_BRS (1u << 20)
+#define CAN_BUS_MRAM_T1_DLC_Pos 16u
+
+// Next free hardware TX FIFO element, or NULL if the FIFO is full or the
+// controller isn't running.
+static CCM_FUNC volatile uint32_t *tx_hw_element(can_bus_t *b, uint32_t *put) {
+  if (b->hfdcan->State != HAL_FDCAN_STATE_BUSY)
+    return NULL;
+  const uint32_t txfqs = b->hfdcan->Instance->TXFQS;
+  if (txfqs & FDCAN_TXFQS_TFQF)
+    return NULL;
+  *put = (txfqs & FDCAN_TXFQS_TFQPI) >> FDCAN_TXFQS_TFQPI_Pos;
+  return (volatile uint32_t *)(b->hfdcan->msgRam.TxFIFOQSA +
+                               *put * CAN_BUS_MRAM_TX_ELEMENT_BYTES);
+}
+
+#if CAN_BUS_TX_EVENTS
+// Start the record of a frame going into element `put`; returns its marker.
+static CCM_FUNC uint8_t tx_rec_new(can_bus_t *b, uint32_t put, uint8_t stamp,
+                                   uint8_t tries) {
+  const uint8_t mm = (uint8_t)((b->tx_mm++ & CAN_BUS_TX_MM_SEQ) |
+                               (stamp ? CAN_BUS_TX_MM_STAMP : 0u));
+  can_bus_tx_rec_t *r = &b->tx_rec[mm % CAN_BUS_TX_RECS];
+  r->ts = (uint16_t)(b->hfdcan->Instance->TSCV & FDCAN_TSCV_TSC);
+  r->tries = tries;
+  b->tx_elem_mm[put] = mm;
+  return mm;
+}
+#endif
+
+#if CAN_BUS_ASYNC_SLOTS
+// A queued fragment of an async message (see "Async sends"): its header,
+// and where its share sits in the caller's buffer, which is read when the
+// frame goes into the hardware FIFO.
+typedef struct {
+  uint16_t off;
+  uint8_t take;
+  uint8_t pos; // header bytes
+  uint8_t hdr[8];
+} can_bus_tx_ref_t;
+
+_Static_assert(sizeof(can_bus_tx_ref_t) <= 64u, "ref fits a slot");
+
+struct can_bus_async {
+  const uint8_t *buf;
+  can_bus_tx_done_cb_t done; // NULL: slot free
+  void *user;
+  uint16_t pending;  // fragments not yet off the hardware FIFO
+  uint8_t failed;    // one of them didn't make it
+  uint8_t finished;  // pending reached 0, callback not run yet
+};
+
+static can_bus_async_t g_async[CAN_BUS_INSTANCES][CAN_BUS_ASYNC_SLOTS];
+
+// The frame in element `elem` is off the FIFO (`ok`: sent); count it off
+// its async message, if it has one. IRQs masked.
+static CCM_FUNC void async_elem_end(can_bus_t *b, uint32_t elem, int ok) {
+  const uint8_t tag = b->tx_elem_async[elem];
+  if (!tag)
+    return;
+  b->tx_elem_async[elem] = 0;
+  can_bus_async_t *a = &b->async[tag - 1u];
+  if (!ok)
+    a->failed = 1;
+  if (a->pending && --a->pending == 0)
+    a->finished = 1;
+}
+#endif
+
+// Write the header of element `put` (payload already in place) and request
+// its transmission.
+static CCM_FUNC void tx_hw_commit(can_bus_t *b, volatile uint32_t *e,
+                                  uint32_t put, uint32_t id, uint8_t len,
+                                  uint8_t marker) {
+#if CAN_BUS_ASYNC_SLOTS
+  // A free element's last frame is done; if the pump got here before that
+  // frame's completion interrupt, count it now. Async senders tag the new
+  // frame after this.
+  async_elem_end(b, put, 1);
+#endif
+  e[0] = (id & CAN_BUS_ID_XTD)
+             ? (id & CAN_BUS_ID_EXT_Msk) | CAN_BUS_MRAM_T0_XTD
+             : (id & 0x7FFu) << CAN_BUS_MRAM_T0_STDID_Pos;
+  const uint32_t fd =
+      (id & CAN_BUS_ID_CLASSIC)
+          ? 0u
+          : CAN_BUS_MRAM_T1_FDF | (b->brs ? CAN_BUS_MRAM_T1_BRS : 0u);
+#if CAN_BUS_TX_EVENTS
+  e[1] = ((uint32_t)tx_rec_new(b, put, marker, 0) << CAN_BUS_MRAM_T1_MM_Pos) |
+         CAN_BUS_MRAM_T1_EFC | fd |
+         (can_bus_len_to_dlc(len) << CAN_BUS_MRAM_T1_DLC_Pos);
+#else
+  e[1] = ((uint32_t)marker << CAN_BUS_MRAM_T1_MM_Pos) |
+         (marker ? CAN_BUS_MRAM_T1_EFC : 0u) | fd |
+         (can_bus_len_to_dlc(len) << CAN_BUS_MRAM_T1_DLC_Pos);
+#endif
+  uint32_t bits;
+  b->tx_elem_ns[put] = frame_ns(b, id, len, &bits);
+  b->tx_elem_bits[put] = (uint16_t)bits;
+  b->hfdcan->Instance->TXBAR = 1u << put;
+  b->hfdcan->LatestTxFifoQRequest = 1u << put;
+  boot_time_mark(BOOT_CAN_TX);
+
+  const can_bus_rx_tap_cb_t cap = b->capture;
+  if (cap) {
+    uint32_t words[16];
+    for (unsigned i = 0; i < (len + 3u) / 4u; i++)
+      words[i] = e[2 + i];
+    const uint8_t flags =
+        CAN_BUS_RAW_TX | ((id & CAN_BUS_ID_XTD) ? CAN_BUS_RAW_EXT : 0u) |
+        (fd ? CAN_BUS_RAW_FD : 0u) | (b->brs && fd ? CAN_BUS_RAW_BRS : 0u);
+    cap(id & CAN_BUS_ID_EXT_Msk, flags, (const uint8_t *)words, len,
+        ts_ticks_to_us(b, ts_now_ticks(b)), b->capture_user);
+  }
+}
+
+// Read position in a caller's segment list.
+typedef struct {
+  const can_bus_iovec_t *iov;
+  size_t off;
+} can_bus_iov_cursor_t;
+
+static CCM_FUNC void frag_emit(volatile uint32_t *dst, const uint8_t *hdr,
+                               size_t hdr_len, can_bus_iov_cursor_t *c,
+                               size_t take, size_t wire);
+
+// Hand one queued frame to the hardware TX FIFO.
+static CCM_FUNC HAL_StatusTypeDef tx_hw_add(can_bus_t *b,
+                                            can_bus_tx_frame_t *f) {
+  uint32_t put;
+  volatile uint32_t *e = b->listen_only ? NULL : tx_hw_element(b, &put);
+  if (!e)
+    return HAL_ERROR;
+#if CAN_BUS_ASYNC_SLOTS
+  if (f->ref) {
+    can_bus_tx_ref_t rf;
+    memcpy(&rf, f->data, sizeof(rf));
+    const can_bus_iovec_t seg = {b->async[f->ref - 1u].buf + rf.off, rf.take};
+    can_bus_iov_cursor_t c = {&seg, 0};
+    frag_emit(&e[2], rf.hdr, rf.pos, &c, rf.take, f->len);
+    tx_hw_commit(b, e, put, f->id, f->len, f->marker);
+    b->tx_elem_async[put] = f->ref;
+    f->ref = 0; // the slot goes back to the ring
+    return HAL_OK;
+  }
+#endif
+  const uint32_t *src = (const uint32_t *)(const void *)f->data;
+  for (unsigned i = 0; i < (f->len + 3u) / 4u; i++) {
+    e[2 + i] = src[i];
+  }
+  tx_hw_commit(b, e, put, f->id, f->len, f->marker);
+  return HAL_OK;
+}
+
+// =========================
+// TX shaping and time-triggered windows
+// =========================
+//
+// Optional token bucket per class (can_bus_set_tx_shaping()), so a long
+// bulk dump takes a bounded share of the bus instead of all of it. A class
+// may start a frame while its bucket isn't empty, and each frame takes its
+// estimated bus time out of it; the bucket refills at the class's share of
+// wall time up to the burst size.
+//
+// Optionally (can_bus_set_tx_window()) some classes only start frames
+// inside a periodic window, so boards given disjoint windows on a common
+// clock don't arbitrate against each other. A frame is only released if it
+// and the frames already in the hardware FIFO fit before the window closes.
+//
+// While a class is held the others keep the hardware FIFO, and the
+// us_clock alarm restarts the pump when the class may go again: with the
+// FIFO idle no TX completion would. ISR forwarding and the responder are
+// neither shaped nor windowed.
+
+#ifndef CAN_BUS_TX_SHAPING
+#define CAN_BUS_TX_SHAPING 1
+#endif
+
+#ifndef CAN_BUS_TX_WINDOWS
+#define CAN_BUS_TX_WINDOWS 1
+#endif
+
+struct can_bus_shaper {
+  uint8_t share_pct; // of the bus, 0 = unshaped
+  int32_t tokens_ns; // may go negative by up to one frame
+  uint32_t burst_ns;
+  uint64_t last_us;
+};
+
+static can_bus_shaper_t g_shapers[CAN_BUS_INSTANCES][CAN_BUS_TX_PRIO_COUNT];
+
+static void alarm_arm(void);
+static void busoff_rejoin(can_bus_t *b);
+
+#if CAN_BUS_TX_SHAPING
+// Whether class `p` may start a frame at `now`; refills its bucket.
+static CCM_FUNC int shape_ok(can_bus_t *b, unsigned p, uint64_t now) {
+  can_bus_shaper_t *s = &b->shaper[p];
+  if (s->share_pct == 0)
+    return 1;
+  const uint64_t dt = now - s->last_us;
+  s->last_us = now;
+  // share_pct percent of dt microseconds, in nanoseconds.
+  const uint64_t add = (dt >= s->burst_ns / 10u + 1u)
+                           ? s->burst_ns
+                           : dt * 10u * s->share_pct;
+  int64_t t = (int64_t)s->tokens_ns + (int64_t)add;
+  if (t > (int64_t)s->burst_ns)
+    t = s->burst_ns;
+  s->tokens_ns = (int32_t)t;
+  return s->tokens_ns > 0;
+}
+
+static CCM_FUNC void shape_charge(can_bus_t *b, unsigned p, uint32_t id,
+                                  uint8_t len) {
+  can_bus_shaper_t *s = &b->shaper[p];
+  if (s->share_pct != 0)
+    s->tokens_ns -= (int32_t)frame_ns(b, id, len, NULL);
+}
+
+// Microseconds until a held class's bucket is positive again; 0 if it
+// isn't held.
+static CCM_FUNC uint64_t shape_wait(const can_bus_t *b, unsigned p) {
+  const can_bus_shaper_t *s = &b->shaper[p];
+  if (s->share_pct == 0 || s->tokens_ns > 0)
+    return 0;
+  return (uint64_t)(-(int64_t)s->tokens_ns) / (10u * s->share_pct) + 1u;
+}
+#else
+static inline int shape_ok(can_bus_t *b, unsigned p, uint64_t now) {
+  (void)b;
+  (void)p;
+  (void)now;
+  return 1;
+}
+
+static inline void shape_charge(can_bus_t *b, unsigned p, uint32_t id,
+                                uint8_t len) {
+  (void)b;
+  (void)p;
+  (void)id;
+  (void)len;
+}
+
+static inline uint64_t shape_wait(const can_bus_t *b, unsigned p) {
+  (void)b;
+  (void)p;
+  return 0;
+}
+#endif
+
+#if CAN_BUS_TX_WINDOWS
+// Nanoseconds since the start of the window cycle `now` falls in.
+static CCM_FUNC uint32_t window_phase(const can_bus_t *b, uint64_t now) {
+  const uint64_t cyc = b->win_cycle_ns;
+  if ((int64_t)(now - b->win_anchor_us) >= 0)
+    return (uint32_t)(((now - b->win_anchor_us) * 1000u) % cyc);
+  const uint32_t back =
+      (uint32_t)(((b->win_anchor_us - now) * 1000u) % cyc);
+  return back ? (uint32_t)(cyc - back) : 0u;
+}
+
+// Whether class `p` may start frame (id, len) at `now` with `hw_free`
+// hardware FIFO elements free.
+static CCM_FUNC int window_ok(const can_bus_t *b, unsigned p, uint64_t now,
+                              uint32_t id, uint8_t len, uint32_t hw_free) {
+  if (b->win_cycle_ns == 0 || !(b->win_classes & (1u << p)))
+    return 1;
+  const uint32_t phase = window_phase(b, now);
+  if (phase >= b->win_open_ns)
+    return 0;
+  const uint32_t ahead = CAN_BUS_TX_HW_DEPTH - hw_free + 1u;
+  return (uint64_t)frame_ns(b, id, len, NULL) * ahead <= b->win_open_ns - phase;
+}
+
+// Microseconds until the next window opens.
+static CCM_FUNC uint64_t window_wait(const can_bus_t *b, uint64_t now) {
+  return (b->win_cycle_ns - window_phase(b, now)) / 1000u + 1u;
+}
+#else
+static inline int window_ok(const can_bus_t *b, unsigned p, uint64_t now,
+                            uint32_t id, uint8_t len, uint32_t hw_free) {
+  (void)b;
+  (void)p;
+  (void)now;
+  (void)id;
+  (void)len;
+  (void)hw_free;
+  return 1;
+}
+
+static inline uint64_t window_wait(const can_bus_t *b, uint64_t now) {
+  (void)b;
+  (void)now;
+  return 0;
+}
+#endif
+
+// Ring class `p` sends from next: for bulk, the express lane while it has
+// frames, but the ring after CAN_BUS_TX_EXPRESS_BURST of them in a row.
+// NULL when the class has nothing queued.
+static CCM_FUNC can_bus_tx_ring_t *tx_class_ring(can_bus_t *b, unsigned p) {
+  can_bus_tx_ring_t *r = &b->tx_ring[p];
+  const int ring = r->tail != r->head;
+#if CAN_BUS_TX_EXPRESS_DEPTH
+  can_bus_tx_ring_t *x = b->tx_express;
+  if (p == CAN_BUS_TX_PRIO_LOW && x->tail != x->head &&
+      (!ring || b->express_run < CAN_BUS_TX_EXPRESS_BURST))
+    return x;
+#endif
+  return ring ? r : NULL;
+}
+
+// After a pump: arm the alarm for the first held class with frames queued.
+static CCM_FUNC void tx_hold_schedule(can_bus_t *b, uint64_t now) {
+  const uint32_t hw_free = HAL_FDCAN_GetTxFifoFreeLevel(b->hfdcan);
+  uint64_t wait = UINT64_MAX;
+  for (unsigned p = 0; p < CAN_BUS_TX_PRIO_COUNT; p++) {
+    const can_bus_tx_ring_t *r = tx_class_ring(b, p);
+    if (!r)
+      continue;
+    uint64_t w = shape_wait(b, p);
+    const can_bus_tx_frame_t *f = &r->slots[r->tail];
+    if (!window_ok(b, p, now, f->id, f->len, hw_free)) {
+      const uint64_t ww = window_wait(b, now);
+      if (ww > w)
+        w = ww;
+    }
+    if (w != 0 && w < wait)
+      wait = w;
+  }
+  if (wait == UINT64_MAX)
+    return;
+  b->shape_wake_us = now + wait;
+  b->shape_holds++;
+  alarm_arm();
+}
+
+static CCM_FUNC void cyclic_service(can_bus_t *b, uint64_t now);
+
+// Move queued frames into the hardware FIFO until either runs out, from
+// the highest class with a frame its shaper and window let through; due
+// cyclic frames go first. Caller must have IRQs masked (see the ISR
+// responder).
+static CCM_FUNC void tx_pump(can_bus_t *b) {
+  if (b->mon.state == CAN_BUS_STATE_BUS_OFF || b->listen_only ||
+      b->tx_draining)
+    return; // frames wait in the rings, in class order, for the rejoin
+  const uint64_t now = us_clock_now();
+  cyclic_service(b, now);
+  for (;;) {
+    const uint32_t hw_free = HAL_FDCAN_GetTxFifoFreeLevel(b->hfdcan);
+    if (hw_free == 0)
+      break;
+
+    unsigned p;
+    can_bus_tx_ring_t *r = NULL;
+    for (p = 0; p < CAN_BUS_TX_PRIO_COUNT; p++) {
+      const can_bus_tx_ring_t *q = r = tx_class_ring(b, p);
+      if (!q)
+        continue;
+      __DMB(); // see slot contents published before head (acquire)
+      const can_bus_tx_frame_t *f = &q->slots[q->tail];
+      if (shape_ok(b, p, now) &&
+          window_ok(b, p, now, f->id, f->len, hw_free))
+        break;
+    }
+    if (p == CAN_BUS_TX_PRIO_COUNT)
+      break;
+    if (p == CAN_BUS_TX_PRIO_LOW && hw_free <= CAN_BUS_TX_HW_RESERVE)
+      break; // keep room for a higher class; TX-complete resumes the pump
+    if (p == CAN_BUS_TX_PRIO_LOW && hw_free < CAN_BUS_TX_HW_DEPTH &&
+        b->mon.state == CAN_BUS_STATE_PASSIVE) {
+      b->mon.passive_holds++;
+      break; // error passive: one bulk frame on the wire at a time
+    }
+
+    uint16_t t = r->tail;
+
+    if (tx_hw_add(b, &r->slots[t]) != HAL_OK)
+      break;
+    shape_charge(b, p, r->slots[t].id, r->slots[t].len);
+#if CAN_BUS_TX_EXPRESS_DEPTH
+    if (p == CAN_BUS_TX_PRIO_LOW)
+      b->express_run = (r == b->tx_express) ? b->express_run + 1u : 0u;
+#endif
+
+    r->tail = tx_rb_next(r, t);
+  }
+  tx_hold_schedule(b, now);
+}
+
+// Run the pump with IRQs masked, from a thread or an ISR.
+static inline void tx_kick(can_bus_t *b) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  tx_pump(b);
+  __set_PRIMASK(primask);
+}
+
+// =========================
+// TX packing
+// =========================
+//
+// can_bus_send_packed_prio() collects small messages into one frame as
+// length-prefixed records behind a magic, so a burst of tiny packets pays
+// arbitration, CRC and interframe space once:
+//   [u16 CAN_BUS_PACK_MAGIC] { [u8 len 1..61] [len bytes] }... [0 / end]
+// One frame is open at a time per instance, for one (ID, class). It goes out
+// when the next record doesn't fit, when a message of its class is sent any
+// other way (order within a class is kept), or CAN_BUS_PACK_FLUSH_US after
+// its first record. That deadline is a us_clock alarm which only runs the pack
+// notify hook: the flush itself happens in can_bus_process_rx(), on the
+// sending thread, since the TX rings have a single producer.
+
+#ifndef CAN_BUS_PACK_FLUSH_US
+#define CAN_BUS_PACK_FLUSH_US 500u
+#endif
+
+#define CAN_BUS_PACK_REC_MAX (64u - CAN_BUS_PACK_HDR - 1u)
+
+struct can_bus_pack {
+  uint8_t buf[64];
+  uint8_t used; // bytes in buf, 0 = no open frame
+  uint8_t prio;
+  uint16_t std_id;
+  uint64_t deadline_us;
+};
+
+static can_bus_pack_t g_packs[CAN_BUS_INSTANCES];
+
+// Ring-full result of a send: the next TX completion runs tx_notify.
+static inline HAL_StatusTypeDef tx_full(can_bus_t *b) {
+  b->tx_blocked = 1;
+  return HAL_BUSY;
+}
+
+// One frame into a class's TX ring. Callers flush the class's open packed
+// frame first.
+static HAL_StatusTypeDef tx_queue_frame(can_bus_t *b, can_bus_tx_prio_t prio,
+                                        uint32_t id, const uint8_t *bytes,
+                                        size_t len) {
+  can_bus_tx_ring_t *r = &b->tx_ring[prio];
+  if (tx_rb_free(r) < 1)
+    return tx_full(b);
+
+  uint16_t h = r->head;
+  tx_rb_fill(r, h, id, bytes, len);
+  r->slots[h].marker = (prio == CAN_BUS_TX_PRIO_HIGH);
+
+  __DMB(); // publish slot before updating head (release)
+  r->head = tx_rb_next(r, h);
+
+  tx_kick(b);
+  return HAL_OK;
+}
+
+// Runs the notify hook of every instance with an open frame (pack_poll()
+// sorts out which of them are due), restarts pumps the shaper held and
+// sends cyclic frames that are due.
+static void bus_alarm(void) {
+  const uint64_t now = us_clock_now();
+  for (unsigned i = 0; i < g_bus_count; i++) {
+    can_bus_t *b = &g_bus[i];
+    const can_bus_pack_notify_cb_t cb = b->pack_notify;
+    if (cb && b->pack->used != 0)
+      cb();
+    if (b->shape_wake_us && (int64_t)(now - b->shape_wake_us) >= 0) {
+      b->shape_wake_us = 0;
+      tx_kick(b); // re-arms if still held
+    } else if (b->cyclic_next_us && (int64_t)(now - b->cyclic_next_us) >= 0) {
+      tx_kick(b);
+    }
+    if (b->boff_rejoin_us && (int64_t)(now - b->boff_rejoin_us) >= 0)
+      busoff_rejoin(b);
+  }
+  alarm_arm();
+}
+
+// Point the single us_clock alarm at the earliest open frame's deadline,
+// shaper release, bus-off rejoin or cyclic frame still ahead; ones already
+// passed have had their turn.
+static void alarm_arm(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint64_t now = us_clock_now();
+  uint64_t next = 0;
+  for (unsigned i = 0; i < g_bus_count; i++) {
+    const can_bus_t *b = &g_bus[i];
+    const uint64_t at[4] = {b->pack->used != 0 ? b->pack->deadline_us : 0,
+                            b->shape_wake_us, b->boff_rejoin_us,
+                            b->cyclic_next_us};
+    for (unsigned k = 0; k < 4; k++) {
+      if (at[k] && (int64_t)(at[k] - now) > 0 &&
+          (!next || (int64_t)(at[k] - next) < 0))
+        next = at[k];
+    }
+  }
+  us_clock_set_alarm(next, next ? bus_alarm : NULL);
+  __set_PRIMASK(primask);
+}
+
+// Queue the open frame, if any. HAL_BUSY leaves it open (and due).
+static HAL_StatusTypeDef pack_flush(can_bus_t *b) {
+  can_bus_pack_t *p = b->pack;
+  if (p->used == 0)
+    return HAL_OK;
+  const HAL_StatusTypeDef st = tx_queue_frame(
+      b, (can_bus_tx_prio_t)p->prio, p->std_id, p->buf, p->used);
+  if (st != HAL_OK)
+    return st;
+  p->used = 0;
+  b->pack_stats.tx_frames++;
+  alarm_arm();
+  return HAL_OK;
+}
+
+// Flush before anything else is queued in the open frame's class.
+static inline HAL_StatusTypeDef pack_flush_class(can_bus_t *b,
+                                                 can_bus_tx_prio_t prio) {
+  return (b->pack->used != 0 && b->pack->prio == prio) ? pack_flush(b) : HAL_OK;
+}
+
+// From can_bus_process_rx(): send the open frame once its deadline passed.
+static void pack_poll(can_bus_t *b) {
+  if (b->pack->used == 0)
+    return;
+  const uint64_t now = us_clock_now();
+  if ((int64_t)(now - b->pack->deadline_us) < 0)
+    return;
+  if (pack_flush(b) != HAL_OK) {
+    b->pack->deadline_us = now + CAN_BUS_PACK_FLUSH_US; // ring full
+    alarm_arm();
+  }
+}
+
+// =========================
+// Fragment headers (sender)
+// =========================
+
+// Fragments needed for a `len`-byte message; 0 if it can't be sent
+// (frag_cnt and the length prefix are 8 and 16 bits on the wire).
+// `cap` is the data a fragment carries after its TX_HDR bytes.
+static size_t frag_count_cap(size_t len, size_t cap) {
+  if (len == 0 || len > 0xFFFFu)
+    return 0;
+  const size_t cnt = (CAN_BUS_FRAG_TX_LEAD + len + cap - 1u) / cap;
+  return (cnt <= 255u) ? cnt : 0;
+}
+
+static size_t frag_count(size_t len) {
+  return frag_count_cap(len, CAN_BUS_FRAG_TX_CAP);
+}
+
+// Build the payload header of fragment `idx` of `cnt` into `hdr` (at most 8
+// bytes) and the frame ID into *id, for fragments of `cap` + TX_HDR bytes.
+// Returns the header length, i.e. where the fragment's share of the message
+// starts.
+static CCM_FUNC size_t frag_header_cap(uint8_t *hdr, uint32_t *id,
+                                       uint32_t std_id, uint8_t seq,
+                                       uint8_t idx, uint8_t cnt, size_t len,
+                                       size_t cap) {
+  (void)cap; // only v1 headers carry the stride
+  uint8_t flags = 0;
+  if (idx == 0)
+    flags |= CAN_BUS_FRAG_F_FIRST;
+  if (idx == (uint8_t)(cnt - 1))
+    flags |= CAN_BUS_FRAG_F_LAST;
+
+#if CAN_BUS_FRAG_EXT_ID
+  *id = CAN_BUS_ID_XTD | ((std_id & 0x7FFu) << CAN_BUS_XID_BASE_Pos) |
+        ((uint32_t)seq << CAN_BUS_XID_SEQ_Pos) |
+        ((uint32_t)idx << CAN_BUS_XID_IDX_Pos) | flags;
+  if (idx != 0)
+    return 0;
+  hdr[0] = (uint8_t)len;
+  hdr[1] = (uint8_t)(len >> 8);
+  return CAN_BUS_XID_LEAD;
+#elif CAN_BUS_FRAG_COMPACT_HDR
+  (void)flags;
+  *id = std_id & 0x7FFu;
+  can_bus_frag_hdr2_t h2;
+  h2.magic = CAN_BUS_FRAG_MAGIC_V2;
+  h2.seq = seq;
+  h2.frag_idx = idx;
+  memcpy(hdr, &h2, sizeof(h2));
+  if (idx != 0)
+    return sizeof(h2);
+  can_bus_frag_hdr2_first_t h1;
+  h1.frag_cnt = cnt;
+  h1.rsvd = 0;
+  h1.total_len = (uint16_t)len;
+  memcpy(hdr + sizeof(h2), &h1, sizeof(h1));
+  return sizeof(h2) + sizeof(h1);
+#else
+  *id = std_id & 0x7FFu;
+  can_bus_frag_hdr_t fh;
+  fh.magic = CAN_BUS_FRAG_MAGIC;
+  fh.seq = seq;
+  fh.frag_idx = idx;
+  fh.frag_cnt = cnt;
+  fh.flags = (uint8_t)(flags | (cap << CAN_BUS_FRAG_STRIDE_Pos));
+  fh.total_len = (uint16_t)len;
+  memcpy(hdr, &fh, sizeof(fh));
+  return sizeof(fh);
+#endif
+}
+
+// Fixed-size fragments, for everything but can_bus_sendv_prio().
+static CCM_FUNC size_t frag_header(uint8_t *hdr, uint32_t *id, uint32_t std_id,
+                                   uint8_t seq, uint8_t idx, uint8_t cnt,
+                                   size_t len) {
+  return frag_header_cap(hdr, id, std_id, seq, idx, cnt, len,
+                         CAN_BUS_FRAG_TX_CAP);
+}
+
+#if CAN_BUS_FRAG_SINGLE
+// Header of a single-frame message into `hdr`; returns its length.
+static CCM_FUNC size_t single_header(uint8_t *hdr, uint32_t *id,
+                                     uint32_t std_id, size_t len) {
+  *id = std_id & 0x7FFu;
+  hdr[0] = (uint8_t)CAN_BUS_SINGLE_MAGIC;
+  hdr[1] = (uint8_t)(CAN_BUS_SINGLE_MAGIC >> 8);
+  hdr[2] = (uint8_t)len;
+  return CAN_BUS_SINGLE_HDR;
+}
+#endif
+
+// =========================
+// Classic peers
+// =========================
+//
+// IDs shared with classic-CAN nodes carry fragments in 8-byte frames with a
+// header small enough to leave them most of the payload:
+//   first   1 SSSS LLL  LLLLLLLL   seq (4 bits), message length (11 bits)
+//   others  0 S IIIIII             seq bit 0, fragment index 1..63
+// so 6 data bytes in the first frame and 7 in the rest. Messages on one ID
+// can't interleave (a sender queues all its fragments at once), which is
+// why later fragments only need a sequence bit. Lost-fragment repair (NACK,
+// parity) isn't available in this format.
+
+#define CAN_BUS_CLASSIC_LEN 8u
+#define CAN_BUS_CLASSIC_F_FIRST 0x80u
+#define CAN_BUS_CLASSIC_SEQ_Pos 3u
+#define CAN_BUS_CLASSIC_SEQ_Msk 0x0Fu
+#define CAN_BUS_CLASSIC_SEQ_BIT 0x40u
+#define CAN_BUS_CLASSIC_IDX_Msk 0x3Fu
+#define CAN_BUS_CLASSIC_LEN_MAX 0x7FFu
+#define CAN_BUS_CLASSIC_CAP (CAN_BUS_CLASSIC_LEN - 1u) // data after 1 byte
+#define CAN_BUS_CLASSIC_LEAD 1u // extra header byte in the first fragment
+
+struct can_bus_peer {
+  uint16_t std_id;
+  uint8_t used;
+  uint8_t rx_valid; // rx_seq holds the last first fragment's seq
+  uint8_t rx_seq;
+};
+
+static can_bus_peer_t g_peer_tabs[CAN_BUS_INSTANCES][CAN_BUS_PEER_PROFILES];
+
+static can_bus_peer_t *peer_classic(can_bus_t *b, uint32_t id) {
+  if (b->peer_count == 0 || (id & CAN_BUS_ID_XTD))
+    return NULL;
+  for (unsigned i = 0; i < CAN_BUS_PEER_PROFILES; i++) {
+    if (b->peers[i].used && b->peers[i].std_id == (id & 0x7FFu))
+      return &b->peers[i];
+  }
+  return NULL;
+}
+
+// Classic fragments for a `len`-byte message; 0 if it can't be sent.
+static size_t classic_frag_count(size_t len) {
+  if (len == 0 || len > CAN_BUS_CLASSIC_LEN_MAX)
+    return 0;
+  const size_t cnt = (CAN_BUS_CLASSIC_LEAD + len + CAN_BUS_CLASSIC_CAP - 1u) /
+                     CAN_BUS_CLASSIC_CAP;
+  return (cnt <= CAN_BUS_CLASSIC_IDX_Msk + 1u) ? cnt : 0;
+}
+
+// Header of classic fragment `idx` into `hdr`; returns its length.
+static size_t classic_header(uint8_t *hdr, uint8_t seq, uint8_t idx,
+                             size_t len) {
+  if (idx == 0) {
+    hdr[0] = (uint8_t)(CAN_BUS_CLASSIC_F_FIRST |
+                       ((seq & CAN_BUS_CLASSIC_SEQ_Msk)
+                        << CAN_BUS_CLASSIC_SEQ_Pos) |
+                       (len >> 8));
+    hdr[1] = (uint8_t)len;
+    return 1u + CAN_BUS_CLASSIC_LEAD;
+  }
+  hdr[0] = (uint8_t)(((seq & 1u) ? CAN_BUS_CLASSIC_SEQ_BIT : 0u) | idx);
+  return 1u;
+}
+
+// =========================
+// Reassembly state
+// =========================
+//
+// In-flight messages are tracked per (std_id, seq) in a small open-addressed
+// hash table, so several boards sharing a CAN ID (or one board's back-to-back
+// messages) reassemble side by side. Slot metadata is cheap; payload storage
+// comes from a shared pool of fixed blocks, and each message takes only the
+// contiguous run of blocks its total_len needs.
+//
+// Every fragment is placed on its own at idx * stride, the stride coming from
+// the header (v1), fragment 0 (v2, extended IDs) or any full fragment (older
+// v1 senders), never from whichever frame happened to arrive first. One that
+// can't be placed yet, because fragment 0 with the length or the stride
+// hasn't been seen, waits in a small per-bus early table and is replayed
+// when its message can take it, so fragments reordered across FIFOs or
+// buses don't cost a retransmit.
+//
+// Each in-flight message and held fragment carries a proto_timer.h timer,
+// re-armed as fragments arrive, for its NACK point and its timeout; nothing
+// scans the tables on the RX path.
+//
+// When the table or the pool runs out, the in-flight message that loses
+// the least goes: each one's staleness (its age against its timeout) is
+// weighed against how complete it is, plus a bonus for high-priority IDs
+// (can_bus_set_reasm_priority()). A low-priority newcomer never evicts a
+// high-priority message, nor one whose completion outweighs its
+// staleness; it is refused instead (starts_refused). CAN_BUS_REASM_RESERVED
+// slots stay for high-priority IDs, so a noisy low-priority sender can't
+// crowd them out at all.
+
+#ifndef CAN_BUS_REASM_SLOTS
+#define CAN_BUS_REASM_SLOTS 18 // ordinary IDs get all but the reserved
+#endif
+#ifndef CAN_BUS_REASM_EARLY
+#define CAN_BUS_REASM_EARLY 4u // fragments held ahead of their message
+#endif
+#ifndef CAN_BUS_REASM_RESERVED
+#define CAN_BUS_REASM_RESERVED 1u // slots only high-priority IDs may take
+#endif
+// Default high-priority ID range, until can_bus_set_reasm_priority().
+#ifndef CAN_BUS_REASM_HIGH_ID_FIRST
+#define CAN_BUS_REASM_HIGH_ID_FIRST 0x000u
+#endif
+#ifndef CAN_BUS_REASM_HIGH_ID_LAST
+#define CAN_BUS_REASM_HIGH_ID_LAST 0x00Fu
+#endif
+// Eviction weights, in 1/256: completion counts 0..256, a high-priority
+// message this much more, staleness 0..256 up to its timeout and
+// CAN_BUS_REASM_STALE_EXPIRED past it.
+#ifndef CAN_BUS_REASM_PRIO_WEIGHT
+#define CAN_BUS_REASM_PRIO_WEIGHT 256
+#endif
+#define CAN_BUS_REASM_STALE_EXPIRED 1024
+_Static_assert(CAN_BUS_REASM_RESERVED < CAN_BUS_REASM_SLOTS,
+               "low-priority IDs need a slot");
+
+#ifndef CAN_BUS_REASM_MAX_BYTES
+#define CAN_BUS_REASM_MAX_BYTES 2048
+#endif
+
+#ifndef CAN_BUS_REASM_MAX_FRAGS
+#define CAN_BUS_REASM_MAX_FRAGS 64
+#endif
+
+// The pool's block size and count (CAN_BUS_REASM_BLOCK_BYTES,
+// CAN_BUS_REASM_POOL_BLOCKS) are set in mem_budget.h.
+
+_Static_assert(CAN_BUS_REASM_SLOTS <= 256, "slot index must fit in u8");
+_Static_assert(CAN_BUS_REASM_POOL_BLOCKS <= 32,
+               "pool bitmap is a single 32-bit word");
+_Static_assert(CAN_BUS_REASM_MAX_BYTES <=
+                   CAN_BUS_REASM_BLOCK_BYTES * CAN_BUS_REASM_POOL_BLOCKS,
+               "pool can't hold one maximum-size message");
+
+// =========================
+// Selective retransmit (CAN_BUS_FRAG_RELIABLE)
+// =========================
+//
+// A receiver missing fragments of a message sends a NACK on
+// CAN_BUS_NACK_STD_ID naming (std_id, seq, total_len) with a bitmap of the
+// fragments it still needs: right after the last fragment if there are
+// gaps, and again at half the reassembly timeout (CAN_BUS_NACK_MAX times in
+// all). The sender keeps its last CAN_BUS_RTX_SLOTS fragmented messages and
+// queues just those fragments again. As in reassembly, boards sharing an ID
+// are told apart only by (seq, total_len).
+
+#if CAN_BUS_FRAG_RELIABLE
+_Static_assert(CAN_BUS_REASM_MAX_FRAGS <= 64, "NACK bitmap is 64 bits");
+_Static_assert(CAN_BUS_RTX_SLOTS > 0, "need a retransmit slot");
+
+struct can_bus_rtx_slot {
+  uint32_t std_id;
+  uint16_t len; // 0 = empty
+  uint8_t seq;
+  uint8_t prio;
+  uint8_t data[CAN_BUS_REASM_MAX_BYTES];
+};
+
+static can_bus_rtx_slot_t g_rtx_slots[CAN_BUS_INSTANCES][CAN_BUS_RTX_SLOTS];
+
+// Buffer to keep a copy of the message being sent in, or NULL if it can't
+// be repaired anyway (longer than any receiver reassembles).
+static uint8_t *rtx_record(can_bus_t *b, uint32_t std_id, uint8_t seq,
+                           can_bus_tx_prio_t prio, size_t len) {
+  if (len > CAN_BUS_REASM_MAX_BYTES ||
+      frag_count(len) > CAN_BUS_REASM_MAX_FRAGS)
+    return NULL;
+  can_bus_rtx_slot_t *r = &b->rtx[b->rtx_next];
+  b->rtx_next = (b->rtx_next + 1u) % CAN_BUS_RTX_SLOTS;
+  r->std_id = std_id & 0x7FFu;
+  r->seq = seq;
+  r->prio = (uint8_t)prio;
+  r->len = (uint16_t)len;
+  return r->data;
+}
+
+// Queue fragment `idx` of a kept message again (no TX timestamp marker).
+static HAL_StatusTypeDef rtx_queue(can_bus_t *b, const can_bus_rtx_slot_t *m,
+                                   uint8_t idx, uint8_t cnt) {
+  can_bus_tx_ring_t *r = &b->tx_ring[m->prio];
+  if (tx_rb_free(r) < 1)
+    return HAL_BUSY;
+  uint8_t frame[CAN_BUS_FRAG_WIRE_LEN];
+  uint32_t id;
+  const size_t pos = frag_header(frame, &id, m->std_id, m->seq, idx, cnt,
+                                 m->len);
+  const size_t off =
+      (idx == 0) ? 0u : (size_t)idx * CAN_BUS_FRAG_TX_CAP - CAN_BUS_FRAG_TX_LEAD;
+  size_t take = m->len - off;
+  if (take > CAN_BUS_FRAG_WIRE_LEN - pos)
+    take = CAN_BUS_FRAG_WIRE_LEN - pos;
+  memcpy(frame + pos, m->data + off, take);
+
+  const uint16_t h = r->head;
+  tx_rb_fill(r, h, id, frame,
+             (idx == cnt - 1u) ? pos + take : CAN_BUS_FRAG_WIRE_LEN);
+  r->slots[h].marker = 0;
+  __DMB(); // publish slot before updating head (release)
+  r->head = tx_rb_next(r, h);
+  return HAL_OK;
+}
+
+// NACK from a receiver (thread context).
+static void rx_nack(can_bus_t *b, const can_bus_rx_frame_t *f) {
+  can_bus_nack_t n;
+  if (f->len < sizeof(n))
+    return;
+  memcpy(&n, f->data, sizeof(n));
+  if (n.magic != CAN_BUS_NACK_MAGIC)
+    return;
+  b->rtx_stats.nacks_rx++;
+
+  const can_bus_rtx_slot_t *m = NULL;
+  for (unsigned i = 0; i < CAN_BUS_RTX_SLOTS; i++) {
+    if (b->rtx[i].len != 0 && b->rtx[i].len == n.total_len &&
+        b->rtx[i].std_id == n.std_id && b->rtx[i].seq == n.seq)
+      m = &b->rtx[i];
+  }
+  if (!m) {
+    b->rtx_stats.nacks_stale++; // not ours, or already overwritten
+    return;
+  }
+
+  const uint8_t cnt = (uint8_t)frag_count(m->len);
+  if (pack_flush_class(b, (can_bus_tx_prio_t)m->prio) != HAL_OK)
+    return;
+  for (uint8_t idx = 0; idx < cnt; idx++) {
+    if (!((n.missing >> idx) & 1u))
+      continue;
+    if (rtx_queue(b, m, idx, cnt) != HAL_OK)
+      break; // the next NACK asks again
+    b->rtx_stats.frags_resent++;
+  }
+  tx_kick(b);
+}
+
+// Ask the sender of (std_id, seq) for the fragments not in got_mask
+// (thread context).
+static void nack_send(can_bus_t *b, uint32_t std_id, uint8_t seq,
+                      uint16_t total_len, uint8_t frag_cnt,
+                      const uint64_t *got_mask) {
+  can_bus_nack_t n;
+  n.magic = CAN_BUS_NACK_MAGIC;
+  n.std_id = (uint16_t)std_id;
+  n.seq = seq;
+  n.frag_cnt = frag_cnt;
+  n.total_len = total_len;
+  const uint64_t all =
+      (frag_cnt >= 64u) ? ~0ull : ((1ull << frag_cnt) - 1u);
+  n.missing = ~got_mask[0] & all;
+  if (pack_flush_class(b, CAN_BUS_TX_PRIO_MID) == HAL_OK &&
+      tx_queue_frame(b, CAN_BUS_TX_PRIO_MID, CAN_BUS_NACK_STD_ID,
+                     (const uint8_t *)&n, sizeof(n)) == HAL_OK)
+    b->rtx_stats.nacks_tx++;
+}
+#endif
+
+enum {
+  CAN_BUS_REASM_FREE = 0, // never used since the last table clear
+  CAN_BUS_REASM_ACTIVE,
+  CAN_BUS_REASM_TOMB, // released; keeps probe chains intact
+  CAN_BUS_REASM_HELD, // complete, buffer pinned by the pending RX batch
+};
+
+struct can_bus_reasm_slot {
+  uint8_t state;
+  uint8_t seq;
+  uint8_t frag_cnt;
+  uint8_t data_cap; // payload bytes per frag (wire_len - hdr)
+  uint8_t lead;     // of those, taken by the length prefix in frag 0
+  uint8_t blk_first;
+  uint8_t blk_cnt;
+  uint16_t total_len;
+  uint16_t got_count;
+  uint16_t timeout_ms; // current reassembly timeout for this sender
+  uint8_t stats_idx;   // id_stats entry, or CAN_BUS_ID_STATS_NONE
+  uint8_t stream;      // stream_subs index + 1, 0 = buffered delivery
+  uint8_t next;        // streamed: next fragment to hand out in order
+  uint8_t nacks;       // NACKs sent for this message
+  uint32_t std_id; // which CAN ID this slot is for
+  uint32_t first_ts; // RX timestamp of the first fragment seen
+  uint32_t last_tick_ms;
+  uint8_t *ext; // buffer from reasm_alloc instead of the pool, or NULL
+  proto_timer_t timer; // NACK point or timeout, from last_tick_ms
+  uint64_t got_mask[(CAN_BUS_REASM_MAX_FRAGS + 63) / 64];
+};
+
+// One fragment, decoded from either wire format.
+typedef struct {
+  uint32_t std_id;    // sender (base ID)
+  uint16_t total_len; // 0: not known from this frame (later ext fragment)
+  uint8_t seq;
+  uint8_t idx;
+  uint8_t cnt;        // valid with total_len
+  uint8_t flags;      // CAN_BUS_FRAG_F_*
+  uint8_t cap;        // data bytes per fragment frame (stride); 0 unknown
+  uint8_t lead;       // bytes of fragment 0 taken by a length prefix
+  const uint8_t *data;
+  uint8_t len;
+} can_bus_frag_t;
+
+// A fragment that arrived before its message could place it.
+struct can_bus_early {
+  can_bus_frag_t fr; // fr.data points at `data` once replayed
+  uint32_t ts;
+  uint32_t tick_ms;
+  uint8_t used;
+  proto_timer_t timer; // reassembly timeout after tick_ms
+  uint8_t data[CAN_BUS_FRAG_WIRE_LEN];
+};
+
+static can_bus_early_t g_early_tabs[CAN_BUS_INSTANCES][CAN_BUS_REASM_EARLY];
+
+// Slot tables in CCM next to the RX rings; the block pools are too big for it
+// and go in the arena.
+static CCM_BSS can_bus_reasm_slot_t
+    g_reasm_slots[CAN_BUS_INSTANCES][CAN_BUS_REASM_SLOTS];
+
+static MEM_ARENA(reasm) uint8_t
+    g_reasm_pools[CAN_BUS_INSTANCES][CAN_BUS_REASM_POOL_BLOCKS]
+                 [CAN_BUS_REASM_BLOCK_BYTES] __attribute__((aligned(4)));
+
+// Per-sender statistics, keyed by std_id. Entries are claimed on the first
+// fragment from an ID and kept until can_bus_reset_id_stats(); fragments from
+// further IDs are only counted in id_stats_untracked.
+
+#ifndef CAN_BUS_ID_STATS_SLOTS
+#define CAN_BUS_ID_STATS_SLOTS 8
+#endif
+
+#define CAN_BUS_ID_STATS_NONE 0xFFu
+_Static_assert(CAN_BUS_ID_STATS_SLOTS < CAN_BUS_ID_STATS_NONE,
+               "stats index must fit in u8");
+
+struct can_bus_id_stats_entry {
+  can_bus_id_stats_t pub;
+  uint32_t gap_avg_q4; // EWMA of the inter-fragment gap, ms << 4
+  uint32_t last_rx_ts; // first-fragment timestamp of the last completed one
+  uint8_t has_rx_ts;
+  uint8_t used;
+  uint8_t has_gap;
+  uint8_t has_seq;
+  uint8_t last_seq;
+};
+
+static can_bus_id_stats_entry_t
+    g_id_stats_tabs[CAN_BUS_INSTANCES][CAN_BUS_ID_STATS_SLOTS];
+
+static uint8_t id_stats_lookup(can_bus_t *b, uint32_t std_id) {
+  for (unsigned i = 0; i < CAN_BUS_ID_STATS_SLOTS; i++) {
+    if (!b->id_stats[i].used) {
+      b->id_stats[i].used = 1;
+      b->id_stats[i].pub.std_id = (uint16_t)std_id;
+      b->id_stats[i].pub.timeout_ms = CAN_BUS_REASM_TIMEOUT_MS;
+      return (uint8_t)i;
+    }
+    if (b->id_stats[i].pub.std_id == std_id)
+      return (uint8_t)i;
+  }
+  b->id_stats_untracked++;
+  return CAN_BUS_ID_STATS_NONE;
+}
+
+static inline can_bus_id_stats_entry_t *id_stats_at(can_bus_t *b, uint8_t idx) {
+  return (idx == CAN_BUS_ID_STATS_NONE) ? NULL : &b->id_stats[idx];
+}
+
+// Fold one measured gap into the sender's average and re-derive its timeout.
+static void id_stats_gap(can_bus_id_stats_entry_t *e, uint32_t gap_ms) {
+  if (gap_ms > CAN_BUS_REASM_TIMEOUT_MAX_MS)
+    gap_ms = CAN_BUS_REASM_TIMEOUT_MAX_MS;
+  const uint32_t sample = gap_ms << 4;
+  if (!e->has_gap) {
+    e->gap_avg_q4 = sample;
+    e->has_gap = 1;
+  } else {
+    // alpha = 1/8
+    e->gap_avg_q4 = e->gap_avg_q4 - (e->gap_avg_q4 >> 3) + (sample >> 3);
+  }
+
+  uint32_t t = ((e->gap_avg_q4 * CAN_BUS_REASM_TIMEOUT_GAP_MULT) >> 4) +
+               CAN_BUS_REASM_TIMEOUT_MIN_MS;
+  if (t > CAN_BUS_REASM_TIMEOUT_MAX_MS)
+    t = CAN_BUS_REASM_TIMEOUT_MAX_MS;
+  e->pub.gap_avg_ms = (uint16_t)(e->gap_avg_q4 >> 4);
+  e->pub.timeout_ms = (uint16_t)t;
+}
+
+static inline uint8_t *reasm_buf(const can_bus_t *b,
+                                 const can_bus_reasm_slot_t *s) {
+  if (s->ext)
+    return s->ext;
+  return b->reasm_pool + (size_t)s->blk_first * CAN_BUS_REASM_BLOCK_BYTES;
+}
+
+// Streaming subscriber for messages on std_id: its index + 1, or 0.
+static uint8_t stream_lookup(can_bus_t *b, uint32_t std_id) {
+  for (unsigned i = 0; i < CAN_BUS_MAX_STREAM_SUBSCRIBERS; i++) {
+    const can_bus_stream_sub_t *s = &b->stream_subs[i];
+    if (s->cb && ((std_id ^ s->id) & s->mask) == 0)
+      return (uint8_t)(i + 1u);
+  }
+  return 0;
+}
+
+static void stream_emit(can_bus_t *b, const can_bus_reasm_slot_t *s,
+                        const uint8_t *data, size_t len, size_t off,
+                        uint8_t flags) {
+  const can_bus_stream_sub_t *sub = &b->stream_subs[s->stream - 1u];
+  if (sub->cb)
+    sub->cb(data, len, off, s->total_len, (uint16_t)s->std_id, flags,
+            sub->user);
+}
+
+static void reasm_pool_reset(can_bus_t *b) {
+  b->reasm_pool_free = (CAN_BUS_REASM_POOL_BLOCKS == 32)
+                          ? 0xFFFFFFFFu
+                          : ((1u << CAN_BUS_REASM_POOL_BLOCKS) - 1u);
+}
+
+// First-fit search for `n` contiguous free blocks. Returns the first block
+// index, or -1 if no run is long enough.
+static int reasm_pool_alloc(can_bus_t *b, unsigned n) {
+  const uint32_t run = (n >= 32) ? 0xFFFFFFFFu : ((1u << n) - 1u);
+  for (unsigned first = 0; first + n <= CAN_BUS_REASM_POOL_BLOCKS; first++) {
+    if (((b->reasm_pool_free >> first) & run) == run) {
+      b->reasm_pool_free &= ~(run << first);
+      return (int)first;
+    }
+  }
+  return -1;
+}
+
+static void reasm_pool_release(can_bus_t *b, unsigned first, unsigned n) {
+  const uint32_t run = (n >= 32) ? 0xFFFFFFFFu : ((1u << n) - 1u);
+  b->reasm_pool_free |= run << first;
+}
+
+static inline unsigned reasm_hash(uint32_t std_id, uint8_t seq) {
+  return (unsigned)((std_id * 31u) ^ seq) % CAN_BUS_REASM_SLOTS;
+}
+
+// Linear probe step; the table size needn't be a power of two.
+static inline unsigned reasm_next(unsigned i) {
+  return (i + 1u == CAN_BUS_REASM_SLOTS) ? 0u : i + 1u;
+}
+
+static void reasm_clear_all(can_bus_t *b) {
+  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++)
+    proto_timer_cancel(&b->reasm[i].timer);
+  for (unsigned i = 0; i < CAN_BUS_REASM_EARLY; i++)
+    proto_timer_cancel(&b->early[i].timer);
+  memset(b->reasm, 0, CAN_BUS_REASM_SLOTS * sizeof(b->reasm[0]));
+  b->reasm_active = 0;
+  b->reasm_low = 0;
+  memset(b->early, 0, CAN_BUS_REASM_EARLY * sizeof(b->early[0]));
+  b->early_count = 0;
+  reasm_pool_reset(b);
+}
+
+static inline int reasm_is_high(const can_bus_t *b, uint32_t std_id) {
+  return std_id >= b->reasm_high_first && std_id <= b->reasm_high_last;
+}
+
+// A fragment of `s` came in at `now_ms`: its next look is the NACK point
+// halfway to the timeout while repair requests are left
+// (CAN_BUS_FRAG_RELIABLE), the timeout otherwise.
+static void reasm_touch(can_bus_reasm_slot_t *s, uint32_t now_ms) {
+  s->last_tick_ms = now_ms;
+  uint32_t after = s->timeout_ms;
+#if CAN_BUS_FRAG_RELIABLE
+  if (s->nacks < CAN_BUS_NACK_MAX)
+    after /= 2u;
+#endif
+  proto_timer_arm(&s->timer, now_ms + after + 1u);
+}
+
+static void reasm_timer_fire(proto_timer_t *t, void *user);
+
+static void reasm_release(can_bus_t *b, can_bus_reasm_slot_t *s) {
+  if (s->state != CAN_BUS_REASM_ACTIVE && s->state != CAN_BUS_REASM_HELD)
+    return;
+  proto_timer_cancel(&s->timer);
+  if (s->stream && s->next != 0 && s->next < s->frag_cnt)
+    stream_emit(b, s, NULL, 0, 0, CAN_BUS_STREAM_ABORT); // started, not ended
+  reasm_pool_release(b, s->blk_first, s->blk_cnt);
+  if (s->ext) {
+    b->reasm_free(s->ext);
+    s->ext = NULL;
+  }
+  s->state = CAN_BUS_REASM_TOMB;
+  if (!reasm_is_high(b, s->std_id))
+    b->reasm_low--;
+  if (--b->reasm_active == 0) {
+    // Nothing in flight: drop every tombstone so probes stay short.
+    for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
+      b->reasm[i].state = CAN_BUS_REASM_FREE;
+    }
+  }
+}
+
+static can_bus_reasm_slot_t *reasm_find(can_bus_t *b, uint32_t std_id,
+                                        uint8_t seq) {
+  unsigned i = reasm_hash(std_id, seq);
+  for (unsigned n = 0; n < CAN_BUS_REASM_SLOTS; n++) {
+    can_bus_reasm_slot_t *s = &b->reasm[i];
+    if (s->state == CAN_BUS_REASM_FREE)
+      return NULL;
+    if (s->state == CAN_BUS_REASM_ACTIVE && s->std_id == std_id &&
+        s->seq == seq)
+      return s;
+    i = reasm_next(i);
+  }
+  return NULL;
+}
+
+// The in-flight message to give up for a new one (see "Reassembly
+// state"), or NULL if a newcomer of priority `high` may evict none.
+static can_bus_reasm_slot_t *reasm_victim(can_bus_t *b, int high,
+                                          uint32_t now_ms) {
+  can_bus_reasm_slot_t *victim = NULL;
+  int32_t best = 0;
+  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
+    can_bus_reasm_slot_t *s = &b->reasm[i];
+    if (s->state != CAN_BUS_REASM_ACTIVE)
+      continue;
+    const int s_high = reasm_is_high(b, s->std_id);
+    if (s_high && !high)
+      continue;
+    const uint32_t age = (uint32_t)(now_ms - s->last_tick_ms);
+    const uint32_t to = s->timeout_ms ? s->timeout_ms : 1u;
+    const int32_t stale = (age >= to) ? CAN_BUS_REASM_STALE_EXPIRED
+                                      : (int32_t)((age * 256u) / to);
+    const int32_t keep =
+        (int32_t)(((uint32_t)s->got_count * 256u) / s->frag_cnt) +
+        (s_high ? CAN_BUS_REASM_PRIO_WEIGHT : 0);
+    const int32_t score = stale - keep;
+    if (!victim || score > best) {
+      victim = s;
+      best = score;
+    }
+  }
+  if (victim && !high && best < 0)
+    return NULL; // more would be lost than the newcomer could bring
+  return victim;
+}
+
+static void rx_batch_flush(can_bus_t *b);
+static void mon_poll(can_bus_t *b);
+
+// Start tracking a new message. Delivers the pending RX batch, then evicts
+// the stalest in-flight message(s), while the table or the buffer pool is
+// exhausted.
+static can_bus_reasm_slot_t *reasm_start(can_bus_t *b, uint32_t std_id,
+                                         uint8_t seq, uint8_t frag_cnt,
+                                         uint16_t total_len, uint8_t data_cap,
+                                         uint32_t now_ms) {
+  // Streamed messages only get a buffer once a fragment arrives out of order.
+  const uint8_t stream = stream_lookup(b, std_id);
+  unsigned blocks = stream ? 0u
+                           : (total_len + CAN_BUS_REASM_BLOCK_BYTES - 1u) /
+                                 CAN_BUS_REASM_BLOCK_BYTES;
+  uint8_t *ext = NULL;
+  if (blocks != 0 && b->reasm_alloc) {
+    ext = b->reasm_alloc(total_len);
+    if (ext)
+      blocks = 0; // the pool is the fallback
+  }
+
+  const int high = reasm_is_high(b, std_id);
+  int first;
+  while ((first = reasm_pool_alloc(b, blocks)) < 0 ||
+         b->reasm_active == CAN_BUS_REASM_SLOTS ||
+         (!high &&
+          b->reasm_low >= b->reasm_low_max)) {
+    if (first >= 0)
+      reasm_pool_release(b, (unsigned)first, blocks);
+    if (b->batch_len != 0) {
+      rx_batch_flush(b); // frees held buffers; never evict those
+      continue;
+    }
+    can_bus_reasm_slot_t *victim = reasm_victim(b, high, now_ms);
+    if (!victim) {
+      can_bus_id_stats_entry_t *ne = id_stats_at(b, id_stats_lookup(b, std_id));
+      if (ne)
+        ne->pub.starts_refused++;
+      if (ext)
+        b->reasm_free(ext);
+      return NULL;
+    }
+    can_bus_id_stats_entry_t *ve = id_stats_at(b, victim->stats_idx);
+    if (ve)
+      ve->pub.msgs_evicted++;
+    reasm_release(b, victim);
+  }
+
+  unsigned i = reasm_hash(std_id, seq);
+  while (b->reasm[i].state == CAN_BUS_REASM_ACTIVE ||
+         b->reasm[i].state == CAN_BUS_REASM_HELD) {
+    i = reasm_next(i);
+  }
+
+  can_bus_reasm_slot_t *s = &b->reasm[i];
+  memset(s, 0, sizeof(*s));
+  s->state = CAN_BUS_REASM_ACTIVE;
+  s->std_id = std_id;
+  s->seq = seq;
+  s->frag_cnt = frag_cnt;
+  s->total_len = total_len;
+  s->data_cap = data_cap;
+  s->blk_first = (uint8_t)first;
+  s->blk_cnt = (uint8_t)blocks;
+  s->ext = ext;
+  s->stream = stream;
+  s->stats_idx = id_stats_lookup(b, std_id);
+  const can_bus_id_stats_entry_t *e = id_stats_at(b, s->stats_idx);
+  s->timeout_ms = e ? e->pub.timeout_ms : CAN_BUS_REASM_TIMEOUT_MS;
+  proto_timer_init(&s->timer, reasm_timer_fire, b);
+  reasm_touch(s, now_ms);
+  b->reasm_active++;
+  if (!high)
+    b->reasm_low++;
+  return s;
+}
+
+#if CAN_BUS_FRAG_RELIABLE
+static void reasm_nack(can_bus_t *b, can_bus_reasm_slot_t *s) {
+  if (s->nacks >= CAN_BUS_NACK_MAX)
+    return;
+  s->nacks++;
+  nack_send(b, s->std_id, s->seq, s->total_len, s->frag_cnt, s->got_mask);
+}
+#endif
+
+static inline int bit_test(uint64_t *mask, uint16_t idx) {
+  uint16_t w = (uint16_t)(idx / 64);
+  uint16_t b = (uint16_t)(idx % 64);
+  return (mask[w] >> b) & 1u;
+}
+
+static inline void bit_set(uint64_t *mask, uint16_t idx) {
+  uint16_t w = (uint16_t)(idx / 64);
+  uint16_t b = (uint16_t)(idx % 64);
+  mask[w] |= (1ull << b);
+}
+
+// Slot timer (reasm_touch()). A completed message waiting in HELD for its
+// batch isn't timed; NACKs sent since the last fragment may have used up
+// the repairs, so the timeout is checked against the age, not assumed.
+static void reasm_timer_fire(proto_timer_t *t, void *user) {
+  can_bus_t *b = user;
+  can_bus_reasm_slot_t *s = (can_bus_reasm_slot_t *)(void *)((uint8_t *)t -
+      offsetof(can_bus_reasm_slot_t, timer));
+  if (s->state != CAN_BUS_REASM_ACTIVE)
+    return;
+  const uint32_t now_ms = HAL_GetTick();
+#if CAN_BUS_FRAG_RELIABLE
+  // Stalled halfway to the timeout: ask again, and give the repair time.
+  if (s->nacks < CAN_BUS_NACK_MAX) {
+    reasm_nack(b, s);
+    reasm_touch(s, now_ms);
+    return;
+  }
+#endif
+  if ((uint32_t)(now_ms - s->last_tick_ms) <= s->timeout_ms) {
+    proto_timer_arm(&s->timer, s->last_tick_ms + s->timeout_ms + 1u);
+    return;
+  }
+  can_bus_id_stats_entry_t *e = id_stats_at(b, s->stats_idx);
+  if (e)
+    e->pub.msgs_expired++;
+  reasm_release(b, s);
+}
+
+// =========================
+// Credit flow control (CAN_BUS_FLOW_CONTROL)
+// =========================
+//
+// An advertising receiver splits its free reassembly blocks evenly between
+// the senders in its stats table plus one share for newcomers, and
+// broadcasts that every period. A sender spends ceil(len / block_bytes) of
+// its share on each fragmented message and gets HAL_BUSY when the share
+// runs out, until the next advert. With several advertisers the last one
+// heard wins; the shares only need to be roughly right.
+
+#if CAN_BUS_FLOW_CONTROL
+struct can_bus_credit_slot {
+  uint16_t std_id;
+  uint8_t used;
+  uint8_t credits;
+};
+
+static can_bus_credit_slot_t
+    g_credit_tabs[CAN_BUS_INSTANCES][CAN_BUS_CREDIT_IDS];
+
+static void credit_advertise(can_bus_t *b, uint32_t now_ms) {
+  if (b->credit_period_ms == 0 ||
+      (uint32_t)(now_ms - b->credit_sent_ms) < b->credit_period_ms)
+    return;
+
+  can_bus_credit_t c;
+  memset(&c, 0, sizeof(c));
+  c.magic = CAN_BUS_CREDIT_MAGIC;
+  c.block_bytes = CAN_BUS_REASM_BLOCK_BYTES;
+  uint32_t senders = 0;
+  for (unsigned i = 0; i < CAN_BUS_ID_STATS_SLOTS; i++)
+    senders += b->id_stats[i].used;
+  uint32_t free_blk = (uint32_t)__builtin_popcount(b->reasm_pool_free);
+  if (b->reasm_active == CAN_BUS_REASM_SLOTS)
+    free_blk = 0;
+  uint32_t share = free_blk / (senders + 1u);
+  if (share > 0xFFu)
+    share = 0xFFu;
+  c.dflt = (uint8_t)share;
+  for (unsigned i = 0; i < CAN_BUS_ID_STATS_SLOTS && c.count < 14u; i++) {
+    if (!b->id_stats[i].used)
+      continue;
+    c.e[c.count].std_id = b->id_stats[i].pub.std_id;
+    c.e[c.count].credits = (uint8_t)share;
+    c.count++;
+  }
+
+  const size_t len = offsetof(can_bus_credit_t, e) +
+                     c.count * sizeof(can_bus_credit_entry_t);
+  if (pack_flush_class(b, CAN_BUS_TX_PRIO_MID) == HAL_OK &&
+      tx_queue_frame(b, CAN_BUS_TX_PRIO_MID, CAN_BUS_CREDIT_STD_ID,
+                     (const uint8_t *)&c, len) == HAL_OK) {
+    b->credit_sent_ms = now_ms;
+    b->flow_stats.credits_tx++;
+  }
+}
+
+// Advert from a receiver (thread context).
+static void rx_credit(can_bus_t *b, const can_bus_rx_frame_t *f,
+                      uint32_t now_ms) {
+  can_bus_credit_t c;
+  if (f->len < offsetof(can_bus_credit_t, e))
+    return;
+  memset(&c, 0, sizeof(c));
+  memcpy(&c, f->data, (f->len < sizeof(c)) ? f->len : sizeof(c));
+  if (c.magic != CAN_BUS_CREDIT_MAGIC || c.block_bytes == 0)
+    return;
+  const unsigned n = (c.count < 14u) ? c.count : 14u;
+  if (offsetof(can_bus_credit_t, e) + n * sizeof(can_bus_credit_entry_t) >
+      f->len)
+    return;
+  b->flow_stats.credits_rx++;
+  b->credit_block = c.block_bytes;
+  b->credit_dflt = c.dflt;
+  b->credit_heard_ms = now_ms;
+  for (unsigned i = 0; i < CAN_BUS_CREDIT_IDS; i++) {
+    if (!b->credit[i].used)
+      continue;
+    b->credit[i].credits = c.dflt;
+    for (unsigned k = 0; k < n; k++) {
+      if (c.e[k].std_id == b->credit[i].std_id)
+        b->credit[i].credits = c.e[k].credits;
+    }
+  }
+}
+
+// Spend credit for a `len`-byte message on std_id; 0 = hold it back.
+static int credit_take(can_bus_t *b, uint32_t std_id, size_t len) {
+  if (b->credit_block == 0 ||
+      (uint32_t)(HAL_GetTick() - b->credit_heard_ms) > CAN_BUS_CREDIT_STALE_MS)
+    return 1; // nobody is advertising
+  can_bus_credit_slot_t *c = NULL;
+  for (unsigned i = 0; i < CAN_BUS_CREDIT_IDS && !c; i++) {
+    if (b->credit[i].used && b->credit[i].std_id == (std_id & 0x7FFu))
+      c = &b->credit[i];
+  }
+  for (unsigned i = 0; i < CAN_BUS_CREDIT_IDS && !c; i++) {
+    if (!b->credit[i].used) {
+      c = &b->credit[i];
+      c->used = 1;
+      c->std_id = (uint16_t)(std_id & 0x7FFu);
+      c->credits = b->credit_dflt; // until its own share is advertised
+    }
+  }
+  if (!c)
+    return 1; // untracked ID
+  const size_t need = (len + b->credit_block - 1u) / b->credit_block;
+  if (c->credits < need) {
+    b->flow_stats.sends_held++;
+    return 0;
+  }
+  c->credits = (uint8_t)(c->credits - need);
+  return 1;
+}
+#endif
+
+// =========================
+// RX batch
+// =========================
+//
+// With batch subscribers registered, messages completed during one
+// can_bus_process_rx() pass are collected as (ptr, len) pairs that point
+// straight into the RX ring records and reassembly buffers. Those stay pinned
+// (ring tail not advanced, reassembly slot HELD) until the batch goes out at
+// the end of the pass, when it fills up, or when reassembly needs the space.
+
+static void rx_batch_flush(can_bus_t *b) {
+  if (b->batch_len != 0) {
+    for (unsigned i = 0; i < CAN_BUS_MAX_BATCH_SUBSCRIBERS; i++) {
+      can_bus_rx_batch_cb_t cb = b->batch_subs[i].cb;
+      if (cb)
+        cb(b->batch, b->batch_len, b->batch_subs[i].user);
+    }
+  }
+  for (size_t i = 0; i < b->batch_held_cnt; i++) {
+    reasm_release(b, b->batch_held[i]);
+  }
+  b->batch_len = 0;
+  b->batch_held_cnt = 0;
+  rb_release(b, &b->rx_ring[0]);
+  rb_release(b, &b->rx_ring[1]);
+}
+
+static inline void can_bus_notify_rx(can_bus_t *b, const uint8_t *data,
+                                     size_t len, uint16_t std_id, uint32_t ts) {
+  uint32_t bits = b->sub_map[std_id & 0x7FFu];
+  while (bits) {
+    const unsigned i = (unsigned)__builtin_ctz(bits);
+    bits &= bits - 1u;
+    const can_bus_sub_t *s = &b->subs[i];
+    if (s->msg_cb)
+      s->msg_cb(data, len, std_id, ts_widen_us(b, ts), s->user);
+    else if (s->cb)
+      s->cb(data, len, s->user);
+  }
+}
+
+// Deliver one completed message received on `std_id` (first frame at `ts`).
+// `held` is its reassembly slot, or NULL for a single-frame message living in
+// the RX ring. Returns non-zero if the batch now owns the slot (the caller
+// must not release it).
+static int rx_deliver(can_bus_t *b, const uint8_t *data, size_t len,
+                      uint16_t std_id, uint32_t ts,
+                      can_bus_reasm_slot_t *held) {
+  can_bus_notify_rx(b, data, len, std_id, ts);
+  if (b->batch_sub_count == 0)
+    return 0;
+
+  b->batch[b->batch_len].data = data;
+  b->batch[b->batch_len].len = len;
+  b->batch_len++;
+  if (held) {
+    held->state = CAN_BUS_REASM_HELD;
+    b->batch_held[b->batch_held_cnt++] = held;
+  }
+  if (b->batch_len == CAN_BUS_RX_BATCH_MAX) {
+    // rd is still on the current frame; its record stays ours
+    rx_batch_flush(b);
+  }
+  return held != NULL;
+}
+
+// Returns 1 for a fragment, 0 for a raw frame, -1 for a bad fragment.
+static CCM_FUNC int frag_parse(const can_bus_rx_frame_t *f,
+                               can_bus_frag_t *fr) {
+#if CAN_BUS_FRAG_EXT_ID
+  if (!(f->id & CAN_BUS_ID_XTD))
+    return 0;
+  const uint32_t id = f->id & CAN_BUS_ID_EXT_Msk;
+  fr->std_id = id >> CAN_BUS_XID_BASE_Pos;
+  fr->seq = (uint8_t)(id >> CAN_BUS_XID_SEQ_Pos);
+  fr->idx = (uint8_t)(id >> CAN_BUS_XID_IDX_Pos);
+  fr->flags = (uint8_t)(id & CAN_BUS_XID_FLAGS_Msk);
+  fr->total_len = 0;
+  fr->cnt = 0;
+  fr->cap = 0;
+  fr->lead = 0;
+  fr->data = f->data;
+  fr->len = f->len;
+  if ((fr->idx == 0) != ((fr->flags & CAN_BUS_FRAG_F_FIRST) != 0))
+    return -1;
+  if (fr->idx == 0) {
+    if (f->len <= CAN_BUS_XID_LEAD)
+      return -1;
+    fr->total_len = (uint16_t)(f->data[0] | ((uint16_t)f->data[1] << 8));
+    if (fr->total_len == 0 || fr->total_len > CAN_BUS_REASM_MAX_BYTES)
+      return -1;
+    const uint32_t cnt = (CAN_BUS_XID_LEAD + fr->total_len + f->len - 1u) /
+                         f->len;
+    if (cnt > CAN_BUS_REASM_MAX_FRAGS)
+      return -1;
+    fr->cnt = (uint8_t)cnt;
+    fr->cap = f->len;
+    fr->lead = CAN_BUS_XID_LEAD;
+    fr->data += CAN_BUS_XID_LEAD;
+    fr->len -= CAN_BUS_XID_LEAD;
+  }
+  return 1;
+#else
+  if (f->len < sizeof(can_bus_frag_hdr2_t))
+    return 0;
+  uint16_t magic;
+  memcpy(&magic, f->data, sizeof(magic));
+
+  if (magic == CAN_BUS_FRAG_MAGIC_V2) {
+    can_bus_frag_hdr2_t h2;
+    memcpy(&h2, f->data, sizeof(h2));
+    fr->std_id = f->id;
+    fr->seq = h2.seq;
+    fr->idx = h2.frag_idx;
+    fr->flags = 0;
+    fr->total_len = 0;
+    fr->cnt = 0;
+    fr->cap = 0;
+    fr->lead = 0;
+    fr->data = f->data + sizeof(h2);
+    fr->len = (uint8_t)(f->len - sizeof(h2));
+    if (fr->idx != 0)
+      return 1;
+
+    can_bus_frag_hdr2_first_t h1;
+    if (fr->len <= sizeof(h1))
+      return -1;
+    memcpy(&h1, fr->data, sizeof(h1));
+    if (h1.frag_cnt == 0 || h1.frag_cnt > CAN_BUS_REASM_MAX_FRAGS)
+      return -1;
+    if (h1.total_len == 0 || h1.total_len > CAN_BUS_REASM_MAX_BYTES)
+      return -1;
+    fr->flags = CAN_BUS_FRAG_F_FIRST;
+    fr->total_len = h1.total_len;
+    fr->cnt = h1.frag_cnt;
+    fr->cap = fr->len; // later fragments: frame minus the common header
+    fr->lead = sizeof(h1);
+    fr->data += sizeof(h1);
+    fr->len -= sizeof(h1);
+    return 1;
+  }
+
+  if (magic != CAN_BUS_FRAG_MAGIC || f->len < sizeof(can_bus_frag_hdr_t))
+    return 0;
+  can_bus_frag_hdr_t hdr;
+  memcpy(&hdr, f->data, sizeof(hdr));
+
+  // Validate header fields
+  if (hdr.frag_cnt == 0)
+    return -1;
+  if (hdr.frag_idx >= hdr.frag_cnt + fec_parity_count(hdr.frag_cnt))
+    return -1;
+  if (hdr.frag_cnt > CAN_BUS_REASM_MAX_FRAGS)
+    return -1;
+  if (hdr.total_len == 0)
+    return -1;
+  if (hdr.total_len > CAN_BUS_REASM_MAX_BYTES)
+    return -1;
+
+  fr->std_id = f->id;
+  fr->total_len = hdr.total_len;
+  fr->seq = hdr.seq;
+  fr->idx = hdr.frag_idx;
+  fr->cnt = hdr.frag_cnt;
+  fr->flags = hdr.flags & (CAN_BUS_FRAG_F_FIRST | CAN_BUS_FRAG_F_LAST);
+  fr->data = f->data + sizeof(hdr);
+  fr->len = (uint8_t)(f->len - sizeof(hdr));
+  fr->lead = 0;
+  const uint32_t stride =
+      (hdr.flags >> CAN_BUS_FRAG_STRIDE_Pos) & CAN_BUS_FRAG_STRIDE_Msk;
+  if (stride != 0) {
+    // The last fragment may be padded up to an FD length, never past it.
+    if (fr->len > stride || stride * (hdr.frag_cnt - 1u) >= hdr.total_len ||
+        stride * hdr.frag_cnt < hdr.total_len)
+      return -1;
+    fr->cap = (uint8_t)stride;
+  } else {
+    // Older senders: every fragment but the last is full, so any other
+    // one shows the stride (smaller frames are fine if consistent).
+    fr->cap = (fr->idx + 1u != fr->cnt || fr->cnt == 1u) ? fr->len : 0u;
+  }
+  return 1;
+#endif
+}
+
+// Classic-profile frame (see "Classic peers"). Returns 1 for a fragment,
+// -1 for one that doesn't fit the message in flight or is malformed.
+static int frag_parse_classic(const can_bus_rx_frame_t *f, can_bus_peer_t *p,
+                              can_bus_frag_t *fr) {
+  if (f->len < 2u)
+    return -1;
+  const uint8_t b0 = f->data[0];
+  fr->std_id = f->id;
+  fr->flags = 0;
+  fr->total_len = 0;
+  fr->cnt = 0;
+  fr->cap = 0;
+  fr->lead = 0;
+
+  if (b0 & CAN_BUS_CLASSIC_F_FIRST) {
+    const uint16_t total = (uint16_t)(((b0 & 0x07u) << 8) | f->data[1]);
+    const size_t cnt = classic_frag_count(total);
+    if (cnt == 0 || cnt > CAN_BUS_REASM_MAX_FRAGS ||
+        total > CAN_BUS_REASM_MAX_BYTES)
+      return -1;
+    p->rx_seq = (b0 >> CAN_BUS_CLASSIC_SEQ_Pos) & CAN_BUS_CLASSIC_SEQ_Msk;
+    p->rx_valid = 1;
+    fr->seq = p->rx_seq;
+    fr->idx = 0;
+    fr->flags = CAN_BUS_FRAG_F_FIRST;
+    fr->total_len = total;
+    fr->cnt = (uint8_t)cnt;
+    fr->cap = CAN_BUS_CLASSIC_CAP;
+    fr->lead = CAN_BUS_CLASSIC_LEAD;
+    fr->data = f->data + 1u + CAN_BUS_CLASSIC_LEAD;
+    fr->len = (uint8_t)(f->len - 1u - CAN_BUS_CLASSIC_LEAD);
+    return 1;
+  }
+
+  // A later fragment belongs to the message whose first one we last saw,
+  // unless the sequence bit says we missed a newer one.
+  if (!p->rx_valid || ((b0 & CAN_BUS_CLASSIC_SEQ_BIT) != 0) != (p->rx_seq & 1u))
+    return -1;
+  fr->seq = p->rx_seq;
+  fr->idx = b0 & CAN_BUS_CLASSIC_IDX_Msk;
+  fr->data = f->data + 1u;
+  fr->len = (uint8_t)(f->len - 1u);
+  return 1;
+}
+
+// Streamed message: hand fragment `idx` (message bytes at `off`) out now if
+// it is the next one due, followed by any later ones buffered meanwhile;
+// buffer it if it is early.
+static void rx_stream(can_bus_t *b, can_bus_reasm_slot_t *s, uint8_t idx,
+                      const uint8_t *data, uint32_t off, uint32_t take) {
+  if (idx != s->next) {
+    if (s->blk_cnt == 0 && !s->ext && b->reasm_alloc)
+      s->ext = b->reasm_alloc(s->total_len);
+    if (s->blk_cnt == 0 && !s->ext) {
+      const unsigned blocks = (s->total_len + CAN_BUS_REASM_BLOCK_BYTES - 1u) /
+                              CAN_BUS_REASM_BLOCK_BYTES;
+      const int first = reasm_pool_alloc(b, blocks);
+      if (first < 0) {
+        reasm_release(b, s); // no room to reorder; the consumer sees ABORT
+        return;
+      }
+      s->blk_first = (uint8_t)first;
+      s->blk_cnt = (uint8_t)blocks;
+    }
+    bit_set(s->got_mask, idx);
+    s->got_count++;
+    memcpy(reasm_buf(b, s) + off, data, take);
+    return;
+  }
+
+  bit_set(s->got_mask, idx);
+  s->got_count++;
+  for (;;) {
+    uint8_t flags = 0;
+    if (s->next == 0)
+      flags |= CAN_BUS_STREAM_START;
+    if (s->next == s->frag_cnt - 1u)
+      flags |= CAN_BUS_STREAM_END;
+    s->next++;
+    stream_emit(b, s, data, take, off, flags);
+    if (s->next == s->frag_cnt || !bit_test(s->got_mask, s->next))
+      break;
+    // Already here out of order: it sits in the buffer.
+    off = (uint32_t)s->next * s->data_cap - s->lead;
+    take = s->total_len - off;
+    if (take > s->data_cap)
+      take = s->data_cap;
+    data = reasm_buf(b, s) + off;
+  }
+
+  if (s->next == s->frag_cnt) {
+    DBG_MARK_PULSE(REASM_DONE);
+    ITM_TRACE(ITM_EV_REASM_DONE,
+              ((uint32_t)s->total_len << 11) | (s->std_id & 0x7FFu));
+    TRACEX_EVENT(TRACEX_EV_REASM_DONE, s->std_id, s->total_len);
+    can_bus_id_stats_entry_t *st = id_stats_at(b, s->stats_idx);
+    if (st) {
+      st->pub.msgs_completed++;
+      st->last_rx_ts = s->first_ts;
+      st->has_rx_ts = 1;
+    }
+    reasm_release(b, s);
+  }
+}
+
+// Hand a complete buffered message over and free its slot.
+static void reasm_finish(can_bus_t *b, can_bus_reasm_slot_t *s) {
+  DBG_MARK_PULSE(REASM_DONE);
+  ITM_TRACE(ITM_EV_REASM_DONE,
+            ((uint32_t)s->total_len << 11) | (s->std_id & 0x7FFu));
+  TRACEX_EVENT(TRACEX_EV_REASM_DONE, s->std_id, s->total_len);
+  can_bus_id_stats_entry_t *st = id_stats_at(b, s->stats_idx);
+  if (st) {
+    st->pub.msgs_completed++;
+    st->last_rx_ts = s->first_ts;
+    st->has_rx_ts = 1;
+  }
+  if (s->ext && b->rx_take &&
+      b->rx_take(s->ext, s->total_len, (uint16_t)s->std_id, b->rx_take_user)) {
+    s->ext = NULL; // adopted, with no copy; the taker frees it
+    reasm_release(b, s);
+    return;
+  }
+  if (!rx_deliver(b, reasm_buf(b, s), s->total_len, (uint16_t)s->std_id,
+                  s->first_ts, s))
+    reasm_release(b, s);
+}
+
+// Message bytes carried by fragment i, and where they start.
+static inline uint32_t reasm_frag_off(const can_bus_reasm_slot_t *s,
+                                      unsigned i) {
+  return (i == 0) ? 0u : (uint32_t)i * s->data_cap - s->lead;
+}
+
+static inline uint32_t reasm_frag_len(const can_bus_reasm_slot_t *s,
+                                      unsigned i) {
+  const uint32_t off = reasm_frag_off(s, i);
+  const uint32_t cap = s->data_cap - ((i == 0) ? s->lead : 0u);
+  return (s->total_len - off < cap) ? s->total_len - off : cap;
+}
+
+// Parity fragment g arrived (the data fragments went out before it). If
+// exactly one fragment of its group is missing, rebuild it: parity XOR the
+// payload areas (as on the wire, zero-padded to data_cap) of the others.
+static void rx_parity(can_bus_t *b, can_bus_reasm_slot_t *s, uint8_t g,
+                      const uint8_t *data, size_t len) {
+  b->fec_stats.parity_rx++;
+  if (s->stream || len < s->data_cap || s->data_cap > CAN_BUS_FRAG_WIRE_LEN)
+    return; // streamed fragments aren't kept to XOR against
+  const unsigned n = (unsigned)fec_parity_count(s->frag_cnt);
+  int miss = -1;
+  for (unsigned i = g; i < s->frag_cnt; i += n) {
+    if (bit_test(s->got_mask, (uint16_t)i))
+      continue;
+    if (miss >= 0) {
+      b->fec_stats.unrecoverable++;
+      return;
+    }
+    miss = (int)i;
+  }
+  if (miss < 0)
+    return;
+
+  uint8_t acc[CAN_BUS_FRAG_WIRE_LEN];
+  memcpy(acc, data, s->data_cap);
+  for (unsigned i = g; i < s->frag_cnt; i += n) {
+    if ((int)i == miss)
+      continue;
+    const uint8_t *src = reasm_buf(b, s) + reasm_frag_off(s, i);
+    const uint32_t take = reasm_frag_len(s, i);
+    unsigned k = 0;
+    if (i == 0) {
+      // The length prefix isn't in the buffer; it is known from the slot.
+      uint8_t lead[4] = {0};
+#if CAN_BUS_FRAG_EXT_ID
+      lead[0] = (uint8_t)s->total_len;
+      lead[1] = (uint8_t)(s->total_len >> 8);
+#else
+      const can_bus_frag_hdr2_first_t h1 = {s->frag_cnt, 0, s->total_len};
+      _Static_assert(sizeof(h1) <= sizeof(lead), "lead buffer");
+      memcpy(lead, &h1, sizeof(h1)); // v1 has no lead
+#endif
+      for (; k < s->lead && k < sizeof(lead); k++)
+        acc[k] ^= lead[k];
+    }
+    for (uint32_t j = 0; j < take; j++)
+      acc[k + j] ^= src[j];
+  }
+
+  const unsigned m = (unsigned)miss;
+  const unsigned skip = (m == 0) ? s->lead : 0u;
+  memcpy(reasm_buf(b, s) + reasm_frag_off(s, m), acc + skip,
+         reasm_frag_len(s, m));
+  bit_set(s->got_mask, (uint16_t)m);
+  s->got_count++;
+  b->fec_stats.recovered++;
+  if (s->got_count == s->frag_cnt)
+    reasm_finish(b, s);
+}
+
+// Held fragment the reassembly timeout has passed by.
+static void early_timer_fire(proto_timer_t *t, void *user) {
+  can_bus_t *b = user;
+  can_bus_early_t *e = (can_bus_early_t *)(void *)((uint8_t *)t -
+      offsetof(can_bus_early_t, timer));
+  if (!e->used)
+    return;
+  can_bus_id_stats_entry_t *st =
+      id_stats_at(b, id_stats_lookup(b, e->fr.std_id));
+  if (st)
+    st->pub.frags_orphaned++;
+  e->used = 0;
+  b->early_count--;
+}
+
+// Early table (see "Reassembly state"). A full table gives way to the
+// oldest entry.
+static void early_hold(can_bus_t *b, const can_bus_frag_t *fr, uint32_t ts,
+                       uint32_t now_ms) {
+  can_bus_early_t *e = NULL;
+  for (unsigned i = 0; i < CAN_BUS_REASM_EARLY; i++) {
+    can_bus_early_t *c = &b->early[i];
+    if (!c->used) {
+      e = c;
+      break;
+    }
+    if (!e || (int32_t)(c->tick_ms - e->tick_ms) < 0)
+      e = c;
+  }
+  if (e->used) {
+    can_bus_id_stats_entry_t *st =
+        id_stats_at(b, id_stats_lookup(b, e->fr.std_id));
+    if (st)
+      st->pub.frags_orphaned++;
+  } else {
+    b->early_count++;
+  }
+  e->fr = *fr;
+  e->fr.data = NULL;
+  memcpy(e->data, fr->data, fr->len);
+  e->ts = ts;
+  e->tick_ms = now_ms;
+  e->used = 1;
+  if (!proto_timer_armed(&e->timer)) // else it's the entry given way
+    proto_timer_init(&e->timer, early_timer_fire, b);
+  proto_timer_arm(&e->timer, now_ms + CAN_BUS_REASM_TIMEOUT_MS + 1u);
+  can_bus_id_stats_entry_t *st = id_stats_at(b, id_stats_lookup(b, fr->std_id));
+  if (st)
+    st->pub.frags_held++;
+}
+
+static CCM_FUNC int rx_fragment_one(can_bus_t *b, const can_bus_frag_t *fr,
+                                    uint32_t ts, uint32_t now_ms);
+
+// Message (std_id, seq) can place more than before: replay what it left
+// in the early table. An entry taken out and still unplaceable goes back
+// in at or below the index just freed, so the scan never sees it twice.
+static void early_replay(can_bus_t *b, uint32_t std_id, uint8_t seq,
+                         uint32_t now_ms) {
+  int again;
+  do {
+    again = 0;
+    for (unsigned i = 0; i < CAN_BUS_REASM_EARLY && b->early_count; i++) {
+      can_bus_early_t *e = &b->early[i];
+      if (!e->used || e->fr.std_id != std_id || e->fr.seq != seq)
+        continue;
+      uint8_t data[CAN_BUS_FRAG_WIRE_LEN];
+      can_bus_frag_t fr = e->fr;
+      memcpy(data, e->data, fr.len);
+      fr.data = data;
+      e->used = 0;
+      b->early_count--;
+      proto_timer_cancel(&e->timer);
+      again |= rx_fragment_one(b, &fr, e->ts, now_ms);
+    }
+  } while (again && b->early_count);
+}
+
+// Returns 1 when the fragment started its message or told it the stride,
+// i.e. held fragments of the message may fit now.
+static CCM_FUNC int rx_fragment_one(can_bus_t *b, const can_bus_frag_t *fr,
+                                    uint32_t ts, uint32_t now_ms) {
+  can_bus_reasm_slot_t *s = reasm_find(b, fr->std_id, fr->seq);
+  int learned = 0;
+
+  if (!s) {
+    // Extended-ID and v2 fragments only carry the length at index 0; later
+    // ones seen first wait for it. Parity only helps a message in flight.
+    if (fr->total_len == 0) {
+      early_hold(b, fr, ts, now_ms);
+      return 0;
+    }
+    if (fr->idx >= fr->cnt)
+      return 0;
+    if (b->reasm_pause_id && fr->std_id >= b->reasm_pause_id) {
+      can_bus_id_stats_entry_t *e =
+          id_stats_at(b, id_stats_lookup(b, fr->std_id));
+      if (e)
+        e->pub.msgs_paused++;
+      return 0; // consumer is backed up; the lower-priority IDs wait
+    }
+    // The stride may still be unknown (0): an older v1 sender's last
+    // fragment came first.
+    s = reasm_start(b, fr->std_id, fr->seq, fr->cnt, fr->total_len, fr->cap,
+                    now_ms);
+    if (!s)
+      return 0;
+    learned = 1;
+    s->lead = fr->lead;
+    s->first_ts = ts;
+    can_bus_id_stats_entry_t *e = id_stats_at(b, s->stats_idx);
+    if (e) {
+      if (e->has_seq && fr->seq != (uint8_t)(e->last_seq + 1u))
+        e->pub.seq_jumps++;
+      e->last_seq = fr->seq;
+      e->has_seq = 1;
+    }
+  } else {
+    // Must match the in-flight message properties
+    if (fr->total_len != 0 &&
+        (s->frag_cnt != fr->cnt || s->total_len != fr->total_len)) {
+      reasm_release(b, s);
+      return 0;
+    }
+    if (s->data_cap == 0 && fr->cap != 0) {
+      s->data_cap = fr->cap;
+      learned = 1;
+    }
+    can_bus_id_stats_entry_t *e = id_stats_at(b, s->stats_idx);
+    if (e) {
+      id_stats_gap(e, (uint32_t)(now_ms - s->last_tick_ms));
+      s->timeout_ms = e->pub.timeout_ms;
+    }
+  }
+
+  if (fr->idx >= s->frag_cnt &&
+      fr->idx < s->frag_cnt + fec_parity_count(s->frag_cnt)) {
+    reasm_touch(s, now_ms);
+    rx_parity(b, s, (uint8_t)(fr->idx - s->frag_cnt), fr->data, fr->len);
+    return learned;
+  }
+  if (fr->idx >= s->frag_cnt ||
+      ((fr->flags & CAN_BUS_FRAG_F_LAST) && fr->idx != s->frag_cnt - 1u)) {
+    reasm_release(b, s);
+    return 0;
+  }
+  if (s->data_cap == 0) {
+    // Older v1 sender, last fragment first: its offset needs the stride.
+    reasm_touch(s, now_ms);
+    early_hold(b, fr, ts, now_ms);
+    return learned;
+  }
+
+  can_bus_id_stats_entry_t *const st = id_stats_at(b, s->stats_idx);
+  if (st)
+    st->pub.frags_rx++;
+
+  // Compute where this fragment’s payload should land
+  uint32_t off = 0;
+  if (fr->idx != 0)
+    off = (uint32_t)fr->idx * (uint32_t)s->data_cap - s->lead;
+  if (off >= s->total_len)
+    return learned;
+
+  uint32_t take = fr->len;
+  if (take > (uint32_t)s->data_cap - (fr->idx == 0 ? s->lead : 0u))
+    take = (uint32_t)s->data_cap - (fr->idx == 0 ? s->lead : 0u);
+  if (off + take > s->total_len)
+    take = (uint32_t)s->total_len - off;
+
+  reasm_touch(s, now_ms);
+  if (bit_test(s->got_mask, fr->idx)) {
+    if (st)
+      st->pub.dup_frags++;
+    return learned;
+  }
+
+  if (s->stream) {
+    rx_stream(b, s, fr->idx, fr->data, off, take);
+#if CAN_BUS_FRAG_RELIABLE
+    if (s->state == CAN_BUS_REASM_ACTIVE && fr->idx == s->frag_cnt - 1u)
+      reasm_nack(b, s); // the last one is in, so the rest went missing
+#endif
+    return learned;
+  }
+
+  // Mark + copy
+  bit_set(s->got_mask, fr->idx);
+  s->got_count++;
+  memcpy(reasm_buf(b, s) + off, fr->data, take);
+#if CAN_BUS_FRAG_RELIABLE
+  if (fr->idx == s->frag_cnt - 1u && s->got_count != s->frag_cnt)
+    reasm_nack(b, s); // the last one is in, so the rest went missing
+#endif
+
+  if (s->got_count == s->frag_cnt)
+    reasm_finish(b, s);
+  return learned;
+}
+
+static CCM_FUNC void rx_fragment(can_bus_t *b, const can_bus_frag_t *fr,
+                                 uint32_t ts, uint32_t now_ms) {
+  if (rx_fragment_one(b, fr, ts, now_ms) && b->early_count)
+    early_replay(b, fr->std_id, fr->seq, now_ms);
+}
+
+// Split a packed frame into its records (thread context).
+static void rx_unpack(can_bus_t *b, const can_bus_rx_frame_t *f) {
+  b->pack_stats.rx_frames++;
+  size_t pos = CAN_BUS_PACK_HDR;
+  while (pos < f->len) {
+    const size_t n = f->data[pos];
+    if (n == 0)
+      break; // padding up to the FD length
+    if (pos + 1u + n > f->len) {
+      b->pack_stats.rx_bad++;
+      break;
+    }
+    b->pack_stats.rx_records++;
+    (void)rx_deliver(b, &f->data[pos + 1u], n, (uint16_t)f->id, f->ts, NULL);
+    pos += 1u + n;
+  }
+}
+
+// Standard ID a frame is dispatched under: extended IDs by their base.
+static inline uint16_t rx_std_id(uint32_t id) {
+  if (id & CAN_BUS_ID_XTD)
+    return (uint16_t)((id & CAN_BUS_ID_EXT_Msk) >> CAN_BUS_XID_BASE_Pos);
+  return (uint16_t)id;
+}
+
+// =========================
+// Top talkers
+// =========================
+//
+// Frames and bytes per frame ID as they come off the RX rings, to see who
+// loads the bus. The table is open-addressed with a short probe window:
+// an ID lives in one of CAN_BUS_TALKER_PROBE slots from its hash, and a new
+// ID that finds them all taken replaces the one heard from least recently,
+// so a scan of many IDs keeps the busy ones. Gaps are between consecutive
+// frames of an ID, in timestamp ticks until read.
+
+#ifndef CAN_BUS_TALKER_SLOTS
+#define CAN_BUS_TALKER_SLOTS 32u
+#endif
+#ifndef CAN_BUS_TALKER_PROBE
+#define CAN_BUS_TALKER_PROBE 4u
+#endif
+_Static_assert((CAN_BUS_TALKER_SLOTS & (CAN_BUS_TALKER_SLOTS - 1u)) == 0 &&
+                   CAN_BUS_TALKER_PROBE <= CAN_BUS_TALKER_SLOTS,
+               "talker table must be a power of two, probe within it");
+
+struct can_bus_talker_slot {
+  uint32_t id; // frame ID as stored in the RX ring
+  uint32_t frames; // 0 = free
+  uint32_t bytes;
+  uint32_t last_ts; // ticks
+  uint32_t gap_min;
+  uint32_t gap_max;
+};
+
+static can_bus_talker_slot_t
+    g_talker_tabs[CAN_BUS_INSTANCES][CAN_BUS_TALKER_SLOTS];
+
+static CCM_FUNC void talker_note(can_bus_t *b, const can_bus_rx_frame_t *f) {
+  const unsigned h = (unsigned)((f->id * 0x9E3779B1u) >> 24);
+  can_bus_talker_slot_t *victim = NULL;
+  for (unsigned k = 0; k < CAN_BUS_TALKER_PROBE; k++) {
+    can_bus_talker_slot_t *t =
+        &b->talkers[(h + k) & (CAN_BUS_TALKER_SLOTS - 1u)];
+    if (t->frames != 0 && t->id == f->id) {
+      const uint32_t gap = f->ts - t->last_ts;
+      if (t->frames == 1u || gap < t->gap_min)
+        t->gap_min = gap;
+      if (gap > t->gap_max)
+        t->gap_max = gap;
+      t->frames++;
+      t->bytes += f->len;
+      t->last_ts = f->ts;
+      return;
+    }
+    if (!victim || (victim->frames != 0 &&
+                    (t->frames == 0 ||
+                     (int32_t)(t->last_ts - victim->last_ts) < 0)))
+      victim = t;
+  }
+  if (victim->frames != 0)
+    b->talker_evicted++;
+  victim->id = f->id;
+  victim->frames = 1;
+  victim->bytes = f->len;
+  victim->last_ts = f->ts;
+  victim->gap_min = victim->gap_max = 0;
+}
+
+#if CAN_BUS_FRAG_SINGLE
+// A whole message in one frame (thread context): delivered in place from
+// the RX ring, no reassembly slot or copy.
+static CCM_FUNC void rx_single(can_bus_t *b, const can_bus_rx_frame_t *f) {
+  const size_t n = f->data[CAN_BUS_SINGLE_HDR - 1u];
+  if (n == 0 || CAN_BUS_SINGLE_HDR + n > f->len) {
+    b->single_stats.rx_bad++;
+    return;
+  }
+  b->single_stats.rx++;
+  const uint16_t std_id = (uint16_t)f->id;
+  const uint8_t stream = stream_lookup(b, std_id);
+  if (stream) {
+    const can_bus_stream_sub_t *sub = &b->stream_subs[stream - 1u];
+    sub->cb(&f->data[CAN_BUS_SINGLE_HDR], n, 0, n, std_id,
+            CAN_BUS_STREAM_START | CAN_BUS_STREAM_END, sub->user);
+    return;
+  }
+  (void)rx_deliver(b, &f->data[CAN_BUS_SINGLE_HDR], n, std_id, f->ts, NULL);
+}
+#endif
+
+// Handle one RX frame (thread context)
+static CCM_FUNC void handle_rx_frame(can_bus_t *b, const can_bus_rx_frame_t *f,
+                                     uint32_t now_ms) {
+  talker_note(b, f);
+  const can_bus_rx_tap_cb_t tap = b->rx_tap;
+  if (tap)
+    tap(f->id & CAN_BUS_ID_EXT_Msk,
+        (uint8_t)(f->flags | ((f->id & CAN_BUS_ID_XTD) ? CAN_BUS_RAW_EXT : 0u)),
+        f->data, f->len, ts_widen_us(b, f->ts), b->rx_tap_user);
+  const can_bus_rx_tap_cb_t cap = b->capture;
+  if (cap)
+    cap(f->id & CAN_BUS_ID_EXT_Msk,
+        (uint8_t)(f->flags | ((f->id & CAN_BUS_ID_XTD) ? CAN_BUS_RAW_EXT : 0u)),
+        f->data, f->len, ts_widen_us(b, f->ts), b->capture_user);
+#if CAN_BUS_FRAG_RELIABLE
+  if (f->id == CAN_BUS_NACK_STD_ID) {
+    rx_nack(b, f);
+    return;
+  }
+#endif
+#if CAN_BUS_FLOW_CONTROL
+  if (f->id == CAN_BUS_CREDIT_STD_ID) {
+    rx_credit(b, f, now_ms);
+    return;
+  }
+#endif
+  // Claimed IDs carry single raw frames; no reassembly, no fanout.
+  for (unsigned i = 0; i < CAN_BUS_MAX_ID_SUBSCRIBERS; i++) {
+    if (b->id_subs[i].cb && b->id_subs[i].std_id == f->id) {
+      b->id_subs[i].cb(f->data, f->len, ts_widen_us(b, f->ts),
+                       b->id_subs[i].user);
+      return;
+    }
+  }
+
+  can_bus_frag_t fr;
+  can_bus_peer_t *const peer = peer_classic(b, f->id);
+  if (peer) {
+    if (frag_parse_classic(f, peer, &fr) > 0)
+      rx_fragment(b, &fr, f->ts, now_ms);
+    return;
+  }
+
+  if (!(f->id & CAN_BUS_ID_XTD) && f->len > CAN_BUS_PACK_HDR) {
+    const uint16_t magic = (uint16_t)(f->data[0] | ((uint16_t)f->data[1] << 8));
+#if CAN_BUS_FRAG_SINGLE
+    if (magic == CAN_BUS_SINGLE_MAGIC) {
+      rx_single(b, f);
+      return;
+    }
+#endif
+    if (magic == CAN_BUS_PACK_MAGIC) {
+      rx_unpack(b, f);
+      return;
+    }
+  }
+
+  const int kind = frag_parse(f, &fr);
+  if (kind > 0)
+    rx_fragment(b, &fr, f->ts, now_ms);
+  else if (kind == 0)
+    (void)rx_deliver(b, f->data, f->len, rx_std_id(f->id), f->ts,
+                     NULL); // raw CAN payload
+}
+
+// =========================
+// Acceptance filters
+// =========================
+//
+// Non-matching standard frames are either accepted into FIFO1 (no table) or
+// rejected in hardware. Remote frames are always rejected, and so are
+// extended-ID frames unless they carry fragments (CAN_BUS_FRAG_EXT_ID). Those
+// get an extended table derived from the standard one, so each fragment
+// lands in the FIFO its base ID is filtered into.
+
+#define CAN_BUS_MAX_EXT_FILTERS 8u // G4 message RAM has room for 8
+
+// How long a reprogram waits for the hardware TX FIFO to empty before it
+// stops the controller anyway (three 64-byte frames at 125 kbit/s take ~14).
+#ifndef CAN_BUS_FILTER_DRAIN_MS
+#define CAN_BUS_FILTER_DRAIN_MS 20u
+#endif
+
+static HAL_StatusTypeDef filter_program_global(can_bus_t *b, int reject_std,
+                                               int reject_ext) {
+  return HAL_FDCAN_ConfigGlobalFilter(
+      b->hfdcan, reject_std ? FDCAN_REJECT : FDCAN_ACCEPT_IN_RX_FIFO1,
+      (CAN_BUS_FRAG_EXT_ID && !reject_ext) ? FDCAN_ACCEPT_IN_RX_FIFO1
+                                           : FDCAN_REJECT,
+      FDCAN_REJECT_REMOTE, FDCAN_REJECT_REMOTE);
+}
+
+static HAL_StatusTypeDef filter_program_one(can_bus_t *b, uint32_t index,
+                                            const can_bus_filter_t *f) {
+  FDCAN_FilterTypeDef cfg;
+  memset(&cfg, 0, sizeof(cfg));
+
+  cfg.IdType = FDCAN_STANDARD_ID;
+  cfg.FilterIndex = index;
+
+  if (!f) {
+    // unused entry
+    cfg.FilterType = FDCAN_FILTER_DUAL;
+    cfg.FilterConfig = FDCAN_FILTER_DISABLE;
+    return HAL_FDCAN_ConfigFilter(b->hfdcan, &cfg);
+  }
+
+  switch (f->type) {
+  case CAN_BUS_FILTER_ID_LIST:
+    cfg.FilterType = FDCAN_FILTER_DUAL;
+    break;
+  case CAN_BUS_FILTER_ID_RANGE:
+    cfg.FilterType = FDCAN_FILTER_RANGE;
+    break;
+  case CAN_BUS_FILTER_ID_MASK:
+    cfg.FilterType = FDCAN_FILTER_MASK;
+    break;
+  default:
+    return HAL_ERROR;
+  }
+
+  cfg.FilterConfig = (f->fifo == CAN_BUS_RX_FIFO0) ? FDCAN_FILTER_TO_RXFIFO0
+                                                   : FDCAN_FILTER_TO_RXFIFO1;
+  cfg.FilterID1 = f->id1 & 0x7FFu;
+  cfg.FilterID2 = f->id2 & 0x7FFu;
+  return HAL_FDCAN_ConfigFilter(b->hfdcan, &cfg);
+}
+
+#if CAN_BUS_FRAG_EXT_ID
+// Extended entry `index` matching every fragment ID whose base ID is in
+// lo..hi (or matches lo under mask hi, for `mask`). NULL `fifo` disables.
+static HAL_StatusTypeDef filter_program_ext(can_bus_t *b, uint32_t index,
+                                            uint32_t lo, uint32_t hi, int mask,
+                                            const can_bus_rx_fifo_t *fifo) {
+  FDCAN_FilterTypeDef cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.IdType = FDCAN_EXTENDED_ID;
+  cfg.FilterIndex = index;
+  cfg.FilterType = mask ? FDCAN_FILTER_MASK : FDCAN_FILTER_RANGE_NO_EIDM;
+  if (!fifo) {
+    cfg.FilterConfig = FDCAN_FILTER_DISABLE;
+    return HAL_FDCAN_ConfigFilter(b->hfdcan, &cfg);
+  }
+  cfg.FilterConfig = (*fifo == CAN_BUS_RX_FIFO0) ? FDCAN_FILTER_TO_RXFIFO0
+                                                 : FDCAN_FILTER_TO_RXFIFO1;
+  cfg.FilterID1 = (lo & 0x7FFu) << CAN_BUS_XID_BASE_Pos;
+  cfg.FilterID2 = ((hi & 0x7FFu) << CAN_BUS_XID_BASE_Pos) |
+                  (mask ? 0u : CAN_BUS_XID_SUB_Msk);
+  return HAL_FDCAN_ConfigFilter(b->hfdcan, &cfg);
+}
+
+// Mirror the standard table for fragments: one extended entry per range or
+// mask entry, one per distinct ID of a list entry. Sets `*fits` to 0 (every
+// entry disabled) if that needs more than CAN_BUS_MAX_EXT_FILTERS.
+static HAL_StatusTypeDef filter_program_ext_table(can_bus_t *b,
+                                                  const can_bus_filter_t *f,
+                                                  size_t count, int *fits) {
+  uint32_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    n += (f[i].type == CAN_BUS_FILTER_ID_LIST && f[i].id1 != f[i].id2) ? 2u
+                                                                       : 1u;
+  }
+  *fits = (n <= CAN_BUS_MAX_EXT_FILTERS);
+
+  HAL_StatusTypeDef st = HAL_OK;
+  n = 0;
+  for (size_t i = 0; *fits && i < count && st == HAL_OK; i++) {
+    const int mask = (f[i].type == CAN_BUS_FILTER_ID_MASK);
+    const uint32_t hi =
+        (f[i].type == CAN_BUS_FILTER_ID_LIST) ? f[i].id1 : f[i].id2;
+    st = filter_program_ext(b, n++, f[i].id1, hi, mask, &f[i].fifo);
+    if (st == HAL_OK && f[i].type == CAN_BUS_FILTER_ID_LIST &&
+        f[i].id1 != f[i].id2)
+      st = filter_program_ext(b, n++, f[i].id2, f[i].id2, 0, &f[i].fifo);
+  }
+  while (n < CAN_BUS_MAX_EXT_FILTERS && st == HAL_OK) {
+    st = filter_program_ext(b, n++, 0, 0, 0, NULL);
+  }
+  return st;
+}
+#endif
+
+// Control traffic of the driver itself (NACKs, credits), into FIFO0.
+static const can_bus_filter_t g_drv_filters[] = {
+#if CAN_BUS_FRAG_RELIABLE
+    {CAN_BUS_FILTER_ID_LIST, CAN_BUS_NACK_STD_ID, CAN_BUS_NACK_STD_ID,
+     CAN_BUS_RX_FIFO0},
+#endif
+#if CAN_BUS_FLOW_CONTROL
+    {CAN_BUS_FILTER_ID_LIST, CAN_BUS_CREDIT_STD_ID, CAN_BUS_CREDIT_STD_ID,
+     CAN_BUS_RX_FIFO0},
+#endif
+    {CAN_BUS_FILTER_ID_LIST, 0, 0, CAN_BUS_RX_FIFO0}, // end, not programmed
+};
+#define CAN_BUS_DRV_FILTERS                                                    \
+  (sizeof(g_drv_filters) / sizeof(g_drv_filters[0]) - 1u)
+
+#if CAN_BUS_ASYNC_SLOTS
+static void async_elems_end(can_bus_t *b, uint32_t mask, int ok);
+static void async_run_done(can_bus_t *b);
+#endif
+
+// Let the frames already in the hardware FIFO go out before a stop cancels
+// them. The pump is held meanwhile; a bus that doesn't ACK never drains, so
+// the wait is bounded. Returns the elements the stop will drop.
+static uint32_t tx_hw_drain(can_bus_t *b) {
+  b->tx_draining = 1;
+  const uint32_t t0 = HAL_GetTick();
+  uint32_t busy;
+  while ((busy = b->hfdcan->Instance->TXBRP) != 0 &&
+         HAL_GetTick() - t0 < CAN_BUS_FILTER_DRAIN_MS) {
+  }
+  return busy;
+}
+
+HAL_StatusTypeDef can_bus_set_filters(can_bus_t *b,
+                                      const can_bus_filter_t *filters,
+                                      size_t count) {
+  if (!b)
+    return HAL_ERROR;
+  // The driver's own control IDs get in past any table.
+  const size_t extra = (count > 0) ? CAN_BUS_DRV_FILTERS : 0u;
+  if (count + extra > CAN_BUS_MAX_STD_FILTERS)
+    return HAL_ERROR;
+  if (count > 0 && !filters)
+    return HAL_ERROR;
+  for (size_t i = 0; i < count; i++) {
+    if (filters[i].type == CAN_BUS_FILTER_ID_RANGE &&
+        filters[i].id1 > filters[i].id2)
+      return HAL_ERROR;
+  }
+
+  // Global filter config needs the controller out of normal operation.
+  const int was_running = (b->hfdcan->State == HAL_FDCAN_STATE_BUSY);
+  const uint32_t dropped = was_running ? tx_hw_drain(b) : 0u;
+  if (was_running && HAL_FDCAN_Stop(b->hfdcan) != HAL_OK) {
+    b->tx_draining = 0;
+    return HAL_ERROR;
+  }
+  b->tx_draining = 0;
+  b->mon.tx_flushed += (uint32_t)__builtin_popcount(dropped);
+#if CAN_BUS_ASYNC_SLOTS
+  if (dropped)
+    async_elems_end(b, dropped, 0);
+#endif
+
+  HAL_StatusTypeDef st = HAL_OK;
+  for (uint32_t i = 0; i < b->hfdcan->Init.StdFiltersNbr && st == HAL_OK; i++) {
+    const can_bus_filter_t *f = (i < count) ? &filters[i] : NULL;
+    if (i >= count && i - count < extra)
+      f = &g_drv_filters[i - count];
+    st = filter_program_one(b, i, f);
+  }
+  int ext_fits = 1;
+#if CAN_BUS_FRAG_EXT_ID
+  if (st == HAL_OK)
+    st = filter_program_ext_table(b, filters, count, &ext_fits);
+#endif
+  // Fragments the extended table can't describe are all taken into FIFO1.
+  if (st == HAL_OK)
+    st = filter_program_global(b, count > 0, count > 0 && ext_fits);
+
+  if (was_running) {
+    if (HAL_FDCAN_Start(b->hfdcan) != HAL_OK)
+      return HAL_ERROR;
+    tx_kick(b); // what the drain held back
+  }
+#if CAN_BUS_ASYNC_SLOTS
+  if (dropped)
+    async_run_done(b);
+#endif
+  return st;
+}
+
+// =========================
+// Public API
+// =========================
+
+// Point an instance at its slice of the static storage.
+static void bus_wire(can_bus_t *b) {
+  const unsigned i = (unsigned)(b - g_bus);
+
+  b->rx_ring = g_rx_rings[i];
+  b->readers = g_rx_readers[i];
+  table_swap_init(&b->routes, &g_route_tabs[i][0], &g_route_tabs[i][1],
+                  sizeof(g_route_tabs[i][0]), TABLE_SWAP_ISR_READERS);
+  b->rx_ring[0].mask = CAN_BUS_RX_HI_RING_BYTES - 1u;
+  b->rx_ring[0].buf = g_rx_buf_hi[i];
+  b->rx_ring[0].policy = CAN_BUS_RX_HI_OVERFLOW;
+  b->rx_ring[1].mask = CAN_BUS_RX_RING_BYTES - 1u;
+  b->rx_ring[1].buf = g_rx_buf_lo[i];
+  b->rx_ring[1].policy = CAN_BUS_RX_OVERFLOW;
+
+  b->tx_ring = g_tx_rings[i];
+  b->tx_ring[CAN_BUS_TX_PRIO_HIGH].depth = CAN_BUS_TX_HI_RING_DEPTH;
+  b->tx_ring[CAN_BUS_TX_PRIO_HIGH].slots = g_tx_slots_hi[i];
+  b->tx_ring[CAN_BUS_TX_PRIO_MID].depth = CAN_BUS_TX_MID_RING_DEPTH;
+  b->tx_ring[CAN_BUS_TX_PRIO_MID].slots = g_tx_slots_mid[i];
+  b->tx_ring[CAN_BUS_TX_PRIO_LOW].depth = CAN_BUS_TX_RING_DEPTH;
+  b->tx_ring[CAN_BUS_TX_PRIO_LOW].slots = g_tx_slots_lo[i];
+#if CAN_BUS_TX_EXPRESS_DEPTH
+  b->tx_express = &g_tx_express[i];
+  b->tx_express->depth = CAN_BUS_TX_EXPRESS_DEPTH;
+  b->tx_express->slots = g_tx_slots_x[i];
+#endif
+
+  b->shaper = g_shapers[i];
+  b->preload = g_preload[i];
+  b->preload_set = 0;
+#if CAN_BUS_CYCLIC_SLOTS
+  b->cyclic = g_cyclic_tabs[i];
+#endif
+#if CAN_BUS_ASYNC_SLOTS
+  b->async = g_async[i];
+  memset(b->async, 0, sizeof(g_async[i]));
+  memset(b->tx_elem_async, 0, sizeof(b->tx_elem_async));
+#endif
+  b->pack = &g_packs[i];
+  b->peers = g_peer_tabs[i];
+#if CAN_BUS_FRAG_RELIABLE
+  b->rtx = g_rtx_slots[i];
+#endif
+  b->reasm = g_reasm_slots[i];
+  b->reasm_high_first = CAN_BUS_REASM_HIGH_ID_FIRST;
+  b->reasm_high_last = CAN_BUS_REASM_HIGH_ID_LAST;
+  b->reasm_low_max = CAN_BUS_REASM_SLOTS - CAN_BUS_REASM_RESERVED;
+  b->early = g_early_tabs[i];
+  b->reasm_pool = &g_reasm_pools[i][0][0];
+  b->id_stats = g_id_stats_tabs[i];
+  b->talkers = g_talker_tabs[i];
+#if CAN_BUS_FLOW_CONTROL
+  b->credit = g_credit_tabs[i];
+#endif
+}
+
+#if CAN_BUS_AUTOBAUD
+// PSR error code that means the frame on the wire didn't decode.
+static int autobaud_error(uint32_t code) { return code != 0 && code != 7u; }
+
+// Listen with the timing applied for up to CAN_BUS_AUTOBAUD_LISTEN_MS.
+// Returns 0 on a protocol error or too few frames, 1 when enough decoded,
+// 2 when a BRS frame among them also checked the data phase.
+static int autobaud_listen(FDCAN_HandleTypeDef *h) {
+  if (HAL_FDCAN_Start(h) != HAL_OK)
+    return 0;
+  (void)h->Instance->PSR; // clear the codes left from the last row
+  const uint32_t t0 = HAL_GetTick();
+  unsigned frames = 0, brs = 0;
+  int err = 0;
+  while (!err && HAL_GetTick() - t0 < CAN_BUS_AUTOBAUD_LISTEN_MS &&
+         (frames < CAN_BUS_AUTOBAUD_FRAMES || !brs)) {
+    const uint32_t psr = h->Instance->PSR;
+    err = autobaud_error(psr & FDCAN_PSR_LEC) ||
+          autobaud_error((psr & FDCAN_PSR_DLEC) >> FDCAN_PSR_DLEC_Pos);
+    static const uint32_t fifos[2] = {FDCAN_RX_FIFO0, FDCAN_RX_FIFO1};
+    FDCAN_RxHeaderTypeDef hdr;
+    uint8_t data[64];
+    for (unsigned i = 0; i < 2; i++) {
+      while (HAL_FDCAN_GetRxFifoFillLevel(h, fifos[i]) &&
+             HAL_FDCAN_GetRxMessage(h, fifos[i], &hdr, data) == HAL_OK) {
+        frames++;
+        if (hdr.BitRateSwitch == FDCAN_BRS_ON)
+          brs++;
+      }
+    }
+  }
+  (void)HAL_FDCAN_Stop(h);
+  if (err || frames < CAN_BUS_AUTOBAUD_FRAMES)
+    return 0;
+  return brs ? 2 : 1;
+}
+
+// Table row the bus is running at, found by listening in bus monitoring
+// mode; `dflt` (the configured rates) when nothing decodes. Leaves the
+// controller stopped, with its init settings and interrupts as they were.
+static const can_bus_bit_timing_t *
+autobaud_scan(can_bus_t *b, uint32_t kernel_hz,
+              const can_bus_bit_timing_t *dflt) {
+  FDCAN_HandleTypeDef *h = b->hfdcan;
+  const FDCAN_InitTypeDef init = h->Init;
+  const uint32_t ile = h->Instance->ILE;
+  h->Instance->ILE = 0; // the frames are ours to drain, not the ISR's
+  h->Init.Mode = FDCAN_MODE_BUS_MONITORING;
+  h->Init.StdFiltersNbr = 0; // everything into FIFO0
+  h->Init.ExtFiltersNbr = 0;
+
+  const can_bus_bit_timing_t *pick = NULL, *nominal_only = NULL;
+  const uint32_t t0 = HAL_GetTick();
+  while (!pick && !nominal_only &&
+         HAL_GetTick() - t0 < CAN_BUS_AUTOBAUD_TIMEOUT_MS) {
+    for (unsigned i = 0; i < CAN_BUS_TIMINGS && !pick; i++) {
+      const can_bus_bit_timing_t *t = &g_bit_timings[i];
+      uint8_t brs = 0;
+      if (t->kernel_hz != kernel_hz ||
+          can_bus_apply_bit_timing(h, t, &brs) != HAL_OK)
+        continue;
+      (void)HAL_FDCAN_ConfigGlobalFilter(h, FDCAN_ACCEPT_IN_RX_FIFO0,
+                                         FDCAN_ACCEPT_IN_RX_FIFO0,
+                                         FDCAN_FILTER_REMOTE,
+                                         FDCAN_FILTER_REMOTE);
+      b->rate.tried++;
+      const int r = autobaud_listen(h);
+      if (r == 2) {
+        pick = t;
+      } else if (r == 1 &&
+                 (!nominal_only || (dflt && t->data_bps == dflt->data_bps &&
+                                    nominal_only->data_bps != dflt->data_bps))) {
+        nominal_only = t;
+      }
+    }
+  }
+
+  h->Init = init;
+  if (!dflt && !pick && !nominal_only && b->rate.tried)
+    (void)HAL_FDCAN_Init(h); // back to the CubeMX timing
+  h->Instance->ILE = ile;
+  b->rate.detected = (pick || nominal_only) ? 1u : 0u;
+  b->rate.data_checked = pick ? 1u : 0u;
+  return pick ? pick : nominal_only ? nominal_only : dflt;
+}
+#endif
+
+HAL_StatusTypeDef can_bus_init(FDCAN_HandleTypeDef *hfdcan) {
+  if (!hfdcan)
+    return HAL_ERROR;
+
+  // Re-init keeps the instance (and its subscribers); a new handle claims
+  // the next free one.
+  can_bus_t *b = bus_of(hfdcan);
+  if (!b) {
+    if (g_bus_count >= CAN_BUS_INSTANCES)
+      return HAL_ERROR;
+    b = &g_bus[g_bus_count];
+    b->hfdcan = hfdcan;
+    b->irq_line = -1;
+    bus_wire(b);
+    g_bus_count++;
+  }
+  b->brs = 0;
+#ifdef FDCAN1
+  if (hfdcan->Instance == FDCAN1) {
+    b->it_irqn[0] = FDCAN1_IT0_IRQn;
+    b->it_irqn[1] = FDCAN1_IT1_IRQn;
+  } else
+#endif
+  {
+    b->it_irqn[0] = FDCAN2_IT0_IRQn;
+    b->it_irqn[1] = FDCAN2_IT1_IRQn;
+  }
+
+  // Replace the CubeMX timing with the table entry for this kernel clock
+  // (or the one the bus turns out to run at).
+  const uint32_t kernel_hz = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN);
+  const can_bus_bit_timing_t *t = can_bus_find_timing(
+      kernel_hz, CAN_BUS_NOMINAL_BITRATE, CAN_BUS_DATA_BITRATE);
+  memset(&b->rate, 0, sizeof(b->rate));
+#if CAN_BUS_AUTOBAUD
+  if (hfdcan->Init.Mode == FDCAN_MODE_NORMAL)
+    t = autobaud_scan(b, kernel_hz, t);
+#endif
+  HAL_StatusTypeDef st =
+      t ? can_bus_apply_bit_timing(hfdcan, t, &b->brs) : HAL_ERROR;
+  b->rate.nominal_bps = t ? t->nominal_bps : CAN_BUS_NOMINAL_BITRATE;
+  b->rate.data_bps = t ? t->data_bps : CAN_BUS_DATA_BITRATE;
+  b->nom_bit_ns = 1000000000u / b->rate.nominal_bps;
+  b->data_bit_ns = 1000000000u / b->rate.data_bps;
+
+#if CAN_BUS_FRAG_EXT_ID
+  // CubeMX configures no extended filters. Set the list size directly too:
+  // the re-init above is skipped when no timing entry matched.
+  hfdcan->Init.ExtFiltersNbr = CAN_BUS_MAX_EXT_FILTERS;
+  MODIFY_REG(hfdcan->Instance->RXGFC, FDCAN_RXGFC_LSE,
+             CAN_BUS_MAX_EXT_FILTERS << FDCAN_RXGFC_LSE_Pos);
+#endif
+
+  // reset rings + reasm
+  for (unsigned i = 0; i < 2; i++) {
+    can_bus_rx_ring_t *r = &b->rx_ring[i];
+    r->head = r->tail = r->rd = 0;
+    r->stalled = 0;
+    r->flush_gen = r->seen_gen = r->flush_pos = 0;
+    r->frames = r->dropped = r->stalls = r->high_water = r->flushed = 0;
+  }
+  // Open readers stay open and follow the rings from their new start.
+  for (unsigned i = 0; i < CAN_BUS_RX_READERS; i++) {
+    can_bus_rx_reader_t *c = &b->readers[i];
+    memset(c->pos, 0, sizeof(c->pos));
+    memset(c->seq, 0, sizeof(c->seq));
+  }
+  // Backpressure leaves frames in the FIFO; blocking mode keeps the oldest.
+  HAL_FDCAN_ConfigRxFifoOverwrite(hfdcan, FDCAN_RX_FIFO0, FDCAN_RX_FIFO_BLOCKING);
+  HAL_FDCAN_ConfigRxFifoOverwrite(hfdcan, FDCAN_RX_FIFO1, FDCAN_RX_FIFO_BLOCKING);
+  for (unsigned i = 0; i < CAN_BUS_TX_PRIO_COUNT; i++) {
+    b->tx_ring[i].head = 0;
+    b->tx_ring[i].tail = 0;
+    b->shaper[i].tokens_ns = (int32_t)b->shaper[i].burst_ns;
+    b->shaper[i].last_us = us_clock_now();
+  }
+#if CAN_BUS_TX_EXPRESS_DEPTH
+  b->tx_express->head = 0;
+  b->tx_express->tail = 0;
+#endif
+  b->express_run = 0;
+  b->shape_wake_us = 0;
+  reasm_clear_all(b);
+  can_bus_reset_id_stats(b);
+  can_bus_reset_talkers(b);
+  b->pack->used = 0;
+  memset(&b->pack_stats, 0, sizeof(b->pack_stats));
+  memset(&b->single_stats, 0, sizeof(b->single_stats));
+  memset(&b->express_stats, 0, sizeof(b->express_stats));
+  memset(&b->mon, 0, sizeof(b->mon));
+  b->boff_rejoin_us = 0;
+  b->boff_min_ms = CAN_BUS_BUSOFF_MIN_MS;
+  b->boff_max_ms = CAN_BUS_BUSOFF_MAX_MS;
+  b->boff_delay_ms = b->boff_min_ms;
+  b->boff_up_ms = HAL_GetTick() - CAN_BUS_BUSOFF_STABLE_MS;
+  b->mon_busy_ns = b->mon_prev_busy_ns = 0;
+  b->mon_tx_bits = b->mon_rx_bits = 0;
+  memset(b->mon_prev, 0, sizeof(b->mon_prev));
+  b->mon_last_us = us_clock_now();
+
+  // Accept everything into the bulk FIFO1 until a filter table is installed;
+  // the reset default would put all of it on the high-priority FIFO0.
+  (void)filter_program_global(b, 0, 0);
+
+  // Timestamp counter: one tick per nominal bit time.
+  const uint32_t ckdiv = hfdcan->Init.ClockDivider; // CKDIV encoding
+  const uint32_t bit_tq = 1u + hfdcan->Init.NominalTimeSeg1 +
+                          hfdcan->Init.NominalTimeSeg2;
+  b->ts_bps = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN) /
+             ((ckdiv ? ckdiv * 2u : 1u) * hfdcan->Init.NominalPrescaler * bit_tq);
+  b->ts_wraps = 0;
+  b->tx_evt_valid = 0;
+#if CAN_BUS_TX_EVENTS
+  memset(&b->tx_ev, 0, sizeof(b->tx_ev));
+  b->tx_lat_total = 0;
+#endif
+#if CAN_BUS_RX_LAT_HIST
+  memset(b->rx_lat_frames, 0, sizeof(b->rx_lat_frames));
+  memset(b->rx_lat_max_us, 0, sizeof(b->rx_lat_max_us));
+  memset(b->rx_lat_hist, 0, sizeof(b->rx_lat_hist));
+#endif
+  HAL_FDCAN_ConfigTimestampCounter(hfdcan, FDCAN_TIMESTAMP_PRESC_1);
+  HAL_FDCAN_EnableTimestampCounter(hfdcan, FDCAN_TIMESTAMP_INTERNAL);
+
+  // Line 0: high-priority FIFO0, timestamp wraparound (so no FIFO0 read
+  // lands between the flag clear and the wrap count) and the RX flush
+  // timeout. Line 1: bulk FIFO1, TX completion, TX events and error state.
+  // Must precede ActivateNotification, which enables the line each group
+  // is routed to.
+  HAL_FDCAN_ConfigInterruptLines(hfdcan,
+                                 FDCAN_IT_GROUP_RX_FIFO0 | FDCAN_IT_GROUP_MISC,
+                                 FDCAN_INTERRUPT_LINE0);
+  HAL_FDCAN_ConfigInterruptLines(hfdcan,
+                                 FDCAN_IT_GROUP_RX_FIFO1 | FDCAN_IT_GROUP_SMSG |
+                                     FDCAN_IT_GROUP_TX_FIFO_ERROR |
+                                     FDCAN_IT_GROUP_BIT_LINE_ERROR |
+                                     FDCAN_IT_GROUP_PROTOCOL_ERROR,
+                                 FDCAN_INTERRUPT_LINE1);
+
+  HAL_NVIC_SetPriority(CAN_BUS_NOTIFY_IRQn, CAN_BUS_NOTIFY_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(CAN_BUS_NOTIFY_IRQn);
+
+  // subscribers static-zeroed
+  HAL_FDCAN_ActivateNotification(hfdcan,
+                                 (CAN_BUS_RX_COALESCE_FIFO == 0)
+                                     ? FDCAN_IT_RX_FIFO0_FULL
+                                     : FDCAN_IT_RX_FIFO0_NEW_MESSAGE,
+                                 0);
+  HAL_FDCAN_ActivateNotification(hfdcan,
+                                 (CAN_BUS_RX_COALESCE_FIFO == 1)
+                                     ? FDCAN_IT_RX_FIFO1_FULL
+                                     : FDCAN_IT_RX_FIFO1_NEW_MESSAGE,
+                                 0);
+#if CAN_BUS_RX_COALESCE_FIFO >= 0
+  // Timeout counter ticks with the timestamp prescaler (one bit time).
+  uint64_t flush = ((uint64_t)CAN_BUS_RX_FLUSH_US * b->ts_bps) / 1000000u;
+  if (flush == 0)
+    flush = 1;
+  if (flush > 0xFFFFu)
+    flush = 0xFFFFu;
+  HAL_FDCAN_ConfigTimeoutCounter(hfdcan,
+                                 (CAN_BUS_RX_COALESCE_FIFO == 0)
+                                     ? FDCAN_TIMEOUT_RX_FIFO0
+                                     : FDCAN_TIMEOUT_RX_FIFO1,
+                                 (uint32_t)flush);
+  HAL_FDCAN_EnableTimeoutCounter(hfdcan);
+  HAL_FDCAN_ActivateNotification(hfdcan, FDCAN_IT_TIMEOUT_OCCURRED, 0);
+#endif
+  HAL_FDCAN_ActivateNotification(hfdcan, FDCAN_IT_TX_COMPLETE,
+                                 FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 |
+                                     FDCAN_TX_BUFFER2);
+  // Failed one-shot transmissions (see "TX events").
+  HAL_FDCAN_ActivateNotification(hfdcan, FDCAN_IT_TX_ABORT_COMPLETE,
+                                 FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 |
+                                     FDCAN_TX_BUFFER2);
+  HAL_FDCAN_ActivateNotification(
+      hfdcan, FDCAN_IT_TX_EVT_FIFO_NEW_DATA | FDCAN_IT_TIMESTAMP_WRAPAROUND, 0);
+  // Error state changes for the bus monitor (not every protocol error).
+  HAL_FDCAN_ActivateNotification(
+      hfdcan, FDCAN_IT_ERROR_WARNING | FDCAN_IT_ERROR_PASSIVE | FDCAN_IT_BUS_OFF,
+      0);
+  if (b->listen_only)
+    SET_BIT(hfdcan->Instance->CCCR, FDCAN_CCCR_MON); // CCE still set
+  if (HAL_FDCAN_Start(hfdcan) != HAL_OK)
+    return HAL_ERROR;
+  return st;
+}
+
+HAL_StatusTypeDef can_bus_set_listen_only(can_bus_t *b, int on) {
+  if (!b)
+    return HAL_ERROR;
+  const uint8_t v = on ? 1u : 0u;
+  if (b->listen_only == v)
+    return HAL_OK;
+  FDCAN_HandleTypeDef *h = b->hfdcan;
+  const int running = (h->State == HAL_FDCAN_STATE_BUSY);
+  if (running && HAL_FDCAN_Stop(h) != HAL_OK)
+    return HAL_ERROR;
+  // Stopped (or never started): INIT and CCE are set, MON is writable.
+  if (v)
+    SET_BIT(h->Instance->CCCR, FDCAN_CCCR_MON);
+  else
+    CLEAR_BIT(h->Instance->CCCR, FDCAN_CCCR_MON);
+  b->listen_only = v;
+  if (running && HAL_FDCAN_Start(h) != HAL_OK)
+    return HAL_ERROR;
+  if (!v)
+    tx_kick(b); // what queued up while listening
+  return HAL_OK;
+}
+
+void can_bus_get_bitrate(can_bus_t *b, can_bus_bitrate_t *out) {
+  if (!b || !out)
+    return;
+  *out = b->rate;
+  out->listen_only = b->listen_only;
+}
+
+can_bus_t *can_bus_get(unsigned index) {
+  return (index < g_bus_count) ? &g_bus[index] : NULL;
+}
+
+// Set or clear subscriber i's bit for every ID it matches.
+static void sub_map_update(can_bus_t *b, unsigned i, int on) {
+  const uint8_t bit = (uint8_t)(1u << i);
+  const uint16_t mask = b->subs[i].mask & 0x7FFu;
+  const uint16_t id = b->subs[i].id & mask;
+  for (uint32_t sid = 0; sid < 0x800u; sid++) {
+    if ((sid & mask) != id)
+      continue;
+    if (on)
+      b->sub_map[sid] |= bit;
+    else
+      b->sub_map[sid] &= (uint8_t)~bit;
+  }
+}
+
+static HAL_StatusTypeDef sub_add(can_bus_t *b, can_bus_rx_cb_t cb,
+                                 can_bus_msg_cb_t msg_cb, uint16_t id,
+                                 uint16_t mask, void *user) {
+  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
+    if (b->subs[i].cb == cb && b->subs[i].msg_cb == msg_cb &&
+        b->subs[i].user == user)
+      return HAL_ERROR;
+  }
+  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
+    if (b->subs[i].cb == NULL && b->subs[i].msg_cb == NULL) {
+      b->subs[i].id = id;
+      b->subs[i].mask = mask;
+      b->subs[i].user = user;
+      b->subs[i].cb = cb;
+      b->subs[i].msg_cb = msg_cb;
+      sub_map_update(b, i, 1); // entry complete before it can be dispatched
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+static HAL_StatusTypeDef sub_remove(can_bus_t *b, can_bus_rx_cb_t cb,
+                                    can_bus_msg_cb_t msg_cb, void *user) {
+  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
+    if (b->subs[i].cb == cb && b->subs[i].msg_cb == msg_cb &&
+        b->subs[i].user == user) {
+      sub_map_update(b, i, 0);
+      b->subs[i].cb = NULL;
+      b->subs[i].msg_cb = NULL;
+      b->subs[i].user = NULL;
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+HAL_StatusTypeDef can_bus_subscribe_rx(can_bus_t *b, can_bus_rx_cb_t cb,
+                                       void *user) {
+  if (!b || !cb)
+    return HAL_ERROR;
+  return sub_add(b, cb, NULL, 0, 0, user);
+}
+
+HAL_StatusTypeDef can_bus_subscribe_rx_match(can_bus_t *b, uint16_t std_id,
+                                             uint16_t mask, can_bus_msg_cb_t cb,
+                                             void *user) {
+  if (!b || !cb)
+    return HAL_ERROR;
+  return sub_add(b, NULL, cb, std_id, mask, user);
+}
+
+HAL_StatusTypeDef can_bus_unsubscribe_rx_match(can_bus_t *b,
+                                               can_bus_msg_cb_t cb,
+                                               void *user) {
+  if (!b || !cb)
+    return HAL_ERROR;
+  return sub_remove(b, NULL, cb, user);
+}
+
+HAL_StatusTypeDef can_bus_subscribe_rx_batch(can_bus_t *b,
+                                             can_bus_rx_batch_cb_t cb,
+                                             void *user) {
+  if (!b || !cb)
+    return HAL_ERROR;
+
+  for (unsigned i = 0; i < CAN_BUS_MAX_BATCH_SUBSCRIBERS; i++) {
+    if (b->batch_subs[i].cb == cb && b->batch_subs[i].user == user)
+      return HAL_ERROR;
+  }
+  for (unsigned i = 0; i < CAN_BUS_MAX_BATCH_SUBSCRIBERS; i++) {
+    if (b->batch_subs[i].cb == NULL) {
+      b->batch_subs[i].cb = cb;
+      b->batch_subs[i].user = user;
+      b->batch_sub_count++;
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+HAL_StatusTypeDef can_bus_unsubscribe_rx_batch(can_bus_t *b,
+                                               can_bus_rx_batch_cb_t cb,
+                                               void *user) {
+  if (!b || !cb)
+    return HAL_ERROR;
+
+  for (unsigned i = 0; i < CAN_BUS_MAX_BATCH_SUBSCRIBERS; i++) {
+    if (b->batch_subs[i].cb == cb && b->batch_subs[i].user == user) {
+      b->batch_subs[i].cb = NULL;
+      b->batch_subs[i].user = NULL;
+      b->batch_sub_count--;
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+HAL_StatusTypeDef can_bus_set_reasm_alloc(can_bus_t *b,
+                                          can_bus_buf_alloc_t alloc,
+                                          can_bus_buf_free_t free_fn) {
+  if (!b || (alloc == NULL) != (free_fn == NULL))
+    return HAL_ERROR;
+  if (b->reasm_active != 0)
+    return HAL_BUSY; // buffers in flight belong to the current allocator
+  b->reasm_alloc = alloc;
+  b->reasm_free = free_fn;
+  return HAL_OK;
+}
+
+void can_bus_set_reasm_pause(can_bus_t *b, uint16_t from_id) {
+  if (b)
+    b->reasm_pause_id = from_id;
+}
+
+void can_bus_set_reasm_low_limit(can_bus_t *b, unsigned slots) {
+  if (!b)
+    return;
+  const unsigned max = CAN_BUS_REASM_SLOTS - CAN_BUS_REASM_RESERVED;
+  b->reasm_low_max = (slots == 0u || slots > max) ? max : slots;
+}
+
+HAL_StatusTypeDef can_bus_set_reasm_priority(can_bus_t *b, uint16_t first_id,
+                                             uint16_t last_id) {
+  if (!b || first_id > last_id || last_id > 0x7FFu)
+    return HAL_ERROR;
+  // The low-priority count is kept per slot start; redo it for the new range.
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  b->reasm_high_first = first_id;
+  b->reasm_high_last = last_id;
+  unsigned low = 0;
+  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
+    const can_bus_reasm_slot_t *s = &b->reasm[i];
+    if ((s->state == CAN_BUS_REASM_ACTIVE || s->state == CAN_BUS_REASM_HELD) &&
+        !reasm_is_high(b, s->std_id))
+      low++;
+  }
+  b->reasm_low = low;
+  __set_PRIMASK(primask);
+  return HAL_OK;
+}
+
+void can_bus_set_rx_take(can_bus_t *b, can_bus_rx_take_cb_t cb, void *user) {
+  if (!b)
+    return;
+  b->rx_take = NULL;
+  b->rx_take_user = user;
+  b->rx_take = cb;
+}
+
+HAL_StatusTypeDef can_bus_subscribe_stream(can_bus_t *b, uint16_t std_id,
+                                           uint16_t mask,
+                                           can_bus_stream_cb_t cb, void *user) {
+  if (!b)
+    return HAL_ERROR;
+  can_bus_stream_sub_t *free_slot = NULL;
+  for (unsigned i = 0; i < CAN_BUS_MAX_STREAM_SUBSCRIBERS; i++) {
+    can_bus_stream_sub_t *s = &b->stream_subs[i];
+    if (s->cb && s->id == std_id && s->mask == mask) {
+      if (cb)
+        return HAL_ERROR;
+      s->cb = NULL;
+      return HAL_OK;
+    }
+    if (!s->cb && !free_slot)
+      free_slot = s;
+  }
+  if (!cb || !free_slot)
+    return HAL_ERROR;
+  free_slot->id = std_id;
+  free_slot->mask = mask;
+  free_slot->user = user;
+  free_slot->cb = cb;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef can_bus_subscribe_id(can_bus_t *b, uint16_t std_id,
+                                       can_bus_frame_cb_t cb, void *user) {
+  if (!b)
+    return HAL_ERROR;
+  can_bus_id_sub_t *free_slot = NULL;
+  for (unsigned i = 0; i < CAN_BUS_MAX_ID_SUBSCRIBERS; i++) {
+    can_bus_id_sub_t *s = &b->id_subs[i];
+    if (s->cb && s->std_id == std_id) {
+      if (cb)
+        return HAL_ERROR;
+      s->cb = NULL;
+      return HAL_OK;
+    }
+    if (!s->cb && !free_slot)
+      free_slot = s;
+  }
+  if (!cb || !free_slot)
+    return HAL_ERROR;
+  free_slot->std_id = std_id;
+  free_slot->user = user;
+  free_slot->cb = cb;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef can_bus_set_peer_profile(can_bus_t *b, uint16_t std_id,
+                                           can_bus_profile_t profile) {
+  if (!b || std_id > 0x7FFu)
+    return HAL_ERROR;
+  can_bus_peer_t *p = peer_classic(b, std_id);
+  if (profile == CAN_BUS_PROFILE_FD) {
+    if (p) {
+      p->used = 0;
+      b->peer_count--;
+    }
+    return HAL_OK;
+  }
+  if (profile != CAN_BUS_PROFILE_CLASSIC)
+    return HAL_ERROR;
+  if (p)
+    return HAL_OK;
+  for (unsigned i = 0; i < CAN_BUS_PEER_PROFILES; i++) {
+    if (!b->peers[i].used) {
+      b->peers[i].std_id = std_id;
+      b->peers[i].rx_valid = 0;
+      b->peers[i].used = 1;
+      b->peer_count++;
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+can_bus_profile_t can_bus_get_peer_profile(can_bus_t *b, uint16_t std_id) {
+  return (b && peer_classic(b, std_id)) ? CAN_BUS_PROFILE_CLASSIC
+                                        : CAN_BUS_PROFILE_FD;
+}
+
+void can_bus_set_rx_notify(can_bus_t *b, can_bus_rx_notify_cb_t cb) {
+  if (b)
+    b->rx_notify = cb;
+}
+
+// One vector for all instances; each callback checks its own rings.
+void can_bus_notify_irq(void) {
+  for (unsigned i = 0; i < g_bus_count; i++) {
+    can_bus_rx_notify_cb_t notify = g_bus[i].rx_notify;
+    if (notify)
+      notify();
+  }
+}
+
+HAL_StatusTypeDef can_bus_set_responder(can_bus_t *b, uint16_t std_id,
+                                        can_bus_responder_cb_t cb,
+                                        void *user) {
+  if (!b || std_id > 0x7FFu)
+    return HAL_ERROR;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  b->resp_cb = NULL;
+  b->resp_id = std_id;
+  b->resp_user = user;
+  b->resp_cb = cb;
+  __set_PRIMASK(primask);
+  return HAL_OK;
+}
+
+void can_bus_set_rx_tap(can_bus_t *b, can_bus_rx_tap_cb_t cb, void *user) {
+  if (!b)
+    return;
+  b->rx_tap = NULL;
+  b->rx_tap_user = user;
+  b->rx_tap = cb;
+}
+
+void can_bus_set_capture(can_bus_t *b, can_bus_rx_tap_cb_t cb, void *user) {
+  if (!b)
+    return;
+  b->capture = NULL;
+  b->capture_user = user;
+  b->capture = cb;
+}
+
+HAL_StatusTypeDef can_bus_inject_rx(can_bus_t *b, can_bus_rx_fifo_t fifo,
+                                    uint32_t id, uint8_t flags,
+                                    const uint8_t *data, size_t len) {
+  if (!b || (unsigned)fifo > 1u || (!data && len) ||
+      len > ((flags & CAN_BUS_RAW_FD) ? 64u : 8u))
+    return HAL_ERROR;
+  if (flags & CAN_BUS_RAW_EXT) {
+    if (!CAN_BUS_FRAG_EXT_ID || id > CAN_BUS_ID_EXT_Msk)
+      return HAL_ERROR; // the drain only keeps these with fragment IDs
+    id |= CAN_BUS_ID_XTD;
+  } else if (id > 0x7FFu) {
+    return HAL_ERROR;
+  }
+  uint32_t words[16] = {0};
+  memcpy(words, data, len);
+
+  can_bus_rx_ring_t *r = &b->rx_ring[fifo];
+  const uint32_t need = rb_rec_bytes((uint8_t)len);
+  HAL_StatusTypeDef st = HAL_BUSY;
+  // The drain ISR is the ring's producer; keep it out while this one is.
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint32_t h = r->head;
+  const uint32_t left = r->mask + 1u - (h & r->mask);
+  const uint32_t skip = (left < need) ? left : 0u;
+  if (r->mask + 1u - (h - r->tail) >= skip + need) {
+    (void)rb_push_words(r, id, (uint32_t)ts_now_ticks(b), words, (uint8_t)len,
+                        flags & (CAN_BUS_RAW_FD | CAN_BUS_RAW_BRS));
+    st = HAL_OK;
+  }
+  __set_PRIMASK(primask);
+  if (st == HAL_OK)
+    NVIC_SetPendingIRQ(CAN_BUS_NOTIFY_IRQn);
+  return st;
+}
+
+HAL_StatusTypeDef can_bus_get_rx_ring_stats(can_bus_t *b,
+                                            can_bus_rx_fifo_t fifo,
+                                            can_bus_rx_ring_stats_t *out) {
+  if (!b || !out || (unsigned)fifo > 1u)
+    return HAL_ERROR;
+  const can_bus_rx_ring_t *r = &b->rx_ring[fifo];
+  out->size_bytes = r->mask + 1u;
+  out->used_bytes = r->head - r->tail;
+  out->high_water_bytes = r->high_water;
+  out->frames = r->frames;
+  out->dropped = r->dropped;
+  out->flushed = r->flushed;
+  out->stalls = r->stalls;
+  out->policy = r->policy;
+  return HAL_OK;
+}
+
+int can_bus_rx_reader_open(can_bus_t *b, can_bus_rx_tap_cb_t cb,
+                           void *user) {
+  if (!b || !cb)
+    return -1;
+  for (unsigned i = 0; i < CAN_BUS_RX_READERS; i++) {
+    can_bus_rx_reader_t *c = &b->readers[i];
+    if (c->cb)
+      continue;
+    memset(&c->st, 0, sizeof(c->st));
+    c->user = user;
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (unsigned k = 0; k < 2; k++) {
+      c->pos[k] = b->rx_ring[k].head;
+      c->seq[k] = b->rx_ring[k].frames;
+    }
+    c->cb = cb;
+    __set_PRIMASK(primask);
+    return (int)i;
+  }
+  return -1;
+}
+
+void can_bus_rx_reader_close(can_bus_t *b, int reader) {
+  if (b && reader >= 0 && (unsigned)reader < CAN_BUS_RX_READERS)
+    b->readers[reader].cb = NULL;
+}
+
+size_t can_bus_rx_reader_poll(can_bus_t *b, int reader, size_t max) {
+  if (!b || reader < 0 || (unsigned)reader >= CAN_BUS_RX_READERS)
+    return 0;
+  can_bus_rx_reader_t *c = &b->readers[reader];
+  if (!c->cb)
+    return 0;
+  size_t n = 0;
+  // FIFO0 emptied before each FIFO1 frame, as in can_bus_process_rx().
+  while (n < max) {
+    if (reader_next(b, c, 0) || reader_next(b, c, 1))
+      n++;
+    else
+      break;
+  }
+  const uint32_t lag = (b->rx_ring[0].frames - c->seq[0]) +
+                       (b->rx_ring[1].frames - c->seq[1]);
+  if (lag > c->st.lag_max)
+    c->st.lag_max = lag;
+  return n;
+}
+
+HAL_StatusTypeDef can_bus_get_rx_reader_stats(can_bus_t *b, int reader,
+                                              can_bus_rx_reader_stats_t *out) {
+  if (!b || !out || reader < 0 || (unsigned)reader >= CAN_BUS_RX_READERS)
+    return HAL_ERROR;
+  const can_bus_rx_reader_t *c = &b->readers[reader];
+  if (!c->cb)
+    return HAL_ERROR;
+  *out = c->st;
+  out->lag = (b->rx_ring[0].frames - c->seq[0]) +
+             (b->rx_ring[1].frames - c->seq[1]);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef can_bus_get_rx_lat_stats(can_bus_t *b,
+                                           can_bus_rx_fifo_t fifo,
+                                           can_bus_rx_lat_stats_t *out) {
+  if (!b || !out || (unsigned)fifo > 1u)
+    return HAL_ERROR;
+  memset(out, 0, sizeof(*out));
+#if CAN_BUS_RX_LAT_HIST
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  out->frames = b->rx_lat_frames[fifo];
+  out->max_us = b->rx_lat_max_us[fifo];
+  memcpy(out->hist, b->rx_lat_hist[fifo], sizeof(out->hist));
+  __set_PRIMASK(primask);
+  const uint32_t r50 = (uint32_t)(((uint64_t)out->frames * 500u + 999u) / 1000u);
+  const uint32_t r99 = (uint32_t)(((uint64_t)out->frames * 990u + 999u) / 1000u);
+  out->p50_us = out->p99_us = out->max_us;
+  uint32_t seen = 0;
+  for (unsigned i = 0; i < CAN_BUS_RX_LAT_BINS - 1u; i++) {
+    const uint32_t prev = seen;
+    seen += out->hist[i];
+    const uint32_t edge = (1u << i) < out->max_us ? (1u << i) : out->max_us;
+    if (prev < r50 && seen >= r50)
+      out->p50_us = edge;
+    if (prev < r99 && seen >= r99)
+      out->p99_us = edge;
+  }
+#endif
+  return HAL_OK;
+}
+
+void can_bus_get_responder_stats(can_bus_t *b, uint32_t *sent,
+                                 uint32_t *dropped) {
+  if (!b)
+    return;
+  if (sent)
+    *sent = b->resp_sent;
+  if (dropped)
+    *dropped = b->resp_dropped;
+}
+
+HAL_StatusTypeDef can_bus_set_routes(can_bus_t *b,
+                                     const can_bus_route_t *routes,
+                                     size_t count) {
+  if (!b || count > CAN_BUS_MAX_ROUTES || (count && !routes))
+    return HAL_ERROR;
+  for (size_t i = 0; i < count; i++) {
+    const can_bus_route_t *rt = &routes[i];
+    if (!rt->dst || rt->dst == b || rt->id > 0x7FFu || rt->mask > 0x7FFu ||
+        (rt->dst_id > 0x7FFu && rt->dst_id != CAN_BUS_ROUTE_SAME_ID))
+      return HAL_ERROR;
+  }
+  // The ISRs keep matching against the old table until the new one is
+  // published whole; readers are ISRs only, so the spare is free at once.
+  can_bus_route_tab_t *tab = table_swap_begin(&b->routes, 0);
+  if (!tab)
+    return HAL_ERROR;
+  for (size_t i = 0; i < count; i++)
+    tab->routes[i] = routes[i];
+  tab->count = (uint8_t)count;
+  table_swap_publish(&b->routes);
+  return HAL_OK;
+}
+
+void can_bus_get_route_stats(can_bus_t *b, uint32_t *forwarded,
+                             uint32_t *dropped) {
+  if (!b)
+    return;
+  if (forwarded)
+    *forwarded = b->fwd_frames;
+  if (dropped)
+    *dropped = b->fwd_dropped;
+}
+
+HAL_StatusTypeDef can_bus_get_id_stats(can_bus_t *b, uint16_t std_id,
+                                       can_bus_id_stats_t *out) {
+  if (!b || !out)
+    return HAL_ERROR;
+  for (unsigned i = 0; i < CAN_BUS_ID_STATS_SLOTS; i++) {
+    if (b->id_stats[i].used && b->id_stats[i].pub.std_id == std_id) {
+      *out = b->id_stats[i].pub;
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+size_t can_bus_get_all_id_stats(can_bus_t *b, can_bus_id_stats_t *out,
+                                size_t max, uint32_t *untracked) {
+  size_t n = 0;
+  if (!b)
+    return 0;
+  for (unsigned i = 0; i < CAN_BUS_ID_STATS_SLOTS && n < max; i++) {
+    if (b->id_stats[i].used && out)
+      out[n++] = b->id_stats[i].pub;
+  }
+  if (untracked)
+    *untracked = b->id_stats_untracked;
+  return n;
+}
+
+size_t can_bus_get_talkers(can_bus_t *b, can_bus_talker_t *out, size_t max,
+                           uint32_t *evicted) {
+  if (!b)
+    return 0;
+  if (evicted)
+    *evicted = b->talker_evicted;
+  if (!out)
+    return 0;
+  // Busiest first: pick the next largest byte count below the last one
+  // taken, ties broken by slot order.
+  uint32_t taken[(CAN_BUS_TALKER_SLOTS + 31u) / 32u] = {0};
+  const uint64_t now = ts_now_ticks(b);
+  size_t n = 0;
+  for (; n < max; n++) {
+    const can_bus_talker_slot_t *best = NULL;
+    unsigned best_i = 0;
+    for (unsigned i = 0; i < CAN_BUS_TALKER_SLOTS; i++) {
+      const can_bus_talker_slot_t *t = &b->talkers[i];
+      if (t->frames == 0 || (taken[i / 32u] & (1u << (i % 32u))))
+        continue;
+      if (!best || t->bytes > best->bytes) {
+        best = t;
+        best_i = i;
+      }
+    }
+    if (!best)
+      break;
+    taken[best_i / 32u] |= 1u << (best_i % 32u);
+    can_bus_talker_t *o = &out[n];
+    o->id = (best->id & CAN_BUS_ID_XTD)
+                ? ((best->id & CAN_BUS_ID_EXT_Msk) | CAN_BUS_TALKER_EXT)
+                : best->id;
+    o->frames = best->frames;
+    o->bytes = best->bytes;
+    o->age_us = (uint32_t)ts_ticks_to_us(b, (uint32_t)((uint32_t)now -
+                                                       best->last_ts));
+    o->gap_min_us = (uint32_t)ts_ticks_to_us(b, best->gap_min);
+    o->gap_max_us = (uint32_t)ts_ticks_to_us(b, best->gap_max);
+  }
+  return n;
+}
+
+void can_bus_reset_talkers(can_bus_t *b) {
+  if (!b)
+    return;
+  memset(b->talkers, 0, CAN_BUS_TALKER_SLOTS * sizeof(b->talkers[0]));
+  b->talker_evicted = 0;
+}
+
+uint64_t can_bus_time_us(can_bus_t *b) {
+  if (!b)
+    return 0;
+  return ts_ticks_to_us(b, ts_now_ticks(b));
+}
+
+HAL_StatusTypeDef can_bus_last_rx_time_us(can_bus_t *b, uint16_t std_id,
+                                          uint64_t *t_us) {
+  if (!t_us || !b)
+    return HAL_ERROR;
+  for (unsigned i = 0; i < CAN_BUS_ID_STATS_SLOTS; i++) {
+    if (b->id_stats[i].used && b->id_stats[i].pub.std_id == std_id) {
+      if (!b->id_stats[i].has_rx_ts)
+        return HAL_ERROR;
+      *t_us = ts_widen_us(b, b->id_stats[i].last_rx_ts);
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+HAL_StatusTypeDef can_bus_last_tx_time_us(can_bus_t *b, uint16_t std_id,
+                                          uint64_t *t_us) {
+  if (!t_us || !b)
+    return HAL_ERROR;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint8_t valid = b->tx_evt_valid;
+  const uint32_t id = b->tx_evt_id;
+  const uint32_t ts = b->tx_evt_ts;
+  __set_PRIMASK(primask);
+  if (!valid || id != std_id)
+    return HAL_ERROR;
+  *t_us = ts_widen_us(b, ts);
+  return HAL_OK;
+}
+
+void can_bus_reset_id_stats(can_bus_t *b) {
+  // In-flight slots keep their index; point them back at the default.
+  for (unsigned i = 0; i < CAN_BUS_REASM_SLOTS; i++) {
+    b->reasm[i].stats_idx = CAN_BUS_ID_STATS_NONE;
+  }
+  memset(b->id_stats, 0, CAN_BUS_ID_STATS_SLOTS * sizeof(b->id_stats[0]));
+  b->id_stats_untracked = 0;
+}
+
+HAL_StatusTypeDef can_bus_unsubscribe_rx(can_bus_t *b, can_bus_rx_cb_t cb,
+                                         void *user) {
+  if (!b || !cb)
+    return HAL_ERROR;
+  return sub_remove(b, cb, NULL, user);
+}
+
+// Queue a single CAN/CAN-FD payload up to 64 bytes.
+// If len is not an exact FD size, it rounds up and zero-pads.
+// Returns HAL_BUSY if the class's TX ring has no free slot.
+HAL_StatusTypeDef can_bus_send_bytes_prio(can_bus_t *b, const uint8_t *bytes,
+                                          size_t len, uint32_t std_id,
+                                          can_bus_tx_prio_t prio) {
+  if (!b)
+    return HAL_ERROR;
+  if (!bytes || len == 0)
+    return HAL_ERROR;
+  if ((unsigned)prio >= CAN_BUS_TX_PRIO_COUNT)
+    return HAL_ERROR;
+
+  uint32_t id = std_id & 0x7FFu;
+  if (peer_classic(b, id)) {
+    if (len > CAN_BUS_CLASSIC_LEN)
+      return HAL_ERROR;
+    id |= CAN_BUS_ID_CLASSIC;
+  }
+  if (len > 64)
+    len = 64;
+  if (pack_flush_class(b, prio) != HAL_OK)
+    return HAL_BUSY;
+  return tx_queue_frame(b, prio, id, bytes, len);
+}
+
+HAL_StatusTypeDef can_bus_send_bytes(can_bus_t *b, const uint8_t *bytes,
+                                     size_t len, uint32_t std_id) {
+  return can_bus_send_bytes_prio(b, bytes, len, std_id, CAN_BUS_TX_PRIO_LOW);
+}
+
+HAL_StatusTypeDef can_bus_send_raw(can_bus_t *b, uint32_t id, uint8_t flags,
+                                   const uint8_t *bytes, size_t len,
+                                   can_bus_tx_prio_t prio) {
+  if (!b || (!bytes && len != 0) || (unsigned)prio >= CAN_BUS_TX_PRIO_COUNT)
+    return HAL_ERROR;
+  if (flags & CAN_BUS_RAW_EXT)
+    id = (id & CAN_BUS_ID_EXT_Msk) | CAN_BUS_ID_XTD;
+  else
+    id &= 0x7FFu;
+  if (!(flags & CAN_BUS_RAW_FD)) {
+    if (len > CAN_BUS_CLASSIC_LEN)
+      return HAL_ERROR;
+    id |= CAN_BUS_ID_CLASSIC;
+  } else if (len > 64) {
+    return HAL_ERROR;
+  }
+  if (pack_flush_class(b, prio) != HAL_OK)
+    return HAL_BUSY;
+  return tx_queue_frame(b, prio, id, bytes, len);
+}
+
+// =========================
+// Pre-loaded frames
+// =========================
+//
+// The G4 message RAM has no dedicated TX buffers: its three TX elements
+// are all FIFO (or all queue). So a pre-loaded frame is kept ready-built in
+// a TX slot image here, and can_bus_tx_fire() only copies it into the next
+// free hardware element and requests it, from a thread or an ISR, ahead of
+// every software ring and not shaped or windowed. It still goes after the
+// frames already in the hardware FIFO, at most CAN_BUS_TX_HW_DEPTH -
+// CAN_BUS_TX_HW_RESERVE of them bulk. Fired frames are time-stamped, so
+// can_bus_last_tx_time_us() says when one actually left.
+
+HAL_StatusTypeDef can_bus_tx_preload(can_bus_t *b, unsigned slot,
+                                     uint32_t std_id, const uint8_t *bytes,
+                                     size_t len) {
+  if (!b || slot >= CAN_BUS_TX_PRELOAD_SLOTS || (!bytes && len != 0) ||
+      len > 64u)
+    return HAL_ERROR;
+  uint32_t id = std_id & 0x7FFu;
+  if (peer_classic(b, id)) {
+    if (len > CAN_BUS_CLASSIC_LEN)
+      return HAL_ERROR;
+    id |= CAN_BUS_ID_CLASSIC;
+  }
+  const size_t wire = can_bus_round_up_fd_len(len);
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  can_bus_tx_frame_t *f = &b->preload[slot];
+  f->id = id;
+  f->len = (uint8_t)wire;
+  f->marker = 1;
+  if (len)
+    memcpy(f->data, bytes, len);
+  if (wire > len)
+    memset(f->data + len, 0, wire - len);
+  b->preload_set |= (uint8_t)(1u << slot);
+  __set_PRIMASK(primask);
+  return HAL_OK;
+}
+
+void can_bus_tx_unload(can_bus_t *b, unsigned slot) {
+  if (b && slot < CAN_BUS_TX_PRELOAD_SLOTS)
+    b->preload_set &= (uint8_t)~(1u << slot);
+}
+
+CCM_FUNC HAL_StatusTypeDef can_bus_tx_fire(can_bus_t *b, unsigned slot) {
+  if (!b || slot >= CAN_BUS_TX_PRELOAD_SLOTS ||
+      (b->preload_set & (1u << slot)) == 0)
+    return HAL_ERROR;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const HAL_StatusTypeDef st =
+      (tx_hw_add(b, &b->preload[slot]) == HAL_OK) ? HAL_OK : HAL_BUSY;
+  __set_PRIMASK(primask);
+  return st;
+}
+
+// =========================
+// Cyclic frames
+// =========================
+//
+// Frames registered with a period (can_bus_cyclic_add()) are sent by the
+// pump itself: the us_clock alarm, a TIM2 compare interrupt, kicks it at
+// the earliest due time, and the pump copies every due frame from its
+// caller's payload into the hardware FIFO ahead of the software rings,
+// neither shaped nor windowed, like a fired pre-loaded frame. No thread
+// runs, so the period holds however busy the telemetry threads are.
+//
+// Due times stay on the grid phase + k * period: a frame sent late doesn't
+// move the next one. A frame the hardware FIFO had no room for stays due
+// and goes from the next TX completion; periods missed altogether (bus-off,
+// a FIFO full for a whole period) are skipped and counted, not sent in a
+// burst.
+
+#define CAN_BUS_CYCLIC_MIN_US 100u
+
+#if CAN_BUS_CYCLIC_SLOTS
+// Send what is due and re-aim the alarm. IRQs masked (the pump's caller).
+static CCM_FUNC void cyclic_service(can_bus_t *b, uint64_t now) {
+  if (!b->cyclic_next_us || (int64_t)(now - b->cyclic_next_us) < 0)
+    return;
+  uint64_t next = 0;
+  for (unsigned i = 0; i < CAN_BUS_CYCLIC_SLOTS; i++) {
+    can_bus_cyclic_t *c = &b->cyclic[i];
+    if (!c->used)
+      continue;
+    if ((int64_t)(now - c->next_us) >= 0) {
+      can_bus_tx_frame_t *f = &c->img;
+      if (c->len)
+        memcpy(f->data, c->data, c->len);
+      if (tx_hw_add(b, f) == HAL_OK) {
+        const uint64_t late = now - c->next_us;
+        if (late > c->late_max_us)
+          c->late_max_us = (late > UINT32_MAX) ? UINT32_MAX : (uint32_t)late;
+        c->sent++;
+        c->next_us += c->period_us;
+        if ((int64_t)(now - c->next_us) >= 0) {
+          const uint64_t miss = (now - c->next_us) / c->period_us + 1u;
+          c->skipped += (uint32_t)miss;
+          c->next_us += miss * c->period_us;
+        }
+      }
+    }
+    if (!next || (int64_t)(c->next_us - next) < 0)
+      next = c->next_us;
+  }
+  b->cyclic_next_us = next;
+  alarm_arm();
+}
+
+int can_bus_cyclic_add(can_bus_t *b, uint32_t id, uint8_t flags,
+                       const void *data, size_t len, uint32_t period_us,
+                       uint32_t phase_us) {
+  if (!b || (!data && len != 0) || len > 64u ||
+      period_us < CAN_BUS_CYCLIC_MIN_US || period_us > 0x7FFFFFFFu)
+    return -1;
+  if (flags & CAN_BUS_RAW_EXT)
+    id = (id & CAN_BUS_ID_EXT_Msk) | CAN_BUS_ID_XTD;
+  else
+    id &= 0x7FFu;
+  if (!(flags & CAN_BUS_RAW_FD)) {
+    if (len > CAN_BUS_CLASSIC_LEN)
+      return -1;
+    id |= CAN_BUS_ID_CLASSIC;
+  }
+  const size_t wire = can_bus_round_up_fd_len(len);
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  int h = -1;
+  for (unsigned i = 0; i < CAN_BUS_CYCLIC_SLOTS; i++) {
+    if (!b->cyclic[i].used) {
+      h = (int)i;
+      break;
+    }
+  }
+  if (h >= 0) {
+    can_bus_cyclic_t *c = &b->cyclic[h];
+    memset(c, 0, sizeof(*c));
+    c->data = data;
+    c->len = (uint8_t)len;
+    c->period_us = period_us;
+    c->img.id = id;
+    c->img.len = (uint8_t)wire;
+    c->img.marker = 1;
+    c->next_us = us_clock_now() + phase_us;
+    c->used = 1;
+    if (!b->cyclic_next_us || (int64_t)(c->next_us - b->cyclic_next_us) < 0)
+      b->cyclic_next_us = c->next_us;
+    tx_pump(b); // sends it now if the phase is 0, else arms the alarm
+    alarm_arm();
+  }
+  __set_PRIMASK(primask);
+  return h;
+}
+
+void can_bus_cyclic_remove(can_bus_t *b, int h) {
+  if (!b || h < 0 || (unsigned)h >= CAN_BUS_CYCLIC_SLOTS)
+    return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  b->cyclic[h].used = 0;
+  // A stale earliest time only costs one early alarm that finds nothing.
+  __set_PRIMASK(primask);
+}
+
+void can_bus_get_cyclic_stats(can_bus_t *b, int h,
+                              can_bus_cyclic_stats_t *out) {
+  if (!out)
+    return;
+  memset(out, 0, sizeof(*out));
+  if (!b || h < 0 || (unsigned)h >= CAN_BUS_CYCLIC_SLOTS)
+    return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const can_bus_cyclic_t *c = &b->cyclic[h];
+  if (c->used) {
+    out->sent = c->sent;
+    out->skipped = c->skipped;
+    out->late_max_us = c->late_max_us;
+    out->period_us = c->period_us;
+  }
+  __set_PRIMASK(primask);
+}
+#else
+static inline void cyclic_service(can_bus_t *b, uint64_t now) {
+  (void)b;
+  (void)now;
+}
+
+int can_bus_cyclic_add(can_bus_t *b, uint32_t id, uint8_t flags,
+                       const void *data, size_t len, uint32_t period_us,
+                       uint32_t phase_us) {
+  (void)b;
+  (void)id;
+  (void)flags;
+  (void)data;
+  (void)len;
+  (void)period_us;
+  (void)phase_us;
+  return -1;
+}
+
+void can_bus_cyclic_remove(can_bus_t *b, int h) {
+  (void)b;
+  (void)h;
+}
+
+void can_bus_get_cyclic_stats(can_bus_t *b, int h,
+                              can_bus_cyclic_stats_t *out) {
+  (void)b;
+  (void)h;
+  if (out)
+    memset(out, 0, sizeof(*out));
+}
+#endif
+
+// Write `hdr`, `take` bytes from the cursor and zero padding as the
+// ceil(wire / 4) words of a frame payload, one store per word. `dst` is a
+// TX ring slot or a message RAM element.
+static CCM_FUNC void frag_emit(volatile uint32_t *dst, const uint8_t *hdr,
+                               size_t hdr_len, can_bus_iov_cursor_t *c,
+                               size_t take, size_t wire) {
+  const size_t end = hdr_len + take;
+  size_t i = 0;
+  for (size_t w = 0; w < (wire + 3u) / 4u; w++) {
+    while (i >= hdr_len && i < end && c->off == c->iov->len) {
+      c->iov++; // skip to the next non-empty segment
+      c->off = 0;
+    }
+    uint32_t v = 0;
+    if (i >= hdr_len && i + 4u <= end && c->iov->len - c->off >= 4u) {
+      memcpy(&v, (const uint8_t *)c->iov->base + c->off, 4); // unaligned ok
+      c->off += 4u;
+      i += 4u;
+    } else {
+      for (unsigned b = 0; b < 4u; b++, i++) {
+        uint8_t byte = 0;
+        if (i < hdr_len) {
+          byte = hdr[i];
+        } else if (i < end) {
+          while (c->off == c->iov->len) {
+            c->iov++;
+            c->off = 0;
+          }
+          byte = ((const uint8_t *)c->iov->base)[c->off++];
+        }
+        v |= (uint32_t)byte << (8u * b);
+      }
+    }
+    dst[w] = v;
+  }
+}
+
+// Fragments may skip the TX ring while nothing queued would go out before
+// them anyway: every ring of this class and above is empty, the class's
+// shaper and window let frame (id, len) through, and the hardware FIFO has
+// room (bulk frames keep CAN_BUS_TX_HW_RESERVE free).
+static CCM_FUNC int tx_direct_ok(can_bus_t *b, can_bus_tx_prio_t prio,
+                                 uint32_t id, uint8_t len) {
+  for (unsigned p = 0; p <= (unsigned)prio; p++) {
+    if (tx_class_ring(b, p))
+      return 0;
+  }
+  const uint32_t hw_free = HAL_FDCAN_GetTxFifoFreeLevel(b->hfdcan);
+  const uint64_t now = us_clock_now();
+  if (!shape_ok(b, prio, now) || !window_ok(b, prio, now, id, len, hw_free))
+    return 0;
+  return hw_free > ((prio == CAN_BUS_TX_PRIO_LOW) ? CAN_BUS_TX_HW_RESERVE : 0u);
+}
+
+#if CAN_BUS_TX_EXPRESS_DEPTH
+// Whether a bulk message of `cnt` fragments on `std_id` takes the express
+// lane: only with ring frames waiting (else the ring is as quick and keeps
+// the order), if it is short or wins arbitration against the train at the
+// head of the ring, and if the lane has room for all of it.
+static int tx_express_ok(can_bus_t *b, uint32_t std_id, size_t cnt) {
+  const can_bus_tx_ring_t *r = &b->tx_ring[CAN_BUS_TX_PRIO_LOW];
+  const uint16_t t = r->tail; // the slot stays ours to read: one producer
+  if (t == r->head || tx_rb_free(b->tx_express) < cnt)
+    return 0;
+  if (cnt <= CAN_BUS_TX_EXPRESS_FRAGS)
+    return 1;
+  const uint32_t id = r->slots[t].id;
+  const uint32_t head_std = (id & CAN_BUS_ID_XTD)
+                                ? (id >> CAN_BUS_XID_BASE_Pos) & 0x7FFu
+                                : id & 0x7FFu;
+  return (std_id & 0x7FFu) < head_std;
+}
+#endif
+
+// can_bus_sendv_prio() for a classic-profile ID: queued classic frames
+// only, as classic nodes share the bus at the nominal rate anyway.
+static HAL_StatusTypeDef classic_sendv(can_bus_t *b, const can_bus_iovec_t *iov,
+                                       size_t len, uint32_t std_id,
+                                       can_bus_tx_prio_t prio) {
+  const size_t cnt = classic_frag_count(len);
+  can_bus_tx_ring_t *r = &b->tx_ring[prio];
+  if (cnt == 0 || cnt > (size_t)(r->depth - 1))
+    return HAL_ERROR;
+  if (pack_flush_class(b, prio) != HAL_OK || tx_rb_free(r) < cnt)
+    return tx_full(b);
+#if CAN_BUS_FLOW_CONTROL
+  if (!credit_take(b, std_id, len))
+    return HAL_BUSY;
+#endif
+
+  const uint8_t seq = b->tx_seq++;
+  can_bus_iov_cursor_t cur = {iov, 0};
+  uint16_t h = r->head;
+  size_t off = 0;
+  for (uint8_t idx = 0; idx < cnt; idx++) {
+    uint8_t hdr[2];
+    const size_t pos = classic_header(hdr, seq, idx, len);
+    size_t take = len - off;
+    if (take > CAN_BUS_CLASSIC_LEN - pos)
+      take = CAN_BUS_CLASSIC_LEN - pos;
+    off += take;
+
+    can_bus_tx_frame_t *f = &r->slots[h];
+    f->id = (std_id & 0x7FFu) | CAN_BUS_ID_CLASSIC;
+    f->len = (uint8_t)(pos + take);
+    f->marker = (prio == CAN_BUS_TX_PRIO_HIGH && idx == 0);
+    frag_emit((uint32_t *)(void *)f->data, hdr, pos, &cur, take, pos + take);
+    h = tx_rb_next(r, h);
+  }
+
+  __DMB(); // publish all fragment slots before updating head (release)
+  r->head = h;
+  tx_kick(b);
+  return HAL_OK;
+}
+
+#if CAN_BUS_FRAG_FEC
+// Fill `par` ring slots from h on with the parity fragments of a message;
+// returns the slot after them. Each parity payload is the XOR of the payload
+// areas (header-free, zero-padded) of the fragments it covers.
+static uint16_t fec_build(can_bus_t *b, can_bus_tx_ring_t *r, uint16_t h,
+                          const can_bus_iovec_t *iov, size_t len,
+                          uint32_t std_id, uint8_t seq, uint8_t cnt,
+                          size_t par) {
+  const uint16_t first = h;
+  for (size_t g = 0; g < par; g++) {
+    can_bus_tx_frame_t *f = &r->slots[h];
+    uint8_t hdr[8];
+    uint32_t id;
+    const size_t pos =
+        frag_header(hdr, &id, std_id, seq, (uint8_t)(cnt + g), cnt, len);
+    memset(f->data, 0, CAN_BUS_FRAG_WIRE_LEN);
+    memcpy(f->data, hdr, pos);
+    f->id = id;
+    f->len = CAN_BUS_FRAG_WIRE_LEN;
+    f->marker = 0;
+    h = tx_rb_next(r, h);
+  }
+
+  can_bus_iov_cursor_t c = {iov, 0};
+  size_t off = 0;
+  for (unsigned i = 0; i < cnt; i++) {
+    uint8_t *acc = r->slots[(first + i % par) % r->depth].data +
+                   CAN_BUS_FRAG_TX_HDR;
+    size_t k = 0;
+    if (i == 0) {
+      uint8_t hdr[8];
+      uint32_t id;
+      const size_t pos = frag_header(hdr, &id, std_id, seq, 0, cnt, len);
+      for (; k < pos - CAN_BUS_FRAG_TX_HDR; k++)
+        acc[k] ^= hdr[CAN_BUS_FRAG_TX_HDR + k]; // the length prefix
+    }
+    size_t take = len - off;
+    if (take > CAN_BUS_FRAG_TX_CAP - k)
+      take = CAN_BUS_FRAG_TX_CAP - k;
+    off += take;
+    for (; take != 0; take--, k++) {
+      while (c.off == c.iov->len) {
+        c.iov++;
+        c.off = 0;
+      }
+      acc[k] ^= ((const uint8_t *)c.iov->base)[c.off++];
+    }
+  }
+  b->fec_stats.parity_tx += (uint32_t)par;
+  return h;
+}
+#endif
+
+// =========================
+// Adaptive fragment size
+// =========================
+//
+// A fragmented message goes in frames of one FD size, picked per message
+// from 12..64 bytes by expected bus time: the frames it takes (the last one
+// as short as it can be), each over the chance it gets through, since the
+// controller resends a frame that an error destroys and the chance of that
+// grows with the frame's bits. The error rate per bit is the bus monitor's
+// (errors the controller logged over wire bits seen), so on a clean bus
+// 64-byte frames, with the least header and arbitration per byte, always
+// win, and shorter ones take over as errors rise. Bulk-class messages can
+// also be held to a bus time per frame (can_bus_set_frag_block_us()), which
+// bounds how long a high-class frame waits behind one of them; the other
+// classes only look at their own delivery. Sizes that need more fragments
+// than the ring or a reassembly slot takes are skipped. Retransmit and
+// parity assume 64-byte fragments, so with CAN_BUS_FRAG_RELIABLE or
+// CAN_BUS_FRAG_FEC every message uses those.
+
+static const uint8_t k_frag_wire[CAN_BUS_FRAG_SIZES] = {12u, 16u, 20u, 24u,
+                                                        32u, 48u, 64u};
+_Static_assert(CAN_BUS_FRAG_WIRE_LEN == 64, "largest size is the default");
+
+#if CAN_BUS_FRAG_ADAPT && !CAN_BUS_FRAG_RELIABLE && !CAN_BUS_FRAG_FEC
+// Bus time of `n` frames of `ns` and `bits` each, counting resends.
+static uint64_t frag_try_ns(uint32_t n, uint32_t ns, uint32_t bits,
+                            uint32_t err_pgb) {
+  uint64_t p_ppm = ((uint64_t)bits * err_pgb) / 1000u;
+  if (p_ppm > 500000u)
+    p_ppm = 500000u; // past this the estimate means little
+  return ((uint64_t)n * ns * 1000000u) / (1000000u - p_ppm);
+}
+#endif
+
+// Index into k_frag_wire of the frame size for a `len`-byte fragmented
+// message in class `prio`, in at most `max_cnt` fragments.
+static unsigned frag_size_pick(can_bus_t *b, size_t len,
+                               can_bus_tx_prio_t prio, size_t max_cnt) {
+  unsigned best = CAN_BUS_FRAG_SIZES - 1u;
+#if CAN_BUS_FRAG_ADAPT && !CAN_BUS_FRAG_RELIABLE && !CAN_BUS_FRAG_FEC
+  const uint32_t err_pgb = b->mon_err_pgb;
+  const uint32_t block_ns =
+      (prio == CAN_BUS_TX_PRIO_LOW) ? b->frag_block_ns : 0u;
+  if (err_pgb == 0 && block_ns == 0)
+    return best;
+  if (max_cnt > CAN_BUS_REASM_MAX_FRAGS)
+    max_cnt = CAN_BUS_REASM_MAX_FRAGS;
+  const uint32_t xtd = CAN_BUS_FRAG_EXT_ID ? CAN_BUS_ID_XTD : 0u;
+  uint64_t best_ns = UINT64_MAX;
+  for (unsigned i = 0; i < CAN_BUS_FRAG_SIZES; i++) {
+    const size_t cap = k_frag_wire[i] - CAN_BUS_FRAG_TX_HDR;
+    const size_t cnt = frag_count_cap(len, cap);
+    if (cnt == 0 || cnt > max_cnt)
+      continue;
+    uint32_t bits;
+    const uint32_t ns = frame_ns(b, xtd, k_frag_wire[i], &bits);
+    if (block_ns != 0 && ns > block_ns && i != 0)
+      continue; // the smallest size is always allowed
+    const size_t tail = CAN_BUS_FRAG_TX_LEAD + len - (cnt - 1u) * cap;
+    uint32_t tail_bits;
+    const uint32_t tail_ns = frame_ns(
+        b, xtd, (uint8_t)can_bus_round_up_fd_len(CAN_BUS_FRAG_TX_HDR + tail),
+        &tail_bits);
+    const uint64_t t = frag_try_ns((uint32_t)cnt - 1u, ns, bits, err_pgb) +
+                       frag_try_ns(1u, tail_ns, tail_bits, err_pgb);
+    if (t <= best_ns) { // ties go to the larger frame
+      best_ns = t;
+      best = i;
+    }
+  }
+#else
+  (void)b;
+  (void)len;
+  (void)prio;
+  (void)max_cnt;
+#endif
+  return best;
+}
+
+// Send a message given as segments by fragmenting into multiple CAN FD
+// frames. This uses frames of the size frag_size_pick() gives (64B unless
+// the bus is seeing errors; the last one as short as it can be) and a
+// small header in each frame, or extended IDs with a length prefix in
+// the first (CAN_BUS_FRAG_EXT_ID). A message that fits one frame goes as a
+// single-frame message instead (CAN_BUS_FRAG_SINGLE).
+//
+// Each payload byte is copied once: straight into the hardware TX FIFO while
+// the queues ahead of it are empty, otherwise into a TX ring slot (which the
+// pump later moves to message RAM as whole words). For an async message
+// (`async` = its slot + 1, one segment) the ring slot only points into the
+// caller's buffer, and the pump copies from there.
+//
+// The whole message is queued or none of it is: if the TX ring can't hold
+// every fragment this returns HAL_BUSY without sending anything, so a
+// receiver never sees a partial train it would only time out on.
+static HAL_StatusTypeDef sendv_msg(can_bus_t *b, const can_bus_iovec_t *iov,
+                                   size_t iovcnt, uint32_t std_id,
+                                   can_bus_tx_prio_t prio, uint8_t async) {
+#if !CAN_BUS_ASYNC_SLOTS
+  (void)async;
+#endif
+  if (!b)
+    return HAL_ERROR;
+  if (!iov || iovcnt == 0)
+    return HAL_ERROR;
+  if ((unsigned)prio >= CAN_BUS_TX_PRIO_COUNT)
+    return HAL_ERROR;
+  size_t len = 0;
+  for (size_t i = 0; i < iovcnt; i++) {
+    if (iov[i].len != 0 && !iov[i].base)
+      return HAL_ERROR;
+    if (iov[i].len > 0xFFFFu - len)
+      return HAL_ERROR; // header uses u16 total_len
+    len += iov[i].len;
+  }
+  if (len == 0)
+    return HAL_ERROR;
+  if (peer_classic(b, std_id))
+    return classic_sendv(b, iov, len, std_id, prio);
+
+  const int single = CAN_BUS_FRAG_SINGLE && len <= CAN_BUS_SINGLE_CAP;
+  can_bus_tx_ring_t *r = &b->tx_ring[prio];
+  const unsigned size_idx = single ? CAN_BUS_FRAG_SIZES - 1u
+                                   : frag_size_pick(b, len, prio, r->depth - 1u);
+  const size_t frag_wire = k_frag_wire[size_idx];
+  const size_t frag_cnt_sz =
+      single ? 1u : frag_count_cap(len, frag_wire - CAN_BUS_FRAG_TX_HDR);
+  if (frag_cnt_sz == 0 || frag_cnt_sz > (size_t)(r->depth - 1))
+    return HAL_ERROR; // could never fit, even with an empty ring
+
+  if (pack_flush_class(b, prio) != HAL_OK)
+    return tx_full(b);
+#if CAN_BUS_TX_EXPRESS_DEPTH
+  const int express =
+      prio == CAN_BUS_TX_PRIO_LOW && tx_express_ok(b, std_id, frag_cnt_sz);
+  if (express)
+    r = b->tx_express;
+#else
+  const int express = 0;
+#endif
+  if (tx_rb_free(r) < frag_cnt_sz)
+    return tx_full(b);
+#if CAN_BUS_FLOW_CONTROL
+  if (!credit_take(b, std_id, len))
+    return HAL_BUSY; // receivers are full; try again after their next advert
+#endif
+
+  PROF_START(send);
+  const uint8_t seq = single ? 0u : b->tx_seq++;
+  const uint8_t frag_cnt = (uint8_t)frag_cnt_sz;
+  b->single_stats.tx += (uint32_t)single;
+  if (express) {
+    b->express_stats.msgs++;
+    b->express_stats.frames += frag_cnt;
+  }
+  b->frag_size_tx[size_idx] += (uint32_t)!single;
+#if CAN_BUS_FRAG_FEC
+  // Parity rides along when it fits; the message goes out without it
+  // otherwise. Async messages go without: parity is built from a copy.
+  size_t par = (single || async) ? 0u : fec_parity_count(frag_cnt_sz);
+  if (frag_cnt_sz + par > 255u || tx_rb_free(r) < frag_cnt_sz + par)
+    par = 0;
+#endif
+#if CAN_BUS_FRAG_RELIABLE
+  uint8_t *keep = single ? NULL : rtx_record(b, std_id, seq, prio, len);
+  for (size_t i = 0; keep && i < iovcnt; i++) {
+    if (iov[i].len)
+      dma_copy(keep, iov[i].base, iov[i].len);
+    keep += iov[i].len;
+  }
+#endif
+
+#if CAN_BUS_ASYNC_SLOTS
+  if (async)
+    b->async[async - 1u].pending = frag_cnt; // before any can complete
+#endif
+
+  can_bus_iov_cursor_t cur = {iov, 0};
+  uint16_t h = r->head;
+  int direct = 1; // until the first fragment that has to be queued
+  size_t off = 0;
+  for (uint8_t idx = 0; idx < frag_cnt; idx++) {
+    uint8_t hdr[8];
+    uint32_t id;
+#if CAN_BUS_FRAG_SINGLE
+    const size_t pos =
+        single ? single_header(hdr, &id, std_id, len)
+               : frag_header_cap(hdr, &id, std_id, seq, idx, frag_cnt, len,
+                                 frag_wire - CAN_BUS_FRAG_TX_HDR);
+#else
+    const size_t pos = frag_header_cap(hdr, &id, std_id, seq, idx, frag_cnt,
+                                       len, frag_wire - CAN_BUS_FRAG_TX_HDR);
+#endif
+
+    size_t take = len - off;
+    if (take > frag_wire - pos)
+      take = frag_wire - pos;
+    const size_t start = off;
+    off += take;
+
+    // Full frames of the chosen size, except the last (padded to the next
+    // FD length).
+    const uint8_t wire = (uint8_t)can_bus_round_up_fd_len(
+        (idx == frag_cnt - 1u) ? pos + take : frag_wire);
+    // Time-stamp the first fragment of high-class messages.
+    const uint8_t marker = (prio == CAN_BUS_TX_PRIO_HIGH && idx == 0);
+
+    if (direct) {
+      const uint32_t primask = __get_PRIMASK();
+      __disable_irq();
+      uint32_t put;
+      volatile uint32_t *e =
+          tx_direct_ok(b, prio, id, wire) ? tx_hw_element(b, &put) : NULL;
+      if (e) {
+        frag_emit(&e[2], hdr, pos, &cur, take, wire);
+        tx_hw_commit(b, e, put, id, wire, marker);
+#if CAN_BUS_ASYNC_SLOTS
+        b->tx_elem_async[put] = async;
+#endif
+        shape_charge(b, prio, id, wire);
+      }
+      __set_PRIMASK(primask);
+      if (e)
+        continue;
+      direct = 0;
+    }
+
+    can_bus_tx_frame_t *f = &r->slots[h];
+    f->id = id;
+    f->len = wire;
+    f->marker = marker;
+#if CAN_BUS_ASYNC_SLOTS
+    if (async) {
+      can_bus_tx_ref_t rf;
+      rf.off = (uint16_t)start;
+      rf.take = (uint8_t)take;
+      rf.pos = (uint8_t)pos;
+      memcpy(rf.hdr, hdr, sizeof(rf.hdr));
+      memcpy(f->data, &rf, sizeof(rf));
+      f->ref = async;
+      h = tx_rb_next(r, h);
+      continue;
+    }
+#endif
+    (void)start;
+    frag_emit((uint32_t *)(void *)f->data, hdr, pos, &cur, take, wire);
+    h = tx_rb_next(r, h);
+  }
+#if CAN_BUS_FRAG_FEC
+  if (par != 0)
+    h = fec_build(b, r, h, iov, len, std_id, seq, frag_cnt, par);
+#endif
+
+  __DMB(); // publish all fragment slots before updating head (release)
+  r->head = h;
+
+  tx_kick(b);
+  PROF_STOP(send, PROF_CAN_SEND_LARGE);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef can_bus_sendv_prio(can_bus_t *b, const can_bus_iovec_t *iov,
+                                     size_t iovcnt, uint32_t std_id,
+                                     can_bus_tx_prio_t prio) {
+  return sendv_msg(b, iov, iovcnt, std_id, prio, 0);
+}
+
+HAL_StatusTypeDef can_bus_sendv(can_bus_t *b, const can_bus_iovec_t *iov,
+                                size_t iovcnt, uint32_t std_id) {
+  return can_bus_sendv_prio(b, iov, iovcnt, std_id, CAN_BUS_TX_PRIO_LOW);
+}
+
+// =========================
+// Async sends
+// =========================
+//
+// can_bus_send_async() queues a message whose ring slots point into the
+// caller's buffer instead of holding copies of it; the pump reads each
+// fragment from there as it goes into the hardware FIFO. A slot per message
+// in flight (CAN_BUS_ASYNC_SLOTS) holds the buffer, the callback and a
+// count of fragments not yet done. Each hardware element is tagged with the
+// slot of the frame in it, and the frame counts off when its completion or
+// final abort interrupt runs, or when the pump refills the element first
+// (an abort seen that late counts as sent). A fragment sent again
+// (CAN_BUS_TX_RETRY) keeps its tag. Callbacks run from those interrupts
+// once the FIFO has been refilled, with IRQs enabled.
+
+#if CAN_BUS_ASYNC_SLOTS
+// Count off the frames of the elements in `mask` whose element hasn't been
+// refilled since (the pump counted those already).
+static void async_elems_end(can_bus_t *b, uint32_t mask, int ok) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq(); // the FIFO0 responder may refill an element
+  const uint32_t busy = b->hfdcan->Instance->TXBRP;
+  for (uint32_t i = 0; i < CAN_BUS_TX_HW_DEPTH; i++) {
+    if ((mask & (1u << i)) && !(busy & (1u << i)))
+      async_elem_end(b, i, ok);
+  }
+  __set_PRIMASK(primask);
+}
+
+// Free the slots of finished messages and run their callbacks.
+static void async_run_done(can_bus_t *b) {
+  for (unsigned i = 0; i < CAN_BUS_ASYNC_SLOTS; i++) {
+    can_bus_async_t *a = &b->async[i];
+    if (!a->finished)
+      continue;
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const can_bus_tx_done_cb_t cb = a->finished ? a->done : NULL;
+    void *user = a->user;
+    const HAL_StatusTypeDef st = a->failed ? HAL_ERROR : HAL_OK;
+    if (cb) {
+      a->finished = 0;
+      a->done = NULL; // free
+      b->async_stats.done++;
+      b->async_stats.failed += (uint32_t)(st != HAL_OK);
+    }
+    __set_PRIMASK(primask);
+    if (cb)
+      cb(user, st);
+  }
+}
+#endif
+
+HAL_StatusTypeDef can_bus_send_async_prio(can_bus_t *b, const void *buf,
+                                          size_t len, uint32_t std_id,
+                                          can_bus_tx_prio_t prio,
+                                          can_bus_tx_done_cb_t done,
+                                          void *user) {
+#if CAN_BUS_ASYNC_SLOTS
+  if (!b || !buf || len == 0 || !done)
+    return HAL_ERROR;
+  if (peer_classic(b, std_id))
+    return HAL_ERROR; // classic fragments are built by copying
+  unsigned i;
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (i = 0; i < CAN_BUS_ASYNC_SLOTS && b->async[i].done; i++) {
+  }
+  if (i < CAN_BUS_ASYNC_SLOTS) {
+    can_bus_async_t *a = &b->async[i];
+    a->buf = (const uint8_t *)buf;
+    a->done = done;
+    a->user = user;
+    a->pending = 0;
+    a->failed = 0;
+    a->finished = 0;
+  }
+  __set_PRIMASK(primask);
+  if (i == CAN_BUS_ASYNC_SLOTS) {
+    b->async_stats.no_slot++;
+    return tx_full(b); // a completion frees one
+  }
+
+  const can_bus_iovec_t iov = {buf, len};
+  const HAL_StatusTypeDef st =
+      sendv_msg(b, &iov, 1, std_id, prio, (uint8_t)(i + 1u));
+  if (st != HAL_OK) {
+    b->async[i].done = NULL; // nothing was queued
+    return st;
+  }
+  b->async_stats.sent++;
+  return HAL_OK;
+#else
+  (void)b;
+  (void)buf;
+  (void)len;
+  (void)std_id;
+  (void)prio;
+  (void)done;
+  (void)user;
   return HAL_ERROR;
+#endif
+}
+
+HAL_StatusTypeDef can_bus_send_async(can_bus_t *b, const void *buf,
+                                     size_t len, uint32_t std_id,
+                                     can_bus_tx_done_cb_t done, void *user) {
+  return can_bus_send_async_prio(b, buf, len, std_id, CAN_BUS_TX_PRIO_LOW,
+                                 done, user);
+}
+
+void can_bus_get_async_stats(can_bus_t *b, can_bus_async_stats_t *out) {
+  if (!out)
+    return;
+  memset(out, 0, sizeof(*out));
+#if CAN_BUS_ASYNC_SLOTS
+  if (!b)
+    return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = b->async_stats;
+  __set_PRIMASK(primask);
+#else
+  (void)b;
+#endif
 }
 
-HAL_StatusTypeDef can_bus_unsubscribe_rx(can_bus_rx_cb_t cb, void *user) {
-  if (!cb)
+HAL_StatusTypeDef can_bus_send_large_prio(can_bus_t *b, const uint8_t *bytes,
+                                          size_t len, uint32_t std_id,
+                                          can_bus_tx_prio_t prio) {
+  if (!b || !bytes || len == 0)
     return HAL_ERROR;
+  const can_bus_iovec_t iov = {bytes, len};
+  return can_bus_sendv_prio(b, &iov, 1, std_id, prio);
+}
 
-  for (unsigned i = 0; i < CAN_BUS_MAX_SUBSCRIBERS; i++) {
-    if (g_subs[i].cb == cb && g_subs[i].user == user) {
-      g_subs[i].cb = NULL;
-      g_subs[i].user = NULL;
-      return HAL_OK;
+// Reserve/commit: the caller serializes straight into the payload areas of
+// TX ring slots. Fragment headers go in front of those areas at commit,
+// once the final length is known, and nothing is visible to the pump until
+// head is published.
+HAL_StatusTypeDef can_bus_tx_reserve(can_bus_t *b, size_t len, uint32_t std_id,
+                                     can_bus_tx_prio_t prio,
+                                     can_bus_tx_resv_t *rv) {
+  if (!b || !rv)
+    return HAL_ERROR;
+  rv->len = 0;
+  if ((unsigned)prio >= CAN_BUS_TX_PRIO_COUNT || peer_classic(b, std_id))
+    return HAL_ERROR;
+  const size_t cnt = frag_count(len);
+  can_bus_tx_ring_t *r = &b->tx_ring[prio];
+  if (cnt == 0 || cnt > (size_t)(r->depth - 1))
+    return HAL_ERROR;
+  if (pack_flush_class(b, prio) != HAL_OK || tx_rb_free(r) < cnt)
+    return tx_full(b);
+#if CAN_BUS_FLOW_CONTROL
+  if (!credit_take(b, std_id, len))
+    return HAL_BUSY;
+#endif
+
+  rv->std_id = std_id;
+  rv->len = (uint16_t)len;
+  rv->head = r->head;
+  rv->prio = (uint8_t)prio;
+  rv->frag_cnt = (uint8_t)cnt;
+  return HAL_OK;
+}
+
+uint8_t *can_bus_tx_span(can_bus_t *b, const can_bus_tx_resv_t *rv, size_t idx,
+                         size_t *len) {
+  if (!b || !rv || rv->len == 0 || idx >= rv->frag_cnt)
+    return NULL;
+  can_bus_tx_ring_t *r = &b->tx_ring[rv->prio];
+  // Fragment idx carries message bytes [idx * cap - lead, ...).
+  const size_t pos = CAN_BUS_FRAG_TX_HDR + (idx == 0 ? CAN_BUS_FRAG_TX_LEAD : 0u);
+  const size_t start = idx * CAN_BUS_FRAG_TX_CAP -
+                       (idx == 0 ? 0u : CAN_BUS_FRAG_TX_LEAD);
+  size_t take = CAN_BUS_FRAG_WIRE_LEN - pos;
+  if (take > rv->len - start)
+    take = rv->len - start;
+  if (len)
+    *len = take;
+  return r->slots[(rv->head + idx) % r->depth].data + pos;
+}
+
+HAL_StatusTypeDef can_bus_tx_commit(can_bus_t *b, can_bus_tx_resv_t *rv,
+                                    size_t used) {
+  if (!b || !rv || rv->len == 0 || rv->prio >= CAN_BUS_TX_PRIO_COUNT)
+    return HAL_ERROR;
+  const can_bus_tx_prio_t prio = (can_bus_tx_prio_t)rv->prio;
+  can_bus_tx_ring_t *r = &b->tx_ring[prio];
+  if (used == 0 || used > rv->len || r->head != rv->head) {
+    rv->len = 0; // something else was queued on the class meanwhile
+    return HAL_ERROR;
+  }
+
+  PROF_START(send);
+  // A shorter message keeps the same layout, just fewer fragments.
+  const uint8_t cnt = (uint8_t)frag_count(used);
+  const uint8_t seq = b->tx_seq++;
+#if CAN_BUS_FRAG_RELIABLE
+  uint8_t *keep = rtx_record(b, rv->std_id, seq, prio, used);
+#endif
+  uint16_t h = rv->head;
+  size_t left = used;
+  for (uint8_t idx = 0; idx < cnt; idx++) {
+    can_bus_tx_frame_t *f = &r->slots[h];
+    uint8_t hdr[8];
+    uint32_t id;
+    const size_t pos = frag_header(hdr, &id, rv->std_id, seq, idx, cnt, used);
+    memcpy(f->data, hdr, pos);
+    size_t take = CAN_BUS_FRAG_WIRE_LEN - pos;
+    if (take > left)
+      take = left;
+    left -= take;
+#if CAN_BUS_FRAG_RELIABLE
+    if (keep) {
+      memcpy(keep, f->data + pos, take);
+      keep += take;
     }
+#endif
+
+    const size_t wire = can_bus_round_up_fd_len(
+        (idx == cnt - 1u) ? pos + take : CAN_BUS_FRAG_WIRE_LEN);
+    memset(f->data + pos + take, 0, wire - pos - take);
+    f->id = id;
+    f->len = (uint8_t)wire;
+    f->marker = (prio == CAN_BUS_TX_PRIO_HIGH && idx == 0);
+    h = tx_rb_next(r, h);
   }
+  rv->len = 0;
+
+  __DMB(); // publish all fragment slots before updating head (release)
+  r->head = h;
+
+  tx_kick(b);
+  PROF_STOP(send, PROF_CAN_SEND_LARGE);
+  return HAL_OK;
+}
+
+void can_bus_get_rtx_stats(can_bus_t *b, can_bus_rtx_stats_t *out) {
+  if (b && out)
+    *out = b->rtx_stats;
+}
+
+void can_bus_get_fec_stats(can_bus_t *b, can_bus_fec_stats_t *out) {
+  if (b && out)
+    *out = b->fec_stats;
+}
+
+HAL_StatusTypeDef can_bus_advertise_credits(can_bus_t *b, uint32_t period_ms) {
+#if CAN_BUS_FLOW_CONTROL
+  if (!b)
+    return HAL_ERROR;
+  b->credit_period_ms = period_ms;
+  b->credit_sent_ms = HAL_GetTick() - period_ms; // first advert on next pass
+  return HAL_OK;
+#else
+  (void)b;
+  (void)period_ms;
   return HAL_ERROR;
+#endif
 }
 
-// Send a single CAN/CAN-FD payload up to 64 bytes.
-// If len is not an exact FD size, it rounds up and zero-pads.
-HAL_StatusTypeDef can_bus_send_bytes(const uint8_t *bytes, size_t len,
-                                     uint32_t std_id) {
-  if (!g_hfdcan)
+void can_bus_get_flow_stats(can_bus_t *b, can_bus_flow_stats_t *out) {
+  if (b && out)
+    *out = b->flow_stats;
+}
+
+void can_bus_tx_cancel(can_bus_tx_resv_t *rv) {
+  if (rv)
+    rv->len = 0; // slots were never published
+}
+
+HAL_StatusTypeDef can_bus_send_large(can_bus_t *b, const uint8_t *bytes,
+                                     size_t len, uint32_t std_id) {
+  return can_bus_send_large_prio(b, bytes, len, std_id, CAN_BUS_TX_PRIO_LOW);
+}
+
+HAL_StatusTypeDef can_bus_send_packed_prio(can_bus_t *b, const uint8_t *bytes,
+                                           size_t len, uint32_t std_id,
+                                           can_bus_tx_prio_t prio) {
+  if (!b)
     return HAL_ERROR;
   if (!bytes || len == 0)
     return HAL_ERROR;
+  if ((unsigned)prio >= CAN_BUS_TX_PRIO_COUNT)
+    return HAL_ERROR;
+  if (len > CAN_BUS_PACK_REC_MAX || peer_classic(b, std_id))
+    return can_bus_send_large_prio(b, bytes, len, std_id, prio);
 
-  if (len > 64)
-    len = 64;
+  std_id &= 0x7FFu;
+  if (b->pack->used != 0 &&
+      (b->pack->prio != prio || b->pack->std_id != std_id ||
+       b->pack->used + 1u + len > sizeof(b->pack->buf))) {
+    if (pack_flush(b) != HAL_OK)
+      return HAL_BUSY;
+  }
 
-  size_t wire_len = can_bus_round_up_fd_len(len);
-  uint32_t dlc = can_bus_len_to_dlc(wire_len);
-  if (dlc == 0xFFFFFFFFu)
-    return HAL_ERROR;
+  if (b->pack->used == 0) {
+    b->pack->buf[0] = (uint8_t)CAN_BUS_PACK_MAGIC;
+    b->pack->buf[1] = (uint8_t)(CAN_BUS_PACK_MAGIC >> 8);
+    b->pack->used = CAN_BUS_PACK_HDR;
+    b->pack->prio = (uint8_t)prio;
+    b->pack->std_id = (uint16_t)std_id;
+    b->pack->deadline_us = us_clock_now() + CAN_BUS_PACK_FLUSH_US;
+    alarm_arm();
+  }
+  b->pack->buf[b->pack->used] = (uint8_t)len;
+  memcpy(&b->pack->buf[b->pack->used + 1u], bytes, len);
+  b->pack->used = (uint8_t)(b->pack->used + 1u + len);
+  b->pack_stats.tx_records++;
 
-  FDCAN_TxHeaderTypeDef txHeader;
-  memset(&txHeader, 0, sizeof(txHeader));
+  // Full (no room for even a 1-byte record): don't wait for the deadline.
+  // A busy ring just leaves it for pack_poll().
+  if (sizeof(b->pack->buf) - b->pack->used < 2u)
+    (void)pack_flush(b);
+  return HAL_OK;
+}
 
-  txHeader.Identifier = std_id & 0x7FFu;
-  txHeader.IdType = FDCAN_STANDARD_ID;
-  txHeader.TxFrameType = FDCAN_DATA_FRAME;
+HAL_StatusTypeDef can_bus_send_packed(can_bus_t *b, const uint8_t *bytes,
+                                      size_t len, uint32_t std_id) {
+  return can_bus_send_packed_prio(b, bytes, len, std_id, CAN_BUS_TX_PRIO_LOW);
+}
 
-  txHeader.DataLength = dlc; // DLC code (HAL expects this)
-  txHeader.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
-  txHeader.BitRateSwitch = FDCAN_BRS_OFF;
-  txHeader.FDFormat = FDCAN_FD_CAN;
-  txHeader.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-  txHeader.MessageMarker = 0;
+void can_bus_flush_packed(can_bus_t *b) {
+  if (b)
+    (void)pack_flush(b);
+}
 
-  uint8_t txData[64] = {0};
-  memcpy(txData, bytes, len);
+void can_bus_set_pack_notify(can_bus_t *b, can_bus_pack_notify_cb_t cb) {
+  if (b)
+    b->pack_notify = cb;
+}
 
-  return HAL_FDCAN_AddMessageToTxFifoQ(g_hfdcan, &txHeader, txData);
+void can_bus_set_tx_notify(can_bus_t *b, can_bus_tx_notify_cb_t cb) {
+  if (b)
+    b->tx_notify = cb;
 }
 
-// Send an arbitrarily large buffer by fragmenting into multiple CAN FD frames.
-// This uses fixed 64B frames (DLC=64) and a small header in each frame.
-HAL_StatusTypeDef can_bus_send_large(const uint8_t *bytes, size_t len,
-                                     uint32_t std_id) {
-  if (!g_hfdcan)
+HAL_StatusTypeDef can_bus_set_tx_shaping(can_bus_t *b, can_bus_tx_prio_t prio,
+                                         uint8_t share_pct, uint32_t burst_us) {
+  if (!b || (unsigned)prio >= CAN_BUS_TX_PRIO_COUNT || share_pct > 100u)
     return HAL_ERROR;
-  if (!bytes || len == 0)
+#if !CAN_BUS_TX_SHAPING
+  if (share_pct != 0 && share_pct != 100u)
     return HAL_ERROR;
-  if (len > 0xFFFFu)
-    return HAL_ERROR; // header uses u16 total_len
-
-  static uint8_t g_seq = 0;
-  uint8_t seq = g_seq++;
+#endif
+  if (share_pct == 100u)
+    share_pct = 0;
+  if (share_pct != 0 && (burst_us == 0 || burst_us > 1000000u))
+    return HAL_ERROR;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  can_bus_shaper_t *s = &b->shaper[prio];
+  s->share_pct = share_pct;
+  s->burst_ns = burst_us * 1000u;
+  s->tokens_ns = (int32_t)s->burst_ns;
+  s->last_us = us_clock_now();
+  __set_PRIMASK(primask);
+  tx_kick(b); // an unshaped class may have frames waiting
+  return HAL_OK;
+}
 
-  const size_t hdr_sz = sizeof(can_bus_frag_hdr_t);
-  const size_t wire_len = CAN_BUS_FRAG_WIRE_LEN;
-  if (wire_len > 64)
+HAL_StatusTypeDef can_bus_set_tx_window(can_bus_t *b, uint8_t class_mask,
+                                        uint64_t anchor_us, uint32_t cycle_ns,
+                                        uint32_t open_ns) {
+  if (!b)
     return HAL_ERROR;
-  const size_t data_cap = wire_len - hdr_sz;
-  if (data_cap == 0)
+  if (cycle_ns != 0 &&
+      (!CAN_BUS_TX_WINDOWS || open_ns == 0 || open_ns > cycle_ns ||
+       class_mask >= (1u << CAN_BUS_TX_PRIO_COUNT)))
     return HAL_ERROR;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  b->win_anchor_us = anchor_us;
+  b->win_cycle_ns = cycle_ns;
+  b->win_open_ns = open_ns;
+  b->win_classes = class_mask;
+  __set_PRIMASK(primask);
+  tx_kick(b); // the new window may already be open
+  return HAL_OK;
+}
 
-  // frag_cnt must fit in u8 with current header design
-  size_t frag_cnt_sz = (len + data_cap - 1) / data_cap;
-  if (frag_cnt_sz == 0)
-    frag_cnt_sz = 1;
-  if (frag_cnt_sz > 255)
-    return HAL_ERROR;
+uint32_t can_bus_get_tx_shape_holds(can_bus_t *b) {
+  return b ? b->shape_holds : 0;
+}
 
-  uint8_t frag_cnt = (uint8_t)frag_cnt_sz;
+unsigned can_bus_tx_fill_pct(can_bus_t *b, can_bus_tx_prio_t prio) {
+  if (!b || (unsigned)prio >= CAN_BUS_TX_PRIO_COUNT || !b->tx_ring)
+    return 0;
+  const can_bus_tx_ring_t *r = &b->tx_ring[prio];
+  const size_t cap = (size_t)(r->depth - 1);
+  if (cap == 0)
+    return 0;
+  return (unsigned)(((cap - tx_rb_free(r)) * 100u) / cap);
+}
 
-  size_t off = 0;
-  for (uint8_t idx = 0; idx < frag_cnt; idx++) {
-    uint8_t frame[64] = {0};
-
-    can_bus_frag_hdr_t hdr;
-    hdr.magic = CAN_BUS_FRAG_MAGIC;
-    hdr.seq = seq;
-    hdr.frag_idx = idx;
-    hdr.frag_cnt = frag_cnt;
-    hdr.flags = 0;
-    if (idx == 0)
-      hdr.flags |= CAN_BUS_FRAG_F_FIRST;
-    if (idx == (uint8_t)(frag_cnt - 1))
-      hdr.flags |= CAN_BUS_FRAG_F_LAST;
-    hdr.total_len = (uint16_t)len;
-
-    memcpy(frame, &hdr, hdr_sz);
+void can_bus_get_pack_stats(can_bus_t *b, can_bus_pack_stats_t *out) {
+  if (b && out)
+    *out = b->pack_stats;
+}
 
-    size_t take = len - off;
-    if (take > data_cap)
-      take = data_cap;
-    memcpy(frame + hdr_sz, bytes + off, take);
-    off += take;
+void can_bus_get_single_stats(can_bus_t *b, can_bus_single_stats_t *out) {
+  if (b && out)
+    *out = b->single_stats;
+}
 
-    // send a fixed 64-byte payload frame (pads zeros)
-    HAL_StatusTypeDef st = can_bus_send_bytes(frame, wire_len, std_id);
-    if (st != HAL_OK)
-      return st;
-  }
+void can_bus_get_express_stats(can_bus_t *b, can_bus_express_stats_t *out) {
+  if (b && out)
+    *out = b->express_stats;
+}
+
+void can_bus_get_frag_size_stats(can_bus_t *b, can_bus_frag_size_stats_t *out) {
+  if (b && out)
+    memcpy(out->msgs, b->frag_size_tx, sizeof(out->msgs));
+}
 
+HAL_StatusTypeDef can_bus_set_frag_block_us(can_bus_t *b, uint32_t us) {
+  if (!b || us > 1000000u)
+    return HAL_ERROR;
+#if !CAN_BUS_FRAG_ADAPT || CAN_BUS_FRAG_RELIABLE || CAN_BUS_FRAG_FEC
+  if (us != 0)
+    return HAL_ERROR; // fragments are always 64 bytes
+#endif
+  b->frag_block_ns = us * 1000u;
   return HAL_OK;
 }
 
 // Call this periodically from thread/main-loop context.
-// It drains the ISR ring buffer, expires old partial reassembly slots,
+// It drains the ISR ring buffers, expires old partial reassembly slots,
 // reassembles fragmented messages, and notifies subscribers.
-void can_bus_process_rx(void) {
+//
+// The FIFO0 ring is emptied before every bulk frame, so a high-priority frame
+// that arrives mid-drain waits behind at most one bulk frame.
+//
+// Frames are handled in place in the ring; a slot is released only after
+// every subscriber has returned, so callbacks must not keep the pointer.
+void can_bus_process_rx(can_bus_t *b) {
+  if (!b)
+    return;
   uint32_t now = HAL_GetTick();
-  reasm_expire_old(now);
+  pack_poll(b);
+  mon_poll(b);
+#if CAN_BUS_FLOW_CONTROL
+  credit_advertise(b, now);
+#endif
+
+  const can_bus_rx_frame_t *f;
+  for (;;) {
+    while ((f = rb_peek(&b->rx_ring[0])) != NULL) {
+      PROF_START(hi);
+      handle_rx_frame(b, f, now);
+      PROF_STOP(hi, PROF_CAN_HANDLE_FRAME);
+      rb_advance(&b->rx_ring[0]);
+      if (b->batch_len == 0)
+        rb_release(b, &b->rx_ring[0]);
+    }
+    if ((f = rb_peek(&b->rx_ring[1])) == NULL)
+      break;
+    PROF_START(lo);
+    handle_rx_frame(b, f, now);
+    PROF_STOP(lo, PROF_CAN_HANDLE_FRAME);
+    rb_advance(&b->rx_ring[1]);
+    if (b->batch_len == 0)
+      rb_release(b, &b->rx_ring[1]);
+  }
+  rx_batch_flush(b);
+
+  // Backstop in case a TX-complete interrupt was missed.
+  tx_kick(b);
+}
 
-  can_bus_rx_frame_t f;
-  while (rb_pop(&f)) {
-    handle_rx_frame(&f, now);
+#ifdef MICROBENCH_ENABLED
+// =========================
+// Microbenchmark hooks
+// =========================
+//
+// Each hook times one private step with DWT->CYCCNT (enabled by the
+// caller) around exactly the code the driver runs, on the caller's data.
+
+_Static_assert(CAN_BUS_RX_REC_MAX <= CAN_BUS_BENCH_REC_BYTES,
+               "grow CAN_BUS_BENCH_REC_BYTES");
+
+// Scratch ring: the ISR's push and the thread's peek/advance/release,
+// without touching an instance's rings.
+static can_bus_rx_ring_t g_bench_ring;
+static uint8_t g_bench_ring_buf[1024] __attribute__((aligned(4)));
+
+static void bench_ring_init(void) {
+  if (g_bench_ring.buf)
+    return;
+  g_bench_ring.buf = g_bench_ring_buf;
+  g_bench_ring.mask = sizeof(g_bench_ring_buf) - 1u;
+  g_bench_ring.policy = CAN_BUS_RX_DROP_NEWEST;
+}
+
+uint32_t can_bus_bench_rb_push(const uint32_t *words, uint8_t len) {
+  bench_ring_init();
+  const uint32_t t0 = DWT->CYCCNT;
+  (void)rb_push_words(&g_bench_ring, 0x100u, 0, words, len, CAN_BUS_RAW_FD);
+  return DWT->CYCCNT - t0;
+}
+
+uint32_t can_bus_bench_rb_pop(void) {
+  bench_ring_init();
+  const uint32_t t0 = DWT->CYCCNT;
+  if (rb_peek(&g_bench_ring)) {
+    rb_advance(&g_bench_ring);
+    __DMB();
+    g_bench_ring.tail = g_bench_ring.rd;
   }
+  return DWT->CYCCNT - t0;
+}
+
+uint32_t can_bus_bench_frag(uint8_t *rec, uint8_t *wire, uint32_t std_id,
+                            uint8_t seq, uint8_t idx, const uint8_t *msg,
+                            size_t len) {
+  *wire = 0;
+  const size_t cnt = frag_count(len);
+  if (idx >= cnt)
+    return 0;
+  const uint32_t t0 = DWT->CYCCNT;
+  uint8_t hdr[8];
+  uint32_t id;
+  const size_t pos =
+      frag_header(hdr, &id, std_id, seq, idx, (uint8_t)cnt, len);
+  const size_t start =
+      idx == 0 ? 0u : (size_t)idx * CAN_BUS_FRAG_TX_CAP - CAN_BUS_FRAG_TX_LEAD;
+  size_t take = len - start;
+  if (take > CAN_BUS_FRAG_WIRE_LEN - pos)
+    take = CAN_BUS_FRAG_WIRE_LEN - pos;
+  const size_t n = can_bus_round_up_fd_len(
+      (idx == cnt - 1u) ? pos + take : CAN_BUS_FRAG_WIRE_LEN);
+  const can_bus_iovec_t iov = {msg + start, take};
+  can_bus_iov_cursor_t cur = {&iov, 0};
+  can_bus_rx_frame_t *f = (can_bus_rx_frame_t *)(void *)rec;
+  f->id = id;
+  f->ts = 0;
+  f->len = (uint8_t)n;
+  f->flags = CAN_BUS_RAW_FD;
+  frag_emit((uint32_t *)(void *)f->data, hdr, pos, &cur, take, n);
+  const uint32_t cyc = DWT->CYCCNT - t0;
+  *wire = (uint8_t)n;
+  return cyc;
+}
+
+void can_bus_bench_frame(uint8_t *rec, uint32_t std_id, const uint8_t *data,
+                         uint8_t len) {
+  can_bus_rx_frame_t *f = (can_bus_rx_frame_t *)(void *)rec;
+  if (len > 64u)
+    len = 64u;
+  f->id = std_id & 0x7FFu;
+  f->ts = 0;
+  f->len = len;
+  f->flags = CAN_BUS_RAW_FD;
+  memcpy(f->data, data, len);
 }
 
+uint32_t can_bus_bench_rx(can_bus_t *b, const uint8_t *rec) {
+  const can_bus_rx_frame_t *f = (const can_bus_rx_frame_t *)(const void *)rec;
+  const uint32_t now = HAL_GetTick();
+  const uint32_t t0 = DWT->CYCCNT;
+  handle_rx_frame(b, f, now);
+  const uint32_t cyc = DWT->CYCCNT - t0;
+  // Completed messages are dropped here, not handed to the subscribers:
+  // the record is the caller's, not in a ring.
+  for (size_t i = 0; i < b->batch_held_cnt; i++)
+    reasm_release(b, b->batch_held[i]);
+  b->batch_len = 0;
+  b->batch_held_cnt = 0;
+  return cyc;
+}
+#endif /* MICROBENCH_ENABLED */
+
 // =========================
 // HAL ISR callback
 // =========================
 //
 // IMPORTANT: ensure only one definition exists in the entire link.
 //
-// This ISR does minimal work: drains RX FIFO1 into our ring buffer.
+// These ISRs do minimal work: drain each RX FIFO into its ring buffer.
 // Reassembly and subscriber callbacks happen in can_bus_process_rx().
+//
+// Instead of HAL_FDCAN_GetRxMessage() per frame, the drain reads message RAM
+// elements directly: two header words decoded with shifts, payload copied as
+// words into the ring slot, and one acknowledge write per batch (acking the
+// last index read releases every element before it too).
+
+// G4 message RAM layout is fixed: 3 elements per RX FIFO, 18 words each
+// (2 header words + 64 data bytes).
+#define CAN_BUS_MRAM_RX_ELEMENTS 3u
+#define CAN_BUS_MRAM_RX_ELEMENT_BYTES (18u * 4u)
+
+// RX element header bits (RM0440, "Rx FIFO element")
+#define CAN_BUS_MRAM_R0_XTD (1u << 30)
+#define CAN_BUS_MRAM_R0_RTR (1u << 29)
+#define CAN_BUS_MRAM_R0_STDID_Pos 18u
+#define CAN_BUS_MRAM_R0_EXTID 0x1FFFFFFFu
+#define CAN_BUS_MRAM_R1_FDF (1u << 21)
+#define CAN_BUS_MRAM_R1_BRS (1u << 20)
+#define CAN_BUS_MRAM_R1_DLC_Pos 16u
+#define CAN_BUS_MRAM_R1_RXTS 0xFFFFu
+
+// =========================
+// ISR responder
+// =========================
+//
+// Request frames on the responder ID are answered from the FIFO0 drain
+// itself: the reply goes straight into the hardware TX FIFO, ahead of
+// anything still in the software rings. Every other hardware FIFO write
+// runs with IRQs masked, so this one can't interleave with theirs.
+
+static CCM_FUNC void rx_respond(can_bus_t *b, const volatile uint32_t *words,
+                                size_t len, uint32_t ts) {
+  uint32_t req_w[16];
+  for (size_t i = 0; i < (len + 3u) / 4u; i++)
+    req_w[i] = words[i];
 
-void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef *hfdcan,
-                               uint32_t RxFifo1ITs) {
-  if ((RxFifo1ITs & FDCAN_IT_RX_FIFO1_NEW_MESSAGE) == 0)
+  can_bus_tx_frame_t f;
+  const size_t n = b->resp_cb((const uint8_t *)req_w, len, ts_widen_us(b, ts),
+                             f.data, b->resp_user);
+  if (n == 0)
     return;
+  if (n > sizeof(f.data)) {
+    b->resp_dropped++;
+    return;
+  }
 
-  FDCAN_RxHeaderTypeDef hdr;
-  uint8_t data[64];
+  f.id = b->resp_id;
+  f.len = (uint8_t)can_bus_round_up_fd_len(n);
+  f.marker = 0;
+  f.ref = 0;
+  if (f.len > n)
+    memset(f.data + n, 0, f.len - n);
 
-  while (HAL_FDCAN_GetRxFifoFillLevel(hfdcan, FDCAN_RX_FIFO1) > 0) {
-    if (HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO1, &hdr, data) != HAL_OK) {
-      break;
+  if (HAL_FDCAN_GetTxFifoFreeLevel(b->hfdcan) == 0 ||
+      tx_hw_add(b, &f) != HAL_OK)
+    b->resp_dropped++;
+  else
+    b->resp_sent++;
+}
+
+// =========================
+// ISR forwarding
+// =========================
+//
+// Frames matching a gateway route are copied from the RX element straight
+// into the destination controller's hardware TX FIFO, ahead of its software
+// rings. The destination's own FIFO0 drain (responder) may run at a higher
+// priority than this one, so the copy is done with IRQs masked; it is at
+// most 16 words.
+
+// First route matching the standard ID `id`, or NULL.
+static CCM_FUNC const can_bus_route_t *rx_route_find(const can_bus_t *b,
+                                                     uint32_t id) {
+  const can_bus_route_tab_t *tab = table_swap_read(&b->routes);
+  const unsigned n = tab->count;
+  if (n == 0 || (id & CAN_BUS_ID_XTD))
+    return NULL;
+  for (unsigned i = 0; i < n; i++) {
+    const can_bus_route_t *rt = &tab->routes[i];
+    if ((id & rt->mask) == (rt->id & rt->mask))
+      return rt;
+  }
+  return NULL;
+}
+
+static CCM_FUNC void rx_forward(can_bus_t *b, const can_bus_route_t *rt,
+                                uint32_t id, const volatile uint32_t *words,
+                                size_t len, int fd) {
+  can_bus_t *dst = rt->dst;
+  uint32_t out = (rt->dst_id == CAN_BUS_ROUTE_SAME_ID) ? id : rt->dst_id;
+  if (!fd)
+    out |= CAN_BUS_ID_CLASSIC; // keep the frame format
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t put;
+  volatile uint32_t *e = tx_hw_element(dst, &put);
+  if (e) {
+    for (size_t i = 0; i < (len + 3u) / 4u; i++)
+      e[2 + i] = words[i];
+    tx_hw_commit(dst, e, put, out, (uint8_t)len, 0);
+  }
+  __set_PRIMASK(primask);
+
+  if (e)
+    b->fwd_frames++;
+  else
+    b->fwd_dropped++;
+}
+
+#if CAN_BUS_RX_LAT_HIST
+// Frame that started `ticks` before the drain and took `busy_ns` on the
+// wire. Past half a wrap it started after the drain did: no wait.
+static CCM_FUNC void rx_lat_note(can_bus_t *b, unsigned f, uint32_t ticks,
+                                 uint32_t busy_ns) {
+  const uint32_t ns = (ticks < 0x8000u) ? ticks * b->nom_bit_ns : 0u;
+  const uint32_t us = (ns > busy_ns) ? (ns - busy_ns) / 1000u : 0u;
+  unsigned bin = us ? 32u - (unsigned)__builtin_clz(us) : 0u;
+  if (bin >= CAN_BUS_RX_LAT_BINS)
+    bin = CAN_BUS_RX_LAT_BINS - 1u;
+  b->rx_lat_hist[f][bin]++;
+  b->rx_lat_frames[f]++;
+  if (us > b->rx_lat_max_us[f])
+    b->rx_lat_max_us[f] = us;
+}
+#endif
+
+// Returns the number of elements taken from the hardware FIFO.
+static CCM_FUNC unsigned rx_drain_fifo(can_bus_t *b, uint32_t fifo,
+                                       can_bus_rx_ring_t *r) {
+  const FDCAN_HandleTypeDef *hfdcan = b->hfdcan;
+  FDCAN_GlobalTypeDef *can = hfdcan->Instance;
+  // RXF0S/RXF1S (and RXF0A/RXF1A) share the same field layout.
+  volatile uint32_t *status =
+      (fifo == FDCAN_RX_FIFO0) ? &can->RXF0S : &can->RXF1S;
+  volatile uint32_t *ack =
+      (fifo == FDCAN_RX_FIFO0) ? &can->RXF0A : &can->RXF1A;
+  const uint32_t base = (fifo == FDCAN_RX_FIFO0) ? hfdcan->msgRam.RxFIFO0SA
+                                                 : hfdcan->msgRam.RxFIFO1SA;
+
+  const uint32_t now_ts = (uint32_t)ts_now_ticks(b);
+
+  unsigned taken = 0;
+  for (;;) {
+    const uint32_t s = *status;
+    const uint32_t fill = (s & FDCAN_RXF0S_F0FL) >> FDCAN_RXF0S_F0FL_Pos;
+    if (fill == 0)
+      return taken;
+
+    uint32_t gi = (s & FDCAN_RXF0S_F0GI) >> FDCAN_RXF0S_F0GI_Pos;
+    uint32_t last = gi;
+    uint32_t done = 0;
+
+    for (; done < fill; done++) {
+      const volatile uint32_t *e = (const volatile uint32_t *)(
+          base + gi * CAN_BUS_MRAM_RX_ELEMENT_BYTES);
+      const uint32_t r0 = e[0];
+      const uint32_t r1 = e[1];
+
+      // Only handle data frames, standard ones unless extended IDs carry
+      // fragments (filters reject the rest anyway)
+      if (!(r0 & CAN_BUS_MRAM_R0_RTR) &&
+          (CAN_BUS_FRAG_EXT_ID || !(r0 & CAN_BUS_MRAM_R0_XTD))) {
+        const uint32_t id =
+            (r0 & CAN_BUS_MRAM_R0_XTD)
+                ? (r0 & CAN_BUS_MRAM_R0_EXTID) | CAN_BUS_ID_XTD
+                : (r0 >> CAN_BUS_MRAM_R0_STDID_Pos) & 0x7FFu;
+        size_t len = can_bus_dlc_to_len(r1 >> CAN_BUS_MRAM_R1_DLC_Pos);
+        if (!(r1 & CAN_BUS_MRAM_R1_FDF) && len > 8)
+          len = 8; // classic frame: DLC 9..15 still means 8 bytes
+        const uint32_t ts = ts_extend(now_ts, r1 & CAN_BUS_MRAM_R1_RXTS);
+
+        const can_bus_route_t *rt = rx_route_find(b, id);
+        const int fd = (r1 & CAN_BUS_MRAM_R1_FDF) != 0;
+        if (fifo == FDCAN_RX_FIFO0 && b->resp_cb && id == b->resp_id) {
+          rx_respond(b, &e[2], len, ts);
+        } else if (rt && !rt->local) {
+          rx_forward(b, rt, id, &e[2], len, fd);
+        } else if (!rb_push_words(
+                       r, id, ts, &e[2], (uint8_t)len,
+                       fd ? (uint8_t)(CAN_BUS_RAW_FD |
+                                      ((r1 & CAN_BUS_MRAM_R1_BRS)
+                                           ? CAN_BUS_RAW_BRS
+                                           : 0u))
+                          : 0u)) {
+          // Backpressure: leave it (and the rest) in the FIFO. A local
+          // route forwards once the frame is stored, so no duplicates.
+          break;
+        } else if (rt) {
+          rx_forward(b, rt, id, &e[2], len, fd);
+        }
+      }
+      const int fdf = (r1 & CAN_BUS_MRAM_R1_FDF) != 0;
+      size_t wl = can_bus_dlc_to_len(r1 >> CAN_BUS_MRAM_R1_DLC_Pos);
+      if (!fdf && wl > 8)
+        wl = 8;
+      uint32_t nom, data;
+      frame_bits(r0 & CAN_BUS_MRAM_R0_XTD, fdf && (r1 & CAN_BUS_MRAM_R1_BRS),
+                 (uint8_t)wl, &nom, &data);
+      const uint32_t busy_ns = nom * b->nom_bit_ns + data * b->data_bit_ns;
+      b->mon.rx_frames++;
+      b->mon_rx_bits += nom + data;
+      b->mon_busy_ns += busy_ns;
+#if CAN_BUS_RX_LAT_HIST
+      rx_lat_note(b, fifo == FDCAN_RX_FIFO0 ? 0u : 1u,
+                  (now_ts - (r1 & CAN_BUS_MRAM_R1_RXTS)) & 0xFFFFu, busy_ns);
+#endif
+
+      last = gi;
+      gi = (gi + 1u == CAN_BUS_MRAM_RX_ELEMENTS) ? 0u : gi + 1u;
+    }
+
+    if (done == 0)
+      return taken;
+    taken += done;
+    *ack = last;
+    if (done < fill)
+      return taken;
+  }
+}
+
+// =========================
+// RX interrupt dispatch
+// =========================
+//
+// FIFOn is drained only from interrupt line n, via can_bus_irq(n). HAL
+// dispatches every pending flag from whichever line fired, so a FIFO event
+// seen on the other line is handed over by pending its line; two drains of
+// one FIFO never nest.
+
+static CCM_FUNC void rx_request(can_bus_t *b, unsigned fifo) {
+  b->rx_pending[fifo] = 1;
+  if (b->irq_line != (int8_t)fifo)
+    NVIC_SetPendingIRQ(b->it_irqn[fifo]);
+}
+
+static CCM_FUNC void rx_service(can_bus_t *b, unsigned fifo) {
+  if (!b->rx_pending[fifo])
+    return;
+  b->rx_pending[fifo] = 0; // a later request just drains an empty FIFO
+  PROF_START(isr);
+  const unsigned taken = rx_drain_fifo(
+      b, fifo ? FDCAN_RX_FIFO1 : FDCAN_RX_FIFO0, &b->rx_ring[fifo]);
+  PROF_STOP(isr, PROF_CAN_RX_ISR);
+  if (taken)
+    NVIC_SetPendingIRQ(CAN_BUS_NOTIFY_IRQn);
+}
+
+CCM_FUNC void can_bus_irq(FDCAN_HandleTypeDef *hfdcan, unsigned line) {
+  can_bus_t *b = bus_of(hfdcan);
+  if (!b || line > 1u)
+    return;
+  const int8_t prev = b->irq_line; // line 0 may preempt line 1
+  b->irq_line = (int8_t)line;
+  HAL_FDCAN_IRQHandler(b->hfdcan);
+  rx_service(b, line);
+  b->irq_line = prev;
+}
+
+CCM_FUNC void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan,
+                                        uint32_t RxFifo0ITs) {
+  can_bus_t *b = bus_of(hfdcan);
+  low_power_note_can_rx();
+  if (b &&
+      (RxFifo0ITs & (FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO0_FULL)))
+    rx_request(b, 0);
+}
+
+CCM_FUNC void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef *hfdcan,
+                                        uint32_t RxFifo1ITs) {
+  can_bus_t *b = bus_of(hfdcan);
+  low_power_note_can_rx();
+  if (b &&
+      (RxFifo1ITs & (FDCAN_IT_RX_FIFO1_NEW_MESSAGE | FDCAN_IT_RX_FIFO1_FULL)))
+    rx_request(b, 1);
+}
+
+// Flush timer of the coalesced FIFO: a frame has waited CAN_BUS_RX_FLUSH_US.
+void HAL_FDCAN_TimeoutOccurredCallback(FDCAN_HandleTypeDef *hfdcan) {
+#if CAN_BUS_RX_COALESCE_FIFO >= 0
+  can_bus_t *b = bus_of(hfdcan);
+  if (b)
+    rx_request(b, CAN_BUS_RX_COALESCE_FIFO);
+#else
+  (void)hfdcan;
+#endif
+}
+
+// =========================
+// TX events
+// =========================
+//
+// With CAN_BUS_TX_EVENTS each frame's message marker names a record holding
+// the timestamp counter at the moment it went into the hardware FIFO. Its
+// TX event carries the start-of-frame time, so the difference is the wait
+// for the FIFO ahead of it and for arbitration (one timestamp wrap at most,
+// 65536 bit times). The automatic retransmission is off, so a frame that
+// loses arbitration, gets no ACK or hits an error ends cancelled instead:
+// the cause is taken from the last error code, and with CAN_BUS_TX_RETRY
+// the frame is copied into a free element and sent again.
+
+#if CAN_BUS_TX_EVENTS
+static CCM_FUNC void tx_rec_done(can_bus_t *b, uint8_t mm, uint32_t ts16) {
+  const can_bus_tx_rec_t *r = &b->tx_rec[mm % CAN_BUS_TX_RECS];
+  const uint32_t ticks = (ts16 - r->ts) & 0xFFFFu;
+  can_bus_tx_event_stats_t *s = &b->tx_ev;
+  if (s->events == 0 || ticks < s->lat_min_us)
+    s->lat_min_us = ticks;
+  if (ticks > s->lat_max_us)
+    s->lat_max_us = ticks;
+  s->events++;
+  b->tx_lat_total += ticks;
+#ifdef PROFILING_ENABLED
+  if (b->ts_bps)
+    prof_record(PROF_CAN_TX_WIRE,
+                (uint32_t)(((uint64_t)ticks * SystemCoreClock) / b->ts_bps));
+#endif
+}
+
+#if CAN_BUS_TX_RETRY
+// Send the frame that failed in element `old` again. IRQs masked.
+// Returns 1 if it was.
+static int tx_resend(can_bus_t *b, uint32_t old) {
+  const uint8_t mm = b->tx_elem_mm[old];
+  const uint8_t tries = b->tx_rec[mm % CAN_BUS_TX_RECS].tries;
+  if (tries >= CAN_BUS_TX_RETRY)
+    return 0;
+  uint32_t put;
+  volatile uint32_t *dst = NULL;
+  // The element may have been refilled before this interrupt was taken.
+  if ((b->hfdcan->Instance->TXBRP & (1u << old)) == 0)
+    dst = tx_hw_element(b, &put);
+  if (!dst) {
+    b->tx_ev.retry_dropped++;
+    return 0;
+  }
+  const volatile uint32_t *src =
+      (const volatile uint32_t *)(b->hfdcan->msgRam.TxFIFOQSA +
+                                  old * CAN_BUS_MRAM_TX_ELEMENT_BYTES);
+  const uint32_t t0 = src[0];
+  const uint32_t t1 = src[1];
+  if (dst != src) {
+    const size_t len = can_bus_dlc_to_len((t1 >> CAN_BUS_MRAM_T1_DLC_Pos) &
+                                          0xFu);
+    for (size_t i = 0; i < (len + 3u) / 4u; i++)
+      dst[2 + i] = src[2 + i];
+  }
+  const uint8_t nmm = tx_rec_new(b, put, mm & CAN_BUS_TX_MM_STAMP,
+                                 (uint8_t)(tries + 1u));
+  dst[0] = t0;
+  dst[1] = (t1 & ~(0xFFu << CAN_BUS_MRAM_T1_MM_Pos)) |
+           ((uint32_t)nmm << CAN_BUS_MRAM_T1_MM_Pos);
+  b->tx_elem_ns[put] = b->tx_elem_ns[old];
+  b->tx_elem_bits[put] = b->tx_elem_bits[old];
+#if CAN_BUS_ASYNC_SLOTS
+  const uint8_t tag = b->tx_elem_async[old];
+  b->tx_elem_async[old] = 0;
+  if (put != old)
+    async_elem_end(b, put, 1); // the free element's last frame
+  b->tx_elem_async[put] = tag;  // still the same fragment
+#endif
+  b->hfdcan->Instance->TXBAR = 1u << put;
+  b->hfdcan->LatestTxFifoQRequest = 1u << put;
+  b->tx_ev.retried++;
+  return 1;
+}
+#endif
+#endif
+
+void can_bus_get_tx_event_stats(can_bus_t *b, can_bus_tx_event_stats_t *out) {
+  if (!out)
+    return;
+  memset(out, 0, sizeof(*out));
+#if CAN_BUS_TX_EVENTS
+  if (!b)
+    return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = b->tx_ev;
+  const uint64_t total = b->tx_lat_total;
+  __set_PRIMASK(primask);
+  out->lat_avg_us =
+      out->events ? (uint32_t)ts_ticks_to_us(b, total / out->events) : 0;
+  out->lat_min_us = (uint32_t)ts_ticks_to_us(b, out->lat_min_us);
+  out->lat_max_us = (uint32_t)ts_ticks_to_us(b, out->lat_max_us);
+#else
+  (void)b;
+#endif
+}
+
+CCM_FUNC void HAL_FDCAN_TxEventFifoCallback(FDCAN_HandleTypeDef *hfdcan,
+                                            uint32_t TxEventFifoITs) {
+  can_bus_t *b = bus_of(hfdcan);
+  if (!b || (TxEventFifoITs & FDCAN_IT_TX_EVT_FIFO_NEW_DATA) == 0)
+    return;
+  const uint32_t now_ts = (uint32_t)ts_now_ticks(b);
+  FDCAN_TxEventFifoTypeDef ev;
+  while ((hfdcan->Instance->TXEFS & FDCAN_TXEFS_EFFL) != 0 &&
+         HAL_FDCAN_GetTxEvent(hfdcan, &ev) == HAL_OK) {
+#if CAN_BUS_TX_EVENTS
+    tx_rec_done(b, (uint8_t)ev.MessageMarker, ev.TxTimestamp);
+    if ((ev.MessageMarker & CAN_BUS_TX_MM_STAMP) == 0)
+      continue;
+#endif
+    b->tx_evt_valid = 0;
+    b->tx_evt_id = (ev.IdType == FDCAN_EXTENDED_ID)
+                      ? ev.Identifier >> CAN_BUS_XID_BASE_Pos // fragment
+                      : ev.Identifier;
+    b->tx_evt_ts = ts_extend(now_ts, ev.TxTimestamp);
+    b->tx_evt_valid = 1;
+  }
+#if CAN_BUS_TX_EVENTS
+  if (hfdcan->Instance->IR & FDCAN_IR_TEFL) {
+    hfdcan->Instance->IR = FDCAN_IR_TEFL;
+    b->tx_ev.events_lost++;
+  }
+#endif
+}
+
+// =========================
+// Bus monitor
+// =========================
+//
+// Frames and wire bits are counted as they leave (TX completion) or arrive
+// (RX drain), in both directions; bus load is their bus time over wall
+// time, so traffic the hardware filters reject isn't seen. Error state
+// changes come from the status interrupts. TEC/REC, the error logging
+// counter and the last error codes are sampled from can_bus_process_rx(),
+// so the code histograms count polls that saw an error, not every error.
+// The FDCAN keeps no count of lost arbitrations.
+//
+// Bus-off holds the TX pump: queued frames stay in the software rings (and
+// the hardware FIFO), and go out in class order once the controller is
+// back. The rejoin waits out the backoff on the us_clock alarm. In error
+// passive, bulk frames only go to an empty hardware FIFO, so a node whose
+// frames keep failing doesn't crowd the bus with them.
+
+#ifndef CAN_BUS_MON_PERIOD_MS
+#define CAN_BUS_MON_PERIOD_MS 1000u
+#endif
+
+// Clear INIT: the controller rejoins after the recovery sequence. IRQs
+// masked.
+static void busoff_rejoin(can_bus_t *b) {
+  b->boff_rejoin_us = 0;
+  b->hfdcan->Instance->CCCR &= ~FDCAN_CCCR_INIT;
+  b->mon.recoveries++;
+  b->boff_up_ms = HAL_GetTick();
+}
+
+#if CAN_BUS_BUSOFF_RECOVER
+// Bus-off entered: rejoin after the current backoff, and grow it for the
+// next one unless the bus stayed up long enough since the last. IRQs
+// masked.
+static void busoff_schedule(can_bus_t *b) {
+  if ((uint32_t)(HAL_GetTick() - b->boff_up_ms) >= CAN_BUS_BUSOFF_STABLE_MS)
+    b->boff_delay_ms = b->boff_min_ms;
+  const uint32_t delay = b->boff_delay_ms;
+  uint32_t next = delay ? delay * 2u : 1u;
+  if (next < b->boff_min_ms)
+    next = b->boff_min_ms;
+  if (next > b->boff_max_ms)
+    next = b->boff_max_ms;
+  b->boff_delay_ms = next;
+  b->mon.backoff_ms = delay;
+  if (delay == 0) {
+    busoff_rejoin(b);
+    return;
+  }
+  b->boff_rejoin_us = us_clock_now() + (uint64_t)delay * 1000u;
+  alarm_arm();
+}
+#endif
+
+HAL_StatusTypeDef can_bus_set_busoff_backoff(can_bus_t *b, uint32_t min_ms,
+                                             uint32_t max_ms) {
+  if (!b || min_ms > max_ms)
+    return HAL_ERROR;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  b->boff_min_ms = min_ms;
+  b->boff_max_ms = max_ms;
+  if (b->boff_delay_ms < min_ms)
+    b->boff_delay_ms = min_ms;
+  if (b->boff_delay_ms > max_ms)
+    b->boff_delay_ms = max_ms;
+  __set_PRIMASK(primask);
+  return HAL_OK;
+}
+
+// Account one PSR read (which clears its error codes). IRQs masked.
+static void mon_psr(can_bus_t *b, uint32_t psr) {
+  can_bus_monitor_t *m = &b->mon;
+  const uint32_t lec = psr & FDCAN_PSR_LEC;
+  const uint32_t dlec = (psr & FDCAN_PSR_DLEC) >> FDCAN_PSR_DLEC_Pos;
+  if (lec != 0 && lec != 7u)
+    m->lec[lec]++;
+  if (dlec != 0 && dlec != 7u)
+    m->dlec[dlec]++;
+
+  const uint8_t state = (psr & FDCAN_PSR_BO)   ? CAN_BUS_STATE_BUS_OFF
+                        : (psr & FDCAN_PSR_EP) ? CAN_BUS_STATE_PASSIVE
+                        : (psr & FDCAN_PSR_EW) ? CAN_BUS_STATE_WARNING
+                                               : CAN_BUS_STATE_ACTIVE;
+  if (state > m->state) {
+    if (state >= CAN_BUS_STATE_WARNING && m->state < CAN_BUS_STATE_WARNING)
+      m->warnings++;
+    if (state >= CAN_BUS_STATE_PASSIVE && m->state < CAN_BUS_STATE_PASSIVE)
+      m->passives++;
+    if (state == CAN_BUS_STATE_BUS_OFF) {
+      m->bus_offs++;
+#if CAN_BUS_BUSOFF_RECOVER
+      busoff_schedule(b);
+#endif
     }
+  }
+  const uint8_t was = m->state;
+  m->state = state;
+  if (was >= CAN_BUS_STATE_PASSIVE && state < was)
+    tx_pump(b); // back on the bus, or bulk no longer throttled
+}
+
+void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan,
+                                   uint32_t ErrorStatusITs) {
+  (void)ErrorStatusITs;
+  can_bus_t *b = bus_of(hfdcan);
+  if (!b)
+    return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  mon_psr(b, hfdcan->Instance->PSR);
+  __set_PRIMASK(primask);
+}
+
+// From can_bus_process_rx(): sample the error registers and, once per
+// CAN_BUS_MON_PERIOD_MS, turn the running counts into rates.
+static void mon_poll(can_bus_t *b) {
+  FDCAN_GlobalTypeDef *can = b->hfdcan->Instance;
+  can_bus_monitor_t *m = &b->mon;
+  const uint64_t now = us_clock_now();
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint32_t ecr = can->ECR; // clears CEL
+  m->errors += (ecr & FDCAN_ECR_CEL) >> FDCAN_ECR_CEL_Pos;
+  m->tec = (uint8_t)((ecr & FDCAN_ECR_TEC) >> FDCAN_ECR_TEC_Pos);
+  m->rec = (uint8_t)((ecr & FDCAN_ECR_REC) >> FDCAN_ECR_REC_Pos);
+  mon_psr(b, can->PSR);
+  const uint64_t dt_us = now - b->mon_last_us;
+  if (dt_us < (uint64_t)CAN_BUS_MON_PERIOD_MS * 1000u) {
+    __set_PRIMASK(primask);
+    return;
+  }
+  const uint32_t cur[4] = {m->tx_frames, m->rx_frames, b->mon_tx_bits,
+                           b->mon_rx_bits};
+  const uint64_t busy = b->mon_busy_ns;
+  const uint32_t errors = m->errors;
+  __set_PRIMASK(primask);
+
+  uint32_t rate[4];
+  for (unsigned i = 0; i < 4; i++)
+    rate[i] = (uint32_t)(((uint64_t)(cur[i] - b->mon_prev[i]) * 1000000u) /
+                         dt_us);
+  uint64_t load = (busy - b->mon_prev_busy_ns) / (dt_us * 10u);
+  if (load > 100u)
+    load = 100u;
+  // Errors per wire bit, averaged over a few periods; a period without
+  // frames says nothing about it.
+  const uint64_t bits =
+      (uint64_t)(cur[2] - b->mon_prev[2]) + (cur[3] - b->mon_prev[3]);
+  if (bits != 0) {
+    uint64_t pgb = ((uint64_t)(errors - b->mon_prev_errors) * 1000000000u) /
+                   bits;
+    if (pgb > UINT32_MAX)
+      pgb = UINT32_MAX;
+    b->mon_err_pgb = (uint32_t)((3u * (uint64_t)b->mon_err_pgb + pgb) / 4u);
+  }
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  m->tx_fps = rate[0];
+  m->rx_fps = rate[1];
+  m->tx_bps = rate[2];
+  m->rx_bps = rate[3];
+  m->load_pct = (uint8_t)load;
+  m->err_per_gbit = b->mon_err_pgb;
+  __set_PRIMASK(primask);
+  memcpy(b->mon_prev, cur, sizeof(cur));
+  b->mon_prev_errors = errors;
+  b->mon_prev_busy_ns = busy;
+  b->mon_last_us = now;
+}
+
+void can_bus_get_monitor(can_bus_t *b, can_bus_monitor_t *out) {
+  if (!b || !out)
+    return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = b->mon;
+  __set_PRIMASK(primask);
+}
 
-    // Only handle standard IDs here; extend as needed
-    uint32_t std_id = hdr.Identifier & 0x7FFu;
+void HAL_FDCAN_TimestampWraparoundCallback(FDCAN_HandleTypeDef *hfdcan) {
+  can_bus_t *b = bus_of(hfdcan);
+  if (b)
+    b->ts_wraps++;
+}
 
-    // hdr.DataLength is DLC code in HAL
-    size_t len = can_bus_dlc_to_len(hdr.DataLength);
-    if (len > 64)
-      len = 64;
+// Refill the hardware TX FIFO as buffers complete.
+void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef *hfdcan,
+                                        uint32_t BufferIndexes) {
+  can_bus_t *b = bus_of(hfdcan);
+  if (!b)
+    return;
+  for (unsigned i = 0; i < CAN_BUS_TX_HW_DEPTH; i++) {
+    if (BufferIndexes & (1u << i)) {
+      b->mon.tx_frames++;
+      b->mon_tx_bits += b->tx_elem_bits[i];
+      b->mon_busy_ns += b->tx_elem_ns[i];
+    }
+  }
+#if CAN_BUS_ASYNC_SLOTS
+  async_elems_end(b, BufferIndexes, 1);
+#endif
+  tx_kick(b); // line 1: the FIFO0 responder may preempt us
+#if CAN_BUS_ASYNC_SLOTS
+  async_run_done(b);
+#endif
+  const can_bus_tx_notify_cb_t cb = b->tx_notify;
+  if (b->tx_blocked && cb) {
+    b->tx_blocked = 0;
+    cb();
+  }
+}
 
-    // Push into ring; drop-oldest on overflow
-    rb_push_drop_oldest(std_id, data, (uint8_t)len);
+// A transmission that failed (AutoRetransmission is off, so there is no
+// second attempt) frees its element without completing: account it, maybe
+// send it again, and refill the FIFO.
+void HAL_FDCAN_TxBufferAbortCallback(FDCAN_HandleTypeDef *hfdcan,
+                                     uint32_t BufferIndexes) {
+  can_bus_t *b = bus_of(hfdcan);
+  if (!b)
+    return;
+#if CAN_BUS_TX_EVENTS
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint32_t psr = hfdcan->Instance->PSR;
+  mon_psr(b, psr);
+  // One error code for all of them; none means arbitration was lost.
+  const uint32_t lec = psr & FDCAN_PSR_LEC;
+  for (unsigned i = 0; i < CAN_BUS_TX_HW_DEPTH; i++) {
+    if ((BufferIndexes & (1u << i)) == 0)
+      continue;
+    if (lec == 3u) // ack error
+      b->tx_ev.nacked++;
+    else if (lec == 0 || lec == 7u)
+      b->tx_ev.arb_lost++;
+    else
+      b->tx_ev.bus_errors++;
+#if CAN_BUS_TX_RETRY
+    if (tx_resend(b, i))
+      BufferIndexes &= ~(1u << i); // its async message waits on the resend
+#endif
   }
+  __set_PRIMASK(primask);
+#endif
+#if CAN_BUS_ASYNC_SLOTS
+  async_elems_end(b, BufferIndexes, 0);
+#else
+  (void)BufferIndexes;
+#endif
+  tx_kick(b);
+#if CAN_BUS_ASYNC_SLOTS
+  async_run_done(b);
+#endif
 }
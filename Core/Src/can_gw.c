@@ -0,0 +1,144 @@
+// can_gw.c
+//
+// Dual-gateway redundancy (can_gw.h):
+//  - one peer is tracked: the first gateway heard, replaced only once it
+//  has timed out. Heartbeats from any other node count in `others`.
+//  - sharing holds while the peer was heard within CAN_GW_TIMEOUT_MS and
+//  both uplinks are up. can_gw_owns() evaluates that at every call from
+//  the heartbeat time and flags, so a dead peer's share moves over on the
+//  first packet after the timeout, not at the next poll.
+//  - the type hash is a Fibonacci multiply, top bit: neighbouring type IDs
+//  (a sensor's channels, usually numbered together) land on both shares.
+//
+// Notes / Assumptions:
+//  - Heartbeats go in the command class (CAN_BUS_TX_PRIO_MID) so bulk
+//  telemetry can't delay them past the timeout; a full ring retries on the
+//  next millisecond.
+//  - State is written in the telemetry RX thread only; can_gw_owns() reads
+//  single words from the TX thread, so a torn view lasts one packet.
+//  - Both gateways must agree on share assignment: node IDs unique on the
+//  bus (telemetry_node_id()).
+
+#include "can_gw.h"
+
+#ifdef CAN_GW_ENABLED
+
+#define BEAT_LEN 8u
+#define NO_PEER 0xFFFFu
+
+static can_bus_t *g_bus = NULL;
+static int (*g_uplink_fn)(void) = NULL;
+static uint16_t g_node = 0;
+static uint8_t g_ready = 0;
+static uint8_t g_local_up = 1;
+static uint32_t g_seq = 0;
+static uint32_t g_next_ms = 0;
+static volatile uint16_t g_peer_node = NO_PEER;
+static volatile uint8_t g_peer_up = 0;
+static volatile uint32_t g_peer_heard_ms = 0;
+static can_gw_stats_t g_stats;
+
+static int peer_alive(uint32_t now) {
+  return g_peer_node != NO_PEER &&
+         now - g_peer_heard_ms <= CAN_GW_TIMEOUT_MS;
+}
+
+static int sharing(uint32_t now) {
+  return g_local_up && g_peer_up && peer_alive(now);
+}
+
+static void on_beat(const uint8_t *d, size_t len, uint64_t ts_us,
+                    void *user) {
+  (void)ts_us;
+  (void)user;
+  if (len < BEAT_LEN || d[0] != CAN_GW_VERSION) {
+    g_stats.bad++;
+    return;
+  }
+  const uint16_t node = (uint16_t)(d[1] | (d[2] << 8));
+  if (node == g_node)
+    return;
+  const uint32_t now = HAL_GetTick();
+  if (node != g_peer_node && peer_alive(now)) {
+    g_stats.others++;
+    return;
+  }
+  g_stats.beats_rx++;
+  g_peer_up = (d[3] & CAN_GW_F_UPLINK) ? 1u : 0u;
+  g_peer_heard_ms = now;
+  g_peer_node = node;
+}
+
+int can_gw_owns(uint32_t ty) {
+  if (!g_ready || !sharing(HAL_GetTick()))
+    return 1;
+  const uint32_t share = (ty * 2654435761u) >> 31;
+  const uint32_t mine = (g_node < g_peer_node) ? 0u : 1u;
+  if (share == mine)
+    return 1;
+  g_stats.shed++;
+  return 0;
+}
+
+uint32_t can_gw_poll(void) {
+  if (!g_ready)
+    return UINT32_MAX;
+  const uint32_t now = HAL_GetTick();
+  g_local_up = (!g_uplink_fn || g_uplink_fn()) ? 1u : 0u;
+
+  const uint8_t role = sharing(now) ? CAN_GW_ROLE_SHARE : CAN_GW_ROLE_ALL;
+  if (role == CAN_GW_ROLE_ALL && g_stats.role == CAN_GW_ROLE_SHARE)
+    g_stats.takeovers++;
+  g_stats.role = role;
+
+  if ((int32_t)(now - g_next_ms) >= 0) {
+    const uint8_t f[BEAT_LEN] = {
+        CAN_GW_VERSION,
+        (uint8_t)g_node,
+        (uint8_t)(g_node >> 8),
+        g_local_up ? CAN_GW_F_UPLINK : 0u,
+        (uint8_t)g_seq,
+        (uint8_t)(g_seq >> 8),
+        (uint8_t)(g_seq >> 16),
+        (uint8_t)(g_seq >> 24),
+    };
+    if (can_bus_send_raw(g_bus, CAN_GW_STD_ID, 0, f, sizeof(f),
+                         CAN_BUS_TX_PRIO_MID) != HAL_OK)
+      return 1u; // ring full; again on the next tick
+    g_stats.beats_tx++;
+    g_seq++;
+    g_next_ms = now + CAN_GW_PERIOD_MS;
+  }
+
+  uint32_t wait = g_next_ms - now;
+  if (role == CAN_GW_ROLE_SHARE) {
+    const uint32_t left = CAN_GW_TIMEOUT_MS - (now - g_peer_heard_ms) + 1u;
+    if (left < wait)
+      wait = left; // see the takeover in the stats when it happens
+  }
+  return wait;
+}
+
+HAL_StatusTypeDef can_gw_init(can_bus_t *bus, uint16_t node_id,
+                              int (*uplink_up)(void)) {
+  if (!bus || node_id == NO_PEER)
+    return HAL_ERROR;
+  if (can_bus_subscribe_id(bus, CAN_GW_STD_ID, on_beat, NULL) != HAL_OK)
+    return HAL_ERROR;
+  g_bus = bus;
+  g_node = node_id;
+  g_uplink_fn = uplink_up;
+  g_next_ms = HAL_GetTick();
+  g_ready = 1;
+  return HAL_OK;
+}
+
+void can_gw_get_stats(can_gw_stats_t *out) {
+  if (!out)
+    return;
+  *out = g_stats;
+  out->peer_node = g_peer_node;
+  out->share = (g_peer_node != NO_PEER && g_node > g_peer_node) ? 1u : 0u;
+}
+
+#endif /* CAN_GW_ENABLED */
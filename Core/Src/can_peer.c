@@ -0,0 +1,266 @@
+// can_peer.c
+//
+// Peer discovery (can_peer.h):
+//  - adverts are classic frames on CAN_PEER_STD_ID, one per advertised ID,
+//  sent in the command class. A round that hits a full TX ring resumes at
+//  the frame it stopped on, from the next poll.
+//  - the table has one entry per advertised ID, keyed by the ID (NO_ID
+//  entries by node). A second node advertising a known ID takes the entry
+//  over; that's counted as a conflict, since its traffic can't be told
+//  apart from the first node's.
+//  - an entry's profile follows its FD flag through
+//  can_bus_set_peer_profile(); the entry remembers whether it set CLASSIC
+//  so expiry and a changed advert undo only what discovery did.
+//
+// Notes / Assumptions:
+//  - Runs entirely in the telemetry RX thread (the subscribe callback and
+//  the poll), so nothing here is locked; the adverts share the command
+//  class with ISO-TP flow control, sent from the same thread.
+//  - BRS is recorded, not acted on: the data-phase bit rate is set for the
+//  whole bus, so a node without it only shows up in the table.
+//  - The driver's profile table is small (CAN_BUS_PEER_PROFILES); classic
+//  IDs beyond it keep FD and are counted in no_profile.
+
+#include "can_peer.h"
+#include <string.h>
+
+#ifdef CAN_PEER_ENABLED
+
+#define ADVERT_LEN 8u
+#define CAP_UNIT 64u
+#define CAP_UNIT_STREAM 0xFFu
+
+typedef struct {
+  can_peer_info_t info; // age_ms unused
+  uint32_t heard_ms;
+  uint8_t used;
+  uint8_t classic; // we set CAN_BUS_PROFILE_CLASSIC on info.std_id
+} peer_entry_t;
+
+static can_bus_t *g_bus = NULL;
+static uint16_t g_node = 0;
+static can_peer_local_t g_local[CAN_PEER_LOCAL_MAX];
+static size_t g_nlocal = 0;
+static uint8_t g_ready = 0;
+static uint8_t g_due = 0;     // advertise at the next poll
+static size_t g_tx_next = 0;  // next advert of the round in progress
+static uint32_t g_next_ms = 0;
+static peer_entry_t g_peers[CAN_PEER_MAX];
+static can_peer_stats_t g_stats;
+
+static uint8_t cap_units(uint32_t bytes) {
+  if (bytes == CAN_PEER_CAP_STREAM)
+    return CAP_UNIT_STREAM;
+  const uint32_t u = bytes / CAP_UNIT;
+  return (u >= CAP_UNIT_STREAM) ? (uint8_t)(CAP_UNIT_STREAM - 1u) : (uint8_t)u;
+}
+
+static void apply_profile(peer_entry_t *e, uint8_t classic) {
+  if (e->info.std_id == CAN_PEER_NO_ID || e->classic == classic)
+    return;
+  if (can_bus_set_peer_profile(g_bus, e->info.std_id,
+                               classic ? CAN_BUS_PROFILE_CLASSIC
+                                       : CAN_BUS_PROFILE_FD) != HAL_OK) {
+    g_stats.no_profile++;
+    return;
+  }
+  e->classic = classic;
+}
+
+static void entry_drop(peer_entry_t *e) {
+  apply_profile(e, 0);
+  e->used = 0;
+}
+
+static peer_entry_t *entry_find(uint16_t std_id, uint16_t node) {
+  for (unsigned i = 0; i < CAN_PEER_MAX; i++) {
+    peer_entry_t *e = &g_peers[i];
+    if (e->used && e->info.std_id == std_id &&
+        (std_id != CAN_PEER_NO_ID || e->info.node_id == node))
+      return e;
+  }
+  return NULL;
+}
+
+static int node_known(uint16_t node) {
+  for (unsigned i = 0; i < CAN_PEER_MAX; i++) {
+    if (g_peers[i].used && g_peers[i].info.node_id == node)
+      return 1;
+  }
+  return 0;
+}
+
+static void on_advert(const uint8_t *d, size_t len, uint64_t ts_us,
+                      void *user) {
+  (void)ts_us;
+  (void)user;
+  if (len < ADVERT_LEN || d[0] != CAN_PEER_VERSION) {
+    g_stats.bad++;
+    return;
+  }
+  const uint16_t node = (uint16_t)(d[1] | (d[2] << 8));
+  const uint16_t std_id = (uint16_t)(d[3] | (d[4] << 8));
+  if (node == g_node || (std_id > 0x7FFu && std_id != CAN_PEER_NO_ID)) {
+    if (node != g_node)
+      g_stats.bad++;
+    return;
+  }
+  g_stats.adverts_rx++;
+
+  peer_entry_t *e = entry_find(std_id, node);
+  if (!e) {
+    if (!node_known(node))
+      g_due = 1; // a new node: let it hear us now, not in a period
+    for (unsigned i = 0; i < CAN_PEER_MAX && !e; i++) {
+      if (!g_peers[i].used)
+        e = &g_peers[i];
+    }
+    if (!e) {
+      g_stats.table_full++;
+      return;
+    }
+    memset(e, 0, sizeof(*e));
+    e->used = 1;
+  } else if (e->info.node_id != node) {
+    g_stats.conflicts++;
+  }
+
+  uint8_t frame = d[6];
+  if (frame < 8u)
+    frame = 8u;
+  if (frame > 64u)
+    frame = 64u;
+  e->info.node_id = node;
+  e->info.std_id = std_id;
+  e->info.flags = d[5] & (CAN_PEER_F_FD | CAN_PEER_F_BRS);
+  e->info.transport = (uint8_t)((d[5] >> 4) & 0x03u);
+  e->info.frame_max = (e->info.flags & CAN_PEER_F_FD) ? frame : 8u;
+  e->info.reasm_bytes = (d[7] == CAP_UNIT_STREAM)
+                            ? CAN_PEER_CAP_STREAM
+                            : (uint32_t)d[7] * CAP_UNIT;
+  e->heard_ms = HAL_GetTick();
+  apply_profile(e, (e->info.flags & CAN_PEER_F_FD) ? 0u : 1u);
+}
+
+// Our adverts from g_tx_next on; HAL_BUSY if the ring filled first.
+static HAL_StatusTypeDef send_round(void) {
+  const uint8_t flags =
+      (CAN_PEER_LOCAL_FD ? CAN_PEER_F_FD : 0u) |
+      (CAN_PEER_LOCAL_FD && CAN_PEER_LOCAL_BRS ? CAN_PEER_F_BRS : 0u);
+  const size_t count = g_nlocal ? g_nlocal : 1u;
+  while (g_tx_next < count) {
+    const can_peer_local_t *l = g_nlocal ? &g_local[g_tx_next] : NULL;
+    const uint16_t std_id = l ? l->std_id : CAN_PEER_NO_ID;
+    const uint8_t f[ADVERT_LEN] = {
+        CAN_PEER_VERSION,
+        (uint8_t)g_node,
+        (uint8_t)(g_node >> 8),
+        (uint8_t)std_id,
+        (uint8_t)(std_id >> 8),
+        (uint8_t)(flags | ((l ? l->transport & 0x03u : 0u) << 4)),
+        CAN_PEER_LOCAL_FD ? 64u : 8u,
+        l ? cap_units(l->reasm_bytes) : 0u,
+    };
+    if (can_bus_send_raw(g_bus, CAN_PEER_STD_ID, 0, f, sizeof(f),
+                         CAN_BUS_TX_PRIO_MID) != HAL_OK)
+      return HAL_BUSY;
+    g_stats.adverts_tx++;
+    g_tx_next++;
+  }
+  g_tx_next = 0;
+  return HAL_OK;
+}
+
+uint32_t can_peer_poll(void) {
+  if (!g_ready)
+    return UINT32_MAX;
+  const uint32_t now = HAL_GetTick();
+
+  uint32_t next_ms = UINT32_MAX;
+  for (unsigned i = 0; i < CAN_PEER_MAX; i++) {
+    peer_entry_t *e = &g_peers[i];
+    if (!e->used)
+      continue;
+    const uint32_t age = now - e->heard_ms;
+    if (age > CAN_PEER_STALE_MS) {
+      entry_drop(e);
+      g_stats.expired++;
+      continue;
+    }
+    const uint32_t left = CAN_PEER_STALE_MS - age + 1u;
+    if (left < next_ms)
+      next_ms = left;
+  }
+
+  if (g_due || g_tx_next || (int32_t)(now - g_next_ms) >= 0) {
+    if (send_round() != HAL_OK)
+      return 1u; // ring full; the rest of the round on the next tick
+    g_due = 0;
+    g_next_ms = now + CAN_PEER_PERIOD_MS;
+  }
+  const uint32_t advert_ms = g_next_ms - now;
+  return (advert_ms < next_ms) ? advert_ms : next_ms;
+}
+
+HAL_StatusTypeDef can_peer_init(can_bus_t *bus, uint16_t node_id,
+                                const can_peer_local_t *ids, size_t n) {
+  if (!bus || n > CAN_PEER_LOCAL_MAX || (n && !ids))
+    return HAL_ERROR;
+  for (size_t i = 0; i < n; i++) {
+    if (ids[i].std_id > 0x7FFu)
+      return HAL_ERROR;
+  }
+  if (can_bus_subscribe_id(bus, CAN_PEER_STD_ID, on_advert, NULL) != HAL_OK)
+    return HAL_ERROR;
+  g_bus = bus;
+  g_node = node_id;
+  if (n)
+    memcpy(g_local, ids, n * sizeof(ids[0]));
+  g_nlocal = n;
+  g_tx_next = 0;
+  g_due = 1;
+  g_ready = 1;
+  return HAL_OK;
+}
+
+static void info_out(const peer_entry_t *e, can_peer_info_t *out) {
+  *out = e->info;
+  out->age_ms = HAL_GetTick() - e->heard_ms;
+}
+
+int can_peer_lookup(uint16_t std_id, can_peer_info_t *out) {
+  for (unsigned i = 0; i < CAN_PEER_MAX; i++) {
+    const peer_entry_t *e = &g_peers[i];
+    if (e->used && e->info.std_id == std_id && std_id != CAN_PEER_NO_ID) {
+      if (out)
+        info_out(e, out);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int can_peer_get(unsigned i, can_peer_info_t *out) {
+  if (i >= CAN_PEER_MAX || !g_peers[i].used)
+    return 0;
+  if (out)
+    info_out(&g_peers[i], out);
+  return 1;
+}
+
+void can_peer_get_stats(can_peer_stats_t *out) {
+  if (!out)
+    return;
+  *out = g_stats;
+  out->peers = 0;
+  out->classic = 0;
+  for (unsigned i = 0; i < CAN_PEER_MAX; i++) {
+    if (!g_peers[i].used)
+      continue;
+    out->peers++;
+    if (g_peers[i].classic)
+      out->classic++;
+  }
+}
+
+#endif /* CAN_PEER_ENABLED */
@@ -0,0 +1,52 @@
+// cobs.c
+#include "cobs.h"
+
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+  if (!dst || cap < COBS_MAX_ENCODED(len)) return 0;
+
+  size_t code_pos = 0;
+  size_t out = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < len; i++) {
+    if (src[i] == 0) {
+      dst[code_pos] = code;
+      code_pos = out++;
+      code = 1;
+      continue;
+    }
+    dst[out++] = src[i];
+    if (++code == 0xFFu) {
+      dst[code_pos] = code;
+      code_pos = out++;
+      code = 1;
+    }
+  }
+  dst[code_pos] = code;
+  return out;
+}
+
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+  if (!src || !dst || len == 0) return 0;
+
+  size_t in = 0;
+  size_t out = 0;
+
+  while (in < len) {
+    const uint8_t code = src[in++];
+    if (code == 0) return 0;
+
+    const size_t run = (size_t)code - 1u;
+    if (run > len - in || out + run > cap) return 0;
+    for (size_t i = 0; i < run; i++) {
+      dst[out++] = src[in++];
+    }
+
+    // A 0xFF block carries no implied zero; the final block never does.
+    if (code != 0xFFu && in < len) {
+      if (out >= cap) return 0;
+      dst[out++] = 0;
+    }
+  }
+  return out;
+}
@@ -0,0 +1,261 @@
+// config_store.c
+//
+// Tunables in internal flash (format in config_store.h):
+//  - the first call reads both pages and keeps the values of the valid
+//  record with the newest seq; config_define() takes its key's value from
+//  there.
+//  - config_set() only touches RAM. config_commit() marks the set for
+//  config_store_poll(), which lays out the record in RAM, erases the other
+//  page, programs the entries and then the header, and reads it back.
+//  - keys a record holds that this build doesn't declare are written back
+//  unchanged, so a downgrade and upgrade keeps them.
+//
+// Notes / Assumptions:
+//  - Same single-bank stalls as flash_log.c (a page erase ~22 ms); commits
+//  are rare and happen in the maintenance thread.
+//  - Values are single words, so each is read and written whole without a
+//  lock; a record is laid out with interrupts masked so it holds one
+//  consistent set.
+
+#include "config_store.h"
+#include "crc_hw.h"
+#include <string.h>
+
+#define CFG_MAGIC 0x31474643u // "CFG1"
+#define CFG_FORMAT 1u
+#define CFG_HDR 16u
+#define CFG_ENTRY 8u
+#define CFG_PAGES 2u
+
+_Static_assert(CFG_HDR + CONFIG_KEY_COUNT * CFG_ENTRY <= FLASH_PAGE_SIZE,
+               "a record must fit a page");
+
+extern uint8_t _sconfig[];
+extern uint8_t _econfig[];
+
+typedef struct {
+  config_entry_t e;
+  config_apply_cb_t apply;
+} cfg_slot_t;
+
+static cfg_slot_t g_cfg[CONFIG_KEY_COUNT];
+static uint32_t g_stored[CONFIG_KEY_COUNT];
+static uint8_t g_stored_ok[CONFIG_KEY_COUNT];
+static uint8_t g_loaded = 0;
+static int8_t g_page = -1; // holding the newest record
+static volatile uint8_t g_commit = 0;
+static config_stats_t g_stats;
+
+static uint8_t g_image[CFG_HDR + CONFIG_KEY_COUNT * CFG_ENTRY]
+    __attribute__((aligned(8)));
+
+static inline uint8_t *page_addr(uint32_t p) {
+  return &_sconfig[p * FLASH_PAGE_SIZE];
+}
+
+static inline uint16_t rd16(const uint8_t *a) {
+  return (uint16_t)(a[0] | (a[1] << 8));
+}
+
+static inline uint32_t rd32(const uint8_t *a) {
+  uint32_t v;
+  memcpy(&v, a, sizeof(v));
+  return v;
+}
+
+static inline void wr16(uint8_t *a, uint16_t v) {
+  a[0] = (uint8_t)v;
+  a[1] = (uint8_t)(v >> 8);
+}
+
+static inline void wr32(uint8_t *a, uint32_t v) { memcpy(a, &v, sizeof(v)); }
+
+// CRC of a record in flash or the image: everything after the crc field.
+static uint32_t record_crc(const uint8_t *r, uint32_t count) {
+  return crc_hw_compute(&crc_hw_crc32, &r[8],
+                        CFG_HDR - 8u + (size_t)count * CFG_ENTRY);
+}
+
+// Entry count of a valid record on page `p`, -1 if it holds none. A record
+// from a build with more keys is read too; load() skips the keys this one
+// doesn't know.
+static int page_valid(uint32_t p) {
+  const uint8_t *a = page_addr(p);
+  if (rd32(a) != CFG_MAGIC || rd16(&a[8]) != CFG_FORMAT) return -1;
+  const uint32_t count = rd16(&a[10]);
+  if (CFG_HDR + count * CFG_ENTRY > FLASH_PAGE_SIZE) return -1;
+  if (record_crc(a, count) != rd32(&a[4])) return -1;
+  return (int)count;
+}
+
+static void load(void) {
+  if (g_loaded) return;
+  g_loaded = 1;
+  const uint32_t pages = (uint32_t)(_econfig - _sconfig) / FLASH_PAGE_SIZE;
+  int count = -1;
+  for (uint32_t p = 0; p < pages && p < CFG_PAGES; p++) {
+    const int n = page_valid(p);
+    if (n < 0) continue;
+    const uint32_t seq = rd32(&page_addr(p)[12]);
+    if (g_page >= 0 && (int32_t)(seq - g_stats.seq) <= 0) continue;
+    g_page = (int8_t)p;
+    g_stats.seq = seq;
+    count = n;
+  }
+  if (g_page < 0) return;
+  const uint8_t *e = &page_addr((uint32_t)g_page)[CFG_HDR];
+  for (int i = 0; i < count; i++, e += CFG_ENTRY) {
+    const uint16_t key = rd16(e);
+    if ((uint16_t)(rd16(&e[2]) ^ key) != 0xFFFFu || key == CONFIG_KEY_NONE ||
+        key >= CONFIG_KEY_COUNT)
+      continue;
+    g_stored[key] = rd32(&e[4]);
+    g_stored_ok[key] = 1;
+  }
+}
+
+static inline int key_ok(config_key_t key) {
+  return (unsigned)key > CONFIG_KEY_NONE && (unsigned)key < CONFIG_KEY_COUNT;
+}
+
+uint32_t config_define(config_key_t key, uint32_t def, uint32_t min,
+                       uint32_t max, uint8_t flags, config_apply_cb_t apply) {
+  if (!key_ok(key)) return def;
+  load();
+  uint32_t v = def;
+  if (g_stored_ok[key]) {
+    if (g_stored[key] >= min && g_stored[key] <= max) v = g_stored[key];
+    else g_stats.ignored++;
+  }
+  cfg_slot_t *s = &g_cfg[key];
+  s->e.value = v;
+  s->e.pending = v;
+  s->e.def = def;
+  s->e.min = min;
+  s->e.max = max;
+  s->e.flags = (uint8_t)((flags & CONFIG_LIVE) | CONFIG_DEFINED);
+  s->apply = apply;
+  return v;
+}
+
+uint32_t config_get(config_key_t key) {
+  return key_ok(key) ? g_cfg[key].e.value : 0;
+}
+
+HAL_StatusTypeDef config_set(config_key_t key, uint32_t value) {
+  if (!key_ok(key)) return HAL_ERROR;
+  cfg_slot_t *s = &g_cfg[key];
+  if (!(s->e.flags & CONFIG_DEFINED) || value < s->e.min ||
+      value > s->e.max)
+    return HAL_ERROR;
+  s->e.pending = value;
+  g_stats.dirty = 1;
+  if ((s->e.flags & CONFIG_LIVE) && s->e.value != value) {
+    s->e.value = value;
+    if (s->apply) s->apply(value);
+  }
+  return HAL_OK;
+}
+
+void config_set_defaults(void) {
+  for (unsigned k = 1; k < CONFIG_KEY_COUNT; k++) {
+    if (g_cfg[k].e.flags & CONFIG_DEFINED)
+      (void)config_set((config_key_t)k, g_cfg[k].e.def);
+  }
+}
+
+void config_commit(void) { g_commit = 1; }
+
+static void dcache_reset(void) {
+  if (!READ_BIT(FLASH->ACR, FLASH_ACR_DCEN)) return;
+  __HAL_FLASH_DATA_CACHE_DISABLE();
+  __HAL_FLASH_DATA_CACHE_RESET();
+  __HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+// Lay out the pending values as a record in g_image; returns its length.
+static size_t build_image(uint32_t seq) {
+  uint32_t count = 0;
+  uint8_t *e = &g_image[CFG_HDR];
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (unsigned k = 1; k < CONFIG_KEY_COUNT; k++) {
+    uint32_t v;
+    if (g_cfg[k].e.flags & CONFIG_DEFINED) v = g_cfg[k].e.pending;
+    else if (g_stored_ok[k]) v = g_stored[k];
+    else continue;
+    wr16(e, (uint16_t)k);
+    wr16(&e[2], (uint16_t)~k);
+    wr32(&e[4], v);
+    e += CFG_ENTRY;
+    count++;
+  }
+  g_stats.dirty = 0;
+  __set_PRIMASK(primask);
+
+  wr32(&g_image[0], CFG_MAGIC);
+  wr16(&g_image[8], CFG_FORMAT);
+  wr16(&g_image[10], (uint16_t)count);
+  wr32(&g_image[12], seq);
+  wr32(&g_image[4], record_crc(g_image, count));
+  return CFG_HDR + (size_t)count * CFG_ENTRY;
+}
+
+static HAL_StatusTypeDef write_page(uint32_t p, size_t len) {
+  uint8_t *a = page_addr(p);
+  FLASH_EraseInitTypeDef er = {0};
+  er.TypeErase = FLASH_TYPEERASE_PAGES;
+  er.Banks = FLASH_BANK_1;
+  er.Page = ((uint32_t)(uintptr_t)a - FLASH_BASE) / FLASH_PAGE_SIZE;
+  er.NbPages = 1;
+  uint32_t bad = 0;
+  (void)HAL_FLASH_Unlock();
+  HAL_StatusTypeDef st = HAL_FLASHEx_Erase(&er, &bad);
+  // Back to front, so the magic goes last: a record cut short has none.
+  for (size_t off = len; st == HAL_OK && off > 0;) {
+    off -= 8u;
+    uint64_t v;
+    memcpy(&v, &g_image[off], sizeof(v));
+    st = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD,
+                           (uint32_t)(uintptr_t)&a[off], v);
+  }
+  (void)HAL_FLASH_Lock();
+  dcache_reset();
+  if (st == HAL_OK && memcmp(a, g_image, len) != 0) st = HAL_ERROR;
+  return st;
+}
+
+uint32_t config_store_poll(void) {
+  if (!g_commit) return UINT32_MAX;
+  g_commit = 0;
+  load();
+  const uint32_t pages = (uint32_t)(_econfig - _sconfig) / FLASH_PAGE_SIZE;
+  if (pages == 0) {
+    g_stats.errors++;
+    return UINT32_MAX;
+  }
+  const uint32_t p = (g_page < 0 || pages < 2u) ? 0u : (uint32_t)(g_page ^ 1);
+  const uint32_t seq = g_stats.seq + 1u;
+  const size_t len = build_image(seq);
+  if (write_page(p, len) != HAL_OK) {
+    g_stats.errors++;
+    g_stats.dirty = 1;
+    return UINT32_MAX; // the previous record still stands
+  }
+  g_page = (int8_t)p;
+  g_stats.seq = seq;
+  g_stats.commits++;
+  return UINT32_MAX;
+}
+
+int config_get_entry(config_key_t key, config_entry_t *out) {
+  if (!out || (unsigned)key >= CONFIG_KEY_COUNT) return 0;
+  *out = g_cfg[key].e;
+  return 1;
+}
+
+void config_get_stats(config_stats_t *out) {
+  if (!out) return;
+  load();
+  *out = g_stats;
+}
@@ -0,0 +1,225 @@
+// coro.c
+//
+// Coroutine executor (coro.h):
+//  - coroutines are kept in a table of pointers; one pass runs, in table
+//  order, every one that was woken, yielded, just started or whose deadline
+//  passed, then the thread waits on its event flag for the earliest
+//  deadline left, or for coro_wake().
+//  - a wake is a flag in the coroutine, taken (tested and cleared with IRQs
+//  masked) just before it runs, so one coming in while it runs makes it run
+//  again in the next pass.
+//  - a deadline fires once: after the run it passed in, it is disarmed
+//  unless the coroutine armed a new one.
+//  - a coroutine returning CORO_DONE leaves the table.
+//
+// Notes / Assumptions:
+//  - Deadlines are ThreadX ticks compared as signed differences: waits stay
+//  below 2^31 ticks.
+//  - Run times are us_clock; a coroutine hogging the thread shows up in
+//  run_max_us, nothing preempts it.
+
+#include "coro.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "us_clock.h"
+#include "stm32g4xx_hal.h"
+#include <string.h>
+
+#ifdef CORO_ENABLED
+
+// Below the I2C poll thread, above the telemetry stages: drivers mostly
+// start transfers and hand values on. Stack: CORO_THREAD_STACK_SIZE in
+// mem_budget.h.
+#ifndef CORO_THREAD_PRIORITY
+#define CORO_THREAD_PRIORITY 4u
+#endif
+
+#define WAKE_FLAG 0x1u
+
+static TX_THREAD g_thread;
+static MEM_ARENA(stack) ULONG g_stack[CORO_THREAD_STACK_SIZE / sizeof(ULONG)];
+static TX_EVENT_FLAGS_GROUP g_wake;
+static uint8_t g_ready = 0;
+static coro_t *g_coros[CORO_MAX];
+
+static ULONG ms_to_ticks(uint32_t ms) {
+  const uint64_t t = ((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u;
+  return (ULONG)t;
+}
+
+static void kick(void) {
+  if (g_ready) {
+    (void)tx_event_flags_set(&g_wake, WAKE_FLAG, TX_OR);
+  }
+}
+
+int coro_start(coro_t *c, const char *name, coro_fn_t fn, void *user) {
+  if (!c || !fn || c->used) {
+    return -1;
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  int slot = -1;
+  for (unsigned i = 0; i < CORO_MAX; i++) {
+    if (!g_coros[i]) {
+      slot = (int)i;
+      break;
+    }
+  }
+  if (slot >= 0) {
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->fn = fn;
+    c->user = user;
+    c->yielded = 1; // first run in the next pass
+    c->used = 1;
+    g_coros[slot] = c;
+  }
+  __set_PRIMASK(primask);
+  if (slot < 0) {
+    return -1;
+  }
+  kick();
+  return 0;
+}
+
+void coro_stop(coro_t *c) {
+  if (!c) {
+    return;
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (unsigned i = 0; i < CORO_MAX; i++) {
+    if (g_coros[i] == c) {
+      g_coros[i] = NULL;
+    }
+  }
+  c->used = 0;
+  __set_PRIMASK(primask);
+}
+
+void coro_wake(coro_t *c) {
+  if (!c) {
+    return;
+  }
+  c->signalled = 1;
+  kick();
+}
+
+void coro_arm(coro_t *c, uint32_t ms) {
+  c->deadline = (uint32_t)(tx_time_get() + ms_to_ticks(ms));
+  c->armed = 1;
+}
+
+int coro_timed_out(const coro_t *c) {
+  return c->armed && (int32_t)(tx_time_get() - c->deadline) >= 0;
+}
+
+int coro_get_stats(unsigned i, coro_stats_t *out) {
+  if (!out) {
+    return 0;
+  }
+  memset(out, 0, sizeof(*out));
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  unsigned seen = 0;
+  int found = 0;
+  for (unsigned k = 0; k < CORO_MAX && !found; k++) {
+    const coro_t *c = g_coros[k];
+    if (!c || seen++ != i) {
+      continue;
+    }
+    out->name = c->name;
+    out->runs = c->runs;
+    out->run_max_us = c->run_max_us;
+    out->run_avg_us = c->runs ? (uint32_t)(c->run_total_us / c->runs) : 0u;
+    found = 1;
+  }
+  __set_PRIMASK(primask);
+  return found;
+}
+
+// Run everything that is due once; the ticks until the earliest deadline
+// left, 0 if something yielded, TX_WAIT_FOREVER for none.
+static ULONG run_pass(void) {
+  ULONG wait = TX_WAIT_FOREVER;
+  for (unsigned i = 0; i < CORO_MAX; i++) {
+    coro_t *c = g_coros[i];
+    if (!c) {
+      continue;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const uint8_t woken = c->signalled;
+    c->signalled = 0;
+    __set_PRIMASK(primask);
+
+    const ULONG now = tx_time_get();
+    const int due = c->armed && (int32_t)(now - c->deadline) >= 0;
+    if (!woken && !c->yielded && !due) {
+      if (c->armed && (ULONG)(c->deadline - now) < wait) {
+        wait = (ULONG)(c->deadline - now);
+      }
+      continue;
+    }
+
+    c->woken = woken;
+    c->yielded = 0;
+    const uint64_t t0 = us_clock_now();
+    const int r = c->fn(c, c->user);
+    const uint32_t us = (uint32_t)(us_clock_now() - t0);
+    c->runs++;
+    c->run_total_us += us;
+    if (us > c->run_max_us) {
+      c->run_max_us = us;
+    }
+    if (r == CORO_DONE) {
+      coro_stop(c);
+      continue;
+    }
+    if (coro_timed_out(c)) {
+      c->armed = 0; // had its run; it doesn't fire again
+    }
+    if (c->yielded || c->signalled) {
+      wait = 0;
+    } else if (c->armed) {
+      // A deadline the coroutine didn't meet yet still times its next run.
+      const int32_t left = (int32_t)(c->deadline - tx_time_get());
+      const ULONG w = (left > 0) ? (ULONG)left : 0u;
+      if (w < wait) {
+        wait = w;
+      }
+    }
+  }
+  return wait;
+}
+
+static void coro_thread_entry(ULONG input) {
+  (void)input;
+  for (;;) {
+    const ULONG wait = run_pass();
+    if (wait == 0) {
+      continue;
+    }
+    ULONG got;
+    (void)tx_event_flags_get(&g_wake, WAKE_FLAG, TX_OR_CLEAR, &got, wait);
+  }
+}
+
+void create_coro_thread(void) {
+  if (tx_event_flags_create(&g_wake, "coro") != TX_SUCCESS) {
+    die("Failed to create coroutine flags");
+  }
+  const UINT status = tx_thread_create(
+      &g_thread, "Coroutines", coro_thread_entry, 0, g_stack,
+      CORO_THREAD_STACK_SIZE, CORO_THREAD_PRIORITY, CORO_THREAD_PRIORITY,
+      TX_NO_TIME_SLICE, TX_AUTO_START);
+  if (status != TX_SUCCESS) {
+    die("Failed to create coroutine thread: %u", (unsigned)status);
+  }
+  g_ready = 1;
+}
+
+#endif /* CORO_ENABLED */
@@ -0,0 +1,176 @@
+// cpu_load_thread.c
+//
+// Low-priority monitor that publishes per-thread, ISR and idle CPU share
+// from the ThreadX execution profile once per window, and keeps the last
+// window's shares for the health packet. Built only with
+// TX_EXECUTION_PROFILE_ENABLE (CMake option ENABLE_THREADX_PROFILING).
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+
+#include <stdio.h>
+
+#ifdef TX_EXECUTION_PROFILE_ENABLE
+
+TX_THREAD cpu_load_thread;
+MEM_ARENA(stack) ULONG cpu_load_thread_stack[CPU_LOAD_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+// Sampling window:
+#define CPU_LOAD_PERIOD_MS 1000u
+
+// Below every worker thread so the measurement doesn't steal their time.
+#define CPU_LOAD_THREAD_PRIORITY 30u
+
+// Threads whose last share is kept for cpu_load_thread_permille().
+#define CPU_LOAD_MAX_THREADS 16u
+
+extern TX_THREAD *_tx_thread_created_ptr;
+
+static struct {
+    const TX_THREAD *t;
+    uint16_t permille;
+} g_last[CPU_LOAD_MAX_THREADS];
+static volatile uint16_t g_last_isr = CPU_LOAD_UNKNOWN;
+static volatile uint16_t g_last_idle = CPU_LOAD_UNKNOWN;
+
+static ULONG permille(EXECUTION_TIME part, EXECUTION_TIME whole)
+{
+    return whole ? (ULONG)((part * 1000ULL) / whole) : 0u;
+}
+
+// Report shares of the last window in per mille, then restart the window.
+static void report_cpu_load(void)
+{
+    EXECUTION_TIME isr = 0;
+    EXECUTION_TIME idle = 0;
+    (void)_tx_execution_isr_time_get(&isr);
+    (void)_tx_execution_idle_time_get(&idle);
+
+    EXECUTION_TIME whole = isr + idle;
+    TX_THREAD *head = _tx_thread_created_ptr;
+    TX_THREAD *t = head;
+    while (t != TX_NULL) {
+        EXECUTION_TIME busy = 0;
+        (void)_tx_execution_thread_time_get(t, &busy);
+        whole += busy;
+        t = t->tx_thread_created_next;
+        if (t == head) {
+            break;
+        }
+    }
+
+    g_last_isr = (uint16_t)permille(isr, whole);
+    g_last_idle = (uint16_t)permille(idle, whole);
+
+    char txt[192];
+    int n = snprintf(txt, sizeof(txt), "cpu permille isr=%u idle=%u",
+                     (unsigned)g_last_isr, (unsigned)g_last_idle);
+
+    t = head;
+    unsigned kept = 0;
+    while (t != TX_NULL) {
+        EXECUTION_TIME busy = 0;
+        (void)_tx_execution_thread_time_get(t, &busy);
+        const ULONG pm = permille(busy, whole);
+        if (kept < CPU_LOAD_MAX_THREADS) {
+            g_last[kept].permille = (uint16_t)pm;
+            g_last[kept].t = t;
+            kept++;
+        }
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            n += snprintf(txt + n, sizeof(txt) - (size_t)n, " %s=%lu",
+                          t->tx_thread_name ? t->tx_thread_name : "?", pm);
+        }
+        (void)_tx_execution_thread_time_reset(t);
+        t = t->tx_thread_created_next;
+        if (t == head) {
+            break;
+        }
+    }
+    (void)_tx_execution_isr_time_reset();
+    (void)_tx_execution_idle_time_reset();
+
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+void cpu_load_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
+
+    const ULONG period_ticks =
+        (ULONG)(((uint64_t)CPU_LOAD_PERIOD_MS * TX_TIMER_TICKS_PER_SECOND) / 1000u);
+
+    for (;;) {
+        tx_thread_sleep(period_ticks ? period_ticks : 1u);
+        report_cpu_load();
+    }
+}
+
+void create_cpu_load_thread(void)
+{
+    UINT status = tx_thread_create(&cpu_load_thread,
+                                   "CPU Load",
+                                   cpu_load_thread_entry,
+                                   0,
+                                   cpu_load_thread_stack,
+                                   CPU_LOAD_THREAD_STACK_SIZE,
+                                   CPU_LOAD_THREAD_PRIORITY,
+                                   CPU_LOAD_THREAD_PRIORITY,
+                                   TX_NO_TIME_SLICE,
+                                   TX_AUTO_START);
+
+    if (status != TX_SUCCESS) {
+        die("Failed to create CPU load thread: %u", (unsigned)status);
+    }
+}
+
+uint16_t cpu_load_thread_permille(const TX_THREAD *t)
+{
+    for (unsigned i = 0; i < CPU_LOAD_MAX_THREADS; i++) {
+        if (g_last[i].t == t && t != TX_NULL) {
+            return g_last[i].permille;
+        }
+    }
+    return CPU_LOAD_UNKNOWN;
+}
+
+uint16_t cpu_load_isr_permille(void)
+{
+    return g_last_isr;
+}
+
+uint16_t cpu_load_idle_permille(void)
+{
+    return g_last_idle;
+}
+
+#else
+
+void create_cpu_load_thread(void)
+{
+}
+
+uint16_t cpu_load_thread_permille(const TX_THREAD *t)
+{
+    (void)t;
+    return CPU_LOAD_UNKNOWN;
+}
+
+uint16_t cpu_load_isr_permille(void)
+{
+    return CPU_LOAD_UNKNOWN;
+}
+
+uint16_t cpu_load_idle_permille(void)
+{
+    return CPU_LOAD_UNKNOWN;
+}
+
+#endif /* TX_EXECUTION_PROFILE_ENABLE */
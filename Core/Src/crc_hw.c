@@ -0,0 +1,141 @@
+// crc_hw.c
+//
+// CRC unit service (API in crc_hw.h):
+//  - each call loads POL, INIT and CR (POLYSIZE, REV_OUT) and resets the
+//  unit, then feeds the data and applies the final xor in software.
+//  - reflected input: the unaligned head and tail go in as byte writes with
+//  REV_IN per byte; the aligned body as word writes with REV_IN per word.
+//  Bit-reversing a little-endian word puts its first byte first, so both
+//  read the data in memory order. Unreflected input has no word mode that
+//  keeps byte order, so it goes in byte by byte.
+//  - bodies from CRC_HW_DMA_MIN_BYTES go through dma_copy_to_reg().
+//
+// Notes / Assumptions:
+//  - INIT is in the unit's own (unreflected) shift register domain, which
+//  is what the parameter model's `init` is.
+//  - crc_sw_compute() is a bitwise model: slow, but it is only the fallback
+//  for interrupt context.
+
+#include "crc_hw.h"
+#include "dma_copy.h"
+#include "tx_api.h"
+
+const crc_hw_params_t crc_hw_crc32 = {
+    .poly = 0x04C11DB7u, .init = 0xFFFFFFFFu, .xorout = 0xFFFFFFFFu,
+    .width = 32, .refin = 1, .refout = 1};
+const crc_hw_params_t crc_hw_crc16_ccitt = {
+    .poly = 0x1021u, .init = 0xFFFFu, .xorout = 0,
+    .width = 16, .refin = 0, .refout = 0};
+
+static TX_MUTEX g_lock;
+static uint8_t g_ready = 0;
+
+static uint32_t width_mask(uint8_t width) {
+  return (width >= 32u) ? 0xFFFFFFFFu : ((1u << width) - 1u);
+}
+
+static int width_ok(uint8_t width) {
+  return width == 7u || width == 8u || width == 16u || width == 32u;
+}
+
+static uint32_t reflect(uint32_t v, uint8_t bits) {
+  uint32_t r = 0;
+  for (uint8_t i = 0; i < bits; i++) {
+    r = (r << 1) | (v & 1u);
+    v >>= 1;
+  }
+  return r;
+}
+
+uint32_t crc_sw_compute(const crc_hw_params_t *p, const void *data,
+                        size_t len) {
+  if (!p || !width_ok(p->width)) return 0;
+  const uint8_t *d = (const uint8_t *)data;
+  const uint32_t mask = width_mask(p->width);
+  const uint32_t top = 1u << (p->width - 1u);
+  uint32_t c = p->init & mask;
+  for (size_t i = 0; i < len; i++) {
+    const uint8_t b = p->refin ? (uint8_t)reflect(d[i], 8) : d[i];
+    for (int bit = 7; bit >= 0; bit--) {
+      const uint32_t fb = ((c & top) ? 1u : 0u) ^ ((b >> bit) & 1u);
+      c = (c << 1) & mask;
+      if (fb) c ^= p->poly & mask;
+    }
+  }
+  if (p->refout) c = reflect(c, p->width);
+  return (c ^ p->xorout) & mask;
+}
+
+static uint32_t polysize(uint8_t width) {
+  switch (width) {
+  case 7:
+    return CRC_CR_POLYSIZE_0 | CRC_CR_POLYSIZE_1;
+  case 8:
+    return CRC_CR_POLYSIZE_1;
+  case 16:
+    return CRC_CR_POLYSIZE_0;
+  default:
+    return 0;
+  }
+}
+
+static void set_rev_in(uint32_t rev) {
+  MODIFY_REG(CRC->CR, CRC_CR_REV_IN, rev);
+}
+
+static void feed_bytes(const uint8_t *d, size_t n) {
+  if (n >= CRC_HW_DMA_MIN_BYTES) {
+    dma_copy_to_reg(&CRC->DR, d, n, 1);
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+    *(__IO uint8_t *)(__IO void *)&CRC->DR = d[i];
+}
+
+uint32_t crc_hw_compute(const crc_hw_params_t *p, const void *data,
+                        size_t len) {
+  if (!p || !width_ok(p->width)) return 0;
+  if (!g_ready || __get_IPSR() != 0u || __get_PRIMASK() != 0u ||
+      tx_thread_identify() == TX_NULL)
+    return crc_sw_compute(p, data, len);
+
+  const uint8_t *d = (const uint8_t *)data;
+  (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+  CRC->POL = p->poly & width_mask(p->width);
+  CRC->INIT = p->init & width_mask(p->width);
+  CRC->CR = polysize(p->width) | (p->refout ? CRC_CR_REV_OUT : 0u) |
+            (p->refin ? CRC_CR_REV_IN_0 : 0u) | CRC_CR_RESET;
+
+  if (!p->refin) {
+    feed_bytes(d, len);
+  } else {
+    size_t head = (size_t)((4u - ((uint32_t)(uintptr_t)d & 3u)) & 3u);
+    if (head > len) head = len;
+    feed_bytes(d, head);
+    d += head;
+    len -= head;
+    const size_t body = len & ~(size_t)3u;
+    if (body) {
+      set_rev_in(CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1);
+      if (body >= CRC_HW_DMA_MIN_BYTES) {
+        dma_copy_to_reg(&CRC->DR, d, body, 4);
+      } else {
+        const uint32_t *w = (const uint32_t *)(const void *)d;
+        for (size_t i = 0; i < body / 4u; i++) CRC->DR = w[i];
+      }
+      set_rev_in(CRC_CR_REV_IN_0);
+    }
+    feed_bytes(d + body, len - body);
+  }
+  const uint32_t c = CRC->DR;
+  (void)tx_mutex_put(&g_lock);
+  return (c ^ p->xorout) & width_mask(p->width);
+}
+
+HAL_StatusTypeDef crc_hw_init(void) {
+  if (tx_mutex_create(&g_lock, "crc", TX_INHERIT) != TX_SUCCESS)
+    return HAL_ERROR;
+  __HAL_RCC_CRC_CLK_ENABLE();
+  g_ready = 1;
+  return HAL_OK;
+}
@@ -0,0 +1,37 @@
+// dbg_marker.c
+//
+// Pin setup for the logic-analyzer markers (dbg_marker.h). The markers
+// themselves are BSRR stores in the header's macros.
+//
+// Built only with DBG_MARKERS_ENABLED (CMake option ENABLE_DBG_MARKERS).
+//
+// Notes / Assumptions:
+//  - The default pins are free on this board; a build that uses one for
+//  something else moves or unsets the marker (pin 0).
+
+#include "dbg_marker.h"
+
+#ifdef DBG_MARKERS_ENABLED
+
+#include "stm32g4xx_hal.h"
+
+static void mark_pin(GPIO_TypeDef *port, uint32_t pin) {
+  if (!pin) return;
+  port->BSRR = pin << 16;
+  GPIO_InitTypeDef init = {0};
+  init.Pin = pin;
+  init.Mode = GPIO_MODE_OUTPUT_PP;
+  init.Pull = GPIO_NOPULL;
+  init.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  HAL_GPIO_Init(port, &init);
+}
+
+void dbg_marker_init(void) {
+  mark_pin(DBG_MARK_PORT_CAN_ISR, DBG_MARK_PIN_CAN_ISR);
+  mark_pin(DBG_MARK_PORT_RB_PUSH, DBG_MARK_PIN_RB_PUSH);
+  mark_pin(DBG_MARK_PORT_REASM_DONE, DBG_MARK_PIN_REASM_DONE);
+  mark_pin(DBG_MARK_PORT_ROUTER_DISPATCH, DBG_MARK_PIN_ROUTER_DISPATCH);
+  mark_pin(DBG_MARK_PORT_TX_SEND, DBG_MARK_PIN_TX_SEND);
+}
+
+#endif
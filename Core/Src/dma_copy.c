@@ -0,0 +1,258 @@
+// dma_copy.c
+//
+// Memory-to-memory DMA copies (API in dma_copy.h):
+//  - a small ring of requests; the head is on the channel while g_busy and
+//  its transfer-complete interrupt reports it and starts the next one.
+//  - the transfer width is patched into CCR per request (channel
+//  disabled): words when everything is 4-aligned, bytes otherwise.
+//  - dma_copy() queues its request with a waiter bit and blocks on the
+//  event flag the interrupt sets for that slot.
+//  - dma_copy_to_reg() is the same request with the destination increment
+//  off and the caller's width, feeding a data register (the CRC unit).
+//
+// Notes / Assumptions:
+//  - CubeMX configures channel 1 for the DMAMUX request generator; nothing
+//  uses that, and dma_copy_init() reprograms the channel as MEM2MEM on a
+//  handle of its own.
+//  - CCM SRAM is treated as CPU-only; copies touching it use memcpy().
+//  - The G4 has no data cache on SRAM, so there is nothing to clean or
+//  invalidate around a transfer.
+
+#include "dma_copy.h"
+#include "tx_api.h"
+#include <string.h>
+
+#ifndef DMA_COPY_QUEUE_LEN
+#define DMA_COPY_QUEUE_LEN 4u
+#endif
+#ifndef DMA_COPY_CHANNEL
+#define DMA_COPY_CHANNEL DMA1_Channel1
+#endif
+#ifndef DMA_COPY_IRQn
+#define DMA_COPY_IRQn DMA1_Channel1_IRQn
+#endif
+// Below every peripheral: a copy finishing late only delays its waiter.
+#ifndef DMA_COPY_IRQ_PRIO
+#define DMA_COPY_IRQ_PRIO 12u
+#endif
+
+#define CCM_START 0x10000000u
+#define CCM_END   0x10008000u
+#define DMA_COPY_MAX_ITEMS 0xFFFFu // CNDTR is 16 bits
+
+_Static_assert((DMA_COPY_QUEUE_LEN & (DMA_COPY_QUEUE_LEN - 1u)) == 0 &&
+                   DMA_COPY_QUEUE_LEN <= 32u,
+               "DMA_COPY_QUEUE_LEN must be a power of two, at most 32");
+
+typedef struct {
+  void *dst;
+  const void *src;
+  size_t len;
+  dma_copy_cb_t done;
+  void *user;
+  uint8_t reg_width; // dma_copy_to_reg(): fixed destination, 1 or 4 bytes
+  // dma_copy() is blocked on this slot's event flag, result to here
+  volatile HAL_StatusTypeDef *waiter;
+} dma_req_t;
+
+static DMA_HandleTypeDef g_hdma;
+static uint8_t g_ready = 0;
+
+static dma_req_t g_q[DMA_COPY_QUEUE_LEN];
+static uint32_t g_q_head = 0;
+static uint32_t g_q_tail = 0;
+static volatile uint8_t g_busy = 0;
+
+static TX_EVENT_FLAGS_GROUP g_done_flags;
+static dma_copy_stats_t g_stats;
+
+static int in_ccm(const void *p, size_t len) {
+  const uint32_t a = (uint32_t)(uintptr_t)p;
+  return a < CCM_END && a + len > CCM_START;
+}
+
+// =========================
+// Queue (interrupts masked or channel ISR)
+// =========================
+
+static HAL_StatusTypeDef start(const dma_req_t *r) {
+  const uint32_t a = (uint32_t)(uintptr_t)r->dst |
+                     (uint32_t)(uintptr_t)r->src | (uint32_t)r->len;
+  const int words = r->reg_width ? r->reg_width == 4u : (a & 3u) == 0;
+  MODIFY_REG(g_hdma.Instance->CCR,
+             DMA_CCR_PSIZE | DMA_CCR_MSIZE | DMA_CCR_MINC,
+             (words ? (DMA_PDATAALIGN_WORD | DMA_MDATAALIGN_WORD)
+                    : (DMA_PDATAALIGN_BYTE | DMA_MDATAALIGN_BYTE)) |
+                 (r->reg_width ? 0u : DMA_MINC_ENABLE));
+  g_hdma.Init.MemInc = r->reg_width ? DMA_MINC_DISABLE : DMA_MINC_ENABLE;
+  g_hdma.Init.PeriphDataAlignment =
+      words ? DMA_PDATAALIGN_WORD : DMA_PDATAALIGN_BYTE;
+  g_hdma.Init.MemDataAlignment =
+      words ? DMA_MDATAALIGN_WORD : DMA_MDATAALIGN_BYTE;
+  return HAL_DMA_Start_IT(&g_hdma, (uint32_t)(uintptr_t)r->src,
+                          (uint32_t)(uintptr_t)r->dst,
+                          (uint32_t)(words ? r->len / 4u : r->len));
+}
+
+// Report and pop the head.
+static void finish(HAL_StatusTypeDef st) {
+  const uint32_t slot = g_q_head & (DMA_COPY_QUEUE_LEN - 1u);
+  const dma_req_t *r = &g_q[slot];
+  if (st == HAL_OK) {
+    g_stats.dma++;
+    g_stats.bytes += (uint32_t)r->len;
+  } else {
+    g_stats.errors++;
+  }
+  if (r->done) r->done(st, r->user);
+  if (r->waiter) {
+    *r->waiter = st;
+    (void)tx_event_flags_set(&g_done_flags, 1u << slot, TX_OR);
+  }
+  g_q_head++;
+  g_busy = 0;
+}
+
+static void kick(void) {
+  while (!g_busy && g_q_head != g_q_tail) {
+    g_busy = 1;
+    if (start(&g_q[g_q_head & (DMA_COPY_QUEUE_LEN - 1u)]) != HAL_OK)
+      finish(HAL_ERROR);
+  }
+}
+
+// What the channel would have done, on the CPU.
+static void cpu_copy(void *dst, const void *src, size_t len,
+                     uint8_t reg_width) {
+  if (reg_width == 4u) {
+    const uint32_t *s = (const uint32_t *)src;
+    for (size_t i = 0; i < len / 4u; i++) *(volatile uint32_t *)dst = s[i];
+  } else if (reg_width == 1u) {
+    const uint8_t *s = (const uint8_t *)src;
+    for (size_t i = 0; i < len; i++) *(volatile uint8_t *)dst = s[i];
+  } else if (len) {
+    memcpy(dst, src, len);
+  }
+}
+
+// Queue a request; its slot, or -1 if it was done on the CPU.
+static int submit(void *dst, const void *src, size_t len, dma_copy_cb_t done,
+                  void *user, volatile HAL_StatusTypeDef *waiter,
+                  uint8_t reg_width) {
+  const int cpu = !g_ready || len < DMA_COPY_MIN_BYTES ||
+                  (!reg_width && in_ccm(dst, len)) || in_ccm(src, len) ||
+                  len > DMA_COPY_MAX_ITEMS;
+  int slot = -1;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (!cpu && g_q_tail - g_q_head < DMA_COPY_QUEUE_LEN) {
+    slot = (int)(g_q_tail & (DMA_COPY_QUEUE_LEN - 1u));
+    dma_req_t *r = &g_q[slot];
+    r->dst = dst;
+    r->src = src;
+    r->len = len;
+    r->done = done;
+    r->user = user;
+    r->reg_width = reg_width;
+    r->waiter = waiter;
+    g_q_tail++;
+    kick();
+  } else {
+    g_stats.cpu++;
+  }
+  __set_PRIMASK(primask);
+  if (slot < 0) {
+    cpu_copy(dst, src, len, reg_width);
+    if (done) done(HAL_OK, user);
+  }
+  return slot;
+}
+
+void dma_copy_async(void *dst, const void *src, size_t len,
+                    dma_copy_cb_t done, void *user) {
+  (void)submit(dst, src, len, done, user, NULL, 0);
+}
+
+// Queue and wait, or do it on the CPU where blocking isn't allowed.
+static void copy_wait(void *dst, const void *src, size_t len,
+                      uint8_t reg_width) {
+  // Blocking needs a thread with interrupts on.
+  if (__get_IPSR() != 0u || __get_PRIMASK() != 0u ||
+      tx_thread_identify() == TX_NULL) {
+    (void)submit(dst, src, len, NULL, NULL, NULL, reg_width);
+    return;
+  }
+  volatile HAL_StatusTypeDef st = HAL_BUSY;
+  const int slot = submit(dst, src, len, NULL, NULL, &st, reg_width);
+  if (slot < 0) return;
+  ULONG got = 0;
+  (void)tx_event_flags_get(&g_done_flags, 1u << slot, TX_OR_CLEAR, &got,
+                           TX_WAIT_FOREVER);
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_stats.waits++;
+  __set_PRIMASK(primask);
+  if (st != HAL_OK) cpu_copy(dst, src, len, reg_width); // transfer error
+}
+
+void dma_copy(void *dst, const void *src, size_t len) {
+  copy_wait(dst, src, len, 0);
+}
+
+void dma_copy_to_reg(volatile void *reg, const void *src, size_t len,
+                     uint8_t width) {
+  if (width != 1u && width != 4u) return;
+  copy_wait((void *)(uintptr_t)reg, src, len - len % width, width);
+}
+
+void dma_copy_get_stats(dma_copy_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_stats;
+  __set_PRIMASK(primask);
+}
+
+// =========================
+// Channel ISR and init
+// =========================
+
+static void on_cplt(DMA_HandleTypeDef *hdma) {
+  (void)hdma;
+  finish(HAL_OK);
+  kick();
+}
+
+static void on_error(DMA_HandleTypeDef *hdma) {
+  (void)hdma;
+  finish(HAL_ERROR);
+  kick();
+}
+
+void dma_copy_irq(void) { HAL_DMA_IRQHandler(&g_hdma); }
+
+HAL_StatusTypeDef dma_copy_init(void) {
+  if (tx_event_flags_create(&g_done_flags, "dma copy") != TX_SUCCESS)
+    return HAL_ERROR;
+  __HAL_RCC_DMAMUX1_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  g_hdma.Instance = DMA_COPY_CHANNEL;
+  g_hdma.Init.Request = DMA_REQUEST_MEM2MEM;
+  g_hdma.Init.Direction = DMA_MEMORY_TO_MEMORY;
+  g_hdma.Init.PeriphInc = DMA_PINC_ENABLE;
+  g_hdma.Init.MemInc = DMA_MINC_ENABLE;
+  g_hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  g_hdma.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  g_hdma.Init.Mode = DMA_NORMAL;
+  g_hdma.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&g_hdma) != HAL_OK) return HAL_ERROR;
+  if (HAL_DMA_RegisterCallback(&g_hdma, HAL_DMA_XFER_CPLT_CB_ID, on_cplt) !=
+          HAL_OK ||
+      HAL_DMA_RegisterCallback(&g_hdma, HAL_DMA_XFER_ERROR_CB_ID, on_error) !=
+          HAL_OK)
+    return HAL_ERROR;
+  HAL_NVIC_SetPriority(DMA_COPY_IRQn, DMA_COPY_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(DMA_COPY_IRQn);
+  g_ready = 1;
+  return HAL_OK;
+}
@@ -0,0 +1,402 @@
+// dsp_filter.c
+//
+// FMAC / CORDIC filter channels (API in dsp_filter.h):
+//  - producers append to a per-channel ring (samples plus the low word of
+//  their us_clock_now() time) and kick the DSP thread once a block is in.
+//  - the thread runs each element of a block through the FMAC as an FIR:
+//  load the channel's taps, preload X1 with the element's last taps - 1
+//  inputs, then DMA the block in and the outputs out, sleeping on the
+//  output DMA completion. Keeping the history here lets one FMAC serve
+//  every channel.
+//  - decimation picks outputs off the filtered block; polar channels go
+//  through the CORDIC (modulus function, zero-overhead mode) on the way.
+//
+// Notes / Assumptions:
+//  - FMAC_IRQn is the CAN driver's software notify vector (can_bus.c), so
+//  the FMAC's own interrupt enables stay off. Underflow or overflow shows
+//  up as an output DMA that doesn't finish, caught by DSP_FILTER_TIMEOUT_MS.
+//  - Inputs are halved before the CORDIC so |(x, y)| stays below 1, and the
+//  modulus doubled after, saturating.
+
+#include "dsp_filter.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "us_clock.h"
+#include <string.h>
+
+#ifndef DSP_FILTER_IN_DMA_CHANNEL
+#define DSP_FILTER_IN_DMA_CHANNEL DMA1_Channel7 // 5-6: I2C2
+#endif
+#ifndef DSP_FILTER_IN_DMA_IRQn
+#define DSP_FILTER_IN_DMA_IRQn DMA1_Channel7_IRQn
+#endif
+#ifndef DSP_FILTER_OUT_DMA_CHANNEL
+#define DSP_FILTER_OUT_DMA_CHANNEL DMA1_Channel8
+#endif
+#ifndef DSP_FILTER_OUT_DMA_IRQn
+#define DSP_FILTER_OUT_DMA_IRQn DMA1_Channel8_IRQn
+#endif
+#ifndef DSP_FILTER_IRQ_PRIO
+#define DSP_FILTER_IRQ_PRIO 12u
+#endif
+// One block through the FMAC: 32 taps x 32 samples is about 6 us.
+#define DSP_FILTER_TIMEOUT_MS 10u
+
+// Below the telemetry stages: filtered output is bulk. Above the SD log.
+// Stack size: DSP_FILTER_THREAD_STACK_SIZE in mem_budget.h.
+#define DSP_FILTER_THREAD_PRIORITY 7u
+
+#define RING (2u * DSP_FILTER_BLOCK)
+#define HIST (DSP_FILTER_MAX_TAPS - 1u)
+
+_Static_assert((DSP_FILTER_BLOCK & (DSP_FILTER_BLOCK - 1u)) == 0,
+               "DSP_FILTER_BLOCK must be a power of two");
+_Static_assert(DSP_FILTER_MAX_TAPS * 2u + DSP_FILTER_BLOCK <= 255u,
+               "FMAC memory: taps, input and output buffers");
+
+typedef struct {
+  volatile uint8_t used;
+  dsp_filter_cfg_t cfg;
+  int16_t coeffs[DSP_FILTER_MAX_TAPS];
+  int16_t ring[RING][DSP_FILTER_MAX_ELEMS];
+  uint32_t stamp[RING];   // us_clock_now() low word at the push
+  volatile uint32_t head; // producer
+  volatile uint32_t tail; // DSP thread
+  int16_t hist[DSP_FILTER_MAX_ELEMS][HIST]; // last inputs, oldest first
+  uint16_t phase; // outputs to skip before the next forwarded one
+} dsp_chan_t;
+
+TX_THREAD dsp_filter_thread;
+static MEM_ARENA(stack) ULONG dsp_filter_stack[DSP_FILTER_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static FMAC_HandleTypeDef g_hfmac;
+static CORDIC_HandleTypeDef g_hcordic;
+static DMA_HandleTypeDef g_hdma_in;
+static DMA_HandleTypeDef g_hdma_out;
+
+static TX_SEMAPHORE g_kick;
+static TX_SEMAPHORE g_fmac_done;
+static TX_MUTEX g_cordic_lock;
+static volatile uint8_t g_ready = 0;
+static volatile uint8_t g_fmac_err = 0;
+
+static dsp_chan_t g_chan[DSP_FILTER_MAX_CHANNELS];
+static dsp_filter_stats_t g_stats;
+
+// Block being filtered, one element at a time, and its outputs.
+static int16_t g_in[DSP_FILTER_BLOCK];
+static int16_t g_out[DSP_FILTER_MAX_ELEMS][DSP_FILTER_BLOCK];
+
+static ULONG ms_ticks(uint32_t ms) {
+  const ULONG t = (ULONG)(((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) /
+                          1000u);
+  return t ? t : 1u;
+}
+
+static void stat_add(uint32_t *field, uint32_t n) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *field += n;
+  __set_PRIMASK(primask);
+}
+
+// =========================
+// Channels
+// =========================
+
+int dsp_filter_add(const dsp_filter_cfg_t *cfg) {
+  if (!cfg || !cfg->coeffs || cfg->taps == 0 ||
+      cfg->taps > DSP_FILTER_MAX_TAPS || cfg->shift > 7u || cfg->elems == 0 ||
+      cfg->elems > DSP_FILTER_MAX_ELEMS || cfg->decimate == 0 ||
+      (cfg->polar && cfg->elems != 2u))
+    return -1;
+  for (unsigned i = 0; i < DSP_FILTER_MAX_CHANNELS; i++) {
+    dsp_chan_t *c = &g_chan[i];
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const uint8_t taken = c->used;
+    if (!taken) c->used = 2; // claimed, not yet live
+    __set_PRIMASK(primask);
+    if (taken) continue;
+
+    c->cfg = *cfg;
+    memcpy(c->coeffs, cfg->coeffs, cfg->taps * sizeof(int16_t));
+    c->cfg.coeffs = c->coeffs;
+    memset(c->hist, 0, sizeof(c->hist));
+    c->head = 0;
+    c->tail = 0;
+    c->phase = 0;
+    __DMB();
+    c->used = 1;
+    return (int)i;
+  }
+  return -1;
+}
+
+void dsp_filter_remove(int handle) {
+  if (handle < 0 || handle >= (int)DSP_FILTER_MAX_CHANNELS) return;
+  g_chan[handle].used = 0;
+}
+
+HAL_StatusTypeDef dsp_filter_push(int handle, const int16_t *x) {
+  if (handle < 0 || handle >= (int)DSP_FILTER_MAX_CHANNELS || !x)
+    return HAL_ERROR;
+  dsp_chan_t *c = &g_chan[handle];
+  if (c->used != 1u) return HAL_ERROR;
+  const uint32_t h = c->head;
+  if (h - c->tail >= RING) {
+    stat_add(&g_stats.overruns, 1);
+    return HAL_BUSY;
+  }
+  memcpy(c->ring[h & (RING - 1u)], x, c->cfg.elems * sizeof(int16_t));
+  c->stamp[h & (RING - 1u)] = (uint32_t)us_clock_now();
+  __DMB();
+  c->head = h + 1u;
+  stat_add(&g_stats.pushed, 1);
+  if (g_ready && h + 1u - c->tail >= DSP_FILTER_BLOCK)
+    (void)tx_semaphore_ceiling_put(&g_kick, 1);
+  return HAL_OK;
+}
+
+void dsp_filter_get_stats(dsp_filter_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_stats;
+  __set_PRIMASK(primask);
+}
+
+// =========================
+// CORDIC
+// =========================
+
+HAL_StatusTypeDef dsp_polar_q15(const int16_t *xy, size_t n, int16_t *out) {
+  if (!g_ready || (n && (!xy || !out))) return HAL_ERROR;
+  int32_t in[8], res[8];
+  HAL_StatusTypeDef st = HAL_OK;
+  (void)tx_mutex_get(&g_cordic_lock, TX_WAIT_FOREVER);
+  for (size_t done = 0; done < n && st == HAL_OK;) {
+    const size_t k = (n - done < 8u) ? n - done : 8u;
+    for (size_t i = 0; i < k; i++) {
+      const uint16_t x = (uint16_t)(xy[2u * (done + i)] >> 1);
+      const uint16_t y = (uint16_t)(xy[2u * (done + i) + 1u] >> 1);
+      in[i] = (int32_t)((uint32_t)x | ((uint32_t)y << 16));
+    }
+    st = HAL_CORDIC_CalculateZO(&g_hcordic, in, res, (uint32_t)k, 1u);
+    for (size_t i = 0; st == HAL_OK && i < k; i++) {
+      const int32_t mag = 2 * (int32_t)(int16_t)(uint16_t)res[i];
+      out[2u * (done + i)] = (int16_t)(mag > INT16_MAX ? INT16_MAX : mag);
+      out[2u * (done + i) + 1u] = (int16_t)((uint32_t)res[i] >> 16);
+    }
+    done += k;
+  }
+  (void)tx_mutex_put(&g_cordic_lock);
+  return st;
+}
+
+// =========================
+// FMAC
+// =========================
+
+void HAL_FMAC_OutputDataReadyCallback(FMAC_HandleTypeDef *hfmac) {
+  if (hfmac != &g_hfmac) return;
+  (void)tx_semaphore_ceiling_put(&g_fmac_done, 1);
+}
+
+void HAL_FMAC_ErrorCallback(FMAC_HandleTypeDef *hfmac) {
+  if (hfmac != &g_hfmac) return;
+  g_fmac_err = 1;
+  (void)tx_semaphore_ceiling_put(&g_fmac_done, 1);
+}
+
+void dsp_filter_dma_in_irq(void) { HAL_DMA_IRQHandler(&g_hdma_in); }
+
+void dsp_filter_dma_out_irq(void) { HAL_DMA_IRQHandler(&g_hdma_out); }
+
+// FIR g_in (with `hist` before it) into `out`, then slide `hist`.
+static HAL_StatusTypeDef fir_block(dsp_chan_t *c, int16_t *hist,
+                                   int16_t *out) {
+  const uint8_t taps = c->cfg.taps;
+  FMAC_FilterConfigTypeDef f = {0};
+  f.CoeffBaseAddress = 0;
+  f.CoeffBufferSize = taps;
+  f.InputBaseAddress = taps;
+  f.InputBufferSize = (uint8_t)(taps + DSP_FILTER_BLOCK / 2u);
+  f.InputThreshold = FMAC_THRESHOLD_1;
+  f.OutputBaseAddress = (uint8_t)(2u * taps + DSP_FILTER_BLOCK / 2u);
+  f.OutputBufferSize = DSP_FILTER_BLOCK / 2u;
+  f.OutputThreshold = FMAC_THRESHOLD_1;
+  f.pCoeffB = c->coeffs;
+  f.CoeffBSize = taps;
+  f.InputAccess = FMAC_BUFFER_ACCESS_DMA;
+  f.OutputAccess = FMAC_BUFFER_ACCESS_DMA;
+  f.Clip = FMAC_CLIP_ENABLED;
+  f.Filter = FMAC_FUNC_CONVO_FIR;
+  f.P = taps;
+  f.R = c->cfg.shift;
+  if (HAL_FMAC_FilterConfig(&g_hfmac, &f) != HAL_OK) return HAL_ERROR;
+  // Its vector isn't ours (file header); errors surface as the timeout.
+  CLEAR_BIT(FMAC->CR, FMAC_CR_UNFLIEN | FMAC_CR_OVFLIEN);
+
+  const int16_t *h = &hist[HIST - (taps - 1u)];
+  if (taps > 1u && HAL_FMAC_FilterPreload(&g_hfmac, (int16_t *)h,
+                                          (uint8_t)(taps - 1u), NULL,
+                                          0) != HAL_OK)
+    return HAL_ERROR;
+
+  uint16_t out_n = DSP_FILTER_BLOCK, in_n = DSP_FILTER_BLOCK;
+  g_fmac_err = 0;
+  (void)tx_semaphore_get(&g_fmac_done, TX_NO_WAIT); // stale completion
+  HAL_StatusTypeDef st = HAL_FMAC_FilterStart(&g_hfmac, out, &out_n);
+  if (st == HAL_OK) st = HAL_FMAC_AppendFilterData(&g_hfmac, g_in, &in_n);
+  if (st == HAL_OK &&
+      (tx_semaphore_get(&g_fmac_done, ms_ticks(DSP_FILTER_TIMEOUT_MS)) !=
+           TX_SUCCESS ||
+       g_fmac_err))
+    st = HAL_ERROR;
+  (void)HAL_FMAC_FilterStop(&g_hfmac);
+  if (st != HAL_OK) return st;
+
+  // Keep the newest HIST inputs.
+  if (DSP_FILTER_BLOCK >= HIST) {
+    memcpy(hist, &g_in[DSP_FILTER_BLOCK - HIST], HIST * sizeof(int16_t));
+  } else {
+    memmove(hist, &hist[DSP_FILTER_BLOCK],
+            (HIST - DSP_FILTER_BLOCK) * sizeof(int16_t));
+    memcpy(&hist[HIST - DSP_FILTER_BLOCK], g_in,
+           DSP_FILTER_BLOCK * sizeof(int16_t));
+  }
+  return HAL_OK;
+}
+
+// Filter the oldest block of `c` and forward its decimated outputs.
+static void run_block(dsp_chan_t *c) {
+  const uint32_t t = c->tail;
+  const uint8_t elems = c->cfg.elems;
+  for (uint8_t e = 0; e < elems; e++) {
+    for (uint32_t k = 0; k < DSP_FILTER_BLOCK; k++)
+      g_in[k] = c->ring[(t + k) & (RING - 1u)][e];
+    if (fir_block(c, c->hist[e], g_out[e]) != HAL_OK) {
+      stat_add(&g_stats.errors, 1);
+      c->tail = t + DSP_FILTER_BLOCK;
+      return;
+    }
+  }
+  stat_add(&g_stats.blocks, 1);
+
+  const uint64_t now = us_clock_now();
+  uint32_t sent = 0, dropped = 0;
+  for (uint32_t k = 0; k < DSP_FILTER_BLOCK; k++) {
+    if (c->phase) {
+      c->phase--;
+      continue;
+    }
+    c->phase = (uint16_t)(c->cfg.decimate - 1u);
+    int16_t v[DSP_FILTER_MAX_ELEMS];
+    for (uint8_t e = 0; e < elems; e++) v[e] = g_out[e][k];
+    if (c->cfg.polar && dsp_polar_q15(v, 1, v) != HAL_OK) {
+      stat_add(&g_stats.errors, 1);
+      continue;
+    }
+    const uint32_t age = (uint32_t)now - c->stamp[(t + k) & (RING - 1u)];
+    if (log_telemetry_from_isr_at(c->cfg.type, v, elems, sizeof(int16_t),
+                                  now - age) == SEDS_OK)
+      sent++;
+    else
+      dropped++;
+  }
+  c->tail = t + DSP_FILTER_BLOCK;
+  stat_add(&g_stats.sent, sent);
+  stat_add(&g_stats.dropped, dropped);
+}
+
+void dsp_filter_thread_entry(ULONG initial_input) {
+  (void)initial_input;
+  for (;;) {
+    (void)tx_semaphore_get(&g_kick, TX_WAIT_FOREVER);
+    int more = 1;
+    while (more) {
+      more = 0;
+      for (unsigned i = 0; i < DSP_FILTER_MAX_CHANNELS; i++) {
+        dsp_chan_t *c = &g_chan[i];
+        if (c->used != 1u || c->head - c->tail < DSP_FILTER_BLOCK) continue;
+        run_block(c);
+        more = 1;
+      }
+    }
+  }
+}
+
+// =========================
+// Init
+// =========================
+
+static HAL_StatusTypeDef dma_init(DMA_HandleTypeDef *hdma,
+                                  DMA_Channel_TypeDef *ch, uint32_t request,
+                                  uint32_t dir) {
+  hdma->Instance = ch;
+  hdma->Init.Request = request;
+  hdma->Init.Direction = dir;
+  hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma->Init.MemInc = DMA_MINC_ENABLE;
+  hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdma->Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+  hdma->Init.Mode = DMA_NORMAL;
+  hdma->Init.Priority = DMA_PRIORITY_LOW;
+  return HAL_DMA_Init(hdma);
+}
+
+static HAL_StatusTypeDef hw_init(void) {
+  __HAL_RCC_DMAMUX1_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  __HAL_RCC_FMAC_CLK_ENABLE();
+  __HAL_RCC_CORDIC_CLK_ENABLE();
+
+  g_hfmac.Instance = FMAC;
+  if (HAL_FMAC_Init(&g_hfmac) != HAL_OK ||
+      dma_init(&g_hdma_in, DSP_FILTER_IN_DMA_CHANNEL, DMA_REQUEST_FMAC_WRITE,
+               DMA_MEMORY_TO_PERIPH) != HAL_OK ||
+      dma_init(&g_hdma_out, DSP_FILTER_OUT_DMA_CHANNEL, DMA_REQUEST_FMAC_READ,
+               DMA_PERIPH_TO_MEMORY) != HAL_OK)
+    return HAL_ERROR;
+  __HAL_LINKDMA(&g_hfmac, hdmaIn, g_hdma_in);
+  __HAL_LINKDMA(&g_hfmac, hdmaOut, g_hdma_out);
+  HAL_NVIC_SetPriority(DSP_FILTER_IN_DMA_IRQn, DSP_FILTER_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(DSP_FILTER_IN_DMA_IRQn);
+  HAL_NVIC_SetPriority(DSP_FILTER_OUT_DMA_IRQn, DSP_FILTER_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(DSP_FILTER_OUT_DMA_IRQn);
+
+  g_hcordic.Instance = CORDIC;
+  const CORDIC_ConfigTypeDef cc = {
+      .Function = CORDIC_FUNCTION_MODULUS,
+      .Scale = CORDIC_SCALE_0,
+      .InSize = CORDIC_INSIZE_16BITS,
+      .OutSize = CORDIC_OUTSIZE_16BITS,
+      .NbWrite = CORDIC_NBWRITE_1,
+      .NbRead = CORDIC_NBREAD_1,
+      .Precision = CORDIC_PRECISION_4CYCLES, // 16 iterations: q1.15
+  };
+  if (HAL_CORDIC_Init(&g_hcordic) != HAL_OK ||
+      HAL_CORDIC_Configure(&g_hcordic, &cc) != HAL_OK)
+    return HAL_ERROR;
+  return HAL_OK;
+}
+
+void create_dsp_filter_thread(void) {
+  if (tx_semaphore_create(&g_kick, "dsp kick", 0) != TX_SUCCESS ||
+      tx_semaphore_create(&g_fmac_done, "fmac done", 0) != TX_SUCCESS ||
+      tx_mutex_create(&g_cordic_lock, "cordic", TX_INHERIT) != TX_SUCCESS)
+    die("Failed to create DSP filter sync");
+  if (hw_init() != HAL_OK) die("Failed to init FMAC / CORDIC");
+  const UINT status = tx_thread_create(
+      &dsp_filter_thread, "DSP Filter", dsp_filter_thread_entry, 0,
+      dsp_filter_stack, DSP_FILTER_THREAD_STACK_SIZE,
+      DSP_FILTER_THREAD_PRIORITY, DSP_FILTER_THREAD_PRIORITY,
+      TX_NO_TIME_SLICE, TX_AUTO_START);
+  if (status != TX_SUCCESS) {
+    die("Failed to create DSP filter thread: %u", (unsigned)status);
+  }
+  g_ready = 1;
+}
@@ -0,0 +1,281 @@
+// file_srv.c
+//
+// Named file pulls on can_bulk sessions (file_srv.h):
+//  - serving: the session on FILE_SRV_RX_ID/TX_ID takes a request into a
+//  small buffer through its sink; at its end the file is looked up and
+//  opened, and the answer goes out as one bulk transfer whose source puts
+//  the 8-byte header first and then reads the file at the offset asked for.
+//  - pulling: one session at a time on the node's pair, reopened when the
+//  pair changes. The request is sent from its own buffer; the answer's
+//  header is picked out by position and the rest goes to the caller's sink
+//  unchanged, refusals included, so the node is paced by that sink.
+//
+// Notes / Assumptions:
+//  - A new request replaces the answer being sent, as a new START replaces
+//  a transfer in can_bulk.c.
+//  - Runs in the telemetry RX thread (can_bulk callbacks, USB commands and
+//  the poll), so nothing here is locked.
+
+#include "file_srv.h"
+#include "can_bulk.h"
+#include "sd_log.h"
+#include <stdio.h>
+#include <string.h>
+
+#define REQ_HDR 4u // u32 offset
+#define ANS_HDR 8u // u8 status, 3 zero bytes, u32 size
+
+typedef struct {
+  char name[FILE_SRV_NAME_MAX];
+  uint8_t name_len;
+  file_srv_open_t open;
+  can_bulk_source_t read;
+  void *user;
+} file_entry_t;
+
+static can_bus_t *g_bus = NULL;
+static file_entry_t g_files[FILE_SRV_MAX_FILES];
+static unsigned g_nfiles = 0;
+
+// Serving.
+static uint8_t g_req[REQ_HDR + FILE_SRV_NAME_MAX];
+static uint8_t g_req_bad = 0;   // request longer than g_req
+static uint8_t g_ans_due = 0;   // answer to start from file_srv_poll()
+static uint8_t g_ans_hdr[ANS_HDR];
+static const file_entry_t *g_ans_file = NULL; // NULL: header only
+static uint32_t g_ans_off = 0;  // file offset of the first byte after it
+static uint32_t g_ans_total = 0;
+
+// Pulling.
+static uint16_t g_pull_req_id = 0;
+static uint16_t g_pull_rep_id = 0; // 0: no session open
+static uint8_t g_pull_active = 0;
+static uint8_t g_pull_hdr[ANS_HDR];
+static uint32_t g_pull_off = 0;    // offset asked for
+static file_srv_sink_t g_pull_sink = NULL;
+static void *g_pull_user = NULL;
+static uint8_t g_pull_msg[REQ_HDR + FILE_SRV_NAME_MAX];
+static uint32_t g_pull_msg_len = 0;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  for (unsigned i = 0; i < 4u; i++) p[i] = (uint8_t)(v >> (8u * i));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static const file_entry_t *file_find(const uint8_t *name, size_t len) {
+  for (unsigned i = 0; i < g_nfiles; i++) {
+    if (g_files[i].name_len == len && memcmp(g_files[i].name, name, len) == 0)
+      return &g_files[i];
+  }
+  return NULL;
+}
+
+HAL_StatusTypeDef file_srv_register(const char *name, file_srv_open_t open,
+                                    can_bulk_source_t read, void *user) {
+  const size_t len = name ? strlen(name) : 0;
+  if (len == 0 || len > FILE_SRV_NAME_MAX || !open || !read ||
+      g_nfiles >= FILE_SRV_MAX_FILES ||
+      file_find((const uint8_t *)name, len))
+    return HAL_ERROR;
+  file_entry_t *f = &g_files[g_nfiles++];
+  memcpy(f->name, name, len);
+  f->name_len = (uint8_t)len;
+  f->open = open;
+  f->read = read;
+  f->user = user;
+  return HAL_OK;
+}
+
+// =========================
+// Serving
+// =========================
+
+static size_t ans_source(uint32_t off, uint8_t *dst, size_t len, void *user) {
+  (void)user;
+  size_t n = 0;
+  if (off < ANS_HDR) {
+    n = ANS_HDR - off;
+    if (n > len) n = len;
+    memcpy(dst, &g_ans_hdr[off], n);
+    if (n == len || !g_ans_file) return n;
+  }
+  // A file with nothing to give yet sends the header alone for now.
+  return n + g_ans_file->read(g_ans_off + (off + (uint32_t)n - ANS_HDR),
+                              dst + n, len - n, g_ans_file->user);
+}
+
+static void ans_start(void) {
+  if (g_ans_due && can_bulk_send(FILE_SRV_RX_ID, g_ans_total, ans_source,
+                                 NULL) == HAL_OK)
+    g_ans_due = 0;
+}
+
+// The request is complete: look it up and answer.
+static void req_done(size_t len) {
+  uint8_t status = FILE_SRV_OK;
+  uint32_t size = 0;
+  const uint32_t off = (len >= REQ_HDR) ? get_le32(g_req) : 0;
+  const file_entry_t *f = NULL;
+  if (g_req_bad || len <= REQ_HDR) {
+    status = FILE_SRV_BAD_REQ;
+  } else if (!(f = file_find(&g_req[REQ_HDR], len - REQ_HDR))) {
+    status = FILE_SRV_NOT_FOUND;
+  } else {
+    size = f->open(f->user);
+    if (off > size) {
+      status = FILE_SRV_BAD_OFFSET;
+      f = NULL;
+    }
+  }
+
+  can_bulk_cancel(FILE_SRV_RX_ID); // a new request replaces the answer
+  memset(g_ans_hdr, 0, sizeof(g_ans_hdr));
+  g_ans_hdr[0] = status;
+  put_le32(&g_ans_hdr[4], size);
+  g_ans_file = f;
+  g_ans_off = off;
+  g_ans_total = ANS_HDR + (f ? size - off : 0u);
+  g_ans_due = 1;
+  ans_start();
+}
+
+static int srv_sink(const uint8_t *data, size_t len, uint32_t off,
+                    uint32_t total, uint8_t flags, void *user) {
+  (void)total;
+  (void)user;
+  if (flags & CAN_BUS_STREAM_ABORT) return 0;
+  if (flags & CAN_BUS_STREAM_START) g_req_bad = 0;
+  if (off + len > sizeof(g_req))
+    g_req_bad = 1; // taken anyway, answered with BAD_REQ
+  else
+    memcpy(&g_req[off], data, len);
+  if (flags & CAN_BUS_STREAM_END) req_done(off + len);
+  return 0;
+}
+
+// =========================
+// Pulling
+// =========================
+
+static void pull_end(uint8_t status) {
+  g_pull_active = 0;
+  if (g_pull_sink)
+    (void)g_pull_sink(status, NULL, 0, 0, 0, CAN_BUS_STREAM_END, g_pull_user);
+}
+
+static int pull_sink(const uint8_t *data, size_t len, uint32_t off,
+                     uint32_t total, uint8_t flags, void *user) {
+  (void)user;
+  if (!g_pull_active) return 0;
+  if (flags & CAN_BUS_STREAM_ABORT) {
+    pull_end(FILE_SRV_LOST);
+    return 0;
+  }
+  size_t skip = 0;
+  if (off < ANS_HDR) {
+    skip = ANS_HDR - off;
+    if (skip > len) skip = len;
+    memcpy(&g_pull_hdr[off], data, skip);
+  }
+  if (off + len < ANS_HDR) return 0;
+  if (off + len == ANS_HDR && !(flags & CAN_BUS_STREAM_END)) return 0;
+
+  const uint8_t status = g_pull_hdr[0];
+  const uint32_t size = get_le32(&g_pull_hdr[4]);
+  if (status != FILE_SRV_OK || total != ANS_HDR + (size - g_pull_off)) {
+    // The rest of the answer, if any, is taken and dropped.
+    pull_end(status != FILE_SRV_OK ? status : FILE_SRV_BAD_REQ);
+    return 0;
+  }
+  const uint32_t file_off = g_pull_off + (off + (uint32_t)skip - ANS_HDR);
+  const uint8_t end = flags & CAN_BUS_STREAM_END;
+  if (g_pull_sink(FILE_SRV_OK, data + skip, len - skip, file_off, size, end,
+                  g_pull_user) != 0)
+    return 1;
+  if (end) g_pull_active = 0;
+  return 0;
+}
+
+static void pull_tx_done(HAL_StatusTypeDef status, void *user) {
+  (void)user;
+  if (status != HAL_OK && g_pull_active) pull_end(FILE_SRV_LOST);
+}
+
+static size_t req_source(uint32_t off, uint8_t *dst, size_t len, void *user) {
+  (void)user;
+  if (len > g_pull_msg_len - off) len = g_pull_msg_len - off;
+  memcpy(dst, &g_pull_msg[off], len);
+  return len;
+}
+
+HAL_StatusTypeDef file_srv_pull(uint16_t req_id, uint16_t rep_id,
+                                uint32_t offset, const char *name,
+                                size_t name_len, file_srv_sink_t sink,
+                                void *user) {
+  if (!g_bus || !name || name_len == 0 || name_len > FILE_SRV_NAME_MAX ||
+      !sink || req_id > 0x7FFu || rep_id < FILE_SRV_PULL_FIRST ||
+      rep_id > FILE_SRV_PULL_LAST || req_id == rep_id)
+    return HAL_ERROR;
+  if (g_pull_active) return HAL_BUSY;
+
+  if (g_pull_rep_id != rep_id || g_pull_req_id != req_id) {
+    if (g_pull_rep_id) can_bulk_close(g_pull_rep_id);
+    g_pull_rep_id = 0;
+    const can_bulk_config_t cfg = {
+        .bus = g_bus,
+        .tx_id = req_id,
+        .rx_id = rep_id,
+        .window = 0,
+        .sink = pull_sink,
+        .on_tx_done = pull_tx_done,
+    };
+    if (can_bulk_open(&cfg) != HAL_OK) return HAL_ERROR;
+    g_pull_req_id = req_id;
+    g_pull_rep_id = rep_id;
+  }
+
+  put_le32(g_pull_msg, offset);
+  memcpy(&g_pull_msg[REQ_HDR], name, name_len);
+  g_pull_msg_len = (uint32_t)(REQ_HDR + name_len);
+  memset(g_pull_hdr, 0, sizeof(g_pull_hdr));
+  g_pull_off = offset;
+  g_pull_sink = sink;
+  g_pull_user = user;
+  if (can_bulk_send(rep_id, g_pull_msg_len, req_source, NULL) != HAL_OK)
+    return HAL_BUSY;
+  g_pull_active = 1;
+  return HAL_OK;
+}
+
+void file_srv_pull_abort(void) {
+  if (!g_pull_active) return;
+  g_pull_active = 0;
+  can_bulk_close(g_pull_rep_id); // tells the node; reopened by the next pull
+  g_pull_rep_id = 0;
+}
+
+uint32_t file_srv_poll(void) {
+  ans_start();
+  return g_ans_due ? 1u : UINT32_MAX;
+}
+
+void file_srv_init(can_bus_t *bus) {
+  g_bus = bus;
+  const can_bulk_config_t cfg = {
+      .bus = bus,
+      .tx_id = FILE_SRV_TX_ID,
+      .rx_id = FILE_SRV_RX_ID,
+      .window = 0,
+      .sink = srv_sink,
+  };
+  if (can_bulk_open(&cfg) != HAL_OK) {
+    printf("Error: can_bulk_open failed\r\n");
+  }
+#ifdef SD_LOG_ENABLED
+  (void)file_srv_register("sdlog", sd_log_file_open, sd_log_file_read, NULL);
+#endif
+}
@@ -0,0 +1,331 @@
+// flash_log.c
+//
+// Record ring in internal flash (format in flash_log.h):
+//  - appends copy into one of two RAM staging buffers, already laid out as
+//  flash records; flash_log_poll() swaps them and programs the full one a
+//  double word at a time. A record's first double word (its length) goes
+//  last, so one cut short by a reset reads as the end of its page.
+//  - pages are opened in ring order, so every page is erased as often as
+//  the others (the wear levelling). A page is erased in the background once
+//  it has been read back, one erase per poll, soonest-needed first.
+//  - with the ring full, opening a page erases the oldest unread one.
+//  - a page read to its end gets its mark zeroed, so after a reset reading
+//  resumes at the first unread page; records of a page read only in part
+//  come back again.
+//
+// Notes / Assumptions:
+//  - The STM32G491 has a single flash bank: instruction fetches stall while
+//  a double word programs (~0.1 ms) or a page erases (~22 ms), from every
+//  context that runs out of flash. That is why all of it happens in
+//  flash_log_poll() and a low-priority thread should call it.
+//  - After programming the data cache is reset so reads see the new words;
+//  the HAL page erase flushes it itself.
+
+#include "flash_log.h"
+#include "tx_api.h"
+#include <string.h>
+
+// Ring pages tracked, at most; the linker region decides the actual count.
+#define FLASH_LOG_MAX_PAGES 64u
+
+// poll interval asked for while staged data or erases are outstanding
+#ifndef FLASH_LOG_BUSY_MS
+#define FLASH_LOG_BUSY_MS 20u
+#endif
+
+#define PAGE_MAGIC 0x31474C46u // "FLG1"
+#define PAGE_HDR 16u           // magic, seq, read mark
+#define REC_HDR 4u
+#define ERASED32 0xFFFFFFFFu
+#define ERASED64 UINT64_MAX
+
+_Static_assert((FLASH_LOG_STAGE_BYTES % 8u) == 0 &&
+                   FLASH_LOG_STAGE_BYTES <= FLASH_PAGE_SIZE - PAGE_HDR,
+               "FLASH_LOG_STAGE_BYTES must be double words within a page");
+
+enum { PAGE_ERASED = 0, PAGE_DATA, PAGE_DONE };
+
+extern uint8_t _sflash_log[];
+extern uint8_t _eflash_log[];
+
+static uint8_t g_stage[2][FLASH_LOG_STAGE_BYTES] __attribute__((aligned(8)));
+static uint16_t g_stage_used[2];
+static uint8_t g_stage_fill = 0;
+static TX_MUTEX g_lock;
+
+static uint8_t g_page[FLASH_LOG_MAX_PAGES];
+static uint32_t g_pages = 0;
+static uint32_t g_seq = 1;     // of the next page opened
+static uint32_t g_wr_page = 0; // the open page, or the next one to open
+static uint32_t g_wr_off = 0;
+static uint8_t g_wr_open = 0;
+static uint32_t g_rd_page = 0;
+static uint32_t g_rd_off = PAGE_HDR;
+static flash_log_stats_t g_stats;
+
+static inline uint8_t *page_addr(uint32_t p) {
+  return &_sflash_log[p * FLASH_PAGE_SIZE];
+}
+
+static inline uint32_t rec_size(uint32_t len) {
+  return (REC_HDR + len + 7u) & ~7u;
+}
+
+static inline uint32_t rd32(const uint8_t *a) {
+  uint32_t v;
+  memcpy(&v, a, sizeof(v));
+  return v;
+}
+
+static inline uint64_t rd64(const uint8_t *a) {
+  uint64_t v;
+  memcpy(&v, a, sizeof(v));
+  return v;
+}
+
+static int lock(void) {
+  if (tx_thread_identify() == TX_NULL) return 0; // boot, single context
+  return tx_mutex_get(&g_lock, TX_WAIT_FOREVER) == TX_SUCCESS;
+}
+
+static void unlock(int locked) {
+  if (locked) (void)tx_mutex_put(&g_lock);
+}
+
+static HAL_StatusTypeDef program64(uint8_t *a, uint64_t v) {
+  (void)HAL_FLASH_Unlock();
+  const uint32_t addr = (uint32_t)(uintptr_t)a;
+  const HAL_StatusTypeDef st =
+      HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr, v);
+  (void)HAL_FLASH_Lock();
+  if (st != HAL_OK) g_stats.errors++;
+  return st;
+}
+
+static HAL_StatusTypeDef erase_page(uint32_t p) {
+  FLASH_EraseInitTypeDef e = {0};
+  e.TypeErase = FLASH_TYPEERASE_PAGES;
+  e.Banks = FLASH_BANK_1;
+  e.Page = ((uint32_t)(uintptr_t)page_addr(p) - FLASH_BASE) / FLASH_PAGE_SIZE;
+  e.NbPages = 1;
+  uint32_t bad = 0;
+  (void)HAL_FLASH_Unlock();
+  const HAL_StatusTypeDef st = HAL_FLASHEx_Erase(&e, &bad);
+  (void)HAL_FLASH_Lock();
+  if (st != HAL_OK) {
+    g_stats.errors++;
+    return st;
+  }
+  g_page[p] = PAGE_ERASED;
+  g_stats.erases++;
+  return HAL_OK;
+}
+
+static void dcache_reset(void) {
+  if (!READ_BIT(FLASH->ACR, FLASH_ACR_DCEN)) return;
+  __HAL_FLASH_DATA_CACHE_DISABLE();
+  __HAL_FLASH_DATA_CACHE_RESET();
+  __HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+static int page_erased(uint32_t p) {
+  const uint8_t *a = page_addr(p);
+  for (uint32_t off = 0; off < FLASH_PAGE_SIZE; off += 8u)
+    if (rd64(&a[off]) != ERASED64) return 0;
+  return 1;
+}
+
+HAL_StatusTypeDef flash_log_init(void) {
+  if (g_pages) return HAL_OK;
+  uint32_t pages = (uint32_t)(_eflash_log - _sflash_log) / FLASH_PAGE_SIZE;
+  if (pages > FLASH_LOG_MAX_PAGES) pages = FLASH_LOG_MAX_PAGES;
+  if (pages < 2u) return HAL_ERROR;
+  if (tx_mutex_create(&g_lock, "flash log", TX_INHERIT) != TX_SUCCESS)
+    return HAL_ERROR;
+
+  int have = 0, unread = 0;
+  uint32_t newest = 0, max_seq = 0, min_seq = 0;
+  for (uint32_t p = 0; p < pages; p++) {
+    const uint8_t *a = page_addr(p);
+    if (rd32(a) != PAGE_MAGIC) {
+      g_page[p] = page_erased(p) ? PAGE_ERASED : PAGE_DONE;
+      continue;
+    }
+    const uint32_t seq = rd32(&a[4]);
+    if (!have || seq > max_seq) {
+      max_seq = seq;
+      newest = p;
+      have = 1;
+    }
+    if (rd64(&a[8]) != ERASED64) {
+      g_page[p] = PAGE_DONE;
+    } else {
+      g_page[p] = PAGE_DATA;
+      if (!unread || seq < min_seq) {
+        min_seq = seq;
+        g_rd_page = p;
+        unread = 1;
+      }
+    }
+  }
+  g_pages = pages;
+  // The newest page may end in a cut-short record: always start a new one.
+  g_seq = have ? max_seq + 1u : 1u;
+  g_wr_page = have ? (newest + 1u) % pages : 0;
+  if (!unread) g_rd_page = g_wr_page;
+  g_rd_off = PAGE_HDR;
+  g_stats.pages = (uint16_t)pages;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef flash_log_append(const uint8_t *data, size_t len) {
+  if (!g_pages) return HAL_ERROR;
+  if (!data || len == 0 || len > FLASH_LOG_RECORD_MAX) {
+    g_stats.dropped_big++;
+    return HAL_ERROR;
+  }
+  const uint32_t size = rec_size((uint32_t)len);
+  const int locked = lock();
+  const uint8_t s = g_stage_fill;
+  if (g_stage_used[s] + size > FLASH_LOG_STAGE_BYTES) {
+    g_stats.dropped_full++;
+    unlock(locked);
+    return HAL_BUSY;
+  }
+  uint8_t *r = &g_stage[s][g_stage_used[s]];
+  const uint32_t hdr = (uint32_t)len | ((uint32_t)(uint16_t)~len << 16);
+  memcpy(r, &hdr, sizeof(hdr));
+  memcpy(&r[REC_HDR], data, len);
+  memset(&r[REC_HDR + len], 0xFF, size - REC_HDR - len);
+  g_stage_used[s] = (uint16_t)(g_stage_used[s] + size);
+  unlock(locked);
+  return HAL_OK;
+}
+
+static void rd_page_done(void) {
+  const uint32_t p = g_rd_page;
+  if (g_page[p] == PAGE_DATA) {
+    (void)program64(&page_addr(p)[8], 0);
+    g_page[p] = PAGE_DONE;
+  }
+  g_rd_page = (p + 1u) % g_pages;
+  g_rd_off = PAGE_HDR;
+}
+
+// Make g_wr_page the open page: erase it first if it has to be, losing its
+// records if the ring is full.
+static int open_page(void) {
+  const uint32_t p = g_wr_page;
+  if (g_page[p] == PAGE_DATA) {
+    g_stats.pages_lost++;
+    g_page[p] = PAGE_DONE; // not read, but going
+    if (p == g_rd_page) rd_page_done();
+  }
+  if (g_page[p] != PAGE_ERASED && erase_page(p) != HAL_OK) return 0;
+  const uint64_t hdr = (uint64_t)PAGE_MAGIC | ((uint64_t)g_seq << 32);
+  if (program64(page_addr(p), hdr) != HAL_OK) {
+    g_page[p] = PAGE_DONE;
+    return 0;
+  }
+  g_page[p] = PAGE_DATA;
+  g_seq++;
+  g_wr_off = PAGE_HDR;
+  g_wr_open = 1;
+  return 1;
+}
+
+static void close_page(void) {
+  g_wr_open = 0;
+  g_wr_page = (g_wr_page + 1u) % g_pages;
+}
+
+static void program_stage(uint8_t s) {
+  const uint8_t *buf = g_stage[s];
+  for (uint32_t off = 0; off < g_stage_used[s];) {
+    const uint8_t *r = &buf[off];
+    const uint32_t size = rec_size(rd32(r) & 0xFFFFu);
+    off += size;
+    if (g_wr_open && g_wr_off + size > FLASH_PAGE_SIZE) close_page();
+    if (!g_wr_open && !open_page()) {
+      close_page(); // skip the page that won't erase or program
+      continue;
+    }
+    uint8_t *a = &page_addr(g_wr_page)[g_wr_off];
+    HAL_StatusTypeDef st = HAL_OK;
+    for (uint32_t i = 8u; i < size && st == HAL_OK; i += 8u)
+      st = program64(&a[i], rd64(&r[i]));
+    if (st == HAL_OK) st = program64(a, rd64(r));
+    if (st != HAL_OK) {
+      close_page(); // the rest of it can't be trusted to be erased
+      continue;
+    }
+    g_wr_off += size;
+    g_stats.stored++;
+  }
+  g_stage_used[s] = 0;
+  dcache_reset();
+}
+
+uint32_t flash_log_poll(void) {
+  if (!g_pages) return UINT32_MAX;
+  const int locked = lock();
+  const uint8_t s = g_stage_fill;
+  const int staged = g_stage_used[s] != 0;
+  if (staged) g_stage_fill ^= 1u;
+  unlock(locked);
+  if (staged) {
+    program_stage(s);
+    return FLASH_LOG_BUSY_MS;
+  }
+  for (uint32_t i = 0; i < g_pages; i++) {
+    const uint32_t p = (g_wr_page + i) % g_pages;
+    if (g_page[p] != PAGE_DONE || (g_wr_open && p == g_wr_page)) continue;
+    (void)erase_page(p);
+    return FLASH_LOG_BUSY_MS;
+  }
+  return UINT32_MAX;
+}
+
+int flash_log_peek(const uint8_t **data, size_t *len) {
+  if (!g_pages || !data || !len) return 0;
+  for (uint32_t n = 0; n <= g_pages; n++) {
+    const uint32_t p = g_rd_page;
+    const int writing = (p == g_wr_page);
+    if (g_page[p] == PAGE_DATA) {
+      const uint8_t *a = &page_addr(p)[g_rd_off];
+      const uint32_t hdr =
+          (g_rd_off + 8u <= FLASH_PAGE_SIZE) ? rd32(a) : ERASED32;
+      const uint32_t l = hdr & 0xFFFFu;
+      if (hdr != ERASED32 && (hdr >> 16) == (~l & 0xFFFFu) &&
+          g_rd_off + rec_size(l) <= FLASH_PAGE_SIZE) {
+        *data = &a[REC_HDR];
+        *len = l;
+        return 1;
+      }
+      // End of the page, or a damaged record: the writer may still add to
+      // its page; any other page is finished.
+      if (writing && g_wr_open) return 0;
+    } else if (writing) {
+      return 0; // caught up: nothing written past here yet
+    }
+    rd_page_done();
+  }
+  return 0;
+}
+
+void flash_log_pop(void) {
+  const uint8_t *d;
+  size_t len;
+  if (!flash_log_peek(&d, &len)) return;
+  g_rd_off += rec_size((uint32_t)len);
+  g_stats.read++;
+}
+
+void flash_log_get_stats(flash_log_stats_t *out) {
+  if (!out) return;
+  *out = g_stats;
+  uint16_t unread = 0;
+  for (uint32_t p = 0; p < g_pages; p++)
+    if (g_page[p] == PAGE_DATA) unread++;
+  out->pages_unread = unread;
+}
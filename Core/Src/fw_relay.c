@@ -0,0 +1,393 @@
+// fw_relay.c
+//
+// Firmware delivery to a node on the bus (fw_relay.h):
+//  - the host's bytes land in a ring of FW_RELAY_WINDOW blocks, block i in
+//  slot i % FW_RELAY_WINDOW; a slot is the host's again once the target
+//  reports having every byte of its block.
+//  - send_one() sends the next complete block as FW_BLOCK (offset, bytes,
+//  CRC-32) while it ends within the target's last credit (bytes taken +
+//  room), without waiting for answers in between. With no credit and
+//  nothing outstanding one block goes anyway, every FW_RELAY_PROBE_MS, to
+//  learn the new credit.
+//  - every answer carries what the target has taken, so acknowledgements
+//  never depend on matching answers to blocks. A refusal rewinds sending to
+//  the first missing block; the answers still due for blocks sent before
+//  the rewind (g_drain) can't start another one.
+//  - BEGIN and COMMIT are sent until the target answers them with
+//  something other than BUSY.
+//
+// Notes / Assumptions:
+//  - One target at a time; a new BEGIN drops the session before it.
+//  - Runs entirely in the telemetry RX thread (USB commands, ISO-TP
+//  callbacks and the poll), so nothing here is locked.
+//  - Answers are single frames; the ISO-TP session's own buffer only has
+//  to take short ones.
+
+#include "fw_relay.h"
+#include "crc_hw.h"
+#include "isotp.h"
+#include "telemetry.h"
+#include "us_clock.h"
+#include <string.h>
+
+// no answer for this long: what was sent counts as lost
+#ifndef FW_RELAY_TIMEOUT_MS
+#define FW_RELAY_TIMEOUT_MS 500u
+#endif
+// wait after a BUSY, and between blocks sent without credit
+#ifndef FW_RELAY_PROBE_MS
+#define FW_RELAY_PROBE_MS 10u
+#endif
+// refusals or timeouts in a row without progress before giving up
+#ifndef FW_RELAY_RETRIES
+#define FW_RELAY_RETRIES 8u
+#endif
+
+#define BLOCK FW_RELAY_BLOCK_BYTES
+#define ANSWER_LEN 10u // op | 0x80, status, u32 taken, u32 room
+
+enum { R_IDLE = 0, R_BEGIN, R_STREAM, R_COMMIT, R_DONE, R_FAILED };
+
+static can_bus_t *g_bus = NULL;
+static uint16_t g_rep_id = 0;
+static uint8_t g_open = 0;
+
+static uint8_t g_state = R_IDLE;
+static uint32_t g_size = 0;
+static uint32_t g_crc = 0;
+static uint8_t g_reset_flag = 0;
+
+static uint32_t g_rx = 0;         // image bytes taken from the host
+static uint32_t g_acked = 0;      // image bytes the target has
+static uint32_t g_credit_end = 0; // taken + room at the target's last answer
+static uint32_t g_send = 0;       // offset of the next block to send
+static uint8_t g_inflight = 0;    // blocks sent, not answered
+static uint8_t g_drain = 0;       // answers due from before a rewind
+static uint8_t g_ctrl_op = 0;     // BEGIN, COMMIT or ABORT to send
+static uint8_t g_ctrl_due = 0;
+static uint8_t g_ctrl_wait = 0;   // its answer is due
+static uint8_t g_tx_busy = 0;     // g_msg is ISO-TP's until on_tx_done
+static uint8_t g_tx_block = 0;    // g_msg holds a block
+static uint8_t g_retries = 0;
+static uint64_t g_last_us = 0;    // last answer, or the send that started
+                                  // waiting for one
+static uint64_t g_hold_us = 0;    // nothing is sent before this
+
+static uint8_t g_ring[FW_RELAY_WINDOW][BLOCK];
+static uint8_t g_msg[1u + 4u + BLOCK + 4u];
+static uint8_t g_isotp_rx[32];
+
+static inline uint32_t rd32le(const uint8_t *a) {
+  return a[0] | ((uint32_t)a[1] << 8) | ((uint32_t)a[2] << 16) |
+         ((uint32_t)a[3] << 24);
+}
+
+static inline void wr32le(uint8_t *a, uint32_t v) {
+  a[0] = (uint8_t)v;
+  a[1] = (uint8_t)(v >> 8);
+  a[2] = (uint8_t)(v >> 16);
+  a[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t block_floor(uint32_t off) { return off - off % BLOCK; }
+
+static void fail(void) {
+  g_state = R_FAILED;
+  g_ctrl_due = 0;
+  g_ctrl_wait = 0;
+}
+
+// Send again from the first byte the target lacks.
+static void rewind(void) {
+  g_send = block_floor(g_acked);
+  g_drain = g_inflight;
+}
+
+static int tx(size_t len) {
+  g_tx_busy = 1;
+  if (isotp_send(g_rep_id, g_msg, len) == HAL_OK) return 1;
+  g_tx_busy = 0;
+  return 0;
+}
+
+static int send_ctrl(uint64_t now) {
+  size_t len = 1;
+  g_msg[0] = g_ctrl_op;
+  if (g_ctrl_op == TELEMETRY_USB_CTRL_FW_BEGIN) {
+    wr32le(&g_msg[1], g_size);
+    wr32le(&g_msg[5], g_crc);
+    len = 9;
+  } else if (g_ctrl_op == TELEMETRY_USB_CTRL_FW_COMMIT) {
+    g_msg[1] = g_reset_flag;
+    len = 2;
+  }
+  g_tx_block = 0;
+  if (!tx(len)) return 0;
+  g_ctrl_due = 0;
+  g_ctrl_wait = g_ctrl_op != TELEMETRY_USB_CTRL_FW_ABORT;
+  g_last_us = now;
+  return 1;
+}
+
+static int send_block(uint64_t now) {
+  if (g_send >= g_size) return 0;
+  uint32_t end = g_send + BLOCK;
+  if (end > g_size) end = g_size;
+  if (end > g_rx) return 0; // not all here yet
+  const int probe = end > g_credit_end;
+  if (probe && g_inflight) return 0; // their answers bring new credit
+  const uint32_t len = end - g_send;
+  g_msg[0] = TELEMETRY_USB_CTRL_FW_BLOCK;
+  wr32le(&g_msg[1], g_send);
+  memcpy(&g_msg[5], g_ring[(g_send / BLOCK) % FW_RELAY_WINDOW], len);
+  wr32le(&g_msg[5u + len], crc_hw_compute(&crc_hw_crc32, &g_msg[5], len));
+  g_tx_block = 1;
+  if (!tx(5u + len + 4u)) return 0;
+  if (!g_inflight) g_last_us = now;
+  g_inflight++;
+  g_send = end;
+  if (probe) g_hold_us = now + FW_RELAY_PROBE_MS * 1000ull;
+  return 1;
+}
+
+static int send_one(void) {
+  if (!g_open || g_tx_busy) return 0;
+  const uint64_t now = us_clock_now();
+  if (now < g_hold_us) return 0;
+  if (g_ctrl_due) return send_ctrl(now);
+  if (g_state != R_STREAM && g_state != R_COMMIT) return 0;
+  return send_block(now);
+}
+
+static void pump(void) {
+  static uint8_t pumping = 0;
+  if (pumping) return; // a single frame finishes inside isotp_send()
+  pumping = 1;
+  while (send_one()) {
+  }
+  pumping = 0;
+}
+
+static void on_tx_done(HAL_StatusTypeDef status, void *user) {
+  (void)user;
+  g_tx_busy = 0;
+  if (status != HAL_OK && g_tx_block) {
+    // The target refused the frames or stopped taking them: lost.
+    if (g_inflight) g_inflight--;
+    rewind();
+    if (++g_retries > FW_RELAY_RETRIES) fail();
+  }
+  pump();
+}
+
+static void on_block_answer(uint8_t st, uint32_t taken, uint32_t room) {
+  if (g_inflight) g_inflight--;
+  if (taken > g_size) taken = g_size;
+  if (taken > g_acked) {
+    g_acked = taken;
+    g_retries = 0;
+  }
+  g_credit_end = taken + room;
+  if (st == TELEMETRY_USB_CTRL_OK) g_hold_us = 0; // a probe was answered
+  if (g_drain) {
+    g_drain--;
+  } else if (st != TELEMETRY_USB_CTRL_OK) {
+    rewind();
+    if (st == TELEMETRY_USB_CTRL_BUSY) {
+      g_hold_us = us_clock_now() + FW_RELAY_PROBE_MS * 1000ull;
+    } else if (++g_retries > FW_RELAY_RETRIES) {
+      fail();
+      return;
+    }
+  }
+  if (g_state == R_COMMIT && g_acked == g_size && !g_ctrl_wait) {
+    g_ctrl_op = TELEMETRY_USB_CTRL_FW_COMMIT;
+    g_ctrl_due = 1;
+  }
+}
+
+static void on_ctrl_answer(uint8_t op, uint8_t st, uint32_t taken,
+                           uint32_t room) {
+  if (!g_ctrl_wait || op != g_ctrl_op) return;
+  g_ctrl_wait = 0;
+  if (st == TELEMETRY_USB_CTRL_BUSY) {
+    g_ctrl_due = 1; // verifying, or still busy with a last session
+    g_hold_us = us_clock_now() + FW_RELAY_PROBE_MS * 1000ull;
+    return;
+  }
+  if (st != TELEMETRY_USB_CTRL_OK) {
+    fail();
+    return;
+  }
+  if (op == TELEMETRY_USB_CTRL_FW_BEGIN) {
+    g_state = R_STREAM;
+    g_credit_end = taken + room;
+  } else {
+    g_state = R_DONE;
+  }
+}
+
+static void on_answer(const uint8_t *d, size_t len, void *user) {
+  (void)user;
+  if (len < ANSWER_LEN || !(d[0] & 0x80u)) return;
+  const uint8_t op = (uint8_t)(d[0] & 0x7Fu);
+  const uint32_t taken = rd32le(&d[2]);
+  const uint32_t room = rd32le(&d[6]);
+  g_last_us = us_clock_now();
+  if (op == TELEMETRY_USB_CTRL_FW_BLOCK) {
+    on_block_answer(d[1], taken, room);
+  } else if (g_state != R_FAILED) {
+    on_ctrl_answer(op, d[1], taken, room);
+  }
+  pump();
+}
+
+void fw_relay_init(can_bus_t *bus) { g_bus = bus; }
+
+/* ---- Host commands ---- */
+
+static uint8_t relay_begin(const uint8_t *a, size_t n) {
+  if (!g_bus || n < 12u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint16_t req = (uint16_t)(a[0] | (a[1] << 8));
+  const uint16_t rep = (uint16_t)(a[2] | (a[3] << 8));
+  const uint32_t size = rd32le(&a[4]);
+  if (req > 0x7FFu || rep < FW_RELAY_REPLY_FIRST ||
+      rep > FW_RELAY_REPLY_LAST || req == rep || size == 0)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  if (g_open) isotp_close(g_rep_id);
+  g_open = 0;
+  g_tx_busy = 0;
+  const isotp_config_t cfg = {
+      .bus = g_bus,
+      .tx_id = req,
+      .rx_id = rep,
+      .block_size = 0,
+      .st_min = 0,
+      .rx_buf = g_isotp_rx,
+      .rx_cap = sizeof(g_isotp_rx),
+      .on_rx = on_answer,
+      .on_tx_done = on_tx_done,
+  };
+  if (isotp_open(&cfg) != HAL_OK) return TELEMETRY_USB_CTRL_BAD_ARG;
+  g_open = 1;
+  g_rep_id = rep;
+  g_size = size;
+  g_crc = rd32le(&a[8]);
+  g_reset_flag = 0;
+  g_rx = g_acked = g_credit_end = g_send = 0;
+  g_inflight = g_drain = g_retries = 0;
+  g_hold_us = 0;
+  g_state = R_BEGIN;
+  g_ctrl_op = TELEMETRY_USB_CTRL_FW_BEGIN;
+  g_ctrl_due = 1;
+  g_ctrl_wait = 0;
+  pump();
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static uint8_t relay_data(const uint8_t *a, size_t n) {
+  if ((g_state != R_BEGIN && g_state != R_STREAM) || n < 4u)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint32_t off = rd32le(a);
+  const uint8_t *d = &a[4];
+  uint32_t left = (uint32_t)(n - 4u);
+  if (off > g_rx || left > g_size - off) return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint32_t dup = g_rx - off;
+  if (dup >= left) return TELEMETRY_USB_CTRL_OK;
+  d += dup;
+  left -= dup;
+  uint8_t st = TELEMETRY_USB_CTRL_OK;
+  while (left) {
+    const uint32_t blk = g_rx / BLOCK;
+    if (blk >= g_acked / BLOCK + FW_RELAY_WINDOW) {
+      st = TELEMETRY_USB_CTRL_BUSY; // the rest again once blocks are acked
+      break;
+    }
+    const uint32_t at = g_rx % BLOCK;
+    uint32_t take = BLOCK - at;
+    if (take > left) take = left;
+    memcpy(&g_ring[blk % FW_RELAY_WINDOW][at], d, take);
+    d += take;
+    left -= take;
+    g_rx += take;
+  }
+  pump();
+  return st;
+}
+
+static uint8_t relay_commit(const uint8_t *a, size_t n) {
+  switch (g_state) {
+  case R_BEGIN:
+    return TELEMETRY_USB_CTRL_BUSY; // the target hasn't taken BEGIN yet
+  case R_STREAM:
+    if (g_rx != g_size) return TELEMETRY_USB_CTRL_BAD_ARG;
+    g_reset_flag = (n >= 1u && a[0] == 1u) ? 1u : 0u;
+    g_state = R_COMMIT;
+    if (g_acked == g_size) {
+      g_ctrl_op = TELEMETRY_USB_CTRL_FW_COMMIT;
+      g_ctrl_due = 1;
+      pump();
+    }
+    return TELEMETRY_USB_CTRL_BUSY;
+  case R_COMMIT:
+    return TELEMETRY_USB_CTRL_BUSY;
+  case R_DONE:
+    return TELEMETRY_USB_CTRL_OK;
+  default:
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  }
+}
+
+uint8_t fw_relay_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  switch (op) {
+  case TELEMETRY_USB_CTRL_FW_RELAY_BEGIN:
+    return relay_begin(args, n);
+  case TELEMETRY_USB_CTRL_FW_RELAY_DATA:
+    return relay_data(args, n);
+  case TELEMETRY_USB_CTRL_FW_RELAY_COMMIT:
+    return relay_commit(args, n);
+  case TELEMETRY_USB_CTRL_FW_RELAY_ABORT:
+    if (g_open) {
+      g_ctrl_op = TELEMETRY_USB_CTRL_FW_ABORT;
+      g_ctrl_due = 1;
+      g_hold_us = 0;
+    }
+    g_state = R_IDLE;
+    g_inflight = g_drain = 0;
+    pump();
+    return TELEMETRY_USB_CTRL_OK;
+  default:
+    return TELEMETRY_USB_CTRL_BAD_OP;
+  }
+}
+
+static uint32_t us_to_ms_ceil(uint64_t us) {
+  const uint64_t ms = (us + 999u) / 1000u;
+  return ms > UINT32_MAX - 1u ? UINT32_MAX - 1u : (uint32_t)ms;
+}
+
+uint32_t fw_relay_poll(void) {
+  if (!g_open) return UINT32_MAX;
+  const uint64_t now = us_clock_now();
+  const uint64_t timeout_us = FW_RELAY_TIMEOUT_MS * 1000ull;
+  if ((g_inflight || g_ctrl_wait) && now - g_last_us >= timeout_us) {
+    g_inflight = 0;
+    g_drain = 0;
+    if (g_ctrl_wait) {
+      g_ctrl_wait = 0;
+      g_ctrl_due = 1;
+    }
+    rewind();
+    if (++g_retries > FW_RELAY_RETRIES) fail();
+  }
+  pump();
+
+  uint32_t wait = UINT32_MAX;
+  if (g_hold_us > now) wait = us_to_ms_ceil(g_hold_us - now);
+  if (g_inflight || g_ctrl_wait) {
+    const uint64_t due = g_last_us + timeout_us;
+    const uint32_t ms = due > now ? us_to_ms_ceil(due - now) : 0u;
+    if (ms < wait) wait = ms;
+  }
+  return wait;
+}
@@ -0,0 +1,422 @@
+// fw_update.c
+//
+// Firmware update into the staging slot (fw_update.h):
+//  - DATA copies the image into two page-sized RAM buffers, page k into
+//  buffer k & 1; fw_update_poll() erases the slot page and programs the
+//  full buffer a double word at a time, so the host streams the next page
+//  while the last one goes to flash.
+//  - the slot's last page is the trailer's alone: BEGIN and ABORT erase it
+//  first, so an older pending image can never be installed by mistake, and
+//  only a CRC-checked image gets it written.
+//  - fw_update_install() checks the trailer and the slot's CRC again, then
+//  hands over to install_copy() in CCM: the flash it runs from is what it
+//  overwrites. install_copy() and its helpers touch registers only, no HAL
+//  or library code, and end in a reset.
+//  - a finished copy zeroes the trailer's check word; until then every boot
+//  starts the copy over.
+//
+// Notes / Assumptions:
+//  - Same single-bank stalls as flash_log.c (a page erase ~22 ms, a double
+//  word ~0.1 ms); all of it runs in the maintenance thread.
+//  - The RX thread reads the session fields under the mutex and never
+//  waits on flash: a buffer is either its to fill or the poll's to program.
+//  - BEGIN and ABORT answer BUSY while the poll is at work on the flash.
+
+#include "fw_update.h"
+#include "crc_hw.h"
+#include "mem_sections.h"
+#include "telemetry.h"
+#include "tx_api.h"
+#include <string.h>
+
+// poll interval asked for while a session has flash work coming
+#ifndef FW_UPDATE_BUSY_MS
+#define FW_UPDATE_BUSY_MS 5u
+#endif
+// COMMIT with the reset flag: time for the reply to go out first
+#ifndef FW_UPDATE_RESET_DELAY_MS
+#define FW_UPDATE_RESET_DELAY_MS 200u
+#endif
+
+#define TRAILER_MAGIC 0x50555746u // "FWUP"
+#define ERASED32 0xFFFFFFFFu
+
+typedef struct {
+  uint32_t magic;
+  uint32_t size;
+  uint32_t crc;
+  uint32_t check; // ~magic; zeroed once installed
+} fw_trailer_t;
+
+enum { ST_IDLE = 0, ST_RECEIVING, ST_VERIFYING, ST_PENDING, ST_FAILED };
+enum { BUF_FREE = 0, BUF_READY };
+enum { JOB_NONE = 0, JOB_CLEAR, JOB_PROGRAM, JOB_VERIFY };
+
+extern uint8_t _sfw_stage[];
+extern uint8_t _efw_stage[];
+
+static uint8_t g_buf[2][FLASH_PAGE_SIZE] __attribute__((aligned(8)));
+static volatile uint8_t g_buf_state[2];
+static TX_MUTEX g_lock;
+static uint8_t g_ready = 0;
+
+static uint8_t g_state = ST_IDLE;
+static uint8_t g_clear = 0;   // trailer page to erase before anything else
+static uint8_t g_busy = 0;    // the poll is working on the flash
+static uint8_t g_reset = 0;   // reset at g_reset_at
+static ULONG g_reset_at = 0;
+static uint32_t g_size = 0;
+static uint32_t g_crc = 0;
+static uint32_t g_rx = 0;     // bytes taken
+static uint32_t g_prog = 0;   // pages programmed
+
+static inline fw_trailer_t *trailer_addr(void) {
+  return (fw_trailer_t *)(void *)(_efw_stage - sizeof(fw_trailer_t));
+}
+
+// Largest image: the slot less the trailer page.
+static inline uint32_t stage_max(void) {
+  return (uint32_t)(_efw_stage - _sfw_stage) - FLASH_PAGE_SIZE;
+}
+
+static inline uint32_t rd32le(const uint8_t *a) {
+  return a[0] | ((uint32_t)a[1] << 8) | ((uint32_t)a[2] << 16) |
+         ((uint32_t)a[3] << 24);
+}
+
+static ULONG ms_ticks(uint32_t ms) {
+  return (ULONG)(((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u);
+}
+
+HAL_StatusTypeDef fw_update_init(void) {
+  if (g_ready) return HAL_OK;
+  if (tx_mutex_create(&g_lock, "fw update", TX_INHERIT) != TX_SUCCESS)
+    return HAL_ERROR;
+  g_ready = 1;
+  return HAL_OK;
+}
+
+/* ---- Commands (RX thread) ---- */
+
+static uint8_t cmd_begin(const uint8_t *a, size_t n) {
+  if (n < 8u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint32_t size = rd32le(a);
+  if (size == 0 || size > stage_max()) return TELEMETRY_USB_CTRL_BAD_ARG;
+  g_size = size;
+  g_crc = rd32le(&a[4]);
+  g_rx = 0;
+  g_prog = 0;
+  g_buf_state[0] = g_buf_state[1] = BUF_FREE;
+  g_state = ST_RECEIVING;
+  g_clear = 1;
+  g_reset = 0;
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static uint8_t cmd_data(const uint8_t *a, size_t n) {
+  if (g_state != ST_RECEIVING || n < 4u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  uint32_t off = rd32le(a);
+  const uint8_t *d = &a[4];
+  uint32_t left = (uint32_t)(n - 4u);
+  if (off > g_rx || left > g_size - off) return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint32_t dup = g_rx - off; // a resend of what was taken
+  if (dup >= left) return TELEMETRY_USB_CTRL_OK;
+  d += dup;
+  left -= dup;
+  while (left) {
+    const uint32_t page = g_rx / FLASH_PAGE_SIZE;
+    const uint32_t at = g_rx % FLASH_PAGE_SIZE;
+    const uint8_t b = (uint8_t)(page & 1u);
+    if (g_buf_state[b] != BUF_FREE) return TELEMETRY_USB_CTRL_BUSY;
+    uint32_t take = FLASH_PAGE_SIZE - at;
+    if (take > left) take = left;
+    memcpy(&g_buf[b][at], d, take);
+    d += take;
+    left -= take;
+    g_rx += take;
+    if (g_rx % FLASH_PAGE_SIZE == 0 || g_rx == g_size) {
+      const uint32_t end = at + take;
+      memset(&g_buf[b][end], 0xFF, FLASH_PAGE_SIZE - end);
+      g_buf_state[b] = BUF_READY;
+    }
+  }
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+// DATA with a CRC-32 of its bytes after them, for links without one.
+static uint8_t cmd_block(const uint8_t *a, size_t n) {
+  if (n < 8u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  n -= 4u;
+  if (crc_hw_compute(&crc_hw_crc32, &a[4], n - 4u) != rd32le(&a[n]))
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  return cmd_data(a, n);
+}
+
+static uint8_t cmd_commit(const uint8_t *a, size_t n) {
+  switch (g_state) {
+  case ST_RECEIVING:
+    if (g_rx != g_size) return TELEMETRY_USB_CTRL_BAD_ARG;
+    g_state = ST_VERIFYING;
+    return TELEMETRY_USB_CTRL_BUSY;
+  case ST_VERIFYING:
+    return TELEMETRY_USB_CTRL_BUSY;
+  case ST_PENDING:
+    if (n >= 1u && a[0] == 1u && !g_reset) {
+      g_reset = 1;
+      g_reset_at = tx_time_get() + ms_ticks(FW_UPDATE_RESET_DELAY_MS);
+    }
+    return TELEMETRY_USB_CTRL_OK;
+  default:
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  }
+}
+
+uint8_t fw_update_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  if (!g_ready) return TELEMETRY_USB_CTRL_BAD_OP;
+  if (tx_mutex_get(&g_lock, TX_WAIT_FOREVER) != TX_SUCCESS)
+    return TELEMETRY_USB_CTRL_BUSY;
+  uint8_t status;
+  switch (op) {
+  case TELEMETRY_USB_CTRL_FW_BEGIN:
+    status = g_busy ? TELEMETRY_USB_CTRL_BUSY : cmd_begin(args, n);
+    break;
+  case TELEMETRY_USB_CTRL_FW_DATA:
+    status = cmd_data(args, n);
+    break;
+  case TELEMETRY_USB_CTRL_FW_BLOCK:
+    status = cmd_block(args, n);
+    break;
+  case TELEMETRY_USB_CTRL_FW_COMMIT:
+    status = cmd_commit(args, n);
+    break;
+  case TELEMETRY_USB_CTRL_FW_ABORT:
+    if (g_busy) {
+      status = TELEMETRY_USB_CTRL_BUSY;
+      break;
+    }
+    if (g_state != ST_IDLE) g_clear = 1;
+    g_state = ST_IDLE;
+    g_reset = 0;
+    status = TELEMETRY_USB_CTRL_OK;
+    break;
+  default:
+    status = TELEMETRY_USB_CTRL_BAD_OP;
+    break;
+  }
+  (void)tx_mutex_put(&g_lock);
+  return status;
+}
+
+void fw_update_progress(uint32_t *next, uint32_t *room) {
+  uint32_t r = 0;
+  if (g_ready && tx_mutex_get(&g_lock, TX_WAIT_FOREVER) == TX_SUCCESS) {
+    if (g_state == ST_RECEIVING && g_rx < g_size) {
+      const uint8_t b = (uint8_t)((g_rx / FLASH_PAGE_SIZE) & 1u);
+      if (g_buf_state[b] == BUF_FREE) {
+        r = FLASH_PAGE_SIZE - g_rx % FLASH_PAGE_SIZE;
+        if (g_buf_state[b ^ 1u] == BUF_FREE) r += FLASH_PAGE_SIZE;
+      }
+      if (r > g_size - g_rx) r = g_size - g_rx;
+    }
+    if (next) *next = g_rx;
+    (void)tx_mutex_put(&g_lock);
+  } else if (next) {
+    *next = 0;
+  }
+  if (room) *room = r;
+}
+
+/* ---- Flash work (maintenance thread) ---- */
+
+static HAL_StatusTypeDef erase_at(const uint8_t *a) {
+  FLASH_EraseInitTypeDef e = {0};
+  e.TypeErase = FLASH_TYPEERASE_PAGES;
+  e.Banks = FLASH_BANK_1;
+  e.Page = ((uint32_t)(uintptr_t)a - FLASH_BASE) / FLASH_PAGE_SIZE;
+  e.NbPages = 1;
+  uint32_t bad = 0;
+  (void)HAL_FLASH_Unlock();
+  const HAL_StatusTypeDef st = HAL_FLASHEx_Erase(&e, &bad);
+  (void)HAL_FLASH_Lock();
+  return st;
+}
+
+static HAL_StatusTypeDef program_at(uint8_t *a, const uint8_t *src,
+                                    uint32_t len) {
+  HAL_StatusTypeDef st = HAL_OK;
+  (void)HAL_FLASH_Unlock();
+  for (uint32_t off = 0; off < len && st == HAL_OK; off += 8u) {
+    uint64_t v;
+    memcpy(&v, &src[off], sizeof(v));
+    if (v == UINT64_MAX) continue; // already erased
+    st = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD,
+                           (uint32_t)(uintptr_t)&a[off], v);
+  }
+  (void)HAL_FLASH_Lock();
+  if (READ_BIT(FLASH->ACR, FLASH_ACR_DCEN)) {
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+  }
+  return st;
+}
+
+static HAL_StatusTypeDef program_page(uint32_t page) {
+  uint8_t *a = &_sfw_stage[page * FLASH_PAGE_SIZE];
+  uint32_t len = g_size - page * FLASH_PAGE_SIZE;
+  if (len > FLASH_PAGE_SIZE) len = FLASH_PAGE_SIZE;
+  len = (len + 7u) & ~7u; // the buffer is padded with 0xFF
+  if (erase_at(a) != HAL_OK) return HAL_ERROR;
+  return program_at(a, g_buf[page & 1u], len);
+}
+
+static HAL_StatusTypeDef verify_and_mark(void) {
+  if (crc_hw_compute(&crc_hw_crc32, _sfw_stage, g_size) != g_crc)
+    return HAL_ERROR;
+  const fw_trailer_t t = {TRAILER_MAGIC, g_size, g_crc, ~TRAILER_MAGIC};
+  return program_at((uint8_t *)trailer_addr(), (const uint8_t *)&t,
+                    sizeof(t));
+}
+
+static uint8_t next_job(uint32_t *page) {
+  if (g_clear) return JOB_CLEAR;
+  if (g_state != ST_RECEIVING && g_state != ST_VERIFYING) return JOB_NONE;
+  const uint32_t pages = (g_size + FLASH_PAGE_SIZE - 1u) / FLASH_PAGE_SIZE;
+  if (g_prog < pages) {
+    *page = g_prog;
+    return g_buf_state[g_prog & 1u] == BUF_READY ? JOB_PROGRAM : JOB_NONE;
+  }
+  return g_state == ST_VERIFYING ? JOB_VERIFY : JOB_NONE;
+}
+
+uint32_t fw_update_poll(void) {
+  if (!g_ready) return UINT32_MAX;
+  if (tx_mutex_get(&g_lock, TX_WAIT_FOREVER) != TX_SUCCESS)
+    return FW_UPDATE_BUSY_MS;
+  if (g_reset && (LONG)(tx_time_get() - g_reset_at) >= 0) NVIC_SystemReset();
+  uint32_t page = 0;
+  const uint8_t job = next_job(&page);
+  g_busy = job != JOB_NONE;
+  (void)tx_mutex_put(&g_lock);
+
+  HAL_StatusTypeDef st = HAL_OK;
+  switch (job) {
+  case JOB_CLEAR:
+    st = erase_at((const uint8_t *)trailer_addr());
+    break;
+  case JOB_PROGRAM:
+    st = program_page(page);
+    break;
+  case JOB_VERIFY:
+    st = verify_and_mark();
+    break;
+  default:
+    break;
+  }
+
+  (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+  g_busy = 0;
+  if (job == JOB_CLEAR && st == HAL_OK) g_clear = 0;
+  if (job == JOB_PROGRAM) {
+    g_buf_state[page & 1u] = BUF_FREE;
+    g_prog++;
+  }
+  if (job == JOB_VERIFY) g_state = (st == HAL_OK) ? ST_PENDING : ST_FAILED;
+  if (st != HAL_OK && job != JOB_CLEAR) g_state = ST_FAILED;
+  uint32_t wait = UINT32_MAX;
+  if (job != JOB_NONE || g_state == ST_RECEIVING || g_state == ST_VERIFYING)
+    wait = FW_UPDATE_BUSY_MS;
+  if (g_reset) {
+    const LONG left = (LONG)(g_reset_at - tx_time_get());
+    const uint32_t ms = left > 0 ? (uint32_t)((uint64_t)left * 1000u /
+                                              TX_TIMER_TICKS_PER_SECOND)
+                                 : 0u;
+    if (ms < wait) wait = ms;
+  }
+  (void)tx_mutex_put(&g_lock);
+  return wait;
+}
+
+/* ---- Install (boot) ---- */
+
+CCM_FUNC static void inst_wait(void) {
+  while (FLASH->SR & FLASH_SR_BSY) {
+  }
+}
+
+CCM_FUNC static uint32_t inst_erase(uint32_t page) {
+  inst_wait();
+  FLASH->SR = FLASH_FLAG_SR_ERRORS | FLASH_FLAG_EOP;
+  FLASH->CR = (FLASH->CR & ~FLASH_CR_PNB) | FLASH_CR_PER |
+              (page << FLASH_CR_PNB_Pos);
+  FLASH->CR |= FLASH_CR_STRT;
+  inst_wait();
+  FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_PNB);
+  return FLASH->SR & FLASH_FLAG_SR_ERRORS;
+}
+
+CCM_FUNC static uint32_t inst_program(volatile uint32_t *dst,
+                                      const uint32_t *src) {
+  inst_wait();
+  FLASH->SR = FLASH_FLAG_SR_ERRORS | FLASH_FLAG_EOP;
+  FLASH->CR |= FLASH_CR_PG;
+  dst[0] = src[0];
+  __ISB();
+  dst[1] = src[1];
+  inst_wait();
+  FLASH->CR &= ~FLASH_CR_PG;
+  return FLASH->SR & FLASH_FLAG_SR_ERRORS;
+}
+
+// Copy `size` bytes of the slot over the running image (from page 0) and
+// reset. Nothing in flash may run or be read as constants from here on, so
+// no inline helpers either: they stay out of line at -O0.
+CCM_FUNC __attribute__((noreturn, noinline)) static void
+install_copy(uint32_t size) {
+  FLASH->KEYR = FLASH_KEY1;
+  FLASH->KEYR = FLASH_KEY2;
+  FLASH->ACR &= ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+  const uint32_t pages = (size + FLASH_PAGE_SIZE - 1u) / FLASH_PAGE_SIZE;
+  uint32_t bad = 0;
+  for (uint32_t p = 0; p < pages; p++) {
+    volatile uint32_t *dst =
+        (volatile uint32_t *)(FLASH_BASE + p * FLASH_PAGE_SIZE);
+    const uint32_t *src = (const uint32_t *)&_sfw_stage[p * FLASH_PAGE_SIZE];
+    for (int tries = 0; tries < 3; tries++) {
+      uint32_t err = inst_erase(p);
+      for (uint32_t w = 0; w < FLASH_PAGE_SIZE / 4u && !err; w += 2u) {
+        if ((src[w] & src[w + 1u]) == ERASED32) continue;
+        err = inst_program(&dst[w], &src[w]);
+      }
+      if (!err) break;
+      if (tries == 2) bad = 1;
+    }
+  }
+  if (!bad) {
+    // Installed: invalidate the trailer (zeroing programs over anything).
+    uint32_t zero[2];
+    zero[0] = 0u;
+    zero[1] = 0u;
+    (void)inst_program((volatile uint32_t *)(void *)(_efw_stage - 8u), zero);
+  }
+  FLASH->CR |= FLASH_CR_LOCK;
+  __DSB();
+  SCB->AIRCR = (0x5FAu << SCB_AIRCR_VECTKEY_Pos) | SCB_AIRCR_SYSRESETREQ_Msk;
+  __DSB();
+  for (;;) {
+  }
+}
+
+void fw_update_install(void) {
+  const fw_trailer_t *t = trailer_addr();
+  if (t->magic != TRAILER_MAGIC || t->check != ~TRAILER_MAGIC) return;
+  if (t->size == 0 || t->size > stage_max() ||
+      crc_sw_compute(&crc_hw_crc32, _sfw_stage, t->size) != t->crc) {
+    // Damaged since COMMIT: drop it rather than check it every boot.
+    const uint8_t zero[8] = {0};
+    (void)program_at((uint8_t *)&trailer_addr()->crc, zero, sizeof(zero));
+    return;
+  }
+  __disable_irq();
+  install_copy(t->size);
+}
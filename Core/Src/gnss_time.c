@@ -0,0 +1,367 @@
+// gnss_time.c
+//
+// GNSS time source for the master (API and pairing rules in gnss_time.h):
+//  - the PPS capture ISR only records the edge's raw time and bumps a
+//  count; edges closer than GNSS_TIME_PPS_MIN_GAP_MS to the last one are
+//  glitches and dropped there.
+//  - DMA writes USART2 bytes into g_rx_dma in circular mode; the poll reads
+//  how far it got from the channel's counter, so no UART or DMA interrupt
+//  is needed and nothing here shares uart_link.c's HAL callbacks.
+//  - the capture ISR also notes where DMA stood at the edge, and the poll
+//  parses the bytes before it ahead of taking the edge: a sentence is only
+//  ever paired with an edge that came before it, however late the poll.
+//  - sentences are assembled a byte at a time, checked and parsed for the
+//  UTC time of day and date; only whole-second times label an edge.
+//
+// Notes / Assumptions:
+//  - GNSS_TIME_RX_DMA_SIZE bytes cover about a second at 9600 baud, so the
+//  maintenance thread can be held up by a flash erase without losing a
+//  sentence; a poll later than that drops what the buffer holds.
+//  - An edge waits for its sentence until GNSS_TIME_LABEL_WAIT_MS, then goes
+//  to the clock unlabelled; unix time is only ever set from a labelled one.
+//  - ZDA and RMC for the same second are both fine: the second one finds
+//  no edge waiting.
+//  - Pins: PA1 (TIM2_CH2) and PA3 (USART2_RX) are free on this board.
+#include "gnss_time.h"
+#include "us_clock.h"
+#include "rtc_time.h"
+
+#include <string.h>
+
+#ifdef GNSS_TIME_ENABLED
+
+#ifndef GNSS_TIME_RX_DMA_SIZE
+#define GNSS_TIME_RX_DMA_SIZE 1024u // power of two
+#endif
+#ifndef GNSS_TIME_RX_DMA_CHANNEL
+#define GNSS_TIME_RX_DMA_CHANNEL DMA2_Channel1 // DMA1 is taken
+#endif
+#ifndef GNSS_TIME_RX_DMA_REQUEST
+#define GNSS_TIME_RX_DMA_REQUEST DMA_REQUEST_USART2_RX
+#endif
+// A 1 Hz PPS; anything faster is ringing on the line.
+#ifndef GNSS_TIME_PPS_MIN_GAP_MS
+#define GNSS_TIME_PPS_MIN_GAP_MS 500u
+#endif
+#ifndef GNSS_TIME_LABEL_WAIT_MS
+#define GNSS_TIME_LABEL_WAIT_MS 1000u
+#endif
+// No PPS for this long: fall back to the sentences alone.
+#ifndef GNSS_TIME_PPS_TIMEOUT_MS
+#define GNSS_TIME_PPS_TIMEOUT_MS 3000u
+#endif
+// IC2F: fDTS / 8 samples, rejects spikes shorter than ~50 ns at 170 MHz.
+#ifndef GNSS_TIME_PPS_FILTER
+#define GNSS_TIME_PPS_FILTER 3u
+#endif
+#ifndef GNSS_TIME_POLL_MS
+#define GNSS_TIME_POLL_MS 50u
+#endif
+
+#define NMEA_MAX 96u
+
+#if (GNSS_TIME_RX_DMA_SIZE & (GNSS_TIME_RX_DMA_SIZE - 1u)) != 0u
+#error "GNSS_TIME_RX_DMA_SIZE must be a power of two"
+#endif
+
+static DMA_HandleTypeDef g_hdma_rx;
+static uint8_t g_rx_dma[GNSS_TIME_RX_DMA_SIZE];
+static uint16_t g_rx_pos = 0; // DMA position parsed up to
+static uint8_t g_ready = 0;
+
+static char g_line[NMEA_MAX];
+static uint32_t g_line_len = 0;
+
+// Written by the capture ISR: the count last, after the time.
+static volatile uint64_t g_edge_raw = 0;
+static volatile uint16_t g_edge_pos = 0; // DMA position at the edge
+static volatile uint32_t g_edge_count = 0;
+static volatile uint32_t g_glitches = 0;
+
+static uint32_t g_edge_seen = 0;
+static uint64_t g_last_edge_raw = 0;
+static uint64_t g_pending_raw = 0; // 0 = no edge waiting for a sentence
+static uint64_t g_last_announce_raw = 0;
+static gnss_time_stats_t g_stats;
+
+static uint16_t dma_pos(void) {
+  return (uint16_t)((GNSS_TIME_RX_DMA_SIZE - __HAL_DMA_GET_COUNTER(&g_hdma_rx)) &
+                    (GNSS_TIME_RX_DMA_SIZE - 1u));
+}
+
+static void pps_capture(uint64_t at_us) {
+  const uint64_t last = g_edge_raw;
+  if (g_edge_count != 0 && at_us - last < GNSS_TIME_PPS_MIN_GAP_MS * 1000ULL) {
+    g_glitches++;
+    return;
+  }
+  g_edge_raw = at_us;
+  g_edge_pos = dma_pos();
+  __DMB();
+  g_edge_count++;
+}
+
+// Latest edge since the last call and the DMA position at it (0 if none),
+// and the DMA position now. Read together, so any later edge is at `now_pos`
+// or beyond it.
+static uint64_t take_edge(uint16_t *edge_pos, uint16_t *now_pos) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint32_t n = g_edge_count;
+  const uint64_t raw = g_edge_raw;
+  *edge_pos = g_edge_pos;
+  *now_pos = dma_pos();
+  __set_PRIMASK(primask);
+  if (n == g_edge_seen) return 0;
+  g_stats.pps_edges += n - g_edge_seen;
+  g_edge_seen = n;
+  g_last_edge_raw = raw;
+  return raw;
+}
+
+// =========================
+// NMEA
+// =========================
+
+static int hexval(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// `n` decimal digits at s; -1 unless they all are.
+static int32_t digits(const char *s, uint32_t n) {
+  int32_t v = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    if (s[i] < '0' || s[i] > '9') return -1;
+    v = v * 10 + (s[i] - '0');
+  }
+  return v;
+}
+
+// A field of exactly `n` decimal digits; -1 if it isn't one.
+static int32_t field(const char *s, uint32_t n) {
+  return (strlen(s) == n) ? digits(s, n) : -1;
+}
+
+// Split in place at commas; returns the field count.
+static uint32_t split(char *s, char **f, uint32_t max) {
+  uint32_t n = 0;
+  f[n++] = s;
+  for (; *s && n < max; s++) {
+    if (*s == ',') {
+      *s = '\0';
+      f[n++] = s + 1;
+    }
+  }
+  return n;
+}
+
+// hhmmss[.ss]; 0 if malformed or not on a whole second.
+static int parse_tod(const char *s, uint32_t *sod) {
+  if (strlen(s) < 6) return 0;
+  const int32_t hh = digits(s, 2), mm = digits(s + 2, 2), ss = digits(s + 4, 2);
+  if (hh < 0 || mm < 0 || ss < 0 || hh > 23 || mm > 59 || ss > 60) return 0;
+  for (const char *p = s + 6; *p; p++) {
+    if (*p != '.' && *p != '0') return 0;
+  }
+  *sod = (uint32_t)(hh * 3600 + mm * 60 + ss);
+  return 1;
+}
+
+static uint64_t unix_s_of(uint32_t y, uint32_t m, uint32_t d, uint32_t sod) {
+  return (uint64_t)rtc_time_days_from_civil(y, m, d) * 86400ULL + sod;
+}
+
+// UTC second of a time sentence, 0 if it isn't a usable one.
+static uint64_t parse_sentence(char *s) {
+  char *f[20];
+  const uint32_t n = split(s, f, 20);
+  const size_t id = strlen(f[0]);
+  if (id != 5) return 0;
+  const char *type = f[0] + 2; // after the talker ID
+  uint32_t sod = 0;
+  int32_t y, mo, d;
+
+  if (strcmp(type, "RMC") == 0) {
+    if (n < 10) return 0;
+    g_stats.fix = (f[2][0] == 'A');
+    if (!g_stats.fix || !parse_tod(f[1], &sod) || strlen(f[9]) != 6) return 0;
+    d = digits(f[9], 2);
+    mo = digits(f[9] + 2, 2);
+    y = digits(f[9] + 4, 2);
+    if (y >= 0) y += 2000;
+  } else if (strcmp(type, "ZDA") == 0) {
+    if (n < 5 || !parse_tod(f[1], &sod)) return 0;
+    d = field(f[2], 2);
+    mo = field(f[3], 2);
+    y = field(f[4], 4);
+  } else {
+    return 0;
+  }
+  if (y < 2000 || mo < 1 || mo > 12 || d < 1 || d > 31) return 0;
+  return unix_s_of((uint32_t)y, (uint32_t)mo, (uint32_t)d, sod);
+}
+
+// A whole line between '$' and the end; the time in it if any, else 0.
+static uint64_t nmea_line(char *s, uint32_t len) {
+  const char *star = memchr(s, '*', len);
+  if (!star || (uint32_t)(star - s) + 3u > len) return 0;
+  uint8_t sum = 0;
+  for (const char *p = s; p < star; p++) sum ^= (uint8_t)*p;
+  const int hi = hexval(star[1]), lo = hexval(star[2]);
+  if (hi < 0 || lo < 0 || (uint8_t)((hi << 4) | lo) != sum) {
+    g_stats.nmea_bad++;
+    return 0;
+  }
+  s[star - s] = '\0';
+  const uint64_t t = parse_sentence(s);
+  if (t != 0) g_stats.nmea_ok++;
+  else if (strlen(s) == 5 && (strcmp(s + 2, "RMC") == 0 || strcmp(s + 2, "ZDA") == 0))
+    g_stats.nmea_bad++;
+  return t;
+}
+
+// =========================
+// Pairing
+// =========================
+
+static void feed_pending(uint64_t unix_ms) {
+  telemetry_pps_edge(g_pending_raw, unix_ms);
+  g_pending_raw = 0;
+}
+
+static void on_time(uint64_t unix_s, uint64_t rx_raw) {
+  if (g_pending_raw != 0 && rx_raw - g_pending_raw < 1000000ULL) {
+    feed_pending(unix_s * 1000ULL);
+    return;
+  }
+  // No PPS: the sentence is all there is.
+  if (g_last_edge_raw == 0 ||
+      rx_raw - g_last_edge_raw > GNSS_TIME_PPS_TIMEOUT_MS * 1000ULL)
+    telemetry_set_unix_time_ms(unix_s * 1000ULL);
+}
+
+static void rx_byte(uint8_t b, uint64_t now_raw) {
+  if (b == '$') {
+    g_line_len = 0;
+    return;
+  }
+  if (b == '\r' || b == '\n') {
+    if (g_line_len != 0) {
+      g_line[g_line_len] = '\0';
+      const uint64_t t = nmea_line(g_line, g_line_len);
+      if (t != 0) on_time(t, now_raw);
+    }
+    g_line_len = 0;
+    return;
+  }
+  if (g_line_len < NMEA_MAX - 1u) g_line[g_line_len++] = (char)b;
+  else g_line_len = 0; // too long to be a sentence we want
+}
+
+// Parse up to DMA position `to`.
+static void rx_until(uint16_t to, uint64_t now_raw) {
+  while (g_rx_pos != to) {
+    rx_byte(g_rx_dma[g_rx_pos], now_raw);
+    g_rx_pos = (uint16_t)((g_rx_pos + 1u) & (GNSS_TIME_RX_DMA_SIZE - 1u));
+  }
+}
+
+uint32_t gnss_time_poll(void) {
+  if (!g_ready) return UINT32_MAX;
+
+  uint16_t edge_pos = 0, pos = 0;
+  const uint64_t edge = take_edge(&edge_pos, &pos);
+  const uint64_t now = us_clock_now();
+  const uint32_t mask = GNSS_TIME_RX_DMA_SIZE - 1u;
+  const uint32_t avail = (uint32_t)(pos - g_rx_pos) & mask;
+
+  if (edge != 0) {
+    // Bytes before the edge go to the edge before it; more than the ring
+    // holds between two polls only shows as an edge position out of range.
+    if (((uint32_t)(edge_pos - g_rx_pos) & mask) <= avail) {
+      rx_until(edge_pos, now);
+    } else {
+      g_stats.rx_lapped++;
+      g_rx_pos = edge_pos;
+      g_line_len = 0;
+    }
+    if (g_pending_raw != 0) feed_pending(0); // its sentence never came
+    g_pending_raw = edge;
+  }
+  rx_until(pos, now);
+
+  if (g_pending_raw != 0 && now - g_pending_raw > GNSS_TIME_LABEL_WAIT_MS * 1000ULL)
+    feed_pending(0);
+
+  if (telemetry_unix_is_valid() &&
+      (g_last_announce_raw == 0 ||
+       now - g_last_announce_raw >= GNSS_TIME_ANNOUNCE_MS * 1000ULL)) {
+    if (telemetry_timesync_announce(GNSS_TIME_ANNOUNCE_PRIORITY,
+                                    telemetry_unix_ms()) == SEDS_OK)
+      g_stats.announces++;
+    g_last_announce_raw = now;
+  }
+  return GNSS_TIME_POLL_MS;
+}
+
+void gnss_time_get_stats(gnss_time_stats_t *out) {
+  if (!out) return;
+  *out = g_stats;
+  out->pps_glitches = g_glitches;
+  telemetry_pps_get_stats(&out->pps);
+}
+
+// =========================
+// Init
+// =========================
+
+HAL_StatusTypeDef gnss_time_init(void) {
+  GPIO_InitTypeDef gpio = {0};
+  __HAL_RCC_GPIOA_CLK_ENABLE();
+  gpio.Mode = GPIO_MODE_AF_PP;
+  gpio.Pull = GPIO_PULLDOWN;
+  gpio.Speed = GPIO_SPEED_FREQ_LOW;
+  gpio.Pin = GNSS_TIME_PPS_PIN;
+  gpio.Alternate = GNSS_TIME_PPS_AF;
+  HAL_GPIO_Init(GNSS_TIME_PPS_PORT, &gpio);
+  gpio.Pull = GPIO_PULLUP; // idle high
+  gpio.Pin = GNSS_TIME_RX_PIN;
+  gpio.Alternate = GNSS_TIME_RX_AF;
+  HAL_GPIO_Init(GNSS_TIME_RX_PORT, &gpio);
+
+  __HAL_RCC_DMAMUX1_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+  g_hdma_rx.Instance = GNSS_TIME_RX_DMA_CHANNEL;
+  g_hdma_rx.Init.Request = GNSS_TIME_RX_DMA_REQUEST;
+  g_hdma_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  g_hdma_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+  g_hdma_rx.Init.MemInc = DMA_MINC_ENABLE;
+  g_hdma_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  g_hdma_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  g_hdma_rx.Init.Mode = DMA_CIRCULAR;
+  g_hdma_rx.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&g_hdma_rx) != HAL_OK) return HAL_ERROR;
+
+  // USART2 on PCLK1 (the reset clock selection), receive only. Overrun
+  // detection off: with DMA reading RDR a lost byte is all it could
+  // report, and it would otherwise stop reception.
+  __HAL_RCC_USART2_CLK_ENABLE();
+  USART2->CR1 = 0;
+  const uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+  USART2->BRR = (pclk + GNSS_TIME_BAUDRATE / 2u) / GNSS_TIME_BAUDRATE;
+  USART2->CR2 = 0;
+  USART2->CR3 = USART_CR3_DMAR | USART_CR3_OVRDIS;
+  if (HAL_DMA_Start(&g_hdma_rx, (uint32_t)&USART2->RDR, (uint32_t)g_rx_dma,
+                    GNSS_TIME_RX_DMA_SIZE) != HAL_OK)
+    return HAL_ERROR;
+  USART2->CR1 = USART_CR1_RE | USART_CR1_UE;
+
+  us_clock_set_capture(pps_capture, GNSS_TIME_PPS_FILTER);
+  g_ready = 1;
+  return HAL_OK;
+}
+
+#endif
@@ -0,0 +1,157 @@
+// hdr_comp.c
+//
+// Router header compression (format in hdr_comp.h):
+//  - the encoder finds its stream's context by key, or takes a free one or
+//  the least recently used; a new context, and one past HDR_COMP_REFRESH
+//  packets, starts with a define.
+//  - a packet whose compressed form wouldn't be shorter goes whole and
+//  counts towards the refresh, so a stream whose header has drifted from
+//  the template gets a new one soon.
+//  - the decoder keeps the same table, filled only by defines; it never
+//  needs the key.
+//
+// Notes / Assumptions:
+//  - Nothing about the router's packet layout is assumed: whatever bytes of
+//  the span repeat are saved, so the same code suits any header version.
+//  - Both ends must be built with the same HDR_COMP_CONTEXTS and
+//  HDR_COMP_TEMPLATE_BYTES.
+
+#include "hdr_comp.h"
+#include <string.h>
+
+#define DEFINE_BIT 0x80u
+#define ESCAPE 0xFFu
+#define GENS 15u // 15 would make ctx 7's define the escape
+
+_Static_assert(HDR_COMP_CONTEXTS >= 1u && HDR_COMP_CONTEXTS <= 8u,
+               "HDR_COMP_CONTEXTS must be 1..8");
+_Static_assert(HDR_COMP_TEMPLATE_BYTES >= 1u && HDR_COMP_TEMPLATE_BYTES <= 255u,
+               "HDR_COMP_TEMPLATE_BYTES must fit a byte");
+
+void hdr_comp_reset(hdr_comp_t *c) {
+  memset(c, 0, sizeof(*c));
+}
+
+static size_t put_whole(uint8_t *out, uint8_t ctl, const uint8_t *pkt,
+                        size_t len) {
+  out[0] = HDR_COMP_TAG;
+  out[1] = ctl;
+  memcpy(out + 2, pkt, len);
+  return len + 2u;
+}
+
+static size_t put_raw(const uint8_t *pkt, size_t len, uint8_t *out) {
+  if (pkt[0] == HDR_COMP_TAG) return put_whole(out, ESCAPE, pkt, len);
+  memcpy(out, pkt, len);
+  return len;
+}
+
+static hdr_comp_ctx_t *ctx_for(hdr_comp_t *c, uint16_t key) {
+  hdr_comp_ctx_t *victim = &c->ctx[0];
+  for (size_t i = 0; i < HDR_COMP_CONTEXTS; i++) {
+    hdr_comp_ctx_t *x = &c->ctx[i];
+    if (x->used && x->key == key) return x;
+    if (victim->used && (!x->used || (int32_t)(x->last - victim->last) < 0))
+      victim = x;
+  }
+  victim->key = key;
+  victim->uses = HDR_COMP_REFRESH; // taken over: defined before any use
+  return victim;
+}
+
+static size_t define(hdr_comp_t *c, hdr_comp_ctx_t *x, const uint8_t *pkt,
+                     size_t len, uint8_t *out) {
+  const uint8_t idx = (uint8_t)(x - c->ctx);
+  // Never the generation the decoder may still hold for this context.
+  x->gen = (uint8_t)((x->gen + 1u) % GENS);
+  x->used = 1;
+  x->uses = 0;
+  x->len = (uint8_t)((len < HDR_COMP_TEMPLATE_BYTES) ? len : HDR_COMP_TEMPLATE_BYTES);
+  memcpy(x->tpl, pkt, x->len);
+  return put_whole(out, (uint8_t)(DEFINE_BIT | (idx << 4) | x->gen), pkt, len);
+}
+
+size_t hdr_comp_encode(hdr_comp_t *c, uint16_t key, const uint8_t *pkt,
+                       size_t len, uint8_t *out) {
+  if (len == 0) return 0;
+  if (key == HDR_COMP_NO_KEY || len <= HDR_COMP_MIN_BYTES)
+    return put_raw(pkt, len, out);
+
+  hdr_comp_ctx_t *x = ctx_for(c, key);
+  x->last = ++c->tick;
+  if (!x->used || x->uses >= HDR_COMP_REFRESH) return define(c, x, pkt, len, out);
+
+  const size_t span = (len < x->len) ? len : x->len;
+  const size_t map_len = (span + 7u) / 8u;
+  size_t diff = 0;
+  for (size_t i = 0; i < span; i++) diff += (pkt[i] != x->tpl[i]);
+  x->uses++;
+  if (3u + map_len + diff + (len - span) >= len) return put_raw(pkt, len, out);
+
+  const uint8_t idx = (uint8_t)(x - c->ctx);
+  out[0] = HDR_COMP_TAG;
+  out[1] = (uint8_t)((idx << 4) | x->gen);
+  out[2] = (uint8_t)span;
+  uint8_t *map = out + 3;
+  uint8_t *o = map + map_len;
+  memset(map, 0, map_len);
+  for (size_t i = 0; i < span; i++) {
+    if (pkt[i] == x->tpl[i]) continue;
+    map[i >> 3] |= (uint8_t)(1u << (i & 7u));
+    *o++ = pkt[i];
+  }
+  memcpy(o, pkt + span, len - span);
+  return (size_t)(o - out) + (len - span);
+}
+
+hdr_comp_result_t hdr_comp_decode(hdr_comp_t *c, const uint8_t *in,
+                                  size_t len, uint8_t *buf, size_t cap,
+                                  const uint8_t **pkt, size_t *pkt_len) {
+  if (len == 0 || in[0] != HDR_COMP_TAG) return HDR_COMP_PASS;
+  if (len < 3u) return HDR_COMP_DROP;
+  const uint8_t ctl = in[1];
+  if (ctl == ESCAPE) {
+    *pkt = in + 2;
+    *pkt_len = len - 2u;
+    return HDR_COMP_OK;
+  }
+  const uint8_t idx = (uint8_t)((ctl >> 4) & 7u);
+  const uint8_t gen = (uint8_t)(ctl & 0x0Fu);
+  if (idx >= HDR_COMP_CONTEXTS || gen >= GENS) return HDR_COMP_DROP;
+  hdr_comp_ctx_t *x = &c->ctx[idx];
+
+  if (ctl & DEFINE_BIT) {
+    const size_t n = len - 2u;
+    x->used = 1;
+    x->gen = gen;
+    x->len = (uint8_t)((n < HDR_COMP_TEMPLATE_BYTES) ? n : HDR_COMP_TEMPLATE_BYTES);
+    memcpy(x->tpl, in + 2, x->len);
+    *pkt = in + 2;
+    *pkt_len = n;
+    return HDR_COMP_OK;
+  }
+
+  const size_t span = in[2];
+  const size_t map_len = (span + 7u) / 8u;
+  if (!x->used || x->gen != gen || span > x->len || span == 0 ||
+      3u + map_len > len)
+    return HDR_COMP_DROP;
+  const uint8_t *map = in + 3;
+  const uint8_t *p = map + map_len;
+  const uint8_t *end = in + len;
+  if (span > cap) return HDR_COMP_DROP;
+  for (size_t i = 0; i < span; i++) {
+    if (map[i >> 3] & (1u << (i & 7u))) {
+      if (p == end) return HDR_COMP_DROP;
+      buf[i] = *p++;
+    } else {
+      buf[i] = x->tpl[i];
+    }
+  }
+  const size_t rest = (size_t)(end - p);
+  if (span + rest > cap) return HDR_COMP_DROP;
+  memcpy(buf + span, p, rest);
+  *pkt = buf;
+  *pkt_len = span + rest;
+  return HDR_COMP_OK;
+}
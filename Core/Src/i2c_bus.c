@@ -0,0 +1,423 @@
+// i2c_bus.c
+//
+// I2C2 transaction queue (API in i2c_bus.h):
+//  - a fixed ring of transactions; the head is on the bus while g_busy.
+//  Write-then-read goes out as a sequential transmit (I2C_FIRST_FRAME) and
+//  a sequential receive (I2C_LAST_FRAME), so the read follows a repeated
+//  start on the same address.
+//  - completion callbacks (I2C event / DMA interrupts) run the done
+//  callback, pop the head and start the next one; a queue drains back to
+//  back with no thread involved.
+//  - the bus thread queues periodic devices when due and sleeps to the next
+//  one; it also resets a bus stuck with a transaction past
+//  I2C_BUS_TIMEOUT_MS, clocking SCL to free a slave holding SDA low.
+//
+// Notes / Assumptions:
+//  - The queue is pushed with interrupts masked and popped from the
+//  completion interrupts; I2C_BUS_IRQ_PRIO is the same for all four sources,
+//  so completions never nest.
+//  - Periodic polls are on the 1 ms ThreadX tick: good for hundreds of Hz,
+//  with that much jitter. Each device has at most one poll queued.
+
+#include "i2c_bus.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "us_clock.h"
+#include <string.h>
+
+#ifndef I2C_BUS_QUEUE_LEN
+#define I2C_BUS_QUEUE_LEN 8u
+#endif
+#ifndef I2C_BUS_MAX_DEVICES
+#define I2C_BUS_MAX_DEVICES 8u
+#endif
+// One transaction, start to stop; 32 bytes at 100 kHz take about 3.5 ms.
+#ifndef I2C_BUS_TIMEOUT_MS
+#define I2C_BUS_TIMEOUT_MS 10u
+#endif
+
+#ifndef I2C_BUS_TX_DMA_CHANNEL
+#define I2C_BUS_TX_DMA_CHANNEL DMA1_Channel5 // 2-3: USART1, 4: SD card
+#endif
+#ifndef I2C_BUS_TX_DMA_REQUEST
+#define I2C_BUS_TX_DMA_REQUEST DMA_REQUEST_I2C2_TX
+#endif
+#ifndef I2C_BUS_TX_DMA_IRQn
+#define I2C_BUS_TX_DMA_IRQn DMA1_Channel5_IRQn
+#endif
+#ifndef I2C_BUS_RX_DMA_CHANNEL
+#define I2C_BUS_RX_DMA_CHANNEL DMA1_Channel6
+#endif
+#ifndef I2C_BUS_RX_DMA_REQUEST
+#define I2C_BUS_RX_DMA_REQUEST DMA_REQUEST_I2C2_RX
+#endif
+#ifndef I2C_BUS_RX_DMA_IRQn
+#define I2C_BUS_RX_DMA_IRQn DMA1_Channel6_IRQn
+#endif
+// Below the links and CAN: a sensor read can wait a few microseconds.
+#ifndef I2C_BUS_IRQ_PRIO
+#define I2C_BUS_IRQ_PRIO 8u
+#endif
+
+// Pins for the bus clear (stm32g4xx_hal_msp.c: PA8 SDA, PA9 SCL).
+#ifndef I2C_BUS_GPIO_PORT
+#define I2C_BUS_GPIO_PORT GPIOA
+#endif
+#ifndef I2C_BUS_SDA_PIN
+#define I2C_BUS_SDA_PIN GPIO_PIN_8
+#endif
+#ifndef I2C_BUS_SCL_PIN
+#define I2C_BUS_SCL_PIN GPIO_PIN_9
+#endif
+
+// Above the telemetry stages so polls go out on time; it only queues
+// descriptors, the transfers run in interrupts.
+#define I2C_BUS_THREAD_PRIORITY 3u
+// Stack size: I2C_BUS_THREAD_STACK_SIZE in mem_budget.h.
+// Longest sleep with no devices; i2c_bus_add_device() cuts it short.
+#define I2C_BUS_IDLE_MS 1000u
+
+_Static_assert((I2C_BUS_QUEUE_LEN & (I2C_BUS_QUEUE_LEN - 1u)) == 0,
+               "I2C_BUS_QUEUE_LEN must be a power of two");
+
+typedef struct {
+  i2c_bus_xfer_t x;
+  int8_t dev; // periodic device, -1 for i2c_bus_submit()
+  uint8_t rx[I2C_BUS_RX_MAX];
+} i2c_slot_t;
+
+typedef struct {
+  uint8_t used;
+  volatile uint8_t pending; // a poll is queued or on the bus
+  i2c_bus_xfer_t x;
+  uint32_t period_ms;
+  uint32_t next_ms; // HAL_GetTick() time of the next poll
+} i2c_dev_t;
+
+TX_THREAD i2c_bus_thread;
+static MEM_ARENA(stack) ULONG i2c_bus_thread_stack[I2C_BUS_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static I2C_HandleTypeDef *g_hi2c = NULL;
+static DMA_HandleTypeDef g_hdma_tx;
+static DMA_HandleTypeDef g_hdma_rx;
+
+static i2c_slot_t g_q[I2C_BUS_QUEUE_LEN];
+static uint32_t g_q_head = 0;
+static uint32_t g_q_tail = 0;
+static volatile uint8_t g_busy = 0;
+static uint64_t g_t0_us = 0;    // head transaction start
+static uint32_t g_t0_ms = 0;
+
+static i2c_dev_t g_dev[I2C_BUS_MAX_DEVICES];
+static i2c_bus_stats_t g_stats;
+
+static ULONG ms_ticks(uint32_t ms) {
+  const ULONG t = (ULONG)(((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) /
+                          1000u);
+  return t ? t : 1u;
+}
+
+static int xfer_valid(const i2c_bus_xfer_t *x) {
+  return x && x->addr < 0x80u && x->tx_len <= I2C_BUS_TX_MAX &&
+         x->rx_len <= I2C_BUS_RX_MAX && (x->tx_len || x->rx_len);
+}
+
+// =========================
+// Queue (interrupts masked or completion ISR)
+// =========================
+
+static HAL_StatusTypeDef start(i2c_slot_t *s) {
+  const uint16_t a = (uint16_t)(s->x.addr << 1);
+  if (s->x.tx_len && s->x.rx_len)
+    return HAL_I2C_Master_Seq_Transmit_DMA(g_hi2c, a, s->x.tx, s->x.tx_len,
+                                           I2C_FIRST_FRAME);
+  if (s->x.tx_len)
+    return HAL_I2C_Master_Transmit_DMA(g_hi2c, a, s->x.tx, s->x.tx_len);
+  return HAL_I2C_Master_Receive_DMA(g_hi2c, a, s->rx, s->x.rx_len);
+}
+
+// Report and pop the head.
+static void finish(HAL_StatusTypeDef st) {
+  i2c_slot_t *s = &g_q[g_q_head & (I2C_BUS_QUEUE_LEN - 1u)];
+  if (st == HAL_OK) {
+    g_stats.done++;
+  } else if (st == HAL_TIMEOUT) {
+    g_stats.timeouts++;
+  } else {
+    g_stats.errors++;
+  }
+  if (s->x.done)
+    s->x.done(st, s->rx, st == HAL_OK ? s->x.rx_len : 0u, g_t0_us, s->x.user);
+  if (s->dev >= 0) g_dev[s->dev].pending = 0;
+  g_q_head++;
+  g_busy = 0;
+}
+
+// Start queued transactions until one is on the bus or none are left.
+static void kick(void) {
+  while (!g_busy && g_q_head != g_q_tail) {
+    g_t0_us = us_clock_now();
+    g_t0_ms = HAL_GetTick();
+    g_busy = 1;
+    if (start(&g_q[g_q_head & (I2C_BUS_QUEUE_LEN - 1u)]) != HAL_OK)
+      finish(HAL_ERROR);
+  }
+}
+
+static HAL_StatusTypeDef push(const i2c_bus_xfer_t *x, int8_t dev) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (g_q_tail - g_q_head >= I2C_BUS_QUEUE_LEN) {
+    g_stats.queue_full++;
+    __set_PRIMASK(primask);
+    return HAL_BUSY;
+  }
+  i2c_slot_t *s = &g_q[g_q_tail & (I2C_BUS_QUEUE_LEN - 1u)];
+  s->x = *x;
+  s->dev = dev;
+  g_q_tail++;
+  g_stats.queued++;
+  kick();
+  __set_PRIMASK(primask);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef i2c_bus_submit(const i2c_bus_xfer_t *x) {
+  if (!g_hi2c || !xfer_valid(x)) return HAL_ERROR;
+  return push(x, -1);
+}
+
+// =========================
+// HAL callbacks (I2C / DMA ISR)
+// =========================
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  if (hi2c != g_hi2c || !g_busy) return;
+  i2c_slot_t *s = &g_q[g_q_head & (I2C_BUS_QUEUE_LEN - 1u)];
+  if (s->x.rx_len) {
+    if (HAL_I2C_Master_Seq_Receive_DMA(hi2c, (uint16_t)(s->x.addr << 1),
+                                       s->rx, s->x.rx_len,
+                                       I2C_LAST_FRAME) == HAL_OK)
+      return;
+    finish(HAL_ERROR);
+  } else {
+    finish(HAL_OK);
+  }
+  kick();
+}
+
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  if (hi2c != g_hi2c || !g_busy) return;
+  finish(HAL_OK);
+  kick();
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+  if (hi2c != g_hi2c || !g_busy) return;
+  finish(HAL_ERROR);
+  kick();
+}
+
+void i2c_bus_ev_irq(void) {
+  if (g_hi2c) HAL_I2C_EV_IRQHandler(g_hi2c);
+}
+
+void i2c_bus_er_irq(void) {
+  if (g_hi2c) HAL_I2C_ER_IRQHandler(g_hi2c);
+}
+
+void i2c_bus_dma_tx_irq(void) { HAL_DMA_IRQHandler(&g_hdma_tx); }
+
+void i2c_bus_dma_rx_irq(void) { HAL_DMA_IRQHandler(&g_hdma_rx); }
+
+// =========================
+// Init and recovery
+// =========================
+
+static void irqs_enable(int on) {
+  const IRQn_Type irqs[] = {I2C2_EV_IRQn, I2C2_ER_IRQn, I2C_BUS_TX_DMA_IRQn,
+                            I2C_BUS_RX_DMA_IRQn};
+  for (unsigned i = 0; i < sizeof(irqs) / sizeof(irqs[0]); i++) {
+    if (on) {
+      HAL_NVIC_SetPriority(irqs[i], I2C_BUS_IRQ_PRIO, 0);
+      HAL_NVIC_EnableIRQ(irqs[i]);
+    } else {
+      HAL_NVIC_DisableIRQ(irqs[i]);
+    }
+  }
+}
+
+static void wait_us(uint32_t us) {
+  const uint64_t end = us_clock_now() + us;
+  while (us_clock_now() < end) {
+  }
+}
+
+// Up to nine SCL pulses until the slave lets go of SDA, then a stop.
+static void bus_clear(void) {
+  GPIO_InitTypeDef g = {0};
+  g.Pin = I2C_BUS_SDA_PIN | I2C_BUS_SCL_PIN;
+  g.Mode = GPIO_MODE_OUTPUT_OD;
+  g.Pull = GPIO_NOPULL;
+  g.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_WritePin(I2C_BUS_GPIO_PORT, g.Pin, GPIO_PIN_SET);
+  HAL_GPIO_Init(I2C_BUS_GPIO_PORT, &g);
+  for (unsigned i = 0; i < 9u; i++) {
+    if (HAL_GPIO_ReadPin(I2C_BUS_GPIO_PORT, I2C_BUS_SDA_PIN) == GPIO_PIN_SET)
+      break;
+    HAL_GPIO_WritePin(I2C_BUS_GPIO_PORT, I2C_BUS_SCL_PIN, GPIO_PIN_RESET);
+    wait_us(5);
+    HAL_GPIO_WritePin(I2C_BUS_GPIO_PORT, I2C_BUS_SCL_PIN, GPIO_PIN_SET);
+    wait_us(5);
+  }
+  HAL_GPIO_WritePin(I2C_BUS_GPIO_PORT, I2C_BUS_SDA_PIN, GPIO_PIN_RESET);
+  wait_us(5);
+  HAL_GPIO_WritePin(I2C_BUS_GPIO_PORT, I2C_BUS_SDA_PIN, GPIO_PIN_SET);
+  wait_us(5);
+}
+
+// The head has been on the bus too long: start over from a reset
+// peripheral (HAL_I2C_Init() reruns the MSP pin setup). Bus thread.
+static void recover(void) {
+  irqs_enable(0);
+  (void)HAL_DMA_Abort(&g_hdma_tx);
+  (void)HAL_DMA_Abort(&g_hdma_rx);
+  (void)HAL_I2C_DeInit(g_hi2c);
+  bus_clear();
+  const HAL_StatusTypeDef st = HAL_I2C_Init(g_hi2c);
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (g_busy) finish(HAL_TIMEOUT);
+  if (st == HAL_OK) kick();
+  __set_PRIMASK(primask);
+  irqs_enable(1);
+}
+
+static HAL_StatusTypeDef dma_init(DMA_HandleTypeDef *hdma,
+                                  DMA_Channel_TypeDef *ch, uint32_t request,
+                                  uint32_t dir) {
+  hdma->Instance = ch;
+  hdma->Init.Request = request;
+  hdma->Init.Direction = dir;
+  hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma->Init.MemInc = DMA_MINC_ENABLE;
+  hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma->Init.Mode = DMA_NORMAL;
+  hdma->Init.Priority = DMA_PRIORITY_LOW;
+  return HAL_DMA_Init(hdma);
+}
+
+HAL_StatusTypeDef i2c_bus_init(I2C_HandleTypeDef *hi2c) {
+  if (!hi2c) return HAL_ERROR;
+  __HAL_RCC_DMAMUX1_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  if (dma_init(&g_hdma_tx, I2C_BUS_TX_DMA_CHANNEL, I2C_BUS_TX_DMA_REQUEST,
+               DMA_MEMORY_TO_PERIPH) != HAL_OK ||
+      dma_init(&g_hdma_rx, I2C_BUS_RX_DMA_CHANNEL, I2C_BUS_RX_DMA_REQUEST,
+               DMA_PERIPH_TO_MEMORY) != HAL_OK) {
+    return HAL_ERROR;
+  }
+  __HAL_LINKDMA(hi2c, hdmatx, g_hdma_tx);
+  __HAL_LINKDMA(hi2c, hdmarx, g_hdma_rx);
+  irqs_enable(1);
+  g_hi2c = hi2c;
+  return HAL_OK;
+}
+
+// =========================
+// Periodic devices and the bus thread
+// =========================
+
+int i2c_bus_add_device(const i2c_bus_xfer_t *x, uint32_t period_ms) {
+  if (!xfer_valid(x) || period_ms == 0) return -1;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  int h = -1;
+  for (unsigned i = 0; i < I2C_BUS_MAX_DEVICES; i++) {
+    if (!g_dev[i].used) {
+      g_dev[i].x = *x;
+      g_dev[i].period_ms = period_ms;
+      g_dev[i].next_ms = HAL_GetTick();
+      g_dev[i].pending = 0;
+      g_dev[i].used = 1;
+      h = (int)i;
+      break;
+    }
+  }
+  __set_PRIMASK(primask);
+  // The thread may be sleeping towards a later poll.
+  if (h >= 0) (void)tx_thread_wait_abort(&i2c_bus_thread);
+  return h;
+}
+
+void i2c_bus_remove_device(int handle) {
+  if (handle < 0 || handle >= (int)I2C_BUS_MAX_DEVICES) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_dev[handle].used = 0;
+  __set_PRIMASK(primask);
+}
+
+void i2c_bus_get_stats(i2c_bus_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_stats;
+  __set_PRIMASK(primask);
+}
+
+// Queue the devices that are due; ms to the next one.
+static uint32_t poll_devices(uint32_t now) {
+  uint32_t wait = I2C_BUS_IDLE_MS;
+  for (unsigned i = 0; i < I2C_BUS_MAX_DEVICES; i++) {
+    i2c_dev_t *d = &g_dev[i];
+    if (!d->used) continue;
+    if ((int32_t)(now - d->next_ms) >= 0) {
+      if (d->pending) {
+        g_stats.overruns++;
+      } else {
+        d->pending = 1;
+        if (push(&d->x, (int8_t)i) != HAL_OK) d->pending = 0;
+      }
+      d->next_ms += d->period_ms;
+      // Fell a whole period behind: resume from now rather than burst.
+      if ((int32_t)(now - d->next_ms) >= 0) d->next_ms = now + d->period_ms;
+    }
+    const uint32_t left = d->next_ms - now;
+    if (left < wait) wait = left;
+  }
+  return wait;
+}
+
+void i2c_bus_thread_entry(ULONG initial_input) {
+  (void)initial_input;
+  for (;;) {
+    if (!g_hi2c) {
+      (void)tx_thread_sleep(ms_ticks(I2C_BUS_IDLE_MS));
+      continue;
+    }
+    uint32_t now = HAL_GetTick();
+    if (g_busy && now - g_t0_ms > I2C_BUS_TIMEOUT_MS) {
+      recover();
+      now = HAL_GetTick();
+    }
+    uint32_t wait = poll_devices(now);
+    if (g_busy && wait > I2C_BUS_TIMEOUT_MS) wait = I2C_BUS_TIMEOUT_MS;
+    if (wait) (void)tx_thread_sleep(ms_ticks(wait));
+  }
+}
+
+void create_i2c_bus_thread(void) {
+  const UINT status =
+      tx_thread_create(&i2c_bus_thread, "I2C Bus", i2c_bus_thread_entry, 0,
+                       i2c_bus_thread_stack, I2C_BUS_THREAD_STACK_SIZE,
+                       I2C_BUS_THREAD_PRIORITY, I2C_BUS_THREAD_PRIORITY,
+                       TX_NO_TIME_SLICE, TX_AUTO_START);
+  if (status != TX_SUCCESS) {
+    die("Failed to create I2C bus thread: %u", (unsigned)status);
+  }
+}
@@ -0,0 +1,434 @@
+// isotp.c
+//
+// ISO 15765-2 on top of can_bus: inbound frames arrive through
+// can_bus_subscribe_id() callbacks from can_bus_process_rx(), outbound ones
+// are queued with can_bus_send_bytes_prio(). Both run in the same thread as
+// isotp_poll(), so session state needs no locking.
+//
+// Frame layouts (first byte high nibble = PCI type):
+//   SF  0x0L data...              L = 1..7
+//       0x00 LL data...           FD, LL = 8..62
+//   FF  0x1L LL data...           12-bit length, 62 data bytes
+//       0x10 0x00 L32 data...     longer messages, 58 data bytes
+//   CF  0x2N data...              N = sequence number mod 16, from 1
+//   FC  0x3S BS STmin             S: 0 = continue, 1 = wait, 2 = overflow
+//
+// A sender queues its FF, then waits up to N_Bs for a flow control; each FC
+// allows BS consecutive frames (0 = the rest) spaced at least STmin apart.
+// Sends to a CAN_BUS_PROFILE_CLASSIC tx_id use 8-byte frames (6 data bytes
+// in the FF, 2 escaped, 7 per CF); the profile is looked up per message, so
+// one set by peer discovery (can_peer.h) applies from the next send on.
+
+#include "isotp.h"
+#include "can_bus.h"
+#include "us_clock.h"
+#include <string.h>
+
+#ifndef ISOTP_MAX_SESSIONS
+#define ISOTP_MAX_SESSIONS 4u
+#endif
+// N_Bs (sender waiting for FC) and N_Cr (receiver waiting for a CF).
+#ifndef ISOTP_TIMEOUT_MS
+#define ISOTP_TIMEOUT_MS 1000u
+#endif
+// FC(WAIT) frames accepted in a row before the sender gives up (N_WFTmax).
+#ifndef ISOTP_MAX_WAIT_FC
+#define ISOTP_MAX_WAIT_FC 8u
+#endif
+// Data frames go out in the bulk class; flow control in the command class,
+// so a busy bulk queue can't hold up the peer's sender.
+#ifndef ISOTP_TX_PRIO
+#define ISOTP_TX_PRIO CAN_BUS_TX_PRIO_LOW
+#endif
+#ifndef ISOTP_FC_PRIO
+#define ISOTP_FC_PRIO CAN_BUS_TX_PRIO_MID
+#endif
+
+#define ISOTP_FRAME 64u
+#define ISOTP_FRAME_CLASSIC 8u
+#define ISOTP_SF_MAX_CLASSIC 7u
+#define ISOTP_SF_MAX (ISOTP_FRAME - 2u)
+#define ISOTP_FF_LEN12_MAX 4095u
+
+#define PCI_SF 0x0u
+#define PCI_FF 0x1u
+#define PCI_CF 0x2u
+#define PCI_FC 0x3u
+
+#define FC_CTS 0x0u
+#define FC_WAIT 0x1u
+#define FC_OVFLW 0x2u
+
+enum { ST_IDLE = 0, ST_WAIT_FC, ST_SEND_CF };
+
+typedef struct {
+  isotp_config_t cfg;
+  uint8_t used;
+
+  // Reassembly of the peer's multi-frame message.
+  uint8_t rx_active;
+  uint8_t rx_sn;
+  uint8_t rx_bs_left;
+  uint32_t rx_len;
+  uint32_t rx_pos;
+  uint64_t rx_deadline_us;
+
+  // Our send.
+  uint8_t tx_state;
+  uint8_t tx_sn;
+  uint8_t tx_bs;
+  uint8_t tx_bs_left;
+  uint8_t tx_waits;
+  uint8_t tx_dl;           // frame length of this send, 8 or 64
+  uint32_t tx_gap_us;
+  const uint8_t *tx_data;
+  uint32_t tx_len;
+  uint32_t tx_pos;
+  uint64_t tx_next_us;     // ST_SEND_CF: earliest time for the next CF
+  uint64_t tx_deadline_us; // ST_WAIT_FC: N_Bs expiry
+} isotp_session_t;
+
+static isotp_session_t g_sessions[ISOTP_MAX_SESSIONS];
+static isotp_stats_t g_stats;
+
+static isotp_session_t *session_find(uint16_t rx_id) {
+  for (unsigned i = 0; i < ISOTP_MAX_SESSIONS; i++) {
+    if (g_sessions[i].used && g_sessions[i].cfg.rx_id == rx_id)
+      return &g_sessions[i];
+  }
+  return NULL;
+}
+
+// STmin byte -> microseconds. Reserved values mean the maximum, 127 ms.
+static uint32_t st_min_us(uint8_t st) {
+  if (st <= 0x7Fu)
+    return (uint32_t)st * 1000u;
+  if (st >= 0xF1u && st <= 0xF9u)
+    return (uint32_t)(st - 0xF0u) * 100u;
+  return 127000u;
+}
+
+static HAL_StatusTypeDef send_fc(isotp_session_t *s, uint8_t fs) {
+  const uint8_t fc[3] = {(uint8_t)((PCI_FC << 4) | fs), s->cfg.block_size,
+                         s->cfg.st_min};
+  return can_bus_send_bytes_prio(s->cfg.bus, fc, sizeof(fc), s->cfg.tx_id,
+                                 ISOTP_FC_PRIO);
+}
+
+static void tx_finish(isotp_session_t *s, HAL_StatusTypeDef status) {
+  s->tx_state = ST_IDLE;
+  s->tx_data = NULL;
+  if (status == HAL_OK)
+    g_stats.tx_msgs++;
+  else
+    g_stats.tx_aborted++;
+  if (s->cfg.on_tx_done)
+    s->cfg.on_tx_done(status, s->cfg.user);
+}
+
+static void rx_abort(isotp_session_t *s) {
+  s->rx_active = 0;
+  g_stats.rx_aborted++;
+}
+
+// =========================
+// Receive
+// =========================
+
+static void rx_single(isotp_session_t *s, const uint8_t *d, size_t len) {
+  size_t n = d[0] & 0x0Fu;
+  size_t off = 1;
+  if (n == 0) { // FD escape: length in the second byte
+    if (len < 2)
+      return;
+    n = d[1];
+    off = 2;
+  }
+  if (n == 0 || off + n > len)
+    return;
+  if (s->rx_active) // a new message replaces an unfinished one
+    rx_abort(s);
+  g_stats.rx_msgs++;
+  if (s->cfg.on_rx)
+    s->cfg.on_rx(d + off, n, s->cfg.user);
+}
+
+static void rx_first(isotp_session_t *s, const uint8_t *d, size_t len) {
+  if (len < 8)
+    return; // an FF always fills a full classic frame at least
+  uint32_t total = ((uint32_t)(d[0] & 0x0Fu) << 8) | d[1];
+  size_t off = 2;
+  if (total == 0) {
+    total = ((uint32_t)d[2] << 24) | ((uint32_t)d[3] << 16) |
+            ((uint32_t)d[4] << 8) | d[5];
+    off = 6;
+  }
+  if (s->rx_active)
+    rx_abort(s);
+  if (total <= len - off)
+    return; // would have fit a single frame
+  if (!s->cfg.rx_buf || total > s->cfg.rx_cap) {
+    (void)send_fc(s, FC_OVFLW);
+    g_stats.rx_aborted++;
+    return;
+  }
+
+  memcpy(s->cfg.rx_buf, d + off, len - off);
+  s->rx_len = total;
+  s->rx_pos = (uint32_t)(len - off);
+  s->rx_sn = 1;
+  s->rx_bs_left = s->cfg.block_size;
+  s->rx_deadline_us = us_clock_now() + ISOTP_TIMEOUT_MS * 1000ull;
+  s->rx_active = 1;
+  // If the FC can't be queued the sender times out; that's all we can do.
+  (void)send_fc(s, FC_CTS);
+}
+
+static void rx_consecutive(isotp_session_t *s, const uint8_t *d, size_t len) {
+  if (!s->rx_active)
+    return;
+  if ((d[0] & 0x0Fu) != s->rx_sn) {
+    rx_abort(s);
+    return;
+  }
+  size_t n = len - 1;
+  if (n > s->rx_len - s->rx_pos)
+    n = s->rx_len - s->rx_pos; // padding on the last frame
+  memcpy(s->cfg.rx_buf + s->rx_pos, d + 1, n);
+  s->rx_pos += (uint32_t)n;
+  s->rx_sn = (uint8_t)((s->rx_sn + 1u) & 0x0Fu);
+
+  if (s->rx_pos == s->rx_len) {
+    s->rx_active = 0;
+    g_stats.rx_msgs++;
+    if (s->cfg.on_rx)
+      s->cfg.on_rx(s->cfg.rx_buf, s->rx_len, s->cfg.user);
+    return;
+  }
+  s->rx_deadline_us = us_clock_now() + ISOTP_TIMEOUT_MS * 1000ull;
+  if (s->cfg.block_size && --s->rx_bs_left == 0) {
+    s->rx_bs_left = s->cfg.block_size;
+    (void)send_fc(s, FC_CTS);
+  }
+}
+
+static void rx_flow_control(isotp_session_t *s, const uint8_t *d, size_t len) {
+  if (s->tx_state != ST_WAIT_FC || len < 3)
+    return;
+  switch (d[0] & 0x0Fu) {
+  case FC_CTS:
+    s->tx_bs = d[1];
+    s->tx_bs_left = d[1];
+    s->tx_gap_us = st_min_us(d[2]);
+    s->tx_waits = 0;
+    s->tx_next_us = us_clock_now();
+    s->tx_state = ST_SEND_CF;
+    break;
+  case FC_WAIT:
+    if (++s->tx_waits > ISOTP_MAX_WAIT_FC) {
+      tx_finish(s, HAL_TIMEOUT);
+      break;
+    }
+    s->tx_deadline_us = us_clock_now() + ISOTP_TIMEOUT_MS * 1000ull;
+    break;
+  default: // overflow, or a reserved status
+    tx_finish(s, HAL_ERROR);
+    break;
+  }
+}
+
+static void isotp_on_frame(const uint8_t *data, size_t len, uint64_t ts_us,
+                           void *user) {
+  (void)ts_us;
+  isotp_session_t *s = (isotp_session_t *)user;
+  if (!s || !s->used || !data || len == 0)
+    return;
+  switch (data[0] >> 4) {
+  case PCI_SF:
+    rx_single(s, data, len);
+    break;
+  case PCI_FF:
+    rx_first(s, data, len);
+    break;
+  case PCI_CF:
+    rx_consecutive(s, data, len);
+    break;
+  case PCI_FC:
+    rx_flow_control(s, data, len);
+    break;
+  default:
+    break;
+  }
+}
+
+// =========================
+// Send
+// =========================
+
+HAL_StatusTypeDef isotp_send(uint16_t rx_id, const void *data, size_t len) {
+  isotp_session_t *s = session_find(rx_id);
+  if (!s || !data || len == 0 || (uint64_t)len > 0xFFFFFFFFull)
+    return HAL_ERROR;
+  if (s->tx_state != ST_IDLE)
+    return HAL_BUSY;
+
+  const uint8_t *src = (const uint8_t *)data;
+  uint8_t f[ISOTP_FRAME];
+  const int classic = can_bus_get_peer_profile(s->cfg.bus, s->cfg.tx_id) ==
+                      CAN_BUS_PROFILE_CLASSIC;
+  const size_t dl = classic ? ISOTP_FRAME_CLASSIC : ISOTP_FRAME;
+
+  if (len <= (classic ? ISOTP_SF_MAX_CLASSIC : ISOTP_SF_MAX)) {
+    size_t n;
+    if (len <= ISOTP_SF_MAX_CLASSIC) {
+      f[0] = (uint8_t)((PCI_SF << 4) | len);
+      n = 1;
+    } else {
+      f[0] = PCI_SF << 4;
+      f[1] = (uint8_t)len;
+      n = 2;
+    }
+    memcpy(f + n, src, len);
+    if (can_bus_send_bytes_prio(s->cfg.bus, f, n + len, s->cfg.tx_id,
+                                ISOTP_TX_PRIO) != HAL_OK)
+      return HAL_BUSY;
+    tx_finish(s, HAL_OK);
+    return HAL_OK;
+  }
+
+  size_t take;
+  if (len <= ISOTP_FF_LEN12_MAX) {
+    f[0] = (uint8_t)((PCI_FF << 4) | (len >> 8));
+    f[1] = (uint8_t)len;
+    take = dl - 2u;
+  } else {
+    f[0] = PCI_FF << 4;
+    f[1] = 0;
+    f[2] = (uint8_t)(len >> 24);
+    f[3] = (uint8_t)(len >> 16);
+    f[4] = (uint8_t)(len >> 8);
+    f[5] = (uint8_t)len;
+    take = dl - 6u;
+  }
+  memcpy(f + (dl - take), src, take);
+  if (can_bus_send_bytes_prio(s->cfg.bus, f, dl, s->cfg.tx_id,
+                              ISOTP_TX_PRIO) != HAL_OK)
+    return HAL_BUSY;
+
+  s->tx_data = src;
+  s->tx_len = (uint32_t)len;
+  s->tx_pos = (uint32_t)take;
+  s->tx_sn = 1;
+  s->tx_waits = 0;
+  s->tx_dl = (uint8_t)dl;
+  s->tx_deadline_us = us_clock_now() + ISOTP_TIMEOUT_MS * 1000ull;
+  s->tx_state = ST_WAIT_FC;
+  return HAL_OK;
+}
+
+// Queue the CFs that are due; stops at a full TX ring, the end of a block
+// or an STmin gap.
+static void tx_pump(isotp_session_t *s, uint64_t now) {
+  while (s->tx_state == ST_SEND_CF && now >= s->tx_next_us) {
+    uint8_t f[ISOTP_FRAME];
+    uint32_t n = s->tx_len - s->tx_pos;
+    if (n > s->tx_dl - 1u)
+      n = s->tx_dl - 1u;
+    f[0] = (uint8_t)((PCI_CF << 4) | s->tx_sn);
+    memcpy(f + 1, s->tx_data + s->tx_pos, n);
+    if (can_bus_send_bytes_prio(s->cfg.bus, f, n + 1u, s->cfg.tx_id,
+                                ISOTP_TX_PRIO) != HAL_OK)
+      return; // ring full; retried on the next poll
+    s->tx_pos += n;
+    s->tx_sn = (uint8_t)((s->tx_sn + 1u) & 0x0Fu);
+
+    if (s->tx_pos == s->tx_len) {
+      tx_finish(s, HAL_OK);
+      return;
+    }
+    if (s->tx_bs && --s->tx_bs_left == 0) {
+      s->tx_deadline_us = now + ISOTP_TIMEOUT_MS * 1000ull;
+      s->tx_state = ST_WAIT_FC;
+      return;
+    }
+    s->tx_next_us = now + s->tx_gap_us;
+  }
+}
+
+static uint32_t us_to_ms_ceil(uint64_t us) {
+  const uint64_t ms = (us + 999u) / 1000u;
+  return (ms > UINT32_MAX) ? UINT32_MAX : (uint32_t)ms;
+}
+
+uint32_t isotp_poll(void) {
+  uint32_t next_ms = UINT32_MAX;
+  const uint64_t now = us_clock_now();
+
+  for (unsigned i = 0; i < ISOTP_MAX_SESSIONS; i++) {
+    isotp_session_t *s = &g_sessions[i];
+    if (!s->used)
+      continue;
+
+    if (s->rx_active) {
+      if (now >= s->rx_deadline_us) {
+        rx_abort(s);
+      } else {
+        const uint32_t ms = us_to_ms_ceil(s->rx_deadline_us - now);
+        if (ms < next_ms)
+          next_ms = ms;
+      }
+    }
+
+    if (s->tx_state == ST_WAIT_FC && now >= s->tx_deadline_us)
+      tx_finish(s, HAL_TIMEOUT);
+    tx_pump(s, now);
+
+    uint32_t ms = UINT32_MAX;
+    if (s->tx_state == ST_WAIT_FC)
+      ms = us_to_ms_ceil(s->tx_deadline_us - now);
+    else if (s->tx_state == ST_SEND_CF)
+      // A full ring or a sub-ms STmin: come back on the next tick.
+      ms = (s->tx_next_us > now) ? us_to_ms_ceil(s->tx_next_us - now) : 1u;
+    if (ms < next_ms)
+      next_ms = ms;
+  }
+  return next_ms;
+}
+
+// =========================
+// Sessions
+// =========================
+
+HAL_StatusTypeDef isotp_open(const isotp_config_t *cfg) {
+  if (!cfg || !cfg->bus || cfg->rx_id > 0x7FFu || cfg->tx_id > 0x7FFu ||
+      cfg->rx_id == cfg->tx_id || session_find(cfg->rx_id))
+    return HAL_ERROR;
+
+  isotp_session_t *s = NULL;
+  for (unsigned i = 0; i < ISOTP_MAX_SESSIONS && !s; i++) {
+    if (!g_sessions[i].used)
+      s = &g_sessions[i];
+  }
+  if (!s)
+    return HAL_ERROR;
+
+  memset(s, 0, sizeof(*s));
+  s->cfg = *cfg;
+  if (can_bus_subscribe_id(cfg->bus, cfg->rx_id, isotp_on_frame, s) != HAL_OK)
+    return HAL_ERROR;
+  s->used = 1;
+  return HAL_OK;
+}
+
+void isotp_close(uint16_t rx_id) {
+  isotp_session_t *s = session_find(rx_id);
+  if (!s)
+    return;
+  (void)can_bus_subscribe_id(s->cfg.bus, rx_id, NULL, NULL);
+  s->used = 0;
+}
+
+void isotp_get_stats(isotp_stats_t *out) {
+  if (out)
+    *out = g_stats;
+}
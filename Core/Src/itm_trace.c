@@ -0,0 +1,48 @@
+// itm_trace.c
+//
+// SWO setup for the ITM event trace (itm_trace.h): PB3 as TRACESWO, the
+// TPIU in NRZ mode at ITM_TRACE_SWO_HZ, and the ITM with its two stimulus
+// ports. The events themselves are written by itm_trace_emit() inline.
+//
+// Built only with ITM_TRACE_ENABLED (CMake option ENABLE_ITM_TRACE).
+//
+// Notes / Assumptions:
+//  - The TPIU prescaler divides the core clock (SystemCoreClock at init).
+//  - No local or global ITM timestamps: the records carry DWT->CYCCNT.
+
+#include "itm_trace.h"
+
+#ifdef ITM_TRACE_ENABLED
+
+#include "stm32g4xx_hal.h"
+
+volatile uint32_t g_itm_trace_dropped = 0;
+
+void itm_trace_init(void) {
+  __HAL_RCC_GPIOB_CLK_ENABLE();
+  GPIO_InitTypeDef pin = {0};
+  pin.Pin = GPIO_PIN_3;
+  pin.Mode = GPIO_MODE_AF_PP;
+  pin.Pull = GPIO_NOPULL;
+  pin.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  pin.Alternate = GPIO_AF0_TRACE;
+  HAL_GPIO_Init(GPIOB, &pin);
+
+  DBGMCU->CR |= DBGMCU_CR_TRACE_IOEN; // asynchronous trace, SWO only
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  TPI->SPPR = 2u; // NRZ
+  TPI->ACPR = SystemCoreClock / ITM_TRACE_SWO_HZ - 1u;
+  TPI->FFCR = 0x100u; // continuous formatting off, trigger on
+
+  ITM->LAR = 0xC5ACCE55u;
+  ITM->TCR = (1u << ITM_TCR_TraceBusID_Pos) | ITM_TCR_SYNCENA_Msk |
+             ITM_TCR_ITMENA_Msk;
+  ITM->TPR = 0u; // stimulus ports writable without privilege checks
+  ITM->TER |= 3u << ITM_TRACE_PORT;
+}
+
+uint32_t itm_trace_dropped(void) { return g_itm_trace_dropped; }
+
+#endif
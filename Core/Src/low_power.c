@@ -0,0 +1,284 @@
+// low_power.c
+//
+// Stop 1 idle for the tickless ThreadX idle (low_power.h):
+//  - app_threadx.c asks low_power_stop_setup() before every stretched
+//  sleep. When nothing needs the fast clocks it sets the LPTIM1 compare to
+//  the next ThreadX timer, unmasks the wake lines, stops SysTick and sets
+//  SLEEPDEEP, so the scheduler's WFI becomes a stop.
+//  - low_power_stop_exit() runs right after that WFI: it restarts the PLL
+//  (through AHB/2, as the boost range needs) and HSI48, masks the wake
+//  lines again, notes what woke us and how long the clocks took, and moves
+//  TIM2 on by the time it was stopped. app_threadx.c then counts the
+//  elapsed ThreadX ticks from low_power_stop_take().
+//  - LPTIM1 runs free on LSE/LSI the whole time; only its compare changes.
+//
+// Notes / Assumptions:
+//  - The wake interrupts sit above THREADX_BASEPRI_PRIO, since the idle WFI
+//  runs with BASEPRI raised and a masked wakeup would not end it. Their
+//  handlers only note the source and mask themselves.
+//  - A WFI that returns at once (an interrupt was already pending) leaves
+//  the PLL running; nothing is counted for it.
+//  - FDCAN2 is the only bus checked; its RX pin keeps its alternate
+//  function, EXTI12 sees the edges through the input stage.
+
+#include "low_power.h"
+#include "usb_cdc.h"
+#include "us_clock.h"
+#include "tx_api.h"
+#include <string.h>
+
+#ifdef LOW_POWER_STOP_ENABLED
+
+#ifndef TX_LOW_POWER
+#error "LOW_POWER_STOP_ENABLED needs TX_LOW_POWER (ENABLE_TICKLESS_IDLE)"
+#endif
+
+#define LP_CAN FDCAN2
+#define CAN_WAKE_LINE (1u << 12)           // EXTI12: PB12, FDCAN2_RX
+#define USB_WAKE_LINE (1u << 18)           // EXTI18, direct
+#define LPTIM_WAKE_LINE (1u << (37u - 32u)) // EXTI37 (IMR2), direct
+// Longest stop: LPTIM1 counts 16 bits, leave room for the wakeup itself.
+#define LPTIM_MAX_COUNTS 0xF000u
+
+#define MS_TICKS(ms) \
+  (((uint32_t)(ms) * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u)
+
+volatile uint32_t low_power_can_rx_events = 0;
+
+static uint32_t g_lp_hz = 32000u;
+static uint8_t g_inited = 0;
+static volatile uint8_t g_enabled = LOW_POWER_STOP_DEFAULT;
+static uint8_t g_armed = 0;       // set up, WFI not yet returned
+static uint8_t g_cmp_written = 0; // LPTIM1 CMP write in flight until CMPOK
+static uint16_t g_t_enter = 0;    // LPTIM1 count at setup
+static uint32_t g_tim2_enter = 0; // TIM2 count at setup
+static uint32_t g_hpre = 0;       // AHB prescaler to go back to
+static uint32_t g_elapsed_us = 0; // for low_power_stop_take()
+static volatile uint8_t g_wake_src = 0;
+static uint32_t g_can_seen = 0;
+static ULONG g_can_tick = 0;      // last CAN RX seen by the idle path
+static low_power_stats_t g_stats;
+
+// LPTIM1 runs on its own clock: read until two reads agree.
+static uint16_t lptim_now(void) {
+  uint32_t a, b;
+  do {
+    a = LPTIM1->CNT;
+    b = LPTIM1->CNT;
+  } while (a != b);
+  return (uint16_t)a;
+}
+
+static uint32_t counts_to_us(uint32_t n) {
+  return (uint32_t)(((uint64_t)n * 1000000u) / g_lp_hz);
+}
+
+void low_power_init(void) {
+  RCC->APB1ENR1 |= RCC_APB1ENR1_LPTIM1EN;
+  (void)RCC->APB1ENR1;
+  uint32_t sel;
+  if (RCC->BDCR & RCC_BDCR_LSERDY) {
+    sel = 3u; // LSE, already up for the RTC
+    g_lp_hz = 32768u;
+  } else {
+    RCC->CSR |= RCC_CSR_LSION;
+    while (!(RCC->CSR & RCC_CSR_LSIRDY)) {
+    }
+    sel = 1u;
+    g_lp_hz = 32000u;
+  }
+  MODIFY_REG(RCC->CCIPR, RCC_CCIPR_LPTIM1SEL, sel << RCC_CCIPR_LPTIM1SEL_Pos);
+
+  LPTIM1->CR = 0;
+  LPTIM1->CFGR = 0;                 // internal clock, no prescaler
+  LPTIM1->IER = LPTIM_IER_CMPMIE;   // only while disabled
+  LPTIM1->CR = LPTIM_CR_ENABLE;
+  LPTIM1->ARR = 0xFFFFu;
+  while (!(LPTIM1->ISR & LPTIM_ISR_ARROK)) {
+  }
+  LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+  LPTIM1->CR |= LPTIM_CR_CNTSTRT;
+
+  // FDCAN2_RX edges on EXTI12; the line is unmasked only while stopped.
+  RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+  (void)RCC->APB2ENR;
+  MODIFY_REG(SYSCFG->EXTICR[3], SYSCFG_EXTICR4_EXTI12,
+             SYSCFG_EXTICR4_EXTI12_PB);
+  EXTI->FTSR1 |= CAN_WAKE_LINE;
+
+  HAL_NVIC_SetPriority(LPTIM1_IRQn, LOW_POWER_WAKE_IRQ_PRIO, 0);
+  HAL_NVIC_SetPriority(EXTI15_10_IRQn, LOW_POWER_WAKE_IRQ_PRIO, 0);
+  HAL_NVIC_SetPriority(USBWakeUp_IRQn, LOW_POWER_WAKE_IRQ_PRIO, 0);
+
+  MODIFY_REG(PWR->CR1, PWR_CR1_LPMS, PWR_CR1_LPMS_STOP1);
+  g_can_tick = tx_time_get();
+  g_inited = 1;
+}
+
+void low_power_set_stop(uint8_t on) { g_enabled = on ? 1u : 0u; }
+
+void low_power_get_stats(low_power_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_stats;
+  __set_PRIMASK(primask);
+  out->enabled = g_enabled;
+}
+
+static int stop_allowed(unsigned long ticks) {
+  if (!g_inited || !g_enabled || ticks < MS_TICKS(LOW_POWER_STOP_MIN_MS))
+    return 0;
+  if (!usb_cdc_is_suspended() || us_clock_alarm_pending()) return 0;
+  if (g_cmp_written && !(LPTIM1->ISR & LPTIM_ISR_CMPOK)) return 0;
+
+  // CAN: nothing queued or unread, and quiet for a while.
+  if (LP_CAN->TXBRP != 0 || (LP_CAN->RXF0S & FDCAN_RXF0S_F0FL) ||
+      (LP_CAN->RXF1S & FDCAN_RXF1S_F1FL))
+    return 0;
+  const ULONG now = tx_time_get();
+  const uint32_t seen = low_power_can_rx_events;
+  if (seen != g_can_seen) {
+    g_can_seen = seen;
+    g_can_tick = now;
+    return 0;
+  }
+  if (now - g_can_tick < MS_TICKS(LOW_POWER_CAN_QUIET_MS)) return 0;
+
+  // Transfers in flight stop with the bus clock.
+  static DMA_Channel_TypeDef *const k_dma[] = {
+      DMA1_Channel1, DMA1_Channel2, DMA1_Channel3, DMA1_Channel4,
+      DMA1_Channel5, DMA1_Channel6, DMA1_Channel7, DMA1_Channel8,
+      DMA2_Channel1, DMA2_Channel2, DMA2_Channel3, DMA2_Channel4,
+      DMA2_Channel5, DMA2_Channel6, DMA2_Channel7, DMA2_Channel8,
+  };
+  for (size_t i = 0; i < sizeof(k_dma) / sizeof(k_dma[0]); i++) {
+    if (k_dma[i]->CCR & DMA_CCR_EN) return 0;
+  }
+  return 1;
+}
+
+static void wake_lines(uint8_t on) {
+  static const IRQn_Type k_irqs[] = {LPTIM1_IRQn, EXTI15_10_IRQn,
+                                     USBWakeUp_IRQn};
+  EXTI->PR1 = CAN_WAKE_LINE;
+  LPTIM1->ICR = LPTIM_ICR_CMPMCF;
+  if (on) {
+    EXTI->IMR1 |= CAN_WAKE_LINE | USB_WAKE_LINE;
+    EXTI->IMR2 |= LPTIM_WAKE_LINE;
+  } else {
+    EXTI->IMR1 &= ~(CAN_WAKE_LINE | USB_WAKE_LINE);
+    EXTI->IMR2 &= ~LPTIM_WAKE_LINE;
+  }
+  for (size_t i = 0; i < sizeof(k_irqs) / sizeof(k_irqs[0]); i++) {
+    NVIC_ClearPendingIRQ(k_irqs[i]);
+    if (on) {
+      NVIC_EnableIRQ(k_irqs[i]);
+    } else {
+      NVIC_DisableIRQ(k_irqs[i]);
+    }
+  }
+}
+
+int low_power_stop_setup(unsigned long ticks) {
+  if (!stop_allowed(ticks)) return 0;
+
+  uint64_t counts = ((uint64_t)ticks * g_lp_hz) / TX_TIMER_TICKS_PER_SECOND;
+  if (counts > LPTIM_MAX_COUNTS) counts = LPTIM_MAX_COUNTS;
+  if (counts < 2u) return 0;
+
+  g_t_enter = lptim_now();
+  LPTIM1->ICR = LPTIM_ICR_CMPOKCF | LPTIM_ICR_CMPMCF;
+  LPTIM1->CMP = (uint16_t)(g_t_enter + (uint32_t)counts);
+  g_cmp_written = 1;
+  g_tim2_enter = TIM2->CNT;
+  g_hpre = RCC->CFGR & RCC_CFGR_HPRE;
+  g_wake_src = 0;
+  wake_lines(1);
+
+  SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+  SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+  g_armed = 1;
+  return 1;
+}
+
+// Back to the boot clocks (SystemClock_Config()): PLL from HSI16, which
+// the core woke on, and HSI48 for USB.
+static void clocks_restore(void) {
+  RCC->CR |= RCC_CR_PLLON;
+  RCC->CRRCR |= RCC_CRRCR_HSI48ON;
+  while (!(RCC->CR & RCC_CR_PLLRDY)) {
+  }
+  // Into the boost range through AHB/2 for at least 1 us (RM0440 6.1.5).
+  MODIFY_REG(RCC->CFGR, RCC_CFGR_HPRE, RCC_CFGR_HPRE_DIV2);
+  MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_PLL);
+  while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {
+  }
+  for (volatile uint32_t i = 0; i < 64u; i++) {
+  }
+  MODIFY_REG(RCC->CFGR, RCC_CFGR_HPRE, g_hpre);
+  while (!(RCC->CRRCR & RCC_CRRCR_HSI48RDY)) {
+  }
+}
+
+void low_power_stop_exit(void) {
+  if (!g_armed) return;
+  g_armed = 0;
+  const uint16_t t_wake = lptim_now();
+  SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+  const uint8_t stopped = (RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL;
+  if (stopped) clocks_restore();
+  const uint16_t t_ready = lptim_now();
+
+  uint8_t src = g_wake_src;
+  if (EXTI->PR1 & CAN_WAKE_LINE) src |= LOW_POWER_WAKE_CAN;
+  if (LPTIM1->ISR & LPTIM_ISR_CMPM) src |= LOW_POWER_WAKE_TIMER;
+  if (USB->ISTR & USB_ISTR_WKUP) src |= LOW_POWER_WAKE_USB; // the USB ISR clears it
+  wake_lines(0);
+  g_wake_src = 0;
+
+  g_elapsed_us = counts_to_us((uint16_t)(t_ready - g_t_enter));
+  if (!stopped) return;
+
+  // TIM2 only ran before the stop and during the restart.
+  const uint32_t ran = TIM2->CNT - g_tim2_enter;
+  if (g_elapsed_us > ran) us_clock_advance(g_elapsed_us - ran);
+
+  const uint32_t lat = counts_to_us((uint16_t)(t_ready - t_wake));
+  g_stats.stops++;
+  g_stats.lat_last_us = lat;
+  if (lat > g_stats.lat_max_us) g_stats.lat_max_us = lat;
+  g_stats.stopped_us += g_elapsed_us;
+  if (src & LOW_POWER_WAKE_TIMER) g_stats.wake_timer++;
+  if (src & LOW_POWER_WAKE_CAN) g_stats.wake_can++;
+  if (src & LOW_POWER_WAKE_USB) g_stats.wake_usb++;
+  if (src == 0) g_stats.wake_other++;
+}
+
+uint32_t low_power_stop_take(void) {
+  const uint32_t us = g_elapsed_us;
+  g_elapsed_us = 0;
+  return us;
+}
+
+void low_power_wake_irq(uint8_t source) {
+  g_wake_src |= source;
+  switch (source) {
+  case LOW_POWER_WAKE_TIMER:
+    LPTIM1->ICR = LPTIM_ICR_CMPMCF;
+    NVIC_DisableIRQ(LPTIM1_IRQn);
+    break;
+  case LOW_POWER_WAKE_CAN:
+    EXTI->PR1 = CAN_WAKE_LINE;
+    NVIC_DisableIRQ(EXTI15_10_IRQn);
+    break;
+  case LOW_POWER_WAKE_USB:
+    EXTI->IMR1 &= ~USB_WAKE_LINE; // held high until the USB ISR runs
+    NVIC_DisableIRQ(USBWakeUp_IRQn);
+    break;
+  default:
+    break;
+  }
+}
+
+#endif /* LOW_POWER_STOP_ENABLED */
@@ -0,0 +1,153 @@
+// lz_dict.c
+//
+// LZ77 with a built-in dictionary (API in lz_dict.h):
+//  - positions are counted in one virtual buffer: the dictionary, then the
+//  data. An offset reaching below the data's start reads the dictionary.
+//  - the match finder keeps one candidate per hash of the next 4 bytes;
+//  the dictionary is hashed into the table at the start of every call.
+//  - greedy parse, minimum match 4, matches stop at the end of the data.
+//
+// Notes / Assumptions:
+//  - Changing k_dict changes the wire format: every node on the bus needs
+//  the same one.
+
+#include "lz_dict.h"
+
+#define MIN_MATCH 4u
+
+// Phrases the firmware's error and status text is made of; the most common
+// come last, where the offsets to them are shortest.
+static const char k_dict[] =
+    "invalid argument unsupported configuration not initialized "
+    "checksum mismatch buffer overflow queue full dropped packets "
+    "sensor read of register address device not responding at "
+    "retrying reset watchdog voltage current temperature pressure "
+    "telemetry router CAN bus USB UART I2C SPI SD card flash DMA "
+    "thread mutex semaphore event flags status error code timeout "
+    "Failed to create Failed to init Failed to start Failed to send "
+    "Error: Warning: ";
+
+#define DICT_LEN (sizeof(k_dict) - 1u)
+
+_Static_assert(DICT_LEN >= MIN_MATCH && DICT_LEN < 0x8000u,
+               "dictionary must fit in the offset range");
+
+static inline uint8_t byte_at(const uint8_t *src, size_t p) {
+  return (p < DICT_LEN) ? (uint8_t)k_dict[p] : src[p - DICT_LEN];
+}
+
+static inline uint32_t read4(const uint8_t *src, size_t p) {
+  return (uint32_t)byte_at(src, p) | ((uint32_t)byte_at(src, p + 1u) << 8) |
+         ((uint32_t)byte_at(src, p + 2u) << 16) |
+         ((uint32_t)byte_at(src, p + 3u) << 24);
+}
+
+static inline uint32_t hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32u - LZ_DICT_HASH_BITS);
+}
+
+// Length `n` in the token nibble's extension bytes; 0 if out of room.
+static size_t put_len(uint8_t *dst, size_t o, size_t cap, size_t n) {
+  for (; n >= 255u; n -= 255u) {
+    if (o >= cap) return 0;
+    dst[o++] = 255u;
+  }
+  if (o >= cap) return 0;
+  dst[o++] = (uint8_t)n;
+  return o;
+}
+
+// One sequence: `nlit` literals from `lit`, then a match (mlen 0 = none,
+// the last sequence). Returns the new output position, 0 if out of room.
+static size_t put_seq(uint8_t *dst, size_t o, size_t cap, const uint8_t *lit,
+                      size_t nlit, size_t dist, size_t mlen) {
+  const size_t ml = mlen ? mlen - MIN_MATCH : 0u;
+  if (o >= cap) return 0;
+  dst[o++] = (uint8_t)(((nlit < 15u ? nlit : 15u) << 4) |
+                       (ml < 15u ? ml : 15u));
+  if (nlit >= 15u && !(o = put_len(dst, o, cap, nlit - 15u))) return 0;
+  if (nlit > cap - o) return 0;
+  for (size_t i = 0; i < nlit; i++) dst[o++] = lit[i];
+  if (!mlen) return o;
+  if (cap - o < 2u) return 0;
+  dst[o++] = (uint8_t)dist;
+  dst[o++] = (uint8_t)(dist >> 8);
+  if (ml >= 15u && !(o = put_len(dst, o, cap, ml - 15u))) return 0;
+  return o;
+}
+
+size_t lz_dict_compress(const uint8_t *src, size_t len, uint8_t *dst,
+                        size_t cap, lz_dict_work_t *work) {
+  if (!src || !dst || !work || len + DICT_LEN > 0xFFFFu) return 0;
+  const size_t end = DICT_LEN + len;
+  for (size_t i = 0; i < (1u << LZ_DICT_HASH_BITS); i++)
+    work->head[i] = 0xFFFFu;
+  for (size_t p = 0; p + MIN_MATCH <= DICT_LEN; p++)
+    work->head[hash4(read4(src, p))] = (uint16_t)p;
+
+  size_t o = 0, anchor = DICT_LEN, p = DICT_LEN;
+  while (p + MIN_MATCH <= end) {
+    const uint32_t v = read4(src, p);
+    const uint32_t h = hash4(v);
+    const size_t cand = work->head[h];
+    work->head[h] = (uint16_t)p;
+    if (cand == 0xFFFFu || read4(src, cand) != v) {
+      p++;
+      continue;
+    }
+    size_t mlen = MIN_MATCH;
+    while (p + mlen < end &&
+           byte_at(src, cand + mlen) == byte_at(src, p + mlen))
+      mlen++;
+    o = put_seq(dst, o, cap, &src[anchor - DICT_LEN], p - anchor, p - cand,
+                mlen);
+    if (!o) return 0;
+    // Let later matches find the bytes this one covered, sparsely.
+    for (size_t q = p + 1u; q + MIN_MATCH <= end && q < p + mlen; q += 2u)
+      work->head[hash4(read4(src, q))] = (uint16_t)q;
+    p += mlen;
+    anchor = p;
+  }
+  return put_seq(dst, o, cap, &src[anchor - DICT_LEN], end - anchor, 0, 0);
+}
+
+// Extension bytes after a 15 nibble; false on a truncated stream.
+static int get_len(const uint8_t *src, size_t len, size_t *i, size_t *n) {
+  uint8_t b;
+  do {
+    if (*i >= len) return 0;
+    b = src[(*i)++];
+    *n += b;
+  } while (b == 255u);
+  return 1;
+}
+
+HAL_StatusTypeDef lz_dict_decompress(const uint8_t *src, size_t len,
+                                     uint8_t *dst, size_t cap,
+                                     size_t *out_len) {
+  if (!src || !dst || !out_len) return HAL_ERROR;
+  size_t i = 0, o = 0;
+  while (i < len) {
+    const uint8_t tok = src[i++];
+    size_t nlit = tok >> 4;
+    if (nlit == 15u && !get_len(src, len, &i, &nlit)) return HAL_ERROR;
+    if (nlit > len - i || nlit > cap - o) return HAL_ERROR;
+    for (size_t k = 0; k < nlit; k++) dst[o++] = src[i++];
+    if (i == len) break; // last sequence: literals only
+
+    if (len - i < 2u) return HAL_ERROR;
+    const size_t dist = (size_t)src[i] | ((size_t)src[i + 1u] << 8);
+    i += 2u;
+    size_t mlen = (size_t)(tok & 15u);
+    if (mlen == 15u && !get_len(src, len, &i, &mlen)) return HAL_ERROR;
+    mlen += MIN_MATCH;
+    if (dist == 0 || dist > DICT_LEN + o || mlen > cap - o) return HAL_ERROR;
+    // Overlapping matches repeat, so copy forwards one byte at a time.
+    size_t from = DICT_LEN + o - dist;
+    for (size_t k = 0; k < mlen; k++, from++)
+      dst[o++] = (from < DICT_LEN) ? (uint8_t)k_dict[from]
+                                   : dst[from - DICT_LEN];
+  }
+  *out_len = o;
+  return HAL_OK;
+}
@@ -22,7 +22,26 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "boot_time.h"
+#include "can_bus.h"
+#include "dbg_marker.h"
+#include "fw_update.h"
+#include "itm_trace.h"
+#include "profiler.h"
+#include "us_clock.h"
+#include "rtc_time.h"
+#include "low_power.h"
+#include "i2c_bus.h"
+#include "gnss_time.h"
+#include "mem_budget.h"
+#ifdef SPI_LINK_ENABLED
+#include "spi_link.h"
+#endif
+#ifdef UART_LINK_ENABLED
+#include "uart_link.h"
+#else
+#include "uart_console.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -79,7 +98,10 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+  boot_time_mark(BOOT_MAIN);
+#ifdef TELEMETRY_FAST_BOOT
+  SystemCoreClockUpdate(); /* the PLL is up already; .data reset the value */
+#endif
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -88,14 +110,15 @@ int main(void)
   HAL_Init();
 
   /* USER CODE BEGIN Init */
-
+  boot_time_mark(BOOT_HAL);
   /* USER CODE END Init */
 
   /* Configure the system clock */
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  boot_time_mark(BOOT_CLOCK);
+  fw_update_install(); // resets into a pending update, if there is one
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -106,7 +129,42 @@ int main(void)
   MX_USART1_UART_Init();
   MX_USB_PCD_Init();
   /* USER CODE BEGIN 2 */
-
+  if (us_clock_init() != HAL_OK)
+  {
+    Error_Handler();
+  }
+  (void)rtc_time_init(); // no LSE only means no time across resets
+  low_power_init();      // LPTIM1 takes the LSE when the RTC started it
+  prof_init();
+  itm_trace_init();
+#ifdef UART_LINK_ENABLED
+  if (uart_link_init(&huart1, UART_LINK_BAUDRATE) != HAL_OK)
+#else
+  if (uart_console_init(&huart1, UART_CONSOLE_BAUDRATE) != HAL_OK)
+#endif
+  {
+    Error_Handler();
+  }
+#ifdef SPI_LINK_ENABLED
+  if (spi_link_init() != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
+  mem_budget_print();
+  if (can_bus_init(&hfdcan2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (i2c_bus_init(&hi2c2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (gnss_time_init() != HAL_OK)
+  {
+    Error_Handler();
+  }
+  boot_time_mark(BOOT_DRIVERS);
   /* USER CODE END 2 */
 
   MX_ThreadX_Init();
@@ -135,7 +193,7 @@ void SystemClock_Config(void)
 
   /** Configure the main internal regulator output voltage
   */
-  HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE1);
+  HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE1_BOOST);
 
   /** Initializes the RCC Oscillators according to the specified parameters
   * in the RCC_OscInitTypeDef structure.
@@ -144,7 +202,13 @@ void SystemClock_Config(void)
   RCC_OscInitStruct.HSIState = RCC_HSI_ON;
   RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
   RCC_OscInitStruct.HSI48State = RCC_HSI48_ON;
-  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+  RCC_OscInitStruct.PLL.PLLM = RCC_PLLM_DIV4;
+  RCC_OscInitStruct.PLL.PLLN = 85;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+  RCC_OscInitStruct.PLL.PLLQ = RCC_PLLQ_DIV2;
+  RCC_OscInitStruct.PLL.PLLR = RCC_PLLR_DIV2;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
     Error_Handler();
@@ -154,12 +218,12 @@ void SystemClock_Config(void)
   */
   RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
                               |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
-  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
   RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
   RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
   RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
 
-  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_4) != HAL_OK)
   {
     Error_Handler();
   }
@@ -195,7 +259,7 @@ static void MX_FDCAN2_Init(void)
   hfdcan2.Init.DataSyncJumpWidth = 1;
   hfdcan2.Init.DataTimeSeg1 = 1;
   hfdcan2.Init.DataTimeSeg2 = 1;
-  hfdcan2.Init.StdFiltersNbr = 0;
+  hfdcan2.Init.StdFiltersNbr = 28;
   hfdcan2.Init.ExtFiltersNbr = 0;
   hfdcan2.Init.TxFifoQueueMode = FDCAN_TX_FIFO_OPERATION;
   if (HAL_FDCAN_Init(&hfdcan2) != HAL_OK)
@@ -203,6 +267,14 @@ static void MX_FDCAN2_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN FDCAN2_Init 2 */
+#if defined(TELEMETRY_BENCH) || defined(MICROBENCH_ENABLED)
+  /* Loopback benchmarks: every frame comes straight back to us. */
+  hfdcan2.Init.Mode = FDCAN_MODE_INTERNAL_LOOPBACK;
+  if (HAL_FDCAN_Init(&hfdcan2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
 
   /* USER CODE END FDCAN2_Init 2 */
 
@@ -384,7 +456,7 @@ static void MX_GPIO_Init(void)
   __HAL_RCC_GPIOA_CLK_ENABLE();
 
   /* USER CODE BEGIN MX_GPIO_Init_2 */
-
+  dbg_marker_init();
   /* USER CODE END MX_GPIO_Init_2 */
 }
 
@@ -0,0 +1,40 @@
+// mem_budget.c
+//
+// Boot-time printout of the RAM budget (mem_budget.h):
+//  - the arena regions as budgeted, next to the size the linker gave the
+//  .arena section and where it landed;
+//  - the CCM SRAM use, code and data, against its 16 KB.
+//
+// Notes / Assumptions:
+//  - The linker symbols come from STM32G491XX_FLASH.ld.
+//  - A linked arena smaller than the budget is normal: regions of features
+//  not built in are budgeted but not linked.
+
+#include "mem_budget.h"
+
+#include <stdio.h>
+
+extern uint8_t __arena_start[];
+extern uint8_t __arena_end[];
+extern uint8_t _sccmram[];
+extern uint8_t _eccmnoinit[];
+
+void mem_budget_print(void) {
+  const unsigned long linked =
+      (unsigned long)(__arena_end - __arena_start);
+  printf("mem arena @%p %lu/%lu B: reasm %lu, rust pools %lu, rust heap "
+         "%lu, sample blocks %lu, stacks %lu\r\n",
+         (void *)__arena_start, linked, (unsigned long)MEM_ARENA_BYTES,
+         (unsigned long)MEM_ARENA_REASM_BYTES,
+         (unsigned long)MEM_ARENA_RUST_POOLS_BYTES,
+         (unsigned long)RUST_HEAP_SIZE,
+         (unsigned long)MEM_ARENA_BLOCKS_BYTES,
+         (unsigned long)MEM_ARENA_STACKS_BYTES);
+  printf("mem ccm %lu/%lu B: rx rings %lu\r\n",
+         (unsigned long)(_eccmnoinit - _sccmram),
+         (unsigned long)MEM_BUDGET_CCM_BYTES,
+         (unsigned long)MEM_CCM_RX_RINGS_BYTES);
+  if (linked > MEM_ARENA_BYTES)
+    printf("mem arena over budget by %lu B\r\n",
+           linked - (unsigned long)MEM_ARENA_BYTES);
+}
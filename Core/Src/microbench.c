@@ -0,0 +1,548 @@
+// microbench.c
+//
+// DWT microbenchmark suite; see microbench.h. Built only with
+// MICROBENCH_ENABLED (the gateway_board_bench image, CMake option
+// ENABLE_MICROBENCH).
+//
+//  - every case is a function that sets up, reads DWT->CYCCNT around the
+//  one call under test, cleans up and returns the difference (MB_SKIP when
+//  the call refused). Driver steps that are private to can_bus.c are timed
+//  inside the can_bus_bench_*() hooks.
+//  - the cost of two back-to-back counter reads is measured first and
+//  taken off every sample.
+//  - fragmented RX cases build a three-fragment message (or a one-fragment
+//  one) with the driver's own framing and feed all of it, timing just the
+//  fragment the case names, so no reassembly is left half done.
+//
+// Notes / Assumptions:
+//  - The thread is created before the scheduler starts, above every other
+//  application thread, and nothing before the blocking cases sleeps: the
+//  RX handling cases run while the telemetry RX thread can't, as the
+//  driver requires. The router cases call dispatch_tx_queue() and
+//  process_rx_queue() before the telemetry threads ever have.
+//  - Fragments go to MICROBENCH_CAN_STD_ID, which nothing subscribes to;
+//  completed messages are dropped by can_bus_bench_rx().
+//  - Router log cases send real message packets, to USB too.
+#include "microbench.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "can_bus.h"
+#include "dma_copy.h"
+#include "mem_budget.h"
+#include "telemetry.h"
+#include "telemetry_hooks.h"
+#include "us_clock.h"
+#include "stm32g4xx_hal.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MICROBENCH_ENABLED
+
+// Runs before the timed ones, e.g. to settle the flash accelerator.
+#ifndef MICROBENCH_WARMUP
+#define MICROBENCH_WARMUP 4u
+#endif
+
+// Standard ID the CAN cases send and frame on; no subscriber takes it.
+#ifndef MICROBENCH_CAN_STD_ID
+#define MICROBENCH_CAN_STD_ID 0x6B0u
+#endif
+
+// Let USB come up before the results go out.
+#ifndef MICROBENCH_REPORT_DELAY_MS
+#define MICROBENCH_REPORT_DELAY_MS 3000u
+#endif
+
+// can_bus_send_large() retries with the TX ring full, 1 ms apart.
+#define MICROBENCH_SEND_TRIES 50u
+
+// Below the ThreadX timer thread, above every application thread.
+#define MICROBENCH_PRIORITY 1u
+
+#define MB_SKIP UINT32_MAX
+#define MB_COPY_MAX 1024u
+#define MB_FRAGS_MAX 4u
+#define MB_RX_SINGLE_LEN 32u
+#define MB_RX_MSG_LEN 150u // three fragments with any header layout
+
+typedef uint32_t (*mb_fn_t)(unsigned i, uint32_t arg);
+
+typedef struct {
+    const char *name;
+    mb_fn_t fn;
+    uint32_t arg;
+} mb_case_t;
+
+enum { MB_RX_RAW, MB_RX_SINGLE, MB_RX_FIRST, MB_RX_MIDDLE, MB_RX_LAST };
+
+static TX_THREAD microbench_thread;
+static MEM_ARENA(stack) ULONG microbench_stack[MICROBENCH_STACK_SIZE / sizeof(ULONG)];
+
+static uint8_t g_src[MB_COPY_MAX + 4u] __attribute__((aligned(4)));
+static uint8_t g_dst[MB_COPY_MAX + 4u] __attribute__((aligned(4)));
+static uint8_t g_rec[MB_FRAGS_MAX][CAN_BUS_BENCH_REC_BYTES] __attribute__((aligned(4)));
+static uint32_t g_words[16];
+static uint8_t g_seq;
+static volatile uint32_t g_sink;
+static const char g_text[] = "microbench payload, not telemetry: 64 bytes of ascii text.......";
+_Static_assert(sizeof(g_text) > 64u, "log cases send up to 64 bytes of g_text");
+
+static uint32_t g_overhead;
+static volatile uint8_t g_done;
+
+static uint32_t case_dwt(unsigned i, uint32_t arg)
+{
+    (void)i;
+    (void)arg;
+    const uint32_t t0 = DWT->CYCCNT;
+    return DWT->CYCCNT - t0;
+}
+
+// ---- CAN driver ----
+
+static uint32_t case_rb_push(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t c = can_bus_bench_rb_push(g_words, (uint8_t)len);
+    (void)can_bus_bench_rb_pop();
+    return c;
+}
+
+static uint32_t case_rb_pop(unsigned i, uint32_t len)
+{
+    (void)i;
+    (void)can_bus_bench_rb_push(g_words, (uint8_t)len);
+    return can_bus_bench_rb_pop();
+}
+
+static uint32_t case_rx(unsigned i, uint32_t pattern)
+{
+    (void)i;
+    can_bus_t *b = can_bus_get(TELEMETRY_CAN_BUS);
+    if (pattern == MB_RX_RAW) {
+        can_bus_bench_frame(g_rec[0], MICROBENCH_CAN_STD_ID, g_src, 8u);
+        return can_bus_bench_rx(b, g_rec[0]);
+    }
+    const size_t len = (pattern == MB_RX_SINGLE) ? MB_RX_SINGLE_LEN : MB_RX_MSG_LEN;
+    const uint8_t seq = g_seq++;
+    unsigned cnt = 0;
+    uint8_t wire = 0;
+    while (cnt < MB_FRAGS_MAX) {
+        (void)can_bus_bench_frag(g_rec[cnt], &wire, MICROBENCH_CAN_STD_ID, seq,
+                                 (uint8_t)cnt, g_src, len);
+        if (wire == 0) {
+            break;
+        }
+        cnt++;
+    }
+    if (cnt == 0 || (pattern == MB_RX_MIDDLE && cnt < 3u)) {
+        return MB_SKIP;
+    }
+    const unsigned timed = (pattern == MB_RX_MIDDLE) ? 1u
+                           : (pattern == MB_RX_LAST) ? cnt - 1u
+                                                     : 0u;
+    uint32_t c = 0;
+    for (unsigned k = 0; k < cnt; k++) {
+        const uint32_t ck = can_bus_bench_rx(b, g_rec[k]);
+        if (k == timed) {
+            c = ck;
+        }
+    }
+    return c;
+}
+
+static uint32_t case_frag(unsigned i, uint32_t idx)
+{
+    uint8_t wire;
+    const uint32_t c = can_bus_bench_frag(g_rec[0], &wire, MICROBENCH_CAN_STD_ID,
+                                          (uint8_t)i, (uint8_t)idx, g_src,
+                                          MB_RX_MSG_LEN);
+    return wire ? c : MB_SKIP;
+}
+
+static uint32_t case_send_large(unsigned i, uint32_t len)
+{
+    (void)i;
+    can_bus_t *b = can_bus_get(TELEMETRY_CAN_BUS);
+    for (unsigned t = 0; t < MICROBENCH_SEND_TRIES; t++) {
+        const uint32_t t0 = DWT->CYCCNT;
+        const HAL_StatusTypeDef st =
+            can_bus_send_large(b, g_src, len, MICROBENCH_CAN_STD_ID);
+        const uint32_t c = DWT->CYCCNT - t0;
+        if (st == HAL_OK) {
+            return c;
+        }
+        if (st != HAL_BUSY) {
+            break;
+        }
+        tx_thread_sleep(1);
+    }
+    return MB_SKIP;
+}
+
+// ---- Router heap ----
+
+static uint32_t case_malloc(unsigned i, uint32_t size)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    void *p = telemetryMalloc(size);
+    const uint32_t c = DWT->CYCCNT - t0;
+    if (!p) {
+        return MB_SKIP;
+    }
+    telemetryFree(p);
+    return c;
+}
+
+static uint32_t case_free(unsigned i, uint32_t size)
+{
+    (void)i;
+    void *p = telemetryMalloc(size);
+    if (!p) {
+        return MB_SKIP;
+    }
+    const uint32_t t0 = DWT->CYCCNT;
+    telemetryFree(p);
+    return DWT->CYCCNT - t0;
+}
+
+// ---- Copies ----
+
+static uint32_t case_memcpy(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    memcpy(g_dst, g_src, len);
+    return DWT->CYCCNT - t0;
+}
+
+static uint32_t case_memcpy_unaligned(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    memcpy(g_dst, g_src + 1, len);
+    return DWT->CYCCNT - t0;
+}
+
+static uint32_t case_memmove(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    memmove(g_dst + 4, g_dst, len); // overlapping, copied backwards
+    return DWT->CYCCNT - t0;
+}
+
+static uint32_t case_dma_copy(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    dma_copy(g_dst, g_src, len);
+    return DWT->CYCCNT - t0;
+}
+
+// ---- Clocks, formatting ----
+
+static uint32_t case_now_ms(unsigned i, uint32_t arg)
+{
+    (void)i;
+    (void)arg;
+    const uint32_t t0 = DWT->CYCCNT;
+    g_sink = (uint32_t)telemetry_now_ms();
+    return DWT->CYCCNT - t0;
+}
+
+static uint32_t case_now_us(unsigned i, uint32_t arg)
+{
+    (void)i;
+    (void)arg;
+    const uint32_t t0 = DWT->CYCCNT;
+    g_sink = (uint32_t)telemetry_now_us();
+    return DWT->CYCCNT - t0;
+}
+
+static uint32_t case_us_clock(unsigned i, uint32_t arg)
+{
+    (void)i;
+    (void)arg;
+    const uint32_t t0 = DWT->CYCCNT;
+    g_sink = (uint32_t)us_clock_now();
+    return DWT->CYCCNT - t0;
+}
+
+static uint32_t case_tick(unsigned i, uint32_t arg)
+{
+    (void)i;
+    (void)arg;
+    const uint32_t t0 = DWT->CYCCNT;
+    g_sink = HAL_GetTick();
+    return DWT->CYCCNT - t0;
+}
+
+static int mb_fmt(char *buf, size_t n, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int r = vsnprintf(buf, n, fmt, args);
+    va_end(args);
+    return r;
+}
+
+// A stats line of the kind the maintenance thread logs.
+static uint32_t case_vsnprintf(unsigned i, uint32_t arg)
+{
+    (void)arg;
+    char txt[96];
+    const uint32_t t0 = DWT->CYCCNT;
+    const int n = mb_fmt(txt, sizeof(txt), "can rx=%lu drop=%lu hw=%lu/%lu err=%u",
+                         (unsigned long)i * 977u, (unsigned long)i,
+                         (unsigned long)g_sink, 4096ul, i & 7u);
+    const uint32_t c = DWT->CYCCNT - t0;
+    g_sink = (uint32_t)n;
+    return c;
+}
+
+// ---- Router ----
+
+static uint32_t case_log_async(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    const SedsResult r = log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, g_text, len, 1);
+    const uint32_t c = DWT->CYCCNT - t0;
+    (void)dispatch_tx_queue();
+    return (r == SEDS_OK) ? c : MB_SKIP;
+}
+
+static uint32_t case_log_sync(unsigned i, uint32_t len)
+{
+    (void)i;
+    const uint32_t t0 = DWT->CYCCNT;
+    const SedsResult r = log_telemetry_synchronous(SEDS_DT_MESSAGE_DATA, g_text, len, 1);
+    const uint32_t c = DWT->CYCCNT - t0;
+    return (r == SEDS_OK) ? c : MB_SKIP;
+}
+
+static uint32_t case_dispatch(unsigned i, uint32_t len)
+{
+    (void)i;
+    if (log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, g_text, len, 1) != SEDS_OK) {
+        (void)dispatch_tx_queue();
+        return MB_SKIP;
+    }
+    const uint32_t t0 = DWT->CYCCNT;
+    const SedsResult r = dispatch_tx_queue();
+    const uint32_t c = DWT->CYCCNT - t0;
+    return (r == SEDS_OK) ? c : MB_SKIP;
+}
+
+// Nothing queued: the fixed cost of a pass of the RX thread.
+static uint32_t case_process_rx(unsigned i, uint32_t arg)
+{
+    (void)i;
+    (void)arg;
+    const uint32_t t0 = DWT->CYCCNT;
+    (void)process_rx_queue();
+    return DWT->CYCCNT - t0;
+}
+
+static const mb_case_t g_cases[] = {
+    {"rb_push_8", case_rb_push, 8u},
+    {"rb_push_64", case_rb_push, 64u},
+    {"rb_pop", case_rb_pop, 64u},
+    {"rx_raw", case_rx, MB_RX_RAW},
+    {"rx_single", case_rx, MB_RX_SINGLE},
+    {"rx_first", case_rx, MB_RX_FIRST},
+    {"rx_middle", case_rx, MB_RX_MIDDLE},
+    {"rx_last", case_rx, MB_RX_LAST},
+    {"frag_first", case_frag, 0u},
+    {"frag_middle", case_frag, 1u},
+    {"frag_last", case_frag, 2u},
+    {"malloc_32", case_malloc, 32u},
+    {"malloc_64", case_malloc, 64u},
+    {"malloc_128", case_malloc, 128u},
+    {"malloc_512", case_malloc, 512u},
+    {"malloc_2048", case_malloc, 2048u},
+    {"malloc_4096", case_malloc, 4096u}, // past the classes: byte pool
+    {"free_32", case_free, 32u},
+    {"free_64", case_free, 64u},
+    {"free_128", case_free, 128u},
+    {"free_512", case_free, 512u},
+    {"free_2048", case_free, 2048u},
+    {"free_4096", case_free, 4096u},
+    {"memcpy_64", case_memcpy, 64u},
+    {"memcpy_1024", case_memcpy, 1024u},
+    {"memcpy_1024_unal", case_memcpy_unaligned, 1024u},
+    {"memmove_1020", case_memmove, MB_COPY_MAX - 4u},
+    {"now_ms", case_now_ms, 0},
+    {"now_us", case_now_us, 0},
+    {"us_clock", case_us_clock, 0},
+    {"hal_tick", case_tick, 0},
+    {"vsnprintf", case_vsnprintf, 0},
+    {"log_async_16", case_log_async, 16u},
+    {"log_async_64", case_log_async, 64u},
+    {"log_sync_16", case_log_sync, 16u},
+    {"dispatch_16", case_dispatch, 16u},
+    {"process_rx", case_process_rx, 0},
+    // These may block: other threads run from here on.
+    {"send_large_64", case_send_large, 64u},
+    {"send_large_256", case_send_large, 256u},
+    {"send_large_1024", case_send_large, 1024u},
+    {"dma_copy_1024", case_dma_copy, 1024u},
+};
+#define MB_CASES (sizeof(g_cases) / sizeof(g_cases[0]))
+
+static microbench_result_t g_results[MB_CASES];
+
+static void mb_run(const mb_case_t *k, microbench_result_t *r)
+{
+    for (unsigned w = 0; w < MICROBENCH_WARMUP; w++) {
+        (void)k->fn(w, k->arg);
+    }
+    uint64_t total = 0;
+    memset(r, 0, sizeof(*r));
+    r->name = k->name;
+    r->min = UINT32_MAX;
+    for (unsigned i = 0; i < MICROBENCH_ITERS; i++) {
+        uint32_t c = k->fn(i, k->arg);
+        if (c == MB_SKIP) {
+            r->skipped++;
+            continue;
+        }
+        c = (c > g_overhead) ? c - g_overhead : 0u;
+        r->n++;
+        total += c;
+        if (c < r->min) {
+            r->min = c;
+        }
+        if (c > r->max) {
+            r->max = c;
+        }
+    }
+    if (r->n == 0) {
+        r->min = 0;
+    } else {
+        r->mean = (uint32_t)(total / r->n);
+    }
+}
+
+int microbench_get(unsigned i, microbench_result_t *out)
+{
+    if (!g_done || i >= MB_CASES || !out) {
+        return 0;
+    }
+    *out = g_results[i];
+    return 1;
+}
+
+static ULONG ms_to_ticks(uint32_t ms)
+{
+    const uint64_t t = ((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u;
+    return t ? (ULONG)t : 1u;
+}
+
+static void mb_line(const char *txt, int n)
+{
+    if (n <= 0) {
+        return;
+    }
+    printf("%s\r\n", txt);
+    // The intake ring takes a few lines at a time; give the TX thread a tick.
+    for (unsigned t = 0; t < 10u; t++) {
+        if (log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1) !=
+            TELEMETRY_WOULD_BLOCK) {
+            break;
+        }
+        tx_thread_sleep(1);
+    }
+}
+
+// The case as a result record; the USB IN buffer takes a few at a time.
+static void mb_record(const microbench_result_t *r)
+{
+    const uint32_t m[] = {r->n, r->min, r->mean, r->max, r->skipped};
+    for (unsigned t = 0; t < 10u; t++) {
+        if (telemetry_result_record(TELEMETRY_RESULT_SRC_MICRO, r->name, m,
+                                    sizeof(m) / sizeof(m[0])) != HAL_BUSY) {
+            break;
+        }
+        tx_thread_sleep(1);
+    }
+}
+
+void microbench_report(void)
+{
+    if (!g_done) {
+        return;
+    }
+    char txt[112];
+    int n = snprintf(txt, sizeof(txt), "mb suite clk=%luMHz iters=%u dwt=%lu",
+                     (unsigned long)(SystemCoreClock / 1000000u),
+                     (unsigned)MICROBENCH_ITERS, (unsigned long)g_overhead);
+    mb_line(txt, (n < (int)sizeof(txt)) ? n : (int)sizeof(txt) - 1);
+    for (unsigned i = 0; i < MB_CASES; i++) {
+        const microbench_result_t *r = &g_results[i];
+        n = snprintf(txt, sizeof(txt), "mb %s n=%lu min=%lu mean=%lu max=%lu skip=%lu",
+                     r->name, (unsigned long)r->n, (unsigned long)r->min,
+                     (unsigned long)r->mean, (unsigned long)r->max,
+                     (unsigned long)r->skipped);
+        mb_line(txt, (n < (int)sizeof(txt)) ? n : (int)sizeof(txt) - 1);
+        mb_record(r);
+    }
+}
+
+static void microbench_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    for (unsigned i = 0; i < sizeof(g_src); i++) {
+        g_src[i] = (uint8_t)(i * 7u + 1u);
+    }
+    for (unsigned i = 0; i < sizeof(g_words) / sizeof(g_words[0]); i++) {
+        g_words[i] = 0x01010101u * i;
+    }
+
+    g_overhead = UINT32_MAX;
+    for (unsigned i = 0; i < MICROBENCH_ITERS; i++) {
+        const uint32_t c = case_dwt(i, 0);
+        if (c < g_overhead) {
+            g_overhead = c;
+        }
+    }
+    for (unsigned i = 0; i < MB_CASES; i++) {
+        mb_run(&g_cases[i], &g_results[i]);
+    }
+    g_done = 1;
+
+    tx_thread_sleep(ms_to_ticks(MICROBENCH_REPORT_DELAY_MS));
+    microbench_report();
+}
+
+void create_microbench_thread(void)
+{
+    const UINT status = tx_thread_create(&microbench_thread,
+                                         "Microbench",
+                                         microbench_thread_entry,
+                                         0,
+                                         microbench_stack,
+                                         MICROBENCH_STACK_SIZE,
+                                         MICROBENCH_PRIORITY,
+                                         MICROBENCH_PRIORITY,
+                                         TX_NO_TIME_SLICE,
+                                         TX_AUTO_START);
+    if (status != TX_SUCCESS) {
+        die("Failed to create microbench thread: %u", (unsigned)status);
+    }
+}
+
+#else
+
+void create_microbench_thread(void)
+{
+}
+
+#endif /* MICROBENCH_ENABLED */
@@ -0,0 +1,131 @@
+// pc_sample.c
+//
+// TIM7 sampler behind pc_sample.h. The handler stub in stm32g4xx_it.c picks
+// the stack the interrupted context pushed its frame on (EXC_RETURN bit 2)
+// and passes the frame here; the stacked PC, LR and xPSR are words 6, 5
+// and 7 of it, basic or extended (FPU) frame alike.
+//
+// Notes / Assumptions:
+//  - The ring is single producer (this ISR) and single consumer
+//  (pc_sample_read()); a full ring drops the new sample.
+//  - The timer counts microseconds; each period is reloaded with the base
+//  period plus 0..PC_SAMPLE_DITHER_US from an xorshift generator. ARR isn't
+//  preloaded, so the value written in the ISR is the period under way.
+
+#include "pc_sample.h"
+
+#if defined(__ARMCC_VERSION) || defined(__GNUC__) || defined(__ICCARM__)
+#include "cmsis_compiler.h"
+#endif
+
+#ifndef PC_SAMPLE_TIM
+#define PC_SAMPLE_TIM TIM7
+#define PC_SAMPLE_CLK_ENABLE() __HAL_RCC_TIM7_CLK_ENABLE()
+#define PC_SAMPLE_IRQn TIM7_IRQn
+#endif
+// Above everything but FDCAN2 IT0 (also 0), so ISRs get sampled too. No
+// kernel calls: it runs above the ThreadX BASEPRI mask.
+#ifndef PC_SAMPLE_IRQ_PRIO
+#define PC_SAMPLE_IRQ_PRIO 0u
+#endif
+#ifndef PC_SAMPLE_DITHER_US
+#define PC_SAMPLE_DITHER_US 15u // a power of two minus one
+#endif
+
+#if (PC_SAMPLE_RECORDS & (PC_SAMPLE_RECORDS - 1u)) != 0u
+#error "PC_SAMPLE_RECORDS must be a power of two"
+#endif
+#if (PC_SAMPLE_DITHER_US & (PC_SAMPLE_DITHER_US + 1u)) != 0u
+#error "PC_SAMPLE_DITHER_US must be a power of two minus one"
+#endif
+
+static pc_sample_t g_ring[PC_SAMPLE_RECORDS];
+static volatile uint32_t g_head = 0; // samples recorded (ISR)
+static volatile uint32_t g_tail = 0; // samples read (thread)
+static volatile uint32_t g_dropped = 0;
+static uint32_t g_arr_base = 0;
+static uint32_t g_rng = 0x2545F491u;
+static volatile uint32_t g_hz = 0;
+
+void pc_sample_irq(const uint32_t *frame) {
+  PC_SAMPLE_TIM->SR = (uint32_t)~TIM_SR_UIF;
+  uint32_t x = g_rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  g_rng = x;
+  PC_SAMPLE_TIM->ARR = g_arr_base + (x & PC_SAMPLE_DITHER_US);
+
+  const uint32_t head = g_head;
+  if (head - g_tail >= PC_SAMPLE_RECORDS) {
+    g_dropped++;
+    return;
+  }
+  pc_sample_t *s = &g_ring[head & (PC_SAMPLE_RECORDS - 1u)];
+  s->pc = (frame[6] & ~1u) |
+          (((frame[7] & 0x1FFu) != 0u) ? PC_SAMPLE_IN_HANDLER : 0u);
+  s->lr = frame[5];
+  __DMB(); // the sample before its publication (release)
+  g_head = head + 1u;
+}
+
+HAL_StatusTypeDef pc_sample_start(uint32_t hz) {
+  if (hz == 0) hz = PC_SAMPLE_DEFAULT_HZ;
+  if (hz > PC_SAMPLE_MAX_HZ) return HAL_ERROR;
+  // APB1 timers run at 2x PCLK1 unless the APB1 prescaler is 1.
+  uint32_t clk = HAL_RCC_GetPCLK1Freq();
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) clk *= 2u;
+  if (clk < 1000000u || (clk % 1000000u) != 0u) return HAL_ERROR;
+  const uint32_t psc = clk / 1000000u - 1u;
+  if (psc > 0xFFFFu) return HAL_ERROR;
+
+  pc_sample_stop();
+  const uint32_t period = 1000000u / hz; // mean period with the dither
+  g_arr_base = period - 1u - PC_SAMPLE_DITHER_US / 2u;
+  g_head = 0;
+  g_tail = 0;
+  g_dropped = 0;
+
+  PC_SAMPLE_CLK_ENABLE();
+  PC_SAMPLE_TIM->CR1 = 0;
+  PC_SAMPLE_TIM->PSC = psc;
+  PC_SAMPLE_TIM->ARR = g_arr_base;
+  PC_SAMPLE_TIM->CNT = 0;
+  PC_SAMPLE_TIM->EGR = TIM_EGR_UG; // latch PSC
+  PC_SAMPLE_TIM->SR = 0;
+  PC_SAMPLE_TIM->DIER = TIM_DIER_UIE;
+  HAL_NVIC_SetPriority(PC_SAMPLE_IRQn, PC_SAMPLE_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(PC_SAMPLE_IRQn);
+  g_hz = hz;
+  PC_SAMPLE_TIM->CR1 = TIM_CR1_CEN;
+  return HAL_OK;
+}
+
+void pc_sample_stop(void) {
+  if (!g_hz) return;
+  PC_SAMPLE_TIM->CR1 = 0;
+  PC_SAMPLE_TIM->DIER = 0;
+  HAL_NVIC_DisableIRQ(PC_SAMPLE_IRQn);
+  HAL_NVIC_ClearPendingIRQ(PC_SAMPLE_IRQn);
+  g_hz = 0;
+}
+
+size_t pc_sample_read(pc_sample_t *out, size_t max, uint32_t *seq) {
+  uint32_t tail = g_tail;
+  const uint32_t head = g_head;
+  __DMB(); // see the samples after their publication (acquire)
+  if (seq) *seq = tail;
+  size_t n = 0;
+  for (; n < max && tail != head; n++, tail++)
+    out[n] = g_ring[tail & (PC_SAMPLE_RECORDS - 1u)];
+  __DMB(); // done reading before the ISR may reuse the slots
+  g_tail = tail;
+  return n;
+}
+
+void pc_sample_get_stats(pc_sample_stats_t *out) {
+  if (!out) return;
+  out->taken = g_head;
+  out->dropped = g_dropped;
+  out->hz = g_hz;
+}
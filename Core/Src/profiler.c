@@ -0,0 +1,156 @@
+// profiler.c
+//
+// Cycle-accurate probes on the Cortex-M4 DWT cycle counter. Each probe keeps
+// count/min/max/total and a log2 histogram of cycle counts. Samples are
+// recorded with IRQs masked for a few instructions so ISR and thread probes
+// can share the table.
+//
+// Built only with PROFILING_ENABLED (CMake option ENABLE_PROFILING).
+
+#include "profiler.h"
+
+#ifdef PROFILING_ENABLED
+
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static prof_stats_t g_prof[PROF_COUNT];
+static volatile uint8_t g_prof_on = 1;
+
+static const char *const g_prof_names[PROF_COUNT] = {
+    [PROF_CAN_RX_ISR] = "can_rx_isr",
+    [PROF_CAN_RB_PUSH] = "can_rb_push",
+    [PROF_CAN_HANDLE_FRAME] = "can_handle_frame",
+    [PROF_CAN_SEND_LARGE] = "can_send_large",
+    [PROF_ROUTER_PROCESS] = "router_process",
+    [PROF_TX_SEND] = "tx_send",
+    [PROF_CAN_TX_WIRE] = "can_tx_wire",
+};
+
+void prof_reset(void) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  memset(g_prof, 0, sizeof(g_prof));
+  for (unsigned i = 0; i < PROF_COUNT; i++) {
+    g_prof[i].min = UINT32_MAX;
+  }
+  __set_PRIMASK(primask);
+}
+
+void prof_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  prof_reset();
+}
+
+int prof_set_enabled(int on) {
+  g_prof_on = on ? 1u : 0u;
+  return 0;
+}
+
+static inline unsigned prof_bin(uint32_t cycles) {
+  if (cycles == 0)
+    return 0;
+  unsigned bin = 32u - (unsigned)__builtin_clz(cycles);
+  return (bin >= PROF_HIST_BINS) ? (PROF_HIST_BINS - 1u) : bin;
+}
+
+void prof_record(prof_probe_t probe, uint32_t cycles) {
+  if ((unsigned)probe >= PROF_COUNT || !g_prof_on)
+    return;
+  const unsigned bin = prof_bin(cycles);
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  prof_stats_t *s = &g_prof[probe];
+  s->count++;
+  s->total += cycles;
+  if (cycles < s->min)
+    s->min = cycles;
+  if (cycles > s->max)
+    s->max = cycles;
+  s->hist[bin]++;
+  __set_PRIMASK(primask);
+}
+
+void prof_get(prof_probe_t probe, prof_stats_t *out) {
+  if (!out || (unsigned)probe >= PROF_COUNT)
+    return;
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_prof[probe];
+  __set_PRIMASK(primask);
+}
+
+const char *prof_name(prof_probe_t probe) {
+  return ((unsigned)probe < PROF_COUNT) ? g_prof_names[probe] : "?";
+}
+
+// Cycles -> nanoseconds at the current core clock.
+static uint32_t prof_cycles_to_ns(uint64_t cycles) {
+  const uint32_t mhz = SystemCoreClock / 1000000u;
+  return mhz ? (uint32_t)((cycles * 1000u) / mhz) : 0u;
+}
+
+int prof_format(prof_probe_t probe, char *buf, size_t len) {
+  if (!buf || len == 0)
+    return -1;
+
+  prof_stats_t s;
+  prof_get(probe, &s);
+
+  const uint64_t mean = s.count ? (s.total / s.count) : 0;
+  int n = snprintf(buf, len, "prof %s n=%lu min=%luns mean=%luns max=%luns h=",
+                   prof_name(probe), (unsigned long)s.count,
+                   (unsigned long)(s.count ? prof_cycles_to_ns(s.min) : 0),
+                   (unsigned long)prof_cycles_to_ns(mean),
+                   (unsigned long)prof_cycles_to_ns(s.max));
+
+  // Only non-empty bins: "<bin>:<count>"; bin k is < 2^k cycles.
+  for (unsigned i = 0; i < PROF_HIST_BINS && n > 0 && (size_t)n < len; i++) {
+    if (s.hist[i] == 0)
+      continue;
+    n += snprintf(buf + n, len - (size_t)n, "%u:%lu ", i,
+                  (unsigned long)s.hist[i]);
+  }
+  if (n > 0 && (size_t)n >= len)
+    n = (int)len - 1;
+  return n;
+}
+
+void prof_dump_printf(void) {
+  char line[192];
+  for (unsigned i = 0; i < PROF_COUNT; i++) {
+    if (prof_format((prof_probe_t)i, line, sizeof(line)) > 0)
+      printf("%s\r\n", line);
+  }
+}
+
+// One probe as a result record: count, min/mean/max in ns, histogram.
+static void prof_record_result(prof_probe_t probe) {
+  prof_stats_t s;
+  prof_get(probe, &s);
+  if (s.count == 0)
+    return;
+  uint32_t m[4u + PROF_HIST_BINS] = {
+      s.count, prof_cycles_to_ns(s.min), prof_cycles_to_ns(s.total / s.count),
+      prof_cycles_to_ns(s.max)};
+  memcpy(&m[4], s.hist, sizeof(s.hist));
+  (void)telemetry_result_record(TELEMETRY_RESULT_SRC_PROFILER,
+                                prof_name(probe), m, sizeof(m) / sizeof(m[0]));
+}
+
+void prof_report_telemetry(void) {
+  char line[192];
+  for (unsigned i = 0; i < PROF_COUNT; i++) {
+    const int n = prof_format((prof_probe_t)i, line, sizeof(line));
+    if (n > 0)
+      (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, line, (size_t)n,
+                                       1);
+    prof_record_result((prof_probe_t)i);
+  }
+}
+
+#endif // PROFILING_ENABLED
@@ -0,0 +1,217 @@
+// proto_timer.c
+//
+// Hierarchical timer wheel (proto_timer.h):
+//  - g_next is the next tick to process. A timer goes into level 0 when it
+//  is due within 64 ticks of g_next, else into the lowest level l whose
+//  span (64^(l+1)) covers it, at slot (expires >> 6l) & 63. Each slot is a
+//  doubly linked list with a back-pointer, so unlinking needs no search.
+//  - processing tick g_next: at a 64-boundary the level 1 slot for the new
+//  block is re-placed into level 0 (and level 2 into 1 at a 4096-boundary,
+//  ...), then level 0's slot for the tick fires.
+//  - one bit per non-empty slot and level: polls skip the level 0 slots
+//  that are empty up to the next cascade, and the next deadline comes from
+//  the first set bit after the current slot of each level.
+//
+// Notes / Assumptions:
+//  - Single-threaded by contract (proto_timer.h); nothing is locked.
+//  - A due slot is moved onto a local list before its callbacks run, so a
+//  callback may arm or cancel any timer, including others on that list
+//  (their bucket is PT_BUCKET_RUN, which touches no slot bit).
+//  - The wheel starts at the first arm or poll. HAL_GetTick() wraps after
+//  49 days; deadlines compare as signed differences, as elsewhere.
+
+#include "proto_timer.h"
+#include "stm32g4xx_hal.h"
+#include <string.h>
+
+#define PT_BITS 6u
+#define PT_SLOTS (1u << PT_BITS)
+#define PT_MASK (PT_SLOTS - 1u)
+#define PT_SPAN (1ul << (PT_BITS * PROTO_TIMER_LEVELS))
+#define PT_BUCKET_RUN 0xFFFFu // on the list being fired
+
+_Static_assert(PROTO_TIMER_LEVELS >= 1u && PROTO_TIMER_LEVELS <= 5u,
+               "wheel span must fit a signed 32-bit tick difference");
+
+static proto_timer_t *g_slot[PROTO_TIMER_LEVELS][PT_SLOTS];
+static proto_timer_t *g_due; // armed with a deadline already processed
+static uint64_t g_used[PROTO_TIMER_LEVELS];
+static uint32_t g_next;
+static uint8_t g_started;
+static proto_timer_stats_t g_stats;
+
+static void start(void) {
+  if (!g_started) {
+    g_next = HAL_GetTick();
+    g_started = 1;
+  }
+}
+
+static void slot_link(proto_timer_t **head, proto_timer_t *t) {
+  t->next = *head;
+  if (t->next)
+    t->next->pprev = &t->next;
+  *head = t;
+  t->pprev = head;
+}
+
+static void slot_unlink(proto_timer_t *t) {
+  *t->pprev = t->next;
+  if (t->next)
+    t->next->pprev = t->pprev;
+  if (t->bucket != PT_BUCKET_RUN) {
+    const unsigned lvl = t->bucket >> PT_BITS, idx = t->bucket & PT_MASK;
+    if (!g_slot[lvl][idx])
+      g_used[lvl] &= ~(1ull << idx);
+  }
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+static void place(proto_timer_t *t) {
+  uint32_t delta = t->expires_ms - g_next;
+  if ((int32_t)delta < 0) {
+    slot_link(&g_due, t);
+    t->bucket = PT_BUCKET_RUN;
+    return;
+  }
+  if (delta >= PT_SPAN) {
+    delta = PT_SPAN - 1u;
+    t->expires_ms = g_next + delta;
+  }
+  unsigned lvl = 0;
+  while (delta >= (1ul << (PT_BITS * (lvl + 1u))))
+    lvl++;
+  const unsigned idx = (t->expires_ms >> (PT_BITS * lvl)) & PT_MASK;
+  slot_link(&g_slot[lvl][idx], t);
+  g_used[lvl] |= 1ull << idx;
+  t->bucket = (uint16_t)((lvl << PT_BITS) | idx);
+}
+
+void proto_timer_init(proto_timer_t *t, proto_timer_fn_t fn, void *user) {
+  memset(t, 0, sizeof(*t));
+  t->fn = fn;
+  t->user = user;
+}
+
+void proto_timer_arm(proto_timer_t *t, uint32_t expires_ms) {
+  start();
+  if (t->pprev)
+    slot_unlink(t);
+  else
+    g_stats.armed++;
+  t->expires_ms = expires_ms;
+  place(t);
+}
+
+void proto_timer_cancel(proto_timer_t *t) {
+  if (!t->pprev)
+    return;
+  slot_unlink(t);
+  g_stats.armed--;
+}
+
+// Re-place the timers of slot `idx` at `lvl`, one level finer or more.
+static void cascade(unsigned lvl, unsigned idx) {
+  proto_timer_t *t = g_slot[lvl][idx];
+  g_slot[lvl][idx] = NULL;
+  g_used[lvl] &= ~(1ull << idx);
+  while (t) {
+    proto_timer_t *const n = t->next;
+    place(t);
+    g_stats.cascaded++;
+    t = n;
+  }
+}
+
+// Tick at which the earliest timer fires or its slot cascades.
+static uint32_t next_tick(void) {
+  uint32_t best = UINT32_MAX; // as distance from g_next
+  for (unsigned lvl = 0; lvl < PROTO_TIMER_LEVELS; lvl++) {
+    const uint64_t used = g_used[lvl];
+    if (!used)
+      continue;
+    const unsigned shift = PT_BITS * lvl;
+    const unsigned cur = (g_next >> shift) & PT_MASK;
+    uint64_t rot = cur ? (used >> cur) | (used << (PT_SLOTS - cur)) : used;
+    uint32_t dist;
+    if (lvl == 0) {
+      dist = (uint32_t)__builtin_ctzll(rot);
+    } else {
+      // The current slot holds this block's timers only until its cascade
+      // at the block start; past that, ones a full turn ahead.
+      if ((g_next & ((1ul << shift) - 1u)) != 0)
+        rot = (rot >> 1) | (1ull << (PT_SLOTS - 1u));
+      const uint32_t d = (uint32_t)__builtin_ctzll(rot) +
+                         ((g_next & ((1ul << shift) - 1u)) != 0 ? 1u : 0u);
+      dist = (((g_next >> shift) + d) << shift) - g_next;
+    }
+    if (dist < best)
+      best = dist;
+  }
+  return g_next + best;
+}
+
+// Fire the timers on `head`, which is off the wheel.
+static void fire_list(proto_timer_t *head) {
+  head->pprev = &head;
+  for (proto_timer_t *t = head; t; t = t->next)
+    t->bucket = PT_BUCKET_RUN;
+  while (head) {
+    proto_timer_t *const t = head;
+    slot_unlink(t);
+    g_stats.armed--;
+    g_stats.fired++;
+    t->fn(t, t->user);
+  }
+}
+
+uint32_t proto_timer_poll(void) {
+  start();
+  const uint32_t now = HAL_GetTick();
+  if (g_due) {
+    proto_timer_t *const due = g_due;
+    g_due = NULL; // ones armed overdue from here on wait for the next poll
+    fire_list(due);
+  }
+  while ((int32_t)(now - g_next) >= 0) {
+    if (g_stats.armed == 0) {
+      g_next = now + 1u;
+      break;
+    }
+    const unsigned idx = g_next & PT_MASK;
+    if (idx == 0) {
+      for (unsigned lvl = 1; lvl < PROTO_TIMER_LEVELS; lvl++) {
+        const unsigned li = (g_next >> (PT_BITS * lvl)) & PT_MASK;
+        cascade(lvl, li);
+        if (li != 0)
+          break;
+      }
+    }
+    if (!g_used[0]) {
+      // Nothing at level 0: straight to the next cascade, or past `now`.
+      const uint32_t skip = PT_SLOTS - idx;
+      const uint32_t left = now - g_next + 1u;
+      g_next += (skip < left) ? skip : left;
+      continue;
+    }
+    g_next++;
+    proto_timer_t *head = g_slot[0][idx];
+    if (!head)
+      continue;
+    g_slot[0][idx] = NULL;
+    g_used[0] &= ~(1ull << idx);
+    fire_list(head);
+  }
+  if (g_stats.armed == 0)
+    return UINT32_MAX;
+  if (g_due)
+    return 0;
+  const int32_t wait = (int32_t)(next_tick() - now);
+  return (wait > 0) ? (uint32_t)wait : 0u;
+}
+
+void proto_timer_get_stats(proto_timer_stats_t *out) {
+  if (out)
+    *out = g_stats;
+}
@@ -0,0 +1,97 @@
+// ring.c
+//
+// Set-up and the variable-length records of the lock-free rings (ring.h);
+// the fixed-slot paths are inline in the header for the ISRs.
+//
+//  - a record is written whole before the head moves past it, skip marker
+//  included, so the consumer never sees half of one.
+//  - the consumer steps over a skip marker in ring_rec_peek(); it owns the
+//  tail, so that needs no coordination with the producer.
+//
+// Notes / Assumptions:
+//  - Record rings are byte rings (slot size 1) on word-aligned storage;
+//  positions stay multiples of 4, so the end always has room for a marker.
+
+#include "ring.h"
+
+#define REC_SKIP 0xFFFFFFFFu
+
+int ring_init(ring_t *r, void *buf, uint32_t slots, uint32_t slot_size) {
+  if (!r || !buf || slots == 0 || slot_size == 0 || (slots & (slots - 1u)))
+    return 0;
+  memset(r, 0, sizeof(*r));
+  r->buf = (uint8_t *)buf;
+  r->mask = slots - 1u;
+  r->slot = slot_size;
+  return 1;
+}
+
+void ring_reset(ring_t *r) {
+  r->tail = r->head;
+}
+
+void ring_get_stats(const ring_t *r, ring_stats_t *out) {
+  if (!r || !out) return;
+  *out = r->stats;
+}
+
+int ring_rec_push(ring_t *r, const void *data, uint32_t len) {
+  const uint32_t need = RING_REC_BYTES(len);
+  const uint32_t size = ring_size(r);
+  uint32_t h = r->head;
+  uint32_t at = h & r->mask;
+  const uint32_t to_end = size - at;
+  const uint32_t skip = (need > to_end) ? to_end : 0u;
+  const uint32_t used = h - r->tail;
+  if (len >= REC_SKIP || need > size || used + skip + need > size) {
+    r->stats.full++;
+    return 0;
+  }
+
+  if (skip) {
+    *(uint32_t *)(r->buf + at) = REC_SKIP;
+    h += skip;
+    at = 0;
+  }
+  *(uint32_t *)(r->buf + at) = len;
+  if (len) memcpy(r->buf + at + 4u, data, len);
+
+  ring_release(); // record before the position
+  r->head = h + need;
+  r->stats.pushed++;
+  ring_note_fill_(r, used + skip + need);
+  return 1;
+}
+
+const void *ring_rec_peek(ring_t *r, uint32_t *len) {
+  uint32_t t = r->tail;
+  if (r->head == t) return NULL;
+  ring_acquire();
+  uint32_t at = t & r->mask;
+  uint32_t hdr = *(const uint32_t *)(r->buf + at);
+  if (hdr == REC_SKIP) {
+    t += ring_size(r) - at;
+    r->tail = t; // the marker and the record after it came in together
+    at = 0;
+    hdr = *(const uint32_t *)(r->buf);
+  }
+  if (len) *len = hdr;
+  return r->buf + at + 4u;
+}
+
+void ring_rec_consume(ring_t *r) {
+  const uint32_t t = r->tail;
+  const uint32_t len = *(const uint32_t *)(r->buf + (t & r->mask));
+  ring_release(); // done reading before the producer may reuse it
+  r->tail = t + RING_REC_BYTES(len);
+  r->stats.popped++;
+}
+
+int ring_mpsc_init(ring_mpsc_t *q, void *buf, volatile uint32_t *seq,
+                   uint32_t slots, uint32_t slot_size) {
+  if (!q || !seq || !ring_init(&q->r, buf, slots, slot_size)) return 0;
+  q->seq = seq;
+  for (uint32_t i = 0; i < slots; i++)
+    seq[i] = i;
+  return 1;
+}
@@ -0,0 +1,228 @@
+// rtc_time.c
+//
+// Register-level RTC: the HAL RTC module isn't part of the CubeMX config,
+// and all this needs is the calendar, the shift register and two backup
+// words. The calendar runs in 24 h mode from 2000 to 2099 with 1/256 s
+// subseconds (PREDIV_A 127, PREDIV_S 255 off the 32.768 kHz LSE).
+
+#include "rtc_time.h"
+
+#define RTC_TIME_PREDIV_A 127u
+#define RTC_TIME_PREDIV_S 255u
+
+#ifndef RTC_TIME_TIMEOUT_MS
+#define RTC_TIME_TIMEOUT_MS 10u // INITF / RSF / SHPF, a few RTCCLK cycles each
+#endif
+
+// Backup register map. BKP0 holds a magic in the top half and which of the
+// other words are valid in the bottom half.
+#define RTC_TIME_MAGIC      0x5EDC0000u
+#define RTC_TIME_MAGIC_MASK 0xFFFF0000u
+#define RTC_TIME_F_UNIX     0x1u
+#define RTC_TIME_F_DRIFT    0x2u
+#define RTC_TIME_BKP_FLAGS  (TAMP->BKP0R)
+#define RTC_TIME_BKP_DRIFT  (TAMP->BKP1R)
+
+#define RTC_TIME_UNIX_2000  946684800ULL
+
+static uint8_t g_rtc_ready = 0;
+
+static int rtc_clocked(void) {
+  const uint32_t bdcr = RCC->BDCR;
+  return (bdcr & RCC_BDCR_RTCEN) && (bdcr & RCC_BDCR_LSERDY) &&
+         (bdcr & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL_0;
+}
+
+static int rtc_wait(volatile uint32_t *reg, uint32_t mask, uint32_t want) {
+  const uint32_t t0 = HAL_GetTick();
+  while ((*reg & mask) != want) {
+    if (HAL_GetTick() - t0 > RTC_TIME_TIMEOUT_MS) return 0;
+  }
+  return 1;
+}
+
+static inline void rtc_unlock(void) {
+  RTC->WPR = 0xCAu;
+  RTC->WPR = 0x53u;
+}
+
+static inline void rtc_lock(void) { RTC->WPR = 0xFFu; }
+
+static uint32_t bkp_flags(void) {
+  const uint32_t f = RTC_TIME_BKP_FLAGS;
+  return ((f & RTC_TIME_MAGIC_MASK) == RTC_TIME_MAGIC) ? (f & ~RTC_TIME_MAGIC_MASK) : 0;
+}
+
+static void bkp_flags_set(uint32_t flags) {
+  RTC_TIME_BKP_FLAGS = RTC_TIME_MAGIC | flags;
+}
+
+// Wait for the shadow registers to pick up the calendar after a reset.
+static int rtc_sync(void) {
+  rtc_unlock();
+  RTC->ICSR &= ~RTC_ICSR_RSF;
+  rtc_lock();
+  return rtc_wait(&RTC->ICSR, RTC_ICSR_RSF, RTC_ICSR_RSF);
+}
+
+// Finish the RTC setup once the LSE is up. Leaves a running RTC alone.
+static int rtc_bring_up(void) {
+  if (g_rtc_ready) return 1;
+  if (!(RCC->BDCR & RCC_BDCR_LSERDY)) return 0;
+
+  if ((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_0) {
+    RCC->BDCR = (RCC->BDCR & ~RCC_BDCR_RTCSEL) | RCC_BDCR_RTCSEL_0;
+  }
+  RCC->BDCR |= RCC_BDCR_RTCEN;
+
+  rtc_unlock();
+  RTC->ICSR |= RTC_ICSR_INIT;
+  if (!rtc_wait(&RTC->ICSR, RTC_ICSR_INITF, RTC_ICSR_INITF)) {
+    rtc_lock();
+    return 0;
+  }
+  // Two separate writes, synchronous prescaler first (RM0440).
+  RTC->PRER = RTC_TIME_PREDIV_S;
+  RTC->PRER |= RTC_TIME_PREDIV_A << RTC_PRER_PREDIV_A_Pos;
+  RTC->CR &= ~RTC_CR_FMT;
+  RTC->ICSR &= ~RTC_ICSR_INIT;
+  rtc_lock();
+
+  g_rtc_ready = (uint8_t)rtc_sync();
+  return g_rtc_ready;
+}
+
+HAL_StatusTypeDef rtc_time_init(void) {
+  __HAL_RCC_PWR_CLK_ENABLE();
+  __HAL_RCC_RTCAPB_CLK_ENABLE();
+  PWR->CR1 |= PWR_CR1_DBP;
+  if (!rtc_wait(&PWR->CR1, PWR_CR1_DBP, PWR_CR1_DBP)) return HAL_ERROR;
+
+  if (rtc_clocked()) {
+    g_rtc_ready = (uint8_t)rtc_sync();
+    return g_rtc_ready ? HAL_OK : HAL_ERROR;
+  }
+
+  // Another clock source can only be replaced by resetting the domain.
+  if ((RCC->BDCR & RCC_BDCR_RTCSEL) != 0 &&
+      (RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_0) {
+    RCC->BDCR |= RCC_BDCR_BDRST;
+    RCC->BDCR &= ~RCC_BDCR_BDRST;
+  }
+  RCC->BDCR |= RCC_BDCR_LSEON;
+  (void)rtc_bring_up(); // only if the LSE happens to be up already
+  return HAL_OK;
+}
+
+// =========================
+// Calendar
+// =========================
+
+// Days since 1970-01-01 (H. Hinnant's civil calendar algorithms).
+
+static uint32_t days_from_civil(uint32_t y, uint32_t m, uint32_t d) {
+  y -= (m <= 2u);
+  const uint32_t era = y / 400u;
+  const uint32_t yoe = y - era * 400u;
+  const uint32_t doy = (153u * (m > 2u ? m - 3u : m + 9u) + 2u) / 5u + d - 1u;
+  const uint32_t doe = yoe * 365u + yoe / 4u - yoe / 100u + doy;
+  return era * 146097u + doe - 719468u;
+}
+
+static void civil_from_days(uint32_t z, uint32_t *y, uint32_t *m, uint32_t *d) {
+  z += 719468u;
+  const uint32_t era = z / 146097u;
+  const uint32_t doe = z - era * 146097u;
+  const uint32_t yoe = (doe - doe / 1460u + doe / 36524u - doe / 146096u) / 365u;
+  const uint32_t doy = doe - (365u * yoe + yoe / 4u - yoe / 100u);
+  const uint32_t mp = (5u * doy + 2u) / 153u;
+  *d = doy - (153u * mp + 2u) / 5u + 1u;
+  *m = (mp < 10u) ? mp + 3u : mp - 9u;
+  *y = yoe + era * 400u + (*m <= 2u);
+}
+
+uint32_t rtc_time_days_from_civil(uint32_t year, uint32_t mon, uint32_t day) {
+  return days_from_civil(year, mon, day);
+}
+
+static inline uint32_t bcd2(uint32_t v) { return ((v / 10u) << 4) | (v % 10u); }
+static inline uint32_t unbcd(uint32_t v) { return (v >> 4) * 10u + (v & 0xFu); }
+
+HAL_StatusTypeDef rtc_time_get_unix_ms(uint64_t *unix_ms) {
+  if (!unix_ms || !g_rtc_ready || !(bkp_flags() & RTC_TIME_F_UNIX)) return HAL_ERROR;
+
+  // SSR first: reading it freezes TR/DR until DR has been read.
+  const uint32_t ss = RTC->SSR & RTC_SSR_SS;
+  const uint32_t tr = RTC->TR;
+  const uint32_t dr = RTC->DR;
+
+  const uint32_t year = 2000u + unbcd((dr >> RTC_DR_YU_Pos) & 0xFFu);
+  const uint32_t mon = unbcd((dr >> RTC_DR_MU_Pos) & 0x1Fu);
+  const uint32_t day = unbcd((dr >> RTC_DR_DU_Pos) & 0x3Fu);
+  const uint32_t hh = unbcd((tr >> RTC_TR_HU_Pos) & 0x3Fu);
+  const uint32_t mm = unbcd((tr >> RTC_TR_MNU_Pos) & 0x7Fu);
+  const uint32_t sec = unbcd((tr >> RTC_TR_SU_Pos) & 0x7Fu);
+  if (mon < 1u || mon > 12u || day < 1u || day > 31u) return HAL_ERROR;
+
+  const uint64_t s = (uint64_t)days_from_civil(year, mon, day) * 86400ULL +
+                     hh * 3600u + mm * 60u + sec;
+  // SS counts down from PREDIV_S within each second.
+  const uint32_t frac = ((RTC_TIME_PREDIV_S - (ss & RTC_TIME_PREDIV_S)) * 1000u) /
+                        (RTC_TIME_PREDIV_S + 1u);
+  *unix_ms = s * 1000ULL + frac;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef rtc_time_set_unix_ms(uint64_t unix_ms) {
+  if (!rtc_bring_up()) return HAL_BUSY;
+  if (unix_ms < RTC_TIME_UNIX_2000 * 1000ULL) return HAL_ERROR;
+
+  const uint64_t s = unix_ms / 1000ULL;
+  const uint32_t ms = (uint32_t)(unix_ms % 1000ULL);
+  const uint32_t days = (uint32_t)(s / 86400ULL);
+  const uint32_t sod = (uint32_t)(s % 86400ULL);
+  uint32_t y, m, d;
+  civil_from_days(days, &y, &m, &d);
+  if (y > 2099u) return HAL_ERROR;
+  const uint32_t wday = ((days + 3u) % 7u) + 1u; // 1 = Monday; 1970-01-01 was a Thursday
+
+  const uint32_t tr = (bcd2(sod / 3600u) << RTC_TR_HU_Pos) |
+                      (bcd2((sod / 60u) % 60u) << RTC_TR_MNU_Pos) |
+                      (bcd2(sod % 60u) << RTC_TR_SU_Pos);
+  const uint32_t dr = (bcd2(y - 2000u) << RTC_DR_YU_Pos) |
+                      (wday << RTC_DR_WDU_Pos) |
+                      (bcd2(m) << RTC_DR_MU_Pos) |
+                      (bcd2(d) << RTC_DR_DU_Pos);
+
+  rtc_unlock();
+  RTC->ICSR |= RTC_ICSR_INIT;
+  if (!rtc_wait(&RTC->ICSR, RTC_ICSR_INITF, RTC_ICSR_INITF)) {
+    rtc_lock();
+    return HAL_ERROR;
+  }
+  RTC->TR = tr;
+  RTC->DR = dr;
+  RTC->ICSR &= ~RTC_ICSR_INIT;
+
+  // The second restarts on leaving init; shift it forward by the
+  // millisecond part: +1 s, minus (1000 - ms) ms worth of subseconds.
+  if (ms != 0 && rtc_wait(&RTC->ICSR, RTC_ICSR_SHPF, 0)) {
+    const uint32_t subfs = ((1000u - ms) * (RTC_TIME_PREDIV_S + 1u)) / 1000u;
+    RTC->SHIFTR = RTC_SHIFTR_ADD1S | (subfs << RTC_SHIFTR_SUBFS_Pos);
+  }
+  rtc_lock();
+
+  bkp_flags_set(bkp_flags() | RTC_TIME_F_UNIX);
+  return rtc_sync() ? HAL_OK : HAL_ERROR;
+}
+
+void rtc_time_save_drift(int32_t freq_q32) {
+  RTC_TIME_BKP_DRIFT = (uint32_t)freq_q32;
+  bkp_flags_set(bkp_flags() | RTC_TIME_F_DRIFT);
+}
+
+HAL_StatusTypeDef rtc_time_load_drift(int32_t *freq_q32) {
+  if (!freq_q32 || !(bkp_flags() & RTC_TIME_F_DRIFT)) return HAL_ERROR;
+  *freq_q32 = (int32_t)RTC_TIME_BKP_DRIFT;
+  return HAL_OK;
+}
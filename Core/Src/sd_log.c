@@ -0,0 +1,385 @@
+// sd_log.c
+//
+// Append-only SD card log (format in sd_log.h):
+//  - sd_log_append() copies a record into the half being filled, under a
+//  mutex held only for the copy. A record that doesn't fit the current
+//  block closes it; closing the last block of a half hands the half to the
+//  writer and switches filling to the other one.
+//  - the writer thread sends each handed-over half as one multi-block write,
+//  stamping the block headers (seq, session) just before. If nothing filled
+//  a half within SD_LOG_FLUSH_MS it closes the partial one, so a quiet bus
+//  is still on the card within that time.
+//  - mount reads the first ring block, then binary searches for the last
+//  block of the same pass (seq == first seq + offset); writing resumes after
+//  it in a new session.
+//
+// Notes / Assumptions:
+//  - A write error keeps the half and remounts; appends drop meanwhile, and
+//  the half is restamped with the new session when it goes out.
+//  - Halves are written in the order they were filled: both indices only
+//  ever toggle.
+//  - Readers (sd_log_read(): file pulls, the USB disk) share the card with
+//  the writer under g_card. File pulls never wait for it, so they only slow
+//  down while a half goes out.
+
+#include "sd_log.h"
+#include "sd_spi.h"
+#include "dma_copy.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include <string.h>
+
+#ifdef SD_LOG_ENABLED
+
+// Blocks per RAM half, i.e. per multi-block write. Two halves are held.
+#ifndef SD_LOG_HALF_BLOCKS
+#define SD_LOG_HALF_BLOCKS 8u
+#endif
+// Longest a record waits in RAM when its half isn't filling up.
+#ifndef SD_LOG_FLUSH_MS
+#define SD_LOG_FLUSH_MS 250u
+#endif
+// Delay between mount attempts without a card.
+#ifndef SD_LOG_RETRY_MS
+#define SD_LOG_RETRY_MS 1000u
+#endif
+// First block of the log ring (1 MiB in, past a partition table).
+#ifndef SD_LOG_FIRST_LBA
+#define SD_LOG_FIRST_LBA 2048u
+#endif
+
+// Below the telemetry stages; above the CPU load monitor.
+// Stack size: SD_LOG_THREAD_STACK_SIZE in mem_budget.h.
+#define SD_LOG_THREAD_PRIORITY 10u
+
+#define BLK_HDR 16u
+#define REC_HDR 12u
+#define HALF_BYTES (SD_LOG_HALF_BLOCKS * SD_SPI_BLOCK)
+
+_Static_assert(BLK_HDR + REC_HDR + SD_LOG_PAYLOAD_MAX == SD_SPI_BLOCK,
+               "SD_LOG_PAYLOAD_MAX must fill one block");
+_Static_assert(SD_LOG_HALF_BLOCKS > 0 && SD_LOG_HALF_BLOCKS <= 64,
+               "SD_LOG_HALF_BLOCKS out of range");
+
+static const uint8_t k_magic[4] = {'S', 'D', 'L', 'G'};
+
+enum { HALF_FREE = 0, HALF_FILLING, HALF_READY };
+
+typedef struct {
+  uint8_t state;
+  uint8_t blocks; // blocks started, the last one still open while FILLING
+  uint16_t off;   // write offset in the open block
+} sd_half_t;
+
+TX_THREAD sd_log_thread;
+static MEM_ARENA(stack) ULONG sd_log_thread_stack[SD_LOG_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static uint8_t g_buf[2][HALF_BYTES] __attribute__((aligned(4)));
+static uint8_t g_scan[SD_SPI_BLOCK] __attribute__((aligned(4))); // mount
+static sd_half_t g_half[2];
+static uint8_t g_fill = 0; // half appends go to
+static uint8_t g_wr = 0;   // half the writer takes next
+
+static TX_MUTEX g_lock;
+static TX_MUTEX g_card; // SPI card: writer thread vs file pulls
+static TX_SEMAPHORE g_kick;
+static volatile uint8_t g_ready = 0;
+
+static uint32_t g_ring = 0; // blocks in the log ring
+static uint32_t g_seq = 0;
+static uint32_t g_session = 0;
+static sd_log_stats_t g_stats;
+
+// File pull range and its one-block cache.
+static uint32_t g_pull_first = 0;  // seq of the file's first block
+static uint32_t g_pull_blocks = 0;
+static uint32_t g_pull_cached = 0; // seq in g_pull_blk, if g_pull_valid
+static uint8_t g_pull_valid = 0;
+static uint8_t g_pull_blk[SD_SPI_BLOCK] __attribute__((aligned(4)));
+
+static ULONG ms_ticks(uint32_t ms) {
+  const ULONG t = (ULONG)(((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) /
+                          1000u);
+  return t ? t : 1u;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  for (unsigned i = 0; i < 4u; i++) p[i] = (uint8_t)(v >> (8u * i));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+// Record the open block's fill level in its header. Lock held.
+static void close_block(uint8_t h) {
+  uint8_t *blk = &g_buf[h][(g_half[h].blocks - 1u) * SD_SPI_BLOCK];
+  put_le16(&blk[12], (uint16_t)(g_half[h].off - BLK_HDR));
+}
+
+// Hand the filling half to the writer. Lock held.
+static void close_half(void) {
+  close_block(g_fill);
+  g_half[g_fill].state = HALF_READY;
+  g_fill ^= 1u;
+}
+
+void sd_log_append(uint16_t ty, uint64_t ts, const void *data, size_t len) {
+  if (!g_ready) return;
+  if (len > SD_LOG_PAYLOAD_MAX || (len && !data)) {
+    g_stats.dropped_big++;
+    return;
+  }
+  const uint16_t need = (uint16_t)(REC_HDR + len);
+  int kick = 0;
+
+  (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+  sd_half_t *h = &g_half[g_fill];
+  if (!g_stats.mounted) {
+    g_stats.dropped_full++;
+    (void)tx_mutex_put(&g_lock);
+    return;
+  }
+  if (h->state == HALF_FILLING && h->off + need > SD_SPI_BLOCK) {
+    if (h->blocks == SD_LOG_HALF_BLOCKS) {
+      close_half();
+      h = &g_half[g_fill];
+      kick = 1;
+    } else {
+      close_block(g_fill);
+      h->blocks++;
+      h->off = BLK_HDR;
+    }
+  }
+  if (h->state == HALF_FREE) {
+    h->state = HALF_FILLING;
+    h->blocks = 1;
+    h->off = BLK_HDR;
+  }
+  if (h->state != HALF_FILLING) {
+    g_stats.dropped_full++;
+  } else {
+    uint8_t *p = &g_buf[g_fill][(h->blocks - 1u) * SD_SPI_BLOCK + h->off];
+    put_le16(&p[0], (uint16_t)len);
+    put_le16(&p[2], ty);
+    put_le32(&p[4], (uint32_t)ts);
+    put_le32(&p[8], (uint32_t)(ts >> 32));
+    if (len) dma_copy(&p[REC_HDR], data, len);
+    h->off = (uint16_t)(h->off + need);
+    g_stats.records++;
+    g_stats.bytes += (uint32_t)len;
+  }
+  (void)tx_mutex_put(&g_lock);
+  if (kick) (void)tx_semaphore_put(&g_kick);
+}
+
+void sd_log_get_stats(sd_log_stats_t *out) {
+  if (!out) return;
+  (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+  *out = g_stats;
+  (void)tx_mutex_put(&g_lock);
+}
+
+void sd_log_span(uint32_t *first, uint32_t *count) {
+  uint32_t next = 0, ring = 0;
+  if (g_ready) {
+    (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+    if (g_stats.mounted) {
+      next = g_stats.next_seq;
+      ring = g_ring;
+    }
+    (void)tx_mutex_put(&g_lock);
+  }
+  const uint32_t n = (next < ring) ? next : ring;
+  if (first) *first = next - n;
+  if (count) *count = n;
+}
+
+HAL_StatusTypeDef sd_log_read(uint32_t seq, uint8_t *buf, uint32_t count,
+                              uint32_t wait_ms) {
+  if (!g_ready || !buf || count == 0) return HAL_ERROR;
+  const ULONG wait = (wait_ms == 0) ? TX_NO_WAIT
+                     : (wait_ms == UINT32_MAX) ? TX_WAIT_FOREVER
+                                               : ms_ticks(wait_ms);
+  if (tx_mutex_get(&g_card, wait) != TX_SUCCESS) return HAL_BUSY;
+  HAL_StatusTypeDef st = g_stats.mounted ? HAL_OK : HAL_ERROR;
+  uint32_t done = 0;
+  while (st == HAL_OK && done < count) {
+    const uint32_t pos = (seq + done) % g_ring;
+    uint32_t run = count - done;
+    if (run > g_ring - pos) run = g_ring - pos;
+    st = sd_spi_read(SD_LOG_FIRST_LBA + pos, &buf[done * SD_SPI_BLOCK], run);
+    done += run;
+  }
+  (void)tx_mutex_put(&g_card);
+  return st;
+}
+
+uint32_t sd_log_file_open(void *user) {
+  (void)user;
+  sd_log_span(&g_pull_first, &g_pull_blocks);
+  g_pull_valid = 0;
+  return g_pull_blocks * SD_SPI_BLOCK;
+}
+
+size_t sd_log_file_read(uint32_t off, uint8_t *dst, size_t len, void *user) {
+  (void)user;
+  const uint32_t i = off / SD_SPI_BLOCK;
+  if (i >= g_pull_blocks) return 0;
+  const uint32_t seq = g_pull_first + i;
+  if (!g_pull_valid || g_pull_cached != seq) {
+    // With the writer on the card this is asked again on the next poll.
+    if (sd_log_read(seq, g_pull_blk, 1, 0) != HAL_OK) return 0;
+    g_pull_cached = seq;
+    g_pull_valid = 1;
+  }
+  const uint32_t at = off % SD_SPI_BLOCK;
+  if (len > SD_SPI_BLOCK - at) len = SD_SPI_BLOCK - at;
+  memcpy(dst, &g_pull_blk[at], len);
+  return len;
+}
+
+// =========================
+// Writer thread
+// =========================
+
+// Read ring block `i` into `blk`; its seq if it is a log block.
+static int read_seq(uint32_t i, uint8_t *blk, uint32_t *seq) {
+  if (sd_spi_read(SD_LOG_FIRST_LBA + i, blk, 1) != HAL_OK) return -1;
+  if (memcmp(blk, k_magic, sizeof(k_magic)) != 0) return 0;
+  *seq = get_le32(&blk[4]);
+  return 1;
+}
+
+// Find where the log ends.
+static HAL_StatusTypeDef mount(void) {
+  if (sd_spi_init() != HAL_OK) return HAL_ERROR;
+  const uint32_t blocks = sd_spi_block_count();
+  if (blocks <= SD_LOG_FIRST_LBA + SD_LOG_HALF_BLOCKS) return HAL_ERROR;
+  g_ring = blocks - SD_LOG_FIRST_LBA;
+
+  uint8_t *blk = g_scan;
+  uint32_t s0 = 0;
+  const int r = read_seq(0, blk, &s0);
+  if (r < 0) return HAL_ERROR;
+  uint32_t last_session = 0;
+  if (r == 0 || s0 % g_ring != 0) {
+    g_seq = 0; // blank card (or not ours): start at the ring's first block
+  } else {
+    // Largest i with block i in the same pass as block 0.
+    uint32_t lo = 0, hi = g_ring - 1u;
+    last_session = get_le32(&blk[8]);
+    while (lo < hi) {
+      const uint32_t mid = lo + (hi - lo + 1u) / 2u;
+      uint32_t s = 0;
+      const int m = read_seq(mid, blk, &s);
+      if (m < 0) return HAL_ERROR;
+      if (m && s == s0 + mid) {
+        lo = mid;
+        last_session = get_le32(&blk[8]);
+      } else {
+        hi = mid - 1u;
+      }
+    }
+    g_seq = s0 + lo + 1u;
+  }
+  g_session = last_session + 1u;
+
+  (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+  g_stats.mounted = 1;
+  g_stats.next_seq = g_seq;
+  g_stats.session = g_session;
+  (void)tx_mutex_put(&g_lock);
+  return HAL_OK;
+}
+
+// Stamp and write half `h`, wrapping at the end of the ring.
+static HAL_StatusTypeDef write_half(uint8_t h) {
+  const uint32_t n = g_half[h].blocks;
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t *blk = &g_buf[h][i * SD_SPI_BLOCK];
+    memcpy(blk, k_magic, sizeof(k_magic));
+    put_le32(&blk[4], g_seq + i);
+    put_le32(&blk[8], g_session);
+    put_le16(&blk[14], 0);
+  }
+  uint32_t done = 0;
+  while (done < n) {
+    const uint32_t pos = (g_seq + done) % g_ring;
+    uint32_t run = n - done;
+    if (run > g_ring - pos) run = g_ring - pos;
+    if (sd_spi_write(SD_LOG_FIRST_LBA + pos, &g_buf[h][done * SD_SPI_BLOCK],
+                     run) != HAL_OK)
+      return HAL_ERROR;
+    done += run;
+  }
+  g_seq += n;
+  return HAL_OK;
+}
+
+void sd_log_thread_entry(ULONG initial_input) {
+  (void)initial_input;
+  for (;;) {
+    if (!g_stats.mounted) {
+      (void)tx_mutex_get(&g_card, TX_WAIT_FOREVER);
+      const HAL_StatusTypeDef st = mount();
+      (void)tx_mutex_put(&g_card);
+      if (st != HAL_OK) {
+        (void)tx_thread_sleep(ms_ticks(SD_LOG_RETRY_MS));
+        continue;
+      }
+    }
+    if (g_half[g_wr].state != HALF_READY &&
+        tx_semaphore_get(&g_kick, ms_ticks(SD_LOG_FLUSH_MS)) != TX_SUCCESS) {
+      (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+      if (g_half[g_fill].state == HALF_FILLING &&
+          g_half[g_fill ^ 1u].state == HALF_FREE)
+        close_half();
+      (void)tx_mutex_put(&g_lock);
+    }
+
+    while (g_half[g_wr].state == HALF_READY) {
+      (void)tx_mutex_get(&g_card, TX_WAIT_FOREVER);
+      const HAL_StatusTypeDef st = write_half(g_wr);
+      (void)tx_mutex_put(&g_card);
+      (void)tx_mutex_get(&g_lock, TX_WAIT_FOREVER);
+      if (st == HAL_OK) {
+        g_stats.blocks_written += g_half[g_wr].blocks;
+        g_stats.next_seq = g_seq;
+        g_half[g_wr].state = HALF_FREE;
+      } else {
+        g_stats.write_errors++;
+        g_stats.mounted = 0;
+      }
+      (void)tx_mutex_put(&g_lock);
+      if (st != HAL_OK) break;
+      g_wr ^= 1u;
+    }
+  }
+}
+
+void create_sd_log_thread(void) {
+  if (tx_mutex_create(&g_lock, "sd log", TX_INHERIT) != TX_SUCCESS ||
+      tx_mutex_create(&g_card, "sd card", TX_INHERIT) != TX_SUCCESS ||
+      tx_semaphore_create(&g_kick, "sd log kick", 0) != TX_SUCCESS)
+    die("Failed to create SD log sync");
+  const UINT status =
+      tx_thread_create(&sd_log_thread, "SD Log", sd_log_thread_entry, 0,
+                       sd_log_thread_stack, SD_LOG_THREAD_STACK_SIZE,
+                       SD_LOG_THREAD_PRIORITY, SD_LOG_THREAD_PRIORITY,
+                       TX_NO_TIME_SLICE, TX_AUTO_START);
+  if (status != TX_SUCCESS) {
+    die("Failed to create SD log thread: %u", (unsigned)status);
+  }
+  g_ready = 1;
+}
+
+#endif /* SD_LOG_ENABLED */
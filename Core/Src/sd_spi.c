@@ -0,0 +1,362 @@
+// sd_spi.c
+//
+// SD card in SPI mode (SD physical layer spec, SPI chapter):
+//  - init at the slow clock: 80 idle clocks, CMD0, CMD8 to tell v2 cards,
+//  ACMD41 until the card leaves idle, CMD58 for block or byte addressing,
+//  CMD9 for the capacity, then the fast clock.
+//  - writes are one CMD25 per call behind an ACMD23 pre-erase hint; each
+//  block goes out by DMA after its start token, then the data response and
+//  the busy wait the card holds MISO low for.
+//  - reads are CMD17 per block, polled; only the logger's mount scan and
+//  tools read.
+//
+// Notes / Assumptions:
+//  - The slowest SPI1 clock, 170 MHz / 256 = 664 kHz, is above the 400 kHz
+//  the spec gives for identification; cards generally take it.
+//  - In two-line mode the DMA transfer only feeds TX; HAL flushes the RX
+//  FIFO when it ends. The SPI error interrupt isn't enabled in the NVIC, so
+//  the RX overrun that leaves behind doesn't fire.
+
+#include "sd_spi.h"
+#include "tx_api.h"
+#include <string.h>
+
+#ifndef SD_SPI_INSTANCE
+#define SD_SPI_INSTANCE SPI1
+#define SD_SPI_CLK_ENABLE() __HAL_RCC_SPI1_CLK_ENABLE()
+#endif
+#ifndef SD_SPI_GPIO_PORT
+#define SD_SPI_GPIO_PORT GPIOA
+#define SD_SPI_GPIO_CLK_ENABLE() __HAL_RCC_GPIOA_CLK_ENABLE()
+#endif
+#ifndef SD_SPI_PINS
+#define SD_SPI_PINS (GPIO_PIN_5 | GPIO_PIN_6 | GPIO_PIN_7) // SCK, MISO, MOSI
+#endif
+#ifndef SD_SPI_AF
+#define SD_SPI_AF GPIO_AF5_SPI1
+#endif
+#ifndef SD_SPI_CS_PORT
+#define SD_SPI_CS_PORT GPIOA
+#endif
+#ifndef SD_SPI_CS_PIN
+#define SD_SPI_CS_PIN GPIO_PIN_4
+#endif
+
+#ifndef SD_SPI_TX_DMA_CHANNEL
+#define SD_SPI_TX_DMA_CHANNEL DMA1_Channel4 // 1: generator, 2-3: USART1
+#endif
+#ifndef SD_SPI_TX_DMA_REQUEST
+#define SD_SPI_TX_DMA_REQUEST DMA_REQUEST_SPI1_TX
+#endif
+#ifndef SD_SPI_TX_DMA_IRQn
+#define SD_SPI_TX_DMA_IRQn DMA1_Channel4_IRQn
+#endif
+// Below everything else: the logger is never urgent.
+#ifndef SD_SPI_IRQ_PRIO
+#define SD_SPI_IRQ_PRIO 11u
+#endif
+
+#ifndef SD_SPI_SLOW_PRESCALER
+#define SD_SPI_SLOW_PRESCALER SPI_BAUDRATEPRESCALER_256
+#endif
+#ifndef SD_SPI_FAST_PRESCALER
+#define SD_SPI_FAST_PRESCALER SPI_BAUDRATEPRESCALER_8 // 21 MHz of 25 max
+#endif
+
+#define SD_SPI_INIT_TIMEOUT_MS 1000u // ACMD41 until ready
+#define SD_SPI_BUSY_TIMEOUT_MS 500u  // programming a block
+#define SD_SPI_READ_TIMEOUT_MS 200u  // data token after CMD17 / CMD9
+#define SD_SPI_DMA_TIMEOUT_MS 50u    // one block at the fast clock: ~0.2 ms
+
+#define SD_TOKEN_START 0xFEu       // single block read/write, CMD18 data
+#define SD_TOKEN_MULTI_WRITE 0xFCu // CMD25 data block
+#define SD_TOKEN_STOP_TRAN 0xFDu   // end of CMD25
+#define SD_ACMD(n) (0x80u | (n))
+
+static SPI_HandleTypeDef g_hspi;
+static DMA_HandleTypeDef g_hdma_tx;
+static TX_SEMAPHORE g_dma_done;
+static uint8_t g_sem_ok = 0;
+static volatile uint8_t g_dma_err = 0;
+static uint8_t g_block_addr = 0; // SDHC/SDXC: addresses are block numbers
+static uint32_t g_blocks = 0;
+
+static ULONG ms_ticks(uint32_t ms) {
+  const ULONG t = (ULONG)(((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) /
+                          1000u);
+  return t ? t : 1u;
+}
+
+static uint8_t spi_xfer(uint8_t out) {
+  uint8_t in = 0xFF;
+  (void)HAL_SPI_TransmitReceive(&g_hspi, &out, &in, 1, 10);
+  return in;
+}
+
+static void cs_low(void) {
+  HAL_GPIO_WritePin(SD_SPI_CS_PORT, SD_SPI_CS_PIN, GPIO_PIN_RESET);
+}
+
+// Raise CS, then one more byte so the card lets go of MISO.
+static void deselect(void) {
+  HAL_GPIO_WritePin(SD_SPI_CS_PORT, SD_SPI_CS_PIN, GPIO_PIN_SET);
+  (void)spi_xfer(0xFF);
+}
+
+static void set_prescaler(uint32_t presc) {
+  __HAL_SPI_DISABLE(&g_hspi); // HAL enables it again on the next transfer
+  g_hspi.Instance->CR1 = (g_hspi.Instance->CR1 & ~SPI_CR1_BR) | presc;
+  g_hspi.Init.BaudRatePrescaler = presc;
+}
+
+// 1 once the card stops holding MISO low. Spins briefly, then gives the CPU
+// away a tick at a time: programming can take hundreds of ms.
+static int wait_ready(uint32_t timeout_ms) {
+  const uint32_t t0 = HAL_GetTick();
+  for (unsigned n = 0;; n++) {
+    if (spi_xfer(0xFF) == 0xFF) return 1;
+    if (HAL_GetTick() - t0 >= timeout_ms) return 0;
+    if (n >= 64u) (void)tx_thread_sleep(1);
+  }
+}
+
+// Send a command and return its R1 (0xFF: no answer). CS stays low for the
+// rest of the response; the caller deselects.
+static uint8_t sd_cmd(uint8_t cmd, uint32_t arg) {
+  if (cmd & 0x80u) {
+    cmd &= 0x7Fu;
+    const uint8_t r = sd_cmd(55, 0);
+    if (r > 1u) return r;
+  }
+  deselect();
+  cs_low();
+  if (!wait_ready(SD_SPI_BUSY_TIMEOUT_MS)) return 0xFF;
+
+  uint8_t f[6] = {(uint8_t)(0x40u | cmd), (uint8_t)(arg >> 24),
+                  (uint8_t)(arg >> 16), (uint8_t)(arg >> 8), (uint8_t)arg,
+                  0x01u};
+  if (cmd == 0) f[5] = 0x95u; // CRC is only checked before SPI mode is on,
+  if (cmd == 8) f[5] = 0x87u; // and for CMD8
+  (void)HAL_SPI_Transmit(&g_hspi, f, sizeof(f), 10);
+  if (cmd == 12) (void)spi_xfer(0xFF); // stuff byte
+
+  uint8_t r = 0xFF;
+  for (unsigned i = 0; i < 10u; i++) {
+    r = spi_xfer(0xFF);
+    if ((r & 0x80u) == 0) break;
+  }
+  return r;
+}
+
+static void read_bytes(uint8_t *buf, size_t n) {
+  memset(buf, 0xFF, n); // sent while receiving
+  (void)HAL_SPI_Receive(&g_hspi, buf, (uint16_t)n, 100);
+}
+
+// A data block after a read command: start token, `n` bytes, CRC.
+static int read_data(uint8_t *buf, size_t n) {
+  const uint32_t t0 = HAL_GetTick();
+  uint8_t tok;
+  while ((tok = spi_xfer(0xFF)) == 0xFF) {
+    if (HAL_GetTick() - t0 >= SD_SPI_READ_TIMEOUT_MS) return 0;
+  }
+  if (tok != SD_TOKEN_START) return 0;
+  read_bytes(buf, n);
+  (void)spi_xfer(0xFF);
+  (void)spi_xfer(0xFF);
+  return 1;
+}
+
+static uint32_t csd_blocks(const uint8_t *c) {
+  if ((c[0] >> 6) == 1u) { // CSD 2.0: SDHC / SDXC
+    const uint32_t c_size = ((uint32_t)(c[7] & 0x3Fu) << 16) |
+                            ((uint32_t)c[8] << 8) | c[9];
+    return (c_size + 1u) << 10;
+  }
+  const uint32_t bl_len = c[5] & 0x0Fu;
+  const uint32_t c_size = ((uint32_t)(c[6] & 0x03u) << 10) |
+                          ((uint32_t)c[7] << 2) | (c[8] >> 6);
+  const uint32_t mult = ((c[9] & 0x03u) << 1) | (c[10] >> 7);
+  return (c_size + 1u) << (mult + 2u + bl_len - 9u);
+}
+
+static HAL_StatusTypeDef hw_init(void) {
+  SD_SPI_CLK_ENABLE();
+  SD_SPI_GPIO_CLK_ENABLE();
+  __HAL_RCC_DMAMUX1_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  GPIO_InitTypeDef g = {0};
+  HAL_GPIO_WritePin(SD_SPI_CS_PORT, SD_SPI_CS_PIN, GPIO_PIN_SET);
+  g.Pin = SD_SPI_CS_PIN;
+  g.Mode = GPIO_MODE_OUTPUT_PP;
+  g.Pull = GPIO_NOPULL;
+  g.Speed = GPIO_SPEED_FREQ_HIGH;
+  HAL_GPIO_Init(SD_SPI_CS_PORT, &g);
+  g.Pin = SD_SPI_PINS;
+  g.Mode = GPIO_MODE_AF_PP;
+  g.Pull = GPIO_PULLUP; // MISO floats until the card drives it
+  g.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  g.Alternate = SD_SPI_AF;
+  HAL_GPIO_Init(SD_SPI_GPIO_PORT, &g);
+
+  g_hspi.Instance = SD_SPI_INSTANCE;
+  g_hspi.Init.Mode = SPI_MODE_MASTER;
+  g_hspi.Init.Direction = SPI_DIRECTION_2LINES;
+  g_hspi.Init.DataSize = SPI_DATASIZE_8BIT;
+  g_hspi.Init.CLKPolarity = SPI_POLARITY_LOW;
+  g_hspi.Init.CLKPhase = SPI_PHASE_1EDGE;
+  g_hspi.Init.NSS = SPI_NSS_SOFT;
+  g_hspi.Init.BaudRatePrescaler = SD_SPI_SLOW_PRESCALER;
+  g_hspi.Init.FirstBit = SPI_FIRSTBIT_MSB;
+  g_hspi.Init.TIMode = SPI_TIMODE_DISABLE;
+  g_hspi.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+  g_hspi.Init.CRCPolynomial = 7;
+  g_hspi.Init.CRCLength = SPI_CRC_LENGTH_DATASIZE;
+  g_hspi.Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+  if (HAL_SPI_Init(&g_hspi) != HAL_OK) return HAL_ERROR;
+
+  g_hdma_tx.Instance = SD_SPI_TX_DMA_CHANNEL;
+  g_hdma_tx.Init.Request = SD_SPI_TX_DMA_REQUEST;
+  g_hdma_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  g_hdma_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+  g_hdma_tx.Init.MemInc = DMA_MINC_ENABLE;
+  g_hdma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  g_hdma_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  g_hdma_tx.Init.Mode = DMA_NORMAL;
+  g_hdma_tx.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&g_hdma_tx) != HAL_OK) return HAL_ERROR;
+  __HAL_LINKDMA(&g_hspi, hdmatx, g_hdma_tx);
+
+  HAL_NVIC_SetPriority(SD_SPI_TX_DMA_IRQn, SD_SPI_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(SD_SPI_TX_DMA_IRQn);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef sd_spi_init(void) {
+  g_blocks = 0;
+  if (!g_sem_ok) {
+    if (tx_semaphore_create(&g_dma_done, "sd dma", 0) != TX_SUCCESS)
+      return HAL_ERROR;
+    g_sem_ok = 1;
+  }
+  if (!g_hspi.Instance && hw_init() != HAL_OK) return HAL_ERROR;
+
+  set_prescaler(SD_SPI_SLOW_PRESCALER);
+  HAL_GPIO_WritePin(SD_SPI_CS_PORT, SD_SPI_CS_PIN, GPIO_PIN_SET);
+  for (unsigned i = 0; i < 10u; i++) (void)spi_xfer(0xFF);
+
+  HAL_StatusTypeDef st = HAL_ERROR;
+  uint8_t r[4];
+  uint32_t hcs = 0;
+  if (sd_cmd(0, 0) != 1u) goto out;
+  if (sd_cmd(8, 0x1AAu) == 1u) { // v2: echoes the voltage and check pattern
+    read_bytes(r, sizeof(r));
+    if ((r[2] & 0x0Fu) != 0x01u || r[3] != 0xAAu) goto out;
+    hcs = 1u << 30;
+  }
+  const uint32_t t0 = HAL_GetTick();
+  while (sd_cmd(SD_ACMD(41), hcs) != 0) {
+    if (HAL_GetTick() - t0 >= SD_SPI_INIT_TIMEOUT_MS) goto out;
+    (void)tx_thread_sleep(1);
+  }
+  if (sd_cmd(58, 0) != 0) goto out;
+  read_bytes(r, sizeof(r));
+  g_block_addr = (hcs && (r[0] & 0x40u)) ? 1u : 0u; // CCS
+  if (!g_block_addr && sd_cmd(16, SD_SPI_BLOCK) != 0) goto out;
+
+  set_prescaler(SD_SPI_FAST_PRESCALER);
+  uint8_t csd[16];
+  if (sd_cmd(9, 0) != 0 || !read_data(csd, sizeof(csd))) goto out;
+  g_blocks = csd_blocks(csd);
+  st = g_blocks ? HAL_OK : HAL_ERROR;
+out:
+  deselect();
+  return st;
+}
+
+uint32_t sd_spi_block_count(void) { return g_blocks; }
+
+static inline uint32_t block_arg(uint32_t lba) {
+  return g_block_addr ? lba : lba * SD_SPI_BLOCK;
+}
+
+HAL_StatusTypeDef sd_spi_read(uint32_t lba, uint8_t *buf, uint32_t count) {
+  if (!g_blocks || !buf || lba >= g_blocks || count > g_blocks - lba)
+    return HAL_ERROR;
+  HAL_StatusTypeDef st = HAL_OK;
+  for (uint32_t i = 0; i < count; i++) {
+    if (sd_cmd(17, block_arg(lba + i)) != 0 ||
+        !read_data(&buf[i * SD_SPI_BLOCK], SD_SPI_BLOCK)) {
+      st = HAL_ERROR;
+      break;
+    }
+  }
+  deselect();
+  return st;
+}
+
+// One block by DMA, the thread blocked until it is on the wire.
+static int dma_block(const uint8_t *p) {
+  g_dma_err = 0;
+  if (HAL_SPI_Transmit_DMA(&g_hspi, (uint8_t *)p, SD_SPI_BLOCK) != HAL_OK)
+    return 0;
+  if (tx_semaphore_get(&g_dma_done, ms_ticks(SD_SPI_DMA_TIMEOUT_MS)) !=
+      TX_SUCCESS) {
+    (void)HAL_SPI_Abort(&g_hspi);
+    return 0;
+  }
+  return !g_dma_err;
+}
+
+HAL_StatusTypeDef sd_spi_write(uint32_t lba, const uint8_t *buf,
+                               uint32_t count) {
+  if (!g_blocks || !buf || count == 0 || lba >= g_blocks ||
+      count > g_blocks - lba)
+    return HAL_ERROR;
+  (void)sd_cmd(SD_ACMD(23), count); // pre-erase hint; harmless if refused
+  if (sd_cmd(25, block_arg(lba)) != 0) {
+    deselect();
+    return HAL_ERROR;
+  }
+  HAL_StatusTypeDef st = HAL_OK;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!wait_ready(SD_SPI_BUSY_TIMEOUT_MS)) {
+      st = HAL_ERROR;
+      break;
+    }
+    (void)spi_xfer(SD_TOKEN_MULTI_WRITE);
+    if (!dma_block(&buf[i * SD_SPI_BLOCK])) {
+      st = HAL_ERROR;
+      break;
+    }
+    (void)spi_xfer(0xFF); // CRC, not checked in SPI mode
+    (void)spi_xfer(0xFF);
+    if ((spi_xfer(0xFF) & 0x1Fu) != 0x05u) { // data response: accepted
+      st = HAL_ERROR;
+      break;
+    }
+  }
+  if (!wait_ready(SD_SPI_BUSY_TIMEOUT_MS)) st = HAL_ERROR;
+  (void)spi_xfer(SD_TOKEN_STOP_TRAN);
+  (void)spi_xfer(0xFF);
+  if (!wait_ready(SD_SPI_BUSY_TIMEOUT_MS)) st = HAL_ERROR;
+  deselect();
+  return st;
+}
+
+// =========================
+// HAL callbacks (DMA ISR)
+// =========================
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+  if (hspi == &g_hspi) (void)tx_semaphore_put(&g_dma_done);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+  if (hspi != &g_hspi) return;
+  g_dma_err = 1;
+  (void)tx_semaphore_put(&g_dma_done);
+}
+
+void sd_spi_dma_irq(void) { HAL_DMA_IRQHandler(&g_hdma_tx); }
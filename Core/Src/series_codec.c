@@ -0,0 +1,183 @@
+// series_codec.c
+//
+// Delta / XOR series frames (format in series_codec.h):
+//  - elements are held as uint64_t: signed integers sign-extended, unsigned
+//  ones zero-extended, floats as their bit pattern. Integer differences are
+//  taken modulo 2^64, so any 64-bit step round-trips.
+//  - decoding truncates back to the element size.
+//
+// Notes / Assumptions:
+//  - Timestamps are whatever unit the caller passes (the router's elapsed
+//  ms); they only need to be non-decreasing for the deltas to stay short.
+
+#include "series_codec.h"
+#include <string.h>
+
+#define KEY_BIT 0x80u
+#define SEQ_MASK 0x7Fu
+#define VARINT_MAX 10u
+
+static size_t put_varint(uint8_t *out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80u) {
+    out[n++] = (uint8_t)(v | 0x80u);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+static int get_varint(const uint8_t *in, size_t len, size_t *i, uint64_t *v) {
+  uint64_t r = 0;
+  for (unsigned shift = 0; shift < 64u; shift += 7u) {
+    if (*i >= len) return 0;
+    const uint8_t b = in[(*i)++];
+    r |= (uint64_t)(b & 0x7Fu) << shift;
+    if (!(b & 0x80u)) {
+      *v = r;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static inline uint64_t zigzag(uint64_t d) {
+  return (d << 1) ^ (uint64_t)((int64_t)d >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t z) {
+  return (z >> 1) ^ (uint64_t)(-(int64_t)(z & 1u));
+}
+
+static uint64_t load(const uint8_t *p, size_t size, SedsElemKind kind) {
+  union { uint8_t b[8]; uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+          int8_t i8; int16_t i16; int32_t i32; } v = {0};
+  memcpy(v.b, p, size);
+  const int sx = (kind == SEDS_EK_SIGNED);
+  switch (size) {
+  case 1: return sx ? (uint64_t)(int64_t)v.i8 : v.u8;
+  case 2: return sx ? (uint64_t)(int64_t)v.i16 : v.u16;
+  case 4: return sx ? (uint64_t)(int64_t)v.i32 : v.u32;
+  default: return v.u64;
+  }
+}
+
+static void store(uint8_t *p, size_t size, uint64_t x) {
+  const union { uint64_t u64; uint8_t b[8]; } v = {.u64 = x};
+  memcpy(p, v.b, size); // little-endian: the low bytes
+}
+
+static int shape_ok(SedsElemKind kind, size_t count, size_t size) {
+  if (count == 0 || count > SERIES_MAX_ELEMS) return 0;
+  if (kind == SEDS_EK_FLOAT) return size == 4u || size == 8u;
+  return size == 1u || size == 2u || size == 4u || size == 8u;
+}
+
+static inline uint64_t elem_code(SedsElemKind kind, uint64_t x,
+                                 uint64_t prev) {
+  return (kind == SEDS_EK_FLOAT) ? (x ^ prev) : zigzag(x - prev);
+}
+
+size_t series_encode(series_state_t *s, SedsDataType ty, SedsElemKind kind,
+                     const void *vals, size_t count, size_t size, uint64_t ts,
+                     uint8_t *out) {
+  if (!s || !vals || !out || (uint32_t)ty > 0xFFu ||
+      !shape_ok(kind, count, size))
+    return 0;
+  // Worst case of a key frame: header, shape, ts, full-width elements (an
+  // integer difference takes up to 2 bits more than the type, zig-zagged).
+  size_t bits = size * 8u + (kind == SEDS_EK_FLOAT ? 0u : 2u);
+  if (bits > 64u) bits = 64u;
+  if (4u + VARINT_MAX + count * ((bits + 6u) / 7u) > SERIES_FRAME_MAX)
+    return 0;
+
+  const int key = !s->live || s->kind != (uint8_t)kind ||
+                  s->elem_size != size || s->elems != count ||
+                  s->since_key >= SERIES_KEY_EVERY || ts < s->ts;
+  const uint8_t *src = (const uint8_t *)vals;
+  size_t n = 0;
+  s->seq = (uint8_t)((s->seq + 1u) & SEQ_MASK);
+  out[n++] = (uint8_t)ty;
+  out[n++] = (uint8_t)((key ? KEY_BIT : 0u) | s->seq);
+  if (key) {
+    out[n++] = (uint8_t)(((unsigned)kind << 4) | size);
+    out[n++] = (uint8_t)count;
+    n += put_varint(&out[n], ts);
+    s->live = 1;
+    s->kind = (uint8_t)kind;
+    s->elem_size = (uint8_t)size;
+    s->elems = (uint8_t)count;
+    s->since_key = 0;
+    memset(s->prev, 0, sizeof(s->prev));
+  } else {
+    n += put_varint(&out[n], ts - s->ts);
+  }
+  for (size_t e = 0; e < count; e++) {
+    const uint64_t x = load(src + e * size, size, kind);
+    n += put_varint(&out[n], elem_code(kind, x, s->prev[e]));
+    s->prev[e] = x;
+  }
+  s->ts = ts;
+  s->since_key++;
+  return n;
+}
+
+HAL_StatusTypeDef series_decode(series_state_t *s, const uint8_t *in,
+                                size_t len, void *vals, size_t *count,
+                                size_t *size, SedsElemKind *kind,
+                                uint64_t *ts) {
+  if (!s || !in || !vals || len < 3u) return HAL_ERROR;
+  const int key = (in[1] & KEY_BIT) != 0;
+  const uint8_t seq = in[1] & SEQ_MASK;
+  size_t i = 2;
+  uint64_t t;
+  if (key) {
+    if (len < 5u) return HAL_ERROR;
+    const SedsElemKind k = (SedsElemKind)(in[2] >> 4);
+    const size_t sz = in[2] & 0x0Fu, cnt = in[3];
+    if (!shape_ok(k, cnt, sz)) return HAL_ERROR;
+    i = 4;
+    if (!get_varint(in, len, &i, &t)) return HAL_ERROR;
+    s->kind = (uint8_t)k;
+    s->elem_size = (uint8_t)sz;
+    s->elems = (uint8_t)cnt;
+    memset(s->prev, 0, sizeof(s->prev));
+  } else {
+    uint64_t dt;
+    if (!s->live || seq != ((s->seq + 1u) & SEQ_MASK) ||
+        !get_varint(in, len, &i, &dt)) {
+      s->live = 0; // wait for a key frame
+      return HAL_ERROR;
+    }
+    t = s->ts + dt;
+  }
+
+  const SedsElemKind k = (SedsElemKind)s->kind;
+  uint64_t next[SERIES_MAX_ELEMS];
+  for (size_t e = 0; e < s->elems; e++) {
+    uint64_t c;
+    if (!get_varint(in, len, &i, &c)) {
+      s->live = 0;
+      return HAL_ERROR;
+    }
+    next[e] = (k == SEDS_EK_FLOAT) ? (c ^ s->prev[e])
+                                   : s->prev[e] + unzigzag(c);
+  }
+  if (i != len) {
+    s->live = 0;
+    return HAL_ERROR;
+  }
+  uint8_t *dst = (uint8_t *)vals;
+  for (size_t e = 0; e < s->elems; e++) {
+    s->prev[e] = next[e];
+    store(dst + e * s->elem_size, s->elem_size, next[e]);
+  }
+  s->live = 1;
+  s->seq = seq;
+  s->ts = t;
+  *count = s->elems;
+  *size = s->elem_size;
+  *kind = k;
+  *ts = t;
+  return HAL_OK;
+}
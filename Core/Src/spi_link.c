@@ -0,0 +1,467 @@
+// spi_link.c
+//
+// SPI slave side for the telemetry router (layout in spi_link.h):
+//  - Each transaction is armed from the RX DMA transfer-complete interrupt:
+//  the RX channel always takes SPI_LINK_XFER_SIZE bytes, the TX channel only
+//  the header and the used payload, so an idle answer costs 8 bytes of DMA.
+//  RX completing is the end of the transaction.
+//  - TX: two RAM buffers, one on the wire and one collecting frames; the
+//  writer keeps the collecting one complete (header and CRC) after every
+//  frame, so the ISR can swap it onto the wire without touching the data.
+//  - RX: two buffers handed to the thread in order; with both still unread
+//  the next transaction goes to a 4-byte sink (no memory increment) and the
+//  header tells the host so.
+//
+// Notes / Assumptions:
+//  - The SPI and DMA channels are driven here directly, not through the HAL
+//  SPI state machine, so the HAL SPI callbacks stay free for sd_spi.c.
+//  - A host that drops chip select mid-transaction leaves the DMA counts
+//  out of step. spi_link_process_rx() notices a partial count while NSS is
+//  high (or an overrun flagged by the ISR), resets the SPI through RCC (the
+//  only way to empty its TX FIFO) and re-arms; the wire buffer goes out
+//  again.
+//  - One writer thread calls spi_link_send_frame(), one reader thread calls
+//  spi_link_process_rx().
+
+#include "spi_link.h"
+#include "crc_hw.h"
+#include <string.h>
+
+#if defined(__ARMCC_VERSION) || defined(__GNUC__) || defined(__ICCARM__)
+#include "cmsis_compiler.h"
+#endif
+
+#ifndef SPI_LINK_INSTANCE
+#define SPI_LINK_INSTANCE SPI3 // SPI1: SD card, SPI2 pins: FDCAN2
+#define SPI_LINK_CLK_ENABLE() __HAL_RCC_SPI3_CLK_ENABLE()
+#define SPI_LINK_FORCE_RESET() __HAL_RCC_SPI3_FORCE_RESET()
+#define SPI_LINK_RELEASE_RESET() __HAL_RCC_SPI3_RELEASE_RESET()
+#define SPI_LINK_IRQn SPI3_IRQn
+#endif
+#ifndef SPI_LINK_GPIO_PORT
+#define SPI_LINK_GPIO_PORT GPIOC
+#define SPI_LINK_GPIO_CLK_ENABLE() __HAL_RCC_GPIOC_CLK_ENABLE()
+#endif
+#ifndef SPI_LINK_PINS
+#define SPI_LINK_PINS (GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12) // SCK, MISO, MOSI
+#endif
+#ifndef SPI_LINK_NSS_PORT
+#define SPI_LINK_NSS_PORT GPIOA
+#define SPI_LINK_NSS_CLK_ENABLE() __HAL_RCC_GPIOA_CLK_ENABLE()
+#endif
+#ifndef SPI_LINK_NSS_PIN
+#define SPI_LINK_NSS_PIN GPIO_PIN_15
+#endif
+#ifndef SPI_LINK_AF
+#define SPI_LINK_AF GPIO_AF6_SPI3
+#endif
+#ifndef SPI_LINK_DRDY_PORT
+#define SPI_LINK_DRDY_PORT GPIOC
+#endif
+#ifndef SPI_LINK_DRDY_PIN
+#define SPI_LINK_DRDY_PIN GPIO_PIN_9
+#endif
+
+#ifndef SPI_LINK_RX_DMA_CHANNEL
+#define SPI_LINK_RX_DMA_CHANNEL DMA2_Channel2 // DMA2 channel 1: GNSS
+#endif
+#ifndef SPI_LINK_RX_DMA_REQUEST
+#define SPI_LINK_RX_DMA_REQUEST DMA_REQUEST_SPI3_RX
+#endif
+#ifndef SPI_LINK_RX_DMA_IRQn
+#define SPI_LINK_RX_DMA_IRQn DMA2_Channel2_IRQn
+#endif
+#ifndef SPI_LINK_TX_DMA_CHANNEL
+#define SPI_LINK_TX_DMA_CHANNEL DMA2_Channel3
+#endif
+#ifndef SPI_LINK_TX_DMA_REQUEST
+#define SPI_LINK_TX_DMA_REQUEST DMA_REQUEST_SPI3_TX
+#endif
+// Above the UART link: re-arming has to fit in the host's gap.
+#ifndef SPI_LINK_IRQ_PRIO
+#define SPI_LINK_IRQ_PRIO 6u
+#endif
+
+#if SPI_LINK_XFER_SIZE < 64u || SPI_LINK_XFER_SIZE > 0xFFFFu
+#error "SPI_LINK_XFER_SIZE out of range"
+#endif
+
+#define HDR_MAGIC 0u
+#define HDR_FLAGS 1u
+#define HDR_NFLAGS 2u
+#define HDR_CRC 3u
+#define HDR_SEQ 5u // CRC covers from here to the end of the payload
+#define HDR_LEN 6u
+
+static SPI_HandleTypeDef g_hspi;
+static DMA_HandleTypeDef g_hdma_rx;
+static DMA_HandleTypeDef g_hdma_tx;
+static uint8_t g_ready = 0;
+
+// TX
+static uint8_t g_tx_buf[2][SPI_LINK_XFER_SIZE] __attribute__((aligned(4)));
+static uint8_t g_tx_idle[SPI_LINK_HDR_SIZE] __attribute__((aligned(4)));
+static volatile uint16_t g_tx_len[2]; // payload bytes per buffer
+static volatile uint8_t g_tx_fill = 0; // buffer collecting frames
+static int8_t g_tx_wire = -1;          // buffer on the wire, -1: idle header
+static volatile uint8_t g_tx_writer_busy = 0;
+static uint8_t g_tx_seq = 0;
+
+// RX
+static uint8_t g_rx_buf[2][SPI_LINK_XFER_SIZE] __attribute__((aligned(4)));
+static uint32_t g_rx_sink;
+static volatile uint8_t g_rx_q[2];        // filled buffers, oldest first
+static volatile uint32_t g_rx_q_head = 0; // pushed (ISR)
+static volatile uint32_t g_rx_q_tail = 0; // released (thread)
+static int8_t g_rx_dma = -1;              // buffer being received, -1: sink
+static volatile uint8_t g_resync = 0;     // ISR saw the stream out of step
+static uint8_t g_rx_seq = 0;
+static uint8_t g_rx_seq_valid = 0;
+
+static spi_link_rx_cb_t g_rx_cb = NULL;
+static void *g_rx_user = NULL;
+static spi_link_notify_cb_t g_rx_notify = NULL;
+
+static spi_link_stats_t g_stats;
+
+static inline uint32_t irq_lock(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static inline void irq_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+static inline uint16_t rd16(const uint8_t *p) {
+  return (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+}
+
+static inline void wr16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void drdy(int on) {
+  HAL_GPIO_WritePin(SPI_LINK_DRDY_PORT, SPI_LINK_DRDY_PIN,
+                    on ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+// =========================
+// Transactions
+// =========================
+
+// Arm the next transaction. `swap` moves a complete collecting buffer onto
+// the wire; without it the wire buffer goes out again (after a resync).
+// Caller must guarantee exclusion (the RX DMA ISR, or IRQs masked).
+static void xfer_arm_locked(int swap) {
+  SPI_TypeDef *spi = SPI_LINK_INSTANCE;
+  CLEAR_BIT(spi->CR1, SPI_CR1_SPE);
+  CLEAR_BIT(spi->CR2, SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+  (void)HAL_DMA_Abort(&g_hdma_tx); // done, but left busy by HAL_DMA_Start()
+
+  if (swap) {
+    if (g_tx_wire >= 0) g_tx_len[g_tx_wire] = 0; // delivered
+    g_tx_wire = -1;
+    const uint8_t fill = g_tx_fill;
+    if (!g_tx_writer_busy && g_tx_len[fill] != 0) {
+      g_tx_wire = (int8_t)fill;
+      g_tx_fill = (uint8_t)(fill ^ 1u);
+    }
+  }
+
+  // Next RX buffer: the one not waiting for the thread, else the sink.
+  const uint32_t queued = g_rx_q_head - g_rx_q_tail;
+  uint8_t flags = 0;
+  if (queued >= 2u) {
+    g_rx_dma = -1;
+    flags |= SPI_LINK_F_RX_BUSY;
+    g_stats.rx_busy++;
+  } else {
+    g_rx_dma = (int8_t)(queued ? (g_rx_q[g_rx_q_tail & 1u] ^ 1u) : 0u);
+  }
+  if (g_tx_len[g_tx_fill] != 0 || g_tx_writer_busy) flags |= SPI_LINK_F_MORE;
+
+  uint8_t *tx = (g_tx_wire >= 0) ? g_tx_buf[g_tx_wire] : g_tx_idle;
+  const uint16_t tx_len =
+      (uint16_t)(SPI_LINK_HDR_SIZE +
+                 ((g_tx_wire >= 0) ? g_tx_len[g_tx_wire] : 0u));
+  tx[HDR_FLAGS] = flags;
+  tx[HDR_NFLAGS] = (uint8_t)~flags;
+  drdy(g_tx_wire >= 0 || (flags & SPI_LINK_F_MORE));
+
+  DMA_Channel_TypeDef *rx_ch = g_hdma_rx.Instance;
+  uint32_t rx_dst;
+  if (g_rx_dma >= 0) {
+    SET_BIT(rx_ch->CCR, DMA_CCR_MINC);
+    rx_dst = (uint32_t)g_rx_buf[g_rx_dma];
+  } else {
+    CLEAR_BIT(rx_ch->CCR, DMA_CCR_MINC);
+    rx_dst = (uint32_t)&g_rx_sink;
+  }
+
+  SET_BIT(spi->CR2, SPI_CR2_RXDMAEN);
+  (void)HAL_DMA_Start_IT(&g_hdma_rx, (uint32_t)&spi->DR, rx_dst,
+                         SPI_LINK_XFER_SIZE);
+  (void)HAL_DMA_Start(&g_hdma_tx, (uint32_t)tx, (uint32_t)&spi->DR, tx_len);
+  SET_BIT(spi->CR2, SPI_CR2_TXDMAEN);
+  SET_BIT(spi->CR1, SPI_CR1_SPE);
+}
+
+static void rx_done(DMA_HandleTypeDef *hdma) {
+  (void)hdma;
+  g_stats.xfers++;
+  const int8_t idx = g_rx_dma;
+  int wake = 0;
+  if (idx >= 0) {
+    const uint8_t *b = g_rx_buf[idx];
+    if (b[HDR_MAGIC] != SPI_LINK_MAGIC) {
+      g_resync = 1; // let the thread look for a gap to re-align in
+      wake = 1;
+    } else if (rd16(&b[HDR_LEN]) != 0) {
+      g_rx_q[g_rx_q_head & 1u] = (uint8_t)idx;
+      __DMB();
+      g_rx_q_head++;
+      wake = 1;
+    }
+  }
+  xfer_arm_locked(1);
+  if (wake && g_rx_notify) g_rx_notify();
+}
+
+static void rx_error(DMA_HandleTypeDef *hdma) {
+  (void)hdma;
+  g_resync = 1;
+  if (g_rx_notify) g_rx_notify();
+}
+
+// Reset the SPI (FIFOs included) and re-arm; IRQs masked by the caller.
+static void spi_restart_locked(void) {
+  (void)HAL_DMA_Abort(&g_hdma_rx);
+  SPI_LINK_FORCE_RESET();
+  SPI_LINK_RELEASE_RESET();
+  (void)HAL_SPI_Init(&g_hspi);
+  SET_BIT(SPI_LINK_INSTANCE->CR2, SPI_CR2_ERRIE);
+  xfer_arm_locked(0);
+}
+
+// A partial RX count with NSS high both before and after reading it means
+// the host gave up on a transaction; the count is stale until a reset.
+static void rx_check_sync(void) {
+  const uint32_t primask = irq_lock();
+  const int idle0 = HAL_GPIO_ReadPin(SPI_LINK_NSS_PORT, SPI_LINK_NSS_PIN);
+  const uint32_t left = __HAL_DMA_GET_COUNTER(&g_hdma_rx);
+  const int idle1 = HAL_GPIO_ReadPin(SPI_LINK_NSS_PORT, SPI_LINK_NSS_PIN);
+  const int cut = idle0 == GPIO_PIN_SET && idle1 == GPIO_PIN_SET &&
+                  left != 0u && left != SPI_LINK_XFER_SIZE;
+  if (cut || (g_resync && idle0 == GPIO_PIN_SET && idle1 == GPIO_PIN_SET)) {
+    g_resync = 0;
+    g_stats.resyncs++;
+    spi_restart_locked();
+  }
+  irq_unlock(primask);
+}
+
+// =========================
+// TX
+// =========================
+
+HAL_StatusTypeDef spi_link_send_frame(const uint8_t *bytes, size_t len) {
+  if (!bytes || len == 0 || !g_ready) return HAL_ERROR;
+  if (len > SPI_LINK_FRAME_MAX) return HAL_ERROR;
+  const size_t need = len + 2u;
+
+  uint32_t primask = irq_lock();
+  const uint8_t idx = g_tx_fill;
+  const size_t off = g_tx_len[idx];
+  if (off + need > SPI_LINK_PAYLOAD_MAX) {
+    g_stats.tx_busy++;
+    irq_unlock(primask);
+    return HAL_BUSY;
+  }
+  g_tx_writer_busy = 1;
+  irq_unlock(primask);
+
+  uint8_t *buf = g_tx_buf[idx];
+  if (off == 0) {
+    buf[HDR_MAGIC] = SPI_LINK_MAGIC;
+    buf[HDR_SEQ] = ++g_tx_seq;
+  }
+  wr16(&buf[SPI_LINK_HDR_SIZE + off], (uint16_t)len);
+  memcpy(&buf[SPI_LINK_HDR_SIZE + off + 2u], bytes, len);
+  const uint16_t used = (uint16_t)(off + need);
+  wr16(&buf[HDR_LEN], used);
+  wr16(&buf[HDR_CRC],
+       (uint16_t)crc_hw_compute(&crc_hw_crc16_ccitt, &buf[HDR_SEQ],
+                                (SPI_LINK_HDR_SIZE - HDR_SEQ) + used));
+
+  primask = irq_lock();
+  g_tx_len[idx] = used;
+  g_tx_writer_busy = 0;
+  g_stats.tx_frames++;
+  drdy(1);
+  irq_unlock(primask);
+  return HAL_OK;
+}
+
+// =========================
+// RX
+// =========================
+
+static void rx_deliver(const uint8_t *b) {
+  const uint16_t len = rd16(&b[HDR_LEN]);
+  if (len > SPI_LINK_PAYLOAD_MAX ||
+      rd16(&b[HDR_CRC]) !=
+          (uint16_t)crc_hw_compute(&crc_hw_crc16_ccitt, &b[HDR_SEQ],
+                                   (SPI_LINK_HDR_SIZE - HDR_SEQ) + len)) {
+    g_stats.rx_bad++;
+    return;
+  }
+  if (g_rx_seq_valid && b[HDR_SEQ] == g_rx_seq) {
+    g_stats.rx_repeats++;
+    return;
+  }
+  g_rx_seq = b[HDR_SEQ];
+  g_rx_seq_valid = 1;
+
+  const uint8_t *p = &b[SPI_LINK_HDR_SIZE];
+  size_t off = 0;
+  while (off + 2u <= len) {
+    const uint16_t n = rd16(&p[off]);
+    off += 2u;
+    if (n == 0 || off + n > len) {
+      g_stats.rx_bad++; // the rest of the payload can't be trusted
+      return;
+    }
+    g_stats.rx_frames++;
+    if (g_rx_cb) g_rx_cb(&p[off], n, g_rx_user);
+    off += n;
+  }
+}
+
+void spi_link_process_rx(void) {
+  if (!g_ready) return;
+  uint32_t tail = g_rx_q_tail;
+  while (tail != g_rx_q_head) {
+    __DMB(); // see the buffer after its queue entry (acquire)
+    rx_deliver(g_rx_buf[g_rx_q[tail & 1u]]);
+    tail++;
+    __DMB(); // done reading before the ISR may reuse it
+    g_rx_q_tail = tail;
+  }
+  rx_check_sync();
+}
+
+void spi_link_set_rx_handler(spi_link_rx_cb_t cb, void *user) {
+  g_rx_user = user;
+  g_rx_cb = cb;
+}
+
+void spi_link_set_rx_notify(spi_link_notify_cb_t cb) { g_rx_notify = cb; }
+
+void spi_link_get_stats(spi_link_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = irq_lock();
+  *out = g_stats;
+  irq_unlock(primask);
+}
+
+void spi_link_dma_rx_irq(void) { HAL_DMA_IRQHandler(&g_hdma_rx); }
+
+// Overrun: the host clocked faster than DMA drained, or into a re-arm.
+void spi_link_spi_irq(void) {
+  SPI_TypeDef *spi = SPI_LINK_INSTANCE;
+  if (spi->SR & SPI_SR_OVR) {
+    (void)spi->DR;
+    (void)spi->SR; // clears OVR
+    g_resync = 1;
+    if (g_rx_notify) g_rx_notify();
+  }
+}
+
+// =========================
+// Init
+// =========================
+
+static HAL_StatusTypeDef dma_init(DMA_HandleTypeDef *hdma,
+                                  DMA_Channel_TypeDef *ch, uint32_t request,
+                                  uint32_t dir) {
+  hdma->Instance = ch;
+  hdma->Init.Request = request;
+  hdma->Init.Direction = dir;
+  hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma->Init.MemInc = DMA_MINC_ENABLE;
+  hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma->Init.Mode = DMA_NORMAL;
+  hdma->Init.Priority = DMA_PRIORITY_VERY_HIGH; // a slave can't stall SCK
+  return HAL_DMA_Init(hdma);
+}
+
+HAL_StatusTypeDef spi_link_init(void) {
+  SPI_LINK_CLK_ENABLE();
+  SPI_LINK_GPIO_CLK_ENABLE();
+  SPI_LINK_NSS_CLK_ENABLE();
+  __HAL_RCC_DMAMUX1_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  GPIO_InitTypeDef g = {0};
+  HAL_GPIO_WritePin(SPI_LINK_DRDY_PORT, SPI_LINK_DRDY_PIN, GPIO_PIN_RESET);
+  g.Pin = SPI_LINK_DRDY_PIN;
+  g.Mode = GPIO_MODE_OUTPUT_PP;
+  g.Pull = GPIO_NOPULL;
+  g.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_Init(SPI_LINK_DRDY_PORT, &g);
+  g.Pin = SPI_LINK_PINS;
+  g.Mode = GPIO_MODE_AF_PP;
+  g.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  g.Alternate = SPI_LINK_AF;
+  HAL_GPIO_Init(SPI_LINK_GPIO_PORT, &g);
+  g.Pin = SPI_LINK_NSS_PIN;
+  g.Pull = GPIO_PULLUP; // deselected while the host is away
+  HAL_GPIO_Init(SPI_LINK_NSS_PORT, &g);
+
+  g_hspi.Instance = SPI_LINK_INSTANCE;
+  g_hspi.Init.Mode = SPI_MODE_SLAVE;
+  g_hspi.Init.Direction = SPI_DIRECTION_2LINES;
+  g_hspi.Init.DataSize = SPI_DATASIZE_8BIT;
+  g_hspi.Init.CLKPolarity = SPI_POLARITY_LOW;
+  g_hspi.Init.CLKPhase = SPI_PHASE_1EDGE;
+  g_hspi.Init.NSS = SPI_NSS_HARD_INPUT;
+  g_hspi.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_2; // unused as slave
+  g_hspi.Init.FirstBit = SPI_FIRSTBIT_MSB;
+  g_hspi.Init.TIMode = SPI_TIMODE_DISABLE;
+  g_hspi.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+  g_hspi.Init.CRCPolynomial = 7;
+  g_hspi.Init.CRCLength = SPI_CRC_LENGTH_DATASIZE;
+  g_hspi.Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+  if (HAL_SPI_Init(&g_hspi) != HAL_OK) return HAL_ERROR;
+
+  if (dma_init(&g_hdma_rx, SPI_LINK_RX_DMA_CHANNEL, SPI_LINK_RX_DMA_REQUEST,
+               DMA_PERIPH_TO_MEMORY) != HAL_OK ||
+      dma_init(&g_hdma_tx, SPI_LINK_TX_DMA_CHANNEL, SPI_LINK_TX_DMA_REQUEST,
+               DMA_MEMORY_TO_PERIPH) != HAL_OK) {
+    return HAL_ERROR;
+  }
+  g_hdma_rx.XferCpltCallback = rx_done;
+  g_hdma_rx.XferErrorCallback = rx_error;
+
+  // The idle answer: no payload, seq 0, its CRC fixed.
+  g_tx_idle[HDR_MAGIC] = SPI_LINK_MAGIC;
+  g_tx_idle[HDR_SEQ] = 0;
+  wr16(&g_tx_idle[HDR_LEN], 0);
+  wr16(&g_tx_idle[HDR_CRC],
+       (uint16_t)crc_sw_compute(&crc_hw_crc16_ccitt, &g_tx_idle[HDR_SEQ],
+                                SPI_LINK_HDR_SIZE - HDR_SEQ));
+
+  HAL_NVIC_SetPriority(SPI_LINK_RX_DMA_IRQn, SPI_LINK_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(SPI_LINK_RX_DMA_IRQn);
+  HAL_NVIC_SetPriority(SPI_LINK_IRQn, SPI_LINK_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(SPI_LINK_IRQn);
+
+  const uint32_t primask = irq_lock();
+  SET_BIT(SPI_LINK_INSTANCE->CR2, SPI_CR2_ERRIE);
+  xfer_arm_locked(0);
+  g_ready = 1;
+  irq_unlock(primask);
+  return HAL_OK;
+}
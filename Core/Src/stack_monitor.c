@@ -0,0 +1,107 @@
+// stack_monitor.c
+//
+// Stack high-water marks (stack_monitor.h):
+//  - a scan walks _tx_thread_created_ptr, like cpu_load_thread.c, and
+//  counts the fill words left at the low end of each stack (stacks grow
+//  down). Only the untouched low end is read, so it needs no lock.
+//  - the overflow handler runs from the scheduler on the offending thread's
+//  switch; it only counts and triggers the black box.
+//
+// Notes / Assumptions:
+//  - Stack filling is on (the ThreadX default, forced by stack checking).
+//  - Threads are never deleted, so a thread seen in the list stays valid.
+//  - A word that is the fill pattern by chance reads as unused; the mark
+//  can be low by that much.
+
+#include "stack_monitor.h"
+#include "telemetry.h"
+#include "tx_api.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern TX_THREAD *_tx_thread_created_ptr;
+
+static volatile uint32_t g_overflows = 0;
+static const char *volatile g_overflow_name = NULL;
+
+#ifdef TX_ENABLE_STACK_CHECKING
+static VOID stack_error(TX_THREAD *t) {
+  g_overflows++;
+  g_overflow_name = t ? t->tx_thread_name : NULL;
+  telemetry_blackbox_trigger(TELEMETRY_BLACKBOX_STACK);
+}
+#endif
+
+void stack_monitor_init(void) {
+#ifdef TX_ENABLE_STACK_CHECKING
+  (void)tx_thread_stack_error_notify(stack_error);
+#endif
+}
+
+static uint32_t high_water(const TX_THREAD *t) {
+  const ULONG *lo = (const ULONG *)t->tx_thread_stack_start;
+  const ULONG *hi = (const ULONG *)((const UCHAR *)t->tx_thread_stack_end + 1);
+  const ULONG *p = lo;
+  while (p < hi && *p == TX_STACK_FILL) p++;
+  return (uint32_t)((const UCHAR *)hi - (const UCHAR *)p);
+}
+
+size_t stack_monitor_scan(stack_monitor_entry_t *out, size_t cap) {
+  if (!out) return 0;
+  TX_THREAD *head = _tx_thread_created_ptr;
+  TX_THREAD *t = head;
+  size_t n = 0;
+  while (t != TX_NULL && n < cap) {
+    out[n].name = t->tx_thread_name ? t->tx_thread_name : "?";
+    out[n].size = (uint32_t)t->tx_thread_stack_size;
+    out[n].used = high_water(t);
+    n++;
+    t = t->tx_thread_created_next;
+    if (t == head) break;
+  }
+  return n;
+}
+
+uint32_t stack_monitor_overflows(const char **last) {
+  if (last) *last = g_overflow_name;
+  return g_overflows;
+}
+
+static void send_line(const char *txt, int n) {
+  if (n <= 0) return;
+  (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+void stack_monitor_report(void) {
+  stack_monitor_entry_t st[STACK_MONITOR_MAX_THREADS];
+  const size_t count = stack_monitor_scan(st, STACK_MONITOR_MAX_THREADS);
+
+  char txt[160];
+  int n = 0;
+  for (size_t i = 0; i < count; i++) {
+    char item[48];
+    const int warn = (uint64_t)st[i].used * 100u >=
+                     (uint64_t)st[i].size * STACK_MONITOR_WARN_PCT;
+    const int m = snprintf(item, sizeof(item), " %s=%lu/%lu%s", st[i].name,
+                           (unsigned long)st[i].used,
+                           (unsigned long)st[i].size, warn ? "!" : "");
+    if (m <= 0 || (size_t)m >= sizeof(item)) continue;
+    if (n > 0 && (size_t)(n + m) >= sizeof(txt)) {
+      send_line(txt, n); // full: the rest on another line
+      n = 0;
+    }
+    if (n == 0) n = snprintf(txt, sizeof(txt), "stack");
+    memcpy(&txt[n], item, (size_t)m + 1u);
+    n += m;
+  }
+  send_line(txt, n);
+
+  const char *last = NULL;
+  const uint32_t overflows = stack_monitor_overflows(&last);
+  if (overflows) {
+    n = snprintf(txt, sizeof(txt), "stack overflow n=%lu last=%s",
+                 (unsigned long)overflows, last ? last : "?");
+    if (n > 0 && (size_t)n < sizeof(txt)) send_line(txt, n);
+  }
+}
@@ -22,6 +22,31 @@
 #include "stm32g4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "tx_api.h"
+#include "can_bus.h"
+#include "dbg_marker.h"
+#include "itm_trace.h"
+#include "us_clock.h"
+#include "i2c_bus.h"
+#include "dma_copy.h"
+#include "dsp_filter.h"
+#ifdef UART_LINK_ENABLED
+#include "uart_link.h"
+#else
+#include "uart_console.h"
+#endif
+#ifdef SD_LOG_ENABLED
+#include "sd_spi.h"
+#endif
+#ifdef SPI_LINK_ENABLED
+#include "spi_link.h"
+#endif
+#ifdef PC_SAMPLE_ENABLED
+#include "pc_sample.h"
+#endif
+#ifdef LOW_POWER_STOP_ENABLED
+#include "low_power.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -36,7 +61,14 @@
 
 /* Private macro -------------------------------------------------------------*/
 /* USER CODE BEGIN PM */
-
+/* Charge handler time to ISRs in the ThreadX execution profile */
+#ifdef TX_EXECUTION_PROFILE_ENABLE
+#define ISR_PROFILE_ENTER() _tx_execution_isr_enter()
+#define ISR_PROFILE_EXIT()  _tx_execution_isr_exit()
+#else
+#define ISR_PROFILE_ENTER() ((void)0)
+#define ISR_PROFILE_EXIT()  ((void)0)
+#endif
 /* USER CODE END PM */
 
 /* Private variables ---------------------------------------------------------*/
@@ -59,7 +91,7 @@ extern PCD_HandleTypeDef hpcd_USB_FS;
 extern TIM_HandleTypeDef htim6;
 
 /* USER CODE BEGIN EV */
-
+extern FDCAN_HandleTypeDef hfdcan2;
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -166,11 +198,11 @@ void DebugMon_Handler(void)
 void USB_LP_IRQHandler(void)
 {
   /* USER CODE BEGIN USB_LP_IRQn 0 */
-
+  ISR_PROFILE_ENTER();
   /* USER CODE END USB_LP_IRQn 0 */
   HAL_PCD_IRQHandler(&hpcd_USB_FS);
   /* USER CODE BEGIN USB_LP_IRQn 1 */
-
+  ISR_PROFILE_EXIT();
   /* USER CODE END USB_LP_IRQn 1 */
 }
 
@@ -180,14 +212,262 @@ void USB_LP_IRQHandler(void)
 void TIM6_DAC_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM6_DAC_IRQn 0 */
-
+  ISR_PROFILE_ENTER();
   /* USER CODE END TIM6_DAC_IRQn 0 */
   HAL_TIM_IRQHandler(&htim6);
   /* USER CODE BEGIN TIM6_DAC_IRQn 1 */
-
+  ISR_PROFILE_EXIT();
   /* USER CODE END TIM6_DAC_IRQn 1 */
 }
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles FDCAN2 interrupt 0.
+  * Runs above the ThreadX BASEPRI mask: no kernel calls, and no execution
+  * profile hooks (they touch kernel state).
+  */
+void FDCAN2_IT0_IRQHandler(void)
+{
+  DBG_MARK_HI(CAN_ISR);
+  ITM_TRACE(ITM_EV_CAN_ISR_IN, 0);
+  can_bus_irq(&hfdcan2, 0);
+  ITM_TRACE(ITM_EV_CAN_ISR_OUT, 0);
+  DBG_MARK_LO(CAN_ISR);
+}
+
+/**
+  * @brief This function handles FDCAN2 interrupt 1 (above the mask, as IT0).
+  */
+void FDCAN2_IT1_IRQHandler(void)
+{
+  DBG_MARK_HI(CAN_ISR);
+  ITM_TRACE(ITM_EV_CAN_ISR_IN, 1);
+  can_bus_irq(&hfdcan2, 1);
+  ITM_TRACE(ITM_EV_CAN_ISR_OUT, 1);
+  DBG_MARK_LO(CAN_ISR);
+}
+
+/**
+  * @brief Spare FMAC vector, pended by the FDCAN RX ISRs to wake threads.
+  */
+void FMAC_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  can_bus_notify_irq();
+  ISR_PROFILE_EXIT();
+}
+
+#ifdef UART_LINK_ENABLED
+/**
+  * @brief This function handles DMA1 channel2 global interrupt (link TX).
+  */
+void DMA1_Channel2_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  uart_link_dma_tx_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles DMA1 channel3 global interrupt (link RX).
+  */
+void DMA1_Channel3_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  uart_link_dma_rx_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles USART1 global interrupt.
+  */
+void USART1_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  uart_link_uart_irq();
+  ISR_PROFILE_EXIT();
+}
+#else
+/**
+  * @brief This function handles DMA1 channel2 global interrupt (console TX).
+  */
+void DMA1_Channel2_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  uart_console_dma_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles USART1 global interrupt.
+  */
+void USART1_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  uart_console_uart_irq();
+  ISR_PROFILE_EXIT();
+}
+#endif
+
+/**
+  * @brief This function handles TIM2 global interrupt (microsecond clock).
+  */
+void TIM2_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  us_clock_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles DMA1 channel1 global interrupt (mem copy).
+  */
+void DMA1_Channel1_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  dma_copy_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles DMA1 channel5 global interrupt (I2C2 TX).
+  */
+void DMA1_Channel5_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  i2c_bus_dma_tx_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles DMA1 channel6 global interrupt (I2C2 RX).
+  */
+void DMA1_Channel6_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  i2c_bus_dma_rx_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles I2C2 event interrupt.
+  */
+void I2C2_EV_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  i2c_bus_ev_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles I2C2 error interrupt.
+  */
+void I2C2_ER_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  i2c_bus_er_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles DMA1 channel7 global interrupt (FMAC in).
+  */
+void DMA1_Channel7_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  dsp_filter_dma_in_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles DMA1 channel8 global interrupt (FMAC out).
+  */
+void DMA1_Channel8_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  dsp_filter_dma_out_irq();
+  ISR_PROFILE_EXIT();
+}
+
+#ifdef SD_LOG_ENABLED
+/**
+  * @brief This function handles DMA1 channel4 global interrupt (SD card TX).
+  */
+void DMA1_Channel4_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  sd_spi_dma_irq();
+  ISR_PROFILE_EXIT();
+}
+#endif
+
+#ifdef PC_SAMPLE_ENABLED
+/**
+  * @brief This function handles TIM7 global interrupt (PC sampler).
+  * Hands pc_sample_irq() the frame the interrupted context stacked: on the
+  * process stack for a thread (EXC_RETURN bit 2), else on the main stack.
+  * Runs above the ThreadX BASEPRI mask: no profile hooks.
+  */
+__attribute__((naked)) void TIM7_IRQHandler(void)
+{
+  __asm volatile(
+      "tst lr, #4\n"
+      "ite eq\n"
+      "mrseq r0, msp\n"
+      "mrsne r0, psp\n"
+      "b pc_sample_irq\n");
+}
+#endif
+
+#ifdef SPI_LINK_ENABLED
+/**
+  * @brief This function handles DMA2 channel2 global interrupt (SPI link RX).
+  */
+void DMA2_Channel2_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  spi_link_dma_rx_irq();
+  ISR_PROFILE_EXIT();
+}
+
+/**
+  * @brief This function handles SPI3 global interrupt (SPI link errors).
+  */
+void SPI3_IRQHandler(void)
+{
+  ISR_PROFILE_ENTER();
+  spi_link_spi_irq();
+  ISR_PROFILE_EXIT();
+}
+#endif
+
+#ifdef LOW_POWER_STOP_ENABLED
+/**
+  * @brief This function handles LPTIM1 global interrupt (stop idle timer).
+  * The stop wake lines run above the ThreadX BASEPRI mask, as FDCAN2: no
+  * kernel calls, no profile hooks; each one only masks itself.
+  */
+void LPTIM1_IRQHandler(void)
+{
+  low_power_wake_irq(LOW_POWER_WAKE_TIMER);
+}
+
+/**
+  * @brief This function handles EXTI line[15:10] interrupts (CAN RX wake).
+  */
+void EXTI15_10_IRQHandler(void)
+{
+  low_power_wake_irq(LOW_POWER_WAKE_CAN);
+}
+
+/**
+  * @brief This function handles USB wakeup through EXTI line 18.
+  */
+void USBWakeUp_IRQHandler(void)
+{
+  low_power_wake_irq(LOW_POWER_WAKE_USB);
+}
+#endif
+
 /* USER CODE END 1 */
@@ -0,0 +1,110 @@
+// table_swap.c
+//
+// Double-buffered tables with a grace period (see table_swap.h):
+//  - publish stores the spare as the live pointer after a barrier, so a
+//  reader that loads the new pointer also sees everything written into it.
+//  - the grace period is a bitmap of the threads that were ready (preempted,
+//  maybe inside a read) when the pointer moved, by their place in ThreadX's
+//  created list; a thread drops out once it is seen in any other state,
+//  because a reader never suspends with the table in hand.
+//  - table_swap_begin() sleeps a tick at a time until the bitmap empties,
+//  then copies the live table into the spare for the caller to edit.
+//
+// Notes / Assumptions:
+//  - Threads are never deleted, and ThreadX adds new ones at the end of the
+//  created list, so a thread keeps its place in it. Threads past
+//  TABLE_SWAP_MAX_THREADS share one flag, cleared when none of them is ready.
+//  - A thread that computes without ever suspending holds the grace period
+//  off for as long; every thread in this firmware waits on a queue, flag or
+//  sleep in its loop, and callers pass how long they are willing to wait.
+//  - Before the kernel starts nothing else runs, so there's no grace period.
+
+#include "table_swap.h"
+#include "tx_api.h"
+#include "stm32g4xx_hal.h"
+#include <string.h>
+
+extern TX_THREAD *_tx_thread_created_ptr;
+
+static int kernel_up(void) {
+  return tx_thread_identify() != TX_NULL || __get_IPSR() != 0u;
+}
+
+void table_swap_init(table_swap_t *t, void *a, void *b, size_t size,
+                     unsigned flags) {
+  if (!t || !a || !b || t->live) return;
+  t->spare = b;
+  t->size = size;
+  t->flags = (uint8_t)flags;
+  t->pending = 0;
+  t->pending_more = 0;
+  t->publishes = 0;
+  t->busy = 0;
+  __DMB();
+  t->live = a;
+}
+
+// Threads other than the caller that are ready now: all of them into the
+// bitmap (publish), or only those still in it (grace check).
+static void scan_ready(table_swap_t *t, int start) {
+  const TX_THREAD *me = tx_thread_identify();
+  uint32_t keep = 0;
+  uint8_t more = 0;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  TX_THREAD *head = _tx_thread_created_ptr;
+  TX_THREAD *th = head;
+  uint32_t i = 0;
+  while (th != TX_NULL) {
+    if (th != me && th->tx_thread_state == TX_READY) {
+      if (i < TABLE_SWAP_MAX_THREADS) {
+        if (start || (t->pending & (1u << i))) keep |= 1u << i;
+      } else if (start || t->pending_more) {
+        more = 1;
+      }
+    }
+    i++;
+    th = th->tx_thread_created_next;
+    if (th == head) break;
+  }
+  if (!start) keep &= t->pending; // a thread may only drop out
+  t->pending = keep;
+  t->pending_more = more;
+  __set_PRIMASK(primask);
+}
+
+void table_swap_publish(table_swap_t *t) {
+  if (!t || !t->live) return;
+  void *next = t->spare;
+  __DMB(); // the edits land before the pointer does
+  t->spare = t->live;
+  t->live = next;
+  t->publishes++;
+  if ((t->flags & TABLE_SWAP_ISR_READERS) || !kernel_up()) {
+    t->pending = 0;
+    t->pending_more = 0;
+    return;
+  }
+  scan_ready(t, 1);
+}
+
+void *table_swap_begin(table_swap_t *t, uint32_t wait_ms) {
+  if (!t || !t->live) return NULL;
+  if (__get_IPSR() != 0u) {
+    t->busy++;
+    return NULL;
+  }
+  ULONG left = (ULONG)(((uint64_t)wait_ms * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u);
+  for (;;) {
+    if (t->pending || t->pending_more) scan_ready(t, 0);
+    if (!t->pending && !t->pending_more) break;
+    if (left == 0 || tx_thread_identify() == TX_NULL) {
+      t->busy++;
+      return NULL;
+    }
+    left--;
+    tx_thread_sleep(1);
+  }
+  memcpy(t->spare, t->live, t->size);
+  return t->spare;
+}
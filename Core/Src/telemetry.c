@@ -2,11 +2,50 @@
 #include "telemetry.h"
 
 #include "app_threadx.h" // brings in tx_api.h usually
+#include "boot_time.h"
+#include "GB-Threads.h"
 #include "can_bus.h"
+#include "can_peer.h"
+#include "can_gw.h"
+#include "config_store.h"
+#include "dbg_marker.h"
+#include "dma_copy.h"
+#include "file_srv.h"
+#include "flash_log.h"
+#include "fw_relay.h"
+#include "fw_update.h"
+#include "hdr_comp.h"
+#include "isotp.h"
+#include "itm_trace.h"
+#include "lz_dict.h"
+#include "mem_sections.h"
+#include "profiler.h"
+#include "ring.h"
+#include "rtc_time.h"
+#include "sd_log.h"
+#include "seqlock.h"
+#include "series_codec.h"
+#include "table_swap.h"
+#include "tracex.h"
+#include "telemetry_bench.h"
+#include "telemetry_hooks.h"
+#include "us_clock.h"
+#include "usb_cdc.h"
+#ifdef UART_LINK_ENABLED
+#include "uart_link.h"
+#endif
+#ifdef SPI_LINK_ENABLED
+#include "spi_link.h"
+#endif
+#ifdef PC_SAMPLE_ENABLED
+#include "pc_sample.h"
+#endif
 #include "sedsprintf.h"
 #include "stm32g4xx_hal.h"
+#include "arm_math.h"
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,66 +65,685 @@ static void print_data_no_telem(void *data, size_t len) {
 
 static uint8_t g_can_rx_subscribed = 0;
 static int32_t g_can_side_id = -1;
+static int32_t g_usb_side_id = -1;
+#ifdef UART_LINK_ENABLED
+static int32_t g_uart_side_id = -1;
+#endif
+#ifdef SPI_LINK_ENABLED
+static int32_t g_spi_side_id = -1;
+#endif
 
-#ifndef TX_TIMER_TICKS_PER_SECOND
-#error "TX_TIMER_TICKS_PER_SECOND must be defined by ThreadX."
+// Standard CAN ID carrying serialized router packets (bulk class).
+#ifndef TELEMETRY_CAN_STD_ID
+#define TELEMETRY_CAN_STD_ID 0x03u
 #endif
 
-/* ---------------- ThreadX clock helpers (32->64 extender) ---------------- */
-static uint64_t tx_raw_now_ms(void *user) {
-  (void)user;
+// Standard CAN IDs for the higher TX classes: time sync, then errors and
+// commands. Lower than the bulk ID so they also win arbitration; both are
+// received on the high-priority FIFO0 path.
+#ifndef TELEMETRY_CAN_TIMESYNC_STD_ID
+#define TELEMETRY_CAN_TIMESYNC_STD_ID 0x01u
+#endif
+
+#ifndef TELEMETRY_CAN_CONTROL_STD_ID
+#define TELEMETRY_CAN_CONTROL_STD_ID 0x02u
+#endif
+
+// Highest ID the per-type map (TELEMETRY_CAN_ID_MAP_HEADER) may give a
+// bulk packet. Everything from TELEMETRY_CAN_STD_ID up to here is received
+// as router traffic on FIFO1.
+#ifndef TELEMETRY_CAN_STD_ID_LAST
+#define TELEMETRY_CAN_STD_ID_LAST 0x1Fu
+#endif
+
+#ifndef TELEMETRY_CAN_ID_MAP_HEADER
+#define TELEMETRY_CAN_ID_MAP_HEADER "telemetry_can_ids.h"
+#endif
+
+// Compact time-sync request/response frames (not router packets), ahead of
+// everything else on the bus.
+#ifndef TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID
+#define TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID 0x00u
+#endif
+
+// Pack small bulk-class packets several to a CAN frame (can_bus_send_packed).
+// Receivers always unpack; enable once every node on the bus runs a build
+// that does.
+#ifndef TELEMETRY_CAN_PACK
+#define TELEMETRY_CAN_PACK 0
+#endif
+
+// Compress packets of TELEMETRY_CAN_LZ_MIN_BYTES or more (lz_dict.h) before
+// they go out on CAN, when that saves bytes; mostly message and error text.
+// Such a message is [u16 TELEMETRY_CAN_LZ_MAGIC][u16 length][stream].
+// Receivers always decompress, up to TELEMETRY_CAN_LZ_MAX bytes; enable once
+// every node on the bus runs a build that does.
+#ifndef TELEMETRY_CAN_LZ
+#define TELEMETRY_CAN_LZ 0
+#endif
+#ifndef TELEMETRY_CAN_LZ_MIN_BYTES
+#define TELEMETRY_CAN_LZ_MIN_BYTES 96u
+#endif
+#ifndef TELEMETRY_CAN_LZ_MAX
+#define TELEMETRY_CAN_LZ_MAX 1024u
+#endif
+#define TELEMETRY_CAN_LZ_MAGIC 0x5A53u // 'S''Z'
+#define TELEMETRY_CAN_LZ_HDR 4u
+
+// Trace every Nth packet sent on CAN (0 = off) while this node's clock is
+// synced: it goes out as [u16 TELEMETRY_CAN_TRACE_MAGIC][u16 origin]
+// [u32 synced us at log time, low bits][packet], packets up to
+// TELEMETRY_CAN_TRACE_MAX bytes. A receiving gateway strips the header and
+// bins source-to-gateway latency per origin and data type
+// (telemetry_trace_get_stats()), in tables of TELEMETRY_TRACE_ORIGINS and
+// TELEMETRY_TRACE_TYPES entries. Receivers always strip it; enable once
+// every node on the bus runs a build that does.
+#ifndef TELEMETRY_CAN_TRACE_EVERY
+#define TELEMETRY_CAN_TRACE_EVERY 0u
+#endif
+#ifndef TELEMETRY_CAN_TRACE_MAX
+#define TELEMETRY_CAN_TRACE_MAX 256u
+#endif
+#ifndef TELEMETRY_TRACE_ORIGINS
+#define TELEMETRY_TRACE_ORIGINS 8u
+#endif
+#ifndef TELEMETRY_TRACE_TYPES
+#define TELEMETRY_TRACE_TYPES 16u
+#endif
+#define TELEMETRY_CAN_TRACE_MAGIC 0x5254u // 'T''R'
+#define TELEMETRY_CAN_TRACE_HDR 8u
+
+// This board's origin in traces (0 = folded from the chip UID).
+#ifndef TELEMETRY_NODE_ID
+#define TELEMETRY_NODE_ID 0u
+#endif
+
+// Compact series frames (series_codec.h) on one ID, bulk priority: data
+// types given a profile with telemetry_set_series() go out as delta / XOR
+// encoded single frames here instead of as router packets, and received
+// ones are handed to the router. Receiver state is per data type, so only
+// one node may send a given type this way.
+#ifndef TELEMETRY_CAN_SERIES_STD_ID
+#define TELEMETRY_CAN_SERIES_STD_ID 0x20u
+#endif
+#ifndef TELEMETRY_SERIES_CHANNELS
+#define TELEMETRY_SERIES_CHANNELS 8u
+#endif
+
+// Share of the bus the bulk class may take (can_bus_set_tx_shaping()), and
+// the burst it may send at full rate after a pause; 0 = unshaped. Time sync
+// and control are never shaped.
+#ifndef TELEMETRY_CAN_BULK_SHARE_PCT
+#define TELEMETRY_CAN_BULK_SHARE_PCT 50u
+#endif
+#ifndef TELEMETRY_CAN_BULK_BURST_US
+#define TELEMETRY_CAN_BULK_BURST_US 2000u
+#endif
+
+// Time-triggered CAN transmission (can_bus_set_tx_window()): the classes in
+// TELEMETRY_TT_CLASSES only start frames in slot TELEMETRY_TT_SLOT of a
+// TELEMETRY_TT_CYCLE_US cycle on the synchronized clock, minus a guard for
+// clock error at its end. Every board on the bus needs a slot of its own.
+// A client sends freely until its servo locks, and again after a step.
+#ifndef TELEMETRY_TT
+#define TELEMETRY_TT 0
+#endif
+#ifndef TELEMETRY_TT_CYCLE_US
+#define TELEMETRY_TT_CYCLE_US 10000u
+#endif
+#ifndef TELEMETRY_TT_SLOT_US
+#define TELEMETRY_TT_SLOT_US 2000u
+#endif
+#ifndef TELEMETRY_TT_SLOT
+#define TELEMETRY_TT_SLOT 0u
+#endif
+#ifndef TELEMETRY_TT_GUARD_US
+#define TELEMETRY_TT_GUARD_US 100u
+#endif
+#ifndef TELEMETRY_TT_CLASSES
+#define TELEMETRY_TT_CLASSES (1u << CAN_BUS_TX_PRIO_LOW)
+#endif
+
+_Static_assert((TELEMETRY_TT_SLOT + 1u) * TELEMETRY_TT_SLOT_US <=
+                       TELEMETRY_TT_CYCLE_US &&
+                   TELEMETRY_TT_GUARD_US < TELEMETRY_TT_SLOT_US,
+               "TT slot must fit its cycle");
+
+// Reassemble inbound CAN messages in the router heap (telemetryMalloc)
+// rather than the CAN driver's static pool, so the pool can be built
+// smaller (CAN_BUS_REASM_POOL_BLOCKS). The router still copies each packet
+// into its queue: it has no call that adopts a caller's buffer yet, so no
+// can_bus_set_rx_take() hook is installed.
+#ifndef TELEMETRY_CAN_RX_HEAP
+#define TELEMETRY_CAN_RX_HEAP 0
+#endif
+#if TELEMETRY_CAN_RX_HEAP && defined(RUST_HEAP_STEADY_STRICT)
+#error "TELEMETRY_CAN_RX_HEAP allocates per message; ENABLE_STATIC_HEAP forbids it"
+#endif
+
+// Advertise reassembly credits to CAN senders every this many ms (0 = off);
+// needs can_bus.c built with CAN_BUS_FLOW_CONTROL. Meant for the gateway,
+// which takes fragmented traffic from every other node.
+#ifndef TELEMETRY_CAN_CREDIT_MS
+#define TELEMETRY_CAN_CREDIT_MS 0u
+#endif
+
+// ISO-TP endpoint for standard tools: serialized router packets sent to
+// TELEMETRY_ISOTP_RX_ID enter the router from the CAN side. Defaults are the
+// usual diagnostic request/response pair; keep them clear of the router IDs.
+#ifndef TELEMETRY_ISOTP
+#define TELEMETRY_ISOTP 0
+#endif
+#ifndef TELEMETRY_ISOTP_RX_ID
+#define TELEMETRY_ISOTP_RX_ID 0x7E0u
+#endif
+#ifndef TELEMETRY_ISOTP_TX_ID
+#define TELEMETRY_ISOTP_TX_ID 0x7E8u
+#endif
+#ifndef TELEMETRY_ISOTP_RX_MAX
+#define TELEMETRY_ISOTP_RX_MAX 1024u
+#endif
+
+// Firmware update over CAN (FW_UPDATE_ENABLED): an ISO-TP session of its
+// own beside the router one, for FW_* commands (telemetry.h). RX_MAX bounds
+// one command, so an FW_DATA chunk of up to 1 KB.
+#ifndef TELEMETRY_FW_ISOTP_RX_ID
+#define TELEMETRY_FW_ISOTP_RX_ID 0x7E1u
+#endif
+#ifndef TELEMETRY_FW_ISOTP_TX_ID
+#define TELEMETRY_FW_ISOTP_TX_ID 0x7E9u
+#endif
+#ifndef TELEMETRY_FW_ISOTP_RX_MAX
+#define TELEMETRY_FW_ISOTP_RX_MAX (1024u + 16u)
+#endif
+
+// Relay packets no local endpoint consumes by copying their serialized bytes
+// to the other sides, instead of letting the router deserialize and rebuild
+// them. Needs a telemetry_peek_type() for the linked router version.
+#ifndef TELEMETRY_RELAY_CUT_THROUGH
+#define TELEMETRY_RELAY_CUT_THROUGH 0
+#endif
+
+// Drop inbound packets whose data type no local endpoint consumes while no
+// other side is up to relay them to, before they reach the router's queue.
+// Uses telemetry_peek_type() like the cut-through.
+#ifndef TELEMETRY_RX_EARLY_DROP
+#define TELEMETRY_RX_EARLY_DROP 0
+#endif
+// Inbound packets remembered to drop the copies that arrive again over a
+// second path or around a gateway loop (multiple of 4, 0 = off), and for
+// how long.
+#ifndef TELEMETRY_RX_DEDUP_SLOTS
+#define TELEMETRY_RX_DEDUP_SLOTS 64u
+#endif
+#ifndef TELEMETRY_RX_DEDUP_MS
+#define TELEMETRY_RX_DEDUP_MS 500u
+#endif
+
+// Records the asynchronous logging calls park in the intake ring until the
+// TX thread hands them to the router (power of two; 0 = call the router
+// directly). Samples or messages larger than TELEMETRY_INTAKE_DATA_MAX
+// bytes skip the ring.
+#ifndef TELEMETRY_INTAKE_SLOTS
+#define TELEMETRY_INTAKE_SLOTS 32u
+#endif
+#ifndef TELEMETRY_INTAKE_DATA_MAX
+#define TELEMETRY_INTAKE_DATA_MAX 48u
+#endif
+
+// Largest packet log_telemetry_batch() packs consecutive items into
+// (TELEMETRY_BATCH_PACK); bounds a buffer on the caller's stack.
+#ifndef TELEMETRY_BATCH_PACK_BYTES
+#define TELEMETRY_BATCH_PACK_BYTES 128u
+#endif
+
+// Intake rings for the HIGH and MID TX classes (power of two), and how long
+// a record of a lower class may wait before it is taken ahead of a higher
+// one.
+#ifndef TELEMETRY_INTAKE_PRIO_SLOTS
+#define TELEMETRY_INTAKE_PRIO_SLOTS 8u
+#endif
+#ifndef TELEMETRY_INTAKE_AGE_MS
+#define TELEMETRY_INTAKE_AGE_MS 50u
+#endif
+
+// Router heap budget for queued packets (0 = the whole Rust heap) and the
+// fill levels, in percent of it, at which each class stops being admitted
+// and CAN reassembly of bulk IDs pauses and resumes. Blocked records older
+// than TELEMETRY_SHED_AGE_MS are dropped, oldest first.
+#ifndef TELEMETRY_HEAP_BUDGET_BYTES
+#define TELEMETRY_HEAP_BUDGET_BYTES 0u
+#endif
+#ifndef TELEMETRY_BUDGET_LOW_PCT
+#define TELEMETRY_BUDGET_LOW_PCT 60u
+#endif
+#ifndef TELEMETRY_BUDGET_MID_PCT
+#define TELEMETRY_BUDGET_MID_PCT 85u
+#endif
+#ifndef TELEMETRY_RX_PAUSE_PCT
+#define TELEMETRY_RX_PAUSE_PCT 75u
+#endif
+#ifndef TELEMETRY_RX_RESUME_PCT
+#define TELEMETRY_RX_RESUME_PCT 50u
+#endif
+#ifndef TELEMETRY_SHED_AGE_MS
+#define TELEMETRY_SHED_AGE_MS 200u
+#endif
+
+// Error logging limits (log_error_*()): messages per call site per window,
+// call sites tracked, and the byte rate and burst of all error messages
+// together. TELEMETRY_ERR_FMT_BYTES is the stack buffer a message is
+// formatted into in one pass; longer ones take a second.
+#ifndef TELEMETRY_ERR_SITE_BURST
+#define TELEMETRY_ERR_SITE_BURST 3u
+#endif
+#ifndef TELEMETRY_ERR_SITE_WINDOW_MS
+#define TELEMETRY_ERR_SITE_WINDOW_MS 1000u
+#endif
+#ifndef TELEMETRY_ERR_SITES
+#define TELEMETRY_ERR_SITES 16u
+#endif
+#ifndef TELEMETRY_ERR_BYTES_PER_S
+#define TELEMETRY_ERR_BYTES_PER_S 512u
+#endif
+#ifndef TELEMETRY_ERR_BURST_BYTES
+#define TELEMETRY_ERR_BURST_BYTES 1024u
+#endif
+#ifndef TELEMETRY_ERR_FMT_BYTES
+#define TELEMETRY_ERR_FMT_BYTES 128u
+#endif
+
+// Packets per router queue whose enqueue time is held for the latency
+// histograms (power of two; 0 = off). Packets beyond it go unmeasured.
+#ifndef TELEMETRY_QLAT_SLOTS
+#define TELEMETRY_QLAT_SLOTS 64u
+#endif
+
+// Router queue pass budgets (telemetry_queue_budget_ms()): the minimum for
+// any queue with work, one more ms per TELEMETRY_QUEUE_PKTS_PER_MS packets
+// waiting, the maximum for a backlog. TX stays at the minimum while the
+// bulk CAN TX ring is TELEMETRY_QUEUE_TX_FULL_PCT full.
+#ifndef TELEMETRY_QUEUE_BUDGET_MIN_MS
+#define TELEMETRY_QUEUE_BUDGET_MIN_MS 1u
+#endif
+#ifndef TELEMETRY_QUEUE_BUDGET_MAX_MS
+#define TELEMETRY_QUEUE_BUDGET_MAX_MS 20u
+#endif
+#ifndef TELEMETRY_QUEUE_PKTS_PER_MS
+#define TELEMETRY_QUEUE_PKTS_PER_MS 16u
+#endif
+#ifndef TELEMETRY_QUEUE_TX_FULL_PCT
+#define TELEMETRY_QUEUE_TX_FULL_PCT 75u
+#endif
+
+// CAN bytes per TX class for packets that found their TX ring full, held in
+// order until a TX completion frees space (0 = hand the router
+// TELEMETRY_WOULD_BLOCK instead).
+#ifndef TELEMETRY_TX_PARK_BYTES
+#define TELEMETRY_TX_PARK_BYTES 384u
+#endif
+
+// Aggregation rules (telemetry_set_aggregation()) and the widest sample they
+// apply to; wider samples pass through unchanged.
+#ifndef TELEMETRY_AGG_MAX_RULES
+#define TELEMETRY_AGG_MAX_RULES 8u
+#endif
+#ifndef TELEMETRY_AGG_MAX_ELEMS
+#define TELEMETRY_AGG_MAX_ELEMS 8u
+#endif
+// float32 MIN/MAX/MEAN/RMS windows are reduced this many samples at a time
+// with CMSIS-DSP; costs TELEMETRY_AGG_MAX_ELEMS * 4 bytes per sample per rule.
+#ifndef TELEMETRY_AGG_BLOCK
+#define TELEMETRY_AGG_BLOCK 16u
+#endif
+// Bus-load fidelity profiles (telemetry_set_agg_profiles()), each with its
+// own aggregation channel while it isn't at full rate; bus load marks in
+// percent, the step-up margin and how long load must stay under it.
+#ifndef TELEMETRY_AGG_PROFILES
+#define TELEMETRY_AGG_PROFILES 4u
+#endif
+#ifndef TELEMETRY_AGG_LOAD_DECIMATE_PCT
+#define TELEMETRY_AGG_LOAD_DECIMATE_PCT 60u
+#endif
+#ifndef TELEMETRY_AGG_LOAD_STATS_PCT
+#define TELEMETRY_AGG_LOAD_STATS_PCT 80u
+#endif
+#ifndef TELEMETRY_AGG_LOAD_HYST_PCT
+#define TELEMETRY_AGG_LOAD_HYST_PCT 15u
+#endif
+#ifndef TELEMETRY_AGG_LOAD_HOLD_MS
+#define TELEMETRY_AGG_LOAD_HOLD_MS 5000u
+#endif
+// The monitor refreshes load once a second (CAN_BUS_MON_PERIOD_MS).
+#ifndef TELEMETRY_AGG_LOAD_POLL_MS
+#define TELEMETRY_AGG_LOAD_POLL_MS 1000u
+#endif
+// Remote rate control (telemetry_set_rate_ctrl(), TELEMETRY_CMD_RATE):
+// types per table; the gateway's pressure marks in percent; how long it
+// stays under the low mark before each step back up; the deepest level
+// (decimation 1 << level); how long a source keeps a table that isn't
+// refreshed; the uplink backlog counted as full.
+#ifndef TELEMETRY_RATE_TYPES
+#define TELEMETRY_RATE_TYPES 4u
+#endif
+#ifndef TELEMETRY_RATE_HIGH_PCT
+#define TELEMETRY_RATE_HIGH_PCT 80u
+#endif
+#ifndef TELEMETRY_RATE_LOW_PCT
+#define TELEMETRY_RATE_LOW_PCT 50u
+#endif
+#ifndef TELEMETRY_RATE_CALM_MS
+#define TELEMETRY_RATE_CALM_MS 5000u
+#endif
+#ifndef TELEMETRY_RATE_MAX_LEVEL
+#define TELEMETRY_RATE_MAX_LEVEL 4u
+#endif
+#ifndef TELEMETRY_RATE_HOLD_MS
+#define TELEMETRY_RATE_HOLD_MS 3000u
+#endif
+#ifndef TELEMETRY_RATE_BACKLOG_BYTES
+#define TELEMETRY_RATE_BACKLOG_BYTES 2048u // one half of the CDC IN buffer
+#endif
+// Broadcasts go out on the load monitor's period.
+#define TELEMETRY_RATE_POLL_MS TELEMETRY_AGG_LOAD_POLL_MS
+
+// Memory-pressure degradation (telemetry_mem_poll()): the heap fill, in
+// percent of the queue budget, that steps down to each level; the margin
+// under a level's mark and how long pressure stays there before each step
+// back up; reassembly slots left to low-priority IDs at TELEMETRY_MEM_REASM.
+#ifndef TELEMETRY_MEM_CAPTURE_PCT
+#define TELEMETRY_MEM_CAPTURE_PCT 50u
+#endif
+#ifndef TELEMETRY_MEM_AGGR_PCT
+#define TELEMETRY_MEM_AGGR_PCT 60u
+#endif
+#ifndef TELEMETRY_MEM_SHED_PCT
+#define TELEMETRY_MEM_SHED_PCT 70u
+#endif
+#ifndef TELEMETRY_MEM_REASM_PCT
+#define TELEMETRY_MEM_REASM_PCT 80u
+#endif
+#ifndef TELEMETRY_MEM_HYST_PCT
+#define TELEMETRY_MEM_HYST_PCT 10u
+#endif
+#ifndef TELEMETRY_MEM_CALM_MS
+#define TELEMETRY_MEM_CALM_MS 2000u
+#endif
+#ifndef TELEMETRY_MEM_POLL_MS
+#define TELEMETRY_MEM_POLL_MS 100u
+#endif
+#ifndef TELEMETRY_MEM_REASM_SLOTS
+#define TELEMETRY_MEM_REASM_SLOTS 4u
+#endif
+
+// Last-value cache: the newest payload of each data type the SD endpoint
+// sees, in up to TELEMETRY_LVC_SLOTS slots of TELEMETRY_LVC_VALUE_MAX bytes,
+// queried with TELEMETRY_USB_CTRL_LVC_GET on USB or UART, or a frame on
+// TELEMETRY_CAN_LVC_QUERY_STD_ID answered on TELEMETRY_CAN_LVC_REPLY_STD_ID.
+// Every type then has a local consumer, so nothing takes the cut-through.
+#ifndef TELEMETRY_LVC
+#define TELEMETRY_LVC 1
+#endif
+#ifndef TELEMETRY_LVC_SLOTS
+#define TELEMETRY_LVC_SLOTS 32u
+#endif
+#ifndef TELEMETRY_LVC_VALUE_MAX
+#define TELEMETRY_LVC_VALUE_MAX 32u
+#endif
+#ifndef TELEMETRY_LVC_REPLY_MAX
+#define TELEMETRY_LVC_REPLY_MAX 256u
+#endif
+#ifndef TELEMETRY_CAN_LVC_QUERY_STD_ID
+#define TELEMETRY_CAN_LVC_QUERY_STD_ID 0x7E1u
+#endif
+#ifndef TELEMETRY_CAN_LVC_REPLY_STD_ID
+#define TELEMETRY_CAN_LVC_REPLY_STD_ID 0x7E9u
+#endif
+
+// Raw bus capture (TELEMETRY_USB_CTRL_CAPTURE_START): bytes of records held
+// between polls (power of two, 0 = no capture), the largest capture frame,
+// and the USB TX backlog above which capture frames wait, so the router's
+// packets always find room.
+#ifndef TELEMETRY_CAPTURE_BYTES
+#define TELEMETRY_CAPTURE_BYTES 2048u
+#endif
+#ifndef TELEMETRY_CAPTURE_FRAME_MAX
+#define TELEMETRY_CAPTURE_FRAME_MAX 512u
+#endif
+#ifndef TELEMETRY_CAPTURE_USB_PENDING_MAX
+#define TELEMETRY_CAPTURE_USB_PENDING_MAX 1024u
+#endif
+
+// Trace buffer bytes per TELEMETRY_USB_CTRL_TRACEX_DUMP frame; the dump
+// waits on the same USB backlog as capture frames.
+#ifndef TELEMETRY_TRACEX_CHUNK
+#define TELEMETRY_TRACEX_CHUNK 256u
+#endif
+
+// Trace replay (TELEMETRY_USB_CTRL_REPLAY_START): bytes of records taken
+// from the host ahead of their time (0 = no replay).
+#ifndef TELEMETRY_REPLAY_BYTES
+#define TELEMETRY_REPLAY_BYTES 2048u
+#endif
+
+// Store and forward of the USB side in internal flash (0 = drop while no
+// host): replay rate in bytes per second, and the USB TX backlog above
+// which stored packets wait.
+#ifndef TELEMETRY_STORE_FORWARD
+#define TELEMETRY_STORE_FORWARD 1
+#endif
+#ifndef TELEMETRY_STORE_REPLAY_BPS
+#define TELEMETRY_STORE_REPLAY_BPS 16384u
+#endif
+#ifndef TELEMETRY_STORE_USB_PENDING_MAX
+#define TELEMETRY_STORE_USB_PENDING_MAX 512u
+#endif
+// telemetry_store_poll() interval while storing or replaying.
+#ifndef TELEMETRY_STORE_POLL_MS
+#define TELEMETRY_STORE_POLL_MS 20u
+#endif
+
+// Black box of recent bus traffic: bytes kept (power of two, 0 = none), the
+// time before and after a trigger a dump covers, and the dump frame size
+// (one flash store or SD log record each).
+#ifndef TELEMETRY_BLACKBOX_BYTES
+#define TELEMETRY_BLACKBOX_BYTES 8192u
+#endif
+#ifndef TELEMETRY_BLACKBOX_PRE_MS
+#define TELEMETRY_BLACKBOX_PRE_MS 5000u
+#endif
+#ifndef TELEMETRY_BLACKBOX_POST_MS
+#define TELEMETRY_BLACKBOX_POST_MS 1000u
+#endif
+#ifndef TELEMETRY_BLACKBOX_FRAME_MAX
+#define TELEMETRY_BLACKBOX_FRAME_MAX 480u
+#endif
+// Bus-off check interval, and the retry after the flash staging was full.
+#define TELEMETRY_BLACKBOX_POLL_MS 100u
+#define TELEMETRY_BLACKBOX_RETRY_MS 20u
 
-  static uint32_t last_ticks32 = 0;
-  static uint64_t high = 0;
+_Static_assert(TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID < TELEMETRY_CAN_TIMESYNC_STD_ID &&
+                   TELEMETRY_CAN_TIMESYNC_STD_ID < TELEMETRY_CAN_CONTROL_STD_ID &&
+                   TELEMETRY_CAN_CONTROL_STD_ID < TELEMETRY_CAN_STD_ID,
+               "CAN IDs must follow the TX class order");
+_Static_assert(TELEMETRY_CAN_SERIES_STD_ID > TELEMETRY_CAN_STD_ID_LAST,
+               "series frames need an ID outside the router range");
 
-  uint32_t cur32 = (uint32_t)tx_time_get();
-  if (cur32 < last_ticks32) {
-    high += (1ULL << 32);
+#include TELEMETRY_CAN_ID_MAP_HEADER
+
+#define TELEMETRY_CAN_ID_CHECK_(ty, id)                                     \
+  _Static_assert((id) >= TELEMETRY_CAN_TIMESYNC_STD_ID &&                   \
+                     (id) <= TELEMETRY_CAN_STD_ID_LAST,                     \
+                 "CAN ID of " #ty " out of range");
+TELEMETRY_CAN_ID_MAP(TELEMETRY_CAN_ID_CHECK_)
+
+// Class of the packet being emitted synchronously right now. tx_send() only
+// sees serialized bytes, so the code paths that know what they send set this
+// around the router call; queued and relayed packets go out as bulk.
+static volatile uint8_t g_can_tx_class = CAN_BUS_TX_PRIO_LOW;
+
+// TX class per data type for the asynchronous path, loaded from
+// g_tx_class_defaults by init_telemetry_router(); types not listed are
+// bulk. telemetry_set_tx_class() adjusts it at run time.
+static const struct {
+  SedsDataType ty;
+  can_bus_tx_prio_t prio;
+} g_tx_class_defaults[] = {
+    {SEDS_DT_TIME_SYNC_ANNOUNCE, CAN_BUS_TX_PRIO_HIGH},
+    {SEDS_DT_TIME_SYNC_REQUEST, CAN_BUS_TX_PRIO_HIGH},
+    {SEDS_DT_TIME_SYNC_RESPONSE, CAN_BUS_TX_PRIO_HIGH},
+    {SEDS_DT_GENERIC_ERROR, CAN_BUS_TX_PRIO_MID},
+};
+static uint8_t g_tx_class[TELEMETRY_RX_MAX_DATA_TYPES];
+
+static void tx_classes_build(void) {
+  memset(g_tx_class, CAN_BUS_TX_PRIO_LOW, sizeof(g_tx_class));
+  for (size_t i = 0;
+       i < sizeof(g_tx_class_defaults) / sizeof(g_tx_class_defaults[0]); i++) {
+    const uint32_t t = (uint32_t)g_tx_class_defaults[i].ty;
+    if (t < TELEMETRY_RX_MAX_DATA_TYPES)
+      g_tx_class[t] = (uint8_t)g_tx_class_defaults[i].prio;
   }
-  last_ticks32 = cur32;
+}
+
+// CAN ID per data type from TELEMETRY_CAN_ID_MAP; 0 = the TX class's ID.
+// telemetry_set_can_id() edits it while senders read it (table_swap.h).
+#define TELEMETRY_TABLE_WAIT_MS 20u
+static uint16_t g_can_type_ids[2][TELEMETRY_RX_MAX_DATA_TYPES];
+static table_swap_t g_can_ids;
+
+static void can_ids_build(void) {
+  table_swap_init(&g_can_ids, g_can_type_ids[0], g_can_type_ids[1],
+                  sizeof(g_can_type_ids[0]), 0);
+  uint16_t *ids = table_swap_begin(&g_can_ids, TELEMETRY_TABLE_WAIT_MS);
+  if (!ids) return;
+  memset(ids, 0, sizeof(g_can_type_ids[0]));
+#define TELEMETRY_CAN_ID_SET_(ty, id)                                       \
+  if ((uint32_t)(ty) < TELEMETRY_RX_MAX_DATA_TYPES)                         \
+    ids[(uint32_t)(ty)] = (uint16_t)(id);
+  TELEMETRY_CAN_ID_MAP(TELEMETRY_CAN_ID_SET_)
+#undef TELEMETRY_CAN_ID_SET_
+  table_swap_publish(&g_can_ids);
+}
+
+SedsResult telemetry_set_can_id(SedsDataType ty, uint16_t id) {
+  if ((uint32_t)ty >= TELEMETRY_RX_MAX_DATA_TYPES || id > 0x7FFu)
+    return SEDS_BAD_ARG;
+  uint16_t *ids = table_swap_begin(&g_can_ids, TELEMETRY_TABLE_WAIT_MS);
+  if (!ids) return SEDS_ERR;
+  ids[(uint32_t)ty] = id;
+  table_swap_publish(&g_can_ids);
+  return SEDS_OK;
+}
+
+static inline UNUSED_FUNCTION can_bus_tx_prio_t tx_class_of(SedsDataType ty) {
+  const uint32_t t = (uint32_t)ty;
+  if (t >= TELEMETRY_RX_MAX_DATA_TYPES) return CAN_BUS_TX_PRIO_LOW;
+  return (can_bus_tx_prio_t)g_tx_class[t];
+}
+
+SedsResult telemetry_set_tx_class(SedsDataType ty, can_bus_tx_prio_t prio) {
+  if ((uint32_t)ty >= TELEMETRY_RX_MAX_DATA_TYPES ||
+      (unsigned)prio >= CAN_BUS_TX_PRIO_COUNT)
+    return SEDS_BAD_ARG;
+  g_tx_class[(uint32_t)ty] = (uint8_t)prio;
+  return SEDS_OK;
+}
 
-  uint64_t ticks64 = high | (uint64_t)cur32;
-  return (ticks64 * 1000ULL) / (uint64_t)TX_TIMER_TICKS_PER_SECOND;
+/* ---------------- Node clock ----------------
+ * us_clock_now() (TIM2) is the raw base; everything below adds offsets. */
+static inline uint64_t tx_raw_now_us(void) { return us_clock_now(); }
+
+// Map an FDCAN hardware timestamp onto tx_raw_now_us(). Both clocks come off
+// the same crystal, so their difference sampled now applies to the capture.
+static uint64_t can_hw_to_raw_us(can_bus_t *bus, uint64_t hw_us) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint64_t node = tx_raw_now_us();
+  const uint64_t can = can_bus_time_us(bus);
+  __set_PRIMASK(primask);
+  return node - (can - hw_us);
 }
 
 /* ---------------- Time sync state (software-only; does NOT affect ThreadX scheduling) ----------------
  *
- * telemetry_now_ms()  = tx_raw_now_ms() + g_master_offset_ms
+ * telemetry_now_us()  = raw + off_us + (raw - base_raw) * freq   (raw = tx_raw_now_us())
+ * telemetry_now_ms()  = telemetry_now_us() / 1000
  * telemetry_unix_ms() = telemetry_now_ms() + g_unix_base_ms   (if valid)
  *
  * Master (RF/GPS board):
- *  - g_master_offset_ms stays 0 (it IS the master)
+ *  - the clock model stays the identity (it IS the master), unless a GNSS
+ *    PPS disciplines it (telemetry_pps_edge())
  *  - telemetry_set_unix_time_ms() updates g_unix_base_ms from GPS unix
  *  - responds to TIME_SYNC_REQUEST packets
  *  - announces unix time periodically
  *
  * Client boards:
- *  - g_master_offset_ms is adjusted from TIME_SYNC_RESPONSE (NTP math)
+ *  - the clock model is disciplined from TIME_SYNC_RESPONSE (NTP math + servo)
  *  - g_unix_base_ms is learned from TIME_SYNC_ANNOUNCE from master
+ *
+ * Both seed g_unix_base_ms from the RTC at init, so unix time is valid
+ * straight after a reset, and write the RTC back once a better source
+ * (GPS or the master) disagrees with it.
  */
-static volatile int64_t  g_master_offset_ms = 0;   // ms
-static volatile uint64_t g_last_delay_ms    = 0;   // ms (from last NTP response)
+static volatile int64_t  g_last_offset_us   = 0;   // us (from last NTP response)
+static volatile uint64_t g_last_delay_us    = 0;   // us (from last NTP response)
 static volatile int64_t  g_unix_base_ms     = 0;   // ms
 static volatile uint8_t  g_unix_valid       = 0;
+static volatile uint8_t  g_unix_from_rtc    = 0;   // base came from the local RTC
 
-static inline int64_t telemetry_master_offset_ms_get(void) {
-  return (int64_t)g_master_offset_ms;
-}
-static inline void telemetry_master_offset_ms_set(int64_t off) {
-  g_master_offset_ms = off;
+// RTC error tolerated before it is rewritten; one write costs a few ms.
+#ifndef NET_RTC_TOLERANCE_MS
+#define NET_RTC_TOLERANCE_MS 500
+#endif
+
+// Clock model: offset off_us at raw time base_raw, slewing at freq_q32
+// (units of 2^-32, so 1 ppm is ~4295). The fields are wider than one load,
+// so they can tear when read from a context that preempted a write.
+// Writers bump g_clk_seq with IRQs masked; readers retry until it is
+// unchanged across the read.
+static volatile uint64_t g_clk_base_raw = 0;
+static volatile int64_t  g_clk_off_us   = 0;
+static volatile int32_t  g_clk_freq_q32 = 0;
+static volatile uint32_t g_clk_seq      = 0;
+
+static int64_t clock_offset_at(uint64_t raw) {
+  uint32_t seq;
+  uint64_t base;
+  int64_t off;
+  int32_t freq;
+  do {
+    seq = g_clk_seq;
+    base = g_clk_base_raw;
+    off = g_clk_off_us;
+    freq = g_clk_freq_q32;
+  } while (seq != g_clk_seq);
+  return off + (((int64_t)(raw - base) * freq) >> 32);
 }
-static inline uint64_t telemetry_last_delay_ms_get(void) {
-  return (uint64_t)g_last_delay_ms;
+
+static void clock_set(uint64_t base_raw, int64_t off_us, int32_t freq_q32) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_clk_base_raw = base_raw;
+  g_clk_off_us = off_us;
+  g_clk_freq_q32 = freq_q32;
+  g_clk_seq++;
+  __set_PRIMASK(primask);
 }
-static inline void telemetry_last_delay_ms_set(uint64_t d) {
-  g_last_delay_ms = d;
+
+static uint64_t raw_to_node_us(uint64_t raw) {
+  int64_t t = (int64_t)raw + clock_offset_at(raw);
+  if (t < 0) t = 0;
+  return (uint64_t)t;
 }
 
 /* Public helpers */
+uint64_t telemetry_now_us(void) {
+  return raw_to_node_us(tx_raw_now_us());
+}
+
 uint64_t telemetry_now_ms(void) {
-  int64_t t = (int64_t)tx_raw_now_ms(NULL) + telemetry_master_offset_ms_get();
-  if (t < 0) t = 0;
-  return (uint64_t)t;
+  return telemetry_now_us() / 1000ULL;
 }
 
 uint64_t telemetry_unix_ms(void) {
@@ -103,363 +761,6339 @@ uint8_t telemetry_unix_is_valid(void) {
   return g_unix_valid;
 }
 
+// Keep the RTC within NET_RTC_TOLERANCE_MS of an authoritative unix time.
+static void rtc_follow_unix(uint64_t unix_ms) {
+  uint64_t rtc_ms = 0;
+  if (rtc_time_get_unix_ms(&rtc_ms) == HAL_OK) {
+    const int64_t err = (int64_t)(rtc_ms - unix_ms);
+    if (err < NET_RTC_TOLERANCE_MS && err > -NET_RTC_TOLERANCE_MS) return;
+  }
+  (void)rtc_time_set_unix_ms(unix_ms); // HAL_BUSY until the LSE is up
+}
+
 void telemetry_set_unix_time_ms(uint64_t unix_ms) {
 #if TELEMETRY_TIME_MASTER
   const int64_t now = (int64_t)telemetry_now_ms();
   g_unix_base_ms = (int64_t)unix_ms - now;
+  g_unix_from_rtc = 0;
   g_unix_valid = 1;
+  rtc_follow_unix(unix_ms);
 #else
   (void)unix_ms;
 #endif
 }
 
 static uint64_t node_now_since_ms(void *user);
+static void tt_update(void);
+static int series_claims(const uint8_t *bytes, size_t len);
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+static void intake_init(void);
+static void block_init(void);
+#endif
 
 /* ---------------- NTP math ---------------- */
+#if !TELEMETRY_TIME_MASTER
+// Works in whatever unit the four stamps share (microseconds on the wire).
 static void compute_offset_delay(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4,
-                                 int64_t *offset_ms, uint64_t *delay_ms) {
+                                 int64_t *offset, uint64_t *delay) {
   const int64_t o = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
   const int64_t d = (int64_t)(t4 - t1) - (int64_t)(t3 - t2);
-  *offset_ms = o;
-  *delay_ms = (d < 0) ? 0 : (uint64_t)d;
+  *offset = o;
+  *delay = (d < 0) ? 0 : (uint64_t)d;
 }
-
-#ifndef NET_TIMESYNC_MAX_STEP_MS
-#define NET_TIMESYNC_MAX_STEP_MS 30000
 #endif
 
-#ifndef NET_TIMESYNC_SMOOTH_DIV
-#define NET_TIMESYNC_SMOOTH_DIV 4
+/* ---------------- Time-sync stamps ----------------
+ *
+ * t1..t4 are taken from the FDCAN timestamp counter (SOF of the frame on the
+ * wire) when the capture belongs to this exchange, otherwise from software
+ * at the point the packet is handled. A capture is trusted only if it lies
+ * within NET_TIMESYNC_HW_WINDOW_US of the software stamp it replaces, which
+ * rejects a stale capture from an earlier exchange.
+ *
+ * NET_TIMESYNC_SW_STAMPS=1 ignores the captures on both sides, for
+ * comparing against the hardware stamps (timesync_bench.h).
+ */
+#ifndef NET_TIMESYNC_HW_WINDOW_US
+#define NET_TIMESYNC_HW_WINDOW_US 20000u
 #endif
 
-static void client_apply_offset_ms(int64_t offset_ms) {
-  if (offset_ms > NET_TIMESYNC_MAX_STEP_MS || offset_ms < -NET_TIMESYNC_MAX_STEP_MS) {
-    return;
-  }
-
-  // Smooth to avoid jitter
-  int64_t step = offset_ms / (int64_t)NET_TIMESYNC_SMOOTH_DIV;
-  if (step == 0) {
-    if (offset_ms > 0) step = 1;
-    else if (offset_ms < 0) step = -1;
-  }
+#ifndef NET_TIMESYNC_SW_STAMPS
+#define NET_TIMESYNC_SW_STAMPS 0
+#endif
 
-  g_master_offset_ms += step;
+// `hw_us` on the timestamp scale of `bus`, each controller having its own.
+static uint64_t hw_to_node_us(can_bus_t *bus, uint64_t hw_us) {
+  return raw_to_node_us(can_hw_to_raw_us(bus, hw_us));
 }
 
-/* ---------------- Global router state ---------------- */
-RouterState g_router = {.r = NULL, .created = 0, .start_time = 0};
-
-/* ---------------- TX helpers ---------------- */
-SedsResult tx_send(const uint8_t *bytes, size_t len, void *user) {
-  (void)user;
-  if (!bytes || len == 0) return SEDS_BAD_ARG;
-  return (can_bus_send_large(bytes, len, 0x03) == HAL_OK) ? SEDS_OK : SEDS_IO;
+// Pick the hardware stamp if it is within the window of `sw_us`.
+static uint64_t pick_stamp_us(can_bus_t *bus, HAL_StatusTypeDef have_hw,
+                              uint64_t hw_us, uint64_t sw_us) {
+  if (NET_TIMESYNC_SW_STAMPS || have_hw != HAL_OK) return sw_us;
+  const uint64_t t = hw_to_node_us(bus, hw_us);
+  const uint64_t d = (t > sw_us) ? (t - sw_us) : (sw_us - t);
+  return (d <= NET_TIMESYNC_HW_WINDOW_US) ? t : sw_us;
 }
 
-/* ---------------- Local endpoint handler(s) ---------------- */
-SedsResult on_sd_packet(const SedsPacketView *pkt, void *user) {
-  (void)user;
-  (void)pkt;
-  return SEDS_OK;
+#if TELEMETRY_TIME_MASTER
+// Receive time of a router-format request that came in over CAN.
+static uint64_t rx_stamp_us(void) {
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  uint64_t hw = 0;
+  const HAL_StatusTypeDef st =
+      can_bus_last_rx_time_us(bus, TELEMETRY_CAN_TIMESYNC_STD_ID, &hw);
+  return pick_stamp_us(bus, st, hw, telemetry_now_us());
 }
+#endif
 
-/* ---------------- Time sync endpoint ----------------
+/* ---------------- Clock servo ----------------
  *
- * Handles:
- *  - TIME_SYNC_RESPONSE (clients): compute offset and update g_master_offset_ms
- *  - TIME_SYNC_REQUEST  (master): reply with [seq, t1, t2, t3]
- *  - TIME_SYNC_ANNOUNCE (clients): learn unix_ms base
+ * Requests go out in bursts of NET_TIMESYNC_BURST; only the sample with the
+ * smallest round trip of each burst is used, and a burst whose best delay is
+ * well above the recent floor (queueing behind bulk traffic) is dropped.
  *
- * NOTE:
- * This endpoint only updates *software* time. It does NOT affect ThreadX scheduling.
+ * The first sample steps the clock, the second one also measures the drift
+ * since the step. After that a PI loop on the residual offset sets the slew
+ * rate: the I term tracks oscillator drift, the P term removes the phase
+ * error over roughly one burst interval. Large residuals are stepped.
+ *
+ * The pause between bursts starts at NET_TIMESYNC_ACQUIRE_PERIOD_MS and
+ * doubles after every burst that lands within NET_TIMESYNC_LOCK_US, up to
+ * NET_TIMESYNC_MAX_PERIOD_MS; a burst outside the bound (or a step) drops
+ * it back, an empty or high-delay burst keeps it. Each pause gets +-NET_TIMESYNC_JITTER_PCT of random jitter so
+ * boards that booted together don't keep requesting in lockstep.
+ *
+ * The pacing and lock bound are field tunables (config_store.h) with these
+ * defines as defaults; a new value applies from the next burst.
+ *
+ * NET_TIMESYNC_STEP_ONLY=1 replaces the PI loop with a step by every
+ * accepted offset and no slew, the plain offset-stepping client, as a
+ * baseline for timesync_bench.h.
  */
-static SedsResult on_timesync(const SedsPacketView *pkt, void *user) {
-  (void)user;
-  if (!pkt || !pkt->payload) return SEDS_ERR;
+#ifndef NET_TIMESYNC_MAX_STEP_MS
+#define NET_TIMESYNC_MAX_STEP_MS 30000
+#endif
 
-  // ---------- Client: handle response ----------
-  if (pkt->ty == SEDS_DT_TIME_SYNC_RESPONSE && pkt->payload_len >= 32) {
-    uint64_t seq = 0, t1 = 0, t2 = 0, t3 = 0;
-    memcpy(&seq, pkt->payload + 0, 8);
-    memcpy(&t1,  pkt->payload + 8, 8);
-    memcpy(&t2,  pkt->payload + 16, 8);
-    memcpy(&t3,  pkt->payload + 24, 8);
+#ifndef NET_TIMESYNC_BURST
+#define NET_TIMESYNC_BURST 4u
+#endif
 
-    const uint64_t t4 = tx_raw_now_ms(NULL);
+#ifndef NET_TIMESYNC_BURST_GAP_MS
+#define NET_TIMESYNC_BURST_GAP_MS 100u
+#endif
 
-    int64_t offset_ms = 0;
-    uint64_t delay_ms = 0;
-    compute_offset_delay(t1, t2, t3, t4, &offset_ms, &delay_ms);
+// Shortest and longest pause between bursts.
+#ifndef NET_TIMESYNC_ACQUIRE_PERIOD_MS
+#define NET_TIMESYNC_ACQUIRE_PERIOD_MS 2000u
+#endif
 
-#if !TELEMETRY_TIME_MASTER
-    client_apply_offset_ms(offset_ms);
+#ifndef NET_TIMESYNC_MAX_PERIOD_MS
+#define NET_TIMESYNC_MAX_PERIOD_MS 128000u
 #endif
-    telemetry_last_delay_ms_set(delay_ms);
-    (void)seq;
-    return SEDS_OK;
-  }
 
-  // ---------- Master: handle request ----------
-  if (pkt->ty == SEDS_DT_TIME_SYNC_REQUEST && pkt->payload_len >= 16) {
-#if TELEMETRY_TIME_MASTER
-    uint64_t seq = 0, t1 = 0;
-    memcpy(&seq, pkt->payload + 0, 8);
-    memcpy(&t1,  pkt->payload + 8, 8);
+#ifndef NET_TIMESYNC_JITTER_PCT
+#define NET_TIMESYNC_JITTER_PCT 12u
+#endif
 
-    // t2: time at receive (master local base)
-    const uint64_t t2 = tx_raw_now_ms(NULL);
+#ifndef NET_TIMESYNC_STEP_US
+#define NET_TIMESYNC_STEP_US 2000
+#endif
 
-    // Optional: if you do real work here, set t3 right before sending.
-    const uint64_t t3 = tx_raw_now_ms(NULL);
+#ifndef NET_TIMESYNC_LOCK_US
+#define NET_TIMESYNC_LOCK_US 200
+#endif
 
-    const uint64_t resp[4] = {seq, t1, t2, t3};
+#ifndef NET_TIMESYNC_KP_PCT
+#define NET_TIMESYNC_KP_PCT 70
+#endif
 
-    // Timestamp the packet at t3 (master local base)
-    // Router will relay/broadcast it; clients match seq and compute offset.
-    return seds_router_log_ts(g_router.r, SEDS_DT_TIME_SYNC_RESPONSE, t3, resp, 4);
-#else
-    return SEDS_OK;
+#ifndef NET_TIMESYNC_KI_PCT
+#define NET_TIMESYNC_KI_PCT 30
 #endif
-  }
 
-  // ---------- Client: learn unix time from announce ----------
-  // announce payload:
-  //   [priority, unix_ms]
-  if (pkt->ty == SEDS_DT_TIME_SYNC_ANNOUNCE && pkt->payload_len >= 16) {
-#if !TELEMETRY_TIME_MASTER
-    uint64_t priority = 0;
-    uint64_t unix_ms  = 0;
-    memcpy(&priority, pkt->payload + 0, 8);
-    memcpy(&unix_ms,  pkt->payload + 8, 8);
+#ifndef NET_TIMESYNC_MAX_PPM
+#define NET_TIMESYNC_MAX_PPM 500
+#endif
 
-    // Half-RTT correction from last response (best-effort)
-    const uint64_t half_delay = telemetry_last_delay_ms_get() / 2ULL;
+#ifndef NET_TIMESYNC_DELAY_SLACK_US
+#define NET_TIMESYNC_DELAY_SLACK_US 500u
+#endif
 
-    // Set base so telemetry_unix_ms() matches
-    const int64_t now = (int64_t)telemetry_now_ms();
-    g_unix_base_ms = (int64_t)(unix_ms + half_delay) - now;
-    g_unix_valid = 1;
+#ifndef NET_TIMESYNC_STEP_ONLY
+#define NET_TIMESYNC_STEP_ONLY 0
+#endif
 
-    (void)priority;
+#define NET_TIMESYNC_MAX_FREQ_Q32 ((int64_t)NET_TIMESYNC_MAX_PPM * 4295)
+
+/*
+ * Broadcast sync (NET_TIMESYNC_BROADCAST=1 on every board): the master sends
+ * a SYNC frame every NET_TIMESYNC_SYNC_PERIOD_MS and, once its TX event has
+ * the SOF stamp, a FOLLOW_UP with that stamp. Each client stamps the SYNC on
+ * arrival and feeds master TX time + one-way path delay - its arrival time
+ * to the servo, so sync traffic no longer grows with the number of boards.
+ * The path delay (half the best round trip) still comes from request
+ * bursts, but while SYNCs keep arriving those run only every
+ * NET_TIMESYNC_DELAY_PERIOD_MS. A client that misses NET_TIMESYNC_SYNC_LOSS
+ * SYNC periods falls back to the request pacing above.
+ */
+#ifndef NET_TIMESYNC_BROADCAST
+#define NET_TIMESYNC_BROADCAST 0
 #endif
-    return SEDS_OK;
+
+#ifndef NET_TIMESYNC_SYNC_PERIOD_MS
+#define NET_TIMESYNC_SYNC_PERIOD_MS 1000u
+#endif
+
+// SYNC to FOLLOW_UP: long enough for the TX event to come back.
+#ifndef NET_TIMESYNC_FOLLOW_UP_MS
+#define NET_TIMESYNC_FOLLOW_UP_MS 5u
+#endif
+
+#ifndef NET_TIMESYNC_DELAY_PERIOD_MS
+#define NET_TIMESYNC_DELAY_PERIOD_MS 60000u
+#endif
+
+#ifndef NET_TIMESYNC_SYNC_LOSS
+#define NET_TIMESYNC_SYNC_LOSS 4u
+#endif
+
+/*
+ * Boundary clock (TELEMETRY_TIME_BOUNDARY=1, on a client gateway bridging
+ * segments): the servo above syncs this board to the master on
+ * TELEMETRY_CAN_BUS, and the board serves time on TELEMETRY_TIME_DOWN_BUS
+ * from its own disciplined clock, as the master does on its bus: requests
+ * are answered from that controller's RX interrupt and, with
+ * NET_TIMESYNC_BROADCAST, SYNC / FOLLOW_UP go out there too
+ * (telemetry_boundary_poll()). A client downstream sees the path delay of
+ * one hop, however many gateways stand between it and the master.
+ *
+ * Requests go unanswered until the servo tracks, so downstream clients
+ * never learn a clock still being stepped. The downstream controller must
+ * filter TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID into FIFO0, and no gateway
+ * route (can_bus_set_routes()) may carry that ID across: each segment has
+ * its own exchange on it.
+ */
+#ifndef TELEMETRY_TIME_BOUNDARY
+#define TELEMETRY_TIME_BOUNDARY 0
+#endif
+
+#if TELEMETRY_TIME_BOUNDARY && TELEMETRY_TIME_MASTER
+#error "TELEMETRY_TIME_BOUNDARY is for a client; the master serves its own bus"
+#endif
+#if TELEMETRY_TIME_BOUNDARY && TELEMETRY_TIME_DOWN_BUS == TELEMETRY_CAN_BUS
+#error "TELEMETRY_TIME_DOWN_BUS must be another controller than TELEMETRY_CAN_BUS"
+#endif
+
+// Answers requests (and broadcasts) on TIMESYNC_SERVE_BUS.
+#define TIMESYNC_SERVES (TELEMETRY_TIME_MASTER || TELEMETRY_TIME_BOUNDARY)
+#if TELEMETRY_TIME_BOUNDARY
+#define TIMESYNC_SERVE_BUS TELEMETRY_TIME_DOWN_BUS
+#else
+#define TIMESYNC_SERVE_BUS TELEMETRY_CAN_BUS
+#endif
+
+#if !TELEMETRY_TIME_MASTER
+typedef enum {
+  SERVO_UNSYNCED = 0,
+  SERVO_STEPPED,
+  SERVO_TRACKING,
+} servo_state_t;
+
+static servo_state_t g_servo_state = SERVO_UNSYNCED;
+static uint64_t g_servo_last_raw = 0;
+static int64_t  g_servo_drift_q32 = 0;
+static uint8_t  g_servo_locked = 0;
+static uint8_t  g_servo_drift_restored = 0; // g_servo_drift_q32 from backup
+static uint64_t g_delay_floor_us = UINT64_MAX;
+static uint32_t g_sync_period_ms = NET_TIMESYNC_ACQUIRE_PERIOD_MS;
+static uint32_t g_sync_pause_ms = NET_TIMESYNC_ACQUIRE_PERIOD_MS;
+static uint32_t g_jitter_state = 0;
+
+// Quality counters for telemetry_timesync_get_stats(); the fields it
+// derives on read (state, floor, age, period, drift) stay zero here.
+static telemetry_timesync_stats_t g_ts_stats;
+static uint64_t g_ts_last_good_raw = 0; // 0 = never
+static uint64_t g_ts_first_req_raw = 0;  // 0 = nothing sent yet
+#if NET_TIMESYNC_BROADCAST
+static uint64_t g_path_delay_us = UINT64_MAX; // one way, from the bursts
+static uint64_t g_bsync_last_raw = 0;         // last SYNC applied, 0 = never
+static struct {
+  uint32_t seq;
+  uint8_t valid;
+  uint64_t t2; // arrival of SYNC `seq`, node time
+} g_bsync;
+#endif
+static const uint32_t k_ts_hist_edges_us[TELEMETRY_TIMESYNC_HIST_BINS - 1u] = {
+    10u, 30u, 100u, 300u, 1000u, 3000u, 10000u};
+
+static uint32_t ts_hist_bin(uint64_t v_us) {
+  uint32_t i = 0;
+  while (i < TELEMETRY_TIMESYNC_HIST_BINS - 1u && v_us >= k_ts_hist_edges_us[i]) i++;
+  return i;
+}
+
+static struct {
+  uint32_t first_seq;
+  uint8_t sent;
+  uint8_t got;
+  uint8_t done;
+  uint64_t t1[NET_TIMESYNC_BURST];
+  int64_t best_offset_us;
+  uint64_t best_delay_us;
+} g_burst = {.sent = NET_TIMESYNC_BURST, .done = 1}; // first request opens one
+
+static int64_t clamp_freq(int64_t f) {
+  if (f > NET_TIMESYNC_MAX_FREQ_Q32) return NET_TIMESYNC_MAX_FREQ_Q32;
+  if (f < -NET_TIMESYNC_MAX_FREQ_Q32) return -NET_TIMESYNC_MAX_FREQ_Q32;
+  return f;
+}
+
+// Step the model by step_us at raw. Unix time still seeded from the RTC
+// moves with it, so it doesn't jump when the master's clock is adopted.
+static void servo_step(uint64_t raw, int64_t off, int64_t step_us) {
+  clock_set(raw, off + step_us, (int32_t)g_servo_drift_q32);
+  if (g_unix_from_rtc) g_unix_base_ms -= step_us / 1000;
+  g_servo_locked = 0;
+  g_ts_stats.steps++;
+  tt_update();
+}
+
+static int servo_within_lock(int64_t offset_us) {
+  const int64_t lock_us = (int64_t)config_get(CONFIG_TIMESYNC_LOCK_US);
+  return offset_us <= lock_us && offset_us >= -lock_us;
+}
+
+// First lock since boot: convergence time from the first request.
+static void servo_note_lock(uint64_t raw) {
+  if (!g_servo_locked || g_ts_stats.converge_ms != 0) return;
+  const uint64_t ms = (raw - g_ts_first_req_raw) / 1000ULL;
+  g_ts_stats.converge_ms = (ms == 0) ? 1u : (ms > UINT32_MAX) ? UINT32_MAX : (uint32_t)ms;
+}
+
+static void servo_update(int64_t offset_us) {
+  const int64_t max_us = (int64_t)NET_TIMESYNC_MAX_STEP_MS * 1000;
+  if (offset_us > max_us || offset_us < -max_us) {
+    g_ts_stats.rejected_steps++;
+    return;
   }
 
-  return SEDS_OK;
+  // Rebase at now so the change never bends time already handed out.
+  const uint64_t raw = tx_raw_now_us();
+  const int64_t off = clock_offset_at(raw);
+  const uint64_t dt = raw - g_servo_last_raw;
+  g_servo_last_raw = raw;
+
+#if NET_TIMESYNC_STEP_ONLY
+  (void)dt;
+  servo_step(raw, off, offset_us);
+  g_servo_state = SERVO_TRACKING;
+  g_servo_locked = (uint8_t)servo_within_lock(offset_us);
+  servo_note_lock(raw);
+  tt_update();
+  return;
+#endif
+
+  const int64_t step = (int64_t)NET_TIMESYNC_STEP_US;
+  if (g_servo_state == SERVO_UNSYNCED || dt == 0) {
+    servo_step(raw, off, offset_us);
+    // A drift saved before the reset skips the frequency-estimate step.
+    g_servo_state = g_servo_drift_restored ? SERVO_TRACKING : SERVO_STEPPED;
+    return;
+  }
+
+  // Residual as a rate over the last interval, in 2^-32 units. |offset_us|
+  // is bounded by NET_TIMESYNC_MAX_STEP_MS, so this can't overflow.
+  const int64_t ratio_q32 = (offset_us * ((int64_t)1 << 32)) / (int64_t)dt;
+
+  if (g_servo_state == SERVO_STEPPED) {
+    g_servo_drift_q32 = clamp_freq(g_servo_drift_q32 + ratio_q32);
+    servo_step(raw, off, offset_us);
+    g_servo_state = SERVO_TRACKING;
+    return;
+  }
+
+  if (offset_us > step || offset_us < -step) {
+    servo_step(raw, off, offset_us);
+    return;
+  }
+
+  g_servo_drift_q32 =
+      clamp_freq(g_servo_drift_q32 + (ratio_q32 * NET_TIMESYNC_KI_PCT) / 100);
+  const int64_t freq =
+      clamp_freq(g_servo_drift_q32 + (ratio_q32 * NET_TIMESYNC_KP_PCT) / 100);
+  clock_set(raw, off, (int32_t)freq);
+  g_servo_locked = (uint8_t)servo_within_lock(offset_us);
+  if (g_servo_locked) rtc_time_save_drift((int32_t)g_servo_drift_q32);
+  servo_note_lock(raw);
+  tt_update();
 }
 
-/* ---------------- Router timebase ---------------- */
-static uint64_t node_now_since_ms(void *user) {
-  (void)user;
-  const uint64_t now = telemetry_now_ms();
-  const RouterState s = g_router;
-  return s.r ? (now - s.start_time) : 0;
+// xorshift32, seeded from the device UID so each board draws differently.
+static uint32_t jitter_next(void) {
+  uint32_t x = g_jitter_state;
+  if (x == 0) {
+    x = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2() ^ (uint32_t)tx_raw_now_us();
+    if (x == 0) x = 0x9E3779B9u;
+  }
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  g_jitter_state = x;
+  return x;
 }
 
-/* ---------------- RX helpers ---------------- */
-static void telemetry_can_rx(const uint8_t *data, size_t len, void *user) {
-  (void)user;
-  rx_asynchronous(data, len);
+// An offset measured well enough to steer by: a burst's best sample, or a
+// broadcast SYNC.
+static void servo_accept(int64_t cur) {
+  // RFC 3550 style: move 1/16 of the way towards each new |change|.
+  const int64_t prev = g_ts_stats.last_offset_us;
+  if (g_ts_last_good_raw != 0) {
+    const uint64_t dv = (uint64_t)((cur > prev) ? cur - prev : prev - cur);
+    const uint32_t j = g_ts_stats.jitter_us;
+    const uint32_t dj = (dv > UINT32_MAX) ? UINT32_MAX : (uint32_t)dv;
+    g_ts_stats.jitter_us = (dj >= j) ? j + (dj - j) / 16u : j - (j - dj) / 16u;
+  }
+  g_ts_stats.last_offset_us = cur;
+  g_ts_last_good_raw = tx_raw_now_us();
+  servo_update(cur);
 }
 
-void rx_asynchronous(const uint8_t *bytes, size_t len) {
-#ifndef TELEMETRY_ENABLED
+#if NET_TIMESYNC_BROADCAST
+// SYNCs are arriving, so bursts only have to keep the path delay current.
+static int bsync_live(void) {
+  return g_bsync_last_raw != 0 &&
+         tx_raw_now_us() - g_bsync_last_raw <
+             (uint64_t)NET_TIMESYNC_SYNC_LOSS * NET_TIMESYNC_SYNC_PERIOD_MS *
+                 1000ULL;
+}
+#endif
+
+static void schedule_next_burst(void) {
+  const uint32_t span =
+      (g_sync_period_ms / 100u) * config_get(CONFIG_TIMESYNC_JITTER_PCT);
+  const uint32_t j = (span != 0) ? (jitter_next() % (2u * span + 1u)) : 0;
+  g_sync_pause_ms = g_sync_period_ms - span + j;
+#if NET_TIMESYNC_BROADCAST
+  if (bsync_live() && g_sync_pause_ms < NET_TIMESYNC_DELAY_PERIOD_MS)
+    g_sync_pause_ms = NET_TIMESYNC_DELAY_PERIOD_MS - span + j;
+#endif
+}
+
+static void burst_finish(void) {
+  g_burst.done = 1;
+  // Nothing came back: keep the current pace, the master may just be busy.
+  if (g_burst.got == 0) {
+    schedule_next_burst();
+    return;
+  }
+
+  const uint64_t d = g_burst.best_delay_us;
+  const uint8_t ok = (g_delay_floor_us == UINT64_MAX) ||
+                     (d <= g_delay_floor_us + NET_TIMESYNC_DELAY_SLACK_US);
+  // The floor creeps up so a slower path is accepted after a few bursts.
+  if (d < g_delay_floor_us) g_delay_floor_us = d;
+  else g_delay_floor_us += NET_TIMESYNC_DELAY_SLACK_US / 4u;
+
+  g_ts_stats.bursts++;
+  if (ok) {
+    g_ts_stats.last_delay_us = d;
+#if NET_TIMESYNC_BROADCAST
+    g_path_delay_us = d / 2u;
+#endif
+    servo_accept(g_burst.best_offset_us);
+  } else {
+    g_ts_stats.bursts_rejected++;
+  }
+
+  // A burst dropped for delay says nothing about the clock; hold the pace
+  // rather than add traffic to a busy bus.
+  if (!ok) {
+    // keep g_sync_period_ms
+  } else if (!g_servo_locked) {
+    g_sync_period_ms = config_get(CONFIG_TIMESYNC_ACQUIRE_PERIOD_MS);
+  } else {
+    const uint32_t max_ms = config_get(CONFIG_TIMESYNC_MAX_PERIOD_MS);
+    g_sync_period_ms = (g_sync_period_ms < max_ms / 2u)
+                           ? g_sync_period_ms * 2u : max_ms;
+  }
+  schedule_next_burst();
+}
+
+// t1 of request `seq` if it belongs to the open burst and hasn't been
+// answered yet, else 0. Responses to other clients are broadcast too; each
+// client's sequence numbers start at a random point, so they don't overlap.
+static uint64_t burst_t1(uint32_t seq) {
+  const uint32_t idx = seq - g_burst.first_seq;
+  if (g_burst.done || idx >= g_burst.sent) return 0;
+  return g_burst.t1[idx];
+}
+
+static void burst_sample(uint32_t seq, int64_t offset_us, uint64_t delay_us) {
+  const uint32_t idx = seq - g_burst.first_seq;
+  if (g_burst.done || idx >= g_burst.sent || g_burst.t1[idx] == 0) return;
+  g_burst.t1[idx] = 0; // count each request once
+
+  const uint64_t mag = (uint64_t)((offset_us < 0) ? -offset_us : offset_us);
+  g_ts_stats.samples++;
+  g_ts_stats.offset_hist[ts_hist_bin(mag)]++;
+  g_ts_stats.delay_hist[ts_hist_bin(delay_us)]++;
+
+  if (delay_us < g_burst.best_delay_us) {
+    g_burst.best_delay_us = delay_us;
+    g_burst.best_offset_us = offset_us;
+  }
+  g_burst.got++;
+  if (g_burst.got == NET_TIMESYNC_BURST) burst_finish();
+}
+#endif
+
+/* ---------------- PPS discipline (master) ----------------
+ *
+ * With a GNSS receiver (gnss_time.h) the master's node clock is steered so
+ * that whole seconds of telemetry_now_us() fall on the PPS edges, and unix
+ * time is read off the edge the NMEA sentence labelled, so responses and
+ * announces carry the receiver's time to the microsecond rather than to
+ * the UART latency of a sentence.
+ *
+ * Each edge gives a phase error: how far the node clock is past the
+ * nearest whole second at the captured edge. The first edge, and any error
+ * beyond NET_PPS_STEP_US, steps the clock; otherwise the same PI loop as
+ * the client servo (NET_TIMESYNC_KP_PCT / KI_PCT, +-NET_TIMESYNC_MAX_PPM)
+ * slews it, with the PPS as the reference. Edges are handled in a thread,
+ * after the fact; the capture is exact regardless.
+ */
+#ifndef NET_PPS_STEP_US
+#define NET_PPS_STEP_US 1000
+#endif
+
+// Phase error that counts as locked; the capture resolution is 1 us.
+#ifndef NET_PPS_LOCK_US
+#define NET_PPS_LOCK_US 5
+#endif
+
+#if TELEMETRY_TIME_MASTER
+static telemetry_pps_stats_t g_pps;
+static uint64_t g_pps_last_set_raw = 0; // last rebase of the model
+static uint64_t g_pps_last_edge_raw = 0;
+static int64_t  g_pps_drift_q32 = 0;
+
+static int64_t pps_clamp_freq(int64_t f) {
+  if (f > NET_TIMESYNC_MAX_FREQ_Q32) return NET_TIMESYNC_MAX_FREQ_Q32;
+  if (f < -NET_TIMESYNC_MAX_FREQ_Q32) return -NET_TIMESYNC_MAX_FREQ_Q32;
+  return f;
+}
+#endif
+
+void telemetry_pps_edge(uint64_t raw_us, uint64_t unix_ms) {
+#if TELEMETRY_TIME_MASTER
+  const uint64_t edge_node = raw_to_node_us(raw_us);
+  int64_t err = (int64_t)(edge_node % 1000000ULL);
+  if (err >= 500000) err -= 1000000;
+  const uint64_t second_node = edge_node - (uint64_t)err; // nearest whole second
+
+  // Rebase at now, like the client servo, so time already handed out stays.
+  const uint64_t raw = tx_raw_now_us();
+  const int64_t off = clock_offset_at(raw);
+  const uint64_t dt = raw - g_pps_last_set_raw;
+  g_pps.edges++;
+  g_pps.last_err_us = (int32_t)err;
+  g_pps_last_edge_raw = raw_us;
+
+  if (g_pps.edges == 1u || dt == 0 || err > NET_PPS_STEP_US || err < -NET_PPS_STEP_US) {
+    clock_set(raw, off - err, (int32_t)g_pps_drift_q32);
+    g_pps.steps++;
+    g_pps.locked = 0;
+  } else {
+    // -err is the correction, as offset_us is for the client servo.
+    const int64_t ratio_q32 = (-err * ((int64_t)1 << 32)) / (int64_t)dt;
+    g_pps_drift_q32 =
+        pps_clamp_freq(g_pps_drift_q32 + (ratio_q32 * NET_TIMESYNC_KI_PCT) / 100);
+    const int64_t freq =
+        pps_clamp_freq(g_pps_drift_q32 + (ratio_q32 * NET_TIMESYNC_KP_PCT) / 100);
+    clock_set(raw, off, (int32_t)freq);
+    g_pps.locked = (uint8_t)(err <= NET_PPS_LOCK_US && err >= -NET_PPS_LOCK_US);
+  }
+  g_pps_last_set_raw = raw;
+
+  if (unix_ms != 0) {
+    g_unix_base_ms = (int64_t)unix_ms - (int64_t)(second_node / 1000ULL);
+    g_unix_from_rtc = 0;
+    g_unix_valid = 1;
+    g_pps.labelled++;
+    rtc_follow_unix(unix_ms);
+  }
+  tt_update();
+#else
+  (void)raw_us;
+  (void)unix_ms;
+#endif
+}
+
+void telemetry_pps_get_stats(telemetry_pps_stats_t *out) {
+  if (!out) return;
+#if TELEMETRY_TIME_MASTER
+  *out = g_pps;
+  out->drift_ppb = (int32_t)((g_pps_drift_q32 * 1000000000LL) >> 32);
+  out->last_edge_age_ms = UINT32_MAX;
+  if (g_pps_last_edge_raw != 0) {
+    const uint64_t age = (tx_raw_now_us() - g_pps_last_edge_raw) / 1000ULL;
+    if (age < UINT32_MAX) out->last_edge_age_ms = (uint32_t)age;
+  }
+#else
+  memset(out, 0, sizeof(*out));
+  out->last_edge_age_ms = UINT32_MAX;
+#endif
+}
+
+static void timesync_config_define(void) {
+  (void)config_define(CONFIG_TIMESYNC_ACQUIRE_PERIOD_MS,
+                      NET_TIMESYNC_ACQUIRE_PERIOD_MS, 100u, 60000u,
+                      CONFIG_LIVE, NULL);
+  (void)config_define(CONFIG_TIMESYNC_MAX_PERIOD_MS,
+                      NET_TIMESYNC_MAX_PERIOD_MS, 1000u, 600000u, CONFIG_LIVE,
+                      NULL);
+  (void)config_define(CONFIG_TIMESYNC_BURST_GAP_MS, NET_TIMESYNC_BURST_GAP_MS,
+                      10u, 10000u, CONFIG_LIVE, NULL);
+  (void)config_define(CONFIG_TIMESYNC_JITTER_PCT, NET_TIMESYNC_JITTER_PCT, 0u,
+                      50u, CONFIG_LIVE, NULL);
+  (void)config_define(CONFIG_TIMESYNC_LOCK_US, NET_TIMESYNC_LOCK_US, 10u,
+                      100000u, CONFIG_LIVE, NULL);
+#if !TELEMETRY_TIME_MASTER
+  g_sync_period_ms = config_get(CONFIG_TIMESYNC_ACQUIRE_PERIOD_MS);
+  g_sync_pause_ms = g_sync_period_ms;
+#endif
+}
+
+/* ---------------- Time-triggered TX ---------------- */
+// Re-anchor the TX windows on the clock model; runs whenever the model
+// changes. In between, the cycle is converted to raw time at the model's
+// frequency so the windows don't walk off the common clock.
+static void tt_update(void) {
+#if TELEMETRY_TT
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+#if !TELEMETRY_TIME_MASTER
+  if (!g_servo_locked) {
+    (void)can_bus_set_tx_window(bus, 0, 0, 0, 0);
+    return;
+  }
+#endif
+  const uint64_t raw = tx_raw_now_us();
+  const uint64_t node = raw_to_node_us(raw);
+  const uint64_t start = (uint64_t)TELEMETRY_TT_SLOT * TELEMETRY_TT_SLOT_US;
+  const uint64_t phase =
+      (node + TELEMETRY_TT_CYCLE_US - start) % TELEMETRY_TT_CYCLE_US;
+  const int64_t cycle_ns = (int64_t)TELEMETRY_TT_CYCLE_US * 1000;
+  const int64_t slew_ns = (cycle_ns * g_clk_freq_q32) >> 32;
+  (void)can_bus_set_tx_window(
+      bus, TELEMETRY_TT_CLASSES, raw - phase, (uint32_t)(cycle_ns - slew_ns),
+      (TELEMETRY_TT_SLOT_US - TELEMETRY_TT_GUARD_US) * 1000u);
+#endif
+}
+
+/* ---------------- Global router state ---------------- */
+RouterState g_router = {.r = NULL, .created = 0, .start_time = 0};
+
+/* ---------------- TX helpers ---------------- */
+// The COBS links take one writer at a time, and so do the CAN parking
+// buffers, but the TX dispatch thread, the relay cut-through on the ingest
+// thread and synchronous loggers can all send. Outside a thread (init,
+// before the scheduler) there is no one to race with.
+static TX_MUTEX g_link_tx_mutex;
+static uint8_t g_link_tx_mutex_ok = 0;
+static TX_MUTEX g_can_tx_mutex;
+static uint8_t g_can_tx_mutex_ok = 0;
+
+static int tx_lock(TX_MUTEX *m, uint8_t ok) {
+  if (!ok || tx_thread_identify() == TX_NULL) return 0;
+  return tx_mutex_get(m, TX_WAIT_FOREVER) == TX_SUCCESS;
+}
+
+static int link_tx_lock(void) {
+  return tx_lock(&g_link_tx_mutex, g_link_tx_mutex_ok);
+}
+
+static void link_tx_unlock(int locked) {
+  if (locked) (void)tx_mutex_put(&g_link_tx_mutex);
+}
+
+// The data type's mapped ID if telemetry_peek_type() can read it, else
+// the class's.
+static uint32_t can_id_of(can_bus_tx_prio_t prio, const uint8_t *bytes,
+                          size_t len) {
+  static const uint16_t class_ids[CAN_BUS_TX_PRIO_COUNT] = {
+      TELEMETRY_CAN_TIMESYNC_STD_ID,
+      TELEMETRY_CAN_CONTROL_STD_ID,
+      TELEMETRY_CAN_STD_ID,
+  };
+  const uint16_t *ids = table_swap_read(&g_can_ids);
+  SedsDataType ty;
+  if (ids && telemetry_peek_type(bytes, len, &ty) &&
+      (uint32_t)ty < TELEMETRY_RX_MAX_DATA_TYPES && ids[(uint32_t)ty] != 0)
+    return ids[(uint32_t)ty];
+  return class_ids[prio];
+}
+
+static uint32_t g_can_lz_packets = 0;
+static uint32_t g_can_lz_saved = 0;
+
+#if TELEMETRY_CAN_LZ
+// Under g_can_tx_mutex, like everything can_send() touches.
+static lz_dict_work_t g_can_lz_work;
+static uint8_t g_can_lz_tx[TELEMETRY_CAN_LZ_MAX];
+
+// `bytes` compressed into g_can_lz_tx with its header; 0 if not worth it.
+static size_t can_lz_pack(const uint8_t *bytes, size_t len) {
+  if (len < TELEMETRY_CAN_LZ_MIN_BYTES || len > TELEMETRY_CAN_LZ_MAX)
+    return 0;
+  uint8_t *out = &g_can_lz_tx[TELEMETRY_CAN_LZ_HDR];
+  const size_t z = lz_dict_compress(bytes, len, out,
+                                    len - TELEMETRY_CAN_LZ_HDR - 1u,
+                                    &g_can_lz_work);
+  if (!z) return 0;
+  g_can_lz_tx[0] = (uint8_t)TELEMETRY_CAN_LZ_MAGIC;
+  g_can_lz_tx[1] = (uint8_t)(TELEMETRY_CAN_LZ_MAGIC >> 8);
+  g_can_lz_tx[2] = (uint8_t)len;
+  g_can_lz_tx[3] = (uint8_t)(len >> 8);
+  g_can_lz_packets++;
+  g_can_lz_saved += (uint32_t)(len - TELEMETRY_CAN_LZ_HDR - z);
+  return TELEMETRY_CAN_LZ_HDR + z;
+}
+#endif
+
+uint16_t telemetry_node_id(void) {
+  static uint16_t id = TELEMETRY_NODE_ID;
+  if (!id) {
+    const uint32_t u = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2();
+    id = (uint16_t)(u ^ (u >> 16));
+    if (!id) id = 1u;
+  }
+  return id;
+}
+
+// Synced time the packet being logged synchronously right now was logged
+// at, when that was earlier than the call (an intake record); 0 = now.
+static UNUSED_FUNCTION uint64_t g_trace_log_us = 0;
+
+#if TELEMETRY_CAN_TRACE_EVERY
+// Under g_can_tx_mutex, like everything can_send() touches.
+static uint8_t g_can_trace_tx[TELEMETRY_CAN_TRACE_HDR + TELEMETRY_CAN_TRACE_MAX];
+static uint32_t g_can_trace_n = 0;
+
+// Every TELEMETRY_CAN_TRACE_EVERY-th packet with its trace header in
+// g_can_trace_tx; 0 for the others, and while the clock isn't synced.
+static size_t can_trace_wrap(const uint8_t *bytes, size_t len) {
+#if !TELEMETRY_TIME_MASTER
+  if (!g_servo_locked) return 0;
+#endif
+  if (len > TELEMETRY_CAN_TRACE_MAX || ++g_can_trace_n < TELEMETRY_CAN_TRACE_EVERY)
+    return 0;
+  g_can_trace_n = 0;
+  const uint32_t at =
+      (uint32_t)(g_trace_log_us ? g_trace_log_us : telemetry_now_us());
+  const uint16_t origin = telemetry_node_id();
+  g_can_trace_tx[0] = (uint8_t)TELEMETRY_CAN_TRACE_MAGIC;
+  g_can_trace_tx[1] = (uint8_t)(TELEMETRY_CAN_TRACE_MAGIC >> 8);
+  g_can_trace_tx[2] = (uint8_t)origin;
+  g_can_trace_tx[3] = (uint8_t)(origin >> 8);
+  memcpy(&g_can_trace_tx[4], &at, sizeof(at));
+  memcpy(&g_can_trace_tx[TELEMETRY_CAN_TRACE_HDR], bytes, len);
+  return TELEMETRY_CAN_TRACE_HDR + len;
+}
+#endif
+
+static HAL_StatusTypeDef can_send(can_bus_tx_prio_t prio, const uint8_t *bytes,
+                                  size_t len) {
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  const uint32_t id = can_id_of(prio, bytes, len);
+#if TELEMETRY_CAN_TRACE_EVERY
+  const size_t t = can_trace_wrap(bytes, len);
+  if (t) {
+    bytes = g_can_trace_tx;
+    len = t;
+  }
+#endif
+#if TELEMETRY_CAN_LZ
+  const size_t z = can_lz_pack(bytes, len);
+  if (z) {
+    bytes = g_can_lz_tx;
+    len = z;
+  }
+#endif
+#if TELEMETRY_CAN_PACK
+  if (prio == CAN_BUS_TX_PRIO_LOW)
+    return can_bus_send_packed_prio(bus, bytes, len, id, prio);
+#endif
+  return can_bus_send_large_prio(bus, bytes, len, id, prio);
+}
+
+static uint32_t g_can_tx_parked = 0;
+static uint32_t g_can_tx_would_block = 0;
+static uint32_t g_can_tx_failed = 0;
+
+#if TELEMETRY_TX_PARK_BYTES
+// Packets whose class ring was full: [len lo][len hi][bytes], oldest first.
+// A full ring makes the CAN driver raise TELEMETRY_EVT_CAN_TX on the next TX
+// completion, and the TX thread flushes from here before anything newer of
+// the same class goes out.
+typedef struct {
+  uint16_t used;
+  uint8_t buf[TELEMETRY_TX_PARK_BYTES];
+} tx_park_t;
+
+static tx_park_t g_tx_park[CAN_BUS_TX_PRIO_COUNT];
+
+static int tx_park_put(can_bus_tx_prio_t prio, const uint8_t *bytes,
+                       size_t len) {
+  tx_park_t *p = &g_tx_park[prio];
+  if (len > TELEMETRY_TX_PARK_BYTES - 2u - p->used) return 0;
+  p->buf[p->used] = (uint8_t)len;
+  p->buf[p->used + 1u] = (uint8_t)(len >> 8);
+  dma_copy(&p->buf[p->used + 2u], bytes, len);
+  p->used = (uint16_t)(p->used + 2u + len);
+  g_can_tx_parked++;
+  return 1;
+}
+
+// Send what a class has parked, in order. HAL_BUSY if its ring filled up
+// again (the rest stays parked); a packet the driver refuses outright is
+// dropped and counted.
+static HAL_StatusTypeDef tx_park_flush(can_bus_tx_prio_t prio) {
+  tx_park_t *p = &g_tx_park[prio];
+  while (p->used) {
+    const size_t len = (size_t)p->buf[0] | ((size_t)p->buf[1] << 8);
+    const HAL_StatusTypeDef st = can_send(prio, &p->buf[2], len);
+    if (st == HAL_BUSY) return HAL_BUSY;
+    if (st != HAL_OK) g_can_tx_failed++;
+    p->used = (uint16_t)(p->used - 2u - len);
+    memmove(p->buf, &p->buf[2u + len], p->used);
+  }
+  return HAL_OK;
+}
+#else
+static int tx_park_put(can_bus_tx_prio_t prio, const uint8_t *bytes,
+                       size_t len) {
+  (void)prio;
   (void)bytes;
   (void)len;
-  return;
+  return 0;
+}
+
+static HAL_StatusTypeDef tx_park_flush(can_bus_tx_prio_t prio) {
+  (void)prio;
+  return HAL_OK;
+}
+#endif
+
+// Anything parked in any class; flushed by the next dispatch pass.
+static int tx_park_any(void) {
+#if TELEMETRY_TX_PARK_BYTES
+  for (int c = 0; c < CAN_BUS_TX_PRIO_COUNT; c++)
+    if (g_tx_park[c].used) return 1;
+#endif
+  return 0;
+}
+
+// Flush every class; HAL_BUSY while bulk is still parked, in which case
+// the router's queue (all bulk) has to wait for the next TX completion.
+static HAL_StatusTypeDef tx_park_flush_all(void) {
+  const int locked = tx_lock(&g_can_tx_mutex, g_can_tx_mutex_ok);
+  for (int c = CAN_BUS_TX_PRIO_HIGH; c < CAN_BUS_TX_PRIO_LOW; c++)
+    (void)tx_park_flush((can_bus_tx_prio_t)c);
+  const HAL_StatusTypeDef st = tx_park_flush(CAN_BUS_TX_PRIO_LOW);
+  if (locked) (void)tx_mutex_put(&g_can_tx_mutex);
+  return st;
+}
+
+/* ---------------- Queue latency ----------------
+ * The router doesn't say when it takes a packet off a queue, so a shadow
+ * FIFO per queue holds the enqueue time of each packet put on it. A
+ * processing pass that returns SEDS_OK inside its budget ran the queue
+ * dry, so it retires every entry that was there when it started, at the
+ * pass's end: samples are high by at most one pass, and a packet enqueued
+ * during a pass is retired by the next one that drains. One consumer per
+ * queue (the RX and TX threads).
+ *
+ * The same passes give the queue depth for the pass budgets: every packet
+ * put on a queue is counted, tracked or not, and a draining pass sets the
+ * count it started with as done. The router can also queue TX packets
+ * itself while processing RX, so an RX pass that had work leaves the TX
+ * queue marked as maybe holding some. */
+#if TELEMETRY_QLAT_SLOTS & (TELEMETRY_QLAT_SLOTS - 1u)
+#error "TELEMETRY_QLAT_SLOTS must be a power of two"
+#endif
+
+typedef struct {
+  volatile uint32_t head;
+  uint32_t tail;
+  volatile uint32_t in; // packets put on the queue
+  uint32_t in_mark;     // `in` when the current pass started
+  uint32_t done;        // `in` at the start of the last draining pass
+  volatile uint8_t maybe; // may hold packets the router queued itself
+  uint32_t idle;        // passes skipped as empty
+  uint32_t budget_ms;   // last pass budget handed out
+#if TELEMETRY_QLAT_SLOTS
+  uint32_t enq_us[TELEMETRY_QLAT_SLOTS];
+#endif
+  uint32_t hist[TELEMETRY_QLAT_BINS];
+  uint32_t untracked;
+  uint32_t max_us;
+} qlat_t;
+
+static qlat_t g_qlat[TELEMETRY_QUEUE_COUNT];
+
+// Bin i holds samples below TELEMETRY_QLAT_BIN0_US << i; the last the rest.
+static inline unsigned qlat_bin(uint32_t us) {
+  unsigned b = 0;
+  while (b < TELEMETRY_QLAT_BINS - 1u && us >= (TELEMETRY_QLAT_BIN0_US << b))
+    b++;
+  return b;
+}
+
+// A packet just went on queue `q`; any context.
+static inline void qlat_put(telemetry_queue_t q) {
+  qlat_t *l = &g_qlat[q];
+#if TELEMETRY_QLAT_SLOTS
+  const uint32_t now = (uint32_t)tx_raw_now_us();
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  l->in++;
+  if (l->head - l->tail < TELEMETRY_QLAT_SLOTS) {
+    l->enq_us[l->head & (TELEMETRY_QLAT_SLOTS - 1u)] = now;
+    l->head++;
+  } else {
+    l->untracked++;
+  }
+  __set_PRIMASK(primask);
 #else
-  if (!bytes || len == 0) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  l->in++;
+  __set_PRIMASK(primask);
+#endif
+}
 
-  if (!g_router.r) {
-    if (init_telemetry_router() != SEDS_OK) return;
+// After a processing pass of `q` that started at `t0_us` with the FIFO at
+// `mark`: retire what it drained.
+static UNUSED_FUNCTION void qlat_pass(telemetry_queue_t q, uint32_t mark,
+                                      uint64_t t0_us, uint64_t budget_us,
+                                      SedsResult res) {
+  qlat_t *l = &g_qlat[q];
+  if (q == TELEMETRY_QUEUE_RX && l->in_mark != l->done)
+    g_qlat[TELEMETRY_QUEUE_TX].maybe = 1;
+  const uint64_t now = tx_raw_now_us();
+  if (res != SEDS_OK || now - t0_us >= budget_us) return; // may hold more
+  l->done = l->in_mark;
+  if (q == TELEMETRY_QUEUE_TX) l->maybe = 0;
+#if TELEMETRY_QLAT_SLOTS
+  for (; l->tail != mark; l->tail++) {
+    const uint32_t us =
+        (uint32_t)now - l->enq_us[l->tail & (TELEMETRY_QLAT_SLOTS - 1u)];
+    l->hist[qlat_bin(us)]++;
+    if (us > l->max_us) l->max_us = us;
+  }
+#else
+  (void)mark;
+#endif
+}
+
+// Start of a processing pass of `q` (its consumer thread only).
+static inline uint32_t qlat_mark(telemetry_queue_t q) {
+  g_qlat[q].in_mark = g_qlat[q].in;
+  return g_qlat[q].head;
+}
+
+uint32_t telemetry_queue_depth(telemetry_queue_t q) {
+  if ((unsigned)q >= TELEMETRY_QUEUE_COUNT) return 0;
+  return g_qlat[q].in - g_qlat[q].done;
+}
+
+uint32_t telemetry_queue_budget_ms(telemetry_queue_t q) {
+  if ((unsigned)q >= TELEMETRY_QUEUE_COUNT) return 0;
+  qlat_t *l = &g_qlat[q];
+  const uint32_t depth = l->in - l->done;
+  if (depth == 0 && !l->maybe && (q != TELEMETRY_QUEUE_TX || !tx_park_any())) {
+    l->idle++;
+    return 0;
+  }
+  uint32_t ms = TELEMETRY_QUEUE_BUDGET_MIN_MS + depth / TELEMETRY_QUEUE_PKTS_PER_MS;
+  if (ms > TELEMETRY_QUEUE_BUDGET_MAX_MS) ms = TELEMETRY_QUEUE_BUDGET_MAX_MS;
+  // The pass would only fill the bulk ring and park the rest.
+  if (q == TELEMETRY_QUEUE_TX &&
+      can_bus_tx_fill_pct(can_bus_get(TELEMETRY_CAN_BUS), CAN_BUS_TX_PRIO_LOW) >=
+          TELEMETRY_QUEUE_TX_FULL_PCT)
+    ms = TELEMETRY_QUEUE_BUDGET_MIN_MS;
+  l->budget_ms = ms;
+  return ms;
+}
+
+// Upper edge of the bin holding the `pm` per mille sample, capped at max.
+static uint32_t hist_pct(const uint32_t *hist, uint32_t samples,
+                         uint32_t max_us, uint32_t pm) {
+  if (!samples) return 0;
+  const uint32_t rank = (uint32_t)(((uint64_t)samples * pm + 999u) / 1000u);
+  uint32_t seen = 0;
+  for (unsigned b = 0; b < TELEMETRY_QLAT_BINS - 1u; b++) {
+    seen += hist[b];
+    if (seen >= rank) {
+      const uint32_t edge = TELEMETRY_QLAT_BIN0_US << b;
+      return (edge < max_us) ? edge : max_us;
+    }
+  }
+  return max_us;
+}
+
+void telemetry_qlat_get_stats(telemetry_queue_t q,
+                              telemetry_qlat_stats_t *out) {
+  if (!out) return;
+  memset(out, 0, sizeof(*out));
+  if ((unsigned)q >= TELEMETRY_QUEUE_COUNT) return;
+  const qlat_t *l = &g_qlat[q];
+  memcpy(out->hist, l->hist, sizeof(out->hist));
+  for (unsigned b = 0; b < TELEMETRY_QLAT_BINS; b++) out->samples += out->hist[b];
+  out->untracked = l->untracked;
+  out->max_us = l->max_us;
+  out->pending = l->head - l->tail;
+  out->depth = l->in - l->done;
+  out->idle = l->idle;
+  out->budget_ms = l->budget_ms;
+  out->p50_us = hist_pct(out->hist, out->samples, out->max_us, 500u);
+  out->p99_us = hist_pct(out->hist, out->samples, out->max_us, 990u);
+}
+
+void telemetry_qlat_reset(void) {
+  for (unsigned q = 0; q < TELEMETRY_QUEUE_COUNT; q++) {
+    qlat_t *l = &g_qlat[q];
+    memset(l->hist, 0, sizeof(l->hist));
+    l->untracked = 0;
+    l->max_us = 0;
+  }
+}
+
+/* ---------------- Trace latency ----------------
+ * Traced CAN packets (TELEMETRY_CAN_TRACE_EVERY) binned by origin and by
+ * data type, plus all of them together for the health sample. Updated by
+ * the ingest thread only; readers may see a sample half applied. */
+typedef struct {
+  uint16_t key;
+  uint8_t used;
+  uint32_t skewed;
+  uint32_t max_us;
+  uint32_t hist[TELEMETRY_QLAT_BINS];
+} trace_ent_t;
+
+static trace_ent_t g_trace_org[TELEMETRY_TRACE_ORIGINS];
+static trace_ent_t g_trace_ty[TELEMETRY_TRACE_TYPES];
+static trace_ent_t g_trace_all;
+static uint32_t g_trace_untabled; // origin or type table full
+
+static trace_ent_t *trace_slot(trace_ent_t *t, size_t n, uint16_t key) {
+  for (size_t i = 0; i < n; i++) {
+    if (!t[i].used) {
+      t[i].used = 1;
+      t[i].key = key;
+      return &t[i];
+    }
+    if (t[i].key == key) return &t[i];
+  }
+  g_trace_untabled++;
+  return NULL;
+}
+
+static void trace_add(trace_ent_t *e, int32_t us) {
+  if (!e) return;
+  if (us < 0) {
+    e->skewed++;
+    return;
+  }
+  e->hist[qlat_bin((uint32_t)us)]++;
+  if ((uint32_t)us > e->max_us) e->max_us = (uint32_t)us;
+}
+
+static UNUSED_FUNCTION void trace_record(uint16_t origin, uint32_t at_us,
+                                         const uint8_t *bytes, size_t len) {
+#if !TELEMETRY_TIME_MASTER
+  if (!g_servo_locked) return; // our clock isn't comparable yet
+#endif
+  const int32_t us = (int32_t)((uint32_t)telemetry_now_us() - at_us);
+  SedsDataType ty;
+  const uint16_t tkey =
+      telemetry_peek_type(bytes, len, &ty) ? (uint16_t)ty : 0xFFFFu;
+  trace_add(trace_slot(g_trace_org, TELEMETRY_TRACE_ORIGINS, origin), us);
+  trace_add(trace_slot(g_trace_ty, TELEMETRY_TRACE_TYPES, tkey), us);
+  trace_add(&g_trace_all, us);
+}
+
+static void trace_stats(const trace_ent_t *e, telemetry_trace_stats_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->key = e->key;
+  memcpy(out->hist, e->hist, sizeof(out->hist));
+  for (unsigned b = 0; b < TELEMETRY_QLAT_BINS; b++) out->samples += out->hist[b];
+  out->skewed = e->skewed;
+  out->max_us = e->max_us;
+  out->p50_us = hist_pct(out->hist, out->samples, out->max_us, 500u);
+  out->p99_us = hist_pct(out->hist, out->samples, out->max_us, 990u);
+}
+
+int telemetry_trace_get_stats(telemetry_trace_table_t table, size_t i,
+                              telemetry_trace_stats_t *out) {
+  if (!out) return 0;
+  const trace_ent_t *e = NULL;
+  switch (table) {
+  case TELEMETRY_TRACE_BY_ORIGIN:
+    if (i < TELEMETRY_TRACE_ORIGINS && g_trace_org[i].used) e = &g_trace_org[i];
+    break;
+  case TELEMETRY_TRACE_BY_TYPE:
+    if (i < TELEMETRY_TRACE_TYPES && g_trace_ty[i].used) e = &g_trace_ty[i];
+    break;
+  case TELEMETRY_TRACE_ALL:
+    if (i == 0) e = &g_trace_all;
+    break;
+  }
+  if (!e) {
+    memset(out, 0, sizeof(*out));
+    return 0;
+  }
+  trace_stats(e, out);
+  return 1;
+}
+
+/* ---------------- Side counters ----------------
+ * Bumped from the send callbacks (whichever thread logs or dispatches) and
+ * the RX paths, so each one is an LDREX/STREX add rather than a lock. */
+static volatile telemetry_side_stats_t g_side_stats[TELEMETRY_SIDE_COUNT];
+
+static inline void side_add(volatile uint32_t *c, uint32_t n) {
+  uint32_t v;
+  do {
+    v = __LDREXW(c) + n;
+  } while (__STREXW(v, c) != 0u);
+}
+
+static inline void side_rx(telemetry_side_t s, size_t len) {
+  side_add(&g_side_stats[s].rx_packets, 1u);
+  side_add(&g_side_stats[s].rx_bytes, (uint32_t)len);
+}
+
+static inline void side_bad_arg(telemetry_side_t s) {
+  side_add(&g_side_stats[s].bad_args, 1u);
+}
+
+// Result of handing an arrival to the router RX queue.
+static inline void side_queued(telemetry_side_t s, SedsResult res) {
+  if (res == SEDS_OK) {
+    qlat_put(TELEMETRY_QUEUE_RX);
+    return;
   }
+  if (res == SEDS_BAD_ARG) side_bad_arg(s);
+  else side_add(&g_side_stats[s].queue_rejects, 1u);
+}
+
+static inline void side_tx(telemetry_side_t s, SedsResult res, size_t len) {
+  volatile telemetry_side_stats_t *st = &g_side_stats[s];
+  if (res == SEDS_OK) {
+    side_add(&st->tx_packets, 1u);
+    side_add(&st->tx_bytes, (uint32_t)len);
+  } else if (res == SEDS_BAD_ARG) {
+    side_add(&st->bad_args, 1u);
+  } else if (res == TELEMETRY_WOULD_BLOCK) {
+    side_add(&st->queue_rejects, 1u);
+  } else {
+    side_add(&st->io_errors, 1u);
+  }
+}
+
+void telemetry_side_get_stats(telemetry_side_t side,
+                              telemetry_side_stats_t *out) {
+  if (!out) return;
+  if ((unsigned)side >= TELEMETRY_SIDE_COUNT) {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+  *out = g_side_stats[side];
+}
+
+// A full TX ring is congestion, not a link error: the packet is parked and
+// reported as sent, or, with no room to park it, refused with
+// TELEMETRY_WOULD_BLOCK. Anything else the driver rejects is SEDS_ERR.
+SedsResult tx_send(const uint8_t *bytes, size_t len, void *user) {
+  (void)user;
+  if (!bytes || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_CAN);
+    return SEDS_BAD_ARG;
+  }
+  if (series_claims(bytes, len)) {
+    side_tx(TELEMETRY_SIDE_CAN, SEDS_OK, len); // sent as a series frame
+    return SEDS_OK;
+  }
+  const can_bus_tx_prio_t prio = (can_bus_tx_prio_t)g_can_tx_class;
+  PROF_START(send);
+  DBG_MARK_HI(TX_SEND);
+  ITM_TRACE(ITM_EV_TX_SEND, len);
+  TRACEX_EVENT(TRACEX_EV_TX_SEND, len, 0);
+  const int locked = tx_lock(&g_can_tx_mutex, g_can_tx_mutex_ok);
+  HAL_StatusTypeDef st = tx_park_flush(prio);
+  if (st == HAL_OK) st = can_send(prio, bytes, len);
+  SedsResult res = SEDS_OK;
+  if (st == HAL_BUSY) {
+    if (!tx_park_put(prio, bytes, len)) {
+      g_can_tx_would_block++;
+      res = TELEMETRY_WOULD_BLOCK;
+    }
+  } else if (st != HAL_OK) {
+    g_can_tx_failed++;
+    res = SEDS_ERR;
+  }
+  if (locked) (void)tx_mutex_put(&g_can_tx_mutex);
+  DBG_MARK_LO(TX_SEND);
+  PROF_STOP(send, PROF_TX_SEND);
+  side_tx(TELEMETRY_SIDE_CAN, res, len);
+  return res;
+}
+
+void telemetry_can_tx_get_stats(uint32_t *parked, uint32_t *would_block,
+                                uint32_t *failed) {
+  if (parked) *parked = g_can_tx_parked;
+  if (would_block) *would_block = g_can_tx_would_block;
+  if (failed) *failed = g_can_tx_failed;
+}
+
+void telemetry_can_lz_get_stats(uint32_t *packets, uint32_t *saved) {
+  if (packets) *packets = g_can_lz_packets;
+  if (saved) *saved = g_can_lz_saved;
+}
+
+/* ---------------- Series frames ----------------
+ * Numeric types with a series profile go out on CAN as series_codec.h
+ * frames on TELEMETRY_CAN_SERIES_STD_ID, encoded as they are logged, ahead
+ * of the router call; tx_send() then drops the router's copy of the packet
+ * for the CAN side. Received frames are decoded against per-type state and
+ * logged into the router with their sender's timestamp, for the SD card
+ * and the other sides, and kept off CAN the same way. Spotting the router's
+ * copy needs telemetry_peek_type(): with the weak stub both go out. */
+typedef struct {
+  uint8_t used;
+  uint8_t ok; // the last sample of the type went out as a frame
+  uint8_t type;
+  series_state_t st;
+} series_chan_t;
+
+static series_chan_t g_series_tx[TELEMETRY_SERIES_CHANNELS];
+static series_chan_t g_series_rx[TELEMETRY_SERIES_CHANNELS];
+static uint32_t g_series_sent = 0;
+static uint32_t g_series_lost = 0; // frames the receiver couldn't apply
+
+static series_chan_t *series_find(series_chan_t *tab, SedsDataType ty) {
+  for (size_t i = 0; i < TELEMETRY_SERIES_CHANNELS; i++)
+    if (tab[i].used && tab[i].type == (uint8_t)ty) return &tab[i];
+  return NULL;
+}
+
+SedsResult telemetry_set_series(SedsDataType ty, int on) {
+  if ((uint32_t)ty > 0xFFu) return SEDS_BAD_ARG;
+  const int locked = tx_lock(&g_can_tx_mutex, g_can_tx_mutex_ok);
+  series_chan_t *c = series_find(g_series_tx, ty);
+  SedsResult res = SEDS_OK;
+  if (!on) {
+    if (c) c->used = 0;
+  } else if (!c) {
+    res = SEDS_BAD_ARG; // table full
+    for (size_t i = 0; i < TELEMETRY_SERIES_CHANNELS; i++) {
+      if (g_series_tx[i].used) continue;
+      memset(&g_series_tx[i], 0, sizeof(g_series_tx[i]));
+      g_series_tx[i].type = (uint8_t)ty;
+      g_series_tx[i].used = 1;
+      res = SEDS_OK;
+      break;
+    }
+  }
+  if (locked) (void)tx_mutex_put(&g_can_tx_mutex);
+  return res;
+}
+
+void telemetry_series_get_stats(uint32_t *sent, uint32_t *lost) {
+  if (sent) *sent = g_series_sent;
+  if (lost) *lost = g_series_lost;
+}
+
+static int series_claims(const uint8_t *bytes, size_t len) {
+  SedsDataType ty;
+  if (!telemetry_peek_type(bytes, len, &ty)) return 0;
+  const series_chan_t *c = series_find(g_series_tx, ty);
+  return (c && c->ok) || series_find(g_series_rx, ty) != NULL;
+}
+
+// Send one sample of a profiled type as a series frame. Shapes the codec
+// can't take leave `ok` clear, and the router's packet goes out instead.
+static UNUSED_FUNCTION void series_offer(SedsDataType ty, const void *data,
+                                         size_t count, size_t size,
+                                         SedsElemKind kind, uint64_t ts) {
+  const int locked = tx_lock(&g_can_tx_mutex, g_can_tx_mutex_ok);
+  series_chan_t *c = series_find(g_series_tx, ty);
+  if (c) {
+    uint8_t f[SERIES_FRAME_MAX];
+    const size_t n = series_encode(&c->st, ty, kind, data, count, size, ts, f);
+    c->ok = (n != 0);
+    if (n && can_bus_send_bytes(can_bus_get(TELEMETRY_CAN_BUS), f, n,
+                                TELEMETRY_CAN_SERIES_STD_ID) == HAL_OK) {
+      g_series_sent++;
+    } else if (n) {
+      series_reset(&c->st); // the receiver will see a gap: key frame next
+      g_can_tx_failed++;
+    }
+  }
+  if (locked) (void)tx_mutex_put(&g_can_tx_mutex);
+}
+
+#ifdef TELEMETRY_ENABLED
+static uint8_t g_series_rx_next; // slot to reuse once the table is full
+
+// A series frame, from can_bus_process_rx().
+static void on_series_frame(const uint8_t *data, size_t len, uint64_t ts_us,
+                            void *user) {
+  (void)ts_us;
+  (void)user;
+  if (!data || len < 3u || !g_router.r) return;
+  const SedsDataType ty = series_frame_type(data);
+  series_chan_t *c = series_find(g_series_rx, ty);
+  if (!c) {
+    c = &g_series_rx[g_series_rx_next];
+    for (size_t i = 0; i < TELEMETRY_SERIES_CHANNELS; i++) {
+      if (!g_series_rx[i].used) {
+        c = &g_series_rx[i];
+        break;
+      }
+    }
+    if (c == &g_series_rx[g_series_rx_next])
+      g_series_rx_next = (uint8_t)((g_series_rx_next + 1u) %
+                                   TELEMETRY_SERIES_CHANNELS);
+    memset(c, 0, sizeof(*c));
+    c->type = (uint8_t)ty;
+    c->used = 1;
+  }
+  uint64_t vals[SERIES_MAX_ELEMS];
+  size_t count = 0, size = 0;
+  SedsElemKind kind;
+  uint64_t ts = 0;
+  if (series_decode(&c->st, data, len, vals, &count, &size, &kind, &ts) !=
+      HAL_OK) {
+    g_series_lost++;
+    return;
+  }
+  if (seds_router_log_typed_ex(g_router.r, ty, vals, count, size, kind, &ts,
+                               1) == SEDS_OK) {
+    qlat_put(TELEMETRY_QUEUE_TX);
+    telemetry_thread_notify(TELEMETRY_EVT_TX_QUEUED);
+  }
+}
+#endif
+
+// First bytes of a control frame from a host on USB or UART.
+static const uint8_t k_usb_ctrl_magic[4] = TELEMETRY_USB_CTRL_MAGIC;
+
+static int ctrl_is_frame(const uint8_t *bytes, size_t len) {
+  return len >= sizeof(k_usb_ctrl_magic) + 1u &&
+         memcmp(bytes, k_usb_ctrl_magic, sizeof(k_usb_ctrl_magic)) == 0;
+}
+
+// Short reply to a control frame: magic, op | 0x80, status.
+static size_t ctrl_status_reply(uint8_t op, uint8_t status, uint8_t *out) {
+  memcpy(out, k_usb_ctrl_magic, sizeof(k_usb_ctrl_magic));
+  out[sizeof(k_usb_ctrl_magic)] = (uint8_t)(op | 0x80u);
+  out[sizeof(k_usb_ctrl_magic) + 1u] = status;
+  return sizeof(k_usb_ctrl_magic) + 2u;
+}
+
+/* ---------------- Runtime configuration ----------------
+ * CONFIG_* control frames (config_store.h, telemetry.h). Control frames of
+ * both links arrive on the telemetry RX thread, so CONFIG_GET replies share
+ * one buffer. Commits are programmed later by the maintenance thread.
+ */
+#define CFG_REPLY_ENTRY 23u // key u16, flags u8, five u32
+
+static uint8_t g_cfg_reply[sizeof(k_usb_ctrl_magic) + 3u +
+                           (CONFIG_KEY_COUNT - 1u) * CFG_REPLY_ENTRY];
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  for (unsigned i = 0; i < 4u; i++) p[i] = (uint8_t)(v >> (8u * i));
+}
+
+static inline uint32_t get_le16(const uint8_t *p) {
+  return p[0] | ((uint32_t)p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+  return get_le16(p) | (get_le16(&p[2]) << 16);
+}
+
+// CONFIG_GET (u16 LE keys, none = every declared one), answered in
+// g_cfg_reply: status, count, entries. Unknown keys are left out.
+static size_t cfg_get_reply(const uint8_t *args, size_t n) {
+  const size_t hdr = ctrl_status_reply(TELEMETRY_USB_CTRL_CONFIG_GET,
+                                       TELEMETRY_USB_CTRL_OK, g_cfg_reply);
+  if (n % 2u != 0) {
+    g_cfg_reply[hdr - 1u] = TELEMETRY_USB_CTRL_BAD_ARG;
+    return hdr;
+  }
+  uint8_t count = 0;
+  size_t len = hdr + 1u;
+  const size_t asked = n ? n / 2u : CONFIG_KEY_COUNT - 1u;
+  for (size_t i = 0; i < asked; i++) {
+    const uint32_t k = n ? get_le16(&args[2u * i]) : (uint32_t)i + 1u;
+    config_entry_t e;
+    if (!config_get_entry((config_key_t)k, &e) ||
+        !(e.flags & CONFIG_DEFINED))
+      continue;
+    if (len + CFG_REPLY_ENTRY > sizeof(g_cfg_reply)) {
+      g_cfg_reply[hdr - 1u] = TELEMETRY_USB_CTRL_PARTIAL;
+      break;
+    }
+    uint8_t *o = &g_cfg_reply[len];
+    o[0] = (uint8_t)k;
+    o[1] = (uint8_t)(k >> 8);
+    o[2] = e.flags;
+    put_le32(&o[3], e.value);
+    put_le32(&o[7], e.pending);
+    put_le32(&o[11], e.def);
+    put_le32(&o[15], e.min);
+    put_le32(&o[19], e.max);
+    len += CFG_REPLY_ENTRY;
+    count++;
+  }
+  g_cfg_reply[hdr] = count;
+  return len;
+}
+
+// CONFIG_SET, CONFIG_COMMIT and CONFIG_DEFAULTS; the status for the reply.
+static uint8_t cfg_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  switch (op) {
+  case TELEMETRY_USB_CTRL_CONFIG_SET:
+    if (n == 0 || n % 6u != 0) return TELEMETRY_USB_CTRL_BAD_ARG;
+    for (size_t i = 0; i < n; i += 6u) {
+      const uint32_t k = get_le16(&args[i]);
+      if (config_set((config_key_t)k, get_le32(&args[i + 2u])) != HAL_OK)
+        return TELEMETRY_USB_CTRL_BAD_ARG; // the ones before it stay set
+    }
+    return TELEMETRY_USB_CTRL_OK;
+  case TELEMETRY_USB_CTRL_CONFIG_COMMIT:
+    config_commit();
+    (void)tx_thread_wait_abort(&telemetry_maint_thread); // it programs it
+    return TELEMETRY_USB_CTRL_OK;
+  case TELEMETRY_USB_CTRL_CONFIG_DEFAULTS:
+    config_set_defaults();
+    return TELEMETRY_USB_CTRL_OK;
+  default:
+    return TELEMETRY_USB_CTRL_BAD_OP;
+  }
+}
+
+/* ---------------- Top talkers ----------------
+ * TALKERS control frames: the busiest CAN IDs from can_bus_get_talkers(),
+ * in the telemetry_wire.h layout. Read on the RX thread, which also runs
+ * can_bus_process_rx(), so the table is consistent.
+ */
+#ifndef TELEMETRY_TALKERS_MAX
+#define TELEMETRY_TALKERS_MAX 16u
+#endif
+
+_Static_assert(CAN_BUS_TALKER_EXT == TELEMETRY_TALKER_EXT,
+               "talker ID flag is copied to the wire as is");
+
+static uint8_t g_top_reply[sizeof(k_usb_ctrl_magic) + 7u +
+                           TELEMETRY_TALKERS_MAX * TELEMETRY_TALKER_REC];
+
+static size_t top_reply(const uint8_t *args, size_t n) {
+  const size_t hdr = ctrl_status_reply(TELEMETRY_USB_CTRL_TALKERS,
+                                       TELEMETRY_USB_CTRL_OK, g_top_reply);
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  can_bus_talker_t t[TELEMETRY_TALKERS_MAX];
+  uint32_t evicted = 0;
+  const size_t count = can_bus_get_talkers(bus, t, TELEMETRY_TALKERS_MAX,
+                                           &evicted);
+  if (n >= 1u && (args[0] & 0x01u)) can_bus_reset_talkers(bus);
+  g_top_reply[hdr] = (uint8_t)count;
+  put_le32(&g_top_reply[hdr + 1u], evicted);
+  uint8_t *o = &g_top_reply[hdr + 5u];
+  for (size_t i = 0; i < count; i++, o += TELEMETRY_TALKER_REC) {
+    put_le32(&o[0], t[i].id); // CAN_BUS_TALKER_EXT is the wire's bit 31
+    put_le32(&o[4], t[i].frames);
+    put_le32(&o[8], t[i].bytes);
+    put_le32(&o[12], t[i].age_us);
+    put_le32(&o[16], t[i].gap_min_us);
+    put_le32(&o[20], t[i].gap_max_us);
+  }
+  return (size_t)(o - g_top_reply);
+}
+
+/* ---------------- Health on request ----------------
+ * HEALTH_GET control frames: the last summary the maintenance thread
+ * collected, read under its seqlock, so the reply costs a copy and the
+ * collecting side is never held up. Until the first one (or with the
+ * periodic summary off) a fresh one is collected here.
+ */
+static uint8_t g_health_reply[sizeof(k_usb_ctrl_magic) + 2u +
+                              sizeof(telemetry_health_t)];
+
+static size_t health_reply(void) {
+  const size_t hdr = ctrl_status_reply(TELEMETRY_USB_CTRL_HEALTH_GET,
+                                       TELEMETRY_USB_CTRL_OK, g_health_reply);
+  telemetry_health_t h;
+  if (!telemetry_health_last(&h)) telemetry_health_collect(&h);
+  for (size_t i = 0; i < sizeof(h) / 4u; i++) {
+    uint32_t v; // the sample struct is packed
+    memcpy(&v, (const uint8_t *)&h + 4u * i, sizeof(v));
+    put_le32(&g_health_reply[hdr + 4u * i], v);
+  }
+  return hdr + sizeof(h);
+}
+
+/* ---------------- Firmware update ----------------
+ * The same commands from USB control frames and from their own ISO-TP
+ * session on CAN. fw_update_poll() in the maintenance thread does the
+ * flash work, so a command that gives it some wakes it; page buffers
+ * filling are caught by its short poll interval.
+ */
+#ifdef FW_UPDATE_ENABLED
+static uint8_t fw_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  const uint8_t status = fw_update_ctrl(op, args, n);
+  if (op != TELEMETRY_USB_CTRL_FW_DATA && op != TELEMETRY_USB_CTRL_FW_BLOCK)
+    (void)tx_thread_wait_abort(&telemetry_maint_thread);
+  return status;
+}
+
+static uint8_t g_fw_isotp_rx_buf[TELEMETRY_FW_ISOTP_RX_MAX];
+static uint8_t g_fw_isotp_reply[10];
+
+static void fw_isotp_rx(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (len == 0) return;
+  uint32_t next, room;
+  g_fw_isotp_reply[0] = (uint8_t)(data[0] | 0x80u);
+  g_fw_isotp_reply[1] = fw_ctrl(data[0], &data[1], len - 1u);
+  fw_update_progress(&next, &room);
+  put_le32(&g_fw_isotp_reply[2], next);
+  put_le32(&g_fw_isotp_reply[6], room);
+  // Dropped if the last reply is still going out; the host sends again.
+  (void)isotp_send(TELEMETRY_FW_ISOTP_RX_ID, g_fw_isotp_reply,
+                   sizeof(g_fw_isotp_reply));
+}
+#endif
+
+/* ---------------- File pull ----------------
+ * FILE_PULL asks a node for a file and each piece of the answer goes to
+ * USB from the bulk transfer's sink, one frame per CAN frame's worth. A
+ * piece is offered only while CDC has room to spare, like capture frames;
+ * otherwise it is refused, which holds the node's window until there is
+ * room. A host that went away stops the pull the same way, once the
+ * transfer times out.
+ */
+#ifdef FILE_SRV_ENABLED
+#define FIL_FRAME_HDR 13u // magic, status u8, offset u32, size u32
+#define FIL_FRAME_DATA 64u
+
+static const uint8_t k_fil_magic[4] = TELEMETRY_FILE_MAGIC;
+static uint8_t g_fil_frame[FIL_FRAME_HDR + FIL_FRAME_DATA];
+
+static int file_pull_sink(uint8_t status, const uint8_t *data, size_t len,
+                          uint32_t off, uint32_t size, uint8_t flags,
+                          void *user) {
+  (void)flags;
+  (void)user;
+  if (len > FIL_FRAME_DATA) return 1; // can_bulk frames are smaller
+  int refused = 1;
+  const int locked = link_tx_lock();
+  if (usb_cdc_is_connected() &&
+      usb_cdc_tx_pending() <= TELEMETRY_CAPTURE_USB_PENDING_MAX) {
+    memcpy(g_fil_frame, k_fil_magic, sizeof(k_fil_magic));
+    g_fil_frame[4] = status;
+    put_le32(&g_fil_frame[5], off);
+    put_le32(&g_fil_frame[9], size);
+    if (len) memcpy(&g_fil_frame[FIL_FRAME_HDR], data, len);
+    refused = usb_cdc_send_frame(g_fil_frame, FIL_FRAME_HDR + len) != HAL_OK;
+  }
+  link_tx_unlock(locked);
+  // The end of a failed pull can't be held back; the host times out.
+  return (status == FILE_SRV_OK) ? refused : 0;
+}
+
+static uint8_t file_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  if (op == TELEMETRY_USB_CTRL_FILE_PULL_ABORT) {
+    file_srv_pull_abort();
+    return TELEMETRY_USB_CTRL_OK;
+  }
+  if (n < 9u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint16_t req_id = (uint16_t)(args[0] | (args[1] << 8));
+  const uint16_t rep_id = (uint16_t)(args[2] | (args[3] << 8));
+  const uint32_t off = (uint32_t)args[4] | ((uint32_t)args[5] << 8) |
+                       ((uint32_t)args[6] << 16) | ((uint32_t)args[7] << 24);
+  switch (file_srv_pull(req_id, rep_id, off, (const char *)&args[8], n - 8u,
+                        file_pull_sink, NULL)) {
+  case HAL_OK:
+    return TELEMETRY_USB_CTRL_OK;
+  case HAL_BUSY:
+    return TELEMETRY_USB_CTRL_BUSY;
+  default:
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  }
+}
+#endif
+
+/* ---------------- Last-value cache ----------------
+ * Slots go to data types in the order they first arrive and stay theirs;
+ * g_lvc_slot maps a type to its slot + 1. The router may deliver from more
+ * than one thread, so writers store a value with interrupts masked (a copy
+ * is at most TELEMETRY_LVC_VALUE_MAX bytes); readers copy it out under the
+ * slot's seqlock and never mask. Queries all arrive on the telemetry RX
+ * thread and share one reply buffer.
+ */
+#if TELEMETRY_LVC
+_Static_assert(TELEMETRY_LVC_SLOTS <= 255u && TELEMETRY_LVC_VALUE_MAX <= 255u,
+               "LVC slot numbers and value lengths are bytes");
+
+typedef struct {
+  uint64_t ts;
+  uint16_t ty;
+  uint8_t len;
+  uint8_t data[TELEMETRY_LVC_VALUE_MAX];
+} lvc_value_t;
+
+#define LVC_ENTRY_HDR 11u // type u16, length u8, timestamp u64
+
+static lvc_value_t g_lvc[TELEMETRY_LVC_SLOTS];
+static seqlock_t g_lvc_seq[TELEMETRY_LVC_SLOTS];
+static uint8_t g_lvc_slot[TELEMETRY_RX_MAX_DATA_TYPES];
+static volatile uint8_t g_lvc_used = 0;
+static telemetry_lvc_stats_t g_lvc_stats;
+static uint8_t g_lvc_reply[TELEMETRY_LVC_REPLY_MAX];
+
+static void lvc_put(const SedsPacketView *pkt) {
+  const uint32_t t = (uint32_t)pkt->ty;
+  if (t >= TELEMETRY_RX_MAX_DATA_TYPES) return;
+  if (pkt->payload_len > TELEMETRY_LVC_VALUE_MAX) {
+    g_lvc_stats.too_big++;
+    return;
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t s = g_lvc_slot[t];
+  if (s == 0 && g_lvc_used < TELEMETRY_LVC_SLOTS) {
+    g_lvc[g_lvc_used].ty = (uint16_t)t;
+    s = ++g_lvc_used;
+    g_lvc_slot[t] = (uint8_t)s;
+  }
+  if (s != 0) {
+    lvc_value_t *v = &g_lvc[s - 1u];
+    seqlock_write_begin(&g_lvc_seq[s - 1u]);
+    v->ts = pkt->timestamp;
+    v->len = (uint8_t)pkt->payload_len;
+    memcpy(v->data, pkt->payload, pkt->payload_len);
+    seqlock_write_end(&g_lvc_seq[s - 1u]);
+    g_lvc_stats.updates++;
+  } else {
+    g_lvc_stats.no_slot++;
+  }
+  __set_PRIMASK(primask);
+}
+
+// Append slot `s` as a reply entry at out[*n]; 0 if it doesn't fit or
+// kept changing under the read.
+static int lvc_append(uint32_t s, uint8_t *out, size_t *n, size_t cap) {
+  lvc_value_t v;
+  if (!seqlock_read(&g_lvc_seq[s], &v, &g_lvc[s], sizeof(v))) return 0;
+  if (cap - *n < LVC_ENTRY_HDR + v.len) return 0;
+  uint8_t *e = &out[*n];
+  e[0] = (uint8_t)v.ty;
+  e[1] = (uint8_t)(v.ty >> 8);
+  e[2] = v.len;
+  for (unsigned i = 0; i < 8u; i++) e[3u + i] = (uint8_t)(v.ts >> (8u * i));
+  memcpy(&e[LVC_ENTRY_HDR], v.data, v.len);
+  *n += LVC_ENTRY_HDR + v.len;
+  return 1;
+}
+
+// Answer a query (u16 LE types, none = every cached one) with a count byte
+// and the entries, into `out`. Returns the status.
+static uint8_t lvc_query(const uint8_t *req, size_t len, uint8_t *out,
+                         size_t cap, size_t *out_len) {
+  g_lvc_stats.queries++;
+  *out_len = 0;
+  if (len % 2u != 0) return TELEMETRY_USB_CTRL_BAD_ARG;
+  uint8_t status = TELEMETRY_USB_CTRL_OK;
+  uint8_t count = 0;
+  size_t n = 1;
+  const size_t asked = len ? len / 2u : g_lvc_used;
+  for (size_t i = 0; i < asked; i++) {
+    uint32_t s = i;
+    if (len) {
+      const uint32_t t = req[2u * i] | ((uint32_t)req[2u * i + 1u] << 8);
+      if (t >= TELEMETRY_RX_MAX_DATA_TYPES || g_lvc_slot[t] == 0) continue;
+      s = g_lvc_slot[t] - 1u;
+    }
+    if (count == 255u || !lvc_append(s, out, &n, cap)) {
+      status = TELEMETRY_USB_CTRL_PARTIAL;
+      continue;
+    }
+    count++;
+  }
+  out[0] = count;
+  *out_len = n;
+  return status;
+}
+
+// LVC_GET from USB or UART, answered in g_lvc_reply.
+static size_t lvc_ctrl_reply(const uint8_t *args, size_t n) {
+  const size_t hdr = ctrl_status_reply(TELEMETRY_USB_CTRL_LVC_GET, 0,
+                                       g_lvc_reply);
+  size_t len = 0;
+  g_lvc_reply[hdr - 1u] = lvc_query(args, n, &g_lvc_reply[hdr],
+                                    sizeof(g_lvc_reply) - hdr, &len);
+  return hdr + len;
+}
+
+// A query frame on TELEMETRY_CAN_LVC_QUERY_STD_ID, from
+// can_bus_process_rx(). The reply goes out in the control class.
+static void on_lvc_frame(const uint8_t *data, size_t len, uint64_t ts_us,
+                         void *user) {
+  (void)ts_us;
+  (void)user;
+  size_t n = 0;
+  g_lvc_reply[0] = lvc_query(data, len, &g_lvc_reply[1],
+                             sizeof(g_lvc_reply) - 1u, &n);
+  const int locked = tx_lock(&g_can_tx_mutex, g_can_tx_mutex_ok);
+  (void)can_bus_send_large_prio(can_bus_get(TELEMETRY_CAN_BUS), g_lvc_reply,
+                                n + 1u, TELEMETRY_CAN_LVC_REPLY_STD_ID,
+                                CAN_BUS_TX_PRIO_MID);
+  if (locked) (void)tx_mutex_put(&g_can_tx_mutex);
+}
+
+int telemetry_lvc_get(SedsDataType ty, void *out, size_t cap,
+                      uint64_t *timestamp) {
+  const uint32_t t = (uint32_t)ty;
+  if (t >= TELEMETRY_RX_MAX_DATA_TYPES || g_lvc_slot[t] == 0) return -1;
+  const uint32_t s = g_lvc_slot[t] - 1u;
+  lvc_value_t v;
+  if (!seqlock_read(&g_lvc_seq[s], &v, &g_lvc[s], sizeof(v)) || v.len > cap)
+    return -1;
+  memcpy(out, v.data, v.len);
+  if (timestamp) *timestamp = v.ts;
+  return (int)v.len;
+}
+
+void telemetry_lvc_get_stats(telemetry_lvc_stats_t *out) {
+  if (out) *out = g_lvc_stats;
+}
+#else
+int telemetry_lvc_get(SedsDataType ty, void *out, size_t cap,
+                      uint64_t *timestamp) {
+  (void)ty;
+  (void)out;
+  (void)cap;
+  (void)timestamp;
+  return -1;
+}
+
+void telemetry_lvc_get_stats(telemetry_lvc_stats_t *out) {
+  if (out) memset(out, 0, sizeof(*out));
+}
+#endif
+
+/* ---------------- Bus capture ----------------
+ * The capture hook turns each frame into a record in a byte ring, with
+ * interrupts masked since sent frames arrive from ISRs too, and
+ * telemetry_capture_poll() packs whole records into capture frames for the
+ * side that started it. A frame the link refuses stays in the ring for the
+ * next poll, so only a full ring drops records. Start, stop and poll all
+ * run on the telemetry RX thread, the only reader of the ring.
+ */
+#define CAP_REC_HDR TELEMETRY_CAPTURE_REC_HDR
+#define CAP_FRAME_HDR TELEMETRY_CAPTURE_FRAME_HDR
+
+// Memory-pressure level (TELEMETRY_MEM_*), set by telemetry_mem_poll().
+static volatile uint8_t g_mem_level;
+
+#if TELEMETRY_CAPTURE_BYTES || TELEMETRY_BLACKBOX_BYTES
+static const uint8_t k_cap_magic[4] = TELEMETRY_CAPTURE_MAGIC;
+
+static void raw_hook_update(void);
+
+// Capture record header of one frame off the capture hook.
+static void raw_rec_hdr(uint8_t *h, uint32_t id, uint8_t flags, size_t len,
+                        uint64_t ts_us) {
+  const uint32_t can_id =
+      id | ((flags & CAN_BUS_RAW_EXT) ? TELEMETRY_CAPTURE_EFF_FLAG : 0u);
+  for (unsigned i = 0; i < 8u; i++) h[i] = (uint8_t)(ts_us >> (8u * i));
+  for (unsigned i = 0; i < 4u; i++) h[8u + i] = (uint8_t)(can_id >> (8u * i));
+  h[12] = (uint8_t)len;
+  h[13] = (uint8_t)(((flags & CAN_BUS_RAW_FD) ? TELEMETRY_CAPTURE_FD_FDF : 0u) |
+                    ((flags & CAN_BUS_RAW_BRS) ? TELEMETRY_CAPTURE_FD_BRS : 0u) |
+                    ((flags & CAN_BUS_RAW_TX) ? TELEMETRY_CAPTURE_DIR_TX : 0u));
+}
+#endif
+
+#if TELEMETRY_CAPTURE_BYTES
+_Static_assert((TELEMETRY_CAPTURE_BYTES & (TELEMETRY_CAPTURE_BYTES - 1u)) == 0,
+               "TELEMETRY_CAPTURE_BYTES must be a power of two");
+
+_Static_assert(TELEMETRY_CAPTURE_FRAME_MAX >= CAP_FRAME_HDR + CAP_REC_HDR + 64u,
+               "a capture frame must hold an FD record");
+
+static RAM_NOINIT uint8_t g_cap_buf[TELEMETRY_CAPTURE_BYTES];
+static volatile uint32_t g_cap_head = 0; // free-running byte counts
+static volatile uint32_t g_cap_tail = 0;
+static volatile int32_t g_cap_side = -1; // side capture goes to, -1 = off
+static volatile uint8_t g_cap_tx = 0;
+static telemetry_capture_stats_t g_cap_stats;
+static uint8_t g_cap_frame[TELEMETRY_CAPTURE_FRAME_MAX];
+
+static inline uint8_t *cap_at(uint32_t pos) {
+  return &g_cap_buf[pos & (TELEMETRY_CAPTURE_BYTES - 1u)];
+}
+
+static void cap_put(uint32_t pos, const uint8_t *src, size_t n) {
+  for (size_t i = 0; i < n; i++) *cap_at(pos + i) = src[i];
+}
+
+static void cap_frame(const uint8_t *h, uint8_t flags, const uint8_t *data,
+                      size_t len) {
+  if (g_cap_side < 0 || ((flags & CAN_BUS_RAW_TX) && !g_cap_tx)) return;
+  const uint32_t need = CAP_REC_HDR + (uint32_t)len;
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const uint32_t head = g_cap_head;
+  if (TELEMETRY_CAPTURE_BYTES - (head - g_cap_tail) < need) {
+    g_cap_stats.dropped++;
+  } else {
+    cap_put(head, h, CAP_REC_HDR);
+    cap_put(head + CAP_REC_HDR, data, len);
+    g_cap_head = head + need;
+    g_cap_stats.records++;
+  }
+  __set_PRIMASK(primask);
+}
+
+static void cap_stop(void) {
+  g_cap_side = -1;
+  g_cap_stats.active = 0;
+  raw_hook_update();
+}
+
+// (Re)start capture to `side` with an optional flags byte; records left from
+// an earlier capture are discarded.
+static uint8_t cap_start(int32_t side, const uint8_t *a, size_t n) {
+  if (side < 0) return TELEMETRY_USB_CTRL_BAD_ARG;
+  if (g_mem_level >= TELEMETRY_MEM_CAPTURE) return TELEMETRY_USB_CTRL_BUSY;
+  cap_stop();
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_cap_tail = g_cap_head;
+  __set_PRIMASK(primask);
+  g_cap_tx = (n != 0 && (a[0] & TELEMETRY_CAPTURE_TX)) ? 1u : 0u;
+  g_cap_side = side;
+  g_cap_stats.active = 1;
+  raw_hook_update();
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static HAL_StatusTypeDef cap_send(int32_t side, const uint8_t *bytes,
+                                  size_t len) {
+  const int locked = link_tx_lock();
+  HAL_StatusTypeDef st = HAL_BUSY;
+  if (side == g_usb_side_id) {
+    if (usb_cdc_tx_pending() <= TELEMETRY_CAPTURE_USB_PENDING_MAX)
+      st = usb_cdc_send_frame(bytes, len);
+#ifdef UART_LINK_ENABLED
+  } else if (side == g_uart_side_id) {
+    st = uart_link_send_frame(bytes, len);
+#endif
+  }
+  link_tx_unlock(locked);
+  return st;
+}
+
+void telemetry_capture_poll(void) {
+  const int32_t side = g_cap_side;
+  if (side < 0) return;
+  if (side == g_usb_side_id && !usb_cdc_is_connected()) {
+    cap_stop(); // the host went away
+    return;
+  }
+  for (;;) {
+    const uint32_t head = g_cap_head;
+    __DMB(); // see the records before their end (acquire)
+    uint32_t t = g_cap_tail;
+    size_t n = CAP_FRAME_HDR;
+    while (t != head) {
+      const size_t rec = CAP_REC_HDR + *cap_at(t + 12u);
+      if (n + rec > sizeof(g_cap_frame)) break;
+      for (size_t i = 0; i < rec; i++) g_cap_frame[n + i] = *cap_at(t + i);
+      n += rec;
+      t += (uint32_t)rec;
+    }
+    if (n == CAP_FRAME_HDR) return;
+    memcpy(g_cap_frame, k_cap_magic, sizeof(k_cap_magic));
+    const uint32_t dropped = g_cap_stats.dropped;
+    for (unsigned i = 0; i < 4u; i++)
+      g_cap_frame[4u + i] = (uint8_t)(dropped >> (8u * i));
+    if (cap_send(side, g_cap_frame, n) != HAL_OK) return; // kept for later
+    g_cap_tail = t;
+    g_cap_stats.frames++;
+  }
+}
+
+void telemetry_capture_get_stats(telemetry_capture_stats_t *out) {
+  if (out) *out = g_cap_stats;
+}
+#else
+void telemetry_capture_poll(void) {}
+
+void telemetry_capture_get_stats(telemetry_capture_stats_t *out) {
+  if (out) memset(out, 0, sizeof(*out));
+}
+#endif
+
+/* ---------------- TraceX dump ----------------
+ * TRACEX_DUMP freezes the ThreadX trace buffer and telemetry_tracex_poll()
+ * sends it in order, a chunk per frame, on the telemetry RX thread. A host
+ * that goes away ends the dump; recording resumes either way.
+ */
+#define TRX_FRAME_HDR 12u // magic, offset u32, size u32
+
+#ifdef TX_ENABLE_EVENT_TRACE
+static const uint8_t k_trx_magic[4] = TELEMETRY_TRACEX_MAGIC;
+static const uint8_t *g_trx_buf = NULL; // frozen buffer, NULL = no dump
+static size_t g_trx_len = 0;
+static size_t g_trx_off = 0;
+static uint8_t g_trx_frame[TRX_FRAME_HDR + TELEMETRY_TRACEX_CHUNK];
+
+static uint8_t tracex_ctrl(void) {
+  if (g_trx_buf) return TELEMETRY_USB_CTRL_BUSY;
+  if (!tracex_freeze(&g_trx_buf, &g_trx_len)) {
+    g_trx_buf = NULL;
+    return TELEMETRY_USB_CTRL_BAD_OP;
+  }
+  g_trx_off = 0;
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static void tracex_done(void) {
+  g_trx_buf = NULL;
+  tracex_resume();
+}
+
+void telemetry_tracex_poll(void) {
+  if (!g_trx_buf) return;
+  if (!usb_cdc_is_connected()) {
+    tracex_done();
+    return;
+  }
+  const int locked = link_tx_lock();
+  while (g_trx_off < g_trx_len &&
+         usb_cdc_tx_pending() <= TELEMETRY_CAPTURE_USB_PENDING_MAX) {
+    size_t n = g_trx_len - g_trx_off;
+    if (n > TELEMETRY_TRACEX_CHUNK) n = TELEMETRY_TRACEX_CHUNK;
+    memcpy(g_trx_frame, k_trx_magic, sizeof(k_trx_magic));
+    put_le32(&g_trx_frame[4], (uint32_t)g_trx_off);
+    put_le32(&g_trx_frame[8], (uint32_t)g_trx_len);
+    memcpy(&g_trx_frame[TRX_FRAME_HDR], &g_trx_buf[g_trx_off], n);
+    if (usb_cdc_send_frame(g_trx_frame, TRX_FRAME_HDR + n) != HAL_OK)
+      break; // busy: the rest next poll
+    g_trx_off += n;
+  }
+  link_tx_unlock(locked);
+  if (g_trx_off >= g_trx_len) tracex_done();
+}
+#else
+static uint8_t tracex_ctrl(void) { return TELEMETRY_USB_CTRL_BAD_OP; }
+
+void telemetry_tracex_poll(void) {}
+#endif
+
+/* ---------------- Heap trace dump ----------------
+ * The same as the TraceX dump for the allocation trace: recording stops
+ * while telemetry_heap_trace_poll() sends the records the ring still holds,
+ * oldest first.
+ */
+#define HTR_FRAME_HDR 12u     // magic, first seq u32, end seq u32
+#define HTR_FRAME_RECORDS 16u // of 16 bytes
+
+#if RUST_HEAP_TRACE_EVENTS
+static const uint8_t k_htr_magic[4] = TELEMETRY_HEAP_TRACE_MAGIC;
+static uint8_t g_htr_active = 0;
+static uint32_t g_htr_seq = 0; // next record to send
+static uint32_t g_htr_end = 0;
+static uint8_t g_htr_frame[HTR_FRAME_HDR +
+                           HTR_FRAME_RECORDS * sizeof(rust_heap_trace_t)];
+
+static uint8_t heap_trace_ctrl(void) {
+  if (g_htr_active) return TELEMETRY_USB_CTRL_BUSY;
+  g_htr_end = rust_heap_trace_freeze(1);
+  g_htr_seq = (g_htr_end > RUST_HEAP_TRACE_EVENTS)
+                  ? g_htr_end - RUST_HEAP_TRACE_EVENTS
+                  : 0u;
+  g_htr_active = 1;
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static void heap_trace_done(void) {
+  g_htr_active = 0;
+  (void)rust_heap_trace_freeze(0);
+}
+
+void telemetry_heap_trace_poll(void) {
+  if (!g_htr_active) return;
+  if (!usb_cdc_is_connected()) {
+    heap_trace_done();
+    return;
+  }
+  // At least one frame goes out, empty if nothing was recorded, so the host
+  // always sees the dump end.
+  int sent_all = 0;
+  const int locked = link_tx_lock();
+  while (!sent_all &&
+         usb_cdc_tx_pending() <= TELEMETRY_CAPTURE_USB_PENDING_MAX) {
+    size_t n = 0;
+    uint32_t seq = g_htr_seq;
+    rust_heap_trace_t e;
+    for (; n < HTR_FRAME_RECORDS && seq < g_htr_end; seq++, n++) {
+      if (!rust_heap_trace_get(seq, &e)) break;
+      memcpy(&g_htr_frame[HTR_FRAME_HDR + n * sizeof(e)], &e, sizeof(e));
+    }
+    if (n == 0) seq = g_htr_end; // nothing left that the ring still holds
+    memcpy(g_htr_frame, k_htr_magic, sizeof(k_htr_magic));
+    put_le32(&g_htr_frame[4], n ? g_htr_seq : seq);
+    put_le32(&g_htr_frame[8], g_htr_end);
+    if (usb_cdc_send_frame(g_htr_frame, HTR_FRAME_HDR + n * sizeof(e)) !=
+        HAL_OK)
+      break; // busy: the rest next poll
+    g_htr_seq = seq;
+    sent_all = (g_htr_seq >= g_htr_end);
+  }
+  link_tx_unlock(locked);
+  if (sent_all) heap_trace_done();
+}
+#else
+static uint8_t heap_trace_ctrl(void) { return TELEMETRY_USB_CTRL_BAD_OP; }
+
+void telemetry_heap_trace_poll(void) {}
+#endif
+
+/* ---------------- PC samples ----------------
+ * Unlike the dumps above the sampler keeps running: every poll sends what
+ * the ring holds, and the thread comes back before the ring is half full.
+ */
+#define PCS_FRAME_HDR 16u     // magic, first seq u32, dropped u32, hz u32
+#define PCS_FRAME_RECORDS 32u // of 8 bytes
+
+#ifdef PC_SAMPLE_ENABLED
+static const uint8_t k_pcs_magic[4] = TELEMETRY_PC_SAMPLE_MAGIC;
+static uint8_t g_pcs_frame[PCS_FRAME_HDR +
+                           PCS_FRAME_RECORDS * sizeof(pc_sample_t)];
+// Read from the ring but not sent yet (USB busy).
+static pc_sample_t g_pcs_held[PCS_FRAME_RECORDS];
+static size_t g_pcs_held_n = 0;
+static uint32_t g_pcs_held_seq = 0;
+
+static uint8_t pc_sample_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  if (op == TELEMETRY_USB_CTRL_PC_SAMPLE_STOP) {
+    pc_sample_stop();
+    return TELEMETRY_USB_CTRL_OK;
+  }
+  if (n != 0u && n != 4u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  g_pcs_held_n = 0;
+  if (pc_sample_start(n ? get_le32(args) : 0u) != HAL_OK)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+uint32_t telemetry_pc_sample_poll(void) {
+  pc_sample_stats_t st;
+  pc_sample_get_stats(&st);
+  if (!st.hz) return UINT32_MAX;
+  if (!usb_cdc_is_connected()) {
+    pc_sample_stop();
+    return UINT32_MAX;
+  }
+  const int locked = link_tx_lock();
+  while (usb_cdc_tx_pending() <= TELEMETRY_CAPTURE_USB_PENDING_MAX) {
+    if (!g_pcs_held_n)
+      g_pcs_held_n =
+          pc_sample_read(g_pcs_held, PCS_FRAME_RECORDS, &g_pcs_held_seq);
+    if (!g_pcs_held_n) break;
+    memcpy(g_pcs_frame, k_pcs_magic, sizeof(k_pcs_magic));
+    put_le32(&g_pcs_frame[4], g_pcs_held_seq);
+    put_le32(&g_pcs_frame[8], st.dropped);
+    put_le32(&g_pcs_frame[12], st.hz);
+    for (size_t i = 0; i < g_pcs_held_n; i++) {
+      uint8_t *r = &g_pcs_frame[PCS_FRAME_HDR + i * sizeof(pc_sample_t)];
+      put_le32(r, g_pcs_held[i].pc);
+      put_le32(r + 4, g_pcs_held[i].lr);
+    }
+    if (usb_cdc_send_frame(g_pcs_frame, PCS_FRAME_HDR +
+                                            g_pcs_held_n * sizeof(pc_sample_t)) !=
+        HAL_OK)
+      break; // busy: these first next poll
+    g_pcs_held_n = 0;
+  }
+  link_tx_unlock(locked);
+  const uint32_t ms = (PC_SAMPLE_RECORDS / 2u) * 1000u / st.hz;
+  return ms ? ms : 1u;
+}
+#else
+static uint8_t pc_sample_ctrl(uint8_t op, const uint8_t *args, size_t n) {
+  (void)op;
+  (void)args;
+  (void)n;
+  return TELEMETRY_USB_CTRL_BAD_OP;
+}
+
+uint32_t telemetry_pc_sample_poll(void) { return UINT32_MAX; }
+#endif
+
+/* ---------------- Result records ----------------
+ * Every benchmark and report result in one layout (TELEMETRY_RESULT_MAGIC),
+ * stamped with the build and the clocks it ran at, so a host can file the
+ * numbers of different revisions and boards side by side. FW_GIT_HASH and
+ * FW_GIT_DIRTY come from CMake at configure time.
+ */
+#ifndef FW_GIT_HASH
+#define FW_GIT_HASH 0u
+#endif
+#ifndef FW_GIT_DIRTY
+#define FW_GIT_DIRTY 0
+#endif
+
+static const uint8_t k_res_magic[4] = TELEMETRY_RESULT_MAGIC;
+// Under g_link_tx_mutex: the benches and the maintenance thread all record.
+static uint8_t g_res_frame[TELEMETRY_RESULT_HDR + TELEMETRY_RESULT_NAME_MAX +
+                           4u * TELEMETRY_RESULT_METRICS_MAX];
+
+HAL_StatusTypeDef telemetry_result_record(uint8_t source, const char *name,
+                                          const uint32_t *metrics,
+                                          size_t count) {
+  if (!name || (count && !metrics) || count > TELEMETRY_RESULT_METRICS_MAX)
+    return HAL_ERROR;
+  size_t name_len = strlen(name);
+  if (name_len > TELEMETRY_RESULT_NAME_MAX) name_len = TELEMETRY_RESULT_NAME_MAX;
+
+  can_bus_bitrate_t rate = {0};
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  if (bus) can_bus_get_bitrate(bus, &rate);
+  uint32_t flags = FW_GIT_DIRTY ? TELEMETRY_RESULT_F_DIRTY : 0u;
+#if defined(TELEMETRY_BENCH) || defined(MICROBENCH_ENABLED)
+  flags |= TELEMETRY_RESULT_F_LOOPBACK;
+#endif
+  const uint16_t node = telemetry_node_id();
+
+  const int locked = link_tx_lock();
+  uint8_t *f = g_res_frame;
+  memcpy(f, k_res_magic, sizeof(k_res_magic));
+  f[4] = TELEMETRY_RESULT_VERSION;
+  f[5] = source;
+  f[6] = (uint8_t)name_len;
+  f[7] = (uint8_t)count;
+  put_le32(&f[8], FW_GIT_HASH);
+  put_le32(&f[12], flags);
+  put_le32(&f[16], SystemCoreClock);
+  put_le32(&f[20], rate.nominal_bps);
+  put_le32(&f[24], rate.data_bps);
+  put_le32(&f[28], (uint32_t)(tx_raw_now_us() / 1000u));
+  f[32] = (uint8_t)node;
+  f[33] = (uint8_t)(node >> 8);
+  f[34] = 0;
+  f[35] = 0;
+  memcpy(&f[TELEMETRY_RESULT_HDR], name, name_len);
+  uint8_t *m = &f[TELEMETRY_RESULT_HDR + name_len];
+  for (size_t i = 0; i < count; i++) put_le32(&m[4u * i], metrics[i]);
+  const size_t len = TELEMETRY_RESULT_HDR + name_len + 4u * count;
+
+  HAL_StatusTypeDef st = HAL_ERROR; // no link up
+  if (usb_cdc_is_connected()) st = usb_cdc_send_frame(f, len);
+#ifdef UART_LINK_ENABLED
+  const HAL_StatusTypeDef ust = uart_link_send_frame(f, len);
+  if (st != HAL_OK) st = ust;
+#endif
+  link_tx_unlock(locked);
+  return st;
+}
+
+/* ---------------- Black box ----------------
+ * The capture hook also keeps the most recent TELEMETRY_BLACKBOX_BYTES of
+ * traffic, both directions, as capture records in a byte ring that
+ * overwrites its oldest records. A trigger lets it record for another
+ * TELEMETRY_BLACKBOX_POST_MS, then freezes it, and telemetry_blackbox_poll()
+ * writes the records from TELEMETRY_BLACKBOX_PRE_MS before the trigger on
+ * as capture frames before recording resumes. The hook only writes while
+ * not frozen and the poll only reads while frozen, so they never overlap.
+ */
+#if TELEMETRY_BLACKBOX_BYTES
+_Static_assert((TELEMETRY_BLACKBOX_BYTES & (TELEMETRY_BLACKBOX_BYTES - 1u)) ==
+                   0,
+               "TELEMETRY_BLACKBOX_BYTES must be a power of two");
+_Static_assert(TELEMETRY_BLACKBOX_FRAME_MAX >=
+                   CAP_FRAME_HDR + CAP_REC_HDR + 64u,
+               "a black box frame must hold an FD record");
+#if TELEMETRY_STORE_FORWARD
+_Static_assert(TELEMETRY_BLACKBOX_FRAME_MAX <= FLASH_LOG_RECORD_MAX,
+               "black box frames must fit a flash store record");
+#endif
+#ifdef SD_LOG_ENABLED
+_Static_assert(TELEMETRY_BLACKBOX_FRAME_MAX <= SD_LOG_PAYLOAD_MAX,
+               "black box frames must fit an SD log record");
+#endif
+
+enum { BB_ARMED = 0, BB_POST, BB_FROZEN };
+
+static RAM_NOINIT uint8_t g_bb_buf[TELEMETRY_BLACKBOX_BYTES];
+static volatile uint32_t g_bb_head = 0; // free-running byte counts
+static volatile uint32_t g_bb_tail = 0;
+static volatile uint8_t g_bb_state = BB_ARMED;
+static uint64_t g_bb_trigger_us = 0;
+static uint32_t g_bb_rd = 0;       // next record written out, while frozen
+static uint32_t g_bb_bus_offs = 0; // monitor count at the last poll
+static telemetry_blackbox_stats_t g_bb_stats;
+static uint8_t g_bb_frame[TELEMETRY_BLACKBOX_FRAME_MAX];
+
+static inline uint8_t *bb_at(uint32_t pos) {
+  return &g_bb_buf[pos & (TELEMETRY_BLACKBOX_BYTES - 1u)];
+}
+
+static inline uint32_t bb_rec_len(uint32_t pos) {
+  return CAP_REC_HDR + *bb_at(pos + 12u);
+}
+
+static uint64_t bb_rec_ts(uint32_t pos) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < 8u; i++) v |= (uint64_t)*bb_at(pos + i) << (8u * i);
+  return v;
+}
+
+static void bb_frame(const uint8_t *h, const uint8_t *data, size_t len) {
+  const uint32_t need = CAP_REC_HDR + (uint32_t)len;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (g_bb_state != BB_FROZEN) {
+    const uint32_t head = g_bb_head;
+    uint32_t tail = g_bb_tail;
+    while (TELEMETRY_BLACKBOX_BYTES - (head - tail) < need)
+      tail += bb_rec_len(tail); // overwrite the oldest
+    g_bb_tail = tail;
+    for (uint32_t i = 0; i < CAP_REC_HDR; i++) *bb_at(head + i) = h[i];
+    for (uint32_t i = 0; i < len; i++) *bb_at(head + CAP_REC_HDR + i) = data[i];
+    g_bb_head = head + need;
+  }
+  __set_PRIMASK(primask);
+}
+
+void telemetry_blackbox_trigger(uint8_t reason) {
+  const uint64_t now = tx_raw_now_us();
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (g_bb_state == BB_ARMED) {
+    g_bb_state = BB_POST;
+    g_bb_trigger_us = now;
+    g_bb_stats.triggers++;
+    g_bb_stats.last_reason = reason;
+  } else {
+    g_bb_stats.ignored++;
+  }
+  __set_PRIMASK(primask);
+}
+
+static uint8_t bb_ctrl(void) {
+  telemetry_blackbox_trigger(TELEMETRY_BLACKBOX_COMMAND);
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+// One frame to every sink; HAL_BUSY to try it again later.
+static HAL_StatusTypeDef bb_emit(const uint8_t *f, size_t n) {
+#if TELEMETRY_STORE_FORWARD
+  if (flash_log_append(f, n) == HAL_BUSY) return HAL_BUSY;
+#endif
+  sd_log_append(TELEMETRY_BLACKBOX_SD_TYPE, g_bb_trigger_us, f, n);
+  return HAL_OK;
+}
+
+uint32_t telemetry_blackbox_poll(void) {
+  can_bus_monitor_t mon;
+  can_bus_get_monitor(can_bus_get(TELEMETRY_CAN_BUS), &mon);
+  if (mon.bus_offs != g_bb_bus_offs) {
+    g_bb_bus_offs = mon.bus_offs;
+    telemetry_blackbox_trigger(TELEMETRY_BLACKBOX_BUS_OFF);
+  }
+  if (g_bb_state == BB_ARMED) return TELEMETRY_BLACKBOX_POLL_MS;
+
+  if (g_bb_state == BB_POST) {
+    const uint64_t now = tx_raw_now_us();
+    const uint64_t end =
+        g_bb_trigger_us + (uint64_t)TELEMETRY_BLACKBOX_POST_MS * 1000u;
+    if (now < end) {
+      const uint64_t left_ms = (end - now + 999u) / 1000u;
+      return (left_ms < TELEMETRY_BLACKBOX_POLL_MS)
+                 ? (uint32_t)left_ms
+                 : TELEMETRY_BLACKBOX_POLL_MS;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    g_bb_state = BB_FROZEN;
+    __set_PRIMASK(primask);
+    const uint64_t pre = (uint64_t)TELEMETRY_BLACKBOX_PRE_MS * 1000u;
+    const uint64_t from = (g_bb_trigger_us > pre) ? g_bb_trigger_us - pre : 0;
+    uint32_t t = g_bb_tail;
+    while (t != g_bb_head && bb_rec_ts(t) < from) t += bb_rec_len(t);
+    g_bb_rd = t;
+  }
+
+  for (;;) {
+    uint32_t t = g_bb_rd;
+    size_t n = CAP_FRAME_HDR;
+    while (t != g_bb_head) {
+      const uint32_t rec = bb_rec_len(t);
+      if (n + rec > sizeof(g_bb_frame)) break;
+      for (uint32_t i = 0; i < rec; i++) g_bb_frame[n + i] = *bb_at(t + i);
+      n += rec;
+      t += rec;
+    }
+    if (n == CAP_FRAME_HDR) break;
+    memcpy(g_bb_frame, k_cap_magic, sizeof(k_cap_magic));
+    memset(&g_bb_frame[4], 0, 4); // nothing dropped: the ring overwrites
+    if (bb_emit(g_bb_frame, n) != HAL_OK)
+      return TELEMETRY_BLACKBOX_RETRY_MS; // flash staging full
+    g_bb_rd = t;
+    g_bb_stats.frames++;
+  }
+  g_bb_stats.dumps++;
+  g_bb_state = BB_ARMED; // the hook reads it with IRQs masked
+  return TELEMETRY_BLACKBOX_POLL_MS;
+}
+
+void telemetry_blackbox_get_stats(telemetry_blackbox_stats_t *out) {
+  if (!out) return;
+  *out = g_bb_stats;
+  out->state = g_bb_state;
+}
+#else
+static uint8_t bb_ctrl(void) { return TELEMETRY_USB_CTRL_BAD_OP; }
+
+void telemetry_blackbox_trigger(uint8_t reason) { (void)reason; }
+
+uint32_t telemetry_blackbox_poll(void) { return UINT32_MAX; }
+
+void telemetry_blackbox_get_stats(telemetry_blackbox_stats_t *out) {
+  if (out) memset(out, 0, sizeof(*out));
+}
+#endif
+
+#if TELEMETRY_CAPTURE_BYTES || TELEMETRY_BLACKBOX_BYTES
+// can_bus has one capture hook; the capture and the black box share it.
+static void raw_frame(uint32_t id, uint8_t flags, const uint8_t *data,
+                      size_t len, uint64_t ts_us, void *user) {
+  (void)user;
+  uint8_t h[CAP_REC_HDR];
+  raw_rec_hdr(h, id, flags, len, ts_us);
+#if TELEMETRY_CAPTURE_BYTES
+  cap_frame(h, flags, data, len);
+#endif
+#if TELEMETRY_BLACKBOX_BYTES
+  bb_frame(h, data, len);
+#endif
+}
+
+static void raw_hook_update(void) {
+  int on = (TELEMETRY_BLACKBOX_BYTES != 0);
+#if TELEMETRY_CAPTURE_BYTES
+  on = on || g_cap_side >= 0;
+#endif
+  can_bus_set_capture(can_bus_get(TELEMETRY_CAN_BUS), on ? raw_frame : NULL,
+                      NULL);
+}
+#endif
+
+/* ---------------- Trace replay ----------------
+ * Capture records from the host are held in order, oldest at g_replay_rd,
+ * and injected into the CAN RX rings once due: the first at once, each
+ * later one when its distance in trace time from the first, divided by the
+ * scale, has passed. Sent frames and time-sync traffic are skipped, the
+ * latter so old exchanges can't steer the clock. Everything runs on the
+ * telemetry RX thread, which also drains the rings.
+ */
+#if TELEMETRY_REPLAY_BYTES
+static RAM_NOINIT uint8_t g_replay_buf[TELEMETRY_REPLAY_BYTES];
+static uint32_t g_replay_used = 0; // bytes held
+static uint32_t g_replay_rd = 0;   // next record
+static uint16_t g_replay_scale_pct = 100;
+static uint8_t g_replay_started = 0; // first record injected, bases taken
+static uint64_t g_replay_base_trace_us = 0;
+static uint64_t g_replay_base_raw_us = 0;
+static telemetry_replay_stats_t g_replay_stats;
+
+static uint64_t le_get(const uint8_t *p, unsigned n) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < n; i++) v |= (uint64_t)p[i] << (8u * i);
+  return v;
+}
+
+// Start over with an optional u16 scale in percent (100 = as recorded,
+// 0 = as fast as the rings take them).
+static uint8_t replay_start(const uint8_t *a, size_t n) {
+  if (n != 0 && n != 2u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  g_replay_scale_pct = n ? (uint16_t)le_get(a, 2u) : 100u;
+  g_replay_used = 0;
+  g_replay_rd = 0;
+  g_replay_started = 0;
+  g_replay_stats.active = 1;
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static void replay_stop(void) {
+  g_replay_used = 0;
+  g_replay_rd = 0;
+  g_replay_stats.active = 0;
+}
+
+// Queue whole records; BUSY leaves the host to send the frame again.
+static uint8_t replay_add(const uint8_t *a, size_t n) {
+  if (!g_replay_stats.active) return TELEMETRY_USB_CTRL_BAD_ARG;
+  for (size_t off = 0; off < n;) {
+    if (n - off < CAP_REC_HDR || a[off + 12u] > 64u ||
+        n - off < CAP_REC_HDR + a[off + 12u])
+      return TELEMETRY_USB_CTRL_BAD_ARG;
+    off += CAP_REC_HDR + a[off + 12u];
+  }
+  if (g_replay_rd) {
+    g_replay_used -= g_replay_rd;
+    memmove(g_replay_buf, &g_replay_buf[g_replay_rd], g_replay_used);
+    g_replay_rd = 0;
+  }
+  if (n > sizeof(g_replay_buf) - g_replay_used) {
+    g_replay_stats.busy++;
+    return TELEMETRY_USB_CTRL_BUSY;
+  }
+  memcpy(&g_replay_buf[g_replay_used], a, n);
+  g_replay_used += (uint32_t)n;
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static uint8_t replay_ctrl(uint8_t op, const uint8_t *a, size_t n) {
+  switch (op) {
+  case TELEMETRY_USB_CTRL_REPLAY_START:
+    return replay_start(a, n);
+  case TELEMETRY_USB_CTRL_REPLAY_DATA:
+    return replay_add(a, n);
+  case TELEMETRY_USB_CTRL_REPLAY_STOP:
+    replay_stop();
+    return TELEMETRY_USB_CTRL_OK;
+  default:
+    return TELEMETRY_USB_CTRL_BAD_OP;
+  }
+}
+
+uint32_t telemetry_replay_poll(void) {
+  if (!g_replay_stats.active) return UINT32_MAX;
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  const uint64_t now = tx_raw_now_us();
+  while (g_replay_rd < g_replay_used) {
+    const uint8_t *rec = &g_replay_buf[g_replay_rd];
+    const uint64_t ts = le_get(rec, 8u);
+    const uint32_t can_id = (uint32_t)le_get(&rec[8], 4u);
+    const uint8_t len = rec[12];
+    const uint8_t fl = rec[13];
+    const uint8_t ext = (can_id & TELEMETRY_CAPTURE_EFF_FLAG) != 0;
+    const uint32_t id = can_id & (ext ? 0x1FFFFFFFu : 0x7FFu);
+    if ((fl & TELEMETRY_CAPTURE_DIR_TX) ||
+        (!ext && id <= TELEMETRY_CAN_TIMESYNC_STD_ID)) {
+      g_replay_stats.skipped++;
+      g_replay_rd += CAP_REC_HDR + len;
+      continue;
+    }
+    if (!g_replay_started) {
+      g_replay_base_trace_us = ts;
+      g_replay_base_raw_us = now;
+      g_replay_started = 1;
+    }
+    if (g_replay_scale_pct != 0 && ts > g_replay_base_trace_us) {
+      const uint64_t due = g_replay_base_raw_us +
+                           (ts - g_replay_base_trace_us) * 100u /
+                               g_replay_scale_pct;
+      if (now < due) return (uint32_t)((due - now + 999u) / 1000u);
+    }
+    // The FIFO the hardware filters give these IDs.
+    const can_bus_rx_fifo_t fifo =
+        (!ext && id <= TELEMETRY_CAN_CONTROL_STD_ID) ? CAN_BUS_RX_FIFO0
+                                                     : CAN_BUS_RX_FIFO1;
+    const uint8_t flags =
+        (uint8_t)((ext ? CAN_BUS_RAW_EXT : 0u) |
+                  ((fl & TELEMETRY_CAPTURE_FD_FDF) ? CAN_BUS_RAW_FD : 0u) |
+                  ((fl & TELEMETRY_CAPTURE_FD_BRS) ? CAN_BUS_RAW_BRS : 0u));
+    const HAL_StatusTypeDef st =
+        can_bus_inject_rx(bus, fifo, id, flags, &rec[CAP_REC_HDR], len);
+    if (st == HAL_BUSY) return 1; // the ring drains on this thread
+    if (st == HAL_OK)
+      g_replay_stats.injected++;
+    else
+      g_replay_stats.skipped++;
+    g_replay_rd += CAP_REC_HDR + len;
+  }
+  return UINT32_MAX;
+}
+
+void telemetry_replay_get_stats(telemetry_replay_stats_t *out) {
+  if (out) *out = g_replay_stats;
+}
+#else
+static uint8_t replay_ctrl(uint8_t op, const uint8_t *a, size_t n) {
+  (void)op;
+  (void)a;
+  (void)n;
+  return TELEMETRY_USB_CTRL_BAD_OP;
+}
+
+uint32_t telemetry_replay_poll(void) { return UINT32_MAX; }
+
+void telemetry_replay_get_stats(telemetry_replay_stats_t *out) {
+  if (out) memset(out, 0, sizeof(*out));
+}
+#endif
+
+/* ---------------- USB host subscriptions ----------------
+ * The host picks the data types the USB side carries, with an optional
+ * minimum gap per type (TELEMETRY_USB_CTRL_* in telemetry.h). Until it
+ * sends a command, and again after each reconnect, it gets every type.
+ * Packets whose type telemetry_peek_type() can't read always go out. The
+ * mask and gaps are a swapped table (table_swap.h), changed under the link
+ * TX lock and read without it by the relay check too; the rate-limit state
+ * stays under the lock.
+ */
+#define USB_SUB_WORDS ((TELEMETRY_RX_MAX_DATA_TYPES + 31u) / 32u)
+typedef struct {
+  uint32_t mask[USB_SUB_WORDS];
+  uint16_t gap_ms[TELEMETRY_RX_MAX_DATA_TYPES];
+} usb_sub_tab_t;
+static usb_sub_tab_t g_usb_sub_tabs[2];
+static table_swap_t g_usb_sub;
+static uint32_t g_usb_sub_last_ms[TELEMETRY_RX_MAX_DATA_TYPES];
+static uint8_t g_usb_sub_up = 0; // host connected at the last check
+static uint32_t g_usb_sub_filtered = 0;
+static uint32_t g_usb_sub_limited = 0;
+
+static void usb_sub_init(void) {
+  table_swap_init(&g_usb_sub, &g_usb_sub_tabs[0], &g_usb_sub_tabs[1],
+                  sizeof(g_usb_sub_tabs[0]), 0);
+}
+
+// 0 if a reader still held the spare table for `wait_ms`.
+static int usb_sub_all(uint8_t on, uint32_t wait_ms) {
+  usb_sub_tab_t *tab = table_swap_begin(&g_usb_sub, wait_ms);
+  if (!tab) return 0;
+  memset(tab->mask, on ? 0xFF : 0x00, sizeof(tab->mask));
+  memset(tab->gap_ms, 0, sizeof(tab->gap_ms));
+  table_swap_publish(&g_usb_sub);
+  return 1;
+}
+
+// A new host session starts with everything subscribed. On the TX path
+// this never waits; the session starts on a later packet instead.
+static void usb_sub_session(void) {
+  const uint8_t up = usb_cdc_is_connected();
+  if (up && !g_usb_sub_up && !usb_sub_all(1, 0)) return;
+  g_usb_sub_up = up;
+}
+
+static inline int usb_sub_has(uint32_t t) {
+  const usb_sub_tab_t *tab = table_swap_read(&g_usb_sub);
+  return t >= TELEMETRY_RX_MAX_DATA_TYPES || !tab ||
+         ((tab->mask[t / 32u] >> (t % 32u)) & 1u);
+}
+
+// 1 if the host takes this packet now (its rate-limit slot is used up).
+static int usb_sub_admit(const uint8_t *bytes, size_t len) {
+  SedsDataType ty;
+  if (!telemetry_peek_type(bytes, len, &ty)) return 1;
+  const uint32_t t = (uint32_t)ty;
+  if (!usb_sub_has(t)) {
+    g_usb_sub_filtered++;
+    return 0;
+  }
+  const usb_sub_tab_t *tab = table_swap_read(&g_usb_sub);
+  const uint16_t gap = (tab && t < TELEMETRY_RX_MAX_DATA_TYPES) ? tab->gap_ms[t] : 0u;
+  if (gap != 0) {
+    const uint32_t now = (uint32_t)(tx_raw_now_us() / 1000u);
+    if ((uint32_t)(now - g_usb_sub_last_ms[t]) < gap) {
+      g_usb_sub_limited++;
+      return 0;
+    }
+    g_usb_sub_last_ms[t] = now;
+  }
+  return 1;
+}
+
+static uint8_t usb_sub_set(const uint8_t *a, size_t n, uint8_t on) {
+  if (n < (on ? 6u : 4u)) return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint32_t first = a[0] | ((uint32_t)a[1] << 8);
+  const uint32_t last = a[2] | ((uint32_t)a[3] << 8);
+  const uint16_t gap = on ? (uint16_t)(a[4] | (a[5] << 8)) : 0u;
+  if (first > last || last >= TELEMETRY_RX_MAX_DATA_TYPES)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  usb_sub_tab_t *tab = table_swap_begin(&g_usb_sub, TELEMETRY_TABLE_WAIT_MS);
+  if (!tab) return TELEMETRY_USB_CTRL_BUSY;
+  const uint32_t now = (uint32_t)(tx_raw_now_us() / 1000u);
+  for (uint32_t t = first; t <= last; t++) {
+    if (on) {
+      tab->mask[t / 32u] |= 1u << (t % 32u);
+    } else {
+      tab->mask[t / 32u] &= ~(1u << (t % 32u));
+    }
+    tab->gap_ms[t] = gap;
+    g_usb_sub_last_ms[t] = now - gap; // the next one goes out
+  }
+  table_swap_publish(&g_usb_sub);
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+typedef HAL_StatusTypeDef (*ctrl_send_fn)(const uint8_t *bytes, size_t len);
+
+// Handle a host control frame and reply to it with `send` (the pipe it came
+// on). 0 if `bytes` isn't one.
+static int usb_ctrl_rx(const uint8_t *bytes, size_t len, ctrl_send_fn send) {
+  if (!ctrl_is_frame(bytes, len)) return 0;
+  const uint8_t op = bytes[sizeof(k_usb_ctrl_magic)];
+  const uint8_t *args = bytes + sizeof(k_usb_ctrl_magic) + 1u;
+  const size_t n = len - sizeof(k_usb_ctrl_magic) - 1u;
+
+#if TELEMETRY_LVC
+  if (op == TELEMETRY_USB_CTRL_LVC_GET) {
+    const size_t rlen = lvc_ctrl_reply(args, n);
+    const int locked = link_tx_lock();
+    (void)send(g_lvc_reply, rlen);
+    link_tx_unlock(locked);
+    return 1;
+  }
+#endif
+  if (op == TELEMETRY_USB_CTRL_CONFIG_GET) {
+    const size_t rlen = cfg_get_reply(args, n);
+    const int locked = link_tx_lock();
+    (void)send(g_cfg_reply, rlen);
+    link_tx_unlock(locked);
+    return 1;
+  }
+  if (op == TELEMETRY_USB_CTRL_TALKERS) {
+    const size_t rlen = top_reply(args, n);
+    const int locked = link_tx_lock();
+    (void)send(g_top_reply, rlen);
+    link_tx_unlock(locked);
+    return 1;
+  }
+  if (op == TELEMETRY_USB_CTRL_HEALTH_GET) {
+    const size_t rlen = health_reply();
+    const int locked = link_tx_lock();
+    (void)send(g_health_reply, rlen);
+    link_tx_unlock(locked);
+    return 1;
+  }
+  const int locked = link_tx_lock();
+  usb_sub_session();
+  uint8_t status = TELEMETRY_USB_CTRL_OK;
+  switch (op) {
+  case TELEMETRY_USB_CTRL_SUBSCRIBE:
+    status = usb_sub_set(args, n, 1);
+    break;
+  case TELEMETRY_USB_CTRL_UNSUBSCRIBE:
+    status = usb_sub_set(args, n, 0);
+    break;
+  case TELEMETRY_USB_CTRL_SUBSCRIBE_ALL:
+  case TELEMETRY_USB_CTRL_UNSUBSCRIBE_ALL:
+    if (!usb_sub_all(op == TELEMETRY_USB_CTRL_SUBSCRIBE_ALL,
+                     TELEMETRY_TABLE_WAIT_MS))
+      status = TELEMETRY_USB_CTRL_BUSY;
+    break;
+#if TELEMETRY_CAPTURE_BYTES
+  case TELEMETRY_USB_CTRL_CAPTURE_START:
+    status = cap_start(g_usb_side_id, args, n);
+    break;
+  case TELEMETRY_USB_CTRL_CAPTURE_STOP:
+    cap_stop();
+    break;
+#endif
+  case TELEMETRY_USB_CTRL_BLACKBOX_TRIGGER:
+    status = bb_ctrl();
+    break;
+  case TELEMETRY_USB_CTRL_REPLAY_START:
+  case TELEMETRY_USB_CTRL_REPLAY_DATA:
+  case TELEMETRY_USB_CTRL_REPLAY_STOP:
+    status = replay_ctrl(op, args, n);
+    break;
+  case TELEMETRY_USB_CTRL_CONFIG_SET:
+  case TELEMETRY_USB_CTRL_CONFIG_COMMIT:
+  case TELEMETRY_USB_CTRL_CONFIG_DEFAULTS:
+    status = cfg_ctrl(op, args, n);
+    break;
+  case TELEMETRY_USB_CTRL_TRACEX_DUMP:
+    status = tracex_ctrl();
+    break;
+  case TELEMETRY_USB_CTRL_HEAP_TRACE_DUMP:
+    status = heap_trace_ctrl();
+    break;
+  case TELEMETRY_USB_CTRL_PC_SAMPLE_START:
+  case TELEMETRY_USB_CTRL_PC_SAMPLE_STOP:
+    status = pc_sample_ctrl(op, args, n);
+    break;
+#ifdef FW_UPDATE_ENABLED
+  case TELEMETRY_USB_CTRL_FW_BEGIN:
+  case TELEMETRY_USB_CTRL_FW_DATA:
+  case TELEMETRY_USB_CTRL_FW_BLOCK:
+  case TELEMETRY_USB_CTRL_FW_COMMIT:
+  case TELEMETRY_USB_CTRL_FW_ABORT:
+    status = fw_ctrl(op, args, n);
+    break;
+#endif
+#ifdef FW_RELAY_ENABLED
+  case TELEMETRY_USB_CTRL_FW_RELAY_BEGIN:
+  case TELEMETRY_USB_CTRL_FW_RELAY_DATA:
+  case TELEMETRY_USB_CTRL_FW_RELAY_COMMIT:
+  case TELEMETRY_USB_CTRL_FW_RELAY_ABORT:
+    status = fw_relay_ctrl(op, args, n);
+    break;
+#endif
+#ifdef FILE_SRV_ENABLED
+  case TELEMETRY_USB_CTRL_FILE_PULL:
+  case TELEMETRY_USB_CTRL_FILE_PULL_ABORT:
+    status = file_ctrl(op, args, n);
+    break;
+#endif
+  default:
+    status = TELEMETRY_USB_CTRL_BAD_OP;
+    break;
+  }
+  uint8_t reply[sizeof(k_usb_ctrl_magic) + 2u];
+  (void)send(reply, ctrl_status_reply(op, status, reply));
+  link_tx_unlock(locked);
+  return 1;
+}
+
+void telemetry_usb_sub_get_stats(uint32_t *filtered, uint32_t *limited) {
+  if (filtered) *filtered = g_usb_sub_filtered;
+  if (limited) *limited = g_usb_sub_limited;
+}
+
+/* ---------------- Store and forward ----------------
+ * While no host has the USB port open its packets are appended to the
+ * flash ring; once one does, telemetry_store_poll() sends them back oldest
+ * first through the host's subscriptions, rate-limited by a byte budget
+ * that refills at TELEMETRY_STORE_REPLAY_BPS (at most one second's worth
+ * banked). Live packets keep going out in between.
+ */
+#if TELEMETRY_STORE_FORWARD
+static uint32_t g_store_credit = 0;
+static uint32_t g_store_last_ms = 0;
+static uint32_t g_store_replayed = 0;
+
+uint32_t telemetry_store_poll(void) {
+  const uint32_t wait = flash_log_poll();
+  const uint32_t now = (uint32_t)(tx_raw_now_us() / 1000u);
+  const uint32_t dt = now - g_store_last_ms;
+  g_store_last_ms = now;
+  if (!usb_cdc_is_connected()) {
+    g_store_credit = 0;
+    return TELEMETRY_STORE_POLL_MS; // staging fills between polls
+  }
+  const uint64_t credit = (uint64_t)g_store_credit +
+                          (uint64_t)dt * TELEMETRY_STORE_REPLAY_BPS / 1000u;
+  g_store_credit = (credit > TELEMETRY_STORE_REPLAY_BPS)
+                       ? TELEMETRY_STORE_REPLAY_BPS
+                       : (uint32_t)credit;
+
+  const uint8_t *d;
+  size_t n;
+  int more = 0;
+  const int locked = link_tx_lock();
+  usb_sub_session();
+  while ((more = flash_log_peek(&d, &n)) != 0) {
+    if (n > g_store_credit ||
+        usb_cdc_tx_pending() > TELEMETRY_STORE_USB_PENDING_MAX)
+      break;
+    // Black box dumps are capture frames, not packets: always sent.
+    static const uint8_t cap_magic[4] = TELEMETRY_CAPTURE_MAGIC;
+    const int dump = n >= sizeof(cap_magic) &&
+                     memcmp(d, cap_magic, sizeof(cap_magic)) == 0;
+    if (dump || usb_sub_admit(d, n)) {
+      const HAL_StatusTypeDef st = usb_cdc_send_frame(d, n);
+      if (st == HAL_BUSY) break;
+      g_store_credit -= (uint32_t)n;
+      if (st == HAL_OK) g_store_replayed++;
+    }
+    flash_log_pop();
+  }
+  link_tx_unlock(locked);
+  return more ? TELEMETRY_STORE_POLL_MS : wait;
+}
+
+void telemetry_store_get_stats(uint32_t *replayed, uint32_t *pending_pages) {
+  flash_log_stats_t st;
+  flash_log_get_stats(&st);
+  if (replayed) *replayed = g_store_replayed;
+  if (pending_pages) *pending_pages = st.pages_unread;
+}
+#else
+uint32_t telemetry_store_poll(void) { return UINT32_MAX; }
+
+void telemetry_store_get_stats(uint32_t *replayed, uint32_t *pending_pages) {
+  if (replayed) *replayed = 0;
+  if (pending_pages) *pending_pages = 0;
+}
+#endif
+
+// USB CDC side: one COBS frame per router packet. With no host on the port
+// there is nobody to deliver to, which is not a link error (the packet is
+// stored for later), and neither is a type the host didn't subscribe to.
+// 1 if this gateway uplinks the packet (can_gw.h); types the peek can't
+// read go out on both.
+static int gw_admit(const uint8_t *bytes, size_t len) {
+#ifdef CAN_GW_ENABLED
+  SedsDataType ty;
+  return !telemetry_peek_type(bytes, len, &ty) || can_gw_owns((uint32_t)ty);
+#else
+  (void)bytes;
+  (void)len;
+  return 1;
+#endif
+}
+
+#ifdef CAN_GW_ENABLED
+static int gw_uplink_up(void) {
+#ifdef UART_LINK_ENABLED
+  return 1;
+#else
+  return usb_cdc_is_connected();
+#endif
+}
+#endif
+
+/* ---------------- USB uplink merge ----------------
+ * With TELEMETRY_USB_MERGE_WINDOW_MS set, packets for the host are held in
+ * one queue per source (this board, CAN, UART), each in the order the
+ * router delivers them, and go out merged by the synced time the gateway
+ * took them in: packets of a source are stamped when they arrive on their
+ * side (an FNV-1a hash of the bytes pairs the arrival with the delivery,
+ * in a table of TELEMETRY_USB_MERGE_TRACK entries), local ones with their
+ * log time. The pump, on each send and from telemetry_usb_merge_poll(),
+ * sends the oldest queue head once it is TELEMETRY_USB_MERGE_WINDOW_MS
+ * old, so a packet that sat longer in the router's RX queue than one
+ * logged here still goes first if it came in first. A full queue sends
+ * its oldest head at once; packets longer than a slot flush everything
+ * held and go straight out. All of it under the link TX lock. */
+#ifndef TELEMETRY_USB_MERGE_WINDOW_MS
+#define TELEMETRY_USB_MERGE_WINDOW_MS 0u // 0 = packets go out as delivered
+#endif
+#ifndef TELEMETRY_USB_MERGE_DEPTH
+#define TELEMETRY_USB_MERGE_DEPTH 8u // per source, power of two
+#endif
+#ifndef TELEMETRY_USB_MERGE_BYTES
+#define TELEMETRY_USB_MERGE_BYTES 128u // largest packet a slot holds
+#endif
+#ifndef TELEMETRY_USB_MERGE_TRACK
+#define TELEMETRY_USB_MERGE_TRACK 32u
+#endif
+
+static UNUSED_FUNCTION uint32_t pkt_hash(const uint8_t *bytes, size_t len) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < len; i++) h = (h ^ bytes[i]) * 16777619u;
+  return h ? h : 1u;
+}
+
+#if TELEMETRY_USB_MERGE_WINDOW_MS
+_Static_assert((TELEMETRY_USB_MERGE_DEPTH & (TELEMETRY_USB_MERGE_DEPTH - 1u)) == 0,
+               "TELEMETRY_USB_MERGE_DEPTH must be a power of two");
+
+enum { MERGE_LOCAL = 0, MERGE_CAN, MERGE_UART, MERGE_SOURCES };
+
+typedef struct {
+  uint64_t us;
+  uint16_t len;
+  uint8_t data[TELEMETRY_USB_MERGE_BYTES];
+} merge_slot_t;
+
+typedef struct {
+  uint32_t hash; // 0 = empty
+  uint8_t src;
+  uint64_t us;
+} merge_arrival_t;
+
+static merge_slot_t g_merge_buf[MERGE_SOURCES][TELEMETRY_USB_MERGE_DEPTH];
+static ring_t g_merge_q[MERGE_SOURCES];
+static merge_arrival_t g_merge_seen[TELEMETRY_USB_MERGE_TRACK];
+static uint32_t g_merge_seen_next = 0;
+static uint64_t g_merge_last_us = 0; // stamp of the last packet sent
+static telemetry_usb_merge_stats_t g_merge_stats;
+
+// Arrival of a packet from side `from`, for the delivery to pair with.
+// Called from every side's RX context.
+static void merge_note(int32_t from, const uint8_t *bytes, size_t len) {
+  if (from >= 0 && from == g_usb_side_id) return; // never goes back up
+  uint8_t src = MERGE_CAN;
+#ifdef UART_LINK_ENABLED
+  if (from >= 0 && from == g_uart_side_id) src = MERGE_UART;
+#endif
+  const uint32_t h = pkt_hash(bytes, len);
+  const uint64_t now = telemetry_now_us();
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  merge_arrival_t *e = &g_merge_seen[g_merge_seen_next];
+  g_merge_seen_next = (g_merge_seen_next + 1u) % TELEMETRY_USB_MERGE_TRACK;
+  e->hash = h;
+  e->src = src;
+  e->us = now;
+  __set_PRIMASK(primask);
+}
+
+// Source and stamp of a delivered packet; unpaired ones count as logged
+// here, at their log time if it is known.
+static uint8_t merge_source(const uint8_t *bytes, size_t len, uint64_t *us) {
+  const uint32_t h = pkt_hash(bytes, len);
+  uint8_t src = MERGE_LOCAL;
+  *us = g_trace_log_us ? g_trace_log_us : telemetry_now_us();
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (uint32_t i = 0; i < TELEMETRY_USB_MERGE_TRACK; i++) {
+    merge_arrival_t *e = &g_merge_seen[i];
+    if (e->hash != h) continue;
+    src = e->src;
+    *us = e->us;
+    e->hash = 0;
+    break;
+  }
+  __set_PRIMASK(primask);
+  return src;
+}
+
+static SedsResult merge_emit(const uint8_t *bytes, size_t len, uint64_t us) {
+  if (us < g_merge_last_us)
+    g_merge_stats.late++;
+  else
+    g_merge_last_us = us;
+  g_merge_stats.sent++;
+  if (!usb_cdc_is_connected()) {
+#if TELEMETRY_STORE_FORWARD
+    (void)flash_log_append(bytes, len);
+#endif
+    return SEDS_OK;
+  }
+  const SedsResult res =
+      (usb_cdc_send_frame(bytes, len) == HAL_OK) ? SEDS_OK : SEDS_IO;
+  side_tx(TELEMETRY_SIDE_USB, res, len);
+  return res;
+}
+
+// Queue whose head is the oldest, or -1 with nothing held.
+static int merge_pick(void) {
+  int best = -1;
+  const merge_slot_t *b = NULL;
+  for (int s = 0; s < MERGE_SOURCES; s++) {
+    ring_t *q = &g_merge_q[s];
+    if (!ring_peek(q)) continue;
+    const merge_slot_t *h = ring_at(q, q->tail);
+    if (!b || h->us < b->us) {
+      best = s;
+      b = h;
+    }
+  }
+  return best;
+}
+
+// Send heads in time order while the oldest is past the window (every one
+// with `all`); returns the first failure.
+static SedsResult merge_pump(int all) {
+  const uint64_t now = telemetry_now_us();
+  SedsResult res = SEDS_OK;
+  for (;;) {
+    const int s = merge_pick();
+    if (s < 0) break;
+    ring_t *q = &g_merge_q[s];
+    const merge_slot_t *h = ring_at(q, q->tail);
+    if (!all && now - h->us < TELEMETRY_USB_MERGE_WINDOW_MS * 1000ULL)
+      break;
+    const SedsResult r = merge_emit(h->data, h->len, h->us);
+    if (res == SEDS_OK) res = r;
+    ring_consume(q, 1u);
+    g_merge_stats.held--;
+  }
+  return res;
+}
+
+static SedsResult merge_send(const uint8_t *bytes, size_t len) {
+  if (!g_merge_q[0].buf)
+    for (int s = 0; s < MERGE_SOURCES; s++)
+      (void)ring_init(&g_merge_q[s], g_merge_buf[s], TELEMETRY_USB_MERGE_DEPTH,
+                      sizeof(merge_slot_t));
+  uint64_t us;
+  const uint8_t src = merge_source(bytes, len, &us);
+  if (len > TELEMETRY_USB_MERGE_BYTES) {
+    g_merge_stats.bypassed++;
+    const SedsResult r = merge_pump(1);
+    const SedsResult res = merge_emit(bytes, len, us);
+    return (r == SEDS_OK) ? res : r;
+  }
+  ring_t *q = &g_merge_q[src];
+  SedsResult res = SEDS_OK;
+  while (!ring_free(q)) { // oldest overall first, until this one has room
+    const int s = merge_pick();
+    ring_t *o = &g_merge_q[s];
+    const merge_slot_t *h = ring_at(o, o->tail);
+    const SedsResult r = merge_emit(h->data, h->len, h->us);
+    if (res == SEDS_OK) res = r;
+    ring_consume(o, 1u);
+    g_merge_stats.held--;
+    g_merge_stats.forced++;
+  }
+  merge_slot_t *slot = ring_slot_w(q);
+  slot->us = us;
+  slot->len = (uint16_t)len;
+  memcpy(slot->data, bytes, len);
+  ring_publish(q, 1u);
+  g_merge_stats.queued++;
+  if (++g_merge_stats.held > g_merge_stats.held_hwm)
+    g_merge_stats.held_hwm = g_merge_stats.held;
+  const SedsResult r = merge_pump(0);
+  return (res == SEDS_OK) ? r : res;
+}
+#endif
+
+void telemetry_usb_merge_get_stats(telemetry_usb_merge_stats_t *out) {
+  if (!out) return;
+#if TELEMETRY_USB_MERGE_WINDOW_MS
+  *out = g_merge_stats;
+#else
+  memset(out, 0, sizeof(*out));
+#endif
+}
+
+uint32_t telemetry_usb_merge_poll(void) {
+#if TELEMETRY_USB_MERGE_WINDOW_MS
+  if (!g_merge_stats.held) return UINT32_MAX;
+  const int locked = link_tx_lock();
+  (void)merge_pump(0);
+  uint32_t wait = UINT32_MAX;
+  const int s = merge_pick();
+  if (s >= 0) {
+    const merge_slot_t *h = ring_at(&g_merge_q[s], g_merge_q[s].tail);
+    const uint64_t age = telemetry_now_us() - h->us;
+    const uint64_t win = TELEMETRY_USB_MERGE_WINDOW_MS * 1000ULL;
+    wait = (age < win) ? (uint32_t)((win - age) / 1000ULL) + 1u : 1u;
+  }
+  link_tx_unlock(locked);
+  return wait;
+#else
+  return UINT32_MAX;
+#endif
+}
+
+static SedsResult usb_tx_send(const uint8_t *bytes, size_t len, void *user) {
+  (void)user;
+  if (!bytes || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_USB);
+    return SEDS_BAD_ARG;
+  }
+  if (telemetry_bench_owns(bytes, len)) return SEDS_OK; // loopback only
+  if (!usb_cdc_is_connected()) {
+#if TELEMETRY_STORE_FORWARD
+    (void)flash_log_append(bytes, len);
+#endif
+    return SEDS_OK;
+  }
+  if (!gw_admit(bytes, len)) return SEDS_OK; // the other gateway's share
+  const int locked = link_tx_lock();
+  usb_sub_session();
+  SedsResult res = SEDS_OK;
+  if (usb_sub_admit(bytes, len)) {
+#if TELEMETRY_USB_MERGE_WINDOW_MS
+    res = merge_send(bytes, len);
+#else
+    res = (usb_cdc_send_frame(bytes, len) == HAL_OK) ? SEDS_OK : SEDS_IO;
+    side_tx(TELEMETRY_SIDE_USB, res, len);
+#endif
+  }
+  link_tx_unlock(locked);
+  return res;
+}
+
+#ifdef SPI_LINK_ENABLED
+// SPI side: router packets as they come, packed into the next transaction
+// the companion clocks; no budget, the host sets the pace.
+static SedsResult spi_tx_send(const uint8_t *bytes, size_t len, void *user) {
+  (void)user;
+  if (!bytes || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_SPI);
+    return SEDS_BAD_ARG;
+  }
+  if (telemetry_bench_owns(bytes, len)) return SEDS_OK; // loopback only
+  const int locked = link_tx_lock();
+  const SedsResult res =
+      (spi_link_send_frame(bytes, len) == HAL_OK) ? SEDS_OK : SEDS_IO;
+  side_tx(TELEMETRY_SIDE_SPI, res, len);
+  link_tx_unlock(locked);
+  return res;
+}
+#endif
+
+/* ---------------- UART downlink budget ----------------
+ * With CONFIG_UART_LINK_BPS set the UART side spends a token bucket of
+ * TELEMETRY_UART_BURST_BYTES, refilled at that rate, charged the framed
+ * size of each packet (COBS overhead and delimiter). URGENT packets go at
+ * once and may overdraw it. Any other packet goes at once only while
+ * nothing is held and the bucket covers it; else it takes its type's entry
+ * in a table of TELEMETRY_UART_SCHED_SLOTS, replacing the older value
+ * there (or, all entries taken, the entry of the worst priority that holds
+ * a worse one). The pump, on each send and from telemetry_link_poll(),
+ * drops stale entries and sends the best priority first, among equals the
+ * type that has waited longest, while the bucket covers it. Packets longer
+ * than an entry are dropped when the bucket can't cover them. All of it
+ * under the link TX lock. */
+#ifdef UART_LINK_ENABLED
+#ifndef TELEMETRY_UART_SCHED_SLOTS
+#define TELEMETRY_UART_SCHED_SLOTS 16u
+#endif
+#ifndef TELEMETRY_UART_SCHED_BYTES
+#define TELEMETRY_UART_SCHED_BYTES 96u // largest packet an entry holds
+#endif
+#ifndef TELEMETRY_UART_BURST_BYTES
+#define TELEMETRY_UART_BURST_BYTES 256u
+#endif
+#ifndef TELEMETRY_UART_STALE_MS
+#define TELEMETRY_UART_STALE_MS 2000u
+#endif
+#ifndef TELEMETRY_UART_LINK_BPS
+#define TELEMETRY_UART_LINK_BPS 0u // CONFIG_UART_LINK_BPS default
+#endif
+
+/* Header compression (hdr_comp.h) on the UART side: each data type is a
+ * stream with a header template at both ends, and its packets carry only
+ * the header bytes that changed. Both ends must run it, so it is off by
+ * default; it keys streams by telemetry_peek_type() and sends packets the
+ * peek can't read whole. Relayed packets of one type from different
+ * senders share a context, which costs compression, never correctness. */
+#ifndef TELEMETRY_UART_HDR_COMP
+#define TELEMETRY_UART_HDR_COMP 0
+#endif
+// Longest packet it encodes; the far end can't take longer frames anyway.
+#ifndef TELEMETRY_UART_HDR_COMP_MAX
+#define TELEMETRY_UART_HDR_COMP_MAX 1024u
+#endif
+
+typedef struct {
+  uint8_t used;
+  uint8_t prio;
+  uint16_t type;
+  uint16_t len;
+  uint32_t ms;    // this value arrived
+  uint32_t since; // the type has waited since (kept when superseded)
+  uint8_t data[TELEMETRY_UART_SCHED_BYTES];
+} link_slot_t;
+
+static link_slot_t g_link_slots[TELEMETRY_UART_SCHED_SLOTS];
+static uint8_t g_link_prio[TELEMETRY_RX_MAX_DATA_TYPES]; // 0 = class default, else prio + 1
+static int64_t g_link_tokens; // milli-bytes; below 0 after an urgent overdraw
+static uint32_t g_link_last_ms;
+static uint32_t g_link_bps;
+static telemetry_link_stats_t g_link_stats;
+
+static void link_bps_apply(uint32_t bps) { g_link_bps = bps; }
+
+static void link_init(void) {
+  g_link_bps = config_define(CONFIG_UART_LINK_BPS, TELEMETRY_UART_LINK_BPS,
+                             0u, 10000000u, CONFIG_LIVE, link_bps_apply);
+  g_link_tokens = (int64_t)TELEMETRY_UART_BURST_BYTES * 1000;
+  g_link_last_ms = HAL_GetTick();
+}
+
+static uint8_t link_prio_of(const uint8_t *bytes, size_t len, uint16_t *type) {
+  SedsDataType ty;
+  if (!telemetry_peek_type(bytes, len, &ty)) return TELEMETRY_LINK_URGENT;
+  const uint32_t t = (uint32_t)ty;
+  *type = (uint16_t)t;
+  if (t < TELEMETRY_RX_MAX_DATA_TYPES && g_link_prio[t])
+    return (uint8_t)(g_link_prio[t] - 1u);
+  return (tx_class_of(ty) == CAN_BUS_TX_PRIO_LOW) ? TELEMETRY_LINK_NORMAL
+                                                  : TELEMETRY_LINK_URGENT;
+}
+
+static int64_t link_cost(size_t len) {
+  return (int64_t)(len + len / 254u + 2u) * 1000;
+}
+
+static void link_refill(uint32_t now) {
+  const int64_t cap = (int64_t)TELEMETRY_UART_BURST_BYTES * 1000;
+  g_link_tokens += (int64_t)(now - g_link_last_ms) * g_link_bps;
+  g_link_last_ms = now;
+  if (g_link_tokens > cap || !g_link_bps) g_link_tokens = cap; // 0: held ones flush
+}
+
+#if TELEMETRY_UART_HDR_COMP
+static hdr_comp_t g_link_hc_tx; // under the link TX lock
+static hdr_comp_t g_link_hc_rx; // UART RX handler only
+static uint8_t g_link_hc_frame[TELEMETRY_UART_HDR_COMP_MAX + HDR_COMP_GROWTH];
+static uint8_t g_link_hc_pkt[TELEMETRY_UART_HDR_COMP_MAX + HDR_COMP_TEMPLATE_BYTES];
+
+// The frame to send for `bytes`; *len becomes its length. NULL when the
+// packet is too long to encode and would read as an encoded frame.
+static const uint8_t *link_hc_encode(const uint8_t *bytes, size_t *len) {
+  const size_t n = *len;
+  if (n > TELEMETRY_UART_HDR_COMP_MAX)
+    return (bytes[0] == HDR_COMP_TAG) ? NULL : bytes;
+  SedsDataType ty;
+  const uint16_t key = telemetry_peek_type(bytes, n, &ty)
+                           ? (uint16_t)(uint32_t)ty : HDR_COMP_NO_KEY;
+  *len = hdr_comp_encode(&g_link_hc_tx, key, bytes, n, g_link_hc_frame);
+  g_link_stats.hc_in_bytes += (uint32_t)n;
+  g_link_stats.hc_out_bytes += (uint32_t)*len;
+  return g_link_hc_frame;
+}
+#endif
+
+static SedsResult link_send(const uint8_t *bytes, size_t len) {
+  size_t wire = len;
+#if TELEMETRY_UART_HDR_COMP
+  const uint8_t *frame = link_hc_encode(bytes, &wire);
+  const HAL_StatusTypeDef st =
+      frame ? uart_link_send_frame(frame, wire) : HAL_ERROR;
+#else
+  const HAL_StatusTypeDef st = uart_link_send_frame(bytes, len);
+#endif
+  const SedsResult res = (st == HAL_OK) ? SEDS_OK : SEDS_IO;
+  side_tx(TELEMETRY_SIDE_UART, res, len);
+  if (g_link_bps) g_link_tokens -= link_cost(wire);
+  g_link_stats.sent++;
+  return res;
+}
+
+// Held entry to send next, dropping stale ones; NULL with none.
+static link_slot_t *link_pick(uint32_t now) {
+  link_slot_t *best = NULL;
+  for (unsigned i = 0; i < TELEMETRY_UART_SCHED_SLOTS; i++) {
+    link_slot_t *s = &g_link_slots[i];
+    if (!s->used) continue;
+    if (now - s->ms > TELEMETRY_UART_STALE_MS) {
+      s->used = 0;
+      g_link_stats.stale++;
+      g_link_stats.pending--;
+      continue;
+    }
+    if (!best || s->prio < best->prio ||
+        (s->prio == best->prio && (int32_t)(s->since - best->since) < 0))
+      best = s;
+  }
+  return best;
+}
+
+static void link_pump(uint32_t now) {
+  link_slot_t *s;
+  while ((s = link_pick(now)) != NULL && g_link_tokens >= link_cost(s->len)) {
+    (void)link_send(s->data, s->len);
+    s->used = 0;
+    g_link_stats.pending--;
+  }
+}
+
+// Entry for `type`: its own, a free one, or the worst-priority one holding
+// something worse than `prio`. NULL when none.
+static link_slot_t *link_slot_for(uint16_t type, uint8_t prio) {
+  link_slot_t *free_s = NULL, *worst = NULL;
+  for (unsigned i = 0; i < TELEMETRY_UART_SCHED_SLOTS; i++) {
+    link_slot_t *s = &g_link_slots[i];
+    if (!s->used) {
+      if (!free_s) free_s = s;
+      continue;
+    }
+    if (s->type == type) return s;
+    if (s->prio > prio && (!worst || s->prio > worst->prio)) worst = s;
+  }
+  if (free_s) return free_s;
+  if (worst) {
+    worst->used = 0;
+    g_link_stats.dropped++;
+    g_link_stats.pending--;
+  }
+  return worst;
+}
+
+// UART side: one COBS frame per router packet, same as USB; over budget,
+// the newest per type waits (above).
+static SedsResult uart_tx_send(const uint8_t *bytes, size_t len, void *user) {
+  (void)user;
+  if (!bytes || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_UART);
+    return SEDS_BAD_ARG;
+  }
+  if (telemetry_bench_owns(bytes, len)) return SEDS_OK; // loopback only
+  if (!gw_admit(bytes, len)) return SEDS_OK;
+  const int locked = link_tx_lock();
+  SedsResult res = SEDS_OK;
+  if (!g_link_bps) {
+    res = link_send(bytes, len);
+    link_tx_unlock(locked);
+    return res;
+  }
+  const uint32_t now = HAL_GetTick();
+  link_refill(now);
+  uint16_t type = 0xFFFFu;
+  const uint8_t prio = link_prio_of(bytes, len, &type);
+  if (prio == TELEMETRY_LINK_URGENT ||
+      (!g_link_stats.pending && g_link_tokens >= link_cost(len))) {
+    res = link_send(bytes, len);
+  } else {
+    link_slot_t *s = (len <= TELEMETRY_UART_SCHED_BYTES)
+                         ? link_slot_for(type, prio)
+                         : NULL;
+    if (!s) {
+      g_link_stats.dropped++;
+    } else {
+      if (s->used) {
+        g_link_stats.superseded++;
+      } else {
+        s->used = 1;
+        s->since = now;
+        g_link_stats.pending++;
+      }
+      s->type = type;
+      s->prio = prio;
+      s->len = (uint16_t)len;
+      s->ms = now;
+      memcpy(s->data, bytes, len);
+      g_link_stats.held++;
+    }
+  }
+  link_pump(now);
+  link_tx_unlock(locked);
+  return res;
+}
+#endif
+
+SedsResult telemetry_set_link_priority(SedsDataType ty, uint8_t prio) {
+  if ((uint32_t)ty >= TELEMETRY_RX_MAX_DATA_TYPES ||
+      prio >= TELEMETRY_LINK_PRIO_COUNT)
+    return SEDS_BAD_ARG;
+#ifdef UART_LINK_ENABLED
+  g_link_prio[(uint32_t)ty] = (uint8_t)(prio + 1u);
+#endif
+  return SEDS_OK;
+}
+
+void telemetry_link_get_stats(telemetry_link_stats_t *out) {
+  if (!out) return;
+#ifdef UART_LINK_ENABLED
+  *out = g_link_stats;
+#else
+  memset(out, 0, sizeof(*out));
+#endif
+}
+
+uint32_t telemetry_link_poll(void) {
+#ifdef UART_LINK_ENABLED
+  if (!g_link_stats.pending) return UINT32_MAX;
+  const int locked = link_tx_lock();
+  const uint32_t now = HAL_GetTick();
+  link_refill(now);
+  link_pump(now);
+  uint32_t wait = UINT32_MAX;
+  link_slot_t *s = link_pick(now);
+  if (s) {
+    const int64_t need = link_cost(s->len) - g_link_tokens;
+    wait = g_link_bps ? (uint32_t)(need / g_link_bps) + 1u : 1u;
+    const uint32_t stale = TELEMETRY_UART_STALE_MS - (now - s->ms) + 1u;
+    if (stale < wait) wait = stale;
+  }
+  link_tx_unlock(locked);
+  return wait;
+#else
+  return UINT32_MAX;
+#endif
+}
+
+/* ---------------- Inbound fast path ----------------
+ * In relay mode every side gets every packet it didn't come from, so the
+ * data type alone decides what an inbound packet needs: a local endpoint
+ * (full router path), a plain copy to the other sides (cut-through), or
+ * nothing at all when no local endpoint wants the type and no other side is
+ * up to take it (early drop, before the router allocates or queues).
+ */
+static uint32_t g_relay_forwarded = 0;
+static uint32_t g_relay_failed = 0;
+static uint32_t g_rx_early_dropped = 0;
+
+// Data types consumed by each local endpoint; give an endpoint its types
+// here when its handler starts using them. With TELEMETRY_LVC the SD card
+// takes every type (local_types_build()).
+static const struct {
+  uint32_t endpoint;
+  SedsDataType ty;
+} g_local_consumers[] = {
+    {(uint32_t)SEDS_EP_TIME_SYNC, SEDS_DT_TIME_SYNC_ANNOUNCE},
+    {(uint32_t)SEDS_EP_TIME_SYNC, SEDS_DT_TIME_SYNC_REQUEST},
+    {(uint32_t)SEDS_EP_TIME_SYNC, SEDS_DT_TIME_SYNC_RESPONSE},
+#ifdef TELEMETRY_CMD_ENDPOINT
+    {(uint32_t)TELEMETRY_CMD_ENDPOINT, TELEMETRY_CMD_TYPE},
+#endif
+};
+
+// Bit per data type with a local consumer, set up with the router. Types
+// past the end count as wanted.
+static uint32_t g_local_types[(TELEMETRY_RX_MAX_DATA_TYPES + 31u) / 32u];
+
+static void local_types_build(const SedsLocalEndpointDesc *locals,
+                              size_t count) {
+  const size_t n = sizeof(g_local_consumers) / sizeof(g_local_consumers[0]);
+  memset(g_local_types, 0, sizeof(g_local_types));
+  for (size_t i = 0; i < n; i++) {
+    for (size_t e = 0; e < count; e++) {
+      const uint32_t ty = (uint32_t)g_local_consumers[i].ty;
+      if (locals[e].endpoint == g_local_consumers[i].endpoint &&
+          ty < TELEMETRY_RX_MAX_DATA_TYPES)
+        g_local_types[ty / 32u] |= 1u << (ty % 32u);
+    }
+  }
+#if TELEMETRY_LVC
+  for (size_t e = 0; e < count; e++)
+    if (locals[e].endpoint == (uint32_t)SEDS_EP_SD_CARD)
+      memset(g_local_types, 0xFF, sizeof(g_local_types));
+#endif
+}
+
+static UNUSED_FUNCTION int type_is_local(SedsDataType ty) {
+  const uint32_t t = (uint32_t)ty;
+  if (t >= TELEMETRY_RX_MAX_DATA_TYPES) return 1;
+  return (g_local_types[t / 32u] >> (t % 32u)) & 1u;
+}
+
+// Some side other than `from` would take a relayed packet of type `ty`.
+// CAN and UART carry everything, so being up is the whole subscription;
+// USB is up while a host has the port open, and takes what it subscribed,
+// or while it doesn't, if its packets are stored for later.
+static UNUSED_FUNCTION int other_side_up(int32_t from, SedsDataType ty) {
+  if (g_can_side_id >= 0 && from != g_can_side_id) return 1;
+  if (g_usb_side_id >= 0 && from != g_usb_side_id &&
+      (usb_cdc_is_connected() ? (!g_usb_sub_up || usb_sub_has((uint32_t)ty))
+                              : TELEMETRY_STORE_FORWARD))
+    return 1;
+#ifdef UART_LINK_ENABLED
+  if (g_uart_side_id >= 0 && from != g_uart_side_id) return 1;
+#endif
+#ifdef SPI_LINK_ENABLED
+  if (g_spi_side_id >= 0 && from != g_spi_side_id) return 1;
+#endif
+  return 0;
+}
+
+__attribute__((weak)) int telemetry_peek_type(const uint8_t *bytes, size_t len,
+                                              SedsDataType *ty) {
+  (void)bytes;
+  (void)len;
+  (void)ty;
+  return 0;
+}
+
+void telemetry_relay_get_stats(uint32_t *forwarded, uint32_t *failed,
+                               uint32_t *dropped) {
+  if (forwarded) *forwarded = g_relay_forwarded;
+  if (failed) *failed = g_relay_failed;
+  if (dropped) *dropped = g_rx_early_dropped;
+}
+
+/* Duplicate suppression: a serialized packet carries its sender, type and
+ * timestamp, so the same bytes seen twice within TELEMETRY_RX_DEDUP_MS are
+ * the same packet, whichever side each copy came in on. The cache keeps a
+ * 32-bit hash of the bytes per packet, in 4-way sets picked by the hash; a
+ * new packet replaces the oldest entry of its set. A hash collision drops
+ * a packet wrongly, about once in 2^32 / TELEMETRY_RX_DEDUP_SLOTS. */
+#if TELEMETRY_RX_DEDUP_SLOTS
+_Static_assert(TELEMETRY_RX_DEDUP_SLOTS % 4u == 0,
+               "TELEMETRY_RX_DEDUP_SLOTS must be a multiple of 4");
+#define DEDUP_WAYS 4u
+#define DEDUP_SETS (TELEMETRY_RX_DEDUP_SLOTS / DEDUP_WAYS)
+
+typedef struct {
+  uint32_t hash; // 0 = empty
+  uint32_t ms;
+} dedup_ent_t;
+
+static dedup_ent_t g_dedup[DEDUP_SETS][DEDUP_WAYS];
+#endif
+static uint32_t g_dedup_dropped = 0;
+
+// 1 if `bytes` arrived already within the window; records it otherwise.
+// Called from every side's RX context.
+static int rx_seen(const uint8_t *bytes, size_t len) {
+#if TELEMETRY_RX_DEDUP_SLOTS
+  const uint32_t h = pkt_hash(bytes, len);
+  const uint32_t now = HAL_GetTick();
+  dedup_ent_t *set = g_dedup[h % DEDUP_SETS];
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  dedup_ent_t *victim = &set[0];
+  int seen = 0;
+  for (unsigned w = 0; w < DEDUP_WAYS; w++) {
+    dedup_ent_t *e = &set[w];
+    const int live = e->hash && now - e->ms <= TELEMETRY_RX_DEDUP_MS;
+    if (live && e->hash == h) {
+      seen = 1;
+      break;
+    }
+    if (!live) {
+      victim = e;
+    } else if (victim->hash &&
+               now - victim->ms <= TELEMETRY_RX_DEDUP_MS &&
+               (int32_t)(e->ms - victim->ms) < 0) {
+      victim = e;
+    }
+  }
+  if (seen) {
+    g_dedup_dropped++;
+  } else {
+    victim->hash = h;
+    victim->ms = now;
+  }
+  __set_PRIMASK(primask);
+  return seen;
+#else
+  (void)bytes;
+  (void)len;
+  return 0;
+#endif
+}
+
+void telemetry_dedup_get_stats(uint32_t *dropped) {
+  if (dropped) *dropped = g_dedup_dropped;
+}
+
+// Handle an inbound packet from side `from` without the router if its data
+// type allows, or drop it as a copy of one already taken. Returns 0 if it
+// has to be queued to the router.
+static int rx_fast_path(int32_t from, const uint8_t *bytes, size_t len) {
+  if (rx_seen(bytes, len)) return 1;
+#if TELEMETRY_USB_MERGE_WINDOW_MS
+  merge_note(from, bytes, len);
+#endif
+#if TELEMETRY_RELAY_CUT_THROUGH || TELEMETRY_RX_EARLY_DROP
+  SedsDataType ty;
+  if (!telemetry_peek_type(bytes, len, &ty) || type_is_local(ty)) return 0;
+#if TELEMETRY_RX_EARLY_DROP
+  if (!other_side_up(from, ty)) {
+    g_rx_early_dropped++;
+    return 1;
+  }
+#endif
+#if TELEMETRY_RELAY_CUT_THROUGH
+  if (from < 0) return 0;
+  SedsResult res = SEDS_OK;
+  if (g_can_side_id >= 0 && from != g_can_side_id &&
+      tx_send(bytes, len, NULL) != SEDS_OK)
+    res = SEDS_IO;
+  if (g_usb_side_id >= 0 && from != g_usb_side_id &&
+      usb_tx_send(bytes, len, NULL) != SEDS_OK)
+    res = SEDS_IO;
+#ifdef UART_LINK_ENABLED
+  if (g_uart_side_id >= 0 && from != g_uart_side_id &&
+      uart_tx_send(bytes, len, NULL) != SEDS_OK)
+    res = SEDS_IO;
+#endif
+#ifdef SPI_LINK_ENABLED
+  if (g_spi_side_id >= 0 && from != g_spi_side_id &&
+      spi_tx_send(bytes, len, NULL) != SEDS_OK)
+    res = SEDS_IO;
+#endif
+  if (res == SEDS_OK)
+    g_relay_forwarded++;
+  else
+    g_relay_failed++;
+  return 1;
+#else
+  return 0;
+#endif
+#else
+  (void)from;
+  (void)bytes;
+  (void)len;
+  return 0;
+#endif
+}
+
+/* ---------------- Local endpoint handler(s) ---------------- */
+SedsResult on_sd_packet(const SedsPacketView *pkt, void *user) {
+  (void)user;
+#if TELEMETRY_LVC
+  if (pkt) lvc_put(pkt);
+#endif
+  if (pkt && pkt->ty == SEDS_DT_GENERIC_ERROR)
+    telemetry_blackbox_trigger(TELEMETRY_BLACKBOX_ERROR_PACKET);
+  if (pkt)
+    sd_log_append((uint16_t)pkt->ty, pkt->timestamp, pkt->payload,
+                  pkt->payload_len);
+  return SEDS_OK;
+}
+
+#if TELEMETRY_TIME_MASTER
+// Time-sync packets are only ever sent synchronously, in the high class.
+static SedsResult log_timesync(SedsDataType ty, uint64_t ts,
+                               const uint64_t *vals, size_t n) {
+  const uint8_t prev = g_can_tx_class;
+  g_can_tx_class = CAN_BUS_TX_PRIO_HIGH;
+  const SedsResult res = seds_router_log_ts(g_router.r, ty, ts, vals, n);
+  g_can_tx_class = prev;
+  return res;
+}
+#endif
+
+/* ---------------- Compact time-sync frames ----------------
+ *
+ * One CAN frame each way on TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID, bypassing
+ * the router and fragmentation (little-endian):
+ *
+ *   request,   8 bytes: u32 seq, u32 t1 (low bits, echo only)
+ *   response, 16 bytes: u32 seq, u32 t3 - t2, u64 t2
+ *   SYNC,      4 bytes: u32 seq                    (NET_TIMESYNC_BROADCAST)
+ *   FOLLOW_UP 12 bytes: u32 seq, u64 SOF of that SYNC, master node time
+ *
+ * all on the one ID and told apart by their length. The master answers
+ * from the CAN RX interrupt (timesync_respond()). The client keeps the full
+ * t1 of every request in the burst, so it never needs to travel back. t2 stays absolute: right after boot master and client
+ * can be hours apart, which no 32-bit delta from t1 would hold. t2 and t4 are
+ * the hardware SOF stamps of the frames themselves.
+ */
+#define TIMESYNC_FRAME_REQ_LEN  TELEMETRY_TIMESYNC_REQ_BYTES
+#define TIMESYNC_FRAME_RESP_LEN TELEMETRY_TIMESYNC_RESP_BYTES
+#define TIMESYNC_FRAME_SYNC_LEN TELEMETRY_TIMESYNC_SYNC_BYTES
+#define TIMESYNC_FRAME_FUP_LEN  TELEMETRY_TIMESYNC_FOLLOW_UP_BYTES
+
+// Sync traffic for telemetry_timesync_get_stats(), written from one context
+// each: the RX interrupt on the master, the RX and maintenance threads on a
+// client.
+static volatile uint32_t g_ts_frames_tx = 0;
+static volatile uint32_t g_ts_frames_rx = 0;
+
+#if TELEMETRY_TIME_BOUNDARY
+// The boundary clock's downstream side, kept apart from the client's own
+// exchanges upstream: its RX interrupt and the maintenance thread.
+static volatile uint32_t g_bc_frames_tx = 0;
+static volatile uint32_t g_bc_frames_rx = 0;
+static volatile uint32_t g_bc_refused = 0;
+#define TS_SERVE_FRAMES_TX g_bc_frames_tx
+#define TS_SERVE_FRAMES_RX g_bc_frames_rx
+#else
+#define TS_SERVE_FRAMES_TX g_ts_frames_tx
+#define TS_SERVE_FRAMES_RX g_ts_frames_rx
+#endif
+
+#if TIMESYNC_SERVES
+// Master or boundary clock: runs in the FDCAN RX ISR of TIMESYNC_SERVE_BUS
+// (can_bus_set_responder), so the reply leaves within microseconds of the
+// request regardless of router load. t3 - t2 is measured on the CAN
+// timestamp scale the request was stamped on.
+static size_t timesync_respond(const uint8_t *req, size_t len, uint64_t ts_us,
+                               uint8_t *reply, void *user) {
+  (void)user;
+  if (len != TIMESYNC_FRAME_REQ_LEN) return 0;
+  TS_SERVE_FRAMES_RX++;
+#if TELEMETRY_TIME_BOUNDARY
+  if (g_servo_state != SERVO_TRACKING) {
+    g_bc_refused++;
+    return 0;
+  }
+#endif
+#if NET_TIMESYNC_SW_STAMPS
+  (void)ts_us;
+  const uint64_t t2 = telemetry_now_us();
+  const uint32_t turn = 0; // answered right away, t3 is t2
+#else
+  can_bus_t *bus = can_bus_get(TIMESYNC_SERVE_BUS);
+  const uint64_t t2 = hw_to_node_us(bus, ts_us);
+  const uint32_t turn = (uint32_t)(can_bus_time_us(bus) - ts_us);
+#endif
+  TS_SERVE_FRAMES_TX++;
+  memcpy(reply, req, 4); // seq
+  memcpy(reply + 4, &turn, 4);
+  memcpy(reply + 8, &t2, 8);
+  return TIMESYNC_FRAME_RESP_LEN;
+}
+#endif
+
+#if !TELEMETRY_TIME_MASTER
+#if NET_TIMESYNC_BROADCAST
+// Client: a SYNC is stamped on arrival, and its FOLLOW_UP turns the stamp
+// into an offset once a burst has measured the path delay.
+static void on_bsync_frame(const uint8_t *data, size_t len, uint64_t ts_us) {
+  uint32_t seq = 0;
+  memcpy(&seq, data, 4);
+  if (len == TIMESYNC_FRAME_SYNC_LEN) {
+    g_bsync.seq = seq;
+    g_bsync.t2 = NET_TIMESYNC_SW_STAMPS
+                     ? telemetry_now_us()
+                     : hw_to_node_us(can_bus_get(TELEMETRY_CAN_BUS), ts_us);
+    g_bsync.valid = 1;
+    return;
+  }
+  if (!g_bsync.valid || g_bsync.seq != seq) return; // its SYNC was missed
+  g_bsync.valid = 0;
+  if (g_path_delay_us == UINT64_MAX) return;
+  uint64_t t1 = 0;
+  memcpy(&t1, data + 4, 8);
+  const int64_t offset_us = (int64_t)(t1 + g_path_delay_us - g_bsync.t2);
+  g_bsync_last_raw = tx_raw_now_us();
+  g_ts_stats.syncs++;
+  g_ts_stats.offset_hist[ts_hist_bin(
+      (uint64_t)((offset_us < 0) ? -offset_us : offset_us))]++;
+  g_last_offset_us = offset_us;
+  servo_accept(offset_us);
+}
+#endif
+
+// Client: a response, handled from can_bus_process_rx().
+static void on_timesync_frame(const uint8_t *data, size_t len, uint64_t ts_us,
+                              void *user) {
+  (void)user;
+  if (!data) return;
+#if NET_TIMESYNC_BROADCAST
+  if (len == TIMESYNC_FRAME_SYNC_LEN || len == TIMESYNC_FRAME_FUP_LEN) {
+    g_ts_frames_rx++;
+    on_bsync_frame(data, len, ts_us);
+    return;
+  }
+#endif
+  if (len != TIMESYNC_FRAME_RESP_LEN) return;
+  g_ts_frames_rx++; // other clients' too: it is all load on the bus
+  uint32_t seq = 0, turn = 0;
+  uint64_t t2 = 0;
+  memcpy(&seq, data, 4);
+  memcpy(&turn, data + 4, 4);
+  memcpy(&t2, data + 8, 8);
+
+  uint64_t t1 = burst_t1(seq);
+  if (t1 == 0) return; // not ours, or already answered
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  const uint64_t t3 = t2 + turn;
+  const uint64_t t4 =
+      NET_TIMESYNC_SW_STAMPS ? telemetry_now_us() : hw_to_node_us(bus, ts_us);
+
+  // Our request's SOF, if the TX event for it has come back by now.
+  uint64_t hw_t1 = 0;
+  const HAL_StatusTypeDef st = can_bus_last_tx_time_us(
+      bus, TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID, &hw_t1);
+  t1 = pick_stamp_us(bus, st, hw_t1, t1);
+
+  int64_t offset_us = 0;
+  uint64_t delay_us = 0;
+  compute_offset_delay(t1, t2, t3, t4, &offset_us, &delay_us);
+  g_last_offset_us = offset_us;
+  g_last_delay_us = delay_us;
+  burst_sample(seq, offset_us, delay_us);
+}
+#endif
+
+/* ---------------- Command endpoint ----------------
+ * Mode changes as router packets (protocol in telemetry.h), handled on the
+ * thread running the router's RX queue. Each maps onto a change the control
+ * frames or the public setters already make; the endpoint puts them on the
+ * network and answers with a status line.
+ */
+#ifdef TELEMETRY_CMD_ENDPOINT
+#ifndef TELEMETRY_CMD_TYPE
+#error "TELEMETRY_CMD_ENDPOINT needs TELEMETRY_CMD_TYPE"
+#endif
+
+#define CMD_AGG_RULE 15u // bytes per AGG rule
+
+static uint8_t cmd_capture(const uint8_t *a, size_t n) {
+#if TELEMETRY_CAPTURE_BYTES
+  if (n < 2u || a[0] > 1u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  if (!a[1]) {
+    cap_stop();
+    return TELEMETRY_USB_CTRL_OK;
+  }
+#ifdef UART_LINK_ENABLED
+  const int32_t uart = g_uart_side_id;
+#else
+  const int32_t uart = -1; // no UART side: cap_start() refuses it
+#endif
+  return cap_start(a[0] ? uart : g_usb_side_id, a + 2, n - 2u);
+#else
+  (void)a;
+  (void)n;
+  return TELEMETRY_USB_CTRL_BAD_OP;
+#endif
+}
+
+static uint8_t cmd_profiler(const uint8_t *a, size_t n) {
+  if (n < 1u || a[0] > 2u) return TELEMETRY_USB_CTRL_BAD_ARG;
+  if (prof_set_enabled(a[0] != 0) != 0) return TELEMETRY_USB_CTRL_BAD_OP;
+  if (a[0] == 2u) prof_reset();
+  return TELEMETRY_USB_CTRL_OK;
+}
+
+static uint8_t cmd_agg(const uint8_t *a, size_t n) {
+  if (n % CMD_AGG_RULE != 0 || n / CMD_AGG_RULE > TELEMETRY_AGG_MAX_RULES)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  telemetry_agg_rule_t rules[TELEMETRY_AGG_MAX_RULES];
+  const size_t count = n / CMD_AGG_RULE;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *r = &a[i * CMD_AGG_RULE];
+    const uint32_t bits = get_le32(&r[7]);
+    rules[i].type = (SedsDataType)get_le16(r);
+    rules[i].mode = (telemetry_agg_mode_t)r[2];
+    rules[i].window = (uint16_t)get_le16(&r[3]);
+    rules[i].window_ms = (uint16_t)get_le16(&r[5]);
+    memcpy(&rules[i].deadband, &bits, sizeof(bits));
+    rules[i].heartbeat_ms = get_le32(&r[11]);
+  }
+  return (telemetry_set_aggregation(rules, count) == SEDS_OK)
+             ? TELEMETRY_USB_CTRL_OK
+             : TELEMETRY_USB_CTRL_BAD_ARG;
+}
+
+#define CMD_AGG_PROFILE 7u // bytes per AGG_PROFILE entry
+
+static uint8_t cmd_agg_profile(const uint8_t *a, size_t n) {
+  if (n % CMD_AGG_PROFILE != 0 || n / CMD_AGG_PROFILE > TELEMETRY_AGG_PROFILES)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  telemetry_agg_profile_t profiles[TELEMETRY_AGG_PROFILES];
+  const size_t count = n / CMD_AGG_PROFILE;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *r = &a[i * CMD_AGG_PROFILE];
+    profiles[i].type = (SedsDataType)get_le16(r);
+    profiles[i].decimate = (uint16_t)get_le16(&r[2]);
+    profiles[i].stats_mode = (telemetry_agg_mode_t)r[4];
+    profiles[i].stats_ms = (uint16_t)get_le16(&r[5]);
+  }
+  return (telemetry_set_agg_profiles(profiles, count) == SEDS_OK)
+             ? TELEMETRY_USB_CTRL_OK
+             : TELEMETRY_USB_CTRL_BAD_ARG;
+}
+
+static uint8_t cmd_shaper(const uint8_t *a, size_t n) {
+  if (n < 6u || a[0] >= CAN_BUS_TX_PRIO_COUNT)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  const uint32_t burst_us = get_le32(&a[2]);
+  if (a[0] == CAN_BUS_TX_PRIO_LOW) {
+    // Burst first: a share with a burst out of range would be refused.
+    if (config_set(CONFIG_CAN_BULK_BURST_US, burst_us) != HAL_OK ||
+        config_set(CONFIG_CAN_BULK_SHARE_PCT, a[1]) != HAL_OK)
+      return TELEMETRY_USB_CTRL_BAD_ARG;
+    return TELEMETRY_USB_CTRL_OK;
+  }
+  return (can_bus_set_tx_shaping(can_bus_get(TELEMETRY_CAN_BUS),
+                                 (can_bus_tx_prio_t)a[0], a[1],
+                                 burst_us) == HAL_OK)
+             ? TELEMETRY_USB_CTRL_OK
+             : TELEMETRY_USB_CTRL_BAD_ARG;
+}
+
+static uint8_t cmd_bench(const uint8_t *a, size_t n) {
+#ifdef TELEMETRY_BENCH
+  uint32_t v[3] = {0, 0, 0};
+  for (size_t i = 0; i < 3u && 4u * (i + 1u) <= n; i++)
+    v[i] = get_le32(&a[4u * i]);
+  return (telemetry_bench_start(v[0], v[1], v[2]) == 0)
+             ? TELEMETRY_USB_CTRL_OK
+             : TELEMETRY_USB_CTRL_BUSY;
+#else
+  (void)a;
+  (void)n;
+  return TELEMETRY_USB_CTRL_BAD_OP;
+#endif
+}
+
+#define CMD_RATE 4u // bytes per RATE entry
+
+// Broadcast by the gateway once a poll while it throttles: not answered,
+// or every source would add a status line to the load it's shedding.
+static uint8_t cmd_rate(const uint8_t *a, size_t n) {
+  if (n < 2u || (n - 2u) % CMD_RATE != 0 ||
+      (n - 2u) / CMD_RATE > TELEMETRY_RATE_TYPES)
+    return TELEMETRY_USB_CTRL_BAD_ARG;
+  telemetry_rate_t rates[TELEMETRY_RATE_TYPES];
+  const size_t count = (n - 2u) / CMD_RATE;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *r = &a[2u + i * CMD_RATE];
+    rates[i].type = (SedsDataType)get_le16(r);
+    rates[i].decimate = (uint16_t)get_le16(&r[2]);
+  }
+  return (telemetry_set_remote_rates(rates, count, get_le16(a)) == SEDS_OK)
+             ? TELEMETRY_USB_CTRL_OK
+             : TELEMETRY_USB_CTRL_BAD_ARG;
+}
+
+static SedsResult on_command(const SedsPacketView *pkt, void *user) {
+  (void)user;
+  if (!pkt || !pkt->payload || pkt->ty != TELEMETRY_CMD_TYPE ||
+      pkt->payload_len < 2u)
+    return SEDS_ERR;
+  const uint8_t op = pkt->payload[0];
+  const uint8_t *a = pkt->payload + 2;
+  const size_t n = pkt->payload_len - 2u;
+  if (op == TELEMETRY_CMD_RATE) {
+    (void)cmd_rate(a, n);
+    return SEDS_OK;
+  }
+  uint8_t st;
+  switch (op) {
+  case TELEMETRY_CMD_CAPTURE:
+    st = cmd_capture(a, n);
+    break;
+  case TELEMETRY_CMD_PROFILER:
+    st = cmd_profiler(a, n);
+    break;
+  case TELEMETRY_CMD_AGG:
+    st = cmd_agg(a, n);
+    break;
+  case TELEMETRY_CMD_SHAPER:
+    st = cmd_shaper(a, n);
+    break;
+  case TELEMETRY_CMD_BENCH:
+    st = cmd_bench(a, n);
+    break;
+  case TELEMETRY_CMD_CONFIG:
+    st = cfg_ctrl(TELEMETRY_USB_CTRL_CONFIG_SET, a, n);
+    break;
+  case TELEMETRY_CMD_COMMIT:
+    st = cfg_ctrl(TELEMETRY_USB_CTRL_CONFIG_COMMIT, a, n);
+    break;
+  case TELEMETRY_CMD_AGG_PROFILE:
+    st = cmd_agg_profile(a, n);
+    break;
+  default:
+    st = TELEMETRY_USB_CTRL_BAD_OP;
+    break;
+  }
+
+  char txt[40];
+  const int len = snprintf(txt, sizeof(txt), "cmd op=%u seq=%u st=%u",
+                           (unsigned)op, (unsigned)pkt->payload[1],
+                           (unsigned)st);
+  if (len > 0 && (size_t)len < sizeof(txt))
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)len,
+                                     1);
+  return SEDS_OK;
+}
+#endif
+
+/* ---------------- Time sync endpoint ----------------
+ *
+ * Handles:
+ *  - TIME_SYNC_REQUEST  (master): reply with [seq, t1, t2, t3], all in µs, for
+ *    nodes that sync over the router (not on this CAN bus)
+ *  - TIME_SYNC_ANNOUNCE (clients): learn unix_ms base
+ *
+ * CAN clients exchange compact frames instead (below).
+ *
+ * NOTE:
+ * This endpoint only updates *software* time. It does NOT affect ThreadX scheduling.
+ */
+static SedsResult on_timesync(const SedsPacketView *pkt, void *user) {
+  (void)user;
+  if (!pkt || !pkt->payload) return SEDS_ERR;
+
+  // ---------- Master: handle request ----------
+  if (pkt->ty == SEDS_DT_TIME_SYNC_REQUEST && pkt->payload_len >= 16) {
+#if TELEMETRY_TIME_MASTER
+    uint64_t seq = 0, t1 = 0;
+    memcpy(&seq, pkt->payload + 0, 8);
+    memcpy(&t1,  pkt->payload + 8, 8);
+
+    // t2: SOF of the request (master local base)
+    const uint64_t t2 = rx_stamp_us();
+
+    // t3: right before sending.
+    const uint64_t t3 = telemetry_now_us();
+
+    const uint64_t resp[4] = {seq, t1, t2, t3};
+
+    // Timestamp the packet at t3 (master local base)
+    // Router will relay/broadcast it; clients match seq and compute offset.
+    return log_timesync(SEDS_DT_TIME_SYNC_RESPONSE, t3 / 1000u, resp, 4);
+#else
+    return SEDS_OK;
+#endif
+  }
+
+  // ---------- Client: learn unix time from announce ----------
+  // announce payload:
+  //   [priority, unix_ms]
+  if (pkt->ty == SEDS_DT_TIME_SYNC_ANNOUNCE && pkt->payload_len >= 16) {
+#if !TELEMETRY_TIME_MASTER
+    uint64_t priority = 0;
+    uint64_t unix_ms  = 0;
+    memcpy(&priority, pkt->payload + 0, 8);
+    memcpy(&unix_ms,  pkt->payload + 8, 8);
+
+    // Half-RTT correction from last response (best-effort)
+    const uint64_t half_delay = g_last_delay_us / 2000ULL;
+
+    // Set base so telemetry_unix_ms() matches
+    const int64_t now = (int64_t)telemetry_now_ms();
+    g_unix_base_ms = (int64_t)(unix_ms + half_delay) - now;
+    g_unix_from_rtc = 0;
+    g_unix_valid = 1;
+    rtc_follow_unix(unix_ms + half_delay);
+
+    (void)priority;
+#endif
+    return SEDS_OK;
+  }
+
+  return SEDS_OK;
+}
+
+/* ---------------- Router timebase ---------------- */
+static uint64_t node_now_since_ms(void *user) {
+  (void)user;
+  const uint64_t now = telemetry_now_us() / 1000ULL;
+  const RouterState s = g_router;
+  return s.r ? (now - s.start_time) : 0;
+}
+
+/* ---------------- Queue budget ----------------
+ * The router's RX and TX queues both live in the Rust heap, and the router
+ * doesn't report per-queue sizes, so the cap applies to the heap as a
+ * whole. Bulk is refused first, then MID; HIGH only stops when the heap
+ * itself is out. On the RX side, reassembly of bulk-ID CAN messages pauses
+ * above TELEMETRY_RX_PAUSE_PCT until the level drops back. */
+static volatile uint32_t g_flow_blocked;
+static volatile uint32_t g_flow_shed;
+static uint8_t g_rx_paused;
+
+// Lock-free counter bump; the counters are written from any context.
+static inline void intake_add(volatile uint32_t *c, uint32_t n) {
+  uint32_t v;
+  do {
+    v = __LDREXW(c) + n;
+  } while (__STREXW(v, c) != 0u);
+}
+
+static inline void intake_count(volatile uint32_t *c) { intake_add(c, 1u); }
+
+static unsigned heap_fill_pct(void) {
+  static uint32_t budget;
+  if (!budget) {
+    budget = TELEMETRY_HEAP_BUDGET_BYTES ? TELEMETRY_HEAP_BUDGET_BYTES
+                                         : rust_heap_capacity_bytes();
+  }
+  return (unsigned)(((uint64_t)rust_heap_live_bytes() * 100u) / budget);
+}
+
+static int class_admitted(can_bus_tx_prio_t prio, unsigned pct) {
+  switch (prio) {
+  case CAN_BUS_TX_PRIO_HIGH: return 1;
+  case CAN_BUS_TX_PRIO_MID: return pct < TELEMETRY_BUDGET_MID_PCT;
+  default:
+    return pct < TELEMETRY_BUDGET_LOW_PCT && g_mem_level < TELEMETRY_MEM_SHED;
+  }
+}
+
+// How long a refused record of class `prio` waits before it is shed: bulk
+// goes at once while memory pressure sheds it.
+static uint64_t shed_age_us(can_bus_tx_prio_t prio) {
+  if (prio == CAN_BUS_TX_PRIO_LOW && g_mem_level >= TELEMETRY_MEM_SHED)
+    return 0;
+  return (uint64_t)TELEMETRY_SHED_AGE_MS * 1000u;
+}
+
+// Ingest side of the budget, re-evaluated from both telemetry threads.
+static void rx_pause_update(unsigned pct) {
+  if (!g_rx_paused && pct >= TELEMETRY_RX_PAUSE_PCT) {
+    g_rx_paused = 1;
+    can_bus_set_reasm_pause(can_bus_get(TELEMETRY_CAN_BUS),
+                            TELEMETRY_CAN_STD_ID);
+  } else if (g_rx_paused && pct < TELEMETRY_RX_RESUME_PCT) {
+    g_rx_paused = 0;
+    can_bus_set_reasm_pause(can_bus_get(TELEMETRY_CAN_BUS), 0);
+  }
+}
+
+void telemetry_flow_get_stats(uint32_t *blocked, uint32_t *shed,
+                              uint8_t *rx_paused) {
+  if (blocked) *blocked = g_flow_blocked;
+  if (shed) *shed = g_flow_shed;
+  if (rx_paused) *rx_paused = g_rx_paused;
+}
+
+/* ---------------- RX helpers ---------------- */
+// One call per can_bus_process_rx() pass: the router and side lookups are
+// done once for the whole burst instead of once per message.
+#ifdef TELEMETRY_ENABLED
+static uint8_t g_can_lz_rx[TELEMETRY_CAN_LZ_MAX];
+
+// A compressed message (TELEMETRY_CAN_LZ) expanded into g_can_lz_rx, which
+// the next call reuses: the router copies packets into its queue. The
+// message itself if it isn't one; NULL if it doesn't decode.
+static const uint8_t *can_lz_unpack(const uint8_t *data, size_t *len) {
+  if (*len <= TELEMETRY_CAN_LZ_HDR ||
+      (data[0] | ((uint16_t)data[1] << 8)) != TELEMETRY_CAN_LZ_MAGIC)
+    return data;
+  const size_t raw = (size_t)data[2] | ((size_t)data[3] << 8);
+  size_t out = 0;
+  if (raw > sizeof(g_can_lz_rx) ||
+      lz_dict_decompress(&data[TELEMETRY_CAN_LZ_HDR],
+                         *len - TELEMETRY_CAN_LZ_HDR, g_can_lz_rx, raw,
+                         &out) != HAL_OK ||
+      out != raw)
+    return NULL;
+  *len = out;
+  return g_can_lz_rx;
+}
+
+// A traced message (TELEMETRY_CAN_TRACE_EVERY) recorded and stripped of
+// its header; the message itself if it isn't one.
+static const uint8_t *can_trace_unwrap(const uint8_t *data, size_t *len) {
+  if (*len <= TELEMETRY_CAN_TRACE_HDR ||
+      (data[0] | ((uint16_t)data[1] << 8)) != TELEMETRY_CAN_TRACE_MAGIC)
+    return data;
+  const uint16_t origin = (uint16_t)(data[2] | (data[3] << 8));
+  uint32_t at;
+  memcpy(&at, &data[4], sizeof(at));
+  data += TELEMETRY_CAN_TRACE_HDR;
+  *len -= TELEMETRY_CAN_TRACE_HDR;
+  trace_record(origin, at, data, *len);
+  return data;
+}
+#endif
+
+static void telemetry_can_rx_batch(const can_bus_msg_t *msgs, size_t count,
+                                   void *user) {
+  (void)user;
+#ifndef TELEMETRY_ENABLED
+  (void)msgs;
+  (void)count;
+#else
+  if (!msgs || count == 0) return;
+
+  if (!g_router.r) {
+    if (init_telemetry_router() != SEDS_OK) return;
+  }
+
+  SedsRouter *const r = g_router.r;
+  const int32_t side = g_can_side_id;
+  for (size_t i = 0; i < count; i++) {
+    if (!msgs[i].data || msgs[i].len == 0) {
+      side_bad_arg(TELEMETRY_SIDE_CAN);
+      continue;
+    }
+    side_rx(TELEMETRY_SIDE_CAN, msgs[i].len);
+    size_t len = msgs[i].len;
+    const uint8_t *data = can_lz_unpack(msgs[i].data, &len);
+    if (!data) {
+      side_bad_arg(TELEMETRY_SIDE_CAN);
+      continue;
+    }
+    data = can_trace_unwrap(data, &len);
+    if (telemetry_bench_rx(data, len)) continue;
+    if (rx_fast_path(side, data, len)) continue;
+    if (side >= 0) {
+      side_queued(TELEMETRY_SIDE_CAN,
+                  seds_router_rx_serialized_packet_to_queue_from_side(
+                      r, (uint32_t)side, data, len));
+    } else {
+      side_queued(TELEMETRY_SIDE_CAN,
+                  seds_router_rx_serialized_packet_to_queue(r, data, len));
+    }
+  }
+#endif
+}
+
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_ISOTP
+static uint8_t g_isotp_rx_buf[TELEMETRY_ISOTP_RX_MAX];
+
+static void telemetry_isotp_rx(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (!g_router.r) return;
+  side_rx(TELEMETRY_SIDE_CAN, len);
+  if (rx_fast_path(g_can_side_id, data, len)) return;
+  if (g_can_side_id >= 0) {
+    side_queued(TELEMETRY_SIDE_CAN,
+                seds_router_rx_serialized_packet_to_queue_from_side(
+                    g_router.r, (uint32_t)g_can_side_id, data, len));
+  } else {
+    side_queued(TELEMETRY_SIDE_CAN, seds_router_rx_serialized_packet_to_queue(
+                                        g_router.r, data, len));
+  }
+}
+#endif
+
+static void telemetry_usb_rx(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (!data || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_USB);
+    return;
+  }
+  if (!g_router.r || g_usb_side_id < 0) return;
+  side_rx(TELEMETRY_SIDE_USB, len);
+  if (usb_ctrl_rx(data, len, usb_cdc_send_frame)) return;
+  if (rx_fast_path(g_usb_side_id, data, len)) return;
+  side_queued(TELEMETRY_SIDE_USB,
+              seds_router_rx_serialized_packet_to_queue_from_side(
+                  g_router.r, (uint32_t)g_usb_side_id, data, len));
+}
+
+#ifdef USB_CMD_EP_ENABLED
+// Replies go back on the command pipe; one too long for it, or with the
+// pipe's queue full, takes the bulk pipe instead.
+static HAL_StatusTypeDef usb_cmd_send(const uint8_t *bytes, size_t len) {
+  if (usb_cdc_send_cmd(bytes, len) == HAL_OK) return HAL_OK;
+  return usb_cdc_send_frame(bytes, len);
+}
+
+// Command pipe: control frames only; bulk dumps they start (trace, files)
+// still stream on the CDC data pipe.
+static void telemetry_usb_cmd(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (!data || len == 0 || !g_router.r) return;
+  side_rx(TELEMETRY_SIDE_USB, len);
+  if (!usb_ctrl_rx(data, len, usb_cmd_send)) side_bad_arg(TELEMETRY_SIDE_USB);
+}
+#endif
+
+#ifdef UART_LINK_ENABLED
+// UART control frames: the cache query and capture; subscriptions are
+// USB's. 0 if `bytes` isn't one.
+static int uart_ctrl_rx(const uint8_t *bytes, size_t len) {
+  if (!ctrl_is_frame(bytes, len)) return 0;
+  const uint8_t op = bytes[sizeof(k_usb_ctrl_magic)];
+  const uint8_t *args = bytes + sizeof(k_usb_ctrl_magic) + 1u;
+  const size_t n = len - sizeof(k_usb_ctrl_magic) - 1u;
+  const int locked = link_tx_lock();
+#if TELEMETRY_LVC
+  if (op == TELEMETRY_USB_CTRL_LVC_GET) {
+    (void)uart_link_send_frame(g_lvc_reply, lvc_ctrl_reply(args, n));
+    link_tx_unlock(locked);
+    return 1;
+  }
+#endif
+  if (op == TELEMETRY_USB_CTRL_CONFIG_GET) {
+    (void)uart_link_send_frame(g_cfg_reply, cfg_get_reply(args, n));
+    link_tx_unlock(locked);
+    return 1;
+  }
+  if (op == TELEMETRY_USB_CTRL_TALKERS) {
+    (void)uart_link_send_frame(g_top_reply, top_reply(args, n));
+    link_tx_unlock(locked);
+    return 1;
+  }
+  if (op == TELEMETRY_USB_CTRL_HEALTH_GET) {
+    (void)uart_link_send_frame(g_health_reply, health_reply());
+    link_tx_unlock(locked);
+    return 1;
+  }
+  uint8_t status = TELEMETRY_USB_CTRL_BAD_OP;
+  switch (op) {
+#if TELEMETRY_CAPTURE_BYTES
+  case TELEMETRY_USB_CTRL_CAPTURE_START:
+    status = cap_start(g_uart_side_id, args, n);
+    break;
+  case TELEMETRY_USB_CTRL_CAPTURE_STOP:
+    cap_stop();
+    status = TELEMETRY_USB_CTRL_OK;
+    break;
+#endif
+  case TELEMETRY_USB_CTRL_BLACKBOX_TRIGGER:
+    status = bb_ctrl();
+    break;
+  case TELEMETRY_USB_CTRL_CONFIG_SET:
+  case TELEMETRY_USB_CTRL_CONFIG_COMMIT:
+  case TELEMETRY_USB_CTRL_CONFIG_DEFAULTS:
+    status = cfg_ctrl(op, args, n);
+    break;
+  default:
+    status = replay_ctrl(op, args, n);
+    break;
+  }
+  uint8_t reply[sizeof(k_usb_ctrl_magic) + 2u];
+  (void)uart_link_send_frame(reply, ctrl_status_reply(op, status, reply));
+  link_tx_unlock(locked);
+  return 1;
+}
+
+static void telemetry_uart_rx(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (!data || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_UART);
+    return;
+  }
+  if (!g_router.r || g_uart_side_id < 0) return;
+  side_rx(TELEMETRY_SIDE_UART, len);
+#if TELEMETRY_UART_HDR_COMP
+  switch (hdr_comp_decode(&g_link_hc_rx, data, len, g_link_hc_pkt,
+                          sizeof(g_link_hc_pkt), &data, &len)) {
+  case HDR_COMP_DROP: g_link_stats.hc_rx_dropped++; return;
+  case HDR_COMP_OK:
+  case HDR_COMP_PASS: break;
+  }
+#endif
+  if (uart_ctrl_rx(data, len)) return;
+  if (rx_fast_path(g_uart_side_id, data, len)) return;
+  side_queued(TELEMETRY_SIDE_UART,
+              seds_router_rx_serialized_packet_to_queue_from_side(
+                  g_router.r, (uint32_t)g_uart_side_id, data, len));
+}
+#endif
+
+#ifdef SPI_LINK_ENABLED
+static void telemetry_spi_rx(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (!data || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_SPI);
+    return;
+  }
+  if (!g_router.r || g_spi_side_id < 0) return;
+  side_rx(TELEMETRY_SIDE_SPI, len);
+  if (rx_fast_path(g_spi_side_id, data, len)) return;
+  side_queued(TELEMETRY_SIDE_SPI,
+              seds_router_rx_serialized_packet_to_queue_from_side(
+                  g_router.r, (uint32_t)g_spi_side_id, data, len));
+}
+#endif
+
+void rx_asynchronous(const uint8_t *bytes, size_t len) {
+#ifndef TELEMETRY_ENABLED
+  (void)bytes;
+  (void)len;
+  return;
+#else
+  if (!bytes || len == 0) {
+    side_bad_arg(TELEMETRY_SIDE_CAN);
+    return;
+  }
+
+  if (!g_router.r) {
+    if (init_telemetry_router() != SEDS_OK) return;
+  }
+
+  side_rx(TELEMETRY_SIDE_CAN, len);
+  if (rx_fast_path(g_can_side_id, bytes, len)) return;
+  if (g_can_side_id >= 0) {
+    side_queued(TELEMETRY_SIDE_CAN,
+                seds_router_rx_serialized_packet_to_queue_from_side(
+                    g_router.r, (uint32_t)g_can_side_id, bytes, len));
+  } else {
+    side_queued(TELEMETRY_SIDE_CAN, seds_router_rx_serialized_packet_to_queue(
+                                        g_router.r, bytes, len));
+  }
+#endif
+}
+
+static UNUSED_FUNCTION void rx_synchronous(const uint8_t *bytes, size_t len) {
+#ifndef TELEMETRY_ENABLED
+  (void)bytes;
+  (void)len;
+  return;
+#else
+  if (!bytes || len == 0) return;
+
+  if (!g_router.r) {
+    if (init_telemetry_router() != SEDS_OK) return;
+  }
+
+  if (g_can_side_id >= 0) {
+    (void)seds_router_receive_serialized_from_side(
+        g_router.r, (uint32_t)g_can_side_id, bytes, len);
+  } else {
+    (void)seds_router_receive_serialized(g_router.r, bytes, len);
+  }
+#endif
+}
+
+/* ---------------- Time sync request/announce ---------------- */
+#if !TELEMETRY_TIME_MASTER
+static uint32_t g_timesync_seq = 0;
+#endif
+#if TIMESYNC_SERVES && NET_TIMESYNC_BROADCAST
+// Master or boundary clock: the SYNC whose FOLLOW_UP is due.
+static struct {
+  uint32_t seq;
+  uint8_t pending;
+  uint32_t frames_tx; // TS_SERVE_FRAMES_TX after it was queued
+  uint64_t t1_sw;     // node time just before it was queued
+} g_bsync_tx;
+#endif
+
+uint32_t telemetry_timesync_interval_ms(void) {
+#if TELEMETRY_TIME_MASTER && NET_TIMESYNC_BROADCAST
+  return g_bsync_tx.pending ? NET_TIMESYNC_FOLLOW_UP_MS
+                            : NET_TIMESYNC_SYNC_PERIOD_MS;
+#elif TELEMETRY_TIME_MASTER
+  return config_get(CONFIG_TIMESYNC_ACQUIRE_PERIOD_MS);
+#else
+  if (g_burst.sent < NET_TIMESYNC_BURST)
+    return config_get(CONFIG_TIMESYNC_BURST_GAP_MS);
+  return g_sync_pause_ms;
+#endif
+}
+
+int32_t telemetry_timesync_drift_ppb(void) {
+  return (int32_t)(((int64_t)g_clk_freq_q32 * 1000000000LL) >> 32);
+}
+
+void telemetry_timesync_get_stats(telemetry_timesync_stats_t *out) {
+  if (!out) return;
+#if TELEMETRY_TIME_MASTER
+  memset(out, 0, sizeof(*out));
+  out->frames_tx = g_ts_frames_tx;
+  out->frames_rx = g_ts_frames_rx;
+#else
+  *out = g_ts_stats;
+  out->servo_state = (uint8_t)g_servo_state;
+  out->locked = g_servo_locked;
+  out->delay_floor_us = g_delay_floor_us;
+  out->period_ms = g_sync_period_ms;
+  out->drift_ppb = telemetry_timesync_drift_ppb();
+  out->frames_tx = g_ts_frames_tx;
+  out->frames_rx = g_ts_frames_rx;
+  out->last_good_age_ms = UINT32_MAX;
+  if (g_ts_last_good_raw != 0) {
+    const uint64_t age = (tx_raw_now_us() - g_ts_last_good_raw) / 1000ULL;
+    if (age < UINT32_MAX) out->last_good_age_ms = (uint32_t)age;
+  }
+#endif
+}
+
+#if TIMESYNC_SERVES && NET_TIMESYNC_BROADCAST
+// Master or boundary clock, each interval: the FOLLOW_UP of the last SYNC
+// if one is due, else the next SYNC. A SYNC whose TX stamp didn't come back
+// gets the software stamp, like an unstamped response. One that a response
+// (from the RX interrupt) followed gets no FOLLOW_UP: the last TX event on
+// the ID may be the response's, and clients drop a SYNC left without one.
+static SedsResult timesync_broadcast(void) {
+  can_bus_t *bus = can_bus_get(TIMESYNC_SERVE_BUS);
+  if (!bus) return SEDS_ERR;
+  if (g_bsync_tx.pending && TS_SERVE_FRAMES_TX != g_bsync_tx.frames_tx) {
+    g_bsync_tx.pending = 0;
+    g_bsync_tx.seq++;
+  }
+  if (g_bsync_tx.pending) {
+    uint64_t hw = 0;
+    const HAL_StatusTypeDef st = can_bus_last_tx_time_us(
+        bus, TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID, &hw);
+    const uint64_t t1 = pick_stamp_us(bus, st, hw, g_bsync_tx.t1_sw);
+    uint8_t fup[TIMESYNC_FRAME_FUP_LEN];
+    memcpy(fup, &g_bsync_tx.seq, 4);
+    memcpy(fup + 4, &t1, 8);
+    g_bsync_tx.pending = 0;
+    g_bsync_tx.seq++;
+    if (can_bus_send_bytes_prio(bus, fup, sizeof(fup),
+                                TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+                                CAN_BUS_TX_PRIO_HIGH) != HAL_OK)
+      return SEDS_IO;
+    TS_SERVE_FRAMES_TX++;
+    return SEDS_OK;
+  }
+  uint8_t sync[TIMESYNC_FRAME_SYNC_LEN];
+  memcpy(sync, &g_bsync_tx.seq, 4);
+  g_bsync_tx.t1_sw = telemetry_now_us();
+  if (can_bus_send_bytes_prio(bus, sync, sizeof(sync),
+                              TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+                              CAN_BUS_TX_PRIO_HIGH) != HAL_OK)
+    return SEDS_IO;
+  TS_SERVE_FRAMES_TX++;
+  g_bsync_tx.frames_tx = TS_SERVE_FRAMES_TX;
+  g_bsync_tx.pending = 1;
+  return SEDS_OK;
+}
+#endif
+
+SedsResult telemetry_timesync_request(void) {
+#ifndef TELEMETRY_ENABLED
+  return SEDS_OK;
+#else
+#if TELEMETRY_TIME_MASTER && NET_TIMESYNC_BROADCAST
+  return timesync_broadcast();
+#elif TELEMETRY_TIME_MASTER
+  // Master doesn't request.
+  return SEDS_OK;
+#else
+  if (!g_router.r) {
+    if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
+  }
+
+  if (g_timesync_seq == 0) g_timesync_seq = jitter_next() | 1u;
+  if (g_ts_first_req_raw == 0) g_ts_first_req_raw = tx_raw_now_us();
+
+  // Responses are matched on the ingest thread, which preempts this one:
+  // the burst is reset in one piece and each request is on record before
+  // it goes out.
+  if (g_burst.sent >= NET_TIMESYNC_BURST) {
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!g_burst.done) burst_finish(); // with whatever came back
+    g_burst.first_seq = g_timesync_seq;
+    g_burst.sent = 0;
+    g_burst.got = 0;
+    g_burst.done = 0;
+    g_burst.best_delay_us = UINT64_MAX;
+    __set_PRIMASK(primask);
+  }
+
+  // Same domain as t4, so the offset measured is the residual error.
+  const uint64_t t1 = telemetry_now_us();
+  const uint32_t seq = g_timesync_seq;
+  const uint32_t t1_lo = (uint32_t)t1;
+  uint8_t req[TIMESYNC_FRAME_REQ_LEN];
+  memcpy(req, &seq, 4);
+  memcpy(req + 4, &t1_lo, 4);
+  const uint8_t idx = g_burst.sent;
+  g_burst.t1[idx] = t1;
+  g_burst.sent = (uint8_t)(idx + 1u);
+  if (can_bus_send_bytes_prio(can_bus_get(TELEMETRY_CAN_BUS), req, sizeof(req),
+                              TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+                              CAN_BUS_TX_PRIO_HIGH) != HAL_OK) {
+    g_burst.sent = idx; // never sent, so nothing can answer it
+    g_burst.t1[idx] = 0;
+    return SEDS_IO;
+  }
+  g_ts_frames_tx++;
+  g_timesync_seq++;
+  return SEDS_OK;
+#endif
+#endif
+}
+
+uint32_t telemetry_boundary_poll(void) {
+#if TELEMETRY_TIME_BOUNDARY && NET_TIMESYNC_BROADCAST && defined(TELEMETRY_ENABLED)
+  static uint64_t due_ms = 0;
+  const uint64_t now = tx_raw_now_us() / 1000u; // not stepped by time sync
+  if (now < due_ms) return (uint32_t)(due_ms - now);
+  if (g_servo_state == SERVO_TRACKING && g_router.r) {
+    (void)timesync_broadcast();
+  } else if (g_bsync_tx.pending) {
+    // Stepped since the SYNC: its FOLLOW_UP would carry the old clock.
+    g_bsync_tx.pending = 0;
+    g_bsync_tx.seq++;
+  }
+  const uint32_t next = g_bsync_tx.pending ? NET_TIMESYNC_FOLLOW_UP_MS
+                                           : NET_TIMESYNC_SYNC_PERIOD_MS;
+  due_ms = now + next;
+  return next;
+#else
+  return UINT32_MAX;
+#endif
+}
+
+void telemetry_boundary_get_stats(telemetry_boundary_stats_t *out) {
+  if (!out) return;
+  memset(out, 0, sizeof(*out));
+#if TELEMETRY_TIME_BOUNDARY
+  out->frames_tx = g_bc_frames_tx;
+  out->frames_rx = g_bc_frames_rx;
+  out->refused = g_bc_refused;
+  out->serving = (uint8_t)(g_servo_state == SERVO_TRACKING);
+#endif
+}
+
+SedsResult telemetry_timesync_announce(uint64_t priority, uint64_t unix_ms) {
+#ifndef TELEMETRY_ENABLED
+  (void)priority;
+  (void)unix_ms;
+  return SEDS_OK;
+#else
+#if !TELEMETRY_TIME_MASTER
+  (void)priority;
+  (void)unix_ms;
+  return SEDS_OK;
+#else
+  if (!g_router.r) {
+    if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
+  }
+
+  // Announce unix_ms from master (and priority for master election if you want it)
+  const uint64_t t = telemetry_now_ms();
+  const uint64_t announce[2] = {priority, unix_ms};
+
+  return log_timesync(SEDS_DT_TIME_SYNC_ANNOUNCE, t, announce, 2);
+#endif
+#endif
+}
+
+void telemetry_timesync_last(int64_t *offset_us, uint64_t *delay_us) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (offset_us) *offset_us = g_last_offset_us;
+  if (delay_us) *delay_us = g_last_delay_us;
+  __set_PRIMASK(primask);
+}
+
+/* ---------------- Router init (idempotent) ---------------- */
+#ifdef TELEMETRY_ENABLED
+// Applies both bulk shaping keys, whichever one changed.
+static void bulk_shaping_apply(uint32_t value) {
+  (void)value;
+  if (can_bus_set_tx_shaping(can_bus_get(TELEMETRY_CAN_BUS),
+                             CAN_BUS_TX_PRIO_LOW,
+                             (uint8_t)config_get(CONFIG_CAN_BULK_SHARE_PCT),
+                             config_get(CONFIG_CAN_BULK_BURST_US)) != HAL_OK) {
+    printf("Error: can_bus_set_tx_shaping failed\r\n");
+  }
+}
+#endif
+
+SedsResult init_telemetry_router(void) {
+#ifndef TELEMETRY_ENABLED
+  timesync_config_define();
+  return SEDS_OK;
+#else
+  if (g_router.created && g_router.r) return SEDS_OK;
+
+  if (!g_can_rx_subscribed) {
+    can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+    if (can_bus_subscribe_rx_batch(bus, telemetry_can_rx_batch, NULL) ==
+        HAL_OK) {
+      g_can_rx_subscribed = 1;
+    } else {
+      printf("Error: can_bus_subscribe_rx_batch failed\r\n");
+    }
+#if TELEMETRY_CAN_RX_HEAP
+    if (can_bus_set_reasm_alloc(bus, telemetryMalloc, telemetryFree) !=
+        HAL_OK) {
+      printf("Error: can_bus_set_reasm_alloc failed\r\n");
+    }
+#endif
+    (void)config_define(CONFIG_CAN_BULK_SHARE_PCT,
+                        TELEMETRY_CAN_BULK_SHARE_PCT, 0u, 100u, CONFIG_LIVE,
+                        bulk_shaping_apply);
+    (void)config_define(CONFIG_CAN_BULK_BURST_US, TELEMETRY_CAN_BULK_BURST_US,
+                        100u, 1000000u, CONFIG_LIVE, bulk_shaping_apply);
+    if (config_get(CONFIG_CAN_BULK_SHARE_PCT) != 0) bulk_shaping_apply(0);
+#if TELEMETRY_TT && TELEMETRY_TIME_MASTER
+    tt_update(); // the master's clock is the reference; clients wait to lock
+#endif
+#if TELEMETRY_CAN_CREDIT_MS
+    if (can_bus_advertise_credits(bus, TELEMETRY_CAN_CREDIT_MS) != HAL_OK) {
+      printf("Error: can_bus_advertise_credits failed\r\n");
+    }
+#endif
+#if TELEMETRY_ISOTP
+    const isotp_config_t isotp = {
+        .bus = bus,
+        .tx_id = TELEMETRY_ISOTP_TX_ID,
+        .rx_id = TELEMETRY_ISOTP_RX_ID,
+        .block_size = 0,
+        .st_min = 0,
+        .rx_buf = g_isotp_rx_buf,
+        .rx_cap = sizeof(g_isotp_rx_buf),
+        .on_rx = telemetry_isotp_rx,
+    };
+    if (isotp_open(&isotp) != HAL_OK) {
+      printf("Error: isotp_open failed\r\n");
+    }
+#endif
+#ifdef FW_UPDATE_ENABLED
+    const isotp_config_t fw_isotp = {
+        .bus = bus,
+        .tx_id = TELEMETRY_FW_ISOTP_TX_ID,
+        .rx_id = TELEMETRY_FW_ISOTP_RX_ID,
+        .block_size = 0,
+        .st_min = 0,
+        .rx_buf = g_fw_isotp_rx_buf,
+        .rx_cap = sizeof(g_fw_isotp_rx_buf),
+        .on_rx = fw_isotp_rx,
+    };
+    if (isotp_open(&fw_isotp) != HAL_OK) {
+      printf("Error: isotp_open failed\r\n");
+    }
+#endif
+#ifdef FW_RELAY_ENABLED
+    fw_relay_init(bus);
+#endif
+#ifdef FILE_SRV_ENABLED
+    file_srv_init(bus);
+#endif
+    // Time sync and control messages keep their reassembly slots over bulk
+    // telemetry when the table fills.
+    if (can_bus_set_reasm_priority(bus, TELEMETRY_CAN_TIMESYNC_STD_ID,
+                                   TELEMETRY_CAN_CONTROL_STD_ID) != HAL_OK) {
+      printf("Error: can_bus_set_reasm_priority failed\r\n");
+    }
+#ifdef CAN_PEER_ENABLED
+    // The IDs other nodes reach this one on, for their capability tables.
+    const can_peer_local_t peer_ids[] = {
+#if TELEMETRY_ISOTP
+        {TELEMETRY_ISOTP_RX_ID, CAN_PEER_XPORT_ISOTP, sizeof(g_isotp_rx_buf)},
+#endif
+#ifdef FW_UPDATE_ENABLED
+        {TELEMETRY_FW_ISOTP_RX_ID, CAN_PEER_XPORT_ISOTP,
+         sizeof(g_fw_isotp_rx_buf)},
+#endif
+#ifdef FILE_SRV_ENABLED
+        {FILE_SRV_RX_ID, CAN_PEER_XPORT_BULK, CAN_PEER_CAP_STREAM},
+#endif
+        {0, 0, 0}, // keeps the array non-empty; not counted
+    };
+    if (can_peer_init(bus, telemetry_node_id(), peer_ids,
+                      sizeof(peer_ids) / sizeof(peer_ids[0]) - 1u) != HAL_OK) {
+      printf("Error: can_peer_init failed\r\n");
+    }
+#endif
+#ifdef CAN_GW_ENABLED
+    if (can_gw_init(bus, telemetry_node_id(), gw_uplink_up) != HAL_OK) {
+      printf("Error: can_gw_init failed\r\n");
+    }
+#endif
+#if TELEMETRY_TIME_MASTER
+    if (can_bus_set_responder(bus, TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+                              timesync_respond, NULL) != HAL_OK) {
+      printf("Error: can_bus_set_responder failed\r\n");
+    }
+#else
+    if (can_bus_subscribe_id(bus, TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+                             on_timesync_frame, NULL) != HAL_OK) {
+      printf("Error: can_bus_subscribe_id failed\r\n");
+    }
+#endif
+#if TELEMETRY_TIME_BOUNDARY
+    // The downstream controller must be up (can_bus_init()) by now.
+    can_bus_t *down = can_bus_get(TELEMETRY_TIME_DOWN_BUS);
+    if (!down || can_bus_set_responder(down, TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+                                       timesync_respond, NULL) != HAL_OK) {
+      printf("Error: boundary clock responder failed\r\n");
+    }
+#endif
+#if TELEMETRY_LVC
+    if (can_bus_subscribe_id(bus, TELEMETRY_CAN_LVC_QUERY_STD_ID, on_lvc_frame,
+                             NULL) != HAL_OK) {
+      printf("Error: can_bus_subscribe_id failed\r\n");
+    }
+#endif
+    if (can_bus_subscribe_id(bus, TELEMETRY_CAN_SERIES_STD_ID,
+                             on_series_frame, NULL) != HAL_OK) {
+      printf("Error: can_bus_subscribe_id failed\r\n");
+    }
+
+    // Only router and time-sync traffic is of interest; drop the rest in
+    // hardware.
+    // Time sync and control go to FIFO0 so bulk bursts can't delay them.
+    const can_bus_filter_t filters[] = {
+        {CAN_BUS_FILTER_ID_RANGE, TELEMETRY_CAN_TIMESYNC_FRAME_STD_ID,
+         TELEMETRY_CAN_CONTROL_STD_ID, CAN_BUS_RX_FIFO0},
+        {CAN_BUS_FILTER_ID_RANGE, TELEMETRY_CAN_STD_ID,
+         TELEMETRY_CAN_STD_ID_LAST, CAN_BUS_RX_FIFO1},
+        {CAN_BUS_FILTER_ID_LIST, TELEMETRY_CAN_SERIES_STD_ID,
+         TELEMETRY_CAN_SERIES_STD_ID, CAN_BUS_RX_FIFO1},
+#if TELEMETRY_ISOTP
+        {CAN_BUS_FILTER_ID_LIST, TELEMETRY_ISOTP_RX_ID, TELEMETRY_ISOTP_RX_ID,
+         CAN_BUS_RX_FIFO1},
+#endif
+#ifdef FW_UPDATE_ENABLED
+        {CAN_BUS_FILTER_ID_LIST, TELEMETRY_FW_ISOTP_RX_ID,
+         TELEMETRY_FW_ISOTP_RX_ID, CAN_BUS_RX_FIFO1},
+#endif
+#ifdef FW_RELAY_ENABLED
+        {CAN_BUS_FILTER_ID_RANGE, FW_RELAY_REPLY_FIRST, FW_RELAY_REPLY_LAST,
+         CAN_BUS_RX_FIFO1},
+#endif
+#ifdef FILE_SRV_ENABLED
+        {CAN_BUS_FILTER_ID_LIST, FILE_SRV_RX_ID, FILE_SRV_RX_ID,
+         CAN_BUS_RX_FIFO1},
+        {CAN_BUS_FILTER_ID_RANGE, FILE_SRV_PULL_FIRST, FILE_SRV_PULL_LAST,
+         CAN_BUS_RX_FIFO1},
+#endif
+#if TELEMETRY_LVC
+        {CAN_BUS_FILTER_ID_LIST, TELEMETRY_CAN_LVC_QUERY_STD_ID,
+         TELEMETRY_CAN_LVC_QUERY_STD_ID, CAN_BUS_RX_FIFO1},
+#endif
+#ifdef CAN_PEER_ENABLED
+        {CAN_BUS_FILTER_ID_LIST, CAN_PEER_STD_ID, CAN_PEER_STD_ID,
+         CAN_BUS_RX_FIFO1},
+#endif
+#ifdef CAN_GW_ENABLED
+        // FIFO0: heartbeats shouldn't wait behind bulk for the timeout.
+        {CAN_BUS_FILTER_ID_LIST, CAN_GW_STD_ID, CAN_GW_STD_ID,
+         CAN_BUS_RX_FIFO0},
+#endif
+    };
+    if (can_bus_set_filters(bus, filters,
+                            sizeof(filters) / sizeof(filters[0])) != HAL_OK) {
+      printf("Error: can_bus_set_filters failed\r\n");
+    }
+#if TELEMETRY_BLACKBOX_BYTES
+    raw_hook_update(); // the black box records from the start
+#endif
+  }
+
+  const SedsLocalEndpointDesc locals[] = {
+      {
+          .endpoint = (uint32_t)SEDS_EP_SD_CARD,
+          .packet_handler = on_sd_packet,
+          .serialized_handler = NULL,
+          .user = NULL,
+      },
+      {
+          .endpoint = (uint32_t)SEDS_EP_TIME_SYNC,
+          .packet_handler = on_timesync,
+          .serialized_handler = NULL,
+          .user = NULL,
+      },
+#ifdef TELEMETRY_CMD_ENDPOINT
+      {
+          .endpoint = (uint32_t)TELEMETRY_CMD_ENDPOINT,
+          .packet_handler = on_command,
+          .serialized_handler = NULL,
+          .user = NULL,
+      },
+#endif
+  };
+
+  local_types_build(locals, sizeof(locals) / sizeof(locals[0]));
+  tx_classes_build();
+  can_ids_build();
+  usb_sub_init();
+  timesync_config_define();
+#if TELEMETRY_INTAKE_SLOTS
+  intake_init();
+  block_init();
+#endif
+#if TELEMETRY_STORE_FORWARD
+  if (flash_log_init() != HAL_OK) printf("Error: flash_log_init failed\r\n");
+#endif
+#ifdef FW_UPDATE_ENABLED
+  if (fw_update_init() != HAL_OK) printf("Error: fw_update_init failed\r\n");
+#endif
+  if (!g_link_tx_mutex_ok &&
+      tx_mutex_create(&g_link_tx_mutex, "link tx", TX_INHERIT) == TX_SUCCESS)
+    g_link_tx_mutex_ok = 1;
+  if (!g_can_tx_mutex_ok &&
+      tx_mutex_create(&g_can_tx_mutex, "can tx", TX_INHERIT) == TX_SUCCESS)
+    g_can_tx_mutex_ok = 1;
+
+  SedsRouter *r = seds_router_new(
+      // Master should be relay too (so it forwards non-local packets),
+      // unless you truly want it to sink everything.
+      Seds_RM_Relay,
+      node_now_since_ms,
+      NULL,
+      locals,
+      (size_t)(sizeof(locals) / sizeof(locals[0])));
+
+  if (!r) {
+    printf("Error: failed to create router\r\n");
+    g_router.r = NULL;
+    g_router.created = 0;
+    g_can_side_id = -1;
+    g_usb_side_id = -1;
+#ifdef UART_LINK_ENABLED
+    g_uart_side_id = -1;
+#endif
+#ifdef SPI_LINK_ENABLED
+    g_spi_side_id = -1;
+#endif
+    return SEDS_ERR;
+  }
+
+  g_can_side_id = seds_router_add_side_serialized(
+      r, "can", 3, tx_send, NULL, false);
+
+  if (g_can_side_id < 0) {
+    printf("Error: failed to add CAN side: %ld\r\n", (long)g_can_side_id);
+    g_can_side_id = -1;
+  }
+
+  g_usb_side_id = seds_router_add_side_serialized(
+      r, "usb", 3, usb_tx_send, NULL, false);
+
+  if (g_usb_side_id < 0) {
+    printf("Error: failed to add USB side: %ld\r\n", (long)g_usb_side_id);
+    g_usb_side_id = -1;
+  } else {
+    usb_cdc_set_rx_handler(telemetry_usb_rx, NULL);
+#ifdef USB_CMD_EP_ENABLED
+    usb_cdc_set_cmd_handler(telemetry_usb_cmd, NULL);
+#endif
+  }
+
+#ifdef UART_LINK_ENABLED
+  g_uart_side_id = seds_router_add_side_serialized(
+      r, "uart", 4, uart_tx_send, NULL, false);
+
+  if (g_uart_side_id < 0) {
+    g_uart_side_id = -1; // printf is discarded with the link enabled
+  } else {
+    link_init();
+    uart_link_set_rx_handler(telemetry_uart_rx, NULL);
+  }
+#endif
+
+#ifdef SPI_LINK_ENABLED
+  g_spi_side_id = seds_router_add_side_serialized(
+      r, "spi", 3, spi_tx_send, NULL, false);
+
+  if (g_spi_side_id < 0) {
+    printf("Error: failed to add SPI side: %ld\r\n", (long)g_spi_side_id);
+    g_spi_side_id = -1;
+  } else {
+    spi_link_set_rx_handler(telemetry_spi_rx, NULL);
+  }
+#endif
+
+  g_router.r = r;
+  g_router.created = 1;
+  g_router.start_time = telemetry_now_ms();
+  boot_time_mark(BOOT_ROUTER);
+
+#if TELEMETRY_TIME_MASTER
+  // master offset stays 0, unless a PPS got in first
+  if (g_pps.edges == 0) clock_set(0, 0, 0);
+#else
+  // Start slewing at the rate learned before the reset; the first
+  // response then only has to fix the phase.
+  int32_t drift_q32 = 0;
+  if (rtc_time_load_drift(&drift_q32) == HAL_OK) {
+    g_servo_drift_q32 = clamp_freq(drift_q32);
+    g_servo_drift_restored = 1;
+    clock_set(tx_raw_now_us(), 0, (int32_t)g_servo_drift_q32);
+  }
+#endif
+
+  uint64_t rtc_ms = 0;
+  if (!g_unix_valid && rtc_time_get_unix_ms(&rtc_ms) == HAL_OK) {
+    g_unix_base_ms = (int64_t)rtc_ms - (int64_t)telemetry_now_ms();
+    g_unix_from_rtc = 1;
+    g_unix_valid = 1;
+  }
+
+  return SEDS_OK;
+#endif
+}
+
+/* ---------------- Logging APIs ---------------- */
+// Wake the telemetry thread once a packet is sitting on a router queue.
+static inline UNUSED_FUNCTION SedsResult notify_queued(SedsResult res) {
+  if (res == SEDS_OK) {
+    qlat_put(TELEMETRY_QUEUE_TX);
+    telemetry_thread_notify(TELEMETRY_EVT_TX_QUEUED);
+  }
+  return res;
+}
+
+static inline SedsElemKind guess_kind_from_elem_size(size_t elem_size) {
+  if (elem_size == 4 || elem_size == 8) return SEDS_EK_FLOAT;
+  return SEDS_EK_UNSIGNED;
+}
+
+/* ---------------- Aggregation ----------------
+ * Per-data-type reduction ahead of the router: each rule folds a window of
+ * samples into one, element by element, so the output keeps the type's
+ * shape. The window closes after `window` samples or `window_ms` since it
+ * opened, whichever is set and comes first, checked as samples arrive.
+ * Accumulators are doubles so 32-bit integer channels stay exact. That's
+ * soft-float on the M4, so float32 statistics instead collect a block of
+ * samples per element and fold it into the accumulator with the CMSIS-DSP
+ * kernels: one double update per TELEMETRY_AGG_BLOCK samples. Updates run
+ * with IRQs masked: logging threads and the intake drain share them. */
+typedef struct {
+  telemetry_agg_rule_t rule;
+  uint16_t seen; // samples in the open window
+  uint8_t elems;
+  uint8_t elem_size;
+  SedsElemKind kind;
+  uint64_t start_ms;
+  double acc[TELEMETRY_AGG_MAX_ELEMS]; // min, max, sum, sum of squares, or
+                                       // the last value forwarded (DEADBAND)
+  uint8_t held[TELEMETRY_AGG_MAX_ELEMS * 8u]; // TELEMETRY_AGG_LAST
+  uint8_t fill; // samples in blk
+  float32_t blk[TELEMETRY_AGG_MAX_ELEMS][TELEMETRY_AGG_BLOCK]; // per element
+} agg_chan_t;
+
+// Rules from telemetry_set_aggregation() first, then the channels of the
+// profiles that aren't at full rate, then the remote rates.
+static agg_chan_t g_agg[TELEMETRY_AGG_MAX_RULES + TELEMETRY_AGG_PROFILES +
+                        TELEMETRY_RATE_TYPES];
+static volatile uint8_t g_agg_count;
+static uint8_t g_agg_static; // rules set with telemetry_set_aggregation()
+
+static telemetry_agg_profile_t g_aggp[TELEMETRY_AGG_PROFILES];
+static uint8_t g_aggp_count;
+static uint64_t g_aggp_calm_ms; // load under the step-up mark since, or 0
+static telemetry_agg_load_stats_t g_aggp_stats;
+
+// Source side: the table the gateway sent, until g_rate_until_ms.
+static telemetry_rate_t g_rate[TELEMETRY_RATE_TYPES];
+static uint8_t g_rate_count;
+static uint64_t g_rate_until_ms;
+// Gateway side: the types it throttles, and how far.
+static telemetry_rate_t g_ratec[TELEMETRY_RATE_TYPES];
+static uint8_t g_ratec_count;
+static uint64_t g_ratec_calm_ms; // pressure under the low mark since, or 0
+static uint32_t g_ratec_failed;  // g_relay_failed at the last poll
+#ifdef TELEMETRY_CMD_ENDPOINT
+static uint8_t g_ratec_seq;
+#endif
+static telemetry_rate_stats_t g_rate_stats;
+
+typedef enum { AGG_PASS, AGG_DROP, AGG_EMIT } agg_result_t;
+
+static double agg_get(const uint8_t *p, size_t size, SedsElemKind kind) {
+  union { uint8_t b[8]; uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+          int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+          float f; double d; } v;
+  memcpy(v.b, p, size);
+  switch (size) {
+  case 1: return kind == SEDS_EK_SIGNED ? (double)v.i8 : (double)v.u8;
+  case 2: return kind == SEDS_EK_SIGNED ? (double)v.i16 : (double)v.u16;
+  case 4:
+    if (kind == SEDS_EK_FLOAT) return (double)v.f;
+    return kind == SEDS_EK_SIGNED ? (double)v.i32 : (double)v.u32;
+  default:
+    if (kind == SEDS_EK_FLOAT) return v.d;
+    return kind == SEDS_EK_SIGNED ? (double)v.i64 : (double)v.u64;
+  }
+}
+
+static void agg_put(uint8_t *p, size_t size, SedsElemKind kind, double x) {
+  union { uint8_t b[8]; uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+          int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+          float f; double d; } v;
+  if (kind != SEDS_EK_FLOAT) x += (x < 0) ? -0.5 : 0.5; // round, not truncate
+  switch (size) {
+  case 1:
+    if (kind == SEDS_EK_SIGNED) v.i8 = (int8_t)x; else v.u8 = (uint8_t)x;
+    break;
+  case 2:
+    if (kind == SEDS_EK_SIGNED) v.i16 = (int16_t)x; else v.u16 = (uint16_t)x;
+    break;
+  case 4:
+    if (kind == SEDS_EK_FLOAT) v.f = (float)x;
+    else if (kind == SEDS_EK_SIGNED) v.i32 = (int32_t)x;
+    else v.u32 = (uint32_t)x;
+    break;
+  default:
+    if (kind == SEDS_EK_FLOAT) v.d = x;
+    else if (kind == SEDS_EK_SIGNED) v.i64 = (int64_t)x;
+    else v.u64 = (uint64_t)x;
+    break;
+  }
+  memcpy(p, v.b, size);
+}
+
+// No libm here: bit-trick first guess, then Newton steps.
+static float agg_sqrtf(float x) {
+  if (!(x > 0.0f)) return 0.0f;
+  union { float f; uint32_t u; } g = { .f = x };
+  g.u = 0x1FBD1DF5u + (g.u >> 1);
+  float r = g.f;
+  for (int i = 0; i < 3; i++) r = 0.5f * (r + x / r);
+  return r;
+}
+
+// Channels of the profiles below full rate at the current level (the
+// coarsest under memory pressure), after the static rules, then those of
+// the remote rates, each with a fresh window. IRQs masked.
+static void agg_apply_level(void) {
+  const uint8_t level = (g_mem_level >= TELEMETRY_MEM_AGGR)
+                            ? (uint8_t)TELEMETRY_AGG_LEVEL_STATS
+                            : g_aggp_stats.level;
+  uint8_t n = g_agg_static;
+  for (uint8_t i = 0; i < g_aggp_count; i++) {
+    const telemetry_agg_profile_t *p = &g_aggp[i];
+    telemetry_agg_rule_t r = {.type = p->type};
+    if (level >= TELEMETRY_AGG_LEVEL_STATS && p->stats_ms) {
+      r.mode = p->stats_mode;
+      r.window_ms = p->stats_ms;
+    } else if (level >= TELEMETRY_AGG_LEVEL_DECIMATED && p->decimate > 1u) {
+      r.mode = TELEMETRY_AGG_DECIMATE;
+      r.window = p->decimate;
+    } else {
+      continue; // full rate: no channel
+    }
+    memset(&g_agg[n], 0, sizeof(g_agg[n]));
+    g_agg[n++].rule = r;
+  }
+  for (uint8_t i = 0; i < g_rate_count; i++) {
+    if (g_rate[i].decimate <= 1u) continue;
+    memset(&g_agg[n], 0, sizeof(g_agg[n]));
+    g_agg[n].rule.type = g_rate[i].type;
+    g_agg[n].rule.mode = TELEMETRY_AGG_DECIMATE;
+    g_agg[n++].rule.window = g_rate[i].decimate;
+  }
+  g_agg_count = n;
+}
+
+SedsResult telemetry_set_aggregation(const telemetry_agg_rule_t *rules,
+                                     size_t count) {
+  if (count > TELEMETRY_AGG_MAX_RULES || (count && !rules)) return SEDS_BAD_ARG;
+  for (size_t i = 0; i < count; i++) {
+    if (rules[i].mode > TELEMETRY_AGG_DEADBAND) return SEDS_BAD_ARG;
+    if (rules[i].mode == TELEMETRY_AGG_DEADBAND) {
+      if (!(rules[i].deadband >= 0.0f)) return SEDS_BAD_ARG;
+    } else if (rules[i].window == 0 && rules[i].window_ms == 0) {
+      return SEDS_BAD_ARG;
+    }
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (size_t i = 0; i < count; i++) {
+    memset(&g_agg[i], 0, sizeof(g_agg[i]));
+    g_agg[i].rule = rules[i];
+  }
+  g_agg_static = (uint8_t)count;
+  agg_apply_level();
+  __set_PRIMASK(primask);
+  return SEDS_OK;
+}
+
+// Fold the samples in `c->blk` into the accumulators; `first` when they
+// open the window.
+static void agg_flush_block(agg_chan_t *c, bool first) {
+  const uint32_t n = c->fill;
+  const telemetry_agg_mode_t mode = c->rule.mode;
+  for (size_t e = 0; n && e < c->elems; e++) {
+    float32_t r;
+    uint32_t at;
+    double *a = &c->acc[e];
+    if (mode == TELEMETRY_AGG_MIN) {
+      arm_min_f32(c->blk[e], n, &r, &at);
+      if (first || r < *a) *a = r;
+    } else if (mode == TELEMETRY_AGG_MAX) {
+      arm_max_f32(c->blk[e], n, &r, &at);
+      if (first || r > *a) *a = r;
+    } else {
+      if (mode == TELEMETRY_AGG_RMS) {
+        arm_power_f32(c->blk[e], n, &r); // sum of squares
+      } else {
+        arm_mean_f32(c->blk[e], n, &r);
+        r *= (float32_t)n;
+      }
+      *a = first ? (double)r : *a + (double)r;
+    }
+  }
+  c->fill = 0;
+}
+
+// Report by exception; `seen` flags a forwarded sample, start_ms its time.
+static agg_result_t agg_deadband(agg_chan_t *c, const uint8_t *src,
+                                 size_t count, size_t size, SedsElemKind kind,
+                                 uint64_t now_ms) {
+  bool send = !c->seen || c->elems != count || c->elem_size != size ||
+              c->kind != kind ||
+              (c->rule.heartbeat_ms &&
+               now_ms - c->start_ms >= c->rule.heartbeat_ms);
+  const double band = (double)c->rule.deadband;
+  for (size_t e = 0; !send && e < count; e++) {
+    const double d = agg_get(src + e * size, size, kind) - c->acc[e];
+    send = (band > 0.0) ? (d > band || d < -band) : (d != 0.0);
+  }
+  if (!send) return AGG_DROP;
+  for (size_t e = 0; e < count; e++)
+    c->acc[e] = agg_get(src + e * size, size, kind);
+  c->seen = 1;
+  c->elems = (uint8_t)count;
+  c->elem_size = (uint8_t)size;
+  c->kind = kind;
+  c->start_ms = now_ms;
+  return AGG_PASS;
+}
+
+// Feed one sample to its rule. AGG_EMIT leaves the reduced sample, same
+// shape as the input, in `out`.
+static agg_result_t agg_offer(SedsDataType ty, const void *data,
+                              size_t count, size_t size, SedsElemKind kind,
+                              uint64_t now_ms, uint8_t *out) {
+  if (!g_agg_count || count > TELEMETRY_AGG_MAX_ELEMS || size > 8u)
+    return AGG_PASS;
+  const uint8_t *src = (const uint8_t *)data;
+  agg_result_t res = AGG_DROP;
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  agg_chan_t *c = NULL;
+  for (uint8_t i = 0; i < g_agg_count; i++) {
+    if (g_agg[i].rule.type == ty) {
+      c = &g_agg[i];
+      break;
+    }
+  }
+  if (!c) {
+    __set_PRIMASK(primask);
+    return AGG_PASS;
+  }
+  if (c->rule.mode == TELEMETRY_AGG_DEADBAND) {
+    res = agg_deadband(c, src, count, size, kind, now_ms);
+    __set_PRIMASK(primask);
+    return res;
+  }
+  if (c->seen &&
+      (c->elems != count || c->elem_size != size || c->kind != kind))
+    c->seen = 0; // shape changed: start over
+  const telemetry_agg_mode_t mode = c->rule.mode;
+  if (c->seen == 0) {
+    c->elems = (uint8_t)count;
+    c->elem_size = (uint8_t)size;
+    c->kind = kind;
+    c->start_ms = now_ms;
+    c->fill = 0;
+    if (mode == TELEMETRY_AGG_DECIMATE) res = AGG_PASS; // first of N
+  }
+  const bool block = kind == SEDS_EK_FLOAT && size == sizeof(float32_t) &&
+                     mode != TELEMETRY_AGG_DECIMATE &&
+                     mode != TELEMETRY_AGG_LAST;
+  if (block) {
+    for (size_t e = 0; e < count; e++)
+      memcpy(&c->blk[e][c->fill], src + e * size, sizeof(float32_t));
+    if (++c->fill == TELEMETRY_AGG_BLOCK)
+      agg_flush_block(c, c->seen + 1u == c->fill);
+  }
+  for (size_t e = 0; !block && mode != TELEMETRY_AGG_DECIMATE &&
+                     mode != TELEMETRY_AGG_LAST && e < count; e++) {
+    const double x = agg_get(src + e * size, size, kind);
+    double *a = &c->acc[e];
+    if (c->seen == 0) {
+      *a = (mode == TELEMETRY_AGG_RMS) ? x * x : x;
+    } else if (mode == TELEMETRY_AGG_MIN) {
+      if (x < *a) *a = x;
+    } else if (mode == TELEMETRY_AGG_MAX) {
+      if (x > *a) *a = x;
+    } else {
+      *a += (mode == TELEMETRY_AGG_RMS) ? x * x : x;
+    }
+  }
+  if (mode == TELEMETRY_AGG_LAST) memcpy(c->held, src, count * size);
+  c->seen++;
+
+  const bool full = (c->rule.window && c->seen >= c->rule.window) ||
+                    (c->rule.window_ms &&
+                     now_ms - c->start_ms >= c->rule.window_ms);
+  if (full) {
+    if (mode == TELEMETRY_AGG_LAST) {
+      memcpy(out, c->held, count * size);
+      res = AGG_EMIT;
+    } else if (mode != TELEMETRY_AGG_DECIMATE) {
+      if (block) agg_flush_block(c, c->seen == c->fill);
+      for (size_t e = 0; e < count; e++) {
+        double x = c->acc[e];
+        if (mode == TELEMETRY_AGG_MEAN) x /= c->seen;
+        if (mode == TELEMETRY_AGG_RMS) x = agg_sqrtf((float)(x / c->seen));
+        agg_put(out + e * size, size, kind, x);
+      }
+      res = AGG_EMIT;
+    }
+    c->seen = 0;
+  }
+  __set_PRIMASK(primask);
+  return res;
+}
+
+/* ---------------- Bus-load profiles ----------------
+ * The level moves on the monitor's load figure, refreshed once per
+ * CAN_BUS_MON_PERIOD_MS: straight down to whatever level the load calls
+ * for, so an overload is shed within one period, and up one level at a
+ * time after a calm spell, so the load the restored rate adds is measured
+ * before the next step. The margin keeps a level's own saving from
+ * bouncing it straight back up. */
+SedsResult telemetry_set_agg_profiles(const telemetry_agg_profile_t *profiles,
+                                      size_t count) {
+  if (count > TELEMETRY_AGG_PROFILES || (count && !profiles))
+    return SEDS_BAD_ARG;
+  for (size_t i = 0; i < count; i++) {
+    const telemetry_agg_mode_t m = profiles[i].stats_mode;
+    if (profiles[i].stats_ms &&
+        (m < TELEMETRY_AGG_LAST || m > TELEMETRY_AGG_RMS))
+      return SEDS_BAD_ARG;
+  }
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (count) memcpy(g_aggp, profiles, count * sizeof(profiles[0]));
+  g_aggp_count = (uint8_t)count;
+  agg_apply_level();
+  __set_PRIMASK(primask);
+  return SEDS_OK;
+}
+
+uint32_t telemetry_agg_load_poll(void) {
+  if (!g_aggp_count) return UINT32_MAX;
+  can_bus_monitor_t mon;
+  can_bus_get_monitor(can_bus_get(TELEMETRY_CAN_BUS), &mon);
+  const uint8_t load = mon.load_pct;
+  const uint64_t now = tx_raw_now_us() / 1000u; // not stepped by time sync
+  const uint8_t level = g_aggp_stats.level;
+
+  uint8_t want = TELEMETRY_AGG_LEVEL_FULL;
+  if (load >= TELEMETRY_AGG_LOAD_STATS_PCT)
+    want = TELEMETRY_AGG_LEVEL_STATS;
+  else if (load >= TELEMETRY_AGG_LOAD_DECIMATE_PCT)
+    want = TELEMETRY_AGG_LEVEL_DECIMATED;
+
+  uint8_t next = level;
+  if (want > level) {
+    next = want;
+    g_aggp_calm_ms = 0;
+  } else if (level != TELEMETRY_AGG_LEVEL_FULL) {
+    const uint32_t mark = (level == TELEMETRY_AGG_LEVEL_STATS)
+                              ? TELEMETRY_AGG_LOAD_STATS_PCT
+                              : TELEMETRY_AGG_LOAD_DECIMATE_PCT;
+    if (load + TELEMETRY_AGG_LOAD_HYST_PCT >= mark) {
+      g_aggp_calm_ms = 0;
+    } else if (!g_aggp_calm_ms) {
+      g_aggp_calm_ms = now ? now : 1u;
+    } else if (now - g_aggp_calm_ms >= TELEMETRY_AGG_LOAD_HOLD_MS) {
+      next = (uint8_t)(level - 1u);
+      g_aggp_calm_ms = 0; // the next step waits out its own calm spell
+    }
+  }
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_aggp_stats.load_pct = load;
+  if (next != level) {
+    if (next > level)
+      g_aggp_stats.step_downs++;
+    else
+      g_aggp_stats.step_ups++;
+    g_aggp_stats.level = next;
+    agg_apply_level();
+  }
+  __set_PRIMASK(primask);
+  return TELEMETRY_AGG_LOAD_POLL_MS;
+}
+
+void telemetry_agg_get_load_stats(telemetry_agg_load_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_aggp_stats;
+  __set_PRIMASK(primask);
+}
+
+/* ---------------- Remote rate control ----------------
+ * The gateway sees the pressure first: its uplink backing up, relays
+ * refused, the bus load. Dropping there only sheds data that has already
+ * crossed the bus, so it tells the sources instead. Once a poll it takes
+ * the worst of the three in percent and moves one level: deeper while it
+ * is at or over TELEMETRY_RATE_HIGH_PCT, back up after a calm spell under
+ * TELEMETRY_RATE_LOW_PCT. Each step is a period apart so the sources' cut
+ * shows in the next reading. While throttled it broadcasts the table every
+ * poll; sources keep it for the hold it carries, so a gateway that goes
+ * away doesn't leave them throttled. A source's table becomes DECIMATE
+ * channels behind its own rules and profiles. */
+SedsResult telemetry_set_remote_rates(const telemetry_rate_t *rates,
+                                      size_t count, uint32_t hold_ms) {
+  if (count > TELEMETRY_RATE_TYPES || (count && !rates)) return SEDS_BAD_ARG;
+  const uint64_t now = tx_raw_now_us() / 1000u;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  // A refresh of the same table keeps its windows open.
+  const bool same = count == g_rate_count &&
+                    (!count || !memcmp(g_rate, rates, count * sizeof(rates[0])));
+  if (count) memcpy(g_rate, rates, count * sizeof(rates[0]));
+  g_rate_count = (uint8_t)count;
+  g_rate_until_ms = now + hold_ms;
+  g_rate_stats.remote_types = (uint8_t)count;
+  g_rate_stats.remote_applied++;
+  if (!same) agg_apply_level();
+  __set_PRIMASK(primask);
+  return SEDS_OK;
+}
+
+SedsResult telemetry_set_rate_ctrl(const telemetry_rate_t *types,
+                                   size_t count) {
+  if (count > TELEMETRY_RATE_TYPES || (count && !types)) return SEDS_BAD_ARG;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (count) memcpy(g_ratec, types, count * sizeof(types[0]));
+  g_ratec_count = (uint8_t)count;
+  __set_PRIMASK(primask);
+  return SEDS_OK;
+}
+
+// Worst of bus load, uplink backlog and refused relays, in percent.
+static uint8_t rate_pressure(void) {
+  can_bus_monitor_t mon;
+  can_bus_get_monitor(can_bus_get(TELEMETRY_CAN_BUS), &mon);
+  uint32_t backlog =
+      (uint32_t)(usb_cdc_tx_pending() * 100u / TELEMETRY_RATE_BACKLOG_BYTES);
+#ifdef UART_LINK_ENABLED
+  const uint32_t held = g_link_stats.pending * 100u / TELEMETRY_UART_SCHED_SLOTS;
+  if (held > backlog) backlog = held;
+#endif
+  const uint32_t failed = g_relay_failed;
+  if (failed != g_ratec_failed) backlog = 100u; // a side refused a relay
+  g_ratec_failed = failed;
+  if (backlog > 100u) backlog = 100u;
+  g_rate_stats.load_pct = mon.load_pct;
+  g_rate_stats.backlog_pct = (uint8_t)backlog;
+  return (uint8_t)((mon.load_pct > backlog) ? mon.load_pct : backlog);
+}
+
+// The table for the current level; none at level 0 clears the sources'.
+static void rate_broadcast(void) {
+#ifdef TELEMETRY_CMD_ENDPOINT
+  uint8_t msg[4u + 4u * TELEMETRY_RATE_TYPES];
+  size_t n = 0;
+  msg[n++] = TELEMETRY_CMD_RATE;
+  msg[n++] = g_ratec_seq++;
+  msg[n++] = (uint8_t)TELEMETRY_RATE_HOLD_MS;
+  msg[n++] = (uint8_t)(TELEMETRY_RATE_HOLD_MS >> 8);
+  const uint32_t div = 1u << g_rate_stats.level;
+  for (uint8_t i = 0; g_rate_stats.level && i < g_ratec_count; i++) {
+    const uint16_t d = (div < g_ratec[i].decimate) ? (uint16_t)div
+                                                   : g_ratec[i].decimate;
+    msg[n++] = (uint8_t)g_ratec[i].type;
+    msg[n++] = (uint8_t)((uint32_t)g_ratec[i].type >> 8);
+    msg[n++] = (uint8_t)d;
+    msg[n++] = (uint8_t)(d >> 8);
+  }
+  if (log_telemetry_asynchronous(TELEMETRY_CMD_TYPE, msg, n, 1) == SEDS_OK)
+    g_rate_stats.broadcasts++;
+#endif
+}
+
+uint32_t telemetry_rate_poll(void) {
+  const uint64_t now = tx_raw_now_us() / 1000u; // not stepped by time sync
+  uint32_t wait = UINT32_MAX;
+
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (g_rate_count) {
+    if (now >= g_rate_until_ms) {
+      g_rate_count = 0; // the gateway stopped refreshing it
+      g_rate_stats.remote_types = 0;
+      g_rate_stats.remote_expired++;
+      agg_apply_level();
+    } else {
+      wait = (uint32_t)(g_rate_until_ms - now);
+    }
+  }
+  __set_PRIMASK(primask);
+
+  if (!g_ratec_count) return wait;
+  const uint8_t pressure = rate_pressure();
+  const uint8_t level = g_rate_stats.level;
+  uint8_t next = level;
+  if (pressure >= TELEMETRY_RATE_HIGH_PCT) {
+    if (level < TELEMETRY_RATE_MAX_LEVEL) next = (uint8_t)(level + 1u);
+    g_ratec_calm_ms = 0;
+  } else if (level && pressure < TELEMETRY_RATE_LOW_PCT) {
+    if (!g_ratec_calm_ms) {
+      g_ratec_calm_ms = now ? now : 1u;
+    } else if (now - g_ratec_calm_ms >= TELEMETRY_RATE_CALM_MS) {
+      next = (uint8_t)(level - 1u);
+      g_ratec_calm_ms = 0; // the next step waits out its own calm spell
+    }
+  } else {
+    g_ratec_calm_ms = 0;
+  }
+  if (next > level) g_rate_stats.step_downs++;
+  if (next < level) g_rate_stats.step_ups++;
+  g_rate_stats.level = next;
+  if (next || next != level) rate_broadcast();
+  return (wait < TELEMETRY_RATE_POLL_MS) ? wait : TELEMETRY_RATE_POLL_MS;
+}
+
+void telemetry_rate_get_stats(telemetry_rate_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_rate_stats;
+  __set_PRIMASK(primask);
+}
+
+/* ---------------- Memory pressure ----------------
+ * Left alone, an exhausted heap fails whichever packet allocates next. The
+ * monitor gives up the cheaper things first instead, in a fixed order, and
+ * keeps each until the pressure has calmed, so an overloaded gateway loses
+ * the same things every time. The actions are read where they apply
+ * (cap_start(), agg_apply_level(), class_admitted(), shed_age_us()); a
+ * change of level applies what needs doing at once. */
+static const uint8_t k_mem_mark[] = {
+    0u, TELEMETRY_MEM_CAPTURE_PCT, TELEMETRY_MEM_AGGR_PCT,
+    TELEMETRY_MEM_SHED_PCT, TELEMETRY_MEM_REASM_PCT};
+_Static_assert(sizeof(k_mem_mark) == TELEMETRY_MEM_REASM + 1u,
+               "a mark per level");
+
+static uint64_t g_mem_calm_ms; // pressure under the level's mark since, or 0
+static uint32_t g_mem_failed;  // rust_heap_failed_count() at the last poll
+static telemetry_mem_stats_t g_mem_stats;
+
+static void mem_apply(uint8_t level, uint8_t prev) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_mem_level = level;
+  g_mem_stats.level = level;
+  if ((level >= TELEMETRY_MEM_AGGR) != (prev >= TELEMETRY_MEM_AGGR))
+    agg_apply_level();
+  __set_PRIMASK(primask);
+#if TELEMETRY_CAPTURE_BYTES
+  if (level >= TELEMETRY_MEM_CAPTURE && g_cap_side >= 0) {
+    cap_stop();
+    g_mem_stats.captures_stopped++;
+  }
+#endif
+  if ((level >= TELEMETRY_MEM_REASM) != (prev >= TELEMETRY_MEM_REASM))
+    can_bus_set_reasm_low_limit(can_bus_get(TELEMETRY_CAN_BUS),
+                                (level >= TELEMETRY_MEM_REASM)
+                                    ? TELEMETRY_MEM_REASM_SLOTS
+                                    : 0u);
+}
+
+uint32_t telemetry_mem_poll(void) {
+  const uint64_t now = tx_raw_now_us() / 1000u; // not stepped by time sync
+  unsigned pressure = heap_fill_pct();
+  const uint32_t failed = rust_heap_failed_count();
+  if (failed != g_mem_failed) pressure = 100u; // an allocation failed
+  g_mem_failed = failed;
+  if (pressure > 100u) pressure = 100u;
+
+  const uint8_t level = g_mem_level;
+  uint8_t want = TELEMETRY_MEM_NORMAL;
+  while (want < TELEMETRY_MEM_REASM && pressure >= k_mem_mark[want + 1u])
+    want++;
+
+  uint8_t next = level;
+  if (want > level) {
+    next = want;
+    g_mem_calm_ms = 0;
+  } else if (level != TELEMETRY_MEM_NORMAL) {
+    if (pressure + TELEMETRY_MEM_HYST_PCT >= k_mem_mark[level]) {
+      g_mem_calm_ms = 0;
+    } else if (!g_mem_calm_ms) {
+      g_mem_calm_ms = now ? now : 1u;
+    } else if (now - g_mem_calm_ms >= TELEMETRY_MEM_CALM_MS) {
+      next = (uint8_t)(level - 1u);
+      g_mem_calm_ms = 0; // the next step waits out its own calm spell
+    }
+  }
+
+  g_mem_stats.pressure_pct = (uint8_t)pressure;
+  if (pressure > g_mem_stats.peak_pct) g_mem_stats.peak_pct = (uint8_t)pressure;
+  g_mem_stats.alloc_failed = failed;
+  if (next != level) {
+    if (next > level)
+      g_mem_stats.step_downs++;
+    else
+      g_mem_stats.step_ups++;
+    mem_apply(next, level);
+  }
+  return TELEMETRY_MEM_POLL_MS;
+}
+
+void telemetry_mem_get_stats(telemetry_mem_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *out = g_mem_stats;
+  __set_PRIMASK(primask);
+}
+
+/* ---------------- Intake ring ----------------
+ * Bounded MPSC queues (per-slot sequence numbers) between the asynchronous
+ * logging calls, from any thread or ISR, and the router, one per TX class
+ * (can_bus_tx_prio_t). A producer claims a slot by bumping its ring's head
+ * with LDREX/STREX, fills it and publishes it through the slot's seq;
+ * nothing blocks and nothing touches the router's lock.
+ * telemetry_intake_drain() is the only consumer.
+ *
+ *   seq == pos      free for the producer claiming position pos
+ *   seq == pos + 1  filled, the consumer may take it
+ * The raw us_clock_now() timestamp is taken at intake, so the drain delay
+ * doesn't show up in the packet, and mapped onto the router's timebase in
+ * the drain. Producers cost one claim, one memcpy and an event flag set,
+ * which is what makes log_telemetry_from_isr() cheap.
+ *
+ * The router's own TX queue is FIFO, so the drain does the prioritising:
+ * strict class order, except that a lower-class record older than
+ * TELEMETRY_INTAKE_AGE_MS goes first, and HIGH/MID records are sent at
+ * once in their CAN class instead of queueing behind bulk. */
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+_Static_assert((TELEMETRY_INTAKE_SLOTS & (TELEMETRY_INTAKE_SLOTS - 1u)) == 0,
+               "TELEMETRY_INTAKE_SLOTS must be a power of two");
+_Static_assert((TELEMETRY_INTAKE_PRIO_SLOTS &
+                (TELEMETRY_INTAKE_PRIO_SLOTS - 1u)) == 0 &&
+                   TELEMETRY_INTAKE_PRIO_SLOTS,
+               "TELEMETRY_INTAKE_PRIO_SLOTS must be a power of two");
+_Static_assert(TELEMETRY_INTAKE_DATA_MAX <= 255u,
+               "intake record length is 8 bits");
+
+typedef struct {
+  volatile uint32_t seq;
+  uint16_t type;     // SedsDataType
+  uint8_t len;       // bytes in data
+  uint8_t elem;      // element size | kind << 4; 0 = string
+  uint64_t raw_us;   // tx_raw_now_us() scale
+  uint8_t data[TELEMETRY_INTAKE_DATA_MAX];
+} intake_rec_t;
+
+typedef struct {
+  intake_rec_t *slots;
+  uint32_t mask;
+  volatile uint32_t head; // next position to claim
+  uint32_t tail;          // consumer only
+} intake_ring_t;
+
+static intake_rec_t g_intake_high[TELEMETRY_INTAKE_PRIO_SLOTS];
+static intake_rec_t g_intake_mid[TELEMETRY_INTAKE_PRIO_SLOTS];
+static intake_rec_t g_intake_low[TELEMETRY_INTAKE_SLOTS];
+static intake_ring_t g_intake[CAN_BUS_TX_PRIO_COUNT] = {
+    [CAN_BUS_TX_PRIO_HIGH] = {g_intake_high, TELEMETRY_INTAKE_PRIO_SLOTS - 1u},
+    [CAN_BUS_TX_PRIO_MID] = {g_intake_mid, TELEMETRY_INTAKE_PRIO_SLOTS - 1u},
+    [CAN_BUS_TX_PRIO_LOW] = {g_intake_low, TELEMETRY_INTAKE_SLOTS - 1u},
+};
+static volatile uint8_t g_intake_ready;
+static volatile uint32_t g_intake_queued;
+static volatile uint32_t g_intake_overflow;
+
+static void intake_init(void) {
+  if (g_intake_ready) return;
+  for (unsigned c = 0; c < CAN_BUS_TX_PRIO_COUNT; c++) {
+    intake_ring_t *q = &g_intake[c];
+    for (uint32_t i = 0; i <= q->mask; i++) q->slots[i].seq = i;
+    q->head = 0;
+    q->tail = 0;
+  }
+  (void)config_define(CONFIG_INTAKE_AGE_MS, TELEMETRY_INTAKE_AGE_MS, 1u,
+                      10000u, CONFIG_LIVE, NULL);
+  __DMB();
+  g_intake_ready = 1;
+}
+
+// Claim the next slot, or NULL when the ring is full.
+static intake_rec_t *intake_claim(intake_ring_t *q) {
+  for (;;) {
+    const uint32_t pos = __LDREXW(&q->head);
+    intake_rec_t *rec = &q->slots[pos & q->mask];
+    const int32_t dif = (int32_t)(rec->seq - pos);
+    if (dif < 0) { // consumer hasn't freed it yet (a full lap behind)
+      __CLREX();
+      return NULL;
+    }
+    if (dif > 0) { // another producer took pos; reload the head
+      __CLREX();
+      continue;
+    }
+    if (__STREXW(pos + 1u, &q->head) == 0u) {
+      __DMB();
+      return rec;
+    }
+  }
+}
+
+// Claim the `n` (at most a ring) records from the head on in one step;
+// 0 when the last of them isn't free yet. The consumer frees in order, so
+// the others are free too.
+static int intake_claim_n(intake_ring_t *q, uint32_t n, uint32_t *first) {
+  for (;;) {
+    const uint32_t pos = __LDREXW(&q->head);
+    const uint32_t last = pos + n - 1u;
+    const int32_t dif = (int32_t)(q->slots[last & q->mask].seq - last);
+    if (dif < 0) {
+      __CLREX();
+      return 0;
+    }
+    if (dif > 0) {
+      __CLREX();
+      continue;
+    }
+    if (__STREXW(pos + n, &q->head) == 0u) {
+      __DMB();
+      *first = pos;
+      return 1;
+    }
+  }
+}
+
+static int intake_fits(size_t len, size_t elem_size) {
+  return g_intake_ready && len <= TELEMETRY_INTAKE_DATA_MAX && elem_size <= 15u;
+}
+
+static void intake_set(intake_rec_t *rec, SedsDataType ty, size_t len,
+                       size_t elem_size, SedsElemKind kind, uint64_t raw_us) {
+  rec->type = (uint16_t)ty;
+  rec->len = (uint8_t)len;
+  rec->elem = (uint8_t)(elem_size | ((unsigned)kind << 4));
+  rec->raw_us = raw_us;
+}
+
+// Hand record `pos` (contents written) to the consumer.
+static void intake_publish(intake_rec_t *rec, uint32_t pos) {
+  __DMB(); // contents visible before the slot is
+  rec->seq = pos + 1u;
+}
+
+// Copy a sample or message in. SEDS_ERR if it doesn't fit a record (the
+// caller goes straight to the router), TELEMETRY_WOULD_BLOCK if the ring
+// was full.
+static SedsResult intake_push(SedsDataType ty, const void *data, size_t len,
+                              size_t elem_size, SedsElemKind kind,
+                              uint64_t raw_us) {
+  if (!intake_fits(len, elem_size))
+    return SEDS_ERR;
+  intake_rec_t *rec = intake_claim(&g_intake[tx_class_of(ty)]);
+  if (!rec) {
+    intake_count(&g_intake_overflow);
+    return TELEMETRY_WOULD_BLOCK;
+  }
+  const uint32_t pos = rec->seq;
+  intake_set(rec, ty, len, elem_size, kind, raw_us);
+  if (len) memcpy(rec->data, data, len);
+  intake_publish(rec, pos);
+  intake_count(&g_intake_queued);
+  telemetry_thread_notify(TELEMETRY_EVT_TX_QUEUED);
+  return SEDS_OK;
+}
+
+// Oldest published record of the class, or NULL.
+static intake_rec_t *intake_head(intake_ring_t *q) {
+  intake_rec_t *rec = &q->slots[q->tail & q->mask];
+  if (rec->seq != q->tail + 1u) return NULL; // empty, or still being filled
+  __DMB();
+  return rec;
+}
+
+static void intake_pop(intake_ring_t *q, intake_rec_t *rec) {
+  __DMB(); // done reading before the producers may reuse it
+  rec->seq = q->tail + q->mask + 1u;
+  q->tail++;
+}
+
+static inline uint64_t intake_age_us(const intake_rec_t *rec,
+                                     uint64_t now_raw) {
+  return (now_raw > rec->raw_us) ? now_raw - rec->raw_us : 0;
+}
+
+// Class to take from next among those the heap budget admits: an aged
+// lower-class head first, else the highest non-empty class. Records of
+// refused classes wait in their ring (which is what producers see as
+// TELEMETRY_WOULD_BLOCK once it fills) and are shed once stale. -1 when
+// nothing can go.
+static int intake_pick(uint64_t now_raw, unsigned pct) {
+  uint8_t ok[CAN_BUS_TX_PRIO_COUNT];
+  for (int c = CAN_BUS_TX_PRIO_HIGH; c < CAN_BUS_TX_PRIO_COUNT; c++) {
+    ok[c] = (uint8_t)class_admitted((can_bus_tx_prio_t)c, pct);
+    if (ok[c]) continue;
+    intake_rec_t *rec;
+    while ((rec = intake_head(&g_intake[c])) != NULL &&
+           intake_age_us(rec, now_raw) >=
+               shed_age_us((can_bus_tx_prio_t)c)) {
+      intake_pop(&g_intake[c], rec);
+      intake_count(&g_flow_shed);
+    }
+  }
+
+  int pick = -1;
+  uint64_t oldest = 0;
+  const uint64_t age_us = (uint64_t)config_get(CONFIG_INTAKE_AGE_MS) * 1000u;
+  for (int c = CAN_BUS_TX_PRIO_COUNT - 1; c > CAN_BUS_TX_PRIO_HIGH; c--) {
+    const intake_rec_t *rec = ok[c] ? intake_head(&g_intake[c]) : NULL;
+    if (!rec) continue;
+    const uint64_t age = intake_age_us(rec, now_raw);
+    if (age >= age_us && age > oldest) {
+      pick = c;
+      oldest = age;
+    }
+  }
+  if (pick >= 0) return pick;
+  for (int c = CAN_BUS_TX_PRIO_HIGH; c < CAN_BUS_TX_PRIO_COUNT; c++)
+    if (ok[c] && intake_head(&g_intake[c])) return c;
+  return -1;
+}
+
+// Hand one intake sample (elem_size 0: a message) of TX class `cls` to the
+// router, stamped with `raw_us`. Bulk joins the router's queue; the rest
+// goes out now in its class.
+static void intake_log(SedsDataType ty, int cls, uint64_t raw_us,
+                       const uint8_t *data, size_t len, size_t elem_size,
+                       SedsElemKind kind) {
+  const uint64_t node_ms = raw_to_node_us(raw_us) / 1000ULL;
+  const uint64_t ts =
+      (node_ms > g_router.start_time) ? node_ms - g_router.start_time : 0;
+  const int queue = (cls == CAN_BUS_TX_PRIO_LOW);
+  const uint8_t prev = g_can_tx_class;
+  g_can_tx_class = (uint8_t)cls;
+  g_trace_log_us = queue ? 0 : raw_to_node_us(raw_us);
+  SedsResult res = SEDS_ERR; // not logged
+  if (elem_size == 0) {
+    res = seds_router_log_string_ex(g_router.r, ty, (const char *)data, len,
+                                    &ts, queue);
+  } else {
+    const size_t count = len / elem_size;
+    uint8_t agg[TELEMETRY_AGG_MAX_ELEMS * 8u];
+    const agg_result_t a = agg_offer(ty, data, count, elem_size, kind, ts, agg);
+    const void *vals = (a == AGG_EMIT) ? agg : data;
+    if (a != AGG_DROP) {
+      series_offer(ty, vals, count, elem_size, kind, ts);
+      res = seds_router_log_typed_ex(g_router.r, ty, vals, count, elem_size,
+                                     kind, &ts, queue);
+    }
+  }
+  if (queue && res == SEDS_OK) qlat_put(TELEMETRY_QUEUE_TX);
+  g_trace_log_us = 0;
+  g_can_tx_class = prev;
+}
+
+/* ---------------- Sample blocks ----------------
+ * telemetry_block_get() hands out TELEMETRY_BLOCK_BYTES blocks of a ThreadX
+ * block pool (arena region "block"); the caller fills the data behind the
+ * header and telemetry_block_send() queues only the block's address on a
+ * TX_QUEUE. The queue holds as many messages as the pool has blocks, so a
+ * send never finds it full. The drain takes the queue in order: a head
+ * whose class the heap budget refuses waits (parked in g_block_head) and
+ * holds the blocks behind it, and is shed once older than
+ * TELEMETRY_SHED_AGE_MS, like the ring's records. */
+typedef struct {
+  uint64_t raw_us; // tx_raw_now_us() at the send
+  uint16_t type;   // SedsDataType
+  uint16_t len;    // bytes of data
+  uint8_t elem;    // element size | kind << 4
+  uint8_t pad[3];
+} block_hdr_t;
+
+_Static_assert(sizeof(block_hdr_t) == TELEMETRY_BLOCK_HDR_BYTES,
+               "block header size");
+_Static_assert(TELEMETRY_BLOCK_BYTES > TELEMETRY_BLOCK_HDR_BYTES &&
+                   TELEMETRY_BLOCK_BYTES % sizeof(ULONG) == 0,
+               "TELEMETRY_BLOCK_BYTES: whole words past the header");
+
+#define BLOCK_MSG_WORDS (sizeof(void *) / sizeof(ULONG))
 
-  if (g_can_side_id >= 0) {
-    (void)seds_router_rx_serialized_packet_to_queue_from_side(
-        g_router.r, (uint32_t)g_can_side_id, bytes, len);
-  } else {
-    (void)seds_router_rx_serialized_packet_to_queue(g_router.r, bytes, len);
+static MEM_ARENA(block) ULONG
+    g_block_mem[MEM_ARENA_BLOCKS_BYTES / sizeof(ULONG)];
+static ULONG g_block_q_mem[TELEMETRY_BLOCK_COUNT * BLOCK_MSG_WORDS];
+static TX_BLOCK_POOL g_block_pool;
+static TX_QUEUE g_block_q;
+static block_hdr_t *g_block_head; // consumer only
+static volatile uint8_t g_block_ready;
+static volatile uint32_t g_block_sent;
+static volatile uint32_t g_block_exhausted;
+
+static void block_init(void) {
+  if (g_block_ready) return;
+  if (tx_block_pool_create(&g_block_pool, "sample blocks",
+                           TELEMETRY_BLOCK_BYTES, g_block_mem,
+                           sizeof(g_block_mem)) != TX_SUCCESS ||
+      tx_queue_create(&g_block_q, "sample blocks", BLOCK_MSG_WORDS,
+                      g_block_q_mem, sizeof(g_block_q_mem)) != TX_SUCCESS) {
+    printf("Error: sample block pool\r\n");
+    return;
   }
-#endif
+  g_block_ready = 1;
 }
 
-static UNUSED_FUNCTION void rx_synchronous(const uint8_t *bytes, size_t len) {
-#ifndef TELEMETRY_ENABLED
-  (void)bytes;
-  (void)len;
-  return;
-#else
-  if (!bytes || len == 0) return;
+// Queued blocks, after the ring's records of the pass; returns how many it
+// took out of `max`.
+static size_t block_drain(size_t max, unsigned pct) {
+  size_t n = 0;
+  while (g_block_ready && n < max) {
+    if (!g_block_head) {
+      ULONG msg[BLOCK_MSG_WORDS];
+      if (tx_queue_receive(&g_block_q, msg, TX_NO_WAIT) != TX_SUCCESS) break;
+      memcpy(&g_block_head, msg, sizeof(g_block_head));
+    }
+    block_hdr_t *h = g_block_head;
+    const SedsDataType ty = (SedsDataType)h->type;
+    const can_bus_tx_prio_t cls = tx_class_of(ty);
+    if (class_admitted(cls, pct)) {
+      intake_log(ty, (int)cls, h->raw_us, (const uint8_t *)(h + 1), h->len,
+                 h->elem & 0x0Fu, (SedsElemKind)(h->elem >> 4));
+      n++;
+    } else if ((tx_raw_now_us() > h->raw_us ? tx_raw_now_us() - h->raw_us
+                                             : 0) < shed_age_us(cls)) {
+      break; // wait for the budget
+    } else {
+      intake_count(&g_flow_shed);
+    }
+    g_block_head = NULL;
+    (void)tx_block_release(h);
+  }
+  return n;
+}
+#endif
 
+size_t telemetry_intake_drain(size_t max) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
   if (!g_router.r) {
-    if (init_telemetry_router() != SEDS_OK) return;
+    if (init_telemetry_router() != SEDS_OK) return 0;
   }
-
-  if (g_can_side_id >= 0) {
-    (void)seds_router_receive_serialized_from_side(
-        g_router.r, (uint32_t)g_can_side_id, bytes, len);
-  } else {
-    (void)seds_router_receive_serialized(g_router.r, bytes, len);
+  size_t n = 0;
+  int cls;
+  while (n < max &&
+         (cls = intake_pick(tx_raw_now_us(), heap_fill_pct())) >= 0) {
+    intake_ring_t *q = &g_intake[cls];
+    intake_rec_t *rec = intake_head(q);
+    intake_log((SedsDataType)rec->type, cls, rec->raw_us, rec->data,
+               rec->len, rec->elem & 0x0Fu, (SedsElemKind)(rec->elem >> 4));
+    intake_pop(q, rec);
+    n++;
   }
+  n += block_drain(max - n, heap_fill_pct());
+  rx_pause_update(heap_fill_pct());
+  return n;
+#else
+  (void)max;
+  return 0;
 #endif
 }
 
-/* ---------------- Time sync request/announce ---------------- */
-static uint64_t g_timesync_seq = 1;
-
-SedsResult telemetry_timesync_request(void) {
-#ifndef TELEMETRY_ENABLED
-  return SEDS_OK;
-#else
-#if TELEMETRY_TIME_MASTER
-  // Master doesn't request.
-  return SEDS_OK;
+SedsResult log_telemetry_from_isr_at(SedsDataType data_type, const void *data,
+                                     size_t element_count, size_t element_size,
+                                     uint64_t raw_us) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  if (!data || element_count == 0 || element_size == 0) return SEDS_BAD_ARG;
+  if (element_count > TELEMETRY_INTAKE_DATA_MAX / element_size)
+    return SEDS_BAD_ARG;
+  return intake_push(data_type, data, element_count * element_size,
+                     element_size, guess_kind_from_elem_size(element_size),
+                     raw_us);
 #else
-  if (!g_router.r) {
-    if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
-  }
+  (void)data_type;
+  (void)data;
+  (void)element_count;
+  (void)element_size;
+  (void)raw_us;
+  return SEDS_ERR;
+#endif
+}
 
-  const uint64_t t1 = tx_raw_now_ms(NULL);
-  const uint64_t req[2] = { g_timesync_seq++, t1 };
+SedsResult log_telemetry_from_isr(SedsDataType data_type, const void *data,
+                                  size_t element_count, size_t element_size) {
+  return log_telemetry_from_isr_at(data_type, data, element_count,
+                                   element_size, tx_raw_now_us());
+}
 
-  return seds_router_log_ts(g_router.r, SEDS_DT_TIME_SYNC_REQUEST, t1, req, 2);
-#endif
+void *telemetry_block_get(uint32_t wait_ticks) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  VOID *p = NULL;
+  if (!g_block_ready ||
+      tx_block_allocate(&g_block_pool, &p, (ULONG)wait_ticks) != TX_SUCCESS) {
+    intake_count(&g_block_exhausted);
+    return NULL;
+  }
+  return (block_hdr_t *)p + 1;
+#else
+  (void)wait_ticks;
+  return NULL;
 #endif
 }
 
-SedsResult telemetry_timesync_announce(uint64_t priority, uint64_t unix_ms) {
-#ifndef TELEMETRY_ENABLED
-  (void)priority;
-  (void)unix_ms;
-  return SEDS_OK;
+void telemetry_block_put(void *block) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  if (block) (void)tx_block_release((block_hdr_t *)block - 1);
 #else
-#if !TELEMETRY_TIME_MASTER
-  (void)priority;
-  (void)unix_ms;
+  (void)block;
+#endif
+}
+
+SedsResult telemetry_block_send(void *block, SedsDataType data_type,
+                                size_t element_count, size_t element_size,
+                                SedsElemKind kind) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  if (!block) return SEDS_BAD_ARG;
+  if (element_count == 0 || element_size == 0 || element_size > 8u ||
+      element_count > TELEMETRY_BLOCK_DATA_MAX / element_size) {
+    telemetry_block_put(block);
+    return SEDS_BAD_ARG;
+  }
+  block_hdr_t *h = (block_hdr_t *)block - 1;
+  h->raw_us = tx_raw_now_us();
+  h->type = (uint16_t)data_type;
+  h->len = (uint16_t)(element_count * element_size);
+  h->elem = (uint8_t)(element_size | ((unsigned)kind << 4));
+  ULONG msg[BLOCK_MSG_WORDS];
+  memcpy(msg, &h, sizeof(h));
+  if (tx_queue_send(&g_block_q, msg, TX_NO_WAIT) != TX_SUCCESS) {
+    (void)tx_block_release(h); // a block not from telemetry_block_get()
+    return SEDS_ERR;
+  }
+  intake_count(&g_block_sent);
+  telemetry_thread_notify(TELEMETRY_EVT_TX_QUEUED);
   return SEDS_OK;
 #else
-  if (!g_router.r) {
-    if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
-  }
-
-  // Announce unix_ms from master (and priority for master election if you want it)
-  const uint64_t t = tx_raw_now_ms(NULL);
-  const uint64_t announce[2] = {priority, unix_ms};
-
-  return seds_router_log_ts(g_router.r, SEDS_DT_TIME_SYNC_ANNOUNCE, t, announce, 2);
+  (void)block;
+  (void)data_type;
+  (void)element_count;
+  (void)element_size;
+  (void)kind;
+  return SEDS_ERR;
 #endif
+}
+
+void telemetry_block_get_stats(uint32_t *sent, uint32_t *exhausted) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  if (sent) *sent = g_block_sent;
+  if (exhausted) *exhausted = g_block_exhausted;
+#else
+  if (sent) *sent = 0;
+  if (exhausted) *exhausted = 0;
 #endif
 }
 
-/* ---------------- Router init (idempotent) ---------------- */
-SedsResult init_telemetry_router(void) {
-#ifndef TELEMETRY_ENABLED
-  return SEDS_OK;
+void telemetry_intake_get_stats(uint32_t *queued, uint32_t *overflow) {
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  if (queued) *queued = g_intake_queued;
+  if (overflow) *overflow = g_intake_overflow;
 #else
-  if (g_router.created && g_router.r) return SEDS_OK;
+  if (queued) *queued = 0;
+  if (overflow) *overflow = 0;
+#endif
+}
 
-  if (!g_can_rx_subscribed) {
-    if (can_bus_subscribe_rx(telemetry_can_rx, NULL) == HAL_OK) {
-      g_can_rx_subscribed = 1;
-    } else {
-      printf("Error: can_bus_subscribe_rx failed\r\n");
-    }
-  }
+// The last summary collected, for readers that shouldn't collect their own
+// (telemetry_health_last(), HEALTH_GET).
+static telemetry_health_t g_health_last;
+static seqlock_t g_health_seq = SEQLOCK_INIT;
 
-  const SedsLocalEndpointDesc locals[] = {
-      {
-          .endpoint = (uint32_t)SEDS_EP_SD_CARD,
-          .packet_handler = on_sd_packet,
-          .serialized_handler = NULL,
-          .user = NULL,
-      },
-      {
-          .endpoint = (uint32_t)SEDS_EP_TIME_SYNC,
-          .packet_handler = on_timesync,
-          .serialized_handler = NULL,
-          .user = NULL,
-      },
-  };
+static uint32_t health_pm(uint16_t pm) {
+  return (pm == CPU_LOAD_UNKNOWN) ? UINT32_MAX : pm;
+}
 
-  SedsRouter *r = seds_router_new(
-      // Master should be relay too (so it forwards non-local packets),
-      // unless you truly want it to sink everything.
-      Seds_RM_Relay,
-      node_now_since_ms,
-      NULL,
-      locals,
-      (size_t)(sizeof(locals) / sizeof(locals[0])));
+void telemetry_health_collect(telemetry_health_t *out) {
+  if (!out) return;
+  memset(out, 0, sizeof(*out));
+  out->version = TELEMETRY_HEALTH_VERSION;
+  out->uptime_s = (uint32_t)(tx_raw_now_us() / 1000000ULL);
 
-  if (!r) {
-    printf("Error: failed to create router\r\n");
-    g_router.r = NULL;
-    g_router.created = 0;
-    g_can_side_id = -1;
-    return SEDS_ERR;
-  }
+  out->cpu_idle_pm = health_pm(cpu_load_idle_permille());
+  out->cpu_isr_pm = health_pm(cpu_load_isr_permille());
+  out->cpu_rx_pm = health_pm(cpu_load_thread_permille(&telemetry_rx_thread));
+  out->cpu_tx_pm = health_pm(cpu_load_thread_permille(&telemetry_tx_thread));
+  out->cpu_maint_pm =
+      health_pm(cpu_load_thread_permille(&telemetry_maint_thread));
 
-  g_can_side_id = seds_router_add_side_serialized(
-      r, "can", 3, tx_send, NULL, false);
+  rust_heap_stats_t hs;
+  rust_heap_get_stats(&hs);
+  out->heap_live = hs.live_bytes;
+  out->heap_peak = hs.peak_bytes;
+  out->heap_failed = hs.failed_count;
 
-  if (g_can_side_id < 0) {
-    printf("Error: failed to add CAN side: %ld\r\n", (long)g_can_side_id);
-    g_can_side_id = -1;
+  can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+  for (unsigned f = 0; f < 2u; f++) {
+    can_bus_rx_ring_stats_t rs;
+    if (can_bus_get_rx_ring_stats(bus, (can_bus_rx_fifo_t)f, &rs) != HAL_OK)
+      continue;
+    if (rs.high_water_bytes > out->rx_ring_hw_bytes)
+      out->rx_ring_hw_bytes = rs.high_water_bytes;
+    out->rx_ring_dropped += rs.dropped;
+  }
+  can_bus_id_stats_t ids[8];
+  uint32_t untracked = 0;
+  const size_t nids = can_bus_get_all_id_stats(
+      bus, ids, sizeof(ids) / sizeof(ids[0]), &untracked);
+  for (size_t i = 0; i < nids; i++) {
+    out->reasm_done += ids[i].msgs_completed;
+    out->reasm_expired += ids[i].msgs_expired + ids[i].msgs_evicted;
   }
 
-  g_router.r = r;
-  g_router.created = 1;
-  g_router.start_time = telemetry_now_ms();
+#if defined(TELEMETRY_ENABLED) && TELEMETRY_INTAKE_SLOTS
+  out->intake_high = g_intake[CAN_BUS_TX_PRIO_HIGH].head -
+                     g_intake[CAN_BUS_TX_PRIO_HIGH].tail;
+  out->intake_mid = g_intake[CAN_BUS_TX_PRIO_MID].head -
+                    g_intake[CAN_BUS_TX_PRIO_MID].tail;
+  out->intake_low = g_intake[CAN_BUS_TX_PRIO_LOW].head -
+                    g_intake[CAN_BUS_TX_PRIO_LOW].tail;
+#endif
+  out->queue_heap_pct = heap_fill_pct();
+
+  can_bus_monitor_t mon;
+  can_bus_get_monitor(bus, &mon);
+  out->can_load_pct = mon.load_pct;
+  out->can_tec = mon.tec;
+  out->can_rec = mon.rec;
+  out->can_state = mon.state;
 
 #if TELEMETRY_TIME_MASTER
-  // master offset stays 0
-  g_master_offset_ms = 0;
+  out->ts_offset_us = UINT32_MAX;
+  out->ts_delay_us = UINT32_MAX;
+  out->ts_locked = UINT32_MAX;
+#else
+  telemetry_timesync_stats_t ts;
+  telemetry_timesync_get_stats(&ts);
+  int64_t off = ts.last_offset_us;
+  if (off > INT32_MAX) off = INT32_MAX;
+  if (off < INT32_MIN) off = INT32_MIN;
+  out->ts_offset_us = (uint32_t)(int32_t)off;
+  out->ts_delay_us = (ts.last_delay_us > UINT32_MAX - 1u)
+                         ? UINT32_MAX - 1u
+                         : (uint32_t)ts.last_delay_us;
+  out->ts_locked = ts.locked;
 #endif
 
-  return SEDS_OK;
-#endif
+  // Each side's block is a telemetry_side_stats_t, field for field.
+  _Static_assert(offsetof(telemetry_health_t, usb_rx_pkts) -
+                         offsetof(telemetry_health_t, can_rx_pkts) ==
+                     sizeof(telemetry_side_stats_t),
+                 "health side block must match telemetry_side_stats_t");
+  for (unsigned s = 0; s <= TELEMETRY_SIDE_UART; s++) {
+    telemetry_side_stats_t ss;
+    telemetry_side_get_stats((telemetry_side_t)s, &ss);
+    memcpy((uint8_t *)out + offsetof(telemetry_health_t, can_rx_pkts) +
+               s * sizeof(ss),
+           &ss, sizeof(ss));
+  }
+
+  telemetry_trace_stats_t tr;
+  (void)telemetry_trace_get_stats(TELEMETRY_TRACE_ALL, 0, &tr);
+  out->trace_n = tr.samples;
+  out->trace_p50_us = tr.p50_us;
+  out->trace_p99_us = tr.p99_us;
+  out->trace_max_us = tr.max_us;
+
+  can_bus_rx_lat_stats_t lat;
+  if (can_bus_get_rx_lat_stats(bus, CAN_BUS_RX_FIFO0, &lat) == HAL_OK) {
+    out->rxlat_hi_p99_us = lat.p99_us;
+    out->rxlat_hi_max_us = lat.max_us;
+  }
+  if (can_bus_get_rx_lat_stats(bus, CAN_BUS_RX_FIFO1, &lat) == HAL_OK) {
+    out->rxlat_p99_us = lat.p99_us;
+    out->rxlat_max_us = lat.max_us;
+  }
+
+  // Collected from the maintenance and RX threads: masked so the two
+  // writers of the snapshot don't interleave.
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  seqlock_write_begin(&g_health_seq);
+  g_health_last = *out;
+  seqlock_write_end(&g_health_seq);
+  __set_PRIMASK(primask);
 }
 
-/* ---------------- Logging APIs ---------------- */
-static inline SedsElemKind guess_kind_from_elem_size(size_t elem_size) {
-  if (elem_size == 4 || elem_size == 8) return SEDS_EK_FLOAT;
-  return SEDS_EK_UNSIGNED;
+int telemetry_health_last(telemetry_health_t *out) {
+  if (!out) return 0;
+  if (g_health_last.version != 0 &&
+      seqlock_read(&g_health_seq, out, &g_health_last, sizeof(*out)))
+    return 1;
+  memset(out, 0, sizeof(*out));
+  return 0;
 }
 
-SedsResult log_telemetry_synchronous(SedsDataType data_type, const void *data,
-                                     size_t element_count, size_t element_size) {
+// Kind and count known at compile time (LOG_TELEMETRY* in telemetry.h):
+// nothing left to guess or check here.
+SedsResult log_telemetry_typed_synchronous(SedsDataType data_type,
+                                           const void *data,
+                                           size_t element_count,
+                                           size_t element_size,
+                                           SedsElemKind kind) {
 #ifdef TELEMETRY_ENABLED
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
-  if (!data || element_count == 0 || element_size == 0) return SEDS_BAD_ARG;
-
-  const SedsElemKind kind = guess_kind_from_elem_size(element_size);
-
+  uint8_t agg[TELEMETRY_AGG_MAX_ELEMS * 8u];
+  switch (agg_offer(data_type, data, element_count, element_size, kind,
+                    node_now_since_ms(NULL), agg)) {
+  case AGG_DROP: return SEDS_OK;
+  case AGG_EMIT: data = agg; break;
+  case AGG_PASS: break;
+  }
+  series_offer(data_type, data, element_count, element_size, kind,
+               node_now_since_ms(NULL));
   return seds_router_log_typed_ex(g_router.r, data_type, data, element_count,
                                  element_size, kind, NULL, 0);
 #else
   (void)data_type;
+  (void)kind;
   print_data_no_telem((void *)data, element_count * element_size);
   return SEDS_OK;
 #endif
 }
 
-SedsResult log_telemetry_asynchronous(SedsDataType data_type, const void *data,
-                                      size_t element_count, size_t element_size) {
+SedsResult log_telemetry_typed_asynchronous(SedsDataType data_type,
+                                            const void *data,
+                                            size_t element_count,
+                                            size_t element_size,
+                                            SedsElemKind kind) {
 #ifdef TELEMETRY_ENABLED
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
+#if TELEMETRY_INTAKE_SLOTS
+  if (element_count <= TELEMETRY_INTAKE_DATA_MAX / element_size) {
+    const SedsResult res = intake_push(data_type, data,
+                                       element_count * element_size,
+                                       element_size, kind, tx_raw_now_us());
+    if (res != SEDS_ERR) return res;
+  }
+#endif
+  if (!class_admitted(tx_class_of(data_type), heap_fill_pct())) {
+    intake_count(&g_flow_blocked);
+    return TELEMETRY_WOULD_BLOCK;
+  }
+  uint8_t agg[TELEMETRY_AGG_MAX_ELEMS * 8u];
+  switch (agg_offer(data_type, data, element_count, element_size, kind,
+                    node_now_since_ms(NULL), agg)) {
+  case AGG_DROP: return SEDS_OK;
+  case AGG_EMIT: data = agg; break;
+  case AGG_PASS: break;
+  }
+  series_offer(data_type, data, element_count, element_size, kind,
+               node_now_since_ms(NULL));
+  return notify_queued(seds_router_log_typed_ex(
+      g_router.r, data_type, data, element_count, element_size, kind, NULL, 1));
+#else
+  (void)data_type;
+  (void)kind;
+  print_data_no_telem((void *)data, element_count * element_size);
+  return SEDS_OK;
+#endif
+}
+
+SedsResult log_telemetry_synchronous(SedsDataType data_type, const void *data,
+                                     size_t element_count, size_t element_size) {
   if (!data || element_count == 0 || element_size == 0) return SEDS_BAD_ARG;
+  return log_telemetry_typed_synchronous(
+      data_type, data, element_count, element_size,
+      guess_kind_from_elem_size(element_size));
+}
 
-  const SedsElemKind kind = guess_kind_from_elem_size(element_size);
+SedsResult log_telemetry_asynchronous(SedsDataType data_type, const void *data,
+                                      size_t element_count, size_t element_size) {
+  if (!data || element_count == 0 || element_size == 0) return SEDS_BAD_ARG;
+  return log_telemetry_typed_asynchronous(
+      data_type, data, element_count, element_size,
+      guess_kind_from_elem_size(element_size));
+}
 
-  return seds_router_log_typed_ex(g_router.r, data_type, data, element_count,
-                                 element_size, kind, NULL, 1);
+/* ---------------- Batches ----------------
+ * log_telemetry_batch() checks the router, reads the heap budget and wakes
+ * the TX thread once per call. Asynchronous items that fit intake records
+ * go in runs: consecutive ones of the same TX class claim all their records
+ * with one update of the ring head, so a run is queued whole or refused
+ * whole. With TELEMETRY_BATCH_PACK, consecutive items of the same type and
+ * element shape become one record or packet (stamped with the first),
+ * up to TELEMETRY_BATCH_PACK_BYTES. */
+#ifdef TELEMETRY_ENABLED
+// End of the unit that starts at items[i], and its bytes in *len.
+static size_t batch_unit(const telemetry_batch_item_t *items, size_t n,
+                         size_t i, unsigned flags, size_t *len) {
+  const telemetry_batch_item_t *a = &items[i];
+  size_t bytes = a->count * a->size;
+  size_t j = i + 1u;
+  while ((flags & TELEMETRY_BATCH_PACK) && j < n &&
+         items[j].type == a->type && items[j].size == a->size &&
+         items[j].kind == a->kind &&
+         bytes + items[j].count * items[j].size <= TELEMETRY_BATCH_PACK_BYTES) {
+    bytes += items[j].count * items[j].size;
+    j++;
+  }
+  *len = bytes;
+  return j;
+}
+
+static void batch_copy(uint8_t *dst, const telemetry_batch_item_t *items,
+                       size_t i, size_t j) {
+  for (; i < j; i++) {
+    const size_t len = items[i].count * items[i].size;
+    memcpy(dst, items[i].data, len);
+    dst += len;
+  }
+}
+
+// Unit items[i..j) straight to the router, stamped at `raw_us`.
+static SedsResult batch_router(const telemetry_batch_item_t *items, size_t i,
+                               size_t j, size_t len, uint64_t raw_us,
+                               int queue) {
+  const telemetry_batch_item_t *a = &items[i];
+  uint8_t pack[TELEMETRY_BATCH_PACK_BYTES];
+  const void *data = a->data;
+  if (j - i > 1u) {
+    batch_copy(pack, items, i, j);
+    data = pack;
+  }
+  const size_t count = len / a->size;
+  const uint64_t node_ms = raw_to_node_us(raw_us) / 1000ULL;
+  const uint64_t ts =
+      (node_ms > g_router.start_time) ? node_ms - g_router.start_time : 0;
+  uint8_t agg[TELEMETRY_AGG_MAX_ELEMS * 8u];
+  switch (agg_offer(a->type, data, count, a->size, a->kind, ts, agg)) {
+  case AGG_DROP: return SEDS_OK;
+  case AGG_EMIT: data = agg; break;
+  case AGG_PASS: break;
+  }
+  series_offer(a->type, data, count, a->size, a->kind, ts);
+  const SedsResult res = seds_router_log_typed_ex(
+      g_router.r, a->type, data, count, a->size, a->kind, &ts, queue);
+  if (queue && res == SEDS_OK) qlat_put(TELEMETRY_QUEUE_TX);
+  return res;
+}
+
+#if TELEMETRY_INTAKE_SLOTS
+// The run of units from items[*i] that go to `cls`'s ring, queued with one
+// claim; *i moves past it.
+static SedsResult batch_intake(const telemetry_batch_item_t *items, size_t n,
+                               size_t *i, unsigned flags, uint64_t now) {
+  const can_bus_tx_prio_t cls = tx_class_of(items[*i].type);
+  intake_ring_t *q = &g_intake[cls];
+  uint32_t units = 0;
+  size_t end = *i;
+  while (end < n && units <= q->mask) {
+    size_t len;
+    const size_t e = batch_unit(items, n, end, flags, &len);
+    if (tx_class_of(items[end].type) != cls ||
+        !intake_fits(len, items[end].size))
+      break;
+    end = e;
+    units++;
+  }
+  const size_t start = *i;
+  *i = end;
+
+  uint32_t pos;
+  if (!intake_claim_n(q, units, &pos)) {
+    intake_add(&g_intake_overflow, units);
+    return TELEMETRY_WOULD_BLOCK;
+  }
+  for (size_t k = start; k < end; pos++) {
+    size_t len;
+    const size_t e = batch_unit(items, n, k, flags, &len);
+    const telemetry_batch_item_t *a = &items[k];
+    intake_rec_t *rec = &q->slots[pos & q->mask];
+    intake_set(rec, a->type, len, a->size, a->kind,
+               a->raw_us ? a->raw_us : now);
+    batch_copy(rec->data, items, k, e);
+    intake_publish(rec, pos);
+    k = e;
+  }
+  intake_add(&g_intake_queued, units);
+  return SEDS_OK;
+}
+#endif
+#endif
+
+SedsResult log_telemetry_batch(const telemetry_batch_item_t *items, size_t n,
+                               unsigned flags) {
+  if (!items || n == 0) return SEDS_BAD_ARG;
+  for (size_t i = 0; i < n; i++) {
+    if (!items[i].data || items[i].count == 0 || items[i].size == 0)
+      return SEDS_BAD_ARG;
+  }
+#ifdef TELEMETRY_ENABLED
+  if (!g_router.r) {
+    if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
+  }
+  const int sync = (flags & TELEMETRY_BATCH_SYNC) != 0;
+  const uint64_t now = tx_raw_now_us();
+  const unsigned pct = sync ? 0u : heap_fill_pct();
+  SedsResult first = SEDS_OK;
+  int queued = 0;
+  size_t i = 0;
+  while (i < n) {
+    const telemetry_batch_item_t *a = &items[i];
+    size_t len;
+    const size_t j = batch_unit(items, n, i, flags, &len);
+    SedsResult res;
+#if TELEMETRY_INTAKE_SLOTS
+    if (!sync && intake_fits(len, a->size)) {
+      res = batch_intake(items, n, &i, flags, now);
+      if (res == SEDS_OK) queued = 1;
+      if (res != SEDS_OK && first == SEDS_OK) first = res;
+      continue;
+    }
+#endif
+    const uint64_t raw = a->raw_us ? a->raw_us : now;
+    if (sync) {
+      res = batch_router(items, i, j, len, raw, 0);
+    } else if (!class_admitted(tx_class_of(a->type), pct)) {
+      intake_count(&g_flow_blocked);
+      res = TELEMETRY_WOULD_BLOCK;
+    } else {
+      res = batch_router(items, i, j, len, raw, 1);
+      if (res == SEDS_OK) queued = 1;
+    }
+    if (res != SEDS_OK && first == SEDS_OK) first = res;
+    i = j;
+  }
+  if (queued) telemetry_thread_notify(TELEMETRY_EVT_TX_QUEUED);
+  return first;
 #else
-  (void)data_type;
-  print_data_no_telem((void *)data, element_count * element_size);
+  (void)flags;
+  for (size_t i = 0; i < n; i++)
+    print_data_no_telem((void *)items[i].data, items[i].count * items[i].size);
   return SEDS_OK;
 #endif
 }
@@ -472,7 +7106,20 @@ SedsResult dispatch_tx_queue(void) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
-  return seds_router_process_tx_queue(g_router.r);
+  // Resume with what the last pass left parked; the router's queue stays
+  // put until that is out.
+  if (tx_park_flush_all() != HAL_OK) return TELEMETRY_WOULD_BLOCK;
+  const uint32_t mark = qlat_mark(TELEMETRY_QUEUE_TX);
+  const uint64_t t0 = tx_raw_now_us();
+  PROF_START(proc);
+  DBG_MARK_HI(ROUTER_DISPATCH);
+  ITM_TRACE(ITM_EV_ROUTER_IN, ITM_ROUTER_TX);
+  const SedsResult res = seds_router_process_tx_queue(g_router.r);
+  ITM_TRACE(ITM_EV_ROUTER_OUT, ITM_ROUTER_TX);
+  DBG_MARK_LO(ROUTER_DISPATCH);
+  PROF_STOP(proc, PROF_ROUTER_PROCESS);
+  qlat_pass(TELEMETRY_QUEUE_TX, mark, t0, UINT64_MAX, res);
+  return res;
 #endif
 }
 
@@ -483,7 +7130,15 @@ SedsResult process_rx_queue(void) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
-  return seds_router_process_rx_queue(g_router.r);
+  const uint32_t mark = qlat_mark(TELEMETRY_QUEUE_RX);
+  const uint64_t t0 = tx_raw_now_us();
+  PROF_START(proc);
+  ITM_TRACE(ITM_EV_ROUTER_IN, ITM_ROUTER_RX);
+  const SedsResult res = seds_router_process_rx_queue(g_router.r);
+  ITM_TRACE(ITM_EV_ROUTER_OUT, ITM_ROUTER_RX);
+  PROF_STOP(proc, PROF_ROUTER_PROCESS);
+  qlat_pass(TELEMETRY_QUEUE_RX, mark, t0, UINT64_MAX, res);
+  return res;
 #endif
 }
 
@@ -494,7 +7149,20 @@ SedsResult dispatch_tx_queue_timeout(uint32_t timeout_ms) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
-  return seds_router_process_tx_queue_with_timeout(g_router.r, timeout_ms);
+  // Resume with what the last pass left parked; the router's queue stays
+  // put until that is out.
+  if (tx_park_flush_all() != HAL_OK) return TELEMETRY_WOULD_BLOCK;
+  const uint32_t mark = qlat_mark(TELEMETRY_QUEUE_TX);
+  const uint64_t t0 = tx_raw_now_us();
+  PROF_START(proc);
+  DBG_MARK_HI(ROUTER_DISPATCH);
+  ITM_TRACE(ITM_EV_ROUTER_IN, ITM_ROUTER_TX);
+  const SedsResult res = seds_router_process_tx_queue_with_timeout(g_router.r, timeout_ms);
+  ITM_TRACE(ITM_EV_ROUTER_OUT, ITM_ROUTER_TX);
+  DBG_MARK_LO(ROUTER_DISPATCH);
+  PROF_STOP(proc, PROF_ROUTER_PROCESS);
+  qlat_pass(TELEMETRY_QUEUE_TX, mark, t0, (uint64_t)timeout_ms * 1000u, res);
+  return res;
 #endif
 }
 
@@ -505,7 +7173,16 @@ SedsResult process_rx_queue_timeout(uint32_t timeout_ms) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
-  return seds_router_process_rx_queue_with_timeout(g_router.r, timeout_ms);
+  rx_pause_update(heap_fill_pct());
+  const uint32_t mark = qlat_mark(TELEMETRY_QUEUE_RX);
+  const uint64_t t0 = tx_raw_now_us();
+  PROF_START(proc);
+  ITM_TRACE(ITM_EV_ROUTER_IN, ITM_ROUTER_RX);
+  const SedsResult res = seds_router_process_rx_queue_with_timeout(g_router.r, timeout_ms);
+  ITM_TRACE(ITM_EV_ROUTER_OUT, ITM_ROUTER_RX);
+  PROF_STOP(proc, PROF_ROUTER_PROCESS);
+  qlat_pass(TELEMETRY_QUEUE_RX, mark, t0, (uint64_t)timeout_ms * 1000u, res);
+  return res;
 #endif
 }
 
@@ -516,11 +7193,196 @@ SedsResult process_all_queues_timeout(uint32_t timeout_ms) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
-  return seds_router_process_all_queues_with_timeout(g_router.r, timeout_ms);
+  const uint32_t rx_mark = qlat_mark(TELEMETRY_QUEUE_RX);
+  const uint32_t tx_mark = qlat_mark(TELEMETRY_QUEUE_TX);
+  const uint64_t t0 = tx_raw_now_us();
+  PROF_START(proc);
+  ITM_TRACE(ITM_EV_ROUTER_IN, ITM_ROUTER_ALL);
+  const SedsResult res = seds_router_process_all_queues_with_timeout(g_router.r, timeout_ms);
+  ITM_TRACE(ITM_EV_ROUTER_OUT, ITM_ROUTER_ALL);
+  PROF_STOP(proc, PROF_ROUTER_PROCESS);
+  qlat_pass(TELEMETRY_QUEUE_RX, rx_mark, t0, (uint64_t)timeout_ms * 1000u, res);
+  qlat_pass(TELEMETRY_QUEUE_TX, tx_mark, t0, (uint64_t)timeout_ms * 1000u, res);
+  return res;
+#endif
+}
+
+/* ---------------- Error logging ----------------
+ * Rate limits, so an error repeating in a loop can't flood the bus: each
+ * call site, told apart by its format string (or deferred format ID), may
+ * send TELEMETRY_ERR_SITE_BURST messages per TELEMETRY_ERR_SITE_WINDOW_MS.
+ * Calls past that are counted and return before any formatting; once the
+ * window is over, telemetry_error_poll() sends "<n> repeats suppressed:
+ * <format>" for the site. A token bucket (TELEMETRY_ERR_BYTES_PER_S, burst
+ * TELEMETRY_ERR_BURST_BYTES) caps all error messages together, summaries
+ * included; messages over it count as suppressed at their site. The site
+ * table reuses the least recently used entry, preferring one with nothing
+ * to report. */
+#define ERR_KEY_DEFERRED 0xFFFF0000u // | format ID; flash never gets there
+#define ERR_PKT_OVERHEAD 16u         // router header, charged per message
+
+typedef struct {
+  uintptr_t key;       // format string address, or ERR_KEY_DEFERRED | ID
+  const char *fmt;     // for the summary; NULL for deferred formats
+  uint32_t window_ms;  // start of the current window
+  uint32_t last_ms;    // last call, for reuse
+  uint32_t sent;       // messages in the window
+  uint32_t suppressed; // since the last summary
+} err_site_t;
+
+static err_site_t g_err_sites[TELEMETRY_ERR_SITES];
+static int32_t g_err_tokens = (int32_t)TELEMETRY_ERR_BURST_BYTES;
+static uint32_t g_err_refill_ms;
+static uint32_t g_err_suppressed;
+static uint32_t g_err_capped;
+
+static inline uint32_t err_now_ms(void) {
+  return (uint32_t)(tx_raw_now_us() / 1000u);
+}
+
+// IRQs masked.
+static void err_refill(uint32_t now) {
+  const uint32_t add =
+      (uint32_t)((uint64_t)(now - g_err_refill_ms) * TELEMETRY_ERR_BYTES_PER_S /
+                 1000u);
+  if (add == 0) return; // keep the remainder for the next call
+  g_err_refill_ms = now;
+  const int64_t t = (int64_t)g_err_tokens + add;
+  g_err_tokens = (t > (int64_t)TELEMETRY_ERR_BURST_BYTES)
+                     ? (int32_t)TELEMETRY_ERR_BURST_BYTES
+                     : (int32_t)t;
+}
+
+// IRQs masked.
+static err_site_t *err_site(uintptr_t key, const char *fmt, uint32_t now) {
+  err_site_t *victim = NULL;
+  for (size_t i = 0; i < TELEMETRY_ERR_SITES; i++) {
+    err_site_t *s = &g_err_sites[i];
+    if (s->key == key) return s;
+    if (victim && !victim->key) continue; // a free entry beats any other
+    if (!victim || !s->key || (victim->suppressed && !s->suppressed) ||
+        (!victim->suppressed == !s->suppressed &&
+         (int32_t)(s->last_ms - victim->last_ms) < 0))
+      victim = s;
+  }
+  memset(victim, 0, sizeof(*victim)); // a pending count is lost with it
+  victim->key = key;
+  victim->fmt = fmt;
+  victim->window_ms = now;
+  return victim;
+}
+
+// Whether an error call may format and send its message.
+static int err_admit(uintptr_t key, const char *fmt) {
+  const uint32_t now = err_now_ms();
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  err_refill(now);
+  err_site_t *s = err_site(key, fmt, now);
+  s->last_ms = now;
+  if (now - s->window_ms >= TELEMETRY_ERR_SITE_WINDOW_MS && !s->suppressed) {
+    s->window_ms = now; // a pending count keeps its window for the poll
+    s->sent = 0;
+  }
+  int ok = 0;
+  if (s->sent >= TELEMETRY_ERR_SITE_BURST) {
+    s->suppressed++;
+    g_err_suppressed++;
+  } else if (g_err_tokens <= 0) {
+    s->suppressed++;
+    g_err_capped++;
+  } else {
+    s->sent++;
+    ok = 1;
+  }
+  __set_PRIMASK(primask);
+  return ok;
+}
+
+// Charge a message to the bucket; it may go into debt by one message.
+static void err_charge(size_t len) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_err_tokens -= (int32_t)(len + ERR_PKT_OVERHEAD);
+  __set_PRIMASK(primask);
+}
+
+#ifdef TELEMETRY_ENABLED
+static SedsResult log_error_string_async(const char *s, size_t len) {
+  err_charge(len);
+#if TELEMETRY_INTAKE_SLOTS
+  {
+    const SedsResult res = intake_push(SEDS_DT_GENERIC_ERROR, s, len, 0,
+                                       SEDS_EK_UNSIGNED, tx_raw_now_us());
+    if (res != SEDS_ERR) return res;
+  }
+#endif
+  if (!class_admitted(tx_class_of(SEDS_DT_GENERIC_ERROR), heap_fill_pct())) {
+    intake_count(&g_flow_blocked);
+    return TELEMETRY_WOULD_BLOCK;
+  }
+  return notify_queued(seds_router_log_string_ex(
+      g_router.r, SEDS_DT_GENERIC_ERROR, s, len, NULL, 1));
+}
+#endif
+
+uint32_t telemetry_error_poll(void) {
+#ifndef TELEMETRY_ENABLED
+  return UINT32_MAX;
+#else
+  uint32_t wait = UINT32_MAX;
+  for (size_t i = 0; i < TELEMETRY_ERR_SITES; i++) {
+    const uint32_t now = err_now_ms();
+    uint32_t count = 0;
+    uintptr_t key = 0;
+    const char *fmt = NULL;
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    err_refill(now);
+    err_site_t *s = &g_err_sites[i];
+    if (s->suppressed) {
+      const uint32_t age = now - s->window_ms;
+      if (age < TELEMETRY_ERR_SITE_WINDOW_MS) {
+        if (TELEMETRY_ERR_SITE_WINDOW_MS - age < wait)
+          wait = TELEMETRY_ERR_SITE_WINDOW_MS - age;
+      } else if (g_err_tokens <= 0) {
+        wait = 100u; // over the cap; retry when some has refilled
+      } else {
+        count = s->suppressed;
+        key = s->key;
+        fmt = s->fmt;
+        s->suppressed = 0;
+        s->sent = 0;
+        s->window_ms = now;
+      }
+    }
+    __set_PRIMASK(primask);
+    if (!count || !g_router.r) continue;
+
+    char buf[TELEMETRY_ERR_FMT_BYTES];
+    int n;
+    if (fmt) {
+      size_t flen = strcspn(fmt, "\r\n");
+      n = snprintf(buf, sizeof(buf), "%lu repeats suppressed: %.*s",
+                   (unsigned long)count, (int)flen, fmt);
+    } else {
+      n = snprintf(buf, sizeof(buf),
+                   "%lu repeats suppressed: deferred format 0x%04x",
+                   (unsigned long)count, (unsigned)(key & 0xFFFFu));
+    }
+    if (n < 0) continue;
+    if ((size_t)n >= sizeof(buf)) n = (int)sizeof(buf) - 1;
+    (void)log_error_string_async(buf, (size_t)n);
+  }
+  return wait;
 #endif
 }
 
-/* ---------------- Error logging ---------------- */
+void telemetry_error_get_stats(uint32_t *suppressed, uint32_t *capped) {
+  if (suppressed) *suppressed = g_err_suppressed;
+  if (capped) *capped = g_err_capped;
+}
+
 SedsResult log_error_asyncronous(const char *fmt, ...) {
 #ifndef TELEMETRY_ENABLED
   (void)fmt;
@@ -529,19 +7391,24 @@ SedsResult log_error_asyncronous(const char *fmt, ...) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
+  if (!err_admit((uintptr_t)fmt, fmt)) return SEDS_OK;
 
   va_list args;
   va_start(args, fmt);
 
+  char small[TELEMETRY_ERR_FMT_BYTES];
   va_list args_copy;
   va_copy(args_copy, args);
-  int len = vsnprintf(NULL, 0, fmt, args_copy);
+  int len = vsnprintf(small, sizeof(small), fmt, args_copy);
   va_end(args_copy);
 
   if (len < 0) {
     va_end(args);
-    const char *empty = "";
-    return seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, empty, 0, NULL, 1);
+    return log_error_string_async("", 0);
+  }
+  if ((size_t)len < sizeof(small)) {
+    va_end(args);
+    return log_error_string_async(small, (size_t)len);
   }
 
   if (len > 512) len = 512;
@@ -550,15 +7417,25 @@ SedsResult log_error_asyncronous(const char *fmt, ...) {
   int written = vsnprintf(buf, (size_t)len + 1, fmt, args);
   va_end(args);
 
-  if (written < 0) {
-    const char *empty = "";
-    return seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, empty, 0, NULL, 1);
-  }
-
-  return seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, buf, (size_t)written, NULL, 1);
+  if (written < 0) return log_error_string_async("", 0);
+  if (written > len) written = len;
+  return log_error_string_async(buf, (size_t)written);
 #endif
 }
 
+#ifdef TELEMETRY_ENABLED
+// Synchronous errors go out right away in the control class.
+static SedsResult log_error_string_sync(const char *s, size_t len) {
+  err_charge(len);
+  const uint8_t prev = g_can_tx_class;
+  g_can_tx_class = CAN_BUS_TX_PRIO_MID;
+  const SedsResult res =
+      seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, s, len, NULL, 0);
+  g_can_tx_class = prev;
+  return res;
+}
+#endif
+
 SedsResult log_error_syncronous(const char *fmt, ...) {
 #ifndef TELEMETRY_ENABLED
   (void)fmt;
@@ -567,19 +7444,24 @@ SedsResult log_error_syncronous(const char *fmt, ...) {
   if (!g_router.r) {
     if (init_telemetry_router() != SEDS_OK) return SEDS_ERR;
   }
+  if (!err_admit((uintptr_t)fmt, fmt)) return SEDS_OK;
 
   va_list args;
   va_start(args, fmt);
 
+  char small[TELEMETRY_ERR_FMT_BYTES];
   va_list args_copy;
   va_copy(args_copy, args);
-  int len = vsnprintf(NULL, 0, fmt, args_copy);
+  int len = vsnprintf(small, sizeof(small), fmt, args_copy);
   va_end(args_copy);
 
   if (len < 0) {
     va_end(args);
-    const char *empty = "";
-    return seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, empty, 0, NULL, 0);
+    return log_error_string_sync("", 0);
+  }
+  if ((size_t)len < sizeof(small)) {
+    va_end(args);
+    return log_error_string_sync(small, (size_t)len);
   }
 
   if (len > 512) len = 512;
@@ -588,15 +7470,34 @@ SedsResult log_error_syncronous(const char *fmt, ...) {
   int written = vsnprintf(buf, (size_t)len + 1, fmt, args);
   va_end(args);
 
-  if (written < 0) {
-    const char *empty = "";
-    return seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, empty, 0, NULL, 0);
-  }
-
-  return seds_router_log_string_ex(g_router.r, SEDS_DT_GENERIC_ERROR, buf, (size_t)written, NULL, 0);
+  if (written < 0) return log_error_string_sync("", 0);
+  if (written > len) written = len;
+  return log_error_string_sync(buf, (size_t)written);
 #endif
 }
 
+/* ---------------- Deferred-format errors ---------------- */
+// [TELEMETRY_DEFERRED_MARK][id lo][id hi][args, little-endian]; the widths
+// come from the argument types (LOG_ERROR_DEFERRED), which -Wformat keeps in
+// step with the conversions the host decoder reads them by.
+SedsResult log_error_deferred(uint16_t fmt_id, const uint64_t *vals,
+                              const uint8_t *widths, size_t count) {
+  if (!err_admit(ERR_KEY_DEFERRED | fmt_id, NULL)) return SEDS_OK;
+  if (count > TELEMETRY_DEFERRED_MAX_ARGS) count = TELEMETRY_DEFERRED_MAX_ARGS;
+  uint8_t buf[3u + 8u * TELEMETRY_DEFERRED_MAX_ARGS];
+  size_t n = 0;
+  buf[n++] = TELEMETRY_DEFERRED_MARK;
+  buf[n++] = (uint8_t)fmt_id;
+  buf[n++] = (uint8_t)(fmt_id >> 8);
+  for (size_t i = 0; i < count; i++) {
+    uint64_t v = vals[i];
+    for (uint8_t b = 0; b < widths[i]; b++, v >>= 8) buf[n++] = (uint8_t)v;
+  }
+  err_charge(n);
+  return log_telemetry_typed_asynchronous(SEDS_DT_GENERIC_ERROR, buf, n, 1,
+                                          SEDS_EK_UNSIGNED);
+}
+
 SedsResult print_telemetry_error(const int32_t error_code) {
 #ifndef TELEMETRY_ENABLED
   (void)error_code;
@@ -610,7 +7511,7 @@ SedsResult print_telemetry_error(const int32_t error_code) {
   if (res == SEDS_OK) {
     printf("Error: %s\r\n", buf);
   } else {
-    (void)log_error_asyncronous("Error: seds_error_to_string failed: %d\r\n", (int)res);
+    LOG_ERROR_DEFERRED("Error: seds_error_to_string failed: %d\r\n", (int)res);
   }
   return res;
 #endif
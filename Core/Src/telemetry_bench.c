@@ -0,0 +1,422 @@
+// telemetry_bench.c
+//
+// Loopback self-benchmark; see telemetry_bench.h. Built only with
+// TELEMETRY_BENCH (CMake option ENABLE_LOOPBACK_BENCH).
+#include "telemetry_bench.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "us_clock.h"
+#include "stm32g4xx_hal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef TELEMETRY_BENCH
+
+// Defaults for the run started at boot and for 0 arguments.
+#ifndef TELEMETRY_BENCH_SIZE
+#define TELEMETRY_BENCH_SIZE 256u
+#endif
+#ifndef TELEMETRY_BENCH_RATE_HZ
+#define TELEMETRY_BENCH_RATE_HZ 200u
+#endif
+#ifndef TELEMETRY_BENCH_RUN_MS
+#define TELEMETRY_BENCH_RUN_MS 10000u
+#endif
+#ifndef TELEMETRY_BENCH_MAX_SIZE
+#define TELEMETRY_BENCH_MAX_SIZE 1024u
+#endif
+
+// Let the router and USB come up before the first run.
+#ifndef TELEMETRY_BENCH_START_DELAY_MS
+#define TELEMETRY_BENCH_START_DELAY_MS 3000u
+#endif
+
+// Idle spin rate measured over this before traffic starts; the run's CPU
+// share is what the spinner loses against it.
+#define TELEMETRY_BENCH_CAL_MS 250u
+
+// After the last packet, wait this long for stragglers before counting
+// the rest as lost.
+#define TELEMETRY_BENCH_DRAIN_MS 500u
+
+// The bench header sits near the start of the router's serialized packet;
+// only the first bytes are searched.
+#define TELEMETRY_BENCH_SCAN_BYTES 64u
+
+// Producer below the telemetry threads, like any application logging; the
+// idle spinner below everything. Stack sizes are in mem_budget.h.
+#define TELEMETRY_BENCH_PRIORITY 10u
+#define TELEMETRY_BENCH_SPIN_PRIORITY 31u
+
+#define TELEMETRY_BENCH_MAGIC 0x48434E42u // "BNCH"
+
+// Latency histogram: quarter-octave bins of microseconds, up to 2^25 us.
+#define TELEMETRY_BENCH_BINS 96u
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t run;
+    uint16_t rsvd;
+    uint32_t seq;
+    uint64_t t_us; // us_clock_now() at the log call
+} bench_hdr_t;
+
+TX_THREAD telemetry_bench_thread;
+static MEM_ARENA(stack) ULONG telemetry_bench_stack[TELEMETRY_BENCH_STACK_SIZE / sizeof(ULONG)];
+static TX_THREAD telemetry_bench_spin_thread;
+static MEM_ARENA(stack) ULONG
+    telemetry_bench_spin_stack[TELEMETRY_BENCH_SPIN_STACK_SIZE / sizeof(ULONG)];
+
+static volatile uint32_t g_spins;
+
+// Requested run; picked up by the bench thread.
+static volatile uint8_t g_start;
+static uint32_t g_cfg_size;
+static uint32_t g_cfg_rate;
+static uint32_t g_cfg_run_ms;
+
+// Receive side, written by the telemetry RX thread while a run is active.
+static volatile uint8_t g_active;
+static volatile uint8_t g_running; // from start request to results
+static volatile uint16_t g_run;
+static struct {
+    uint32_t received;
+    uint32_t reordered;
+    uint32_t last_seq;
+    uint32_t max_us;
+    uint64_t first_us;
+    uint64_t last_us;
+    uint32_t hist[TELEMETRY_BENCH_BINS];
+} g_rx;
+
+static telemetry_bench_result_t g_result;
+static uint8_t g_pkt[TELEMETRY_BENCH_MAX_SIZE];
+
+static unsigned lat_bin(uint32_t us)
+{
+    if (us < 4u) {
+        return us;
+    }
+    const unsigned e = 31u - (unsigned)__builtin_clz(us);
+    const unsigned b = 4u * (e - 1u) + ((us >> (e - 2u)) & 3u);
+    return (b < TELEMETRY_BENCH_BINS) ? b : TELEMETRY_BENCH_BINS - 1u;
+}
+
+static uint32_t lat_bin_upper(unsigned b)
+{
+    if (b < 4u) {
+        return b;
+    }
+    const unsigned e = b / 4u + 1u;
+    return ((4u + b % 4u) << (e - 2u)) + (1u << (e - 2u)) - 1u;
+}
+
+// Copy the bench header out of a router packet; 0 if there is none.
+static int bench_find(const uint8_t *bytes, size_t len, bench_hdr_t *out)
+{
+    if (!bytes || len < sizeof(bench_hdr_t)) {
+        return 0;
+    }
+    size_t last = len - sizeof(bench_hdr_t);
+    if (last > TELEMETRY_BENCH_SCAN_BYTES) {
+        last = TELEMETRY_BENCH_SCAN_BYTES;
+    }
+    const uint32_t magic = TELEMETRY_BENCH_MAGIC;
+    for (size_t i = 0; i <= last; i++) {
+        if (bytes[i] == (uint8_t)magic && memcmp(&bytes[i], &magic, 4) == 0) {
+            memcpy(out, &bytes[i], sizeof(*out));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int telemetry_bench_owns(const uint8_t *bytes, size_t len)
+{
+    bench_hdr_t h;
+    return bench_find(bytes, len, &h);
+}
+
+int telemetry_bench_rx(const uint8_t *bytes, size_t len)
+{
+    bench_hdr_t h;
+    if (!bench_find(bytes, len, &h)) {
+        return 0;
+    }
+    if (!g_active || h.run != g_run) {
+        return 1; // left over from an earlier run
+    }
+    const uint64_t now = us_clock_now();
+    const uint64_t age = (now > h.t_us) ? now - h.t_us : 0;
+    const uint32_t lat = (age > UINT32_MAX) ? UINT32_MAX : (uint32_t)age;
+
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (g_rx.received == 0) {
+        g_rx.first_us = now;
+    } else if (h.seq <= g_rx.last_seq) {
+        g_rx.reordered++;
+    }
+    if (g_rx.received == 0 || h.seq > g_rx.last_seq) {
+        g_rx.last_seq = h.seq;
+    }
+    g_rx.received++;
+    g_rx.last_us = now;
+    if (lat > g_rx.max_us) {
+        g_rx.max_us = lat;
+    }
+    g_rx.hist[lat_bin(lat)]++;
+    __set_PRIMASK(primask);
+    return 1;
+}
+
+int telemetry_bench_start(uint32_t size, uint32_t rate_hz, uint32_t run_ms)
+{
+    if (size == 0) {
+        size = TELEMETRY_BENCH_SIZE;
+    }
+    if (size < sizeof(bench_hdr_t) || size > TELEMETRY_BENCH_MAX_SIZE) {
+        return -1;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const int busy = g_running;
+    if (!busy) {
+        g_cfg_size = size;
+        g_cfg_rate = rate_hz ? rate_hz : TELEMETRY_BENCH_RATE_HZ;
+        g_cfg_run_ms = run_ms ? run_ms : TELEMETRY_BENCH_RUN_MS;
+        g_running = 1;
+        g_start = 1;
+    }
+    __set_PRIMASK(primask);
+    if (busy) {
+        return -1;
+    }
+    (void)tx_thread_wait_abort(&telemetry_bench_thread);
+    return 0;
+}
+
+void telemetry_bench_get(telemetry_bench_result_t *out)
+{
+    if (!out) {
+        return;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = g_result;
+    __set_PRIMASK(primask);
+}
+
+static ULONG ms_to_ticks(uint32_t ms)
+{
+    const uint64_t t = ((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999u) / 1000u;
+    return t ? (ULONG)t : 1u;
+}
+
+// Latency below which `pct` percent of the `n` received packets arrived.
+static uint32_t lat_percentile(const uint32_t *hist, uint32_t n, unsigned pct)
+{
+    const uint64_t want = ((uint64_t)n * pct + 99u) / 100u;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < TELEMETRY_BENCH_BINS; b++) {
+        seen += hist[b];
+        if (seen >= want && seen != 0) {
+            return lat_bin_upper(b);
+        }
+    }
+    return 0;
+}
+
+static void bench_report(const telemetry_bench_result_t *r)
+{
+    char txt[224];
+    int n = snprintf(txt, sizeof(txt),
+                     "bench size=%lu rate=%lu/s sent=%lu refused=%lu rx=%lu "
+                     "lost=%lu reord=%lu goodput=%luB/s lat p50=%lu p90=%lu "
+                     "p99=%lu max=%luus cpu=%u%%",
+                     (unsigned long)r->size, (unsigned long)r->rate_hz,
+                     (unsigned long)r->sent, (unsigned long)r->refused,
+                     (unsigned long)r->received, (unsigned long)r->lost,
+                     (unsigned long)r->reordered,
+                     (unsigned long)r->goodput_Bps,
+                     (unsigned long)r->lat_p50_us,
+                     (unsigned long)r->lat_p90_us,
+                     (unsigned long)r->lat_p99_us,
+                     (unsigned long)r->lat_max_us, (unsigned)r->cpu_pct);
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+    printf("%s\r\n", txt);
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+
+    const uint32_t m[] = {r->size,       r->rate_hz,    r->run_ms,
+                          r->sent,       r->refused,    r->received,
+                          r->lost,       r->reordered,  r->goodput_Bps,
+                          r->lat_p50_us, r->lat_p90_us, r->lat_p99_us,
+                          r->lat_max_us, r->cpu_pct};
+    (void)telemetry_result_record(TELEMETRY_RESULT_SRC_LOOPBACK, "loopback", m,
+                                  sizeof(m) / sizeof(m[0]));
+}
+
+static void bench_run(void)
+{
+    const uint32_t size = g_cfg_size;
+    const uint32_t rate = g_cfg_rate;
+    const uint64_t run_us = (uint64_t)g_cfg_run_ms * 1000u;
+
+    uint32_t s0 = g_spins;
+    tx_thread_sleep(ms_to_ticks(TELEMETRY_BENCH_CAL_MS));
+    const uint64_t idle_per_ms = (g_spins - s0) / TELEMETRY_BENCH_CAL_MS;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(&g_rx, 0, sizeof(g_rx));
+    g_run++;
+    g_active = 1;
+    __set_PRIMASK(primask);
+
+    for (uint32_t i = sizeof(bench_hdr_t); i < size; i++) {
+        g_pkt[i] = (uint8_t)i;
+    }
+    bench_hdr_t h = {.magic = TELEMETRY_BENCH_MAGIC, .run = g_run};
+
+    const uint64_t t0 = us_clock_now();
+    s0 = g_spins;
+    uint32_t sent = 0;
+    uint32_t refused = 0;
+    for (;;) {
+        const uint64_t el = us_clock_now() - t0;
+        if (el >= run_us) {
+            break;
+        }
+        const uint64_t due = el * rate / 1000000u + 1u;
+        while (h.seq < due) {
+            h.t_us = us_clock_now();
+            memcpy(g_pkt, &h, sizeof(h));
+            if (log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, g_pkt, size,
+                                           1) == SEDS_OK) {
+                sent++;
+            } else {
+                refused++;
+            }
+            h.seq++;
+        }
+        tx_thread_sleep(1);
+    }
+    const uint32_t spins_run = g_spins - s0;
+    const uint64_t t_run_us = us_clock_now() - t0;
+
+    tx_thread_sleep(ms_to_ticks(TELEMETRY_BENCH_DRAIN_MS));
+
+    static uint32_t hist[TELEMETRY_BENCH_BINS];
+    primask = __get_PRIMASK();
+    __disable_irq();
+    g_active = 0;
+    const uint32_t received = g_rx.received;
+    const uint32_t reordered = g_rx.reordered;
+    const uint32_t max_us = g_rx.max_us;
+    const uint64_t rx_span = g_rx.last_us - g_rx.first_us;
+    memcpy(hist, g_rx.hist, sizeof(hist));
+    __set_PRIMASK(primask);
+
+    telemetry_bench_result_t r = {
+        .size = size,
+        .rate_hz = rate,
+        .run_ms = (uint32_t)(run_us / 1000u),
+        .sent = sent,
+        .refused = refused,
+        .received = received,
+        .lost = (sent > received) ? sent - received : 0,
+        .reordered = reordered,
+        .lat_p50_us = lat_percentile(hist, received, 50),
+        .lat_p90_us = lat_percentile(hist, received, 90),
+        .lat_p99_us = lat_percentile(hist, received, 99),
+        .lat_max_us = max_us,
+        .done = 1,
+    };
+    // Payload bytes over the receive span, from the first arrival.
+    if (received > 1 && rx_span != 0) {
+        r.goodput_Bps = (uint32_t)(((uint64_t)(received - 1u) * size *
+                                    1000000u) / rx_span);
+    }
+    const uint64_t idle = idle_per_ms * t_run_us / 1000u;
+    if (idle != 0 && spins_run < idle) {
+        r.cpu_pct = (uint8_t)(100u - ((uint64_t)spins_run * 100u) / idle);
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    g_result = r;
+    g_running = 0;
+    __set_PRIMASK(primask);
+    bench_report(&r);
+}
+
+static void telemetry_bench_spin_entry(ULONG initial_input)
+{
+    (void)initial_input;
+    for (;;) {
+        g_spins++;
+    }
+}
+
+void telemetry_bench_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
+
+    tx_thread_sleep(ms_to_ticks(TELEMETRY_BENCH_START_DELAY_MS));
+    (void)telemetry_bench_start(0, 0, 0);
+    for (;;) {
+        if (!g_start) {
+            // telemetry_bench_start() cuts this short.
+            tx_thread_sleep(ms_to_ticks(60000u));
+            continue;
+        }
+        g_start = 0;
+        bench_run();
+    }
+}
+
+void create_telemetry_bench_thread(void)
+{
+    UINT status = tx_thread_create(&telemetry_bench_spin_thread,
+                                   "Bench Idle",
+                                   telemetry_bench_spin_entry,
+                                   0,
+                                   telemetry_bench_spin_stack,
+                                   TELEMETRY_BENCH_SPIN_STACK_SIZE,
+                                   TELEMETRY_BENCH_SPIN_PRIORITY,
+                                   TELEMETRY_BENCH_SPIN_PRIORITY,
+                                   TX_NO_TIME_SLICE,
+                                   TX_AUTO_START);
+    if (status == TX_SUCCESS) {
+        status = tx_thread_create(&telemetry_bench_thread,
+                                  "Bench",
+                                  telemetry_bench_thread_entry,
+                                  0,
+                                  telemetry_bench_stack,
+                                  TELEMETRY_BENCH_STACK_SIZE,
+                                  TELEMETRY_BENCH_PRIORITY,
+                                  TELEMETRY_BENCH_PRIORITY,
+                                  TX_NO_TIME_SLICE,
+                                  TX_AUTO_START);
+    }
+
+    if (status != TX_SUCCESS) {
+        die("Failed to create bench thread: %u", (unsigned)status);
+    }
+}
+
+#else
+
+void create_telemetry_bench_thread(void)
+{
+}
+
+#endif /* TELEMETRY_BENCH */
@@ -1,7 +1,14 @@
 // Core/Src/telemetry_alloc.c
+#include "telemetry_hooks.h"
+#include "crc_hw.h"
+#include "mem_budget.h"
 #include "tx_api.h"
+#include "stm32g4xx.h"
+#include "us_clock.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 /*
  * Rust expects these functions to exist for heap allocations:
@@ -10,11 +17,159 @@
  *   void telemetryFree(void *);
  *   void seds_error_msg(const char *str, size_t len);
  *
+ * and these for packet and fragment checksums, on the CRC unit:
+ *
+ *   uint32_t telemetryCrc32(const uint8_t *, size_t);
+ *   uint16_t telemetryCrc16(const uint8_t *, size_t);
+ *
+ * and these for its locks (telemetry_hooks.h):
+ *
+ *   void *telemetryLockCreate(const char *);
+ *   void telemetryLock(void *);
+ *   void telemetryUnlock(void *);
+ *   uint32_t telemetryCriticalEnter(void);
+ *   void telemetryCriticalExit(uint32_t);
+ *
+ */
+
+/*
+ * Allocations are served from fixed-size TX_BLOCK_POOLs (one per size class),
+ * which allocate and free in constant time and cannot fragment. A request
+ * goes to the smallest class that fits, spills to the next larger class if
+ * that one is empty, and only falls back to the byte pool when it is larger
+ * than every class (or all fitting classes are exhausted).
+ *
+ * Block counts and RUST_HEAP_SIZE are set in mem_budget.h: the byte pool
+ * takes what the arena has left, so more blocks here mean a smaller
+ * fallback. The defaults keep the total close to the previous single 32 KB
+ * byte pool.
+ *
+ * rust_heap_seal() marks the end of start-up: allocations after it are
+ * counted as steady-state ones, those that reach the byte pool separately,
+ * since only they cost a search and can fragment. RUST_HEAP_STEADY_STRICT
+ * (CMake option ENABLE_STATIC_HEAP) refuses them, so a running gateway
+ * only takes blocks from the pools sized and reserved at build time;
+ * RUST_HEAP_STEADY_TRAP (the same option, Debug builds) stops at a
+ * breakpoint on each one while a debugger is attached.
  */
 
-#define RUST_HEAP_SIZE  (32 * 1024u)  // this will need to be tuned
+typedef struct {
+    TX_BLOCK_POOL pool;
+    ULONG block_size;
+    UCHAR *mem;
+    ULONG mem_size;
+    /* usage counters */
+    ULONG in_use;
+    ULONG peak;
+    ULONG allocs;
+    ULONG exhausted; /* requests that had to go elsewhere */
+} rust_size_class_t;
+
+static MEM_ARENA(rust) ULONG rust_mem_32[RUST_POOL_BYTES(32u, RUST_POOL_32_BLOCKS) / sizeof(ULONG)];
+static MEM_ARENA(rust) ULONG rust_mem_64[RUST_POOL_BYTES(64u, RUST_POOL_64_BLOCKS) / sizeof(ULONG)];
+static MEM_ARENA(rust) ULONG rust_mem_128[RUST_POOL_BYTES(128u, RUST_POOL_128_BLOCKS) / sizeof(ULONG)];
+static MEM_ARENA(rust) ULONG rust_mem_512[RUST_POOL_BYTES(512u, RUST_POOL_512_BLOCKS) / sizeof(ULONG)];
+static MEM_ARENA(rust) ULONG rust_mem_2048[RUST_POOL_BYTES(2048u, RUST_POOL_2048_BLOCKS) / sizeof(ULONG)];
+
+static rust_size_class_t rust_classes[] = {
+    {.block_size = 32u,   .mem = (UCHAR *)rust_mem_32,   .mem_size = sizeof(rust_mem_32)},
+    {.block_size = 64u,   .mem = (UCHAR *)rust_mem_64,   .mem_size = sizeof(rust_mem_64)},
+    {.block_size = 128u,  .mem = (UCHAR *)rust_mem_128,  .mem_size = sizeof(rust_mem_128)},
+    {.block_size = 512u,  .mem = (UCHAR *)rust_mem_512,  .mem_size = sizeof(rust_mem_512)},
+    {.block_size = 2048u, .mem = (UCHAR *)rust_mem_2048, .mem_size = sizeof(rust_mem_2048)},
+};
+#define RUST_CLASS_COUNT (sizeof(rust_classes) / sizeof(rust_classes[0]))
+
+_Static_assert(RUST_CLASS_COUNT == RUST_HEAP_CLASS_COUNT,
+               "update RUST_HEAP_CLASS_COUNT in telemetry_hooks.h");
+
 static TX_BYTE_POOL rust_byte_pool;
-static UCHAR rust_heap[RUST_HEAP_SIZE];
+static MEM_ARENA(rust) UCHAR rust_heap[RUST_HEAP_SIZE];
+
+/* Whole-heap counters (class counters live in rust_classes). */
+static ULONG rust_peak_bytes = 0;
+static ULONG rust_alloc_count = 0;
+static ULONG rust_failed_count = 0;
+static ULONG rust_size_hist[RUST_HEAP_HIST_BINS];
+static volatile UINT rust_sealed = 0;
+static ULONG rust_steady_allocs = 0;
+static ULONG rust_steady_pool_allocs = 0;
+
+/* Bytes handed out right now. Caller holds interrupts disabled. */
+static ULONG live_bytes_locked(void)
+{
+    ULONG live = rust_byte_pool.tx_byte_pool_size - rust_byte_pool.tx_byte_pool_available;
+    for (ULONG i = 0; i < RUST_CLASS_COUNT; i++) {
+        live += rust_classes[i].in_use * rust_classes[i].block_size;
+    }
+    return live;
+}
+
+static ULONG hist_bin(size_t size)
+{
+    ULONG bin = 0;
+    while (bin < RUST_HEAP_HIST_BINS - 1u && size > ((size_t)32u << bin)) {
+        bin++;
+    }
+    return bin;
+}
+
+#if RUST_HEAP_TRACE_EVENTS
+_Static_assert((RUST_HEAP_TRACE_EVENTS & (RUST_HEAP_TRACE_EVENTS - 1u)) == 0,
+               "RUST_HEAP_TRACE_EVENTS must be a power of two");
+_Static_assert(sizeof(rust_heap_trace_t) == 16u, "trace records are 16 bytes");
+
+static rust_heap_trace_t rust_trace[RUST_HEAP_TRACE_EVENTS];
+static ULONG rust_trace_seq = 0; /* events recorded since boot */
+static volatile UINT rust_trace_frozen = 0;
+
+/* Where the hook was called from. If that is only the library's allocator
+   shim, the trace shows the shim; it can't unwind further. */
+#define TRACE_CALLER() ((uint32_t)(uintptr_t)__builtin_return_address(0))
+
+/* Caller holds interrupts disabled. */
+static void trace_locked(uint8_t op, size_t size, const void *ptr, uint8_t cls,
+                         uint32_t caller)
+{
+    if (rust_trace_frozen) {
+        return;
+    }
+    rust_heap_trace_t *e = &rust_trace[rust_trace_seq & (RUST_HEAP_TRACE_EVENTS - 1u)];
+    e->ts_us = (uint32_t)us_clock_now();
+    e->caller = caller;
+    e->ptr = (uint32_t)(uintptr_t)ptr;
+    e->size = (uint16_t)((size > 0xFFFFu) ? 0xFFFFu : size);
+    e->op = op;
+    e->cls = cls;
+    rust_trace_seq++;
+}
+#else
+#define TRACE_CALLER() 0u
+#define trace_locked(op, size, ptr, cls, caller) ((void)(caller))
+#endif
+
+/* Account for an allocation attempt (`ptr` NULL if it failed). Caller holds
+   interrupts disabled. */
+static void note_alloc_locked(size_t size, const void *ptr, uint8_t cls,
+                              uint32_t caller)
+{
+    const UINT ok = (ptr != NULL);
+    trace_locked(ok ? RUST_HEAP_TRACE_ALLOC : RUST_HEAP_TRACE_FAIL, size, ptr,
+                 cls, caller);
+    rust_size_hist[hist_bin(size)]++;
+    if (rust_sealed) {
+        rust_steady_allocs++;
+    }
+    if (!ok) {
+        rust_failed_count++;
+        return;
+    }
+    rust_alloc_count++;
+    const ULONG live = live_bytes_locked();
+    if (live > rust_peak_bytes) {
+        rust_peak_bytes = live;
+    }
+}
 
 void rust_heap_init(void)
 {
@@ -27,6 +182,14 @@ void rust_heap_init(void)
                                       "rust_heap",
                                       rust_heap,
                                       sizeof(rust_heap));
+    for (ULONG i = 0; i < RUST_CLASS_COUNT && status == TX_SUCCESS; i++) {
+        rust_size_class_t *c = &rust_classes[i];
+        status = tx_block_pool_create(&c->pool,
+                                      "rust_blocks",
+                                      c->block_size,
+                                      c->mem,
+                                      c->mem_size);
+    }
     if (status != TX_SUCCESS) {
         /* If this fails, you're in deep trouble – spin or assert */
         while (1) { }
@@ -35,34 +198,423 @@ void rust_heap_init(void)
     initialized = 1;
 }
 
+static rust_size_class_t *class_of_ptr(const void *pv)
+{
+    const UCHAR *p = (const UCHAR *)pv;
+    for (ULONG i = 0; i < RUST_CLASS_COUNT; i++) {
+        rust_size_class_t *c = &rust_classes[i];
+        if (p >= c->mem && p < c->mem + c->mem_size) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
 void *telemetryMalloc(size_t xSize)
 {
+    TX_INTERRUPT_SAVE_AREA
     void *ptr = NULL;
+    const uint32_t caller = TRACE_CALLER();
 
-    /* Make sure pool is ready – safe to call multiple times */
+    /* Make sure pools are ready – safe to call multiple times */
     rust_heap_init();
 
-    /* TX_NO_WAIT: allocator is fast and non-blocking */
+    for (ULONG i = 0; i < RUST_CLASS_COUNT; i++) {
+        rust_size_class_t *c = &rust_classes[i];
+        if (xSize > c->block_size) {
+            continue;
+        }
+        /* TX_NO_WAIT: allocator is fast and non-blocking */
+        if (tx_block_allocate(&c->pool, &ptr, TX_NO_WAIT) == TX_SUCCESS) {
+            TX_DISABLE
+            c->allocs++;
+            if (++c->in_use > c->peak) {
+                c->peak = c->in_use;
+            }
+            note_alloc_locked(xSize, ptr, (uint8_t)i, caller);
+            TX_RESTORE
+            return ptr;
+        }
+        TX_DISABLE
+        c->exhausted++;
+        TX_RESTORE
+    }
+
+    if (rust_sealed) {
+        TX_DISABLE
+        rust_steady_pool_allocs++;
+        TX_RESTORE
+#ifdef RUST_HEAP_STEADY_TRAP
+        if (CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk) {
+            __BKPT(0); /* the caller is in the backtrace */
+        }
+#endif
+#ifdef RUST_HEAP_STEADY_STRICT
+        TX_DISABLE
+        note_alloc_locked(xSize, NULL, RUST_HEAP_TRACE_BYTE_POOL, caller);
+        TX_RESTORE
+        return NULL;
+#endif
+    }
+
     UINT status = tx_byte_allocate(&rust_byte_pool, &ptr, xSize, TX_NO_WAIT);
     if (status != TX_SUCCESS) {
-        return NULL;
+        ptr = NULL;
     }
+    TX_DISABLE
+    note_alloc_locked(xSize, ptr, RUST_HEAP_TRACE_BYTE_POOL, caller);
+    TX_RESTORE
     return ptr;
 }
 
 void telemetryFree(void *pv)
 {
+    TX_INTERRUPT_SAVE_AREA
     if (pv == NULL) {
         return;
     }
+    const uint32_t caller = TRACE_CALLER();
+
+    rust_size_class_t *c = class_of_ptr(pv);
+    if (c != NULL) {
+        if (tx_block_release(pv) == TX_SUCCESS) {
+            TX_DISABLE
+            c->in_use--;
+            trace_locked(RUST_HEAP_TRACE_FREE, 0, pv,
+                         (uint8_t)(c - rust_classes), caller);
+            TX_RESTORE
+        }
+        return;
+    }
 
     /* If the pool wasn’t created yet, something is badly wrong,
        but tx_byte_release() will fail and we just ignore it. */
-    (void)tx_byte_release(pv);
+    if (tx_byte_release(pv) == TX_SUCCESS) {
+        TX_DISABLE
+        trace_locked(RUST_HEAP_TRACE_FREE, 0, pv, RUST_HEAP_TRACE_BYTE_POOL,
+                     caller);
+        TX_RESTORE
+    }
+}
+
+/*
+ * Largest contiguous free run in the byte pool. Walks the ThreadX block list
+ * directly: each block starts with a pointer to the next block followed by
+ * a word that is TX_BYTE_BLOCK_FREE when the block is free. Adjacent free
+ * blocks count as one run since ThreadX merges them on the next search.
+ */
+#ifndef TX_BYTE_BLOCK_FREE
+#define TX_BYTE_BLOCK_FREE ((ULONG) 0xFFFFEEEEUL)
+#endif
+
+static ULONG largest_free_locked(void)
+{
+    UCHAR *start = rust_byte_pool.tx_byte_pool_start;
+    UCHAR *cur = start;
+    UCHAR *run_start = NULL;
+    ULONG best = 0;
+    ULONG blocks = rust_byte_pool.tx_byte_pool_fragments + 1u;
+
+    while (blocks-- > 0u) {
+        UCHAR *next = *(UCHAR **)cur;
+        const ALIGN_TYPE tag = *(ALIGN_TYPE *)(cur + sizeof(UCHAR *));
+        if (tag == TX_BYTE_BLOCK_FREE) {
+            if (run_start == NULL) {
+                run_start = cur;
+            }
+            if (next > run_start) {
+                const ULONG run = (ULONG)(next - run_start)
+                                  - (ULONG)(sizeof(UCHAR *) + sizeof(ALIGN_TYPE));
+                if (run > best) {
+                    best = run;
+                }
+            }
+        } else {
+            run_start = NULL;
+        }
+        if (next <= cur) {
+            break; /* wrapped back to the start of the pool */
+        }
+        cur = next;
+    }
+    return best;
+}
+
+#if RUST_HEAP_TRACE_EVENTS
+uint32_t rust_heap_trace_freeze(int on)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    rust_trace_frozen = on ? 1u : 0u;
+    const ULONG seq = rust_trace_seq;
+    TX_RESTORE
+    return (uint32_t)seq;
+}
+
+int rust_heap_trace_get(uint32_t seq, rust_heap_trace_t *out)
+{
+    TX_INTERRUPT_SAVE_AREA
+    int ok = 0;
+    TX_DISABLE
+    if (out != NULL && seq < rust_trace_seq &&
+        rust_trace_seq - seq <= RUST_HEAP_TRACE_EVENTS) {
+        *out = rust_trace[seq & (RUST_HEAP_TRACE_EVENTS - 1u)];
+        ok = 1;
+    }
+    TX_RESTORE
+    return ok;
+}
+#else
+uint32_t rust_heap_trace_freeze(int on)
+{
+    (void)on;
+    return 0;
+}
+
+int rust_heap_trace_get(uint32_t seq, rust_heap_trace_t *out)
+{
+    (void)seq;
+    (void)out;
+    return 0;
+}
+#endif
+
+void rust_heap_seal(void)
+{
+    rust_sealed = 1;
+}
+
+uint32_t rust_heap_live_bytes(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    rust_heap_init();
+    TX_DISABLE
+    const ULONG live = live_bytes_locked();
+    TX_RESTORE
+    return (uint32_t)live;
+}
+
+uint32_t rust_heap_failed_count(void)
+{
+    return (uint32_t)rust_failed_count;
+}
+
+uint32_t rust_heap_capacity_bytes(void)
+{
+    ULONG total = RUST_HEAP_SIZE;
+    for (ULONG i = 0; i < RUST_CLASS_COUNT; i++) {
+        total += (rust_classes[i].mem_size / (rust_classes[i].block_size + sizeof(void *))) *
+                 rust_classes[i].block_size;
+    }
+    return (uint32_t)total;
+}
+
+void rust_heap_get_stats(rust_heap_stats_t *out)
+{
+    TX_INTERRUPT_SAVE_AREA
+    if (out == NULL) {
+        return;
+    }
+    rust_heap_init();
+
+    ULONG avail = 0;
+    ULONG frags = 0;
+    (void)tx_byte_pool_info_get(&rust_byte_pool, TX_NULL, &avail, &frags,
+                                TX_NULL, TX_NULL, TX_NULL);
+
+    TX_DISABLE
+    out->live_bytes = live_bytes_locked();
+    out->peak_bytes = rust_peak_bytes;
+    out->alloc_count = rust_alloc_count;
+    out->failed_count = rust_failed_count;
+    out->largest_free_fragment = largest_free_locked();
+    out->steady_allocs = rust_steady_allocs;
+    out->steady_pool_allocs = rust_steady_pool_allocs;
+    out->sealed = (uint8_t)rust_sealed;
+    for (ULONG i = 0; i < RUST_HEAP_HIST_BINS; i++) {
+        out->size_hist[i] = rust_size_hist[i];
+    }
+    for (ULONG i = 0; i < RUST_CLASS_COUNT; i++) {
+        out->class_block_size[i] = rust_classes[i].block_size;
+        out->class_in_use[i] = rust_classes[i].in_use;
+        out->class_peak[i] = rust_classes[i].peak;
+        out->class_exhausted[i] = rust_classes[i].exhausted;
+    }
+    TX_RESTORE
+
+    out->byte_pool_free = avail;
+    out->byte_pool_fragments = frags;
 }
 
 void seds_error_msg(const char *str, size_t len)
 {
     (void)len;
     printf("%s\n", str);
-}
\ No newline at end of file
+}
+
+uint32_t telemetryCrc32(const uint8_t *data, size_t len)
+{
+    return crc_hw_compute(&crc_hw_crc32, data, len);
+}
+
+uint16_t telemetryCrc16(const uint8_t *data, size_t len)
+{
+    return (uint16_t)crc_hw_compute(&crc_hw_crc16_ccitt, data, len);
+}
+
+/*
+ * Router locks: a fixed table of TX_INHERIT mutexes handed out in creation
+ * order, never deleted. A take first tries without waiting, so only the
+ * takes that found the lock held count as contended and are timed. Hold
+ * times run from the outermost take to the matching release. The
+ * counters are written by the owner, under the mutex.
+ */
+typedef struct {
+    TX_MUTEX mutex;
+    uint64_t held_at_us;
+    rust_lock_stats_t st;
+} rust_lock_t;
+
+static rust_lock_t rust_locks[RUST_LOCKS];
+static ULONG rust_lock_count = 0;
+static ULONG rust_lock_not_thread = 0;
+static ULONG rust_critical_count = 0;
+static ULONG rust_critical_max = 0;
+static ULONG rust_critical_depth = 0;
+static ULONG rust_critical_start = 0;
+
+static int lock_usable(void)
+{
+    if (tx_thread_identify() != TX_NULL && __get_IPSR() == 0u) {
+        return 1;
+    }
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    rust_lock_not_thread++;
+    TX_RESTORE
+    return 0;
+}
+
+void *telemetryLockCreate(const char *name)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    const ULONG i = rust_lock_count;
+    if (i < RUST_LOCKS) {
+        rust_lock_count = i + 1u;
+    }
+    TX_RESTORE
+    if (i >= RUST_LOCKS) {
+        return NULL;
+    }
+    rust_lock_t *l = &rust_locks[i];
+    l->st.name = name;
+    if (tx_mutex_create(&l->mutex, (CHAR *)(name ? name : "rust"), TX_INHERIT) !=
+        TX_SUCCESS) {
+        return NULL; // the slot stays used; nothing can be created twice
+    }
+    return l;
+}
+
+void telemetryLock(void *lock)
+{
+    rust_lock_t *l = (rust_lock_t *)lock;
+    if (l == NULL || !lock_usable()) {
+        return;
+    }
+    uint64_t waited = 0;
+    if (tx_mutex_get(&l->mutex, TX_NO_WAIT) != TX_SUCCESS) {
+        const uint64_t t0 = us_clock_now();
+        (void)tx_mutex_get(&l->mutex, TX_WAIT_FOREVER);
+        waited = us_clock_now() - t0 + 1u; // a wait under 1 us still counts
+    }
+    if (l->mutex.tx_mutex_ownership_count != 1u) {
+        return; // nested
+    }
+    l->held_at_us = us_clock_now();
+    l->st.acquires++;
+    if (waited) {
+        l->st.contended++;
+        if (waited > l->st.wait_max_us) {
+            l->st.wait_max_us = (waited > UINT32_MAX) ? UINT32_MAX : (uint32_t)waited;
+        }
+    }
+}
+
+void telemetryUnlock(void *lock)
+{
+    rust_lock_t *l = (rust_lock_t *)lock;
+    if (l == NULL || tx_thread_identify() == TX_NULL || __get_IPSR() != 0u) {
+        return;
+    }
+    if (l->mutex.tx_mutex_owner == tx_thread_identify() &&
+        l->mutex.tx_mutex_ownership_count == 1u) {
+        const uint64_t held = us_clock_now() - l->held_at_us;
+        l->st.hold_total_us += held;
+        if (held > l->st.hold_max_us) {
+            l->st.hold_max_us = (held > UINT32_MAX) ? UINT32_MAX : (uint32_t)held;
+        }
+    }
+    (void)tx_mutex_put(&l->mutex);
+}
+
+uint32_t telemetryCriticalEnter(void)
+{
+#ifdef TX_PORT_USE_BASEPRI
+    const uint32_t state = __get_BASEPRI();
+    __set_BASEPRI_MAX(TX_PORT_BASEPRI);
+#else
+    const uint32_t state = __get_PRIMASK();
+    __disable_irq();
+#endif
+    if (rust_critical_depth++ == 0u) {
+        rust_critical_start = DWT->CYCCNT;
+    }
+    return state;
+}
+
+void telemetryCriticalExit(uint32_t state)
+{
+    if (rust_critical_depth != 0u && --rust_critical_depth == 0u) {
+        const ULONG cycles = DWT->CYCCNT - rust_critical_start;
+        rust_critical_count++;
+        if (cycles > rust_critical_max) {
+            rust_critical_max = cycles;
+        }
+    }
+#ifdef TX_PORT_USE_BASEPRI
+    __set_BASEPRI(state);
+#else
+    __set_PRIMASK(state);
+#endif
+}
+
+int rust_lock_get_stats(unsigned i, rust_lock_stats_t *out)
+{
+    if (out == NULL) {
+        return 0;
+    }
+    memset(out, 0, sizeof(*out));
+    if (i >= rust_lock_count) {
+        return 0;
+    }
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    *out = rust_locks[i].st;
+    TX_RESTORE
+    return 1;
+}
+
+void rust_lock_get_misc(uint32_t *critical, uint32_t *critical_max_cycles,
+                        uint32_t *not_thread)
+{
+    if (critical) {
+        *critical = rust_critical_count;
+    }
+    if (critical_max_cycles) {
+        *critical_max_cycles = rust_critical_max;
+    }
+    if (not_thread) {
+        *not_thread = rust_lock_not_thread;
+    }
+}
@@ -0,0 +1,53 @@
+// Instantiates telemetry.hpp on representative schemas so its
+// static_asserts run in every firmware build; nothing here is linked in.
+#include "telemetry.hpp"
+
+namespace {
+
+struct check_f32 {
+  static constexpr SedsDataType type = SEDS_DT_MESSAGE_DATA;
+  typedef float elem_type;
+  float a, b, c;
+};
+
+struct check_u8 {
+  static constexpr SedsDataType type = SEDS_DT_MESSAGE_DATA;
+  static constexpr can_bus_tx_prio_t tx_class = CAN_BUS_TX_PRIO_HIGH;
+  typedef uint8_t elem_type;
+  uint8_t a, b, c;
+};
+
+struct check_i16 {
+  static constexpr SedsDataType type = SEDS_DT_MESSAGE_DATA;
+  typedef int16_t elem_type;
+  int16_t v[4];
+};
+
+typedef telemetry::schema<check_f32> f32;
+typedef telemetry::schema<check_u8> u8;
+typedef telemetry::schema<check_i16> i16;
+
+static_assert(f32::count == 3u && f32::size == 4u &&
+                  f32::kind == SEDS_EK_FLOAT &&
+                  f32::tx_class == CAN_BUS_TX_PRIO_LOW,
+              "float schema in the bulk class");
+static_assert(u8::count == 3u && u8::size == 1u &&
+                  u8::kind == SEDS_EK_UNSIGNED &&
+                  u8::tx_class == CAN_BUS_TX_PRIO_HIGH,
+              "uint8_t schema with a TX class");
+static_assert(i16::count == 4u && i16::size == 2u &&
+                  i16::kind == SEDS_EK_SIGNED,
+              "int16_t array schema");
+static_assert(telemetry::can_id_of(SEDS_DT_MESSAGE_DATA) != 0u,
+              "TELEMETRY_CAN_ID_MAP lookup");
+
+// A uint8_t field followed by a uint16_t one pads; alignof catches it.
+struct padded {
+  uint8_t a;
+  uint16_t b;
+};
+static_assert(sizeof(padded) % sizeof(uint8_t) == 0 &&
+                  alignof(padded) != alignof(uint8_t),
+              "the alignment check is what rejects padded schemas");
+
+} // namespace
@@ -0,0 +1,275 @@
+// telemetry_sched.c
+//
+// Slot scheduler for periodic telemetry sources; see telemetry_sched.h.
+#include "telemetry_sched.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "stm32g4xx_hal.h"
+
+#ifndef TELEMETRY_SCHED_MAX_SOURCES
+#define TELEMETRY_SCHED_MAX_SOURCES 16u
+#endif
+
+// Slot width; periods and phases are whole slots.
+#ifndef TELEMETRY_SCHED_SLOT_MS
+#define TELEMETRY_SCHED_SLOT_MS 5u
+#endif
+
+// Slots over which the phase search balances load (1 s by default). Periods
+// longer than this are placed by their position within it.
+#ifndef TELEMETRY_SCHED_FRAME_SLOTS
+#define TELEMETRY_SCHED_FRAME_SLOTS 200u
+#endif
+
+// Largest sample a callback may produce.
+#define TELEMETRY_SCHED_SAMPLE_MAX 64u
+
+// Same level as TX dispatch, which therefore can't preempt a slot: the
+// samples of one slot are all queued before dispatch runs on them.
+// Stack size: TELEMETRY_SCHED_STACK_SIZE in mem_budget.h.
+#define TELEMETRY_SCHED_PRIORITY 5u
+
+TX_THREAD telemetry_sched_thread;
+static MEM_ARENA(stack) ULONG telemetry_sched_stack[TELEMETRY_SCHED_STACK_SIZE / sizeof(ULONG)];
+
+typedef struct {
+    telemetry_source_t src;
+    uint32_t period_slots;
+    uint32_t phase_slots;
+    uint64_t next_slot;
+    uint8_t used;
+} sched_entry_t;
+
+static sched_entry_t g_sources[TELEMETRY_SCHED_MAX_SOURCES];
+static uint8_t g_slot_load[TELEMETRY_SCHED_FRAME_SLOTS];
+static telemetry_sched_stats_t g_stats;
+
+// Slot number, widened past the 32-bit tick counter's wrap.
+static uint64_t now_slot(void)
+{
+    static uint32_t last_ticks;
+    static uint32_t wraps;
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const uint32_t ticks = (uint32_t)tx_time_get();
+    if (ticks < last_ticks) {
+        wraps++;
+    }
+    last_ticks = ticks;
+    const uint64_t wide = ((uint64_t)wraps << 32) | ticks;
+    __set_PRIMASK(primask);
+    return (wide * 1000ULL / (uint64_t)TX_TIMER_TICKS_PER_SECOND) /
+           TELEMETRY_SCHED_SLOT_MS;
+}
+
+// Add (+1) or take back (-1) a source's slots in the load map.
+static void load_mark(uint32_t period, uint32_t phase, int delta)
+{
+    for (uint32_t s = phase % TELEMETRY_SCHED_FRAME_SLOTS;
+         s < TELEMETRY_SCHED_FRAME_SLOTS; s += period) {
+        g_slot_load[s] = (uint8_t)(g_slot_load[s] + delta);
+    }
+}
+
+// Phase whose slots carry the least load, heaviest slot first, then total.
+static uint32_t pick_phase(uint32_t period)
+{
+    const uint32_t span = (period < TELEMETRY_SCHED_FRAME_SLOTS)
+                              ? period
+                              : TELEMETRY_SCHED_FRAME_SLOTS;
+    uint32_t best = 0;
+    uint32_t best_peak = UINT32_MAX;
+    uint32_t best_sum = UINT32_MAX;
+    for (uint32_t p = 0; p < span; p++) {
+        uint32_t peak = 0;
+        uint32_t sum = 0;
+        for (uint32_t s = p; s < TELEMETRY_SCHED_FRAME_SLOTS; s += period) {
+            if (g_slot_load[s] > peak) {
+                peak = g_slot_load[s];
+            }
+            sum += g_slot_load[s];
+        }
+        if (peak < best_peak || (peak == best_peak && sum < best_sum)) {
+            best = p;
+            best_peak = peak;
+            best_sum = sum;
+        }
+    }
+    return best;
+}
+
+int telemetry_sched_add(const telemetry_source_t *src)
+{
+    if (!src || !src->sample || src->period_ms == 0 || src->elem_size == 0 ||
+        src->elem_size > 8u) {
+        return -1;
+    }
+    const uint32_t period = (src->period_ms + TELEMETRY_SCHED_SLOT_MS - 1u) /
+                            TELEMETRY_SCHED_SLOT_MS;
+
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int handle = -1;
+    for (unsigned i = 0; i < TELEMETRY_SCHED_MAX_SOURCES; i++) {
+        if (!g_sources[i].used) {
+            handle = (int)i;
+            break;
+        }
+    }
+    if (handle >= 0) {
+        sched_entry_t *e = &g_sources[handle];
+        e->src = *src;
+        e->period_slots = period;
+        e->phase_slots = pick_phase(period);
+        load_mark(period, e->phase_slots, +1);
+        // First run at the next slot congruent to the phase.
+        const uint64_t now = now_slot() + 1u;
+        const uint32_t at = (uint32_t)(now % period);
+        e->next_slot = now + (e->phase_slots % period + period - at) % period;
+        e->used = 1;
+    }
+    __set_PRIMASK(primask);
+    if (handle >= 0) {
+        // The thread may be sleeping towards a later slot.
+        (void)tx_thread_wait_abort(&telemetry_sched_thread);
+    }
+    return handle;
+}
+
+void telemetry_sched_remove(int handle)
+{
+    if (handle < 0 || (unsigned)handle >= TELEMETRY_SCHED_MAX_SOURCES) {
+        return;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sched_entry_t *e = &g_sources[handle];
+    if (e->used) {
+        load_mark(e->period_slots, e->phase_slots, -1);
+        e->used = 0;
+    }
+    __set_PRIMASK(primask);
+}
+
+void telemetry_sched_get_stats(telemetry_sched_stats_t *out)
+{
+    if (!out) {
+        return;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = g_stats;
+    __set_PRIMASK(primask);
+}
+
+// Next source due at or before `slot`, shortest period first; copies it
+// out and advances its deadline past `slot`. -1 when none is due.
+static int take_due(uint64_t slot, telemetry_source_t *out)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int pick = -1;
+    for (unsigned i = 0; i < TELEMETRY_SCHED_MAX_SOURCES; i++) {
+        const sched_entry_t *e = &g_sources[i];
+        if (e->used && e->next_slot <= slot &&
+            (pick < 0 || e->period_slots < g_sources[pick].period_slots)) {
+            pick = (int)i;
+        }
+    }
+    if (pick >= 0) {
+        sched_entry_t *e = &g_sources[pick];
+        *out = e->src;
+        // Late by whole periods: skip them rather than bursting to catch up.
+        do {
+            e->next_slot += e->period_slots;
+            if (e->next_slot <= slot) {
+                g_stats.skipped++;
+            }
+        } while (e->next_slot <= slot);
+    }
+    __set_PRIMASK(primask);
+    return pick;
+}
+
+static uint64_t next_due_slot(void)
+{
+    uint64_t next = UINT64_MAX;
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (unsigned i = 0; i < TELEMETRY_SCHED_MAX_SOURCES; i++) {
+        if (g_sources[i].used && g_sources[i].next_slot < next) {
+            next = g_sources[i].next_slot;
+        }
+    }
+    __set_PRIMASK(primask);
+    return next;
+}
+
+void telemetry_sched_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
+
+    uint8_t buf[TELEMETRY_SCHED_SAMPLE_MAX];
+    for (;;) {
+        const uint64_t slot = now_slot();
+        telemetry_source_t src;
+        uint32_t queued = 0;
+        while (take_due(slot, &src) >= 0) {
+            const size_t n = src.sample(buf, sizeof(buf), src.user);
+            if (n == 0 || n > sizeof(buf) / src.elem_size) {
+                continue;
+            }
+            if (log_telemetry_typed_asynchronous(src.type, buf, n,
+                                                 src.elem_size,
+                                                 src.kind) == SEDS_OK) {
+                queued++;
+            }
+        }
+        if (queued) {
+            const uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            g_stats.samples += queued;
+            __set_PRIMASK(primask);
+        }
+
+        // Sleep to the start of the next busy slot (telemetry_sched_add()
+        // cuts it short), at most a frame.
+        const uint64_t next = next_due_slot();
+        uint64_t wait = TELEMETRY_SCHED_FRAME_SLOTS;
+        const uint64_t cur = now_slot();
+        if (next != UINT64_MAX) {
+            wait = (next > cur) ? next - cur : 0;
+            if (wait > TELEMETRY_SCHED_FRAME_SLOTS) {
+                wait = TELEMETRY_SCHED_FRAME_SLOTS;
+            }
+        }
+        if (wait == 0) {
+            continue;
+        }
+        const uint64_t ticks = (wait * TELEMETRY_SCHED_SLOT_MS *
+                                (uint64_t)TX_TIMER_TICKS_PER_SECOND) /
+                               1000ULL;
+        tx_thread_sleep(ticks ? (ULONG)ticks : 1u);
+    }
+}
+
+void create_telemetry_sched_thread(void)
+{
+    UINT status = tx_thread_create(&telemetry_sched_thread,
+                                   "Telemetry Sched",
+                                   telemetry_sched_thread_entry,
+                                   0,
+                                   telemetry_sched_stack,
+                                   TELEMETRY_SCHED_STACK_SIZE,
+                                   TELEMETRY_SCHED_PRIORITY,
+                                   TELEMETRY_SCHED_PRIORITY,
+                                   TX_NO_TIME_SLICE,
+                                   TX_AUTO_START);
+
+    if (status != TX_SUCCESS) {
+        die("Failed to create telemetry scheduler thread: %u",
+            (unsigned)status);
+    }
+}
@@ -1,15 +1,92 @@
 // telemetry_thread.c
 #include "GB-Threads.h"
+#include "app_task.h"
+#include "coro.h"
+#include "boot_time.h"
 #include "tx_api.h"
 #include "telemetry.h"
 #include "can_bus.h"
+#include "can_peer.h"
+#include "can_gw.h"
+#include "config_store.h"
+#include "fw_relay.h"
+#include "fw_update.h"
+#include "gnss_time.h"
+#include "isotp.h"
+#include "low_power.h"
+#include "can_bulk.h"
+#include "file_srv.h"
+#include "mem_budget.h"
+#include "proto_timer.h"
+#include "usb_cdc.h"
+#include "usb_gs.h"
+#ifdef UART_LINK_ENABLED
+#include "uart_link.h"
+#endif
+#ifdef SPI_LINK_ENABLED
+#include "spi_link.h"
+#endif
+#include "telemetry_hooks.h"
+#include "profiler.h"
+#include "stack_monitor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Three stages, so a stalled one can't hold up the one before it:
+//   ingest:      CAN/USB/UART RX, reassembly, router RX queue, ISO-TP
+//   dispatch:    router TX queue, woken by new packets and TX completion
+//   maintenance: time-sync requests, the periodic reports, the flash
+//                store and config commits, whose programming waits belong
+//                at the bottom
+// Ingest runs highest so the RX rings drain even while TX is backed up.
+// These are the defaults; the config store can override them per board,
+// read when the threads are created.
+#define TELEMETRY_RX_PRIORITY 4u
+#define TELEMETRY_TX_PRIORITY 5u
+#define TELEMETRY_MAINT_PRIORITY 6u
+
+// Stack sizes are in mem_budget.h.
+TX_THREAD telemetry_rx_thread;
+TX_THREAD telemetry_tx_thread;
+TX_THREAD telemetry_maint_thread;
+MEM_ARENA(stack) ULONG
+    telemetry_rx_thread_stack[TELEMETRY_RX_STACK_SIZE / sizeof(ULONG)];
+MEM_ARENA(stack) ULONG
+    telemetry_tx_thread_stack[TELEMETRY_TX_STACK_SIZE / sizeof(ULONG)];
+MEM_ARENA(stack) ULONG
+    telemetry_maint_thread_stack[TELEMETRY_MAINT_STACK_SIZE / sizeof(ULONG)];
+
+// How often the Rust heap counters are published:
+#define HEAP_REPORT_PERIOD_MS 10000u
+
+// Uptime after which allocations count as steady-state (rust_heap_seal()):
+// the router's queues and tables have grown to their working size by then.
+#ifndef TELEMETRY_HEAP_SEAL_MS
+#define TELEMETRY_HEAP_SEAL_MS 5000u
+#endif
+
+// Default health summary period (config key, 0 = off):
+#ifndef TELEMETRY_HEALTH_PERIOD_MS
+#define TELEMETRY_HEALTH_PERIOD_MS 1000u
+#endif
+#define TELEMETRY_HEALTH_PERIOD_MAX_MS 3600000u
+
+// Every this many health summaries also go out as a result record
+// (telemetry_result_record()), for result_collect.py; 0 = never.
+#ifndef TELEMETRY_HEALTH_RESULT_EVERY
+#define TELEMETRY_HEALTH_RESULT_EVERY 10u
+#endif
 
-TX_THREAD telemetry_thread;
-#define TELEMETRY_THREAD_STACK_SIZE 1024u
-ULONG telemetry_thread_stack[TELEMETRY_THREAD_STACK_SIZE / sizeof(ULONG)];
+// Longest the ingest and dispatch threads block without an event. Backstop
+// for router work left over when a processing pass hits its time budget.
+#define TELEMETRY_IDLE_WAKE_MS 50u
 
-// How often this node requests a resync from the master:
-#define TIMESYNC_REQUEST_PERIOD_MS 2000u   // e.g. every 2 seconds
+// Intake ring records handed to the router per pass.
+#define TELEMETRY_INTAKE_BATCH 16u
+
+static TX_EVENT_FLAGS_GROUP telemetry_events;
+static volatile UCHAR telemetry_events_ready = 0;
 
 #ifndef TX_TIMER_TICKS_PER_SECOND
 #error "TX_TIMER_TICKS_PER_SECOND must be defined by ThreadX."
@@ -20,9 +97,930 @@ static uint64_t tx_now_ms(void) {
     return ((uint64_t)(uint32_t)ticks * 1000ULL) / (uint64_t)TX_TIMER_TICKS_PER_SECOND;
 }
 
-void telemetry_thread_entry(ULONG initial_input)
+static ULONG ms_to_ticks(uint64_t ms) {
+    uint64_t ticks = (ms * (uint64_t)TX_TIMER_TICKS_PER_SECOND + 999ULL) / 1000ULL;
+    return (ticks == 0) ? 1u : (ULONG)ticks;
+}
+
+void telemetry_thread_notify(ULONG flags)
+{
+    if (telemetry_events_ready) {
+        (void)tx_event_flags_set(&telemetry_events, flags, TX_OR);
+    }
+}
+
+static void telemetry_can_rx_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_CAN_RX);
+}
+
+static void telemetry_can_pack_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_CAN_PACK);
+}
+
+static void telemetry_can_tx_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_CAN_TX);
+}
+
+static void telemetry_usb_rx_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_USB_RX);
+}
+
+#ifdef UART_LINK_ENABLED
+static void telemetry_uart_rx_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_UART_RX);
+}
+#endif
+
+#ifdef SPI_LINK_ENABLED
+static void telemetry_spi_rx_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_SPI_RX);
+}
+#endif
+
+#ifdef USB_GS_USB_ENABLED
+static void telemetry_gs_tx_notify(void)
+{
+    telemetry_thread_notify(TELEMETRY_EVT_GS_TX);
+}
+#endif
+
+// Publish allocator counters as a text message so they show up in any log
+// viewer without a new data type.
+static void report_heap_stats(void)
+{
+    rust_heap_stats_t st;
+    rust_heap_get_stats(&st);
+
+    char txt[256];
+    int n = snprintf(txt, sizeof(txt),
+                     "heap live=%lu peak=%lu allocs=%lu fail=%lu "
+                     "bp_free=%lu bp_frags=%lu bp_big=%lu steady=%s%lu/%lu hist=",
+                     (unsigned long)st.live_bytes, (unsigned long)st.peak_bytes,
+                     (unsigned long)st.alloc_count, (unsigned long)st.failed_count,
+                     (unsigned long)st.byte_pool_free,
+                     (unsigned long)st.byte_pool_fragments,
+                     (unsigned long)st.largest_free_fragment,
+                     st.sealed ? "" : "-", (unsigned long)st.steady_allocs,
+                     (unsigned long)st.steady_pool_allocs);
+    for (unsigned i = 0; i < RUST_HEAP_HIST_BINS && n > 0 && (size_t)n < sizeof(txt); i++) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, "%s%lu",
+                      i ? "/" : "", (unsigned long)st.size_hist[i]);
+    }
+    for (unsigned i = 0; i < RUST_HEAP_CLASS_COUNT && n > 0 && (size_t)n < sizeof(txt); i++) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, " c%lu=%lu/%lu/%lu",
+                      (unsigned long)st.class_block_size[i],
+                      (unsigned long)st.class_in_use[i],
+                      (unsigned long)st.class_peak[i],
+                      (unsigned long)st.class_exhausted[i]);
+    }
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+// Router lock counters (telemetry_hooks.h): per lock takes/contended, the
+// longest wait and hold and the mean hold in us; then the critical
+// sections. Nothing until the router has created a lock.
+static void report_lock_stats(void)
+{
+    rust_lock_stats_t st;
+    if (!rust_lock_get_stats(0, &st)) {
+        return;
+    }
+    uint32_t crit, crit_max, not_thread;
+    rust_lock_get_misc(&crit, &crit_max, &not_thread);
+    char txt[224];
+    int n = snprintf(txt, sizeof(txt), "locks crit=%lu/%lucyc isr=%lu",
+                     (unsigned long)crit, (unsigned long)crit_max,
+                     (unsigned long)not_thread);
+    for (unsigned i = 0; n > 0 && (size_t)n < sizeof(txt) &&
+                         rust_lock_get_stats(i, &st); i++) {
+        const uint32_t mean =
+            st.acquires ? (uint32_t)(st.hold_total_us / st.acquires) : 0u;
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n,
+                      " %s=%lu/%lu/%lu/%lu/%lu", st.name ? st.name : "?",
+                      (unsigned long)st.acquires, (unsigned long)st.contended,
+                      (unsigned long)st.wait_max_us,
+                      (unsigned long)st.hold_max_us, (unsigned long)mean);
+    }
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+// One text message per sender with fragment/loss counters and the learned
+// reassembly timeout, sent with the heap report.
+static void report_can_stats(void)
+{
+    can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+    can_bus_id_stats_t st[8];
+    uint32_t untracked = 0;
+    const size_t count = can_bus_get_all_id_stats(
+        bus, st, sizeof(st) / sizeof(st[0]), &untracked);
+
+    char txt[192];
+    for (size_t i = 0; i < count; i++) {
+        int n = snprintf(txt, sizeof(txt),
+                         "can id=0x%03x frags=%lu done=%lu exp=%lu evict=%lu "
+                         "dup=%lu jump=%lu held=%lu orphan=%lu refused=%lu "
+                         "gap=%ums to=%ums",
+                         (unsigned)st[i].std_id,
+                         (unsigned long)st[i].frags_rx,
+                         (unsigned long)st[i].msgs_completed,
+                         (unsigned long)st[i].msgs_expired,
+                         (unsigned long)st[i].msgs_evicted,
+                         (unsigned long)st[i].dup_frags,
+                         (unsigned long)st[i].seq_jumps,
+                         (unsigned long)st[i].frags_held,
+                         (unsigned long)st[i].frags_orphaned,
+                         (unsigned long)st[i].starts_refused,
+                         (unsigned)st[i].gap_avg_ms,
+                         (unsigned)st[i].timeout_ms);
+        if (n <= 0) {
+            continue;
+        }
+        if ((size_t)n >= sizeof(txt)) {
+            n = (int)sizeof(txt) - 1;
+        }
+        (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+    }
+    if (untracked != 0) {
+        const int n = snprintf(txt, sizeof(txt), "can untracked frags=%lu",
+                               (unsigned long)untracked);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    // Busiest IDs: id:frames/bytes/min-max gap in us.
+    can_bus_talker_t top[4];
+    uint32_t evicted = 0;
+    const size_t ntop = can_bus_get_talkers(bus, top, sizeof(top) / sizeof(top[0]),
+                                            &evicted);
+    if (ntop != 0) {
+        int n = snprintf(txt, sizeof(txt), "can top evict=%lu",
+                         (unsigned long)evicted);
+        for (size_t i = 0; i < ntop && n > 0 && (size_t)n < sizeof(txt); i++) {
+            n += snprintf(&txt[n], sizeof(txt) - (size_t)n,
+                          " %s%lx:%lu/%lu/%lu-%lu",
+                          (top[i].id & CAN_BUS_TALKER_EXT) ? "x" : "",
+                          (unsigned long)(top[i].id & ~CAN_BUS_TALKER_EXT),
+                          (unsigned long)top[i].frames,
+                          (unsigned long)top[i].bytes,
+                          (unsigned long)top[i].gap_min_us,
+                          (unsigned long)top[i].gap_max_us);
+        }
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    for (unsigned f = 0; f < 2; f++) {
+        can_bus_rx_ring_stats_t rs;
+        if (can_bus_get_rx_ring_stats(bus, (can_bus_rx_fifo_t)f, &rs) != HAL_OK) {
+            continue;
+        }
+        const int n = snprintf(txt, sizeof(txt),
+                               "can rx%u pol=%u used=%lu hw=%lu/%lu frames=%lu "
+                               "drop=%lu flush=%lu stall=%lu",
+                               f, (unsigned)rs.policy,
+                               (unsigned long)rs.used_bytes,
+                               (unsigned long)rs.high_water_bytes,
+                               (unsigned long)rs.size_bytes,
+                               (unsigned long)rs.frames,
+                               (unsigned long)rs.dropped,
+                               (unsigned long)rs.flushed,
+                               (unsigned long)rs.stalls);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_monitor_t mon;
+    can_bus_get_monitor(bus, &mon);
+    {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can bus load=%u%% tx=%lu/s %lubps "
+                               "rx=%lu/s %lubps tec=%u rec=%u st=%u "
+                               "ew=%lu ep=%lu boff=%lu/%lums phold=%lu "
+                               "err=%lu",
+                               (unsigned)mon.load_pct,
+                               (unsigned long)mon.tx_fps,
+                               (unsigned long)mon.tx_bps,
+                               (unsigned long)mon.rx_fps,
+                               (unsigned long)mon.rx_bps,
+                               (unsigned)mon.tec, (unsigned)mon.rec,
+                               (unsigned)mon.state,
+                               (unsigned long)mon.warnings,
+                               (unsigned long)mon.passives,
+                               (unsigned long)mon.bus_offs,
+                               (unsigned long)mon.backoff_ms,
+                               (unsigned long)mon.passive_holds,
+                               (unsigned long)mon.errors);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_bitrate_t rate;
+    can_bus_get_bitrate(bus, &rate);
+    if (rate.detected || rate.listen_only) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can rate nom=%lu data=%lu detected=%u "
+                               "data_checked=%u tried=%u listen=%u",
+                               (unsigned long)rate.nominal_bps,
+                               (unsigned long)rate.data_bps,
+                               (unsigned)rate.detected,
+                               (unsigned)rate.data_checked,
+                               (unsigned)rate.tried,
+                               (unsigned)rate.listen_only);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_tx_event_stats_t es;
+    can_bus_get_tx_event_stats(bus, &es);
+    if (es.events != 0 || es.arb_lost != 0 || es.nacked != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can txev n=%lu lost=%lu lat=%lu/%lu/%luus "
+                               "arb=%lu nack=%lu err=%lu retry=%lu/%lu",
+                               (unsigned long)es.events,
+                               (unsigned long)es.events_lost,
+                               (unsigned long)es.lat_min_us,
+                               (unsigned long)es.lat_avg_us,
+                               (unsigned long)es.lat_max_us,
+                               (unsigned long)es.arb_lost,
+                               (unsigned long)es.nacked,
+                               (unsigned long)es.bus_errors,
+                               (unsigned long)es.retried,
+                               (unsigned long)es.retry_dropped);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_pack_stats_t ps;
+    can_bus_get_pack_stats(bus, &ps);
+    if (ps.tx_frames != 0 || ps.rx_frames != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can pack tx=%lu/%lu rx=%lu/%lu bad=%lu",
+                               (unsigned long)ps.tx_records,
+                               (unsigned long)ps.tx_frames,
+                               (unsigned long)ps.rx_records,
+                               (unsigned long)ps.rx_frames,
+                               (unsigned long)ps.rx_bad);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_single_stats_t ss;
+    can_bus_get_single_stats(bus, &ss);
+    if (ss.tx != 0 || ss.rx != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can single tx=%lu rx=%lu bad=%lu",
+                               (unsigned long)ss.tx,
+                               (unsigned long)ss.rx,
+                               (unsigned long)ss.rx_bad);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_express_stats_t xp;
+    can_bus_get_express_stats(bus, &xp);
+    if (xp.msgs != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can express msgs=%lu frames=%lu",
+                               (unsigned long)xp.msgs,
+                               (unsigned long)xp.frames);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    telemetry_agg_load_stats_t al;
+    telemetry_agg_get_load_stats(&al);
+    if (al.step_downs != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "agg level=%u load=%u%% down=%lu up=%lu",
+                               (unsigned)al.level,
+                               (unsigned)al.load_pct,
+                               (unsigned long)al.step_downs,
+                               (unsigned long)al.step_ups);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    telemetry_rate_stats_t rs;
+    telemetry_rate_get_stats(&rs);
+    if (rs.step_downs != 0 || rs.remote_applied != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "rate level=%u load=%u%% backlog=%u%% down=%lu "
+                               "up=%lu remote=%u applied=%lu expired=%lu",
+                               (unsigned)rs.level, (unsigned)rs.load_pct,
+                               (unsigned)rs.backlog_pct,
+                               (unsigned long)rs.step_downs,
+                               (unsigned long)rs.step_ups,
+                               (unsigned)rs.remote_types,
+                               (unsigned long)rs.remote_applied,
+                               (unsigned long)rs.remote_expired);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    telemetry_mem_stats_t mp;
+    telemetry_mem_get_stats(&mp);
+    if (mp.step_downs != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "mem level=%u pressure=%u%% peak=%u%% down=%lu "
+                               "up=%lu failed=%lu cap_stops=%lu",
+                               (unsigned)mp.level, (unsigned)mp.pressure_pct,
+                               (unsigned)mp.peak_pct,
+                               (unsigned long)mp.step_downs,
+                               (unsigned long)mp.step_ups,
+                               (unsigned long)mp.alloc_failed,
+                               (unsigned long)mp.captures_stopped);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    // Only worth a line once some message went in short frames.
+    can_bus_frag_size_stats_t fz;
+    can_bus_get_frag_size_stats(bus, &fz);
+    uint32_t short_msgs = 0;
+    for (unsigned i = 0; i + 1u < CAN_BUS_FRAG_SIZES; i++) {
+        short_msgs += fz.msgs[i];
+    }
+    if (short_msgs != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can frag sizes 12=%lu 16=%lu 20=%lu 24=%lu 32=%lu 48=%lu 64=%lu",
+                               (unsigned long)fz.msgs[0], (unsigned long)fz.msgs[1],
+                               (unsigned long)fz.msgs[2], (unsigned long)fz.msgs[3],
+                               (unsigned long)fz.msgs[4], (unsigned long)fz.msgs[5],
+                               (unsigned long)fz.msgs[6]);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_rtx_stats_t xs;
+    can_bus_get_rtx_stats(bus, &xs);
+    if (xs.nacks_tx != 0 || xs.nacks_rx != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can rtx nack_tx=%lu nack_rx=%lu stale=%lu resent=%lu",
+                               (unsigned long)xs.nacks_tx,
+                               (unsigned long)xs.nacks_rx,
+                               (unsigned long)xs.nacks_stale,
+                               (unsigned long)xs.frags_resent);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_fec_stats_t fs;
+    can_bus_get_fec_stats(bus, &fs);
+    if (fs.parity_tx != 0 || fs.parity_rx != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can fec tx=%lu rx=%lu recovered=%lu lost=%lu",
+                               (unsigned long)fs.parity_tx,
+                               (unsigned long)fs.parity_rx,
+                               (unsigned long)fs.recovered,
+                               (unsigned long)fs.unrecoverable);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bus_flow_stats_t ws;
+    can_bus_get_flow_stats(bus, &ws);
+    if (ws.credits_tx != 0 || ws.credits_rx != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "can credit tx=%lu rx=%lu held=%lu",
+                               (unsigned long)ws.credits_tx,
+                               (unsigned long)ws.credits_rx,
+                               (unsigned long)ws.sends_held);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    isotp_stats_t is;
+    isotp_get_stats(&is);
+    if (is.rx_msgs != 0 || is.tx_msgs != 0 || is.rx_aborted != 0 ||
+        is.tx_aborted != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "isotp rx=%lu tx=%lu rx_abort=%lu tx_abort=%lu",
+                               (unsigned long)is.rx_msgs,
+                               (unsigned long)is.tx_msgs,
+                               (unsigned long)is.rx_aborted,
+                               (unsigned long)is.tx_aborted);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    can_bulk_stats_t bs;
+    can_bulk_get_stats(&bs);
+    if (bs.rx_xfers != 0 || bs.tx_xfers != 0 || bs.rx_aborted != 0 ||
+        bs.tx_aborted != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "bulk rx=%lu tx=%lu rx_abort=%lu tx_abort=%lu "
+                               "rewind=%lu",
+                               (unsigned long)bs.rx_xfers,
+                               (unsigned long)bs.tx_xfers,
+                               (unsigned long)bs.rx_aborted,
+                               (unsigned long)bs.tx_aborted,
+                               (unsigned long)bs.rewinds);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+    proto_timer_stats_t pts;
+    proto_timer_get_stats(&pts);
+    if (pts.fired != 0 || pts.armed != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "timers armed=%lu fired=%lu cascaded=%lu",
+                               (unsigned long)pts.armed,
+                               (unsigned long)pts.fired,
+                               (unsigned long)pts.cascaded);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+#ifdef CAN_PEER_ENABLED
+    can_peer_stats_t cps;
+    can_peer_get_stats(&cps);
+    {
+        const int n = snprintf(txt, sizeof(txt),
+                               "peers n=%u classic=%u adv_tx=%lu adv_rx=%lu "
+                               "expired=%lu full=%lu conflict=%lu",
+                               (unsigned)cps.peers, (unsigned)cps.classic,
+                               (unsigned long)cps.adverts_tx,
+                               (unsigned long)cps.adverts_rx,
+                               (unsigned long)cps.expired,
+                               (unsigned long)cps.table_full,
+                               (unsigned long)cps.conflicts);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+    telemetry_usb_merge_stats_t ms;
+    telemetry_usb_merge_get_stats(&ms);
+    if (ms.queued != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "usb merge q=%lu sent=%lu forced=%lu "
+                               "bypass=%lu late=%lu hwm=%lu",
+                               (unsigned long)ms.queued, (unsigned long)ms.sent,
+                               (unsigned long)ms.forced,
+                               (unsigned long)ms.bypassed,
+                               (unsigned long)ms.late,
+                               (unsigned long)ms.held_hwm);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+
+#ifdef SPI_LINK_ENABLED
+    spi_link_stats_t sl;
+    spi_link_get_stats(&sl);
+    if (sl.rx_bad != 0 || sl.rx_busy != 0 || sl.resyncs != 0 || sl.tx_busy != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "spi link xfers=%lu bad=%lu busy=%lu rep=%lu "
+                               "resync=%lu txbusy=%lu",
+                               (unsigned long)sl.xfers, (unsigned long)sl.rx_bad,
+                               (unsigned long)sl.rx_busy,
+                               (unsigned long)sl.rx_repeats,
+                               (unsigned long)sl.resyncs,
+                               (unsigned long)sl.tx_busy);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+#ifdef UART_LINK_ENABLED
+    telemetry_link_stats_t ls;
+    telemetry_link_get_stats(&ls);
+    if (ls.held != 0 || ls.dropped != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "uart link sent=%lu held=%lu newer=%lu "
+                               "stale=%lu drop=%lu pend=%lu",
+                               (unsigned long)ls.sent, (unsigned long)ls.held,
+                               (unsigned long)ls.superseded,
+                               (unsigned long)ls.stale,
+                               (unsigned long)ls.dropped,
+                               (unsigned long)ls.pending);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+    if (ls.hc_in_bytes != 0 || ls.hc_rx_dropped != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "uart hdr in=%lu out=%lu rxdrop=%lu",
+                               (unsigned long)ls.hc_in_bytes,
+                               (unsigned long)ls.hc_out_bytes,
+                               (unsigned long)ls.hc_rx_dropped);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+#ifdef CAN_GW_ENABLED
+    can_gw_stats_t gws;
+    can_gw_get_stats(&gws);
+    {
+        const int n = snprintf(txt, sizeof(txt),
+                               "gw role=%u share=%u peer=%u beat_tx=%lu "
+                               "beat_rx=%lu takeover=%lu shed=%lu other=%lu",
+                               (unsigned)gws.role, (unsigned)gws.share,
+                               (unsigned)gws.peer_node,
+                               (unsigned long)gws.beats_tx,
+                               (unsigned long)gws.beats_rx,
+                               (unsigned long)gws.takeovers,
+                               (unsigned long)gws.shed,
+                               (unsigned long)gws.others);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+#ifdef APP_TASK_ENABLED
+    for (int h = 0; h < (int)APP_TASK_MAX; h++) {
+        app_task_stats_t ts;
+        if (!app_task_get_stats(h, &ts) || ts.releases == 0) {
+            continue;
+        }
+        const int n = snprintf(txt, sizeof(txt),
+                               "task %s run=%lu miss=%lu skip=%lu jit=%lu/%lu us "
+                               "exec=%lu/%lu us",
+                               ts.name ? ts.name : "?",
+                               (unsigned long)ts.releases,
+                               (unsigned long)ts.misses,
+                               (unsigned long)ts.skipped,
+                               (unsigned long)ts.jitter_last_us,
+                               (unsigned long)ts.jitter_max_us,
+                               (unsigned long)(ts.exec_total_us / ts.releases),
+                               (unsigned long)ts.exec_max_us);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+#ifdef CORO_ENABLED
+    coro_stats_t cs;
+    for (unsigned i = 0; coro_get_stats(i, &cs); i++) {
+        const int n = snprintf(txt, sizeof(txt), "coro %s run=%lu exec=%lu/%lu us",
+                               cs.name ? cs.name : "?",
+                               (unsigned long)cs.runs,
+                               (unsigned long)cs.run_avg_us,
+                               (unsigned long)cs.run_max_us);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+#ifdef LOW_POWER_STOP_ENABLED
+    low_power_stats_t lp;
+    low_power_get_stats(&lp);
+    if (lp.stops != 0) {
+        const int n = snprintf(txt, sizeof(txt),
+                               "lp stop=%lu wake=%lu/%lu/%lu/%lu lat=%lu/%lu us "
+                               "stopped=%lu ms",
+                               (unsigned long)lp.stops,
+                               (unsigned long)lp.wake_timer,
+                               (unsigned long)lp.wake_can,
+                               (unsigned long)lp.wake_usb,
+                               (unsigned long)lp.wake_other,
+                               (unsigned long)lp.lat_last_us,
+                               (unsigned long)lp.lat_max_us,
+                               (unsigned long)(lp.stopped_us / 1000u));
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+#endif
+
+    uint32_t resp_sent = 0, resp_dropped = 0;
+    can_bus_get_responder_stats(bus, &resp_sent, &resp_dropped);
+    if (resp_sent != 0 || resp_dropped != 0) {
+        const int n = snprintf(txt, sizeof(txt), "can responder sent=%lu drop=%lu",
+                               (unsigned long)resp_sent,
+                               (unsigned long)resp_dropped);
+        if (n > 0 && (size_t)n < sizeof(txt)) {
+            (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+        }
+    }
+}
+
+// Servo state and sync quality, sent with the heap report. The histograms
+// are per response; the bin edges are listed in telemetry.h.
+// Master with a GNSS receiver: how well the clock follows the PPS.
+static void report_pps_stats(void)
+{
+    telemetry_pps_stats_t st;
+    telemetry_pps_get_stats(&st);
+    if (st.edges == 0) {
+        return;
+    }
+    char txt[128];
+    const int n = snprintf(txt, sizeof(txt),
+                           "pps n=%lu lab=%lu step=%lu lock=%u err=%ldus "
+                           "drift=%ldppb age=%lums",
+                           (unsigned long)st.edges, (unsigned long)st.labelled,
+                           (unsigned long)st.steps, (unsigned)st.locked,
+                           (long)st.last_err_us, (long)st.drift_ppb,
+                           (unsigned long)st.last_edge_age_ms);
+    if (n > 0) {
+        (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt,
+                                         ((size_t)n < sizeof(txt)) ? (size_t)n : sizeof(txt) - 1u, 1);
+    }
+}
+
+static void report_boundary_stats(void)
+{
+    telemetry_boundary_stats_t st;
+    telemetry_boundary_get_stats(&st);
+    if (st.frames_rx == 0 && st.frames_tx == 0) {
+        return;
+    }
+    char txt[96];
+    const int n = snprintf(txt, sizeof(txt),
+                           "timesync down serve=%u tx=%lu rx=%lu refused=%lu",
+                           (unsigned)st.serving, (unsigned long)st.frames_tx,
+                           (unsigned long)st.frames_rx,
+                           (unsigned long)st.refused);
+    if (n > 0) {
+        (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt,
+                                         ((size_t)n < sizeof(txt)) ? (size_t)n : sizeof(txt) - 1u, 1);
+    }
+}
+
+static void report_timesync_stats(void)
+{
+    report_boundary_stats();
+
+    telemetry_timesync_stats_t st;
+    telemetry_timesync_get_stats(&st);
+    if (st.samples == 0 && st.syncs == 0 && st.rejected_steps == 0) {
+        report_pps_stats();
+        return; // master, or nothing heard yet
+    }
+
+    char txt[256];
+    int n = snprintf(txt, sizeof(txt),
+                     "timesync st=%u lock=%u off=%ldus dly=%luus floor=%luus "
+                     "jit=%luus age=%lums per=%lums drift=%ldppb n=%lu "
+                     "sync=%lu burst=%lu/%lu step=%lu rej=%lu hoff=",
+                     (unsigned)st.servo_state, (unsigned)st.locked,
+                     (long)st.last_offset_us, (unsigned long)st.last_delay_us,
+                     (unsigned long)st.delay_floor_us,
+                     (unsigned long)st.jitter_us,
+                     (unsigned long)st.last_good_age_ms,
+                     (unsigned long)st.period_ms, (long)st.drift_ppb,
+                     (unsigned long)st.samples, (unsigned long)st.syncs,
+                     (unsigned long)st.bursts_rejected,
+                     (unsigned long)st.bursts, (unsigned long)st.steps,
+                     (unsigned long)st.rejected_steps);
+    for (unsigned i = 0; i < TELEMETRY_TIMESYNC_HIST_BINS && n > 0 && (size_t)n < sizeof(txt); i++) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, "%s%lu",
+                      i ? "/" : "", (unsigned long)st.offset_hist[i]);
+    }
+    if (n > 0 && (size_t)n < sizeof(txt)) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, " hdly=");
+    }
+    for (unsigned i = 0; i < TELEMETRY_TIMESYNC_HIST_BINS && n > 0 && (size_t)n < sizeof(txt); i++) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, "%s%lu",
+                      i ? "/" : "", (unsigned long)st.delay_hist[i]);
+    }
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+// Router queue latency since boot, sent with the heap report.
+static void report_qlat_stats(void)
+{
+    static const char *const names[TELEMETRY_QUEUE_COUNT] = {"rx", "tx"};
+    char txt[224];
+    int n = snprintf(txt, sizeof(txt), "qlat");
+    for (unsigned q = 0; q < TELEMETRY_QUEUE_COUNT && n > 0 && (size_t)n < sizeof(txt); q++) {
+        telemetry_qlat_stats_t st;
+        telemetry_qlat_get_stats((telemetry_queue_t)q, &st);
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n,
+                      " %s n=%lu p50=%luus p99=%luus max=%luus pend=%lu skip=%lu"
+                      " depth=%lu idle=%lu bud=%lums",
+                      names[q], (unsigned long)st.samples,
+                      (unsigned long)st.p50_us, (unsigned long)st.p99_us,
+                      (unsigned long)st.max_us, (unsigned long)st.pending,
+                      (unsigned long)st.untracked, (unsigned long)st.depth,
+                      (unsigned long)st.idle, (unsigned long)st.budget_ms);
+    }
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+// Trace latency per origin or data type, with the health summary: key as
+// hex, then samples/p50/p99/max us. Nothing until a traced packet arrives.
+static void report_trace(telemetry_trace_table_t table, const char *what)
+{
+    telemetry_trace_stats_t st;
+    if (!telemetry_trace_get_stats(table, 0, &st)) {
+        return;
+    }
+    char txt[224];
+    int n = snprintf(txt, sizeof(txt), "health.trace %s", what);
+    for (size_t i = 0; n > 0 && (size_t)n < sizeof(txt) &&
+                       telemetry_trace_get_stats(table, i, &st); i++) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n,
+                      " %x=%lu/%lu/%lu/%lu", (unsigned)st.key,
+                      (unsigned long)st.samples, (unsigned long)st.p50_us,
+                      (unsigned long)st.p99_us, (unsigned long)st.max_us);
+    }
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+// CAN RX interrupt latency histograms, FIFO0 then FIFO1: frames, then the
+// count of each bin (bin i below 1 us << i) up to the last non-empty one.
+static void report_rx_lat(void)
+{
+    can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+    char txt[224];
+    const int head = snprintf(txt, sizeof(txt), "health.rxlat");
+    int n = head;
+    for (unsigned f = 0; f < 2u && n > 0 && (size_t)n < sizeof(txt); f++) {
+        can_bus_rx_lat_stats_t st;
+        if (can_bus_get_rx_lat_stats(bus, (can_bus_rx_fifo_t)f, &st) != HAL_OK ||
+            st.frames == 0) {
+            continue;
+        }
+        unsigned last = 0;
+        for (unsigned i = 0; i < CAN_BUS_RX_LAT_BINS; i++) {
+            if (st.hist[i] != 0) {
+                last = i;
+            }
+        }
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, " %s=%lu:",
+                      f ? "fifo1" : "fifo0", (unsigned long)st.frames);
+        for (unsigned i = 0; i <= last && n > 0 && (size_t)n < sizeof(txt); i++) {
+            n += snprintf(txt + n, sizeof(txt) - (size_t)n, "%s%lu",
+                          i ? "/" : "", (unsigned long)st.hist[i]);
+        }
+    }
+    if (n <= head || (size_t)n >= sizeof(txt)) {
+        return;
+    }
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+}
+
+// Every TELEMETRY_HEALTH_RESULT_EVERY-th summary as a result record.
+static void report_health_result(const telemetry_health_t *h)
+{
+    _Static_assert(sizeof(*h) <= 4u * TELEMETRY_RESULT_METRICS_MAX,
+                   "health summary too large for a result record");
+    static uint32_t count = 0;
+    if (TELEMETRY_HEALTH_RESULT_EVERY == 0u ||
+        ++count < TELEMETRY_HEALTH_RESULT_EVERY) {
+        return;
+    }
+    count = 0;
+    uint32_t m[sizeof(*h) / 4u];
+    memcpy(m, h, sizeof(m)); // the sample struct is packed
+    (void)telemetry_result_record(TELEMETRY_RESULT_SRC_HEALTH, "health", m,
+                                  sizeof(m) / sizeof(m[0]));
+}
+
+// One health summary. Binary on TELEMETRY_HEALTH_TYPE when the schema has
+// one (layout in telemetry.h), else the same fields as text.
+static void report_health(void)
+{
+    telemetry_health_t h;
+    telemetry_health_collect(&h);
+    report_health_result(&h);
+#ifdef TELEMETRY_HEALTH_TYPE
+    (void)LOG_TELEMETRY_SAMPLE(TELEMETRY_HEALTH_TYPE, h);
+#else
+    char txt[224];
+    int n = snprintf(txt, sizeof(txt),
+                     "health v=%lu up=%lus cpu=%lu/%lu/%lu/%lu/%lu "
+                     "heap=%lu/%lu/%lu ring=%lu/%lu reasm=%lu/%lu "
+                     "intake=%lu/%lu/%lu q=%lu%% can=%lu%%/%lu/%lu/%lu "
+                     "ts=%ld/%lu/%lu",
+                     (unsigned long)h.version, (unsigned long)h.uptime_s,
+                     (unsigned long)h.cpu_idle_pm, (unsigned long)h.cpu_isr_pm,
+                     (unsigned long)h.cpu_rx_pm, (unsigned long)h.cpu_tx_pm,
+                     (unsigned long)h.cpu_maint_pm, (unsigned long)h.heap_live,
+                     (unsigned long)h.heap_peak, (unsigned long)h.heap_failed,
+                     (unsigned long)h.rx_ring_hw_bytes,
+                     (unsigned long)h.rx_ring_dropped,
+                     (unsigned long)h.reasm_done,
+                     (unsigned long)h.reasm_expired,
+                     (unsigned long)h.intake_high, (unsigned long)h.intake_mid,
+                     (unsigned long)h.intake_low,
+                     (unsigned long)h.queue_heap_pct,
+                     (unsigned long)h.can_load_pct, (unsigned long)h.can_tec,
+                     (unsigned long)h.can_rec, (unsigned long)h.can_state,
+                     (long)(int32_t)h.ts_offset_us,
+                     (unsigned long)h.ts_delay_us, (unsigned long)h.ts_locked);
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+
+    // Side counters as a second line, rx/tx packets:bytes then rej/io/bad.
+    static const char *const side_names[TELEMETRY_SIDE_COUNT] = {"can", "usb",
+                                                                 "uart", "spi"};
+    n = snprintf(txt, sizeof(txt), "health.side");
+    for (unsigned s = 0; s < TELEMETRY_SIDE_COUNT && n > 0 && (size_t)n < sizeof(txt); s++) {
+        telemetry_side_stats_t ss;
+        telemetry_side_get_stats((telemetry_side_t)s, &ss);
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n,
+                      " %s=%lu:%lu/%lu:%lu/%lu/%lu/%lu", side_names[s],
+                      (unsigned long)ss.rx_packets, (unsigned long)ss.rx_bytes,
+                      (unsigned long)ss.tx_packets, (unsigned long)ss.tx_bytes,
+                      (unsigned long)ss.queue_rejects,
+                      (unsigned long)ss.io_errors, (unsigned long)ss.bad_args);
+    }
+    if (n > 0 && (size_t)n < sizeof(txt)) {
+        uint32_t dup;
+        telemetry_dedup_get_stats(&dup);
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, " dup=%lu",
+                      (unsigned long)dup);
+    }
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(txt)) {
+        n = (int)sizeof(txt) - 1;
+    }
+    (void)log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1);
+#endif
+    report_trace(TELEMETRY_TRACE_BY_ORIGIN, "org");
+    report_trace(TELEMETRY_TRACE_BY_TYPE, "ty");
+    report_rx_lat();
+}
+
+static ULONG wait_events(ULONG mask, uint64_t wait_ms)
+{
+    ULONG got = 0;
+    (void)tx_event_flags_get(&telemetry_events, mask, TX_OR_CLEAR, &got,
+                             ms_to_ticks(wait_ms));
+    return got;
+}
+
+void telemetry_rx_thread_entry(ULONG initial_input)
 {
     (void)initial_input;
+    boot_time_mark(BOOT_THREADS);
 
     // Ensure router exists early (so we can send requests immediately)
     (void)init_telemetry_router();
@@ -33,37 +1031,262 @@ void telemetry_thread_entry(ULONG initial_input)
                                     sizeof(started_txt),
                                     1);
 
-    uint64_t last_req_ms = 0;
+    can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+    for (;;) {
+        can_bus_process_rx(bus);
+        usb_cdc_process_rx();
+#ifdef UART_LINK_ENABLED
+        uart_link_process_rx();
+#endif
+#ifdef SPI_LINK_ENABLED
+        spi_link_process_rx();
+#endif
+        // Sized to the backlog; skipped while the queue is known empty.
+        const uint32_t rx_budget = telemetry_queue_budget_ms(TELEMETRY_QUEUE_RX);
+        if (rx_budget != 0) {
+            (void)process_rx_queue_timeout(rx_budget);
+        }
+        can_bus_process_rx(bus);
+        telemetry_capture_poll();
+        telemetry_tracex_poll();
+        telemetry_heap_trace_poll();
+        const uint32_t pcs_ms = telemetry_pc_sample_poll();
+        const uint32_t relay_ms = fw_relay_poll();
+        const uint32_t isotp_ms = isotp_poll();
+        const uint32_t file_ms = file_srv_poll();
+        const uint32_t bulk_ms = can_bulk_poll();
+        const uint32_t replay_ms = telemetry_replay_poll();
+        const uint32_t peer_ms = can_peer_poll();
+        const uint32_t gw_ms = can_gw_poll();
+        const uint32_t link_ms = telemetry_link_poll();
+        const uint32_t merge_ms = telemetry_usb_merge_poll();
+        const uint32_t timer_ms = proto_timer_poll();
+
+        uint64_t wait_ms = TELEMETRY_IDLE_WAKE_MS;
+        if (wait_ms > timer_ms) {
+            wait_ms = timer_ms; // reassembly NACK point or timeout
+        }
+        if (wait_ms > isotp_ms) {
+            wait_ms = isotp_ms; // next ISO-TP consecutive frame or timeout
+        }
+        if (wait_ms > bulk_ms) {
+            wait_ms = bulk_ms; // bulk transfer window or ack timeout
+        }
+        if (wait_ms > file_ms) {
+            wait_ms = file_ms; // file answer waiting for the TX ring
+        }
+        if (wait_ms > relay_ms) {
+            wait_ms = relay_ms; // firmware relay probe or answer timeout
+        }
+        if (wait_ms > replay_ms) {
+            wait_ms = replay_ms; // next replayed frame is due
+        }
+        if (wait_ms > peer_ms) {
+            wait_ms = peer_ms; // next discovery advert or peer expiry
+        }
+        if (wait_ms > gw_ms) {
+            wait_ms = gw_ms; // next gateway heartbeat or peer timeout
+        }
+        if (wait_ms > link_ms) {
+            wait_ms = link_ms; // UART budget covers the next held packet
+        }
+        if (wait_ms > merge_ms) {
+            wait_ms = merge_ms; // oldest merged packet leaves the window
+        }
+        if (wait_ms > pcs_ms) {
+            wait_ms = pcs_ms; // PC samples to stream before the ring fills
+        }
+        (void)wait_events(TELEMETRY_EVT_RX_ALL, wait_ms);
+    }
+}
+
+void telemetry_tx_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
 
+    ULONG woke = 1;
     for (;;) {
-        can_bus_process_rx();
-        (void)process_all_queues_timeout(5);
-        can_bus_process_rx();
+        const size_t taken = telemetry_intake_drain(TELEMETRY_INTAKE_BATCH);
+        // Sized to the backlog and the bulk CAN ring; an idle wake-up still
+        // makes a short pass, for anything the router queued on its own.
+        uint32_t tx_budget = telemetry_queue_budget_ms(TELEMETRY_QUEUE_TX);
+        if (tx_budget == 0 && woke == 0) {
+            tx_budget = 1u;
+        }
+        if (tx_budget != 0) {
+            (void)dispatch_tx_queue_timeout(tx_budget);
+        }
+        usb_gs_process_tx(); // host frames share this thread's CAN rings
+        if (taken == TELEMETRY_INTAKE_BATCH) {
+            continue; // intake backlog; the router queue went out meanwhile
+        }
+        // Woken by new packets, and by the CAN TX path freeing ring space
+        // after a send found it full; dispatch then resumes with the
+        // packets parked on it.
+        woke = wait_events(TELEMETRY_EVT_TX_ALL, TELEMETRY_IDLE_WAKE_MS);
+    }
+}
 
+void telemetry_maint_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
+
+    uint64_t last_req_ms = 0;
+    uint64_t last_heap_ms = 0;
+    uint64_t last_health_ms = 0;
+    (void)config_define(CONFIG_HEALTH_PERIOD_MS, TELEMETRY_HEALTH_PERIOD_MS, 0,
+                        TELEMETRY_HEALTH_PERIOD_MAX_MS, CONFIG_LIVE, NULL);
+
+    uint8_t sealed = 0;
+
+    for (;;) {
         const uint64_t now_ms = tx_now_ms();
-        if ((uint64_t)(now_ms - last_req_ms) >= (uint64_t)TIMESYNC_REQUEST_PERIOD_MS) {
+        if (!sealed && now_ms >= TELEMETRY_HEAP_SEAL_MS) {
+            rust_heap_seal();
+            sealed = 1;
+        }
+        // Request spacing comes from the clock servo (bursts, then a pause).
+        const uint64_t req_period = telemetry_timesync_interval_ms();
+        uint64_t since_req = (uint64_t)(now_ms - last_req_ms);
+        if (since_req >= req_period) {
             (void)telemetry_timesync_request();
             last_req_ms = now_ms;
+            since_req = 0;
         }
+        uint64_t since_heap = (uint64_t)(now_ms - last_heap_ms);
+        if (since_heap >= (uint64_t)HEAP_REPORT_PERIOD_MS) {
+            report_heap_stats();
+            report_lock_stats();
+            report_can_stats();
+            report_timesync_stats();
+            report_qlat_stats();
+            prof_report_telemetry();
+            stack_monitor_report();
+            boot_time_report();
+            last_heap_ms = now_ms;
+            since_heap = 0;
+        }
+        const uint64_t health_period = config_get(CONFIG_HEALTH_PERIOD_MS);
+        uint64_t since_health = (uint64_t)(now_ms - last_health_ms);
+        if (health_period != 0 && since_health >= health_period) {
+            report_health();
+            last_health_ms = now_ms;
+            since_health = 0;
+        }
+
+        const uint32_t blackbox_ms = telemetry_blackbox_poll();
+        const uint32_t store_ms = telemetry_store_poll();
+        (void)config_store_poll(); // woken early by a commit
+        const uint32_t fw_ms = fw_update_poll();
+        const uint32_t err_ms = telemetry_error_poll();
+        const uint32_t gnss_ms = gnss_time_poll();
+        const uint32_t agg_ms = telemetry_agg_load_poll();
+        const uint32_t rate_ms = telemetry_rate_poll();
+        const uint32_t mem_ms = telemetry_mem_poll();
+        const uint32_t bc_ms = telemetry_boundary_poll();
 
-        tx_thread_sleep(1);
+        // The servo may have shortened the interval after a response.
+        const uint64_t next_req = telemetry_timesync_interval_ms();
+        uint64_t wait_ms = (next_req > since_req) ? next_req - since_req : 0;
+        if (wait_ms > HEAP_REPORT_PERIOD_MS - since_heap) {
+            wait_ms = HEAP_REPORT_PERIOD_MS - since_heap;
+        }
+        if (health_period != 0 && wait_ms > health_period - since_health) {
+            wait_ms = health_period - since_health;
+        }
+        if (!sealed && wait_ms > TELEMETRY_HEAP_SEAL_MS - now_ms) {
+            wait_ms = TELEMETRY_HEAP_SEAL_MS - now_ms;
+        }
+        if (wait_ms > store_ms) {
+            wait_ms = store_ms; // flash staging, erases or replay pending
+        }
+        if (wait_ms > blackbox_ms) {
+            wait_ms = blackbox_ms; // bus-off check or dump under way
+        }
+        if (wait_ms > fw_ms) {
+            wait_ms = fw_ms; // firmware update pages to program
+        }
+        if (wait_ms > err_ms) {
+            wait_ms = err_ms; // suppressed error repeats to summarize
+        }
+        if (wait_ms > gnss_ms) {
+            wait_ms = gnss_ms; // NMEA bytes to parse, PPS edges to feed
+        }
+        if (wait_ms > agg_ms) {
+            wait_ms = agg_ms; // next bus load reading for the profiles
+        }
+        if (wait_ms > rate_ms) {
+            wait_ms = rate_ms; // rate broadcast, or a remote table lapsing
+        }
+        if (wait_ms > mem_ms) {
+            wait_ms = mem_ms; // next heap pressure reading
+        }
+        if (wait_ms > bc_ms) {
+            wait_ms = bc_ms; // downstream SYNC or FOLLOW_UP
+        }
+        (void)tx_thread_sleep(ms_to_ticks(wait_ms));
     }
 }
 
-void create_telemetry_thread(void)
+static void start_thread(TX_THREAD *t, CHAR *name, void (*entry)(ULONG),
+                         ULONG *stack, ULONG stack_size, UINT priority)
 {
-    UINT status = tx_thread_create(&telemetry_thread,
-                                   "Telemetry Thread",
-                                   telemetry_thread_entry,
-                                   0,
-                                   telemetry_thread_stack,
-                                   TELEMETRY_THREAD_STACK_SIZE,
-                                   5,
-                                   5,
-                                   TX_NO_TIME_SLICE,
-                                   TX_AUTO_START);
+    const UINT status = tx_thread_create(t,
+                                         name,
+                                         entry,
+                                         0,
+                                         stack,
+                                         stack_size,
+                                         priority,
+                                         priority,
+                                         TX_NO_TIME_SLICE,
+                                         TX_AUTO_START);
+    if (status != TX_SUCCESS) {
+        die("Failed to create %s: %u", name, (unsigned)status);
+    }
+}
 
+void create_telemetry_thread(void)
+{
+    UINT status = tx_event_flags_create(&telemetry_events, "Telemetry Events");
     if (status != TX_SUCCESS) {
-        die("Failed to create telemetry thread: %u", (unsigned)status);
+        die("Failed to create telemetry events: %u", (unsigned)status);
     }
+    telemetry_events_ready = 1;
+    can_bus_t *bus = can_bus_get(TELEMETRY_CAN_BUS);
+    can_bus_set_rx_notify(bus, telemetry_can_rx_notify);
+    can_bus_set_pack_notify(bus, telemetry_can_pack_notify);
+    can_bus_set_tx_notify(bus, telemetry_can_tx_notify);
+    usb_cdc_set_rx_notify(telemetry_usb_rx_notify);
+#ifdef UART_LINK_ENABLED
+    uart_link_set_rx_notify(telemetry_uart_rx_notify);
+#endif
+#ifdef SPI_LINK_ENABLED
+    spi_link_set_rx_notify(telemetry_spi_rx_notify);
+#endif
+#ifdef USB_GS_USB_ENABLED
+    usb_gs_attach(bus);
+    usb_gs_set_tx_notify(telemetry_gs_tx_notify);
+#endif
+
+    const uint32_t max_prio = TX_MAX_PRIORITIES - 1u;
+    const UINT rx_prio = (UINT)config_define(CONFIG_TELEMETRY_RX_PRIORITY,
+                                             TELEMETRY_RX_PRIORITY, 1u,
+                                             max_prio, 0, NULL);
+    const UINT tx_prio = (UINT)config_define(CONFIG_TELEMETRY_TX_PRIORITY,
+                                             TELEMETRY_TX_PRIORITY, 1u,
+                                             max_prio, 0, NULL);
+    const UINT maint_prio = (UINT)config_define(
+        CONFIG_TELEMETRY_MAINT_PRIORITY, TELEMETRY_MAINT_PRIORITY, 1u,
+        max_prio, 0, NULL);
+
+    start_thread(&telemetry_rx_thread, "Telemetry RX",
+                 telemetry_rx_thread_entry, telemetry_rx_thread_stack,
+                 TELEMETRY_RX_STACK_SIZE, rx_prio);
+    start_thread(&telemetry_tx_thread, "Telemetry TX",
+                 telemetry_tx_thread_entry, telemetry_tx_thread_stack,
+                 TELEMETRY_TX_STACK_SIZE, tx_prio);
+    start_thread(&telemetry_maint_thread, "Telemetry Maint",
+                 telemetry_maint_thread_entry, telemetry_maint_thread_stack,
+                 TELEMETRY_MAINT_STACK_SIZE, maint_prio);
 }
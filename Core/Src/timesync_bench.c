@@ -0,0 +1,292 @@
+// timesync_bench.c
+//
+// Time-sync convergence and accuracy bench; see timesync_bench.h. Built
+// only with TIMESYNC_BENCH_ENABLED (CMake option ENABLE_TIMESYNC_BENCH).
+//
+//  - one thread: it sleeps until TIMESYNC_BENCH_LEAD_US before the next
+//  pulse time, spins on telemetry_now_us() with interrupts on, and the last
+//  TIMESYNC_BENCH_IRQ_OFF_US with them off, so the edge lands within a
+//  clock read of the synced time. The report is formatted after a pulse,
+//  never in the spin.
+//  - everything measured comes from telemetry_timesync_get_stats(): the
+//  steady-state histogram is the sample histogram minus a copy taken when
+//  the first lock is seen, the traffic is the frame counters' growth.
+//
+// Notes / Assumptions:
+//  - The thread sits above the telemetry threads and spins up to
+//  TIMESYNC_BENCH_LEAD_US per pulse; at the defaults that is 0.2% of the
+//  CPU, taken at the same moment on every board.
+//  - A clock step during the spin moves the target: a step back by more
+//  than the lead drops that pulse rather than spin it out.
+//  - The steady-state copy is taken on the first pass after the lock, so a
+//  sample from the burst that locked can land on either side.
+//  - The pulse pin is set up here; PB11 is free on this board.
+#include "timesync_bench.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "mem_budget.h"
+#include "telemetry.h"
+#include "stm32g4xx_hal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef TIMESYNC_BENCH_ENABLED
+
+#ifndef TELEMETRY_TIME_MASTER
+#define TELEMETRY_TIME_MASTER 0
+#endif
+
+// Two ticks: the sleep can wake up to one tick late.
+#ifndef TIMESYNC_BENCH_LEAD_US
+#define TIMESYNC_BENCH_LEAD_US (2000000u / TX_TIMER_TICKS_PER_SECOND)
+#endif
+
+#ifndef TIMESYNC_BENCH_IRQ_OFF_US
+#define TIMESYNC_BENCH_IRQ_OFF_US 5u
+#endif
+
+// Above the telemetry threads, so the wake-up isn't queued behind them.
+#define TIMESYNC_BENCH_PRIORITY 1u
+
+#if defined(NET_TIMESYNC_STEP_ONLY) && NET_TIMESYNC_STEP_ONLY
+#define TIMESYNC_BENCH_MODE_NAME "step"
+#elif defined(NET_TIMESYNC_SW_STAMPS) && NET_TIMESYNC_SW_STAMPS
+#define TIMESYNC_BENCH_MODE_NAME "sw"
+#else
+#define TIMESYNC_BENCH_MODE_NAME "servo"
+#endif
+
+#if TELEMETRY_TIME_MASTER
+#define TSB_TX_BYTES TELEMETRY_TIMESYNC_RESP_BYTES
+#define TSB_RX_BYTES TELEMETRY_TIMESYNC_REQ_BYTES
+#else
+#define TSB_TX_BYTES TELEMETRY_TIMESYNC_REQ_BYTES
+#define TSB_RX_BYTES TELEMETRY_TIMESYNC_RESP_BYTES
+#endif
+
+static TX_THREAD timesync_bench_thread;
+static MEM_ARENA(stack) ULONG timesync_bench_stack[TIMESYNC_BENCH_STACK_SIZE / sizeof(ULONG)];
+
+static timesync_bench_result_t g_res;
+static uint8_t g_have_snap = 0;
+static uint32_t g_snap_samples = 0;
+static uint32_t g_snap_hist[TELEMETRY_TIMESYNC_HIST_BINS];
+static uint32_t g_last_bursts = 0;
+static uint32_t g_last_tx = 0;
+static uint32_t g_last_rx = 0;
+static uint32_t g_last_report_ms = 0;
+
+void timesync_bench_get(timesync_bench_result_t *out)
+{
+    if (!out) {
+        return;
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = g_res;
+    __set_PRIMASK(primask);
+}
+
+static void pulse_pin_init(void)
+{
+    if (!TIMESYNC_BENCH_PULSE_PIN) {
+        return;
+    }
+    TIMESYNC_BENCH_PULSE_PORT->BSRR = (uint32_t)TIMESYNC_BENCH_PULSE_PIN << 16;
+    GPIO_InitTypeDef init = {0};
+    init.Pin = TIMESYNC_BENCH_PULSE_PIN;
+    init.Mode = GPIO_MODE_OUTPUT_PP;
+    init.Pull = GPIO_NOPULL;
+    init.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    HAL_GPIO_Init(TIMESYNC_BENCH_PULSE_PORT, &init);
+}
+
+// Wait for synced time t_us and pulse the pin there if `fire`. 0 when a
+// clock step moved t_us out of reach.
+static int pulse_at(uint64_t t_us, int fire)
+{
+    for (;;) {
+        const uint64_t now = telemetry_now_us();
+        if (now + TIMESYNC_BENCH_LEAD_US >= t_us) {
+            break;
+        }
+        const uint64_t ticks = ((t_us - now - TIMESYNC_BENCH_LEAD_US) *
+                                TX_TIMER_TICKS_PER_SECOND) / 1000000ULL;
+        if (ticks == 0) {
+            break;
+        }
+        tx_thread_sleep(ticks > 0xFFFFFFFFull ? 0xFFFFFFFFu : (ULONG)ticks);
+    }
+    if (!fire) {
+        return 1;
+    }
+
+    for (;;) {
+        const uint64_t now = telemetry_now_us();
+        if (now + TIMESYNC_BENCH_IRQ_OFF_US >= t_us) {
+            break;
+        }
+        if (t_us - now > 2u * TIMESYNC_BENCH_LEAD_US) {
+            return 0; // stepped back
+        }
+    }
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    while (telemetry_now_us() < t_us) {
+    }
+    TIMESYNC_BENCH_PULSE_PORT->BSRR = (uint32_t)TIMESYNC_BENCH_PULSE_PIN;
+    __set_PRIMASK(primask);
+
+    const uint64_t end = telemetry_now_us() + TIMESYNC_BENCH_PULSE_WIDTH_US;
+    while (telemetry_now_us() < end) {
+    }
+    TIMESYNC_BENCH_PULSE_PORT->BSRR = (uint32_t)TIMESYNC_BENCH_PULSE_PIN << 16;
+    return 1;
+}
+
+static void tsb_line(const char *txt, int n)
+{
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= 256u) {
+        n = 255;
+    }
+    printf("%s\r\n", txt);
+    for (unsigned t = 0; t < 10u; t++) {
+        if (log_telemetry_asynchronous(SEDS_DT_MESSAGE_DATA, txt, (size_t)n, 1) !=
+            TELEMETRY_WOULD_BLOCK) {
+            break;
+        }
+        tx_thread_sleep(1);
+    }
+}
+
+static void report(const telemetry_timesync_stats_t *st)
+{
+    char txt[256];
+    int n = snprintf(txt, sizeof(txt),
+                     "tsb mode=%s lock=%u conv=%lums off=%ldus jit=%luus "
+                     "pulses=%lu steady=%lu smax=%luus sh=",
+                     TIMESYNC_BENCH_MODE_NAME, (unsigned)g_res.locked,
+                     (unsigned long)g_res.converge_ms, (long)st->last_offset_us,
+                     (unsigned long)st->jitter_us, (unsigned long)g_res.pulses,
+                     (unsigned long)g_res.steady_samples,
+                     (unsigned long)g_res.steady_max_us);
+    for (unsigned i = 0; i < TELEMETRY_TIMESYNC_HIST_BINS && n > 0 && (size_t)n < sizeof(txt); i++) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, "%s%lu",
+                      i ? "/" : "", (unsigned long)g_res.steady_hist[i]);
+    }
+    if (n > 0 && (size_t)n < sizeof(txt)) {
+        n += snprintf(txt + n, sizeof(txt) - (size_t)n, " fps=%lu bps=%lu",
+                      (unsigned long)g_res.frames_per_s,
+                      (unsigned long)g_res.bytes_per_s);
+    }
+    tsb_line(txt, n);
+
+    uint32_t m[7u + TELEMETRY_TIMESYNC_HIST_BINS] = {
+        g_res.locked,         g_res.converge_ms,   g_res.pulses,
+        g_res.steady_samples, g_res.steady_max_us, g_res.frames_per_s,
+        g_res.bytes_per_s};
+    memcpy(&m[7], g_res.steady_hist, sizeof(g_res.steady_hist));
+    (void)telemetry_result_record(TELEMETRY_RESULT_SRC_TIMESYNC,
+                                  TIMESYNC_BENCH_MODE_NAME, m,
+                                  sizeof(m) / sizeof(m[0]));
+}
+
+static void update(void)
+{
+    telemetry_timesync_stats_t st;
+    telemetry_timesync_get_stats(&st);
+
+    timesync_bench_result_t r = g_res;
+    r.locked = TELEMETRY_TIME_MASTER ? 1u : st.locked;
+    r.converge_ms = st.converge_ms;
+    if (st.converge_ms != 0 && !g_have_snap) {
+        memcpy(g_snap_hist, st.offset_hist, sizeof(g_snap_hist));
+        g_snap_samples = st.samples;
+        g_last_bursts = st.bursts;
+        g_have_snap = 1;
+    }
+    if (g_have_snap) {
+        r.steady_samples = st.samples - g_snap_samples;
+        for (unsigned i = 0; i < TELEMETRY_TIMESYNC_HIST_BINS; i++) {
+            r.steady_hist[i] = st.offset_hist[i] - g_snap_hist[i];
+        }
+        if (st.bursts != g_last_bursts) {
+            const int64_t o = st.last_offset_us;
+            const uint64_t mag = (uint64_t)((o < 0) ? -o : o);
+            const uint32_t m = (mag > UINT32_MAX) ? UINT32_MAX : (uint32_t)mag;
+            if (m > r.steady_max_us) {
+                r.steady_max_us = m;
+            }
+            g_last_bursts = st.bursts;
+        }
+    }
+
+    const uint32_t now = HAL_GetTick();
+    const uint32_t dt = now - g_last_report_ms;
+    const int due = dt >= TIMESYNC_BENCH_REPORT_MS;
+    if (due) {
+        const uint64_t dtx = st.frames_tx - g_last_tx;
+        const uint64_t drx = st.frames_rx - g_last_rx;
+        r.frames_per_s = (uint32_t)(((dtx + drx) * 1000u) / dt);
+        r.bytes_per_s =
+            (uint32_t)(((dtx * TSB_TX_BYTES + drx * TSB_RX_BYTES) * 1000u) / dt);
+        g_last_tx = st.frames_tx;
+        g_last_rx = st.frames_rx;
+        g_last_report_ms = now;
+    }
+
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    g_res = r;
+    __set_PRIMASK(primask);
+    if (due) {
+        report(&st);
+    }
+}
+
+static void timesync_bench_thread_entry(ULONG initial_input)
+{
+    (void)initial_input;
+    pulse_pin_init();
+    g_last_report_ms = HAL_GetTick();
+
+    const uint64_t period_us = (uint64_t)TIMESYNC_BENCH_PULSE_PERIOD_MS * 1000ULL;
+    for (;;) {
+        const uint64_t t = (telemetry_now_us() / period_us + 1u) * period_us;
+        const int fire = TIMESYNC_BENCH_PULSE_PIN &&
+                         (TELEMETRY_TIME_MASTER || g_res.converge_ms != 0);
+        if (pulse_at(t, fire) && fire) {
+            g_res.pulses++; // only this thread writes g_res
+        }
+        update();
+    }
+}
+
+void create_timesync_bench_thread(void)
+{
+    const UINT status = tx_thread_create(&timesync_bench_thread,
+                                         "Timesync bench",
+                                         timesync_bench_thread_entry,
+                                         0,
+                                         timesync_bench_stack,
+                                         TIMESYNC_BENCH_STACK_SIZE,
+                                         TIMESYNC_BENCH_PRIORITY,
+                                         TIMESYNC_BENCH_PRIORITY,
+                                         TX_NO_TIME_SLICE,
+                                         TX_AUTO_START);
+    if (status != TX_SUCCESS) {
+        die("Failed to create timesync bench thread: %u", (unsigned)status);
+    }
+}
+
+#else
+
+void create_timesync_bench_thread(void)
+{
+}
+
+#endif /* TIMESYNC_BENCH_ENABLED */
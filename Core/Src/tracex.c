@@ -0,0 +1,46 @@
+// tracex.c
+//
+// RAM buffer for the ThreadX event trace (tracex.h):
+//  - tracex_init() turns on the cycle counter the port stamps events with
+//  (TX_TRACE_TIME_SOURCE is DWT->CYCCNT) and hands ThreadX the buffer.
+//  - a snapshot filters every event instead of disabling the trace, so the
+//  buffer and its registry stay as they were; tx_trace_enable() would start
+//  them over.
+//
+// Built only with TX_ENABLE_EVENT_TRACE (CMake option ENABLE_TRACEX).
+//
+// Notes / Assumptions:
+//  - Objects created while a snapshot is read out still go into the
+//  registry; at run time there are none.
+
+#include "tracex.h"
+
+#ifdef TX_ENABLE_EVENT_TRACE
+
+#include "stm32g4xx_hal.h"
+
+static uint8_t g_tracex_buf[TRACEX_BUFFER_BYTES] __attribute__((aligned(4)));
+static uint8_t g_tracex_on = 0;
+
+#define TRACEX_EVERY_EVENT (TX_TRACE_ALL_EVENTS | TX_TRACE_USER_EVENTS)
+
+void tracex_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  g_tracex_on = tx_trace_enable(g_tracex_buf, sizeof(g_tracex_buf),
+                                TRACEX_REGISTRY_ENTRIES) == TX_SUCCESS;
+}
+
+int tracex_freeze(const uint8_t **buf, size_t *len) {
+  if (!g_tracex_on || !buf || !len) return 0;
+  (void)tx_trace_event_filter(TRACEX_EVERY_EVENT);
+  *buf = g_tracex_buf;
+  *len = sizeof(g_tracex_buf);
+  return 1;
+}
+
+void tracex_resume(void) {
+  if (g_tracex_on) (void)tx_trace_event_unfilter(TRACEX_EVERY_EVENT);
+}
+
+#endif
@@ -0,0 +1,173 @@
+// tx_execution_profile.c
+//
+// Cycle accounting behind TX_EXECUTION_PROFILE_ENABLE. Every cycle is charged
+// to exactly one of: the running thread, ISRs (outermost nesting level only),
+// or idle (no thread scheduled, including time spent in the scheduler).
+
+#include "tx_api.h"
+
+#ifdef TX_EXECUTION_PROFILE_ENABLE
+
+#include "stm32g4xx.h"
+#include "itm_trace.h"
+
+extern TX_THREAD *_tx_thread_current_ptr;
+
+static TX_THREAD *exec_current = TX_NULL;
+static ULONG exec_isr_nest = 0;
+static EXECUTION_TIME_SOURCE_TYPE exec_isr_start = 0;
+static EXECUTION_TIME_SOURCE_TYPE exec_idle_start = 0;
+static EXECUTION_TIME exec_isr_total = 0;
+static EXECUTION_TIME exec_idle_total = 0;
+
+// Counter delta; unsigned subtraction absorbs one CYCCNT wrap.
+static inline EXECUTION_TIME elapsed(EXECUTION_TIME_SOURCE_TYPE from,
+                                     EXECUTION_TIME_SOURCE_TYPE now)
+{
+    return (EXECUTION_TIME)(EXECUTION_TIME_SOURCE_TYPE)(now - from);
+}
+
+void _tx_execution_initialize(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    exec_idle_start = TX_EXECUTION_TIME_SOURCE;
+}
+
+// Scheduler hooks run in PendSV with interrupts enabled around them, so the
+// updates below are made with interrupts masked.
+
+void _tx_execution_thread_enter(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    const EXECUTION_TIME_SOURCE_TYPE now = TX_EXECUTION_TIME_SOURCE;
+    if (exec_current == TX_NULL) {
+        exec_idle_total += elapsed(exec_idle_start, now);
+    }
+    exec_current = _tx_thread_current_ptr;
+    if (exec_current != TX_NULL) {
+        exec_current->tx_thread_execution_time_last_start = now;
+        ITM_TRACE(ITM_EV_THREAD_IN, (uintptr_t)exec_current);
+    }
+    TX_RESTORE
+}
+
+void _tx_execution_thread_exit(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    const EXECUTION_TIME_SOURCE_TYPE now = TX_EXECUTION_TIME_SOURCE;
+    if (exec_current != TX_NULL) {
+        exec_current->tx_thread_execution_time_total +=
+            elapsed(exec_current->tx_thread_execution_time_last_start, now);
+        ITM_TRACE(ITM_EV_THREAD_OUT, (uintptr_t)exec_current);
+        exec_current = TX_NULL;
+        exec_idle_start = now;
+    }
+    TX_RESTORE
+}
+
+void _tx_execution_isr_enter(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    if (exec_isr_nest++ == 0u) {
+        const EXECUTION_TIME_SOURCE_TYPE now = TX_EXECUTION_TIME_SOURCE;
+        if (exec_current != TX_NULL) {
+            exec_current->tx_thread_execution_time_total +=
+                elapsed(exec_current->tx_thread_execution_time_last_start, now);
+        } else {
+            exec_idle_total += elapsed(exec_idle_start, now);
+        }
+        exec_isr_start = now;
+    }
+    TX_RESTORE
+}
+
+void _tx_execution_isr_exit(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    if (exec_isr_nest > 0u && --exec_isr_nest == 0u) {
+        const EXECUTION_TIME_SOURCE_TYPE now = TX_EXECUTION_TIME_SOURCE;
+        exec_isr_total += elapsed(exec_isr_start, now);
+        if (exec_current != TX_NULL) {
+            exec_current->tx_thread_execution_time_last_start = now;
+        } else {
+            exec_idle_start = now;
+        }
+    }
+    TX_RESTORE
+}
+
+UINT _tx_execution_thread_time_get(TX_THREAD *thread_ptr, EXECUTION_TIME *total_time)
+{
+    TX_INTERRUPT_SAVE_AREA
+    if (thread_ptr == TX_NULL || total_time == TX_NULL) {
+        return TX_PTR_ERROR;
+    }
+    TX_DISABLE
+    *total_time = thread_ptr->tx_thread_execution_time_total;
+    TX_RESTORE
+    return TX_SUCCESS;
+}
+
+UINT _tx_execution_thread_time_reset(TX_THREAD *thread_ptr)
+{
+    TX_INTERRUPT_SAVE_AREA
+    if (thread_ptr == TX_NULL) {
+        return TX_PTR_ERROR;
+    }
+    TX_DISABLE
+    thread_ptr->tx_thread_execution_time_total = 0;
+    if (thread_ptr == exec_current && exec_isr_nest == 0u) {
+        thread_ptr->tx_thread_execution_time_last_start = TX_EXECUTION_TIME_SOURCE;
+    }
+    TX_RESTORE
+    return TX_SUCCESS;
+}
+
+UINT _tx_execution_isr_time_get(EXECUTION_TIME *total_time)
+{
+    TX_INTERRUPT_SAVE_AREA
+    if (total_time == TX_NULL) {
+        return TX_PTR_ERROR;
+    }
+    TX_DISABLE
+    *total_time = exec_isr_total;
+    TX_RESTORE
+    return TX_SUCCESS;
+}
+
+UINT _tx_execution_isr_time_reset(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    exec_isr_total = 0;
+    TX_RESTORE
+    return TX_SUCCESS;
+}
+
+UINT _tx_execution_idle_time_get(EXECUTION_TIME *total_time)
+{
+    TX_INTERRUPT_SAVE_AREA
+    if (total_time == TX_NULL) {
+        return TX_PTR_ERROR;
+    }
+    TX_DISABLE
+    *total_time = exec_idle_total;
+    TX_RESTORE
+    return TX_SUCCESS;
+}
+
+UINT _tx_execution_idle_time_reset(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_DISABLE
+    exec_idle_total = 0;
+    TX_RESTORE
+    return TX_SUCCESS;
+}
+
+#endif /* TX_EXECUTION_PROFILE_ENABLE */
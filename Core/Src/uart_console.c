@@ -0,0 +1,191 @@
+// uart_console.c
+//
+// printf backend: producers copy into a byte ring inside a short PRIMASK
+// section (callers include ISRs, so a CAS reservation scheme could spin
+// against a preempted writer), then return. The drain side sends the
+// contiguous run at the tail with one DMA transfer; the half-transfer
+// interrupt hands the first half of that run back to producers early and
+// the transfer-complete interrupt releases the rest and starts the next run.
+
+#include "uart_console.h"
+#include "mem_sections.h"
+#include <string.h>
+
+#if defined(__ARMCC_VERSION) || defined(__GNUC__) || defined(__ICCARM__)
+#include "cmsis_compiler.h"
+#endif
+
+#ifndef UART_CONSOLE_RING_SIZE
+#define UART_CONSOLE_RING_SIZE 2048u // power of two
+#endif
+
+#ifndef UART_CONSOLE_TX_DMA_CHANNEL
+#define UART_CONSOLE_TX_DMA_CHANNEL DMA1_Channel2 // Channel1: DMA generator
+#endif
+#ifndef UART_CONSOLE_TX_DMA_REQUEST
+#define UART_CONSOLE_TX_DMA_REQUEST DMA_REQUEST_USART1_TX
+#endif
+#ifndef UART_CONSOLE_TX_DMA_IRQn
+#define UART_CONSOLE_TX_DMA_IRQn DMA1_Channel2_IRQn
+#endif
+#ifndef UART_CONSOLE_UART_IRQn
+#define UART_CONSOLE_UART_IRQn USART1_IRQn
+#endif
+// Below FDCAN and USB: console output is never urgent.
+#ifndef UART_CONSOLE_IRQ_PRIO
+#define UART_CONSOLE_IRQ_PRIO 10u
+#endif
+
+#if (UART_CONSOLE_RING_SIZE & (UART_CONSOLE_RING_SIZE - 1u)) != 0u
+#error "UART_CONSOLE_RING_SIZE must be a power of two"
+#endif
+
+static UART_HandleTypeDef *g_huart = NULL;
+static DMA_HandleTypeDef g_hdma_tx;
+
+static RAM_NOINIT char g_ring[UART_CONSOLE_RING_SIZE];
+static volatile uint32_t g_head = 0;     // producers
+static volatile uint32_t g_tail = 0;     // drain (DMA callbacks)
+static volatile uint32_t g_dma_len = 0;  // run in flight, 0 = idle
+static volatile uint32_t g_dma_freed = 0; // part of it already released
+static volatile uint32_t g_dropped = 0;
+
+static inline uint32_t irq_lock(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static inline void irq_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+// Caller must guarantee exclusion (ISR context, or IRQs masked).
+static void start_dma_locked(void) {
+  if (!g_huart || g_dma_len != 0) return;
+
+  const uint32_t avail = g_head - g_tail;
+  if (avail == 0) return;
+
+  const uint32_t idx = g_tail & (UART_CONSOLE_RING_SIZE - 1u);
+  uint32_t run = UART_CONSOLE_RING_SIZE - idx;
+  if (run > avail) run = avail;
+
+  g_dma_len = run;
+  g_dma_freed = 0;
+  if (HAL_UART_Transmit_DMA(g_huart, (uint8_t *)&g_ring[idx], (uint16_t)run) !=
+      HAL_OK) {
+    g_dma_len = 0; // retried on the next write
+  }
+}
+
+size_t uart_console_write(const char *data, size_t len) {
+  if (!data || len == 0) return 0;
+
+  const uint32_t primask = irq_lock();
+  const uint32_t free = UART_CONSOLE_RING_SIZE - (g_head - g_tail);
+  const uint32_t n = (len < free) ? (uint32_t)len : free;
+
+  const uint32_t idx = g_head & (UART_CONSOLE_RING_SIZE - 1u);
+  const uint32_t first = (n < UART_CONSOLE_RING_SIZE - idx)
+                             ? n
+                             : UART_CONSOLE_RING_SIZE - idx;
+  memcpy(&g_ring[idx], data, first);
+  memcpy(&g_ring[0], data + first, n - first);
+  g_head += n;
+  g_dropped += (uint32_t)len - n;
+
+  start_dma_locked();
+  irq_unlock(primask);
+  return n;
+}
+
+uint32_t uart_console_dropped(void) { return g_dropped; }
+
+// =========================
+// HAL callbacks (DMA / UART ISR)
+// =========================
+
+void HAL_UART_TxHalfCpltCallback(UART_HandleTypeDef *huart) {
+  if (huart != g_huart || g_dma_len == 0) return;
+  const uint32_t half = g_dma_len / 2u;
+  g_tail += half - g_dma_freed;
+  g_dma_freed = half;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+  if (huart != g_huart) return;
+  g_tail += g_dma_len - g_dma_freed;
+  g_dma_len = 0;
+  g_dma_freed = 0;
+  start_dma_locked();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+  if (huart != g_huart) return;
+  // Abandon the run in flight rather than stall the console.
+  g_tail += g_dma_len - g_dma_freed;
+  g_dma_len = 0;
+  g_dma_freed = 0;
+  start_dma_locked();
+}
+
+void uart_console_dma_irq(void) { HAL_DMA_IRQHandler(&g_hdma_tx); }
+
+void uart_console_uart_irq(void) {
+  if (g_huart) HAL_UART_IRQHandler(g_huart);
+}
+
+// =========================
+// Init
+// =========================
+
+HAL_StatusTypeDef uart_console_init(UART_HandleTypeDef *huart, uint32_t baud) {
+  if (!huart) return HAL_ERROR;
+
+  if (baud != 0 && baud != huart->Init.BaudRate) {
+    huart->Init.BaudRate = baud;
+    huart->Init.OverSampling = (baud > HAL_RCC_GetPCLK2Freq() / 16u)
+                                   ? UART_OVERSAMPLING_8
+                                   : UART_OVERSAMPLING_16;
+    if (HAL_UART_Init(huart) != HAL_OK) return HAL_ERROR;
+  }
+
+  g_hdma_tx.Instance = UART_CONSOLE_TX_DMA_CHANNEL;
+  g_hdma_tx.Init.Request = UART_CONSOLE_TX_DMA_REQUEST;
+  g_hdma_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  g_hdma_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+  g_hdma_tx.Init.MemInc = DMA_MINC_ENABLE;
+  g_hdma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  g_hdma_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  g_hdma_tx.Init.Mode = DMA_NORMAL;
+  g_hdma_tx.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&g_hdma_tx) != HAL_OK) return HAL_ERROR;
+  __HAL_LINKDMA(huart, hdmatx, g_hdma_tx);
+
+  HAL_NVIC_SetPriority(UART_CONSOLE_TX_DMA_IRQn, UART_CONSOLE_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(UART_CONSOLE_TX_DMA_IRQn);
+  HAL_NVIC_SetPriority(UART_CONSOLE_UART_IRQn, UART_CONSOLE_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(UART_CONSOLE_UART_IRQn);
+
+  const uint32_t primask = irq_lock();
+  g_huart = huart;
+  start_dma_locked(); // flush anything printed before init
+  irq_unlock(primask);
+  return HAL_OK;
+}
+
+// =========================
+// newlib / picolibc hooks (override the weak ones in syscalls.c)
+// =========================
+
+int _write(int file, char *ptr, int len) {
+  (void)file;
+  if (len <= 0) return 0;
+  (void)uart_console_write(ptr, (size_t)len);
+  return len; // dropped output is counted, not reported as an I/O error
+}
+
+int __io_putchar(int ch) {
+  const char c = (char)ch;
+  (void)uart_console_write(&c, 1);
+  return ch;
+}
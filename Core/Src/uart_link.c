@@ -0,0 +1,342 @@
+// uart_link.c
+//
+// UART side for the telemetry router:
+//  - RX: HAL_UARTEx_ReceiveToIdle_DMA() on a circular buffer. The RX event
+//  (half, full or idle line) only publishes how far DMA has written; the
+//  DMA buffer itself is the ring the thread reads from.
+//  - TX: two RAM buffers, one on the wire and one collecting frames; the
+//  TX-complete callback swaps them, so back-to-back frames go out without
+//  a gap waiting for the writer.
+//
+// Notes / Assumptions:
+//  - One writer thread calls uart_link_send_frame(); encoding runs outside
+//  the lock with the fill buffer marked busy (same scheme as usb_cdc.c).
+//  - One reader thread calls uart_link_process_rx(). If it falls more than
+//  UART_LINK_RX_DMA_SIZE behind, the lapped bytes are skipped and the frame
+//  in progress is dropped.
+
+#include "uart_link.h"
+#include "cobs.h"
+#include <string.h>
+
+#if defined(__ARMCC_VERSION) || defined(__GNUC__) || defined(__ICCARM__)
+#include "cmsis_compiler.h"
+#endif
+
+#ifndef UART_LINK_RX_DMA_SIZE
+#define UART_LINK_RX_DMA_SIZE 4096u // ~20 ms of slack at 2 Mbaud; power of two
+#endif
+
+#ifndef UART_LINK_TX_BUF_SIZE
+#define UART_LINK_TX_BUF_SIZE 1024u // per half of the TX double buffer
+#endif
+
+#ifndef UART_LINK_RX_FRAME_MAX
+#define UART_LINK_RX_FRAME_MAX 1024u // encoded bytes, delimiter excluded
+#endif
+
+#ifndef UART_LINK_RX_DMA_CHANNEL
+#define UART_LINK_RX_DMA_CHANNEL DMA1_Channel3
+#endif
+#ifndef UART_LINK_RX_DMA_REQUEST
+#define UART_LINK_RX_DMA_REQUEST DMA_REQUEST_USART1_RX
+#endif
+#ifndef UART_LINK_RX_DMA_IRQn
+#define UART_LINK_RX_DMA_IRQn DMA1_Channel3_IRQn
+#endif
+#ifndef UART_LINK_TX_DMA_CHANNEL
+#define UART_LINK_TX_DMA_CHANNEL DMA1_Channel2 // Channel1: DMA generator
+#endif
+#ifndef UART_LINK_TX_DMA_REQUEST
+#define UART_LINK_TX_DMA_REQUEST DMA_REQUEST_USART1_TX
+#endif
+#ifndef UART_LINK_TX_DMA_IRQn
+#define UART_LINK_TX_DMA_IRQn DMA1_Channel2_IRQn
+#endif
+#ifndef UART_LINK_UART_IRQn
+#define UART_LINK_UART_IRQn USART1_IRQn
+#endif
+#ifndef UART_LINK_IRQ_PRIO
+#define UART_LINK_IRQ_PRIO 7u // just below FDCAN bulk RX
+#endif
+
+#if (UART_LINK_RX_DMA_SIZE & (UART_LINK_RX_DMA_SIZE - 1u)) != 0u
+#error "UART_LINK_RX_DMA_SIZE must be a power of two"
+#endif
+
+static UART_HandleTypeDef *g_huart = NULL;
+static DMA_HandleTypeDef g_hdma_rx;
+static DMA_HandleTypeDef g_hdma_tx;
+
+// RX
+static uint8_t g_rx_dma[UART_LINK_RX_DMA_SIZE];
+static volatile uint32_t g_rx_head = 0; // bytes DMA has written (ISR)
+static uint32_t g_rx_tail = 0;          // bytes consumed (thread)
+static uint16_t g_rx_last_pos = 0;      // DMA position at the last event
+static volatile uint8_t g_rx_resync = 0; // reception restarted after an error
+static uint32_t g_rx_resync_at = 0;      // head value the restart began at
+
+static uint8_t g_rx_frame[UART_LINK_RX_FRAME_MAX];
+static size_t g_rx_frame_len = 0;
+static uint8_t g_rx_frame_drop = 0;
+
+static uart_link_rx_cb_t g_rx_cb = NULL;
+static void *g_rx_user = NULL;
+static uart_link_notify_cb_t g_rx_notify = NULL;
+
+// TX
+static uint8_t g_tx_buf[2][UART_LINK_TX_BUF_SIZE];
+static volatile uint8_t g_tx_fill_idx = 0;
+static volatile size_t g_tx_fill_len = 0;
+static volatile uint8_t g_tx_inflight = 0;
+static volatile uint8_t g_tx_writer_busy = 0;
+
+static uart_link_stats_t g_stats;
+
+static inline uint32_t irq_lock(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static inline void irq_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+// =========================
+// TX
+// =========================
+
+// Caller must guarantee exclusion (ISR context, or IRQs masked).
+static void tx_start_locked(void) {
+  if (!g_huart || g_tx_inflight || g_tx_writer_busy || g_tx_fill_len == 0) {
+    return;
+  }
+  const uint8_t idx = g_tx_fill_idx;
+  const uint16_t len = (uint16_t)g_tx_fill_len;
+
+  g_tx_fill_idx = (uint8_t)(idx ^ 1u);
+  g_tx_fill_len = 0;
+  g_tx_inflight = 1;
+  if (HAL_UART_Transmit_DMA(g_huart, g_tx_buf[idx], len) != HAL_OK) {
+    g_tx_inflight = 0; // frames lost; the link keeps going
+  }
+}
+
+HAL_StatusTypeDef uart_link_send_frame(const uint8_t *bytes, size_t len) {
+  if (!bytes || len == 0 || !g_huart) return HAL_ERROR;
+
+  const size_t need = COBS_MAX_ENCODED(len) + 1u; // + delimiter
+  if (need > UART_LINK_TX_BUF_SIZE) return HAL_ERROR;
+
+  uint32_t primask = irq_lock();
+  if (g_tx_fill_len + need > UART_LINK_TX_BUF_SIZE) {
+    g_stats.tx_busy++;
+    irq_unlock(primask);
+    return HAL_BUSY;
+  }
+  g_tx_writer_busy = 1;
+  uint8_t *dst = &g_tx_buf[g_tx_fill_idx][g_tx_fill_len];
+  irq_unlock(primask);
+
+  size_t n = cobs_encode(bytes, len, dst, need - 1u);
+  dst[n++] = 0x00;
+
+  primask = irq_lock();
+  g_tx_fill_len += n;
+  g_tx_writer_busy = 0;
+  g_stats.tx_frames++;
+  tx_start_locked();
+  irq_unlock(primask);
+  return HAL_OK;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+  if (huart != g_huart) return;
+  g_tx_inflight = 0;
+  tx_start_locked();
+}
+
+// =========================
+// RX
+// =========================
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t pos) {
+  if (huart != g_huart) return;
+  // `pos` is where DMA stands in the circular buffer (0..size).
+  const uint16_t last = g_rx_last_pos;
+  uint32_t delta;
+  if (pos >= last) {
+    delta = (uint32_t)(pos - last);
+  } else {
+    delta = (uint32_t)(UART_LINK_RX_DMA_SIZE - last) + pos;
+  }
+  g_rx_last_pos = pos;
+  if (delta == 0) return;
+
+  __DMB();
+  g_rx_head += delta;
+  if (g_rx_notify) g_rx_notify();
+}
+
+static HAL_StatusTypeDef rx_start(void) {
+  g_rx_last_pos = 0;
+  return HAL_UARTEx_ReceiveToIdle_DMA(g_huart, g_rx_dma,
+                                      (uint16_t)UART_LINK_RX_DMA_SIZE);
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+  if (huart != g_huart) return;
+  g_stats.rx_overruns++;
+  // Errors abort DMA reception; restart at the top of the buffer. Keep head
+  // aligned with the buffer index and let the reader skip the gap.
+  if (g_huart->RxState == HAL_UART_STATE_READY) {
+    const uint32_t head = g_rx_head;
+    const uint32_t skip =
+        (UART_LINK_RX_DMA_SIZE - (head & (UART_LINK_RX_DMA_SIZE - 1u))) &
+        (UART_LINK_RX_DMA_SIZE - 1u);
+    g_rx_resync_at = head + skip;
+    g_rx_resync = 1;
+    g_rx_head = head + skip;
+    (void)rx_start();
+  }
+  if (g_huart->gState == HAL_UART_STATE_READY && g_tx_inflight) {
+    g_tx_inflight = 0;
+    tx_start_locked();
+  }
+}
+
+static void rx_deliver_frame(void) {
+  if (g_rx_frame_drop || g_rx_frame_len == 0) return;
+  const size_t n =
+      cobs_decode(g_rx_frame, g_rx_frame_len, g_rx_frame, sizeof(g_rx_frame));
+  if (n == 0) {
+    g_stats.rx_bad_frames++;
+    return;
+  }
+  g_stats.rx_frames++;
+  if (g_rx_cb) g_rx_cb(g_rx_frame, n, g_rx_user);
+}
+
+void uart_link_process_rx(void) {
+  uint32_t tail = g_rx_tail;
+
+  const uint32_t primask = irq_lock();
+  const uint32_t head = g_rx_head;
+  if (g_rx_resync) {
+    g_rx_resync = 0;
+    tail = g_rx_resync_at;
+    g_rx_frame_drop = 1;
+  }
+  irq_unlock(primask);
+  __DMB();
+
+  if (head - tail > UART_LINK_RX_DMA_SIZE) {
+    // DMA lapped us: the oldest bytes are gone.
+    g_stats.rx_overruns++;
+    tail = head - UART_LINK_RX_DMA_SIZE;
+    g_rx_frame_drop = 1;
+  }
+  g_stats.rx_bytes += head - tail;
+
+  while (tail != head) {
+    const uint8_t b = g_rx_dma[tail & (UART_LINK_RX_DMA_SIZE - 1u)];
+    tail++;
+
+    if (b == 0x00) {
+      rx_deliver_frame();
+      g_rx_frame_len = 0;
+      g_rx_frame_drop = 0;
+    } else if (g_rx_frame_len < sizeof(g_rx_frame)) {
+      g_rx_frame[g_rx_frame_len++] = b;
+    } else if (!g_rx_frame_drop) {
+      g_rx_frame_drop = 1; // oversize: skip to the next delimiter
+      g_stats.rx_bad_frames++;
+    }
+  }
+  g_rx_tail = tail;
+}
+
+void uart_link_set_rx_handler(uart_link_rx_cb_t cb, void *user) {
+  g_rx_user = user;
+  g_rx_cb = cb;
+}
+
+void uart_link_set_rx_notify(uart_link_notify_cb_t cb) { g_rx_notify = cb; }
+
+void uart_link_get_stats(uart_link_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = irq_lock();
+  *out = g_stats;
+  irq_unlock(primask);
+}
+
+void uart_link_dma_rx_irq(void) { HAL_DMA_IRQHandler(&g_hdma_rx); }
+
+void uart_link_dma_tx_irq(void) { HAL_DMA_IRQHandler(&g_hdma_tx); }
+
+void uart_link_uart_irq(void) {
+  if (g_huart) HAL_UART_IRQHandler(g_huart);
+}
+
+// =========================
+// Init
+// =========================
+
+static HAL_StatusTypeDef dma_init(DMA_HandleTypeDef *hdma,
+                                  DMA_Channel_TypeDef *ch, uint32_t request,
+                                  uint32_t dir, uint32_t mode) {
+  hdma->Instance = ch;
+  hdma->Init.Request = request;
+  hdma->Init.Direction = dir;
+  hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma->Init.MemInc = DMA_MINC_ENABLE;
+  hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma->Init.Mode = mode;
+  hdma->Init.Priority = DMA_PRIORITY_HIGH;
+  return HAL_DMA_Init(hdma);
+}
+
+HAL_StatusTypeDef uart_link_init(UART_HandleTypeDef *huart, uint32_t baud) {
+  if (!huart) return HAL_ERROR;
+
+  if (baud != 0 && baud != huart->Init.BaudRate) {
+    huart->Init.BaudRate = baud;
+    huart->Init.OverSampling = (baud > HAL_RCC_GetPCLK2Freq() / 16u)
+                                   ? UART_OVERSAMPLING_8
+                                   : UART_OVERSAMPLING_16;
+    if (HAL_UART_Init(huart) != HAL_OK) return HAL_ERROR;
+  }
+
+  if (dma_init(&g_hdma_rx, UART_LINK_RX_DMA_CHANNEL, UART_LINK_RX_DMA_REQUEST,
+               DMA_PERIPH_TO_MEMORY, DMA_CIRCULAR) != HAL_OK ||
+      dma_init(&g_hdma_tx, UART_LINK_TX_DMA_CHANNEL, UART_LINK_TX_DMA_REQUEST,
+               DMA_MEMORY_TO_PERIPH, DMA_NORMAL) != HAL_OK) {
+    return HAL_ERROR;
+  }
+  __HAL_LINKDMA(huart, hdmarx, g_hdma_rx);
+  __HAL_LINKDMA(huart, hdmatx, g_hdma_tx);
+
+  HAL_NVIC_SetPriority(UART_LINK_RX_DMA_IRQn, UART_LINK_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(UART_LINK_RX_DMA_IRQn);
+  HAL_NVIC_SetPriority(UART_LINK_TX_DMA_IRQn, UART_LINK_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(UART_LINK_TX_DMA_IRQn);
+  HAL_NVIC_SetPriority(UART_LINK_UART_IRQn, UART_LINK_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(UART_LINK_UART_IRQn);
+
+  g_huart = huart;
+  return rx_start();
+}
+
+// =========================
+// newlib / picolibc hooks (override the weak ones in syscalls.c)
+// =========================
+
+// The console is not built alongside the link; printf output is discarded
+// rather than corrupting the frame stream.
+int _write(int file, char *ptr, int len) {
+  (void)file;
+  (void)ptr;
+  return (len > 0) ? len : 0;
+}
+
+int __io_putchar(int ch) { return ch; }
@@ -0,0 +1,142 @@
+// us_clock.c
+//
+// TIM2 counts microseconds up to 2^32 and wraps about every 71 minutes; the
+// update interrupt counts wraps into g_wraps. A reader samples g_wraps, CNT
+// and the pending update flag, and retries if the ISR ran in between. A
+// wrap that happened but hasn't been serviced yet (the reader preempted the
+// update interrupt) shows as UIF set with CNT in the lower half.
+//
+// Channel 1 provides a single one-shot alarm: only the low 32 bits of the
+// deadline are compared, which is why it has to be less than 2^31 us out.
+//
+// Channel 2 captures edges: CCR2 holds the low 32 bits, and the high ones
+// come from a read of the clock in the ISR, which can only be later.
+
+#include "us_clock.h"
+
+#ifndef US_CLOCK_TIM
+#define US_CLOCK_TIM TIM2
+#endif
+#ifndef US_CLOCK_IRQn
+#define US_CLOCK_IRQn TIM2_IRQn
+#endif
+// Only has to run once per wrap; readers cope with it being late.
+#ifndef US_CLOCK_IRQ_PRIO
+#define US_CLOCK_IRQ_PRIO 14u
+#endif
+
+static volatile uint32_t g_wraps = 0;
+static volatile uint8_t g_running = 0;
+static volatile us_clock_alarm_cb_t g_alarm_cb = NULL;
+static volatile us_clock_capture_cb_t g_capture_cb = NULL;
+
+uint64_t us_clock_now(void) {
+  if (!g_running) return 0;
+
+  uint32_t hi, lo, sr;
+  do {
+    hi = g_wraps;
+    lo = US_CLOCK_TIM->CNT;
+    sr = US_CLOCK_TIM->SR;
+  } while (hi != g_wraps);
+
+  if ((sr & TIM_SR_UIF) && lo < 0x80000000u) hi++;
+  return ((uint64_t)hi << 32) | lo;
+}
+
+void us_clock_set_alarm(uint64_t at_us, us_clock_alarm_cb_t cb) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  US_CLOCK_TIM->DIER &= ~TIM_DIER_CC1IE;
+  US_CLOCK_TIM->SR = (uint32_t)~TIM_SR_CC1IF;
+  g_alarm_cb = cb;
+  if (cb && g_running) {
+    US_CLOCK_TIM->CCR1 = (uint32_t)at_us;
+    US_CLOCK_TIM->DIER |= TIM_DIER_CC1IE;
+    // The match only fires on equality; catch a deadline already passed.
+    if ((int32_t)(US_CLOCK_TIM->CNT - (uint32_t)at_us) >= 0)
+      US_CLOCK_TIM->EGR = TIM_EGR_CC1G;
+  }
+  __set_PRIMASK(primask);
+}
+
+uint8_t us_clock_alarm_pending(void) {
+  return (US_CLOCK_TIM->DIER & TIM_DIER_CC1IE) ? 1u : 0u;
+}
+
+void us_clock_set_capture(us_clock_capture_cb_t cb, uint32_t filter) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  US_CLOCK_TIM->DIER &= ~TIM_DIER_CC2IE;
+  US_CLOCK_TIM->CCER &= ~(TIM_CCER_CC2E | TIM_CCER_CC2P | TIM_CCER_CC2NP);
+  g_capture_cb = cb;
+  if (cb) {
+    // CC2S = 01: IC2 on TI2, no prescaler; rising edge.
+    US_CLOCK_TIM->CCMR1 =
+        (US_CLOCK_TIM->CCMR1 & ~(TIM_CCMR1_CC2S | TIM_CCMR1_IC2PSC | TIM_CCMR1_IC2F)) |
+        TIM_CCMR1_CC2S_0 | ((filter & 0xFu) << TIM_CCMR1_IC2F_Pos);
+    US_CLOCK_TIM->SR = (uint32_t)~(TIM_SR_CC2IF | TIM_SR_CC2OF);
+    US_CLOCK_TIM->CCER |= TIM_CCER_CC2E;
+    US_CLOCK_TIM->DIER |= TIM_DIER_CC2IE;
+  }
+  __set_PRIMASK(primask);
+}
+
+void us_clock_advance(uint32_t us) {
+  const uint32_t before = US_CLOCK_TIM->CNT;
+  US_CLOCK_TIM->CNT = before + us;
+  if (before + us < before) g_wraps++; // no update event for a written wrap
+}
+
+void us_clock_irq(void) {
+  const uint32_t sr = US_CLOCK_TIM->SR;
+  if ((sr & TIM_SR_CC1IF) && (US_CLOCK_TIM->DIER & TIM_DIER_CC1IE)) {
+    US_CLOCK_TIM->DIER &= ~TIM_DIER_CC1IE;
+    US_CLOCK_TIM->SR = (uint32_t)~TIM_SR_CC1IF;
+    const us_clock_alarm_cb_t cb = g_alarm_cb;
+    g_alarm_cb = NULL;
+    if (cb) cb();
+  }
+
+  if ((sr & TIM_SR_CC2IF) && (US_CLOCK_TIM->DIER & TIM_DIER_CC2IE)) {
+    const uint32_t ccr = US_CLOCK_TIM->CCR2; // clears CC2IF
+    US_CLOCK_TIM->SR = (uint32_t)~TIM_SR_CC2OF; // an edge lost in between
+    const uint64_t now = us_clock_now();
+    const us_clock_capture_cb_t cb = g_capture_cb;
+    if (cb) cb(now - (uint32_t)((uint32_t)now - ccr));
+  }
+
+  if (!(sr & TIM_SR_UIF)) return;
+  // Count and acknowledge together, so a reader preempting this ISR never
+  // sees the wrap both counted and still pending.
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_wraps++;
+  US_CLOCK_TIM->SR = (uint32_t)~TIM_SR_UIF;
+  __set_PRIMASK(primask);
+}
+
+HAL_StatusTypeDef us_clock_init(void) {
+  // APB1 timers run at 2x PCLK1 unless the APB1 prescaler is 1.
+  uint32_t clk = HAL_RCC_GetPCLK1Freq();
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) clk *= 2u;
+  if (clk < 1000000u || (clk % 1000000u) != 0u) return HAL_ERROR;
+  const uint32_t psc = clk / 1000000u - 1u;
+  if (psc > 0xFFFFu) return HAL_ERROR;
+
+  __HAL_RCC_TIM2_CLK_ENABLE();
+  US_CLOCK_TIM->CR1 = 0;
+  US_CLOCK_TIM->PSC = psc;
+  US_CLOCK_TIM->ARR = 0xFFFFFFFFu;
+  US_CLOCK_TIM->CNT = 0;
+  US_CLOCK_TIM->EGR = TIM_EGR_UG; // latch PSC
+  US_CLOCK_TIM->SR = 0;
+  US_CLOCK_TIM->DIER = TIM_DIER_UIE;
+
+  g_wraps = 0;
+  HAL_NVIC_SetPriority(US_CLOCK_IRQn, US_CLOCK_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(US_CLOCK_IRQn);
+  US_CLOCK_TIM->CR1 = TIM_CR1_CEN;
+  g_running = 1;
+  return HAL_OK;
+}
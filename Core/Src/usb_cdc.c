@@ -0,0 +1,1083 @@
+// usb_cdc.c
+//
+// Minimal USB CDC-ACM device directly on the HAL PCD driver:
+//  - EP0 enumeration (device/config/string descriptors, address,
+//  configuration) plus the ACM line-coding / control-line requests
+//  - Bulk IN 0x81 uses the peripheral's double-buffered packet memory, fed
+//  from two RAM buffers: one in flight, one collecting new frames. A
+//  collecting buffer goes out once CDC_TX_COALESCE_BYTES are pending, when
+//  the other completes, or after CDC_TX_FLUSH_FRAMES start-of-frames
+//  - Bulk OUT 0x01 is copied into a byte ring by the ISR; the thread calling
+//  usb_cdc_process_rx() splits it into COBS frames
+//
+// Notes / Assumptions:
+//  - One writer thread (the telemetry router) calls usb_cdc_send_frame().
+//  Frames are encoded outside any lock: the writer marks the fill buffer
+//  busy, and the IN-complete ISR leaves it alone until the writer commits.
+//  - A frame is queued whole or not at all (HAL_BUSY), so the host never
+//  sees a torn frame.
+//  - OUT is flow-controlled by not re-arming the endpoint (host gets NAK)
+//  while the RX ring has no room for another packet.
+//  - All USB interrupts are on USB_LP_IRQn; thread-side HAL calls run with
+//  PRIMASK set and are short (at most one 64-byte PMA copy).
+//  - With USB_GS_USB_ENABLED the device is composite: the gs_usb vendor
+//  interface (usb_gs.c) comes first on EP 0x81/0x02, and the CDC function
+//  moves to interfaces 1-2 behind an IAD, on EP 0x83/0x03/0x84.
+//  - USB_MSC_ENABLED adds the read-only log disk (usb_msc.c) after the CDC
+//  function, on EP 0x85/0x05; the CDC function then sits behind an IAD too.
+//  - USB_CMD_EP_ENABLED adds the command pipe last: a vendor interface with
+//  interrupt EP 0x06/0x86. Host control frames sent there skip the bulk OUT
+//  ring, wait in a queue of their own that usb_cdc_process_rx() empties
+//  first, and their replies skip the coalescing IN buffers. Interrupt
+//  transfers get reserved bandwidth every frame, so a saturated bulk pipe
+//  doesn't delay them.
+
+#include "usb_cdc.h"
+#include "cobs.h"
+#include "mem_sections.h"
+#include "ring.h"
+#include <string.h>
+
+#ifdef USB_GS_USB_ENABLED
+#include "usb_gs.h"
+#endif
+#ifdef USB_MSC_ENABLED
+#include "usb_msc.h"
+#endif
+
+#if defined(USB_GS_USB_ENABLED) || defined(USB_MSC_ENABLED) ||               \
+    defined(USB_CMD_EP_ENABLED)
+#define CDC_COMPOSITE 1
+#endif
+
+#if defined(__ARMCC_VERSION) || defined(__GNUC__) || defined(__ICCARM__)
+#include "cmsis_compiler.h"
+#endif
+
+#ifndef CDC_TX_BUF_SIZE
+#define CDC_TX_BUF_SIZE 2048u // per half of the IN double buffer
+#endif
+
+// Start a transfer right away once this much is pending; below it, wait for
+// usb_cdc_flush() or the flush timeout so small frames share packets.
+#ifndef CDC_TX_COALESCE_BYTES
+#define CDC_TX_COALESCE_BYTES 256u
+#endif
+
+// Flush timeout: an idle IN pipe sends what is pending after this many
+// start-of-frame interrupts (1 ms each).
+#ifndef CDC_TX_FLUSH_FRAMES
+#define CDC_TX_FLUSH_FRAMES 1u
+#endif
+
+#ifndef CDC_RX_RING_SIZE
+#define CDC_RX_RING_SIZE 1024u // power of two
+#endif
+
+#ifndef CDC_RX_FRAME_MAX
+#define CDC_RX_FRAME_MAX 1024u // encoded bytes, delimiter excluded
+#endif
+
+#ifndef USB_CMD_QUEUE
+#define USB_CMD_QUEUE 2u // frames per direction, power of two
+#endif
+
+#ifdef USB_GS_USB_ENABLED
+#ifndef CDC_USB_VID
+#define CDC_USB_VID 0x1D50u // OpenMoko
+#endif
+#ifndef CDC_USB_PID
+#define CDC_USB_PID 0x606Fu // candleLight (gs_usb)
+#endif
+#else
+#ifndef CDC_USB_VID
+#define CDC_USB_VID 0x0483u // STMicroelectronics
+#endif
+#ifndef CDC_USB_PID
+#define CDC_USB_PID 0x5740u // Virtual COM Port
+#endif
+#endif
+
+#define CDC_EP0_MPS 64u
+#define CDC_DATA_MPS 64u
+#define CDC_CMD_MPS 8u
+
+// Packet memory layout: 8-entry BTABLE at 0x000, then 64-byte buffers.
+#define PMA_EP0_OUT 0x040u
+#define PMA_EP0_IN 0x080u
+
+#ifdef USB_GS_USB_ENABLED
+#define CDC_OUT_EP 0x03u
+#define CDC_IN_EP 0x83u
+#define CDC_CMD_EP 0x84u
+#define CDC_COMM_IF 1u // interface 0 is gs_usb
+
+#define PMA_GS_IN_0 0x0C0u
+#define PMA_GS_IN_1 0x100u
+#define PMA_GS_OUT 0x140u
+#define PMA_CDC_OUT 0x180u
+#define PMA_CDC_IN_0 0x1C0u
+#define PMA_CDC_IN_1 0x200u
+#define PMA_CDC_CMD 0x240u
+#define PMA_MSC_OUT 0x280u
+#define PMA_MSC_IN_0 0x2C0u
+#define PMA_MSC_IN_1 0x300u
+#define PMA_CMD_OUT 0x340u
+#define PMA_CMD_IN 0x380u
+#else
+#define CDC_OUT_EP 0x01u
+#define CDC_IN_EP 0x81u
+#define CDC_CMD_EP 0x82u
+#define CDC_COMM_IF 0u
+
+#define PMA_CDC_OUT 0x0C0u
+#define PMA_CDC_IN_0 0x100u
+#define PMA_CDC_IN_1 0x140u
+#define PMA_CDC_CMD 0x180u
+#define PMA_MSC_OUT 0x1C0u
+#define PMA_MSC_IN_0 0x200u
+#define PMA_MSC_IN_1 0x240u
+#define PMA_CMD_OUT 0x280u
+#define PMA_CMD_IN 0x2C0u
+#endif
+
+#ifdef USB_MSC_ENABLED
+#define USB_MSC_IF (CDC_COMM_IF + 2u)
+#endif
+
+#define CMD_OUT_EP 0x06u
+#define CMD_IN_EP 0x86u
+#define CMD_MPS 64u
+
+// Interfaces and configuration descriptor length per function: 9-byte
+// configuration, 58 bytes of CDC (+8 for its IAD when composite), 23 for
+// gs_usb and MSC (interface and two endpoints) each.
+#ifdef USB_GS_USB_ENABLED
+#define CDC_IF_GS 1u
+#else
+#define CDC_IF_GS 0u
+#endif
+#ifdef USB_MSC_ENABLED
+#define CDC_IF_MSC 1u
+#else
+#define CDC_IF_MSC 0u
+#endif
+#ifdef USB_CMD_EP_ENABLED
+#define CDC_IF_CMD 1u
+#define CMD_IF (CDC_COMM_IF + 2u + CDC_IF_MSC)
+#else
+#define CDC_IF_CMD 0u
+#endif
+#ifdef CDC_COMPOSITE
+#define CDC_IAD_LEN 8u
+#else
+#define CDC_IAD_LEN 0u
+#endif
+#define CDC_NUM_IF (2u + CDC_IF_GS + CDC_IF_MSC + CDC_IF_CMD)
+#define CDC_CONFIG_DESC_LEN \
+  (67u + CDC_IAD_LEN + 23u * (CDC_IF_GS + CDC_IF_MSC + CDC_IF_CMD))
+
+#if (CDC_RX_RING_SIZE & (CDC_RX_RING_SIZE - 1u)) != 0u
+#error "CDC_RX_RING_SIZE must be a power of two"
+#endif
+#if (USB_CMD_QUEUE & (USB_CMD_QUEUE - 1u)) != 0u || USB_CMD_QUEUE > 128u
+#error "USB_CMD_QUEUE must be a power of two up to 128"
+#endif
+
+// =========================
+// Descriptors
+// =========================
+
+static const uint8_t k_device_desc[18] = {
+    18, 0x01,                 // bLength, DEVICE
+    0x00, 0x02,               // bcdUSB 2.00
+#ifdef CDC_COMPOSITE
+    0xEF, 0x02, 0x01,         // composite with IAD
+#else
+    0x02, 0x00, 0x00,         // CDC class at device level
+#endif
+    CDC_EP0_MPS,              // bMaxPacketSize0
+    (uint8_t)(CDC_USB_VID & 0xFFu), (uint8_t)(CDC_USB_VID >> 8),
+    (uint8_t)(CDC_USB_PID & 0xFFu), (uint8_t)(CDC_USB_PID >> 8),
+    0x00, 0x02,               // bcdDevice
+    1, 2, 3,                  // iManufacturer, iProduct, iSerialNumber
+    1,                        // bNumConfigurations
+};
+
+static const uint8_t k_config_desc[CDC_CONFIG_DESC_LEN] = {
+    // Configuration
+    9, 0x02, CDC_CONFIG_DESC_LEN, 0x00, CDC_NUM_IF, 1, 0, 0xC0, 50,
+#ifdef USB_GS_USB_ENABLED
+    // Interface 0: gs_usb (vendor)
+    9, 0x04, 0, 0, 2, 0xFF, 0xFF, 0xFF, 0,
+    7, 0x05, USB_GS_IN_EP, 0x02, USB_GS_MPS, 0x00, 0,
+    7, 0x05, USB_GS_OUT_EP, 0x02, USB_GS_MPS, 0x00, 0,
+#endif
+#ifdef CDC_COMPOSITE
+    // IAD: the two CDC interfaces are one function
+    8, 0x0B, CDC_COMM_IF, 2, 0x02, 0x02, 0x01, 0,
+#endif
+    // Communication interface (ACM)
+    9, 0x04, CDC_COMM_IF, 0, 1, 0x02, 0x02, 0x01, 0,
+    5, 0x24, 0x00, 0x10, 0x01,           // header, CDC 1.10
+    5, 0x24, 0x01, 0x00, CDC_COMM_IF + 1, // call management, data interface
+    4, 0x24, 0x02, 0x02,                 // ACM: line coding + serial state
+    5, 0x24, 0x06, CDC_COMM_IF, CDC_COMM_IF + 1, // union: master, slave
+    7, 0x05, CDC_CMD_EP, 0x03, CDC_CMD_MPS, 0x00, 16,
+    // Data interface
+    9, 0x04, CDC_COMM_IF + 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+    7, 0x05, CDC_OUT_EP, 0x02, CDC_DATA_MPS, 0x00, 0,
+    7, 0x05, CDC_IN_EP, 0x02, CDC_DATA_MPS, 0x00, 0,
+#ifdef USB_MSC_ENABLED
+    // Mass Storage: SCSI transparent, Bulk-Only
+    9, 0x04, USB_MSC_IF, 0, 2, 0x08, 0x06, 0x50, 0,
+    7, 0x05, USB_MSC_IN_EP, 0x02, USB_MSC_MPS, 0x00, 0,
+    7, 0x05, USB_MSC_OUT_EP, 0x02, USB_MSC_MPS, 0x00, 0,
+#endif
+#ifdef USB_CMD_EP_ENABLED
+    // Command pipe (vendor): interrupt, polled every frame
+    9, 0x04, CMD_IF, 0, 2, 0xFF, 0x00, 0x00, 0,
+    7, 0x05, CMD_OUT_EP, 0x03, CMD_MPS, 0x00, 1,
+    7, 0x05, CMD_IN_EP, 0x03, CMD_MPS, 0x00, 1,
+#endif
+};
+
+static const char *const k_strings[] = {
+    NULL, // 0: language IDs
+    "SEDS",
+    "Gateway Board Telemetry",
+    NULL, // 3: serial number from the device UID
+};
+
+// =========================
+// State
+// =========================
+
+typedef enum {
+  EP0_IDLE = 0,
+  EP0_DATA_IN,
+  EP0_DATA_OUT,
+  EP0_STATUS_IN,
+} ep0_state_t;
+
+static PCD_HandleTypeDef *g_hpcd = NULL;
+
+static volatile uint8_t g_configured = 0;
+static volatile uint8_t g_dtr = 0;
+static volatile uint8_t g_suspended = 0;
+static uint8_t g_config_value = 0;
+
+// EP0
+static ep0_state_t g_ep0_state = EP0_IDLE;
+static uint8_t g_ep0_buf[CDC_CONFIG_DESC_LEN + 1u]; // strings, status, coding
+static const uint8_t *g_ep0_ptr = NULL;
+static uint32_t g_ep0_rem = 0;
+static uint8_t g_ep0_zlp = 0;
+static uint8_t g_ep0_out_req = 0;
+#ifdef USB_GS_USB_ENABLED
+static uint8_t g_ep0_out_vendor = 0;
+static uint16_t g_ep0_out_value = 0;
+#endif
+
+// Line coding (ignored by the bridge, echoed back to the host).
+static uint8_t g_line_coding[7] = {0x00, 0xC2, 0x01, 0x00, 0, 0, 8}; // 115200 8N1
+
+// Bulk IN
+static RAM_NOINIT uint8_t g_tx_buf[2][CDC_TX_BUF_SIZE] __ALIGNED(4);
+static volatile uint8_t g_tx_fill_idx = 0;     // buffer collecting frames
+static volatile size_t g_tx_fill_len = 0;
+static volatile uint8_t g_tx_inflight = 0;     // other buffer (or ZLP) on the bus
+static volatile uint32_t g_tx_inflight_len = 0;
+static volatile uint8_t g_tx_writer_busy = 0;  // writer encoding into fill
+static uint8_t g_tx_age = 0;                   // SOFs with fill waiting
+
+static usb_cdc_notify_cb_t g_tx_notify = NULL;
+
+// Bulk OUT
+static uint8_t g_rx_pkt[CDC_DATA_MPS] __ALIGNED(4);
+// ISR produces, the thread consumes.
+static RAM_NOINIT uint8_t g_rx_buf[CDC_RX_RING_SIZE];
+static ring_t g_rx = RING_INIT(g_rx_buf, CDC_RX_RING_SIZE, 1u);
+static volatile uint8_t g_rx_paused = 0;
+
+static uint8_t g_rx_frame[CDC_RX_FRAME_MAX];
+static size_t g_rx_frame_len = 0;
+static uint8_t g_rx_frame_overflow = 0;
+
+static usb_cdc_rx_cb_t g_rx_cb = NULL;
+static void *g_rx_user = NULL;
+static usb_cdc_notify_cb_t g_rx_notify = NULL;
+
+#ifdef USB_CMD_EP_ENABLED
+typedef struct {
+  uint16_t len;
+  uint8_t data[USB_CMD_FRAME_MAX];
+} cmd_slot_t;
+
+// RX: the ISR assembles into slot head and publishes it; the thread owns
+// the slots from tail to head. TX is the other way round.
+static uint8_t g_cmd_pkt[CMD_MPS] __ALIGNED(4);
+static cmd_slot_t g_cmd_rx[USB_CMD_QUEUE];
+static volatile uint8_t g_cmd_rx_head = 0;
+static volatile uint8_t g_cmd_rx_tail = 0;
+static uint16_t g_cmd_rx_fill = 0;
+static uint8_t g_cmd_rx_overflow = 0;
+static volatile uint8_t g_cmd_rx_paused = 0;
+static cmd_slot_t g_cmd_tx[USB_CMD_QUEUE] __ALIGNED(4);
+static volatile uint8_t g_cmd_tx_head = 0;
+static volatile uint8_t g_cmd_tx_tail = 0;
+static volatile uint8_t g_cmd_tx_inflight = 0;
+static uint8_t g_cmd_tx_zlp = 0;
+
+static usb_cdc_rx_cb_t g_cmd_cb = NULL;
+static void *g_cmd_user = NULL;
+#endif
+
+static inline uint32_t irq_lock(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static inline void irq_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+// =========================
+// Bulk IN
+// =========================
+
+// Hand the fill buffer to the hardware and start collecting in the other.
+// Caller must guarantee exclusion (ISR context, or IRQs masked).
+static void tx_start_locked(void) {
+  if (!g_configured || g_tx_inflight || g_tx_writer_busy || g_tx_fill_len == 0) {
+    return;
+  }
+  const uint8_t idx = g_tx_fill_idx;
+  const uint32_t len = (uint32_t)g_tx_fill_len;
+
+  g_tx_fill_idx = (uint8_t)(idx ^ 1u);
+  g_tx_fill_len = 0;
+  g_tx_age = 0;
+  g_tx_inflight = 1;
+  g_tx_inflight_len = len;
+  (void)HAL_PCD_EP_Transmit(g_hpcd, CDC_IN_EP, g_tx_buf[idx], len);
+}
+
+static void tx_complete_isr(void) {
+  // A transfer ending on a packet boundary needs a ZLP to end the host read,
+  // unless more data follows right away.
+  if (g_tx_inflight_len != 0 && (g_tx_inflight_len % CDC_DATA_MPS) == 0 &&
+      (g_tx_fill_len == 0 || g_tx_writer_busy)) {
+    g_tx_inflight_len = 0;
+    (void)HAL_PCD_EP_Transmit(g_hpcd, CDC_IN_EP, NULL, 0);
+    return;
+  }
+  g_tx_inflight = 0;
+  tx_start_locked();
+}
+
+// Start-of-frame (USB ISR, 1 ms while the bus is active): the flush timeout
+// for small frames when no usb_cdc_flush() comes.
+static void tx_sof_isr(void) {
+  if (g_tx_inflight || g_tx_fill_len == 0) {
+    g_tx_age = 0;
+    return;
+  }
+  if (++g_tx_age >= CDC_TX_FLUSH_FRAMES) tx_start_locked();
+}
+
+static void tx_reset(void) {
+  g_tx_fill_len = 0;
+  g_tx_inflight = 0;
+  g_tx_inflight_len = 0;
+}
+
+uint8_t usb_cdc_is_connected(void) { return (uint8_t)(g_configured && g_dtr); }
+
+uint8_t usb_cdc_is_suspended(void) { return g_suspended; }
+
+HAL_StatusTypeDef usb_cdc_send_frame(const uint8_t *bytes, size_t len) {
+  if (!bytes || len == 0) return HAL_ERROR;
+  if (!usb_cdc_is_connected()) return HAL_ERROR;
+
+  const size_t need = COBS_MAX_ENCODED(len) + 1u; // + delimiter
+  if (need > CDC_TX_BUF_SIZE) return HAL_ERROR;
+
+  uint32_t primask = irq_lock();
+  if (g_tx_fill_len + need > CDC_TX_BUF_SIZE) {
+    irq_unlock(primask);
+    return HAL_BUSY;
+  }
+  g_tx_writer_busy = 1;
+  uint8_t *dst = &g_tx_buf[g_tx_fill_idx][g_tx_fill_len];
+  irq_unlock(primask);
+
+  // The ISR never swaps the fill buffer while writer_busy is set.
+  size_t n = cobs_encode(bytes, len, dst, need - 1u);
+  dst[n++] = 0x00;
+
+  usb_cdc_notify_cb_t notify = NULL;
+  primask = irq_lock();
+  g_tx_fill_len += n;
+  g_tx_writer_busy = 0;
+  if (!g_tx_inflight) {
+    if (g_tx_fill_len >= CDC_TX_COALESCE_BYTES) {
+      tx_start_locked();
+    } else {
+      notify = g_tx_notify;
+    }
+  }
+  irq_unlock(primask);
+
+  if (notify) notify();
+  return HAL_OK;
+}
+
+void usb_cdc_flush(void) {
+  const uint32_t primask = irq_lock();
+  tx_start_locked();
+  irq_unlock(primask);
+}
+
+size_t usb_cdc_tx_pending(void) { return g_tx_fill_len; }
+
+void usb_cdc_set_tx_notify(usb_cdc_notify_cb_t cb) { g_tx_notify = cb; }
+
+// =========================
+// Command pipe
+// =========================
+
+#ifdef USB_CMD_EP_ENABLED
+static void cmd_rx_arm(void) {
+  (void)HAL_PCD_EP_Receive(g_hpcd, CMD_OUT_EP, g_cmd_pkt, CMD_MPS);
+}
+
+static void cmd_rx_complete_isr(void) {
+  const uint32_t n = HAL_PCD_EP_GetRxCount(g_hpcd, CMD_OUT_EP);
+  cmd_slot_t *s = &g_cmd_rx[g_cmd_rx_head & (USB_CMD_QUEUE - 1u)];
+
+  if (g_cmd_rx_fill + n > USB_CMD_FRAME_MAX) {
+    g_cmd_rx_overflow = 1; // drop until the transfer ends
+  } else {
+    memcpy(&s->data[g_cmd_rx_fill], g_cmd_pkt, n);
+    g_cmd_rx_fill = (uint16_t)(g_cmd_rx_fill + n);
+  }
+  // A short packet (or ZLP) ends the frame.
+  if (n < CMD_MPS) {
+    if (!g_cmd_rx_overflow && g_cmd_rx_fill != 0) {
+      s->len = g_cmd_rx_fill;
+      __DMB();
+      g_cmd_rx_head++;
+    }
+    g_cmd_rx_fill = 0;
+    g_cmd_rx_overflow = 0;
+  }
+
+  if ((uint8_t)(g_cmd_rx_head - g_cmd_rx_tail) < USB_CMD_QUEUE) {
+    cmd_rx_arm();
+  } else {
+    g_cmd_rx_paused = 1;
+  }
+
+  if (n < CMD_MPS && g_rx_notify) g_rx_notify();
+}
+
+static void cmd_process(void) {
+  while (g_cmd_rx_tail != g_cmd_rx_head) {
+    const cmd_slot_t *s = &g_cmd_rx[g_cmd_rx_tail & (USB_CMD_QUEUE - 1u)];
+    if (g_cmd_cb) g_cmd_cb(s->data, s->len, g_cmd_user);
+    __DMB();
+    g_cmd_rx_tail++;
+  }
+  if (g_cmd_rx_paused) {
+    const uint32_t primask = irq_lock();
+    if (g_cmd_rx_paused && g_configured) {
+      g_cmd_rx_paused = 0;
+      cmd_rx_arm();
+    }
+    irq_unlock(primask);
+  }
+}
+
+// Caller must guarantee exclusion (ISR context, or IRQs masked).
+static void cmd_tx_start_locked(void) {
+  if (!g_configured || g_cmd_tx_inflight || g_cmd_tx_tail == g_cmd_tx_head)
+    return;
+  cmd_slot_t *s = &g_cmd_tx[g_cmd_tx_tail & (USB_CMD_QUEUE - 1u)];
+  g_cmd_tx_inflight = 1;
+  g_cmd_tx_zlp = (uint8_t)((s->len % CMD_MPS) == 0u);
+  (void)HAL_PCD_EP_Transmit(g_hpcd, CMD_IN_EP, s->data, s->len);
+}
+
+static void cmd_tx_complete_isr(void) {
+  if (g_cmd_tx_zlp) {
+    g_cmd_tx_zlp = 0;
+    (void)HAL_PCD_EP_Transmit(g_hpcd, CMD_IN_EP, NULL, 0);
+    return;
+  }
+  g_cmd_tx_inflight = 0;
+  g_cmd_tx_tail++;
+  cmd_tx_start_locked();
+}
+
+// Unconfigured or reset: replies not sent yet are dropped, a half-received
+// frame too; complete commands still run.
+static void cmd_reset(void) {
+  g_cmd_tx_inflight = 0;
+  g_cmd_tx_zlp = 0;
+  g_cmd_tx_tail = g_cmd_tx_head;
+  g_cmd_rx_fill = 0;
+  g_cmd_rx_overflow = 0;
+}
+
+HAL_StatusTypeDef usb_cdc_send_cmd(const uint8_t *bytes, size_t len) {
+  if (!bytes || len == 0 || len > USB_CMD_FRAME_MAX) return HAL_ERROR;
+  if (!g_configured) return HAL_ERROR;
+  if ((uint8_t)(g_cmd_tx_head - g_cmd_tx_tail) >= USB_CMD_QUEUE)
+    return HAL_BUSY;
+
+  // The ISR only reads slots before head.
+  cmd_slot_t *s = &g_cmd_tx[g_cmd_tx_head & (USB_CMD_QUEUE - 1u)];
+  memcpy(s->data, bytes, len);
+  s->len = (uint16_t)len;
+
+  const uint32_t primask = irq_lock();
+  g_cmd_tx_head++;
+  cmd_tx_start_locked();
+  irq_unlock(primask);
+  return HAL_OK;
+}
+
+void usb_cdc_set_cmd_handler(usb_cdc_rx_cb_t cb, void *user) {
+  g_cmd_user = user;
+  g_cmd_cb = cb;
+}
+#endif
+
+// =========================
+// Bulk OUT
+// =========================
+
+static inline uint32_t rx_free(void) { return ring_free(&g_rx); }
+
+static void rx_arm(void) {
+  (void)HAL_PCD_EP_Receive(g_hpcd, CDC_OUT_EP, g_rx_pkt, CDC_DATA_MPS);
+}
+
+static void rx_complete_isr(void) {
+  const uint32_t n = HAL_PCD_EP_GetRxCount(g_hpcd, CDC_OUT_EP);
+
+  // rx_arm() is only called with room for a full packet.
+  (void)ring_push(&g_rx, g_rx_pkt, n, 0);
+
+  if (rx_free() >= CDC_DATA_MPS) {
+    rx_arm();
+  } else {
+    g_rx_paused = 1;
+  }
+
+  if (n && g_rx_notify) g_rx_notify();
+}
+
+static void rx_deliver_frame(void) {
+  if (g_rx_frame_overflow || g_rx_frame_len == 0) return;
+  const size_t n =
+      cobs_decode(g_rx_frame, g_rx_frame_len, g_rx_frame, sizeof(g_rx_frame));
+  if (n && g_rx_cb) g_rx_cb(g_rx_frame, n, g_rx_user);
+}
+
+void usb_cdc_process_rx(void) {
+#ifdef USB_CMD_EP_ENABLED
+  cmd_process(); // commands don't wait behind the bulk stream
+#endif
+  uint32_t n = ring_peek(&g_rx);
+
+  // At most two contiguous spans, each handed back once scanned.
+  while (n) {
+    const uint8_t *p = (const uint8_t *)ring_at(&g_rx, g_rx.tail);
+    const uint32_t span = ring_contig(&g_rx, g_rx.tail, n);
+    for (uint32_t i = 0; i < span; i++) {
+      const uint8_t b = p[i];
+      if (b == 0x00) {
+        rx_deliver_frame();
+        g_rx_frame_len = 0;
+        g_rx_frame_overflow = 0;
+      } else if (g_rx_frame_len < sizeof(g_rx_frame)) {
+        g_rx_frame[g_rx_frame_len++] = b;
+      } else {
+        g_rx_frame_overflow = 1; // drop until the next delimiter
+      }
+    }
+    ring_consume(&g_rx, span);
+    n -= span;
+  }
+
+  if (g_rx_paused && rx_free() >= CDC_DATA_MPS) {
+    const uint32_t primask = irq_lock();
+    if (g_rx_paused && g_configured) {
+      g_rx_paused = 0;
+      rx_arm();
+    }
+    irq_unlock(primask);
+  }
+}
+
+void usb_cdc_set_rx_handler(usb_cdc_rx_cb_t cb, void *user) {
+  g_rx_user = user;
+  g_rx_cb = cb;
+}
+
+void usb_cdc_set_rx_notify(usb_cdc_notify_cb_t cb) { g_rx_notify = cb; }
+
+// =========================
+// EP0 / enumeration
+// =========================
+
+static void ep0_stall(void) {
+  (void)HAL_PCD_EP_SetStall(g_hpcd, 0x80u);
+  (void)HAL_PCD_EP_SetStall(g_hpcd, 0x00u);
+  g_ep0_state = EP0_IDLE;
+}
+
+static void ep0_send_status(void) {
+  g_ep0_state = EP0_STATUS_IN;
+  (void)HAL_PCD_EP_Transmit(g_hpcd, 0x80u, NULL, 0);
+}
+
+static void ep0_continue_in(void) {
+  const uint32_t chunk = (g_ep0_rem > CDC_EP0_MPS) ? CDC_EP0_MPS : g_ep0_rem;
+  (void)HAL_PCD_EP_Transmit(g_hpcd, 0x80u, (uint8_t *)g_ep0_ptr, chunk);
+  g_ep0_ptr += chunk;
+  g_ep0_rem -= chunk;
+}
+
+static void ep0_send(const uint8_t *data, uint32_t len, uint16_t w_length) {
+  if (len > w_length) len = w_length;
+  g_ep0_ptr = data;
+  g_ep0_rem = len;
+  // Short of what the host asked for and on a packet boundary: end with ZLP.
+  g_ep0_zlp = (uint8_t)(len < w_length && (len % CDC_EP0_MPS) == 0);
+  g_ep0_state = EP0_DATA_IN;
+  ep0_continue_in();
+}
+
+static uint32_t build_string_desc(uint8_t index) {
+  uint32_t n = 2;
+
+  if (index == 0) {
+    g_ep0_buf[n++] = 0x09; // English (US)
+    g_ep0_buf[n++] = 0x04;
+  } else if (index == 3) {
+    static const char hex[] = "0123456789ABCDEF";
+    const uint32_t uid[3] = {HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2()};
+    for (int w = 2; w >= 0; w--) {
+      for (int s = 28; s >= 0; s -= 4) {
+        g_ep0_buf[n++] = (uint8_t)hex[(uid[w] >> s) & 0xFu];
+        g_ep0_buf[n++] = 0;
+      }
+    }
+  } else {
+    const char *s = k_strings[index];
+    while (*s && n + 2u <= sizeof(g_ep0_buf)) {
+      g_ep0_buf[n++] = (uint8_t)*s++;
+      g_ep0_buf[n++] = 0;
+    }
+  }
+  g_ep0_buf[0] = (uint8_t)n;
+  g_ep0_buf[1] = 0x03;
+  return n;
+}
+
+static void set_configuration(uint8_t value) {
+  if (g_config_value != 0) {
+#ifdef USB_GS_USB_ENABLED
+    usb_gs_configure(NULL);
+    (void)HAL_PCD_EP_Close(g_hpcd, USB_GS_IN_EP);
+    (void)HAL_PCD_EP_Close(g_hpcd, USB_GS_OUT_EP);
+#endif
+#ifdef USB_MSC_ENABLED
+    usb_msc_configure(NULL);
+    (void)HAL_PCD_EP_Close(g_hpcd, USB_MSC_IN_EP);
+    (void)HAL_PCD_EP_Close(g_hpcd, USB_MSC_OUT_EP);
+#endif
+#ifdef USB_CMD_EP_ENABLED
+    (void)HAL_PCD_EP_Close(g_hpcd, CMD_IN_EP);
+    (void)HAL_PCD_EP_Close(g_hpcd, CMD_OUT_EP);
+    cmd_reset();
+#endif
+    (void)HAL_PCD_EP_Close(g_hpcd, CDC_IN_EP);
+    (void)HAL_PCD_EP_Close(g_hpcd, CDC_OUT_EP);
+    (void)HAL_PCD_EP_Close(g_hpcd, CDC_CMD_EP);
+    g_configured = 0;
+    g_dtr = 0;
+    tx_reset();
+  }
+  g_config_value = value;
+  if (value == 0) return;
+
+  (void)HAL_PCD_EP_Open(g_hpcd, CDC_IN_EP, CDC_DATA_MPS, EP_TYPE_BULK);
+  (void)HAL_PCD_EP_Open(g_hpcd, CDC_OUT_EP, CDC_DATA_MPS, EP_TYPE_BULK);
+  (void)HAL_PCD_EP_Open(g_hpcd, CDC_CMD_EP, CDC_CMD_MPS, EP_TYPE_INTR);
+#ifdef USB_GS_USB_ENABLED
+  (void)HAL_PCD_EP_Open(g_hpcd, USB_GS_IN_EP, USB_GS_MPS, EP_TYPE_BULK);
+  (void)HAL_PCD_EP_Open(g_hpcd, USB_GS_OUT_EP, USB_GS_MPS, EP_TYPE_BULK);
+  usb_gs_configure(g_hpcd);
+#endif
+#ifdef USB_MSC_ENABLED
+  (void)HAL_PCD_EP_Open(g_hpcd, USB_MSC_IN_EP, USB_MSC_MPS, EP_TYPE_BULK);
+  (void)HAL_PCD_EP_Open(g_hpcd, USB_MSC_OUT_EP, USB_MSC_MPS, EP_TYPE_BULK);
+  usb_msc_configure(g_hpcd);
+#endif
+#ifdef USB_CMD_EP_ENABLED
+  (void)HAL_PCD_EP_Open(g_hpcd, CMD_IN_EP, CMD_MPS, EP_TYPE_INTR);
+  (void)HAL_PCD_EP_Open(g_hpcd, CMD_OUT_EP, CMD_MPS, EP_TYPE_INTR);
+  g_cmd_rx_paused = 0;
+  if ((uint8_t)(g_cmd_rx_head - g_cmd_rx_tail) < USB_CMD_QUEUE) {
+    cmd_rx_arm();
+  } else {
+    g_cmd_rx_paused = 1;
+  }
+#endif
+
+  g_rx_paused = 0;
+  if (rx_free() >= CDC_DATA_MPS) {
+    rx_arm();
+  } else {
+    g_rx_paused = 1;
+  }
+  g_configured = 1;
+}
+
+static void handle_standard_request(const uint8_t *req, uint16_t w_value,
+                                    uint16_t w_index, uint16_t w_length) {
+  const uint8_t recipient = req[0] & 0x1Fu;
+
+  switch (req[1]) {
+  case 0x06: { // GET_DESCRIPTOR
+    const uint8_t type = (uint8_t)(w_value >> 8);
+    const uint8_t index = (uint8_t)(w_value & 0xFFu);
+    if (type == 0x01) {
+      ep0_send(k_device_desc, sizeof(k_device_desc), w_length);
+    } else if (type == 0x02) {
+      ep0_send(k_config_desc, sizeof(k_config_desc), w_length);
+    } else if (type == 0x03 &&
+               index < sizeof(k_strings) / sizeof(k_strings[0])) {
+      ep0_send(g_ep0_buf, build_string_desc(index), w_length);
+    } else {
+      ep0_stall();
+    }
+    return;
+  }
+  case 0x05: // SET_ADDRESS: applied by the HAL after the status stage
+    (void)HAL_PCD_SetAddress(g_hpcd, (uint8_t)(w_value & 0x7Fu));
+    ep0_send_status();
+    return;
+  case 0x09: // SET_CONFIGURATION
+    if (w_value > 1u) {
+      ep0_stall();
+      return;
+    }
+    set_configuration((uint8_t)w_value);
+    ep0_send_status();
+    return;
+  case 0x08: // GET_CONFIGURATION
+    g_ep0_buf[0] = g_config_value;
+    ep0_send(g_ep0_buf, 1, w_length);
+    return;
+  case 0x00: // GET_STATUS
+    g_ep0_buf[0] = (recipient == 0) ? 0x01u : 0x00u; // self-powered
+    g_ep0_buf[1] = 0;
+    ep0_send(g_ep0_buf, 2, w_length);
+    return;
+  case 0x0A: // GET_INTERFACE
+    g_ep0_buf[0] = 0;
+    ep0_send(g_ep0_buf, 1, w_length);
+    return;
+  case 0x0B: // SET_INTERFACE (one alternate setting only)
+    ep0_send_status();
+    return;
+  case 0x01: // CLEAR_FEATURE
+  case 0x03: // SET_FEATURE
+    if (recipient == 2 && w_value == 0 && (w_index & 0x7Fu) != 0) {
+      const uint8_t ep = (uint8_t)(w_index & 0xFFu);
+      if (req[1] == 0x03) {
+        (void)HAL_PCD_EP_SetStall(g_hpcd, ep);
+      } else {
+        (void)HAL_PCD_EP_ClrStall(g_hpcd, ep);
+#ifdef USB_MSC_ENABLED
+        if ((ep & 0x7Fu) == USB_MSC_OUT_EP) usb_msc_clear_halt_isr(ep);
+#endif
+      }
+    }
+    ep0_send_status();
+    return;
+  default:
+    ep0_stall();
+    return;
+  }
+}
+
+static void handle_class_request(const uint8_t *req, uint16_t w_value,
+                                 uint16_t w_index, uint16_t w_length) {
+#ifdef USB_MSC_ENABLED
+  // Get Max LUN / Bulk-Only reset, addressed to the MSC interface.
+  if ((req[0] & 0x1Fu) == 1u && (w_index & 0xFFu) == USB_MSC_IF) {
+    const int n = usb_msc_ctrl(req[1], g_ep0_buf, sizeof(g_ep0_buf));
+    if (n < 0) {
+      ep0_stall();
+    } else if (req[0] & 0x80u) {
+      ep0_send(g_ep0_buf, (uint32_t)n, w_length);
+    } else {
+      ep0_send_status();
+    }
+    return;
+  }
+#else
+  (void)w_index;
+#endif
+  switch (req[1]) {
+  case 0x20: // SET_LINE_CODING
+    if (w_length != sizeof(g_line_coding)) {
+      ep0_stall();
+      return;
+    }
+    g_ep0_out_req = req[1];
+    g_ep0_state = EP0_DATA_OUT;
+    (void)HAL_PCD_EP_Receive(g_hpcd, 0x00u, g_ep0_buf, w_length);
+    return;
+  case 0x21: // GET_LINE_CODING
+    memcpy(g_ep0_buf, g_line_coding, sizeof(g_line_coding));
+    ep0_send(g_ep0_buf, sizeof(g_line_coding), w_length);
+    return;
+  case 0x22: // SET_CONTROL_LINE_STATE
+    g_dtr = (uint8_t)(w_value & 0x1u);
+    ep0_send_status();
+    return;
+  default:
+    ep0_stall();
+    return;
+  }
+}
+
+#ifdef USB_GS_USB_ENABLED
+// gs_usb requests (usb_gs.c); wValue is the channel.
+static void handle_vendor_request(const uint8_t *req, uint16_t w_value,
+                                  uint16_t w_length) {
+  if (req[0] & 0x80u) {
+    const int n =
+        usb_gs_ctrl_in(req[1], w_value, g_ep0_buf, sizeof(g_ep0_buf));
+    if (n < 0) {
+      ep0_stall();
+    } else {
+      ep0_send(g_ep0_buf, (uint32_t)n, w_length);
+    }
+    return;
+  }
+  if (w_length == 0) {
+    if (usb_gs_ctrl_out(req[1], w_value, NULL, 0) < 0) {
+      ep0_stall();
+    } else {
+      ep0_send_status();
+    }
+    return;
+  }
+  if (w_length > sizeof(g_ep0_buf)) {
+    ep0_stall();
+    return;
+  }
+  g_ep0_out_req = req[1];
+  g_ep0_out_value = w_value;
+  g_ep0_out_vendor = 1;
+  g_ep0_state = EP0_DATA_OUT;
+  (void)HAL_PCD_EP_Receive(g_hpcd, 0x00u, g_ep0_buf, w_length);
+}
+#endif
+
+// =========================
+// HAL PCD callbacks (USB ISR)
+// =========================
+
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd) {
+  const uint8_t *req = (const uint8_t *)hpcd->Setup;
+  const uint16_t w_value = (uint16_t)(req[2] | (req[3] << 8));
+  const uint16_t w_index = (uint16_t)(req[4] | (req[5] << 8));
+  const uint16_t w_length = (uint16_t)(req[6] | (req[7] << 8));
+
+  g_ep0_state = EP0_IDLE;
+  switch (req[0] & 0x60u) {
+  case 0x00:
+    handle_standard_request(req, w_value, w_index, w_length);
+    break;
+  case 0x20:
+    handle_class_request(req, w_value, w_index, w_length);
+    break;
+#ifdef USB_GS_USB_ENABLED
+  case 0x40:
+    handle_vendor_request(req, w_value, w_length);
+    break;
+#endif
+  default:
+    ep0_stall();
+    break;
+  }
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+  (void)hpcd;
+  if (epnum == (CDC_IN_EP & 0x7Fu)) {
+    tx_complete_isr();
+    return;
+  }
+#ifdef USB_GS_USB_ENABLED
+  if (epnum == (USB_GS_IN_EP & 0x7Fu)) {
+    usb_gs_in_complete_isr();
+    return;
+  }
+#endif
+#ifdef USB_MSC_ENABLED
+  if (epnum == (USB_MSC_IN_EP & 0x7Fu)) {
+    usb_msc_in_complete_isr();
+    return;
+  }
+#endif
+#ifdef USB_CMD_EP_ENABLED
+  if (epnum == (CMD_IN_EP & 0x7Fu)) {
+    cmd_tx_complete_isr();
+    return;
+  }
+#endif
+  if (epnum != 0) return;
+
+  if (g_ep0_state != EP0_DATA_IN) {
+    g_ep0_state = EP0_IDLE; // status stage done
+    return;
+  }
+  if (g_ep0_rem > 0) {
+    ep0_continue_in();
+  } else if (g_ep0_zlp) {
+    g_ep0_zlp = 0;
+    (void)HAL_PCD_EP_Transmit(g_hpcd, 0x80u, NULL, 0);
+  } else {
+    // Data stage done; accept the host's zero-length status OUT.
+    g_ep0_state = EP0_IDLE;
+    (void)HAL_PCD_EP_Receive(g_hpcd, 0x00u, NULL, 0);
+  }
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+  (void)hpcd;
+  if (epnum == CDC_OUT_EP) {
+    rx_complete_isr();
+    return;
+  }
+#ifdef USB_GS_USB_ENABLED
+  if (epnum == USB_GS_OUT_EP) {
+    usb_gs_out_complete_isr();
+    return;
+  }
+#endif
+#ifdef USB_MSC_ENABLED
+  if (epnum == USB_MSC_OUT_EP) {
+    usb_msc_out_complete_isr();
+    return;
+  }
+#endif
+#ifdef USB_CMD_EP_ENABLED
+  if (epnum == CMD_OUT_EP) {
+    cmd_rx_complete_isr();
+    return;
+  }
+#endif
+  if (epnum != 0 || g_ep0_state != EP0_DATA_OUT) return;
+
+#ifdef USB_GS_USB_ENABLED
+  if (g_ep0_out_vendor) {
+    g_ep0_out_vendor = 0;
+    const uint32_t n = HAL_PCD_EP_GetRxCount(g_hpcd, 0x00u);
+    if (usb_gs_ctrl_out(g_ep0_out_req, g_ep0_out_value, g_ep0_buf, n) < 0) {
+      ep0_stall();
+    } else {
+      ep0_send_status();
+    }
+    return;
+  }
+#endif
+
+  if (g_ep0_out_req == 0x20) {
+    memcpy(g_line_coding, g_ep0_buf, sizeof(g_line_coding));
+  }
+  g_ep0_out_req = 0;
+  ep0_send_status();
+}
+
+void HAL_PCD_SOFCallback(PCD_HandleTypeDef *hpcd) {
+  (void)hpcd;
+  tx_sof_isr();
+}
+
+// The HAL has put the macrocell in low-power mode; a resume or reset undoes it.
+void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd) {
+  (void)hpcd;
+  g_suspended = 1;
+}
+
+void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd) {
+  (void)hpcd;
+  g_suspended = 0;
+}
+
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd) {
+  g_suspended = 0;
+  g_configured = 0;
+  g_dtr = 0;
+  g_config_value = 0;
+  g_ep0_state = EP0_IDLE;
+  tx_reset();
+#ifdef USB_GS_USB_ENABLED
+  usb_gs_configure(NULL);
+#endif
+#ifdef USB_MSC_ENABLED
+  usb_msc_configure(NULL);
+#endif
+#ifdef USB_CMD_EP_ENABLED
+  cmd_reset();
+#endif
+
+  (void)HAL_PCD_EP_Open(hpcd, 0x00u, CDC_EP0_MPS, EP_TYPE_CTRL);
+  (void)HAL_PCD_EP_Open(hpcd, 0x80u, CDC_EP0_MPS, EP_TYPE_CTRL);
+}
+
+// =========================
+// Init
+// =========================
+
+HAL_StatusTypeDef usb_cdc_init(PCD_HandleTypeDef *hpcd) {
+  if (!hpcd) return HAL_ERROR;
+  g_hpcd = hpcd;
+
+  (void)HAL_PCDEx_PMAConfig(hpcd, 0x00u, PCD_SNG_BUF, PMA_EP0_OUT);
+  (void)HAL_PCDEx_PMAConfig(hpcd, 0x80u, PCD_SNG_BUF, PMA_EP0_IN);
+  (void)HAL_PCDEx_PMAConfig(hpcd, CDC_OUT_EP, PCD_SNG_BUF, PMA_CDC_OUT);
+  (void)HAL_PCDEx_PMAConfig(hpcd, CDC_IN_EP, PCD_DBL_BUF,
+                            PMA_CDC_IN_0 | (PMA_CDC_IN_1 << 16));
+  (void)HAL_PCDEx_PMAConfig(hpcd, CDC_CMD_EP, PCD_SNG_BUF, PMA_CDC_CMD);
+#ifdef USB_GS_USB_ENABLED
+  (void)HAL_PCDEx_PMAConfig(hpcd, USB_GS_IN_EP, PCD_DBL_BUF,
+                            PMA_GS_IN_0 | (PMA_GS_IN_1 << 16));
+  (void)HAL_PCDEx_PMAConfig(hpcd, USB_GS_OUT_EP, PCD_SNG_BUF, PMA_GS_OUT);
+#endif
+#ifdef USB_MSC_ENABLED
+  (void)HAL_PCDEx_PMAConfig(hpcd, USB_MSC_IN_EP, PCD_DBL_BUF,
+                            PMA_MSC_IN_0 | (PMA_MSC_IN_1 << 16));
+  (void)HAL_PCDEx_PMAConfig(hpcd, USB_MSC_OUT_EP, PCD_SNG_BUF, PMA_MSC_OUT);
+#endif
+#ifdef USB_CMD_EP_ENABLED
+  (void)HAL_PCDEx_PMAConfig(hpcd, CMD_OUT_EP, PCD_SNG_BUF, PMA_CMD_OUT);
+  (void)HAL_PCDEx_PMAConfig(hpcd, CMD_IN_EP, PCD_SNG_BUF, PMA_CMD_IN);
+#endif
+
+  // SOF drives the TX flush timeout (MX_USB_PCD_Init leaves it off).
+  hpcd->Init.Sof_enable = ENABLE;
+  hpcd->Instance->CNTR |= USB_CNTR_SOFM;
+
+  return HAL_PCD_Start(hpcd);
+}
@@ -0,0 +1,445 @@
+// usb_gs.c
+//
+// gs_usb (candleLight) vendor interface on the usb_cdc.c device; see
+// usb_gs.h. One channel, bridged to a can_bus instance:
+//  - EP0 vendor requests (interface recipient) describe the channel, take
+//  the host's mode and report the bus state; usb_cdc.c hands them over
+//  - Bulk IN 0x81 carries one host frame per transfer from a ring of
+//  fixed-size slots: bus frames from the RX tap (CAN RX thread) and echoes
+//  of host frames (CAN TX thread), both pushed with IRQs masked
+//  - Bulk OUT 0x02 receives each host frame into a small slot ring; the
+//  sending thread queues them on the bus
+//
+// Notes / Assumptions:
+//  - Host frames (struct gs_host_frame in the Linux driver) are little
+//  endian: echo_id, can_id, can_dlc, channel, flags, reserved, then 8
+//  (classic) or 64 (FD flag) data bytes and, in timestamp mode, a 32-bit
+//  microsecond time from the same clock as GS_USB_BREQ_TIMESTAMP.
+//  - The host keeps at most 10 frames in flight and needs every one echoed
+//  to free it, also refused ones; bus frames leave that many IN slots free.
+//  - OUT is flow-controlled by not re-arming the endpoint (host gets NAK)
+//  while every slot is taken, e.g. while the CAN TX ring is full.
+
+#include "usb_gs.h"
+#include "ring.h"
+#include <string.h>
+
+#ifndef USB_GS_IN_SLOTS
+#define USB_GS_IN_SLOTS 32u // power of two
+#endif
+
+#ifndef USB_GS_OUT_SLOTS
+#define USB_GS_OUT_SLOTS 4u // power of two
+#endif
+
+// IN slots bus frames leave for echoes (the Linux driver's GS_MAX_TX_URBS).
+#define USB_GS_ECHO_RESERVE 10u
+
+#define USB_GS_TX_PRIO CAN_BUS_TX_PRIO_MID
+
+#if (USB_GS_IN_SLOTS & (USB_GS_IN_SLOTS - 1u)) != 0u ||                       \
+    (USB_GS_OUT_SLOTS & (USB_GS_OUT_SLOTS - 1u)) != 0u
+#error "USB_GS_IN_SLOTS and USB_GS_OUT_SLOTS must be powers of two"
+#endif
+#if USB_GS_IN_SLOTS <= USB_GS_ECHO_RESERVE
+#error "USB_GS_IN_SLOTS must leave room beyond the echo reserve"
+#endif
+
+// Vendor requests (bRequest)
+#define GS_BREQ_HOST_FORMAT 0u
+#define GS_BREQ_BITTIMING 1u
+#define GS_BREQ_MODE 2u
+#define GS_BREQ_BT_CONST 4u
+#define GS_BREQ_DEVICE_CONFIG 5u
+#define GS_BREQ_TIMESTAMP 6u
+#define GS_BREQ_DATA_BITTIMING 10u
+#define GS_BREQ_BT_CONST_EXT 11u
+#define GS_BREQ_GET_STATE 14u
+
+#define GS_FEAT_HW_TIMESTAMP (1u << 4)
+#define GS_FEAT_FD (1u << 8)
+#define GS_FEAT_BT_CONST_EXT (1u << 10)
+#define GS_FEAT_GET_STATE (1u << 13)
+#define GS_FEATURES                                                            \
+  (GS_FEAT_HW_TIMESTAMP | GS_FEAT_FD | GS_FEAT_BT_CONST_EXT | GS_FEAT_GET_STATE)
+
+#define GS_MODE_RESET 0u
+#define GS_MODE_START 1u
+#define GS_MODE_HW_TIMESTAMP (1u << 4) // mode flags, as the features
+#define GS_MODE_FD (1u << 8)
+
+// Host frame flags
+#define GS_FLAG_OVERFLOW 0x01u
+#define GS_FLAG_FD 0x02u
+#define GS_FLAG_BRS 0x04u
+
+// can_id bits (Linux can_id)
+#define GS_CAN_EFF 0x80000000u
+#define GS_CAN_RTR 0x40000000u
+#define GS_CAN_ERR 0x20000000u
+
+#define GS_ECHO_RX 0xFFFFFFFFu // echo_id of a frame from the bus
+
+#define GS_HDR 12u
+#define GS_FRAME_MAX (GS_HDR + 64u + 4u)
+
+typedef struct {
+  uint8_t buf[GS_FRAME_MAX] __ALIGNED(4);
+  uint8_t len;
+} gs_slot_t;
+
+static can_bus_t *g_bus = NULL;
+static PCD_HandleTypeDef *volatile g_hpcd = NULL; // set while configured
+
+static volatile uint8_t g_started = 0;
+static volatile uint8_t g_mode_ts = 0; // append timestamps
+static volatile uint8_t g_mode_fd = 0; // host takes FD frames
+static uint8_t g_overflow = 0;         // tag the next bus frame
+
+// Bulk IN: producers with IRQs masked, the ISR consumes.
+static gs_slot_t g_in[USB_GS_IN_SLOTS];
+static volatile uint32_t g_in_head = 0;
+static volatile uint32_t g_in_tail = 0;
+static volatile uint8_t g_in_busy = 0; // slot at tail on the bus
+
+// Bulk OUT: the ISR produces, the sending thread consumes.
+static gs_slot_t g_out_slots[USB_GS_OUT_SLOTS];
+static ring_t g_out = RING_INIT(g_out_slots, USB_GS_OUT_SLOTS, sizeof(gs_slot_t));
+static volatile uint8_t g_out_paused = 0;
+
+static usb_cdc_notify_cb_t g_tx_notify = NULL;
+
+// Host bit timing (prop_seg, phase_seg1, phase_seg2, sjw, brp); kept for
+// the record, the firmware's timing stays in force.
+static uint32_t g_bittiming[2][5];
+
+static usb_gs_stats_t g_stats;
+
+static inline uint32_t irq_lock(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static inline void irq_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+static inline void put_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static const uint8_t k_dlc_len[16] = {0,  1,  2,  3,  4,  5,  6,  7,
+                                      8, 12, 16, 20, 24, 32, 48, 64};
+
+static uint8_t len_to_dlc(size_t len) {
+  uint8_t dlc = 0;
+  while (dlc < 15u && k_dlc_len[dlc] < len)
+    dlc++;
+  return dlc;
+}
+
+// =========================
+// Bulk IN
+// =========================
+
+// Caller must guarantee exclusion (ISR context, or IRQs masked).
+static void in_start_locked(void) {
+  PCD_HandleTypeDef *const hpcd = g_hpcd;
+  if (!hpcd || g_in_busy || g_in_head == g_in_tail)
+    return;
+  gs_slot_t *s = &g_in[g_in_tail & (USB_GS_IN_SLOTS - 1u)];
+  g_in_busy = 1;
+  (void)HAL_PCD_EP_Transmit(hpcd, USB_GS_IN_EP, s->buf, s->len);
+}
+
+// Drop everything not yet on the bus. Exclusion as above.
+static void in_reset_locked(void) { g_in_head = g_in_tail + g_in_busy; }
+
+void usb_gs_in_complete_isr(void) {
+  if (g_in_busy) {
+    g_in_busy = 0;
+    g_in_tail++;
+  }
+  in_start_locked();
+}
+
+// Encode one host frame into the next IN slot, keeping `reserve` slots
+// free. 0 if there's no room or the channel isn't started.
+static int in_push(uint32_t echo_id, uint32_t can_id, uint8_t flags,
+                   const uint8_t *data, size_t len, uint32_t t_us,
+                   uint32_t reserve) {
+  const size_t cap = (flags & GS_FLAG_FD) ? 64u : 8u;
+  if (len > cap)
+    len = cap;
+
+  const uint32_t primask = irq_lock();
+  if (!g_started || !g_hpcd ||
+      g_in_head - g_in_tail + reserve >= USB_GS_IN_SLOTS) {
+    irq_unlock(primask);
+    return 0;
+  }
+  gs_slot_t *s = &g_in[g_in_head & (USB_GS_IN_SLOTS - 1u)];
+  uint8_t *f = s->buf;
+  put_le32(f, echo_id);
+  put_le32(f + 4, can_id);
+  f[8] = len_to_dlc(len);
+  f[9] = 0; // channel
+  f[10] = flags;
+  f[11] = 0;
+  memcpy(f + GS_HDR, data, len);
+  memset(f + GS_HDR + len, 0, cap - len);
+  size_t n = GS_HDR + cap;
+  if (g_mode_ts) {
+    put_le32(f + n, t_us);
+    n += 4u;
+  }
+  s->len = (uint8_t)n;
+  g_in_head++;
+  in_start_locked();
+  irq_unlock(primask);
+  return 1;
+}
+
+// CAN RX thread, for every frame off the RX rings.
+static void rx_tap(uint32_t id, uint8_t flags, const uint8_t *data,
+                   size_t len, uint64_t ts_us, void *user) {
+  (void)user;
+  if (!g_started)
+    return;
+  uint8_t gf = g_overflow ? GS_FLAG_OVERFLOW : 0u;
+  if (flags & CAN_BUS_RAW_FD) {
+    if (!g_mode_fd) {
+      g_stats.rx_dropped++; // the host can't take it
+      return;
+    }
+    gf |= GS_FLAG_FD;
+    if (flags & CAN_BUS_RAW_BRS)
+      gf |= GS_FLAG_BRS;
+  }
+  const uint32_t can_id = (flags & CAN_BUS_RAW_EXT) ? (id | GS_CAN_EFF) : id;
+  if (in_push(GS_ECHO_RX, can_id, gf, data, len, (uint32_t)ts_us,
+              USB_GS_ECHO_RESERVE)) {
+    g_stats.rx_frames++;
+    g_overflow = 0;
+  } else {
+    g_stats.rx_dropped++;
+    g_overflow = 1;
+  }
+}
+
+// =========================
+// Bulk OUT
+// =========================
+
+static inline uint32_t out_free(void) { return ring_free(&g_out); }
+
+// The endpoint fills the slot at the head in place.
+static void out_arm(void) {
+  gs_slot_t *s = (gs_slot_t *)ring_at(&g_out, g_out.head);
+  (void)HAL_PCD_EP_Receive(g_hpcd, USB_GS_OUT_EP, s->buf, GS_FRAME_MAX);
+}
+
+void usb_gs_out_complete_isr(void) {
+  if (!g_hpcd)
+    return;
+  const uint32_t n = HAL_PCD_EP_GetRxCount(g_hpcd, USB_GS_OUT_EP);
+  ((gs_slot_t *)ring_at(&g_out, g_out.head))->len = (uint8_t)n;
+  ring_publish(&g_out, 1);
+
+  if (out_free() > 0) {
+    out_arm();
+  } else {
+    g_out_paused = 1;
+  }
+  if (g_tx_notify)
+    g_tx_notify();
+}
+
+// Queue one host frame and echo it. 0 if the TX ring is full (try again).
+static int tx_frame(const gs_slot_t *s) {
+  const uint8_t *f = s->buf;
+  if (s->len < GS_HDR + 8u) {
+    g_stats.tx_rejected++; // no echo_id to answer with
+    return 1;
+  }
+  const uint32_t echo_id = get_le32(f);
+  const uint32_t can_id = get_le32(f + 4);
+  const uint8_t gf = f[10] & (GS_FLAG_FD | GS_FLAG_BRS);
+  size_t len = k_dlc_len[f[8] & 0xFu];
+  if (!(gf & GS_FLAG_FD) && len > 8u)
+    len = 8u;
+
+  HAL_StatusTypeDef st = HAL_ERROR;
+  if (!(can_id & (GS_CAN_RTR | GS_CAN_ERR)) && s->len >= GS_HDR + len) {
+    uint8_t rf = 0;
+    if (can_id & GS_CAN_EFF)
+      rf |= CAN_BUS_RAW_EXT;
+    if (gf & GS_FLAG_FD)
+      rf |= CAN_BUS_RAW_FD;
+    if (gf & GS_FLAG_BRS)
+      rf |= CAN_BUS_RAW_BRS;
+    st = can_bus_send_raw(g_bus, can_id & ~GS_CAN_EFF, rf, f + GS_HDR, len,
+                          USB_GS_TX_PRIO);
+  }
+  if (st == HAL_BUSY) {
+    g_stats.tx_retries++;
+    return 0;
+  }
+  if (st == HAL_OK) {
+    g_stats.tx_frames++;
+  } else {
+    g_stats.tx_rejected++;
+  }
+  // Echoed once queued (the host frees its TX context on it); the time is
+  // when it was queued, not when it went out.
+  (void)in_push(echo_id, can_id, gf, f + GS_HDR, len,
+                (uint32_t)can_bus_time_us(g_bus), 0);
+  return 1;
+}
+
+void usb_gs_process_tx(void) {
+  const uint32_t n = ring_peek(&g_out);
+  uint32_t done = 0;
+  while (done < n) {
+    if (g_started && g_bus &&
+        !tx_frame((const gs_slot_t *)ring_at(&g_out, g_out.tail + done)))
+      break; // the CAN TX notify wakes the sender again
+    done++;
+  }
+  ring_consume(&g_out, done);
+
+  if (g_out_paused && out_free() > 0) {
+    const uint32_t primask = irq_lock();
+    if (g_out_paused && g_hpcd) {
+      g_out_paused = 0;
+      out_arm();
+    }
+    irq_unlock(primask);
+  }
+}
+
+void usb_gs_set_tx_notify(usb_cdc_notify_cb_t cb) { g_tx_notify = cb; }
+
+// =========================
+// Control requests (USB ISR)
+// =========================
+
+static void set_mode(uint32_t mode, uint32_t flags) {
+  g_started = 0;
+  in_reset_locked();
+  g_overflow = 0;
+  if (mode != GS_MODE_START)
+    return;
+  g_mode_ts = (uint8_t)((flags & GS_MODE_HW_TIMESTAMP) != 0);
+  g_mode_fd = (uint8_t)((flags & GS_MODE_FD) != 0);
+  g_started = 1;
+}
+
+int usb_gs_ctrl_in(uint8_t request, uint16_t w_value, uint8_t *buf,
+                   size_t cap) {
+  if (request != GS_BREQ_DEVICE_CONFIG && w_value != 0)
+    return -1; // one channel
+  if (cap < 72u)
+    return -1;
+
+  switch (request) {
+  case GS_BREQ_DEVICE_CONFIG:
+    buf[0] = buf[1] = buf[2] = 0;
+    buf[3] = 0; // channels - 1
+    put_le32(buf + 4, 2u); // sw_version
+    put_le32(buf + 8, 1u); // hw_version
+    return 12;
+  case GS_BREQ_BT_CONST:
+  case GS_BREQ_BT_CONST_EXT: {
+    // FDCAN NBTP / DBTP field ranges
+    static const uint32_t k_bt[16] = {1, 256, 1, 128, 128, 1, 512, 1,
+                                      1, 32,  1, 16,  16,  1, 32,  1};
+    put_le32(buf, GS_FEATURES);
+    put_le32(buf + 4, HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN));
+    const unsigned words = (request == GS_BREQ_BT_CONST) ? 8u : 16u;
+    for (unsigned i = 0; i < words; i++)
+      put_le32(buf + 8 + 4u * i, k_bt[i]);
+    return (int)(8u + 4u * words);
+  }
+  case GS_BREQ_TIMESTAMP:
+    put_le32(buf, (uint32_t)can_bus_time_us(g_bus));
+    return 4;
+  case GS_BREQ_GET_STATE: {
+    can_bus_monitor_t m;
+    memset(&m, 0, sizeof(m));
+    can_bus_get_monitor(g_bus, &m);
+    put_le32(buf, m.state); // CAN_BUS_STATE_* match Linux's can_state
+    put_le32(buf + 4, m.rec);
+    put_le32(buf + 8, m.tec);
+    return 12;
+  }
+  default:
+    return -1;
+  }
+}
+
+int usb_gs_ctrl_out(uint8_t request, uint16_t w_value, const uint8_t *data,
+                    size_t len) {
+  if (request != GS_BREQ_HOST_FORMAT && w_value != 0)
+    return -1;
+
+  switch (request) {
+  case GS_BREQ_HOST_FORMAT: // byte order probe; frames are little endian
+    return (len == 4u) ? 0 : -1;
+  case GS_BREQ_BITTIMING:
+  case GS_BREQ_DATA_BITTIMING: {
+    if (len != 20u)
+      return -1;
+    uint32_t *bt = g_bittiming[request == GS_BREQ_DATA_BITTIMING];
+    for (unsigned i = 0; i < 5u; i++)
+      bt[i] = get_le32(data + 4u * i);
+    return 0;
+  }
+  case GS_BREQ_MODE:
+    if (len != 8u)
+      return -1;
+    set_mode(get_le32(data), get_le32(data + 4));
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+void usb_gs_configure(PCD_HandleTypeDef *hpcd) {
+  g_hpcd = hpcd;
+  set_mode(GS_MODE_RESET, 0);
+  g_in_busy = 0; // the endpoint was (re)opened
+  g_in_head = g_in_tail;
+  // Frames still in the OUT ring are dropped by the sending thread, as the
+  // channel is stopped.
+  g_out_paused = 1;
+  if (hpcd && out_free() > 0) {
+    g_out_paused = 0;
+    out_arm();
+  }
+}
+
+// =========================
+// Setup
+// =========================
+
+void usb_gs_attach(can_bus_t *bus) {
+  g_bus = bus;
+  can_bus_set_rx_tap(bus, rx_tap, NULL);
+}
+
+void usb_gs_get_stats(usb_gs_stats_t *out) {
+  if (!out)
+    return;
+  const uint32_t primask = irq_lock();
+  *out = g_stats;
+  out->started = g_started;
+  irq_unlock(primask);
+}
@@ -0,0 +1,666 @@
+// usb_msc.c
+//
+// Read-only Mass Storage interface on the usb_cdc.c device; see usb_msc.h.
+//  - Bulk-Only Transport in the USB ISR: each CBW on OUT 0x05 is decoded
+//  and answered there. Small replies (INQUIRY, sense, capacity) go out of
+//  one buffer on IN 0x85, then the CSW; errors stall the data pipe and the
+//  CSW follows the host's CLEAR_FEATURE.
+//  - READ(10) is handed to the MSC thread, which fills two buffers of
+//  USB_MSC_BUF_BLOCKS sectors in turn; the IN-complete ISR sends whichever
+//  is ready and wakes the thread for the one it just freed, so the card
+//  read of one buffer overlaps the USB transfer of the other.
+//  - The FAT32 volume (usb_msc.h) is a handful of numbers: sector 0..31 are
+//  the reserved area (boot sector and FSInfo, copies at 6 and 7), then two
+//  FATs, then cluster 2 (the root directory) and the file from cluster 3
+//  on, one contiguous chain. Anything but file sectors is built per read.
+//
+// Notes / Assumptions:
+//  - The volume has at least 65525 clusters, however short the log, since
+//  hosts pick FAT12/16/32 by the cluster count alone; the free ones read as
+//  zeros and cost nothing.
+//  - SDLOG.BIN stops short of 4 GB (the FAT32 file size limit); a longer
+//  log is cut to its newest blocks.
+//  - The thread and the ISR share the BOT state with IRQs masked, as in
+//  usb_cdc.c; a job generation count lets the thread drop a fill that a
+//  reset or a new command overtook.
+//  - Invalid CBWs stall both pipes until the host's Bulk-Only reset.
+
+#include "usb_msc.h"
+#include "sd_log.h"
+#include "GB-Threads.h"
+#include "tx_api.h"
+#include "telemetry.h"
+#include "mem_budget.h"
+#include "mem_sections.h"
+#include <string.h>
+
+#ifdef USB_MSC_ENABLED
+
+#ifndef SD_LOG_ENABLED
+#error "USB_MSC_ENABLED needs SD_LOG_ENABLED"
+#endif
+
+// Below the SD writer, so log writes always come first.
+// Stack size: USB_MSC_THREAD_STACK_SIZE in mem_budget.h.
+#define USB_MSC_THREAD_PRIORITY 11u
+
+#define SECTOR 512u
+#define SPC 8u            // sectors per cluster
+#define RSVD 32u          // reserved sectors
+#define NFATS 2u
+#define MIN_CLUSTERS (65525u + 16u)
+#define FILE_MAX_BLOCKS (0xFFFFFFFFu / SECTOR)
+#define FAT_EOC 0x0FFFFFFFu
+
+#define CBW_SIG 0x43425355u
+#define CSW_SIG 0x53425355u
+#define CBW_LEN 31u
+#define CSW_LEN 13u
+
+#define CSW_PASSED 0u
+#define CSW_FAILED 1u
+
+// Class requests
+#define MSC_REQ_GET_MAX_LUN 0xFEu
+#define MSC_REQ_RESET 0xFFu
+
+_Static_assert(USB_MSC_BUF_BLOCKS > 0 && USB_MSC_BUF_BLOCKS <= 64,
+               "USB_MSC_BUF_BLOCKS out of range");
+
+enum {
+  BOT_DEAD = 0,  // invalid CBW, or not configured: wait for a reset
+  BOT_CBW,       // OUT armed for the next command
+  BOT_REPLY,     // small reply on IN
+  BOT_READ,      // READ(10) data on IN
+  BOT_CSW_CLEAR, // IN stalled; CSW once the host clears it
+  BOT_CSW,       // CSW on IN
+};
+
+enum { BUF_FREE = 0, BUF_FILLING, BUF_READY, BUF_SENDING };
+
+typedef struct {
+  uint32_t first;       // log seq of file sector 0
+  uint32_t blocks;      // file sectors
+  uint32_t fat_sectors; // per FAT
+  uint32_t data_lba;    // cluster 2
+  uint32_t sectors;     // volume size
+} msc_volume_t;
+
+typedef struct {
+  uint8_t state;
+  uint32_t len;
+} msc_buf_t;
+
+TX_THREAD usb_msc_thread;
+static MEM_ARENA(stack) ULONG usb_msc_thread_stack[USB_MSC_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static TX_SEMAPHORE g_kick;
+static volatile uint8_t g_thread_ready = 0;
+
+static PCD_HandleTypeDef *g_hpcd = NULL;
+
+// BOT (USB ISR, thread with IRQs masked)
+static volatile uint8_t g_state = BOT_DEAD;
+static uint8_t g_cbw[USB_MSC_MPS] __ALIGNED(4);
+static uint8_t g_csw[CSW_LEN] __ALIGNED(4);
+static uint8_t g_reply[36] __ALIGNED(4);
+static uint32_t g_tag = 0;
+static uint32_t g_host_len = 0; // dCBWDataTransferLength
+static uint8_t g_dir_in = 0;
+static uint32_t g_moved = 0;    // data phase bytes so far
+static uint8_t g_short = 0;     // last data packet was short: host is done
+static uint8_t g_csw_status = CSW_PASSED;
+static uint8_t g_sense[3] = {0, 0, 0}; // key, ASC, ASCQ
+
+// READ(10) job
+static RAM_NOINIT uint8_t g_data[2][USB_MSC_BUF_BLOCKS * SECTOR] __ALIGNED(4);
+static msc_buf_t g_buf[2];
+static uint8_t g_fill = 0; // thread fills this one next
+static uint8_t g_send = 0; // ISR sends this one next
+static uint8_t g_in_busy = 0;
+static uint32_t g_job_gen = 0;
+static uint32_t g_job_lba = 0;   // next sector to fill
+static uint32_t g_job_left = 0;  // sectors still to fill
+static uint32_t g_job_bytes = 0; // data phase length
+static uint8_t g_job_error = 0;
+
+// Volume
+static msc_volume_t g_vol;
+static volatile uint8_t g_ready = 0;   // g_vol valid, card mounted
+static volatile uint8_t g_rebuild = 0; // thread: build g_vol
+static uint8_t g_absent_seen = 0;      // host was told there's no medium
+static uint8_t g_changed = 0;          // pending UNIT ATTENTION
+
+static usb_msc_stats_t g_stats;
+
+static inline uint32_t irq_lock(void) {
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+static inline void irq_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+static void put_le16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  for (unsigned i = 0; i < 4u; i++) p[i] = (uint8_t)(v >> (8u * i));
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+  for (unsigned i = 0; i < 4u; i++) p[i] = (uint8_t)(v >> (24u - 8u * i));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void kick(void) {
+  if (g_thread_ready) (void)tx_semaphore_put(&g_kick);
+}
+
+// =========================
+// Volume
+// =========================
+
+// Thread, while g_ready is 0.
+static void volume_build(void) {
+  sd_log_stats_t st;
+  sd_log_get_stats(&st);
+  if (!st.mounted) return;
+
+  msc_volume_t v;
+  sd_log_span(&v.first, &v.blocks);
+  if (v.blocks > FILE_MAX_BLOCKS) {
+    v.first += v.blocks - FILE_MAX_BLOCKS;
+    v.blocks = FILE_MAX_BLOCKS;
+  }
+  uint32_t clusters = 1u + (v.blocks + SPC - 1u) / SPC; // root + file
+  if (clusters < MIN_CLUSTERS) clusters = MIN_CLUSTERS;
+  v.fat_sectors = ((clusters + 2u) * 4u + SECTOR - 1u) / SECTOR;
+  v.data_lba = RSVD + NFATS * v.fat_sectors;
+  v.sectors = v.data_lba + clusters * SPC;
+
+  const uint32_t primask = irq_lock();
+  g_vol = v;
+  g_stats.file_blocks = v.blocks;
+  g_changed = g_absent_seen;
+  g_absent_seen = 0;
+  g_ready = 1;
+  irq_unlock(primask);
+}
+
+static void make_boot(uint8_t *p) {
+  static const uint8_t k_jump[3] = {0xEB, 0x58, 0x90};
+  memcpy(p, k_jump, sizeof(k_jump));
+  memcpy(&p[3], "SEDS    ", 8);
+  put_le16(&p[11], SECTOR);
+  p[13] = SPC;
+  put_le16(&p[14], RSVD);
+  p[16] = NFATS;
+  p[21] = 0xF8; // fixed disk
+  put_le16(&p[24], 63);
+  put_le16(&p[26], 255);
+  put_le32(&p[32], g_vol.sectors);
+  put_le32(&p[36], g_vol.fat_sectors);
+  put_le32(&p[44], 2); // root directory cluster
+  put_le16(&p[48], 1); // FSInfo
+  put_le16(&p[50], 6); // backup boot sector
+  p[64] = 0x80;
+  p[66] = 0x29;
+  put_le32(&p[67], g_vol.first + g_vol.blocks); // serial: new per log end
+  memcpy(&p[71], "SEDS LOG   ", 11);
+  memcpy(&p[82], "FAT32   ", 8);
+  p[510] = 0x55;
+  p[511] = 0xAA;
+}
+
+static void make_fsinfo(uint8_t *p) {
+  put_le32(&p[0], 0x41615252u);
+  put_le32(&p[484], 0x61417272u);
+  put_le32(&p[488], 0);           // no free clusters: read-only
+  put_le32(&p[492], 0xFFFFFFFFu); // next free unknown
+  put_le32(&p[508], 0xAA550000u);
+}
+
+static void make_fat(uint32_t index, uint8_t *p) {
+  const uint32_t file_clusters = (g_vol.blocks + SPC - 1u) / SPC;
+  const uint32_t last = 3u + file_clusters - 1u;
+  for (uint32_t i = 0; i < SECTOR / 4u; i++) {
+    const uint32_t e = index * (SECTOR / 4u) + i;
+    uint32_t v = 0;
+    if (e == 0) {
+      v = 0x0FFFFFF8u; // media byte
+    } else if (e <= 2u) {
+      v = FAT_EOC; // reserved, root directory
+    } else if (file_clusters && e <= last) {
+      v = (e == last) ? FAT_EOC : e + 1u;
+    }
+    put_le32(&p[4u * i], v);
+  }
+}
+
+static void make_dir_entry(uint8_t *p, const char *name, uint8_t attr,
+                           uint32_t cluster, uint32_t size) {
+  const uint16_t date = (uint16_t)(((2024u - 1980u) << 9) | (1u << 5) | 1u);
+  memcpy(p, name, 11);
+  p[11] = attr;
+  put_le16(&p[16], date);
+  put_le16(&p[18], date);
+  put_le16(&p[20], (uint16_t)(cluster >> 16));
+  put_le16(&p[24], date);
+  put_le16(&p[26], (uint16_t)cluster);
+  put_le32(&p[28], size);
+}
+
+// One sector of anything but the file.
+static void make_sector(uint32_t lba, uint8_t *p) {
+  memset(p, 0, SECTOR);
+  if (lba < RSVD) {
+    if (lba == 0 || lba == 6u) make_boot(p);
+    if (lba == 1u || lba == 7u) make_fsinfo(p);
+  } else if (lba < g_vol.data_lba) {
+    make_fat((lba - RSVD) % g_vol.fat_sectors, p);
+  } else if (lba == g_vol.data_lba) {
+    make_dir_entry(p, "SEDS LOG   ", 0x08, 0, 0); // volume label
+    make_dir_entry(&p[32], "SDLOG   BIN", 0x01, g_vol.blocks ? 3u : 0u,
+                   g_vol.blocks * SECTOR);
+  }
+}
+
+// `n` sectors from `lba` on; the file's come off the card in one read.
+static HAL_StatusTypeDef volume_read(uint32_t lba, uint8_t *dst, uint32_t n) {
+  const uint32_t file_lba = g_vol.data_lba + SPC; // cluster 3
+  while (n > 0) {
+    uint32_t run = 1;
+    if (lba >= file_lba && lba - file_lba < g_vol.blocks) {
+      const uint32_t k = lba - file_lba;
+      run = g_vol.blocks - k;
+      if (run > n) run = n;
+      const HAL_StatusTypeDef st =
+          sd_log_read(g_vol.first + k, dst, run, UINT32_MAX);
+      if (st != HAL_OK) return st;
+    } else {
+      make_sector(lba, dst);
+    }
+    lba += run;
+    dst += run * SECTOR;
+    n -= run;
+  }
+  return HAL_OK;
+}
+
+// =========================
+// Bulk-Only Transport (USB ISR; thread with IRQs masked)
+// =========================
+
+static void cbw_arm(void) {
+  g_state = BOT_CBW;
+  (void)HAL_PCD_EP_Receive(g_hpcd, USB_MSC_OUT_EP, g_cbw, USB_MSC_MPS);
+}
+
+static void csw_send(void) {
+  put_le32(&g_csw[0], CSW_SIG);
+  put_le32(&g_csw[4], g_tag);
+  put_le32(&g_csw[8], g_host_len - g_moved);
+  g_csw[12] = g_csw_status;
+  g_state = BOT_CSW;
+  (void)HAL_PCD_EP_Transmit(g_hpcd, USB_MSC_IN_EP, g_csw, CSW_LEN);
+}
+
+// The data phase is over: stall what the host still expects, then CSW.
+static void finish(uint8_t status) {
+  g_csw_status = status;
+  if (status != CSW_PASSED) g_stats.failed++;
+  if (g_moved < g_host_len) {
+    if (!g_dir_in) {
+      (void)HAL_PCD_EP_SetStall(g_hpcd, USB_MSC_OUT_EP);
+    } else if (!g_short) {
+      (void)HAL_PCD_EP_SetStall(g_hpcd, USB_MSC_IN_EP);
+      g_state = BOT_CSW_CLEAR;
+      return;
+    }
+  }
+  csw_send();
+}
+
+static void fail(uint8_t key, uint8_t asc, uint8_t ascq) {
+  g_sense[0] = key;
+  g_sense[1] = asc;
+  g_sense[2] = ascq;
+  finish(CSW_FAILED);
+}
+
+static void reply(uint32_t len) {
+  if (g_host_len == 0) {
+    finish(CSW_PASSED);
+    return;
+  }
+  if (!g_dir_in) {
+    fail(0x05, 0x24, 0x00); // ILLEGAL REQUEST, invalid field in CDB
+    return;
+  }
+  if (len > g_host_len) len = g_host_len;
+  g_moved = len;
+  g_short = (len % USB_MSC_MPS) != 0u;
+  g_state = BOT_REPLY;
+  (void)HAL_PCD_EP_Transmit(g_hpcd, USB_MSC_IN_EP, g_reply, len);
+}
+
+// 1 with the volume up; otherwise the command fails with the reason.
+static int media_ok(void) {
+  if (!g_ready) {
+    g_absent_seen = 1;
+    g_rebuild = 1; // the card may have mounted since
+    kick();
+    fail(0x02, 0x3A, 0x00); // NOT READY, medium not present
+    return 0;
+  }
+  if (g_changed) {
+    g_changed = 0;
+    fail(0x06, 0x28, 0x00); // UNIT ATTENTION, medium may have changed
+    return 0;
+  }
+  return 1;
+}
+
+static void in_kick_locked(void) {
+  if (g_state != BOT_READ || g_in_busy) return;
+  msc_buf_t *b = &g_buf[g_send];
+  if (b->state == BUF_READY) {
+    b->state = BUF_SENDING;
+    g_in_busy = 1;
+    (void)HAL_PCD_EP_Transmit(g_hpcd, USB_MSC_IN_EP, g_data[g_send], b->len);
+  } else if (g_job_error) {
+    fail(0x03, 0x11, 0x00); // MEDIUM ERROR, unrecovered read error
+  }
+}
+
+static void job_reset(void) {
+  g_job_gen++;
+  g_job_left = 0;
+  g_job_error = 0;
+  g_in_busy = 0;
+  g_fill = 0;
+  g_send = 0;
+  g_buf[0].state = BUF_FREE;
+  g_buf[1].state = BUF_FREE;
+}
+
+static void scsi_read10(const uint8_t *cb) {
+  const uint32_t lba = get_be32(&cb[2]);
+  const uint32_t count = ((uint32_t)cb[7] << 8) | cb[8];
+  if (!media_ok()) return;
+  if (lba > g_vol.sectors || count > g_vol.sectors - lba) {
+    fail(0x05, 0x21, 0x00); // ILLEGAL REQUEST, LBA out of range
+    return;
+  }
+  if (g_host_len > 0 && !g_dir_in) {
+    fail(0x05, 0x24, 0x00);
+    return;
+  }
+  uint32_t n = g_host_len / SECTOR; // the host's length wins if shorter
+  if (n > count) n = count;
+  if (n == 0) {
+    finish(CSW_PASSED);
+    return;
+  }
+  job_reset();
+  g_job_lba = lba;
+  g_job_left = n;
+  g_job_bytes = n * SECTOR;
+  g_short = 0;
+  g_state = BOT_READ;
+  kick();
+}
+
+static void scsi(const uint8_t *cb) {
+  if (cb[0] != 0x03) memset(g_sense, 0, sizeof(g_sense));
+  memset(g_reply, 0, sizeof(g_reply));
+  switch (cb[0]) {
+  case 0x00: // TEST UNIT READY
+    if (media_ok()) finish(CSW_PASSED);
+    return;
+  case 0x03: // REQUEST SENSE: the last command's, then cleared
+    g_reply[0] = 0x70;
+    g_reply[2] = g_sense[0];
+    g_reply[7] = 10;
+    g_reply[12] = g_sense[1];
+    g_reply[13] = g_sense[2];
+    memset(g_sense, 0, sizeof(g_sense));
+    reply(18);
+    return;
+  case 0x12: // INQUIRY
+    if (cb[1] & 0x01u) { // no vital product data pages
+      fail(0x05, 0x24, 0x00);
+      return;
+    }
+    g_reply[1] = 0x80; // removable: hosts poll for the card
+    g_reply[2] = 0x02;
+    g_reply[3] = 0x02;
+    g_reply[4] = 36u - 5u;
+    memcpy(&g_reply[8], "SEDS    Gateway Log     1.0 ", 28);
+    reply(36);
+    return;
+  case 0x1A: // MODE SENSE(6): header only, write protected
+    g_reply[0] = 3;
+    g_reply[2] = 0x80;
+    reply(4);
+    return;
+  case 0x5A: // MODE SENSE(10)
+    g_reply[1] = 6;
+    g_reply[3] = 0x80;
+    reply(8);
+    return;
+  case 0x1B: // START STOP UNIT
+  case 0x1E: // PREVENT ALLOW MEDIUM REMOVAL
+  case 0x2F: // VERIFY(10)
+  case 0x35: // SYNCHRONIZE CACHE(10)
+    finish(CSW_PASSED);
+    return;
+  case 0x23: // READ FORMAT CAPACITIES
+    g_reply[3] = 8;
+    put_be32(&g_reply[4], g_ready ? g_vol.sectors : 0u);
+    g_reply[8] = g_ready ? 0x02u : 0x03u; // formatted / no medium
+    g_reply[10] = (uint8_t)(SECTOR >> 8);
+    reply(12);
+    return;
+  case 0x25: // READ CAPACITY(10)
+    if (!media_ok()) return;
+    put_be32(&g_reply[0], g_vol.sectors - 1u);
+    put_be32(&g_reply[4], SECTOR);
+    reply(8);
+    return;
+  case 0x28: // READ(10)
+    scsi_read10(cb);
+    return;
+  case 0x2A: // WRITE(10)
+  case 0xAA: // WRITE(12)
+    fail(0x07, 0x27, 0x00); // DATA PROTECT, write protected
+    return;
+  default:
+    fail(0x05, 0x20, 0x00); // ILLEGAL REQUEST, invalid command
+    return;
+  }
+}
+
+void usb_msc_out_complete_isr(void) {
+  if (!g_hpcd || g_state != BOT_CBW) return;
+  const uint32_t n = HAL_PCD_EP_GetRxCount(g_hpcd, USB_MSC_OUT_EP);
+  if (n != CBW_LEN || get_le32(g_cbw) != CBW_SIG || (g_cbw[13] & 0x0Fu) != 0 ||
+      g_cbw[14] == 0 || g_cbw[14] > 16u) {
+    g_state = BOT_DEAD;
+    (void)HAL_PCD_EP_SetStall(g_hpcd, USB_MSC_IN_EP);
+    (void)HAL_PCD_EP_SetStall(g_hpcd, USB_MSC_OUT_EP);
+    return;
+  }
+  g_stats.commands++;
+  g_tag = get_le32(&g_cbw[4]);
+  g_host_len = get_le32(&g_cbw[8]);
+  g_dir_in = (g_cbw[12] & 0x80u) != 0;
+  g_moved = 0;
+  g_short = 0;
+  scsi(&g_cbw[15]);
+}
+
+void usb_msc_in_complete_isr(void) {
+  if (!g_hpcd) return;
+  switch (g_state) {
+  case BOT_REPLY:
+    finish(CSW_PASSED);
+    return;
+  case BOT_READ:
+    if (!g_in_busy) return;
+    g_in_busy = 0;
+    g_moved += g_buf[g_send].len;
+    g_stats.read_blocks += g_buf[g_send].len / SECTOR;
+    g_buf[g_send].state = BUF_FREE;
+    g_send ^= 1u;
+    if (g_moved >= g_job_bytes) {
+      finish(CSW_PASSED);
+    } else {
+      in_kick_locked();
+      kick(); // refill the buffer just sent
+    }
+    return;
+  case BOT_CSW:
+    cbw_arm();
+    return;
+  default:
+    return;
+  }
+}
+
+void usb_msc_clear_halt_isr(uint8_t ep) {
+  if (!g_hpcd) return;
+  if (g_state == BOT_DEAD) {
+    (void)HAL_PCD_EP_SetStall(g_hpcd, ep); // held until the reset
+  } else if (g_state == BOT_CSW_CLEAR && ep == USB_MSC_IN_EP) {
+    csw_send();
+  }
+}
+
+static void bot_reset(void) {
+  job_reset();
+  g_moved = 0;
+  g_host_len = 0;
+  cbw_arm();
+}
+
+int usb_msc_ctrl(uint8_t request, uint8_t *buf, size_t cap) {
+  switch (request) {
+  case MSC_REQ_GET_MAX_LUN:
+    if (cap < 1u) return -1;
+    buf[0] = 0; // one LUN
+    return 1;
+  case MSC_REQ_RESET:
+    if (!g_hpcd) return -1;
+    bot_reset();
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+void usb_msc_configure(PCD_HandleTypeDef *hpcd) {
+  g_hpcd = hpcd;
+  job_reset();
+  g_state = BOT_DEAD;
+  g_ready = 0;
+  g_changed = 0;
+  g_absent_seen = 0;
+  if (!hpcd) return;
+  // Fix the volume for this session; commands wait on media_ok() meanwhile.
+  g_rebuild = 1;
+  kick();
+  bot_reset();
+}
+
+void usb_msc_get_stats(usb_msc_stats_t *out) {
+  if (!out) return;
+  const uint32_t primask = irq_lock();
+  *out = g_stats;
+  out->ready = g_ready;
+  irq_unlock(primask);
+}
+
+// =========================
+// Thread
+// =========================
+
+// Fill free buffers while the current READ(10) has sectors left.
+static void fill_buffers(void) {
+  for (;;) {
+    uint32_t primask = irq_lock();
+    const uint8_t i = g_fill;
+    msc_buf_t *b = &g_buf[i];
+    if (g_state != BOT_READ || g_job_left == 0 || g_job_error ||
+        b->state != BUF_FREE) {
+      irq_unlock(primask);
+      return;
+    }
+    const uint32_t gen = g_job_gen;
+    const uint32_t lba = g_job_lba;
+    const uint32_t n =
+        (g_job_left < USB_MSC_BUF_BLOCKS) ? g_job_left : USB_MSC_BUF_BLOCKS;
+    b->state = BUF_FILLING;
+    irq_unlock(primask);
+
+    const HAL_StatusTypeDef st = volume_read(lba, g_data[i], n);
+
+    primask = irq_lock();
+    if (gen == g_job_gen) {
+      if (st == HAL_OK) {
+        b->state = BUF_READY;
+        b->len = n * SECTOR;
+        g_job_lba += n;
+        g_job_left -= n;
+        g_fill ^= 1u;
+      } else {
+        b->state = BUF_FREE;
+        g_job_error = 1;
+        g_stats.card_errors++;
+      }
+      in_kick_locked();
+    }
+    irq_unlock(primask);
+  }
+}
+
+void usb_msc_thread_entry(ULONG initial_input) {
+  (void)initial_input;
+  for (;;) {
+    (void)tx_semaphore_get(&g_kick, TX_WAIT_FOREVER);
+    if (g_rebuild) {
+      g_rebuild = 0;
+      if (!g_ready) volume_build();
+    }
+    fill_buffers();
+  }
+}
+
+void create_usb_msc_thread(void) {
+  if (tx_semaphore_create(&g_kick, "usb msc kick", 0) != TX_SUCCESS)
+    die("Failed to create USB MSC semaphore");
+  const UINT status =
+      tx_thread_create(&usb_msc_thread, "USB MSC", usb_msc_thread_entry, 0,
+                       usb_msc_thread_stack, USB_MSC_THREAD_STACK_SIZE,
+                       USB_MSC_THREAD_PRIORITY, USB_MSC_THREAD_PRIORITY,
+                       TX_NO_TIME_SLICE, TX_AUTO_START);
+  if (status != TX_SUCCESS) {
+    die("Failed to create USB MSC thread: %u", (unsigned)status);
+  }
+  g_thread_ready = 1;
+  kick(); // a host may have configured the device already
+}
+
+#endif /* USB_MSC_ENABLED */
@@ -23,6 +23,8 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "app_azure_rtos_config.h"
+#include "usb_cdc.h"
 
 /* USER CODE END Includes */
 
@@ -33,6 +35,13 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/* Byte pool bookkeeping: a header on the allocated block, the free block
+   after it and the end marker (two pointers each), with slack. */
+#define UX_DEVICE_APP_POOL_OVERHEAD  64U
+
+#if UX_DEVICE_APP_MEM_POOL_SIZE < UX_DEVICE_APP_THREAD_STACK_SIZE + UX_DEVICE_APP_POOL_OVERHEAD
+#error "UX_DEVICE_APP_MEM_POOL_SIZE can't hold the USB app thread stack"
+#endif
 
 /* USER CODE END PD */
 
@@ -46,6 +55,7 @@
 static TX_THREAD ux_device_app_thread;
 
 /* USER CODE BEGIN PV */
+extern PCD_HandleTypeDef hpcd_USB_FS;
 
 /* USER CODE END PV */
 
@@ -106,6 +116,10 @@ static VOID app_ux_device_thread_entry(ULONG thread_input)
 {
   /* USER CODE BEGIN app_ux_device_thread_entry */
   TX_PARAMETER_NOT_USED(thread_input);
+
+  /* Connect and return: usb_cdc runs from the USB interrupt, including the
+     bulk IN flush timeout (start-of-frame driven). */
+  (void)usb_cdc_init(&hpcd_USB_FS);
   /* USER CODE END app_ux_device_thread_entry */
 }
 
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+Show which CAN IDs load the gateway's bus, busiest first, like top.
+
+Sends TELEMETRY_USB_CTRL_TALKERS on the CDC port every interval with the
+clear flag set, so each table covers one interval, and prints per ID the
+frame and byte rates, its share of the bytes received, how long ago it was
+last heard and the shortest and longest gap between two of its frames.
+Router packets and other frames on the port are skipped.
+
+Usage
+  ./bus_top.py /dev/ttyACM0
+  ./bus_top.py --interval 5 --once /dev/ttyACM0
+  --keep reads without clearing, so the counts run since boot
+"""
+from __future__ import annotations
+
+import argparse
+import struct
+import sys
+import time
+from pathlib import Path
+
+from cdc_link import ctrl_reply, frames, open_port, send_ctrl
+
+OP_TALKERS = 0x1D
+STATUS = {1: "talker stats not built in"}
+RECORD = struct.Struct("<IIIIII")  # TELEMETRY_TALKER_REC
+EXT = 0x80000000
+
+
+def poll(fd: int, clear: bool) -> tuple[int, list[tuple]] | None:
+    send_ctrl(fd, OP_TALKERS, bytes([1 if clear else 0]))
+    for f in frames(fd):
+        st = ctrl_reply(f, OP_TALKERS)
+        if st is None:
+            continue
+        if st:
+            print(f"refused: {STATUS.get(st, st)}", file=sys.stderr)
+            return None
+        count = f[6]
+        evicted, = struct.unpack_from("<I", f, 7)
+        recs = [RECORD.unpack_from(f, 11 + k * RECORD.size)
+                for k in range(count) if 11 + (k + 1) * RECORD.size <= len(f)]
+        return evicted, recs
+    return None
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", type=Path)
+    ap.add_argument("--interval", type=float, default=2.0)
+    ap.add_argument("--once", action="store_true")
+    ap.add_argument("--keep", action="store_true")
+    args = ap.parse_args(argv[1:])
+
+    fd = open_port(args.port)
+    if not args.keep:
+        poll(fd, True)  # start the first interval now
+    while True:
+        start = time.monotonic()
+        time.sleep(args.interval)
+        got = poll(fd, not args.keep)
+        if got is None:
+            return 1
+        span = time.monotonic() - start if not args.keep else 1.0
+        evicted, recs = got
+        total = sum(r[2] for r in recs) or 1
+        print(f"\n{'id':>10} {'fr/s' if not args.keep else 'frames':>9} "
+              f"{'B/s' if not args.keep else 'bytes':>10} {'share':>6} "
+              f"{'age ms':>8} {'gap us':>17}   evicted={evicted}")
+        for cid, fr, by, age, gmin, gmax in recs:
+            name = f"x{cid & ~EXT:08x}" if cid & EXT else f"{cid:03x}"
+            print(f"{name:>10} {fr / span:9.1f} {by / span:10.1f} "
+                  f"{100.0 * by / total:5.1f}% {age / 1000:8.1f} "
+                  f"{gmin:8d}-{gmax:<8d}")
+        if args.once:
+            return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
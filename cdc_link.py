@@ -0,0 +1,72 @@
+"""
+CDC port helpers shared by the host scripts that talk to the gateway's USB
+control protocol (TELEMETRY_USB_CTRL_* in Core/Inc/telemetry.h): COBS
+framing with a 0x00 delimiter, opening the port raw, sending a control op
+and reading frames back.
+"""
+from __future__ import annotations
+
+import os
+import termios
+import tty
+from pathlib import Path
+
+CTRL_MAGIC = bytes([0xC5]) + b"SUB"
+STATUS_OK = 0
+
+
+def cobs_encode(data: bytes) -> bytes:
+    out, block = bytearray(), bytearray()
+    for b in data:
+        if b:
+            block.append(b)
+        if not b or len(block) == 254:
+            out += bytes([len(block) + 1]) + block
+            block.clear()
+    return bytes(out + bytes([len(block) + 1]) + block)
+
+
+def cobs_decode(data: bytes) -> bytes | None:
+    out, i = bytearray(), 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def open_port(path: Path, read_only: bool = False) -> int:
+    """A tty is set raw and its stale input dropped; a file is read as is."""
+    fd = os.open(path, os.O_RDONLY if read_only else os.O_RDWR)
+    if os.isatty(fd):
+        tty.setraw(fd)
+        termios.tcflush(fd, termios.TCIFLUSH)
+    return fd
+
+
+def send_ctrl(fd: int, op: int, payload: bytes = b"") -> None:
+    os.write(fd, cobs_encode(CTRL_MAGIC + bytes([op]) + payload) + b"\0")
+
+
+def ctrl_reply(f: bytes, op: int) -> int | None:
+    """The status in `f` if it answers `op`, else None."""
+    if f[:4] == CTRL_MAGIC and len(f) >= 6 and f[4] == op | 0x80:
+        return f[5]
+    return None
+
+
+def frames(fd: int):
+    pending = bytearray()
+    while True:
+        chunk = os.read(fd, 4096)
+        if not chunk:
+            return
+        pending += chunk
+        while (end := pending.find(0)) >= 0:
+            raw, pending = bytes(pending[:end]), pending[end + 1:]
+            if raw and (f := cobs_decode(raw)) is not None:
+                yield f
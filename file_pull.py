@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Pull a named file (e.g. the SD log) off a node through the gateway over USB.
+
+Sends TELEMETRY_USB_CTRL_FILE_PULL on the CDC port with the node's file
+service IDs (FILE_SRV_RX_ID / FILE_SRV_TX_ID in Core/Inc/file_srv.h), then
+writes the TELEMETRY_FILE_MAGIC frames (status, offset, file size, bytes)
+to the output as they come; the bytes arrive in order, straight off the
+bus. With --resume an existing output is continued from its size. Router
+packets and other frames on the port are skipped.
+
+Usage
+  ./file_pull.py /dev/ttyACM0 sdlog flight.sdlog
+  ./file_pull.py --node 0x7C1:0x7D1 --resume /dev/ttyACM0 sdlog flight.sdlog
+"""
+from __future__ import annotations
+
+import argparse
+import sys
+import time
+from pathlib import Path
+
+from cdc_link import ctrl_reply, frames, open_port, send_ctrl
+
+FIL_MAGIC = bytes([0xC5]) + b"FIL"
+OP_FILE_PULL, OP_FILE_PULL_ABORT = 0x1B, 0x1C
+CTRL_STATUS = {1: "file pulls not built in", 2: "bad node IDs or name",
+               4: "another pull is running"}
+FILE_STATUS = {1: "no such file", 2: "offset past the end",
+               3: "request refused", 4: "transfer lost"}
+
+
+def id_pair(s: str) -> tuple[int, int]:
+    req, rep = s.split(":")
+    return int(req, 0), int(rep, 0)
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", type=Path)
+    ap.add_argument("name")
+    ap.add_argument("out", type=Path)
+    ap.add_argument("--node", type=id_pair, default=(0x7C0, 0x7D0), metavar="REQ:REPLY",
+                    help="node's file service IDs (default 0x7C0:0x7D0)")
+    ap.add_argument("--resume", action="store_true", help="continue an existing output")
+    args = ap.parse_args(argv[1:])
+
+    name = args.name.encode()
+    start = args.out.stat().st_size if args.resume and args.out.exists() else 0
+    fd = open_port(args.port)
+    send_ctrl(fd, OP_FILE_PULL, args.node[0].to_bytes(2, "little") +
+              args.node[1].to_bytes(2, "little") + start.to_bytes(4, "little") + name)
+
+    t0 = time.monotonic()
+    done = start
+    with open(args.out, "ab" if start else "wb") as out:
+        try:
+            for f in frames(fd):
+                if (st := ctrl_reply(f, OP_FILE_PULL)) is not None:
+                    if st:
+                        print(f"refused: {CTRL_STATUS.get(st, st)}", file=sys.stderr)
+                        return 1
+                    continue
+                if f[:4] != FIL_MAGIC or len(f) < 13:
+                    continue
+                if f[4]:
+                    print(f"\n{args.name}: {FILE_STATUS.get(f[4], f[4])}", file=sys.stderr)
+                    return 1
+                off = int.from_bytes(f[5:9], "little")
+                size = int.from_bytes(f[9:13], "little")
+                if off != done:
+                    continue  # not ours, or a stale pull
+                out.write(f[13:])
+                done += len(f) - 13
+                print(f"\r{done}/{size} bytes", end="", flush=True)
+                if done >= size:
+                    dt = time.monotonic() - t0
+                    print(f"\r{args.out}: {done - start} bytes in {dt:.1f} s "
+                          f"({(done - start) / max(dt, 1e-3) / 1024:.1f} KB/s)")
+                    return 0
+        except KeyboardInterrupt:
+            send_ctrl(fd, OP_FILE_PULL_ABORT)
+            print(f"\nstopped at {done} bytes; --resume continues", file=sys.stderr)
+            return 1
+    print("stream ended before the file was complete", file=sys.stderr)
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""
+Expand deferred-format error payloads (LOG_ERROR_DEFERRED) against the ELF.
+
+The firmware sends [0x00][id lo][id hi][args...] as a GENERIC_ERROR payload;
+the ID is the format string's offset in the non-loaded .seds_fmt section.
+Argument widths follow the conversions: 8 bytes for %ll / %j, a 4-byte float
+for %f %e %g %a, 4 bytes for everything else.
+
+Usage
+  ./fmt_decode.py build/Debug/gateway_board.elf 00 0c 00 fe ff ff ff
+  some_log_dump | ./fmt_decode.py build/Debug/gateway_board.elf -
+    (one hex payload per line on stdin)
+"""
+from __future__ import annotations
+
+import re
+import struct
+import sys
+from pathlib import Path
+
+CONV = re.compile(r"%(?:%|[-+ #0]*(?:\*|\d+)?(?:\.(?:\*|\d+))?"
+                  r"(hh|h|ll|l|j|z|t|L)?([diouxXcpfFeEgGaAs]))")
+
+
+def load_fmt_section(elf: Path) -> bytes:
+    data = elf.read_bytes()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        raise SystemExit(f"{elf}: not a little-endian ELF32 file")
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+
+    def header(i: int) -> tuple[int, int, int]:
+        name, _, _, _, off, size = struct.unpack_from(
+            "<IIIIII", data, shoff + i * shentsize)
+        return name, off, size
+
+    _, stroff, _ = header(shstrndx)
+    for i in range(shnum):
+        name, off, size = header(i)
+        end = data.index(b"\0", stroff + name)
+        if data[stroff + name:end] == b".seds_fmt":
+            return data[off:off + size]
+    raise SystemExit(f"{elf}: no .seds_fmt section")
+
+
+def expand(table: bytes, payload: bytes) -> str:
+    if len(payload) < 3 or payload[0] != 0:
+        return payload.decode("utf-8", "replace")  # plain text error
+    fmt_id = payload[1] | (payload[2] << 8)
+    if fmt_id >= len(table):
+        return f"<unknown format id {fmt_id}>"
+    fmt = table[fmt_id:table.index(b"\0", fmt_id)].decode("utf-8", "replace")
+
+    args = payload[3:]
+    pos = 0
+
+    def conv(m: re.Match) -> str:
+        nonlocal pos
+        if m.group(0) == "%%":
+            return "%"
+        length, kind = m.group(1), m.group(2)
+        spec = m.group(0)
+        if length:
+            spec = spec[:-len(length) - 1] + kind
+        if kind == "s":
+            return "<%s>"
+        if kind in "fFeEgGaA":
+            val, = struct.unpack_from("<f", args, pos)
+            pos += 4
+        else:
+            width = 8 if length in ("ll", "j") else 4
+            signed = kind in "di"
+            val = int.from_bytes(args[pos:pos + width], "little", signed=signed)
+            pos += width
+            if kind == "p":
+                spec, val = "0x%08x", val
+        return spec % val
+
+    try:
+        return CONV.sub(conv, fmt)
+    except (struct.error, TypeError, ValueError):
+        return f"<bad arguments for {fmt!r}: {args.hex()}>"
+
+
+def main(argv: list[str]) -> int:
+    if len(argv) < 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    table = load_fmt_section(Path(argv[1]))
+    if argv[2] == "-":
+        for line in sys.stdin:
+            if line.strip():
+                print(expand(table, bytes.fromhex(line.strip())))
+    else:
+        print(expand(table, bytes.fromhex("".join(argv[2:]))))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+Send a firmware image to the gateway's update slot over USB or CAN-FD.
+
+Streams the .bin (from build.py build, with -DENABLE_FW_UPDATE=ON) with the
+FW_BEGIN / FW_DATA / FW_COMMIT commands (Core/Inc/fw_update.h): on the CDC
+port as control frames, or with --can through a SocketCAN ISO-TP socket to
+TELEMETRY_FW_ISOTP_RX_ID. BUSY answers and lost replies are sent again,
+which the gateway takes as duplicates. The image is installed at the next
+reset; --reset asks for it at once.
+
+With --relay the image is for another node: the gateway takes it over USB
+(FW_RELAY_*, Core/Inc/fw_relay.h) and streams it on to that node's ISO-TP
+request/reply IDs over CAN-FD.
+
+Usage
+  ./fw_update.py /dev/ttyACM0 build/Release/gateway.bin --reset
+  ./fw_update.py --can can0 build/Release/gateway.bin
+  ./fw_update.py --relay 0x7E2:0x7F2 /dev/ttyACM0 node.bin --reset
+  ./fw_update.py --abort /dev/ttyACM0
+"""
+from __future__ import annotations
+
+import argparse
+import os
+import select
+import socket
+import sys
+import time
+import zlib
+from pathlib import Path
+
+from cdc_link import cobs_decode, ctrl_reply, open_port, send_ctrl
+
+OP_BEGIN, OP_DATA, OP_COMMIT, OP_ABORT = 0x12, 0x13, 0x14, 0x15
+RELAY_OP = {OP_BEGIN: 0x17, OP_DATA: 0x18, OP_COMMIT: 0x19, OP_ABORT: 0x1A}
+ST_OK, ST_BAD_OP, ST_BAD_ARG, ST_BUSY = 0, 1, 2, 4
+STATUS = {1: "updates not built in", 2: "refused (size, order or CRC), "
+           "or the relay target stopped answering"}
+
+USB_CHUNK = 896    # one CDC frame, COBS overhead included
+CAN_CHUNK = 1024   # TELEMETRY_FW_ISOTP_RX_MAX less the header
+FW_ISOTP_RX_ID, FW_ISOTP_TX_ID = 0x7E1, 0x7E9
+
+# linux/can/isotp.h
+SOL_CAN_ISOTP = 106
+CAN_ISOTP_LL_OPTS = 5
+CANFD_MTU = 72
+
+
+class UsbLink:
+    chunk = USB_CHUNK
+
+    def __init__(self, port: Path):
+        self.fd = open_port(port)
+        self.pending = bytearray()
+
+    def request(self, op: int, payload: bytes, timeout: float) -> int | None:
+        send_ctrl(self.fd, op, payload)
+        end = time.monotonic() + timeout
+        while (left := end - time.monotonic()) > 0:
+            if not select.select([self.fd], [], [], left)[0]:
+                break
+            self.pending += os.read(self.fd, 4096)
+            while (cut := self.pending.find(0)) >= 0:
+                raw, self.pending = bytes(self.pending[:cut]), self.pending[cut + 1:]
+                f = cobs_decode(raw) if raw else None
+                if f and (st := ctrl_reply(f, op)) is not None:
+                    return st
+        return None
+
+
+class RelayLink(UsbLink):
+    """The gateway passes the commands on to the node at `ids`."""
+
+    def __init__(self, port: Path, ids: tuple[int, int]):
+        super().__init__(port)
+        self.ids = ids
+
+    def request(self, op: int, payload: bytes, timeout: float) -> int | None:
+        if op == OP_BEGIN:
+            payload = (self.ids[0].to_bytes(2, "little") +
+                       self.ids[1].to_bytes(2, "little") + payload)
+        return super().request(RELAY_OP[op], payload, timeout)
+
+
+def id_pair(s: str) -> tuple[int, int]:
+    req, rep = s.split(":")
+    return int(req, 0), int(rep, 0)
+
+
+class CanLink:
+    chunk = CAN_CHUNK
+
+    def __init__(self, iface: str, rx_id: int, tx_id: int):
+        self.s = socket.socket(socket.AF_CAN, socket.SOCK_DGRAM, socket.CAN_ISOTP)
+        # FD frames of 64 bytes, as the gateway sends them
+        self.s.setsockopt(SOL_CAN_ISOTP, CAN_ISOTP_LL_OPTS, bytes([CANFD_MTU, 64, 0]))
+        self.s.bind((iface, tx_id, rx_id))  # (ours to receive, ours to send)
+
+    def request(self, op: int, payload: bytes, timeout: float) -> int | None:
+        self.s.send(bytes([op]) + payload)
+        end = time.monotonic() + timeout
+        while (left := end - time.monotonic()) > 0:
+            if not select.select([self.s], [], [], left)[0]:
+                break
+            r = self.s.recv(16)
+            if len(r) >= 2 and r[0] == op | 0x80:
+                return r[1]
+        return None
+
+
+def command(link, op: int, payload: bytes = b"", tries: int = 5) -> int:
+    """Send until answered with something other than BUSY."""
+    lost = 0
+    while True:
+        st = link.request(op, payload, timeout=1.0)
+        if st is None:
+            lost += 1
+            if lost >= tries:
+                raise TimeoutError(f"no answer to op 0x{op:02x}")
+            continue
+        if st != ST_BUSY:
+            return st
+        time.sleep(0.01)
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", help="CDC port, or the CAN interface with --can")
+    ap.add_argument("image", type=Path, nargs="?")
+    ap.add_argument("--can", action="store_true", help="port is a SocketCAN interface")
+    ap.add_argument("--rx-id", type=lambda s: int(s, 0), default=FW_ISOTP_RX_ID,
+                    help="gateway's ISO-TP request ID (default 0x7E1)")
+    ap.add_argument("--tx-id", type=lambda s: int(s, 0), default=FW_ISOTP_TX_ID,
+                    help="gateway's ISO-TP reply ID (default 0x7E9)")
+    ap.add_argument("--relay", type=id_pair, metavar="REQ:REPLY",
+                    help="send it through the gateway to the node on these ISO-TP IDs")
+    ap.add_argument("--reset", action="store_true", help="install it now")
+    ap.add_argument("--abort", action="store_true", help="drop a session or pending image")
+    args = ap.parse_args(argv[1:])
+
+    if args.can:
+        link = CanLink(args.port, args.rx_id, args.tx_id)
+    elif args.relay:
+        link = RelayLink(Path(args.port), args.relay)
+    else:
+        link = UsbLink(Path(args.port))
+    if args.abort:
+        return 0 if command(link, OP_ABORT) == ST_OK else 1
+    if args.image is None:
+        ap.error("an image is needed unless --abort")
+
+    image = args.image.read_bytes()
+    crc = zlib.crc32(image)
+    st = command(link, OP_BEGIN, len(image).to_bytes(4, "little") + crc.to_bytes(4, "little"))
+    if st != ST_OK:
+        print(f"BEGIN: {STATUS.get(st, st)}", file=sys.stderr)
+        return 1
+
+    t0 = time.monotonic()
+    for off in range(0, len(image), link.chunk):
+        st = command(link, OP_DATA, off.to_bytes(4, "little") + image[off:off + link.chunk])
+        if st != ST_OK:
+            print(f"\nDATA at {off}: {STATUS.get(st, st)}", file=sys.stderr)
+            return 1
+        done = min(off + link.chunk, len(image))
+        print(f"\r{done}/{len(image)} bytes", end="", flush=True)
+    dt = time.monotonic() - t0
+    print(f"\r{len(image)} bytes in {dt:.1f} s ({len(image) / max(dt, 1e-3) / 1024:.1f} KB/s)")
+
+    st = command(link, OP_COMMIT, bytes([1 if args.reset else 0]), tries=20)
+    if st != ST_OK:
+        print(f"COMMIT: {STATUS.get(st, st)}", file=sys.stderr)
+        return 1
+    print(f"crc32 {crc:08x} verified; " +
+          ("resetting into it" if args.reset else "installed at the next reset"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,658 @@
+// gateway_stream.hpp
+//
+// Header-only host reader for the gateway's USB byte stream, live or as a
+// raw CDC capture file (what the host scripts call usb_capture.bin):
+//  - frame_reader splits the stream at the 0x00 delimiters and hands each
+//  COBS-decoded frame to a callback. A frame that is a single COBS block
+//  is handed over where it lies; others are decoded into one scratch
+//  buffer, or in place with feed_in_place(). No allocation per frame.
+//  - classify() tells the in-band frames (Core/Inc/telemetry_wire.h) from
+//  router packets, and the views read their fields straight off the
+//  frame: control replies and last values, capture records, TraceX and
+//  heap trace dumps, file pulls.
+//  - health_view and health_t come from the firmware's own field list
+//  (TELEMETRY_HEALTH_FIELDS), deferred_view / fmt_table / expand() turn
+//  LOG_ERROR_DEFERRED payloads back into text like fmt_decode.py.
+//  - mapped_file maps a capture file read-only for feed().
+//
+// Notes / Assumptions:
+//  - Views borrow the bytes they were made from: a frame passed to the
+//  callback is valid until it returns.
+//  - Router packets are handed over whole; their layout belongs to
+//  sedsprintf_rs, whose host crate deserializes them. The health and
+//  deferred-format views take the payload it yields.
+//  - C++17, little-endian host. Build with the repo root on the include
+//  path.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GATEWAY_STREAM_MMAP 1
+#endif
+
+#include "Core/Inc/telemetry_wire.h"
+
+namespace gateway {
+
+// Borrowed byte range.
+struct bytes {
+  const uint8_t *p = nullptr;
+  size_t n = 0;
+
+  bytes() = default;
+  bytes(const void *data, size_t len)
+      : p(static_cast<const uint8_t *>(data)), n(len) {}
+
+  const uint8_t *begin() const { return p; }
+  const uint8_t *end() const { return p + n; }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  uint8_t operator[](size_t i) const { return p[i]; }
+  // From `off`, at most `len` bytes; empty past the end.
+  bytes sub(size_t off, size_t len = SIZE_MAX) const {
+    if (off >= n) return {};
+    return {p + off, (len < n - off) ? len : n - off};
+  }
+};
+
+inline uint16_t le16(const uint8_t *p) { return uint16_t(p[0] | (p[1] << 8)); }
+inline uint32_t le32(const uint8_t *p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+inline uint64_t le64(const uint8_t *p) {
+  return uint64_t(le32(p)) | (uint64_t(le32(p + 4)) << 32);
+}
+
+/* ---------------- COBS ---------------- */
+
+namespace cobs {
+
+constexpr size_t bad = SIZE_MAX;
+
+// One frame without its delimiter into `out` (in.n bytes always do; `out`
+// may be in.p itself to decode in place). Returns the length or `bad`.
+inline size_t decode(bytes in, uint8_t *out) {
+  size_t i = 0, o = 0;
+  while (i < in.n) {
+    const uint8_t code = in.p[i];
+    if (code == 0 || i + code > in.n) return bad;
+    std::memmove(out + o, in.p + i + 1, code - 1u);
+    o += code - 1u;
+    i += code;
+    if (code < 0xFF && i < in.n) out[o++] = 0;
+  }
+  return o;
+}
+
+// A frame of one block holds no zero: its bytes are the packet as they are.
+inline bool direct(bytes in, bytes *out) {
+  if (in.n == 0 || in.p[0] != in.n) return false;
+  *out = in.sub(1);
+  return true;
+}
+
+} // namespace cobs
+
+/* ---------------- Frames ---------------- */
+
+enum class kind : uint8_t {
+  router,     // serialized router packet
+  ctrl_reply, // answer to a control op
+  capture,    // raw bus capture records (also the blackbox dump)
+  tracex,     // ThreadX trace dump part
+  heap_trace, // allocation trace dump part
+  pc_sample,  // PC sampling profiler samples
+  file,       // file pull part
+  result,     // benchmark / report result record
+};
+
+namespace detail {
+constexpr uint8_t ctrl_magic[4] = TELEMETRY_USB_CTRL_MAGIC;
+constexpr uint8_t capture_magic[4] = TELEMETRY_CAPTURE_MAGIC;
+constexpr uint8_t tracex_magic[4] = TELEMETRY_TRACEX_MAGIC;
+constexpr uint8_t heap_trace_magic[4] = TELEMETRY_HEAP_TRACE_MAGIC;
+constexpr uint8_t pc_sample_magic[4] = TELEMETRY_PC_SAMPLE_MAGIC;
+constexpr uint8_t file_magic[4] = TELEMETRY_FILE_MAGIC;
+constexpr uint8_t result_magic[4] = TELEMETRY_RESULT_MAGIC;
+
+inline bool has_magic(bytes f, const uint8_t (&m)[4]) {
+  return f.n >= 4 && std::memcmp(f.p, m, 4) == 0;
+}
+} // namespace detail
+
+inline kind classify(bytes f) {
+  if (f.n < 4 || f.p[0] != 0xC5) return kind::router;
+  if (detail::has_magic(f, detail::ctrl_magic)) return kind::ctrl_reply;
+  if (detail::has_magic(f, detail::capture_magic)) return kind::capture;
+  if (detail::has_magic(f, detail::tracex_magic)) return kind::tracex;
+  if (detail::has_magic(f, detail::heap_trace_magic)) return kind::heap_trace;
+  if (detail::has_magic(f, detail::pc_sample_magic)) return kind::pc_sample;
+  if (detail::has_magic(f, detail::file_magic)) return kind::file;
+  if (detail::has_magic(f, detail::result_magic)) return kind::result;
+  return kind::router;
+}
+
+struct frame {
+  kind k;
+  bytes data; // the whole decoded frame, magic included
+};
+
+/*
+ * Splits a byte stream into frames. feed() takes chunks of any size, from
+ * a bulk transfer or a whole mapped file; a frame split across chunks is
+ * carried over in a buffer kept between calls. Frames longer than
+ * `max_frame` are skipped and counted.
+ */
+class frame_reader {
+public:
+  struct stats_t {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;     // decoded
+    uint64_t malformed = 0; // COBS that doesn't decode
+    uint64_t oversize = 0;
+  };
+
+  explicit frame_reader(size_t max_frame = 64u * 1024u)
+      : max_(max_frame), scratch_(max_frame) {
+    pending_.reserve(max_frame);
+  }
+
+  template <class F> void feed(bytes chunk, F &&on_frame) {
+    const uint8_t *p = chunk.p, *end = chunk.p + chunk.n;
+    while (p < end) {
+      const uint8_t *z =
+          static_cast<const uint8_t *>(std::memchr(p, 0, size_t(end - p)));
+      if (!z) {
+        carry(p, size_t(end - p));
+        return;
+      }
+      if (!pending_.empty() || skipping_) {
+        carry(p, size_t(z - p));
+        if (!skipping_)
+          emit(bytes(pending_.data(), pending_.size()), on_frame);
+        pending_.clear();
+        skipping_ = false;
+      } else {
+        emit(bytes(p, size_t(z - p)), on_frame);
+      }
+      p = z + 1;
+    }
+  }
+
+  // As feed(), decoding frames inside `buf`, which the caller gives up.
+  template <class F> void feed_in_place(uint8_t *buf, size_t n, F &&on_frame) {
+    uint8_t *p = buf, *end = buf + n;
+    while (p < end && (!pending_.empty() || skipping_)) {
+      uint8_t *z = static_cast<uint8_t *>(std::memchr(p, 0, size_t(end - p)));
+      if (!z) {
+        carry(p, size_t(end - p));
+        return;
+      }
+      feed(bytes(p, size_t(z - p) + 1u), on_frame);
+      p = z + 1;
+    }
+    while (p < end) {
+      uint8_t *z = static_cast<uint8_t *>(std::memchr(p, 0, size_t(end - p)));
+      if (!z) {
+        carry(p, size_t(end - p));
+        return;
+      }
+      const size_t len = size_t(z - p);
+      if (len != 0) {
+        const size_t out = cobs::decode(bytes(p, len), p);
+        deliver(out, p, on_frame);
+      }
+      p = z + 1;
+    }
+  }
+
+  // Drop a partial frame, e.g. after reopening the port.
+  void reset() {
+    pending_.clear();
+    skipping_ = false;
+  }
+
+  const stats_t &stats() const { return stats_; }
+
+private:
+  // A COBS block code per 254 bytes on top of the frame.
+  size_t encoded_max() const { return max_ + max_ / 254u + 1u; }
+
+  void carry(const uint8_t *p, size_t n) {
+    if (skipping_) return;
+    if (pending_.size() + n > encoded_max()) {
+      stats_.oversize++;
+      pending_.clear();
+      skipping_ = true;
+      return;
+    }
+    pending_.insert(pending_.end(), p, p + n);
+  }
+
+  template <class F> void emit(bytes raw, F &on_frame) {
+    if (raw.n == 0) return;
+    bytes f;
+    if (cobs::direct(raw, &f)) {
+      deliver(f.n, f.p, on_frame);
+      return;
+    }
+    if (raw.n > encoded_max()) {
+      stats_.oversize++;
+      return;
+    }
+    deliver(cobs::decode(raw, scratch_.data()), scratch_.data(), on_frame);
+  }
+
+  template <class F> void deliver(size_t n, const uint8_t *p, F &on_frame) {
+    if (n == cobs::bad) {
+      stats_.malformed++;
+      return;
+    }
+    if (n > max_) {
+      stats_.oversize++;
+      return;
+    }
+    if (n == 0) return;
+    stats_.frames++;
+    stats_.bytes += n;
+    const bytes f(p, n);
+    on_frame(frame{classify(f), f});
+  }
+
+  size_t max_;
+  std::vector<uint8_t> scratch_;
+  std::vector<uint8_t> pending_;
+  bool skipping_ = false;
+  stats_t stats_;
+};
+
+/* ---------------- In-band frames ---------------- */
+
+// magic, op | 0x80, status, payload
+struct ctrl_reply_view {
+  bytes f;
+  bool valid() const { return f.n >= 6 && (f.p[4] & TELEMETRY_USB_CTRL_REPLY); }
+  uint8_t op() const { return uint8_t(f.p[4] & ~TELEMETRY_USB_CTRL_REPLY); }
+  uint8_t status() const { return f.p[5]; }
+  bytes payload() const { return f.sub(6); }
+};
+
+// LVC_GET reply payload: count, then type u16, length u8, timestamp u64,
+// value.
+struct lvc_value {
+  uint16_t type;
+  uint64_t timestamp;
+  bytes value;
+};
+
+class lvc_values {
+public:
+  explicit lvc_values(bytes payload) : b_(payload.sub(1)) {}
+  // Next value into *v; false at the end or at a truncated entry.
+  bool next(lvc_value *v) {
+    if (b_.n < 11u) return false;
+    const size_t len = b_.p[2];
+    if (b_.n < 11u + len) return false;
+    v->type = le16(b_.p);
+    v->timestamp = le64(b_.p + 3);
+    v->value = b_.sub(11, len);
+    b_ = b_.sub(11u + len);
+    return true;
+  }
+
+private:
+  bytes b_;
+};
+
+// TALKERS reply payload: count, u32 IDs evicted, records busiest first.
+struct talker {
+  uint32_t id; // TELEMETRY_TALKER_EXT for 29-bit
+  uint32_t frames, bytes, age_us, gap_min_us, gap_max_us;
+};
+
+struct talkers_view {
+  bytes b;
+  bool valid() const { return b.n >= 5u && b.n >= 5u + count() * TELEMETRY_TALKER_REC; }
+  size_t count() const { return b.p[0]; }
+  uint32_t evicted() const { return le32(b.p + 1); }
+  talker at(size_t i) const {
+    const uint8_t *p = b.p + 5u + i * TELEMETRY_TALKER_REC;
+    return {le32(p), le32(p + 4), le32(p + 8), le32(p + 12), le32(p + 16),
+            le32(p + 20)};
+  }
+};
+
+// One raw CAN frame, as a pcapng LINKTYPE_CAN_SOCKETCAN packet would hold.
+struct can_record {
+  uint64_t time_us; // FDCAN timestamp scale
+  uint32_t can_id;  // SocketCAN, TELEMETRY_CAPTURE_EFF_FLAG for 29-bit
+  uint8_t flags;    // SocketCAN FD flags | TELEMETRY_CAPTURE_DIR_TX
+  bytes data;
+
+  uint32_t id() const { return can_id & 0x1FFFFFFFu; }
+  bool extended() const { return can_id & TELEMETRY_CAPTURE_EFF_FLAG; }
+  bool fd() const { return flags & TELEMETRY_CAPTURE_FD_FDF; }
+  bool brs() const { return flags & TELEMETRY_CAPTURE_FD_BRS; }
+  bool tx() const { return flags & TELEMETRY_CAPTURE_DIR_TX; }
+};
+
+// magic, u32 records dropped so far, records
+class capture_view {
+public:
+  explicit capture_view(bytes f) : f_(f), rest_(f.sub(TELEMETRY_CAPTURE_FRAME_HDR)) {}
+  bool valid() const { return f_.n >= TELEMETRY_CAPTURE_FRAME_HDR; }
+  uint32_t dropped() const { return le32(f_.p + 4); }
+  bool next(can_record *r) {
+    constexpr size_t hdr = TELEMETRY_CAPTURE_REC_HDR;
+    if (rest_.n < hdr || rest_.n < hdr + rest_.p[12]) return false;
+    r->time_us = le64(rest_.p);
+    r->can_id = le32(rest_.p + 8);
+    r->flags = rest_.p[13];
+    r->data = rest_.sub(hdr, rest_.p[12]);
+    rest_ = rest_.sub(hdr + r->data.n);
+    return true;
+  }
+
+private:
+  bytes f_, rest_;
+};
+
+// magic, u32 offset, u32 buffer size, bytes
+struct tracex_view {
+  bytes f;
+  bool valid() const { return f.n >= 12; }
+  uint32_t offset() const { return le32(f.p + 4); }
+  uint32_t total() const { return le32(f.p + 8); }
+  bytes data() const { return f.sub(12); }
+};
+
+// rust_heap_trace_t (telemetry_hooks.h)
+struct heap_trace_record {
+  uint32_t ts_us, caller, ptr;
+  uint16_t size;
+  uint8_t op, cls;
+};
+
+// magic, u32 seq of the first record, u32 seq the dump ends at, records
+struct heap_trace_view {
+  bytes f;
+  bool valid() const { return f.n >= 12; }
+  uint32_t first_seq() const { return le32(f.p + 4); }
+  uint32_t end_seq() const { return le32(f.p + 8); }
+  size_t count() const { return (f.n - 12u) / 16u; }
+  heap_trace_record at(size_t i) const {
+    const uint8_t *p = f.p + 12u + i * 16u;
+    return {le32(p), le32(p + 4), le32(p + 8), le16(p + 12), p[14], p[15]};
+  }
+};
+
+// magic, u8 FILE_SRV_* status, u32 offset, u32 file size, bytes
+struct file_view {
+  bytes f;
+  bool valid() const { return f.n >= 13; }
+  uint8_t status() const { return f.p[4]; }
+  uint32_t offset() const { return le32(f.p + 5); }
+  uint32_t size() const { return le32(f.p + 9); }
+  bytes data() const { return f.sub(13); }
+  bool last() const { return status() != 0 || offset() + data().n >= size(); }
+};
+
+// magic, u8 version, u8 source, u8 name length, u8 metric count, u32 git
+// hash, u32 flags, u32 core Hz, u32 CAN nominal, u32 CAN data bit/s, u32
+// uptime ms, u16 node ID, u16 zero, name, u32 metrics
+struct result_view {
+  bytes f;
+  bool valid() const {
+    return f.n >= TELEMETRY_RESULT_HDR &&
+           f.n >= TELEMETRY_RESULT_HDR + f.p[6] + 4u * f.p[7];
+  }
+  uint8_t version() const { return f.p[4]; }
+  uint8_t source() const { return f.p[5]; }
+  uint32_t git_hash() const { return le32(f.p + 8); }
+  uint32_t flags() const { return le32(f.p + 12); }
+  uint32_t core_hz() const { return le32(f.p + 16); }
+  uint32_t can_nominal() const { return le32(f.p + 20); }
+  uint32_t can_data() const { return le32(f.p + 24); }
+  uint32_t uptime_ms() const { return le32(f.p + 28); }
+  uint16_t node_id() const { return le16(f.p + 32); }
+  bytes name() const { return f.sub(TELEMETRY_RESULT_HDR, f.p[6]); }
+  size_t count() const { return f.p[7]; }
+  uint32_t metric(size_t i) const {
+    return le32(f.p + TELEMETRY_RESULT_HDR + f.p[6] + 4u * i);
+  }
+};
+
+/* ---------------- Health ---------------- */
+
+struct health_t {
+  uint32_t TELEMETRY_HEALTH_FIELDS;
+};
+
+enum class health_field : unsigned { TELEMETRY_HEALTH_FIELDS, count };
+
+static_assert(sizeof(health_t) == unsigned(health_field::count) * 4u,
+              "health_t must be packed u32s");
+
+// Payload of a TELEMETRY_HEALTH_TYPE packet, or of a HEALTH_GET reply after
+// its status. An older firmware's shorter layout reads the fields it lacks
+// as UINT32_MAX, like unmeasured ones.
+struct health_view {
+  bytes payload;
+  bool valid() const { return payload.n >= 4 && payload.n % 4u == 0; }
+  uint32_t version() const { return get(health_field::version); }
+  uint32_t get(health_field f) const {
+    const size_t off = size_t(f) * 4u;
+    return (off + 4u <= payload.n) ? le32(payload.p + off) : UINT32_MAX;
+  }
+  health_t decode() const {
+    health_t h;
+    std::memset(&h, 0xFF, sizeof(h));
+    std::memcpy(&h, payload.p, (payload.n < sizeof(h)) ? payload.n : sizeof(h));
+    return h;
+  }
+};
+
+/* ---------------- Deferred-format errors ---------------- */
+
+// [TELEMETRY_FMT_DEFERRED][u16 format id][args]; anything else is text.
+struct deferred_view {
+  bytes payload;
+  bool deferred() const {
+    return payload.n >= 3 && payload.p[0] == TELEMETRY_FMT_DEFERRED;
+  }
+  uint16_t id() const { return le16(payload.p + 1); }
+  bytes args() const { return payload.sub(3); }
+};
+
+// The .seds_fmt section of the firmware ELF; borrows the ELF's bytes.
+class fmt_table {
+public:
+  fmt_table() = default;
+  explicit fmt_table(bytes section) : sec_(section) {}
+
+  // Empty if `elf` isn't a little-endian ELF32 with a .seds_fmt section.
+  static fmt_table from_elf(bytes elf) {
+    if (elf.n < 0x34 || std::memcmp(elf.p, "\x7f" "ELF", 4) != 0 ||
+        elf.p[4] != 1 || elf.p[5] != 1)
+      return {};
+    const uint32_t shoff = le32(elf.p + 0x20);
+    const uint16_t shentsize = le16(elf.p + 0x2E), shnum = le16(elf.p + 0x30),
+                   shstrndx = le16(elf.p + 0x32);
+    auto header = [&](uint32_t i, uint32_t *name, uint32_t *off,
+                      uint32_t *size) {
+      const size_t h = size_t(shoff) + size_t(i) * shentsize;
+      if (h + 24u > elf.n) return false;
+      *name = le32(elf.p + h);
+      *off = le32(elf.p + h + 16);
+      *size = le32(elf.p + h + 20);
+      return true;
+    };
+    uint32_t name, stroff, size;
+    if (shstrndx >= shnum || !header(shstrndx, &name, &stroff, &size))
+      return {};
+    const bytes strtab = elf.sub(stroff, size);
+    for (uint32_t i = 0; i < shnum; i++) {
+      uint32_t off;
+      if (!header(i, &name, &off, &size)) break;
+      const bytes s = strtab.sub(name);
+      if (s.n >= 10 && std::memcmp(s.p, ".seds_fmt", 10) == 0 &&
+          size_t(off) + size <= elf.n)
+        return fmt_table(elf.sub(off, size));
+    }
+    return {};
+  }
+
+  bool empty() const { return sec_.empty(); }
+
+  // Format string at `id`, NULL if out of range.
+  const char *format(uint16_t id) const {
+    if (id >= sec_.n || !std::memchr(sec_.p + id, 0, sec_.n - id)) return nullptr;
+    return reinterpret_cast<const char *>(sec_.p + id);
+  }
+
+private:
+  bytes sec_;
+};
+
+// Append the text of an error payload to `out`. Widths follow the
+// conversions as on the target: 8 bytes for %ll / %j, a float for
+// %f %e %g %a, 4 bytes for the rest; %s is not sent.
+inline void expand(const fmt_table &t, deferred_view v, std::string &out) {
+  if (!v.deferred()) {
+    out.append(reinterpret_cast<const char *>(v.payload.p), v.payload.n);
+    return;
+  }
+  const char *fmt = t.format(v.id());
+  char buf[64];
+  if (!fmt) {
+    std::snprintf(buf, sizeof(buf), "<unknown format id %u>", unsigned(v.id()));
+    out += buf;
+    return;
+  }
+  const bytes args = v.args();
+  size_t pos = 0;
+  for (const char *c = fmt; *c;) {
+    if (*c != '%') {
+      const char *n = std::strchr(c, '%');
+      const size_t len = n ? size_t(n - c) : std::strlen(c);
+      out.append(c, len);
+      c += len;
+      continue;
+    }
+    if (c[1] == '%') {
+      out += '%';
+      c += 2;
+      continue;
+    }
+    // %[flags][width][.precision][length]conversion, length dropped
+    char spec[24];
+    size_t s = 0;
+    const char *q = c + 1;
+    spec[s++] = '%';
+    while (*q && std::strchr("-+ #0", *q) && s < 8) spec[s++] = *q++;
+    while (*q >= '0' && *q <= '9' && s < 12) spec[s++] = *q++;
+    if (*q == '.') {
+      spec[s++] = *q++;
+      while (*q >= '0' && *q <= '9' && s < 16) spec[s++] = *q++;
+    }
+    int wide = 0;
+    while (*q && std::strchr("hlLjzt", *q)) {
+      if (*q == 'j' || (q[0] == 'l' && q[1] == 'l')) wide = 1;
+      q += (q[0] == 'l' && q[1] == 'l') ? 2 : 1;
+    }
+    const char conv = *q;
+    if (!conv || !std::strchr("diouxXcpfFeEgGaAs", conv)) {
+      out += "<bad format>";
+      return;
+    }
+    c = q + 1;
+    if (conv == 's') {
+      out += "<%s>";
+      continue;
+    }
+    const size_t width = (std::strchr("fFeEgGaA", conv) || !wide) ? 4u : 8u;
+    if (pos + width > args.n) {
+      out += "<bad arguments>";
+      return;
+    }
+    const uint8_t *a = args.p + pos;
+    pos += width;
+    int n;
+    if (std::strchr("fFeEgGaA", conv)) {
+      spec[s++] = conv;
+      spec[s] = 0;
+      float f;
+      std::memcpy(&f, a, 4);
+      n = std::snprintf(buf, sizeof(buf), spec, double(f));
+    } else if (conv == 'p') {
+      n = std::snprintf(buf, sizeof(buf), "0x%08x", unsigned(le32(a)));
+    } else if (conv == 'c') {
+      spec[s++] = conv;
+      spec[s] = 0;
+      n = std::snprintf(buf, sizeof(buf), spec, int(a[0]));
+    } else {
+      spec[s++] = 'l';
+      spec[s++] = 'l';
+      spec[s++] = conv;
+      spec[s] = 0;
+      const bool sgn = (conv == 'd' || conv == 'i');
+      if (wide) {
+        const uint64_t u = le64(a);
+        n = sgn ? std::snprintf(buf, sizeof(buf), spec, (long long)int64_t(u))
+                : std::snprintf(buf, sizeof(buf), spec, (unsigned long long)u);
+      } else {
+        const uint32_t u = le32(a);
+        n = sgn ? std::snprintf(buf, sizeof(buf), spec, (long long)int32_t(u))
+                : std::snprintf(buf, sizeof(buf), spec, (unsigned long long)u);
+      }
+    }
+    if (n > 0) out.append(buf, (size_t(n) < sizeof(buf)) ? size_t(n) : sizeof(buf) - 1u);
+  }
+}
+
+/* ---------------- Files ---------------- */
+
+#ifdef GATEWAY_STREAM_MMAP
+// A file mapped read-only; empty if it can't be.
+class mapped_file {
+public:
+  explicit mapped_file(const char *path) {
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *m = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) {
+        b_ = bytes(m, size_t(st.st_size));
+        (void)::madvise(m, b_.n, MADV_SEQUENTIAL);
+      }
+    }
+    ::close(fd);
+  }
+  ~mapped_file() {
+    if (b_.p) ::munmap(const_cast<uint8_t *>(b_.p), b_.n);
+  }
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  bytes data() const { return b_; }
+  explicit operator bool() const { return b_.p != nullptr; }
+
+private:
+  bytes b_;
+};
+#endif
+
+} // namespace gateway
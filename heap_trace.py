@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Dump the router heap's allocation trace over USB and rank the call sites.
+
+Needs a build with ENABLE_HEAP_TRACE. Sends TELEMETRY_USB_CTRL_HEAP_TRACE_DUMP
+on the CDC port, collects the TELEMETRY_HEAP_TRACE_MAGIC frames and prints
+one line per caller: allocations, frees and failures, bytes asked for, the
+rate over the span the ring covers, and blocks still outstanding at the end
+of it. The hottest steady-state allocators come out on top.
+
+Usage
+  ./heap_trace.py /dev/ttyACM0 [--elf build/Debug/gateway_board.elf]
+  ./heap_trace.py --no-request usb_capture.bin
+    (frames from a raw CDC byte stream recorded earlier)
+  --elf names callers after the function holding the return address
+  --raw prints every event instead of the summary
+"""
+from __future__ import annotations
+
+import argparse
+import bisect
+import struct
+import sys
+from dataclasses import dataclass
+from pathlib import Path
+
+from cdc_link import ctrl_reply, frames, open_port, send_ctrl
+
+HTR_MAGIC = bytes([0xC5]) + b"HTR"
+OP_HEAP_TRACE_DUMP = 0x11
+STATUS = {0: "ok", 1: "heap trace not built in", 4: "a dump is already running"}
+
+RECORD = struct.Struct("<IIIHBB")  # rust_heap_trace_t
+OPS = {1: "alloc", 2: "free", 3: "fail"}
+
+
+@dataclass
+class Site:
+    allocs: int = 0
+    frees: int = 0
+    fails: int = 0
+    bytes: int = 0
+    live: int = 0
+
+
+def func_symbols(elf: Path) -> tuple[list[int], list[tuple[int, str]]]:
+    data = elf.read_bytes()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        raise SystemExit(f"{elf}: not a little-endian ELF32 file")
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, _ = struct.unpack_from("<HHH", data, 0x2E)
+    sections = [struct.unpack_from("<IIIIIIIIII", data, shoff + k * shentsize)
+                for k in range(shnum)]
+    funcs: list[tuple[int, int, str]] = []
+    for sh in sections:
+        if sh[1] != 2:  # SHT_SYMTAB
+            continue
+        strtab = sections[sh[6]]
+        for off in range(sh[4], sh[4] + sh[5], 16):
+            name, value, size, info, _, _ = struct.unpack_from(
+                "<IIIBBH", data, off)
+            if info & 0x0F != 2 or not size:  # STT_FUNC
+                continue
+            start = strtab[4] + name
+            sym = data[start:data.index(b"\0", start)].decode()
+            funcs.append((value & ~1, size, sym))  # drop the Thumb bit
+    funcs.sort()
+    return [f[0] for f in funcs], [(f[1], f[2]) for f in funcs]
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", type=Path)
+    ap.add_argument("--elf", type=Path)
+    ap.add_argument("--raw", action="store_true")
+    ap.add_argument("--no-request", action="store_true",
+                    help="read frames only, don't send the dump command")
+    args = ap.parse_args(argv[1:])
+
+    starts, funcs = func_symbols(args.elf) if args.elf else ([], [])
+
+    def where(addr: int) -> str:
+        addr &= ~1
+        i = bisect.bisect_right(starts, addr) - 1
+        if i >= 0 and addr < starts[i] + funcs[i][0]:
+            return f"{funcs[i][1]}+0x{addr - starts[i]:x}"
+        return f"0x{addr:08x}"
+
+    fd = open_port(args.port, read_only=args.no_request)
+    if not args.no_request:
+        send_ctrl(fd, OP_HEAP_TRACE_DUMP)
+
+    events: dict[int, tuple] = {}
+    end: int | None = None
+    for f in frames(fd):
+        if (st := ctrl_reply(f, OP_HEAP_TRACE_DUMP)) is not None:
+            if st:
+                print(f"refused: {STATUS.get(st, st)}", file=sys.stderr)
+                return 1
+            continue
+        if f[:4] != HTR_MAGIC or len(f) < 12:
+            continue
+        first, frame_end = struct.unpack_from("<II", f, 4)
+        if end != frame_end:
+            events, end = {}, frame_end  # a new dump
+        for k, off in enumerate(range(12, len(f) - RECORD.size + 1,
+                                      RECORD.size)):
+            events[first + k] = RECORD.unpack_from(f, off)
+        if first + (len(f) - 12) // RECORD.size >= end:
+            break
+    else:
+        print("stream ended before the dump was complete", file=sys.stderr)
+        if not events:
+            return 1
+
+    ordered = [events[s] for s in sorted(events)]
+    if args.raw:
+        for ts, caller, ptr, size, op, cls in ordered:
+            print(f"{ts:10d} {OPS.get(op, op):5s} {size:5d} cls={cls:3d} "
+                  f"0x{ptr:08x} {where(caller)}")
+        return 0
+    if not ordered:
+        print("no events recorded")
+        return 0
+
+    sites: dict[int, Site] = {}
+    owner: dict[int, int] = {}  # block -> caller that allocated it
+    for _, caller, ptr, size, op, _ in ordered:
+        s = sites.setdefault(caller, Site())
+        if op == 1:
+            s.allocs += 1
+            s.bytes += size
+            s.live += 1
+            owner[ptr] = caller
+        elif op == 2:
+            s.frees += 1
+            if (a := owner.pop(ptr, None)) is not None:
+                sites[a].live -= 1
+        elif op == 3:
+            s.fails += 1
+    span_s = ((ordered[-1][0] - ordered[0][0]) & 0xFFFFFFFF) / 1e6 or 1e-6
+
+    print(f"{len(ordered)} events over {span_s:.3f} s "
+          f"(of {end} since boot)")
+    print(f"{'allocs/s':>9} {'bytes/s':>9} {'allocs':>7} {'frees':>7} "
+          f"{'fails':>5} {'live':>5}  caller")
+    for caller, s in sorted(sites.items(),
+                            key=lambda kv: (-kv[1].allocs, -kv[1].bytes)):
+        print(f"{s.allocs / span_s:9.1f} {s.bytes / span_s:9.0f} "
+              f"{s.allocs:7d} {s.frees:7d} {s.fails:5d} {s.live:5d}  "
+              f"{where(caller)}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
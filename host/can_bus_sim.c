@@ -0,0 +1,310 @@
+// can_bus_sim.c
+//
+// Many boards on one bus: N can_bus instances, each on its own simulated
+// controller (mock/fdcan_mock.c), sharing one wire and one clock. For
+// node counts the bench can't be wired up for, it reports what the bus
+// does as boards are added: load, and the latency and loss of the
+// messages between them.
+//
+//  - traffic: node i sends a MSG_LEN-byte message with can_bus_send_large()
+//  on standard ID SIM_BASE_ID + i about every PERIOD_MS: the boards' clocks
+//  aren't aligned, so each starts at a random phase and every period is
+//  off by up to 1/16 either way (a fixed seed, so runs repeat). Messages
+//  carry the time they were due; one the TX ring refuses is retried as
+//  the bus frees up, so backlog shows up as latency.
+//  - wire: one frame at a time. When the bus is free the head frames of
+//  the controllers' TX FIFOs arbitrate (lowest identifier wins, a
+//  standard frame before an extended one with the same base), the winner
+//  takes its bus time, and every other node receives it.
+//  - reported per N: bus load (wire time over run time), messages due and
+//  sent, deliveries (each message should reach the other N - 1), lost,
+//  and the latency from due to delivery, p50 / p99 / max.
+//
+// Every delivery is checked byte for byte; a corrupt one makes the exit
+// status non-zero. Losses are reported, not failed: past the reassembly
+// slots a receiver has, they are what the driver does.
+//
+// Time sync between nodes is not simulated: it lives in telemetry.c, on
+// the sedsprintf_rs router, which isn't in this tree.
+//
+// Usage: can_bus_sim [--quick]   (--quick: 100 ms per node count, for ctest)
+
+#include "can_bus.h"
+#include "fdcan_mock.h"
+#include "host_board.h"
+#include "proto_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_NODES FDCAN_MOCK_INSTANCES
+#define SIM_BASE_ID 0x200u
+#define SIM_MAGIC 0x5Du
+#define SIM_HDR 12u // magic, sender, seq (2), due ns (8)
+#define MSG_LEN 128u
+#define PERIOD_MS 20u
+#define MAX_SAMPLES (1u << 20)
+
+typedef struct {
+  FDCAN_HandleTypeDef h;
+  can_bus_t *bus;
+  uint64_t due_ns; // next message
+  uint16_t seq;
+  uint8_t backlog; // a due message the TX ring refused
+} sim_node_t;
+
+static sim_node_t g_node[SIM_NODES];
+static unsigned g_active; // nodes on the wire this run
+
+typedef struct {
+  uint32_t due;
+  uint32_t sent;
+  uint32_t refused; // send_large HAL_BUSY, retried
+  uint32_t received;
+  uint32_t corrupt;
+  uint64_t wire_ns;
+} sim_stats_t;
+
+static sim_stats_t g_st;
+static uint32_t g_lat_us[MAX_SAMPLES];
+static uint32_t g_lat_n;
+
+static uint32_t g_rand = 12345u;
+
+static uint32_t rand_below(uint32_t n) {
+  g_rand = g_rand * 1664525u + 1013904223u;
+  return (uint32_t)(((uint64_t)(g_rand >> 8) * n) >> 24);
+}
+
+// The period after the one just sent, jittered.
+static uint64_t next_period_ns(void) {
+  const uint32_t period = PERIOD_MS * 1000000u;
+  return period - period / 16u + rand_below(period / 8u);
+}
+
+static uint8_t pattern(uint32_t sender, uint32_t seq, uint32_t i) {
+  return (uint8_t)(sender * 29u + seq * 7u + i);
+}
+
+static void on_rx(const uint8_t *data, size_t len, void *user) {
+  (void)user;
+  if (len != MSG_LEN || data[0] != SIM_MAGIC || data[1] >= g_active) {
+    g_st.corrupt++;
+    return;
+  }
+  const uint32_t seq = data[2] | (data[3] << 8);
+  uint64_t due;
+  memcpy(&due, &data[4], 8);
+  for (size_t i = SIM_HDR; i < len; i++) {
+    if (data[i] != pattern(data[1], seq, (uint32_t)i)) {
+      g_st.corrupt++;
+      return;
+    }
+  }
+  g_st.received++;
+  if (g_lat_n < MAX_SAMPLES)
+    g_lat_us[g_lat_n++] = (uint32_t)((host_clock_ns() - due) / 1000u);
+}
+
+static void inject(sim_node_t *n, const fdcan_mock_frame_t *f) {
+  const uint8_t flags = (f->xtd ? CAN_BUS_RAW_EXT : 0u) |
+                        (f->fdf ? CAN_BUS_RAW_FD : 0u) |
+                        (f->brs ? CAN_BUS_RAW_BRS : 0u);
+  HAL_StatusTypeDef st = can_bus_inject_rx(n->bus, CAN_BUS_RX_FIFO1, f->id,
+                                           flags, f->data, f->len);
+  if (st == HAL_BUSY) { // ring full: let the thread catch up
+    can_bus_process_rx(n->bus);
+    st = can_bus_inject_rx(n->bus, CAN_BUS_RX_FIFO1, f->id, flags, f->data,
+                           f->len);
+  }
+  if (st != HAL_OK) {
+    fprintf(stderr, "inject failed (%d)\n", (int)st);
+    exit(2);
+  }
+}
+
+// Every node but the sender receives the frame.
+static void on_wire(FDCAN_HandleTypeDef *h, const fdcan_mock_frame_t *f,
+                    void *user) {
+  (void)user;
+  g_st.wire_ns += fdcan_mock_frame_ns(h, f);
+  for (unsigned i = 0; i < g_active; i++) {
+    if (&g_node[i].h != h)
+      inject(&g_node[i], f);
+  }
+}
+
+// Arbitration field, lower wins: the base ID first, then a standard frame
+// (dominant IDE) before an extended one.
+static uint32_t arb_key(const fdcan_mock_frame_t *f) {
+  return f->xtd ? ((f->id >> 18) << 19) | (1u << 18) | (f->id & 0x3FFFFu)
+                : f->id << 19;
+}
+
+// Send what is due; a refused message stays due.
+static void generate(uint64_t end_ns) {
+  static uint8_t buf[MSG_LEN];
+  const uint64_t now = host_clock_ns();
+  for (unsigned i = 0; i < g_active; i++) {
+    sim_node_t *n = &g_node[i];
+    if (!n->backlog) {
+      if (n->due_ns > now || n->due_ns >= end_ns)
+        continue;
+      g_st.due++;
+      n->backlog = 1;
+    }
+    buf[0] = SIM_MAGIC;
+    buf[1] = (uint8_t)i;
+    buf[2] = (uint8_t)n->seq;
+    buf[3] = (uint8_t)(n->seq >> 8);
+    memcpy(&buf[4], &n->due_ns, 8);
+    for (size_t k = SIM_HDR; k < MSG_LEN; k++)
+      buf[k] = pattern(i, n->seq, (uint32_t)k);
+    const HAL_StatusTypeDef st =
+        can_bus_send_large(n->bus, buf, MSG_LEN, SIM_BASE_ID + i);
+    if (st == HAL_BUSY) {
+      g_st.refused++;
+      continue;
+    }
+    if (st != HAL_OK) {
+      fprintf(stderr, "send_large failed (%d)\n", (int)st);
+      exit(2);
+    }
+    g_st.sent++;
+    n->backlog = 0;
+    n->seq++;
+    n->due_ns += next_period_ns();
+  }
+}
+
+// One frame on the bus, from the node winning arbitration, and the
+// interrupts and thread work it causes. Returns 0 if nothing is pending.
+static int bus_step(void) {
+  sim_node_t *win = NULL;
+  uint32_t best = 0;
+  for (unsigned i = 0; i < g_active; i++) {
+    fdcan_mock_frame_t f;
+    if (!fdcan_mock_tx_head(&g_node[i].h, &f))
+      continue;
+    const uint32_t key = arb_key(&f);
+    if (!win || key < best) {
+      win = &g_node[i];
+      best = key;
+    }
+  }
+  if (!win)
+    return 0;
+  (void)fdcan_mock_transmit(&win->h, 1);
+  can_bus_irq(&win->h, 1);
+  can_bus_irq(&win->h, 0);
+  if (host_nvic_take(FMAC_IRQn))
+    can_bus_notify_irq();
+  for (unsigned i = 0; i < g_active; i++)
+    can_bus_process_rx(g_node[i].bus);
+  (void)proto_timer_poll();
+  return 1;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t pct(uint32_t p) {
+  if (!g_lat_n)
+    return 0;
+  return g_lat_us[(uint64_t)(g_lat_n - 1u) * p / 100u];
+}
+
+// `nodes` nodes sending for `ms`, then until the bus is quiet.
+static void run(unsigned nodes, uint32_t ms) {
+  memset(&g_st, 0, sizeof(g_st));
+  g_lat_n = 0;
+  g_active = nodes;
+  const uint64_t t0 = host_clock_ns();
+  for (unsigned i = 0; i < nodes; i++) {
+    g_node[i].due_ns = t0 + rand_below(PERIOD_MS * 1000000u);
+    g_node[i].backlog = 0;
+  }
+
+  const uint64_t end = t0 + (uint64_t)ms * 1000000u;
+  for (;;) {
+    generate(end);
+    if (bus_step())
+      continue;
+    // Bus idle: on to the next message due, if any is left to send.
+    uint64_t next = UINT64_MAX;
+    for (unsigned i = 0; i < nodes; i++) {
+      if (g_node[i].backlog)
+        next = host_clock_ns();
+      else if (g_node[i].due_ns < end && g_node[i].due_ns < next)
+        next = g_node[i].due_ns;
+    }
+    if (next == UINT64_MAX)
+      break;
+    if (next > host_clock_ns())
+      host_clock_advance(next - host_clock_ns());
+  }
+  const uint64_t elapsed = host_clock_ns() - t0;
+  for (unsigned i = 0; i < nodes; i++)
+    can_bus_process_rx(g_node[i].bus);
+
+  qsort(g_lat_us, g_lat_n, sizeof(g_lat_us[0]), cmp_u32);
+  const uint32_t expect = g_st.sent * (nodes - 1u);
+  printf("%5u %6.1f %6u %6u %8u %8u %6u %7u %7u %7u\n", nodes,
+         elapsed ? 100.0 * g_st.wire_ns / elapsed : 0.0,
+         g_st.due, g_st.sent, expect, g_st.received, expect - g_st.received,
+         pct(50), pct(99), pct(100));
+}
+
+int main(int argc, char **argv) {
+  const int quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+  const uint32_t ms = quick ? 100u : 2000u;
+  static const unsigned counts[] = {2, 4, 8, 16, 20};
+
+  for (unsigned i = 0; i < SIM_NODES; i++) {
+    FDCAN_HandleTypeDef *h = &g_node[i].h;
+    h->Instance = &fdcan_mock_regs[i];
+    h->Init.ClockDivider = FDCAN_CLOCK_DIV1;
+    h->Init.FrameFormat = FDCAN_FRAME_FD_BRS;
+    h->Init.Mode = FDCAN_MODE_NORMAL;
+    h->Init.NominalPrescaler = 16;
+    h->Init.NominalTimeSeg1 = 1;
+    h->Init.NominalTimeSeg2 = 1;
+    h->Init.DataPrescaler = 1;
+    h->Init.DataTimeSeg1 = 1;
+    h->Init.DataTimeSeg2 = 1;
+    h->Init.StdFiltersNbr = 28;
+    h->Init.TxFifoQueueMode = FDCAN_TX_FIFO_OPERATION;
+    if (can_bus_init(h) != HAL_OK) {
+      fprintf(stderr, "can_bus_init failed for node %u\n", i);
+      return 2;
+    }
+    g_node[i].bus = can_bus_get(i);
+    fdcan_mock_set_wire(h, on_wire, NULL);
+    can_bus_subscribe_rx(g_node[i].bus, on_rx, NULL);
+  }
+
+  can_bus_bitrate_t br;
+  can_bus_get_bitrate(g_node[0].bus, &br);
+  printf("can_bus_sim: %lu/%lu bit/s, %u-byte message per node every %u ms,"
+         " %u ms per run%s\n",
+         (unsigned long)br.nominal_bps, (unsigned long)br.data_bps, MSG_LEN,
+         PERIOD_MS, (unsigned)ms, quick ? " (quick)" : "");
+  printf("load: wire time over run time; latency in us from due to"
+         " delivery\n\n");
+  printf("%5s %6s %6s %6s %8s %8s %6s %7s %7s %7s\n", "nodes", "load%",
+         "due", "sent", "expect", "rcvd", "lost", "p50", "p99", "max");
+
+  int fail = 0;
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (counts[i] > SIM_NODES)
+      break;
+    run(counts[i], ms);
+    if (g_st.corrupt) {
+      fprintf(stderr, "FAIL: %u corrupt deliveries\n", (unsigned)g_st.corrupt);
+      fail = 1;
+    }
+  }
+  return fail;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+ * Host stand-in for CMSIS cmsis_compiler.h: the attribute macros and the
+ * core intrinsics the firmware uses, for a single-threaded x86-64/ARM64
+ * build. PRIMASK is a plain variable; "interrupts" are whatever the bench
+ * calls between driver calls, so masking only has to be tracked, not
+ * enforced. Exclusive loads/stores always succeed.
+ */
+
+#include <stdint.h>
+
+#ifndef __ASM
+#define __ASM __asm__
+#endif
+#ifndef __INLINE
+#define __INLINE inline
+#endif
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+#ifndef __STATIC_FORCEINLINE
+#define __STATIC_FORCEINLINE __attribute__((always_inline)) static inline
+#endif
+#ifndef __NO_RETURN
+#define __NO_RETURN __attribute__((__noreturn__))
+#endif
+#ifndef __USED
+#define __USED __attribute__((used))
+#endif
+#ifndef __WEAK
+#define __WEAK __attribute__((weak))
+#endif
+#ifndef __PACKED
+#define __PACKED __attribute__((packed, aligned(1)))
+#endif
+#ifndef __PACKED_STRUCT
+#define __PACKED_STRUCT struct __attribute__((packed, aligned(1)))
+#endif
+#ifndef __ALIGNED
+#define __ALIGNED(x) __attribute__((aligned(x)))
+#endif
+#ifndef __RESTRICT
+#define __RESTRICT __restrict
+#endif
+#ifndef __COMPILER_BARRIER
+#define __COMPILER_BARRIER() __asm__ volatile("" ::: "memory")
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uint32_t host_primask;
+
+__STATIC_FORCEINLINE void __DMB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+__STATIC_FORCEINLINE void __DSB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+__STATIC_FORCEINLINE void __ISB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+__STATIC_FORCEINLINE void __NOP(void) {}
+__STATIC_FORCEINLINE void __WFI(void) {}
+__STATIC_FORCEINLINE void __SEV(void) {}
+
+__STATIC_FORCEINLINE void __disable_irq(void) { host_primask = 1u; }
+__STATIC_FORCEINLINE void __enable_irq(void) { host_primask = 0u; }
+__STATIC_FORCEINLINE uint32_t __get_PRIMASK(void) { return host_primask; }
+__STATIC_FORCEINLINE void __set_PRIMASK(uint32_t m) { host_primask = m & 1u; }
+__STATIC_FORCEINLINE uint32_t __get_BASEPRI(void) { return 0u; }
+__STATIC_FORCEINLINE void __set_BASEPRI(uint32_t v) { (void)v; }
+__STATIC_FORCEINLINE uint32_t __get_IPSR(void) { return 0u; }
+
+__STATIC_FORCEINLINE uint32_t __LDREXW(volatile uint32_t *p) { return *p; }
+__STATIC_FORCEINLINE uint32_t __STREXW(uint32_t v, volatile uint32_t *p) {
+  *p = v;
+  return 0u;
+}
+__STATIC_FORCEINLINE uint16_t __LDREXH(volatile uint16_t *p) { return *p; }
+__STATIC_FORCEINLINE uint32_t __STREXH(uint16_t v, volatile uint16_t *p) {
+  *p = v;
+  return 0u;
+}
+__STATIC_FORCEINLINE uint8_t __LDREXB(volatile uint8_t *p) { return *p; }
+__STATIC_FORCEINLINE uint32_t __STREXB(uint8_t v, volatile uint8_t *p) {
+  *p = v;
+  return 0u;
+}
+__STATIC_FORCEINLINE void __CLREX(void) {}
+
+__STATIC_FORCEINLINE uint32_t __REV(uint32_t v) { return __builtin_bswap32(v); }
+__STATIC_FORCEINLINE uint32_t __REV16(uint32_t v) {
+  return ((v & 0xFF00FF00u) >> 8) | ((v & 0x00FF00FFu) << 8);
+}
+__STATIC_FORCEINLINE uint32_t __RBIT(uint32_t v) {
+  uint32_t r = 0;
+  for (unsigned i = 0; i < 32u; i++)
+    r |= ((v >> i) & 1u) << (31u - i);
+  return r;
+}
+__STATIC_FORCEINLINE uint8_t __CLZ(uint32_t v) {
+  return v ? (uint8_t)__builtin_clz(v) : 32u;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+ * Host stand-in for CMSIS core_cm4.h, included by the real stm32g491xx.h
+ * in place of the Cortex-M4 one: the register qualifiers, the NVIC calls
+ * (pending state only, see host_nvic_take()) and DWT/ITM/SCB blocks as
+ * plain variables.
+ */
+
+#include <stdint.h>
+#include "cmsis_compiler.h"
+
+#ifdef __cplusplus
+#define __I volatile
+#else
+#define __I volatile const
+#endif
+#define __O volatile
+#define __IO volatile
+#define __IM volatile const
+#define __OM volatile
+#define __IOM volatile
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  __IOM uint32_t CTRL;
+  __IOM uint32_t CYCCNT;
+  __IOM uint32_t CPICNT;
+  __IOM uint32_t EXCCNT;
+  __IOM uint32_t SLEEPCNT;
+  __IOM uint32_t LSUCNT;
+  __IOM uint32_t FOLDCNT;
+  __IM uint32_t PCSR;
+  __IOM uint32_t COMP0;
+  __IOM uint32_t MASK0;
+  __IOM uint32_t FUNCTION0;
+} DWT_Type;
+
+typedef struct {
+  __OM union {
+    __OM uint8_t u8;
+    __OM uint16_t u16;
+    __OM uint32_t u32;
+  } PORT[32U];
+  __IOM uint32_t TER;
+  __IOM uint32_t TPR;
+  __IOM uint32_t TCR;
+} ITM_Type;
+
+typedef struct {
+  __IOM uint32_t DHCSR;
+  __OM uint32_t DCRSR;
+  __IOM uint32_t DCRDR;
+  __IOM uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+  __IM uint32_t CPUID;
+  __IOM uint32_t ICSR;
+  __IOM uint32_t VTOR;
+  __IOM uint32_t AIRCR;
+  __IOM uint32_t SCR;
+  __IOM uint32_t CCR;
+  __IOM uint8_t SHP[12U];
+  __IOM uint32_t SHCSR;
+} SCB_Type;
+
+extern DWT_Type host_dwt;
+extern ITM_Type host_itm;
+extern CoreDebug_Type host_core_debug;
+extern SCB_Type host_scb;
+
+#define DWT (&host_dwt)
+#define ITM (&host_itm)
+#define CoreDebug (&host_core_debug)
+#define SCB (&host_scb)
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+#define ITM_TCR_ITMENA_Msk (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define SCB_ICSR_VECTACTIVE_Msk (0x1FFUL)
+#define SCB_SCR_SLEEPDEEP_Msk (1UL << 2)
+
+void NVIC_SetPendingIRQ(IRQn_Type irqn);
+void NVIC_ClearPendingIRQ(IRQn_Type irqn);
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irqn);
+void NVIC_EnableIRQ(IRQn_Type irqn);
+void NVIC_DisableIRQ(IRQn_Type irqn);
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irqn);
+uint32_t NVIC_EncodePriority(uint32_t group, uint32_t pre, uint32_t sub);
+uint32_t NVIC_GetPriorityGrouping(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,467 @@
+// fdcan_mock.c
+//
+// The FDCAN HAL calls can_bus.c makes, on a model of the controller (see
+// fdcan_mock.h):
+//  - message RAM: the G4's fixed layout (28 standard filters, 8 extended,
+//  2 x 3 RX elements, 3 TX events, 3 TX buffers; 0x350 bytes) per
+//  controller, mapped below 4 GB.
+//  - TX FIFO: TXBAR writes are applied lazily by fdcan_mock_sync(), which
+//  the TXFQS/TXBRP/TSCV reads in stm32g4xx.h go through; transmission
+//  happens in fdcan_mock_transmit(), or in those reads in a poll mode.
+//  - interrupts: IR/IE as plain registers; HAL_FDCAN_IRQHandler() clears
+//  and dispatches the TX event, TX complete and timestamp wrap sources in
+//  the HAL's order. The driver's one write-1-to-clear (TEFL) can't be
+//  modelled in plain memory, so lost TX events are only counted here.
+//
+// Notes / Assumptions:
+//  - Single-threaded: the bench calls the "ISRs" between driver calls.
+//  - Filters, RX FIFOs, error counters and bus errors are not modelled.
+
+#include "fdcan_mock.h"
+#include "host_board.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define MOCK_INSTANCES ((unsigned)FDCAN_MOCK_INSTANCES)
+#define MRAM_BYTES 0x350u
+#define MRAM_TX_OFF 0x278u
+#define TX_ELEM_WORDS 18u
+#define TX_DEPTH 3u
+#define TX_EVENTS 3u
+#define KERNEL_HZ 170000000u
+
+FDCAN_GlobalTypeDef fdcan_mock_regs[MOCK_INSTANCES];
+
+typedef struct {
+  FDCAN_HandleTypeDef *h;
+  uint8_t *mram;
+  uint32_t put, get, count; // TX FIFO
+  FDCAN_TxEventFifoTypeDef ev[TX_EVENTS];
+  uint32_t ev_get, ev_count, ev_lost;
+  uint64_t ts_wraps;
+  fdcan_mock_wire_cb_t wire;
+  void *wire_user;
+  fdcan_mock_poll_t poll;
+} mock_ctl_t;
+
+static mock_ctl_t g_ctl[MOCK_INSTANCES];
+
+static const uint8_t k_dlc_len[16] = {0, 1,  2,  3,  4,  5,  6,  7,
+                                      8, 12, 16, 20, 24, 32, 48, 64};
+
+static mock_ctl_t *ctl_of(const FDCAN_HandleTypeDef *h) {
+  if (!h || h->Instance < &fdcan_mock_regs[0] ||
+      h->Instance >= &fdcan_mock_regs[MOCK_INSTANCES])
+    return NULL;
+  return &g_ctl[h->Instance - &fdcan_mock_regs[0]];
+}
+
+// The HAL keeps message RAM addresses in uint32_t fields.
+static uint8_t *mram_alloc(void) {
+#ifdef MAP_32BIT
+  void *p = mmap(NULL, MRAM_BYTES, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  if (p == MAP_FAILED)
+    p = NULL;
+#else
+  void *p = calloc(1, MRAM_BYTES);
+#endif
+  if (!p || (uintptr_t)p + MRAM_BYTES > 0xFFFFFFFFu) {
+    fprintf(stderr, "fdcan_mock: no message RAM below 4 GB\n");
+    abort();
+  }
+  return p;
+}
+
+static uint32_t nominal_bit_clocks(const FDCAN_HandleTypeDef *h) {
+  const uint32_t ckdiv = h->Init.ClockDivider;
+  const uint32_t n = (ckdiv ? ckdiv * 2u : 1u) * h->Init.NominalPrescaler *
+                     (1u + h->Init.NominalTimeSeg1 + h->Init.NominalTimeSeg2);
+  return n ? n : 1u;
+}
+
+static uint32_t data_bit_clocks(const FDCAN_HandleTypeDef *h) {
+  const uint32_t ckdiv = h->Init.ClockDivider;
+  return (ckdiv ? ckdiv * 2u : 1u) * h->Init.DataPrescaler *
+         (1u + h->Init.DataTimeSeg1 + h->Init.DataTimeSeg2);
+}
+
+uint32_t fdcan_mock_frame_ns(const FDCAN_HandleTypeDef *h,
+                             const fdcan_mock_frame_t *f) {
+  uint32_t nom, data;
+  if (!f->fdf) {
+    // SOF, ID (+ SRR, IDE, ID ext), RTR, r0, DLC, data, CRC + delimiter
+    nom = (f->xtd ? 39u : 19u) + 8u * f->len + 16u;
+    data = 0;
+  } else {
+    // SOF, ID (+ SRR, IDE, ID ext), RRS, FDF, res, BRS | ESI, DLC, data,
+    // stuff count, CRC + delimiter
+    nom = f->xtd ? 36u : 17u;
+    data = 5u + 8u * f->len + 4u + (f->len <= 16u ? 17u : 21u) + 1u;
+    if (!f->brs) {
+      nom += data;
+      data = 0;
+    }
+  }
+  nom += 12u; // ACK, EOF, intermission
+  const uint64_t clocks =
+      (uint64_t)nom * nominal_bit_clocks(h) + (uint64_t)data * data_bit_clocks(h);
+  return (uint32_t)(clocks * 1000000000u / KERNEL_HZ);
+}
+
+static void update_txfqs(mock_ctl_t *c) {
+  FDCAN_GlobalTypeDef *r = c->h->Instance;
+  const uint32_t free_n = TX_DEPTH - c->count;
+  r->TXFQS_[0] = (free_n << FDCAN_TXFQS_TFFL_Pos) |
+                 (c->get << FDCAN_TXFQS_TFGI_Pos) |
+                 (c->put << FDCAN_TXFQS_TFQPI_Pos) |
+                 (free_n ? 0u : FDCAN_TXFQS_TFQF);
+}
+
+// Timestamp counter since time 0, not wrapped: one tick per TCP bit times.
+static uint64_t ts_ticks(const mock_ctl_t *c) {
+  const FDCAN_GlobalTypeDef *r = c->h->Instance;
+  const uint32_t tcp = ((r->TSCC & FDCAN_TSCC_TCP) >> FDCAN_TSCC_TCP_Pos) + 1u;
+  return (uint64_t)(((unsigned __int128)host_clock_ns() * KERNEL_HZ) /
+                    ((uint64_t)1000000000u * nominal_bit_clocks(c->h) * tcp));
+}
+
+unsigned fdcan_mock_sync(void) {
+  static int polling; // fdcan_mock_transmit() syncs too
+  for (unsigned i = 0; i < MOCK_INSTANCES; i++) {
+    mock_ctl_t *c = &g_ctl[i];
+    if (!c->h)
+      continue;
+    FDCAN_GlobalTypeDef *r = c->h->Instance;
+    uint32_t bar = r->TXBAR;
+    r->TXBAR = 0;
+    // Add requests land on the put element, as the driver wrote them.
+    while (bar && c->count < TX_DEPTH) {
+      const uint32_t bit = 1u << c->put;
+      if (!(bar & bit)) {
+        fprintf(stderr, "fdcan_mock: TXBAR 0x%x, put index %u\n",
+                (unsigned)bar, (unsigned)c->put);
+        abort();
+      }
+      bar &= ~bit;
+      r->TXBRP_[0] |= bit;
+      r->TXBTO &= ~bit;
+      c->put = (c->put + 1u) % TX_DEPTH;
+      c->count++;
+    }
+    update_txfqs(c);
+
+    if (c->count && c->poll != FDCAN_MOCK_POLL_FROZEN && !polling) {
+      polling = 1;
+      if (c->poll == FDCAN_MOCK_POLL_SENDS)
+        (void)fdcan_mock_transmit(c->h, 1);
+      else
+        host_clock_advance(10000u);
+      polling = 0;
+    }
+
+    const uint64_t ticks = ts_ticks(c);
+    r->TSCV_[0] = (uint32_t)(ticks & 0xFFFFu);
+    if ((ticks >> 16) != c->ts_wraps) {
+      c->ts_wraps = ticks >> 16;
+      r->IR |= FDCAN_IR_TSW;
+    }
+  }
+  return 0;
+}
+
+void fdcan_mock_set_wire(FDCAN_HandleTypeDef *hfdcan, fdcan_mock_wire_cb_t cb,
+                         void *user) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c)
+    return;
+  c->wire = cb;
+  c->wire_user = user;
+}
+
+void fdcan_mock_set_poll(FDCAN_HandleTypeDef *hfdcan, fdcan_mock_poll_t mode) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (c)
+    c->poll = mode;
+}
+
+unsigned fdcan_mock_tx_pending(FDCAN_HandleTypeDef *hfdcan) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c || !c->h)
+    return 0;
+  (void)fdcan_mock_sync();
+  return c->count;
+}
+
+// The element the FIFO sends next, decoded.
+static const uint32_t *tx_head(const mock_ctl_t *c, fdcan_mock_frame_t *f) {
+  const uint32_t *e =
+      (const uint32_t *)(c->mram + MRAM_TX_OFF + c->get * TX_ELEM_WORDS * 4u);
+  f->xtd = (e[0] >> 30) & 1u;
+  f->id = f->xtd ? e[0] & 0x1FFFFFFFu : (e[0] >> 18) & 0x7FFu;
+  f->fdf = (e[1] >> 21) & 1u;
+  f->brs = f->fdf && ((e[1] >> 20) & 1u);
+  const uint32_t dlc = (e[1] >> 16) & 0xFu;
+  f->len = f->fdf ? k_dlc_len[dlc] : (uint8_t)(dlc > 8u ? 8u : dlc);
+  memcpy(f->data, &e[2], f->len);
+  return e;
+}
+
+int fdcan_mock_tx_head(FDCAN_HandleTypeDef *hfdcan, fdcan_mock_frame_t *f) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c || !c->h || hfdcan->State != HAL_FDCAN_STATE_BUSY)
+    return 0;
+  (void)fdcan_mock_sync();
+  if (!c->count)
+    return 0;
+  (void)tx_head(c, f);
+  return 1;
+}
+
+unsigned fdcan_mock_transmit(FDCAN_HandleTypeDef *hfdcan, unsigned max) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c || !c->h || hfdcan->State != HAL_FDCAN_STATE_BUSY)
+    return 0;
+  (void)fdcan_mock_sync();
+  FDCAN_GlobalTypeDef *r = hfdcan->Instance;
+  unsigned n = 0;
+  while (n < max && c->count) {
+    const uint32_t bit = 1u << c->get;
+    fdcan_mock_frame_t f;
+    const uint32_t *e = tx_head(c, &f);
+    const uint32_t dlc = (e[1] >> 16) & 0xFu;
+
+    // Timestamp at start of frame, then the frame's time on the bus.
+    const uint32_t ts = r->TSCV_[0] & FDCAN_TSCV_TSC;
+    host_clock_advance(fdcan_mock_frame_ns(hfdcan, &f));
+    if (c->wire)
+      c->wire(hfdcan, &f, c->wire_user);
+
+    if (e[1] & (1u << 23)) { // EFC
+      if (c->ev_count == TX_EVENTS) {
+        c->ev_lost++;
+      } else {
+        FDCAN_TxEventFifoTypeDef *ev =
+            &c->ev[(c->ev_get + c->ev_count) % TX_EVENTS];
+        ev->Identifier = f.id;
+        ev->IdType = f.xtd ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
+        ev->TxFrameType = FDCAN_DATA_FRAME;
+        ev->DataLength = dlc;
+        ev->ErrorStateIndicator = FDCAN_ESI_ACTIVE;
+        ev->BitRateSwitch = f.brs ? FDCAN_BRS_ON : FDCAN_BRS_OFF;
+        ev->FDFormat = f.fdf ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
+        ev->TxTimestamp = ts;
+        ev->MessageMarker = e[1] >> 24;
+        ev->EventType = FDCAN_TX_EVENT;
+        c->ev_count++;
+        r->TXEFS = c->ev_count;
+        r->IR |= FDCAN_IR_TEFN;
+      }
+    }
+
+    r->TXBRP_[0] &= ~bit;
+    r->TXBTO |= bit;
+    r->IR |= FDCAN_IR_TC;
+    c->get = (c->get + 1u) % TX_DEPTH;
+    c->count--;
+    update_txfqs(c);
+    n++;
+  }
+  return n;
+}
+
+// =========================
+// HAL
+// =========================
+
+HAL_StatusTypeDef HAL_FDCAN_Init(FDCAN_HandleTypeDef *hfdcan) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c)
+    return HAL_ERROR;
+  if (!c->mram)
+    c->mram = mram_alloc();
+  memset(c->mram, 0, MRAM_BYTES);
+  const uint32_t base = (uint32_t)(uintptr_t)c->mram;
+  hfdcan->msgRam.StandardFilterSA = base;
+  hfdcan->msgRam.ExtendedFilterSA = base + 0x070u;
+  hfdcan->msgRam.RxFIFO0SA = base + 0x0B0u;
+  hfdcan->msgRam.RxFIFO1SA = base + 0x188u;
+  hfdcan->msgRam.TxEventFIFOSA = base + 0x260u;
+  hfdcan->msgRam.TxFIFOQSA = base + MRAM_TX_OFF;
+  hfdcan->LatestTxFifoQRequest = 0;
+  hfdcan->ErrorCode = HAL_FDCAN_ERROR_NONE;
+  hfdcan->State = HAL_FDCAN_STATE_READY;
+
+  FDCAN_GlobalTypeDef *r = hfdcan->Instance;
+  memset((void *)r, 0, sizeof(*r));
+  r->CCCR = FDCAN_CCCR_INIT;
+  c->h = hfdcan;
+  c->put = c->get = c->count = 0;
+  c->ev_get = c->ev_count = 0;
+  c->ts_wraps = ts_ticks(c) >> 16;
+  update_txfqs(c);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_Start(FDCAN_HandleTypeDef *hfdcan) {
+  if (!ctl_of(hfdcan) || hfdcan->State != HAL_FDCAN_STATE_READY)
+    return HAL_ERROR;
+  hfdcan->Instance->CCCR &= ~FDCAN_CCCR_INIT;
+  hfdcan->State = HAL_FDCAN_STATE_BUSY;
+  return HAL_OK;
+}
+
+// Entering init mode cancels what is still pending.
+HAL_StatusTypeDef HAL_FDCAN_Stop(FDCAN_HandleTypeDef *hfdcan) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c || hfdcan->State != HAL_FDCAN_STATE_BUSY)
+    return HAL_ERROR;
+  (void)fdcan_mock_sync();
+  FDCAN_GlobalTypeDef *r = hfdcan->Instance;
+  r->TXBCF |= r->TXBRP_[0];
+  r->TXBRP_[0] = 0;
+  c->get = c->put;
+  c->count = 0;
+  update_txfqs(c);
+  r->CCCR |= FDCAN_CCCR_INIT;
+  hfdcan->LatestTxFifoQRequest = 0;
+  hfdcan->State = HAL_FDCAN_STATE_READY;
+  return HAL_OK;
+}
+
+uint32_t HAL_FDCAN_GetTxFifoFreeLevel(const FDCAN_HandleTypeDef *hfdcan) {
+  (void)fdcan_mock_sync();
+  return hfdcan->Instance->TXFQS_[0] & FDCAN_TXFQS_TFFL;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetTxEvent(FDCAN_HandleTypeDef *hfdcan,
+                                       FDCAN_TxEventFifoTypeDef *pTxEvent) {
+  mock_ctl_t *c = ctl_of(hfdcan);
+  if (!c || !c->ev_count)
+    return HAL_ERROR;
+  *pTxEvent = c->ev[c->ev_get];
+  c->ev_get = (c->ev_get + 1u) % TX_EVENTS;
+  c->ev_count--;
+  hfdcan->Instance->TXEFS = c->ev_count;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ActivateNotification(FDCAN_HandleTypeDef *hfdcan,
+                                                 uint32_t ActiveITs,
+                                                 uint32_t BufferIndexes) {
+  FDCAN_GlobalTypeDef *r = hfdcan->Instance;
+  r->IE |= ActiveITs;
+  if (ActiveITs & FDCAN_IT_TX_COMPLETE)
+    r->TXBTIE |= BufferIndexes;
+  if (ActiveITs & FDCAN_IT_TX_ABORT_COMPLETE)
+    r->TXBCIE |= BufferIndexes;
+  r->ILE |= FDCAN_INTERRUPT_LINE0 | FDCAN_INTERRUPT_LINE1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigInterruptLines(FDCAN_HandleTypeDef *hfdcan,
+                                                 uint32_t ITList,
+                                                 uint32_t InterruptLine) {
+  if (InterruptLine == FDCAN_INTERRUPT_LINE0)
+    hfdcan->Instance->ILS &= ~ITList;
+  else
+    hfdcan->Instance->ILS |= ITList;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigTimestampCounter(FDCAN_HandleTypeDef *hfdcan,
+                                                   uint32_t TimestampPrescaler) {
+  hfdcan->Instance->TSCC =
+      (hfdcan->Instance->TSCC & ~FDCAN_TSCC_TCP) | TimestampPrescaler;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_EnableTimestampCounter(FDCAN_HandleTypeDef *hfdcan,
+                                                   uint32_t TimestampOperation) {
+  hfdcan->Instance->TSCC =
+      (hfdcan->Instance->TSCC & ~FDCAN_TSCC_TSS) | TimestampOperation;
+  return HAL_OK;
+}
+
+// TX events, transmission complete, then the timestamp wrap, as the HAL
+// orders them; flags are cleared before each callback.
+void HAL_FDCAN_IRQHandler(FDCAN_HandleTypeDef *hfdcan) {
+  FDCAN_GlobalTypeDef *r = hfdcan->Instance;
+  (void)fdcan_mock_sync();
+  const uint32_t tef = r->IR & r->IE & (FDCAN_IR_TEFN | FDCAN_IR_TEFF);
+  if (tef) {
+    r->IR &= ~tef;
+    HAL_FDCAN_TxEventFifoCallback(hfdcan, tef);
+  }
+  if ((r->IR & FDCAN_IR_TC) && (r->IE & FDCAN_IT_TX_COMPLETE)) {
+    const uint32_t done = r->TXBTO & r->TXBTIE;
+    r->IR &= ~FDCAN_IR_TC;
+    HAL_FDCAN_TxBufferCompleteCallback(hfdcan, done);
+  }
+  if ((r->IR & FDCAN_IR_TSW) && (r->IE & FDCAN_IT_TIMESTAMP_WRAPAROUND)) {
+    r->IR &= ~FDCAN_IR_TSW;
+    HAL_FDCAN_TimestampWraparoundCallback(hfdcan);
+  }
+}
+
+// Filters, RX FIFO modes, the timeout counter and transmitter delay
+// compensation have no effect on the model.
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigFilter(FDCAN_HandleTypeDef *hfdcan,
+                                         const FDCAN_FilterTypeDef *sFilterConfig) {
+  (void)hfdcan;
+  (void)sFilterConfig;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigGlobalFilter(FDCAN_HandleTypeDef *hfdcan,
+                                               uint32_t NonMatchingStd,
+                                               uint32_t NonMatchingExt,
+                                               uint32_t RejectRemoteStd,
+                                               uint32_t RejectRemoteExt) {
+  (void)hfdcan;
+  (void)NonMatchingStd;
+  (void)NonMatchingExt;
+  (void)RejectRemoteStd;
+  (void)RejectRemoteExt;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigRxFifoOverwrite(FDCAN_HandleTypeDef *hfdcan,
+                                                  uint32_t RxFifo,
+                                                  uint32_t OperationMode) {
+  (void)hfdcan;
+  (void)RxFifo;
+  (void)OperationMode;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigTimeoutCounter(FDCAN_HandleTypeDef *hfdcan,
+                                                 uint32_t TimeoutOperation,
+                                                 uint32_t TimeoutPeriod) {
+  (void)hfdcan;
+  (void)TimeoutOperation;
+  (void)TimeoutPeriod;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_EnableTimeoutCounter(FDCAN_HandleTypeDef *hfdcan) {
+  (void)hfdcan;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan,
+                                                      uint32_t TdcOffset,
+                                                      uint32_t TdcFilter) {
+  (void)hfdcan;
+  (void)TdcOffset;
+  (void)TdcFilter;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_EnableTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan) {
+  (void)hfdcan;
+  return HAL_OK;
+}
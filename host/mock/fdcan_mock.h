@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * FDCAN model for the host build (fdcan_mock.c).
+ *
+ * Each controller gets the G4's fixed message RAM layout below 4 GB (the
+ * HAL keeps its start addresses in 32-bit fields) and a 3-element TX FIFO
+ * driven through TXBAR/TXFQS/TXBRP as on the device. Nothing leaves the TX
+ * FIFO until the bench calls fdcan_mock_transmit() (or lets the driver's
+ * own polling move the bus, fdcan_mock_set_poll()), which sends the pending
+ * elements in order: each is decoded and handed to the wire callback, time
+ * advances by its bus time, and TX complete / TX event interrupts are
+ * raised for the next can_bus_irq(). RX FIFOs are not modelled; received
+ * frames go in with can_bus_inject_rx().
+ */
+
+#include <stdint.h>
+#include "stm32g4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint32_t id; /* 11- or 29-bit */
+  uint8_t xtd;
+  uint8_t fdf;
+  uint8_t brs;
+  uint8_t len;
+  uint8_t data[64];
+} fdcan_mock_frame_t;
+
+typedef void (*fdcan_mock_wire_cb_t)(FDCAN_HandleTypeDef *hfdcan,
+                                     const fdcan_mock_frame_t *f, void *user);
+
+/* Where frames sent on `hfdcan` go; NULL drops them. */
+void fdcan_mock_set_wire(FDCAN_HandleTypeDef *hfdcan, fdcan_mock_wire_cb_t cb,
+                         void *user);
+
+/* Send up to `max` pending TX FIFO elements; returns how many went. */
+unsigned fdcan_mock_transmit(FDCAN_HandleTypeDef *hfdcan, unsigned max);
+
+/*
+ * What the bus does while the driver spins on TXBRP (the default is
+ * nothing: time only moves in fdcan_mock_transmit()). SENDS transmits the
+ * head element on each read, as an idle bus would while the CPU waits;
+ * STALLS lets 10 us pass per read and sends nothing, as with no ACK.
+ */
+typedef enum {
+  FDCAN_MOCK_POLL_FROZEN = 0,
+  FDCAN_MOCK_POLL_SENDS,
+  FDCAN_MOCK_POLL_STALLS,
+} fdcan_mock_poll_t;
+
+void fdcan_mock_set_poll(FDCAN_HandleTypeDef *hfdcan, fdcan_mock_poll_t mode);
+
+/* The frame the TX FIFO sends next, without sending it; 0 if empty. A
+ * bus model arbitrates between controllers on these. */
+int fdcan_mock_tx_head(FDCAN_HandleTypeDef *hfdcan, fdcan_mock_frame_t *f);
+
+/* Elements waiting in the TX FIFO. */
+unsigned fdcan_mock_tx_pending(FDCAN_HandleTypeDef *hfdcan);
+
+/* Bus time of a frame at the handle's bit timing, without stuff bits. */
+uint32_t fdcan_mock_frame_ns(const FDCAN_HandleTypeDef *hfdcan,
+                             const fdcan_mock_frame_t *f);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,127 @@
+// host_board.c
+//
+// What the firmware gets from the board, the core and the kernel when
+// can_bus.c runs on the host: the simulated clock behind HAL_GetTick(),
+// us_clock and the boot-time marks, NVIC pending bits, the core debug
+// blocks as plain variables and the ThreadX calls table_swap.c makes.
+
+#include "host_board.h"
+#include "boot_time.h"
+#include "stm32g4xx_hal.h"
+#include "tx_api.h"
+#include "us_clock.h"
+
+uint32_t host_primask;
+uint32_t SystemCoreClock = 170000000u;
+DWT_Type host_dwt;
+ITM_Type host_itm;
+CoreDebug_Type host_core_debug;
+SCB_Type host_scb;
+
+// Boot phases are all past: boot_time_mark() stays on its fast path.
+volatile uint32_t g_boot_reached = 0xFFFFFFFFu;
+void boot_time_mark_slow(boot_phase_t ph) { (void)ph; }
+
+TX_THREAD *_tx_thread_created_ptr = TX_NULL;
+TX_THREAD *tx_thread_identify(void) { return TX_NULL; }
+UINT tx_thread_sleep(ULONG ticks) {
+  host_clock_advance((uint64_t)ticks * 1000000000u / TX_TIMER_TICKS_PER_SECOND);
+  return 0;
+}
+
+// =========================
+// Clock
+// =========================
+
+static uint64_t now_ns;
+static uint64_t alarm_us;
+static us_clock_alarm_cb_t alarm_cb;
+
+uint64_t host_clock_ns(void) { return now_ns; }
+
+void host_clock_advance(uint64_t ns) {
+  now_ns += ns;
+  if (alarm_cb && now_ns / 1000u >= alarm_us) {
+    const us_clock_alarm_cb_t cb = alarm_cb;
+    alarm_cb = NULL;
+    cb();
+  }
+}
+
+uint32_t HAL_GetTick(void) { return (uint32_t)(now_ns / 1000000u); }
+void HAL_Delay(uint32_t ms) { host_clock_advance((uint64_t)ms * 1000000u); }
+
+HAL_StatusTypeDef us_clock_init(void) { return HAL_OK; }
+uint64_t us_clock_now(void) { return now_ns / 1000u; }
+
+void us_clock_set_alarm(uint64_t at_us, us_clock_alarm_cb_t cb) {
+  alarm_us = at_us;
+  alarm_cb = cb;
+  if (cb && now_ns / 1000u >= at_us)
+    host_clock_advance(0);
+}
+
+uint8_t us_clock_alarm_pending(void) { return alarm_cb != NULL; }
+
+// =========================
+// NVIC
+// =========================
+
+#define HOST_IRQS 128u
+
+static uint32_t nvic_pending[HOST_IRQS / 32u];
+static uint8_t nvic_prio[HOST_IRQS];
+
+void NVIC_SetPendingIRQ(IRQn_Type irqn) {
+  if ((unsigned)irqn < HOST_IRQS)
+    nvic_pending[irqn / 32] |= 1u << (irqn % 32);
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irqn) {
+  if ((unsigned)irqn < HOST_IRQS)
+    nvic_pending[irqn / 32] &= ~(1u << (irqn % 32));
+}
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irqn) {
+  if ((unsigned)irqn >= HOST_IRQS)
+    return 0;
+  return (nvic_pending[irqn / 32] >> (irqn % 32)) & 1u;
+}
+
+int host_nvic_take(IRQn_Type irqn) {
+  const uint32_t p = NVIC_GetPendingIRQ(irqn);
+  NVIC_ClearPendingIRQ(irqn);
+  return (int)p;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irqn) { (void)irqn; }
+void NVIC_DisableIRQ(IRQn_Type irqn) { (void)irqn; }
+
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority) {
+  if ((unsigned)irqn < HOST_IRQS)
+    nvic_prio[irqn] = (uint8_t)priority;
+}
+
+uint32_t NVIC_GetPriority(IRQn_Type irqn) {
+  return (unsigned)irqn < HOST_IRQS ? nvic_prio[irqn] : 0u;
+}
+
+uint32_t NVIC_EncodePriority(uint32_t group, uint32_t pre, uint32_t sub) {
+  (void)group;
+  (void)sub;
+  return pre;
+}
+
+uint32_t NVIC_GetPriorityGrouping(void) { return 3u; }
+
+void HAL_NVIC_SetPriority(IRQn_Type irqn, uint32_t pre, uint32_t sub) {
+  (void)sub;
+  NVIC_SetPriority(irqn, pre);
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type irqn) { NVIC_EnableIRQ(irqn); }
+void HAL_NVIC_DisableIRQ(IRQn_Type irqn) { NVIC_DisableIRQ(irqn); }
+
+uint32_t HAL_RCCEx_GetPeriphCLKFreq(uint32_t clk) {
+  return clk == RCC_PERIPHCLK_FDCAN ? 170000000u : 0u;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Simulated time and interrupt state for the host build.
+ *
+ * Time only moves when the model says so: fdcan_mock_transmit() advances it
+ * by each frame's bus time, HAL_Delay() and host_clock_advance() by what
+ * they are given. HAL_GetTick(), us_clock_now() and the FDCAN timestamp
+ * counter all read it, so timeouts in the driver follow bus time, not the
+ * speed of the machine running the bench.
+ */
+
+#include <stdint.h>
+#include "stm32g4xx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t host_clock_ns(void);
+
+/* Move simulated time forward; fires a us_clock alarm that falls due. */
+void host_clock_advance(uint64_t ns);
+
+/* Non-zero (and cleared) if `irqn` was pended with NVIC_SetPendingIRQ(). */
+int host_nvic_take(IRQn_Type irqn);
+
+#ifdef __cplusplus
+}
+#endif
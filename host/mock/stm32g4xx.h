@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+ * Host stand-in for stm32g4xx.h. The real stm32g491xx.h supplies the IRQ
+ * numbers and register bit definitions; the FDCAN register block is
+ * replaced by the model in fdcan_mock.c.
+ *
+ * The driver writes TXBAR and then reads TXFQS for the next free element,
+ * as the hardware updates it at once. Plain memory can't do that, so the
+ * registers whose value depends on what happened since (TXFQS, TXBRP,
+ * TSCV) are read through fdcan_mock_sync(), which first applies pending
+ * add requests and advances the timestamp counter. Every other register
+ * is plain memory that the model reads and writes.
+ */
+
+#define FDCAN_GlobalTypeDef fdcan_hw_regs_t
+#include "stm32g491xx.h"
+#undef FDCAN_GlobalTypeDef
+#undef FDCAN1
+#undef FDCAN2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { RESET = 0, SET = !RESET } FlagStatus, ITStatus;
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+typedef enum { SUCCESS = 0, ERROR = !SUCCESS } ErrorStatus;
+#define IS_FUNCTIONAL_STATE(STATE) (((STATE) == DISABLE) || ((STATE) == ENABLE))
+
+#define SET_BIT(REG, BIT) ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT) ((REG) & (BIT))
+#define CLEAR_REG(REG) ((REG) = (0x0))
+#define WRITE_REG(REG, VAL) ((REG) = (VAL))
+#define READ_REG(REG) ((REG))
+#define MODIFY_REG(REG, CLEARMASK, SETMASK)                                    \
+  WRITE_REG((REG), (((READ_REG(REG)) & (~(CLEARMASK))) | (SETMASK)))
+#define POSITION_VAL(VAL) (__CLZ(__RBIT(VAL)))
+
+/* Same layout as the device's; the synced registers are 1-element arrays
+ * so the macros below can index them with the sync call. */
+typedef struct {
+  __IO uint32_t CREL;
+  __IO uint32_t ENDN;
+  uint32_t RESERVED1;
+  __IO uint32_t DBTP;
+  __IO uint32_t TEST;
+  __IO uint32_t RWD;
+  __IO uint32_t CCCR;
+  __IO uint32_t NBTP;
+  __IO uint32_t TSCC;
+  __IO uint32_t TSCV_[1];
+  __IO uint32_t TOCC;
+  __IO uint32_t TOCV;
+  uint32_t RESERVED2[4];
+  __IO uint32_t ECR;
+  __IO uint32_t PSR;
+  __IO uint32_t TDCR;
+  uint32_t RESERVED3;
+  __IO uint32_t IR;
+  __IO uint32_t IE;
+  __IO uint32_t ILS;
+  __IO uint32_t ILE;
+  uint32_t RESERVED4[8];
+  __IO uint32_t RXGFC;
+  __IO uint32_t XIDAM;
+  __IO uint32_t HPMS;
+  uint32_t RESERVED5;
+  __IO uint32_t RXF0S;
+  __IO uint32_t RXF0A;
+  __IO uint32_t RXF1S;
+  __IO uint32_t RXF1A;
+  uint32_t RESERVED6[8];
+  __IO uint32_t TXBC;
+  __IO uint32_t TXFQS_[1];
+  __IO uint32_t TXBRP_[1];
+  __IO uint32_t TXBAR;
+  __IO uint32_t TXBCR;
+  __IO uint32_t TXBTO;
+  __IO uint32_t TXBCF;
+  __IO uint32_t TXBTIE;
+  __IO uint32_t TXBCIE;
+  __IO uint32_t TXEFS;
+  __IO uint32_t TXEFA;
+} FDCAN_GlobalTypeDef;
+
+_Static_assert(__builtin_offsetof(FDCAN_GlobalTypeDef, TXEFA) == 0xE8u,
+               "FDCAN register layout");
+
+/* The G491's two, or more for a simulated bus of many boards; those past
+ * FDCAN2 are only reachable as &fdcan_mock_regs[i]. */
+#ifndef FDCAN_MOCK_INSTANCES
+#define FDCAN_MOCK_INSTANCES 2
+#endif
+
+extern FDCAN_GlobalTypeDef fdcan_mock_regs[FDCAN_MOCK_INSTANCES];
+#define FDCAN1 (&fdcan_mock_regs[0])
+#define FDCAN2 (&fdcan_mock_regs[1])
+
+unsigned fdcan_mock_sync(void);
+#define TXFQS TXFQS_[fdcan_mock_sync()]
+#define TXBRP TXBRP_[fdcan_mock_sync()]
+#define TSCV TSCV_[fdcan_mock_sync()]
+
+#ifdef __cplusplus
+}
+#endif
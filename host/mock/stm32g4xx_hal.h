@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Host stand-in for stm32g4xx_hal.h: the real HAL types and FDCAN
+ * definitions, with the HAL calls the driver makes implemented by
+ * fdcan_mock.c. Configured like Core/Inc/stm32g4xx_hal_conf.h.
+ */
+
+#define USE_HAL_FDCAN_REGISTER_CALLBACKS 0U
+#define HAL_FDCAN_MODULE_ENABLED
+
+#include "stm32g4xx_hal_def.h"
+#include "stm32g4xx_hal_fdcan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RCC_PERIPHCLK_FDCAN 0x00001000U
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+void HAL_NVIC_SetPriority(IRQn_Type irqn, uint32_t pre, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irqn);
+void HAL_NVIC_DisableIRQ(IRQn_Type irqn);
+uint32_t HAL_RCCEx_GetPeriphCLKFreq(uint32_t clk);
+
+#ifdef __cplusplus
+}
+#endif
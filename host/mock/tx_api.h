@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * Host stand-in for ThreadX tx_api.h, enough for table_swap.c: no threads
+ * are created, so tx_thread_identify() is NULL and the created list empty,
+ * which table_swap takes as "kernel not started" (no grace period).
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned long ULONG;
+typedef unsigned int UINT;
+
+#define TX_NULL ((void *)0)
+#define TX_READY 0u
+
+#ifndef TX_TIMER_TICKS_PER_SECOND
+#define TX_TIMER_TICKS_PER_SECOND 1000u
+#endif
+
+typedef struct TX_THREAD_STRUCT {
+  UINT tx_thread_state;
+  struct TX_THREAD_STRUCT *tx_thread_created_next;
+} TX_THREAD;
+
+TX_THREAD *tx_thread_identify(void);
+UINT tx_thread_sleep(ULONG ticks);
+
+#ifdef __cplusplus
+}
+#endif
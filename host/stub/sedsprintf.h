@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+ * The declarations of the sedsprintf_rs C API that telemetry.c and
+ * telemetry_hooks.c use, for the host compile check (telemetry_check in
+ * CMakeLists.txt). Only the shapes matter: nothing links against these, and
+ * the enum values are placeholders for the ones the router generates.
+ * Keep it in step with what those files call; a new router call fails the
+ * check until it is added here.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SedsRouter SedsRouter;
+typedef int32_t SedsResult;
+
+enum { SEDS_OK = 0, SEDS_ERR = -1, SEDS_BAD_ARG = -2, SEDS_IO = -3 };
+
+typedef enum {
+  SEDS_DT_MESSAGE_DATA,
+  SEDS_DT_GENERIC_ERROR,
+  SEDS_DT_TIME_SYNC_REQUEST,
+  SEDS_DT_TIME_SYNC_RESPONSE,
+  SEDS_DT_TIME_SYNC_ANNOUNCE,
+  SEDS_DT_IMU,
+  SEDS_DT_GYRO_DATA,
+  SEDS_DT_ACCEL_DATA,
+} SedsDataType;
+
+typedef enum { SEDS_EP_SD_CARD, SEDS_EP_TIME_SYNC } SedsEndpoint;
+typedef enum { SEDS_EK_UNSIGNED, SEDS_EK_SIGNED, SEDS_EK_FLOAT } SedsElemKind;
+typedef enum { Seds_RM_Relay, Seds_RM_Sink } SedsRouterMode;
+
+typedef struct {
+  SedsDataType ty;
+  const uint8_t *payload;
+  size_t payload_len;
+  uint64_t timestamp;
+  const char *sender;
+  size_t sender_len;
+} SedsPacketView;
+
+typedef SedsResult (*SedsPacketHandler)(const SedsPacketView *pkt,
+                                        void *user);
+typedef SedsResult (*SedsSerHandler)(const uint8_t *bytes, size_t len,
+                                     void *user);
+typedef uint64_t (*SedsNowFn)(void *user);
+
+typedef struct {
+  uint32_t endpoint;
+  SedsPacketHandler packet_handler;
+  SedsSerHandler serialized_handler;
+  void *user;
+} SedsLocalEndpointDesc;
+
+SedsRouter *seds_router_new(int mode, SedsNowFn now, void *user,
+                            const SedsLocalEndpointDesc *handlers,
+                            size_t n_handlers);
+int32_t seds_router_add_side_serialized(SedsRouter *r, const char *name,
+                                        size_t name_len, SedsSerHandler tx,
+                                        void *user, bool reliable);
+
+SedsResult seds_router_log_ts(SedsRouter *r, SedsDataType ty, uint64_t ts,
+                              const void *data, size_t len);
+SedsResult seds_router_log_typed_ex(SedsRouter *r, SedsDataType ty,
+                                    const void *data, size_t count,
+                                    size_t elem_size, SedsElemKind kind,
+                                    const uint64_t *ts, int queue);
+SedsResult seds_router_log_string_ex(SedsRouter *r, SedsDataType ty,
+                                     const char *s, size_t len,
+                                     const uint64_t *ts, int queue);
+
+SedsResult seds_router_rx_serialized_packet_to_queue(SedsRouter *r,
+                                                     const uint8_t *bytes,
+                                                     size_t len);
+SedsResult seds_router_rx_serialized_packet_to_queue_from_side(
+    SedsRouter *r, int32_t side, const uint8_t *bytes, size_t len);
+SedsResult seds_router_receive_serialized(SedsRouter *r, const uint8_t *bytes,
+                                          size_t len);
+SedsResult seds_router_receive_serialized_from_side(SedsRouter *r,
+                                                    int32_t side,
+                                                    const uint8_t *bytes,
+                                                    size_t len);
+
+SedsResult seds_router_process_tx_queue(SedsRouter *r);
+SedsResult seds_router_process_rx_queue(SedsRouter *r);
+SedsResult seds_router_process_tx_queue_with_timeout(SedsRouter *r,
+                                                     uint32_t ms);
+SedsResult seds_router_process_rx_queue_with_timeout(SedsRouter *r,
+                                                     uint32_t ms);
+SedsResult seds_router_process_all_queues_with_timeout(SedsRouter *r,
+                                                       uint32_t ms);
+
+int32_t seds_error_to_string_len(int32_t err);
+SedsResult seds_error_to_string(int32_t err, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
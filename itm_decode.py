@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""
+Decode the ITM event trace (itm_trace.h) from a raw SWO capture.
+
+Each event is a word on stimulus port P (event << 24 | arg) followed by the
+DWT cycle counter on port P + 1. Other ports, sync, overflow and protocol
+packets are skipped; a port-P word without its cycle word is dropped.
+
+Usage
+  ./itm_decode.py swo.bin [--port 1] [--hz 170000000] [--elf firmware.elf]
+    --elf names thread addresses after their TX_THREAD symbols
+"""
+from __future__ import annotations
+
+import argparse
+import struct
+import sys
+from pathlib import Path
+
+EVENTS = {
+    1: "thread_in", 2: "thread_out", 3: "can_isr_in", 4: "can_isr_out",
+    5: "reasm_done", 6: "router_in", 7: "router_out", 8: "tx_send",
+}
+ROUTER = {0: "rx", 1: "tx", 2: "all"}
+
+
+def stimulus_words(data: bytes):
+    """Yield (port, value) for each software source packet."""
+    i = 0
+    while i < len(data):
+        h = data[i]
+        i += 1
+        if h == 0x00 or h == 0x80 or h == 0x70:
+            continue  # sync, overflow
+        size = h & 0x03
+        if size:
+            n = 4 if size == 3 else size
+            if i + n > len(data):
+                return
+            if not h & 0x04:  # software source
+                yield h >> 3, int.from_bytes(data[i:i + n], "little")
+            i += n
+            continue
+        if h & 0x80:  # timestamp or extension with continuation bytes
+            while i < len(data) and data[i] & 0x80:
+                i += 1
+            i += 1
+
+
+def thread_symbols(elf: Path) -> dict[int, str]:
+    data = elf.read_bytes()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        raise SystemExit(f"{elf}: not a little-endian ELF32 file")
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, _ = struct.unpack_from("<HHH", data, 0x2E)
+    sections = [struct.unpack_from("<IIIIIIIIII", data, shoff + k * shentsize)
+                for k in range(shnum)]
+    names: dict[int, str] = {}
+    for sh in sections:
+        if sh[1] != 2:  # SHT_SYMTAB
+            continue
+        strtab = sections[sh[6]]
+        for off in range(sh[4], sh[4] + sh[5], 16):
+            name, value, size, info, _, _ = struct.unpack_from(
+                "<IIIBBH", data, off)
+            if info & 0x0F != 1 or not size:  # STT_OBJECT
+                continue
+            start = strtab[4] + name
+            sym = data[start:data.index(b"\0", start)].decode()
+            if "thread" in sym:
+                names[value & 0xFFFFFF] = sym
+    return names
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("capture", type=Path)
+    ap.add_argument("--port", type=int, default=1)
+    ap.add_argument("--hz", type=float, default=170e6, help="core clock")
+    ap.add_argument("--elf", type=Path)
+    args = ap.parse_args(argv[1:])
+    threads = thread_symbols(args.elf) if args.elf else {}
+
+    pending = None
+    base = last = None
+    wraps = 0
+    for port, value in stimulus_words(args.capture.read_bytes()):
+        if port == args.port:
+            pending = value
+            continue
+        if port != args.port + 1 or pending is None:
+            continue
+        if last is not None and value < last:
+            wraps += 1
+        last = value
+        cycles = value + (wraps << 32)
+        if base is None:
+            base = cycles
+        ev, arg = pending >> 24, pending & 0xFFFFFF
+        pending = None
+        name = EVENTS.get(ev, f"ev{ev}")
+        if ev in (1, 2):
+            detail = threads.get(arg, f"0x{arg:06x}")
+        elif ev in (6, 7):
+            detail = ROUTER.get(arg, str(arg))
+        elif ev == 5:
+            detail = f"id=0x{arg & 0x7FF:03x} len={arg >> 11}"
+        else:
+            detail = str(arg)
+        us = (cycles - base) * 1e6 / args.hz
+        print(f"{us:14.3f} us  {name:<12} {detail}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
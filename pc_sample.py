@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""
+Sample the gateway's program counter over USB and print a flat profile.
+
+Needs a build with ENABLE_PC_SAMPLE. Sends TELEMETRY_USB_CTRL_PC_SAMPLE_START
+on the CDC port, collects the TELEMETRY_PC_SAMPLE_MAGIC frames for a while,
+stops the sampler and prints one line per function: samples, share of all
+samples, and how many of them hit while an interrupt handler ran. Time
+spent with interrupts masked lands on the code that unmasks them.
+
+Usage
+  ./pc_sample.py /dev/ttyACM0 --elf build/Debug/gateway_board.elf
+  ./pc_sample.py /dev/ttyACM0 --map build/Debug/gateway_board.map -s 30
+  ./pc_sample.py --no-request usb_capture.bin --elf ...
+    (frames from a raw CDC byte stream recorded earlier)
+  --hz sets the sample rate (default: the firmware's, 5 kHz)
+  --callers adds the calling function (from the stacked LR) per line
+"""
+from __future__ import annotations
+
+import argparse
+import bisect
+import re
+import struct
+import sys
+import time
+from collections import Counter
+from pathlib import Path
+
+from cdc_link import ctrl_reply, frames, open_port, send_ctrl
+from heap_trace import func_symbols
+
+PCS_MAGIC = bytes([0xC5]) + b"PCS"
+OP_PC_SAMPLE_START = 0x1F
+OP_PC_SAMPLE_STOP = 0x20
+STATUS = {0: "ok", 1: "PC sampling not built in", 2: "rate not supported"}
+
+HEADER = struct.Struct("<4sIII")
+RECORD = struct.Struct("<II")  # pc_sample_t
+IN_HANDLER = 0x1
+
+
+def map_symbols(path: Path) -> tuple[list[int], list[tuple[int, str]]]:
+    """Functions from a GNU ld map of a -ffunction-sections build."""
+    funcs: list[tuple[int, int, str]] = []
+    text = path.read_text(errors="replace")
+    # " .text.name  0xaddr  0xsize  file.o", the name alone on its line
+    # when it is long.
+    for m in re.finditer(r"^ \.text\.(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)",
+                         text, re.M):
+        addr, size = int(m[2], 16), int(m[3], 16)
+        if addr and size:
+            funcs.append((addr, size, m[1]))
+    funcs.sort()
+    return [f[0] for f in funcs], [(f[1], f[2]) for f in funcs]
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", type=Path)
+    ap.add_argument("--elf", type=Path)
+    ap.add_argument("--map", type=Path)
+    ap.add_argument("-s", "--seconds", type=float, default=10.0)
+    ap.add_argument("--hz", type=int, default=0)
+    ap.add_argument("--callers", action="store_true")
+    ap.add_argument("--top", type=int, default=40)
+    ap.add_argument("--no-request", action="store_true",
+                    help="read frames only, don't start the sampler")
+    args = ap.parse_args(argv[1:])
+
+    if args.elf:
+        starts, funcs = func_symbols(args.elf)
+    elif args.map:
+        starts, funcs = map_symbols(args.map)
+    else:
+        starts, funcs = [], []
+
+    def func(addr: int) -> str:
+        i = bisect.bisect_right(starts, addr) - 1
+        if i >= 0 and addr < starts[i] + funcs[i][0]:
+            return funcs[i][1]
+        return f"0x{addr:08x}"
+
+    fd = open_port(args.port, read_only=args.no_request)
+    if not args.no_request:
+        send_ctrl(fd, OP_PC_SAMPLE_START, struct.pack("<I", args.hz))
+
+    hits: Counter[str] = Counter()
+    in_handler: Counter[str] = Counter()
+    callers: Counter[tuple[str, str]] = Counter()
+    total = dropped = hz = 0
+    next_seq: int | None = None
+    lost = 0  # gaps in seq the host never saw: USB frames dropped
+    deadline = time.monotonic() + args.seconds
+    try:
+        for f in frames(fd):
+            if (st := ctrl_reply(f, OP_PC_SAMPLE_START)) is not None:
+                if st:
+                    print(f"refused: {STATUS.get(st, st)}", file=sys.stderr)
+                    return 1
+                continue
+            if f[:4] != PCS_MAGIC or len(f) < HEADER.size:
+                continue
+            _, seq, dropped, hz = HEADER.unpack_from(f)
+            if next_seq is not None and seq > next_seq:
+                lost += seq - next_seq
+            for off in range(HEADER.size, len(f) - RECORD.size + 1,
+                             RECORD.size):
+                pc, lr = RECORD.unpack_from(f, off)
+                name = func(pc & ~IN_HANDLER)
+                hits[name] += 1
+                if pc & IN_HANDLER:
+                    in_handler[name] += 1
+                if args.callers:
+                    callers[(name, func(lr & ~1))] += 1
+                total += 1
+            next_seq = seq + (len(f) - HEADER.size) // RECORD.size
+            if not args.no_request and time.monotonic() >= deadline:
+                break
+    finally:
+        if not args.no_request:
+            send_ctrl(fd, OP_PC_SAMPLE_STOP)
+
+    if not total:
+        print("no samples received")
+        return 1
+    print(f"{total} samples at {hz} Hz ({total / (hz or 1):.1f} s), "
+          f"{dropped} dropped on the board, {lost} lost on the way")
+    print(f"{'samples':>8} {'%':>6} {'isr%':>5}  function")
+    for name, n in hits.most_common(args.top):
+        print(f"{n:8d} {100.0 * n / total:6.2f} "
+              f"{100.0 * in_handler[name] / n:5.0f}  {name}")
+    if args.callers:
+        print()
+        print(f"{'samples':>8} {'%':>6}  function <- caller (LR)")
+        for (name, caller), n in callers.most_common(args.top):
+            print(f"{n:8d} {100.0 * n / total:6.2f}  {name} <- {caller}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""
+Collect benchmark result records from the gateway and compare revisions.
+
+Every benchmark (microbench, the loopback and time-sync benches, the
+profiler report) and every Nth health summary goes out as one
+TELEMETRY_RESULT_MAGIC frame on USB and the UART link: the firmware git
+hash and clock setup it ran with, then its metrics. This appends each one
+as a JSON line to a results file, with the metrics named, the host time
+and a board label, so runs of different firmware revisions and board
+setups end up side by side.
+
+Usage
+  ./result_collect.py /dev/ttyACM0 -o results.jsonl --board bench-a
+  ./result_collect.py usb_capture.bin -o results.jsonl
+    (frames from a raw CDC byte stream recorded earlier)
+  -s stops after that many seconds (default: until the port closes)
+  ./result_collect.py --compare results.jsonl 1a2b3c4d 5e6f7a8b
+    mean of each metric per benchmark under the second revision against
+    the first, worst change first; --board / --source narrow it down
+"""
+from __future__ import annotations
+
+import argparse
+import json
+import re
+import struct
+import sys
+import time
+from collections import defaultdict
+from pathlib import Path
+
+from cdc_link import frames, open_port
+
+RES_MAGIC = bytes([0xC5]) + b"RES"
+RES_VERSION = 1
+HEADER = struct.Struct("<4sBBBBIIIIIIHH")
+F_DIRTY = 0x01
+F_LOOPBACK = 0x02
+
+
+def health_fields() -> list[str]:
+    """TELEMETRY_HEALTH_FIELDS from telemetry_wire.h next to this script."""
+    wire = Path(__file__).resolve().parent / "Core/Inc/telemetry_wire.h"
+    try:
+        text = wire.read_text()
+    except OSError:
+        return []
+    m = re.search(r"#define TELEMETRY_HEALTH_FIELDS((?:.*\\\n)*.*)", text)
+    return re.findall(r"\w+", m[1].replace("\\", "")) if m else []
+
+
+SOURCES = {
+    1: ("micro", ["n", "min", "mean", "max", "skipped"]),
+    2: ("loopback", ["size", "rate_hz", "run_ms", "sent", "refused",
+                     "received", "lost", "reordered", "goodput_Bps",
+                     "lat_p50_us", "lat_p90_us", "lat_p99_us", "lat_max_us",
+                     "cpu_pct"]),
+    3: ("timesync", ["locked", "converge_ms", "pulses", "steady_samples",
+                     "steady_max_us", "frames_per_s", "bytes_per_s"]
+                    + [f"hist{i}" for i in range(8)]),
+    4: ("profiler", ["count", "min_ns", "mean_ns", "max_ns"]
+                    + [f"hist{i}" for i in range(16)]),
+    5: ("health", health_fields()),
+}
+
+
+def decode(f: bytes) -> dict | None:
+    """A result frame as a dict, None if `f` is not one."""
+    if f[:4] != RES_MAGIC or len(f) < HEADER.size:
+        return None
+    (_, ver, src, name_len, count, git, flags, core_hz, can_nom, can_data,
+     uptime_ms, node, _) = HEADER.unpack_from(f)
+    if ver != RES_VERSION or len(f) < HEADER.size + name_len + 4 * count:
+        return None
+    off = HEADER.size + name_len
+    values = list(struct.unpack_from(f"<{count}I", f, off))
+    source, names = SOURCES.get(src, (str(src), []))
+    if len(names) < count:
+        names = names + [f"m{i}" for i in range(len(names), count)]
+    return {
+        "source": source,
+        "name": f[HEADER.size:off].decode(errors="replace"),
+        "git": f"{git:08x}",
+        "dirty": bool(flags & F_DIRTY),
+        "loopback": bool(flags & F_LOOPBACK),
+        "core_hz": core_hz,
+        "can_nominal": can_nom,
+        "can_data": can_data,
+        "node": node,
+        "uptime_ms": uptime_ms,
+        "metrics": dict(zip(names, values)),
+    }
+
+
+def collect(args: argparse.Namespace) -> int:
+    fd = open_port(args.port, read_only=True)
+    n = 0
+    deadline = time.monotonic() + args.seconds if args.seconds else None
+    with open(args.output, "a") as out:
+        for f in frames(fd):
+            if (r := decode(f)) is not None:
+                r = {"host_time": round(time.time(), 3),
+                     "board": args.board, **r}
+                out.write(json.dumps(r) + "\n")
+                out.flush()
+                n += 1
+                print(f"{r['source']:9} {r['name']:24} {r['git']}"
+                      f"{'+' if r['dirty'] else ''}")
+            if deadline is not None and time.monotonic() >= deadline:
+                break
+    print(f"{n} records appended to {args.output}")
+    return 0
+
+
+def compare(args: argparse.Namespace) -> int:
+    path, base, new = args.compare
+    # (source, name, board, clock setup) -> revision -> metric -> values
+    runs: dict[tuple, dict[str, dict[str, list[int]]]] = defaultdict(
+        lambda: defaultdict(lambda: defaultdict(list)))
+    for line in Path(path).read_text().splitlines():
+        r = json.loads(line)
+        if args.board and r.get("board") != args.board:
+            continue
+        if args.source and r["source"] != args.source:
+            continue
+        rev = (base if r["git"].startswith(base)
+               else new if r["git"].startswith(new) else None)
+        if rev is None:
+            continue
+        key = (r["source"], r["name"], r.get("board", ""),
+               r["core_hz"], r["can_nominal"], r["can_data"])
+        for k, v in r["metrics"].items():
+            runs[key][rev][k].append(v)
+
+    rows = []
+    for key, revs in runs.items():
+        if base not in revs or new not in revs:
+            continue
+        for k, old_v in revs[base].items():
+            new_v = revs[new].get(k)
+            if not new_v:
+                continue
+            a, b = sum(old_v) / len(old_v), sum(new_v) / len(new_v)
+            ratio = b / a if a else (1.0 if b == 0 else float("inf"))
+            rows.append((abs(ratio - 1.0), key, k, a, b, ratio))
+    if not rows:
+        print(f"no benchmark ran under both {base} and {new}")
+        return 1
+    rows.sort(key=lambda r: r[0], reverse=True)
+    print(f"{'source':9} {'name':24} {'board':10} {'metric':16} "
+          f"{base[:8]:>12} {new[:8]:>12} {'ratio':>7}")
+    for _, key, k, a, b, ratio in rows[:args.top]:
+        print(f"{key[0]:9} {key[1]:24} {key[2] or '-':10} {k:16} "
+              f"{a:12.1f} {b:12.1f} {ratio:7.3f}")
+    return 0
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", type=Path, nargs="?")
+    ap.add_argument("-o", "--output", type=Path, default=Path("results.jsonl"))
+    ap.add_argument("-s", "--seconds", type=float, default=0.0)
+    ap.add_argument("--board", default="",
+                    help="label for the board setup the records came from")
+    ap.add_argument("--compare", nargs=3, metavar=("FILE", "BASE", "NEW"),
+                    help="compare two git hashes (prefixes) in FILE")
+    ap.add_argument("--source", choices=[s for s, _ in SOURCES.values()])
+    ap.add_argument("--top", type=int, default=60)
+    args = ap.parse_args(argv[1:])
+
+    if args.compare:
+        return compare(args)
+    if args.port is None:
+        ap.error("a port or capture file is needed unless --compare")
+    return collect(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
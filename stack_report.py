@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""
+Recommend a stack size for each thread from the compiler's call graph.
+
+Reads the .ci files GCC writes with -fcallgraph-info=su (CMake option
+ENABLE_STACK_REPORT) and takes, for each thread entry, the deepest chain of
+static frames below it, plus room for the context ThreadX saves on the
+thread's stack and a margin. What the graph can't bound is listed next to
+the figure: recursion, calls through pointers, dynamic frames (VLAs,
+alloca) and functions without a call graph (newlib, the Rust library).
+Compare with the run-time high-water marks ("stack ..." text lines).
+
+Usage
+  ./stack_report.py build/Debug
+  ./stack_report.py build/Debug -v    (list what each thread can't bound)
+"""
+from __future__ import annotations
+
+import argparse
+import re
+import sys
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent
+
+# Thread, entry function, where its stack size is defined.
+THREADS = [
+    ("Telemetry RX", "telemetry_rx_thread_entry",
+     "Core/Inc/mem_budget.h", "TELEMETRY_RX_STACK_SIZE"),
+    ("Telemetry TX", "telemetry_tx_thread_entry",
+     "Core/Inc/mem_budget.h", "TELEMETRY_TX_STACK_SIZE"),
+    ("Telemetry Maint", "telemetry_maint_thread_entry",
+     "Core/Inc/mem_budget.h", "TELEMETRY_MAINT_STACK_SIZE"),
+    ("Telemetry Sched", "telemetry_sched_thread_entry",
+     "Core/Inc/mem_budget.h", "TELEMETRY_SCHED_STACK_SIZE"),
+    ("CPU Load", "cpu_load_thread_entry",
+     "Core/Inc/mem_budget.h", "CPU_LOAD_THREAD_STACK_SIZE"),
+    ("Bench", "telemetry_bench_thread_entry",
+     "Core/Inc/mem_budget.h", "TELEMETRY_BENCH_STACK_SIZE"),
+    ("Bench Idle", "telemetry_bench_spin_entry",
+     "Core/Inc/mem_budget.h", "TELEMETRY_BENCH_SPIN_STACK_SIZE"),
+    ("I2C Bus", "i2c_bus_thread_entry",
+     "Core/Inc/mem_budget.h", "I2C_BUS_THREAD_STACK_SIZE"),
+    ("DSP Filter", "dsp_filter_thread_entry",
+     "Core/Inc/mem_budget.h", "DSP_FILTER_THREAD_STACK_SIZE"),
+    ("SD Log", "sd_log_thread_entry",
+     "Core/Inc/mem_budget.h", "SD_LOG_THREAD_STACK_SIZE"),
+    ("USBX", "app_ux_device_thread_entry",
+     "USBX/App/app_usbx_device.h", "UX_DEVICE_APP_THREAD_STACK_SIZE"),
+    ("Timer", "_tx_timer_thread_entry",
+     "Middlewares/ST/threadx/ports/cortex_m4/gnu/inc/tx_port.h",
+     "TX_TIMER_THREAD_STACK_SIZE"),
+]
+
+# Saved on the thread's stack at a switch: the exception frame with the FPU
+# state (26 words), s16-s31 and r4-r11 / lr. Handlers run on the MSP.
+SWITCH_FRAME = 26 * 4 + 16 * 4 + 9 * 4
+MARGIN_PCT = 25
+
+NODE = re.compile(r'node:\s*\{\s*title:\s*"([^"]+)"\s*label:\s*"([^"]*)"')
+EDGE = re.compile(r'edge:\s*\{\s*sourcename:\s*"([^"]+)"\s*targetname:\s*"([^"]+)"')
+FRAME = re.compile(r"\\n(\d+) bytes \(([a-z,]+)\)")
+
+
+class Graph:
+    def __init__(self) -> None:
+        self.frame: dict[str, int] = {}
+        self.kind: dict[str, str] = {}
+        self.calls: dict[str, set[str]] = {}
+
+    def load(self, ci: Path) -> None:
+        text = ci.read_text(errors="replace")
+        for title, label in NODE.findall(text):
+            m = FRAME.search(label)
+            if m:  # defined here; external nodes carry no frame
+                self.frame[title] = int(m.group(1))
+                self.kind[title] = m.group(2)
+                self.calls.setdefault(title, set())
+        for src, dst in EDGE.findall(text):
+            self.calls.setdefault(src, set()).add(dst)
+
+    def resolve(self, name: str) -> str | None:
+        if name in self.frame:
+            return name
+        # static functions are titled "file.c:name" in some GCC versions
+        hits = [t for t in self.frame if t.rsplit(":", 1)[-1] == name]
+        return hits[0] if len(hits) == 1 else None
+
+    def depth(self, fn: str, unbounded: set[str],
+              memo: dict[str, int], path: set[str]) -> int:
+        if fn in memo:
+            return memo[fn]
+        if fn in path:
+            unbounded.add(f"recursion in {fn}")
+            return 0
+        if "dynamic" in self.kind.get(fn, "") and \
+                "bounded" not in self.kind[fn]:
+            unbounded.add(f"dynamic frame in {fn}")
+        path.add(fn)
+        deepest = 0
+        for callee in self.calls.get(fn, ()):
+            if callee == "__indirect_call":
+                unbounded.add(f"indirect call in {fn}")
+                continue
+            r = self.resolve(callee)
+            if r is None:
+                unbounded.add(f"no call graph for {callee}")
+                continue
+            deepest = max(deepest, self.depth(r, unbounded, memo, path))
+        path.discard(fn)
+        memo[fn] = self.frame.get(fn, 0) + deepest
+        return memo[fn]
+
+
+def configured(src: str, macro: str) -> int | None:
+    p = ROOT / src
+    if not p.exists():
+        return None
+    m = re.search(rf"#define\s+{macro}\s+\(?(\d+)", p.read_text(errors="replace"))
+    return int(m.group(1)) if m else None
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("build", type=Path)
+    ap.add_argument("-v", "--verbose", action="store_true")
+    args = ap.parse_args(argv[1:])
+
+    files = sorted(args.build.rglob("*.ci"))
+    if not files:
+        print(f"{args.build}: no .ci files (configure with "
+              "-DENABLE_STACK_REPORT=ON)", file=sys.stderr)
+        return 1
+    g = Graph()
+    for ci in files:
+        g.load(ci)
+
+    print(f"{'thread':<16} {'static':>7} {'recommend':>9} {'config':>7}  notes")
+    for name, entry, src, macro in THREADS:
+        fn = g.resolve(entry)
+        if fn is None:
+            continue  # not in this build
+        unbounded: set[str] = set()
+        deep = g.depth(fn, unbounded, {}, set())
+        need = (deep + SWITCH_FRAME) * (100 + MARGIN_PCT) // 100
+        need = (need + 63) // 64 * 64
+        have = configured(src, macro)
+        note = []
+        if have is not None and need > have:
+            note.append("TOO SMALL")
+        elif have is not None and have - need >= 512:
+            note.append(f"{have - need} spare")
+        if unbounded:
+            note.append(f"{len(unbounded)} unbounded")
+        print(f"{name:<16} {deep:>7} {need:>9} "
+              f"{have if have is not None else '?':>7}  {', '.join(note)}")
+        if args.verbose:
+            for u in sorted(unbounded):
+                print(f"{'':<18}{u}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -64,6 +64,8 @@ Reset_Handler:
   
 /* Call the clock system initialization function.*/
     bl  SystemInit
+/* Start the boot clock (and in fast boot the PLL) before the copies below. */
+    bl  boot_early_init
 
 /* Copy the data segment initializers from flash to SRAM */
   ldr r0, =_sdata
@@ -96,6 +98,36 @@ LoopFillZerobss:
   cmp r2, r4
   bcc FillZerobss
 
+/* Copy CCM SRAM code and data from flash, then zero its bss. */
+  ldr r0, =_sccmram
+  ldr r1, =_eccmram
+  ldr r2, =_siccmram
+  movs r3, #0
+  b LoopCopyCcmInit
+
+CopyCcmInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyCcmInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyCcmInit
+
+  ldr r2, =_sccmbss
+  ldr r4, =_eccmbss
+  movs r3, #0
+  b LoopFillZeroCcm
+
+FillZeroCcm:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillZeroCcm:
+  cmp r2, r4
+  bcc FillZeroCcm
+
 /* Call static constructors */
     bl __libc_init_array
 /* Call the application's entry point.*/
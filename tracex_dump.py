@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Pull the ThreadX event trace off the gateway over USB into a TraceX file.
+
+Sends TELEMETRY_USB_CTRL_TRACEX_DUMP on the CDC port, then collects the
+TELEMETRY_TRACEX_MAGIC frames (offset, buffer size, bytes) until the whole
+buffer is in and writes it out as it is: TraceX opens it directly. Router
+packets and other frames on the port are skipped.
+
+Usage
+  ./tracex_dump.py /dev/ttyACM0 gateway.trx
+  ./tracex_dump.py --no-request usb_capture.bin gateway.trx
+    (frames from a raw CDC byte stream recorded earlier)
+"""
+from __future__ import annotations
+
+import argparse
+import sys
+from pathlib import Path
+
+from cdc_link import ctrl_reply, frames, open_port, send_ctrl
+
+TRX_MAGIC = bytes([0xC5]) + b"TRX"
+OP_TRACEX_DUMP = 0x10
+STATUS = {0: "ok", 1: "tracing not built in", 4: "a dump is already running"}
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("port", type=Path)
+    ap.add_argument("out", type=Path)
+    ap.add_argument("--no-request", action="store_true",
+                    help="read frames only, don't send the dump command")
+    args = ap.parse_args(argv[1:])
+
+    fd = open_port(args.port, read_only=args.no_request)
+    if not args.no_request:
+        send_ctrl(fd, OP_TRACEX_DUMP)
+
+    image: bytearray | None = None
+    have: set[int] = set()
+    for f in frames(fd):
+        if (st := ctrl_reply(f, OP_TRACEX_DUMP)) is not None:
+            if st:
+                print(f"refused: {STATUS.get(st, st)}", file=sys.stderr)
+                return 1
+            continue
+        if f[:4] != TRX_MAGIC or len(f) < 12:
+            continue
+        off = int.from_bytes(f[4:8], "little")
+        size = int.from_bytes(f[8:12], "little")
+        if image is None or len(image) != size:
+            image, have = bytearray(size), set()  # a new dump
+        image[off:off + len(f) - 12] = f[12:]
+        have.update(range(off, off + len(f) - 12))
+        if len(have) >= size:
+            args.out.write_bytes(image)
+            print(f"{args.out}: {size} bytes")
+            return 0
+    print("stream ended before the dump was complete", file=sys.stderr)
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""
+Send control ops on the gateway's USB command pipe and time the replies.
+
+The command pipe (ENABLE_USB_CMD_EP, Core/Inc/usb_cdc.h) is a vendor
+interface with interrupt endpoints next to the CDC port: the same control
+frames as on the port (TELEMETRY_USB_CTRL_* in Core/Inc/telemetry_wire.h),
+unencoded, one per transfer. Replies come back on it unless they are too
+long for it, then on the CDC port. Needs pyusb and access to the device.
+
+Usage
+  ./usb_cmd.py                         TALKERS without clearing, once
+  ./usb_cmd.py --op 0x0C --repeat 200  CONFIG_GET, round-trip stats
+  ./usb_cmd.py --op 0x01 --args 0a000a000000
+  --vid/--pid pick the device (default: the ST VCP or candleLight IDs)
+"""
+from __future__ import annotations
+
+import argparse
+import sys
+import time
+
+import usb.core
+import usb.util
+
+from cdc_link import CTRL_MAGIC
+
+DEVICES = [(0x0483, 0x5740), (0x1D50, 0x606F)]
+OP_TALKERS = 0x1D
+MPS = 64
+
+
+def find_pipe(dev):
+    """The vendor interface whose endpoints are interrupt ones."""
+    for intf in dev.get_active_configuration():
+        if intf.bInterfaceClass != 0xFF:
+            continue
+        eps = list(intf)
+        if eps and all(usb.util.endpoint_type(e.bmAttributes)
+                       == usb.util.ENDPOINT_TYPE_INTR for e in eps):
+            ep_out = next(e for e in eps if usb.util.endpoint_direction(
+                e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+            ep_in = next(e for e in eps if usb.util.endpoint_direction(
+                e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+            return intf, ep_out, ep_in
+    return None
+
+
+def send(ep_out, frame: bytes) -> None:
+    ep_out.write(frame)
+    if len(frame) % MPS == 0:
+        ep_out.write(b"")  # the frame ends on a short packet
+
+
+def recv(ep_in, timeout_ms: int) -> bytes:
+    out = bytearray()
+    while True:
+        chunk = bytes(ep_in.read(MPS, timeout=timeout_ms))
+        out += chunk
+        if len(chunk) < MPS:
+            return bytes(out)
+
+
+def main(argv: list[str]) -> int:
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("--op", type=lambda s: int(s, 0), default=OP_TALKERS)
+    ap.add_argument("--args", type=bytes.fromhex, default=None,
+                    help="payload as hex (default: 00 for TALKERS)")
+    ap.add_argument("--repeat", type=int, default=1)
+    ap.add_argument("--timeout", type=int, default=500, help="ms per reply")
+    ap.add_argument("--vid", type=lambda s: int(s, 0))
+    ap.add_argument("--pid", type=lambda s: int(s, 0))
+    args = ap.parse_args(argv[1:])
+
+    ids = [(args.vid, args.pid)] if args.vid is not None else DEVICES
+    dev = next((d for v, p in ids
+                if (d := usb.core.find(idVendor=v, idProduct=p))), None)
+    if dev is None:
+        print("no gateway on USB", file=sys.stderr)
+        return 1
+    found = find_pipe(dev)
+    if found is None:
+        print("no command pipe (built without ENABLE_USB_CMD_EP?)",
+              file=sys.stderr)
+        return 1
+    intf, ep_out, ep_in = found
+    usb.util.claim_interface(dev, intf.bInterfaceNumber)
+
+    payload = args.args
+    if payload is None:
+        payload = b"\0" if args.op == OP_TALKERS else b""
+    frame = CTRL_MAGIC + bytes([args.op]) + payload
+    times = []
+    for _ in range(args.repeat):
+        t0 = time.perf_counter()
+        send(ep_out, frame)
+        try:
+            reply = recv(ep_in, args.timeout)
+        except usb.core.USBTimeoutError:
+            print("no reply on the pipe (too long for it? see the CDC port)",
+                  file=sys.stderr)
+            return 1
+        times.append((time.perf_counter() - t0) * 1000.0)
+        if reply[:4] != CTRL_MAGIC or len(reply) < 6 or reply[4] != args.op | 0x80:
+            print(f"unexpected reply: {reply.hex()}", file=sys.stderr)
+            return 1
+
+    print(f"op 0x{args.op:02x} status {reply[5]} ({len(reply)} bytes)")
+    if args.repeat > 1:
+        times.sort()
+        print(f"round trip ms: min {times[0]:.2f} "
+              f"median {times[len(times) // 2]:.2f} max {times[-1]:.2f}")
+    else:
+        print(f"round trip {times[0]:.2f} ms")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))